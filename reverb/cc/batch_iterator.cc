@@ -0,0 +1,105 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/batch_iterator.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/sampler.h"
+#include "tensorflow/core/framework/tensor.h"
+
+namespace deepmind {
+namespace reverb {
+
+absl::Status BatchIterator::Options::Validate() const {
+  if (batch_size < 1) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("batch_size (", batch_size, ") must be >= 1"));
+  }
+  if (num_batching_threads < 1) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "num_batching_threads (", num_batching_threads, ") must be >= 1"));
+  }
+  if (num_prefetched_batches < 1) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "num_prefetched_batches (", num_prefetched_batches, ") must be >= 1"));
+  }
+  return absl::OkStatus();
+}
+
+BatchIterator::BatchIterator(std::unique_ptr<Sampler> sampler,
+                             const Options& options)
+    : sampler_(std::move(sampler)),
+      batch_size_(options.batch_size),
+      batches_(options.num_prefetched_batches),
+      num_running_batchers_(options.num_batching_threads) {
+  REVERB_CHECK_OK(options.Validate());
+  for (int i = 0; i < options.num_batching_threads; i++) {
+    batching_threads_.push_back(internal::StartThread(
+        absl::StrCat("BatchIterator_", i), [this] { RunBatcher(); }));
+  }
+}
+
+BatchIterator::~BatchIterator() { Close(); }
+
+absl::Status BatchIterator::GetNext(std::vector<tensorflow::Tensor>* batch) {
+  if (batches_.Pop(batch)) return absl::OkStatus();
+
+  absl::MutexLock lock(&mu_);
+  if (closed_) {
+    return absl::CancelledError("BatchIterator has been closed.");
+  }
+  return status_;
+}
+
+void BatchIterator::Close() {
+  {
+    absl::MutexLock lock(&mu_);
+    if (closed_) return;
+    closed_ = true;
+  }
+  batches_.Close();
+  sampler_->Close();
+  batching_threads_.clear();  // Joins the threads.
+}
+
+void BatchIterator::RunBatcher() {
+  while (true) {
+    std::vector<tensorflow::Tensor> batch;
+    if (auto status = sampler_->GetNextBatch(batch_size_, &batch);
+        !status.ok()) {
+      absl::MutexLock lock(&mu_);
+      if (status_.ok()) status_ = std::move(status);
+      break;
+    }
+    if (!batches_.Push(std::move(batch))) break;
+  }
+
+  absl::MutexLock lock(&mu_);
+  if (--num_running_batchers_ == 0) {
+    batches_.SetLastItemPushed();
+  }
+}
+
+}  // namespace reverb
+}  // namespace deepmind
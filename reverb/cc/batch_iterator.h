@@ -0,0 +1,111 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_BATCH_ITERATOR_H_
+#define REVERB_CC_BATCH_ITERATOR_H_
+
+#include <memory>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/sampler.h"
+#include "reverb/cc/support/queue.h"
+#include "tensorflow/core/framework/tensor.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Assembles batches of trajectories (see `Sampler::GetNextBatch`) from a
+// `Sampler` on background threads so batches are ready by the time the
+// consumer asks for them. Consumers which don't run a `tf.data` pipeline (e.g
+// JAX learners fed from Python) thus get the same overlap of sampling,
+// decoding and batching with the training step as the datasets.
+class BatchIterator {
+ public:
+  struct Options {
+    // Number of trajectories in each batch. Must be >= 1.
+    int batch_size = 1;
+
+    // Number of threads which assemble batches concurrently. Must be >= 1.
+    //
+    // The threads pop the samples of their batches concurrently so when more
+    // than one thread is used, the sampler must not have a `max_samples`
+    // limit. The last samples could otherwise be spread over the partial
+    // batches of several threads, none of which ever completes.
+    int num_batching_threads = 1;
+
+    // Maximum number of complete batches waiting to be returned by `GetNext`.
+    // Must be >= 1.
+    int num_prefetched_batches = 2;
+
+    // Checks that field values are valid and returns `InvalidArgument` if any
+    // field value invalid.
+    absl::Status Validate() const;
+  };
+
+  // Starts the batching threads. `options` must be valid.
+  BatchIterator(std::unique_ptr<Sampler> sampler, const Options& options);
+
+  // Closes the iterator and joins the batching threads.
+  ~BatchIterator();
+
+  // Blocks until a batch is ready and moves it into `batch`. Batches consist of
+  // 4+K tensors with a leading dimension of size `batch_size` (see
+  // `Sampler::GetNextBatch`).
+  //
+  // Once the sampler fails (e.g because `max_samples` have been returned) the
+  // batches which are already complete are still returned before the error.
+  // Returns `CancelledError` once `Close` has been called.
+  absl::Status GetNext(std::vector<tensorflow::Tensor>* batch);
+
+  // Closes the sampler, unblocks all pending and future calls to `GetNext` and
+  // joins the batching threads.
+  void Close() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // BatchIterator is neither copyable nor movable.
+  BatchIterator(const BatchIterator&) = delete;
+  BatchIterator& operator=(const BatchIterator&) = delete;
+
+ private:
+  // Pushes batches to `batches_` until the sampler fails or the queue is
+  // closed.
+  void RunBatcher() ABSL_LOCKS_EXCLUDED(mu_);
+
+  const std::unique_ptr<Sampler> sampler_;
+  const int batch_size_;
+
+  internal::Queue<std::vector<tensorflow::Tensor>> batches_;
+
+  absl::Mutex mu_;
+
+  // Number of batching threads which haven't returned yet. The last one marks
+  // `batches_` as complete so `GetNext` stops blocking once it is drained.
+  int num_running_batchers_ ABSL_GUARDED_BY(mu_);
+
+  // First error returned by the sampler.
+  absl::Status status_ ABSL_GUARDED_BY(mu_);
+
+  bool closed_ ABSL_GUARDED_BY(mu_) = false;
+
+  std::vector<std::unique_ptr<internal::Thread>> batching_threads_;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_BATCH_ITERATOR_H_
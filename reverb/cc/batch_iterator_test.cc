@@ -0,0 +1,142 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/batch_iterator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/sampler.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using ::testing::SizeIs;
+using ::testing::UnorderedElementsAre;
+
+std::shared_ptr<Table> MakeTable(int num_items) {
+  auto table = std::make_shared<Table>(
+      /*name=*/"queue",
+      /*sampler=*/std::make_shared<FifoSelector>(),
+      /*remover=*/std::make_shared<FifoSelector>(),
+      /*max_size=*/100,
+      /*max_times_sampled=*/1,
+      /*rate_limiter=*/std::make_shared<RateLimiter>(1, 1, 0, 100));
+  for (int i = 1; i <= num_items; i++) {
+    ChunkData chunk =
+        testing::MakeChunkData(i, testing::MakeSequenceRange(i, 0, 1));
+    TableItem item;
+    item.item = testing::MakePrioritizedItem(i, 1.0, {chunk});
+    item.chunks.push_back(std::make_shared<ChunkStore::Chunk>(chunk));
+    REVERB_EXPECT_OK(table->InsertOrAssign(std::move(item)));
+  }
+  return table;
+}
+
+std::unique_ptr<Sampler> MakeSampler(std::shared_ptr<Table> table,
+                                     int64_t max_samples) {
+  Sampler::Options options;
+  options.max_samples = max_samples;
+  return absl::make_unique<Sampler>(std::move(table), options);
+}
+
+TEST(BatchIteratorTest, ReturnsBatchesBeforeSamplerError) {
+  BatchIterator::Options options;
+  options.batch_size = 3;
+  BatchIterator iterator(MakeSampler(MakeTable(6), /*max_samples=*/6),
+                         options);
+
+  std::vector<uint64_t> keys;
+  for (int i = 0; i < 2; i++) {
+    std::vector<tensorflow::Tensor> batch;
+    REVERB_ASSERT_OK(iterator.GetNext(&batch));
+    ASSERT_THAT(batch, SizeIs(5));
+    EXPECT_EQ(batch[0].shape(), tensorflow::TensorShape({3}));
+    EXPECT_EQ(batch[4].shape(), tensorflow::TensorShape({3, 2, 10}));
+    for (int j = 0; j < 3; j++) {
+      keys.push_back(batch[0].flat<tensorflow::uint64>()(j));
+    }
+  }
+  EXPECT_THAT(keys, UnorderedElementsAre(1, 2, 3, 4, 5, 6));
+
+  // All samples have been returned so the sampler fails.
+  std::vector<tensorflow::Tensor> batch;
+  EXPECT_EQ(iterator.GetNext(&batch).code(), absl::StatusCode::kOutOfRange);
+}
+
+TEST(BatchIteratorTest, BatchesConcurrently) {
+  BatchIterator::Options options;
+  options.batch_size = 3;
+  options.num_batching_threads = 2;
+  // Each thread might hold on to a partial batch of 2 samples.
+  BatchIterator iterator(
+      MakeSampler(MakeTable(3 * 3 + 2 * 2), Sampler::kUnlimitedMaxSamples),
+      options);
+
+  std::vector<uint64_t> keys;
+  for (int i = 0; i < 3; i++) {
+    std::vector<tensorflow::Tensor> batch;
+    REVERB_ASSERT_OK(iterator.GetNext(&batch));
+    ASSERT_THAT(batch, SizeIs(5));
+    for (int j = 0; j < 3; j++) {
+      keys.push_back(batch[0].flat<tensorflow::uint64>()(j));
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+  EXPECT_EQ(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+TEST(BatchIteratorTest, CloseUnblocksBatchers) {
+  // The table is empty so the batching threads block until closed.
+  BatchIterator iterator(
+      MakeSampler(MakeTable(0), Sampler::kUnlimitedMaxSamples), {});
+  iterator.Close();
+
+  std::vector<tensorflow::Tensor> batch;
+  EXPECT_EQ(iterator.GetNext(&batch).code(), absl::StatusCode::kCancelled);
+}
+
+TEST(BatchIteratorOptionsTest, Validate) {
+  BatchIterator::Options options;
+  REVERB_EXPECT_OK(options.Validate());
+  options.batch_size = 0;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+  options.batch_size = 1;
+  options.num_batching_threads = 0;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+  options.num_batching_threads = 1;
+  options.num_prefetched_batches = 0;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
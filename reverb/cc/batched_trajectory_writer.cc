@@ -0,0 +1,151 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/batched_trajectory_writer.h"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "reverb/cc/chunker.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/trajectory_writer.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_util.h"
+
+namespace deepmind {
+namespace reverb {
+
+BatchedTrajectoryWriter::BatchedTrajectoryWriter(
+    std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
+    int num_envs, const TrajectoryWriter::Options& options)
+    : num_envs_(num_envs),
+      writer_(absl::make_unique<TrajectoryWriter>(std::move(stub), options)) {
+  REVERB_CHECK_GT(num_envs_, 0);
+  episodes_.reserve(num_envs_);
+  for (int i = 0; i < num_envs_; i++) {
+    episodes_.push_back({key_generator_.Generate(), 0});
+  }
+}
+
+absl::Status BatchedTrajectoryWriter::Append(
+    std::vector<absl::optional<tensorflow::Tensor>> data,
+    std::vector<std::vector<absl::optional<std::weak_ptr<CellRef>>>>* refs) {
+  for (int column = 0; column < data.size(); column++) {
+    if (data[column].has_value() &&
+        (data[column]->dims() == 0 ||
+         data[column]->dim_size(0) != num_envs_)) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Column ", column, " has shape ", data[column]->shape().DebugString(),
+          " but the first dimension must be the number of environments (",
+          num_envs_, ")."));
+    }
+  }
+  num_columns_ = std::max<int>(num_columns_, data.size());
+
+  // Split the columns into one column per environment. Slicing the first
+  // dimension does not copy the data unless the row isn't aligned.
+  std::vector<absl::optional<tensorflow::Tensor>> env_data(data.size() *
+                                                           num_envs_);
+  std::vector<CellRef::EpisodeInfo> episode_infos(env_data.size());
+  for (int column = 0; column < data.size(); column++) {
+    for (int env = 0; env < num_envs_; env++) {
+      const int writer_column = WriterColumn(column, env);
+      episode_infos[writer_column] = episodes_[env];
+      if (!data[column].has_value()) continue;
+
+      tensorflow::Tensor row = data[column]->SubSlice(env);
+      if (!row.IsAligned()) {
+        row = tensorflow::tensor::DeepCopy(row);
+      }
+      env_data[writer_column] = std::move(row);
+    }
+  }
+
+  std::vector<absl::optional<std::weak_ptr<CellRef>>> env_refs;
+  REVERB_RETURN_IF_ERROR(writer_->AppendToChunkers(std::move(env_data),
+                                                   episode_infos, &env_refs));
+
+  refs->assign(num_envs_, {});
+  for (int env = 0; env < num_envs_; env++) {
+    (*refs)[env].reserve(data.size());
+    for (int column = 0; column < data.size(); column++) {
+      (*refs)[env].push_back(std::move(env_refs[WriterColumn(column, env)]));
+    }
+    episodes_[env].step++;
+  }
+
+  return absl::OkStatus();
+}
+
+absl::Status BatchedTrajectoryWriter::CreateItem(
+    absl::string_view table, double priority,
+    absl::Span<const TrajectoryColumn> trajectory) {
+  return writer_->CreateItem(table, priority, trajectory);
+}
+
+absl::Status BatchedTrajectoryWriter::EndEpisode(int env, bool clear_buffers) {
+  if (env < 0 || env >= num_envs_) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Environment ", env, " is out of range [0, ", num_envs_, ")."));
+  }
+
+  std::vector<int> columns(num_columns_);
+  for (int column = 0; column < num_columns_; column++) {
+    columns[column] = WriterColumn(column, env);
+  }
+  REVERB_RETURN_IF_ERROR(writer_->EndColumnEpisodes(columns, clear_buffers));
+
+  episodes_[env] = {key_generator_.Generate(), 0};
+  return absl::OkStatus();
+}
+
+absl::Status BatchedTrajectoryWriter::Flush(int ignore_last_num_items,
+                                            absl::Duration timeout) {
+  return writer_->Flush(ignore_last_num_items, timeout);
+}
+
+void BatchedTrajectoryWriter::Close() { writer_->Close(); }
+
+absl::Status BatchedTrajectoryWriter::ConfigureChunker(
+    int column, const std::shared_ptr<ChunkerOptions>& options) {
+  for (int env = 0; env < num_envs_; env++) {
+    REVERB_RETURN_IF_ERROR(
+        writer_->ConfigureChunker(WriterColumn(column, env), options));
+  }
+  return absl::OkStatus();
+}
+
+int BatchedTrajectoryWriter::num_envs() const { return num_envs_; }
+
+int BatchedTrajectoryWriter::episode_step(int env) const {
+  return episodes_[env].step;
+}
+
+int BatchedTrajectoryWriter::WriterColumn(int column, int env) const {
+  return column * num_envs_ + env;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
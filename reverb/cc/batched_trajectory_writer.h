@@ -0,0 +1,120 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_BATCHED_TRAJECTORY_WRITER_H_
+#define REVERB_CC_BATCHED_TRAJECTORY_WRITER_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "reverb/cc/chunker.h"
+#include "reverb/cc/reverb_service.grpc.pb.h"
+#include "reverb/cc/support/key_generators.h"
+#include "reverb/cc/trajectory_writer.h"
+#include "tensorflow/core/framework/tensor.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Writes the trajectories of a batch of (vectorized) environments which are
+// stepped together. Every column passed to `Append` holds the data of all the
+// environments stacked along the first dimension, i.e `[num_envs, ...]`, which
+// removes the overhead of calling `Append` once per environment.
+//
+// Each environment has its own episode and its own chunker for every column,
+// so chunks never mix the data of different environments. All the environments
+// share a single `TrajectoryWriter` and thus a single gRPC stream to the
+// server.
+//
+// Like `TrajectoryWriter`, none of the methods (except `Close`) are thread
+// safe.
+class BatchedTrajectoryWriter {
+ public:
+  BatchedTrajectoryWriter(
+      std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
+      int num_envs, const TrajectoryWriter::Options& options);
+
+  // Appends one step for each of the environments. Every provided column (i.e
+  // not absl::nullopt) must have `num_envs` as its first dimension, and row
+  // `i` is appended to the episode of environment `i`. The episode step of
+  // every environment is incremented.
+  //
+  // `refs` is resized to `num_envs` and `(*refs)[i]` holds the references to
+  // the data of environment `i`, in the same format as
+  // `TrajectoryWriter::Append`.
+  absl::Status Append(
+      std::vector<absl::optional<tensorflow::Tensor>> data,
+      std::vector<std::vector<absl::optional<std::weak_ptr<CellRef>>>>* refs);
+
+  // See `ColumnWriter::CreateItem`. The trajectory can reference the data of
+  // any of the environments.
+  absl::Status CreateItem(absl::string_view table, double priority,
+                          absl::Span<const TrajectoryColumn> trajectory);
+
+  // Finalizes the chunks of environment `env` and starts a new episode for it.
+  // If `clear_buffers` is true then the existing `CellRef`s of the environment
+  // can no longer be referenced by new items. Unlike
+  // `TrajectoryWriter::EndEpisode`, this does not wait for pending items to be
+  // confirmed as the other environments are still running. Use `Flush` for
+  // that.
+  absl::Status EndEpisode(int env, bool clear_buffers);
+
+  // See `ColumnWriter::Flush`.
+  absl::Status Flush(int ignore_last_num_items = 0,
+                     absl::Duration timeout = absl::InfiniteDuration());
+
+  // See `TrajectoryWriter::Close`.
+  void Close();
+
+  // Configures the chunkers of `column` for all the environments. See
+  // `TrajectoryWriter::ConfigureChunker`.
+  absl::Status ConfigureChunker(int column,
+                                const std::shared_ptr<ChunkerOptions>& options);
+
+  // Number of environments in the batch.
+  int num_envs() const;
+
+  // Step within the active episode of environment `env`.
+  int episode_step(int env) const;
+
+ private:
+  // Index of the `writer_` column which holds `column` of environment `env`.
+  int WriterColumn(int column, int env) const;
+
+  const int num_envs_;
+
+  // Used to generate the episode IDs.
+  internal::ThreadLocalKeyGenerator key_generator_;
+
+  // ID and step of the active episode of every environment.
+  std::vector<CellRef::EpisodeInfo> episodes_;
+
+  // Number of columns seen in `Append` so far.
+  int num_columns_ = 0;
+
+  // Owns the chunkers of all the environments and the stream to the server.
+  std::unique_ptr<TrajectoryWriter> writer_;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_BATCHED_TRAJECTORY_WRITER_H_
@@ -0,0 +1,638 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/batched_trajectory_writer.h"
+
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include "grpcpp/impl/codegen/client_callback.h"
+#include "grpcpp/impl/codegen/status.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "reverb/cc/chunker.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/reverb_service.grpc.pb.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/testing/tensor_testutil.h"
+#include "reverb/cc/trajectory_writer.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/types.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Return;
+using ::testing::SizeIs;
+
+using Step = ::std::vector<::absl::optional<::tensorflow::Tensor>>;
+using BatchedStepRef =
+    ::std::vector<::std::vector<::absl::optional<::std::weak_ptr<CellRef>>>>;
+
+MATCHER(IsChunkAndItem, "") {
+  return arg.chunks_size() == 1 && arg.items_size() > 0;
+}
+
+// Creates a [num_envs, 1] tensor where row `i` holds the value `offset + i`.
+tensorflow::Tensor MakeBatch(int num_envs, int offset = 0) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({num_envs, 1}));
+  for (int i = 0; i < num_envs; i++) {
+    tensor.flat<int32_t>()(i) = offset + i;
+  }
+  return tensor;
+}
+
+std::vector<TrajectoryColumn> MakeTrajectory(
+    std::vector<std::vector<absl::optional<std::weak_ptr<CellRef>>>>
+        trajectory) {
+  std::vector<TrajectoryColumn> columns;
+  for (const auto& optional_refs : trajectory) {
+    std::vector<std::weak_ptr<CellRef>> col_refs;
+    for (const auto& optional_ref : optional_refs) {
+      col_refs.push_back(optional_ref.value());
+    }
+    columns.push_back(TrajectoryColumn(std::move(col_refs), /*squeeze=*/false));
+  }
+  return columns;
+}
+
+class FakeStream : public ::grpc::ClientCallbackReaderWriter<
+                       ::deepmind::reverb::InsertStreamRequest,
+                       ::deepmind::reverb::InsertStreamResponse> {
+ public:
+  FakeStream(bool generate_responses)
+      : generate_responses_(generate_responses) {
+    requests_ = std::make_shared<std::vector<InsertStreamRequest>>();
+  }
+
+  void SetReactor(
+      ::grpc::ClientBidiReactor<::deepmind::reverb::InsertStreamRequest,
+                                ::deepmind::reverb::InsertStreamResponse>*
+          reactor) {
+    reactor_ = reactor;
+    BindReactor(reactor);
+  }
+  MOCK_METHOD(void, StartCall, ());
+  MOCK_METHOD(void, WritesDone, ());
+  MOCK_METHOD(void, AddHold, (int holds));
+  void Read(::deepmind::reverb::InsertStreamResponse* resp) {
+    absl::MutexLock lock(&mu_);
+    REVERB_CHECK(response_ == nullptr);
+    response_ = resp;
+  }
+
+  void RemoveHold() {
+    callback_thread_ = internal::StartThread("OnDoneAsync", [this] {
+      reactor_->OnDone(status_);
+    });
+  }
+
+  void Write(const InsertStreamRequest* msg,
+             grpc::WriteOptions options) override {
+    int confirm_cnt = 0;
+    {
+      absl::MutexLock lock(&mu_);
+      requests_->push_back(*msg);
+      for (auto& item : msg->items()) {
+        pending_confirmation_.push(item.key());
+        confirm_cnt++;
+      }
+      if (!generate_responses_) {
+        return;
+      }
+    }
+    reactor_->OnWriteDone(true);
+    ConfirmItems(confirm_cnt);
+  }
+
+  void SetStatus(grpc::Status status) {
+    status_ = status;
+  }
+
+  void BlockUntilNumRequestsIs(int size) const {
+    absl::MutexLock lock(&mu_);
+    auto trigger = [size, this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      return requests_->size() == size;
+    };
+    mu_.Await(absl::Condition(&trigger));
+  }
+
+  void ConfirmItems(int count) {
+    {
+      absl::MutexLock lock(&mu_);
+      for (int x = 0; x < count; x++) {
+        response_->add_keys(pending_confirmation_.front());
+        pending_confirmation_.pop();
+      }
+      response_ = nullptr;
+    }
+    reactor_->OnReadDone(true);
+  }
+
+  const std::vector<InsertStreamRequest>& requests() const {
+    absl::MutexLock lock(&mu_);
+    return *requests_;
+  }
+
+  const int requests_size() const {
+    absl::MutexLock lock(&mu_);
+    return requests_->size();
+  }
+
+  InsertStreamRequest request(int idx) const {
+    absl::MutexLock lock(&mu_);
+    return (*requests_)[idx];
+  }
+
+  std::shared_ptr<std::vector<InsertStreamRequest>> requests_ptr() const {
+    absl::MutexLock lock(&mu_);
+    return requests_;
+  }
+
+ private:
+  mutable absl::Mutex mu_;
+  ::grpc::ClientBidiReactor<::deepmind::reverb::InsertStreamRequest,
+                            ::deepmind::reverb::InsertStreamResponse>*
+      reactor_ = nullptr;
+  std::unique_ptr<::deepmind::reverb::internal::Thread> callback_thread_;
+  std::shared_ptr<std::vector<InsertStreamRequest>> requests_
+      ABSL_GUARDED_BY(mu_);
+  std::queue<uint64_t> pending_confirmation_;
+  ::deepmind::reverb::InsertStreamResponse* response_ ABSL_GUARDED_BY(mu_) =
+      nullptr;
+  const bool generate_responses_;
+  grpc::Status status_ = ::grpc::Status::OK;
+};
+
+class AsyncInterface : public ::deepmind::reverb::/* grpc_gen:: */ReverbService::
+                           StubInterface::async_interface {
+ public:
+  AsyncInterface(bool generate_responses = true)
+      : stream_(generate_responses) {}
+
+  void InsertStream(
+      ::grpc::ClientContext* context,
+      ::grpc::ClientBidiReactor<::deepmind::reverb::InsertStreamRequest,
+                                ::deepmind::reverb::InsertStreamResponse>*
+          reactor) {
+    stream_.SetReactor(reactor);
+  }
+
+  MOCK_METHOD(void, Checkpoint,
+               (::grpc::ClientContext*,
+                    const ::deepmind::reverb::CheckpointRequest*,
+                    ::deepmind::reverb::CheckpointResponse*,
+                    std::function<void(::grpc::Status)>));
+  MOCK_METHOD(void, Checkpoint,
+               (::grpc::ClientContext*,
+                    const ::deepmind::reverb::CheckpointRequest*,
+                    ::deepmind::reverb::CheckpointResponse*,
+                    ::grpc::ClientUnaryReactor* reactor));
+  MOCK_METHOD(void, MutatePriorities,
+               (::grpc::ClientContext*,
+                    const ::deepmind::reverb::MutatePrioritiesRequest* request,
+                    ::deepmind::reverb::MutatePrioritiesResponse* response,
+                    std::function<void(::grpc::Status)>));
+  MOCK_METHOD(void, MutatePriorities,
+               (::grpc::ClientContext*,
+                    const ::deepmind::reverb::MutatePrioritiesRequest* request,
+                    ::deepmind::reverb::MutatePrioritiesResponse* response,
+                    ::grpc::ClientUnaryReactor* reactor));
+  MOCK_METHOD(
+      void, MutatePrioritiesStream,
+      (::grpc::ClientContext*,
+       (::grpc::ClientBidiReactor<::deepmind::reverb::MutatePrioritiesRequest,
+                                  ::deepmind::reverb::MutatePrioritiesResponse>*
+            reactor)));
+  MOCK_METHOD(
+      void, TransformPriorities,
+      (::grpc::ClientContext*,
+       const ::deepmind::reverb::TransformPrioritiesRequest* request,
+       ::deepmind::reverb::TransformPrioritiesResponse* response,
+       std::function<void(::grpc::Status)>));
+  MOCK_METHOD(
+      void, TransformPriorities,
+      (::grpc::ClientContext*,
+       const ::deepmind::reverb::TransformPrioritiesRequest* request,
+       ::deepmind::reverb::TransformPrioritiesResponse* response,
+       ::grpc::ClientUnaryReactor* reactor));
+  MOCK_METHOD(void, Reset, (::grpc::ClientContext*,
+                           const ::deepmind::reverb::ResetRequest* request,
+                           ::deepmind::reverb::ResetResponse* response,
+                           std::function<void(::grpc::Status)>));
+  MOCK_METHOD(void, Reset, (::grpc::ClientContext*,
+                           const ::deepmind::reverb::ResetRequest* request,
+                           ::deepmind::reverb::ResetResponse* response,
+                           ::grpc::ClientUnaryReactor* reactor));
+  MOCK_METHOD(void, LockProfile,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::LockProfileRequest* request,
+               ::deepmind::reverb::LockProfileResponse* response,
+               std::function<void(::grpc::Status)>));
+  MOCK_METHOD(void, LockProfile,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::LockProfileRequest* request,
+               ::deepmind::reverb::LockProfileResponse* response,
+               ::grpc::ClientUnaryReactor* reactor));
+  MOCK_METHOD(void, DumpTrace,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::DumpTraceRequest* request,
+               ::deepmind::reverb::DumpTraceResponse* response,
+               std::function<void(::grpc::Status)>));
+  MOCK_METHOD(void, DumpTrace,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::DumpTraceRequest* request,
+               ::deepmind::reverb::DumpTraceResponse* response,
+               ::grpc::ClientUnaryReactor* reactor));
+  MOCK_METHOD(void, CheckpointStatus,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::CheckpointStatusRequest* request,
+               ::deepmind::reverb::CheckpointStatusResponse* response,
+               std::function<void(::grpc::Status)>));
+  MOCK_METHOD(void, CheckpointStatus,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::CheckpointStatusRequest* request,
+               ::deepmind::reverb::CheckpointStatusResponse* response,
+               ::grpc::ClientUnaryReactor* reactor));
+  MOCK_METHOD(
+      void, SampleStream,
+      ((::grpc::ClientContext*),
+       (::grpc::ClientBidiReactor<::deepmind::reverb::SampleStreamRequest,
+                                  ::deepmind::reverb::SampleStreamResponse>*)));
+  MOCK_METHOD(
+      void, GetItems,
+      ((::grpc::ClientContext*),
+       (::grpc::ClientBidiReactor<::deepmind::reverb::GetItemsRequest,
+                                  ::deepmind::reverb::SampleStreamResponse>*)));
+  MOCK_METHOD(void, ServerInfo,
+               (::grpc::ClientContext*,
+                    const ::deepmind::reverb::ServerInfoRequest* request,
+                    ::deepmind::reverb::ServerInfoResponse* response,
+                    std::function<void(::grpc::Status)>));
+  MOCK_METHOD(void, ServerInfo,
+               (::grpc::ClientContext*,
+                    const ::deepmind::reverb::ServerInfoRequest* request,
+                    ::deepmind::reverb::ServerInfoResponse* response,
+                    ::grpc::ClientUnaryReactor* reactor));
+  MOCK_METHOD(void,
+      InitializeConnection,
+      ((::grpc::ClientContext*) ,
+           (::grpc::ClientBidiReactor<
+               ::deepmind::reverb::InitializeConnectionRequest,
+               ::deepmind::reverb::InitializeConnectionResponse>*)));
+
+ public:
+  FakeStream stream_;
+};
+
+class MockReverbServiceAsyncStub
+    : public ::deepmind::reverb::/* grpc_gen:: */ReverbService::StubInterface {
+ public:
+  MOCK_METHOD(::grpc::Status,
+      Checkpoint,
+      (::grpc::ClientContext*,
+                     const ::deepmind::reverb::CheckpointRequest&,
+                     ::deepmind::reverb::CheckpointResponse*));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                   ::deepmind::reverb::CheckpointResponse>*, AsyncCheckpointRaw,
+               (
+                   ::grpc::ClientContext*,
+                   const ::deepmind::reverb::CheckpointRequest&,
+                   ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::CheckpointResponse>*,
+              PrepareAsyncCheckpointRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::CheckpointRequest&,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD((::grpc::ClientReaderWriterInterface<
+                  ::deepmind::reverb::InsertStreamRequest,
+                  ::deepmind::reverb::InsertStreamResponse>*),
+              InsertStreamRaw, (::grpc::ClientContext*));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::InsertStreamRequest,
+                  ::deepmind::reverb::InsertStreamResponse>*),
+              AsyncInsertStreamRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*, void* tag));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::InsertStreamRequest,
+                  ::deepmind::reverb::InsertStreamResponse>*),
+              PrepareAsyncInsertStreamRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::Status,
+      MutatePriorities,
+      (::grpc::ClientContext*,
+                     const ::deepmind::reverb::MutatePrioritiesRequest& request,
+                     ::deepmind::reverb::MutatePrioritiesResponse* response));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::MutatePrioritiesResponse>*,
+              AsyncMutatePrioritiesRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::MutatePrioritiesRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::MutatePrioritiesResponse>*,
+              PrepareAsyncMutatePrioritiesRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::MutatePrioritiesRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD((::grpc::ClientReaderWriterInterface<
+                  ::deepmind::reverb::MutatePrioritiesRequest,
+                  ::deepmind::reverb::MutatePrioritiesResponse>*),
+              MutatePrioritiesStreamRaw, (::grpc::ClientContext*));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::MutatePrioritiesRequest,
+                  ::deepmind::reverb::MutatePrioritiesResponse>*),
+              AsyncMutatePrioritiesStreamRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*, void* tag));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::MutatePrioritiesRequest,
+                  ::deepmind::reverb::MutatePrioritiesResponse>*),
+              PrepareAsyncMutatePrioritiesStreamRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::Status, TransformPriorities,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::TransformPrioritiesRequest& request,
+               ::deepmind::reverb::TransformPrioritiesResponse* response));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::TransformPrioritiesResponse>*,
+              AsyncTransformPrioritiesRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::TransformPrioritiesRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::TransformPrioritiesResponse>*,
+              PrepareAsyncTransformPrioritiesRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::TransformPrioritiesRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::Status, Reset,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::ResetRequest& request,
+               ::deepmind::reverb::ResetResponse* response));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::ResetResponse>*,
+              AsyncResetRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::ResetRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD((::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::ResetResponse>*),
+              PrepareAsyncResetRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::ResetRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::Status, LockProfile,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::LockProfileRequest& request,
+               ::deepmind::reverb::LockProfileResponse* response));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::LockProfileResponse>*,
+              AsyncLockProfileRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::LockProfileRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::LockProfileResponse>*,
+              PrepareAsyncLockProfileRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::LockProfileRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::Status, DumpTrace,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::DumpTraceRequest& request,
+               ::deepmind::reverb::DumpTraceResponse* response));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::DumpTraceResponse>*,
+              AsyncDumpTraceRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::DumpTraceRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::DumpTraceResponse>*,
+              PrepareAsyncDumpTraceRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::DumpTraceRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::Status, CheckpointStatus,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::CheckpointStatusRequest& request,
+               ::deepmind::reverb::CheckpointStatusResponse* response));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::CheckpointStatusResponse>*,
+              AsyncCheckpointStatusRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::CheckpointStatusRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::CheckpointStatusResponse>*,
+              PrepareAsyncCheckpointStatusRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::CheckpointStatusRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD((::grpc::ClientReaderWriterInterface<
+                  ::deepmind::reverb::SampleStreamRequest,
+                  ::deepmind::reverb::SampleStreamResponse>*),
+              SampleStreamRaw, (::grpc::ClientContext*));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::SampleStreamRequest,
+                  ::deepmind::reverb::SampleStreamResponse>*),
+              AsyncSampleStreamRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*, void* tag));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::SampleStreamRequest,
+                  ::deepmind::reverb::SampleStreamResponse>*),
+              PrepareAsyncSampleStreamRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*));
+  MOCK_METHOD((::grpc::ClientReaderWriterInterface<
+                  ::deepmind::reverb::GetItemsRequest,
+                  ::deepmind::reverb::SampleStreamResponse>*),
+              GetItemsRaw, (::grpc::ClientContext*));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::GetItemsRequest,
+                  ::deepmind::reverb::SampleStreamResponse>*),
+              AsyncGetItemsRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*, void* tag));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::GetItemsRequest,
+                  ::deepmind::reverb::SampleStreamResponse>*),
+              PrepareAsyncGetItemsRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::Status, ServerInfo,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::ServerInfoRequest&,
+               ::deepmind::reverb::ServerInfoResponse* response));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::ServerInfoResponse>*,
+              AsyncServerInfoRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::ServerInfoRequest&,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::ServerInfoResponse>*,
+              PrepareAsyncServerInfoRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::ServerInfoRequest&,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD((::grpc::ClientReaderWriterInterface<
+                  ::deepmind::reverb::InitializeConnectionRequest,
+                  ::deepmind::reverb::InitializeConnectionResponse>*),
+              InitializeConnectionRaw, (::grpc::ClientContext*));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::InitializeConnectionRequest,
+                  ::deepmind::reverb::InitializeConnectionResponse>*),
+              AsyncInitializeConnectionRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*, void*));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::InitializeConnectionRequest,
+                  ::deepmind::reverb::InitializeConnectionResponse>*),
+              PrepareAsyncInitializeConnectionRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*));
+  MOCK_METHOD(deepmind::reverb::/* grpc_gen:: */ReverbService::StubInterface::
+                  async_interface*,
+              async, ());
+};
+
+inline TrajectoryWriter::Options MakeOptions(int max_chunk_length,
+                                             int num_keep_alive_refs) {
+  return TrajectoryWriter::Options{
+      .chunker_options = std::make_shared<ConstantChunkerOptions>(
+          max_chunk_length, num_keep_alive_refs),
+  };
+}
+
+TEST(BatchedTrajectoryWriter, AppendSplitsRowsByEnvironment) {
+  AsyncInterface async;
+  auto stub = std::make_shared<MockReverbServiceAsyncStub>();
+  EXPECT_CALL(*stub, async()).WillRepeatedly(Return(&async));
+
+  BatchedTrajectoryWriter writer(stub, /*num_envs=*/3,
+                                 MakeOptions(/*max_chunk_length=*/2,
+                                             /*num_keep_alive_refs=*/2));
+  BatchedStepRef refs;
+  REVERB_ASSERT_OK(writer.Append(Step({MakeBatch(3), absl::nullopt}), &refs));
+  ASSERT_THAT(refs, SizeIs(3));
+
+  for (int env = 0; env < 3; env++) {
+    ASSERT_THAT(refs[env], SizeIs(2));
+    EXPECT_FALSE(refs[env][1].has_value());
+
+    auto ref = refs[env][0]->lock();
+    ASSERT_TRUE(ref);
+    EXPECT_EQ(ref->episode_step(), 0);
+
+    tensorflow::Tensor data;
+    REVERB_ASSERT_OK(ref->GetData(&data));
+    tensorflow::Tensor want(tensorflow::DT_INT32, tensorflow::TensorShape({1}));
+    want.flat<int32_t>()(0) = env;
+    test::ExpectTensorEqual<int32_t>(data, want);
+  }
+
+  // Every environment has its own episode and thus its own chunks.
+  EXPECT_NE(refs[0][0]->lock()->episode_id(), refs[1][0]->lock()->episode_id());
+  EXPECT_NE(refs[0][0]->lock()->chunk_key(), refs[1][0]->lock()->chunk_key());
+
+  writer.Close();
+}
+
+TEST(BatchedTrajectoryWriter, AppendRejectsWrongNumberOfEnvironments) {
+  AsyncInterface async;
+  auto stub = std::make_shared<MockReverbServiceAsyncStub>();
+  EXPECT_CALL(*stub, async()).WillRepeatedly(Return(&async));
+
+  BatchedTrajectoryWriter writer(stub, /*num_envs=*/3,
+                                 MakeOptions(/*max_chunk_length=*/2,
+                                             /*num_keep_alive_refs=*/2));
+  BatchedStepRef refs;
+  EXPECT_EQ(writer.Append(Step({MakeBatch(2)}), &refs).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(writer.Append(Step({tensorflow::Tensor(1)}), &refs).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  writer.Close();
+}
+
+TEST(BatchedTrajectoryWriter, EndEpisodeOnlyAffectsEnvironment) {
+  AsyncInterface async;
+  auto stub = std::make_shared<MockReverbServiceAsyncStub>();
+  EXPECT_CALL(*stub, async()).WillRepeatedly(Return(&async));
+
+  BatchedTrajectoryWriter writer(stub, /*num_envs=*/2,
+                                 MakeOptions(/*max_chunk_length=*/10,
+                                             /*num_keep_alive_refs=*/10));
+  BatchedStepRef first;
+  REVERB_ASSERT_OK(writer.Append(Step({MakeBatch(2)}), &first));
+  EXPECT_EQ(writer.episode_step(0), 1);
+  EXPECT_EQ(writer.episode_step(1), 1);
+
+  REVERB_ASSERT_OK(writer.EndEpisode(/*env=*/0, /*clear_buffers=*/true));
+  EXPECT_EQ(writer.episode_step(0), 0);
+  EXPECT_EQ(writer.episode_step(1), 1);
+
+  // The episode of the first environment was cleared but the second one is
+  // still referencing its data.
+  EXPECT_TRUE(first[0][0]->expired());
+  EXPECT_FALSE(first[1][0]->expired());
+
+  BatchedStepRef second;
+  REVERB_ASSERT_OK(writer.Append(Step({MakeBatch(2)}), &second));
+  EXPECT_EQ(second[0][0]->lock()->episode_step(), 0);
+  EXPECT_EQ(second[1][0]->lock()->episode_step(), 1);
+  EXPECT_EQ(second[1][0]->lock()->episode_id(),
+            first[1][0]->lock()->episode_id());
+
+  EXPECT_EQ(writer.EndEpisode(/*env=*/2, /*clear_buffers=*/true).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  writer.Close();
+}
+
+TEST(BatchedTrajectoryWriter, ItemsCanReferenceAnyEnvironment) {
+  AsyncInterface async;
+  auto stub = std::make_shared<MockReverbServiceAsyncStub>();
+  EXPECT_CALL(*stub, async()).WillRepeatedly(Return(&async));
+
+  BatchedTrajectoryWriter writer(stub, /*num_envs=*/2,
+                                 MakeOptions(/*max_chunk_length=*/1,
+                                             /*num_keep_alive_refs=*/1));
+  BatchedStepRef refs;
+  REVERB_ASSERT_OK(writer.Append(Step({MakeBatch(2)}), &refs));
+
+  REVERB_ASSERT_OK(
+      writer.CreateItem("table", 1.0, MakeTrajectory({{refs[1][0]}})));
+  REVERB_ASSERT_OK(writer.Flush());
+
+  // Only the chunk of the referenced environment is sent.
+  ASSERT_THAT(async.stream_.requests(), ElementsAre(IsChunkAndItem()));
+  EXPECT_EQ(async.stream_.requests()[0].chunks(0).chunk_key(),
+            refs[1][0]->lock()->chunk_key());
+
+  writer.Close();
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,184 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Benchmarks of `TFRecordCheckpointer::Save` and `Load` for synthesized
+// tables. Every benchmark checkpoints a single uniform table whose items each
+// reference their own chunk of (incompressible) random bytes, sweeping the
+// number of chunks, the size of each chunk and the number of chunk files
+// (`num_shards`). Both report records (`items_per_second`) and bytes
+// (`bytes_per_second`) written or read per second as well as the time of each
+// phase of the last call in milliseconds (see `TFRecordCheckpointer::Stats`):
+//
+//   lock_ms, serialization_ms, io_ms, commit_ms, cleanup_ms, restore_ms
+//
+// The checkpoints are written to a temporary directory, so the results depend
+// on the file system backing it (set `TEST_TMPDIR` to choose one).
+
+#include <cfloat>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "absl/random/random.h"
+#include "absl/time/time.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/tfrecord_checkpointer.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/tensor_compression.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/types.pb.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+constexpr char kTableName[] = "benchmark";
+
+std::shared_ptr<Table> MakeTable(int64_t max_size) {
+  return std::make_shared<Table>(
+      kTableName, std::make_shared<UniformSelector>(),
+      std::make_shared<FifoSelector>(), max_size, /*max_times_sampled=*/0,
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1,
+                                    /*min_diff=*/-DBL_MAX,
+                                    /*max_diff=*/DBL_MAX));
+}
+
+// Chunk `key` holding a single step of `num_bytes` random bytes.
+ChunkData MakeChunk(uint64_t key, int64_t num_bytes, absl::BitGen* bit_gen) {
+  tensorflow::Tensor tensor(tensorflow::DT_UINT8,
+                            tensorflow::TensorShape({1, num_bytes}));
+  for (uint8_t& value : tensor.flat<uint8_t>()) {
+    value = absl::Uniform<uint8_t>(*bit_gen);
+  }
+  ChunkData chunk =
+      testing::MakeChunkData(key, testing::MakeSequenceRange(key, 0, 0), 0);
+  CompressTensorAsProto(tensor, chunk.mutable_data()->add_tensors());
+  chunk.set_data_tensors_len(1);
+  return chunk;
+}
+
+// Table of `num_chunks` items which each reference their own chunk of
+// `chunk_bytes` bytes.
+std::shared_ptr<Table> MakeFilledTable(ChunkStore* chunk_store,
+                                       int64_t num_chunks,
+                                       int64_t chunk_bytes) {
+  auto table = MakeTable(num_chunks);
+  absl::BitGen bit_gen;
+  for (int64_t key = 1; key <= num_chunks; key++) {
+    auto chunk = chunk_store->Insert(MakeChunk(key, chunk_bytes, &bit_gen));
+    REVERB_CHECK(table
+                     ->InsertOrAssign({testing::MakePrioritizedItem(
+                                           key, 1.0, {chunk->data()}),
+                                       {chunk}})
+                     .ok());
+  }
+  return table;
+}
+
+std::string MakeRoot() {
+  std::string name;
+  REVERB_CHECK(tensorflow::Env::Default()->LocalTempFilename(&name));
+  return name;
+}
+
+void ReportStats(const TFRecordCheckpointer::Stats& stats,
+                 benchmark::State* state) {
+  state->SetItemsProcessed(state->iterations() * stats.num_records);
+  state->SetBytesProcessed(state->iterations() * stats.num_bytes);
+  state->counters["lock_ms"] = absl::ToDoubleMilliseconds(stats.lock);
+  state->counters["serialization_ms"] =
+      absl::ToDoubleMilliseconds(stats.serialization);
+  state->counters["io_ms"] = absl::ToDoubleMilliseconds(stats.io);
+  state->counters["commit_ms"] = absl::ToDoubleMilliseconds(stats.commit);
+  state->counters["cleanup_ms"] = absl::ToDoubleMilliseconds(stats.cleanup);
+  state->counters["restore_ms"] = absl::ToDoubleMilliseconds(stats.restore);
+}
+
+void BM_Save(benchmark::State& state) {
+  const int64_t num_chunks = state.range(0);
+  const int64_t chunk_bytes = state.range(1) << 10;
+  const int num_shards = state.range(2);
+  ChunkStore chunk_store;
+  auto table = MakeFilledTable(&chunk_store, num_chunks, chunk_bytes);
+
+  TFRecordCheckpointer checkpointer(MakeRoot(), "", absl::nullopt,
+                                    /*max_incremental_checkpoints=*/0,
+                                    num_shards);
+  std::string path;
+  for (auto _ : state) {
+    // Only the latest checkpoint is kept, so every save also deletes one.
+    REVERB_CHECK(checkpointer.Save({table.get()}, /*keep_latest=*/1, &path)
+                     .ok());
+  }
+  ReportStats(checkpointer.last_save_stats(), &state);
+}
+
+void BM_Load(benchmark::State& state) {
+  const int64_t num_chunks = state.range(0);
+  const int64_t chunk_bytes = state.range(1) << 10;
+  const int num_shards = state.range(2);
+  TFRecordCheckpointer checkpointer(MakeRoot(), "", absl::nullopt,
+                                    /*max_incremental_checkpoints=*/0,
+                                    num_shards);
+  std::string path;
+  {
+    ChunkStore chunk_store;
+    auto table = MakeFilledTable(&chunk_store, num_chunks, chunk_bytes);
+    REVERB_CHECK(checkpointer.Save({table.get()}, /*keep_latest=*/1, &path)
+                     .ok());
+  }
+
+  for (auto _ : state) {
+    ChunkStore chunk_store;
+    std::vector<std::shared_ptr<Table>> tables = {MakeTable(num_chunks)};
+    REVERB_CHECK(checkpointer.Load(path, &chunk_store, &tables).ok());
+    // Destroying the tables and chunks is not part of the load.
+    state.PauseTiming();
+    tables.clear();
+    state.ResumeTiming();
+  }
+  ReportStats(checkpointer.last_load_stats(), &state);
+}
+
+void CheckpointArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"num_chunks", "chunk_kib", "num_shards"});
+  for (int num_chunks : {256, 4096}) {
+    for (int chunk_kib : {16, 256}) {
+      for (int num_shards : {1, 4}) {
+        b->Args({num_chunks, chunk_kib, num_shards});
+      }
+    }
+  }
+  // The chunk files are written and read by one thread each.
+  b->UseRealTime()->Unit(benchmark::kMillisecond);
+}
+
+BENCHMARK(BM_Save)->Apply(CheckpointArgs);
+BENCHMARK(BM_Load)->Apply(CheckpointArgs);
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
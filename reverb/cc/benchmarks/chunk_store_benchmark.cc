@@ -0,0 +1,103 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Microbenchmarks of `ChunkStore` insert and lookup with all threads sharing a
+// single store. The chunks hold no data as the store never inspects it.
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+ChunkData MakeChunkData(uint64_t key) {
+  ChunkData data;
+  data.set_chunk_key(key);
+  data.mutable_sequence_range()->set_episode_id(key);
+  return data;
+}
+
+// Every thread keeps its last `state.range(0)` chunks alive so each insert
+// also destroys (and eventually cleans up) the oldest chunk of the thread.
+void BM_ChunkStoreInsert(benchmark::State& state) {
+  static ChunkStore* store = nullptr;
+  if (state.thread_index() == 0) {
+    store = new ChunkStore();
+  }
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> live(state.range(0));
+  uint64_t key = static_cast<uint64_t>(state.thread_index()) << 48;
+  int64_t i = 0;
+  for (auto _ : state) {
+    live[i++ % live.size()] = store->Insert(MakeChunkData(key++));
+  }
+  state.SetItemsProcessed(state.iterations());
+  live.clear();
+  if (state.thread_index() == 0) {
+    delete store;
+    store = nullptr;
+  }
+}
+
+// Looks up one of `state.range(0)` chunks, chosen uniformly at random.
+void BM_ChunkStoreGet(benchmark::State& state) {
+  static ChunkStore* store = nullptr;
+  static std::vector<std::shared_ptr<ChunkStore::Chunk>>* chunks = nullptr;
+  if (state.thread_index() == 0) {
+    store = new ChunkStore();
+    chunks = new std::vector<std::shared_ptr<ChunkStore::Chunk>>();
+    for (int64_t key = 0; key < state.range(0); key++) {
+      chunks->push_back(store->Insert(MakeChunkData(key)));
+    }
+  }
+  absl::BitGen bit_gen;
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> result;
+  for (auto _ : state) {
+    const ChunkStore::Key key =
+        absl::Uniform<uint64_t>(bit_gen, 0, state.range(0));
+    REVERB_CHECK(store->Get({key}, &result).ok());
+  }
+  state.SetItemsProcessed(state.iterations());
+  result.clear();
+  if (state.thread_index() == 0) {
+    delete chunks;
+    chunks = nullptr;
+    delete store;
+    store = nullptr;
+  }
+}
+
+BENCHMARK(BM_ChunkStoreInsert)
+    ->RangeMultiplier(16)
+    ->Range(1 << 10, 1 << 18)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK(BM_ChunkStoreGet)
+    ->RangeMultiplier(16)
+    ->Range(1 << 10, 1 << 18)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
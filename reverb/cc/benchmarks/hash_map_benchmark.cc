@@ -0,0 +1,141 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Microbenchmarks of the hashes of the maps keyed by item and chunk keys: the
+// identity (`std::hash`, which `tensorflow::hash` used before), `absl::Hash`
+// and `internal::KeyHash`. Each benchmark takes the kind of keys (see
+// `KeyPattern`) and the number of keys as arguments, e.g.:
+//
+//   bazel run -c opt //reverb/cc/benchmarks:hash_map_benchmark -- \
+//     --benchmark_filter=BM_HashMapFind<.*KeyHash>/keys:1/
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+enum KeyPattern {
+  // Uniformly random keys, like item keys.
+  kRandomKeys = 0,
+  // Random keys where every group of 64 is consecutive, like chunk keys.
+  kRangeKeys = 1,
+};
+
+// Creates `state.range(1)` keys of the pattern `state.range(0)`.
+std::vector<uint64_t> MakeKeys(benchmark::State& state) {
+  const int64_t num_keys = state.range(1);
+  absl::BitGen bit_gen;
+  std::vector<uint64_t> keys(num_keys);
+  for (auto& key : keys) key = absl::Uniform<uint64_t>(bit_gen);
+  if (state.range(0) == kRangeKeys) {
+    state.SetLabel("range");
+    for (int64_t i = 0; i < num_keys; i++) {
+      keys[i] = keys[i - i % 64] + i % 64;
+    }
+  } else {
+    state.SetLabel("random");
+  }
+  return keys;
+}
+
+template <typename Hash>
+void BM_HashMapInsert(benchmark::State& state) {
+  const std::vector<uint64_t> keys = MakeKeys(state);
+  for (auto _ : state) {
+    absl::flat_hash_map<uint64_t, size_t, Hash> map;
+    for (size_t i = 0; i < keys.size(); i++) {
+      map.emplace(keys[i], i);
+    }
+    benchmark::DoNotOptimize(map);
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template <typename Hash>
+void BM_HashMapFind(benchmark::State& state) {
+  const std::vector<uint64_t> keys = MakeKeys(state);
+  absl::flat_hash_map<uint64_t, size_t, Hash> map;
+  for (size_t i = 0; i < keys.size(); i++) {
+    map.emplace(keys[i], i);
+  }
+  absl::BitGen bit_gen;
+  for (auto _ : state) {
+    auto it = map.find(keys[absl::Uniform<size_t>(bit_gen, 0, keys.size())]);
+    benchmark::DoNotOptimize(it->second);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+template <typename Hash>
+void BM_HashMapErase(benchmark::State& state) {
+  const std::vector<uint64_t> keys = MakeKeys(state);
+  for (auto _ : state) {
+    state.PauseTiming();
+    absl::flat_hash_map<uint64_t, size_t, Hash> map;
+    for (size_t i = 0; i < keys.size(); i++) {
+      map.emplace(keys[i], i);
+    }
+    state.ResumeTiming();
+    for (uint64_t key : keys) {
+      map.erase(key);
+    }
+    REVERB_CHECK(map.empty());
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+void AllKeyArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"keys", "items"});
+  for (int pattern : {kRandomKeys, kRangeKeys}) {
+    for (int64_t num_items : {1 << 16, 1 << 20}) {
+      b->Args({pattern, num_items});
+    }
+  }
+}
+
+// The identity hash degrades to probing long runs of full groups for range
+// keys so it is only run with random keys.
+void RandomKeyArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"keys", "items"});
+  for (int64_t num_items : {1 << 16, 1 << 20}) {
+    b->Args({kRandomKeys, num_items});
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_HashMapInsert, std::hash<uint64_t>)->Apply(RandomKeyArgs);
+BENCHMARK_TEMPLATE(BM_HashMapInsert, absl::Hash<uint64_t>)->Apply(AllKeyArgs);
+BENCHMARK_TEMPLATE(BM_HashMapInsert, internal::KeyHash)->Apply(AllKeyArgs);
+BENCHMARK_TEMPLATE(BM_HashMapFind, std::hash<uint64_t>)->Apply(RandomKeyArgs);
+BENCHMARK_TEMPLATE(BM_HashMapFind, absl::Hash<uint64_t>)->Apply(AllKeyArgs);
+BENCHMARK_TEMPLATE(BM_HashMapFind, internal::KeyHash)->Apply(AllKeyArgs);
+BENCHMARK_TEMPLATE(BM_HashMapErase, std::hash<uint64_t>)->Apply(RandomKeyArgs);
+BENCHMARK_TEMPLATE(BM_HashMapErase, absl::Hash<uint64_t>)->Apply(AllKeyArgs);
+BENCHMARK_TEMPLATE(BM_HashMapErase, internal::KeyHash)->Apply(AllKeyArgs);
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,101 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Microbenchmarks of `HeapSelector` and `DaryHeapSelector` when used as the
+// sampler of a priority queue style table (`max_times_sampled=1`). Each
+// benchmark takes the arity of the heap (see `MakeHeap`) and the number of
+// items as arguments, e.g.:
+//
+//   bazel run -c opt //reverb/cc/benchmarks:heap_benchmark -- \
+//     --benchmark_filter=BM_HeapPopAndInsert/arity:8/
+
+#include <cstdint>
+#include <memory>
+
+#include "benchmark/benchmark.h"
+#include "absl/memory/memory.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/selectors/dary_heap.h"
+#include "reverb/cc/selectors/heap.h"
+#include "reverb/cc/selectors/interface.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Creates a `HeapSelector` if `state.range(0)` is 2 and a `DaryHeapSelector`
+// of that arity otherwise, holding `state.range(1)` items with keys
+// [0, state.range(1)).
+std::unique_ptr<ItemSelector> MakeHeap(benchmark::State& state,
+                                       absl::BitGen* bit_gen) {
+  std::unique_ptr<ItemSelector> selector;
+  if (state.range(0) == 2) {
+    state.SetLabel("HeapSelector");
+    selector = absl::make_unique<HeapSelector>();
+  } else {
+    state.SetLabel("DaryHeapSelector");
+    selector = absl::make_unique<DaryHeapSelector>(/*min_heap=*/true,
+                                                   /*arity=*/state.range(0));
+  }
+  for (int64_t key = 0; key < state.range(1); key++) {
+    REVERB_CHECK(
+        selector->Insert(key, absl::Uniform<double>(*bit_gen, 0, 1)).ok());
+  }
+  return selector;
+}
+
+// Every sample pops the top item which is then replaced by a new item.
+void BM_HeapPopAndInsert(benchmark::State& state) {
+  absl::BitGen bit_gen;
+  auto selector = MakeHeap(state, &bit_gen);
+  int64_t next = state.range(1);
+  for (auto _ : state) {
+    REVERB_CHECK(selector->Delete(selector->Sample().key).ok());
+    REVERB_CHECK(
+        selector->Insert(next++, absl::Uniform<double>(bit_gen, 0, 1)).ok());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_HeapUpdate(benchmark::State& state) {
+  absl::BitGen bit_gen;
+  auto selector = MakeHeap(state, &bit_gen);
+  const int64_t num_items = state.range(1);
+  for (auto _ : state) {
+    REVERB_CHECK(selector
+                     ->Update(absl::Uniform<int64_t>(bit_gen, 0, num_items),
+                              absl::Uniform<double>(bit_gen, 0, 1))
+                     .ok());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void HeapArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"arity", "items"});
+  for (int arity : {2, 4, 8}) {
+    for (int64_t num_items : {1 << 14, 1 << 20}) {
+      b->Args({arity, num_items});
+    }
+  }
+}
+
+BENCHMARK(BM_HeapPopAndInsert)->Apply(HeapArgs);
+BENCHMARK(BM_HeapUpdate)->Apply(HeapArgs);
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
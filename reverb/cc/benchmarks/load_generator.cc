@@ -0,0 +1,442 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// End-to-end load generator. Starts a server with a single table (or connects
+// to an existing one), runs actor threads which write trajectories through
+// `TrajectoryWriter` and learner threads which read them back through
+// `Sampler`, and periodically reports throughput and latency percentiles.
+//
+//   bazel run -c opt //reverb/cc/benchmarks:load_generator -- \
+//     --num_actors=64 --num_learners=4 --shape=84,84,4 --sequence_length=20 \
+//     --samples_per_insert=8 --duration=5m
+//
+// Every line of the report covers the interval since the previous line and a
+// summary over the whole run is printed at the end. Latency percentiles are
+// upper bounds of power-of-two buckets (see `internal::LatencyHistogram`).
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/memory/memory.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "reverb/cc/chunker.h"
+#include "reverb/cc/client.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/net.h"
+#include "reverb/cc/platform/server.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/sampler.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/lifo.h"
+#include "reverb/cc/selectors/prioritized.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/latency_histogram.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/trajectory_writer.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+
+ABSL_FLAG(std::string, server_address, "",
+          "Address of an existing server to load. If empty then a server is "
+          "started in process with a table configured by the --table_* and "
+          "rate limiter flags.");
+ABSL_FLAG(std::string, table, "load_generator", "Name of the table.");
+ABSL_FLAG(std::string, table_sampler, "uniform",
+          "Sampler of the table: uniform, prioritized, fifo or lifo.");
+ABSL_FLAG(std::string, table_remover, "fifo",
+          "Remover of the table: uniform, prioritized, fifo or lifo.");
+ABSL_FLAG(int64_t, table_max_size, 1000000,
+          "Maximum number of items in the table.");
+ABSL_FLAG(int32_t, table_max_times_sampled, 0,
+          "Maximum number of times an item is sampled, 0 for unlimited.");
+ABSL_FLAG(double, samples_per_insert, 0,
+          "If > 0 then the table is rate limited to this ratio of samples per "
+          "insert (`SampleToInsertRatio`). Otherwise only "
+          "--min_size_to_sample is enforced (`MinSize`).");
+ABSL_FLAG(int64_t, min_size_to_sample, 1000,
+          "Minimum number of items in the table before sampling can start.");
+ABSL_FLAG(double, error_buffer, 1000,
+          "Tolerated deviation from --samples_per_insert, in samples.");
+ABSL_FLAG(int, num_actors, 4, "Number of threads writing trajectories.");
+ABSL_FLAG(int, num_learners, 1, "Number of threads sampling trajectories.");
+ABSL_FLAG(std::string, shape, "84,84,4",
+          "Comma separated shape of the float tensors appended every step.");
+ABSL_FLAG(int, num_columns, 1, "Number of tensors appended every step.");
+ABSL_FLAG(int, sequence_length, 10, "Number of steps referenced by each item.");
+ABSL_FLAG(int, period, 1, "Number of steps between consecutive items.");
+ABSL_FLAG(int, episode_length, 1000, "Number of steps of each episode.");
+ABSL_FLAG(int, chunk_length, 0,
+          "Number of steps per chunk. 0 uses --sequence_length.");
+ABSL_FLAG(int, num_sampler_workers, 1,
+          "Number of sampler workers (i.e streams) per learner.");
+ABSL_FLAG(int, max_in_flight_samples_per_worker, 100,
+          "Number of samples requested by each sampler worker at a time.");
+ABSL_FLAG(absl::Duration, duration, absl::Minutes(1),
+          "How long the load is generated for.");
+ABSL_FLAG(absl::Duration, report_interval, absl::Seconds(5),
+          "Time between two reports.");
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Records latencies both over the whole run and since the last report.
+class LatencyRecorder {
+ public:
+  LatencyRecorder()
+      : interval_(absl::make_unique<internal::LatencyHistogram>()) {}
+
+  void Record(absl::Duration latency) ABSL_LOCKS_EXCLUDED(mu_) {
+    total_.Record(latency);
+    absl::ReaderMutexLock lock(&mu_);
+    interval_->Record(latency);
+  }
+
+  // Returns the latencies recorded since the previous call.
+  std::unique_ptr<internal::LatencyHistogram> TakeInterval()
+      ABSL_LOCKS_EXCLUDED(mu_) {
+    auto interval = absl::make_unique<internal::LatencyHistogram>();
+    absl::MutexLock lock(&mu_);
+    std::swap(interval, interval_);
+    return interval;
+  }
+
+  const internal::LatencyHistogram& total() const { return total_; }
+
+ private:
+  internal::LatencyHistogram total_;
+  absl::Mutex mu_;
+  std::unique_ptr<internal::LatencyHistogram> interval_ ABSL_GUARDED_BY(mu_);
+};
+
+struct Stats {
+  // Latency of `Append`, including the `CreateItem` call of steps which
+  // complete an item.
+  LatencyRecorder steps;
+  // Latency of `CreateItem`.
+  LatencyRecorder items;
+  // Latency of `EndEpisode`, i.e until all items of the episode have been
+  // confirmed by the server.
+  LatencyRecorder episodes;
+  // Latency of `GetNextTrajectory`.
+  LatencyRecorder samples;
+};
+
+std::string FormatHistogram(absl::string_view name,
+                            const internal::LatencyHistogram& histogram,
+                            absl::Duration elapsed) {
+  return absl::StrFormat(
+      "%s %.1f/s (p50 %s p99 %s p99.9 %s)", name,
+      histogram.count() / absl::ToDoubleSeconds(elapsed),
+      absl::FormatDuration(histogram.Quantile(0.5)),
+      absl::FormatDuration(histogram.Quantile(0.99)),
+      absl::FormatDuration(histogram.Quantile(0.999)));
+}
+
+absl::Status ParseShape(absl::string_view value,
+                        tensorflow::TensorShape* shape) {
+  for (absl::string_view dim : absl::StrSplit(value, ',', absl::SkipEmpty())) {
+    int64_t size;
+    if (!absl::SimpleAtoi(dim, &size) || size <= 0) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid --shape '", value, "'."));
+    }
+    shape->AddDim(size);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status MakeSelector(absl::string_view name,
+                          std::shared_ptr<ItemSelector>* selector) {
+  if (name == "uniform") {
+    *selector = std::make_shared<UniformSelector>();
+  } else if (name == "prioritized") {
+    *selector = std::make_shared<PrioritizedSelector>(/*priority_exponent=*/1);
+  } else if (name == "fifo") {
+    *selector = std::make_shared<FifoSelector>();
+  } else if (name == "lifo") {
+    *selector = std::make_shared<LifoSelector>();
+  } else {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Unknown selector '", name, "'."));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status MakeTable(std::shared_ptr<Table>* table) {
+  std::shared_ptr<ItemSelector> sampler;
+  REVERB_RETURN_IF_ERROR(MakeSelector(absl::GetFlag(FLAGS_table_sampler),
+                                      &sampler));
+  std::shared_ptr<ItemSelector> remover;
+  REVERB_RETURN_IF_ERROR(MakeSelector(absl::GetFlag(FLAGS_table_remover),
+                                      &remover));
+
+  const double samples_per_insert = absl::GetFlag(FLAGS_samples_per_insert);
+  const int64_t min_size_to_sample = absl::GetFlag(FLAGS_min_size_to_sample);
+  std::shared_ptr<RateLimiter> rate_limiter;
+  if (samples_per_insert > 0) {
+    const double offset = samples_per_insert * min_size_to_sample;
+    const double error_buffer = absl::GetFlag(FLAGS_error_buffer);
+    rate_limiter = std::make_shared<RateLimiter>(
+        samples_per_insert, min_size_to_sample, offset - error_buffer,
+        offset + error_buffer);
+  } else {
+    rate_limiter = std::make_shared<RateLimiter>(
+        /*samples_per_insert=*/1, min_size_to_sample, /*min_diff=*/-DBL_MAX,
+        /*max_diff=*/DBL_MAX);
+  }
+
+  *table = std::make_shared<Table>(
+      absl::GetFlag(FLAGS_table), std::move(sampler), std::move(remover),
+      absl::GetFlag(FLAGS_table_max_size),
+      absl::GetFlag(FLAGS_table_max_times_sampled), std::move(rate_limiter));
+  return absl::OkStatus();
+}
+
+// Appends `--episode_length` steps per episode until `stop` is set and
+// creates an item of `--sequence_length` steps every `--period` steps.
+absl::Status RunActor(TrajectoryWriter* writer,
+                      const tensorflow::TensorShape& shape,
+                      const std::atomic<bool>* stop, Stats* stats) {
+  const std::string table = absl::GetFlag(FLAGS_table);
+  const int num_columns = absl::GetFlag(FLAGS_num_columns);
+  const int sequence_length = absl::GetFlag(FLAGS_sequence_length);
+  const int period = absl::GetFlag(FLAGS_period);
+  const int episode_length = absl::GetFlag(FLAGS_episode_length);
+
+  // Random data so the compression ratio is not unrealistically high. The
+  // tensors are reused to keep their creation out of the measurements.
+  absl::BitGen bit_gen;
+  std::vector<tensorflow::Tensor> tensors;
+  for (int i = 0; i < 16; i++) {
+    tensorflow::Tensor tensor(tensorflow::DT_FLOAT, shape);
+    auto flat = tensor.flat<float>();
+    for (int j = 0; j < flat.size(); j++) {
+      flat(j) = absl::Uniform<float>(bit_gen, 0, 1);
+    }
+    tensors.push_back(std::move(tensor));
+  }
+
+  std::vector<std::deque<std::weak_ptr<CellRef>>> windows(num_columns);
+  std::vector<absl::optional<std::weak_ptr<CellRef>>> refs;
+  for (int64_t step = 0; !stop->load(); step++) {
+    const int episode_step = step % episode_length;
+    std::vector<absl::optional<tensorflow::Tensor>> data;
+    for (int i = 0; i < num_columns; i++) {
+      data.push_back(tensors[(step + i) % tensors.size()]);
+    }
+
+    const absl::Time start = absl::Now();
+    REVERB_RETURN_IF_ERROR(writer->Append(std::move(data), &refs));
+    for (int i = 0; i < num_columns; i++) {
+      windows[i].push_back(refs[i].value());
+      if (windows[i].size() > sequence_length) windows[i].pop_front();
+    }
+    if (episode_step + 1 >= sequence_length &&
+        (episode_step + 1 - sequence_length) % period == 0) {
+      std::vector<TrajectoryColumn> trajectory;
+      for (const auto& window : windows) {
+        trajectory.emplace_back(
+            std::vector<std::weak_ptr<CellRef>>(window.begin(), window.end()),
+            /*squeeze=*/false);
+      }
+      const absl::Time create_start = absl::Now();
+      REVERB_RETURN_IF_ERROR(writer->CreateItem(table, 1.0, trajectory));
+      stats->items.Record(absl::Now() - create_start);
+    }
+    stats->steps.Record(absl::Now() - start);
+
+    if (episode_step + 1 == episode_length) {
+      const absl::Time end_start = absl::Now();
+      REVERB_RETURN_IF_ERROR(writer->EndEpisode(/*clear_buffers=*/true));
+      stats->episodes.Record(absl::Now() - end_start);
+      for (auto& window : windows) window.clear();
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status RunLearner(Sampler* sampler, const std::atomic<bool>* stop,
+                        Stats* stats) {
+  std::vector<tensorflow::Tensor> data;
+  while (!stop->load()) {
+    const absl::Time start = absl::Now();
+    REVERB_RETURN_IF_ERROR(sampler->GetNextTrajectory(&data));
+    stats->samples.Record(absl::Now() - start);
+  }
+  return absl::OkStatus();
+}
+
+void PrintReport(absl::string_view prefix,
+                 const internal::LatencyHistogram& steps,
+                 const internal::LatencyHistogram& items,
+                 const internal::LatencyHistogram& episodes,
+                 const internal::LatencyHistogram& samples,
+                 absl::Duration elapsed, int64_t table_size) {
+  absl::PrintF("%s | %s | %s | %s | %s | table size %d\n", prefix,
+               FormatHistogram("steps", steps, elapsed),
+               FormatHistogram("items", items, elapsed),
+               FormatHistogram("episodes", episodes, elapsed),
+               FormatHistogram("samples", samples, elapsed), table_size);
+}
+
+int64_t TableSize(Client* client) {
+  struct Client::ServerInfo info;
+  if (!client->ServerInfo(absl::Seconds(1), &info).ok()) return -1;
+  for (const auto& table_info : info.table_info) {
+    if (table_info.name() == absl::GetFlag(FLAGS_table)) {
+      return table_info.current_size();
+    }
+  }
+  return -1;
+}
+
+absl::Status Run() {
+  tensorflow::TensorShape shape;
+  REVERB_RETURN_IF_ERROR(ParseShape(absl::GetFlag(FLAGS_shape), &shape));
+  const int sequence_length = absl::GetFlag(FLAGS_sequence_length);
+  if (sequence_length <= 0 || absl::GetFlag(FLAGS_period) <= 0 ||
+      absl::GetFlag(FLAGS_episode_length) < sequence_length ||
+      absl::GetFlag(FLAGS_num_columns) <= 0) {
+    return absl::InvalidArgumentError(
+        "--sequence_length, --period and --num_columns must be > 0 and "
+        "--episode_length must be >= --sequence_length.");
+  }
+
+  std::unique_ptr<Server> server;
+  std::string server_address = absl::GetFlag(FLAGS_server_address);
+  if (server_address.empty()) {
+    std::shared_ptr<Table> table;
+    REVERB_RETURN_IF_ERROR(MakeTable(&table));
+    const int port = internal::PickUnusedPortOrDie();
+    REVERB_RETURN_IF_ERROR(
+        StartServer({table}, port, /*checkpointer=*/nullptr, &server));
+    server_address = absl::StrCat("localhost:", port);
+  }
+  Client client(server_address);
+
+  const int chunk_length = absl::GetFlag(FLAGS_chunk_length) > 0
+                               ? absl::GetFlag(FLAGS_chunk_length)
+                               : sequence_length;
+  TrajectoryWriter::Options writer_options;
+  writer_options.chunker_options = std::make_shared<ConstantChunkerOptions>(
+      chunk_length, std::max(chunk_length, sequence_length));
+  std::vector<std::unique_ptr<TrajectoryWriter>> writers(
+      absl::GetFlag(FLAGS_num_actors));
+  for (auto& writer : writers) {
+    REVERB_RETURN_IF_ERROR(client.NewTrajectoryWriter(writer_options, &writer));
+  }
+
+  Sampler::Options sampler_options;
+  sampler_options.num_workers = absl::GetFlag(FLAGS_num_sampler_workers);
+  sampler_options.max_in_flight_samples_per_worker =
+      absl::GetFlag(FLAGS_max_in_flight_samples_per_worker);
+  std::vector<std::unique_ptr<Sampler>> samplers(
+      absl::GetFlag(FLAGS_num_learners));
+  for (auto& sampler : samplers) {
+    REVERB_RETURN_IF_ERROR(client.NewSamplerWithoutSignatureCheck(
+        absl::GetFlag(FLAGS_table), sampler_options, &sampler));
+  }
+
+  Stats stats;
+  std::atomic<bool> stop(false);
+  absl::Mutex mu;
+  absl::Status first_error;
+  auto run = [&](std::function<absl::Status()> fn) {
+    return internal::StartThread("load_generator", [&, fn = std::move(fn)] {
+      absl::Status status = fn();
+      // Errors caused by the writers and samplers being closed are expected.
+      if (!status.ok() && !stop.exchange(true)) {
+        absl::MutexLock lock(&mu);
+        first_error = status;
+      }
+    });
+  };
+  std::vector<std::unique_ptr<internal::Thread>> threads;
+  for (auto& writer : writers) {
+    threads.push_back(run([&, writer = writer.get()] {
+      return RunActor(writer, shape, &stop, &stats);
+    }));
+  }
+  for (auto& sampler : samplers) {
+    threads.push_back(run([&, sampler = sampler.get()] {
+      return RunLearner(sampler, &stop, &stats);
+    }));
+  }
+
+  const absl::Time start = absl::Now();
+  const absl::Time end = start + absl::GetFlag(FLAGS_duration);
+  const absl::Duration report_interval = absl::GetFlag(FLAGS_report_interval);
+  absl::Time last_report = start;
+  while (!stop.load() && absl::Now() < end) {
+    absl::SleepFor(std::min(report_interval, end - absl::Now()));
+    const absl::Time now = absl::Now();
+    PrintReport(absl::StrFormat("%8.1fs", absl::ToDoubleSeconds(now - start)),
+                *stats.steps.TakeInterval(), *stats.items.TakeInterval(),
+                *stats.episodes.TakeInterval(), *stats.samples.TakeInterval(),
+                now - last_report, TableSize(&client));
+    last_report = now;
+  }
+
+  stop.store(true);
+  for (auto& sampler : samplers) sampler->Close();
+  for (auto& writer : writers) writer->Close();
+  threads.clear();  // Joins the threads.
+
+  PrintReport("   total", stats.steps.total(), stats.items.total(),
+              stats.episodes.total(), stats.samples.total(),
+              last_report - start, TableSize(&client));
+
+  if (server != nullptr) server->Stop();
+  absl::MutexLock lock(&mu);
+  return first_error;
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  absl::Status status = deepmind::reverb::Run();
+  if (!status.ok()) {
+    REVERB_LOG(REVERB_ERROR) << status;
+    return 1;
+  }
+  return 0;
+}
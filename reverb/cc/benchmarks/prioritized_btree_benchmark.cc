@@ -0,0 +1,110 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Microbenchmarks of `PrioritizedSelector` and `BTreePrioritizedSelector`. Each
+// benchmark takes the branching factor of the tree (see `MakePrioritized`) and
+// the number of items as arguments, e.g.:
+//
+//   bazel run -c opt --copt=-mavx2 \
+//     //reverb/cc/benchmarks:prioritized_btree_benchmark -- \
+//     --benchmark_filter=BM_PrioritizedSampleBatch/
+
+#include <cstdint>
+#include <memory>
+
+#include "benchmark/benchmark.h"
+#include "absl/memory/memory.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/prioritized.h"
+#include "reverb/cc/selectors/prioritized_btree.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+constexpr double kPriorityExponent = 0.6;
+constexpr int kBatchSize = 256;
+
+// Creates a `PrioritizedSelector` if `state.range(0)` is 2 and a
+// `BTreePrioritizedSelector` with that branching factor otherwise, holding
+// `state.range(1)` items with keys [0, state.range(1)).
+std::unique_ptr<ItemSelector> MakePrioritized(benchmark::State& state,
+                                              absl::BitGen* bit_gen) {
+  std::unique_ptr<ItemSelector> selector;
+  if (state.range(0) == 2) {
+    state.SetLabel("PrioritizedSelector");
+    selector = absl::make_unique<PrioritizedSelector>(kPriorityExponent);
+  } else {
+    state.SetLabel("BTreePrioritizedSelector");
+    selector = absl::make_unique<BTreePrioritizedSelector>(
+        kPriorityExponent, /*branching_factor=*/state.range(0));
+  }
+  for (int64_t key = 0; key < state.range(1); key++) {
+    REVERB_CHECK(
+        selector->Insert(key, absl::Uniform<double>(*bit_gen, 0, 1)).ok());
+  }
+  return selector;
+}
+
+void BM_PrioritizedSample(benchmark::State& state) {
+  absl::BitGen bit_gen;
+  auto selector = MakePrioritized(state, &bit_gen);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(selector->Sample());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_PrioritizedSampleBatch(benchmark::State& state) {
+  absl::BitGen bit_gen;
+  auto selector = MakePrioritized(state, &bit_gen);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(selector->SampleBatch(kBatchSize));
+  }
+  state.SetItemsProcessed(state.iterations() * kBatchSize);
+}
+
+void BM_PrioritizedUpdate(benchmark::State& state) {
+  absl::BitGen bit_gen;
+  auto selector = MakePrioritized(state, &bit_gen);
+  const int64_t num_items = state.range(1);
+  for (auto _ : state) {
+    REVERB_CHECK(selector
+                     ->Update(absl::Uniform<int64_t>(bit_gen, 0, num_items),
+                              absl::Uniform<double>(bit_gen, 0, 1))
+                     .ok());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void PrioritizedArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"branching", "items"});
+  for (int branching_factor : {2, 8, 16}) {
+    for (int64_t num_items : {1 << 14, 1 << 20}) {
+      b->Args({branching_factor, num_items});
+    }
+  }
+}
+
+BENCHMARK(BM_PrioritizedSample)->Apply(PrioritizedArgs);
+BENCHMARK(BM_PrioritizedSampleBatch)->Apply(PrioritizedArgs);
+BENCHMARK(BM_PrioritizedUpdate)->Apply(PrioritizedArgs);
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
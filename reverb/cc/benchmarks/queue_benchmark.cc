@@ -0,0 +1,63 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Microbenchmarks of `Queue` and `LockFreeQueue`. Every thread pushes an item
+// and pops one with all threads sharing a single queue, so with more than one
+// thread the benchmarks measure the queues under contention.
+
+#include <cstdint>
+#include <memory>
+
+#include "benchmark/benchmark.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/support/lock_free_queue.h"
+#include "reverb/cc/support/queue.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+constexpr int kCapacity = 1024;
+
+template <typename Q>
+void BM_QueuePushPop(benchmark::State& state) {
+  static Q* queue = nullptr;
+  if (state.thread_index() == 0) {
+    queue = new Q(kCapacity);
+  }
+  int64_t value = 0;
+  for (auto _ : state) {
+    REVERB_CHECK(queue->Push(value));
+    REVERB_CHECK(queue->Pop(&value));
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    delete queue;
+    queue = nullptr;
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_QueuePushPop, Queue<int64_t>)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_QueuePushPop, LockFreeQueue<int64_t>)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,110 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Microbenchmarks of `RateLimiter` admission. The limiter never blocks so the
+// benchmarks measure the cost of the admission checks themselves, with all
+// threads sharing the limiter and the mutex guarding it (i.e the table mutex).
+
+#include <cfloat>
+#include <memory>
+
+#include "benchmark/benchmark.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/rate_limiter.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+RateLimiter* MakeLimiter() {
+  return new RateLimiter(/*samples_per_insert=*/1.0, /*min_size_to_sample=*/1,
+                         /*min_diff=*/-DBL_MAX, /*max_diff=*/DBL_MAX);
+}
+
+// One insert and one sample per iteration, each admitted under the lock.
+void BM_RateLimiterInsertAndSample(benchmark::State& state) {
+  static absl::Mutex* mu = new absl::Mutex;
+  static RateLimiter* limiter = nullptr;
+  if (state.thread_index() == 0) {
+    limiter = MakeLimiter();
+  }
+  for (auto _ : state) {
+    absl::MutexLock lock(mu);
+    REVERB_CHECK(limiter->CanInsert(mu, 1));
+    limiter->CreateInstantInsertEvent(mu);
+    limiter->Insert(mu);
+    REVERB_CHECK(limiter->MaybeCommitSample(mu));
+  }
+  state.SetItemsProcessed(state.iterations() * 2);
+  if (state.thread_index() == 0) {
+    delete limiter;
+    limiter = nullptr;
+  }
+}
+
+// `state.range(0)` inserts and samples per iteration, admitted in one call
+// each like the batched insert and sample lanes of the table.
+void BM_RateLimiterCommitBatch(benchmark::State& state) {
+  static absl::Mutex* mu = new absl::Mutex;
+  static RateLimiter* limiter = nullptr;
+  if (state.thread_index() == 0) {
+    limiter = MakeLimiter();
+  }
+  const int batch_size = state.range(0);
+  for (auto _ : state) {
+    absl::MutexLock lock(mu);
+    REVERB_CHECK_EQ(limiter->CommitInserts(mu, batch_size), batch_size);
+    for (int i = 0; i < batch_size; i++) {
+      limiter->Insert(mu);
+    }
+    REVERB_CHECK_EQ(limiter->MaybeCommitSamples(mu, batch_size), batch_size);
+  }
+  state.SetItemsProcessed(state.iterations() * batch_size * 2);
+  if (state.thread_index() == 0) {
+    delete limiter;
+    limiter = nullptr;
+  }
+}
+
+// The lock-free admission hint used by observers and the insert fast path.
+void BM_RateLimiterCanSampleWithoutLock(benchmark::State& state) {
+  static RateLimiter* limiter = nullptr;
+  if (state.thread_index() == 0) {
+    limiter = MakeLimiter();
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(limiter->CanSampleWithoutLock(1));
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    delete limiter;
+    limiter = nullptr;
+  }
+}
+
+BENCHMARK(BM_RateLimiterInsertAndSample)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_RateLimiterCommitBatch)
+    ->RangeMultiplier(8)
+    ->Range(1, 512)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK(BM_RateLimiterCanSampleWithoutLock)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
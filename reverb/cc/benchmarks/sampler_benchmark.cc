@@ -0,0 +1,290 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Microbenchmarks of the read path: a `Sampler` reading trajectories from a
+// table of 1K items, each of which references its own compressed chunk
+// (inserted through the `ChunkStore`, as the server does for written chunks).
+// `BM_LocalSampler` reads from the table directly (so no RPCs are involved)
+// and `BM_GrpcSampler` through a server running in the same process. Both
+// sweep the number of workers, `flexible_batch_size`, the sequence length and
+// the number of (float32[64]) columns and report samples per second
+// (`items_per_second`) and bytes of decompressed samples per second
+// (`bytes_per_second`) as well as these counters:
+//
+//   cpu_us_per_sample: CPU time of the process per sample. For
+//                      `BM_GrpcSampler` this includes the server, which runs
+//                      in the same process.
+//   decompress_us_per_sample, transport_us_per_sample (`BM_GrpcSampler`
+//                      only): time a worker spent decompressing a sample and
+//                      the rest of the time its stream took per sample (the
+//                      server sampling and serializing it, the transfer and
+//                      flow control). Measured from the traced streams (see
+//                      `Sampler::Options::trace_sampling_period`).
+//   decompress_fraction: decompress / (decompress + transport).
+//
+// The iteration rate of the `TrajectoryDataset` op on top of the sampler is
+// measured by `//reverb:trajectory_dataset_benchmark`.
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/client.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/net.h"
+#include "reverb/cc/platform/server.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/sampler.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/flight_recorder.h"
+#include "reverb/cc/support/task_executor.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/tensor_compression.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/types.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+constexpr int kNumItems = 1000;
+constexpr int kColumnSize = 64;
+constexpr absl::string_view kTableName = "benchmark";
+
+// One in `kTraceSamplingPeriod` streams of `BM_GrpcSampler` is traced. Streams
+// are short enough that the spans of a traced stream fit in the flight
+// recorder.
+constexpr int kTraceSamplingPeriod = 10;
+constexpr int kSamplesPerStream = 100;
+
+// Chunk `key` holding a single sequence of `sequence_length` steps. Every
+// column changes smoothly over time so that it compresses somewhat.
+ChunkData MakeChunk(uint64_t key, int sequence_length, int num_columns) {
+  ChunkData chunk;
+  chunk.set_chunk_key(key);
+  chunk.mutable_sequence_range()->set_episode_id(key);
+  chunk.mutable_sequence_range()->set_start(0);
+  chunk.mutable_sequence_range()->set_end(sequence_length - 1);
+  for (int column = 0; column < num_columns; column++) {
+    tensorflow::Tensor tensor(tensorflow::DT_FLOAT,
+                              tensorflow::TensorShape({sequence_length,
+                                                       kColumnSize}));
+    auto values = tensor.matrix<float>();
+    for (int step = 0; step < sequence_length; step++) {
+      for (int i = 0; i < kColumnSize; i++) {
+        values(step, i) = std::sin(key + column + step * 0.01f + i * 0.1f);
+      }
+    }
+    CompressChunkColumn(tensor, CompressionOptions(), &chunk);
+  }
+  chunk.set_data_tensors_len(num_columns);
+  return chunk;
+}
+
+// Table of `kNumItems` items which never blocks samplers. Each item is the
+// whole sequence of its own chunk. The tables (and their servers) are created
+// once per shape and shared by all benchmarks reading that shape.
+struct Fixture {
+  std::shared_ptr<Table> table;
+  std::unique_ptr<Server> server;
+  std::unique_ptr<Client> client;
+};
+
+Fixture* GetFixture(int sequence_length, int num_columns) {
+  static auto* const fixtures =
+      new std::map<std::pair<int, int>, std::unique_ptr<Fixture>>();
+  static auto* const chunk_store = new ChunkStore();
+
+  auto& fixture = (*fixtures)[{sequence_length, num_columns}];
+  if (fixture != nullptr) return fixture.get();
+
+  fixture = std::make_unique<Fixture>();
+  fixture->table = std::make_shared<Table>(
+      std::string(kTableName), std::make_shared<UniformSelector>(),
+      std::make_shared<FifoSelector>(), kNumItems, /*max_times_sampled=*/0,
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1,
+                                    /*min_diff=*/-DBL_MAX,
+                                    /*max_diff=*/DBL_MAX));
+  fixture->table->SetCallbackExecutor(
+      std::make_shared<TaskExecutor>(1, "worker"));
+
+  // Keys of different fixtures must not collide in the shared chunk store.
+  static uint64_t next_key = 1;
+  for (int i = 0; i < kNumItems; i++) {
+    const uint64_t key = next_key++;
+    ChunkData chunk = MakeChunk(key, sequence_length, num_columns);
+
+    Table::Item item;
+    item.item.set_key(key);
+    item.item.set_table(std::string(kTableName));
+    item.item.set_priority(1);
+    for (int column = 0; column < num_columns; column++) {
+      FlatTrajectory::ChunkSlice* slice = item.item.mutable_flat_trajectory()
+                                              ->add_columns()
+                                              ->add_chunk_slices();
+      slice->set_chunk_key(key);
+      slice->set_offset(0);
+      slice->set_length(sequence_length);
+      slice->set_index(column);
+    }
+    item.chunks.push_back(chunk_store->Insert(std::move(chunk)));
+    REVERB_CHECK(fixture->table->InsertOrAssign(std::move(item)).ok());
+  }
+
+  const int port = internal::PickUnusedPortOrDie();
+  REVERB_CHECK(StartServer({fixture->table}, port, /*checkpointer=*/nullptr,
+                           &fixture->server)
+                   .ok());
+  fixture->client =
+      std::make_unique<Client>(absl::StrCat("localhost:", port));
+  return fixture.get();
+}
+
+struct Config {
+  explicit Config(benchmark::State& state)
+      : fixture(GetFixture(state.range(2), state.range(3))) {
+    options.num_workers = state.range(0);
+    options.flexible_batch_size = state.range(1);
+    options.max_in_flight_samples_per_worker =
+        std::max<int64_t>(2 * state.range(1), 100);
+  }
+
+  Fixture* fixture;
+  Sampler::Options options;
+};
+
+// Reports the time traced streams spent decompressing samples and the rest of
+// their duration. Only streams all of whose spans are still in the flight
+// recorder are included.
+void ReportTracedStreams(benchmark::State* state) {
+  struct Stream {
+    absl::Duration rpc;
+    absl::Duration decompression;
+    int num_samples = 0;
+  };
+  std::map<uint64_t, Stream> streams;
+  for (const internal::TraceSpan& span :
+       internal::FlightRecorder::Default()->Spans()) {
+    if (span.side != internal::TraceSide::kClient) continue;
+    Stream& stream = streams[span.trace_id];
+    const absl::string_view stage = span.stage;
+    if (stage == "GrpcSamplerWorker RPC") {
+      stream.rpc = span.end - span.start;
+    } else if (stage == "Chunk decompression") {
+      stream.decompression += span.end - span.start;
+      stream.num_samples++;
+    }
+  }
+
+  absl::Duration decompression;
+  absl::Duration transport;
+  int num_samples = 0;
+  for (const auto& [trace_id, stream] : streams) {
+    if (stream.rpc == absl::ZeroDuration() ||
+        stream.num_samples != kSamplesPerStream) {
+      continue;
+    }
+    decompression += stream.decompression;
+    transport += stream.rpc - stream.decompression;
+    num_samples += stream.num_samples;
+  }
+  if (num_samples == 0) return;
+
+  state->counters["decompress_us_per_sample"] =
+      absl::ToDoubleMicroseconds(decompression) / num_samples;
+  state->counters["transport_us_per_sample"] =
+      absl::ToDoubleMicroseconds(transport) / num_samples;
+  state->counters["decompress_fraction"] =
+      absl::FDivDuration(decompression, decompression + transport);
+}
+
+void RunSampler(Sampler* sampler, benchmark::State* state) {
+  std::vector<tensorflow::Tensor> sample;
+  int64_t bytes = 0;
+  const std::clock_t cpu_start = std::clock();
+  for (auto _ : *state) {
+    REVERB_CHECK(sampler->GetNextTrajectory(&sample).ok());
+    for (const tensorflow::Tensor& column : sample) {
+      bytes += column.TotalBytes();
+    }
+  }
+  const std::clock_t cpu_end = std::clock();
+
+  state->SetItemsProcessed(state->iterations());
+  state->SetBytesProcessed(bytes);
+  state->counters["cpu_us_per_sample"] =
+      1e6 * (cpu_end - cpu_start) / CLOCKS_PER_SEC / state->iterations();
+}
+
+void BM_LocalSampler(benchmark::State& state) {
+  Config config(state);
+  Sampler sampler(config.fixture->table, config.options);
+  RunSampler(&sampler, &state);
+  sampler.Close();
+}
+
+void BM_GrpcSampler(benchmark::State& state) {
+  Config config(state);
+  config.options.max_samples_per_stream = kSamplesPerStream;
+  config.options.trace_sampling_period = kTraceSamplingPeriod;
+  internal::FlightRecorder::Default()->Clear();
+
+  std::unique_ptr<Sampler> sampler;
+  REVERB_CHECK(config.fixture->client
+                   ->NewSamplerWithoutSignatureCheck(
+                       std::string(kTableName), config.options, &sampler)
+                   .ok());
+  RunSampler(sampler.get(), &state);
+  sampler->Close();
+  ReportTracedStreams(&state);
+}
+
+void SamplerArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"workers", "batch", "sequence_length", "columns"});
+  for (int workers : {1, 4, 16}) {
+    for (int batch : {1, 16, 64}) {
+      for (int sequence_length : {1, 10, 100}) {
+        for (int columns : {1, 8}) {
+          b->Args({workers, batch, sequence_length, columns});
+        }
+      }
+    }
+  }
+  // The samples are fetched and decoded by the workers of the sampler.
+  b->UseRealTime();
+}
+
+BENCHMARK(BM_LocalSampler)->Apply(SamplerArgs);
+BENCHMARK(BM_GrpcSampler)->Apply(SamplerArgs);
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,140 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Microbenchmarks of every `ItemSelector` implementation. Each benchmark takes
+// the selector (see `kSelectors`) and the number of items as arguments, e.g.:
+//
+//   bazel run -c opt //reverb/cc/benchmarks:selector_benchmark -- \
+//     --benchmark_filter=BM_SelectorSample/3/
+//
+// `Insert` measures an insert followed by the deletion of the oldest item so
+// that the size of the selector stays constant.
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "absl/memory/memory.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/selectors/dary_heap.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/heap.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/lifo.h"
+#include "reverb/cc/selectors/prioritized.h"
+#include "reverb/cc/selectors/prioritized_btree.h"
+#include "reverb/cc/selectors/recency_weighted.h"
+#include "reverb/cc/selectors/uniform.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+struct SelectorFactory {
+  const char* name;
+  std::function<std::unique_ptr<ItemSelector>()> make;
+};
+
+const std::vector<SelectorFactory>& Selectors() {
+  static const auto* const selectors = new std::vector<SelectorFactory>{
+      {"Fifo", [] { return absl::make_unique<FifoSelector>(); }},
+      {"Lifo", [] { return absl::make_unique<LifoSelector>(); }},
+      {"Uniform", [] { return absl::make_unique<UniformSelector>(); }},
+      {"Prioritized",
+       [] { return absl::make_unique<PrioritizedSelector>(0.8); }},
+      {"BTreePrioritized",
+       [] { return absl::make_unique<BTreePrioritizedSelector>(0.8); }},
+      {"Heap", [] { return absl::make_unique<HeapSelector>(); }},
+      {"DaryHeap", [] { return absl::make_unique<DaryHeapSelector>(); }},
+      {"RecencyWeighted",
+       [] {
+         return absl::make_unique<RecencyWeightedSelector>(0.8,
+                                                           absl::Seconds(60));
+       }},
+  };
+  return *selectors;
+}
+
+// Creates the selector with index `state.range(0)` holding `state.range(1)`
+// items with keys [0, state.range(1)).
+std::unique_ptr<ItemSelector> MakeFilledSelector(benchmark::State& state,
+                                                 absl::BitGen* bit_gen) {
+  const SelectorFactory& factory = Selectors()[state.range(0)];
+  state.SetLabel(factory.name);
+  auto selector = factory.make();
+  for (int64_t key = 0; key < state.range(1); key++) {
+    REVERB_CHECK(
+        selector->Insert(key, absl::Uniform<double>(*bit_gen, 0.1, 1)).ok());
+  }
+  return selector;
+}
+
+void BM_SelectorInsert(benchmark::State& state) {
+  absl::BitGen bit_gen;
+  auto selector = MakeFilledSelector(state, &bit_gen);
+  int64_t oldest = 0;
+  int64_t next = state.range(1);
+  for (auto _ : state) {
+    REVERB_CHECK(
+        selector->Insert(next++, absl::Uniform<double>(bit_gen, 0.1, 1)).ok());
+    REVERB_CHECK(selector->Delete(oldest++).ok());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_SelectorSample(benchmark::State& state) {
+  absl::BitGen bit_gen;
+  auto selector = MakeFilledSelector(state, &bit_gen);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(selector->Sample());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_SelectorUpdate(benchmark::State& state) {
+  absl::BitGen bit_gen;
+  auto selector = MakeFilledSelector(state, &bit_gen);
+  const int64_t num_items = state.range(1);
+  for (auto _ : state) {
+    REVERB_CHECK(selector
+                     ->Update(absl::Uniform<int64_t>(bit_gen, 0, num_items),
+                              absl::Uniform<double>(bit_gen, 0.1, 1))
+                     .ok());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void SelectorArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"selector", "items"});
+  for (int i = 0; i < Selectors().size(); i++) {
+    for (int64_t num_items : {1 << 10, 1 << 14, 1 << 18}) {
+      b->Args({i, num_items});
+    }
+  }
+}
+
+BENCHMARK(BM_SelectorInsert)->Apply(SelectorArgs);
+BENCHMARK(BM_SelectorSample)->Apply(SelectorArgs);
+BENCHMARK(BM_SelectorUpdate)->Apply(SelectorArgs);
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
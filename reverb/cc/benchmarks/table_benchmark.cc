@@ -0,0 +1,193 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Microbenchmarks of `Table` insert, sample, mutate and delete for tables of
+// 1K, 16K and 256K items with 1 to 16 threads sharing the table. The tables
+// use a prioritized sampler, a FIFO remover and a rate limiter which never
+// blocks. All items reference the same chunk, so the benchmarks measure the
+// table rather than the creation of chunks.
+
+#include <cfloat>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/prioritized.h"
+#include "reverb/cc/support/task_executor.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/testing/proto_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Keys of items inserted by different threads are `kKeyStride` apart.
+constexpr uint64_t kKeyStride = uint64_t{1} << 40;
+
+Table::Item MakeItem(uint64_t key, double priority) {
+  static const auto* const data =
+      new ChunkData(testing::MakeChunkData(/*key=*/1));
+  static const auto* const chunk = new std::shared_ptr<ChunkStore::Chunk>(
+      std::make_shared<ChunkStore::Chunk>(*data));
+  static const auto* const prototype = new PrioritizedItem(
+      testing::MakePrioritizedItem(/*key=*/0, /*priority=*/1, {*data}));
+
+  Table::Item item;
+  item.item = *prototype;
+  item.item.set_key(key);
+  item.item.set_priority(priority);
+  item.chunks.push_back(*chunk);
+  return item;
+}
+
+// Creates a table holding at most `max_size` items and inserts `num_items`
+// items with keys `thread * kKeyStride + [0, num_items / num_threads)`.
+Table* MakeFilledTable(int64_t max_size, int64_t num_items, int num_threads) {
+  auto* table = new Table(
+      "benchmark", std::make_shared<PrioritizedSelector>(0.8),
+      std::make_shared<FifoSelector>(), max_size, /*max_times_sampled=*/0,
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1,
+                                    /*min_diff=*/-DBL_MAX,
+                                    /*max_diff=*/DBL_MAX));
+  table->SetCallbackExecutor(std::make_shared<TaskExecutor>(1, "worker"));
+  absl::BitGen bit_gen;
+  for (int thread = 0; thread < num_threads; thread++) {
+    for (int64_t i = 0; i < num_items / num_threads; i++) {
+      REVERB_CHECK(table
+                       ->InsertOrAssign(MakeItem(thread * kKeyStride + i,
+                                                 absl::Uniform<double>(
+                                                     bit_gen, 0.1, 1)))
+                       .ok());
+    }
+  }
+  return table;
+}
+
+void DestroyTable(Table* table) {
+  table->Close();
+  delete table;
+}
+
+// Inserts into a full table, so every insert also evicts the oldest item.
+void BM_TableInsert(benchmark::State& state) {
+  static Table* table = nullptr;
+  const int64_t num_items = state.range(0);
+  if (state.thread_index() == 0) {
+    table = MakeFilledTable(num_items, num_items, state.threads());
+  }
+  absl::BitGen bit_gen;
+  uint64_t key =
+      state.thread_index() * kKeyStride + num_items / state.threads();
+  for (auto _ : state) {
+    REVERB_CHECK(
+        table->InsertOrAssign(MakeItem(key++, absl::Uniform(bit_gen, 0.1, 1)))
+            .ok());
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    DestroyTable(table);
+    table = nullptr;
+  }
+}
+
+void BM_TableSample(benchmark::State& state) {
+  static Table* table = nullptr;
+  if (state.thread_index() == 0) {
+    table = MakeFilledTable(state.range(0), state.range(0), state.threads());
+  }
+  Table::SampledItem item;
+  for (auto _ : state) {
+    REVERB_CHECK(table->Sample(&item).ok());
+  }
+  state.SetItemsProcessed(state.iterations());
+  item = Table::SampledItem();
+  if (state.thread_index() == 0) {
+    DestroyTable(table);
+    table = nullptr;
+  }
+}
+
+// Updates the priority of a random item inserted by the same thread.
+void BM_TableMutate(benchmark::State& state) {
+  static Table* table = nullptr;
+  const int64_t num_items = state.range(0);
+  if (state.thread_index() == 0) {
+    table = MakeFilledTable(num_items, num_items, state.threads());
+  }
+  absl::BitGen bit_gen;
+  const uint64_t first_key = state.thread_index() * kKeyStride;
+  const int64_t keys_per_thread = num_items / state.threads();
+  KeyWithPriority update;
+  for (auto _ : state) {
+    update.set_key(first_key +
+                   absl::Uniform<int64_t>(bit_gen, 0, keys_per_thread));
+    update.set_priority(absl::Uniform(bit_gen, 0.1, 1));
+    REVERB_CHECK(table->MutateItems({update}, {}).ok());
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    DestroyTable(table);
+    table = nullptr;
+  }
+}
+
+// Deletes the oldest item inserted by the thread and inserts a new one so the
+// size of the table stays constant. Unlike `BM_TableInsert` the table is
+// never full, so the delete is explicit rather than an eviction.
+void BM_TableDelete(benchmark::State& state) {
+  static Table* table = nullptr;
+  const int64_t num_items = state.range(0);
+  if (state.thread_index() == 0) {
+    table = MakeFilledTable(2 * num_items, num_items, state.threads());
+  }
+  absl::BitGen bit_gen;
+  uint64_t oldest = state.thread_index() * kKeyStride;
+  uint64_t next = oldest + num_items / state.threads();
+  for (auto _ : state) {
+    const Table::Key key = oldest++;
+    REVERB_CHECK(table->MutateItems({}, {key}).ok());
+    REVERB_CHECK(
+        table->InsertOrAssign(MakeItem(next++, absl::Uniform(bit_gen, 0.1, 1)))
+            .ok());
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    DestroyTable(table);
+    table = nullptr;
+  }
+}
+
+void TableArgs(benchmark::internal::Benchmark* b) {
+  b->RangeMultiplier(16)->Range(1 << 10, 1 << 18)->ThreadRange(1, 16);
+  b->UseRealTime();
+}
+
+BENCHMARK(BM_TableInsert)->Apply(TableArgs);
+BENCHMARK(BM_TableSample)->Apply(TableArgs);
+BENCHMARK(BM_TableMutate)->Apply(TableArgs);
+BENCHMARK(BM_TableDelete)->Apply(TableArgs);
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,502 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Microbenchmarks of the write path fed with steps shaped like common
+// workloads:
+//
+//   Atari:    84x84x4 uint8 frame stacks (with mostly static frames), an int32
+//             action and a float reward.
+//   MuJoCo:   float vectors of a humanoid (376 observations and 17 actions)
+//             which change smoothly, and a float reward.
+//   Language: 256 int32 tokens (Zipf distributed), the targets and a uint8
+//             loss mask.
+//
+// `BM_CompressChunkColumn` and `BM_DecompressChunkColumn` measure the codecs
+// on whole chunks, `BM_Chunker` a `Chunker` per column and
+// `BM_TrajectoryWriter` a `TrajectoryWriter` inserting an item per step into a
+// local table (so no RPCs are involved). All of them sweep the workload, the
+// chunk length, delta encoding and the codec and report steps per second
+// (`items_per_second`) as well as these counters:
+//
+//   bytes_per_step:    compressed bytes of the chunks per step.
+//   compression_ratio: uncompressed / compressed bytes of the chunks.
+//   append_p50_us, append_p99_us, append_p999_us: latency percentiles of
+//                      appending a step (`BM_Chunker` and `BM_TrajectoryWriter`
+//                      only). Chunks are compressed by the appending thread, so
+//                      the tail includes the compression of a chunk.
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "absl/random/distributions.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/chunker.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/support/signature.h"
+#include "reverb/cc/support/task_executor.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/tensor_compression.h"
+#include "reverb/cc/trajectory_writer.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/types.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Number of distinct steps generated per workload. The benchmarks cycle
+// through them, starting a new episode each time. A multiple of all the chunk
+// lengths so that episodes end with full chunks.
+constexpr int kEpisodeLength = 200;
+
+struct Workload {
+  std::string name;
+  std::vector<internal::TensorSpec> specs;
+  // `steps[i][j]` is the value of column `j` in step `i`.
+  std::vector<std::vector<tensorflow::Tensor>> steps;
+};
+
+template <typename T>
+tensorflow::Tensor Scalar(tensorflow::DataType dtype, T value) {
+  tensorflow::Tensor tensor(dtype, tensorflow::TensorShape({}));
+  tensor.scalar<T>()() = value;
+  return tensor;
+}
+
+// Frames are a static background of horizontal bands with a few moving
+// sprites and sparse noise, which is roughly how much consecutive Atari frames
+// differ.
+Workload MakeAtari() {
+  constexpr int kSize = 84;
+  constexpr int kStack = 4;
+  std::mt19937 gen(1);
+  std::vector<std::vector<uint8_t>> frames(kEpisodeLength + kStack - 1);
+  std::vector<uint8_t> frame(kSize * kSize);
+  for (int row = 0; row < kSize; row++) {
+    std::fill_n(frame.begin() + row * kSize, kSize, (row / 12) * 32);
+  }
+  for (int i = 0; i < frames.size(); i++) {
+    std::vector<uint8_t>& current = frames[i];
+    current = frame;
+    for (int sprite = 0; sprite < 3; sprite++) {
+      const int top = (i * (sprite + 1) + sprite * 20) % (kSize - 6);
+      const int left = (i * 2 + sprite * 30) % (kSize - 6);
+      for (int row = top; row < top + 6; row++) {
+        std::fill_n(current.begin() + row * kSize + left, 6, 255);
+      }
+    }
+    for (int noise = 0; noise < kSize * kSize / 100; noise++) {
+      current[absl::Uniform(gen, 0, kSize * kSize)] =
+          absl::Uniform<int>(gen, 0, 256);
+    }
+  }
+
+  Workload workload;
+  workload.name = "Atari";
+  workload.specs = {
+      {"observation", tensorflow::DT_UINT8, {kSize, kSize, kStack}},
+      {"action", tensorflow::DT_INT32, tensorflow::PartialTensorShape({})},
+      {"reward", tensorflow::DT_FLOAT, tensorflow::PartialTensorShape({})},
+  };
+  for (int step = 0; step < kEpisodeLength; step++) {
+    tensorflow::Tensor observation(
+        tensorflow::DT_UINT8, tensorflow::TensorShape({kSize, kSize, kStack}));
+    auto values = observation.tensor<uint8_t, 3>();
+    for (int channel = 0; channel < kStack; channel++) {
+      const std::vector<uint8_t>& stacked = frames[step + channel];
+      for (int i = 0; i < kSize * kSize; i++) {
+        values(i / kSize, i % kSize, channel) = stacked[i];
+      }
+    }
+    workload.steps.push_back(
+        {observation,
+         Scalar<int32_t>(tensorflow::DT_INT32, absl::Uniform(gen, 0, 18)),
+         Scalar<float>(tensorflow::DT_FLOAT,
+                       absl::Bernoulli(gen, 0.05) ? 1.0f : 0.0f)});
+  }
+  return workload;
+}
+
+Workload MakeMujoco() {
+  constexpr int kObservationSize = 376;
+  constexpr int kActionSize = 17;
+  std::mt19937 gen(2);
+  Workload workload;
+  workload.name = "MuJoCo";
+  workload.specs = {
+      {"observation", tensorflow::DT_FLOAT, {kObservationSize}},
+      {"action", tensorflow::DT_FLOAT, {kActionSize}},
+      {"reward", tensorflow::DT_FLOAT, tensorflow::PartialTensorShape({})},
+  };
+  std::vector<float> state(kObservationSize);
+  for (float& value : state) value = absl::Gaussian<float>(gen);
+  for (int step = 0; step < kEpisodeLength; step++) {
+    tensorflow::Tensor observation(tensorflow::DT_FLOAT,
+                                   tensorflow::TensorShape({kObservationSize}));
+    for (int i = 0; i < kObservationSize; i++) {
+      state[i] += absl::Gaussian<float>(gen, 0, 0.01);
+      observation.flat<float>()(i) = state[i];
+    }
+    tensorflow::Tensor action(tensorflow::DT_FLOAT,
+                              tensorflow::TensorShape({kActionSize}));
+    for (int i = 0; i < kActionSize; i++) {
+      action.flat<float>()(i) = absl::Uniform<float>(gen, -1, 1);
+    }
+    workload.steps.push_back(
+        {observation, action,
+         Scalar<float>(tensorflow::DT_FLOAT, absl::Gaussian<float>(gen))});
+  }
+  return workload;
+}
+
+Workload MakeLanguage() {
+  constexpr int kSequenceLength = 256;
+  constexpr int kVocabularySize = 32000;
+  std::mt19937 gen(3);
+  Workload workload;
+  workload.name = "Language";
+  workload.specs = {
+      {"tokens", tensorflow::DT_INT32, {kSequenceLength}},
+      {"targets", tensorflow::DT_INT32, {kSequenceLength}},
+      {"loss_mask", tensorflow::DT_UINT8, {kSequenceLength}},
+  };
+  for (int step = 0; step < kEpisodeLength; step++) {
+    const tensorflow::TensorShape shape({kSequenceLength});
+    tensorflow::Tensor tokens(tensorflow::DT_INT32, shape);
+    tensorflow::Tensor targets(tensorflow::DT_INT32, shape);
+    tensorflow::Tensor loss_mask(tensorflow::DT_UINT8, shape);
+    const int prompt_length = absl::Uniform(gen, 0, kSequenceLength / 2);
+    int32_t next = absl::Zipf<int32_t>(gen, kVocabularySize - 1);
+    for (int i = 0; i < kSequenceLength; i++) {
+      tokens.flat<int32_t>()(i) = next;
+      next = absl::Zipf<int32_t>(gen, kVocabularySize - 1);
+      targets.flat<int32_t>()(i) = next;
+      loss_mask.flat<uint8_t>()(i) = i >= prompt_length;
+    }
+    workload.steps.push_back({tokens, targets, loss_mask});
+  }
+  return workload;
+}
+
+const std::vector<Workload>& Workloads() {
+  static const auto* const workloads =
+      new std::vector<Workload>{MakeAtari(), MakeMujoco(), MakeLanguage()};
+  return *workloads;
+}
+
+// Selects the workload, chunk length, delta encoding and codec from the
+// arguments of the benchmark (see `WriterArgs`).
+struct Config {
+  explicit Config(benchmark::State& state)
+      : workload(Workloads()[state.range(0)]),
+        chunk_length(state.range(1)),
+        delta_encode(state.range(2) != 0) {
+    compression.set_codec(static_cast<CompressionCodec>(state.range(3)));
+    state.SetLabel(absl::StrCat(workload.name, "/",
+                                CompressionCodec_Name(compression.codec())));
+  }
+
+  const Workload& workload;
+  const int chunk_length;
+  const bool delta_encode;
+  CompressionOptions compression;
+};
+
+// Totals of the chunks created by all `Chunker`s sharing them.
+struct ChunkTotals {
+  std::atomic<int64_t> uncompressed_bytes{0};
+  std::atomic<int64_t> compressed_bytes{0};
+};
+
+// Constant options which add the statistics of every compressed chunk to
+// `totals`. Clones (as used by `TrajectoryWriter`) share the totals.
+class RecordingChunkerOptions : public ConstantChunkerOptions {
+ public:
+  RecordingChunkerOptions(const Config& config,
+                          std::shared_ptr<ChunkTotals> totals)
+      : ConstantChunkerOptions(config.chunk_length, config.chunk_length,
+                               config.delta_encode, config.compression),
+        totals_(std::move(totals)) {}
+
+  void OnChunkCompressed(const ChunkStatistics& statistics) override {
+    totals_->uncompressed_bytes += statistics.uncompressed_bytes;
+    totals_->compressed_bytes += statistics.compressed_bytes;
+  }
+
+  std::shared_ptr<ChunkerOptions> Clone() const override {
+    return std::make_shared<RecordingChunkerOptions>(*this);
+  }
+
+ private:
+  std::shared_ptr<ChunkTotals> totals_;
+};
+
+void ReportChunkSizes(int64_t num_steps, int64_t uncompressed_bytes,
+                      int64_t compressed_bytes, benchmark::State* state) {
+  state->SetItemsProcessed(num_steps);
+  state->SetBytesProcessed(uncompressed_bytes);
+  if (num_steps > 0 && compressed_bytes > 0) {
+    state->counters["bytes_per_step"] =
+        static_cast<double>(compressed_bytes) / num_steps;
+    state->counters["compression_ratio"] =
+        static_cast<double>(uncompressed_bytes) / compressed_bytes;
+  }
+}
+
+// Latencies of the individual `Append` calls.
+class AppendLatencies {
+ public:
+  void Record(absl::Duration latency) {
+    nanos_.push_back(absl::ToInt64Nanoseconds(latency));
+  }
+
+  void Report(benchmark::State* state) {
+    if (nanos_.empty()) return;
+    std::sort(nanos_.begin(), nanos_.end());
+    auto percentile = [this](double q) {
+      return nanos_[std::min<size_t>(nanos_.size() * q, nanos_.size() - 1)] /
+             1000.0;
+    };
+    state->counters["append_p50_us"] = percentile(0.5);
+    state->counters["append_p99_us"] = percentile(0.99);
+    state->counters["append_p999_us"] = percentile(0.999);
+  }
+
+ private:
+  std::vector<int64_t> nanos_;
+};
+
+// `steps[offset, offset + length)` of `column` stacked into a batch.
+tensorflow::Tensor StackSteps(const Workload& workload, int column,
+                              int offset, int length) {
+  const tensorflow::Tensor& first = workload.steps[offset][column];
+  tensorflow::TensorShape shape = first.shape();
+  shape.InsertDim(0, length);
+  tensorflow::Tensor batch(first.dtype(), shape);
+  const size_t row_bytes = first.TotalBytes();
+  char* data = static_cast<char*>(batch.data());
+  for (int i = 0; i < length; i++) {
+    std::memcpy(data + i * row_bytes,
+                workload.steps[offset + i][column].tensor_data().data(),
+                row_bytes);
+  }
+  return batch;
+}
+
+// The (uncompressed) batches of all chunks of an episode, per column.
+std::vector<std::vector<tensorflow::Tensor>> MakeChunkBatches(
+    const Config& config) {
+  std::vector<std::vector<tensorflow::Tensor>> chunks;
+  for (int offset = 0; offset < kEpisodeLength; offset += config.chunk_length) {
+    chunks.emplace_back();
+    for (int column = 0; column < config.workload.specs.size(); column++) {
+      chunks.back().push_back(
+          StackSteps(config.workload, column, offset, config.chunk_length));
+    }
+  }
+  return chunks;
+}
+
+ChunkData CompressChunk(const Config& config,
+                        const std::vector<tensorflow::Tensor>& columns) {
+  ChunkData chunk;
+  chunk.set_delta_encoded(config.delta_encode);
+  for (const tensorflow::Tensor& column : columns) {
+    CompressChunkColumn(column, config.compression, &chunk);
+  }
+  return chunk;
+}
+
+void BM_CompressChunkColumn(benchmark::State& state) {
+  const Config config(state);
+  const auto chunks = MakeChunkBatches(config);
+  int64_t uncompressed_bytes = 0;
+  int64_t compressed_bytes = 0;
+  int64_t i = 0;
+  for (auto _ : state) {
+    const std::vector<tensorflow::Tensor>& columns =
+        chunks[i++ % chunks.size()];
+    ChunkData chunk = CompressChunk(config, columns);
+    for (const tensorflow::Tensor& column : columns) {
+      uncompressed_bytes += column.TotalBytes();
+    }
+    compressed_bytes += chunk.data().ByteSizeLong();
+  }
+  ReportChunkSizes(state.iterations() * config.chunk_length,
+                   uncompressed_bytes, compressed_bytes, &state);
+}
+
+void BM_DecompressChunkColumn(benchmark::State& state) {
+  const Config config(state);
+  std::vector<ChunkData> chunks;
+  int64_t chunk_uncompressed_bytes = 0;
+  int64_t chunk_compressed_bytes = 0;
+  for (const auto& columns : MakeChunkBatches(config)) {
+    chunks.push_back(CompressChunk(config, columns));
+    for (const tensorflow::Tensor& column : columns) {
+      chunk_uncompressed_bytes += column.TotalBytes();
+    }
+    chunk_compressed_bytes += chunks.back().data().ByteSizeLong();
+  }
+  int64_t i = 0;
+  for (auto _ : state) {
+    const ChunkData& chunk = chunks[i++ % chunks.size()];
+    for (int column = 0; column < config.workload.specs.size(); column++) {
+      benchmark::DoNotOptimize(DecompressChunkColumn(chunk, column));
+    }
+  }
+  // Every chunk has the same number of steps, so the sizes of the average
+  // chunk are reported.
+  const int64_t num_chunks = state.iterations();
+  ReportChunkSizes(num_chunks * config.chunk_length,
+                   num_chunks * chunk_uncompressed_bytes / chunks.size(),
+                   num_chunks * chunk_compressed_bytes / chunks.size(),
+                   &state);
+}
+
+void BM_Chunker(benchmark::State& state) {
+  const Config config(state);
+  auto totals = std::make_shared<ChunkTotals>();
+  auto options = std::make_shared<RecordingChunkerOptions>(config, totals);
+  std::vector<std::shared_ptr<Chunker>> chunkers;
+  for (const internal::TensorSpec& spec : config.workload.specs) {
+    chunkers.push_back(std::make_shared<Chunker>(spec, options));
+  }
+
+  AppendLatencies latencies;
+  std::weak_ptr<CellRef> ref;
+  uint64_t episode_id = 0;
+  int step = 0;
+  for (auto _ : state) {
+    const std::vector<tensorflow::Tensor>& columns =
+        config.workload.steps[step];
+    const absl::Time start = absl::Now();
+    for (int column = 0; column < columns.size(); column++) {
+      REVERB_CHECK(chunkers[column]
+                       ->Append(columns[column], {episode_id, step}, &ref)
+                       .ok());
+    }
+    latencies.Record(absl::Now() - start);
+    if (++step == kEpisodeLength) {
+      step = 0;
+      episode_id++;
+    }
+  }
+  for (auto& chunker : chunkers) REVERB_CHECK(chunker->Flush().ok());
+
+  ReportChunkSizes(state.iterations(), totals->uncompressed_bytes,
+                   totals->compressed_bytes, &state);
+  latencies.Report(&state);
+}
+
+void BM_TrajectoryWriter(benchmark::State& state) {
+  const Config config(state);
+  auto table = std::make_shared<Table>(
+      "benchmark", std::make_shared<FifoSelector>(),
+      std::make_shared<FifoSelector>(), /*max_size=*/1000,
+      /*max_times_sampled=*/0,
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1,
+                                    /*min_diff=*/-DBL_MAX,
+                                    /*max_diff=*/DBL_MAX));
+  table->SetCallbackExecutor(std::make_shared<TaskExecutor>(1, "worker"));
+
+  TrajectoryWriter::LocalServer server;
+  server.chunk_store = std::make_shared<ChunkStore>();
+  server.get_table = [&table](absl::string_view name,
+                              std::shared_ptr<Table>* out) {
+    *out = table;
+    return absl::OkStatus();
+  };
+  auto totals = std::make_shared<ChunkTotals>();
+  TrajectoryWriter::Options options;
+  options.chunker_options =
+      std::make_shared<RecordingChunkerOptions>(config, totals);
+  auto writer = std::make_unique<TrajectoryWriter>(server, options);
+
+  // Every step is inserted as an item of a single step.
+  AppendLatencies latencies;
+  std::vector<absl::optional<std::weak_ptr<CellRef>>> refs;
+  std::vector<TrajectoryColumn> trajectory;
+  int step = 0;
+  for (auto _ : state) {
+    const std::vector<tensorflow::Tensor>& columns =
+        config.workload.steps[step];
+    std::vector<absl::optional<tensorflow::Tensor>> data(columns.begin(),
+                                                         columns.end());
+    const absl::Time start = absl::Now();
+    REVERB_CHECK(writer->Append(std::move(data), &refs).ok());
+    latencies.Record(absl::Now() - start);
+
+    trajectory.clear();
+    for (const auto& ref : refs) {
+      trajectory.push_back(TrajectoryColumn({*ref}, /*squeeze=*/true));
+    }
+    REVERB_CHECK(writer->CreateItem("benchmark", 1.0, trajectory).ok());
+    if (++step == kEpisodeLength) {
+      step = 0;
+      REVERB_CHECK(writer->EndEpisode(/*clear_buffers=*/true).ok());
+    }
+  }
+  REVERB_CHECK(writer->Flush().ok());
+  writer = nullptr;
+  table->Close();
+
+  ReportChunkSizes(state.iterations(), totals->uncompressed_bytes,
+                   totals->compressed_bytes, &state);
+  latencies.Report(&state);
+}
+
+void WriterArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"workload", "chunk_length", "delta", "codec"});
+  for (int workload = 0; workload < Workloads().size(); workload++) {
+    for (int chunk_length : {1, 10, 50}) {
+      for (int delta : {0, 1}) {
+        for (CompressionCodec codec :
+             {COMPRESSION_CODEC_NONE, COMPRESSION_CODEC_SNAPPY,
+              COMPRESSION_CODEC_ZLIB}) {
+          b->Args({workload, chunk_length, delta, codec});
+        }
+      }
+    }
+  }
+}
+
+BENCHMARK(BM_CompressChunkColumn)->Apply(WriterArgs);
+BENCHMARK(BM_DecompressChunkColumn)->Apply(WriterArgs);
+BENCHMARK(BM_Chunker)->Apply(WriterArgs);
+BENCHMARK(BM_TrajectoryWriter)->Apply(WriterArgs);
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
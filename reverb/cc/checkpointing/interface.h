@@ -48,6 +48,14 @@ class Checkpointer {
   virtual absl::Status LoadLatest(
       ChunkStore* chunk_store, std::vector<std::shared_ptr<Table>>* tables) = 0;
 
+  // Like `LoadLatest` but may return before the data of all chunks has been
+  // read. Chunks which have not yet been read are read on first access.
+  // Checkpointers which cannot restore lazily load the checkpoint eagerly.
+  virtual absl::Status LoadLatestLazily(
+      ChunkStore* chunk_store, std::vector<std::shared_ptr<Table>>* tables) {
+    return LoadLatest(chunk_store, tables);
+  }
+
   // Attempts to load a specific fallback checkpoint, if provided.
   virtual absl::Status LoadFallbackCheckpoint(
       ChunkStore* chunk_store, std::vector<std::shared_ptr<Table>>* tables) = 0;
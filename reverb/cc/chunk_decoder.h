@@ -0,0 +1,52 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_CHUNK_DECODER_H_
+#define REVERB_CC_CHUNK_DECODER_H_
+
+#include "absl/status/status.h"
+#include "reverb/cc/schema.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Decodes the columns of sampled chunks in place of the built-in CPU decoding
+// (i.e decompression followed by delta decoding). This allows the decoding of
+// large columns (e.g images) to be offloaded to hardware accelerated codecs,
+// for example decompressing on a GPU into unified or pinned host memory.
+//
+// Decoders are selected through `Sampler::Options::chunk_decoder` and shared
+// by all the workers of the sampler so implementations must be thread safe.
+class ChunkDecoder {
+ public:
+  virtual ~ChunkDecoder() = default;
+
+  // Returns true if `column` of `chunk` should be decoded by `Decode`. All
+  // other columns are decoded on the CPU as usual so a decoder only has to
+  // support the codecs (see `GetChunkColumnCodec`) which it accelerates.
+  virtual bool CanDecode(const ChunkData& chunk, int column) const = 0;
+
+  // Decodes all the rows of `column` of `chunk` into `out`. The result must
+  // match `UnpackChunkColumn`. The sampler slices and concatenates the decoded
+  // columns on the CPU so the buffer of `out` must be host accessible.
+  virtual absl::Status Decode(const ChunkData& chunk, int column,
+                              tensorflow::Tensor* out) const = 0;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_CHUNK_DECODER_H_
@@ -15,80 +15,541 @@
 #include "reverb/cc/chunk_store.h"
 
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include <cstdint>
+#include "absl/base/call_once.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/strings/cord.h"
 #include "absl/strings/str_cat.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/status_macros.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/schema.pb.h"
-#include "reverb/cc/support/queue.h"
+#include "reverb/cc/support/cord_util.h"
+#include "reverb/cc/support/lock_profiler.h"
+#include "reverb/cc/support/periodic_closure.h"
+#include "reverb/cc/support/spill_file.h"
 #include "reverb/cc/tensor_compression.h"
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor.pb.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 
 namespace deepmind {
 namespace reverb {
 
-ChunkStore::Chunk::Chunk(ChunkData data) : data_(std::move(data)) {}
+namespace {
 
-uint64_t ChunkStore::Chunk::key() const { return data_.chunk_key(); }
+// Names under which the mutexes of the shards of all chunk stores are reported
+// by the lock profiler.
+constexpr char kShardMu[] = "ChunkStore::Shard::mu";
+constexpr char kDeletedKeysMu[] = "ChunkStore::Shard::deleted_keys_mu";
 
-const ChunkData& ChunkStore::Chunk::data() const { return data_; }
+// Decompresses (and delta decodes) the tensor of `column` in `chunk_data`.
+tensorflow::Tensor DecodeColumn(const ChunkData& chunk_data, int column) {
+  return DecompressChunkColumn(chunk_data, column);
+}
+
+int NumColumns(const ChunkData& data) {
+  // Try to get number of columns without parsing lazy tensors field.
+  if (data.data_tensors_len() != 0) {
+    return data.data_tensors_len();
+  }
+  return data.data().tensors_size();
+}
+
+int32_t NumRows(const ChunkData& data) {
+  return data.sequence_range().end() - data.sequence_range().start() + 1;
+}
+
+// Checks that the serialized `ChunkData::Data` can be parsed and adds the
+// number of tensors it holds to `num_tensors`. Every field but the content of
+// the tensors is parsed as any bytes are a valid content. This ensures that
+// the data of chunks created from their wire encoding can be parsed when
+// accessed without copying the content up front.
+absl::Status ValidateData(const absl::Cord& serialized, int* num_tensors) {
+  std::vector<absl::Cord> tensors;
+  absl::Cord rest;
+  REVERB_RETURN_IF_ERROR(internal::SplitField(
+      serialized, ChunkData::Data::kTensorsFieldNumber, &tensors, &rest));
+  for (const absl::Cord& tensor : tensors) {
+    std::vector<absl::Cord> content;
+    absl::Cord metadata;
+    REVERB_RETURN_IF_ERROR(internal::SplitField(
+        tensor, tensorflow::TensorProto::kTensorContentFieldNumber, &content,
+        &metadata));
+    tensorflow::TensorProto proto;
+    if (!internal::ParseFromCord(metadata, &proto)) {
+      return absl::InvalidArgumentError("Failed to parse chunk tensor.");
+    }
+  }
+  // Blocks and frame stacks are parsed in full.
+  ChunkData::Data data;
+  if (!internal::ParseFromCord(rest, &data)) {
+    return absl::InvalidArgumentError("Failed to parse chunk data.");
+  }
+  *num_tensors += tensors.size();
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+ChunkStore::Chunk::DataPin::DataPin(const Chunk* chunk) : chunk_(chunk) {
+  if (!chunk_->managed()) return;
+  absl::MutexLock lock(&chunk_->mu_);
+  chunk_->num_pins_++;
+  chunk_->last_access_ = absl::Now();
+  if (!chunk_->resident_) chunk_->FaultIn();
+}
+
+ChunkStore::Chunk::DataPin::DataPin(DataPin&& other) : chunk_(other.chunk_) {
+  other.chunk_ = nullptr;
+}
+
+ChunkStore::Chunk::DataPin& ChunkStore::Chunk::DataPin::operator=(
+    DataPin&& other) {
+  std::swap(chunk_, other.chunk_);
+  return *this;
+}
+
+ChunkStore::Chunk::DataPin::~DataPin() {
+  if (chunk_ == nullptr || !chunk_->managed()) return;
+  absl::MutexLock lock(&chunk_->mu_);
+  chunk_->num_pins_--;
+  chunk_->last_access_ = absl::Now();
+}
+
+ChunkStore::Chunk::Chunk(ChunkData data)
+    : key_(data.chunk_key()),
+      episode_id_(data.sequence_range().episode_id()),
+      num_rows_(NumRows(data)),
+      num_columns_(NumColumns(data)),
+      owned_data_(std::move(data)),
+      data_(&owned_data_),
+      decoded_columns_(new DecodedColumn[num_columns_]) {}
+
+ChunkStore::Chunk::Chunk(std::shared_ptr<google::protobuf::Arena> arena,
+                         const ChunkData* data)
+    : key_(data->chunk_key()),
+      episode_id_(data->sequence_range().episode_id()),
+      num_rows_(NumRows(*data)),
+      num_columns_(NumColumns(*data)),
+      arena_(std::move(arena)),
+      data_(data),
+      decoded_columns_(new DecodedColumn[num_columns_]) {
+  REVERB_CHECK(data_->GetArena() == arena_.get());
+}
+
+ChunkStore::Chunk::Chunk(std::shared_ptr<const ChunkData> data)
+    : key_(data->chunk_key()),
+      episode_id_(data->sequence_range().episode_id()),
+      num_rows_(NumRows(*data)),
+      num_columns_(NumColumns(*data)),
+      shared_data_(std::move(data)),
+      data_(shared_data_.get()),
+      decoded_columns_(new DecodedColumn[num_columns_]) {}
+
+ChunkStore::Chunk::Chunk(DeferredChunk deferred)
+    : key_(deferred.key),
+      episode_id_(deferred.episode_id),
+      num_rows_(deferred.num_rows),
+      num_columns_(deferred.num_columns),
+      data_(&owned_data_),
+      deferred_(true),
+      decoded_columns_(new DecodedColumn[num_columns_]) {
+  absl::call_once(data_byte_size_once_, [this, &deferred] {
+    data_byte_size_ = deferred.data_byte_size;
+  });
+  absl::MutexLock lock(&mu_);
+  loader_ = std::move(deferred.loader);
+  resident_ = false;
+  last_access_ = absl::Now();
+}
+
+ChunkStore::Chunk::Chunk(const ChunkData& metadata, absl::Cord serialized)
+    : key_(metadata.chunk_key()),
+      episode_id_(metadata.sequence_range().episode_id()),
+      num_rows_(NumRows(metadata)),
+      num_columns_(NumColumns(metadata)),
+      data_(&owned_data_),
+      deferred_(true),
+      decoded_columns_(new DecodedColumn[num_columns_]) {
+  absl::call_once(data_byte_size_once_, [this, &serialized] {
+    data_byte_size_ = serialized.size();
+  });
+  absl::MutexLock lock(&mu_);
+  wire_ = std::move(serialized);
+  resident_ = false;
+  last_access_ = absl::Now();
+}
+
+ChunkStore::Chunk::~Chunk() {
+  if (tiered_ == nullptr) return;
+  tiered_->Unregister(this);
+  absl::MutexLock lock(&mu_);
+  if (spilled_) {
+    tiered_->file()->Release(region_);
+  }
+}
+
+uint64_t ChunkStore::Chunk::key() const { return key_; }
+
+const ChunkData& ChunkStore::Chunk::data() const {
+  if (!managed()) return *data_;
+  absl::MutexLock lock(&mu_);
+  last_access_ = absl::Now();
+  if (!resident_) FaultIn();
+  return *data_;
+}
+
+ChunkStore::Chunk::DataPin ChunkStore::Chunk::Pin() const {
+  return DataPin(this);
+}
+
+void ChunkStore::Chunk::Prefetch() const {
+  if (tiered_ == nullptr) return;
+  {
+    absl::MutexLock lock(&mu_);
+    if (resident_ || prefetch_scheduled_) return;
+    prefetch_scheduled_ = true;
+  }
+  tiered_->prefetch_queue()->Push(shared_from_this());
+}
+
+bool ChunkStore::Chunk::resident() const {
+  if (!managed()) return true;
+  absl::MutexLock lock(&mu_);
+  return resident_;
+}
+
+bool ChunkStore::Chunk::SetDeferredData(ChunkData data) const {
+  if (!deferred_) return false;
+  absl::MutexLock lock(&mu_);
+  if (loader_ == nullptr) return false;
+  owned_data_ = std::move(data);
+  data_ = &owned_data_;
+  loader_ = nullptr;
+  resident_ = true;
+  prefetch_scheduled_ = false;
+  return true;
+}
+
+absl::Status ChunkStore::Chunk::MaybeSpill(absl::Time cutoff) const {
+  absl::MutexLock lock(&mu_);
+  if ((!resident_ && wire_.empty()) || num_pins_ > 0 || last_access_ > cutoff) {
+    return absl::OkStatus();
+  }
+  if (!spilled_) {
+    std::string serialized;
+    if (!wire_.empty()) {
+      serialized = std::string(wire_);
+    } else if (!data_->SerializeToString(&serialized)) {
+      return absl::InternalError(
+          absl::StrCat("Failed to serialize chunk ", key_, "."));
+    }
+    REVERB_RETURN_IF_ERROR(tiered_->file()->Write(serialized, &region_));
+    spilled_ = true;
+  }
+
+  // Swapping with an empty message (rather than clearing) actually releases
+  // the memory of the fields.
+  ChunkData empty;
+  owned_data_.Swap(&empty);
+  arena_.reset();
+  shared_data_.reset();
+  data_ = &owned_data_;
+  wire_.Clear();
+  resident_ = false;
+
+  absl::MutexLock serialized_lock(&serialized_mu_);
+  serialized_.Clear();
+  return absl::OkStatus();
+}
+
+void ChunkStore::Chunk::FaultIn() const {
+  if (spilled_) {
+    std::unique_ptr<internal::SpillFile::Mapping> mapping;
+    auto status = tiered_->file()->Map(region_, &mapping);
+    REVERB_CHECK(status.ok()) << "Failed to read spilled chunk " << key_
+                              << ": " << status;
+    REVERB_CHECK(owned_data_.ParseFromArray(mapping->data(), mapping->size()))
+        << "Failed to parse spilled chunk " << key_ << ".";
+  } else if (!wire_.empty()) {
+    // The wire encoding was validated when the chunk was created.
+    REVERB_CHECK(internal::ParseFromCord(wire_, &owned_data_))
+        << "Failed to parse chunk " << key_ << ".";
+    // Holding on to both would double the memory used by the chunk.
+    wire_.Clear();
+  } else {
+    // The data of a deferred chunk is read from its source the first time.
+    REVERB_CHECK(loader_ != nullptr);
+    auto status = loader_(&owned_data_);
+    REVERB_CHECK(status.ok()) << "Failed to read deferred chunk " << key_
+                              << ": " << status;
+    loader_ = nullptr;
+  }
+  data_ = &owned_data_;
+  resident_ = true;
+  prefetch_scheduled_ = false;
+}
 
 size_t ChunkStore::Chunk::DataByteSizeLong() const {
   absl::call_once(data_byte_size_once_,
-                  [this]() { data_byte_size_ = data_.ByteSizeLong(); });
+                  [this]() { data_byte_size_ = data_->ByteSizeLong(); });
   return data_byte_size_;
 }
 
-uint64_t ChunkStore::Chunk::episode_id() const {
-  return data_.sequence_range().episode_id();
+absl::Cord ChunkStore::Chunk::SerializedData() const {
+  if (managed()) {
+    absl::MutexLock lock(&mu_);
+    if (!wire_.empty()) {
+      last_access_ = absl::Now();
+      return wire_;
+    }
+  }
+  {
+    absl::MutexLock lock(&serialized_mu_);
+    if (!serialized_.empty()) return serialized_;
+  }
+
+  // The data is serialized without holding `serialized_mu_` as pinning the
+  // data acquires `mu_`.
+  std::string serialized;
+  {
+    DataPin pin = Pin();
+    pin.data().SerializeToString(&serialized);
+  }
+  absl::Cord cord(std::move(serialized));
+
+  absl::MutexLock lock(&serialized_mu_);
+  if (!serialized_.empty()) return serialized_;
+  if (++num_serializations_ > 1) {
+    serialized_ = cord;
+  }
+  return cord;
 }
 
-int32_t ChunkStore::Chunk::num_rows() const {
-  return data_.sequence_range().end() - data_.sequence_range().start() + 1;
+uint64_t ChunkStore::Chunk::episode_id() const { return episode_id_; }
+
+int32_t ChunkStore::Chunk::num_rows() const { return num_rows_; }
+
+int ChunkStore::Chunk::num_columns() const { return num_columns_; }
+
+absl::Status ChunkStore::Chunk::GetDecodedColumn(
+    int column, tensorflow::Tensor* out) const {
+  if (column >= num_columns() || column < 0) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Cannot unpack column ", column, " in chunk ", key(), " which has ",
+        num_columns(), " columns."));
+  }
+
+  auto& decoded = decoded_columns_[column];
+  absl::call_once(decoded.once, [this, column, &decoded] {
+    decoded.tensor = DecodeColumn(data(), column);
+  });
+  *out = decoded.tensor;
+  return absl::OkStatus();
 }
 
-int ChunkStore::Chunk::num_columns() const {
-  // Try to get number of columns without parsing lazy tensors field.
-  if (data_.data_tensors_len() != 0) {
-    return data_.data_tensors_len();
+absl::Status ChunkStore::Chunk::GetDecompressedData(ChunkData* out) const {
+  const ChunkData& chunk_data = data();
+  out->Clear();
+  out->set_chunk_key(chunk_data.chunk_key());
+  *out->mutable_sequence_range() = chunk_data.sequence_range();
+  out->set_data_tensors_len(num_columns());
+
+  if (chunk_data.data().tensors_size() != num_columns()) {
+    return absl::InternalError(absl::StrCat(
+        "Chunk ", key(), " has ", chunk_data.data().tensors_size(),
+        " tensors but ", num_columns(), " columns."));
+  }
+
+  CompressionOptions options;
+  options.set_codec(COMPRESSION_CODEC_NONE);
+  for (int column = 0; column < num_columns(); column++) {
+    CompressTensorAsProto(DecodeColumn(chunk_data, column), options,
+                          out->mutable_data()->add_tensors());
+    out->add_codecs(COMPRESSION_CODEC_NONE);
   }
-  return data_.data().tensors_size();
+  return absl::OkStatus();
 }
 
-ChunkStore::ChunkStore(int cleanup_batch_size)
-    : delete_keys_(std::make_shared<internal::Queue<Key>>(10000000)),
-      cleaner_(internal::StartThread(
-          "ChunkStore-Cleaner", [this, cleanup_batch_size] {
-            while (CleanupInternal(cleanup_batch_size)) {
-            }
-          })) {}
+ChunkStore::ChunkStore(int cleanup_batch_size, int num_shards)
+    : cleanup_batch_size_(cleanup_batch_size) {
+  REVERB_CHECK_GT(cleanup_batch_size, 0);
+  REVERB_CHECK_GT(num_shards, 0);
+  shards_.reserve(num_shards);
+  for (int i = 0; i < num_shards; i++) {
+    shards_.push_back(std::make_shared<Shard>());
+  }
+}
 
 ChunkStore::~ChunkStore() {
-  // Closing the queue makes all calls to `CleanupInternal` to return false
-  // which will break the loop in `cleaner_` making it joinable.
-  delete_keys_->Close();
-  cleaner_ = nullptr;  // Joins thread.
+  if (tiered_ == nullptr) return;
+  REVERB_CHECK(spill_closure_->Stop().ok());
+  tiered_->prefetch_queue()->Close();
+  prefetch_threads_.clear();
+}
+
+void ChunkStore::SetMemoryBudget(
+    std::shared_ptr<internal::MemoryBudget> budget) {
+  memory_budget_ = std::move(budget);
+}
+
+void ChunkStore::EnableEpisodeSlabs(size_t slab_size) {
+  episode_slabs_ = std::make_unique<internal::EpisodeSlabAllocator>(slab_size);
+}
+
+absl::Status ChunkStore::EnableTieredStorage(TieredStorageOptions options) {
+  if (tiered_ != nullptr) {
+    return absl::FailedPreconditionError(
+        "Tiered storage has already been enabled.");
+  }
+  if (options.cold_after <= absl::ZeroDuration() ||
+      options.scan_interval <= absl::ZeroDuration() ||
+      options.num_prefetch_threads <= 0) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Tiered storage requires positive cold_after, scan_interval and "
+        "num_prefetch_threads but got ",
+        absl::FormatDuration(options.cold_after), ", ",
+        absl::FormatDuration(options.scan_interval), " and ",
+        options.num_prefetch_threads, "."));
+  }
+
+  std::unique_ptr<internal::SpillFile> file;
+  REVERB_RETURN_IF_ERROR(internal::SpillFile::Create(options.directory, &file));
+  tiered_ = std::make_shared<TieredStorage>(std::move(options), std::move(file));
+
+  spill_closure_ = absl::make_unique<internal::PeriodicClosure>(
+      [tiered = tiered_.get()] { tiered->SpillColdChunks(); },
+      tiered_->options().scan_interval, "ChunkSpiller");
+  REVERB_RETURN_IF_ERROR(spill_closure_->Start());
+  for (int i = 0; i < tiered_->options().num_prefetch_threads; i++) {
+    prefetch_threads_.push_back(internal::StartThread(
+        "ChunkPrefetcher", [this] { RunPrefetchWorker(); }));
+  }
+  return absl::OkStatus();
+}
+
+std::shared_ptr<ChunkStore::Chunk> ChunkStore::MakeChunk(
+    std::shared_ptr<google::protobuf::Arena> arena,
+    const ChunkData* data) const {
+  auto chunk = std::make_shared<Chunk>(std::move(arena), data);
+  Manage(chunk);
+  return chunk;
+}
+
+std::shared_ptr<ChunkStore::Chunk> ChunkStore::MakeChunk(
+    std::shared_ptr<const ChunkData> data) const {
+  auto chunk = std::make_shared<Chunk>(std::move(data));
+  Manage(chunk);
+  return chunk;
+}
+
+absl::Status ChunkStore::MakeChunk(absl::Cord serialized,
+                                   std::shared_ptr<Chunk>* chunk) const {
+  std::vector<absl::Cord> data;
+  absl::Cord metadata_wire;
+  REVERB_RETURN_IF_ERROR(internal::SplitField(
+      serialized, ChunkData::kDataFieldNumber, &data, &metadata_wire));
+  ChunkData metadata;
+  if (!internal::ParseFromCord(metadata_wire, &metadata)) {
+    return absl::InvalidArgumentError("Failed to parse chunk metadata.");
+  }
+  int num_tensors = 0;
+  for (const absl::Cord& field : data) {
+    REVERB_RETURN_IF_ERROR(ValidateData(field, &num_tensors));
+  }
+  if (metadata.data_tensors_len() == 0) {
+    metadata.set_data_tensors_len(num_tensors);
+  }
+  if (episode_slabs_ != nullptr) {
+    serialized = episode_slabs_->Copy(metadata.sequence_range().episode_id(),
+                                      serialized);
+  }
+
+  *chunk = std::make_shared<Chunk>(metadata, std::move(serialized));
+  Manage(*chunk);
+  return absl::OkStatus();
+}
+
+void ChunkStore::Manage(const std::shared_ptr<Chunk>& chunk) const {
+  if (memory_budget_ != nullptr) {
+    chunk->memory_charge_ = memory_budget_->Acquire(chunk->DataByteSizeLong());
+  }
+  MaybeTier(chunk);
+}
+
+void ChunkStore::MaybeTier(const std::shared_ptr<Chunk>& chunk) const {
+  if (tiered_ == nullptr) return;
+  // The size cannot be computed while the data is spilled so it is cached
+  // before the chunk becomes subject to spilling.
+  chunk->DataByteSizeLong();
+  {
+    absl::MutexLock lock(&chunk->mu_);
+    chunk->last_access_ = absl::Now();
+  }
+  chunk->tiered_ = tiered_;
+  tiered_->Register(chunk);
+}
+
+void ChunkStore::RunPrefetchWorker() {
+  std::weak_ptr<const Chunk> weak_chunk;
+  while (tiered_->prefetch_queue()->Pop(&weak_chunk)) {
+    if (auto chunk = weak_chunk.lock()) {
+      chunk->data();
+    }
+  }
+}
+
+const std::shared_ptr<ChunkStore::Shard>& ChunkStore::GetShard(
+    Key key) const {
+  // Chunk keys are generated uniformly at random so no hashing is needed.
+  return shards_[key % shards_.size()];
+}
+
+std::shared_ptr<ChunkStore::Chunk> ChunkStore::WrapInsertedChunk(
+    const std::shared_ptr<Shard>& shard, Chunk* chunk) const {
+  return std::shared_ptr<Chunk>(
+      chunk, [shard, batch_size = cleanup_batch_size_](Chunk* chunk) {
+        const Key key = chunk->key();
+        delete chunk;
+        OnChunkDestroyed(shard.get(), key, batch_size);
+      });
 }
 
 std::shared_ptr<ChunkStore::Chunk> ChunkStore::Insert(ChunkData item) {
-  absl::WriterMutexLock lock(&mu_);
-  std::weak_ptr<Chunk>& wp = data_[item.chunk_key()];
+  const std::shared_ptr<Shard>& shard = GetShard(item.chunk_key());
+
+  internal::ProfiledMutexLock lock(&shard->mu, REVERB_LOCK_SITE(kShardMu));
+  std::weak_ptr<Chunk>& wp = shard->data[item.chunk_key()];
   std::shared_ptr<Chunk> sp = wp.lock();
   if (sp == nullptr) {
-    wp = (sp = std::shared_ptr<Chunk>(new Chunk(std::move(item)),
-                                      [q = delete_keys_](Chunk* chunk) {
-                                        q->Push(chunk->key());
-                                        delete chunk;
-                                      }));
+    wp = (sp = WrapInsertedChunk(shard, new Chunk(std::move(item))));
+    Manage(sp);
+  }
+  return sp;
+}
+
+std::shared_ptr<ChunkStore::Chunk> ChunkStore::InsertDeferred(
+    DeferredChunk chunk) {
+  const std::shared_ptr<Shard>& shard = GetShard(chunk.key);
+
+  internal::ProfiledMutexLock lock(&shard->mu, REVERB_LOCK_SITE(kShardMu));
+  std::weak_ptr<Chunk>& wp = shard->data[chunk.key];
+  std::shared_ptr<Chunk> sp = wp.lock();
+  if (sp == nullptr) {
+    wp = (sp = WrapInsertedChunk(shard, new Chunk(std::move(chunk))));
+    Manage(sp);
   }
   return sp;
 }
@@ -96,11 +557,16 @@ std::shared_ptr<ChunkStore::Chunk> ChunkStore::Insert(ChunkData item) {
 tensorflow::Status ChunkStore::Get(
     absl::Span<const ChunkStore::Key> keys,
     std::vector<std::shared_ptr<Chunk>>* chunks) {
-  absl::ReaderMutexLock lock(&mu_);
   chunks->clear();
   chunks->reserve(keys.size());
   for (int i = 0; i < keys.size(); i++) {
-    chunks->push_back(GetItem(keys[i]));
+    Shard* shard = GetShard(keys[i]).get();
+    {
+      internal::ProfiledReaderMutexLock lock(
+          &shard->mu, REVERB_LOCK_SITE(kShardMu));
+      auto it = shard->data.find(keys[i]);
+      chunks->push_back(it == shard->data.end() ? nullptr : it->second.lock());
+    }
     if (!chunks->at(i)) {
       return tensorflow::errors::NotFound(
           absl::StrCat("Chunk ", keys[i], " cannot be found."));
@@ -109,24 +575,73 @@ tensorflow::Status ChunkStore::Get(
   return tensorflow::Status::OK();
 }
 
-std::shared_ptr<ChunkStore::Chunk> ChunkStore::GetItem(Key key) {
-  auto it = data_.find(key);
-  return it == data_.end() ? nullptr : it->second.lock();
+size_t ChunkStore::num_chunks() const {
+  size_t num_chunks = 0;
+  for (const auto& shard : shards_) {
+    internal::ProfiledReaderMutexLock lock(
+        &shard->mu, REVERB_LOCK_SITE(kShardMu));
+    num_chunks += shard->data.size();
+  }
+  return num_chunks;
 }
 
-bool ChunkStore::CleanupInternal(int num_chunks) {
-  std::vector<Key> popped_keys;
-  popped_keys.reserve(num_chunks);
-  if (!delete_keys_->PopBatch(num_chunks, &popped_keys).ok()) {
-    return false;
+void ChunkStore::OnChunkDestroyed(Shard* shard, Key key,
+                                  int cleanup_batch_size) {
+  std::vector<Key> keys;
+  {
+    internal::ProfiledMutexLock lock(
+        &shard->deleted_keys_mu, REVERB_LOCK_SITE(kDeletedKeysMu));
+    shard->deleted_keys.push_back(key);
+    if (shard->deleted_keys.size() < cleanup_batch_size) return;
+    keys.swap(shard->deleted_keys);
   }
 
-  absl::WriterMutexLock data_lock(&mu_);
-  for (const Key& key : popped_keys) {
-    data_.erase(key);
+  internal::ProfiledMutexLock lock(&shard->mu, REVERB_LOCK_SITE(kShardMu));
+  for (const Key& deleted_key : keys) {
+    auto it = shard->data.find(deleted_key);
+    // The key could have been inserted again after the chunk was destroyed.
+    if (it != shard->data.end() && it->second.expired()) {
+      shard->data.erase(it);
+    }
   }
+}
 
-  return true;
+ChunkStore::TieredStorage::TieredStorage(
+    TieredStorageOptions options, std::unique_ptr<internal::SpillFile> file)
+    : options_(std::move(options)), file_(std::move(file)) {}
+
+void ChunkStore::TieredStorage::Register(const std::shared_ptr<Chunk>& chunk) {
+  absl::MutexLock lock(&mu_);
+  chunks_[chunk.get()] = chunk;
+}
+
+void ChunkStore::TieredStorage::Unregister(const Chunk* chunk) {
+  absl::MutexLock lock(&mu_);
+  chunks_.erase(chunk);
+}
+
+void ChunkStore::TieredStorage::SpillColdChunks() {
+  // The chunks are collected first so that the lock isn't held (and thus
+  // chunks can be created and destroyed) while the data is written to disk.
+  std::vector<std::shared_ptr<Chunk>> chunks;
+  {
+    absl::MutexLock lock(&mu_);
+    chunks.reserve(chunks_.size());
+    for (const auto& entry : chunks_) {
+      if (auto chunk = entry.second.lock()) {
+        chunks.push_back(std::move(chunk));
+      }
+    }
+  }
+
+  const absl::Time cutoff = absl::Now() - options_.cold_after;
+  for (const auto& chunk : chunks) {
+    auto status = chunk->MaybeSpill(cutoff);
+    if (!status.ok()) {
+      REVERB_LOG(REVERB_ERROR) << "Failed to spill chunk " << chunk->key()
+                               << ": " << status;
+    }
+  }
 }
 
 }  // namespace reverb
@@ -15,19 +15,29 @@
 #ifndef REVERB_CC_CHUNK_STORE_H_
 #define REVERB_CC_CHUNK_STORE_H_
 
+#include <functional>
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "absl/base/call_once.h"
 #include <cstdint>
 #include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/strings/cord.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "absl/types/span.h"
+#include "google/protobuf/arena.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/schema.pb.h"
-#include "reverb/cc/support/queue.h"
+#include "reverb/cc/support/episode_slab_allocator.h"
+#include "reverb/cc/support/memory_budget.h"
+#include "reverb/cc/support/periodic_closure.h"
+#include "reverb/cc/support/spill_file.h"
+#include "reverb/cc/support/unbounded_queue.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/lib/core/status.h"
@@ -70,24 +80,161 @@ namespace reverb {
 // Insert() returns a shared pointer, as otherwise the Chunk would be destroyed
 // right away.
 //
+// The mapping is sharded by key over a number of independently locked maps so
+// that concurrent calls for different keys rarely contend. The entries of
+// destroyed chunks are erased lazily by the thread that destroys the chunk:
+// keys are buffered per shard and once `cleanup_batch_size` keys have been
+// buffered the shard lock is acquired and their entries are erased in one go.
+//
+// In tiered storage mode (see `EnableTieredStorage`) the data of chunks which
+// have not been accessed for a while is written to a file on local disk and
+// released from memory. Accessing the data of such a chunk reads it back in
+// transparently. Chunks created by the store (`Insert` and `MakeChunk`) are
+// subject to tiering, chunks constructed directly are always kept in memory.
+//
+// Chunks can also be created without their data (see `InsertDeferred`), e.g
+// when a checkpoint is restored lazily. Such chunks are usable immediately as
+// their metadata is provided up front. The data is read from its source the
+// first time it is accessed, unless it has been provided in the meantime
+// through `Chunk::SetDeferredData`.
+//
+// Chunks received over the network can be created from their wire encoding
+// (see `MakeChunk(absl::Cord, ...)`), e.g. the receive buffers of a request, so
+// their data is neither copied nor parsed until it is accessed. Chunks which
+// are only ever sent on to remote samplers are never parsed at all. With
+// episode slabs enabled (see `EnableEpisodeSlabs`) the encoding is instead
+// copied once into memory shared with the other chunks of the same episode.
+//
 // All public methods are thread safe.
 class ChunkStore {
  public:
   using Key = uint64_t;
 
-  class Chunk {
+  static constexpr int kDefaultNumShards = 16;
+
+  struct TieredStorageOptions {
+    // Local directory in which the file holding the spilled chunks is created.
+    // The file is deleted when the process exits.
+    std::string directory;
+
+    // The data of chunks which have not been accessed for at least this long
+    // is spilled to disk. Must be considerably longer than any single access
+    // to the data (see `Chunk::data`).
+    absl::Duration cold_after = absl::Minutes(5);
+
+    // How often chunks are checked for being cold.
+    absl::Duration scan_interval = absl::Seconds(10);
+
+    // Number of threads reading prefetched chunks back into memory.
+    int num_prefetch_threads = 4;
+  };
+
+  class TieredStorage;
+
+  // Metadata of a chunk whose data is not yet available. See `InsertDeferred`.
+  struct DeferredChunk {
+    Key key;
+    uint64_t episode_id;
+    int32_t num_rows;
+    int num_columns;
+
+    // Value returned by `Chunk::DataByteSizeLong`.
+    size_t data_byte_size;
+
+    // Reads the data of the chunk. Called at most once, the first time the
+    // data is accessed, unless the data is provided through
+    // `Chunk::SetDeferredData` before that.
+    std::function<absl::Status(ChunkData*)> loader;
+  };
+
+  class Chunk : public std::enable_shared_from_this<Chunk> {
    public:
+    // RAII handle which keeps the data of a chunk in memory while it exists,
+    // regardless of how long ago the data was accessed. The chunk must outlive
+    // the pin.
+    class DataPin {
+     public:
+      DataPin(DataPin&& other);
+      DataPin& operator=(DataPin&& other);
+      ~DataPin();
+
+      const ChunkData& data() const { return chunk_->data(); }
+
+     private:
+      friend class Chunk;
+
+      explicit DataPin(const Chunk* chunk);
+
+      const Chunk* chunk_;
+    };
+
     explicit Chunk(ChunkData data);
 
+    // Wraps `data` which is allocated on (and owned by) `arena`. The chunk
+    // shares ownership of the arena so it keeps the (potentially many) other
+    // messages allocated on it alive as well. This avoids copying messages
+    // which have been parsed onto an arena, e.g. incoming insert requests.
+    Chunk(std::shared_ptr<google::protobuf::Arena> arena,
+          const ChunkData* data);
+
+    // Wraps `data` whose ownership is shared with its producer, e.g the
+    // `CellRef`s of a writer in the same process as the server. This avoids
+    // copying (or serializing) chunks which are handed over within a process.
+    explicit Chunk(std::shared_ptr<const ChunkData> data);
+
+    // Creates a chunk without its data. See `ChunkStore::InsertDeferred`.
+    explicit Chunk(DeferredChunk deferred);
+
+    // Wraps `serialized`, the wire encoding of a chunk whose fields other than
+    // `data` (and `data_tensors_len` in particular) have been parsed into
+    // `metadata`. Like a deferred chunk, the data is only parsed from
+    // `serialized` when it is first accessed. Until then `serialized` is held
+    // as is, sharing its memory with the caller, and returned by
+    // `SerializedData`.
+    Chunk(const ChunkData& metadata, absl::Cord serialized);
+
+    ~Chunk();
+
     // Unique identifier of the chunk.
     uint64_t key() const;
 
-    // Returns the proto data of the chunk.
+    // Returns the proto data of the chunk. If the data has been spilled to
+    // disk then it is read back into memory first, blocking the caller.
+    //
+    // For chunks subject to tiered storage the returned reference is only
+    // guaranteed to remain valid for `TieredStorageOptions::cold_after` after
+    // the call. Callers that hold on to the data for an unbounded time (e.g
+    // until a response has been sent) must hold a `DataPin` instead.
     const ChunkData& data() const;
 
+    // Returns a handle which keeps the data in memory until it is destroyed.
+    DataPin Pin() const;
+
+    // Starts reading the data back into memory in the background if it has
+    // been spilled to disk, so that a subsequent call to `data` does not have
+    // to block. No-op if the chunk is not subject to tiered storage.
+    void Prefetch() const;
+
+    // True if the data is currently held in memory.
+    bool resident() const;
+
+    // Provides the data of a chunk created without it, so it does not have to
+    // be read by the loader when accessed. Returns false (and leaves the chunk
+    // unchanged) if the chunk was not deferred or its data has already been
+    // read.
+    bool SetDeferredData(ChunkData data) const;
+
     // (Potentially cached) size of `data`.
     size_t DataByteSizeLong() const;
 
+    // Returns the wire encoding of `data`, e.g. to splice it into responses
+    // without serializing it again. Chunks created from their wire encoding
+    // return it as is until the data has been parsed. Otherwise, the encoding
+    // is cached from the second call onwards so chunks which are only sent
+    // once don't hold a second copy of their data. The cache is released when
+    // the data is spilled to disk.
+    absl::Cord SerializedData() const ABSL_LOCKS_EXCLUDED(mu_, serialized_mu_);
+
     // Alias for `data().sequence_range().episode_id()`.
     uint64_t episode_id() const;
 
@@ -98,59 +245,275 @@ class ChunkStore {
     // Number of tensors in each step.
     int num_columns() const;
 
+    // Decompresses (and delta decodes) the tensor of `column`. The decoded
+    // tensor is materialized the first time it is requested and then kept for
+    // the lifetime of the chunk so subsequent calls only copy a reference to
+    // the shared buffer. This is intended for in-process samplers which
+    // repeatedly sample the same chunks, note however that the decoded tensors
+    // are held in addition to the (compressed) `data`.
+    absl::Status GetDecodedColumn(int column, tensorflow::Tensor* out) const;
+
+    // Writes a copy of `data` to `out` in which every column is decompressed
+    // (and delta decoded) and stored with `COMPRESSION_CODEC_NONE`. Used by
+    // servers which decompress chunks on behalf of their clients. Unlike
+    // `GetDecodedColumn`, the decoded tensors are not kept by the chunk.
+    absl::Status GetDecompressedData(ChunkData* out) const;
+
    private:
-    ChunkData data_;
+    friend class ChunkStore;
+    friend class TieredStorage;
+
+    struct DecodedColumn {
+      absl::once_flag once;
+      tensorflow::Tensor tensor;
+    };
+
+    // Writes the data to disk (unless it already has been) and releases it
+    // from memory if it has not been accessed since `cutoff` and is not
+    // pinned.
+    absl::Status MaybeSpill(absl::Time cutoff) const ABSL_LOCKS_EXCLUDED(mu_);
+
+    // Reads the data back from disk, or from the loader if the chunk is
+    // deferred and its data has never been read. Dies if the data cannot be
+    // read as the chunk would otherwise be lost.
+    void FaultIn() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+    // True if the residency of the data has to be checked (under `mu_`) on
+    // every access.
+    bool managed() const { return tiered_ != nullptr || deferred_; }
+
+    // Metadata of `data_` cached at construction so it remains available while
+    // the data is spilled.
+    const uint64_t key_;
+    const uint64_t episode_id_;
+    const int32_t num_rows_;
+    const int num_columns_;
+
+    // Only set when the chunk is not constructed from an arena or a shared
+    // message (or has been read back from disk).
+    mutable ChunkData owned_data_;
+    mutable std::shared_ptr<google::protobuf::Arena> arena_;
+    mutable std::shared_ptr<const ChunkData> shared_data_;
+
+    // Points to either `owned_data_`, a message owned by `arena_` or
+    // `shared_data_`.
+    mutable const ChunkData* data_;
+
+    // Set if the chunk is subject to tiered storage. The remaining members are
+    // only used by chunks for which it is set.
+    std::shared_ptr<TieredStorage> tiered_;
+
+    // Set for chunks created without their data. Such chunks start out non
+    // resident and, like tiered chunks, use the members below.
+    const bool deferred_ = false;
+
+    // Protects the residency of `data_`, i.e `owned_data_`, `arena_` and
+    // `data_` of chunks which are `managed`.
+    mutable absl::Mutex mu_;
+    mutable absl::Time last_access_ ABSL_GUARDED_BY(mu_);
+    mutable int num_pins_ ABSL_GUARDED_BY(mu_) = 0;
+    mutable bool resident_ ABSL_GUARDED_BY(mu_) = true;
+    mutable bool prefetch_scheduled_ ABSL_GUARDED_BY(mu_) = false;
+
+    // Location of the data on disk once it has been spilled. Chunks are
+    // immutable so the data is only ever written once.
+    mutable bool spilled_ ABSL_GUARDED_BY(mu_) = false;
+    mutable internal::SpillFile::Region region_ ABSL_GUARDED_BY(mu_);
+
+    // Reads the data of a deferred chunk. Reset once the data has been read.
+    mutable std::function<absl::Status(ChunkData*)> loader_
+        ABSL_GUARDED_BY(mu_);
+
+    // Wire encoding of chunks created from it. Released once the data has been
+    // parsed or spilled.
+    mutable absl::Cord wire_ ABSL_GUARDED_BY(mu_);
+
     mutable size_t data_byte_size_;
     mutable absl::once_flag data_byte_size_once_;
+
+    // Cached by `SerializedData`. Acquired after `mu_` (when both are held).
+    mutable absl::Mutex serialized_mu_;
+    mutable absl::Cord serialized_ ABSL_GUARDED_BY(serialized_mu_);
+    mutable int num_serializations_ ABSL_GUARDED_BY(serialized_mu_) = 0;
+
+    // Lazily populated by `GetDecodedColumn`. Holds `num_columns()` elements.
+    std::unique_ptr<DecodedColumn[]> decoded_columns_;
+
+    // Charge of the data to the budget of the store (see `SetMemoryBudget`).
+    internal::MemoryBudget::Charge memory_charge_;
   };
 
-  // Starts `cleaner_`. `cleanup_batch_size` is the number of keys the cleaner
-  // should wait for before acquiring the lock and erasing them from `data_`.
-  explicit ChunkStore(int cleanup_batch_size = 1000);
+  // `cleanup_batch_size` is the number of keys of destroyed chunks which are
+  // buffered (per shard) before the shard lock is acquired and the entries are
+  // erased. `num_shards` is the number of independently locked maps.
+  explicit ChunkStore(int cleanup_batch_size = 1000,
+                      int num_shards = kDefaultNumShards);
 
-  // Stops `cleaner_` closes `delete_keys_`.
+  // Stops spilling and prefetching chunks. Chunks which outlive the store keep
+  // working but are no longer spilled.
   ~ChunkStore();
 
+  // Charges the data of all chunks created by the store from now on to
+  // `budget` for as long as the chunks exist. The encoded size of the data is
+  // charged, whether or not it is held in memory. Must be called before the
+  // store is used concurrently.
+  void SetMemoryBudget(std::shared_ptr<internal::MemoryBudget> budget);
+
+  // Enables tiered storage for all chunks created by the store from now on.
+  // Must be called before the store is used concurrently. Returns an error if
+  // the options are invalid, if the spill file cannot be created or if tiered
+  // storage has already been enabled.
+  absl::Status EnableTieredStorage(TieredStorageOptions options);
+
+  // Copies the wire encoding of chunks created by `MakeChunk(absl::Cord, ...)`
+  // from now on into slabs of `slab_size` bytes shared by the chunks of the
+  // same episode (see `internal::EpisodeSlabAllocator`), rather than holding
+  // on to the buffers the chunks were received in. Must be called before the
+  // store is used concurrently.
+  void EnableEpisodeSlabs(size_t slab_size);
+
+  // Set by `EnableEpisodeSlabs`.
+  const internal::EpisodeSlabAllocator* episode_slabs() const {
+    return episode_slabs_.get();
+  }
+
+  // Creates a chunk which wraps `data` (allocated on `arena`) without adding it
+  // to the mapping, making it subject to tiered storage if enabled. Used for
+  // chunks which are only looked up by their owner (e.g insert streams).
+  std::shared_ptr<Chunk> MakeChunk(
+      std::shared_ptr<google::protobuf::Arena> arena,
+      const ChunkData* data) const;
+
+  // Like `MakeChunk` above but wraps a message shared with its producer (see
+  // `Chunk(std::shared_ptr<const ChunkData>)`).
+  std::shared_ptr<Chunk> MakeChunk(std::shared_ptr<const ChunkData> data) const;
+
+  // Like `MakeChunk` above but wraps the wire encoding of a chunk without
+  // copying or parsing its data (see `Chunk(const ChunkData&, absl::Cord)`).
+  // Returns an error if `serialized` is not a valid encoding of a chunk.
+  absl::Status MakeChunk(absl::Cord serialized,
+                         std::shared_ptr<Chunk>* chunk) const;
+
   // Attempts to insert a Chunk into the map using the key inside `item`. If no
   // entry existed for the key, a new Chunk is created, inserted and returned.
   // Otherwise, the existing chunk is returned.
-  std::shared_ptr<Chunk> Insert(ChunkData item) ABSL_LOCKS_EXCLUDED(mu_);
+  std::shared_ptr<Chunk> Insert(ChunkData item);
+
+  // Like `Insert` but creates a chunk without its data. The data is read using
+  // `chunk.loader` when first accessed. If a chunk already exists for the key
+  // then it is returned instead.
+  std::shared_ptr<Chunk> InsertDeferred(DeferredChunk chunk);
 
   // Gets the Chunk for each given key. Returns an error if one of the items
   // does not exist or if `Close` has been called. On success, the returned
   // items are in the same order as given in `keys`.
   tensorflow::Status Get(absl::Span<const Key> keys,
-                         std::vector<std::shared_ptr<Chunk>>* chunks)
-      ABSL_LOCKS_EXCLUDED(mu_);
+                         std::vector<std::shared_ptr<Chunk>>* chunks);
 
-  // Blocks until `num_chunks` expired entries have been cleaned up from
-  // `data_`. This method is called automatically by a background thread to
-  // limit memory size, but does not have any effect on the semantics of Get()
-  // or Insert() calls.
-  //
-  // Returns false if `delete_keys_` closed before `num_chunks` could be popped.
-  bool CleanupInternal(int num_chunks) ABSL_LOCKS_EXCLUDED(mu_);
+  // Number of entries in the mapping. Includes the entries of destroyed chunks
+  // which have not yet been cleaned up (see `cleanup_batch_size`).
+  size_t num_chunks() const;
 
  private:
-  // Gets an item. Returns nullptr if the item does not exist.
-  std::shared_ptr<Chunk> GetItem(Key key) ABSL_SHARED_LOCKS_REQUIRED(mu_);
+  struct Shard {
+    // Holds the actual mapping of key to Chunk. We only hold a weak pointer to
+    // the Chunk, which means that destruction and reference counting of the
+    // chunks happens independently of this map.
+    internal::flat_hash_map<Key, std::weak_ptr<Chunk>> data
+        ABSL_GUARDED_BY(mu);
 
-  // Holds the actual mapping of key to Chunk. We only hold a weak pointer to
-  // the Chunk, which means that destruction and reference counting of the
-  // chunks happens independently of this map.
-  internal::flat_hash_map<Key, std::weak_ptr<Chunk>> data_ ABSL_GUARDED_BY(mu_);
+    // Mutex protecting access to `data`.
+    mutable absl::Mutex mu;
 
-  // Mutex protecting access to `data_`.
-  mutable absl::Mutex mu_;
+    // Keys of destroyed chunks which have not yet been erased from `data`.
+    std::vector<Key> deleted_keys ABSL_GUARDED_BY(deleted_keys_mu);
+
+    // Mutex protecting access to `deleted_keys`. Separate from `mu` so that
+    // destroying chunks does not contend with `Insert` and `Get`.
+    absl::Mutex deleted_keys_mu;
+  };
+
+  // Buffers the key of a destroyed chunk and erases the entries of all
+  // buffered keys once `cleanup_batch_size` keys have been buffered. Entries
+  // which have been replaced by a live chunk in the meantime are kept.
+  static void OnChunkDestroyed(Shard* shard, Key key, int cleanup_batch_size)
+      ABSL_LOCKS_EXCLUDED(shard->mu, shard->deleted_keys_mu);
+
+  const std::shared_ptr<Shard>& GetShard(Key key) const;
+
+  // Takes ownership of `chunk`, which is about to be added to `shard`. The
+  // entry of the chunk is erased (see `OnChunkDestroyed`) once it has been
+  // destroyed.
+  std::shared_ptr<Chunk> WrapInsertedChunk(const std::shared_ptr<Shard>& shard,
+                                           Chunk* chunk) const;
 
-  // Queue of keys of deleted items that will be cleaned up by `cleaner_`. Note
-  // the queue have to be allocated on the heap in order to avoid dereferencing
-  // errors caused by a stack allocated ChunkStore getting destroyed before all
-  // Chunk have been destroyed.
-  std::shared_ptr<internal::Queue<Key>> delete_keys_;
+  // Charges `chunk` to `memory_budget_` and makes it subject to tiered
+  // storage, if either is enabled.
+  void Manage(const std::shared_ptr<Chunk>& chunk) const;
+
+  // Makes `chunk` subject to tiered storage if it is enabled.
+  void MaybeTier(const std::shared_ptr<Chunk>& chunk) const;
+
+  // Reads chunks scheduled through `Chunk::Prefetch` back into memory until the
+  // prefetch queue is closed.
+  void RunPrefetchWorker();
+
+  const int cleanup_batch_size_;
+
+  // Set by `SetMemoryBudget`.
+  std::shared_ptr<internal::MemoryBudget> memory_budget_;
+
+  // Set by `EnableEpisodeSlabs`.
+  std::unique_ptr<internal::EpisodeSlabAllocator> episode_slabs_;
+
+  // Set by `EnableTieredStorage`. Shared with the chunks which are subject to
+  // tiered storage as they may outlive the store.
+  std::shared_ptr<TieredStorage> tiered_;
+
+  // Periodically spills cold chunks. Only set in tiered storage mode.
+  std::unique_ptr<internal::PeriodicClosure> spill_closure_;
+
+  // Threads running `RunPrefetchWorker`. Only set in tiered storage mode.
+  std::vector<std::unique_ptr<internal::Thread>> prefetch_threads_;
+
+  // The shards have to be allocated on the heap and shared with the deleter of
+  // each chunk in order to avoid dereferencing errors caused by a stack
+  // allocated ChunkStore getting destroyed before all Chunk have been
+  // destroyed.
+  std::vector<std::shared_ptr<Shard>> shards_;
+};
+
+// State of the tiered storage mode of a `ChunkStore` which is shared with the
+// chunks subject to it.
+class ChunkStore::TieredStorage {
+ public:
+  TieredStorage(TieredStorageOptions options,
+                std::unique_ptr<internal::SpillFile> file);
+
+  const TieredStorageOptions& options() const { return options_; }
+  internal::SpillFile* file() const { return file_.get(); }
+
+  void Register(const std::shared_ptr<Chunk>& chunk) ABSL_LOCKS_EXCLUDED(mu_);
+  void Unregister(const Chunk* chunk) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Spills the data of all chunks which have not been accessed for
+  // `options().cold_after`.
+  void SpillColdChunks() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Chunks waiting to be read back into memory by the prefetch threads.
+  internal::UnboundedQueue<std::weak_ptr<const Chunk>>* prefetch_queue() {
+    return &prefetch_queue_;
+  }
+
+ private:
+  const TieredStorageOptions options_;
+  const std::unique_ptr<internal::SpillFile> file_;
+
+  mutable absl::Mutex mu_;
+  internal::flat_hash_map<const Chunk*, std::weak_ptr<Chunk>> chunks_
+      ABSL_GUARDED_BY(mu_);
 
-  // Consumes `delete_keys_` to remove dead pointers in `data_`.
-  std::unique_ptr<internal::Thread> cleaner_;
+  internal::UnboundedQueue<std::weak_ptr<const Chunk>> prefetch_queue_;
 };
 
 }  // namespace reverb
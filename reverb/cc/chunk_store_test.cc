@@ -15,14 +15,28 @@
 #include "reverb/cc/chunk_store.h"
 
 #include <atomic>
+#include <cstdlib>
+#include <functional>
 #include <memory>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/strings/cord.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "google/protobuf/arena.h"
+#include "reverb/cc/platform/status_matchers.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/cord_util.h"
+#include "reverb/cc/support/memory_budget.h"
+#include "reverb/cc/tensor_compression.h"
 #include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor.pb.h"
+#include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 
@@ -32,6 +46,25 @@ namespace {
 
 using ChunkVector = ::std::vector<::std::shared_ptr<ChunkStore::Chunk>>;
 
+ChunkStore::TieredStorageOptions MakeTieredStorageOptions(
+    absl::Duration cold_after) {
+  ChunkStore::TieredStorageOptions options;
+  options.directory = getenv("TEST_TMPDIR");
+  options.cold_after = cold_after;
+  options.scan_interval = absl::Milliseconds(1);
+  options.num_prefetch_threads = 1;
+  return options;
+}
+
+// Returns true if `condition` becomes true within a few seconds.
+bool WaitFor(const std::function<bool()>& condition) {
+  for (int retry = 0; retry < 5000; retry++) {
+    if (condition()) return true;
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  return condition();
+}
+
 TEST(ChunkStoreTest, GetAfterInsertSucceeds) {
   ChunkStore store;
   std::shared_ptr<ChunkStore::Chunk> inserted =
@@ -124,6 +157,333 @@ TEST(ChunkStoreTest, ConcurrentCalls) {
   EXPECT_EQ(count, 1000);
 }
 
+TEST(ChunkStoreTest, CleanupDoesNotDeleteReinsertedChunks) {
+  ChunkStore store(/*cleanup_batch_size=*/2, /*num_shards=*/1);
+
+  // Destroy the chunk so its key is buffered for cleanup and then insert the
+  // same key again before the cleanup happens.
+  store.Insert(testing::MakeChunkData(1));
+  std::shared_ptr<ChunkStore::Chunk> reinserted =
+      store.Insert(testing::MakeChunkData(1));
+
+  // Trigger the cleanup by destroying another chunk.
+  store.Insert(testing::MakeChunkData(2));
+
+  ChunkVector chunks;
+  TF_ASSERT_OK(store.Get({1}, &chunks));
+  EXPECT_EQ(chunks[0], reinserted);
+  EXPECT_EQ(store.Get({2}, &chunks).code(), tensorflow::error::NOT_FOUND);
+}
+
+TEST(ChunkStoreTest, GetReturnsChunksFromAllShards) {
+  ChunkStore store(/*cleanup_batch_size=*/1, /*num_shards=*/4);
+  ChunkVector inserted;
+  std::vector<ChunkStore::Key> keys;
+  for (ChunkStore::Key key = 0; key < 100; key++) {
+    inserted.push_back(store.Insert(testing::MakeChunkData(key)));
+    keys.push_back(key);
+  }
+  ChunkVector chunks;
+  TF_ASSERT_OK(store.Get(keys, &chunks));
+  EXPECT_EQ(chunks, inserted);
+}
+
+TEST(ChunkStoreTest, ChunksCanOutliveStore) {
+  std::shared_ptr<ChunkStore::Chunk> chunk;
+  {
+    ChunkStore store(/*cleanup_batch_size=*/1);
+    chunk = store.Insert(testing::MakeChunkData(1));
+  }
+  EXPECT_EQ(chunk->key(), 1);
+  chunk = nullptr;
+}
+
+TEST(ChunkStoreTest, ChunksAreChargedToMemoryBudgetWhileTheyExist) {
+  auto budget = std::make_shared<internal::MemoryBudget>(
+      /*soft_limit_bytes=*/1 << 20);
+  ChunkStore store;
+  store.SetMemoryBudget(budget);
+
+  std::shared_ptr<ChunkStore::Chunk> inserted =
+      store.Insert(testing::MakeChunkData(1));
+  ChunkData original =
+      testing::MakeChunkData(2, testing::MakeSequenceRange(100, 0, 4), 2);
+  std::shared_ptr<ChunkStore::Chunk> wire;
+  REVERB_ASSERT_OK(
+      store.MakeChunk(absl::Cord(original.SerializeAsString()), &wire));
+  EXPECT_EQ(budget->used_bytes(),
+            inserted->DataByteSizeLong() + original.ByteSizeLong());
+
+  inserted = nullptr;
+  EXPECT_EQ(budget->used_bytes(), original.ByteSizeLong());
+  wire = nullptr;
+  EXPECT_EQ(budget->used_bytes(), 0);
+}
+
+TEST(ChunkStoreTest, EnableTieredStorageValidatesOptions) {
+  ChunkStore store;
+  EXPECT_EQ(
+      store.EnableTieredStorage(MakeTieredStorageOptions(absl::ZeroDuration()))
+          .code(),
+      absl::StatusCode::kInvalidArgument);
+
+  auto missing_directory = MakeTieredStorageOptions(absl::Seconds(1));
+  missing_directory.directory = "/does/not/exist";
+  EXPECT_FALSE(store.EnableTieredStorage(missing_directory).ok());
+
+  REVERB_EXPECT_OK(
+      store.EnableTieredStorage(MakeTieredStorageOptions(absl::Seconds(1))));
+  EXPECT_EQ(
+      store.EnableTieredStorage(MakeTieredStorageOptions(absl::Seconds(1)))
+          .code(),
+      absl::StatusCode::kFailedPrecondition);
+}
+
+TEST(ChunkStoreTest, TieredStorageSpillsColdChunksAndReadsThemBack) {
+  ChunkStore store;
+  REVERB_ASSERT_OK(store.EnableTieredStorage(
+      MakeTieredStorageOptions(absl::Milliseconds(50))));
+
+  ChunkData original =
+      testing::MakeChunkData(1, testing::MakeSequenceRange(100, 0, 4), 2);
+  std::shared_ptr<ChunkStore::Chunk> chunk = store.Insert(original);
+  const size_t byte_size = chunk->DataByteSizeLong();
+  EXPECT_TRUE(chunk->resident());
+
+  ASSERT_TRUE(WaitFor([&] { return !chunk->resident(); }));
+
+  // Metadata remains available without reading the data back.
+  EXPECT_EQ(chunk->key(), 1);
+  EXPECT_EQ(chunk->episode_id(), 100);
+  EXPECT_EQ(chunk->num_rows(), 5);
+  EXPECT_EQ(chunk->num_columns(), 2);
+  EXPECT_EQ(chunk->DataByteSizeLong(), byte_size);
+  EXPECT_FALSE(chunk->resident());
+
+  ChunkData read_back = chunk->data();
+  EXPECT_THAT(read_back, testing::EqualsProto(original));
+}
+
+TEST(ChunkStoreTest, TieredStorageDoesNotSpillPinnedChunks) {
+  ChunkStore store;
+  REVERB_ASSERT_OK(store.EnableTieredStorage(
+      MakeTieredStorageOptions(absl::Milliseconds(1))));
+
+  std::shared_ptr<ChunkStore::Chunk> chunk =
+      store.Insert(testing::MakeChunkData(1));
+  {
+    ChunkStore::Chunk::DataPin pin = chunk->Pin();
+    absl::SleepFor(absl::Milliseconds(50));
+    EXPECT_TRUE(chunk->resident());
+    EXPECT_EQ(pin.data().chunk_key(), 1);
+  }
+  EXPECT_TRUE(WaitFor([&] { return !chunk->resident(); }));
+}
+
+TEST(ChunkStoreTest, TieredStoragePrefetchReadsChunkBack) {
+  ChunkStore store;
+  REVERB_ASSERT_OK(store.EnableTieredStorage(
+      MakeTieredStorageOptions(absl::Milliseconds(100))));
+
+  std::shared_ptr<ChunkStore::Chunk> chunk =
+      store.Insert(testing::MakeChunkData(1));
+  ASSERT_TRUE(WaitFor([&] { return !chunk->resident(); }));
+
+  chunk->Prefetch();
+  EXPECT_TRUE(WaitFor([&] { return chunk->resident(); }));
+}
+
+TEST(ChunkStoreTest, TieredStorageReleasesArenaOfSpilledChunks) {
+  ChunkStore store;
+  REVERB_ASSERT_OK(store.EnableTieredStorage(
+      MakeTieredStorageOptions(absl::Milliseconds(1))));
+
+  auto arena = std::make_shared<google::protobuf::Arena>();
+  auto* data = google::protobuf::Arena::CreateMessage<ChunkData>(arena.get());
+  *data = testing::MakeChunkData(3);
+  std::weak_ptr<google::protobuf::Arena> weak_arena = arena;
+
+  std::shared_ptr<ChunkStore::Chunk> chunk =
+      store.MakeChunk(std::move(arena), data);
+  ASSERT_TRUE(WaitFor([&] { return !chunk->resident(); }));
+  EXPECT_TRUE(weak_arena.expired());
+  EXPECT_EQ(chunk->data().chunk_key(), 3);
+}
+
+TEST(ChunkStoreTest, TieredStorageReleasesSharedDataOfSpilledChunks) {
+  ChunkStore store;
+  REVERB_ASSERT_OK(store.EnableTieredStorage(
+      MakeTieredStorageOptions(absl::Milliseconds(1))));
+
+  auto data = std::make_shared<const ChunkData>(testing::MakeChunkData(3));
+  std::weak_ptr<const ChunkData> weak_data = data;
+
+  std::shared_ptr<ChunkStore::Chunk> chunk = store.MakeChunk(std::move(data));
+  ASSERT_TRUE(WaitFor([&] { return !chunk->resident(); }));
+  EXPECT_TRUE(weak_data.expired());
+  EXPECT_EQ(chunk->data().chunk_key(), 3);
+}
+
+// Returns a deferred chunk for `data` which counts the number of times its
+// loader has been called in `num_loads`.
+ChunkStore::DeferredChunk MakeDeferredChunk(const ChunkData& data,
+                                            std::atomic<int>* num_loads) {
+  ChunkStore::DeferredChunk deferred;
+  deferred.key = data.chunk_key();
+  deferred.episode_id = data.sequence_range().episode_id();
+  deferred.num_rows =
+      data.sequence_range().end() - data.sequence_range().start() + 1;
+  deferred.num_columns = data.data().tensors_size();
+  deferred.data_byte_size = data.ByteSizeLong();
+  deferred.loader = [data, num_loads](ChunkData* out) {
+    (*num_loads)++;
+    *out = data;
+    return absl::OkStatus();
+  };
+  return deferred;
+}
+
+TEST(ChunkStoreTest, InsertDeferredReadsDataOnFirstAccess) {
+  ChunkStore store;
+  ChunkData original =
+      testing::MakeChunkData(1, testing::MakeSequenceRange(100, 0, 4), 2);
+  std::atomic<int> num_loads(0);
+  auto chunk = store.InsertDeferred(MakeDeferredChunk(original, &num_loads));
+
+  // The metadata is available without reading the data.
+  EXPECT_FALSE(chunk->resident());
+  EXPECT_EQ(chunk->key(), 1);
+  EXPECT_EQ(chunk->episode_id(), 100);
+  EXPECT_EQ(chunk->num_rows(), 5);
+  EXPECT_EQ(chunk->num_columns(), 2);
+  EXPECT_EQ(chunk->DataByteSizeLong(), original.ByteSizeLong());
+  EXPECT_EQ(num_loads, 0);
+
+  ChunkVector chunks;
+  TF_ASSERT_OK(store.Get({1}, &chunks));
+  EXPECT_EQ(chunks[0], chunk);
+
+  EXPECT_THAT(chunk->data(), testing::EqualsProto(original));
+  EXPECT_TRUE(chunk->resident());
+  EXPECT_THAT(chunk->Pin().data(), testing::EqualsProto(original));
+  EXPECT_EQ(num_loads, 1);
+
+  // The data has already been read so it can no longer be provided.
+  EXPECT_FALSE(chunk->SetDeferredData(original));
+}
+
+TEST(ChunkStoreTest, SetDeferredDataSkipsLoader) {
+  ChunkStore store;
+  ChunkData original = testing::MakeChunkData(1);
+  std::atomic<int> num_loads(0);
+  auto chunk = store.InsertDeferred(MakeDeferredChunk(original, &num_loads));
+
+  EXPECT_TRUE(chunk->SetDeferredData(original));
+  EXPECT_TRUE(chunk->resident());
+  EXPECT_THAT(chunk->data(), testing::EqualsProto(original));
+  EXPECT_EQ(num_loads, 0);
+
+  // Chunks which were not deferred are not affected.
+  EXPECT_FALSE(store.Insert(testing::MakeChunkData(2))
+                   ->SetDeferredData(testing::MakeChunkData(2)));
+}
+
+TEST(ChunkStoreTest, InsertDeferredReturnsExistingChunk) {
+  ChunkStore store;
+  auto chunk = store.Insert(testing::MakeChunkData(1));
+  std::atomic<int> num_loads(0);
+  EXPECT_EQ(store.InsertDeferred(
+                MakeDeferredChunk(testing::MakeChunkData(1), &num_loads)),
+            chunk);
+}
+
+TEST(ChunkStoreTest, MakeChunkFromWireEncodingParsesDataOnFirstAccess) {
+  ChunkStore store;
+  ChunkData original =
+      testing::MakeChunkData(1, testing::MakeSequenceRange(100, 0, 4), 2);
+  absl::Cord serialized(original.SerializeAsString());
+  std::shared_ptr<ChunkStore::Chunk> chunk;
+  REVERB_ASSERT_OK(store.MakeChunk(serialized, &chunk));
+
+  EXPECT_FALSE(chunk->resident());
+  EXPECT_EQ(chunk->key(), 1);
+  EXPECT_EQ(chunk->episode_id(), 100);
+  EXPECT_EQ(chunk->num_rows(), 5);
+  EXPECT_EQ(chunk->num_columns(), 2);
+  EXPECT_EQ(chunk->DataByteSizeLong(), original.ByteSizeLong());
+  EXPECT_EQ(chunk->SerializedData(), serialized);
+
+  EXPECT_THAT(chunk->data(), testing::EqualsProto(original));
+  EXPECT_TRUE(chunk->resident());
+}
+
+TEST(ChunkStoreTest, MakeChunkFromWireEncodingRejectsMalformedData) {
+  ChunkStore store;
+  std::shared_ptr<ChunkStore::Chunk> chunk;
+  std::string serialized = testing::MakeChunkData(1).SerializeAsString();
+  serialized.resize(serialized.size() - 1);
+  EXPECT_EQ(store.MakeChunk(absl::Cord(serialized), &chunk).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // The tensors are validated even though their content is parsed lazily.
+  ChunkData data = testing::MakeChunkData(2);
+  tensorflow::TensorProto tensor;
+  tensor.set_dtype(tensorflow::DT_FLOAT);
+  std::string invalid = tensor.SerializeAsString();
+  invalid.push_back(0x08);  // Tag of a varint without its value.
+  std::string tensors;
+  tensors.push_back(ChunkData::Data::kTensorsFieldNumber << 3 | 2);
+  tensors.push_back(invalid.size());
+  tensors.append(invalid);
+  data.clear_data();
+  serialized = data.SerializeAsString();
+  serialized.push_back(ChunkData::kDataFieldNumber << 3 | 2);
+  serialized.push_back(tensors.size());
+  serialized.append(tensors);
+  EXPECT_EQ(store.MakeChunk(absl::Cord(serialized), &chunk).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(ChunkStoreTest, EpisodeSlabsHoldWireEncodingOfChunksOfEpisode) {
+  ChunkStore store;
+  store.EnableEpisodeSlabs(1 << 20);
+  ChunkVector chunks;
+  for (int key = 1; key <= 3; key++) {
+    ChunkData original = testing::MakeChunkData(
+        key, testing::MakeSequenceRange(/*episode_id=*/key == 2 ? 200 : 100,
+                                        key * 10, key * 10 + 4),
+        2);
+    std::shared_ptr<ChunkStore::Chunk> chunk;
+    REVERB_ASSERT_OK(
+        store.MakeChunk(absl::Cord(original.SerializeAsString()), &chunk));
+    EXPECT_EQ(chunk->SerializedData(), original.SerializeAsString());
+    chunks.push_back(std::move(chunk));
+  }
+  EXPECT_EQ(store.episode_slabs()->num_slabs(), 2);
+
+  // The slab of an episode is released once all of its chunks are destroyed.
+  chunks[0] = nullptr;
+  EXPECT_EQ(store.episode_slabs()->num_slabs(), 2);
+  chunks[2] = nullptr;
+  EXPECT_EQ(store.episode_slabs()->num_slabs(), 1);
+}
+
+TEST(ChunkStoreTest, TieredStorageSpillsDeferredChunksOnceRead) {
+  ChunkStore store;
+  REVERB_ASSERT_OK(store.EnableTieredStorage(
+      MakeTieredStorageOptions(absl::Milliseconds(1))));
+
+  ChunkData original = testing::MakeChunkData(1);
+  std::atomic<int> num_loads(0);
+  auto chunk = store.InsertDeferred(MakeDeferredChunk(original, &num_loads));
+  EXPECT_THAT(chunk->data(), testing::EqualsProto(original));
+  ASSERT_TRUE(WaitFor([&] { return !chunk->resident(); }));
+
+  // The data is read back from the spill file rather than the loader.
+  EXPECT_THAT(chunk->data(), testing::EqualsProto(original));
+  EXPECT_EQ(num_loads, 1);
+}
+
 TEST(ChunkTest, Length) {
   ChunkData data;
   data.mutable_sequence_range()->set_start(5);
@@ -150,6 +510,75 @@ TEST(ChunkTest, Key) {
   }
 }
 
+TEST(ChunkTest, GetDecodedColumnIsDecodedOnce) {
+  ChunkStore::Chunk chunk(
+      testing::MakeChunkData(1, testing::MakeSequenceRange(100, 0, 4), 2));
+
+  tensorflow::Tensor first;
+  REVERB_ASSERT_OK(chunk.GetDecodedColumn(1, &first));
+  EXPECT_EQ(first.dtype(), tensorflow::DT_INT32);
+  EXPECT_EQ(first.shape(), tensorflow::TensorShape({5, 10}));
+  EXPECT_EQ(first.flat<int32_t>()(0), 1);
+
+  // The second call returns the same buffer without decoding again.
+  tensorflow::Tensor second;
+  REVERB_ASSERT_OK(chunk.GetDecodedColumn(1, &second));
+  EXPECT_TRUE(first.SharesBufferWith(second));
+
+  tensorflow::Tensor other;
+  REVERB_ASSERT_OK(chunk.GetDecodedColumn(0, &other));
+  EXPECT_FALSE(first.SharesBufferWith(other));
+
+  EXPECT_EQ(chunk.GetDecodedColumn(2, &other).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(chunk.GetDecodedColumn(-1, &other).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(ChunkTest, SerializedDataIsCachedOnceRequestedAgain) {
+  ChunkData data =
+      testing::MakeChunkData(1, testing::MakeSequenceRange(100, 0, 4), 2);
+  ChunkStore::Chunk chunk(data);
+
+  absl::Cord first = chunk.SerializedData();
+  absl::Cord second = chunk.SerializedData();
+  absl::Cord third = chunk.SerializedData();
+  EXPECT_EQ(first, second);
+  EXPECT_NE(first.TryFlat()->data(), second.TryFlat()->data());
+  EXPECT_EQ(second.TryFlat()->data(), third.TryFlat()->data());
+
+  ChunkData parsed;
+  ASSERT_TRUE(internal::ParseFromCord(third, &parsed));
+  EXPECT_THAT(parsed, testing::EqualsProto(data));
+}
+
+TEST(ChunkTest, GetDecompressedDataStoresDecodedColumnsUncompressed) {
+  ChunkData original =
+      testing::MakeChunkData(1, testing::MakeSequenceRange(100, 0, 4), 2);
+  ChunkStore::Chunk chunk(original);
+
+  ChunkData decompressed;
+  REVERB_ASSERT_OK(chunk.GetDecompressedData(&decompressed));
+  EXPECT_EQ(decompressed.chunk_key(), original.chunk_key());
+  EXPECT_THAT(decompressed.sequence_range(),
+              testing::EqualsProto(original.sequence_range()));
+  EXPECT_FALSE(decompressed.delta_encoded());
+  EXPECT_EQ(decompressed.data_tensors_len(), 2);
+  ASSERT_EQ(decompressed.data().tensors_size(), 2);
+  EXPECT_THAT(decompressed.codecs(),
+              ::testing::ElementsAre(COMPRESSION_CODEC_NONE,
+                                     COMPRESSION_CODEC_NONE));
+
+  for (int column = 0; column < 2; column++) {
+    tensorflow::Tensor want;
+    REVERB_ASSERT_OK(chunk.GetDecodedColumn(column, &want));
+    tensorflow::Tensor got = DecompressTensorFromProto(
+        decompressed.data().tensors(column), COMPRESSION_CODEC_NONE);
+    EXPECT_EQ(got.shape(), want.shape());
+    EXPECT_EQ(got.tensor_data(), want.tensor_data());
+  }
+}
+
 TEST(ChunkTest, EpisodeId) {
   for (int i = 0; i < 5; i++) {
     ChunkData data;
@@ -158,6 +587,29 @@ TEST(ChunkTest, EpisodeId) {
   }
 }
 
+TEST(ChunkTest, KeepsArenaAlive) {
+  auto arena = std::make_shared<google::protobuf::Arena>();
+  auto* data = google::protobuf::Arena::CreateMessage<ChunkData>(arena.get());
+  *data = testing::MakeChunkData(3);
+
+  ChunkStore::Chunk chunk(arena, data);
+  std::weak_ptr<google::protobuf::Arena> weak_arena = arena;
+  arena = nullptr;
+
+  EXPECT_FALSE(weak_arena.expired());
+  EXPECT_EQ(chunk.key(), 3);
+  EXPECT_EQ(&chunk.data(), data);
+}
+
+TEST(ChunkTest, SharesOwnershipOfData) {
+  auto data = std::make_shared<const ChunkData>(testing::MakeChunkData(3));
+
+  ChunkStore::Chunk chunk(data);
+  EXPECT_EQ(data.use_count(), 2);
+  EXPECT_EQ(chunk.key(), 3);
+  EXPECT_EQ(&chunk.data(), data.get());
+}
+
 }  // namespace
 }  // namespace reverb
 }  // namespace deepmind
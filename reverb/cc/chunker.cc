@@ -25,6 +25,8 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/status_macros.h"
 #include "reverb/cc/schema.pb.h"
@@ -35,11 +37,15 @@
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/tensor_util.h"
+#include "tensorflow/core/util/batch_util.h"
 
 namespace deepmind {
 namespace reverb {
 namespace {
 
+// Maximum number of buffers kept in the free list of a `Chunker`.
+constexpr int kMaxFreeBuffers = 2;
+
 int GetLength(const ChunkData& chunk) {
   return chunk.data().tensors(0).tensor_shape().dim(0).size();
 }
@@ -63,9 +69,30 @@ bool CellRef::IsReady() const {
   return chunk_ != nullptr;
 }
 
+bool CellRef::IsFinalized() const {
+  absl::MutexLock lock(&mu_);
+  return finalized_;
+}
+
+void CellRef::WaitUntilReady() const {
+  absl::MutexLock lock(&mu_);
+  REVERB_CHECK(finalized_) << "WaitUntilReady called before the chunk was "
+                              "finalized.";
+  auto ready = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return chunk_ != nullptr;
+  };
+  mu_.Await(absl::Condition(&ready));
+}
+
 void CellRef::SetChunk(std::shared_ptr<ChunkDataContainer> chunk) {
   absl::MutexLock lock(&mu_);
   chunk_ = std::move(chunk);
+  finalized_ = true;
+}
+
+void CellRef::SetFinalized() {
+  absl::MutexLock lock(&mu_);
+  finalized_ = true;
 }
 
 std::weak_ptr<Chunker> CellRef::chunker() const { return chunker_; }
@@ -99,10 +126,15 @@ absl::Status CellRef::GetSpec(internal::TensorSpec* spec) const {
 }
 
 Chunker::Chunker(internal::TensorSpec spec,
-                 std::shared_ptr<ChunkerOptions> options)
+                 std::shared_ptr<ChunkerOptions> options,
+                 std::shared_ptr<TaskExecutor> compression_executor)
     : spec_(std::move(spec)),
       options_(std::move(options)),
-      key_generator_(absl::make_unique<internal::UniformKeyGenerator>()) {
+      compression_executor_(std::move(compression_executor)),
+      free_buffers_(std::make_shared<BufferPool>()),
+      cell_ref_pool_(std::make_shared<internal::FixedSizePool>()),
+      key_generator_(absl::make_unique<internal::ThreadLocalKeyGenerator>()),
+      chunk_keys_(key_generator_.get(), kChunkKeyRangeSize) {
   REVERB_CHECK_GE(options_->GetNumKeepAliveRefs(),
                   options_->GetMaxChunkLength());
   Reset();
@@ -126,42 +158,81 @@ absl::Status Chunker::Append(const tensorflow::Tensor& tensor,
 
   absl::MutexLock lock(&mu_);
 
-  if (!buffer_.empty() &&
+  if (offset_ > 0 &&
       active_refs_.back()->episode_id() != episode_info.episode_id) {
     return absl::FailedPreconditionError(
         "Chunker::Append called with new episode when buffer non empty.");
   }
-  if (!buffer_.empty() &&
+  if (offset_ > 0 &&
       active_refs_.back()->episode_step() >= episode_info.step) {
     return absl::FailedPreconditionError(
         "Chunker::Append called with an episode step which was not greater "
         "than already observed.");
   }
 
-  active_refs_.push_back(
-      std::make_shared<CellRef>(std::weak_ptr<Chunker>(shared_from_this()),
-                                next_chunk_key_, offset_++, episode_info));
+  if (offset_ == 0) {
+    const CompressionOptions compression = options_->GetCompression();
+    if (compression.has_frame_stack()) {
+      if (tensor.dtype() == tensorflow::DT_STRING) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Column ", spec_.name, " can't be compressed as a frame stack ",
+            "since it holds strings."));
+      }
+      if (compression.frame_stack().axis() >= tensor.dims()) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Frame stack axis ", compression.frame_stack().axis(),
+            " is out of range for column ", spec_.name, " with shape ",
+            tensor.shape().DebugString(), "."));
+      }
+    }
+    if (compression.quantization() != QUANTIZATION_NONE &&
+        tensor.dtype() != tensorflow::DT_FLOAT) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Column ", spec_.name, " can't be quantized with ",
+          Quantization_Name(compression.quantization()), " since only float32 ",
+          "columns can be quantized but got ",
+          tensorflow::DataTypeString(tensor.dtype()), "."));
+    }
 
-  // Add a batch dim to the tensor before adding it to the buffer. This will
-  // prepare it for the concat op when the chunk is finalized.
-  tensorflow::TensorShape shape = tensor.shape();
-  shape.InsertDim(0, 1);
+    // The buffer has room for all the rows of the chunk so each step is only
+    // copied once before being compressed.
+    tensorflow::TensorShape shape = tensor.shape();
+    shape.InsertDim(0, options_->GetMaxChunkLength());
+    buffer_ = free_buffers_->Acquire(tensor.dtype(), shape);
+  } else {
+    tensorflow::TensorShape row_shape = buffer_.shape();
+    row_shape.RemoveDim(0);
+    if (tensor.shape() != row_shape) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Tensor of shape ", tensor.shape().DebugString(),
+          " provided for column ", spec_.name,
+          " but the active chunk holds tensors of shape ",
+          row_shape.DebugString(),
+          ". All tensors in a chunk must have the same shape."));
+    }
+  }
+  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
+      tensorflow::batch_util::CopyElementToSlice(tensor, &buffer_, offset_)));
 
-  // This should never fail due to dtype or shape differences, because the dtype
-  // of tensors[j] is UNKNOWN and `shape` has the same number of elements as
-  // `item`.
-  tensorflow::Tensor batched_tensor(tensor.dtype(), shape);
-  REVERB_CHECK(batched_tensor.CopyFrom(tensor, shape));
-  buffer_.push_back(std::move(batched_tensor));
+  active_refs_.push_back(std::allocate_shared<CellRef>(
+      internal::PoolAllocator<CellRef>(cell_ref_pool_), weak_from_this(),
+      next_chunk_key_, offset_++, episode_info));
+  if (active_chunk_keys_.empty() ||
+      active_chunk_keys_.back().first != next_chunk_key_) {
+    active_chunk_keys_.emplace_back(next_chunk_key_, 0);
+  }
+  active_chunk_keys_.back().second++;
 
-  // Create the chunk if max buffer size reached.
-  if (buffer_.size() >= options_->GetMaxChunkLength()) {
+  // Create the chunk if max buffer size reached. The buffer is also full if
+  // `max_chunk_length` has grown since the chunk was started.
+  if (offset_ >= options_->GetMaxChunkLength() ||
+      offset_ >= buffer_.dim_size(0)) {
     REVERB_RETURN_IF_ERROR(FlushLocked());
   }
 
   // Delete references which which have exceeded their max age.
   while (active_refs_.size() > options_->GetNumKeepAliveRefs()) {
-    active_refs_.pop_front();
+    PopOldestRefLocked();
   }
 
   *ref = active_refs_.back();
@@ -169,13 +240,19 @@ absl::Status Chunker::Append(const tensorflow::Tensor& tensor,
   return absl::OkStatus();
 }
 
+void Chunker::PopOldestRefLocked() {
+  active_refs_.pop_front();
+  if (--active_chunk_keys_.front().second == 0) {
+    active_chunk_keys_.pop_front();
+  }
+}
+
 std::vector<uint64_t> Chunker::GetKeepKeys() const {
   absl::MutexLock lock(&mu_);
   std::vector<uint64_t> keys;
-  for (const std::shared_ptr<CellRef>& ref : active_refs_) {
-    if (keys.empty() || keys.back() != ref->chunk_key()) {
-      keys.push_back(ref->chunk_key());
-    }
+  keys.reserve(active_chunk_keys_.size());
+  for (const auto& [key, _] : active_chunk_keys_) {
+    keys.push_back(key);
   }
   return keys;
 }
@@ -186,39 +263,34 @@ absl::Status Chunker::Flush() {
 }
 
 absl::Status Chunker::FlushLocked() {
-  if (buffer_.empty()) return absl::OkStatus();
-
-  auto chunk = absl::make_unique<ChunkData>();
-  chunk->set_chunk_key(next_chunk_key_);
-
-  tensorflow::Tensor batched;
-  REVERB_RETURN_IF_ERROR(
-      FromTensorflowStatus(tensorflow::tensor::Concat(buffer_, &batched)));
+  if (offset_ == 0) return absl::OkStatus();
 
+  ChunkData chunk;
+  chunk.set_chunk_key(next_chunk_key_);
   if (options_->GetDeltaEncode()) {
-    batched = DeltaEncode(batched, /*encode=*/true);
-    chunk->set_delta_encoded(true);
+    chunk.set_delta_encoded(true);
+    chunk.set_delta_encoded_floats(true);
   }
 
-  CompressTensorAsProto(batched, chunk->mutable_data()->add_tensors());
-  chunk->set_data_tensors_len(chunk->data().tensors_size());
-
-  // Set the sequence range of the chunk.
+  // Set the sequence range of the chunk and collect the refs to notify once
+  // the chunk is ready.
+  std::vector<std::shared_ptr<CellRef>> refs;
+  refs.reserve(offset_);
   for (const auto& ref : active_refs_) {
     // active_refs_ is sorted by insertion time. Iterate over the list until
     // the first cell belonging to the newly created chunk is found.
-    if (ref->chunk_key() != chunk->chunk_key()) continue;
+    if (ref->chunk_key() != chunk.chunk_key()) continue;
 
-    if (!chunk->has_sequence_range()) {
+    if (!chunk.has_sequence_range()) {
       // On the first ref belonging to this chunk, set the the episode ID and
       // set the episode length to 1 (i.e. start == end). The episode length
       // will be extended if we discover more refs belonging to this chunk.
-      SequenceRange* range = chunk->mutable_sequence_range();
+      SequenceRange* range = chunk.mutable_sequence_range();
       range->set_episode_id(ref->episode_id());
       range->set_start(ref->episode_step());
       range->set_end(ref->episode_step());
     } else {
-      SequenceRange* range = chunk->mutable_sequence_range();
+      SequenceRange* range = chunk.mutable_sequence_range();
 
       // Sanity check: The ref belongs to this episode (and chunk) and the ref's
       // step counter is monotonically increasing (i.e. active_refs_ is sorted
@@ -245,30 +317,94 @@ absl::Status Chunker::FlushLocked() {
       }
       range->set_end(ref->episode_step());
     }
+    refs.push_back(ref);
   }
 
-  // Now the chunk has been finalized we can notify the `CellRef`s.
-  auto chunk_container = std::make_shared<ChunkDataContainer>(std::move(chunk));
-  for (std::shared_ptr<CellRef>& ref : active_refs_) {
-    if (ref->chunk_key() == chunk_container->chunk->chunk_key()) {
-      ref->SetChunk(chunk_container);
+  if (compression_executor_ != nullptr) {
+    for (const auto& ref : refs) {
+      ref->SetFinalized();
     }
   }
 
-  buffer_.clear();
-  next_chunk_key_ = key_generator_->Generate();
+  // Only the rows in use are compressed. Slicing the first dimension does not
+  // copy the data. Once compressed, the buffer is returned to the free list.
+  auto compress = [chunk = std::move(chunk),
+                   buffer = std::exchange(buffer_, tensorflow::Tensor()),
+                   num_rows = offset_, compression = options_->GetCompression(),
+                   refs = std::move(refs), free_buffers = free_buffers_,
+                   options = options_]() mutable {
+    CompressChunk(std::move(chunk), buffer.Slice(0, num_rows),
+                  std::move(compression), std::move(refs), options.get());
+    free_buffers->Release(std::move(buffer));
+  };
+
+  if (compression_executor_ == nullptr) {
+    compress();
+  } else {
+    compression_executor_->Schedule(std::move(compress));
+  }
+
+  next_chunk_key_ = chunk_keys_.Next();
   offset_ = 0;
 
   return absl::OkStatus();
 }
 
+void Chunker::CompressChunk(ChunkData chunk, const tensorflow::Tensor& batched,
+                            CompressionOptions compression,
+                            std::vector<std::shared_ptr<CellRef>> refs,
+                            ChunkerOptions* options) {
+  const absl::Time start = absl::Now();
+  CompressChunkColumn(batched, compression, &chunk);
+  chunk.set_data_tensors_len(chunk.data().tensors_size());
+  options->OnChunkCompressed(ChunkStatistics{
+      chunk.chunk_key(), static_cast<int>(batched.dim_size(0)),
+      static_cast<int64_t>(batched.TotalBytes()),
+      static_cast<int64_t>(chunk.ByteSizeLong()), absl::Now() - start,
+      chunk.delta_encoded()});
+
+  // Now the chunk has been finalized we can notify the `CellRef`s.
+  auto chunk_container = std::make_shared<ChunkDataContainer>(
+      absl::make_unique<ChunkData>(std::move(chunk)));
+  for (std::shared_ptr<CellRef>& ref : refs) {
+    ref->SetChunk(chunk_container);
+  }
+}
+
+tensorflow::Tensor Chunker::BufferPool::Acquire(
+    tensorflow::DataType dtype, const tensorflow::TensorShape& shape) {
+  absl::MutexLock lock(&mu_);
+  while (!buffers_.empty()) {
+    tensorflow::Tensor buffer = std::move(buffers_.back());
+    buffers_.pop_back();
+    // Buffers of other shapes are left over from chunks of a different length
+    // (or with differently shaped rows) and are unlikely to be needed again.
+    if (buffer.dtype() == dtype && buffer.shape() == shape) {
+      return buffer;
+    }
+  }
+  return tensorflow::Tensor(dtype, shape);
+}
+
+void Chunker::BufferPool::Release(tensorflow::Tensor buffer) {
+  // Compressed chunks and the tensors returned by `CopyDataForCell` are copies
+  // so nothing reads from the buffer once it has been released. Empty tensors
+  // are what `Reset` finds when no chunk was started.
+  if (buffer.NumElements() == 0) return;
+
+  absl::MutexLock lock(&mu_);
+  if (buffers_.size() < kMaxFreeBuffers) {
+    buffers_.push_back(std::move(buffer));
+  }
+}
+
 void Chunker::Reset() {
   absl::MutexLock lock(&mu_);
-  buffer_.clear();
-  buffer_.reserve(options_->GetMaxChunkLength());
+  free_buffers_->Release(std::exchange(buffer_, tensorflow::Tensor()));
   offset_ = 0;
-  next_chunk_key_ = key_generator_->Generate();
+  next_chunk_key_ = chunk_keys_.Next();
   active_refs_.clear();
+  active_chunk_keys_.clear();
 }
 
 const internal::TensorSpec& Chunker::spec() const { return spec_; }
@@ -276,7 +412,7 @@ const internal::TensorSpec& Chunker::spec() const { return spec_; }
 absl::Status Chunker::ApplyConfig(std::shared_ptr<ChunkerOptions> options) {
   absl::MutexLock lock(&mu_);
 
-  if (!buffer_.empty()) {
+  if (offset_ > 0) {
     return absl::FailedPreconditionError(
         "Flush must be called before ApplyConfig.");
   }
@@ -285,7 +421,7 @@ absl::Status Chunker::ApplyConfig(std::shared_ptr<ChunkerOptions> options) {
   options_ = std::move(options);
 
   while (active_refs_.size() > options_->GetNumKeepAliveRefs()) {
-    active_refs_.pop_front();
+    PopOldestRefLocked();
   }
 
   return absl::OkStatus();
@@ -293,14 +429,22 @@ absl::Status Chunker::ApplyConfig(std::shared_ptr<ChunkerOptions> options) {
 
 absl::Status Chunker::CopyDataForCell(const CellRef* ref,
                                       tensorflow::Tensor* out) const {
+  // The data of chunks which are being compressed has already left `buffer_`
+  // so we have to wait for the compression to complete.
+  if (ref->IsFinalized()) {
+    ref->WaitUntilReady();
+  }
+
   absl::MutexLock lock(&mu_);
 
-  // If the chunk has been finalized then we unpack it and slice out the data.
+  // If the chunk has been finalized then we unpack its row and slice out the
+  // data. Block structured chunks only decompress the block holding the row.
   if (ref->IsReady()) {
-    tensorflow::Tensor column;
-    REVERB_RETURN_IF_ERROR(
-        internal::UnpackChunkColumn(*ref->GetChunk()->get(), 0, &column));
-    *out = column.SubSlice(ref->offset());
+    tensorflow::Tensor row;
+    REVERB_RETURN_IF_ERROR(internal::UnpackChunkColumnAndSlice(
+        *ref->GetChunk()->get(), /*column=*/0, ref->offset(), /*length=*/1,
+        &row));
+    *out = row.SubSlice(0);
     if (!out->IsAligned()) {
       *out = tensorflow::tensor::DeepCopy(*out);
     }
@@ -316,19 +460,15 @@ absl::Status Chunker::CopyDataForCell(const CellRef* ref,
     negative_offset++;
   }
 
-  int buffer_index = buffer_.size() - negative_offset - 1;
+  int buffer_index = offset_ - negative_offset - 1;
   if (buffer_index < 0) {
     return absl::InternalError(
         "Data could not be found in buffer nor in finalized chunk.");
   }
 
-  // A batch dimension is added to the data before it is added to the buffer so
-  // we strip that off before copying the content to the output tensor.
-  tensorflow::TensorShape shape = buffer_[buffer_index].shape();
-  shape.RemoveDim(0);
-  if (!out->CopyFrom(buffer_[buffer_index], shape)) {
-    return absl::InternalError("Unable to copy tensor from buffer.");
-  }
+  // The buffer is reused once the chunk has been compressed so the row must
+  // be copied rather than sliced.
+  *out = tensorflow::tensor::DeepCopy(buffer_.SubSlice(buffer_index));
 
   return absl::OkStatus();
 }
@@ -371,15 +511,60 @@ absl::Status ValidateChunkerOptions(const ChunkerOptions* options) {
         "num_keep_alive_refs (", options->GetNumKeepAliveRefs(),
         ") must be >= max_chunk_length (", options->GetMaxChunkLength(), ")."));
   }
+  const CompressionOptions compression = options->GetCompression();
+  switch (compression.codec()) {
+    case COMPRESSION_CODEC_SNAPPY:
+    case COMPRESSION_CODEC_NONE:
+      if (compression.level() != 0) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Compression level is not supported by ",
+            CompressionCodec_Name(compression.codec()), " but got ",
+            compression.level(), "."));
+      }
+      break;
+    case COMPRESSION_CODEC_ZLIB:
+      if (compression.level() < 0 || compression.level() > 9) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Compression level of ", CompressionCodec_Name(compression.codec()),
+            " must be in [0, 9] but got ", compression.level(), "."));
+      }
+      break;
+    default:
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Unsupported compression codec: ", compression.codec(), "."));
+  }
+  if (compression.block_length() < 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Compression block_length must be >= 0 but got ",
+                     compression.block_length(), "."));
+  }
+  if (compression.has_frame_stack()) {
+    if (compression.frame_stack().axis() < 0) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Frame stack axis must be >= 0 but got ",
+                       compression.frame_stack().axis(), "."));
+    }
+    if (compression.block_length() > 0) {
+      return absl::InvalidArgumentError(
+          "Frame stacks can't be compressed in blocks (block_length must be "
+          "0).");
+    }
+  }
+  if (!Quantization_IsValid(compression.quantization())) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Unsupported quantization: ", compression.quantization(), "."));
+  }
   return absl::OkStatus();
 }
 
 ConstantChunkerOptions::ConstantChunkerOptions(int max_chunk_length,
                                                int num_keep_alive_refs,
-                                               bool delta_encode)
+                                               bool delta_encode,
+                                               CompressionOptions compression)
     : max_chunk_length_(max_chunk_length),
       num_keep_alive_refs_(num_keep_alive_refs),
-      delta_encode_(delta_encode) {}
+      delta_encode_(delta_encode),
+      compression_(std::move(compression)) {}
 
 int ConstantChunkerOptions::GetMaxChunkLength() const {
   return max_chunk_length_;
@@ -391,6 +576,10 @@ int ConstantChunkerOptions::GetNumKeepAliveRefs() const {
 
 bool ConstantChunkerOptions::GetDeltaEncode() const { return delta_encode_; }
 
+CompressionOptions ConstantChunkerOptions::GetCompression() const {
+  return compression_;
+}
+
 absl::Status ConstantChunkerOptions::OnItemFinalized(
     const PrioritizedItem& item,
     absl::Span<const std::shared_ptr<CellRef>> refs) {
@@ -398,17 +587,24 @@ absl::Status ConstantChunkerOptions::OnItemFinalized(
 }
 
 std::shared_ptr<ChunkerOptions> ConstantChunkerOptions::Clone() const {
-  return std::make_shared<ConstantChunkerOptions>(max_chunk_length_,
-                                                  num_keep_alive_refs_);
+  return std::make_shared<ConstantChunkerOptions>(
+      max_chunk_length_, num_keep_alive_refs_, delta_encode_, compression_);
 }
 
 AutoTunedChunkerOptions::AutoTunedChunkerOptions(int num_keep_alive_refs,
                                                  double throughput_weight,
-                                                 bool delta_encode)
+                                                 bool delta_encode,
+                                                 CompressionOptions compression,
+                                                 double cpu_weight,
+                                                 bool tune_delta_encode)
     : num_keep_alive_refs_(num_keep_alive_refs),
-      delta_encode_(delta_encode),
+      initial_delta_encode_(delta_encode),
+      tune_delta_encode_(tune_delta_encode),
+      compression_(std::move(compression)),
       throughput_weight_(throughput_weight),
+      cpu_weight_(cpu_weight),
       max_chunk_length_(1),
+      delta_encode_(delta_encode),
       prev_score_(Score{-1, -1}) {}
 
 int AutoTunedChunkerOptions::GetMaxChunkLength() const {
@@ -420,24 +616,34 @@ int AutoTunedChunkerOptions::GetNumKeepAliveRefs() const {
   return num_keep_alive_refs_;
 }
 
-bool AutoTunedChunkerOptions::GetDeltaEncode() const { return delta_encode_; }
+bool AutoTunedChunkerOptions::GetDeltaEncode() const {
+  absl::MutexLock lock(&mu_);
+  return delta_encode_;
+}
+
+CompressionOptions AutoTunedChunkerOptions::GetCompression() const {
+  return compression_;
+}
 
 void AutoTunedChunkerOptions::PushItem(
     absl::Span<const std::shared_ptr<CellRef>> refs) {
   double total_bytes = 0;
   double total_chunk_length = 0;
+  double total_compress_us = 0;
 
   internal::flat_hash_set<uint64_t> seen_chunks;
   for (const auto& ref : refs) {
     if (seen_chunks.insert(ref->chunk_key()).second) {
       total_bytes += ref->GetChunk()->get()->ByteSizeLong();
       total_chunk_length += GetLength(*ref->GetChunk()->get());
+      total_compress_us += CompressTimeUs(ref->chunk_key());
     }
   }
 
   Statistic summary;
   summary.average_chunk_length = total_chunk_length / seen_chunks.size();
   summary.bytes_per_step = total_bytes / refs.size();
+  summary.compress_us_per_step = total_compress_us / refs.size();
   items_.push_back(std::move(summary));
 
   if (items_.size() > kNumItemsToScore) {
@@ -469,6 +675,16 @@ absl::Status AutoTunedChunkerOptions::OnItemFinalized(
   items_.clear();
   chunks_.clear();
 
+  if (tune_delta_encode_ && MaybeSwitchDeltaEncode(new_score)) {
+    rebase_score_ = true;
+    return absl::OkStatus();
+  }
+  if (rebase_score_) {
+    rebase_score_ = false;
+    prev_score_ = new_score;
+    return absl::OkStatus();
+  }
+
   // If this is the first time the score has been recorded then we increase the
   // `max_chunk_length_` so there is something to compare to the next time the
   // score is calculated.
@@ -522,15 +738,21 @@ absl::Status AutoTunedChunkerOptions::ReduceAndClearBuffers(
 
   double avg_chunk_length_sum = 0;
 
+  // CPU time is converted to bytes with `cpu_weight_` so a single cost can be
+  // minimized.
   double avg_bytes_per_item_step = 0;
   for (const auto& summary : items_) {
-    avg_bytes_per_item_step += summary.bytes_per_step / items_.size();
+    avg_bytes_per_item_step +=
+        (summary.bytes_per_step + summary.compress_us_per_step * cpu_weight_) /
+        items_.size();
     avg_chunk_length_sum += summary.average_chunk_length;
   }
 
   double avg_bytes_per_chunk_step = 0;
   for (const auto& summary : chunks_) {
-    avg_bytes_per_chunk_step += summary.bytes_per_step / chunks_.size();
+    avg_bytes_per_chunk_step +=
+        (summary.bytes_per_step + summary.compress_us_per_step * cpu_weight_) /
+        chunks_.size();
     avg_chunk_length_sum += summary.average_chunk_length;
   }
 
@@ -557,6 +779,8 @@ void AutoTunedChunkerOptions::PushChunks(
       summary.average_chunk_length = GetLength(chunk);
       summary.bytes_per_step =
           chunk.ByteSizeLong() / summary.average_chunk_length;
+      summary.compress_us_per_step =
+          CompressTimeUs(chunk.chunk_key()) / summary.average_chunk_length;
       chunks_.push_back(std::move(summary));
     }
   }
@@ -566,9 +790,50 @@ void AutoTunedChunkerOptions::PushChunks(
   }
 }
 
+void AutoTunedChunkerOptions::OnChunkCompressed(
+    const ChunkStatistics& statistics) {
+  absl::MutexLock lock(&mu_);
+  if (!compress_times_.insert({statistics.chunk_key, statistics.compress_time})
+           .second) {
+    return;
+  }
+  compress_times_order_.push_back(statistics.chunk_key);
+  while (compress_times_order_.size() > num_keep_alive_refs_) {
+    compress_times_.erase(compress_times_order_.front());
+    compress_times_order_.pop_front();
+  }
+}
+
+double AutoTunedChunkerOptions::CompressTimeUs(uint64_t chunk_key) const {
+  auto it = compress_times_.find(chunk_key);
+  return it == compress_times_.end()
+             ? 0
+             : absl::ToDoubleMicroseconds(it->second);
+}
+
+bool AutoTunedChunkerOptions::MaybeSwitchDeltaEncode(const Score& score) {
+  delta_encode_costs_[delta_encode_] = score.cost;
+  const absl::optional<double>& other_cost =
+      delta_encode_costs_[!delta_encode_];
+
+  // The other setting is probed when it hasn't been tried at all or not for a
+  // while since the best setting may change with the chunk length and data.
+  bool probe = !other_cost.has_value() ||
+               ++scores_since_delta_encode_probe_ >= kDeltaEncodeProbePeriod;
+  if (!probe && *other_cost >= score.cost) {
+    return false;
+  }
+  if (probe) {
+    scores_since_delta_encode_probe_ = 0;
+  }
+  delta_encode_ = !delta_encode_;
+  return true;
+}
+
 std::shared_ptr<ChunkerOptions> AutoTunedChunkerOptions::Clone() const {
-  return std::make_shared<AutoTunedChunkerOptions>(num_keep_alive_refs_,
-                                                   throughput_weight_);
+  return std::make_shared<AutoTunedChunkerOptions>(
+      num_keep_alive_refs_, throughput_weight_, initial_delta_encode_,
+      compression_, cpu_weight_, tune_delta_encode_);
 }
 
 }  // namespace reverb
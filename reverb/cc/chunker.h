@@ -17,18 +17,22 @@
 
 #include <deque>
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include "absl/base/thread_annotations.h"
 #include "absl/status/status.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "absl/types/span.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/fixed_size_pool.h"
 #include "reverb/cc/support/key_generators.h"
 #include "reverb/cc/support/signature.h"
+#include "reverb/cc/support/task_executor.h"
 #include "tensorflow/core/framework/tensor.h"
 
 namespace deepmind {
@@ -72,7 +76,10 @@ struct ChunkDataContainer {
 // sufficient batch size has been achieved before actually creating the chunk.
 // As such, the data referenced by `CellRef` initially lives inside the
 // `Chunker`. Once the chunker has created a chunk, the chunk is associated with
-// the corresponding `CellRef`s via the `SetChunk` member function.
+// the corresponding `CellRef`s via the `SetChunk` member function. If the
+// `Chunker` compresses chunks asynchronously then the `CellRef` is first marked
+// as finalized (the data has left the buffer of the `Chunker`) and `SetChunk`
+// is only called once the compression has completed.
 //
 // Note: Chunks consume a lot of memory since they hold the actual tensor data.
 // They are kept in memory until the last `CellRef` is destroyed or deletes its
@@ -102,6 +109,16 @@ class CellRef {
   // True if SetChunk has been called.
   bool IsReady() const ABSL_LOCKS_EXCLUDED(mu_);
 
+  // True if the parent `Chunker` has started creating the chunk, i.e. the
+  // referenced data is no longer buffered by the `Chunker`. The chunk might
+  // still be compressed in the background, in which case `IsReady` returns
+  // false until it has completed.
+  bool IsFinalized() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Blocks until SetChunk has been called. Must only be called once
+  // `IsFinalized` returns true.
+  void WaitUntilReady() const ABSL_LOCKS_EXCLUDED(mu_);
+
   // Gets chunker if set. If not yet set then nullptr is returned.
   std::shared_ptr<ChunkDataContainer> GetChunk() const ABSL_LOCKS_EXCLUDED(mu_);
 
@@ -127,6 +144,10 @@ class CellRef {
   void SetChunk(std::shared_ptr<ChunkDataContainer> chunk)
       ABSL_LOCKS_EXCLUDED(mu_);
 
+  // Called by chunker when the referenced data has been moved out of its
+  // buffer and the chunk is being compressed.
+  void SetFinalized() ABSL_LOCKS_EXCLUDED(mu_);
+
  private:
   // Chunker which created the `CellRef` and will eventually create the chunk
   // and call `SetChunk`.
@@ -147,26 +168,36 @@ class CellRef {
   // nullptr until the chunk is actually created by the parent `Chunker` and
   // updated via `SetChunk`.
   std::shared_ptr<ChunkDataContainer> chunk_ ABSL_GUARDED_BY(mu_);
+
+  // True once `SetFinalized` or `SetChunk` has been called.
+  bool finalized_ ABSL_GUARDED_BY(mu_) = false;
 };
 
-// Checks that `max_chunk_length` and `num_keep_alive_refs` is a valid `Chunker`
-// configuration and returns `InvalidArgumentError` if it isn't.
+// Checks that `max_chunk_length`, `num_keep_alive_refs` and the compression
+// options are a valid `Chunker` configuration and returns
+// `InvalidArgumentError` if they aren't.
 absl::Status ValidateChunkerOptions(const ChunkerOptions* options);
 
 class Chunker : public std::enable_shared_from_this<Chunker> {
  public:
-  Chunker(internal::TensorSpec spec, std::shared_ptr<ChunkerOptions> options);
+  // If `compression_executor` is set then chunks are delta encoded and
+  // compressed on its threads rather than by the caller of `Append` (or
+  // `Flush`). The same executor can be shared by any number of `Chunker`s.
+  Chunker(internal::TensorSpec spec, std::shared_ptr<ChunkerOptions> options,
+          std::shared_ptr<TaskExecutor> compression_executor = nullptr);
 
   // Validates `tensor` against `spec_` and `episode_info` against previous
-  // calls, appends it to the active chunk and returns a reference to the new
-  // row. If the active chunk now has `max_chunk_length` rows then it is
+  // calls, copies it into the next row of the active chunk and returns a
+  // reference to the new row. All rows of a chunk must have the same shape. If the active chunk now has `max_chunk_length` rows then it is
   // finalized and its `CellRef`s notified (including `ref`).
   absl::Status Append(const tensorflow::Tensor& tensor,
                       const CellRef::EpisodeInfo& episode_info,
                       std::weak_ptr<CellRef>* ref) ABSL_LOCKS_EXCLUDED(mu_);
 
   // Creates a chunk from the data in the buffer and calls `SetChunk` on its
-  // `CellRef`s.
+  // `CellRef`s. If chunks are compressed asynchronously then the `CellRef`s are
+  // only marked as finalized and `SetChunk` is called once the compression has
+  // completed.
   absl::Status Flush() ABSL_LOCKS_EXCLUDED(mu_);
 
   // Clears buffers of both references and data not yet committed to a Chunk.
@@ -203,6 +234,19 @@ class Chunker : public std::enable_shared_from_this<Chunker> {
  private:
   absl::Status FlushLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
+  // Removes the oldest `CellRef` from `active_refs_` (and its chunk from
+  // `active_chunk_keys_` if it was the last one referencing it).
+  void PopOldestRefLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Delta encodes (if `chunk.delta_encoded()`) and compresses `batched` into
+  // the data of `chunk` and then notifies `refs` that the chunk is ready.
+  // `options` is notified of the statistics of the chunk before `refs`.
+  static void CompressChunk(ChunkData chunk,
+                            const tensorflow::Tensor& batched,
+                            CompressionOptions compression,
+                            std::vector<std::shared_ptr<CellRef>> refs,
+                            ChunkerOptions* options);
+
   // Spec which all data in `Append` must follow.
   internal::TensorSpec spec_;
 
@@ -210,24 +254,88 @@ class Chunker : public std::enable_shared_from_this<Chunker> {
   // Values may change over time depending on the implementation.
   std::shared_ptr<ChunkerOptions> options_;
 
+  // Threads on which chunks are compressed. If nullptr then chunks are
+  // compressed by the thread which flushes the buffer.
+  std::shared_ptr<TaskExecutor> compression_executor_;
+
   mutable absl::Mutex mu_;
 
-  // Data waiting for the next chunk to be constructed.
-  std::vector<tensorflow::Tensor> buffer_ ABSL_GUARDED_BY(mu_);
+  // Buffers of flushed chunks which can be reused once the chunk has been
+  // compressed. Shared with the compression tasks as these may outlive the
+  // `Chunker`.
+  class BufferPool {
+   public:
+    // Returns a free buffer of `dtype` and `shape` or allocates a new one.
+    tensorflow::Tensor Acquire(tensorflow::DataType dtype,
+                               const tensorflow::TensorShape& shape)
+        ABSL_LOCKS_EXCLUDED(mu_);
+
+    // Makes `buffer` available to future `Acquire` calls. At most
+    // `kMaxFreeBuffers` are kept.
+    void Release(tensorflow::Tensor buffer) ABSL_LOCKS_EXCLUDED(mu_);
+
+   private:
+    absl::Mutex mu_;
+    std::vector<tensorflow::Tensor> buffers_ ABSL_GUARDED_BY(mu_);
+  };
+
+  // Data waiting for the next chunk to be constructed. The first dimension has
+  // room for `max_chunk_length` rows (as of the first `Append` of the chunk)
+  // of which the first `offset_` are in use. Allocated by the first `Append`
+  // of each chunk.
+  tensorflow::Tensor buffer_ ABSL_GUARDED_BY(mu_);
 
-  // Offset within the chunk of the next appended item.
+  // Offset within the chunk of the next appended item. This is also the number
+  // of rows of `buffer_` in use.
   int offset_ ABSL_GUARDED_BY(mu_);
 
+  // Free list from which `buffer_` is allocated.
+  std::shared_ptr<BufferPool> free_buffers_;
+
+  // Slabs from which the `CellRef`s created by `Append` (and their shared_ptr
+  // control blocks) are allocated. The pool is kept alive by the `CellRef`s
+  // which outlive the `Chunker`.
+  std::shared_ptr<internal::FixedSizePool> cell_ref_pool_;
+
   // Key of the chunk that will be constructed from `buffer_`.
   uint64_t next_chunk_key_ ABSL_GUARDED_BY(mu_);
 
-  // Used to generate chunk keys.
+  // Used to generate chunk keys. The keys are taken from ranges of
+  // `kChunkKeyRangeSize` keys so a new key only has to be generated for every
+  // `kChunkKeyRangeSize` chunks.
+  static constexpr int kChunkKeyRangeSize = 64;
   std::unique_ptr<internal::KeyGenerator> key_generator_;
+  internal::KeyRangeAllocator chunk_keys_ ABSL_GUARDED_BY(mu_);
 
   // Circular buffer of `CellRef`s that can be referenced in by new items.
   // When the size exceeds `num_keep_alive_refs_` then the oldest item is
   // removed.
   std::deque<std::shared_ptr<CellRef>> active_refs_ ABSL_GUARDED_BY(mu_);
+
+  // Keys of the chunks referenced by `active_refs_` in the same order, each
+  // with the number of refs in `active_refs_` which reference it. Maintained
+  // together with `active_refs_` so that `GetKeepKeys` doesn't have to scan
+  // every ref.
+  std::deque<std::pair<uint64_t, int>> active_chunk_keys_ ABSL_GUARDED_BY(mu_);
+};
+
+// Measurements of a chunk taken by the `Chunker` which created it.
+struct ChunkStatistics {
+  // Key of the chunk.
+  uint64_t chunk_key;
+
+  // Number of steps in the chunk.
+  int num_rows;
+
+  // Size of the data before and after it was (delta encoded and) compressed.
+  int64_t uncompressed_bytes;
+  int64_t compressed_bytes;
+
+  // Time spent delta encoding and compressing the data.
+  absl::Duration compress_time;
+
+  // Whether the chunk was delta encoded.
+  bool delta_encoded;
 };
 
 class ChunkerOptions {
@@ -250,6 +358,11 @@ class ChunkerOptions {
   // Get current recommendation of whether delta encoding should be used.
   virtual bool GetDeltaEncode() const = 0;
 
+  // Get current recommendation of the codec (and level) used to compress
+  // chunks. The selected codec is recorded in `ChunkData.codecs` so readers
+  // can decompress the data without knowing the options of the writer.
+  virtual CompressionOptions GetCompression() const = 0;
+
   // Called by parent `Chunker` once an item is ready to be sent to the
   // server.
   //
@@ -268,6 +381,11 @@ class ChunkerOptions {
       const PrioritizedItem& item,
       absl::Span<const std::shared_ptr<CellRef>> refs) = 0;
 
+  // Called by parent `Chunker` once a chunk has been compressed and before
+  // the `CellRef`s of the chunk become ready. Might be called from the threads
+  // of the compression executor. The default implementation is a noop.
+  virtual void OnChunkCompressed(const ChunkStatistics& statistics) {}
+
   // Make a copy of this `ChunkerOptions` and state. This allows a particular
   // implementation
   // to be used as a template for all (or some) of the `Chunker`s owned by a
@@ -280,7 +398,8 @@ class ChunkerOptions {
 class ConstantChunkerOptions : public ChunkerOptions {
  public:
   ConstantChunkerOptions(int max_chunk_length, int num_keep_alive_refs,
-                         bool delta_encode = false);
+                         bool delta_encode = false,
+                         CompressionOptions compression = {});
 
   int GetMaxChunkLength() const override;
 
@@ -288,6 +407,8 @@ class ConstantChunkerOptions : public ChunkerOptions {
 
   bool GetDeltaEncode() const override;
 
+  CompressionOptions GetCompression() const override;
+
   absl::Status OnItemFinalized(
       const PrioritizedItem& item,
       absl::Span<const std::shared_ptr<CellRef>> refs) override;
@@ -298,6 +419,7 @@ class ConstantChunkerOptions : public ChunkerOptions {
   int max_chunk_length_;
   int num_keep_alive_refs_;
   bool delta_encode_;
+  CompressionOptions compression_;
 };
 
 // Automatically tunes the `max_chunk_length` value within the range [1,
@@ -343,10 +465,21 @@ class AutoTunedChunkerOptions : public ChunkerOptions {
   // score is ignored and the content of the buffers dropped.
   static constexpr auto kMaxChunkLengthError = 0.25;
 
-  // TODO(b/180278134): Remove delta_encode argument once it is auto selected.
+  // Number of scores between attempts of the delta encoding setting which
+  // isn't currently used (only when `tune_delta_encode` is set).
+  static const int kDeltaEncodeProbePeriod = 8;
+
+  // `cpu_weight` is the number of bytes that one microsecond of CPU time spent
+  // compressing a step (or decompressing it when sampled) is considered to be
+  // worth. 0 only minimizes the number of bytes. If `tune_delta_encode` is set
+  // then `delta_encode` is only the initial setting and delta encoding is
+  // periodically turned on and off to select the setting with the lower cost.
   explicit AutoTunedChunkerOptions(int num_keep_alive_ref,
                                    double throughput_weight = 1.0,
-                                   bool delta_encode = false);
+                                   bool delta_encode = false,
+                                   CompressionOptions compression = {},
+                                   double cpu_weight = 0.0,
+                                   bool tune_delta_encode = false);
 
   // Returns the recommendation of the maximum chunk length.
   int GetMaxChunkLength() const override;
@@ -354,9 +487,13 @@ class AutoTunedChunkerOptions : public ChunkerOptions {
   // Returns the (constant) size of the reference buffer.
   int GetNumKeepAliveRefs() const override;
 
-  // Returns the (constant) delta encoding setting.
+  // Returns the delta encoding setting, which is only constant unless
+  // `tune_delta_encode` was set.
   bool GetDeltaEncode() const override;
 
+  // Returns the (constant) compression setting.
+  CompressionOptions GetCompression() const override;
+
   // Calculates performance statistics for the item and the chunks it
   // reference and uses thse to (potentially) update the result of
   // `GetMaxChunkLength`.
@@ -364,11 +501,25 @@ class AutoTunedChunkerOptions : public ChunkerOptions {
       const PrioritizedItem& item,
       absl::Span<const std::shared_ptr<CellRef>> refs) override;
 
+  // Records the compression time of the chunk so it can be included in the
+  // cost of the chunk and of the items referencing it.
+  void OnChunkCompressed(const ChunkStatistics& statistics) override;
+
   std::shared_ptr<ChunkerOptions> Clone() const override;
 
  private:
   struct Score;
 
+  // Records the cost of the current delta encoding setting and switches the
+  // setting if the other one is due to be probed or was cheaper when last
+  // probed. Returns true if the setting was switched.
+  bool MaybeSwitchDeltaEncode(const Score& score)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Microseconds spent compressing the chunk or 0 if unknown.
+  double CompressTimeUs(uint64_t chunk_key) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   // Appends a `Statistic` for every referenced chunk which isn't already part
   // of `chunks`.
   void PushChunks(absl::Span<const std::shared_ptr<CellRef>> refs)
@@ -386,8 +537,12 @@ class AutoTunedChunkerOptions : public ChunkerOptions {
   // The maximum number of CellRef to keep alive. This value is NOT tuned.
   int num_keep_alive_refs_;
 
-  // Whethr delta encoding should be used. This value is NOT tuned.
-  bool delta_encode_;
+  // Whether delta encoding is (initially) used and whether it is tuned.
+  const bool initial_delta_encode_;
+  const bool tune_delta_encode_;
+
+  // Codec used to compress chunks. This value is NOT tuned.
+  CompressionOptions compression_;
 
   // Weight to multiply the score contribution from `items_` with. A higher
   // value results in more emphasise on the amount of data sent per item (i.e
@@ -396,12 +551,29 @@ class AutoTunedChunkerOptions : public ChunkerOptions {
   // focusing on items).
   double throughput_weight_;
 
+  // Bytes one microsecond of compression time is worth.
+  double cpu_weight_;
+
   mutable absl::Mutex mu_;
 
   // Current recommendation returned by `GetMaxChunkLength`. Will always be in
   // the range [1, num_keep_alive_refs_].
   int max_chunk_length_ ABSL_GUARDED_BY(mu_);
 
+  // Current result of `GetDeltaEncode`.
+  bool delta_encode_ ABSL_GUARDED_BY(mu_);
+
+  // The most recent cost observed with delta encoding off ([0]) and on ([1]).
+  absl::optional<double> delta_encode_costs_[2] ABSL_GUARDED_BY(mu_);
+
+  // Number of scores since the delta encoding setting was last probed.
+  int scores_since_delta_encode_probe_ ABSL_GUARDED_BY(mu_) = 0;
+
+  // Set when the delta encoding setting was switched. The next score then only
+  // replaces `prev_score_` since costs of different settings aren't comparable
+  // when tuning `max_chunk_length_`.
+  bool rebase_score_ ABSL_GUARDED_BY(mu_) = false;
+
   // The most recent score which resulted in a change of `max_chunk_length_`. Is
   // initialized to {-1, -1} so an update of `max_chunk_length_` is triggered
   // regardless of what the first score is.
@@ -421,6 +593,10 @@ class AutoTunedChunkerOptions : public ChunkerOptions {
     double bytes_per_step;
     // Average length of the chunks referenced by the item (or chunk).
     double average_chunk_length;
+    // The average number of microseconds spent compressing the chunks per
+    // step. For items this approximates the cost of decompressing the chunks
+    // when the item is sampled.
+    double compress_us_per_step;
   };
 
   // Circular buffer of statistics of the `kNumItemsToScore` most recently
@@ -430,6 +606,13 @@ class AutoTunedChunkerOptions : public ChunkerOptions {
   // Circular buffer of statistics of the `kNumChunksToScore` most recently
   // observed chunks.
   std::deque<Statistic> chunks_ ABSL_GUARDED_BY(mu_);
+
+  // Compression times of the most recently compressed chunks. Items can only
+  // reference chunks with live `CellRef`s so at most `num_keep_alive_refs_`
+  // chunks are tracked, oldest first in `compress_times_order_`.
+  internal::flat_hash_map<uint64_t, absl::Duration> compress_times_
+      ABSL_GUARDED_BY(mu_);
+  std::deque<uint64_t> compress_times_order_ ABSL_GUARDED_BY(mu_);
 };
 
 }  // namespace reverb
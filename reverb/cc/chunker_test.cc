@@ -22,11 +22,16 @@
 #include "gtest/gtest.h"
 #include "absl/random/distributions.h"
 #include "absl/random/random.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/platform/thread.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/support/signature.h"
+#include "reverb/cc/support/task_executor.h"
 #include "reverb/cc/testing/proto_test_util.h"
 #include "reverb/cc/testing/tensor_testutil.h"
 #include "tensorflow/core/framework/tensor.h"
@@ -100,10 +105,13 @@ class MockChunkerOptions : public ChunkerOptions {
   MOCK_METHOD(int, GetMaxChunkLength, (), (const override));
   MOCK_METHOD(int, GetNumKeepAliveRefs, (), (const override));
   MOCK_METHOD(bool, GetDeltaEncode, (), (const override));
+  MOCK_METHOD(CompressionOptions, GetCompression, (), (const override));
   MOCK_METHOD(absl::Status, OnItemFinalized,
               (const PrioritizedItem& item,
                absl::Span<const std::shared_ptr<CellRef>> refs),
               (override));
+  MOCK_METHOD(void, OnChunkCompressed, (const ChunkStatistics& statistics),
+              (override));
   MOCK_METHOD(std::shared_ptr<ChunkerOptions>, Clone, (), (const override));
 };
 
@@ -122,6 +130,93 @@ TEST(CellRef, IsReady) {
   EXPECT_TRUE(ref.lock()->IsReady());
 }
 
+TEST(CellRef, OutlivesChunker) {
+  auto chunker = MakeChunker(kIntSpec, 2, 5);
+
+  std::vector<std::shared_ptr<CellRef>> refs;
+  for (int i = 0; i < 3; i++) {
+    std::weak_ptr<CellRef> ref;
+    auto want = MakeConstantTensor<tensorflow::DT_INT32>({1}, i);
+    REVERB_ASSERT_OK(chunker->Append(want, {1, i}, &ref));
+    refs.push_back(ref.lock());
+  }
+  REVERB_ASSERT_OK(chunker->Flush());
+
+  // The refs are allocated from a pool owned by the chunker which must stay
+  // alive until the last ref has been destroyed.
+  chunker = nullptr;
+  for (int i = 0; i < refs.size(); i++) {
+    EXPECT_TRUE(refs[i]->chunker().expired());
+    tensorflow::Tensor got;
+    REVERB_ASSERT_OK(refs[i]->GetData(&got));
+    test::ExpectTensorEqual<tensorflow::int32>(
+        got, MakeConstantTensor<tensorflow::DT_INT32>({1}, i));
+  }
+}
+
+TEST(CellRef, IsReadyOnceCompressedByExecutor) {
+  auto executor = std::make_shared<TaskExecutor>(1, "Compression");
+  auto chunker = std::make_shared<Chunker>(
+      kIntSpec, std::make_shared<ConstantChunkerOptions>(2, 5), executor);
+
+  // Block the only thread of the executor so the compression can't start.
+  absl::Notification blocked;
+  absl::Notification unblock;
+  executor->Schedule([&] {
+    blocked.Notify();
+    unblock.WaitForNotification();
+  });
+  blocked.WaitForNotification();
+
+  std::weak_ptr<CellRef> ref;
+  auto want = MakeConstantTensor<tensorflow::DT_INT32>({1}, 7);
+  REVERB_ASSERT_OK(chunker->Append(want, {1, 0}, &ref));
+  EXPECT_FALSE(ref.lock()->IsFinalized());
+
+  // The chunk is finalized but not compressed yet.
+  REVERB_ASSERT_OK(chunker->Flush());
+  EXPECT_TRUE(ref.lock()->IsFinalized());
+  EXPECT_FALSE(ref.lock()->IsReady());
+
+  unblock.Notify();
+  ref.lock()->WaitUntilReady();
+  EXPECT_TRUE(ref.lock()->IsReady());
+
+  tensorflow::Tensor got;
+  REVERB_ASSERT_OK(ref.lock()->GetData(&got));
+  test::ExpectTensorEqual<tensorflow::int32>(got, want);
+}
+
+TEST(CellRef, GetDataWaitsForCompression) {
+  auto executor = std::make_shared<TaskExecutor>(1, "Compression");
+  auto chunker = std::make_shared<Chunker>(
+      kFloatSpec,
+      std::make_shared<ConstantChunkerOptions>(2, 5, /*delta_encode=*/true),
+      executor);
+
+  absl::Notification unblock;
+  executor->Schedule([&] { unblock.WaitForNotification(); });
+
+  std::weak_ptr<CellRef> first;
+  std::weak_ptr<CellRef> second;
+  auto first_want = MakeConstantTensor<tensorflow::DT_FLOAT>({1}, 1);
+  auto second_want = MakeConstantTensor<tensorflow::DT_FLOAT>({1}, 2);
+  REVERB_ASSERT_OK(chunker->Append(first_want, {1, 0}, &first));
+  REVERB_ASSERT_OK(chunker->Append(second_want, {1, 1}, &second));
+  EXPECT_TRUE(second.lock()->IsFinalized());
+
+  auto unblock_thread = internal::StartThread("", [&] {
+    absl::SleepFor(absl::Milliseconds(10));
+    unblock.Notify();
+  });
+
+  tensorflow::Tensor got;
+  REVERB_ASSERT_OK(second.lock()->GetData(&got));
+  test::ExpectTensorEqual<float>(got, second_want);
+  REVERB_ASSERT_OK(first.lock()->GetData(&got));
+  test::ExpectTensorEqual<float>(got, first_want);
+}
+
 TEST(CellRef, GetDataFromChunkerBuffer) {
   internal::TensorSpec spec = {"0", tensorflow::DT_INT32, {3, 3}};
   auto chunker = MakeChunker(spec,
@@ -205,6 +300,54 @@ TEST(Chunker, AppendValidatesSpecShape) {
                   "Got [2] which is incompatible with [1]."));
 }
 
+TEST(Chunker, AppendRequiresSameShapeWithinChunk) {
+  auto chunker = MakeChunker(
+      internal::TensorSpec{"0", tensorflow::DT_INT32,
+                           tensorflow::PartialTensorShape({-1})},
+      /*max_chunk_length=*/2, /*num_keep_alive_refs=*/5);
+
+  std::weak_ptr<CellRef> ref;
+  REVERB_ASSERT_OK(chunker->Append(
+      MakeConstantTensor<tensorflow::DT_INT32>({2}, 1), {1, 0}, &ref));
+
+  auto status = chunker->Append(
+      MakeConstantTensor<tensorflow::DT_INT32>({3}, 1), {1, 1}, &ref);
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(std::string(status.message()),
+              ::testing::HasSubstr(
+                  "All tensors in a chunk must have the same shape."));
+
+  // The next chunk can use a different shape.
+  REVERB_ASSERT_OK(chunker->Flush());
+  REVERB_ASSERT_OK(chunker->Append(
+      MakeConstantTensor<tensorflow::DT_INT32>({3}, 1), {1, 1}, &ref));
+}
+
+TEST(Chunker, RecycledBuffersDoNotCorruptData) {
+  for (bool async : {false, true}) {
+    auto executor =
+        async ? std::make_shared<TaskExecutor>(2, "Compression") : nullptr;
+    auto chunker = std::make_shared<Chunker>(
+        kFloatSpec, std::make_shared<ConstantChunkerOptions>(3, 12), executor);
+
+    std::vector<std::shared_ptr<CellRef>> refs;
+    for (int i = 0; i < 10; i++) {
+      std::weak_ptr<CellRef> ref;
+      REVERB_ASSERT_OK(chunker->Append(
+          MakeConstantTensor<tensorflow::DT_FLOAT>({1}, i), {1, i}, &ref));
+      refs.push_back(ref.lock());
+    }
+    REVERB_ASSERT_OK(chunker->Flush());
+
+    for (int i = 0; i < refs.size(); i++) {
+      tensorflow::Tensor got;
+      REVERB_ASSERT_OK(refs[i]->GetData(&got));
+      test::ExpectTensorEqual<float>(
+          got, MakeConstantTensor<tensorflow::DT_FLOAT>({1}, i));
+    }
+  }
+}
+
 TEST(Chunker, AppendFlushesOnMaxChunkLength) {
   auto chunker = MakeChunker(kIntSpec, /*max_chunk_length=*/2,
                              /*num_keep_alive_refs=*/5);
@@ -615,6 +758,38 @@ TEST(Chunker, OnItemFinalizedIsNoopIfNoRefsCreatedByChunker) {
       {step.lock()}));
 }
 
+TEST(Chunker, OnChunkCompressedReceivesStatisticsBeforeRefsAreReady) {
+  auto options = std::make_shared<MockChunkerOptions>();
+  EXPECT_CALL(*options, GetMaxChunkLength()).WillRepeatedly(Return(2));
+  EXPECT_CALL(*options, GetNumKeepAliveRefs()).WillRepeatedly(Return(2));
+  auto chunker = std::make_shared<Chunker>(kIntSpec, options);
+
+  std::weak_ptr<CellRef> first;
+  REVERB_ASSERT_OK(
+      chunker->Append(MakeZeroTensor<tensorflow::DT_INT32>(kIntSpec),
+                      {/*episode_id=*/1, /*step=*/0}, &first));
+
+  ChunkStatistics statistics;
+  EXPECT_CALL(*options, OnChunkCompressed(_))
+      .WillOnce([&](const ChunkStatistics& s) {
+        EXPECT_FALSE(first.lock()->IsReady());
+        statistics = s;
+      });
+  std::weak_ptr<CellRef> second;
+  REVERB_ASSERT_OK(
+      chunker->Append(MakeZeroTensor<tensorflow::DT_INT32>(kIntSpec),
+                      {/*episode_id=*/1, /*step=*/1}, &second));
+  ASSERT_TRUE(second.lock()->IsReady());
+
+  const ChunkData& chunk = *second.lock()->GetChunk()->get();
+  EXPECT_EQ(statistics.chunk_key, chunk.chunk_key());
+  EXPECT_EQ(statistics.num_rows, 2);
+  EXPECT_EQ(statistics.uncompressed_bytes, 2 * sizeof(int32_t));
+  EXPECT_GT(statistics.compressed_bytes, 0);
+  EXPECT_GE(statistics.compress_time, absl::ZeroDuration());
+  EXPECT_FALSE(statistics.delta_encoded);
+}
+
 TEST(Chunker, OnItemFinalizedFiltersRefsAndForwardsToOptions) {
   auto options_a = std::make_shared<MockChunkerOptions>();
   EXPECT_CALL(*options_a, GetMaxChunkLength()).WillRepeatedly(Return(1));
@@ -686,6 +861,158 @@ TEST(Chunker, DeltaEncodeIsRespected) {
                       {/*episode_id=*/1, /*step=*/0}, &step));
   REVERB_ASSERT_OK(chunker->Flush());
   EXPECT_TRUE(step.lock()->GetChunk()->get()->delta_encoded());
+  EXPECT_TRUE(step.lock()->GetChunk()->get()->delta_encoded_floats());
+}
+
+TEST(Chunker, CompressionIsRespected) {
+  for (auto codec : {COMPRESSION_CODEC_SNAPPY, COMPRESSION_CODEC_NONE,
+                     COMPRESSION_CODEC_ZLIB}) {
+    CompressionOptions compression;
+    compression.set_codec(codec);
+    auto chunker = std::make_shared<Chunker>(
+        kIntSpec, std::make_shared<ConstantChunkerOptions>(
+                      /*max_chunk_length=*/2, /*num_keep_alive_refs=*/2,
+                      /*delta_encode=*/false, compression));
+
+    std::weak_ptr<CellRef> first;
+    auto first_want = MakeConstantTensor<tensorflow::DT_INT32>({1}, 1);
+    REVERB_ASSERT_OK(chunker->Append(first_want, {1, 0}, &first));
+    std::weak_ptr<CellRef> second;
+    auto second_want = MakeConstantTensor<tensorflow::DT_INT32>({1}, 2);
+    REVERB_ASSERT_OK(chunker->Append(second_want, {1, 1}, &second));
+
+    ASSERT_TRUE(first.lock()->IsReady());
+    EXPECT_THAT(first.lock()->GetChunk()->get()->codecs(),
+                ::testing::ElementsAre(codec));
+
+    tensorflow::Tensor first_got;
+    REVERB_ASSERT_OK(first.lock()->GetData(&first_got));
+    test::ExpectTensorEqual<tensorflow::int32>(first_got, first_want);
+    tensorflow::Tensor second_got;
+    REVERB_ASSERT_OK(second.lock()->GetData(&second_got));
+    test::ExpectTensorEqual<tensorflow::int32>(second_got, second_want);
+  }
+}
+
+TEST(Chunker, BlockLengthIsRespected) {
+  CompressionOptions compression;
+  compression.set_codec(COMPRESSION_CODEC_SNAPPY);
+  compression.set_block_length(2);
+  auto chunker = std::make_shared<Chunker>(
+      kIntSpec, std::make_shared<ConstantChunkerOptions>(
+                    /*max_chunk_length=*/5, /*num_keep_alive_refs=*/5,
+                    /*delta_encode=*/true, compression));
+
+  std::vector<std::weak_ptr<CellRef>> refs(5);
+  std::vector<tensorflow::Tensor> want;
+  for (int i = 0; i < 5; i++) {
+    want.push_back(MakeConstantTensor<tensorflow::DT_INT32>({1}, i * i));
+    REVERB_ASSERT_OK(chunker->Append(want.back(), {1, i}, &refs[i]));
+  }
+
+  ASSERT_TRUE(refs[0].lock()->IsReady());
+  const ChunkData* chunk = refs[0].lock()->GetChunk()->get();
+  EXPECT_EQ(chunk->block_length(), 2);
+  ASSERT_EQ(chunk->data().blocks_size(), 1);
+  EXPECT_EQ(chunk->data().blocks(0).tensors_size(), 3);
+
+  for (int i = 0; i < 5; i++) {
+    tensorflow::Tensor got;
+    REVERB_ASSERT_OK(refs[i].lock()->GetData(&got));
+    test::ExpectTensorEqual<tensorflow::int32>(got, want[i]);
+  }
+}
+
+TEST(Chunker, FrameStackIsRespected) {
+  CompressionOptions compression;
+  compression.mutable_frame_stack()->set_axis(0);
+  auto chunker = std::make_shared<Chunker>(
+      internal::TensorSpec{"0", tensorflow::DT_INT32, {2}},
+      std::make_shared<ConstantChunkerOptions>(
+          /*max_chunk_length=*/5, /*num_keep_alive_refs=*/5,
+          /*delta_encode=*/true, compression));
+
+  // Consecutive steps share one of their two frames.
+  std::vector<std::weak_ptr<CellRef>> refs(5);
+  std::vector<tensorflow::Tensor> want;
+  for (int i = 0; i < 5; i++) {
+    want.push_back(MakeConstantTensor<tensorflow::DT_INT32>({2}, 0));
+    want.back().flat<int32_t>()(0) = i;
+    want.back().flat<int32_t>()(1) = i + 1;
+    REVERB_ASSERT_OK(chunker->Append(want.back(), {1, i}, &refs[i]));
+  }
+
+  ASSERT_TRUE(refs[0].lock()->IsReady());
+  const ChunkData* chunk = refs[0].lock()->GetChunk()->get();
+  ASSERT_EQ(chunk->data().frame_stacks_size(), 1);
+  const auto& frames = chunk->data().frame_stacks(0).frames();
+  EXPECT_EQ(frames.tensor_shape().dim(0).size(), 6);
+
+  for (int i = 0; i < 5; i++) {
+    tensorflow::Tensor got;
+    REVERB_ASSERT_OK(refs[i].lock()->GetData(&got));
+    test::ExpectTensorEqual<tensorflow::int32>(got, want[i]);
+  }
+}
+
+TEST(Chunker, FrameStackAxisOutOfRange) {
+  CompressionOptions compression;
+  compression.mutable_frame_stack()->set_axis(1);
+  auto chunker = std::make_shared<Chunker>(
+      kIntSpec, std::make_shared<ConstantChunkerOptions>(
+                    /*max_chunk_length=*/2, /*num_keep_alive_refs=*/2,
+                    /*delta_encode=*/false, compression));
+
+  std::weak_ptr<CellRef> ref;
+  auto status = chunker->Append(
+      MakeZeroTensor<tensorflow::DT_INT32>(kIntSpec), {1, 0}, &ref);
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(std::string(status.message()),
+              ::testing::HasSubstr("Frame stack axis 1 is out of range"));
+}
+
+TEST(Chunker, QuantizationIsRespected) {
+  CompressionOptions compression;
+  compression.set_quantization(QUANTIZATION_FLOAT16);
+  auto chunker = std::make_shared<Chunker>(
+      kFloatSpec, std::make_shared<ConstantChunkerOptions>(
+                      /*max_chunk_length=*/2, /*num_keep_alive_refs=*/2,
+                      /*delta_encode=*/true, compression));
+
+  std::vector<std::weak_ptr<CellRef>> refs(2);
+  std::vector<tensorflow::Tensor> want;
+  for (int i = 0; i < 2; i++) {
+    // Values which are exactly representable as float16.
+    want.push_back(MakeConstantTensor<tensorflow::DT_FLOAT>({1}, 0.5 + i));
+    REVERB_ASSERT_OK(chunker->Append(want.back(), {1, i}, &refs[i]));
+  }
+
+  ASSERT_TRUE(refs[0].lock()->IsReady());
+  const ChunkData* chunk = refs[0].lock()->GetChunk()->get();
+  ASSERT_EQ(chunk->quantized_columns_size(), 1);
+  EXPECT_EQ(chunk->data().tensors(0).dtype(), tensorflow::DT_HALF);
+
+  for (int i = 0; i < 2; i++) {
+    tensorflow::Tensor got;
+    REVERB_ASSERT_OK(refs[i].lock()->GetData(&got));
+    test::ExpectTensorEqual<float>(got, want[i]);
+  }
+}
+
+TEST(Chunker, QuantizationOfNonFloatColumn) {
+  CompressionOptions compression;
+  compression.set_quantization(QUANTIZATION_BFLOAT16);
+  auto chunker = std::make_shared<Chunker>(
+      kIntSpec, std::make_shared<ConstantChunkerOptions>(
+                    /*max_chunk_length=*/2, /*num_keep_alive_refs=*/2,
+                    /*delta_encode=*/false, compression));
+
+  std::weak_ptr<CellRef> ref;
+  auto status = chunker->Append(
+      MakeZeroTensor<tensorflow::DT_INT32>(kIntSpec), {1, 0}, &ref);
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(std::string(status.message()),
+              ::testing::HasSubstr("only float32 columns can be quantized"));
 }
 
 TEST(ValidateChunkerOptions, Valid) {
@@ -745,6 +1072,83 @@ TEST(ValidateChunkerOptions, NumKeepAliveLtMaxChunkLength) {
                   "num_keep_alive_refs (5) must be >= max_chunk_length (6)."));
 }
 
+TEST(ValidateChunkerOptions, ZlibLevelOutOfRange) {
+  CompressionOptions compression;
+  compression.set_codec(COMPRESSION_CODEC_ZLIB);
+  compression.set_level(10);
+  auto options = absl::make_unique<ConstantChunkerOptions>(
+      /*max_chunk_length=*/2, /*num_keep_alive_refs=*/2,
+      /*delta_encode=*/false, compression);
+  auto status = ValidateChunkerOptions(options.get());
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(std::string(status.message()),
+              ::testing::HasSubstr("must be in [0, 9] but got 10."));
+}
+
+TEST(ValidateChunkerOptions, LevelNotSupportedBySnappy) {
+  CompressionOptions compression;
+  compression.set_codec(COMPRESSION_CODEC_SNAPPY);
+  compression.set_level(3);
+  auto options = absl::make_unique<ConstantChunkerOptions>(
+      /*max_chunk_length=*/2, /*num_keep_alive_refs=*/2,
+      /*delta_encode=*/false, compression);
+  auto status = ValidateChunkerOptions(options.get());
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(
+      std::string(status.message()),
+      ::testing::HasSubstr("Compression level is not supported by "
+                           "COMPRESSION_CODEC_SNAPPY but got 3."));
+}
+
+TEST(ValidateChunkerOptions, NegativeBlockLength) {
+  CompressionOptions compression;
+  compression.set_block_length(-1);
+  auto options = absl::make_unique<ConstantChunkerOptions>(
+      /*max_chunk_length=*/2, /*num_keep_alive_refs=*/2,
+      /*delta_encode=*/false, compression);
+  auto status = ValidateChunkerOptions(options.get());
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(std::string(status.message()),
+              ::testing::HasSubstr("block_length must be >= 0 but got -1."));
+}
+
+TEST(ValidateChunkerOptions, NegativeFrameStackAxis) {
+  CompressionOptions compression;
+  compression.mutable_frame_stack()->set_axis(-1);
+  auto options = absl::make_unique<ConstantChunkerOptions>(
+      /*max_chunk_length=*/2, /*num_keep_alive_refs=*/2,
+      /*delta_encode=*/false, compression);
+  auto status = ValidateChunkerOptions(options.get());
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(std::string(status.message()),
+              ::testing::HasSubstr("Frame stack axis must be >= 0"));
+}
+
+TEST(ValidateChunkerOptions, FrameStackWithBlocks) {
+  CompressionOptions compression;
+  compression.mutable_frame_stack()->set_axis(0);
+  compression.set_block_length(2);
+  auto options = absl::make_unique<ConstantChunkerOptions>(
+      /*max_chunk_length=*/2, /*num_keep_alive_refs=*/2,
+      /*delta_encode=*/false, compression);
+  auto status = ValidateChunkerOptions(options.get());
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(std::string(status.message()),
+              ::testing::HasSubstr("Frame stacks can't be compressed in"));
+}
+
+TEST(ValidateChunkerOptions, UnsupportedQuantization) {
+  CompressionOptions compression;
+  compression.set_quantization(static_cast<Quantization>(100));
+  auto options = absl::make_unique<ConstantChunkerOptions>(
+      /*max_chunk_length=*/2, /*num_keep_alive_refs=*/2,
+      /*delta_encode=*/false, compression);
+  auto status = ValidateChunkerOptions(options.get());
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(std::string(status.message()),
+              ::testing::HasSubstr("Unsupported quantization: 100."));
+}
+
 TEST(AutoTunedChunkerOptions, SingleStepItemsAndRandomData) {
   auto options = std::make_shared<AutoTunedChunkerOptions>(10);
   auto chunker = std::make_shared<Chunker>(kLargeFloatSpec, options);
@@ -835,6 +1239,48 @@ TEST(AutoTunedChunkerOptions, ConstantNonOverlappingItems) {
   EXPECT_EQ(options->GetMaxChunkLength(), 10);
 }
 
+TEST(AutoTunedChunkerOptions, TunesDeltaEncode) {
+  auto options = std::make_shared<AutoTunedChunkerOptions>(
+      /*num_keep_alive_refs=*/10, /*throughput_weight=*/1.0,
+      /*delta_encode=*/false, CompressionOptions(), /*cpu_weight=*/0.0,
+      /*tune_delta_encode=*/true);
+  auto chunker = std::make_shared<Chunker>(kLargeFloatSpec, options);
+
+  tensorflow::TensorShape shape;
+  ASSERT_TRUE(kLargeFloatSpec.shape.AsTensorShape(&shape));
+
+  // Both settings are probed so chunks are created with and without delta
+  // encoding.
+  bool saw_delta_encoded = false;
+  bool saw_not_delta_encoded = false;
+  for (int i = 0; i < 1000; i++) {
+    std::weak_ptr<CellRef> ref;
+    REVERB_EXPECT_OK(
+        chunker->Append(MakeRandomTensor<tensorflow::DT_FLOAT>(shape, 0, 1),
+                        {/*episode_id=*/1, /*step=*/i}, &ref));
+    if (ref.lock()->IsReady()) {
+      bool delta_encoded = ref.lock()->GetChunk()->get()->delta_encoded();
+      saw_delta_encoded |= delta_encoded;
+      saw_not_delta_encoded |= !delta_encoded;
+      REVERB_EXPECT_OK(
+          chunker->OnItemFinalized(PrioritizedItem(), {ref.lock()}));
+    }
+  }
+
+  EXPECT_TRUE(saw_delta_encoded);
+  EXPECT_TRUE(saw_not_delta_encoded);
+}
+
+TEST(AutoTunedChunkerOptions, CloneKeepsTuningSettings) {
+  AutoTunedChunkerOptions options(
+      /*num_keep_alive_refs=*/10, /*throughput_weight=*/1.0,
+      /*delta_encode=*/true, CompressionOptions(), /*cpu_weight=*/2.0,
+      /*tune_delta_encode=*/true);
+  auto clone = options.Clone();
+  EXPECT_EQ(clone->GetNumKeepAliveRefs(), 10);
+  EXPECT_TRUE(clone->GetDeltaEncode());
+}
+
 }  // namespace
 }  // namespace reverb
 }  // namespace deepmind
@@ -15,17 +15,23 @@
 #include "reverb/cc/client.h"
 
 #include <algorithm>
+#include <deque>
+#include <functional>
 #include <memory>
 
 #include "grpcpp/support/channel_arguments.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
 #include "absl/time/time.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
 #include "reverb/cc/platform/grpc_utils.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/platform/thread.h"
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/streaming_trajectory_writer.h"
@@ -37,26 +43,322 @@ namespace deepmind {
 namespace reverb {
 namespace {
 
-grpc::ChannelArguments CreateChannelArguments() {
+grpc::ChannelArguments CreateChannelArguments(
+    const GrpcTransportOptions& transport_options, int channel_index) {
   grpc::ChannelArguments arguments;
   arguments.SetMaxReceiveMessageSize(-1);  // Unlimited.
   arguments.SetMaxSendMessageSize(-1);     // Unlimited.
   arguments.SetInt(GRPC_ARG_MAX_RECONNECT_BACKOFF_MS, 30 * 1000);
   arguments.SetLoadBalancingPolicyName("round_robin");
+  transport_options.ApplyTo(&arguments);
+  if (transport_options.num_channels > 1) {
+    // Channels with identical arguments share their subchannels (and thus
+    // their TCP connections) so every channel of the pool must be distinct.
+    arguments.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+    arguments.SetInt("reverb.channel_index", channel_index);
+  }
   return arguments;
 }
 
+std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+MakeChannelPool(absl::string_view server_address,
+                const GrpcTransportOptions& transport_options) {
+  REVERB_CHECK_OK(transport_options.Validate());
+  std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      stubs;
+  stubs.reserve(transport_options.num_channels);
+  for (int i = 0; i < transport_options.num_channels; ++i) {
+    auto channel =
+        CreateCustomGrpcChannel(server_address, MakeChannelCredentials(),
+                                CreateChannelArguments(transport_options, i));
+    stubs.push_back(/* grpc_gen:: */ReverbService::NewStub(std::move(channel)));
+  }
+  return stubs;
+}
+
+MutatePrioritiesRequest MakeMutatePrioritiesRequest(
+    absl::string_view table, const std::vector<KeyWithPriority>& updates,
+    const std::vector<uint64_t>& deletes) {
+  MutatePrioritiesRequest request;
+  request.set_table(table.data(), table.size());
+  for (const KeyWithPriority& item : updates) {
+    *request.add_updates() = item;
+  }
+  for (int64_t key : deletes) {
+    request.add_delete_keys(key);
+  }
+  return request;
+}
+
+// Calls `MutatePriorities` through `stub`.
+absl::Status CallMutatePriorities(
+    /* grpc_gen:: */ReverbService::StubInterface* stub,
+    absl::string_view table, const std::vector<KeyWithPriority>& updates,
+    const std::vector<uint64_t>& deletes, absl::Duration timeout) {
+  grpc::ClientContext context;
+  context.set_wait_for_ready(true);
+  context.set_deadline(absl::ToChronoTime(absl::Now() + timeout));
+  MutatePrioritiesRequest request =
+      MakeMutatePrioritiesRequest(table, updates, deletes);
+  MutatePrioritiesResponse response;
+  return FromGrpcStatus(stub->MutatePriorities(&context, request, &response));
+}
+
+// Calls `ServerInfo`. If the request specifies `known_tables_state_id` then
+// the server may leave out the static fields of the tables.
+absl::Status CallServerInfo(
+    /* grpc_gen:: */ReverbService::StubInterface* stub, absl::Duration timeout,
+    absl::optional<absl::uint128> known_tables_state_id,
+    ServerInfoResponse* response) {
+  grpc::ClientContext context;
+  context.set_wait_for_ready(true);
+  if (timeout != absl::InfiniteDuration()) {
+    context.set_deadline(std::chrono::system_clock::now() +
+                         absl::ToChronoSeconds(timeout));
+  }
+
+  ServerInfoRequest request;
+  if (known_tables_state_id.has_value()) {
+    *request.mutable_known_tables_state_id() =
+        Uint128ToMessage(*known_tables_state_id);
+  }
+  return FromGrpcStatus(stub->ServerInfo(&context, request, response));
+}
+
+// Copies the fields of `info` which only change along with the tables state id
+// (see `ServerInfoResponse.static_fields_omitted`).
+TableInfo StaticFieldsOf(const TableInfo& info) {
+  TableInfo static_info;
+  static_info.set_name(info.name());
+  *static_info.mutable_sampler_options() = info.sampler_options();
+  *static_info.mutable_remover_options() = info.remover_options();
+  static_info.set_max_size(info.max_size());
+  static_info.set_max_times_sampled(info.max_times_sampled());
+  if (info.has_signature()) {
+    *static_info.mutable_signature() = info.signature();
+  }
+  return static_info;
+}
+
+// State of a unary call made with the callback API of gRPC. Must outlive the
+// call so it is deleted by the callback which completes it.
+template <typename Request, typename Response>
+struct AsyncUnaryCall {
+  explicit AsyncUnaryCall(absl::Duration timeout) {
+    context.set_wait_for_ready(true);
+    if (timeout != absl::InfiniteDuration()) {
+      context.set_deadline(absl::ToChronoTime(absl::Now() + timeout));
+    }
+  }
+
+  grpc::ClientContext context;
+  Request request;
+  Response response;
+};
+
+// Requests direct access to the table `table_name` (unless empty) and, if
+// `chunk_store` is not null, to the chunk store of the server behind `stub`.
+// Only succeeds if the server is running in the same process.
+absl::Status GetLocalServerObjects(
+    /* grpc_gen:: */ReverbService::StubInterface* stub,
+    absl::string_view table_name, std::shared_ptr<Table>* table,
+    std::shared_ptr<ChunkStore>* chunk_store) {
+  grpc::ClientContext context;
+  context.set_wait_for_ready(false);
+  auto stream = stub->InitializeConnection(&context);
+
+  InitializeConnectionRequest request;
+  request.set_pid(getpid());
+  request.set_table_name(table_name.data(), table_name.size());
+  request.set_include_chunk_store(chunk_store != nullptr);
+  if (!stream->Write(request)) {
+    REVERB_RETURN_IF_ERROR(FromGrpcStatus(stream->Finish()));
+    return absl::InternalError(
+        "InitializeConnection: Failed to write to stream.");
+  }
+
+  InitializeConnectionResponse response;
+  if (!stream->Read(&response)) {
+    REVERB_RETURN_IF_ERROR(FromGrpcStatus(stream->Finish()));
+    return absl::InternalError(
+        "InitializeConnection: Failed to read from stream.");
+  }
+
+  if ((table != nullptr && response.address() == 0) ||
+      (chunk_store != nullptr && response.chunk_store_address() == 0)) {
+    return absl::FailedPreconditionError(
+        "Client and server are not running in the same process.");
+  }
+
+  if (table != nullptr) {
+    *table = *reinterpret_cast<std::shared_ptr<Table>*>(response.address());
+  }
+  if (chunk_store != nullptr) {
+    *chunk_store = *reinterpret_cast<std::shared_ptr<ChunkStore>*>(
+        response.chunk_store_address());
+  }
+  request.set_ownership_transferred(true);
+  stream->Write(request);
+
+  return FromGrpcStatus(stream->Finish());
+}
+
+// Number of `SampleInfo` fields which precede the columns of the trajectory in
+// the dtypes and shapes of a sampler.
+constexpr int kNumInfoTensors = 4;
+
+// Only keeps the dtypes and shapes of `columns` (and of the info fields) if
+// `columns` is not empty, see `Sampler::Options::columns`.
+absl::Status SelectColumns(absl::Span<const int> columns,
+                           internal::DtypesAndShapes* dtypes_and_shapes) {
+  if (columns.empty() || !dtypes_and_shapes->has_value()) {
+    return absl::OkStatus();
+  }
+  const std::vector<internal::TensorSpec>& all = **dtypes_and_shapes;
+  std::vector<internal::TensorSpec> selected(all.begin(),
+                                             all.begin() + kNumInfoTensors);
+  for (int column : columns) {
+    if (column < 0 || kNumInfoTensors + column >= all.size()) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Column ", column, " is out of range for table signature with ",
+          all.size() - kNumInfoTensors, " columns: ",
+          internal::DtypesShapesString(all)));
+    }
+    selected.push_back(all[kNumInfoTensors + column]);
+  }
+  dtypes_and_shapes->emplace(std::move(selected));
+  return absl::OkStatus();
+}
+
 }  // namespace
 
+// Writes requests to a `MutatePrioritiesStream` from any number of threads
+// and matches the (in order) responses to the calls waiting for them.
+class Client::PriorityUpdateStream {
+ public:
+  explicit PriorityUpdateStream(
+      /* grpc_gen:: */ReverbService::StubInterface* stub) {
+    context_.set_wait_for_ready(true);
+    stream_ = stub->MutatePrioritiesStream(&context_);
+    reader_ = internal::StartThread("PriorityUpdateStreamReader",
+                                    [this] { ReadResponses(); });
+  }
+
+  ~PriorityUpdateStream() {
+    context_.TryCancel();
+    reader_ = nullptr;  // Joins the thread.
+  }
+
+  // Sends `request` and blocks until it has been applied or the stream failed.
+  absl::Status Mutate(const MutatePrioritiesRequest& request)
+      ABSL_LOCKS_EXCLUDED(write_mu_, mu_) {
+    auto call = std::make_shared<PendingCall>();
+    {
+      // Requests must be written in the same order as they are added to
+      // `pending_calls_`.
+      absl::MutexLock write_lock(&write_mu_);
+      {
+        absl::MutexLock lock(&mu_);
+        REVERB_RETURN_IF_ERROR(status_);
+        pending_calls_.push_back(call);
+      }
+      // If the write fails then the stream is broken and `ReadResponses` fails
+      // all pending calls.
+      stream_->Write(request);
+    }
+    call->done.WaitForNotification();
+    return call->status;
+  }
+
+  // Returns false once the stream has failed.
+  bool ok() const ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    return status_.ok();
+  }
+
+ private:
+  struct PendingCall {
+    absl::Notification done;
+    absl::Status status;
+  };
+
+  void ReadResponses() {
+    MutatePrioritiesResponse response;
+    while (stream_->Read(&response)) {
+      std::shared_ptr<PendingCall> call;
+      {
+        absl::MutexLock lock(&mu_);
+        REVERB_CHECK(!pending_calls_.empty());
+        call = std::move(pending_calls_.front());
+        pending_calls_.pop_front();
+      }
+      call->done.Notify();
+    }
+    absl::Status status = FromGrpcStatus(stream_->Finish());
+    if (status.ok()) {
+      status = absl::UnavailableError("MutatePrioritiesStream was closed.");
+    }
+    absl::MutexLock lock(&mu_);
+    status_ = status;
+    for (auto& call : pending_calls_) {
+      call->status = status;
+      call->done.Notify();
+    }
+    pending_calls_.clear();
+  }
+
+  grpc::ClientContext context_;
+  std::unique_ptr<grpc::ClientReaderWriterInterface<MutatePrioritiesRequest,
+                                                    MutatePrioritiesResponse>>
+      stream_;
+
+  // Serializes writes to `stream_`.
+  absl::Mutex write_mu_ ABSL_ACQUIRED_BEFORE(mu_);
+
+  mutable absl::Mutex mu_;
+  // Calls waiting for a response, in the order their requests were written.
+  std::deque<std::shared_ptr<PendingCall>> pending_calls_ ABSL_GUARDED_BY(mu_);
+  // Set once the stream has failed.
+  absl::Status status_ ABSL_GUARDED_BY(mu_);
+
+  std::unique_ptr<internal::Thread> reader_;
+};
+
 Client::Client(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub)
-    : stub_(std::move(stub)) {
+    : stream_stubs_({std::move(stub)}), stub_(stream_stubs_.front()) {
   REVERB_CHECK(stub_ != nullptr);
 }
 
 Client::Client(absl::string_view server_address)
-    : stub_(/* grpc_gen:: */ReverbService::NewStub(
-          CreateCustomGrpcChannel(server_address, MakeChannelCredentials(),
-                                  CreateChannelArguments()))) {}
+    : Client(server_address, GrpcTransportOptions()) {}
+
+Client::Client(absl::string_view server_address,
+               const GrpcTransportOptions& transport_options)
+    : stream_stubs_(MakeChannelPool(server_address, transport_options)),
+      stub_(stream_stubs_.front()),
+      transport_options_(transport_options) {}
+
+std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>
+Client::NextStreamStub() {
+  return stream_stubs_[next_stream_stub_.fetch_add(1) % stream_stubs_.size()];
+}
+
+Client::~Client() {
+  absl::MutexLock lock(&async_calls_mu_);
+  async_calls_mu_.Await(absl::Condition(
+      +[](int* num_async_calls) { return *num_async_calls == 0; },
+      &num_async_calls_));
+}
+
+void Client::StartAsyncCall() {
+  absl::MutexLock lock(&async_calls_mu_);
+  ++num_async_calls_;
+}
+
+void Client::FinishAsyncCall() {
+  absl::MutexLock lock(&async_calls_mu_);
+  --num_async_calls_;
+}
 
 absl::Status Client::MaybeUpdateServerInfoCache(
     absl::Duration timeout,
@@ -137,21 +439,37 @@ absl::Status Client::NewWriter(int chunk_length, int max_timesteps,
 absl::Status Client::MutatePriorities(
     absl::string_view table, const std::vector<KeyWithPriority>& updates,
     const std::vector<uint64_t>& deletes, absl::Duration timeout) {
+  return CallMutatePriorities(stub_.get(), table, updates, deletes, timeout);
+}
+
+absl::Status Client::DeleteEpisodes(absl::string_view table,
+                                    const std::vector<uint64_t>& episode_ids,
+                                    absl::Duration timeout) {
   grpc::ClientContext context;
   context.set_wait_for_ready(true);
   context.set_deadline(absl::ToChronoTime(absl::Now() + timeout));
   MutatePrioritiesRequest request;
   request.set_table(table.data(), table.size());
-  for (const KeyWithPriority& item : updates) {
-    *request.add_updates() = item;
-  }
-  for (int64_t key : deletes) {
-    request.add_delete_keys(key);
-  }
+  *request.mutable_delete_episode_ids() = {episode_ids.begin(),
+                                           episode_ids.end()};
   MutatePrioritiesResponse response;
   return FromGrpcStatus(stub_->MutatePriorities(&context, request, &response));
 }
 
+absl::Status Client::StreamMutatePriorities(
+    absl::string_view table, const std::vector<KeyWithPriority>& updates,
+    const std::vector<uint64_t>& deletes) {
+  std::shared_ptr<PriorityUpdateStream> stream;
+  {
+    absl::MutexLock lock(&priority_stream_mu_);
+    if (priority_stream_ == nullptr || !priority_stream_->ok()) {
+      priority_stream_ = std::make_shared<PriorityUpdateStream>(stub_.get());
+    }
+    stream = priority_stream_;
+  }
+  return stream->Mutate(MakeMutatePrioritiesRequest(table, updates, deletes));
+}
+
 absl::Status Client::NewSampler(
     const std::string& table, const Sampler::Options& options,
     internal::DtypesAndShapes dtypes_and_shapes,
@@ -165,6 +483,16 @@ absl::Status Client::NewSampler(
         << ") so Table " << table << " is accessed directly without gRPC.";
     *sampler = absl::make_unique<Sampler>(std::move(table_ptr), options,
                                           std::move(dtypes_and_shapes));
+  } else if (stream_stubs_.size() > 1) {
+    // Every worker opens its streams through the next channel of the pool.
+    std::vector<
+        std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+        worker_stubs(Sampler::NumGrpcWorkers(options));
+    for (auto& stub : worker_stubs) {
+      stub = NextStreamStub();
+    }
+    *sampler = absl::make_unique<Sampler>(worker_stubs, table, options,
+                                          std::move(dtypes_and_shapes));
   } else {
     *sampler = absl::make_unique<Sampler>(stub_, table, options,
                                           std::move(dtypes_and_shapes));
@@ -189,6 +517,7 @@ absl::Status Client::NewSampler(const std::string& table,
            "sampler will be constructed without validating the dtypes "
            "and shapes.";
   }
+  REVERB_RETURN_IF_ERROR(SelectColumns(options.columns, &dtypes_and_shapes));
 
   return NewSampler(table, options, std::move(dtypes_and_shapes), sampler);
 }
@@ -260,6 +589,7 @@ absl::Status Client::NewSampler(
   internal::DtypesAndShapes dtypes_and_shapes;
   REVERB_RETURN_IF_ERROR(GetDtypesAndShapesForSampler(table, validation_timeout,
                                                &dtypes_and_shapes));
+  REVERB_RETURN_IF_ERROR(SelectColumns(options.columns, &dtypes_and_shapes));
   // Only perform check if the table had a signature associated with it.
   if (dtypes_and_shapes) {
     if (dtypes_and_shapes->size() != validation_shapes.size()) {
@@ -310,17 +640,23 @@ absl::Status Client::NewSamplerWithoutSignatureCheck(
 
 absl::Status Client::GetServerInfo(absl::Duration timeout,
                                    struct ServerInfo* info) {
-  grpc::ClientContext context;
-  context.set_wait_for_ready(true);
-  if (timeout != absl::InfiniteDuration()) {
-    context.set_deadline(std::chrono::system_clock::now() +
-                         absl::ToChronoSeconds(timeout));
+  // Only the dynamic fields are needed if the static ones are already cached.
+  absl::optional<absl::uint128> known_tables_state_id;
+  {
+    absl::ReaderMutexLock lock(&cached_table_mu_);
+    if (cached_flat_signatures_) known_tables_state_id = tables_state_id_;
   }
 
-  ServerInfoRequest request;
   ServerInfoResponse response;
   REVERB_RETURN_IF_ERROR(
-      FromGrpcStatus(stub_->ServerInfo(&context, request, &response)));
+      CallServerInfo(stub_.get(), timeout, known_tables_state_id, &response));
+  if (response.static_fields_omitted() &&
+      !AddCachedStaticTableInfo(*known_tables_state_id, &response)) {
+    // The cache was updated while the request was in flight.
+    response.Clear();
+    REVERB_RETURN_IF_ERROR(
+        CallServerInfo(stub_.get(), timeout, absl::nullopt, &response));
+  }
   info->tables_state_id = MessageToUint128(response.tables_state_id());
   for (class TableInfo& table : *response.mutable_table_info()) {
     info->table_info.emplace_back(std::move(table));
@@ -328,6 +664,21 @@ absl::Status Client::GetServerInfo(absl::Duration timeout,
   return absl::OkStatus();
 }
 
+bool Client::AddCachedStaticTableInfo(absl::uint128 tables_state_id,
+                                      ServerInfoResponse* response) {
+  absl::ReaderMutexLock lock(&cached_table_mu_);
+  if (tables_state_id_ != tables_state_id) return false;
+  for (class TableInfo& table_info : *response->mutable_table_info()) {
+    auto it = cached_static_table_info_.find(table_info.name());
+    if (it == cached_static_table_info_.end()) return false;
+    class TableInfo full_info = it->second;
+    full_info.MergeFrom(table_info);
+    table_info = std::move(full_info);
+  }
+  response->set_static_fields_omitted(false);
+  return true;
+}
+
 absl::Status Client::ServerInfo(struct ServerInfo* info) {
   return ServerInfo(absl::InfiniteDuration(), info);
 }
@@ -354,11 +705,39 @@ absl::Status Client::LockedUpdateServerInfoCache(
     }
     cached_flat_signatures_.reset(
         new internal::FlatSignatureMap(std::move(signatures)));
+    cached_static_table_info_.clear();
+    for (const auto& table_info : info.table_info) {
+      cached_static_table_info_[table_info.name()] =
+          StaticFieldsOf(table_info);
+    }
     tables_state_id_ = info.tables_state_id;
   }
   return absl::OkStatus();
 }
 
+absl::Status Client::TransformPriorities(
+    const std::string& table, double priority_scale,
+    absl::optional<double> priority_exponent) {
+  if (!(priority_scale > 0)) {
+    // A scale of zero would be ignored by the server.
+    return absl::InvalidArgumentError(absl::StrCat(
+        "priority_scale must be positive but got ", priority_scale, "."));
+  }
+  grpc::ClientContext context;
+  context.set_wait_for_ready(true);
+  TransformPrioritiesRequest request;
+  request.set_table(table);
+  if (priority_scale != 1) {
+    request.set_priority_scale(priority_scale);
+  }
+  if (priority_exponent.has_value()) {
+    request.mutable_priority_exponent()->set_value(*priority_exponent);
+  }
+  TransformPrioritiesResponse response;
+  return FromGrpcStatus(
+      stub_->TransformPriorities(&context, request, &response));
+}
+
 absl::Status Client::Reset(const std::string& table) {
   grpc::ClientContext context;
   context.set_wait_for_ready(true);
@@ -368,6 +747,94 @@ absl::Status Client::Reset(const std::string& table) {
   return FromGrpcStatus(stub_->Reset(&context, request, &response));
 }
 
+void Client::AsyncMutatePriorities(
+    absl::string_view table, const std::vector<KeyWithPriority>& updates,
+    const std::vector<uint64_t>& deletes, absl::Duration timeout,
+    std::function<void(absl::Status)> done) {
+  using Call =
+      AsyncUnaryCall<MutatePrioritiesRequest, MutatePrioritiesResponse>;
+  auto* call = new Call(timeout);
+  call->request = MakeMutatePrioritiesRequest(table, updates, deletes);
+  StartAsyncCall();
+  stub_->async()->MutatePriorities(
+      &call->context, &call->request, &call->response,
+      [this, call, done = std::move(done)](grpc::Status status) {
+        std::unique_ptr<Call> owned_call(call);
+        done(FromGrpcStatus(status));
+        // The client may be destroyed as soon as the call is finished.
+        FinishAsyncCall();
+      });
+}
+
+void Client::AsyncReset(const std::string& table,
+                        std::function<void(absl::Status)> done) {
+  using Call = AsyncUnaryCall<ResetRequest, ResetResponse>;
+  auto* call = new Call(absl::InfiniteDuration());
+  call->request.set_table(table);
+  StartAsyncCall();
+  stub_->async()->Reset(
+      &call->context, &call->request, &call->response,
+      [this, call, done = std::move(done)](grpc::Status status) {
+        std::unique_ptr<Call> owned_call(call);
+        done(FromGrpcStatus(status));
+        FinishAsyncCall();
+      });
+}
+
+void Client::AsyncServerInfo(
+    absl::Duration timeout,
+    std::function<void(absl::Status, struct ServerInfo)> done) {
+  using Call = AsyncUnaryCall<ServerInfoRequest, ServerInfoResponse>;
+  auto* call = new Call(timeout);
+  StartAsyncCall();
+  stub_->async()->ServerInfo(
+      &call->context, &call->request, &call->response,
+      [this, call, done = std::move(done)](grpc::Status grpc_status) {
+        std::unique_ptr<Call> owned_call(call);
+        struct ServerInfo info;
+        absl::Status status = FromGrpcStatus(grpc_status);
+        if (status.ok()) {
+          info.tables_state_id =
+              MessageToUint128(call->response.tables_state_id());
+          for (class TableInfo& table :
+               *call->response.mutable_table_info()) {
+            info.table_info.emplace_back(std::move(table));
+          }
+          absl::MutexLock lock(&cached_table_mu_);
+          status = LockedUpdateServerInfoCache(info);
+        }
+        done(std::move(status), std::move(info));
+        FinishAsyncCall();
+      });
+}
+
+absl::Status Client::LockProfile(LockProfileRequest::Mode mode, bool reset,
+                                 LockContentionProfile* profile) {
+  grpc::ClientContext context;
+  context.set_wait_for_ready(true);
+  LockProfileRequest request;
+  request.set_mode(mode);
+  request.set_reset(reset);
+  LockProfileResponse response;
+  REVERB_RETURN_IF_ERROR(
+      FromGrpcStatus(stub_->LockProfile(&context, request, &response)));
+  *profile = std::move(*response.mutable_profile());
+  return absl::OkStatus();
+}
+
+absl::Status Client::DumpServerTrace(bool clear,
+                                     std::string* chrome_trace_json) {
+  grpc::ClientContext context;
+  context.set_wait_for_ready(true);
+  DumpTraceRequest request;
+  request.set_clear(clear);
+  DumpTraceResponse response;
+  REVERB_RETURN_IF_ERROR(
+      FromGrpcStatus(stub_->DumpTrace(&context, request, &response)));
+  *chrome_trace_json = std::move(*response.mutable_chrome_trace_json());
+  return absl::OkStatus();
+}
+
 absl::Status Client::Checkpoint(std::string* path) {
   grpc::ClientContext context;
   context.set_fail_fast(true);
@@ -379,38 +846,31 @@ absl::Status Client::Checkpoint(std::string* path) {
   return absl::OkStatus();
 }
 
-absl::Status Client::GetLocalTablePtr(absl::string_view table_name,
-                                      std::shared_ptr<Table>* out) {
+absl::Status Client::StartCheckpoint(uint64_t* checkpoint_id) {
   grpc::ClientContext context;
-  context.set_wait_for_ready(false);
-  auto stream = stub_->InitializeConnection(&context);
-
-  InitializeConnectionRequest request;
-  request.set_pid(getpid());
-  request.set_table_name(table_name.data(), table_name.size());
-  if (!stream->Write(request)) {
-    REVERB_RETURN_IF_ERROR(FromGrpcStatus(stream->Finish()));
-    return absl::InternalError(
-        "InitializeConnection: Failed to write to stream.");
-  }
-
-  InitializeConnectionResponse response;
-  if (!stream->Read(&response)) {
-    REVERB_RETURN_IF_ERROR(FromGrpcStatus(stream->Finish()));
-    return absl::InternalError(
-        "InitializeConnection: Failed to read from stream.");
-  }
-
-  if (response.address() == 0) {
-    return absl::FailedPreconditionError(
-        "Client and server are not running in the same process.");
-  }
+  context.set_fail_fast(true);
+  CheckpointRequest request;
+  request.set_async(true);
+  CheckpointResponse response;
+  REVERB_RETURN_IF_ERROR(
+      FromGrpcStatus(stub_->Checkpoint(&context, request, &response)));
+  *checkpoint_id = response.checkpoint_id();
+  return absl::OkStatus();
+}
 
-  *out = *reinterpret_cast<std::shared_ptr<Table>*>(response.address());
-  request.set_ownership_transferred(true);
-  stream->Write(request);
+absl::Status Client::GetCheckpointStatus(uint64_t checkpoint_id,
+                                         CheckpointStatusResponse* status) {
+  grpc::ClientContext context;
+  context.set_fail_fast(true);
+  CheckpointStatusRequest request;
+  request.set_checkpoint_id(checkpoint_id);
+  return FromGrpcStatus(stub_->CheckpointStatus(&context, request, status));
+}
 
-  return FromGrpcStatus(stream->Finish());
+absl::Status Client::GetLocalTablePtr(absl::string_view table_name,
+                                      std::shared_ptr<Table>* out) {
+  return GetLocalServerObjects(stub_.get(), table_name, out,
+                               /*chunk_store=*/nullptr);
 }
 
 absl::Status Client::NewTrajectoryWriter(
@@ -430,7 +890,25 @@ absl::Status Client::NewTrajectoryWriter(
     const TrajectoryWriter::Options& options,
     std::unique_ptr<TrajectoryWriter>* writer) {
   REVERB_RETURN_IF_ERROR(options.Validate());
-  *writer = absl::make_unique<TrajectoryWriter>(stub_, options);
+
+  TrajectoryWriter::LocalServer server;
+  if (GetLocalServerObjects(stub_.get(), /*table_name=*/"", /*table=*/nullptr,
+                            &server.chunk_store)
+          .ok()) {
+    REVERB_LOG_EVERY_POW_2(REVERB_INFO)
+        << "TrajectoryWriter and server are owned by the same process ("
+        << getpid() << ") so items are inserted directly without gRPC.";
+    server.get_table = [stub = stub_](absl::string_view name,
+                                      std::shared_ptr<Table>* table) {
+      return GetLocalServerObjects(stub.get(), name, table,
+                                   /*chunk_store=*/nullptr);
+    };
+    *writer = absl::make_unique<TrajectoryWriter>(std::move(server), options);
+    return absl::OkStatus();
+  }
+
+  *writer = absl::make_unique<TrajectoryWriter>(
+      NextStreamStub(), WithTransportOptions(options));
   return absl::OkStatus();
 }
 
@@ -438,9 +916,44 @@ absl::Status Client::NewStreamingTrajectoryWriter(
     const TrajectoryWriter::Options& options,
     std::unique_ptr<StreamingTrajectoryWriter>* writer) {
   REVERB_RETURN_IF_ERROR(options.Validate());
-  *writer = absl::make_unique<StreamingTrajectoryWriter>(stub_, options);
+  *writer = absl::make_unique<StreamingTrajectoryWriter>(
+      NextStreamStub(), WithTransportOptions(options));
+  return absl::OkStatus();
+}
+
+absl::Status Client::NewBatchedTrajectoryWriter(
+    int num_envs, const TrajectoryWriter::Options& options,
+    std::unique_ptr<BatchedTrajectoryWriter>* writer) {
+  if (num_envs <= 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("num_envs must be > 0 but got ", num_envs, "."));
+  }
+  REVERB_RETURN_IF_ERROR(options.Validate());
+  *writer = absl::make_unique<BatchedTrajectoryWriter>(
+      NextStreamStub(), num_envs, WithTransportOptions(options));
   return absl::OkStatus();
 }
 
+absl::Status Client::NewPriorityUpdateBuffer(
+    const PriorityUpdateBuffer::Options& options,
+    std::unique_ptr<PriorityUpdateBuffer>* buffer) {
+  REVERB_RETURN_IF_ERROR(options.Validate());
+  *buffer = absl::make_unique<PriorityUpdateBuffer>(
+      options, [stub = stub_](absl::string_view table,
+                              const std::vector<KeyWithPriority>& updates,
+                              const std::vector<uint64_t>& deletes) {
+        return CallMutatePriorities(stub.get(), table, updates, deletes,
+                                    absl::InfiniteDuration());
+      });
+  return absl::OkStatus();
+}
+
+TrajectoryWriter::Options Client::WithTransportOptions(
+    const TrajectoryWriter::Options& options) const {
+  TrajectoryWriter::Options updated_options = options;
+  updated_options.compress_requests |= transport_options_.compress_streams;
+  return updated_options;
+}
+
 }  // namespace reverb
 }  // namespace deepmind
@@ -17,6 +17,8 @@
 
 #include <stddef.h>
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -28,11 +30,16 @@
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "reverb/cc/batched_trajectory_writer.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/priority_update_buffer.h"
 #include "reverb/cc/reverb_service.grpc.pb.h"
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/sampler.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/streaming_trajectory_writer.h"
+#include "reverb/cc/support/grpc_transport_options.h"
 #include "reverb/cc/support/signature.h"
 #include "reverb/cc/trajectory_writer.h"
 #include "reverb/cc/writer.h"
@@ -56,6 +63,17 @@ class Client {
   explicit Client(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub);
   explicit Client(absl::string_view server_address);
 
+  // Like the constructor above but tunes the HTTP/2 transport of the channels
+  // with `transport_options`. `transport_options.num_channels` channels are
+  // opened and the streams of samplers and writers are spread over them.
+  // Trajectory writers created by the client compress their requests if
+  // `transport_options.compress_streams` is set.
+  Client(absl::string_view server_address,
+         const GrpcTransportOptions& transport_options);
+
+  // Waits for the `Async*` calls in flight to complete.
+  ~Client();
+
   // Upon successful return, `writer` will contain an instance of Writer.
   absl::Status NewWriter(int chunk_length, int max_timesteps,
                          bool delta_encoded, std::unique_ptr<Writer>* writer);
@@ -118,10 +136,81 @@ class Client {
       const std::vector<uint64_t>& deletes,
       absl::Duration timeout = absl::InfiniteDuration());
 
+  // Deletes all items of `table` which reference a chunk of any of the
+  // episodes in `episode_ids`. Episodes which don't exist are ignored. The
+  // server finds the items through its episode index rather than a scan.
+  absl::Status DeleteEpisodes(
+      absl::string_view table, const std::vector<uint64_t>& episode_ids,
+      absl::Duration timeout = absl::InfiniteDuration());
+
+  // Same as `MutatePriorities` (without timeout) but sends the request over a
+  // long lived `MutatePrioritiesStream` which is shared by all calls on this
+  // client, avoiding the setup cost of a new call for every request. The
+  // server merges requests of concurrent calls which arrive while earlier
+  // requests are being applied. The stream is opened on first use and
+  // reopened by the next call if it fails, in which case all calls in flight
+  // return the error of the stream.
+  absl::Status StreamMutatePriorities(
+      absl::string_view table, const std::vector<KeyWithPriority>& updates,
+      const std::vector<uint64_t>& deletes);
+
+  // Validates `options` and if valid, creates a `PriorityUpdateBuffer` which
+  // merges the mutations of priorities added to it and sends them in batched
+  // `MutatePriorities` calls. The buffer may outlive the client.
+  absl::Status NewPriorityUpdateBuffer(
+      const PriorityUpdateBuffer::Options& options,
+      std::unique_ptr<PriorityUpdateBuffer>* buffer);
+
+  // Multiplies the priority of every item of `table` by `priority_scale`
+  // (unless it is 1) and then changes the priority exponent of its sampler to
+  // `priority_exponent` (if set). Both are applied by the server in a single
+  // pass over the table. See `Table::ScalePriorities` and
+  // `Table::SetPriorityExponent`.
+  absl::Status TransformPriorities(
+      const std::string& table, double priority_scale,
+      absl::optional<double> priority_exponent = absl::nullopt);
+
   absl::Status Reset(const std::string& table);
 
+  // Non-blocking variants of `MutatePriorities`, `Reset` and `ServerInfo`.
+  // The calls are made with the callback API of gRPC so any number of them can
+  // be in flight without occupying a thread each. `done` is called from a gRPC
+  // thread once the call has completed and must not block. `AsyncServerInfo`
+  // always requests the full table info and then updates the caches of the
+  // client like `ServerInfo`.
+  void AsyncMutatePriorities(absl::string_view table,
+                             const std::vector<KeyWithPriority>& updates,
+                             const std::vector<uint64_t>& deletes,
+                             absl::Duration timeout,
+                             std::function<void(absl::Status)> done);
+  void AsyncReset(const std::string& table,
+                  std::function<void(absl::Status)> done);
+  void AsyncServerInfo(
+      absl::Duration timeout,
+      std::function<void(absl::Status, struct ServerInfo)> done);
+
+  // Applies `mode` to the lock profiler of the server and writes the profile it
+  // has collected to `profile`. If `reset` is true then the server starts a new
+  // profiling window. See `LockProfileRequest`.
+  absl::Status LockProfile(LockProfileRequest::Mode mode, bool reset,
+                           LockContentionProfile* profile);
+
+  // Writes the spans recorded by the flight recorder of the server as a Chrome
+  // trace to `chrome_trace_json` and, if `clear` is true, clears the recorder.
+  // See `Sampler::Options::trace_sampling_period`.
+  absl::Status DumpServerTrace(bool clear, std::string* chrome_trace_json);
+
   absl::Status Checkpoint(std::string* path);
 
+  // Starts a checkpoint which the server writes in the background, without
+  // blocking other RPCs. Poll its progress with `GetCheckpointStatus`.
+  absl::Status StartCheckpoint(uint64_t* checkpoint_id);
+
+  // Status of a checkpoint started with `StartCheckpoint`. Returns
+  // `NotFoundError` if the server does not (or no longer) know the checkpoint.
+  absl::Status GetCheckpointStatus(uint64_t checkpoint_id,
+                                   CheckpointStatusResponse* status);
+
   // Requests ServerInfo. Forces an update of internal signature caches.
   absl::Status ServerInfo(absl::Duration timeout, struct ServerInfo* info);
   // Waits indefinitely for server to respond.
@@ -147,9 +236,36 @@ class Client {
       const TrajectoryWriter::Options& options,
       std::unique_ptr<StreamingTrajectoryWriter>* writer);
 
+  // Validates `options` and if valid, creates a new `BatchedTrajectoryWriter`
+  // for `num_envs` environments which are stepped together.
+  absl::Status NewBatchedTrajectoryWriter(
+      int num_envs, const TrajectoryWriter::Options& options,
+      std::unique_ptr<BatchedTrajectoryWriter>* writer);
+
  private:
+  // Reuses the stub and the signature lookup of the client of every shard.
+  friend class ShardedClient;
+
+  // Stubs of the channel pool, the first of which is `stub_`. Streams are
+  // assigned to the channels round-robin by `NextStreamStub`.
+  const std::vector<
+      std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      stream_stubs_;
+  std::atomic<size_t> next_stream_stub_{0};
+
   const std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub_;
 
+  // Transport options the channels were created with.
+  const GrpcTransportOptions transport_options_;
+
+  // Returns the stub to open the next stream through.
+  std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>
+  NextStreamStub();
+
+  // Returns a copy of `options` with the transport settings of the client.
+  TrajectoryWriter::Options WithTransportOptions(
+      const TrajectoryWriter::Options& options) const;
+
   // Request direct access to Table managed by server. Result will only be
   // populated when the stub was created using a localhost address of a server
   // running in the same process.
@@ -177,18 +293,46 @@ class Client {
       const std::string& table, absl::Duration validation_timeout,
       internal::DtypesAndShapes* dtypes_and_shapes);
 
-  // Purely functional request for server info.  Does not update any internal
-  // caches.
+  // Request for server info.  Does not update any internal caches but, if the
+  // tables of the server haven't changed since the cache was last updated,
+  // takes the static fields of the tables from `cached_static_table_info_`
+  // rather than having the server send them again.
   absl::Status GetServerInfo(absl::Duration timeout, struct ServerInfo* info);
 
-  // Updates tables_state_id_ and cached_flat_signatures_ using info.
+  // Fills in the static fields of `response` (see
+  // `ServerInfoResponse.static_fields_omitted`) from
+  // `cached_static_table_info_`. Returns false if the cache doesn't hold the
+  // tables of `tables_state_id`.
+  bool AddCachedStaticTableInfo(absl::uint128 tables_state_id,
+                                ServerInfoResponse* response)
+      ABSL_LOCKS_EXCLUDED(cached_table_mu_);
+
+  // Updates tables_state_id_, cached_flat_signatures_ and
+  // cached_static_table_info_ using info.
   absl::Status LockedUpdateServerInfoCache(const struct ServerInfo& info)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(cached_table_mu_);
 
+  // Tracks the `Async*` calls in flight, which the destructor waits for.
+  void StartAsyncCall() ABSL_LOCKS_EXCLUDED(async_calls_mu_);
+  void FinishAsyncCall() ABSL_LOCKS_EXCLUDED(async_calls_mu_);
+
+  absl::Mutex async_calls_mu_;
+  int num_async_calls_ ABSL_GUARDED_BY(async_calls_mu_) = 0;
+
+  // Long lived stream used by `StreamMutatePriorities`. Defined in client.cc.
+  class PriorityUpdateStream;
+
+  absl::Mutex priority_stream_mu_;
+  std::shared_ptr<PriorityUpdateStream> priority_stream_
+      ABSL_GUARDED_BY(priority_stream_mu_);
+
   absl::Mutex cached_table_mu_;
   absl::uint128 tables_state_id_ ABSL_GUARDED_BY(cached_table_mu_);
   std::shared_ptr<internal::FlatSignatureMap> cached_flat_signatures_
       ABSL_GUARDED_BY(cached_table_mu_);
+  // Static fields of the `TableInfo` of every table by name.
+  internal::flat_hash_map<std::string, TableInfo> cached_static_table_info_
+      ABSL_GUARDED_BY(cached_table_mu_);
 };
 
 }  // namespace reverb
@@ -56,17 +56,57 @@ class FakeStub : public /* grpc_gen:: */MockReverbServiceStub {
                           const CheckpointRequest& request,
                           CheckpointResponse* response) override {
     last_deadline_ = context->deadline();
+    if (request.async()) {
+      response->set_checkpoint_id(7);
+    } else {
+      response->set_checkpoint_path(kCheckpointPath);
+    }
+    return grpc::Status::OK;
+  }
+
+  grpc::Status CheckpointStatus(grpc::ClientContext* context,
+                                const CheckpointStatusRequest& request,
+                                CheckpointStatusResponse* response) override {
+    if (request.checkpoint_id() != 7) {
+      return grpc::Status(grpc::StatusCode::NOT_FOUND, "Unknown checkpoint");
+    }
+    response->set_state(CheckpointStatusResponse::DONE);
     response->set_checkpoint_path(kCheckpointPath);
     return grpc::Status::OK;
   }
 
+  grpc::Status LockProfile(grpc::ClientContext* context,
+                           const LockProfileRequest& request,
+                           LockProfileResponse* response) override {
+    lock_profile_request_ = request;
+    response->mutable_profile()->set_enabled(true);
+    response->mutable_profile()->add_sites()->set_mutex("Table::mu_");
+    return grpc::Status::OK;
+  }
+
+  grpc::Status DumpTrace(grpc::ClientContext* context,
+                         const DumpTraceRequest& request,
+                         DumpTraceResponse* response) override {
+    dump_trace_request_ = request;
+    response->set_chrome_trace_json("{}");
+    return grpc::Status::OK;
+  }
+
   grpc::Status ServerInfo(grpc::ClientContext* context,
                           const ServerInfoRequest& request,
                           ServerInfoResponse* response) override {
     last_deadline_ = context->deadline();
+    server_info_request_ = request;
     *response->mutable_tables_state_id() =
         Uint128ToMessage(absl::MakeUint128(1, 2));
-    response->add_table_info()->set_max_size(2);
+    if (request.has_known_tables_state_id() &&
+        MessageToUint128(request.known_tables_state_id()) ==
+            absl::MakeUint128(1, 2)) {
+      response->add_table_info()->set_current_size(3);
+      response->set_static_fields_omitted(true);
+    } else {
+      response->add_table_info()->set_max_size(2);
+    }
     return grpc::Status::OK;
   }
 
@@ -80,10 +120,25 @@ class FakeStub : public /* grpc_gen:: */MockReverbServiceStub {
 
   const ResetRequest& reset_request() const { return reset_request_; }
 
+  const LockProfileRequest& lock_profile_request() const {
+    return lock_profile_request_;
+  }
+
+  const DumpTraceRequest& dump_trace_request() const {
+    return dump_trace_request_;
+  }
+
+  const ServerInfoRequest& server_info_request() const {
+    return server_info_request_;
+  }
+
  private:
   std::chrono::system_clock::time_point last_deadline_;
   MutatePrioritiesRequest mutate_priorities_request_;
   ResetRequest reset_request_;
+  LockProfileRequest lock_profile_request_;
+  DumpTraceRequest dump_trace_request_;
+  ServerInfoRequest server_info_request_;
 };
 
 TEST(ClientTest, MutatePrioritiesDefaultValues) {
@@ -108,6 +163,36 @@ TEST(ClientTest, MutatePrioritiesFilled) {
               testing::EqualsProto(expected));
 }
 
+TEST(ClientTest, PriorityUpdateBufferSendsMergedMutations) {
+  auto stub = std::make_shared<FakeStub>();
+  Client client(stub);
+  PriorityUpdateBuffer::Options options;
+  options.flush_interval = absl::Hours(1);
+  std::unique_ptr<PriorityUpdateBuffer> buffer;
+  REVERB_ASSERT_OK(client.NewPriorityUpdateBuffer(options, &buffer));
+  REVERB_ASSERT_OK(
+      buffer->Mutate("table", {testing::MakeKeyWithPriority(1, 2)}, {}));
+  REVERB_ASSERT_OK(
+      buffer->Mutate("table", {testing::MakeKeyWithPriority(1, 3)}, {4}));
+  REVERB_ASSERT_OK(buffer->Flush());
+
+  MutatePrioritiesRequest expected;
+  expected.set_table("table");
+  *expected.add_updates() = testing::MakeKeyWithPriority(1, 3);
+  expected.add_delete_keys(4);
+  EXPECT_THAT(stub->mutate_priorities_request(),
+              testing::EqualsProto(expected));
+}
+
+TEST(ClientTest, NewPriorityUpdateBufferValidatesOptions) {
+  Client client(std::make_shared<FakeStub>());
+  PriorityUpdateBuffer::Options options;
+  options.max_buffered_keys = 0;
+  std::unique_ptr<PriorityUpdateBuffer> buffer;
+  EXPECT_EQ(client.NewPriorityUpdateBuffer(options, &buffer).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
 TEST(ClientTest, Deadline) {
   auto stub = std::make_shared<FakeStub>();
   Client client(stub);
@@ -133,6 +218,31 @@ TEST(ClientTest, ResetRequestFilled) {
   EXPECT_THAT(stub->reset_request(), testing::EqualsProto(expected));
 }
 
+TEST(ClientTest, LockProfile) {
+  auto stub = std::make_shared<FakeStub>();
+  Client client(stub);
+  LockContentionProfile profile;
+  REVERB_EXPECT_OK(
+      client.LockProfile(LockProfileRequest::ENABLE, /*reset=*/true, &profile));
+
+  LockProfileRequest expected;
+  expected.set_mode(LockProfileRequest::ENABLE);
+  expected.set_reset(true);
+  EXPECT_THAT(stub->lock_profile_request(), testing::EqualsProto(expected));
+  EXPECT_TRUE(profile.enabled());
+  ASSERT_EQ(profile.sites_size(), 1);
+  EXPECT_EQ(profile.sites(0).mutex(), "Table::mu_");
+}
+
+TEST(ClientTest, DumpServerTrace) {
+  auto stub = std::make_shared<FakeStub>();
+  Client client(stub);
+  std::string json;
+  REVERB_EXPECT_OK(client.DumpServerTrace(/*clear=*/true, &json));
+  EXPECT_TRUE(stub->dump_trace_request().clear());
+  EXPECT_EQ(json, "{}");
+}
+
 TEST(ClientTest, Checkpoint) {
   auto stub = std::make_shared<FakeStub>();
   Client client(stub);
@@ -141,6 +251,22 @@ TEST(ClientTest, Checkpoint) {
   EXPECT_EQ(path, kCheckpointPath);
 }
 
+TEST(ClientTest, StartCheckpointAndGetStatus) {
+  auto stub = std::make_shared<FakeStub>();
+  Client client(stub);
+  uint64_t checkpoint_id;
+  REVERB_EXPECT_OK(client.StartCheckpoint(&checkpoint_id));
+  EXPECT_EQ(checkpoint_id, 7);
+
+  CheckpointStatusResponse status;
+  REVERB_EXPECT_OK(client.GetCheckpointStatus(checkpoint_id, &status));
+  EXPECT_EQ(status.state(), CheckpointStatusResponse::DONE);
+  EXPECT_EQ(status.checkpoint_path(), kCheckpointPath);
+
+  EXPECT_EQ(client.GetCheckpointStatus(8, &status).code(),
+            absl::StatusCode::kNotFound);
+}
+
 TEST(ClientTest, ServerInfoRequestFilled) {
   auto stub = std::make_shared<FakeStub>();
   Client client(stub);
@@ -154,6 +280,29 @@ TEST(ClientTest, ServerInfoRequestFilled) {
   EXPECT_THAT(info.table_info[0], testing::EqualsProto(expected_info));
 }
 
+TEST(ClientTest, ServerInfoOnlyRequestsDynamicFieldsOnceCached) {
+  auto stub = std::make_shared<FakeStub>();
+  Client client(stub);
+  struct Client::ServerInfo info;
+  REVERB_EXPECT_OK(client.ServerInfo(&info));
+  EXPECT_FALSE(stub->server_info_request().has_known_tables_state_id());
+
+  // The second call sends the id of the cached tables and the static fields
+  // omitted by the server are filled in from the cache.
+  struct Client::ServerInfo second_info;
+  REVERB_EXPECT_OK(client.ServerInfo(&second_info));
+  EXPECT_EQ(
+      MessageToUint128(stub->server_info_request().known_tables_state_id()),
+      absl::MakeUint128(1, 2));
+
+  TableInfo expected_info;
+  expected_info.set_max_size(2);
+  expected_info.set_current_size(3);
+  EXPECT_EQ(second_info.tables_state_id, absl::MakeUint128(1, 2));
+  ASSERT_EQ(second_info.table_info.size(), 1);
+  EXPECT_THAT(second_info.table_info[0], testing::EqualsProto(expected_info));
+}
+
 TEST(ClientTest, NewTrajectoryWriterValidatesOptions) {
   auto stub = std::make_shared<FakeStub>();
   Client client(stub);
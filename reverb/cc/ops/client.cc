@@ -207,14 +207,18 @@ class UpdatePrioritiesOp : public tensorflow::OpKernel {
       updates.push_back(std::move(update));
     }
 
+    // The updates are sent over a stream which is kept open between calls as
+    // the op is typically run after every training step.
+    //
     // The call will only fail if the Reverb-server is brought down during an
-    // active call (e.g preempted). When this happens the request is retried and
-    // since MutatePriorities sets `wait_for_ready` the request will no be sent
-    // before the server is brought up again. It is therefore no problem to have
-    // this retry in this tight loop.
+    // active call (e.g preempted). When this happens the request is retried on
+    // a new stream and since the stream sets `wait_for_ready` the request will
+    // no be sent before the server is brought up again. It is therefore no
+    // problem to have this retry in this tight loop.
     absl::Status status;
     do {
-      status = resource->client()->MutatePriorities(table_str, updates, {});
+      status =
+          resource->client()->StreamMutatePriorities(table_str, updates, {});
     } while (absl::IsUnavailable(status) || absl::IsDeadlineExceeded(status));
     OP_REQUIRES_OK(context, ToTensorflowStatus(status));
   }
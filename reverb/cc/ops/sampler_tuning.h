@@ -0,0 +1,102 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_OPS_SAMPLER_TUNING_H_
+#define REVERB_CC_OPS_SAMPLER_TUNING_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "reverb/cc/sampler.h"
+#include "tensorflow/core/framework/model.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Tunable parameters of tf.data's performance model (`tf.data.AUTOTUNE`) which
+// control the number of active sampler workers (`model::kParallelism`) and the
+// number of samples each of them requests at a time (`model::kBufferSize`),
+// see `Sampler::SetWorkerLimits`. Both start at their maximums and the model
+// tunes them along with the rest of the input pipeline.
+//
+// Only the thread running the iterator may call `Apply`.
+class SamplerTuning {
+ public:
+  SamplerTuning(int64_t max_workers, int64_t max_samples_per_request)
+      : max_workers_(max_workers),
+        max_samples_per_request_(max_samples_per_request),
+        mu_(std::make_shared<tensorflow::mutex>()),
+        cond_var_(std::make_shared<tensorflow::condition_variable>()),
+        num_workers_(std::make_shared<tensorflow::data::model::SharedState>(
+            tensorflow::data::model::kAutotune, mu_, cond_var_)),
+        samples_per_request_(
+            std::make_shared<tensorflow::data::model::SharedState>(
+                tensorflow::data::model::kAutotune, mu_, cond_var_)) {
+    num_workers_->value = max_workers_;
+    samples_per_request_->value = max_samples_per_request_;
+  }
+
+  // Parameters to attach to the model node of the iterator.
+  std::vector<std::shared_ptr<tensorflow::data::model::Parameter>> parameters()
+      const {
+    return {
+        tensorflow::data::model::MakeParameter(
+            tensorflow::data::model::kParallelism, num_workers_, /*min=*/1,
+            /*max=*/max_workers_),
+        tensorflow::data::model::MakeParameter(
+            tensorflow::data::model::kBufferSize, samples_per_request_,
+            /*min=*/1, /*max=*/max_samples_per_request_),
+    };
+  }
+
+  // Applies the values most recently chosen by the model to `sampler`, unless
+  // they have already been applied.
+  void Apply(Sampler* sampler) {
+    int64_t num_workers;
+    int64_t samples_per_request;
+    {
+      tensorflow::mutex_lock lock(*mu_);
+      num_workers = num_workers_->value;
+      samples_per_request = samples_per_request_->value;
+    }
+    if (num_workers == applied_num_workers_ &&
+        samples_per_request == applied_samples_per_request_) {
+      return;
+    }
+    sampler->SetWorkerLimits(num_workers, samples_per_request);
+    applied_num_workers_ = num_workers;
+    applied_samples_per_request_ = samples_per_request;
+  }
+
+ private:
+  const int64_t max_workers_;
+  const int64_t max_samples_per_request_;
+
+  const std::shared_ptr<tensorflow::mutex> mu_;
+  const std::shared_ptr<tensorflow::condition_variable> cond_var_;
+  const std::shared_ptr<tensorflow::data::model::SharedState> num_workers_;
+  const std::shared_ptr<tensorflow::data::model::SharedState>
+      samples_per_request_;
+
+  int64_t applied_num_workers_ = -1;
+  int64_t applied_samples_per_request_ = -1;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_OPS_SAMPLER_TUNING_H_
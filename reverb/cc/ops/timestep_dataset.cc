@@ -12,15 +12,19 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <cstdint>
+
 #include "absl/strings/match.h"
 #include "reverb/cc/client.h"
 #include "reverb/cc/errors.h"
+#include "reverb/cc/ops/sampler_tuning.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/tf_utils.h"
 #include "reverb/cc/sampler.h"
 #include "reverb/cc/support/tf_util.h"
 #include "tensorflow/core/framework/common_shape_fns.h"
 #include "tensorflow/core/framework/dataset.h"
+#include "tensorflow/core/framework/model.h"
 #include "tensorflow/core/framework/op.h"
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/tensor_shape.h"
@@ -42,6 +46,9 @@ REGISTER_OP("ReverbTimestepDataset")
     .Attr("max_samples_per_stream: int = -1")
     .Attr("rate_limiter_timeout_ms: int = -1")
     .Attr("flexible_batch_size: int = -1")
+    .Attr("tf_data_autotune: bool = false")
+    .Attr("window_length: int = -1")
+    .Attr("window_shift: int = -1")
     .Attr("dtypes: list(type) >= 1")
     .Attr("shapes: list(shape) >= 1")
     .Output("dataset: variant")
@@ -96,6 +103,23 @@ auto selected value should almost always be preferred.
 Larger `flexible_batch_size` values result a bias towards sampling over
 inserts. In highly overloaded systems this results in higher sample QPS
 and lower insert QPS compared to lower `flexible_batch_size` values.
+
+`tf_data_autotune` (defaults to false) lets tf.data's performance model (i.e.
+`tf.data.AUTOTUNE`) tune how many of the `num_workers_per_iterator` workers
+fetch samples and how many samples, up to `max_in_flight_samples_per_worker`,
+each of them requests at a time. The number of samples buffered by the sampler
+is reported to the model.
+
+`window_length` (defaults to -1, i.e. no windowing) is the number of
+consecutive timesteps of an item to emit as a single element. When set, every
+tensor has an extra leading dimension of size `window_length` and the windows
+are assembled directly from the sampled chunks (see `Sampler::GetNextWindow`).
+Windows never span more than one item, timesteps at the end of an item which
+don't make up a complete window are dropped.
+
+`window_shift` (defaults to -1, i.e. `window_length`) is the number of
+timesteps between the starts of successive windows of the same item. Requires
+`window_length` to be set.
 )doc");
 
 class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
@@ -111,6 +135,9 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
                                      &sampler_options_.max_samples_per_stream));
     OP_REQUIRES_OK(ctx, ctx->GetAttr("flexible_batch_size",
                                      &sampler_options_.flexible_batch_size));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("tf_data_autotune", &tf_data_autotune_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("window_length", &window_length_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("window_shift", &window_shift_));
     tensorflow::int64 rate_limiter_timeout_ms;
     OP_REQUIRES_OK(
         ctx, ctx->GetAttr("rate_limiter_timeout_ms", &rate_limiter_timeout_ms));
@@ -121,6 +148,18 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
         Int64MillisToNonnegativeDuration(rate_limiter_timeout_ms);
 
     OP_REQUIRES_OK(ctx, ToTensorflowStatus(sampler_options_.Validate()));
+
+    OP_REQUIRES(ctx, window_length_ == -1 || window_length_ > 0,
+                tensorflow::errors::InvalidArgument(
+                    "window_length must be a positive integer or -1, got ",
+                    window_length_));
+    OP_REQUIRES(ctx, window_shift_ == -1 || window_shift_ > 0,
+                tensorflow::errors::InvalidArgument(
+                    "window_shift must be a positive integer or -1, got ",
+                    window_shift_));
+    OP_REQUIRES(ctx, window_shift_ == -1 || window_length_ != -1,
+                tensorflow::errors::InvalidArgument(
+                    "window_shift requires window_length to be set."));
   }
 
   void MakeDataset(tensorflow::OpKernelContext* ctx,
@@ -135,7 +174,8 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
                        ctx, "table", &table));
 
     *output = new Dataset(ctx, server_address, dtypes_, shapes_, table,
-                          sampler_options_);
+                          sampler_options_, tf_data_autotune_, window_length_,
+                          window_shift_);
   }
 
  private:
@@ -144,15 +184,31 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
     Dataset(tensorflow::OpKernelContext* ctx, std::string server_address,
             tensorflow::DataTypeVector dtypes,
             std::vector<tensorflow::PartialTensorShape> shapes,
-            std::string table, const Sampler::Options& sampler_options)
+            std::string table, const Sampler::Options& sampler_options,
+            bool tf_data_autotune, tensorflow::int64 window_length,
+            tensorflow::int64 window_shift)
         : tensorflow::data::DatasetBase(tensorflow::data::DatasetContext(ctx)),
           server_address_(std::move(server_address)),
           dtypes_(std::move(dtypes)),
           shapes_(std::move(shapes)),
           table_(std::move(table)),
           sampler_options_(sampler_options),
+          tf_data_autotune_(tf_data_autotune),
+          window_length_(window_length),
+          window_shift_(window_shift),
           client_(absl::make_unique<Client>(server_address_)) {
       RecordTFDataExperiments();
+
+      // Windows hold `window_length` timesteps stacked along a new leading
+      // dimension.
+      for (const auto& shape : shapes_) {
+        tensorflow::PartialTensorShape output_shape = shape;
+        if (window_length_ != -1) {
+          output_shape = tensorflow::PartialTensorShape({window_length_})
+                             .Concatenate(shape);
+        }
+        output_shapes_.push_back(std::move(output_shape));
+      }
     }
 
     std::unique_ptr<tensorflow::data::IteratorBase> MakeIteratorInternal(
@@ -160,7 +216,10 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
       return absl::make_unique<Iterator>(
           tensorflow::data::DatasetIterator<Dataset>::Params{
               this, absl::StrCat(prefix, "::ReverbTimestepDataset")},
-          client_.get(), table_, sampler_options_, dtypes_, shapes_);
+          client_.get(), table_, sampler_options_, tf_data_autotune_,
+          window_length_,
+          window_shift_ == -1 ? window_length_ : window_shift_, dtypes_,
+          shapes_);
     }
 
     const tensorflow::DataTypeVector& output_dtypes() const override {
@@ -169,7 +228,7 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
 
     const std::vector<tensorflow::PartialTensorShape>& output_shapes()
         const override {
-      return shapes_;
+      return output_shapes_;
     }
 
     std::string DebugString() const override {
@@ -195,6 +254,9 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
       tensorflow::AttrValue max_samples_per_stream_attr;
       tensorflow::AttrValue rate_limiter_timeout_ms_attr;
       tensorflow::AttrValue flexible_batch_size_attr;
+      tensorflow::AttrValue tf_data_autotune_attr;
+      tensorflow::AttrValue window_length_attr;
+      tensorflow::AttrValue window_shift_attr;
       tensorflow::AttrValue dtypes_attr;
       tensorflow::AttrValue shapes_attr;
 
@@ -215,6 +277,9 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
           &rate_limiter_timeout_ms_attr);
       b->BuildAttrValue(sampler_options_.flexible_batch_size,
                         &flexible_batch_size_attr);
+      b->BuildAttrValue(tf_data_autotune_, &tf_data_autotune_attr);
+      b->BuildAttrValue(window_length_, &window_length_attr);
+      b->BuildAttrValue(window_shift_, &window_shift_attr);
       b->BuildAttrValue(dtypes_, &dtypes_attr);
       b->BuildAttrValue(shapes_, &shapes_attr);
 
@@ -229,6 +294,9 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
               {"max_samples_per_stream", max_samples_per_stream_attr},
               {"rate_limiter_timeout_ms", rate_limiter_timeout_ms_attr},
               {"flexible_batch_size", flexible_batch_size_attr},
+              {"tf_data_autotune", tf_data_autotune_attr},
+              {"window_length", window_length_attr},
+              {"window_shift", window_shift_attr},
               {"dtypes", dtypes_attr},
               {"shapes", shapes_attr},
           },
@@ -242,15 +310,23 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
      public:
       explicit Iterator(
           const Params& params, Client* client, const std::string& table,
-          const Sampler::Options& sampler_options,
+          const Sampler::Options& sampler_options, bool tf_data_autotune,
+          tensorflow::int64 window_length, tensorflow::int64 window_shift,
           const tensorflow::DataTypeVector& dtypes,
           const std::vector<tensorflow::PartialTensorShape>& shapes)
           : DatasetIterator<Dataset>(params),
             client_(client),
             table_(table),
             sampler_options_(sampler_options),
+            window_length_(window_length),
+            window_shift_(window_shift),
             dtypes_(dtypes),
             shapes_(shapes),
+            tuning_(tf_data_autotune
+                        ? absl::make_unique<SamplerTuning>(
+                              Sampler::NumGrpcWorkers(sampler_options),
+                              sampler_options.max_in_flight_samples_per_worker)
+                        : nullptr),
             rate_limited_(false) {}
 
       tensorflow::Status Initialize(
@@ -282,6 +358,9 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
           std::vector<tensorflow::Tensor>* out_tensors,
           bool* end_of_sequence) override {
         REVERB_CHECK(sampler_.get() != nullptr) << "Initialize was not called?";
+        if (tuning_ != nullptr) {
+          tuning_->Apply(sampler_.get());
+        }
 
         auto token = ctx->cancellation_manager()->get_cancellation_token();
         bool registered = ctx->cancellation_manager()->RegisterCallback(
@@ -291,9 +370,14 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
         }
 
         tensorflow::Status status;
-        bool last_timestep = false;
-        status = ToTensorflowStatus(sampler_->GetNextTimestep(
-            out_tensors, &last_timestep, &rate_limited_));
+        if (window_length_ != -1) {
+          status = ToTensorflowStatus(sampler_->GetNextWindow(
+              window_length_, window_shift_, out_tensors, &rate_limited_));
+        } else {
+          bool last_timestep = false;
+          status = ToTensorflowStatus(sampler_->GetNextTimestep(
+              out_tensors, &last_timestep, &rate_limited_));
+        }
 
         if (registered &&
             !ctx->cancellation_manager()->DeregisterCallback(token)) {
@@ -301,6 +385,9 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
         }
 
         if (status.ok()) {
+          if (tuning_ != nullptr) {
+            RecordBufferedSamples(ctx, *out_tensors);
+          }
           *end_of_sequence = false;
           return status;
         } else if (sampler_options_.rate_limiter_timeout <
@@ -314,6 +401,16 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
       }
 
      protected:
+      std::shared_ptr<tensorflow::data::model::Node> CreateNode(
+          tensorflow::data::IteratorContext* ctx,
+          tensorflow::data::model::Node::Args args) const override {
+        if (tuning_ == nullptr) {
+          return DatasetIterator<Dataset>::CreateNode(ctx, std::move(args));
+        }
+        return tensorflow::data::model::MakeAsyncKnownRatioNode(
+            std::move(args), /*ratio=*/1, tuning_->parameters());
+      }
+
       tensorflow::Status SaveInternal(
           tensorflow::data::SerializationContext* ctx,
           tensorflow::data::IteratorStateWriter* writer) override {
@@ -331,12 +428,35 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
       }
 
      private:
+      // Reports the change in the number of samples buffered by the sampler
+      // since the last call to the model. The buffered samples are counted as
+      // one timestep each and `element` stands in for their size.
+      void RecordBufferedSamples(
+          tensorflow::data::IteratorContext* ctx,
+          const std::vector<tensorflow::Tensor>& element) {
+        const int64_t num_buffered = sampler_->num_buffered_samples();
+        for (; num_buffered_ < num_buffered; num_buffered_++) {
+          RecordBufferEnqueue(ctx, element);
+        }
+        for (; num_buffered_ > num_buffered; num_buffered_--) {
+          RecordBufferDequeue(ctx, element);
+        }
+      }
+
       Client* client_;
       const std::string& table_;
       const Sampler::Options sampler_options_;
+      // Length and shift of the windows, or -1 if timesteps are returned one
+      // at a time.
+      const tensorflow::int64 window_length_;
+      const tensorflow::int64 window_shift_;
       const tensorflow::DataTypeVector& dtypes_;
       const std::vector<tensorflow::PartialTensorShape>& shapes_;
       std::unique_ptr<Sampler> sampler_;
+      // Parameters tuned by tf.data. Only set if `tf_data_autotune` is true.
+      const std::unique_ptr<SamplerTuning> tuning_;
+      // Number of buffered samples last reported to the model.
+      int64_t num_buffered_ = 0;
 
       // Whether the active sample was delayed due to rate limiting.
       bool rate_limited_;
@@ -347,10 +467,17 @@ class ReverbTimestepDatasetOp : public tensorflow::data::DatasetOpKernel {
     const std::vector<tensorflow::PartialTensorShape> shapes_;
     const std::string table_;
     const Sampler::Options sampler_options_;
+    const bool tf_data_autotune_;
+    const tensorflow::int64 window_length_;
+    const tensorflow::int64 window_shift_;
+    std::vector<tensorflow::PartialTensorShape> output_shapes_;
     std::unique_ptr<Client> client_;
   };  // Dataset.
 
   Sampler::Options sampler_options_;
+  bool tf_data_autotune_;
+  tensorflow::int64 window_length_;
+  tensorflow::int64 window_shift_;
   tensorflow::DataTypeVector dtypes_;
   std::vector<tensorflow::PartialTensorShape> shapes_;
 
@@ -12,15 +12,23 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <cstdint>
+
 #include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
 #include "reverb/cc/client.h"
 #include "reverb/cc/errors.h"
+#include "reverb/cc/ops/sampler_tuning.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/tf_utils.h"
 #include "reverb/cc/sampler.h"
+#include "reverb/cc/sampler_pool.h"
 #include "reverb/cc/support/tf_util.h"
+#include "tensorflow/core/framework/allocator.h"
 #include "tensorflow/core/framework/common_shape_fns.h"
 #include "tensorflow/core/framework/dataset.h"
+#include "tensorflow/core/framework/model.h"
 #include "tensorflow/core/framework/op.h"
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/tensor_shape.h"
@@ -42,6 +50,11 @@ REGISTER_OP("ReverbTrajectoryDataset")
     .Attr("max_samples_per_stream: int = -1")
     .Attr("rate_limiter_timeout_ms: int = -1")
     .Attr("flexible_batch_size: int = -1")
+    .Attr("batch_size: int = -1")
+    .Attr("share_sampler: bool = false")
+    .Attr("pin_output_memory: bool = false")
+    .Attr("tf_data_autotune: bool = false")
+    .Attr("columns: list(int) = []")
     .Attr("dtypes: list(type) >= 1")
     .Attr("shapes: list(shape) >= 1")
     .Output("dataset: variant")
@@ -94,6 +107,39 @@ auto selected value should almost always be preferred.
 Larger `flexible_batch_size` values result a bias towards sampling over
 inserts. In highly overloaded systems this results in higher sample QPS
 and lower insert QPS compared to lower `flexible_batch_size` values.
+
+`batch_size` (defaults to -1, i.e. no batching) is the number of trajectories
+to return in each element. When set, every output tensor gets a leading batch
+dimension and is allocated once per batch and filled directly from the sampled
+chunks (see `Sampler::GetNextBatch`), which is cheaper than applying
+`.batch(batch_size)` to the unbatched dataset. All trajectories of a batch
+must have the same shapes. `shapes` describes a single (unbatched) trajectory.
+
+`share_sampler` (defaults to false) makes all iterators in the process which
+sample from the same server and table with the same options and signature share
+a single `Sampler` (see ../sampler_pool.h) rather than each opening
+`num_workers_per_iterator` streams of their own. This keeps the number of
+streams constant when the dataset is interleaved or replicated. Cancelling any
+of the iterators closes the shared sampler.
+
+`pin_output_memory` (defaults to false) allocates the output tensors with the
+host allocator of the iterator context which is compatible with the
+accelerators (i.e. page-locked memory when a GPU is present), see
+`Sampler::Options::output_allocator`. This allows the samples to be copied to
+the device asynchronously without an intermediate staging copy.
+
+`tf_data_autotune` (defaults to false) lets tf.data's performance model (i.e.
+`tf.data.AUTOTUNE`) tune how many of the `num_workers_per_iterator` workers
+fetch samples and how many samples, up to `max_in_flight_samples_per_worker`,
+each of them requests at a time, along with the rest of the input pipeline. The
+number of samples buffered by the sampler is reported to the model. Can't be
+combined with `share_sampler` as the iterators would fight over the settings.
+
+`columns` [EXPERIMENTAL] (defaults to [], i.e. all columns) are the indices of
+the flattened trajectory columns to sample, in the order they should be output.
+Only the data of the selected columns is sent by the server so the bandwidth is
+proportional to the selection. `dtypes` and `shapes` describe the selected
+columns only, see `Sampler::Options::columns`.
 )doc");
 
 class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
@@ -109,6 +155,12 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
                                      &sampler_options_.max_samples_per_stream));
     OP_REQUIRES_OK(ctx, ctx->GetAttr("flexible_batch_size",
                                      &sampler_options_.flexible_batch_size));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("batch_size", &batch_size_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("share_sampler", &share_sampler_));
+    OP_REQUIRES_OK(ctx,
+                   ctx->GetAttr("pin_output_memory", &pin_output_memory_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("tf_data_autotune", &tf_data_autotune_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("columns", &sampler_options_.columns));
     tensorflow::int64 rate_limiter_timeout_ms;
     OP_REQUIRES_OK(
         ctx, ctx->GetAttr("rate_limiter_timeout_ms", &rate_limiter_timeout_ms));
@@ -119,6 +171,13 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
         Int64MillisToNonnegativeDuration(rate_limiter_timeout_ms);
 
     OP_REQUIRES_OK(ctx, ToTensorflowStatus(sampler_options_.Validate()));
+    OP_REQUIRES(ctx, batch_size_ == -1 || batch_size_ > 0,
+                tensorflow::errors::InvalidArgument(
+                    "batch_size must be a positive integer or -1 but got ",
+                    batch_size_, "."));
+    OP_REQUIRES(ctx, !(tf_data_autotune_ && share_sampler_),
+                tensorflow::errors::InvalidArgument(
+                    "tf_data_autotune and share_sampler can't both be set."));
   }
 
   void MakeDataset(tensorflow::OpKernelContext* ctx,
@@ -133,7 +192,8 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
                        ctx, "table", &table));
 
     *output = new Dataset(ctx, server_address, dtypes_, shapes_, table,
-                          sampler_options_);
+                          sampler_options_, batch_size_, share_sampler_,
+                          pin_output_memory_, tf_data_autotune_);
   }
 
  private:
@@ -142,14 +202,38 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
     Dataset(tensorflow::OpKernelContext* ctx, std::string server_address,
             tensorflow::DataTypeVector dtypes,
             std::vector<tensorflow::PartialTensorShape> shapes,
-            std::string table, const Sampler::Options& sampler_options)
+            std::string table, const Sampler::Options& sampler_options,
+            int batch_size, bool share_sampler, bool pin_output_memory,
+            bool tf_data_autotune)
         : tensorflow::data::DatasetBase(tensorflow::data::DatasetContext(ctx)),
           server_address_(std::move(server_address)),
           dtypes_(std::move(dtypes)),
           shapes_(std::move(shapes)),
           table_(std::move(table)),
           sampler_options_(sampler_options),
+          batch_size_(batch_size),
+          share_sampler_(share_sampler),
+          pin_output_memory_(pin_output_memory),
+          tf_data_autotune_(tf_data_autotune),
           client_(absl::make_unique<Client>(server_address_)) {
+      output_shapes_.reserve(shapes_.size());
+      for (const auto& shape : shapes_) {
+        output_shapes_.push_back(
+            batch_size_ > 0
+                ? tensorflow::PartialTensorShape({batch_size_}).Concatenate(
+                      shape)
+                : shape);
+      }
+      if (share_sampler_) {
+        // Iterators only share samplers which validate the same signature.
+        sampler_pool_key_ = absl::StrCat(
+            SamplerPool::MakeKey(server_address_, table_, sampler_options_),
+            "|", tensorflow::DataTypeVectorString(dtypes_),
+            "|pin_output_memory=", pin_output_memory_);
+        for (const auto& shape : shapes_) {
+          absl::StrAppend(&sampler_pool_key_, "|", shape.DebugString());
+        }
+      }
       RecordTFDataExperiments();
     }
 
@@ -158,7 +242,9 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
       return absl::make_unique<Iterator>(
           tensorflow::data::DatasetIterator<Dataset>::Params{
               this, absl::StrCat(prefix, "::ReverbDataset")},
-          client_.get(), table_, sampler_options_, dtypes_, shapes_);
+          client_.get(), table_, sampler_options_, batch_size_,
+          pin_output_memory_, tf_data_autotune_, dtypes_, shapes_,
+          sampler_pool_key_);
     }
 
     const tensorflow::DataTypeVector& output_dtypes() const override {
@@ -167,7 +253,7 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
 
     const std::vector<tensorflow::PartialTensorShape>& output_shapes()
         const override {
-      return shapes_;
+      return output_shapes_;
     }
 
     std::string DebugString() const override {
@@ -193,6 +279,11 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
       tensorflow::AttrValue max_samples_per_stream_attr;
       tensorflow::AttrValue rate_limiter_timeout_ms_attr;
       tensorflow::AttrValue flexible_batch_size_attr;
+      tensorflow::AttrValue batch_size_attr;
+      tensorflow::AttrValue share_sampler_attr;
+      tensorflow::AttrValue pin_output_memory_attr;
+      tensorflow::AttrValue tf_data_autotune_attr;
+      tensorflow::AttrValue columns_attr;
       tensorflow::AttrValue dtypes_attr;
       tensorflow::AttrValue shapes_attr;
 
@@ -213,6 +304,11 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
           &rate_limiter_timeout_ms_attr);
       b->BuildAttrValue(sampler_options_.flexible_batch_size,
                         &flexible_batch_size_attr);
+      b->BuildAttrValue(batch_size_, &batch_size_attr);
+      b->BuildAttrValue(share_sampler_, &share_sampler_attr);
+      b->BuildAttrValue(pin_output_memory_, &pin_output_memory_attr);
+      b->BuildAttrValue(tf_data_autotune_, &tf_data_autotune_attr);
+      b->BuildAttrValue(sampler_options_.columns, &columns_attr);
       b->BuildAttrValue(dtypes_, &dtypes_attr);
       b->BuildAttrValue(shapes_, &shapes_attr);
 
@@ -227,6 +323,11 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
               {"max_samples_per_stream", max_samples_per_stream_attr},
               {"rate_limiter_timeout_ms", rate_limiter_timeout_ms_attr},
               {"flexible_batch_size", flexible_batch_size_attr},
+              {"batch_size", batch_size_attr},
+              {"share_sampler", share_sampler_attr},
+              {"pin_output_memory", pin_output_memory_attr},
+              {"tf_data_autotune", tf_data_autotune_attr},
+              {"columns", columns_attr},
               {"dtypes", dtypes_attr},
               {"shapes", shapes_attr},
           },
@@ -240,39 +341,50 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
      public:
       explicit Iterator(
           const Params& params, Client* client, const std::string& table,
-          const Sampler::Options& sampler_options,
+          const Sampler::Options& sampler_options, int batch_size,
+          bool pin_output_memory, bool tf_data_autotune,
           const tensorflow::DataTypeVector& dtypes,
-          const std::vector<tensorflow::PartialTensorShape>& shapes)
+          const std::vector<tensorflow::PartialTensorShape>& shapes,
+          std::string sampler_pool_key)
           : DatasetIterator<Dataset>(params),
             client_(client),
             table_(table),
             sampler_options_(sampler_options),
+            batch_size_(batch_size),
+            pin_output_memory_(pin_output_memory),
             dtypes_(dtypes),
             shapes_(shapes),
+            sampler_pool_key_(std::move(sampler_pool_key)),
+            tuning_(tf_data_autotune
+                        ? absl::make_unique<SamplerTuning>(
+                              Sampler::NumGrpcWorkers(sampler_options),
+                              sampler_options.max_in_flight_samples_per_worker)
+                        : nullptr),
             rate_limited_(false) {}
 
       tensorflow::Status Initialize(
           tensorflow::data::IteratorContext* ctx) override {
-        constexpr auto kValidationTimeout = absl::Seconds(30);
-        auto status =
-            client_->NewSampler(table_, sampler_options_,
-                                /*validation_dtypes=*/dtypes_, shapes_,
-                                kValidationTimeout, &sampler_);
-        if (absl::IsDeadlineExceeded(status)) {
-          REVERB_LOG(REVERB_WARNING)
-              << "Unable to validate shapes and dtypes of new sampler for '"
-              << table_ << "' as server could not be reached in time ("
-              << kValidationTimeout
-              << "). We were thus unable to fetch signature from server. The "
-                 "sampler will be constructed without validating the dtypes "
-                 "and shapes.";
-          // Ask for a NewSampler with negative validation_timeout Duration,
-          // which causes it to skip the validation and return an OK status.
-          return ToTensorflowStatus(client_->NewSampler(
-              table_, sampler_options_,
-              /*validation_timeout=*/-absl::InfiniteDuration(), &sampler_));
+        if (pin_output_memory_) {
+          tensorflow::AllocatorAttributes attrs;
+          attrs.set_on_host(true);
+          attrs.set_gpu_compatible(true);
+          output_allocator_ = ctx->allocator(attrs);
         }
-        return ToTensorflowStatus(status);
+        if (sampler_pool_key_.empty()) {
+          std::unique_ptr<Sampler> sampler;
+          TF_RETURN_IF_ERROR(ToTensorflowStatus(NewSampler(&sampler)));
+          sampler_ = std::move(sampler);
+          if (tuning_ != nullptr) {
+            tuning_->Apply(sampler_.get());
+          }
+          return tensorflow::Status::OK();
+        }
+        return ToTensorflowStatus(SamplerPool::Default()->GetOrCreate(
+            sampler_pool_key_,
+            [this](std::unique_ptr<Sampler>* sampler) {
+              return NewSampler(sampler);
+            },
+            &sampler_));
       }
 
       tensorflow::Status GetNextInternal(
@@ -280,22 +392,31 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
           std::vector<tensorflow::Tensor>* out_tensors,
           bool* end_of_sequence) override {
         REVERB_CHECK(sampler_.get() != nullptr) << "Initialize was not called?";
+        if (tuning_ != nullptr) {
+          tuning_->Apply(sampler_.get());
+        }
 
         auto token = ctx->cancellation_manager()->get_cancellation_token();
         bool registered = ctx->cancellation_manager()->RegisterCallback(
-            token, [&] { sampler_->Close(); });
+            token, [&] { CloseSampler(); });
         if (!registered) {
-          sampler_->Close();
+          CloseSampler();
         }
 
         auto status = ToTensorflowStatus(
-            sampler_->GetNextTrajectory(out_tensors, &rate_limited_));
+            batch_size_ > 0
+                ? sampler_->GetNextBatch(batch_size_, out_tensors,
+                                         &rate_limited_)
+                : sampler_->GetNextTrajectory(out_tensors, &rate_limited_));
         if (registered &&
             !ctx->cancellation_manager()->DeregisterCallback(token)) {
           return Cancelled("Iterator context was cancelled");
         }
 
         if (status.ok()) {
+          if (tuning_ != nullptr) {
+            RecordBufferedSamples(ctx, *out_tensors);
+          }
           *end_of_sequence = false;
           return status;
         } else if (sampler_options_.rate_limiter_timeout <
@@ -309,6 +430,16 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
       }
 
      protected:
+      std::shared_ptr<tensorflow::data::model::Node> CreateNode(
+          tensorflow::data::IteratorContext* ctx,
+          tensorflow::data::model::Node::Args args) const override {
+        if (tuning_ == nullptr) {
+          return DatasetIterator<Dataset>::CreateNode(ctx, std::move(args));
+        }
+        return tensorflow::data::model::MakeAsyncKnownRatioNode(
+            std::move(args), /*ratio=*/1, tuning_->parameters());
+      }
+
       tensorflow::Status SaveInternal(
           tensorflow::data::SerializationContext* ctx,
           tensorflow::data::IteratorStateWriter* writer) override {
@@ -326,12 +457,73 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
       }
 
      private:
+      // Reports the change in the number of elements buffered by the sampler
+      // since the last call to the model. `element` stands in for the size of
+      // every buffered element.
+      void RecordBufferedSamples(
+          tensorflow::data::IteratorContext* ctx,
+          const std::vector<tensorflow::Tensor>& element) {
+        const int64_t num_buffered =
+            sampler_->num_buffered_samples() / std::max(batch_size_, 1);
+        for (; num_buffered_ < num_buffered; num_buffered_++) {
+          RecordBufferEnqueue(ctx, element);
+        }
+        for (; num_buffered_ > num_buffered; num_buffered_--) {
+          RecordBufferDequeue(ctx, element);
+        }
+      }
+
+      absl::Status NewSampler(std::unique_ptr<Sampler>* sampler) {
+        constexpr auto kValidationTimeout = absl::Seconds(30);
+        Sampler::Options options = sampler_options_;
+        options.output_allocator = output_allocator_;
+        auto status =
+            client_->NewSampler(table_, options,
+                                /*validation_dtypes=*/dtypes_, shapes_,
+                                kValidationTimeout, sampler);
+        if (absl::IsDeadlineExceeded(status)) {
+          REVERB_LOG(REVERB_WARNING)
+              << "Unable to validate shapes and dtypes of new sampler for '"
+              << table_ << "' as server could not be reached in time ("
+              << kValidationTimeout
+              << "). We were thus unable to fetch signature from server. The "
+                 "sampler will be constructed without validating the dtypes "
+                 "and shapes.";
+          // Ask for a NewSampler with negative validation_timeout Duration,
+          // which causes it to skip the validation and return an OK status.
+          return client_->NewSampler(
+              table_, options,
+              /*validation_timeout=*/-absl::InfiniteDuration(), sampler);
+        }
+        return status;
+      }
+
+      // Closes the sampler. Shared samplers are also removed from the pool so
+      // that iterators created later do not pick up the closed sampler.
+      void CloseSampler() {
+        if (!sampler_pool_key_.empty()) {
+          SamplerPool::Default()->Evict(sampler_pool_key_, sampler_.get());
+        }
+        sampler_->Close();
+      }
+
       Client* client_;
       const std::string& table_;
       const Sampler::Options sampler_options_;
+      const int batch_size_;
+      const bool pin_output_memory_;
       const tensorflow::DataTypeVector& dtypes_;
       const std::vector<tensorflow::PartialTensorShape>& shapes_;
-      std::unique_ptr<Sampler> sampler_;
+      // Key of `sampler_` in `SamplerPool::Default()`, empty if the sampler is
+      // owned by this iterator alone.
+      const std::string sampler_pool_key_;
+      std::shared_ptr<Sampler> sampler_;
+      // Allocator of the output tensors. Only set if `pin_output_memory_`.
+      tensorflow::Allocator* output_allocator_ = nullptr;
+      // Parameters tuned by tf.data. Only set if `tf_data_autotune` is true.
+      const std::unique_ptr<SamplerTuning> tuning_;
+      // Number of buffered elements last reported to the model.
+      int64_t num_buffered_ = 0;
 
       // Whether the most recently returned sample was delayed due to rate
       // limiting or not.
@@ -343,10 +535,23 @@ class ReverbTrajectoryDatasetOp : public tensorflow::data::DatasetOpKernel {
     const std::vector<tensorflow::PartialTensorShape> shapes_;
     const std::string table_;
     const Sampler::Options sampler_options_;
+    const int batch_size_;
+    const bool share_sampler_;
+    const bool pin_output_memory_;
+    const bool tf_data_autotune_;
+    // `shapes_` with the leading batch dimension added if `batch_size_ > 0`.
+    std::vector<tensorflow::PartialTensorShape> output_shapes_;
+    // Key of the shared sampler in `SamplerPool::Default()`. Empty unless
+    // `share_sampler_` is set.
+    std::string sampler_pool_key_;
     std::unique_ptr<Client> client_;
   };  // Dataset.
 
   Sampler::Options sampler_options_;
+  int batch_size_;
+  bool share_sampler_;
+  bool pin_output_memory_;
+  bool tf_data_autotune_;
   tensorflow::DataTypeVector dtypes_;
   std::vector<tensorflow::PartialTensorShape> shapes_;
 
@@ -0,0 +1,381 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/trajectory_writer.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "reverb/cc/chunker.h"
+#include "reverb/cc/client.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/support/tf_util.h"
+#include "tensorflow/core/framework/op.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/resource_op_kernel.h"
+#include "tensorflow/core/framework/shape_inference.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/refcount.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using ::tensorflow::tstring;
+using ::tensorflow::errors::InvalidArgument;
+
+REGISTER_OP("ReverbTrajectoryWriter")
+    .Output("handle: resource")
+    .Attr("server_address: string")
+    .Attr("max_chunk_length: int")
+    .Attr("num_keep_alive_refs: int")
+    .Attr("delta_encode: bool = false")
+    .Attr("container: string = ''")
+    .Attr("shared_name: string = ''")
+    .SetIsStateful()
+    .SetShapeFn(tensorflow::shape_inference::ScalarShape)
+    .Doc(R"doc(
+Constructs a `TrajectoryWriterResource` holding a `TrajectoryWriter` connected
+to `server_address`. The writer, and the stream it inserts over, is kept open
+between op calls so consecutive steps share chunks and uploads are pipelined
+just like with the Python `TrajectoryWriter`.
+)doc");
+
+REGISTER_OP("ReverbTrajectoryWriterAppend")
+    .Attr("T: list(type) >= 1")
+    .Input("handle: resource")
+    .Input("data: T")
+    .SetIsStateful()
+    .Doc(R"doc(
+Appends a step with one tensor per column to the writer. Every call must provide
+the same number of columns with the same dtypes and shapes.
+)doc");
+
+REGISTER_OP("ReverbTrajectoryWriterCreateItem")
+    .Input("handle: resource")
+    .Input("table: string")
+    .Input("priority: double")
+    .Input("num_timesteps: int32")
+    .SetIsStateful()
+    .Doc(R"doc(
+Creates an item in `table` referencing the last `num_timesteps[i]` steps of
+column `i` appended in the current episode. If `num_timesteps` is a scalar then
+it applies to all columns. Columns with 0 timesteps are left out of the item. The item is inserted asynchronously, use
+`ReverbTrajectoryWriterFlush` to wait for it to be confirmed.
+)doc");
+
+REGISTER_OP("ReverbTrajectoryWriterFlush")
+    .Input("handle: resource")
+    .Attr("ignore_last_num_items: int = 0")
+    .SetIsStateful()
+    .Doc(R"doc(
+Blocks until all but the last `ignore_last_num_items` created items have been
+written to the server.
+)doc");
+
+REGISTER_OP("ReverbTrajectoryWriterEndEpisode")
+    .Input("handle: resource")
+    .Attr("clear_buffers: bool = true")
+    .SetIsStateful()
+    .Doc(R"doc(
+Writes all pending items and starts a new episode. Items created after the call
+can only reference steps appended after it.
+)doc");
+
+class TrajectoryWriterResource : public tensorflow::ResourceBase {
+ public:
+  TrajectoryWriterResource(std::string server_address,
+                           int num_keep_alive_refs,
+                           std::unique_ptr<Client> client,
+                           std::unique_ptr<TrajectoryWriter> writer)
+      : server_address_(std::move(server_address)),
+        num_keep_alive_refs_(num_keep_alive_refs),
+        client_(std::move(client)),
+        writer_(std::move(writer)) {}
+
+  std::string DebugString() const override {
+    return absl::StrCat("TrajectoryWriter with server address: ",
+                        server_address_);
+  }
+
+  absl::Status Append(std::vector<tensorflow::Tensor> data)
+      ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    if (!history_.empty() && history_.size() != data.size()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Expected ", history_.size(), " columns but got ",
+                       data.size(), "."));
+    }
+
+    std::vector<absl::optional<tensorflow::Tensor>> columns(
+        std::make_move_iterator(data.begin()),
+        std::make_move_iterator(data.end()));
+    std::vector<absl::optional<std::weak_ptr<CellRef>>> refs;
+    REVERB_RETURN_IF_ERROR(writer_->Append(std::move(columns), &refs));
+
+    history_.resize(refs.size());
+    for (int i = 0; i < refs.size(); i++) {
+      history_[i].push_back(std::move(refs[i].value()));
+      // Older references have expired so they can't be used by items anyway.
+      if (history_[i].size() > num_keep_alive_refs_) {
+        history_[i].pop_front();
+      }
+    }
+    return absl::OkStatus();
+  }
+
+  // `num_timesteps` holds the number of steps of each column, or of all
+  // columns if it only holds a single element and `all_columns` is set.
+  absl::Status CreateItem(absl::string_view table, double priority,
+                          std::vector<int32_t> num_timesteps, bool all_columns)
+      ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    if (all_columns) {
+      num_timesteps.resize(history_.size(), num_timesteps.front());
+    }
+    if (num_timesteps.size() != history_.size()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("num_timesteps must have one element per column (",
+                       history_.size(), ") but got ", num_timesteps.size(),
+                       "."));
+    }
+
+    std::vector<TrajectoryColumn> trajectory;
+    for (int i = 0; i < history_.size(); i++) {
+      if (num_timesteps[i] < 0 || num_timesteps[i] > history_[i].size()) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "num_timesteps[", i, "] must be in [0, ", history_[i].size(),
+            "] but got ", num_timesteps[i], "."));
+      }
+      if (num_timesteps[i] == 0) continue;
+      std::vector<std::weak_ptr<CellRef>> refs(
+          history_[i].end() - num_timesteps[i], history_[i].end());
+      trajectory.emplace_back(std::move(refs), /*squeeze=*/false);
+    }
+    return writer_->CreateItem(table, priority, trajectory);
+  }
+
+  absl::Status Flush(int ignore_last_num_items) ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    return writer_->Flush(ignore_last_num_items);
+  }
+
+  absl::Status EndEpisode(bool clear_buffers) ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    for (auto& column : history_) {
+      column.clear();
+    }
+    return writer_->EndEpisode(clear_buffers);
+  }
+
+ private:
+  const std::string server_address_;
+  const int num_keep_alive_refs_;
+
+  // `TrajectoryWriter` is not thread safe so the ops are serialized.
+  absl::Mutex mu_;
+
+  const std::unique_ptr<Client> client_;
+  const std::unique_ptr<TrajectoryWriter> writer_ ABSL_PT_GUARDED_BY(mu_);
+
+  // References to the steps of each column appended in the current episode,
+  // oldest first.
+  std::vector<std::deque<std::weak_ptr<CellRef>>> history_
+      ABSL_GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(TrajectoryWriterResource);
+};
+
+class TrajectoryWriterHandleOp
+    : public tensorflow::ResourceOpKernel<TrajectoryWriterResource> {
+ public:
+  explicit TrajectoryWriterHandleOp(tensorflow::OpKernelConstruction* context)
+      : tensorflow::ResourceOpKernel<TrajectoryWriterResource>(context) {
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("server_address", &server_address_));
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("max_chunk_length", &max_chunk_length_));
+    OP_REQUIRES_OK(context, context->GetAttr("num_keep_alive_refs",
+                                             &num_keep_alive_refs_));
+    OP_REQUIRES_OK(context, context->GetAttr("delta_encode", &delta_encode_));
+  }
+
+ private:
+  tensorflow::Status CreateResource(TrajectoryWriterResource** ret) override {
+    TrajectoryWriter::Options options;
+    options.chunker_options = std::make_shared<ConstantChunkerOptions>(
+        max_chunk_length_, num_keep_alive_refs_, delta_encode_);
+    TF_RETURN_IF_ERROR(ToTensorflowStatus(options.Validate()));
+
+    auto client = std::make_unique<Client>(server_address_);
+    std::unique_ptr<TrajectoryWriter> writer;
+    TF_RETURN_IF_ERROR(
+        ToTensorflowStatus(client->NewTrajectoryWriter(options, &writer)));
+    *ret = new TrajectoryWriterResource(server_address_, num_keep_alive_refs_,
+                                        std::move(client), std::move(writer));
+    return tensorflow::Status::OK();
+  }
+
+  std::string server_address_;
+  int max_chunk_length_;
+  int num_keep_alive_refs_;
+  bool delta_encode_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(TrajectoryWriterHandleOp);
+};
+
+class TrajectoryWriterAppendOp : public tensorflow::OpKernel {
+ public:
+  explicit TrajectoryWriterAppendOp(tensorflow::OpKernelConstruction* context)
+      : OpKernel(context) {}
+
+  void Compute(tensorflow::OpKernelContext* context) override {
+    TrajectoryWriterResource* resource;
+    OP_REQUIRES_OK(context, LookupResource(context, HandleFromInput(context, 0),
+                                           &resource));
+    tensorflow::core::ScopedUnref unref(resource);
+
+    tensorflow::OpInputList data;
+    OP_REQUIRES_OK(context, context->input_list("data", &data));
+    std::vector<tensorflow::Tensor> tensors(data.begin(), data.end());
+
+    OP_REQUIRES_OK(context,
+                   ToTensorflowStatus(resource->Append(std::move(tensors))));
+  }
+
+  TF_DISALLOW_COPY_AND_ASSIGN(TrajectoryWriterAppendOp);
+};
+
+class TrajectoryWriterCreateItemOp : public tensorflow::OpKernel {
+ public:
+  explicit TrajectoryWriterCreateItemOp(
+      tensorflow::OpKernelConstruction* context)
+      : OpKernel(context) {}
+
+  void Compute(tensorflow::OpKernelContext* context) override {
+    TrajectoryWriterResource* resource;
+    OP_REQUIRES_OK(context, LookupResource(context, HandleFromInput(context, 0),
+                                           &resource));
+    tensorflow::core::ScopedUnref unref(resource);
+
+    const tensorflow::Tensor* table;
+    OP_REQUIRES_OK(context, context->input("table", &table));
+    const tensorflow::Tensor* priority;
+    OP_REQUIRES_OK(context, context->input("priority", &priority));
+    const tensorflow::Tensor* num_timesteps;
+    OP_REQUIRES_OK(context, context->input("num_timesteps", &num_timesteps));
+
+    OP_REQUIRES(
+        context, table->dims() == 0 && priority->dims() == 0,
+        InvalidArgument("Tensors `table` and `priority` must be scalars."));
+    OP_REQUIRES(
+        context, num_timesteps->dims() <= 1,
+        InvalidArgument("Tensor `num_timesteps` must be of rank 0 or 1."));
+
+    auto num_timesteps_t = num_timesteps->flat<tensorflow::int32>();
+    OP_REQUIRES_OK(
+        context,
+        ToTensorflowStatus(resource->CreateItem(
+            table->scalar<tstring>()(), priority->scalar<double>()(),
+            std::vector<int32_t>(num_timesteps_t.data(),
+                                 num_timesteps_t.data() +
+                                     num_timesteps_t.size()),
+            /*all_columns=*/num_timesteps->dims() == 0)));
+  }
+
+  TF_DISALLOW_COPY_AND_ASSIGN(TrajectoryWriterCreateItemOp);
+};
+
+class TrajectoryWriterFlushOp : public tensorflow::OpKernel {
+ public:
+  explicit TrajectoryWriterFlushOp(tensorflow::OpKernelConstruction* context)
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("ignore_last_num_items",
+                                             &ignore_last_num_items_));
+  }
+
+  void Compute(tensorflow::OpKernelContext* context) override {
+    TrajectoryWriterResource* resource;
+    OP_REQUIRES_OK(context, LookupResource(context, HandleFromInput(context, 0),
+                                           &resource));
+    tensorflow::core::ScopedUnref unref(resource);
+
+    OP_REQUIRES_OK(context, ToTensorflowStatus(
+                                resource->Flush(ignore_last_num_items_)));
+  }
+
+ private:
+  int ignore_last_num_items_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(TrajectoryWriterFlushOp);
+};
+
+class TrajectoryWriterEndEpisodeOp : public tensorflow::OpKernel {
+ public:
+  explicit TrajectoryWriterEndEpisodeOp(
+      tensorflow::OpKernelConstruction* context)
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("clear_buffers", &clear_buffers_));
+  }
+
+  void Compute(tensorflow::OpKernelContext* context) override {
+    TrajectoryWriterResource* resource;
+    OP_REQUIRES_OK(context, LookupResource(context, HandleFromInput(context, 0),
+                                           &resource));
+    tensorflow::core::ScopedUnref unref(resource);
+
+    OP_REQUIRES_OK(context,
+                   ToTensorflowStatus(resource->EndEpisode(clear_buffers_)));
+  }
+
+ private:
+  bool clear_buffers_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(TrajectoryWriterEndEpisodeOp);
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("ReverbTrajectoryWriter").Device(tensorflow::DEVICE_CPU),
+    TrajectoryWriterHandleOp);
+
+REGISTER_KERNEL_BUILDER(
+    Name("ReverbTrajectoryWriterAppend").Device(tensorflow::DEVICE_CPU),
+    TrajectoryWriterAppendOp);
+
+REGISTER_KERNEL_BUILDER(
+    Name("ReverbTrajectoryWriterCreateItem").Device(tensorflow::DEVICE_CPU),
+    TrajectoryWriterCreateItemOp);
+
+REGISTER_KERNEL_BUILDER(
+    Name("ReverbTrajectoryWriterFlush").Device(tensorflow::DEVICE_CPU),
+    TrajectoryWriterFlushOp);
+
+REGISTER_KERNEL_BUILDER(
+    Name("ReverbTrajectoryWriterEndEpisode").Device(tensorflow::DEVICE_CPU),
+    TrajectoryWriterEndEpisodeOp);
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
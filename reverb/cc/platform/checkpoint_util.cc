@@ -0,0 +1,257 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/checkpoint_util.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/platform/tfrecord_util.h"
+#include "reverb/cc/platform/zlib.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/dary_heap.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/heap.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/lifo.h"
+#include "reverb/cc/selectors/prioritized.h"
+#include "reverb/cc/selectors/prioritized_btree.h"
+#include "reverb/cc/selectors/recency_weighted.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/philox_bit_gen.h"
+#include "reverb/cc/support/tf_util.h"
+#include "reverb/cc/support/trajectory_util.h"
+#include "reverb/cc/table.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+size_t find_table_index(
+    const std::vector<std::shared_ptr<Table>>* tables,
+    const std::string& name) {
+  for (int i = 0; i < tables->size(); i++) {
+    if (tables->at(i)->name() == name) return i;
+  }
+  return -1;
+}
+
+// Bit generator of the selector, seeded by `options.seed()` if set.
+internal::PhiloxBitGen MakeBitGen(const KeyDistributionOptions& options) {
+  return options.seed() != 0 ? internal::PhiloxBitGen(options.seed())
+                             : internal::PhiloxBitGen();
+}
+
+}  // namespace
+
+std::unique_ptr<ItemSelector> MakeDistribution(
+    const KeyDistributionOptions& options) {
+  switch (options.distribution_case()) {
+    case KeyDistributionOptions::kFifo:
+      return absl::make_unique<FifoSelector>();
+    case KeyDistributionOptions::kLifo:
+      return absl::make_unique<LifoSelector>();
+    case KeyDistributionOptions::kUniform:
+      return absl::make_unique<UniformSelector>(MakeBitGen(options));
+    case KeyDistributionOptions::kPrioritized:
+      return absl::make_unique<PrioritizedSelector>(
+          options.prioritized().priority_exponent(),
+          options.prioritized().batch_sampling(), MakeBitGen(options));
+    case KeyDistributionOptions::kPrioritizedBtree:
+      return absl::make_unique<BTreePrioritizedSelector>(
+          options.prioritized_btree().priority_exponent(),
+          options.prioritized_btree().branching_factor() > 0
+              ? options.prioritized_btree().branching_factor()
+              : BTreePrioritizedSelector::kDefaultBranchingFactor,
+          MakeBitGen(options));
+    case KeyDistributionOptions::kRecencyWeighted:
+      return absl::make_unique<RecencyWeightedSelector>(
+          options.recency_weighted().priority_exponent(),
+          absl::Seconds(options.recency_weighted().decay_seconds()),
+          MakeBitGen(options));
+    case KeyDistributionOptions::kHeap:
+      if (options.heap().arity() > 0) {
+        return absl::make_unique<DaryHeapSelector>(options.heap().min_heap(),
+                                                   options.heap().arity());
+      }
+      return absl::make_unique<HeapSelector>(options.heap().min_heap());
+    case KeyDistributionOptions::DISTRIBUTION_NOT_SET:
+      REVERB_LOG(REVERB_FATAL) << "Selector not set";
+    default:
+      REVERB_LOG(REVERB_FATAL) << "Selector not supported";
+  }
+}
+
+absl::Status LoadTable(PriorityTableCheckpoint* checkpoint,
+                       ChunkStore* chunk_store, std::shared_ptr<Table>* table) {
+  auto sampler = MakeDistribution(checkpoint->sampler());
+  auto remover = MakeDistribution(checkpoint->remover());
+  auto rate_limiter = std::make_shared<RateLimiter>(checkpoint->rate_limiter());
+  auto extensions = (*table)->UnsafeClearExtensions();
+  auto signature =
+      checkpoint->has_signature()
+          ? absl::make_optional(std::move(*checkpoint->mutable_signature()))
+          : absl::nullopt;
+
+  auto loaded_table = std::make_shared<Table>(
+      /*name=*/checkpoint->table_name(),
+      /*sampler=*/std::move(sampler),
+      /*remover=*/std::move(remover),
+      /*max_size=*/checkpoint->max_size(),
+      /*max_times_sampled=*/checkpoint->max_times_sampled(),
+      /*rate_limiter=*/std::move(rate_limiter),
+      /*extensions=*/std::move(extensions),
+      /*signature=*/std::move(signature));
+  loaded_table->set_num_deleted_episodes_from_checkpoint(
+      checkpoint->num_deleted_episodes());
+  loaded_table->set_num_unique_samples_from_checkpoint(
+      checkpoint->num_unique_samples());
+
+  std::vector<Table::Item> items;
+  items.reserve(checkpoint->items_size());
+  for (const auto& checkpoint_item : checkpoint->items()) {
+    items.emplace_back();
+    Table::Item& insert_item = items.back();
+    insert_item.item = checkpoint_item;
+
+    if (insert_item.item.has_deprecated_sequence_range() &&
+        insert_item.item.has_flat_trajectory()) {
+      return absl::InternalError(
+          absl::StrCat("Item ", insert_item.item.key(),
+                       " has both deprecated and new trajectory format: ",
+                       insert_item.item.DebugString(), "."));
+    }
+
+    if (insert_item.item.has_deprecated_sequence_range()) {
+      std::vector<std::shared_ptr<ChunkStore::Chunk>> trajectory_chunks;
+      REVERB_RETURN_IF_ERROR(FromTensorflowStatus(chunk_store->Get(
+          insert_item.item.deprecated_chunk_keys(), &trajectory_chunks)));
+
+      *insert_item.item.mutable_flat_trajectory() =
+          FlatTimestepTrajectory(
+              trajectory_chunks,
+              insert_item.item.deprecated_sequence_range().offset(),
+              insert_item.item.deprecated_sequence_range().length());
+
+      insert_item.item.clear_deprecated_sequence_range();
+      insert_item.item.clear_deprecated_chunk_keys();
+    }
+
+    auto status = FromTensorflowStatus(chunk_store->Get(
+        GetChunkKeys(insert_item.item.flat_trajectory()),
+        &insert_item.chunks));
+    if (!status.ok()) {
+      return absl::DataLossError(absl::StrCat(
+          "Checkpointer::Load: item ", insert_item.item.key(),
+          " references missing chunk: ", status.message()));
+    }
+  }
+
+  // The original table has already been destroyed so if this fails then
+  // there is way to recover.
+  REVERB_RETURN_IF_ERROR(loaded_table->InsertCheckpointItems(std::move(items)));
+  REVERB_RETURN_IF_ERROR(loaded_table->SetMaxBytes(checkpoint->max_bytes()));
+  // Snapshot sampling is configured when the table is constructed rather than
+  // stored in the checkpoint.
+  if ((*table)->snapshot_sampling()) {
+    REVERB_RETURN_IF_ERROR(loaded_table->SetSnapshotSampling(true));
+  }
+
+  table->swap(loaded_table);
+  return absl::OkStatus();
+}
+
+absl::Status LoadTables(const std::string& filename, ChunkStore* chunk_store,
+                        std::vector<std::shared_ptr<Table>>* tables,
+                        bool compressed) {
+  RecordReaderUniquePtr table_reader;
+  REVERB_RETURN_IF_ERROR(OpenReader(filename, &table_reader));
+
+  // Parse all the table checkpoints before building the tables in parallel.
+  std::vector<PriorityTableCheckpoint> checkpoints;
+  std::vector<int> indices;
+  absl::Status table_status;
+  tensorflow::uint64 table_offset = 0;
+  tensorflow::tstring table_record;
+  std::string uncompressed;
+  do {
+    const tensorflow::uint64 record_offset = table_offset;
+    table_status = FromTensorflowStatus(
+        table_reader->ReadRecord(&table_offset, &table_record));
+    if (!table_status.ok()) break;
+    absl::string_view serialized = table_record;
+    if (compressed) {
+      uncompressed.clear();
+      if (!ZlibUncompressToString(serialized, &uncompressed)) {
+        return absl::DataLossError(
+            absl::StrCat("Could not uncompress table record at offset ",
+                         record_offset, " of ", filename, "."));
+      }
+      serialized = uncompressed;
+    }
+    checkpoints.emplace_back();
+    PriorityTableCheckpoint& checkpoint = checkpoints.back();
+    if (!checkpoint.ParseFromArray(serialized.data(), serialized.size())) {
+      return absl::DataLossError(
+          absl::StrCat("Could not parse TFRecord as Checkpoint: '",
+                       serialized, "'"));
+    }
+
+    int index = find_table_index(tables, checkpoint.table_name());
+    if (index == -1) {
+      std::vector<std::string> table_names;
+      for (const auto& table : *tables) {
+        table_names.push_back(absl::StrCat("'", table->name(), "'"));
+      }
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Trying to load table ", checkpoint.table_name(),
+          " but table was not found in provided list of tables. Available "
+          "tables: [",
+          absl::StrJoin(table_names, ", "), "]"));
+    }
+    indices.push_back(index);
+  } while (table_status.ok());
+
+  if (!absl::IsOutOfRange(table_status)) {
+    return table_status;
+  }
+  if (checkpoints.empty()) {
+    return absl::OkStatus();
+  }
+
+  return RunInParallel(
+      checkpoints.size(), "Checkpointer_LoadTable", [&](int i) {
+        return LoadTable(&checkpoints[i], chunk_store, &tables->at(indices[i]));
+      });
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,57 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_PLATFORM_CHECKPOINT_UTIL_H_
+#define REVERB_CC_PLATFORM_CHECKPOINT_UTIL_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/table.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Helpers for restoring tables which are shared by the checkpointers.
+
+// Constructs a new selector from the options stored in a checkpoint.
+std::unique_ptr<ItemSelector> MakeDistribution(
+    const KeyDistributionOptions& options);
+
+// Replaces `table` with a table restored from `checkpoint`. All chunks
+// referenced by the checkpointed items must be present in `chunk_store`.
+absl::Status LoadTable(PriorityTableCheckpoint* checkpoint,
+                       ChunkStore* chunk_store, std::shared_ptr<Table>* table);
+
+// Reads the PriorityTableCheckpoint records stored in the TFRecord file
+// `filename` and replaces the table of the same name in `tables` with the
+// restored table. The tables are restored in parallel. All chunks referenced
+// by the items must already be present in `chunk_store`. If `compressed` then
+// every record is a zlib compressed PriorityTableCheckpoint.
+absl::Status LoadTables(const std::string& filename, ChunkStore* chunk_store,
+                        std::vector<std::shared_ptr<Table>>* tables,
+                        bool compressed = false);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_CHECKPOINT_UTIL_H_
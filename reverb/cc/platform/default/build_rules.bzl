@@ -277,6 +277,54 @@ def reverb_cc_test(name, srcs, deps = [], **kwargs):
         **kwargs
     )
 
+def reverb_cc_binary(name, srcs, deps = [], **kwargs):
+    """Reverb-specific version of cc_binary.
+
+    Args:
+      name: Target name.
+      srcs: Target sources.
+      deps: Target deps.
+      **kwargs: Additional args to cc_binary.
+    """
+    new_deps = [
+        "@tensorflow_includes//:includes",
+        "@tensorflow_solib//:framework_lib",
+    ]
+    native.cc_binary(
+        name = name,
+        copts = tf_copts(),
+        srcs = srcs,
+        deps = depset(deps + new_deps),
+        **kwargs
+    )
+
+def reverb_cc_benchmark(name, srcs, deps = [], **kwargs):
+    """Reverb-specific version of a Google Benchmark binary.
+
+    Benchmarks are not run as part of the test suite. Build them with `-c opt`
+    and run them directly, e.g. with `--benchmark_format=json` to compare the
+    results of two commits.
+
+    Args:
+      name: Target name.
+      srcs: Target sources.
+      deps: Target deps.
+      **kwargs: Additional args to cc_binary.
+    """
+    new_deps = [
+        "@com_github_google_benchmark//:benchmark_main",
+        "@tensorflow_includes//:includes",
+        "@tensorflow_solib//:framework_lib",
+    ]
+    native.cc_binary(
+        name = name,
+        copts = tf_copts(),
+        srcs = srcs,
+        testonly = 1,
+        deps = depset(deps + new_deps),
+        **kwargs
+    )
+
 def reverb_gen_op_wrapper_py(name, out, kernel_lib, linkopts = [], **kwargs):
     """Generates the py_library `name` with a data dep on the ops in kernel_lib.
 
@@ -520,6 +568,7 @@ def reverb_py_test(
 
 def reverb_pybind_deps():
     return [
+        "@dlpack",
         "@pybind11",
     ]
 
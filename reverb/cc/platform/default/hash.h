@@ -15,6 +15,9 @@
 #ifndef REVERB_CC_PLATFORM_DEFAULT_HASH_H_
 #define REVERB_CC_PLATFORM_DEFAULT_HASH_H_
 
+#include <cstdint>
+#include <functional>
+
 #include "absl/strings/cord.h"
 #include "absl/strings/string_view.h"
 #include "tensorflow/core/platform/hash.h"
@@ -30,6 +33,27 @@ struct HashEq {
   using Eq = std::equal_to<T>;
 };
 
+// Hash of the 64-bit keys of items, chunks and episodes. `tensorflow::hash`
+// falls back to `std::hash`, which is the identity for integers, and the hash
+// tables select the group to probe from the high bits of the hash. That is
+// fine for uniformly random keys but keys allocated in consecutive ranges
+// (e.g. chunk keys, see `KeyRangeAllocator`) or small integers then all start
+// probing from the same group. A single multiplication (Fibonacci hashing)
+// folded onto the low bits spreads them over both ends of the hash while
+// costing less than a general purpose hash.
+struct KeyHash {
+  size_t operator()(uint64_t key) const {
+    const uint64_t h = key * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 32);
+  }
+};
+
+template <>
+struct HashEq<uint64_t> {
+  using Hash = KeyHash;
+  using Eq = std::equal_to<uint64_t>;
+};
+
 struct StringHash {
   using is_transparent = void;
 
@@ -0,0 +1,232 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/http_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/thread.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// How often the serving thread checks whether it has been stopped.
+constexpr int kPollTimeoutMs = 100;
+
+// Requests (request line and headers) larger than this are rejected.
+constexpr size_t kMaxRequestSize = 16 * 1024;
+
+absl::Status ErrnoToStatus(absl::string_view what) {
+  return absl::InternalError(absl::StrCat(what, " failed: ", strerror(errno)));
+}
+
+void WriteAll(int fd, absl::string_view data) {
+  while (!data.empty()) {
+    const ssize_t n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return;
+    data.remove_prefix(n);
+  }
+}
+
+std::string MakeResponse(absl::string_view status,
+                         absl::string_view content_type,
+                         absl::string_view body) {
+  return absl::StrCat("HTTP/1.1 ", status, "\r\nContent-Type: ", content_type,
+                      "\r\nContent-Length: ", body.size(),
+                      "\r\nConnection: close\r\n\r\n", body);
+}
+
+absl::string_view HttpStatus(const absl::Status& status) {
+  switch (status.code()) {
+    case absl::StatusCode::kInvalidArgument:
+      return "400 Bad Request";
+    case absl::StatusCode::kFailedPrecondition:
+      return "409 Conflict";
+    default:
+      return "500 Internal Server Error";
+  }
+}
+
+// Parses "<key>=<value>&<key>=<value>". Keys without a value map to an empty
+// string and later occurrences of a key win.
+std::map<std::string, std::string> ParseQuery(absl::string_view query) {
+  std::map<std::string, std::string> parameters;
+  for (absl::string_view parameter :
+       absl::StrSplit(query, '&', absl::SkipEmpty())) {
+    std::pair<std::string, std::string> key_value =
+        absl::StrSplit(parameter, absl::MaxSplits('=', 1));
+    parameters[key_value.first] = std::move(key_value.second);
+  }
+  return parameters;
+}
+
+class HttpServerImpl : public HttpServer {
+ public:
+  HttpServerImpl(int fd, int port, std::map<std::string, HttpHandler> handlers)
+      : fd_(fd), port_(port), handlers_(std::move(handlers)) {
+    thread_ = StartThread("HttpServer", [this] { Serve(); });
+  }
+
+  ~HttpServerImpl() override { Stop(); }
+
+  int port() const override { return port_; }
+
+  void Stop() override {
+    stop_ = true;
+    thread_ = nullptr;  // Joins the thread.
+    if (fd_ >= 0) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+ private:
+  void Serve() {
+    while (!stop_) {
+      pollfd listener = {fd_, POLLIN, 0};
+      if (poll(&listener, 1, kPollTimeoutMs) <= 0) continue;
+      const int connection = accept(fd_, nullptr, nullptr);
+      if (connection < 0) continue;
+      HandleConnection(connection);
+      close(connection);
+    }
+  }
+
+  void HandleConnection(int connection) {
+    std::string request;
+    char buffer[1024];
+    while (!absl::StrContains(request, "\r\n\r\n")) {
+      pollfd readable = {connection, POLLIN, 0};
+      if (request.size() > kMaxRequestSize ||
+          poll(&readable, 1, kPollTimeoutMs * 10) <= 0) {
+        return;
+      }
+      const ssize_t n = recv(connection, buffer, sizeof(buffer), 0);
+      if (n <= 0) return;
+      request.append(buffer, n);
+    }
+
+    // The request line has the format "<method> <target> <version>".
+    std::vector<absl::string_view> request_line = absl::StrSplit(
+        absl::string_view(request).substr(0, request.find("\r\n")), ' ');
+    if (request_line.size() != 3 || request_line[0] != "GET") {
+      WriteAll(connection, MakeResponse("405 Method Not Allowed", "text/plain",
+                                        "Only GET is supported.\n"));
+      return;
+    }
+    const size_t query_start = request_line[1].find('?');
+    auto it =
+        handlers_.find(std::string(request_line[1].substr(0, query_start)));
+    if (it == handlers_.end()) {
+      WriteAll(connection,
+               MakeResponse("404 Not Found", "text/plain", "Not found.\n"));
+      return;
+    }
+    std::string body;
+    auto status = it->second.handler(
+        query_start == absl::string_view::npos
+            ? std::map<std::string, std::string>()
+            : ParseQuery(request_line[1].substr(query_start + 1)),
+        &body);
+    if (!status.ok()) {
+      WriteAll(connection,
+               MakeResponse(HttpStatus(status), "text/plain",
+                            absl::StrCat(status.message(), "\n")));
+      return;
+    }
+    WriteAll(connection, MakeResponse("200 OK", it->second.content_type, body));
+  }
+
+  int fd_;
+  const int port_;
+  const std::map<std::string, HttpHandler> handlers_;
+  std::atomic<bool> stop_{false};
+  std::unique_ptr<Thread> thread_;
+};
+
+}  // namespace
+
+absl::Status StartHttpServer(int port, std::string path,
+                             std::string content_type,
+                             std::function<std::string()> handler,
+                             std::unique_ptr<HttpServer>* server) {
+  std::map<std::string, HttpHandler> handlers;
+  handlers[std::move(path)] = HttpHandler{
+      std::move(content_type),
+      [handler = std::move(handler)](
+          const std::map<std::string, std::string>& query, std::string* body) {
+        *body = handler();
+        return absl::OkStatus();
+      }};
+  return StartHttpServer(port, std::move(handlers), server);
+}
+
+absl::Status StartHttpServer(int port,
+                             std::map<std::string, HttpHandler> handlers,
+                             std::unique_ptr<HttpServer>* server) {
+  const int fd = socket(AF_INET6, SOCK_STREAM, 0);
+  if (fd < 0) return ErrnoToStatus("socket");
+
+  // Accept IPv4 connections as well and allow quick restarts on the same port.
+  int zero = 0, one = 1;
+  setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  sockaddr_in6 address = {};
+  address.sin6_family = AF_INET6;
+  address.sin6_addr = in6addr_any;
+  address.sin6_port = htons(port);
+  socklen_t length = sizeof(address);
+  if (bind(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 ||
+      listen(fd, SOMAXCONN) != 0 ||
+      getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+    auto status = ErrnoToStatus(absl::StrCat("Listening on port ", port));
+    close(fd);
+    return status;
+  }
+
+  *server = std::make_unique<HttpServerImpl>(fd, ntohs(address.sin6_port),
+                                             std::move(handlers));
+  REVERB_LOG(REVERB_INFO) << "Started HTTP server on port "
+                          << (*server)->port();
+  return absl::OkStatus();
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
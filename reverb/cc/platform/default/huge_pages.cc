@@ -0,0 +1,46 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/huge_pages.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Size of a transparent huge page on x86-64 and (with 4K base pages) arm64.
+constexpr uintptr_t kHugePageSize = uintptr_t{2} << 20;
+
+void AdviseHugePages(void* data, size_t size) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+  const uintptr_t aligned_begin =
+      (begin + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  const uintptr_t aligned_end = (begin + size) & ~(kHugePageSize - 1);
+  if (aligned_begin >= aligned_end) return;
+  madvise(reinterpret_cast<void*>(aligned_begin), aligned_end - aligned_begin,
+          MADV_HUGEPAGE);
+#endif
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,71 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/numa.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+absl::Status ParseCpuList(absl::string_view list, std::vector<int>* cpus) {
+  cpus->clear();
+  for (absl::string_view range :
+       absl::StrSplit(absl::StripAsciiWhitespace(list), ',', absl::SkipEmpty())) {
+    std::vector<absl::string_view> bounds = absl::StrSplit(range, '-');
+    int first, last;
+    if (bounds.size() > 2 || !absl::SimpleAtoi(bounds.front(), &first) ||
+        !absl::SimpleAtoi(bounds.back(), &last) || first < 0 || last < first) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid CPU list '", list, "'."));
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(cpu);
+    }
+  }
+  std::sort(cpus->begin(), cpus->end());
+  cpus->erase(std::unique(cpus->begin(), cpus->end()), cpus->end());
+  return absl::OkStatus();
+}
+
+absl::Status GetNumaNodeCpus(int node, std::vector<int>* cpus) {
+  const std::string path =
+      absl::StrCat("/sys/devices/system/node/node", node, "/cpulist");
+  std::ifstream file(path);
+  if (node < 0 || !file) {
+    return absl::NotFoundError(absl::StrCat("NUMA node ", node,
+                                            " does not exist (could not read ",
+                                            path, ")."));
+  }
+  std::stringstream content;
+  content << file.rdbuf();
+  return ParseCpuList(content.str(), cpus);
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
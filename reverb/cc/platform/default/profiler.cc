@@ -0,0 +1,514 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/profiler.h"
+
+#include <execinfo.h>
+#include <malloc.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/time.h>
+#include <ucontext.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/debugging/symbolize.h"
+#include "absl/status/status.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/platform/thread.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+constexpr int kMaxCpuProfileFrequencyHz = 4000;
+
+// Deeper stacks are truncated.
+constexpr int kMaxDepth = 64;
+
+// Length of the thread names (including the terminating null) in the samples.
+constexpr size_t kThreadNameSize = 32;
+
+// Number of distinct stacks a profile can hold. Samples of new stacks are
+// dropped (and counted) once the table is full.
+constexpr int kNumSlots = 4096;
+
+// Number of slots the signal handler probes before dropping a sample.
+constexpr int kMaxProbes = 64;
+
+// A distinct (stack, thread) in the profile. Slots are claimed and filled by
+// the signal handler, so they use plain arrays and atomics only.
+struct Slot {
+  enum State { kEmpty, kWriting, kReady };
+
+  std::atomic<int> state{kEmpty};
+  uint64_t hash;
+  int depth;
+  void* pcs[kMaxDepth];
+  char thread[kThreadNameSize];
+  std::atomic<int64_t> count{0};
+};
+
+struct CpuProfileState {
+  std::atomic<bool> enabled{false};
+  std::atomic<int> handlers_running{0};
+  std::atomic<int64_t> num_dropped{0};
+  Slot slots[kNumSlots];
+};
+
+// Allocated by the first profile and never deleted, so the signal handler can
+// never access freed memory.
+std::atomic<CpuProfileState*> cpu_profile_state{nullptr};
+
+ABSL_CONST_INIT absl::Mutex cpu_profile_mu(absl::kConstInit);
+bool cpu_profiling ABSL_GUARDED_BY(cpu_profile_mu) = false;
+bool handler_installed ABSL_GUARDED_BY(cpu_profile_mu) = false;
+int cpu_profile_frequency_hz ABSL_GUARDED_BY(cpu_profile_mu) = 0;
+absl::Time cpu_profile_start ABSL_GUARDED_BY(cpu_profile_mu);
+
+uint64_t HashSample(void* const* pcs, int depth, const char* thread) {
+  // FNV-1a.
+  uint64_t hash = 14695981039346656037ULL;
+  auto mix = [&hash](uint64_t value) {
+    hash ^= value;
+    hash *= 1099511628211ULL;
+  };
+  for (int i = 0; i < depth; i++) mix(reinterpret_cast<uintptr_t>(pcs[i]));
+  for (const char* c = thread; *c != '\0'; c++) mix(*c);
+  return hash;
+}
+
+// Program counter of the code which was interrupted by the signal.
+void* InterruptedPc(const void* ucontext) {
+  const auto* context = static_cast<const ucontext_t*>(ucontext);
+#if defined(__x86_64__)
+  return reinterpret_cast<void*>(context->uc_mcontext.gregs[REG_RIP]);
+#elif defined(__aarch64__)
+  return reinterpret_cast<void*>(context->uc_mcontext.pc);
+#else
+  return nullptr;
+#endif
+}
+
+// Sets `pcs` to the stack of the interrupted code (innermost frame first) and
+// returns its depth.
+int UnwindInterruptedStack(const void* ucontext, void** pcs) {
+  // The libgcc unwinder follows the call frame information, so unlike frame
+  // pointer based unwinders it also handles code compiled without frame
+  // pointers and steps through the signal frame. The stack starts with the
+  // frames of the handler.
+  void* stack[kMaxDepth + 8];
+  const int depth = backtrace(stack, kMaxDepth + 8);
+  int start = 0;
+  const void* pc = InterruptedPc(ucontext);
+  while (start < depth && stack[start] != pc) start++;
+  if (start == depth) start = std::min(depth, 3);  // Handler and trampoline.
+
+  const int interrupted_depth = std::min(depth - start, kMaxDepth);
+  std::memcpy(pcs, stack + start, interrupted_depth * sizeof(stack[0]));
+  return interrupted_depth;
+}
+
+// Everything called from here must be async-signal-safe.
+void RecordSample(CpuProfileState* state, const void* ucontext) {
+  void* pcs[kMaxDepth];
+  const int depth = UnwindInterruptedStack(ucontext, pcs);
+
+  char thread[kThreadNameSize] = {};
+  const char* name = CurrentThreadName();
+  if (name[0] != '\0') {
+    for (size_t i = 0; i + 1 < kThreadNameSize && name[i] != '\0'; i++) {
+      thread[i] = name[i];
+    }
+  } else {
+    // The kernel name has at most 16 bytes (including the null).
+    prctl(PR_GET_NAME, thread);
+  }
+
+  const uint64_t hash = HashSample(pcs, depth, thread);
+  for (int probe = 0; probe < kMaxProbes; probe++) {
+    Slot& slot = state->slots[(hash + probe) % kNumSlots];
+    int slot_state = slot.state.load(std::memory_order_acquire);
+    if (slot_state == Slot::kEmpty &&
+        slot.state.compare_exchange_strong(slot_state, Slot::kWriting,
+                                           std::memory_order_acquire)) {
+      slot.hash = hash;
+      slot.depth = depth;
+      std::memcpy(slot.pcs, pcs, depth * sizeof(pcs[0]));
+      std::memcpy(slot.thread, thread, sizeof(thread));
+      slot.count.store(1, std::memory_order_relaxed);
+      slot.state.store(Slot::kReady, std::memory_order_release);
+      return;
+    }
+    // Slots which are being written by other threads are skipped, which at
+    // worst splits the samples of a stack over two slots.
+    if (slot_state == Slot::kReady && slot.hash == hash &&
+        slot.depth == depth &&
+        std::memcmp(slot.pcs, pcs, depth * sizeof(pcs[0])) == 0 &&
+        std::strcmp(slot.thread, thread) == 0) {
+      slot.count.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+  state->num_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void HandleProfilingSignal(int signal, siginfo_t* info, void* ucontext) {
+  const int saved_errno = errno;
+  CpuProfileState* state = cpu_profile_state.load(std::memory_order_acquire);
+  if (state != nullptr) {
+    state->handlers_running.fetch_add(1, std::memory_order_acq_rel);
+    if (state->enabled.load(std::memory_order_acquire)) {
+      RecordSample(state, ucontext);
+    }
+    state->handlers_running.fetch_sub(1, std::memory_order_acq_rel);
+  }
+  errno = saved_errno;
+}
+
+absl::Status SetProfilingTimer(int frequency_hz) {
+  itimerval timer = {};
+  if (frequency_hz > 0) {
+    timer.it_interval.tv_usec = 1000000 / frequency_hz;
+    timer.it_value = timer.it_interval;
+  }
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    return absl::InternalError(
+        absl::StrCat("setitimer failed: ", std::strerror(errno)));
+  }
+  return absl::OkStatus();
+}
+
+// The handler is installed once and stays installed: restoring the default
+// action (which terminates the process) could kill the process when a signal
+// of the last timer interval is still pending.
+absl::Status InstallHandler() ABSL_EXCLUSIVE_LOCKS_REQUIRED(cpu_profile_mu) {
+  if (handler_installed) return absl::OkStatus();
+
+  struct sigaction current;
+  sigaction(SIGPROF, nullptr, &current);
+  if ((current.sa_flags & SA_SIGINFO) != 0 ||
+      (current.sa_handler != SIG_DFL && current.sa_handler != SIG_IGN)) {
+    return absl::FailedPreconditionError(
+        "SIGPROF is already handled by another profiler.");
+  }
+
+  struct sigaction action = {};
+  action.sa_sigaction = HandleProfilingSignal;
+  action.sa_flags = SA_RESTART | SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, nullptr) != 0) {
+    return absl::InternalError(
+        absl::StrCat("sigaction failed: ", std::strerror(errno)));
+  }
+  handler_installed = true;
+  return absl::OkStatus();
+}
+
+// Encodes messages of profile.proto
+// (https://github.com/google/pprof/blob/main/proto/profile.proto).
+class ProfileBuilder {
+ public:
+  ProfileBuilder() { String(""); }
+
+  // Index of `value` in the string table.
+  int64_t String(absl::string_view value) {
+    auto [it, inserted] =
+        string_ids_.emplace(std::string(value), string_ids_.size());
+    if (inserted) AppendBytes(6, value, &profile_);
+    return it->second;
+  }
+
+  void AddSampleType(absl::string_view type, absl::string_view unit) {
+    AppendBytes(1, ValueType(type, unit), &profile_);
+  }
+
+  void SetPeriod(absl::string_view type, absl::string_view unit,
+                 int64_t period) {
+    AppendBytes(11, ValueType(type, unit), &profile_);
+    AppendVarint(12, period, &profile_);
+  }
+
+  void SetTime(absl::Time start, absl::Duration duration) {
+    AppendVarint(9, absl::ToUnixNanos(start), &profile_);
+    AppendVarint(10, absl::ToInt64Nanoseconds(duration), &profile_);
+  }
+
+  // Id of the location at `address` in `function`. Locations are interned by
+  // address.
+  uint64_t Location(uintptr_t address, absl::string_view function) {
+    auto [it, inserted] =
+        location_ids_.emplace(address, location_ids_.size() + 1);
+    if (!inserted) return it->second;
+
+    auto [function_it, new_function] = function_ids_.emplace(
+        std::string(function), function_ids_.size() + 1);
+    if (new_function) {
+      std::string message;
+      AppendVarint(1, function_it->second, &message);
+      AppendVarint(2, String(function), &message);
+      AppendVarint(3, String(function), &message);
+      AppendBytes(5, message, &profile_);
+    }
+
+    std::string line;
+    AppendVarint(1, function_it->second, &line);
+    std::string message;
+    AppendVarint(1, it->second, &message);
+    AppendVarint(2, kMappingId, &message);
+    AppendVarint(3, address, &message);
+    AppendBytes(4, line, &message);
+    AppendBytes(4, message, &profile_);
+    return it->second;
+  }
+
+  // `locations` starts at the leaf. `labels` are (key, value) pairs.
+  void AddSample(
+      absl::Span<const uint64_t> locations, absl::Span<const int64_t> values,
+      absl::Span<const std::pair<absl::string_view, absl::string_view>>
+          labels) {
+    std::string message;
+    AppendPacked(1, locations, &message);
+    AppendPacked(2, values, &message);
+    for (const auto& [key, value] : labels) {
+      std::string label;
+      AppendVarint(1, String(key), &label);
+      AppendVarint(2, String(value), &label);
+      AppendBytes(3, label, &message);
+    }
+    AppendBytes(2, message, &profile_);
+  }
+
+  // Returns the serialized profile. The builder must not be used afterwards.
+  std::string Finish() {
+    // All locations are symbolized, a single mapping covering the address
+    // space tells pprof not to look for the binaries.
+    std::string mapping;
+    AppendVarint(1, kMappingId, &mapping);
+    AppendVarint(3, UINT64_MAX, &mapping);
+    AppendVarint(5, String("[reverb]"), &mapping);
+    AppendVarint(7, 1, &mapping);
+    AppendBytes(3, mapping, &profile_);
+    return std::move(profile_);
+  }
+
+ private:
+  static constexpr uint64_t kMappingId = 1;
+
+  static void AppendRawVarint(uint64_t value, std::string* out) {
+    while (value >= 0x80) {
+      out->push_back(static_cast<char>(value | 0x80));
+      value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+  }
+
+  static void AppendVarint(int field, uint64_t value, std::string* out) {
+    AppendRawVarint(field << 3, out);
+    AppendRawVarint(value, out);
+  }
+
+  static void AppendBytes(int field, absl::string_view value,
+                          std::string* out) {
+    AppendRawVarint((field << 3) | 2, out);
+    AppendRawVarint(value.size(), out);
+    out->append(value.data(), value.size());
+  }
+
+  template <typename T>
+  static void AppendPacked(int field, absl::Span<const T> values,
+                           std::string* out) {
+    std::string packed;
+    for (T value : values) AppendRawVarint(value, &packed);
+    AppendBytes(field, packed, out);
+  }
+
+  std::string ValueType(absl::string_view type, absl::string_view unit) {
+    std::string message;
+    AppendVarint(1, String(type), &message);
+    AppendVarint(2, String(unit), &message);
+    return message;
+  }
+
+  std::string profile_;
+  absl::flat_hash_map<std::string, int64_t> string_ids_;
+  absl::flat_hash_map<uintptr_t, uint64_t> location_ids_;
+  absl::flat_hash_map<std::string, uint64_t> function_ids_;
+};
+
+std::string SymbolName(const void* pc) {
+  char name[1024];
+  if (absl::Symbolize(pc, name, sizeof(name))) return name;
+  return absl::StrCat("0x", absl::Hex(reinterpret_cast<uintptr_t>(pc)));
+}
+
+}  // namespace
+
+absl::Status StartCpuProfile(int frequency_hz) {
+  if (frequency_hz <= 0 || frequency_hz > kMaxCpuProfileFrequencyHz) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("frequency_hz must be in [1, ", kMaxCpuProfileFrequencyHz,
+                     "] but got ", frequency_hz, "."));
+  }
+
+  absl::MutexLock lock(&cpu_profile_mu);
+  if (cpu_profiling) {
+    return absl::FailedPreconditionError(
+        "A CPU profile is already being collected.");
+  }
+  REVERB_RETURN_IF_ERROR(InstallHandler());
+
+  CpuProfileState* state = cpu_profile_state.load();
+  if (state == nullptr) {
+    state = new CpuProfileState;
+    cpu_profile_state.store(state, std::memory_order_release);
+  }
+  for (Slot& slot : state->slots) {
+    slot.state.store(Slot::kEmpty, std::memory_order_relaxed);
+  }
+  state->num_dropped = 0;
+
+  // The first call of `backtrace` loads the unwinder, which allocates and must
+  // not happen in the signal handler. Later calls are async-signal-safe as long
+  // as the unwinder looks up the frame information without taking the loader
+  // lock (glibc 2.35 and later).
+  void* pc;
+  backtrace(&pc, 1);
+
+  state->enabled.store(true, std::memory_order_release);
+  if (auto status = SetProfilingTimer(frequency_hz); !status.ok()) {
+    state->enabled = false;
+    return status;
+  }
+  cpu_profiling = true;
+  cpu_profile_frequency_hz = frequency_hz;
+  cpu_profile_start = absl::Now();
+  return absl::OkStatus();
+}
+
+absl::Status StopCpuProfile(std::string* profile) {
+  absl::MutexLock lock(&cpu_profile_mu);
+  if (!cpu_profiling) {
+    return absl::FailedPreconditionError("No CPU profile is being collected.");
+  }
+  SetProfilingTimer(0).IgnoreError();
+  CpuProfileState* state = cpu_profile_state.load();
+  state->enabled.store(false, std::memory_order_release);
+  while (state->handlers_running.load(std::memory_order_acquire) > 0) {
+    sched_yield();
+  }
+  cpu_profiling = false;
+
+  const int64_t period_ns = 1000000000 / cpu_profile_frequency_hz;
+  ProfileBuilder builder;
+  builder.AddSampleType("samples", "count");
+  builder.AddSampleType("cpu", "nanoseconds");
+  builder.SetPeriod("cpu", "nanoseconds", period_ns);
+  builder.SetTime(cpu_profile_start, absl::Now() - cpu_profile_start);
+
+  absl::flat_hash_map<const void*, std::string> symbols;
+  std::vector<uint64_t> locations;
+  for (const Slot& slot : state->slots) {
+    if (slot.state.load(std::memory_order_acquire) != Slot::kReady) continue;
+    locations.clear();
+    for (int i = 0; i < slot.depth; i++) {
+      // All but the innermost frame hold return addresses, which are
+      // symbolized as the call instruction that precedes them.
+      const void* pc = static_cast<const char*>(slot.pcs[i]) - (i > 0 ? 1 : 0);
+      auto it = symbols.find(pc);
+      if (it == symbols.end()) it = symbols.emplace(pc, SymbolName(pc)).first;
+      locations.push_back(
+          builder.Location(reinterpret_cast<uintptr_t>(pc), it->second));
+    }
+    const int64_t count = slot.count.load(std::memory_order_relaxed);
+    const std::string thread_pool = ThreadPoolOfName(slot.thread);
+    const std::pair<absl::string_view, absl::string_view> labels[] = {
+        {"thread", slot.thread}, {"thread_pool", thread_pool}};
+    const int64_t values[] = {count, count * period_ns};
+    builder.AddSample(locations, values, labels);
+  }
+  if (state->num_dropped > 0) {
+    const int64_t dropped = state->num_dropped;
+    const uint64_t location = builder.Location(0, "[dropped samples]");
+    const int64_t values[] = {dropped, dropped * period_ns};
+    builder.AddSample(absl::MakeConstSpan(&location, 1), values, {});
+  }
+  *profile = builder.Finish();
+  return absl::OkStatus();
+}
+
+bool IsCpuProfiling() {
+  absl::MutexLock lock(&cpu_profile_mu);
+  return cpu_profiling;
+}
+
+absl::Status CollectHeapProfile(std::string* profile) {
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  const struct mallinfo2 info = mallinfo2();
+  ProfileBuilder builder;
+  builder.AddSampleType("inuse_space", "bytes");
+  builder.SetPeriod("space", "bytes", 1);
+  builder.SetTime(absl::Now(), absl::ZeroDuration());
+  const std::pair<absl::string_view, size_t> states[] = {
+      {"[malloc in use]", info.uordblks},
+      {"[mmap in use]", info.hblkhd},
+      {"[free retained]", info.fordblks},
+  };
+  // The locations need distinct (fake) addresses as they are interned by
+  // address.
+  uintptr_t address = 1;
+  for (const auto& [state, bytes] : states) {
+    const uint64_t location = builder.Location(address++, state);
+    const int64_t values[] = {static_cast<int64_t>(bytes)};
+    builder.AddSample(absl::MakeConstSpan(&location, 1), values, {});
+  }
+  *profile = builder.Finish();
+  return absl::OkStatus();
+#else
+  return absl::UnimplementedError(
+      "Heap profiles require glibc 2.33 or later.");
+#endif
+}
+
+std::string ThreadPoolOfName(absl::string_view thread_name) {
+  for (absl::string_view prefix :
+       {"grpc", "default-executo", "resolver-execu", "event_engine"}) {
+    if (absl::StartsWith(thread_name, prefix)) return "grpc";
+  }
+  return std::string(thread_name.substr(0, thread_name.find('_')));
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -311,6 +311,16 @@ def reverb_python_deps():
         build_file = clean_dep("//third_party:pybind11.BUILD"),
     )
 
+    http_archive(
+        name = "dlpack",
+        urls = [
+            "https://storage.googleapis.com/mirror.tensorflow.org/github.com/dmlc/dlpack/archive/v0.8.tar.gz",
+            "https://github.com/dmlc/dlpack/archive/v0.8.tar.gz",
+        ],
+        strip_prefix = "dlpack-0.8",
+        build_file = clean_dep("//third_party:dlpack.BUILD"),
+    )
+
     http_archive(
         name = "absl_py",
         sha256 = "603febc9b95a8f2979a7bdb77d2f5e4d9b30d4e0d59579f88eba67d4e4cc5462",
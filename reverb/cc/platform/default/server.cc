@@ -16,16 +16,27 @@
 
 #include <chrono>  // NOLINT(build/c++11) - grpc API requires it.
 #include <csignal>
+#include <map>
 #include <memory>
+#include <string>
 
+#include "grpcpp/resource_quota.h"
 #include "grpcpp/server_builder.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
 #include "reverb/cc/checkpointing/interface.h"
 #include "reverb/cc/client.h"
 #include "reverb/cc/platform/grpc_utils.h"
+#include "reverb/cc/platform/http_server.h"
 #include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/profiler.h"
 #include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/platform/tfrecord_dataset.h"
 #include "reverb/cc/reverb_service_impl.h"
+#include "reverb/cc/support/lock_profiler.h"
+#include "reverb/cc/support/metrics.h"
 #include "reverb/cc/support/periodic_closure.h"
 
 namespace deepmind {
@@ -39,10 +50,30 @@ void signal_handler(int signal) {
   stop_server_fn();
 }
 
+// Default and maximum duration of the CPU profiles served by the profiling
+// endpoint.
+constexpr int64_t kDefaultCpuProfileSeconds = 30;
+constexpr int64_t kMaxCpuProfileSeconds = 3600;
+
+// Sets `value` to the integer query parameter `key` if present.
+template <typename T>
+absl::Status ParseQueryParameter(
+    const std::map<std::string, std::string>& query, const std::string& key,
+    T* value) {
+  auto it = query.find(key);
+  if (it != query.end() && !absl::SimpleAtoi(it->second, value)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Query parameter ", key, " must be an integer but got '", it->second,
+        "'."));
+  }
+  return absl::OkStatus();
+}
+
 class ServerImpl : public Server {
  public:
-  ServerImpl(int port)
+  ServerImpl(int port, const ServerOptions& options)
       : port_(port),
+        options_(options),
         signal_worker_(
             [this] {
               if (stop_signalled_) {
@@ -57,13 +88,38 @@ class ServerImpl : public Server {
     REVERB_CHECK(!running_) << "Initialize() called twice?";
     REVERB_RETURN_IF_ERROR(ReverbServiceImpl::Create(
         std::move(tables), std::move(checkpointer), &reverb_service_));
-    server_ = grpc::ServerBuilder()
-                  .AddListeningPort(absl::StrCat("[::]:", port_),
-                                    MakeServerCredentials())
-                  .RegisterService(reverb_service_.get())
-                  .SetMaxSendMessageSize(kMaxMessageSize)
-                  .SetMaxReceiveMessageSize(kMaxMessageSize)
-                  .BuildAndStart();
+    if (options_.metrics_port >= 0) {
+      REVERB_RETURN_IF_ERROR(internal::StartHttpServer(
+          options_.metrics_port, "/metrics",
+          "text/plain; version=0.0.4; charset=utf-8",
+          [] { return internal::MetricsRegistry::Default()->ExportText(); },
+          &metrics_server_));
+    }
+    if (options_.profiling_port >= 0) {
+      std::map<std::string, internal::HttpHandler> handlers;
+      handlers["/debug/pprof/profile"] = internal::HttpHandler{
+          "application/octet-stream",
+          [this](const std::map<std::string, std::string>& query,
+                 std::string* body) { return ServeCpuProfile(query, body); }};
+      handlers["/debug/pprof/heap"] = internal::HttpHandler{
+          "application/octet-stream",
+          [](const std::map<std::string, std::string>& query,
+             std::string* body) { return internal::CollectHeapProfile(body); }};
+      REVERB_RETURN_IF_ERROR(internal::StartHttpServer(
+          options_.profiling_port, std::move(handlers), &profiling_server_));
+    }
+    if (options_.enable_lock_profiling) {
+      internal::LockProfiler::SetEnabled(true);
+    }
+    grpc::ServerBuilder builder;
+    builder
+        .AddListeningPort(absl::StrCat("[::]:", port_),
+                          MakeServerCredentials())
+        .RegisterService(reverb_service_.get())
+        .SetMaxSendMessageSize(kMaxMessageSize)
+        .SetMaxReceiveMessageSize(kMaxMessageSize);
+    ApplyOptions(&builder);
+    server_ = builder.BuildAndStart();
     if (!server_) {
       return absl::InvalidArgumentError("Failed to BuildAndStart gRPC server");
     }
@@ -83,6 +139,14 @@ class ServerImpl : public Server {
     if (!running_) return;
     REVERB_LOG(REVERB_INFO) << "Shutting down replay server";
 
+    if (metrics_server_ != nullptr) {
+      metrics_server_->Stop();
+    }
+    if (profiling_server_ != nullptr) {
+      // Ends a CPU profile which is being collected early.
+      stopping_.Notify();
+      profiling_server_->Stop();
+    }
     reverb_service_->Close();
 
     // Set a deadline as the sampler streams never closes by themselves.
@@ -112,16 +176,100 @@ class ServerImpl : public Server {
 
   std::string DebugString() const override {
     return absl::StrCat("Server(port=", port_,
+                        ", max_threads=", options_.max_threads,
                         ", reverb_service=", reverb_service_->DebugString(),
                         ")");
   }
 
+  int metrics_port() const override {
+    return metrics_server_ != nullptr ? metrics_server_->port() : -1;
+  }
+
+  int profiling_port() const override {
+    return profiling_server_ != nullptr ? profiling_server_->port() : -1;
+  }
+
+  absl::Status ExportTable(const std::string& table_name,
+                           const std::string& path, int num_shards) override {
+    std::shared_ptr<Table> table;
+    REVERB_RETURN_IF_ERROR(FindTable(table_name, &table));
+    return ::deepmind::reverb::ExportTable(table.get(), path, num_shards);
+  }
+
+  absl::Status ImportTable(const std::string& path,
+                           const std::string& table_name,
+                           int batch_size) override {
+    std::shared_ptr<Table> table;
+    REVERB_RETURN_IF_ERROR(FindTable(table_name, &table));
+    return ::deepmind::reverb::ImportTable(
+        path, reverb_service_->chunk_store(), table.get(), batch_size);
+  }
+
   void SignalStop() { stop_signalled_ = true; }
 
  private:
+  absl::Status FindTable(const std::string& table_name,
+                         std::shared_ptr<Table>* table) const {
+    *table = reverb_service_->TableByName(table_name);
+    if (*table == nullptr) {
+      return absl::NotFoundError(
+          absl::StrCat("Priority table ", table_name, " was not found"));
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status ServeCpuProfile(const std::map<std::string, std::string>& query,
+                               std::string* body) {
+    int64_t seconds = kDefaultCpuProfileSeconds;
+    int frequency_hz = internal::kDefaultCpuProfileFrequencyHz;
+    REVERB_RETURN_IF_ERROR(ParseQueryParameter(query, "seconds", &seconds));
+    REVERB_RETURN_IF_ERROR(ParseQueryParameter(query, "hz", &frequency_hz));
+    if (seconds <= 0 || seconds > kMaxCpuProfileSeconds) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("seconds must be in [1, ", kMaxCpuProfileSeconds,
+                       "] but got ", seconds, "."));
+    }
+    REVERB_RETURN_IF_ERROR(internal::StartCpuProfile(frequency_hz));
+    stopping_.WaitForNotificationWithTimeout(absl::Seconds(seconds));
+    return internal::StopCpuProfile(body);
+  }
+
+  void ApplyOptions(grpc::ServerBuilder* builder) {
+    if (options_.max_threads > 0) {
+      grpc::ResourceQuota quota("reverb_server");
+      quota.SetMaxThreads(options_.max_threads);
+      builder->SetResourceQuota(quota);
+    }
+    if (options_.num_completion_queues > 0) {
+      builder->SetSyncServerOption(grpc::ServerBuilder::NUM_CQS,
+                                   options_.num_completion_queues);
+    }
+    if (options_.min_pollers > 0) {
+      builder->SetSyncServerOption(grpc::ServerBuilder::MIN_POLLERS,
+                                   options_.min_pollers);
+    }
+    if (options_.max_pollers > 0) {
+      builder->SetSyncServerOption(grpc::ServerBuilder::MAX_POLLERS,
+                                   options_.max_pollers);
+    }
+    if (options_.so_reuseport.has_value()) {
+      builder->AddChannelArgument(GRPC_ARG_ALLOW_REUSEPORT,
+                                  *options_.so_reuseport ? 1 : 0);
+    }
+    options_.transport.ApplyTo(builder);
+    reverb_service_->set_compress_streams(options_.transport.compress_streams);
+  }
+
   int port_;
+  ServerOptions options_;
   std::unique_ptr<ReverbServiceImpl> reverb_service_;
   std::unique_ptr<grpc::Server> server_ = nullptr;
+  // Serves the metrics if `options_.metrics_port` is not negative.
+  std::unique_ptr<internal::HttpServer> metrics_server_;
+  // Serves the profiles if `options_.profiling_port` is not negative.
+  std::unique_ptr<internal::HttpServer> profiling_server_;
+  // Notified when the server is stopped.
+  absl::Notification stopping_;
 
   absl::Mutex mu_;
   bool running_ ABSL_GUARDED_BY(mu_) = false;
@@ -138,10 +286,45 @@ class ServerImpl : public Server {
 
 }  // namespace
 
+absl::Status ServerOptions::Validate() const {
+  if (max_threads < 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("max_threads must be >= 0 but got ", max_threads, "."));
+  }
+  if (num_completion_queues < 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("num_completion_queues must be >= 0 but got ",
+                     num_completion_queues, "."));
+  }
+  if (min_pollers < 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("min_pollers must be >= 0 but got ", min_pollers, "."));
+  }
+  if (max_pollers < 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("max_pollers must be >= 0 but got ", max_pollers, "."));
+  }
+  if (max_pollers > 0 && min_pollers > max_pollers) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("min_pollers (", min_pollers,
+                     ") must be <= max_pollers (", max_pollers, ")."));
+  }
+  return transport.Validate();
+}
+
 absl::Status StartServer(std::vector<std::shared_ptr<Table>> tables, int port,
                          std::shared_ptr<Checkpointer> checkpointer,
                          std::unique_ptr<Server> *server) {
-  auto s = absl::make_unique<ServerImpl>(port);
+  return StartServer(std::move(tables), port, std::move(checkpointer),
+                     ServerOptions(), server);
+}
+
+absl::Status StartServer(std::vector<std::shared_ptr<Table>> tables, int port,
+                         std::shared_ptr<Checkpointer> checkpointer,
+                         const ServerOptions& options,
+                         std::unique_ptr<Server>* server) {
+  REVERB_RETURN_IF_ERROR(options.Validate());
+  auto s = absl::make_unique<ServerImpl>(port, options);
   REVERB_RETURN_IF_ERROR(
       s->Initialize(std::move(tables), std::move(checkpointer)));
   *server = std::move(s);
@@ -14,7 +14,11 @@
 
 #include "reverb/cc/platform/snappy.h"
 
+#include <algorithm>
 #include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
 
 #include "absl/meta/type_traits.h"
 #include "snappy-sinksource.h"  // NOLINT(build/include)
@@ -150,8 +154,59 @@ class CheckedByteArraySink : public snappy::Sink {
   bool overflowed_;
 };
 
+// A snappy Source which produces its bytes one piece at a time by calling a
+// generator (see `SnappyCompressFromGenerator`).
+class GeneratorSource : public snappy::Source {
+ public:
+  GeneratorSource(
+      size_t size,
+      const std::function<void(size_t, size_t, char*)>& generate)
+      : size_(size),
+        generate_(generate),
+        piece_(new char[std::min(size, kSnappyGeneratorPieceSize)]) {}
+
+  GeneratorSource(const GeneratorSource&) = delete;
+  GeneratorSource& operator=(const GeneratorSource&) = delete;
+
+  size_t Available() const override { return size_ - position_; }
+
+  const char* Peek(size_t* len) override {
+    if (position_ == piece_end_ && position_ < size_) {
+      piece_start_ = position_;
+      piece_end_ = std::min(size_, piece_start_ + kSnappyGeneratorPieceSize);
+      generate_(piece_start_, piece_end_ - piece_start_, piece_.get());
+    }
+    *len = piece_end_ - position_;
+    return piece_.get() + (position_ - piece_start_);
+  }
+
+  void Skip(size_t n) override { position_ += n; }
+
+ private:
+  const size_t size_;
+  const std::function<void(size_t, size_t, char*)>& generate_;
+  std::unique_ptr<char[]> piece_;
+
+  // Bytes `[piece_start_, piece_end_)` of the input are held by `piece_`.
+  size_t piece_start_ = 0;
+  size_t piece_end_ = 0;
+
+  // Number of bytes consumed by the compressor.
+  size_t position_ = 0;
+};
+
 }  // namespace
 
+size_t SnappyCompressFromGenerator(
+    size_t input_size,
+    const std::function<void(size_t offset, size_t size, char* buffer)>&
+        generate,
+    std::string* output) {
+  GeneratorSource source(input_size, generate);
+  StringSink sink(output);
+  return snappy::Compress(&source, &sink);
+}
+
 template <>
 size_t SnappyCompressFromString(absl::string_view input, std::string* output) {
   snappy::ByteArraySource source(input.data(), input.size());
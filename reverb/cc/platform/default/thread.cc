@@ -12,23 +12,82 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+
 #include "reverb/cc/platform/thread.h"
 
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
 #include <thread>  // NOLINT(build/c++11)
+#include <vector>
 
+#include "absl/base/attributes.h"
 #include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "reverb/cc/platform/logging.h"
 
 namespace deepmind {
 namespace reverb {
 namespace internal {
 namespace {
 
+// Set by the threads started through `StartThread`. The initial-exec TLS model
+// keeps the access free of allocations when Reverb is loaded as a shared
+// library, which `CurrentThreadName` needs to be async-signal-safe.
+constexpr size_t kMaxThreadNameSize = 64;
+ABSL_CONST_INIT thread_local char current_thread_name[kMaxThreadNameSize]
+    __attribute__((tls_model("initial-exec"))) = {};
+
+void SetCurrentThreadName(absl::string_view name) {
+  const size_t size = std::min(name.size(), kMaxThreadNameSize - 1);
+  std::memcpy(current_thread_name, name.data(), size);
+  current_thread_name[size] = '\0';
+
+  // The kernel keeps (at most) 15 characters, which is enough to tell the
+  // threads apart in tools like `top -H` and debuggers.
+  char kernel_name[16];
+  const size_t kernel_size = std::min(size, sizeof(kernel_name) - 1);
+  std::memcpy(kernel_name, name.data(), kernel_size);
+  kernel_name[kernel_size] = '\0';
+  pthread_setname_np(pthread_self(), kernel_name);
+}
+
+absl::Status SetAffinity(pthread_t thread, absl::Span<const int> cpus) {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("CPU index ", cpu, " is out of range."));
+    }
+    CPU_SET(cpu, &cpu_set);
+  }
+  int error = pthread_setaffinity_np(thread, sizeof(cpu_set), &cpu_set);
+  if (error != 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Failed to set CPU affinity to [", absl::StrJoin(cpus, ","),
+                     "]: ", std::strerror(error)));
+  }
+  return absl::OkStatus();
+}
+
 class StdThread : public Thread {
  public:
   explicit StdThread(std::function<void()> fn) : thread_(std::move(fn)) {}
 
   ~StdThread() override { thread_.join(); }
 
+  absl::Status SetCpuAffinity(absl::Span<const int> cpus) override {
+    return SetAffinity(thread_.native_handle(), cpus);
+  }
+
  private:
   std::thread thread_;
 };
@@ -37,9 +96,37 @@ class StdThread : public Thread {
 
 std::unique_ptr<Thread> StartThread(absl::string_view name,
                                     std::function<void()> fn) {
-  return {absl::make_unique<StdThread>(std::move(fn))};
+  if (name.empty()) {
+    return {absl::make_unique<StdThread>(std::move(fn))};
+  }
+  return {absl::make_unique<StdThread>(
+      [name = std::string(name), fn = std::move(fn)] {
+        SetCurrentThreadName(name);
+        fn();
+      })};
+}
+
+std::unique_ptr<Thread> StartThread(absl::string_view name,
+                                    std::function<void()> fn,
+                                    absl::Span<const int> cpu_affinity) {
+  if (cpu_affinity.empty()) {
+    return StartThread(name, std::move(fn));
+  }
+  // The affinity is set by the new thread itself so that `fn` never runs on
+  // any other CPU.
+  std::vector<int> cpus(cpu_affinity.begin(), cpu_affinity.end());
+  return StartThread(name, [cpus = std::move(cpus), fn = std::move(fn)] {
+    auto status = SetAffinity(pthread_self(), cpus);
+    if (!status.ok()) {
+      REVERB_LOG(REVERB_WARNING)
+          << "Thread continues without CPU affinity: " << status;
+    }
+    fn();
+  });
 }
 
+const char* CurrentThreadName() { return current_thread_name; }
+
 }  // namespace internal
 }  // namespace reverb
 }  // namespace deepmind
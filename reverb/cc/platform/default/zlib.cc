@@ -0,0 +1,78 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/platform/zlib.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "zlib.h"  // NOLINT(build/include)
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Size by which the output is grown when the uncompressed size is unknown.
+constexpr size_t kMinOutputGrowth = 64 << 10;
+
+}  // namespace
+
+bool ZlibCompressFromString(absl::string_view input, int level,
+                            std::string* output) {
+  uLongf output_size = compressBound(input.size());
+  output->resize(output_size);
+  if (compress2(reinterpret_cast<Bytef*>(&(*output)[0]), &output_size,
+                reinterpret_cast<const Bytef*>(input.data()), input.size(),
+                level) != Z_OK) {
+    output->clear();
+    return false;
+  }
+  output->resize(output_size);
+  return true;
+}
+
+bool ZlibUncompressToBuffer(absl::string_view input, size_t output_size,
+                            char* output) {
+  uLongf uncompressed_size = output_size;
+  return uncompress(reinterpret_cast<Bytef*>(output), &uncompressed_size,
+                    reinterpret_cast<const Bytef*>(input.data()),
+                    input.size()) == Z_OK &&
+         uncompressed_size == output_size;
+}
+
+bool ZlibUncompressToString(absl::string_view input, std::string* output) {
+  z_stream stream = {};
+  if (inflateInit(&stream) != Z_OK) return false;
+
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  stream.avail_in = input.size();
+
+  output->clear();
+  int result = Z_OK;
+  while (result == Z_OK) {
+    const size_t offset = output->size();
+    output->resize(offset + std::max(kMinOutputGrowth, offset));
+    stream.next_out = reinterpret_cast<Bytef*>(&(*output)[offset]);
+    stream.avail_out = output->size() - offset;
+    result = inflate(&stream, Z_NO_FLUSH);
+    output->resize(output->size() - stream.avail_out);
+  }
+  inflateEnd(&stream);
+  return result == Z_STREAM_END;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,75 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_PLATFORM_HTTP_SERVER_H_
+#define REVERB_CC_PLATFORM_HTTP_SERVER_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Minimal HTTP server which answers `GET` requests for a fixed set of paths
+// with the text returned by the handlers. Intended for exposing metrics and
+// profiles to scrapers, so connections are served one at a time and are closed
+// after each response.
+class HttpServer {
+ public:
+  virtual ~HttpServer() = default;
+
+  // Port the server is listening on.
+  virtual int port() const = 0;
+
+  // Stops accepting connections and blocks until the serving thread has
+  // terminated. Also called by the destructor.
+  virtual void Stop() = 0;
+};
+
+// Starts a server listening on all interfaces on `port` (0 picks an unused
+// port). `GET` requests for `path` are answered with the output of `handler`
+// and content type `content_type` while other paths get a 404.
+absl::Status StartHttpServer(int port, std::string path,
+                             std::string content_type,
+                             std::function<std::string()> handler,
+                             std::unique_ptr<HttpServer>* server);
+
+// Answers the `GET` requests for one path. `query` holds the parameters of the
+// query string (without percent-decoding). The `body` set by `handler` is
+// served with `content_type` while errors are served as plain text with a
+// status matching the code (400 for `InvalidArgument`, 409 for
+// `FailedPrecondition` and 500 otherwise).
+struct HttpHandler {
+  std::string content_type;
+  std::function<absl::Status(const std::map<std::string, std::string>& query,
+                             std::string* body)>
+      handler;
+};
+
+// Like above but serves each path of `handlers` with its handler.
+absl::Status StartHttpServer(int port,
+                             std::map<std::string, HttpHandler> handlers,
+                             std::unique_ptr<HttpServer>* server);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_HTTP_SERVER_H_
@@ -0,0 +1,159 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/http_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "reverb/cc/platform/status_matchers.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::EndsWith;
+using ::testing::HasSubstr;
+using ::testing::StartsWith;
+
+// Sends `request` to the server on `port` and returns the full response.
+std::string Send(int port, absl::string_view request) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  EXPECT_EQ(
+      connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+  EXPECT_EQ(send(fd, request.data(), request.size(), 0), request.size());
+  std::string response;
+  char buffer[1024];
+  ssize_t n;
+  while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    response.append(buffer, n);
+  }
+  close(fd);
+  return response;
+}
+
+std::string Get(int port, absl::string_view target) {
+  return Send(port, absl::StrCat("GET ", target,
+                                 " HTTP/1.1\r\nHost: localhost\r\n\r\n"));
+}
+
+TEST(HttpServerTest, ServesHandlerOutput) {
+  std::atomic<int> calls{0};
+  std::unique_ptr<HttpServer> server;
+  REVERB_ASSERT_OK(StartHttpServer(
+      0, "/metrics", "text/plain",
+      [&calls] { return absl::StrCat("calls ", ++calls, "\n"); }, &server));
+  ASSERT_GT(server->port(), 0);
+
+  std::string response = Get(server->port(), "/metrics");
+  EXPECT_THAT(response, StartsWith("HTTP/1.1 200 OK\r\n"));
+  EXPECT_THAT(response, HasSubstr("Content-Type: text/plain\r\n"));
+  EXPECT_THAT(response, HasSubstr("Content-Length: 8\r\n"));
+  EXPECT_THAT(response, EndsWith("\r\n\r\ncalls 1\n"));
+
+  // The handler is called for every request and query parameters are ignored.
+  EXPECT_THAT(Get(server->port(), "/metrics?format=text"),
+              EndsWith("calls 2\n"));
+}
+
+TEST(HttpServerTest, ServesHandlersWithQueryParameters) {
+  std::map<std::string, HttpHandler> handlers;
+  handlers["/echo"] = HttpHandler{
+      "text/plain",
+      [](const std::map<std::string, std::string>& query, std::string* body) {
+        for (const auto& [key, value] : query) {
+          absl::StrAppend(body, key, ":", value, ";");
+        }
+        return absl::OkStatus();
+      }};
+  handlers["/fail"] = HttpHandler{
+      "text/plain",
+      [](const std::map<std::string, std::string>& query, std::string* body) {
+        if (query.count("busy")) {
+          return absl::FailedPreconditionError("busy");
+        }
+        return absl::InvalidArgumentError("bad query");
+      }};
+  std::unique_ptr<HttpServer> server;
+  REVERB_ASSERT_OK(StartHttpServer(0, std::move(handlers), &server));
+
+  EXPECT_THAT(Get(server->port(), "/echo"), EndsWith("\r\n\r\n"));
+  EXPECT_THAT(Get(server->port(), "/echo?b=2&a=1&&flag&a=3"),
+              EndsWith("\r\n\r\na:3;b:2;flag:;"));
+  EXPECT_THAT(Get(server->port(), "/fail"),
+              StartsWith("HTTP/1.1 400 Bad Request\r\n"));
+  EXPECT_THAT(Get(server->port(), "/fail"), EndsWith("bad query\n"));
+  EXPECT_THAT(Get(server->port(), "/fail?busy"),
+              StartsWith("HTTP/1.1 409 Conflict\r\n"));
+  EXPECT_THAT(Get(server->port(), "/other"),
+              StartsWith("HTTP/1.1 404 Not Found\r\n"));
+}
+
+TEST(HttpServerTest, UnknownPath) {
+  std::unique_ptr<HttpServer> server;
+  REVERB_ASSERT_OK(StartHttpServer(
+      0, "/metrics", "text/plain", [] { return "ok"; }, &server));
+  EXPECT_THAT(Get(server->port(), "/other"),
+              StartsWith("HTTP/1.1 404 Not Found\r\n"));
+}
+
+TEST(HttpServerTest, OnlyGetIsSupported) {
+  std::unique_ptr<HttpServer> server;
+  REVERB_ASSERT_OK(StartHttpServer(
+      0, "/metrics", "text/plain", [] { return "ok"; }, &server));
+  EXPECT_THAT(Send(server->port(), "POST /metrics HTTP/1.1\r\n\r\n"),
+              StartsWith("HTTP/1.1 405 Method Not Allowed\r\n"));
+}
+
+TEST(HttpServerTest, PortInUse) {
+  std::unique_ptr<HttpServer> server;
+  REVERB_ASSERT_OK(StartHttpServer(
+      0, "/metrics", "text/plain", [] { return "ok"; }, &server));
+  std::unique_ptr<HttpServer> other;
+  EXPECT_EQ(StartHttpServer(server->port(), "/metrics", "text/plain",
+                            [] { return "ok"; }, &other)
+                .code(),
+            absl::StatusCode::kInternal);
+}
+
+TEST(HttpServerTest, StopIsIdempotent) {
+  std::unique_ptr<HttpServer> server;
+  REVERB_ASSERT_OK(StartHttpServer(
+      0, "/metrics", "text/plain", [] { return "ok"; }, &server));
+  server->Stop();
+  server->Stop();
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
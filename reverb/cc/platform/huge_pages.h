@@ -0,0 +1,36 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_PLATFORM_HUGE_PAGES_H_
+#define REVERB_CC_PLATFORM_HUGE_PAGES_H_
+
+#include <cstddef>
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Advises the kernel to back the `size` bytes at `data` with transparent huge
+// pages. Only the huge pages which lie entirely within the range are affected.
+// Intended for large arrays which are allocated once and accessed randomly
+// (e.g the nodes of a sum tree) where TLB misses are a significant cost. This
+// is only a hint: it is a no-op on platforms without transparent huge pages
+// and failures are ignored.
+void AdviseHugePages(void* data, size_t size);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_HUGE_PAGES_H_
@@ -0,0 +1,44 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/platform/huge_pages.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(AdviseHugePagesTest, LeavesContentUnchanged) {
+  std::vector<int64_t> values(1 << 20);
+  for (int64_t i = 0; i < values.size(); i++) values[i] = i;
+  AdviseHugePages(values.data(), values.size() * sizeof(int64_t));
+  for (int64_t i = 0; i < values.size(); i++) ASSERT_EQ(values[i], i);
+}
+
+TEST(AdviseHugePagesTest, IgnoresRangesSmallerThanAHugePage) {
+  std::vector<char> values(100, 'a');
+  AdviseHugePages(values.data(), values.size());
+  AdviseHugePages(nullptr, 0);
+  EXPECT_EQ(values[99], 'a');
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,40 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_PLATFORM_NUMA_H_
+#define REVERB_CC_PLATFORM_NUMA_H_
+
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Parses a list of CPU indices in the format used by Linux (see cpuset(7)),
+// e.g "0-3,8,10-11". The result is sorted and does not contain duplicates.
+absl::Status ParseCpuList(absl::string_view list, std::vector<int>* cpus);
+
+// Returns the indices of the CPUs which belong to NUMA node `node`. Returns
+// `NotFoundError` if the node does not exist.
+absl::Status GetNumaNodeCpus(int node, std::vector<int>* cpus);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_NUMA_H_
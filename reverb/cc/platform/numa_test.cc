@@ -0,0 +1,69 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/numa.h"
+
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "reverb/cc/platform/status_matchers.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::ElementsAre;
+
+TEST(ParseCpuListTest, ParsesRangesAndSingleCpus) {
+  std::vector<int> cpus;
+  REVERB_ASSERT_OK(ParseCpuList("0-3,8,10-11\n", &cpus));
+  EXPECT_THAT(cpus, ElementsAre(0, 1, 2, 3, 8, 10, 11));
+}
+
+TEST(ParseCpuListTest, SortsAndRemovesDuplicates) {
+  std::vector<int> cpus;
+  REVERB_ASSERT_OK(ParseCpuList("4,1-2,2", &cpus));
+  EXPECT_THAT(cpus, ElementsAre(1, 2, 4));
+}
+
+TEST(ParseCpuListTest, EmptyList) {
+  std::vector<int> cpus = {1};
+  REVERB_ASSERT_OK(ParseCpuList("", &cpus));
+  EXPECT_THAT(cpus, ElementsAre());
+}
+
+TEST(ParseCpuListTest, RejectsInvalidLists) {
+  std::vector<int> cpus;
+  for (const char* list : {"a", "1-", "3-1", "1-2-3", "-1"}) {
+    EXPECT_EQ(ParseCpuList(list, &cpus).code(),
+              absl::StatusCode::kInvalidArgument)
+        << list;
+  }
+}
+
+TEST(GetNumaNodeCpusTest, MissingNode) {
+  std::vector<int> cpus;
+  EXPECT_EQ(GetNumaNodeCpus(1 << 20, &cpus).code(),
+            absl::StatusCode::kNotFound);
+  EXPECT_EQ(GetNumaNodeCpus(-1, &cpus).code(), absl::StatusCode::kNotFound);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
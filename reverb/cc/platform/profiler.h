@@ -0,0 +1,67 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_PLATFORM_PROFILER_H_
+#define REVERB_CC_PLATFORM_PROFILER_H_
+
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Default sampling frequency of `StartCpuProfile`.
+constexpr int kDefaultCpuProfileFrequencyHz = 100;
+
+// Starts sampling the call stacks of the threads of the process while they use
+// the CPU, `frequency_hz` times per second of CPU time. Only one profile can be
+// collected at a time, `FailedPrecondition` is returned if a profile is already
+// being collected or if another profiler owns `SIGPROF`.
+absl::Status StartCpuProfile(int frequency_hz = kDefaultCpuProfileFrequencyHz);
+
+// Stops the profile started by `StartCpuProfile` and sets `profile` to the
+// samples in the (uncompressed) pprof protobuf format, which `pprof` and
+// similar tools read directly. The stacks are symbolized in process and every
+// sample is labelled with `thread`, the name of the thread (see
+// `CurrentThreadName`, the kernel's name is used for threads not started by
+// `StartThread`), and `thread_pool` (see `ThreadPoolOfName`) so the time spent
+// by e.g. the table workers can be told apart with `pprof -tagfocus`.
+// Returns `FailedPrecondition` if no profile is being collected.
+absl::Status StopCpuProfile(std::string* profile);
+
+// True between `StartCpuProfile` and `StopCpuProfile`.
+bool IsCpuProfiling();
+
+// Sets `profile` to the memory held by the allocator in the pprof protobuf
+// format. Sampling the call stacks of the allocations requires an allocator
+// with built-in support, so the profile only breaks down the memory by state
+// (in use by `malloc`, in use through `mmap` and freed but retained). Returns
+// `Unimplemented` if the allocator does not report the statistics.
+absl::Status CollectHeapProfile(std::string* profile);
+
+// Name of the pool of threads which `thread_name` belongs to. Reverb names its
+// threads `<pool>_<instance>` (e.g. `TableInsertWorker_<table>` and
+// `<executor>_<index>` for the workers of a `TaskExecutor`) and all threads of
+// gRPC map to `grpc`.
+std::string ThreadPoolOfName(absl::string_view thread_name);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_PROFILER_H_
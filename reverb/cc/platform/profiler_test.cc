@@ -0,0 +1,110 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/profiler.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/base/attributes.h"
+#include "absl/status/status.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/platform/thread.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::HasSubstr;
+
+ABSL_ATTRIBUTE_NOINLINE void BurnCpuForProfilerTest(
+    const std::atomic<bool>* stop) {
+  volatile uint64_t value = 0;
+  while (!stop->load()) value = value * 31 + 7;
+}
+
+TEST(CpuProfileTest, SamplesNamedThreads) {
+  REVERB_ASSERT_OK(StartCpuProfile(1000));
+  EXPECT_TRUE(IsCpuProfiling());
+
+  std::atomic<bool> stop{false};
+  auto thread = StartThread("ProfiledWorker_0",
+                            [&stop] { BurnCpuForProfilerTest(&stop); });
+  absl::SleepFor(absl::Milliseconds(300));
+  stop = true;
+  thread = nullptr;
+
+  std::string profile;
+  REVERB_ASSERT_OK(StopCpuProfile(&profile));
+  EXPECT_FALSE(IsCpuProfiling());
+
+  // The string table holds the labels and the symbolized functions.
+  EXPECT_THAT(profile, HasSubstr("nanoseconds"));
+  EXPECT_THAT(profile, HasSubstr("thread_pool"));
+  EXPECT_THAT(profile, HasSubstr("ProfiledWorker_0"));
+  EXPECT_THAT(profile, HasSubstr("ProfiledWorker"));
+  EXPECT_THAT(profile, HasSubstr("BurnCpuForProfilerTest"));
+}
+
+TEST(CpuProfileTest, OnlyOneProfileAtATime) {
+  std::string profile;
+  EXPECT_EQ(StopCpuProfile(&profile).code(),
+            absl::StatusCode::kFailedPrecondition);
+
+  REVERB_ASSERT_OK(StartCpuProfile());
+  EXPECT_EQ(StartCpuProfile().code(), absl::StatusCode::kFailedPrecondition);
+  REVERB_EXPECT_OK(StopCpuProfile(&profile));
+
+  // Profiles can be collected again once stopped.
+  REVERB_EXPECT_OK(StartCpuProfile());
+  REVERB_EXPECT_OK(StopCpuProfile(&profile));
+}
+
+TEST(CpuProfileTest, RejectsInvalidFrequency) {
+  EXPECT_EQ(StartCpuProfile(0).code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(StartCpuProfile(100000).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_FALSE(IsCpuProfiling());
+}
+
+TEST(HeapProfileTest, ReportsAllocatorState) {
+  auto allocation = std::make_unique<char[]>(1 << 20);
+  std::string profile;
+  REVERB_ASSERT_OK(CollectHeapProfile(&profile));
+  EXPECT_THAT(profile, HasSubstr("inuse_space"));
+  EXPECT_THAT(profile, HasSubstr("[malloc in use]"));
+  EXPECT_THAT(profile, HasSubstr("[mmap in use]"));
+}
+
+TEST(ThreadPoolOfNameTest, GroupsThreads) {
+  EXPECT_EQ(ThreadPoolOfName("TableInsertWorker_my_table"),
+            "TableInsertWorker");
+  EXPECT_EQ(ThreadPoolOfName("TableCallbackExecutor_3"),
+            "TableCallbackExecutor");
+  EXPECT_EQ(ThreadPoolOfName("ChunkSpiller"), "ChunkSpiller");
+  EXPECT_EQ(ThreadPoolOfName("grpcpp_sync_ser"), "grpc");
+  EXPECT_EQ(ThreadPoolOfName("default-executo"), "grpc");
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
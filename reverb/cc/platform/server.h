@@ -16,11 +16,14 @@
 #define REVERB_CC_PLATFORM_SERVER_H_
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "absl/status/status.h"
+#include "absl/types/optional.h"
 #include "reverb/cc/checkpointing/interface.h"
 #include "reverb/cc/client.h"
+#include "reverb/cc/support/grpc_transport_options.h"
 #include "reverb/cc/table.h"
 
 namespace deepmind {
@@ -43,12 +46,95 @@ class Server {
 
   // Returns a summary string description.
   virtual std::string DebugString() const = 0;
+
+  // Port of the HTTP endpoint serving the metrics (see
+  // `ServerOptions::metrics_port`), or -1 if it is disabled.
+  virtual int metrics_port() const = 0;
+
+  // Port of the HTTP endpoint serving CPU and heap profiles (see
+  // `ServerOptions::profiling_port`), or -1 if it is disabled.
+  virtual int profiling_port() const = 0;
+
+  // Writes the items of table `table_name`, and the chunks they reference, to
+  // a new dataset in the directory `path` (see `ExportTable`). Returns
+  // `NotFound` if the server has no such table.
+  virtual absl::Status ExportTable(const std::string& table_name,
+                                   const std::string& path, int num_shards) = 0;
+
+  // Inserts the items of the dataset in `path` into table `table_name` and
+  // their chunks into the chunk store of the server (see `ImportTable`).
+  // Returns `NotFound` if the server has no such table.
+  virtual absl::Status ImportTable(const std::string& path,
+                                   const std::string& table_name,
+                                   int batch_size) = 0;
+};
+
+// Options for tuning how the gRPC server distributes work across cores. The
+// defaults leave all settings to gRPC.
+struct ServerOptions {
+  // Checks that field values are valid and returns `InvalidArgument` if any
+  // field value is invalid.
+  absl::Status Validate() const;
+
+  // Maximum number of threads gRPC may create on behalf of the server. 0 leaves
+  // the limit to gRPC.
+  int max_threads = 0;
+
+  // Number of completion queues used to poll for new RPCs and the min/max
+  // number of polling threads per queue. These only apply to the polling
+  // threads which gRPC manages for the server and 0 leaves the value to gRPC.
+  int num_completion_queues = 0;
+  int min_pollers = 0;
+  int max_pollers = 0;
+
+  // Sets `SO_REUSEPORT` on the listening socket. This lets gRPC spread the
+  // listener across its pollers (and allows several servers to share the
+  // port) so accepting new connections is not bottlenecked on a single thread.
+  // Unset leaves the decision to gRPC.
+  absl::optional<bool> so_reuseport = absl::nullopt;
+
+  // Port of an HTTP endpoint which serves the metrics of the server (see
+  // `internal::MetricsRegistry::Default()`) at `/metrics` in the Prometheus
+  // text format. 0 picks an unused port and a negative value (the default)
+  // disables the endpoint.
+  int metrics_port = -1;
+
+  // Port of an HTTP endpoint which serves profiles of the server in the pprof
+  // format, e.g. `pprof http://<host>:<port>/debug/pprof/profile?seconds=10`:
+  //
+  //   * `/debug/pprof/profile` samples the CPU usage of all threads for
+  //     `seconds` (default 30) at `hz` samples per second (default 100). The
+  //     samples are labelled with the thread and its pool (table workers,
+  //     extension workers, `TaskExecutor` workers, gRPC pollers etc., see
+  //     `internal::StopCpuProfile`). Only one profile is collected at a time.
+  //   * `/debug/pprof/heap` reports the memory held by the allocator (see
+  //     `internal::CollectHeapProfile`).
+  //
+  // Profiling has no cost until a profile is requested. The endpoint has its
+  // own port so that scraping the metrics is not blocked while a profile is
+  // collected. 0 picks an unused port and a negative value (the default)
+  // disables the endpoint.
+  int profiling_port = -1;
+
+  // Enables lock contention profiling (see `LockProfileRequest`) when the
+  // server starts. Profiling can also be toggled at runtime through the
+  // `LockProfile` RPC.
+  bool enable_lock_profiling = false;
+
+  // Tuning of the HTTP/2 transport (flow control windows, keepalive and
+  // compression of the streams).
+  GrpcTransportOptions transport;
 };
 
 absl::Status StartServer(std::vector<std::shared_ptr<Table>> tables, int port,
                          std::shared_ptr<Checkpointer> checkpointer,
                          std::unique_ptr<Server> *server);
 
+absl::Status StartServer(std::vector<std::shared_ptr<Table>> tables, int port,
+                         std::shared_ptr<Checkpointer> checkpointer,
+                         const ServerOptions& options,
+                         std::unique_ptr<Server>* server);
+
 }  // namespace reverb
 }  // namespace deepmind
 
@@ -46,6 +46,90 @@ TEST(ServerTest, ErrorOnUnavailablePort) {
               ::testing::HasSubstr("Failed to BuildAndStart gRPC server"));
 }
 
+TEST(ServerTest, StartServerWithOptions) {
+  int port = internal::PickUnusedPortOrDie();
+  ServerOptions options;
+  options.max_threads = 8;
+  options.num_completion_queues = 2;
+  options.min_pollers = 1;
+  options.max_pollers = 2;
+  options.so_reuseport = true;
+  std::unique_ptr<Server> server;
+  REVERB_EXPECT_OK(StartServer(/*tables=*/{},
+                               /*port=*/port, /*checkpointer=*/nullptr,
+                               options, &server));
+}
+
+TEST(ServerTest, MetricsEndpointIsDisabledByDefault) {
+  std::unique_ptr<Server> server;
+  REVERB_ASSERT_OK(StartServer(/*tables=*/{},
+                               /*port=*/internal::PickUnusedPortOrDie(),
+                               /*checkpointer=*/nullptr, &server));
+  EXPECT_EQ(server->metrics_port(), -1);
+}
+
+TEST(ServerTest, StartServerWithMetricsEndpoint) {
+  ServerOptions options;
+  options.metrics_port = 0;
+  std::unique_ptr<Server> server;
+  REVERB_ASSERT_OK(StartServer(/*tables=*/{},
+                               /*port=*/internal::PickUnusedPortOrDie(),
+                               /*checkpointer=*/nullptr, options, &server));
+  EXPECT_GT(server->metrics_port(), 0);
+}
+
+TEST(ServerTest, StartServerWithProfilingEndpoint) {
+  std::unique_ptr<Server> server;
+  REVERB_ASSERT_OK(StartServer(/*tables=*/{},
+                               /*port=*/internal::PickUnusedPortOrDie(),
+                               /*checkpointer=*/nullptr, &server));
+  EXPECT_EQ(server->profiling_port(), -1);
+
+  ServerOptions options;
+  options.metrics_port = 0;
+  options.profiling_port = 0;
+  REVERB_ASSERT_OK(StartServer(/*tables=*/{},
+                               /*port=*/internal::PickUnusedPortOrDie(),
+                               /*checkpointer=*/nullptr, options, &server));
+  EXPECT_GT(server->profiling_port(), 0);
+  EXPECT_NE(server->profiling_port(), server->metrics_port());
+}
+
+TEST(ServerTest, StartServerValidatesOptions) {
+  int port = internal::PickUnusedPortOrDie();
+  ServerOptions options;
+  options.min_pollers = 3;
+  options.max_pollers = 2;
+  std::unique_ptr<Server> server;
+  auto status = StartServer(/*tables=*/{},
+                            /*port=*/port, /*checkpointer=*/nullptr, options,
+                            &server);
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(std::string(status.message()),
+              ::testing::HasSubstr("min_pollers (3) must be <= max_pollers"));
+}
+
+TEST(ServerTest, ExportAndImportOfUnknownTableIsNotFound) {
+  std::unique_ptr<Server> server;
+  REVERB_ASSERT_OK(StartServer(/*tables=*/{},
+                               /*port=*/internal::PickUnusedPortOrDie(),
+                               /*checkpointer=*/nullptr, &server));
+  EXPECT_EQ(server->ExportTable("missing", "/tmp/unused", 1).code(),
+            absl::StatusCode::kNotFound);
+  EXPECT_EQ(server->ImportTable("/tmp/unused", "missing", 1).code(),
+            absl::StatusCode::kNotFound);
+}
+
+TEST(ServerOptionsTest, RejectsNegativeValues) {
+  ServerOptions options;
+  REVERB_EXPECT_OK(options.Validate());
+  options.max_threads = -1;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+  options.max_threads = 0;
+  options.num_completion_queues = -1;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+}
+
 }  // namespace
 }  // namespace reverb
 }  // namespace deepmind
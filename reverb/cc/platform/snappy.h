@@ -16,6 +16,8 @@
 #define REVERB_CC_PLATFORM_SNAPPY_H_
 
 #include <cstddef>
+#include <functional>
+#include <string>
 
 #include "absl/strings/string_view.h"
 
@@ -26,6 +28,21 @@ namespace reverb {
 template <typename Toutput>
 size_t SnappyCompressFromString(absl::string_view input, Toutput* output);
 
+// Size of the pieces in which `SnappyCompressFromGenerator` produces its input.
+constexpr size_t kSnappyGeneratorPieceSize = 64 * 1024;
+
+// Compresses `input_size` bytes which are produced piece by piece by
+// `generate(offset, size, buffer)`, and appends them to `output`. `generate`
+// must write bytes `[offset, offset + size)` of the input to `buffer`. Pieces
+// are generated in order and every piece except the last one holds
+// `kSnappyGeneratorPieceSize` bytes, so only a single piece of the input is
+// held in memory at a time. Returns the number of bytes stored.
+size_t SnappyCompressFromGenerator(
+    size_t input_size,
+    const std::function<void(size_t offset, size_t size, char* buffer)>&
+        generate,
+    std::string* output);
+
 // Uncompress an `input` containing snappy-compressed data to *output.
 template <typename Tinput>
 bool SnappyUncompressToString(const Tinput& input, size_t output_capacity,
@@ -0,0 +1,656 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/streaming_checkpointer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/checkpoint_util.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/platform/tfrecord_util.h"
+#include "reverb/cc/support/tf_util.h"
+#include "reverb/cc/table.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/file_system.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+constexpr char kTablesFileName[] = "tables.tfrecord";
+constexpr char kManifestFileName[] = "MANIFEST";
+constexpr char kManifestTempFileName[] = "MANIFEST.tmp";
+constexpr char kChunkPoolDirName[] = "chunks";
+
+std::string PartFileName(int part) {
+  return absl::StrFormat("chunks-%05d.tfrecord", part);
+}
+
+std::string SharedPartFileName(absl::string_view checkpoint_name, int part) {
+  return absl::StrFormat("%s-%05d.tfrecord", checkpoint_name, part);
+}
+
+std::string ChunkPoolPath(absl::string_view root_dir) {
+  return tensorflow::io::JoinPath(root_dir, kChunkPoolDirName);
+}
+
+// Returns the path of the file holding `part` of the checkpoint in `path`.
+std::string PartPath(const std::string& path,
+                     const CheckpointManifest::Part& part) {
+  if (part.shared()) {
+    return tensorflow::io::JoinPath(
+        ChunkPoolPath(tensorflow::io::Dirname(path)), part.file_name());
+  }
+  return tensorflow::io::JoinPath(path, part.file_name());
+}
+
+bool HasManifest(const std::string& path) {
+  return tensorflow::Env::Default()
+      ->FileExists(tensorflow::io::JoinPath(path, kManifestFileName))
+      .ok();
+}
+
+absl::Status ReadManifest(const std::string& path,
+                          CheckpointManifest* manifest) {
+  std::string content;
+  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(tensorflow::ReadFileToString(
+      tensorflow::Env::Default(),
+      tensorflow::io::JoinPath(path, kManifestFileName), &content)));
+  if (!manifest->ParseFromString(content)) {
+    return absl::DataLossError(
+        absl::StrCat("Could not parse the manifest of checkpoint ", path, "."));
+  }
+  return absl::OkStatus();
+}
+
+// Returns the (sorted) paths of all checkpoint directories in `root_dir`,
+// including the ones which are incomplete.
+absl::Status ListCheckpoints(const std::string& root_dir,
+                             std::vector<std::string>* paths) {
+  std::vector<std::string> filenames;
+  REVERB_RETURN_IF_ERROR(
+      FromTensorflowStatus(tensorflow::Env::Default()->GetMatchingPaths(
+          tensorflow::io::JoinPath(root_dir, "*"), &filenames)));
+  for (auto& filename : filenames) {
+    if (tensorflow::io::Basename(filename) != kChunkPoolDirName) {
+      paths->push_back(std::move(filename));
+    }
+  }
+  std::sort(paths->begin(), paths->end());
+  return absl::OkStatus();
+}
+
+// Finds the most recent complete checkpoint in `root_dir`.
+absl::Status FindLatestCheckpoint(const std::string& root_dir,
+                                  std::string* path) {
+  std::vector<std::string> paths;
+  REVERB_RETURN_IF_ERROR(ListCheckpoints(root_dir, &paths));
+  for (auto it = paths.rbegin(); it != paths.rend(); it++) {
+    if (HasManifest(*it)) {
+      *path = tensorflow::io::JoinPath(root_dir, tensorflow::io::Basename(*it));
+      return absl::OkStatus();
+    }
+  }
+  return absl::NotFoundError(absl::StrCat("No checkpoint found in ", root_dir));
+}
+
+// Reads the manifest of the checkpoint in `path` and checks that all of its
+// parts are complete.
+absl::Status ReadVerifiedManifest(const std::string& path,
+                                  CheckpointManifest* manifest) {
+  if (!HasManifest(path)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Load called with invalid checkpoint path: ", path));
+  }
+  REVERB_RETURN_IF_ERROR(ReadManifest(path, manifest));
+  for (const auto& part : manifest->parts()) {
+    const std::string filename = PartPath(path, part);
+    tensorflow::uint64 num_bytes;
+    auto status = FromTensorflowStatus(
+        tensorflow::Env::Default()->GetFileSize(filename, &num_bytes));
+    if (!status.ok() || num_bytes != part.num_bytes()) {
+      return absl::DataLossError(absl::StrCat(
+          "Checkpoint ", path, " is corrupt: expected ", filename,
+          " to hold ", part.num_bytes(), " bytes but ",
+          status.ok() ? absl::StrCat("found ", num_bytes, " bytes")
+                      : std::string(status.message()),
+          "."));
+    }
+  }
+  return absl::OkStatus();
+}
+
+// Reads the record at `offset` of `file` into `data`.
+absl::Status ReadChunkRecord(tensorflow::RandomAccessFile* file,
+                             uint64_t offset, ChunkData* data) {
+  tensorflow::io::RecordReader reader(file);
+  tensorflow::uint64 record_offset = offset;
+  tensorflow::tstring record;
+  REVERB_RETURN_IF_ERROR(
+      FromTensorflowStatus(reader.ReadRecord(&record_offset, &record)));
+  return internal::ParseChunkRecord(record, data);
+}
+
+// Writes `manifest` to a temporary file and renames it into place so that
+// readers never observe a partially written manifest.
+absl::Status CommitManifest(const std::string& path,
+                            const CheckpointManifest& manifest) {
+  auto* env = tensorflow::Env::Default();
+  const std::string temp_filename =
+      tensorflow::io::JoinPath(path, kManifestTempFileName);
+  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(tensorflow::WriteStringToFile(
+      env, temp_filename, manifest.SerializeAsString())));
+  return FromTensorflowStatus(env->RenameFile(
+      temp_filename, tensorflow::io::JoinPath(path, kManifestFileName)));
+}
+
+// Splits `chunks` into parts of approximately `part_size_bytes`.
+std::vector<std::vector<std::shared_ptr<ChunkStore::Chunk>>> SplitIntoParts(
+    std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks,
+    int64_t part_size_bytes) {
+  std::sort(chunks.begin(), chunks.end(),
+            [](const std::shared_ptr<ChunkStore::Chunk>& a,
+               const std::shared_ptr<ChunkStore::Chunk>& b) {
+              return a->key() < b->key();
+            });
+  std::vector<std::vector<std::shared_ptr<ChunkStore::Chunk>>> parts;
+  int64_t current_part_bytes = 0;
+  for (auto& chunk : chunks) {
+    if (parts.empty() || current_part_bytes >= part_size_bytes) {
+      parts.emplace_back();
+      current_part_bytes = 0;
+    }
+    current_part_bytes += chunk->data().ByteSizeLong();
+    parts.back().push_back(std::move(chunk));
+  }
+  return parts;
+}
+
+// Calls `fn(0)`, ..., `fn(n - 1)` using `num_threads` threads. Once a call
+// has failed no further calls are started and the first error is returned.
+absl::Status ForEachPart(int n, int num_threads, absl::string_view name,
+                         const std::function<absl::Status(int)>& fn) {
+  std::atomic<int> next{0};
+  std::atomic<bool> failed{false};
+  return internal::RunInParallel(num_threads, name, [&](int) {
+    for (int i = next++; i < n && !failed; i = next++) {
+      auto status = fn(i);
+      if (!status.ok()) {
+        failed = true;
+        return status;
+      }
+    }
+    return absl::OkStatus();
+  });
+}
+
+}  // namespace
+
+absl::Status StreamingCheckpointerOptions::Validate() const {
+  if (part_size_bytes <= 0) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "part_size_bytes must be > 0 but got ", part_size_bytes, "."));
+  }
+  if (max_buffered_bytes <= 0) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "max_buffered_bytes must be > 0 but got ", max_buffered_bytes, "."));
+  }
+  if (min_live_fraction < 0 || min_live_fraction > 1) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "min_live_fraction must be in [0, 1] but got ", min_live_fraction,
+        "."));
+  }
+  return absl::OkStatus();
+}
+
+StreamingCheckpointer::StreamingCheckpointer(
+    std::string root_dir, StreamingCheckpointerOptions options,
+    absl::optional<std::string> fallback_checkpoint_path)
+    : root_dir_(std::move(root_dir)),
+      options_(options),
+      fallback_checkpoint_path_(std::move(fallback_checkpoint_path)) {
+  REVERB_CHECK_OK(options_.Validate());
+  REVERB_LOG(REVERB_INFO) << "Initializing StreamingCheckpointer in "
+                          << root_dir_
+                          << (fallback_checkpoint_path_.has_value()
+                                  ? absl::StrCat(
+                                        " and fallback directory ",
+                                        fallback_checkpoint_path_.value(), ".")
+                                  : ".");
+}
+
+StreamingCheckpointer::~StreamingCheckpointer() { StopBackgroundRestore(); }
+
+int StreamingCheckpointer::NumParallelTransfers(int num_parts) const {
+  int64_t max_transfers =
+      std::max<int64_t>(1, options_.max_buffered_bytes /
+                               options_.part_size_bytes);
+  return std::max<int64_t>(1, std::min<int64_t>(max_transfers, num_parts));
+}
+
+absl::Status StreamingCheckpointer::Save(std::vector<Table*> tables,
+                                         int keep_latest, std::string* path) {
+  if (keep_latest <= 0) {
+    return absl::InvalidArgumentError(
+        "StreamingCheckpointer must have keep_latest > 0.");
+  }
+
+  absl::MutexLock lock(&mu_);
+  std::string dir_path =
+      tensorflow::io::JoinPath(root_dir_, absl::FormatTime(absl::Now()));
+  auto* env = tensorflow::Env::Default();
+  REVERB_RETURN_IF_ERROR(
+      FromTensorflowStatus(env->RecursivelyCreateDir(dir_path)));
+
+  auto status = WriteCheckpoint(tables, dir_path);
+  if (!status.ok()) {
+    tensorflow::int64 undeleted_files;
+    tensorflow::int64 undeleted_dirs;
+    auto delete_status = FromTensorflowStatus(
+        env->DeleteRecursively(dir_path, &undeleted_files, &undeleted_dirs));
+    if (delete_status.ok() && options_.deduplicate_chunks) {
+      // Remove the shared parts which were written before the failure.
+      delete_status = CollectGarbage();
+    }
+    if (!delete_status.ok()) {
+      REVERB_LOG(REVERB_WARNING)
+          << "Failed to delete incomplete checkpoint " << dir_path << ": "
+          << delete_status;
+    }
+    return status;
+  }
+
+  REVERB_RETURN_IF_ERROR(DeleteOldCheckpoints(keep_latest));
+  if (options_.deduplicate_chunks) {
+    REVERB_RETURN_IF_ERROR(CollectGarbage());
+  }
+  *path = std::move(dir_path);
+  return absl::OkStatus();
+}
+
+absl::Status StreamingCheckpointer::WriteCheckpoint(
+    const std::vector<Table*>& tables, const std::string& dir_path) {
+  CheckpointManifest manifest;
+  manifest.set_tables_file_name(kTablesFileName);
+
+  internal::RecordWriterUniquePtr table_writer;
+  REVERB_RETURN_IF_ERROR(internal::OpenWriter(
+      tensorflow::io::JoinPath(dir_path, kTablesFileName), &table_writer));
+
+  internal::flat_hash_set<std::shared_ptr<ChunkStore::Chunk>> chunks;
+  for (Table* table : tables) {
+    auto checkpoint = table->Checkpoint();
+    chunks.merge(checkpoint.chunks);
+    REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
+        table_writer->WriteRecord(checkpoint.checkpoint.SerializeAsString())));
+  }
+  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(table_writer->Close()));
+  table_writer = nullptr;
+
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> new_chunks;
+  if (options_.deduplicate_chunks) {
+    REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
+        tensorflow::Env::Default()->RecursivelyCreateDir(
+            ChunkPoolPath(root_dir_))));
+    REVERB_RETURN_IF_ERROR(ReuseSharedParts(chunks, &manifest, &new_chunks));
+  } else {
+    new_chunks.assign(chunks.begin(), chunks.end());
+  }
+  chunks.clear();
+
+  auto parts = SplitIntoParts(std::move(new_chunks), options_.part_size_bytes);
+  const int first_new_part = manifest.parts_size();
+  const std::string checkpoint_name(tensorflow::io::Basename(dir_path));
+  for (int i = 0; i < parts.size(); i++) {
+    auto* part = manifest.add_parts();
+    part->set_num_chunks(parts[i].size());
+    if (options_.deduplicate_chunks) {
+      part->set_file_name(SharedPartFileName(checkpoint_name, i));
+      part->set_shared(true);
+    } else {
+      part->set_file_name(PartFileName(i));
+    }
+    for (const auto& chunk : parts[i]) {
+      auto* entry = part->add_chunks();
+      entry->set_chunk_key(chunk->key());
+      entry->set_episode_id(chunk->episode_id());
+      entry->set_num_rows(chunk->num_rows());
+      entry->set_num_columns(chunk->num_columns());
+      entry->set_data_byte_size(chunk->DataByteSizeLong());
+    }
+  }
+
+  REVERB_RETURN_IF_ERROR(ForEachPart(
+      parts.size(), NumParallelTransfers(parts.size()),
+      "StreamingCheckpointer_SaveChunks", [&](int i) {
+        auto* part = manifest.mutable_parts(first_new_part + i);
+        const std::string filename = PartPath(dir_path, *part);
+        std::vector<uint64_t> offsets;
+        REVERB_RETURN_IF_ERROR(
+            internal::SaveChunks(filename, parts[i], &offsets));
+        for (int j = 0; j < offsets.size(); j++) {
+          part->mutable_chunks(j)->set_offset(offsets[j]);
+        }
+        // Release the chunks as soon as they have been written.
+        parts[i].clear();
+
+        tensorflow::uint64 num_bytes;
+        REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
+            tensorflow::Env::Default()->GetFileSize(filename, &num_bytes)));
+        part->set_num_bytes(num_bytes);
+        return absl::OkStatus();
+      }));
+
+  return CommitManifest(dir_path, manifest);
+}
+
+absl::Status StreamingCheckpointer::ReuseSharedParts(
+    const internal::flat_hash_set<std::shared_ptr<ChunkStore::Chunk>>& chunks,
+    CheckpointManifest* manifest,
+    std::vector<std::shared_ptr<ChunkStore::Chunk>>* new_chunks) {
+  new_chunks->reserve(chunks.size());
+  std::string latest;
+  auto status = FindLatestCheckpoint(root_dir_, &latest);
+  if (absl::IsNotFound(status)) {
+    new_chunks->assign(chunks.begin(), chunks.end());
+    return absl::OkStatus();
+  }
+  REVERB_RETURN_IF_ERROR(status);
+
+  CheckpointManifest previous;
+  REVERB_RETURN_IF_ERROR(ReadManifest(latest, &previous));
+
+  // Index of the shared part (in `previous`) which holds each of the chunks.
+  internal::flat_hash_map<ChunkStore::Key, int> persisted;
+  for (int i = 0; i < previous.parts_size(); i++) {
+    if (!previous.parts(i).shared()) continue;
+    for (const auto& entry : previous.parts(i).chunks()) {
+      persisted[entry.chunk_key()] = i;
+    }
+  }
+
+  std::vector<std::vector<std::shared_ptr<ChunkStore::Chunk>>> live_chunks(
+      previous.parts_size());
+  for (const auto& chunk : chunks) {
+    auto it = persisted.find(chunk->key());
+    if (it == persisted.end()) {
+      new_chunks->push_back(chunk);
+    } else {
+      live_chunks[it->second].push_back(chunk);
+    }
+  }
+
+  // Parts which are mostly garbage are compacted by writing their live chunks
+  // again. Once the older checkpoints have been deleted the part is no longer
+  // referenced and can be collected.
+  for (int i = 0; i < previous.parts_size(); i++) {
+    const auto& part = previous.parts(i);
+    if (live_chunks[i].empty()) continue;
+    if (live_chunks[i].size() <
+        options_.min_live_fraction * part.num_chunks()) {
+      new_chunks->insert(new_chunks->end(), live_chunks[i].begin(),
+                         live_chunks[i].end());
+    } else {
+      *manifest->add_parts() = part;
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status StreamingCheckpointer::CollectGarbage() {
+  auto* env = tensorflow::Env::Default();
+  std::vector<std::string> paths;
+  REVERB_RETURN_IF_ERROR(ListCheckpoints(root_dir_, &paths));
+
+  internal::flat_hash_set<std::string> referenced;
+  for (const auto& path : paths) {
+    if (!HasManifest(path)) continue;
+    CheckpointManifest manifest;
+    REVERB_RETURN_IF_ERROR(ReadManifest(path, &manifest));
+    for (const auto& part : manifest.parts()) {
+      if (part.shared()) referenced.insert(part.file_name());
+    }
+  }
+
+  std::vector<std::string> filenames;
+  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(env->GetMatchingPaths(
+      tensorflow::io::JoinPath(ChunkPoolPath(root_dir_), "*"), &filenames)));
+  for (const auto& filename : filenames) {
+    if (!referenced.contains(tensorflow::io::Basename(filename))) {
+      REVERB_RETURN_IF_ERROR(FromTensorflowStatus(env->DeleteFile(filename)));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status StreamingCheckpointer::DeleteOldCheckpoints(int keep_latest) {
+  auto* env = tensorflow::Env::Default();
+  std::vector<std::string> filenames;
+  REVERB_RETURN_IF_ERROR(ListCheckpoints(root_dir_, &filenames));
+
+  int num_complete = 0;
+  for (auto it = filenames.rbegin(); it != filenames.rend(); it++) {
+    if (num_complete < keep_latest) {
+      if (HasManifest(*it)) num_complete++;
+      continue;
+    }
+    tensorflow::int64 undeleted_files;
+    tensorflow::int64 undeleted_dirs;
+    REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
+        env->DeleteRecursively(*it, &undeleted_files, &undeleted_dirs)));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status StreamingCheckpointer::Load(
+    absl::string_view path, ChunkStore* chunk_store,
+    std::vector<std::shared_ptr<Table>>* tables) {
+  const std::string dir_path(path);
+  REVERB_LOG(REVERB_INFO) << "Loading checkpoint from " << dir_path;
+  CheckpointManifest manifest;
+  REVERB_RETURN_IF_ERROR(ReadVerifiedManifest(dir_path, &manifest));
+
+  // Keep the loaded chunks around so that none of them are cleaned up before
+  // all the tables have been loaded.
+  std::vector<std::vector<std::shared_ptr<ChunkStore::Chunk>>> loaded_chunks(
+      manifest.parts_size());
+  REVERB_RETURN_IF_ERROR(ForEachPart(
+      manifest.parts_size(), NumParallelTransfers(manifest.parts_size()),
+      "StreamingCheckpointer_LoadChunks", [&](int i) {
+        const auto& part = manifest.parts(i);
+        REVERB_RETURN_IF_ERROR(internal::LoadChunks(
+            PartPath(dir_path, part), chunk_store, &loaded_chunks[i]));
+        if (loaded_chunks[i].size() != part.num_chunks()) {
+          return absl::DataLossError(absl::StrCat(
+              "Expected ", part.num_chunks(), " chunks in ", part.file_name(),
+              " of checkpoint ", dir_path, " but found ",
+              loaded_chunks[i].size(), "."));
+        }
+        return absl::OkStatus();
+      }));
+
+  return internal::LoadTables(
+      tensorflow::io::JoinPath(dir_path, manifest.tables_file_name()),
+      chunk_store, tables);
+}
+
+absl::Status StreamingCheckpointer::LoadLatest(
+    ChunkStore* chunk_store, std::vector<std::shared_ptr<Table>>* tables) {
+  if (options_.lazy_restore) {
+    return LoadLatestLazily(chunk_store, tables);
+  }
+  REVERB_LOG(REVERB_INFO) << "Loading latest checkpoint from " << root_dir_;
+  std::string path;
+  REVERB_RETURN_IF_ERROR(FindLatestCheckpoint(root_dir_, &path));
+  return Load(path, chunk_store, tables);
+}
+
+absl::Status StreamingCheckpointer::LoadLatestLazily(
+    ChunkStore* chunk_store, std::vector<std::shared_ptr<Table>>* tables) {
+  REVERB_LOG(REVERB_INFO) << "Lazily loading latest checkpoint from "
+                          << root_dir_;
+  std::string path;
+  REVERB_RETURN_IF_ERROR(FindLatestCheckpoint(root_dir_, &path));
+  CheckpointManifest manifest;
+  REVERB_RETURN_IF_ERROR(ReadVerifiedManifest(path, &manifest));
+  for (const auto& part : manifest.parts()) {
+    if (part.chunks_size() != part.num_chunks()) {
+      REVERB_LOG(REVERB_INFO) << "Checkpoint " << path
+                              << " has no chunk index, loading it eagerly.";
+      return Load(path, chunk_store, tables);
+    }
+  }
+
+  // Create the chunks from the index. Each chunk reads its own record when
+  // accessed before the background restore has reached it.
+  auto* env = tensorflow::Env::Default();
+  std::vector<std::string> filenames;
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
+  for (const auto& part : manifest.parts()) {
+    filenames.push_back(PartPath(path, part));
+    std::unique_ptr<tensorflow::RandomAccessFile> file;
+    REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
+        env->NewRandomAccessFile(filenames.back(), &file)));
+    std::shared_ptr<tensorflow::RandomAccessFile> shared_file(std::move(file));
+
+    for (const auto& entry : part.chunks()) {
+      ChunkStore::DeferredChunk deferred;
+      deferred.key = entry.chunk_key();
+      deferred.episode_id = entry.episode_id();
+      deferred.num_rows = entry.num_rows();
+      deferred.num_columns = entry.num_columns();
+      deferred.data_byte_size = entry.data_byte_size();
+      deferred.loader = [shared_file, offset = entry.offset()](ChunkData* data) {
+        return ReadChunkRecord(shared_file.get(), offset, data);
+      };
+      chunks.push_back(chunk_store->InsertDeferred(std::move(deferred)));
+    }
+  }
+
+  REVERB_RETURN_IF_ERROR(internal::LoadTables(
+      tensorflow::io::JoinPath(path, manifest.tables_file_name()), chunk_store,
+      tables));
+
+  // Only the chunks referenced by the restored tables are kept alive, the
+  // background restore skips the others.
+  std::vector<std::weak_ptr<const ChunkStore::Chunk>> weak_chunks(
+      chunks.begin(), chunks.end());
+  chunks.clear();
+
+  StopBackgroundRestore();
+  stop_restore_ = false;
+  restore_thread_ = internal::StartThread(
+      "StreamingCheckpointer_Restore",
+      [this, path, filenames = std::move(filenames),
+       weak_chunks = std::move(weak_chunks)] {
+        auto status = RestoreInBackground(filenames, weak_chunks);
+        if (!status.ok()) {
+          // Chunks which have not been restored are read when first accessed.
+          REVERB_LOG(REVERB_WARNING)
+              << "Background restore of checkpoint " << path
+              << " failed: " << status;
+        } else {
+          REVERB_LOG(REVERB_INFO) << "Finished restoring the chunks of "
+                                  << "checkpoint " << path << ".";
+        }
+      });
+  return absl::OkStatus();
+}
+
+absl::Status StreamingCheckpointer::RestoreInBackground(
+    const std::vector<std::string>& filenames,
+    const std::vector<std::weak_ptr<const ChunkStore::Chunk>>& chunks) {
+  // The chunks of each part are stored in the order of the records.
+  int index = 0;
+  for (const auto& filename : filenames) {
+    internal::RecordReaderUniquePtr reader;
+    REVERB_RETURN_IF_ERROR(internal::OpenReader(filename, &reader));
+    tensorflow::uint64 offset = 0;
+    tensorflow::tstring record;
+    absl::Status status;
+    while (!stop_restore_) {
+      status =
+          FromTensorflowStatus(reader->ReadRecord(&offset, &record));
+      if (!status.ok()) break;
+      REVERB_CHECK_LT(index, chunks.size());
+      auto chunk = chunks[index++].lock();
+      if (chunk == nullptr || chunk->resident()) continue;
+
+      ChunkData data;
+      REVERB_RETURN_IF_ERROR(internal::ParseChunkRecord(record, &data));
+      if (data.chunk_key() != chunk->key()) {
+        return absl::DataLossError(absl::StrCat(
+            "Expected chunk ", chunk->key(), " but found chunk ",
+            data.chunk_key(), " in ", filename, "."));
+      }
+      chunk->SetDeferredData(std::move(data));
+    }
+    if (stop_restore_) return absl::CancelledError("Checkpointer destroyed.");
+    if (!absl::IsOutOfRange(status)) return status;
+  }
+  return absl::OkStatus();
+}
+
+void StreamingCheckpointer::StopBackgroundRestore() {
+  stop_restore_ = true;
+  restore_thread_ = nullptr;  // Joins the thread.
+}
+
+absl::Status StreamingCheckpointer::LoadFallbackCheckpoint(
+    ChunkStore* chunk_store, std::vector<std::shared_ptr<Table>>* tables) {
+  if (!fallback_checkpoint_path_.has_value()) {
+    return absl::NotFoundError("No fallback checkpoint path provided.");
+  }
+  if (HasManifest(fallback_checkpoint_path_.value())) {
+    return Load(fallback_checkpoint_path_.value(), chunk_store, tables);
+  }
+  return absl::NotFoundError(absl::StrCat("No checkpoint found in ",
+                                          fallback_checkpoint_path_.value()));
+}
+
+std::string StreamingCheckpointer::DebugString() const {
+  return absl::StrCat("StreamingCheckpointer(root_dir=", root_dir_,
+                      ", part_size_bytes=", options_.part_size_bytes,
+                      ", max_buffered_bytes=", options_.max_buffered_bytes,
+                      ", deduplicate_chunks=", options_.deduplicate_chunks,
+                      ", min_live_fraction=", options_.min_live_fraction,
+                      ", lazy_restore=", options_.lazy_restore, ")");
+}
+
+}  // namespace reverb
+}  // namespace deepmind
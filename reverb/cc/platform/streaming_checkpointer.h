@@ -0,0 +1,227 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_PLATFORM_STREAMING_CHECKPOINTER_H_
+#define REVERB_CC_PLATFORM_STREAMING_CHECKPOINTER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/checkpointing/interface.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/table.h"
+
+namespace deepmind {
+namespace reverb {
+
+struct StreamingCheckpointerOptions {
+  // Approximate size of each chunk file. Chunks are assigned to the parts in
+  // key order and a new part is started once the serialized size of the
+  // current one reaches `part_size_bytes`. Chunks larger than this end up in
+  // a part of their own.
+  int64_t part_size_bytes = 64 << 20;
+
+  // Upper bound on the number of bytes which are being written at any one
+  // time. Parts are uploaded in parallel, so this limits the memory used by
+  // the write buffers of the filesystem to roughly `max_buffered_bytes` by
+  // running `max(1, max_buffered_bytes / part_size_bytes)` uploads at once.
+  int64_t max_buffered_bytes = 256 << 20;
+
+  // If set then chunks are written to a pool shared by all checkpoints in the
+  // root directory and only the chunks which were not persisted by the
+  // previous checkpoint are written by `Save`. See StreamingCheckpointer.
+  bool deduplicate_chunks = false;
+
+  // Only used when `deduplicate_chunks` is set. Shared parts of which less
+  // than this fraction of the chunks is still referenced are compacted: the
+  // referenced chunks are written again as part of the new checkpoint so
+  // the old part can be deleted once it is no longer needed.
+  double min_live_fraction = 0.5;
+
+  // If set then `LoadLatest` behaves like `LoadLatestLazily`, so the server
+  // starts serving once the tables have been restored. This is the same as
+  // setting `--reverb_lazy_checkpoint_restore` but only for this checkpointer,
+  // which allows it to be enabled when the server is started from Python.
+  bool lazy_restore = false;
+
+  // Checks that the options are valid.
+  absl::Status Validate() const;
+};
+
+// Checkpointer designed for object storage (e.g. GCS or S3) which are
+// accessed through the TensorFlow filesystem.
+//
+// Rather than a single large chunk file, the chunks are split into parts of
+// roughly `part_size_bytes`. Each part is streamed to its own file and several
+// parts are uploaded in parallel, with the total amount of data in flight
+// bounded by `max_buffered_bytes`. The stored checkpoint has the following
+// format:
+//
+//   <root_dir>/
+//     <timestamp of the checkpoint>/
+//       tables.tfrecord
+//       chunks-<part>.tfrecord
+//       ...
+//       MANIFEST
+//
+// MANIFEST is a serialized CheckpointManifest which lists the files of the
+// checkpoint, the number of chunks in each part and its size. It is written
+// to a temporary file once all other files have been closed and is then
+// renamed into place. Objects only become visible once they have been
+// completely written, so the checkpoint is committed atomically: a directory
+// without a manifest is either still being written or was interrupted and
+// is ignored by `LoadLatest`. `Load` verifies the size of every part against
+// the manifest before any data is restored.
+//
+// If `deduplicate_chunks` is set then the parts are instead written to a pool
+// which sits next to the checkpoints:
+//
+//   <root_dir>/
+//     chunks/
+//       <timestamp of the checkpoint which wrote the part>-<part>.tfrecord
+//       ...
+//     <timestamp of the checkpoint>/
+//       tables.tfrecord
+//       MANIFEST
+//
+// The manifest of such a checkpoint also records the keys of the chunks in
+// each of its parts. When `Save` is called, chunks which are held by a part of
+// the most recent complete checkpoint are not written again: the part is
+// referenced by the new manifest instead. Consecutive checkpoints of a table
+// which changes slowly (e.g. a large FIFO) therefore only write the chunks
+// which were inserted in between. Since the state is read from the manifest,
+// deduplication works across restarts of the server. Once the old
+// checkpoints have been deleted, parts which are not referenced by any
+// remaining manifest are garbage collected.
+//
+// If the checkpoint cannot be written then the files written so far are
+// deleted (on a best effort basis) before `Save` returns the error.
+//
+// The optional `fallback_checkpoint_path` can be set to specify a checkpoint
+// to be reloaded when no checkpoints can be found in `root_dir`.
+class StreamingCheckpointer : public Checkpointer {
+ public:
+  explicit StreamingCheckpointer(
+      std::string root_dir,
+      StreamingCheckpointerOptions options = StreamingCheckpointerOptions(),
+      absl::optional<std::string> fallback_checkpoint_path = absl::nullopt);
+
+  // Stops the background restore started by `LoadLatestLazily`, if any.
+  ~StreamingCheckpointer() override;
+
+  // Save a new checkpoint for every table in `tables` in a sub directory
+  // inside `root_dir_`. If the call is successful, the ABSOLUTE path to the
+  // newly created checkpoint directory is returned.
+  //
+  // After a successful save, all but the `keep_latest` most recent complete
+  // checkpoints are deleted, together with any incomplete checkpoints which
+  // are older than the ones being kept.
+  absl::Status Save(std::vector<Table*> tables, int keep_latest,
+                    std::string* path) override;
+
+  // Attempts to load the checkpoint in `path`.
+  absl::Status Load(absl::string_view path, ChunkStore* chunk_store,
+                    std::vector<std::shared_ptr<Table>>* tables) override;
+
+  // Finds the most recent complete checkpoint within `root_dir_` and calls
+  // `Load`, or `LoadLatestLazily` if `lazy_restore` is set.
+  absl::Status LoadLatest(ChunkStore* chunk_store,
+                          std::vector<std::shared_ptr<Table>>* tables) override;
+
+  // Like `LoadLatest` but only reads the tables before returning. The chunks
+  // are created from the chunk index in the manifest and their data is read by
+  // a background thread, or on demand if a chunk is accessed (e.g. sampled)
+  // before the background thread has reached it. Checkpoints without a chunk
+  // index are loaded eagerly.
+  absl::Status LoadLatestLazily(
+      ChunkStore* chunk_store,
+      std::vector<std::shared_ptr<Table>>* tables) override;
+
+  // Attempts to load the fallback checkpoint. If no fallback_checkpoint_path
+  // was set or if the no checkpoint found then `NotFoundError` is returned.
+  absl::Status LoadFallbackCheckpoint(
+      ChunkStore* chunk_store,
+      std::vector<std::shared_ptr<Table>>* tables) override;
+
+  // Returns a summary string description.
+  std::string DebugString() const override;
+
+  // StreamingCheckpointer is neither copyable nor movable.
+  StreamingCheckpointer(const StreamingCheckpointer&) = delete;
+  StreamingCheckpointer& operator=(const StreamingCheckpointer&) = delete;
+
+ private:
+  // Writes the checkpoint of `tables` to the existing directory `dir_path`.
+  absl::Status WriteCheckpoint(const std::vector<Table*>& tables,
+                               const std::string& dir_path)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Adds the shared parts of the most recent complete checkpoint which hold
+  // chunks in `chunks` to `manifest`. Chunks which will not be referenced
+  // through one of these parts are appended to `new_chunks`.
+  absl::Status ReuseSharedParts(
+      const internal::flat_hash_set<std::shared_ptr<ChunkStore::Chunk>>&
+          chunks,
+      CheckpointManifest* manifest,
+      std::vector<std::shared_ptr<ChunkStore::Chunk>>* new_chunks)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Deletes the files in the chunk pool which are not referenced by the
+  // manifest of any checkpoint in `root_dir_`.
+  absl::Status CollectGarbage() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Deletes the checkpoints in `root_dir_` which are older than the
+  // `keep_latest` most recent complete checkpoints.
+  absl::Status DeleteOldCheckpoints(int keep_latest)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Reads the records of `filenames` in order and sets the data of the
+  // matching chunks in `chunks` which are still alive and not yet resident.
+  absl::Status RestoreInBackground(
+      const std::vector<std::string>& filenames,
+      const std::vector<std::weak_ptr<const ChunkStore::Chunk>>& chunks);
+
+  // Stops and joins `restore_thread_`.
+  void StopBackgroundRestore();
+
+  // Number of parts which are uploaded or downloaded in parallel.
+  int NumParallelTransfers(int num_parts) const;
+
+  const std::string root_dir_;
+  const StreamingCheckpointerOptions options_;
+  const absl::optional<std::string> fallback_checkpoint_path_;
+
+  // Serializes calls to `Save`.
+  absl::Mutex mu_;
+
+  // Reads the chunks of a lazily loaded checkpoint.
+  std::atomic<bool> stop_restore_{false};
+  std::unique_ptr<internal::Thread> restore_thread_;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_STREAMING_CHECKPOINTER_H_
@@ -0,0 +1,494 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/streaming_checkpointer.h"
+
+#include <cfloat>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/prioritized.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/tf_util.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using ::deepmind::reverb::testing::EqualsProto;
+using ::testing::HasSubstr;
+using ::testing::SizeIs;
+
+std::string MakeRoot() {
+  std::string name;
+  REVERB_CHECK(tensorflow::Env::Default()->LocalTempFilename(&name));
+  return name;
+}
+
+std::unique_ptr<Table> MakeUniformTable(const std::string& name) {
+  return absl::make_unique<Table>(
+      name, absl::make_unique<UniformSelector>(),
+      absl::make_unique<FifoSelector>(), 1000, 0,
+      absl::make_unique<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX));
+}
+
+std::unique_ptr<Table> MakePrioritizedTable(const std::string& name,
+                                            double exponent) {
+  return absl::make_unique<Table>(
+      name, absl::make_unique<PrioritizedSelector>(exponent),
+      absl::make_unique<FifoSelector>(), 1000, 0,
+      absl::make_unique<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX));
+}
+
+// Inserts `num_items` items, each referencing a chunk of its own, into every
+// table in `tables`.
+void InsertItems(ChunkStore* chunk_store,
+                 const std::vector<std::shared_ptr<Table>>& tables,
+                 int num_items) {
+  for (int j = 0; j < tables.size(); j++) {
+    int offset = tables[j]->size();
+    for (int i = offset; i < offset + num_items; i++) {
+      auto chunk =
+          chunk_store->Insert(testing::MakeChunkData((j + 1) * 1000 + i));
+      REVERB_EXPECT_OK(tables[j]->InsertOrAssign(
+          {testing::MakePrioritizedItem(i, i, {chunk->data()}), {chunk}}));
+    }
+  }
+}
+
+std::vector<std::string> ListFiles(const std::string& pattern) {
+  std::vector<std::string> filenames;
+  REVERB_CHECK(tensorflow::Env::Default()
+                   ->GetMatchingPaths(pattern, &filenames)
+                   .ok());
+  return filenames;
+}
+
+StreamingCheckpointerOptions SmallPartOptions() {
+  // Every chunk is written to a part of its own using up to 4 threads.
+  StreamingCheckpointerOptions options;
+  options.part_size_bytes = 1;
+  options.max_buffered_bytes = 4;
+  return options;
+}
+
+TEST(StreamingCheckpointerOptionsTest, Validate) {
+  StreamingCheckpointerOptions options;
+  REVERB_EXPECT_OK(options.Validate());
+
+  options.part_size_bytes = 0;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+
+  options.part_size_bytes = 1;
+  options.max_buffered_bytes = 0;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+
+  options.max_buffered_bytes = 1;
+  options.min_live_fraction = 1.5;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST(StreamingCheckpointerTest, SaveAndLoad) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  tables.push_back(MakePrioritizedTable("prioritized", 0.5));
+  InsertItems(&chunk_store, tables, 50);
+
+  for (int i = 0; i < 20; i++) {
+    Table::SampledItem sample;
+    REVERB_EXPECT_OK(tables[1]->Sample(&sample));
+  }
+
+  StreamingCheckpointer checkpointer(MakeRoot(), SmallPartOptions());
+  std::string path;
+  REVERB_ASSERT_OK(
+      checkpointer.Save({tables[0].get(), tables[1].get()}, 1, &path));
+
+  EXPECT_THAT(ListFiles(tensorflow::io::JoinPath(path, "chunks-*.tfrecord")),
+              SizeIs(100));
+  REVERB_EXPECT_OK(FromTensorflowStatus(tensorflow::Env::Default()->FileExists(
+      tensorflow::io::JoinPath(path, "MANIFEST"))));
+
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  loaded_tables.push_back(MakePrioritizedTable("prioritized", 0.5));
+  REVERB_ASSERT_OK(
+      checkpointer.Load(path, &loaded_chunk_store, &loaded_tables));
+
+  for (int i = 0; i < tables.size(); i++) {
+    ASSERT_EQ(loaded_tables[i]->size(), tables[i]->size());
+    for (const auto& item : tables[i]->Copy()) {
+      Table::Item loaded_item;
+      ASSERT_TRUE(loaded_tables[i]->Get(item.item.key(), &loaded_item));
+      EXPECT_THAT(loaded_item.item, EqualsProto(item.item));
+    }
+  }
+}
+
+TEST(StreamingCheckpointerTest, LoadLatestIgnoresCheckpointWithoutManifest) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+
+  const std::string root = MakeRoot();
+  StreamingCheckpointer checkpointer(root);
+
+  InsertItems(&chunk_store, tables, 5);
+  std::string first;
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 2, &first));
+
+  InsertItems(&chunk_store, tables, 5);
+  std::string second;
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 2, &second));
+
+  // Simulate an upload which was interrupted before it was committed.
+  REVERB_ASSERT_OK(FromTensorflowStatus(tensorflow::Env::Default()->DeleteFile(
+      tensorflow::io::JoinPath(second, "MANIFEST"))));
+
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  REVERB_ASSERT_OK(
+      checkpointer.LoadLatest(&loaded_chunk_store, &loaded_tables));
+  EXPECT_EQ(loaded_tables[0]->size(), 5);
+
+  EXPECT_EQ(checkpointer.Load(second, &loaded_chunk_store, &loaded_tables)
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(StreamingCheckpointerTest, LoadDetectsTruncatedPart) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  InsertItems(&chunk_store, tables, 3);
+
+  StreamingCheckpointer checkpointer(MakeRoot(), SmallPartOptions());
+  std::string path;
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &path));
+
+  REVERB_ASSERT_OK(FromTensorflowStatus(tensorflow::WriteStringToFile(
+      tensorflow::Env::Default(),
+      tensorflow::io::JoinPath(path, "chunks-00001.tfrecord"), "truncated")));
+
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  auto status = checkpointer.Load(path, &loaded_chunk_store, &loaded_tables);
+  EXPECT_EQ(status.code(), absl::StatusCode::kDataLoss);
+  EXPECT_THAT(std::string(status.message()),
+              HasSubstr("chunks-00001.tfrecord"));
+  EXPECT_EQ(loaded_tables[0]->size(), 0);
+}
+
+TEST(StreamingCheckpointerTest, SaveDeletesOldData) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  InsertItems(&chunk_store, tables, 10);
+
+  for (int keep_latest : {1, 3}) {
+    const std::string root = MakeRoot();
+    StreamingCheckpointer checkpointer(root, SmallPartOptions());
+    for (int i = 0; i < 5; i++) {
+      std::string path;
+      REVERB_ASSERT_OK(
+          checkpointer.Save({tables[0].get()}, keep_latest, &path));
+      EXPECT_THAT(ListFiles(tensorflow::io::JoinPath(root, "*")),
+                  SizeIs(std::min(keep_latest, i + 1)));
+    }
+  }
+}
+
+StreamingCheckpointerOptions DeduplicatingOptions() {
+  auto options = SmallPartOptions();
+  options.deduplicate_chunks = true;
+  return options;
+}
+
+std::vector<std::string> ListChunkPool(const std::string& root) {
+  return ListFiles(tensorflow::io::JoinPath(root, "chunks", "*"));
+}
+
+TEST(StreamingCheckpointerTest, DeduplicatedSaveOnlyWritesNewChunks) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+
+  const std::string root = MakeRoot();
+  StreamingCheckpointer checkpointer(root, DeduplicatingOptions());
+
+  InsertItems(&chunk_store, tables, 10);
+  std::string first;
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 2, &first));
+  EXPECT_THAT(ListChunkPool(root), SizeIs(10));
+
+  InsertItems(&chunk_store, tables, 5);
+  std::string second;
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 2, &second));
+  EXPECT_THAT(ListChunkPool(root), SizeIs(15));
+
+  // The chunk pool is not mistaken for a checkpoint.
+  EXPECT_THAT(ListFiles(tensorflow::io::JoinPath(root, "*")), SizeIs(3));
+
+  // A new checkpointer (e.g after a restart) picks up where the old one
+  // stopped.
+  StreamingCheckpointer restarted(root, DeduplicatingOptions());
+  InsertItems(&chunk_store, tables, 5);
+  std::string third;
+  REVERB_ASSERT_OK(restarted.Save({tables[0].get()}, 2, &third));
+  EXPECT_THAT(ListChunkPool(root), SizeIs(20));
+
+  for (const auto& path : {second, third}) {
+    ChunkStore loaded_chunk_store;
+    std::vector<std::shared_ptr<Table>> loaded_tables;
+    loaded_tables.push_back(MakeUniformTable("uniform"));
+    REVERB_ASSERT_OK(
+        restarted.Load(path, &loaded_chunk_store, &loaded_tables));
+    EXPECT_EQ(loaded_tables[0]->size(), path == second ? 15 : 20);
+  }
+}
+
+TEST(StreamingCheckpointerTest, DeduplicatedSaveCollectsUnreferencedChunks) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(std::make_shared<Table>(
+      "fifo", absl::make_unique<UniformSelector>(),
+      absl::make_unique<FifoSelector>(), /*max_size=*/10, 0,
+      absl::make_unique<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX)));
+
+  const std::string root = MakeRoot();
+  StreamingCheckpointer checkpointer(root, DeduplicatingOptions());
+
+  InsertItems(&chunk_store, tables, 10);
+  std::string path;
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &path));
+  EXPECT_THAT(ListChunkPool(root), SizeIs(10));
+
+  // Replace half of the items. The evicted chunks are removed from the pool
+  // once the checkpoint referencing them has been deleted.
+  for (int i = 0; i < 5; i++) {
+    auto chunk = chunk_store.Insert(testing::MakeChunkData(100 + i));
+    REVERB_EXPECT_OK(tables[0]->InsertOrAssign(
+        {testing::MakePrioritizedItem(100 + i, i, {chunk->data()}), {chunk}}));
+  }
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &path));
+  EXPECT_THAT(ListChunkPool(root), SizeIs(10));
+
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("fifo"));
+  REVERB_ASSERT_OK(
+      checkpointer.Load(path, &loaded_chunk_store, &loaded_tables));
+  EXPECT_EQ(loaded_tables[0]->size(), 10);
+}
+
+TEST(StreamingCheckpointerTest, DeduplicatedSaveCompactsSparseParts) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+
+  // All chunks of a checkpoint are written to a single part.
+  StreamingCheckpointerOptions options;
+  options.deduplicate_chunks = true;
+  const std::string root = MakeRoot();
+  StreamingCheckpointer checkpointer(root, options);
+
+  InsertItems(&chunk_store, tables, 10);
+  std::string path;
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &path));
+  auto first_pool = ListChunkPool(root);
+  ASSERT_THAT(first_pool, SizeIs(1));
+
+  // Keep only 2 of the 10 chunks alive, which is less than
+  // `min_live_fraction`, so they are written again and the old part is
+  // deleted.
+  std::vector<uint64_t> deleted_keys = {0, 1, 2, 3, 4, 5, 6, 7};
+  REVERB_ASSERT_OK(tables[0]->MutateItems({}, deleted_keys));
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &path));
+  auto second_pool = ListChunkPool(root);
+  ASSERT_THAT(second_pool, SizeIs(1));
+  EXPECT_NE(first_pool[0], second_pool[0]);
+
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  REVERB_ASSERT_OK(
+      checkpointer.Load(path, &loaded_chunk_store, &loaded_tables));
+  EXPECT_EQ(loaded_tables[0]->size(), 2);
+}
+
+// Checks that every item in `tables` exists in `loaded_tables` and references
+// chunks holding the same data.
+void ExpectSameItemsAndData(
+    const std::vector<std::shared_ptr<Table>>& tables,
+    const std::vector<std::shared_ptr<Table>>& loaded_tables) {
+  for (int i = 0; i < tables.size(); i++) {
+    ASSERT_EQ(loaded_tables[i]->size(), tables[i]->size());
+    for (const auto& item : tables[i]->Copy()) {
+      Table::Item loaded_item;
+      ASSERT_TRUE(loaded_tables[i]->Get(item.item.key(), &loaded_item));
+      EXPECT_THAT(loaded_item.item, EqualsProto(item.item));
+      ASSERT_EQ(loaded_item.chunks.size(), item.chunks.size());
+      for (int j = 0; j < item.chunks.size(); j++) {
+        EXPECT_THAT(loaded_item.chunks[j]->data(),
+                    EqualsProto(item.chunks[j]->data()));
+      }
+    }
+  }
+}
+
+TEST(StreamingCheckpointerTest, LoadLatestLazilyRestoresChunksInBackground) {
+  for (bool deduplicate_chunks : {false, true}) {
+    ChunkStore chunk_store;
+    std::vector<std::shared_ptr<Table>> tables;
+    tables.push_back(MakeUniformTable("uniform"));
+    tables.push_back(MakePrioritizedTable("prioritized", 0.5));
+    InsertItems(&chunk_store, tables, 20);
+
+    auto options = SmallPartOptions();
+    options.deduplicate_chunks = deduplicate_chunks;
+    const std::string root = MakeRoot();
+    std::string path;
+    REVERB_ASSERT_OK(StreamingCheckpointer(root, options)
+                         .Save({tables[0].get(), tables[1].get()}, 1, &path));
+
+    StreamingCheckpointer checkpointer(root, options);
+    ChunkStore loaded_chunk_store;
+    std::vector<std::shared_ptr<Table>> loaded_tables;
+    loaded_tables.push_back(MakeUniformTable("uniform"));
+    loaded_tables.push_back(MakePrioritizedTable("prioritized", 0.5));
+    REVERB_ASSERT_OK(
+        checkpointer.LoadLatestLazily(&loaded_chunk_store, &loaded_tables));
+    ASSERT_EQ(loaded_tables[0]->size(), 20);
+    ASSERT_EQ(loaded_tables[1]->size(), 20);
+
+    auto all_resident = [&] {
+      for (const auto& table : loaded_tables) {
+        for (const auto& item : table->Copy()) {
+          for (const auto& chunk : item.chunks) {
+            if (!chunk->resident()) return false;
+          }
+        }
+      }
+      return true;
+    };
+    for (int i = 0; i < 1000 && !all_resident(); i++) {
+      absl::SleepFor(absl::Milliseconds(10));
+    }
+    EXPECT_TRUE(all_resident());
+    ExpectSameItemsAndData(tables, loaded_tables);
+  }
+}
+
+TEST(StreamingCheckpointerTest, LoadLatestLazilyReadsChunksOnDemand) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  InsertItems(&chunk_store, tables, 50);
+
+  const std::string root = MakeRoot();
+  std::string path;
+  REVERB_ASSERT_OK(StreamingCheckpointer(root, SmallPartOptions())
+                       .Save({tables[0].get()}, 1, &path));
+
+  StreamingCheckpointer checkpointer(root, SmallPartOptions());
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  REVERB_ASSERT_OK(
+      checkpointer.LoadLatestLazily(&loaded_chunk_store, &loaded_tables));
+
+  // Samples are served straight away, regardless of how far the background
+  // restore has progressed.
+  for (int i = 0; i < 20; i++) {
+    Table::SampledItem sample;
+    REVERB_ASSERT_OK(loaded_tables[0]->Sample(&sample));
+    Table::Item original;
+    ASSERT_TRUE(tables[0]->Get(sample.ref->item.key(), &original));
+    EXPECT_THAT(sample.ref->chunks[0]->data(),
+                EqualsProto(original.chunks[0]->data()));
+  }
+  ExpectSameItemsAndData(tables, loaded_tables);
+}
+
+TEST(StreamingCheckpointerTest, LoadLatestIsLazyIfRequestedByOptions) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  InsertItems(&chunk_store, tables, 50);
+
+  const std::string root = MakeRoot();
+  std::string path;
+  REVERB_ASSERT_OK(StreamingCheckpointer(root, SmallPartOptions())
+                       .Save({tables[0].get()}, 1, &path));
+
+  auto options = SmallPartOptions();
+  options.lazy_restore = true;
+  StreamingCheckpointer checkpointer(root, options);
+  EXPECT_THAT(checkpointer.DebugString(), HasSubstr("lazy_restore=1"));
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  REVERB_ASSERT_OK(
+      checkpointer.LoadLatest(&loaded_chunk_store, &loaded_tables));
+  ASSERT_EQ(loaded_tables[0]->size(), 50);
+  ExpectSameItemsAndData(tables, loaded_tables);
+}
+
+TEST(StreamingCheckpointerTest, KeepLatestZeroReturnsError) {
+  StreamingCheckpointer checkpointer(MakeRoot());
+  std::string path;
+  EXPECT_EQ(checkpointer.Save({}, 0, &path).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(StreamingCheckpointerTest, LoadLatestInEmptyDir) {
+  StreamingCheckpointer checkpointer(MakeRoot());
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  EXPECT_EQ(checkpointer.LoadLatest(&chunk_store, &tables).code(),
+            absl::StatusCode::kNotFound);
+}
+
+TEST(StreamingCheckpointerTest, LoadMissingFallbackCheckpoint) {
+  StreamingCheckpointer checkpointer(MakeRoot(),
+                                     StreamingCheckpointerOptions(),
+                                     MakeRoot());
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  EXPECT_EQ(checkpointer.LoadFallbackCheckpoint(&chunk_store, &tables).code(),
+            absl::StatusCode::kNotFound);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -15,6 +15,7 @@
 #include "reverb/cc/platform/tfrecord_checkpointer.h"
 
 #include <algorithm>
+#include <functional>
 #include <iterator>
 #include <memory>
 #include <string>
@@ -25,27 +26,26 @@
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
 #include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
 #include "absl/time/clock.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
 #include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/checkpoint_util.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/status_macros.h"
-#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/platform/tfrecord_util.h"
+#include "reverb/cc/platform/zlib.h"
 #include "reverb/cc/schema.pb.h"
-#include "reverb/cc/selectors/fifo.h"
-#include "reverb/cc/selectors/heap.h"
-#include "reverb/cc/selectors/interface.h"
-#include "reverb/cc/selectors/lifo.h"
-#include "reverb/cc/selectors/prioritized.h"
-#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/task_executor.h"
 #include "reverb/cc/support/tf_util.h"
-#include "reverb/cc/support/trajectory_util.h"
 #include "reverb/cc/table.h"
-#include "reverb/cc/table_extensions/interface.h"
 #include "tensorflow/core/lib/io/path.h"
 #include "tensorflow/core/lib/io/record_reader.h"
 #include "tensorflow/core/lib/io/record_writer.h"
@@ -57,96 +57,118 @@ namespace reverb {
 namespace {
 
 constexpr char kTablesFileName[] = "tables.tfrecord";
+constexpr char kCompressedTablesFileName[] = "tables-zlib.tfrecord";
 constexpr char kChunksFileName[] = "chunks.tfrecord";
-constexpr char kDoneFileName[] = "DONE";
-
-using RecordWriterUniquePtr =
-    std::unique_ptr<tensorflow::io::RecordWriter,
-                    std::function<void(tensorflow::io::RecordWriter*)>>;
-using RecordReaderUniquePtr =
-    std::unique_ptr<tensorflow::io::RecordReader,
-                    std::function<void(tensorflow::io::RecordReader*)>>;
-
-absl::Status OpenWriter(const std::string& path,
-                        RecordWriterUniquePtr* writer) {
-  std::unique_ptr<tensorflow::WritableFile> file;
-  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
-      tensorflow::Env::Default()->NewWritableFile(path, &file)));
-  auto* file_ptr = file.release();
-  *writer = RecordWriterUniquePtr(new tensorflow::io::RecordWriter(file_ptr),
-                                  [file_ptr](tensorflow::io::RecordWriter* w) {
-                                    delete w;
-                                    delete file_ptr;
-                                  });
-  return absl::OkStatus();
-}
-
-absl::Status OpenReader(const std::string& path,
-                        RecordReaderUniquePtr* reader) {
-  std::unique_ptr<tensorflow::RandomAccessFile> file;
-  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
-      tensorflow::Env::Default()->NewRandomAccessFile(path, &file)));
-  auto* file_ptr = file.release();
-  *reader = RecordReaderUniquePtr(new tensorflow::io::RecordReader(file_ptr),
-                                  [file_ptr](tensorflow::io::RecordReader* r) {
-                                    delete r;
-                                    delete file_ptr;
-                                  });
+constexpr char kChunksShardFileGlob[] = "chunks-*-of-*.tfrecord";
+constexpr char kParentsFileName[] = "parents.txt";
+
+// Reads the names of the checkpoints which hold the chunks not written to the
+// checkpoint in `path`. Full checkpoints have no parents.
+absl::Status ReadParents(const std::string& path,
+                         std::vector<std::string>* parents) {
+  const std::string filename =
+      tensorflow::io::JoinPath(path, kParentsFileName);
+  if (!tensorflow::Env::Default()->FileExists(filename).ok()) {
+    return absl::OkStatus();
+  }
+  std::string content;
+  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(tensorflow::ReadFileToString(
+      tensorflow::Env::Default(), filename, &content)));
+  for (absl::string_view name :
+       absl::StrSplit(content, '\n', absl::SkipEmpty())) {
+    parents->emplace_back(name);
+  }
   return absl::OkStatus();
 }
 
-inline absl::Status WriteDone(const std::string& path) {
-  std::unique_ptr<tensorflow::WritableFile> file;
-  REVERB_RETURN_IF_ERROR(
-      FromTensorflowStatus(tensorflow::Env::Default()->NewWritableFile(
-          tensorflow::io::JoinPath(path, kDoneFileName), &file)));
-  return FromTensorflowStatus(file->Close());
+inline absl::Status WriteParents(const std::string& path,
+                                 std::vector<std::string> parents) {
+  std::sort(parents.begin(), parents.end());
+  return FromTensorflowStatus(tensorflow::WriteStringToFile(
+      tensorflow::Env::Default(),
+      tensorflow::io::JoinPath(path, kParentsFileName),
+      absl::StrCat(absl::StrJoin(parents, "\n"), "\n")));
 }
 
-inline bool HasDone(const std::string& path) {
-  return tensorflow::Env::Default()
-      ->FileExists(tensorflow::io::JoinPath(path, kDoneFileName))
-      .ok();
+// Returns the name of the file holding shard `shard` of the chunks. Checkpoints
+// with a single shard use the unsharded file name so they can be read by older
+// versions.
+std::string ChunksFileName(int shard, int num_shards) {
+  if (num_shards == 1) {
+    return kChunksFileName;
+  }
+  return absl::StrFormat("chunks-%05d-of-%05d.tfrecord", shard, num_shards);
 }
 
-std::unique_ptr<ItemSelector> MakeDistribution(
-    const KeyDistributionOptions& options) {
-  switch (options.distribution_case()) {
-    case KeyDistributionOptions::kFifo:
-      return absl::make_unique<FifoSelector>();
-    case KeyDistributionOptions::kLifo:
-      return absl::make_unique<LifoSelector>();
-    case KeyDistributionOptions::kUniform:
-      return absl::make_unique<UniformSelector>();
-    case KeyDistributionOptions::kPrioritized:
-      return absl::make_unique<PrioritizedSelector>(
-          options.prioritized().priority_exponent());
-    case KeyDistributionOptions::kHeap:
-      return absl::make_unique<HeapSelector>(options.heap().min_heap());
-    case KeyDistributionOptions::DISTRIBUTION_NOT_SET:
-      REVERB_LOG(REVERB_FATAL) << "Selector not set";
-    default:
-      REVERB_LOG(REVERB_FATAL) << "Selector not supported";
+// Appends the paths of all the chunk files of the checkpoint in `path` to
+// `files`.
+absl::Status GetChunkFiles(const std::string& path,
+                           std::vector<std::string>* files) {
+  const std::string unsharded = tensorflow::io::JoinPath(path, kChunksFileName);
+  if (tensorflow::Env::Default()->FileExists(unsharded).ok()) {
+    files->push_back(unsharded);
   }
+  std::vector<std::string> shards;
+  REVERB_RETURN_IF_ERROR(
+      FromTensorflowStatus(tensorflow::Env::Default()->GetMatchingPaths(
+          tensorflow::io::JoinPath(path, kChunksShardFileGlob), &shards)));
+  std::sort(shards.begin(), shards.end());
+  files->insert(files->end(), shards.begin(), shards.end());
+  return absl::OkStatus();
 }
 
-inline size_t find_table_index(
-    const std::vector<std::shared_ptr<Table>>* tables,
-    const std::string& name) {
-  for (int i = 0; i < tables->size(); i++) {
-    if (tables->at(i)->name() == name) return i;
+// Adds the counters and timings of the chunk files to `stats`.
+void AddChunkFileStats(const std::vector<internal::ChunkFileStats>& files,
+                       TFRecordCheckpointer::Stats* stats) {
+  for (const auto& file : files) {
+    stats->num_records += file.num_records;
+    stats->num_bytes += file.num_bytes;
+    stats->serialization += file.serialization;
+    stats->io += file.io;
+    stats->restore += file.insertion;
   }
-  return -1;
 }
 
 }  // namespace
 
+double TFRecordCheckpointer::Stats::records_per_second() const {
+  return num_records / absl::ToDoubleSeconds(total);
+}
+
+double TFRecordCheckpointer::Stats::bytes_per_second() const {
+  return num_bytes / absl::ToDoubleSeconds(total);
+}
+
+std::string TFRecordCheckpointer::Stats::DebugString() const {
+  return absl::StrCat(
+      "Stats(num_tables=", num_tables, ", num_records=", num_records,
+      ", num_bytes=", num_bytes, ", total=", absl::FormatDuration(total),
+      ", lock=", absl::FormatDuration(lock),
+      ", serialization=", absl::FormatDuration(serialization),
+      ", io=", absl::FormatDuration(io),
+      ", commit=", absl::FormatDuration(commit),
+      ", cleanup=", absl::FormatDuration(cleanup),
+      ", restore=", absl::FormatDuration(restore), ")");
+}
+
 TFRecordCheckpointer::TFRecordCheckpointer(
     std::string root_dir, std::string group,
-    absl::optional<std::string> fallback_checkpoint_path)
+    absl::optional<std::string> fallback_checkpoint_path,
+    int max_incremental_checkpoints, int num_shards, bool compress_tables,
+    int num_serialization_threads)
     : root_dir_(std::move(root_dir)),
       group_(std::move(group)),
-      fallback_checkpoint_path_(std::move(fallback_checkpoint_path)) {
+      fallback_checkpoint_path_(std::move(fallback_checkpoint_path)),
+      max_incremental_checkpoints_(max_incremental_checkpoints),
+      num_shards_(num_shards),
+      compress_tables_(compress_tables) {
+  REVERB_CHECK_GE(max_incremental_checkpoints_, 0);
+  REVERB_CHECK_GE(num_shards_, 1);
+  REVERB_CHECK_GE(num_serialization_threads, 0);
+  if (num_serialization_threads > 0) {
+    serialization_executor_ = std::make_unique<TaskExecutor>(
+        num_serialization_threads, "TFRecordCheckpointer_Serialize");
+  }
   REVERB_LOG(REVERB_INFO) << " Initializing TFRecordCheckpointer in "
                           << root_dir_
                           << (fallback_checkpoint_path_.has_value()
@@ -167,40 +189,128 @@ absl::Status TFRecordCheckpointer::Save(std::vector<Table*> tables,
         "Setting non-empty group is not supported");
   }
 
-  std::string dir_path =
-      tensorflow::io::JoinPath(root_dir_, absl::FormatTime(absl::Now()));
+  absl::MutexLock lock(&mu_);
+  const absl::Time start = absl::Now();
+  Stats stats;
+  internal::Stopwatch stopwatch;
+  const std::string dir_name = absl::FormatTime(start);
+  std::string dir_path = tensorflow::io::JoinPath(root_dir_, dir_name);
+  REVERB_LOG(REVERB_INFO) << "Saving checkpoint of " << tables.size()
+                          << " tables to " << dir_path;
   REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
       tensorflow::Env::Default()->RecursivelyCreateDir(dir_path)));
 
-  RecordWriterUniquePtr table_writer;
-  REVERB_RETURN_IF_ERROR(OpenWriter(
-      tensorflow::io::JoinPath(dir_path, kTablesFileName), &table_writer));
+  stats.io += stopwatch.Lap();
 
-  absl::flat_hash_set<std::shared_ptr<ChunkStore::Chunk>> chunks;
+  // The snapshots are cheap, so they are all taken before any of them is
+  // turned into a checkpoint.
+  std::vector<Table::Snapshot> snapshots;
+  snapshots.reserve(tables.size());
   for (Table* table : tables) {
-    auto checkpoint = table->Checkpoint();
-    chunks.merge(checkpoint.chunks);
-    REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
-        table_writer->WriteRecord(checkpoint.checkpoint.SerializeAsString())));
+    snapshots.push_back(table->TakeSnapshot());
   }
+  stats.lock += stopwatch.Lap();
+
+  std::vector<absl::flat_hash_set<std::shared_ptr<ChunkStore::Chunk>>>
+      table_chunks(tables.size());
+  internal::ChunkFileStats tables_stats;
+  REVERB_RETURN_IF_ERROR(internal::WriteRecords(
+      tensorflow::io::JoinPath(dir_path, compress_tables_
+                                             ? kCompressedTablesFileName
+                                             : kTablesFileName),
+      snapshots.size(),
+      [&](int64_t index, std::string* record) {
+        auto checkpoint = snapshots[index].ToCheckpoint();
+        table_chunks[index] = std::move(checkpoint.chunks);
+        if (!compress_tables_) {
+          *record = checkpoint.checkpoint.SerializeAsString();
+          return absl::OkStatus();
+        }
+        if (!ZlibCompressFromString(checkpoint.checkpoint.SerializeAsString(),
+                                    /*level=*/-1, record)) {
+          return absl::InternalError(absl::StrCat(
+              "Failed to compress the checkpoint of table ",
+              checkpoint.checkpoint.table_name(), "."));
+        }
+        return absl::OkStatus();
+      },
+      serialization_executor_.get(), /*offsets=*/nullptr, &tables_stats));
+  snapshots.clear();
+  AddChunkFileStats({tables_stats}, &stats);
+  stats.num_tables = tables.size();
+  stopwatch.Lap();
 
-  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(table_writer->Close()));
-  table_writer = nullptr;
-
-  RecordWriterUniquePtr chunk_writer;
-  REVERB_RETURN_IF_ERROR(OpenWriter(
-      tensorflow::io::JoinPath(dir_path, kChunksFileName), &chunk_writer));
+  absl::flat_hash_set<std::shared_ptr<ChunkStore::Chunk>> chunks;
+  for (auto& referenced : table_chunks) {
+    chunks.merge(referenced);
+  }
+  table_chunks.clear();
+
+  // Find the previous checkpoints which already hold some of the chunks. If
+  // there are too many of them then a full checkpoint is written instead.
+  internal::flat_hash_set<std::string> parents;
+  if (max_incremental_checkpoints_ > 0) {
+    for (const auto& chunk : chunks) {
+      auto it = saved_chunks_.find(chunk->key());
+      if (it != saved_chunks_.end()) {
+        parents.insert(it->second);
+      }
+    }
+    if (parents.size() > max_incremental_checkpoints_) {
+      parents.clear();
+    }
+  }
 
+  // Split the chunks which have to be written over the shards.
+  internal::flat_hash_map<ChunkStore::Key, std::string> saved_chunks;
+  std::vector<std::vector<std::shared_ptr<ChunkStore::Chunk>>> shards(
+      num_shards_);
   for (const auto& chunk : chunks) {
-    REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
-        chunk_writer->WriteRecord(chunk->data().SerializeAsString())));
+    if (!parents.empty()) {
+      auto it = saved_chunks_.find(chunk->key());
+      if (it != saved_chunks_.end()) {
+        saved_chunks[chunk->key()] = it->second;
+        continue;
+      }
+    }
+    shards[chunk->key() % num_shards_].push_back(chunk);
+    if (max_incremental_checkpoints_ > 0) {
+      saved_chunks[chunk->key()] = dir_name;
+    }
+  }
+  size_t num_written = 0;
+  for (const auto& shard : shards) {
+    num_written += shard.size();
+  }
+  REVERB_LOG(REVERB_INFO) << "Writing " << num_written << " of the "
+                          << chunks.size() << " referenced chunks to "
+                          << num_shards_ << " files (the others are in "
+                          << parents.size() << " parent checkpoints)";
+  chunks.clear();
+  stats.serialization += stopwatch.Lap();
+
+  std::vector<internal::ChunkFileStats> shard_stats(num_shards_);
+  REVERB_RETURN_IF_ERROR(internal::RunInParallel(
+      num_shards_, "TFRecordCheckpointer_SaveChunks", [&](int shard) {
+        return internal::SaveChunks(
+            tensorflow::io::JoinPath(dir_path,
+                                     ChunksFileName(shard, num_shards_)),
+            shards[shard], /*offsets=*/nullptr, &shard_stats[shard],
+            serialization_executor_.get());
+      }));
+  AddChunkFileStats(shard_stats, &stats);
+  stopwatch.Lap();
+
+  if (!parents.empty()) {
+    REVERB_RETURN_IF_ERROR(WriteParents(
+        dir_path, std::vector<std::string>(parents.begin(), parents.end())));
   }
-  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(chunk_writer->Close()));
-  chunk_writer = nullptr;
 
   // Both chunks and table checkpoint has now been written so we can proceed to
   // add the DONE-file.
-  REVERB_RETURN_IF_ERROR(WriteDone(dir_path));
+  REVERB_RETURN_IF_ERROR(internal::WriteDone(dir_path));
+  saved_chunks_ = std::move(saved_chunks);
+  stats.commit += stopwatch.Lap();
 
   // Delete the older checkpoints.
   std::vector<std::string> filenames;
@@ -208,9 +318,22 @@ absl::Status TFRecordCheckpointer::Save(std::vector<Table*> tables,
       FromTensorflowStatus(tensorflow::Env::Default()->GetMatchingPaths(
           tensorflow::io::JoinPath(root_dir_, "*"), &filenames)));
   std::sort(filenames.begin(), filenames.end());
+
+  // Checkpoints which are parents of the checkpoints we keep must be kept too.
+  internal::flat_hash_set<std::string> required_parents;
   int history_counter = 0;
+  for (auto it = filenames.rbegin();
+       it != filenames.rend() && history_counter < keep_latest;
+       it++, history_counter++) {
+    std::vector<std::string> kept_parents;
+    REVERB_RETURN_IF_ERROR(ReadParents(*it, &kept_parents));
+    required_parents.insert(kept_parents.begin(), kept_parents.end());
+  }
+
+  history_counter = 0;
   for (auto it = filenames.rbegin(); it != filenames.rend(); it++) {
-    if (++history_counter > keep_latest) {
+    if (++history_counter > keep_latest &&
+        !required_parents.contains(tensorflow::io::Basename(*it))) {
       tensorflow::int64 undeleted_files;
       tensorflow::int64 undeleted_dirs;
       REVERB_RETURN_IF_ERROR(
@@ -218,6 +341,15 @@ absl::Status TFRecordCheckpointer::Save(std::vector<Table*> tables,
               *it, &undeleted_files, &undeleted_dirs)));
     }
   }
+  stats.cleanup += stopwatch.Lap();
+
+  stats.total = absl::Now() - start;
+  REVERB_LOG(REVERB_INFO) << "Saved checkpoint to " << dir_path << ": "
+                          << stats.DebugString();
+  {
+    absl::MutexLock stats_lock(&stats_mu_);
+    last_save_stats_ = stats;
+  }
 
   *path = std::move(dir_path);
   return absl::OkStatus();
@@ -227,156 +359,68 @@ absl::Status TFRecordCheckpointer::Load(
     absl::string_view path, ChunkStore* chunk_store,
     std::vector<std::shared_ptr<Table>>* tables) {
   REVERB_LOG(REVERB_INFO) << "Loading checkpoint from " << std::string(path);
-  if (!HasDone(std::string(path))) {
+  const absl::Time start = absl::Now();
+  Stats stats;
+  internal::Stopwatch stopwatch;
+  if (!internal::HasDone(std::string(path))) {
     return absl::InvalidArgumentError(absl::StrCat(
         "Load called with invalid checkpoint path: ", std::string(path)));
   }
   // Insert data first to ensure that all data referenced by the tables
-  // exists. Keep the map of chunks around so that none of the chunks are
-  // cleaned up before all the tables have been loaded.
-  internal::flat_hash_map<ChunkStore::Key, std::shared_ptr<ChunkStore::Chunk>>
-      chunk_by_key;
-  {
-    RecordReaderUniquePtr chunk_reader;
-    REVERB_RETURN_IF_ERROR(
-        OpenReader(tensorflow::io::JoinPath(std::string(path), kChunksFileName),
-                   &chunk_reader));
-
-    ChunkData chunk_data;
-    absl::Status chunk_status;
-    tensorflow::uint64 chunk_offset = 0;
-    tensorflow::tstring chunk_record;
-    do {
-      chunk_status = FromTensorflowStatus(
-          chunk_reader->ReadRecord(&chunk_offset, &chunk_record));
-      if (!chunk_status.ok()) break;
-      if (!chunk_data.ParseFromArray(chunk_record.data(),
-                                     chunk_record.size())) {
-        return absl::DataLossError(
-            absl::StrCat("Could not parse TFRecord as ChunkData: '",
-                         absl::string_view(chunk_record), "'"));
-      }
-      if (chunk_data.deprecated_data_size()) {
-        if (!chunk_data.data().tensors().empty()) {
-          return absl::InternalError(
-              absl::StrCat("Checkpoint ChunkData at offset: ", chunk_offset,
-              " has both data and deprecated_data."));
-        }
-        chunk_data.mutable_data()->mutable_tensors()->Swap(
-            chunk_data.mutable_deprecated_data());
-      }
-      chunk_by_key[chunk_data.chunk_key()] = chunk_store->Insert(chunk_data);
-    } while (chunk_status.ok());
-    if (!absl::IsOutOfRange(chunk_status)) {
-      return chunk_status;
-    }
-  }
-
-  RecordReaderUniquePtr table_reader;
-  REVERB_RETURN_IF_ERROR(
-      OpenReader(tensorflow::io::JoinPath(std::string(path), kTablesFileName),
-                 &table_reader));
-
-  PriorityTableCheckpoint checkpoint;
-  absl::Status table_status;
-  tensorflow::uint64 table_offset = 0;
-  tensorflow::tstring table_record;
-  do {
-    table_status = FromTensorflowStatus(
-        table_reader->ReadRecord(&table_offset, &table_record));
-    if (!table_status.ok()) break;
-    if (!checkpoint.ParseFromArray(table_record.data(), table_record.size())) {
+  // exists. Keep the loaded chunks around so that none of them are cleaned up
+  // before all the tables have been loaded.
+  std::vector<std::string> chunk_files;
+  std::vector<std::string> parents;
+  REVERB_RETURN_IF_ERROR(ReadParents(std::string(path), &parents));
+  for (const auto& parent : parents) {
+    const std::string parent_path = tensorflow::io::JoinPath(
+        tensorflow::io::Dirname(path), parent);
+    if (!internal::HasDone(parent_path)) {
       return absl::DataLossError(
-          absl::StrCat("Could not parse TFRecord as Checkpoint: '",
-                       absl::string_view(table_record), "'"));
+          absl::StrCat("Checkpoint ", std::string(path),
+                       " depends on missing or incomplete checkpoint ",
+                       parent_path, "."));
     }
+    REVERB_RETURN_IF_ERROR(GetChunkFiles(parent_path, &chunk_files));
+  }
+  REVERB_RETURN_IF_ERROR(GetChunkFiles(std::string(path), &chunk_files));
+  if (chunk_files.empty()) {
+    return absl::DataLossError(absl::StrCat(
+        "No chunk files found in checkpoint ", std::string(path), "."));
+  }
 
-    int index = find_table_index(tables, checkpoint.table_name());
-    if (index == -1) {
-      std::vector<std::string> table_names;
-      for (const auto& table : *tables) {
-        table_names.push_back(absl::StrCat("'", table->name(), "'"));
-      }
-      return absl::InvalidArgumentError(absl::StrCat(
-          "Trying to load table ", checkpoint.table_name(),
-          " but table was not found in provided list of tables. Available "
-          "tables: [",
-          absl::StrJoin(table_names, ", "), "]"));
-    }
-
-    auto sampler = MakeDistribution(checkpoint.sampler());
-    auto remover = MakeDistribution(checkpoint.remover());
-    auto rate_limiter =
-        std::make_shared<RateLimiter>(checkpoint.rate_limiter());
-    auto extensions = tables->at(index)->UnsafeClearExtensions();
-    auto signature =
-        checkpoint.has_signature()
-            ? absl::make_optional(std::move(checkpoint.signature()))
-            : absl::nullopt;
-
-    auto table = std::make_shared<Table>(
-        /*name=*/checkpoint.table_name(),
-        /*sampler=*/std::move(sampler),
-        /*remover=*/std::move(remover),
-        /*max_size=*/checkpoint.max_size(),
-        /*max_times_sampled=*/checkpoint.max_times_sampled(),
-        /*rate_limiter=*/std::move(rate_limiter),
-        /*extensions=*/std::move(extensions),
-        /*signature=*/std::move(signature));
-    table->set_num_deleted_episodes_from_checkpoint(
-        checkpoint.num_deleted_episodes());
-    table->set_num_unique_samples_from_checkpoint(
-        checkpoint.num_unique_samples());
-
-    for (const auto& checkpoint_item : checkpoint.items()) {
-      Table::Item insert_item;
-      insert_item.item = checkpoint_item;
-
-      if (insert_item.item.has_deprecated_sequence_range() &&
-          insert_item.item.has_flat_trajectory()) {
-        return absl::InternalError(
-            absl::StrCat("Item ", insert_item.item.key(),
-                         " has both deprecated and new trajectory format: ",
-                         insert_item.item.DebugString(), "."));
-      }
-
-      if (insert_item.item.has_deprecated_sequence_range()) {
-        std::vector<std::shared_ptr<ChunkStore::Chunk>> trajectory_chunks;
-        REVERB_RETURN_IF_ERROR(FromTensorflowStatus(chunk_store->Get(
-            insert_item.item.deprecated_chunk_keys(), &trajectory_chunks)));
-
-        *insert_item.item.mutable_flat_trajectory() =
-            internal::FlatTimestepTrajectory(
-                trajectory_chunks,
-                insert_item.item.deprecated_sequence_range().offset(),
-                insert_item.item.deprecated_sequence_range().length());
-
-        insert_item.item.clear_deprecated_sequence_range();
-        insert_item.item.clear_deprecated_chunk_keys();
-      }
-
-      for (const auto& key :
-           internal::GetChunkKeys(insert_item.item.flat_trajectory())) {
-        if (!chunk_by_key.contains(key)) {
-          return absl::DataLossError(absl::StrCat(
-              "TFRecordCheckpointer::Load: chunk_by_key does not contain key: ",
-              key));
-        }
-        insert_item.chunks.push_back(chunk_by_key[key]);
-      }
-
-      // The original table has already been destroyed so if this fails then
-      // there is way to recover.
-      REVERB_RETURN_IF_ERROR(
-          table->InsertCheckpointItem(std::move(insert_item)));
-    }
-
-    tables->at(index).swap(table);
-  } while (table_status.ok());
-
-  if (!absl::IsOutOfRange(table_status)) {
-    return table_status;
+  stats.io += stopwatch.Lap();
+
+  std::vector<std::vector<std::shared_ptr<ChunkStore::Chunk>>> loaded_chunks(
+      chunk_files.size());
+  std::vector<internal::ChunkFileStats> file_stats(chunk_files.size());
+  REVERB_RETURN_IF_ERROR(internal::RunInParallel(
+      chunk_files.size(), "TFRecordCheckpointer_LoadChunks", [&](int i) {
+        return internal::LoadChunks(chunk_files[i], chunk_store,
+                                    &loaded_chunks[i], &file_stats[i]);
+      }));
+  AddChunkFileStats(file_stats, &stats);
+  stopwatch.Lap();
+  REVERB_LOG(REVERB_INFO) << "Read " << stats.num_records << " chunks from "
+                          << chunk_files.size() << " files, restoring tables";
+
+  const std::string compressed_tables_file = tensorflow::io::JoinPath(
+      std::string(path), kCompressedTablesFileName);
+  if (tensorflow::Env::Default()->FileExists(compressed_tables_file).ok()) {
+    REVERB_RETURN_IF_ERROR(internal::LoadTables(
+        compressed_tables_file, chunk_store, tables, /*compressed=*/true));
+  } else {
+    REVERB_RETURN_IF_ERROR(internal::LoadTables(
+        tensorflow::io::JoinPath(std::string(path), kTablesFileName),
+        chunk_store, tables));
   }
+  stats.restore += stopwatch.Lap();
+
+  stats.total = absl::Now() - start;
+  REVERB_LOG(REVERB_INFO) << "Loaded checkpoint from " << std::string(path)
+                          << ": " << stats.DebugString();
+  absl::MutexLock stats_lock(&stats_mu_);
+  last_load_stats_ = stats;
   return absl::OkStatus();
 }
 
@@ -389,7 +433,7 @@ absl::Status TFRecordCheckpointer::LoadLatest(
           tensorflow::io::JoinPath(root_dir_, "*"), &filenames)));
   std::sort(filenames.begin(), filenames.end());
   for (auto it = filenames.rbegin(); it != filenames.rend(); it++) {
-    if (HasDone(*it)) {
+    if (internal::HasDone(*it)) {
       return Load(
           tensorflow::io::JoinPath(root_dir_, tensorflow::io::Basename(*it)),
           chunk_store, tables);
@@ -404,16 +448,34 @@ absl::Status TFRecordCheckpointer::LoadFallbackCheckpoint(
   if (!fallback_checkpoint_path_.has_value()) {
     return absl::NotFoundError("No fallback checkpoint path provided.");
   }
-  if (HasDone(fallback_checkpoint_path_.value())) {
+  if (internal::HasDone(fallback_checkpoint_path_.value())) {
     return Load(fallback_checkpoint_path_.value(), chunk_store, tables);
   }
   return absl::NotFoundError(absl::StrCat("No checkpoint found in ",
                                           fallback_checkpoint_path_.value()));
 }
 
+TFRecordCheckpointer::Stats TFRecordCheckpointer::last_save_stats() const {
+  absl::MutexLock lock(&stats_mu_);
+  return last_save_stats_;
+}
+
+TFRecordCheckpointer::Stats TFRecordCheckpointer::last_load_stats() const {
+  absl::MutexLock lock(&stats_mu_);
+  return last_load_stats_;
+}
+
 std::string TFRecordCheckpointer::DebugString() const {
   return absl::StrCat("TFRecordCheckpointer(root_dir=", root_dir_,
-                      ", group=", group_, ")");
+                      ", group=", group_, ", max_incremental_checkpoints=",
+                      max_incremental_checkpoints_,
+                      ", num_shards=", num_shards_,
+                      ", compress_tables=", compress_tables_,
+                      ", num_serialization_threads=",
+                      serialization_executor_ != nullptr
+                          ? serialization_executor_->num_threads()
+                          : 0,
+                      ")");
 }
 
 }  // namespace reverb
@@ -15,15 +15,20 @@
 #ifndef REVERB_CC_PLATFORM_TFRECORD_CHECKPOINTER_H_
 #define REVERB_CC_PLATFORM_TFRECORD_CHECKPOINTER_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "absl/status/status.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "reverb/cc/checkpointing/interface.h"
 #include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/support/task_executor.h"
 #include "reverb/cc/table.h"
 
 namespace deepmind {
@@ -58,6 +63,43 @@ namespace reverb {
 // The most recent checkpoint can therefore be inferred from the name of the
 // directories within `root_dir`.
 //
+// If `max_incremental_checkpoints` > 0 then checkpoints are incremental: chunks
+// which were written by one of the previous checkpoints (by the same
+// checkpointer) are not written again. Instead the checkpoint directory
+// contains an additional file
+//
+//       parents.txt
+//
+// which lists (one per line) the names of the sibling checkpoint directories
+// which hold the remaining chunks. `Load` reads the chunks of the parents
+// before the chunks of the checkpoint itself, and `Save` never deletes a
+// checkpoint which is still a parent of one of the `keep_latest` most recent
+// checkpoints. A full checkpoint is written whenever the new checkpoint would
+// otherwise depend on more than `max_incremental_checkpoints` parents, which
+// bounds the number of files read by `Load`. As the state is kept in memory,
+// the first checkpoint written by a new checkpointer is always a full one.
+//
+// If `num_shards` > 1 then the chunks are split by key over `num_shards` files
+//
+//       chunks-<shard>-of-<num_shards>.tfrecord
+//
+// which are written by one thread each. `Load` accepts checkpoints with any
+// number of shards and reads all chunk files in parallel. The tables of a
+// checkpoint are also restored in parallel.
+//
+// If `compress_tables` is true then the table records, which hold the items
+// and compress well (unlike the chunks whose tensors are already compressed),
+// are compressed with zlib one by one and written to
+//
+//       tables-zlib.tfrecord
+//
+// instead of `tables.tfrecord`. `Load` reads either file.
+//
+// If `num_serialization_threads` > 0 then the table and chunk records are
+// built, serialized and compressed on a pool of that many threads while the
+// records are written, in order, by one thread per file. Otherwise every file
+// is serialized by the thread writing it.
+//
 // If `group` is nonempty then the directory containing the checkpoint will be
 // created with `group` as group.
 //
@@ -65,11 +107,55 @@ namespace reverb {
 // a checkpoint to be reloaded when no checkpoints can be found in `root_dir`.
 // In practice, this enables use a checkpoint for previous experiment for
 // initialization.
+//
+// Every `Save` and `Load` logs its progress and, once done, the counters and
+// timings of its phases (see `Stats`). The stats of the most recent calls are
+// also returned by `last_save_stats` and `last_load_stats`.
 class TFRecordCheckpointer : public Checkpointer {
  public:
+  // Counters and per phase timings of a `Save` or `Load` call. The chunk
+  // files are written and read by one thread per file, so the phases which
+  // involve them are summed over the threads and may add up to more than
+  // `total`.
+  struct Stats {
+    // Tables written (`Save` only).
+    int64_t num_tables = 0;
+    // Records written or read, i.e one per table and one per chunk, and their
+    // size in bytes. `Load` only counts the chunks.
+    int64_t num_records = 0;
+    int64_t num_bytes = 0;
+
+    // Wall time of the whole call.
+    absl::Duration total;
+
+    // `Save` only: time the table locks were held to take a snapshot of the
+    // items (see `Table::TakeSnapshot`), i.e how long the tables were blocked.
+    absl::Duration lock;
+    // Time spent building and serializing (`Save`) or parsing (`Load`) the
+    // records.
+    absl::Duration serialization;
+    // Time spent opening, writing or reading and closing the files.
+    absl::Duration io;
+    // `Save` only: time spent writing the DONE file (and the parents file),
+    // which commits the checkpoint, and deleting the older checkpoints.
+    absl::Duration commit;
+    absl::Duration cleanup;
+    // `Load` only: time spent inserting the chunks into the chunk store and
+    // restoring the tables (which includes reading the tables file).
+    absl::Duration restore;
+
+    // Records and bytes written or read per second of `total`.
+    double records_per_second() const;
+    double bytes_per_second() const;
+
+    std::string DebugString() const;
+  };
+
   explicit TFRecordCheckpointer(
       std::string root_dir, std::string group = "",
-      absl::optional<std::string> fallback_checkpoint_path = absl::nullopt);
+      absl::optional<std::string> fallback_checkpoint_path = absl::nullopt,
+      int max_incremental_checkpoints = 0, int num_shards = 1,
+      bool compress_tables = false, int num_serialization_threads = 0);
 
   // Save a new checkpoint for every table in `tables` in sub directory
   // inside `root_dir_`. If the call is successful, the ABSOLUTE path to the
@@ -106,6 +192,11 @@ class TFRecordCheckpointer : public Checkpointer {
   // Returns a summary string description.
   std::string DebugString() const override;
 
+  // Stats of the most recent successful `Save` and `Load` (or default stats if
+  // there hasn't been one yet).
+  Stats last_save_stats() const ABSL_LOCKS_EXCLUDED(stats_mu_);
+  Stats last_load_stats() const ABSL_LOCKS_EXCLUDED(stats_mu_);
+
   // TFRecordCheckpointer is neither copyable nor movable.
   TFRecordCheckpointer(const TFRecordCheckpointer&) = delete;
   TFRecordCheckpointer& operator=(const TFRecordCheckpointer&) = delete;
@@ -114,6 +205,27 @@ class TFRecordCheckpointer : public Checkpointer {
   const std::string root_dir_;
   const std::string group_;
   absl::optional<std::string> fallback_checkpoint_path_;
+  const int max_incremental_checkpoints_;
+  const int num_shards_;
+  const bool compress_tables_;
+
+  // Threads serializing the records of `Save`. Null if records are serialized
+  // by the writing threads.
+  std::unique_ptr<TaskExecutor> serialization_executor_;
+
+  // Serializes calls to `Save`.
+  absl::Mutex mu_;
+
+  // Name of the checkpoint directory (inside `root_dir_`) holding each of the
+  // chunks referenced by the most recent checkpoint. Only populated when
+  // incremental checkpoints are enabled.
+  internal::flat_hash_map<ChunkStore::Key, std::string> saved_chunks_
+      ABSL_GUARDED_BY(mu_);
+
+  // `Load` doesn't hold `mu_` so the stats have their own lock.
+  mutable absl::Mutex stats_mu_;
+  Stats last_save_stats_ ABSL_GUARDED_BY(stats_mu_);
+  Stats last_load_stats_ ABSL_GUARDED_BY(stats_mu_);
 };
 
 }  // namespace reverb
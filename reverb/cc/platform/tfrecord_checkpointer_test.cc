@@ -22,6 +22,7 @@
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/strings/str_format.h"
 #include "reverb/cc/chunk_store.h"
 #include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/platform/status_matchers.h"
@@ -36,6 +37,7 @@
 #include "tensorflow/core/framework/tensor_shape.pb.h"
 #include "tensorflow/core/framework/types.pb.h"
 #include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/io/record_reader.h"
 #include "tensorflow/core/platform/env.h"
 
 namespace deepmind {
@@ -165,6 +167,33 @@ TEST(TFRecordCheckpointerTest, SaveAndLoad) {
   }
 }
 
+TEST(TFRecordCheckpointerTest, LoadKeepsSnapshotSamplingOfTable) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  for (int i = 0; i < 10; i++) {
+    auto chunk = chunk_store.Insert(testing::MakeChunkData(i));
+    REVERB_EXPECT_OK(tables[0]->InsertOrAssign(
+        {testing::MakePrioritizedItem(i, i, {chunk->data()}), {chunk}}));
+  }
+
+  TFRecordCheckpointer checkpointer(MakeRoot());
+  std::string path;
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &path));
+
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  REVERB_ASSERT_OK(loaded_tables[0]->SetSnapshotSampling(true));
+  REVERB_ASSERT_OK(
+      checkpointer.Load(path, &loaded_chunk_store, &loaded_tables));
+  EXPECT_TRUE(loaded_tables[0]->snapshot_sampling());
+  EXPECT_EQ(loaded_tables[0]->size(), 10);
+
+  Table::SampledItem sample;
+  REVERB_EXPECT_OK(loaded_tables[0]->Sample(&sample));
+}
+
 TEST(TFRecordCheckpointerTest, SaveDeletesOldData) {
   ChunkStore chunk_store;
 
@@ -213,6 +242,226 @@ TEST(TFRecordCheckpointerTest, SaveDeletesOldData) {
   test(5);  // Edge case keep_latest > num_tables
 }
 
+// Returns the path of the (unsharded) chunk file of the checkpoint in `path`.
+std::string ChunksFile(const std::string& path) {
+  return tensorflow::io::JoinPath(path, "chunks.tfrecord");
+}
+
+// Returns the number of chunks stored in the chunk file `filename`.
+int NumStoredChunks(const std::string& filename) {
+  std::unique_ptr<tensorflow::RandomAccessFile> file;
+  REVERB_CHECK(
+      tensorflow::Env::Default()->NewRandomAccessFile(filename, &file).ok());
+  tensorflow::io::RecordReader reader(file.get());
+  tensorflow::uint64 offset = 0;
+  tensorflow::tstring record;
+  int count = 0;
+  while (reader.ReadRecord(&offset, &record).ok()) count++;
+  return count;
+}
+
+TEST(TFRecordCheckpointerTest, IncrementalSaveOnlyWritesNewChunks) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+
+  auto insert_items = [&](int start, int end) {
+    for (int i = start; i < end; i++) {
+      auto chunk = chunk_store.Insert(testing::MakeChunkData(1000 + i));
+      REVERB_EXPECT_OK(tables[0]->InsertOrAssign(
+          {testing::MakePrioritizedItem(i, i, {chunk->data()}), {chunk}}));
+    }
+  };
+
+  auto root = MakeRoot();
+  TFRecordCheckpointer checkpointer(root, "", absl::nullopt,
+                                    /*max_incremental_checkpoints=*/2);
+
+  insert_items(0, 10);
+  std::string first;
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &first));
+  EXPECT_EQ(NumStoredChunks(ChunksFile(first)), 10);
+
+  insert_items(10, 15);
+  std::string second;
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &second));
+  EXPECT_EQ(NumStoredChunks(ChunksFile(second)), 5);
+
+  // The first checkpoint is still required by the second one so it must not be
+  // deleted even though only one checkpoint is kept.
+  auto* env = tensorflow::Env::Default();
+  REVERB_EXPECT_OK(FromTensorflowStatus(env->FileExists(first)));
+
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  REVERB_ASSERT_OK(
+      checkpointer.Load(second, &loaded_chunk_store, &loaded_tables));
+  EXPECT_EQ(loaded_tables[0]->size(), 15);
+
+  // Depending on a third checkpoint exceeds the limit so a full checkpoint is
+  // written and the older checkpoints can be deleted.
+  insert_items(15, 20);
+  std::string third;
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &third));
+  EXPECT_EQ(NumStoredChunks(ChunksFile(third)), 5);
+  insert_items(20, 25);
+  std::string fourth;
+  REVERB_ASSERT_OK(checkpointer.Save({tables[0].get()}, 1, &fourth));
+  EXPECT_EQ(NumStoredChunks(ChunksFile(fourth)), 25);
+  EXPECT_EQ(env->FileExists(first).code(), tensorflow::error::NOT_FOUND);
+  EXPECT_EQ(env->FileExists(second).code(), tensorflow::error::NOT_FOUND);
+  EXPECT_EQ(env->FileExists(third).code(), tensorflow::error::NOT_FOUND);
+}
+
+TEST(TFRecordCheckpointerTest, ShardedSaveAndLoad) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  tables.push_back(MakePrioritizedTable("prioritized", 0.5));
+
+  std::vector<ChunkStore::Key> chunk_keys;
+  for (int i = 0; i < 100; i++) {
+    for (int j = 0; j < tables.size(); j++) {
+      chunk_keys.push_back((j + 1) * 1000 + i);
+      auto chunk =
+          chunk_store.Insert(testing::MakeChunkData(chunk_keys.back()));
+      REVERB_EXPECT_OK(tables[j]->InsertOrAssign(
+          {testing::MakePrioritizedItem(i, i, {chunk->data()}), {chunk}}));
+    }
+  }
+
+  TFRecordCheckpointer checkpointer(MakeRoot(), "", absl::nullopt,
+                                    /*max_incremental_checkpoints=*/0,
+                                    /*num_shards=*/4);
+  std::string path;
+  REVERB_ASSERT_OK(
+      checkpointer.Save({tables[0].get(), tables[1].get()}, 1, &path));
+
+  std::vector<std::string> shards;
+  REVERB_ASSERT_OK(
+      FromTensorflowStatus(tensorflow::Env::Default()->GetMatchingPaths(
+          tensorflow::io::JoinPath(path, "chunks-*-of-00004.tfrecord"),
+          &shards)));
+  EXPECT_THAT(shards, ::testing::SizeIs(4));
+  int num_chunks = 0;
+  for (const auto& shard : shards) {
+    num_chunks += NumStoredChunks(shard);
+  }
+  EXPECT_EQ(num_chunks, chunk_keys.size());
+
+  // The checkpoint can be loaded by a checkpointer with a different number of
+  // shards.
+  TFRecordCheckpointer loader(MakeRoot());
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  loaded_tables.push_back(MakePrioritizedTable("prioritized", 0.5));
+  REVERB_ASSERT_OK(loader.Load(path, &loaded_chunk_store, &loaded_tables));
+
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
+  REVERB_EXPECT_OK(
+      FromTensorflowStatus(loaded_chunk_store.Get(chunk_keys, &chunks)));
+  for (int i = 0; i < tables.size(); i++) {
+    EXPECT_EQ(loaded_tables[i]->size(), tables[i]->size());
+  }
+}
+
+TEST(TFRecordCheckpointerTest, SaveAndLoadCompressedTablesInParallel) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  tables.push_back(MakePrioritizedTable("prioritized", 0.5));
+
+  std::vector<ChunkStore::Key> chunk_keys;
+  for (int i = 0; i < 100; i++) {
+    for (int j = 0; j < tables.size(); j++) {
+      chunk_keys.push_back((j + 1) * 1000 + i);
+      auto chunk =
+          chunk_store.Insert(testing::MakeChunkData(chunk_keys.back()));
+      REVERB_EXPECT_OK(tables[j]->InsertOrAssign(
+          {testing::MakePrioritizedItem(i, i, {chunk->data()}), {chunk}}));
+    }
+  }
+
+  TFRecordCheckpointer checkpointer(MakeRoot(), "", absl::nullopt,
+                                    /*max_incremental_checkpoints=*/0,
+                                    /*num_shards=*/2, /*compress_tables=*/true,
+                                    /*num_serialization_threads=*/4);
+  std::string path;
+  REVERB_ASSERT_OK(
+      checkpointer.Save({tables[0].get(), tables[1].get()}, 1, &path));
+  EXPECT_TRUE(tensorflow::Env::Default()
+                  ->FileExists(tensorflow::io::JoinPath(
+                      path, "tables-zlib.tfrecord"))
+                  .ok());
+  EXPECT_FALSE(tensorflow::Env::Default()
+                   ->FileExists(tensorflow::io::JoinPath(path,
+                                                         "tables.tfrecord"))
+                   .ok());
+  int num_chunks = 0;
+  for (int shard = 0; shard < 2; shard++) {
+    num_chunks += NumStoredChunks(tensorflow::io::JoinPath(
+        path, absl::StrFormat("chunks-%05d-of-00002.tfrecord", shard)));
+  }
+  EXPECT_EQ(num_chunks, chunk_keys.size());
+
+  // Checkpointers detect the compression when loading.
+  TFRecordCheckpointer loader(MakeRoot());
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  loaded_tables.push_back(MakePrioritizedTable("prioritized", 0.5));
+  REVERB_ASSERT_OK(loader.Load(path, &loaded_chunk_store, &loaded_tables));
+  for (int i = 0; i < tables.size(); i++) {
+    EXPECT_EQ(loaded_tables[i]->size(), tables[i]->size());
+  }
+}
+
+TEST(TFRecordCheckpointerTest, RecordsStatsOfSaveAndLoad) {
+  ChunkStore chunk_store;
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(MakeUniformTable("uniform"));
+  tables.push_back(MakePrioritizedTable("prioritized", 0.5));
+  for (int i = 0; i < 10; i++) {
+    for (int j = 0; j < tables.size(); j++) {
+      auto chunk =
+          chunk_store.Insert(testing::MakeChunkData((j + 1) * 1000 + i));
+      REVERB_EXPECT_OK(tables[j]->InsertOrAssign(
+          {testing::MakePrioritizedItem(i, i, {chunk->data()}), {chunk}}));
+    }
+  }
+
+  TFRecordCheckpointer checkpointer(MakeRoot(), "", absl::nullopt,
+                                    /*max_incremental_checkpoints=*/0,
+                                    /*num_shards=*/2);
+  EXPECT_EQ(checkpointer.last_save_stats().num_records, 0);
+
+  std::string path;
+  REVERB_ASSERT_OK(
+      checkpointer.Save({tables[0].get(), tables[1].get()}, 1, &path));
+  TFRecordCheckpointer::Stats saved = checkpointer.last_save_stats();
+  EXPECT_EQ(saved.num_tables, 2);
+  EXPECT_EQ(saved.num_records, 22);
+  EXPECT_GT(saved.num_bytes, 0);
+  EXPECT_GT(saved.total, absl::ZeroDuration());
+  EXPECT_GT(saved.io, absl::ZeroDuration());
+  EXPECT_GT(saved.records_per_second(), 0);
+
+  ChunkStore loaded_chunk_store;
+  std::vector<std::shared_ptr<Table>> loaded_tables;
+  loaded_tables.push_back(MakeUniformTable("uniform"));
+  loaded_tables.push_back(MakePrioritizedTable("prioritized", 0.5));
+  REVERB_ASSERT_OK(
+      checkpointer.Load(path, &loaded_chunk_store, &loaded_tables));
+  TFRecordCheckpointer::Stats loaded = checkpointer.last_load_stats();
+  EXPECT_EQ(loaded.num_records, 20);
+  EXPECT_GT(loaded.num_bytes, 0);
+  EXPECT_LT(loaded.num_bytes, saved.num_bytes);
+  EXPECT_GT(loaded.restore, absl::ZeroDuration());
+  EXPECT_EQ(loaded.lock, absl::ZeroDuration());
+}
+
 TEST(TFRecordCheckpointerTest, KeepLatestZeroReturnsError) {
   ChunkStore chunk_store;
 
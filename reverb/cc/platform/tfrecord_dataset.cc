@@ -0,0 +1,219 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/tfrecord_dataset.h"
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/platform/tfrecord_util.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/tf_util.h"
+#include "reverb/cc/support/trajectory_util.h"
+#include "reverb/cc/table.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+constexpr char kChunksFileGlob[] = "chunks-*-of-*.tfrecord";
+constexpr char kItemsFileGlob[] = "items-*-of-*.tfrecord";
+
+// Maximum number of items copied per lock acquisition of the exported table.
+constexpr size_t kExportPageSize = 1024;
+
+std::string ShardFileName(absl::string_view prefix, int shard,
+                          int num_shards) {
+  return absl::StrFormat("%s-%05d-of-%05d.tfrecord", prefix, shard,
+                         num_shards);
+}
+
+// Returns the sorted paths of the files in `path` which match `glob`.
+absl::Status GetShardFiles(const std::string& path, absl::string_view glob,
+                           std::vector<std::string>* files) {
+  REVERB_RETURN_IF_ERROR(
+      FromTensorflowStatus(tensorflow::Env::Default()->GetMatchingPaths(
+          tensorflow::io::JoinPath(path, glob), files)));
+  std::sort(files->begin(), files->end());
+  return absl::OkStatus();
+}
+
+// Writes `items` to a new file `filename`.
+absl::Status SaveItems(const std::string& filename,
+                       const std::vector<const Table::Item*>& items) {
+  internal::RecordWriterUniquePtr item_writer;
+  REVERB_RETURN_IF_ERROR(internal::OpenWriter(filename, &item_writer));
+  for (const Table::Item* item : items) {
+    REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
+        item_writer->WriteRecord(item->item.SerializeAsString())));
+  }
+  return FromTensorflowStatus(item_writer->Close());
+}
+
+// Inserts all items stored in the file `filename` into `table`. The chunks
+// referenced by the items must already be present in `chunk_store`.
+absl::Status ImportItems(const std::string& filename,
+                         ChunkStore* chunk_store, Table* table,
+                         int batch_size) {
+  internal::RecordReaderUniquePtr item_reader;
+  REVERB_RETURN_IF_ERROR(internal::OpenReader(filename, &item_reader));
+
+  std::vector<Table::Item> batch;
+  batch.reserve(batch_size);
+  absl::Status item_status;
+  tensorflow::uint64 item_offset = 0;
+  tensorflow::tstring item_record;
+  while (true) {
+    item_status = FromTensorflowStatus(
+        item_reader->ReadRecord(&item_offset, &item_record));
+    if (!item_status.ok()) break;
+
+    batch.emplace_back();
+    Table::Item& item = batch.back();
+    if (!item.item.ParseFromArray(item_record.data(), item_record.size())) {
+      return absl::DataLossError(
+          absl::StrCat("Could not parse TFRecord as PrioritizedItem at offset ",
+                       item_offset, " of ", filename, "."));
+    }
+    if (!item.item.has_flat_trajectory()) {
+      return absl::DataLossError(
+          absl::StrCat("Item ", item.item.key(), " in ", filename,
+                       " does not have a flat trajectory."));
+    }
+    item.item.set_table(table->name());
+    item.item.set_times_sampled(0);
+
+    auto status = FromTensorflowStatus(chunk_store->Get(
+        internal::GetChunkKeys(item.item.flat_trajectory()), &item.chunks));
+    if (!status.ok()) {
+      return absl::DataLossError(
+          absl::StrCat("ImportTable: item ", item.item.key(),
+                       " references missing chunk: ", status.message()));
+    }
+
+    if (batch.size() == batch_size) {
+      REVERB_RETURN_IF_ERROR(table->InsertOrAssignBatch(std::move(batch)));
+      batch.clear();
+      batch.reserve(batch_size);
+    }
+  }
+  if (!absl::IsOutOfRange(item_status)) {
+    return item_status;
+  }
+  if (!batch.empty()) {
+    REVERB_RETURN_IF_ERROR(table->InsertOrAssignBatch(std::move(batch)));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::Status ExportTable(Table* table, const std::string& path,
+                         int num_shards) {
+  if (num_shards < 1) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("num_shards must be >= 1 but got ", num_shards, "."));
+  }
+  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
+      tensorflow::Env::Default()->RecursivelyCreateDir(path)));
+
+  std::vector<Table::Item> items;
+  Table::CopyCursor cursor;
+  while (!cursor.done) {
+    std::vector<Table::Item> page = table->CopyPage(&cursor, kExportPageSize);
+    std::move(page.begin(), page.end(), std::back_inserter(items));
+  }
+
+  // Each chunk is only written once even if it is referenced by many items.
+  internal::flat_hash_set<ChunkStore::Key> seen_chunks;
+  std::vector<std::vector<std::shared_ptr<ChunkStore::Chunk>>> chunk_shards(
+      num_shards);
+  std::vector<std::vector<const Table::Item*>> item_shards(num_shards);
+  for (const auto& item : items) {
+    item_shards[item.item.key() % num_shards].push_back(&item);
+    for (const auto& chunk : item.chunks) {
+      if (seen_chunks.insert(chunk->key()).second) {
+        chunk_shards[chunk->key() % num_shards].push_back(chunk);
+      }
+    }
+  }
+
+  REVERB_RETURN_IF_ERROR(internal::RunInParallel(
+      num_shards, "ExportTable", [&](int shard) -> absl::Status {
+        REVERB_RETURN_IF_ERROR(internal::SaveChunks(
+            tensorflow::io::JoinPath(
+                path, ShardFileName("chunks", shard, num_shards)),
+            chunk_shards[shard]));
+        return SaveItems(tensorflow::io::JoinPath(
+                             path, ShardFileName("items", shard, num_shards)),
+                         item_shards[shard]);
+      }));
+
+  return internal::WriteDone(path);
+}
+
+absl::Status ImportTable(const std::string& path, ChunkStore* chunk_store,
+                         Table* table, int batch_size) {
+  if (batch_size < 1) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("batch_size must be >= 1 but got ", batch_size, "."));
+  }
+  if (!internal::HasDone(path)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("ImportTable called with incomplete dataset: ", path));
+  }
+
+  std::vector<std::string> chunk_files;
+  REVERB_RETURN_IF_ERROR(GetShardFiles(path, kChunksFileGlob, &chunk_files));
+  std::vector<std::string> item_files;
+  REVERB_RETURN_IF_ERROR(GetShardFiles(path, kItemsFileGlob, &item_files));
+
+  // The loaded chunks must stay alive until the items referencing them have
+  // been inserted.
+  std::vector<std::vector<std::shared_ptr<ChunkStore::Chunk>>> loaded_chunks(
+      chunk_files.size());
+  if (!chunk_files.empty()) {
+    REVERB_RETURN_IF_ERROR(internal::RunInParallel(
+        chunk_files.size(), "ImportTable_LoadChunks", [&](int i) {
+          return internal::LoadChunks(chunk_files[i], chunk_store,
+                                      &loaded_chunks[i]);
+        }));
+  }
+
+  if (item_files.empty()) {
+    return absl::OkStatus();
+  }
+  return internal::RunInParallel(
+      item_files.size(), "ImportTable_InsertItems", [&](int i) {
+        return ImportItems(item_files[i], chunk_store, table, batch_size);
+      });
+}
+
+}  // namespace reverb
+}  // namespace deepmind
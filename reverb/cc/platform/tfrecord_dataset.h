@@ -0,0 +1,67 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Bulk import and export of table contents as TFRecord files. Used to seed a
+// table from an offline dataset (or to dump one for offline analysis) from
+// within the server process, without streaming every item through the gRPC
+// service.
+//
+// A dataset directory holds:
+//   chunks-XXXXX-of-YYYYY.tfrecord  `ChunkData` records.
+//   items-XXXXX-of-YYYYY.tfrecord   `PrioritizedItem` records.
+//   DONE                            Written once all other files are complete.
+//
+// Every chunk referenced by the items is stored in the same directory.
+
+#ifndef REVERB_CC_PLATFORM_TFRECORD_DATASET_H_
+#define REVERB_CC_PLATFORM_TFRECORD_DATASET_H_
+
+#include <string>
+
+#include "absl/status/status.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/table.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Number of items passed to each `Table::InsertOrAssignBatch` call by
+// `ImportTable`.
+constexpr int kDefaultImportBatchSize = 1024;
+
+// Writes all items of `table`, and the chunks they reference, to a new dataset
+// in the directory `path`. Both the chunks and the items are split into
+// `num_shards` files which are written in parallel. The items are copied page
+// by page (see `Table::CopyPage`) so the table remains usable during the
+// export, which is therefore not an atomic snapshot of the table.
+absl::Status ExportTable(Table* table, const std::string& path,
+                         int num_shards = 1);
+
+// Inserts all items of the dataset in `path` into `table`. The chunk files are
+// decoded in parallel and inserted into `chunk_store`, after which the item
+// files are read in parallel and their items inserted in batches of
+// `batch_size` using `Table::InsertOrAssignBatch`, so the rate limiter of
+// `table` is respected and the call blocks until all items are inserted.
+//
+// Items keep their keys and priorities but are inserted into `table`
+// regardless of the table they were exported from and start out unsampled.
+absl::Status ImportTable(const std::string& path, ChunkStore* chunk_store,
+                         Table* table,
+                         int batch_size = kDefaultImportBatchSize);
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_TFRECORD_DATASET_H_
@@ -0,0 +1,145 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/tfrecord_dataset.h"
+
+#include <cfloat>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/tf_util.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+std::string MakeRoot() {
+  std::string name;
+  REVERB_CHECK(tensorflow::Env::Default()->LocalTempFilename(&name));
+  return name;
+}
+
+std::unique_ptr<Table> MakeUniformTable(const std::string& name) {
+  return absl::make_unique<Table>(
+      name, absl::make_unique<UniformSelector>(),
+      absl::make_unique<FifoSelector>(), 1000, 0,
+      absl::make_unique<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX));
+}
+
+// Inserts `num_items` items into `table` where item `i` references chunks `i`
+// and `i + 1`, so all but the first and last chunk are shared by two items.
+void FillTable(int num_items, ChunkStore* chunk_store, Table* table) {
+  std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
+  for (int i = 0; i <= num_items; i++) {
+    chunks.push_back(chunk_store->Insert(testing::MakeChunkData(i + 1)));
+  }
+  for (int i = 0; i < num_items; i++) {
+    auto item = testing::MakePrioritizedItem(
+        100 + i, i, {chunks[i]->data(), chunks[i + 1]->data()});
+    REVERB_ASSERT_OK(
+        table->InsertOrAssign({std::move(item), {chunks[i], chunks[i + 1]}}));
+  }
+}
+
+TEST(TFRecordDatasetTest, ExportAndImport) {
+  ChunkStore chunk_store;
+  auto table = MakeUniformTable("source");
+  FillTable(50, &chunk_store, table.get());
+
+  const std::string path = MakeRoot();
+  REVERB_ASSERT_OK(ExportTable(table.get(), path, /*num_shards=*/3));
+
+  std::vector<std::string> item_files;
+  REVERB_ASSERT_OK(
+      FromTensorflowStatus(tensorflow::Env::Default()->GetMatchingPaths(
+          tensorflow::io::JoinPath(path, "items-*-of-00003.tfrecord"),
+          &item_files)));
+  EXPECT_EQ(item_files.size(), 3);
+
+  ChunkStore imported_chunk_store;
+  auto imported = MakeUniformTable("target");
+  REVERB_ASSERT_OK(ImportTable(path, &imported_chunk_store, imported.get(),
+                               /*batch_size=*/7));
+  ASSERT_EQ(imported->size(), table->size());
+
+  for (const auto& item : table->Copy()) {
+    bool item_found = false;
+    for (const auto& imported_item : imported->Copy()) {
+      if (imported_item.item.key() != item.item.key()) continue;
+      item_found = true;
+      EXPECT_EQ(imported_item.item.table(), "target");
+      EXPECT_EQ(imported_item.item.priority(), item.item.priority());
+      EXPECT_EQ(imported_item.item.times_sampled(), 0);
+      EXPECT_THAT(imported_item.item.flat_trajectory(),
+                  testing::EqualsProto(item.item.flat_trajectory()));
+      ASSERT_EQ(imported_item.chunks.size(), item.chunks.size());
+      for (int i = 0; i < item.chunks.size(); i++) {
+        EXPECT_THAT(imported_item.chunks[i]->data(),
+                    testing::EqualsProto(item.chunks[i]->data()));
+      }
+    }
+    EXPECT_TRUE(item_found) << item.item.key();
+  }
+}
+
+TEST(TFRecordDatasetTest, ExportAndImportEmptyTable) {
+  auto table = MakeUniformTable("source");
+  const std::string path = MakeRoot();
+  REVERB_ASSERT_OK(ExportTable(table.get(), path));
+
+  ChunkStore chunk_store;
+  auto imported = MakeUniformTable("target");
+  REVERB_ASSERT_OK(ImportTable(path, &chunk_store, imported.get()));
+  EXPECT_EQ(imported->size(), 0);
+}
+
+TEST(TFRecordDatasetTest, ImportRequiresCompleteDataset) {
+  const std::string path = MakeRoot();
+  REVERB_ASSERT_OK(FromTensorflowStatus(
+      tensorflow::Env::Default()->RecursivelyCreateDir(path)));
+
+  ChunkStore chunk_store;
+  auto table = MakeUniformTable("target");
+  EXPECT_EQ(ImportTable(path, &chunk_store, table.get()).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(TFRecordDatasetTest, InvalidArguments) {
+  auto table = MakeUniformTable("table");
+  ChunkStore chunk_store;
+  EXPECT_EQ(ExportTable(table.get(), MakeRoot(), /*num_shards=*/0).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(
+      ImportTable(MakeRoot(), &chunk_store, table.get(), /*batch_size=*/0)
+          .code(),
+      absl::StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,347 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/platform/tfrecord_util.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/task_executor.h"
+#include "reverb/cc/support/tf_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/lib/io/record_writer.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/file_system.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+constexpr char kDoneFileName[] = "DONE";
+
+constexpr absl::Duration kProgressLogPeriod = absl::Seconds(30);
+
+// Number of records `WriteRecordsPipelined` produces ahead of the record being
+// written, per thread of the executor.
+constexpr int kRecordsAheadPerThread = 4;
+
+// Size of `record` in a TFRecord file written without compression.
+uint64_t FramedRecordSize(const std::string& record) {
+  return tensorflow::io::RecordWriter::kHeaderSize + record.size() +
+         tensorflow::io::RecordWriter::kFooterSize;
+}
+
+// Logs how much of a chunk file has been read or written every
+// `kProgressLogPeriod`.
+class ProgressLogger {
+ public:
+  ProgressLogger(absl::string_view verb, const std::string& filename)
+      : verb_(verb),
+        filename_(filename),
+        start_(absl::Now()),
+        next_log_(start_ + kProgressLogPeriod) {}
+
+  void Update(const ChunkFileStats& stats) {
+    const absl::Time now = absl::Now();
+    if (now < next_log_) return;
+    next_log_ = now + kProgressLogPeriod;
+    REVERB_LOG(REVERB_INFO)
+        << verb_ << " " << stats.num_records << " chunks ("
+        << stats.num_bytes / (1 << 20) << " MiB) of " << filename_ << " in "
+        << absl::FormatDuration(now - start_) << ".";
+  }
+
+ private:
+  const absl::string_view verb_;
+  const std::string& filename_;
+  const absl::Time start_;
+  absl::Time next_log_;
+};
+
+}  // namespace
+
+absl::Duration Stopwatch::Lap() {
+  const absl::Time now = absl::Now();
+  const absl::Duration elapsed = now - last_;
+  last_ = now;
+  return elapsed;
+}
+
+void ChunkFileStats::Add(const ChunkFileStats& other) {
+  num_records += other.num_records;
+  num_bytes += other.num_bytes;
+  serialization += other.serialization;
+  io += other.io;
+  insertion += other.insertion;
+}
+
+absl::Status OpenWriter(const std::string& path,
+                        RecordWriterUniquePtr* writer) {
+  std::unique_ptr<tensorflow::WritableFile> file;
+  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
+      tensorflow::Env::Default()->NewWritableFile(path, &file)));
+  auto* file_ptr = file.release();
+  *writer = RecordWriterUniquePtr(new tensorflow::io::RecordWriter(file_ptr),
+                                  [file_ptr](tensorflow::io::RecordWriter* w) {
+                                    delete w;
+                                    delete file_ptr;
+                                  });
+  return absl::OkStatus();
+}
+
+absl::Status OpenReader(const std::string& path,
+                        RecordReaderUniquePtr* reader) {
+  std::unique_ptr<tensorflow::RandomAccessFile> file;
+  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
+      tensorflow::Env::Default()->NewRandomAccessFile(path, &file)));
+  auto* file_ptr = file.release();
+  *reader = RecordReaderUniquePtr(new tensorflow::io::RecordReader(file_ptr),
+                                  [file_ptr](tensorflow::io::RecordReader* r) {
+                                    delete r;
+                                    delete file_ptr;
+                                  });
+  return absl::OkStatus();
+}
+absl::Status WriteDone(const std::string& path) {
+  std::unique_ptr<tensorflow::WritableFile> file;
+  REVERB_RETURN_IF_ERROR(
+      FromTensorflowStatus(tensorflow::Env::Default()->NewWritableFile(
+          tensorflow::io::JoinPath(path, kDoneFileName), &file)));
+  return FromTensorflowStatus(file->Close());
+}
+
+bool HasDone(const std::string& path) {
+  return tensorflow::Env::Default()
+      ->FileExists(tensorflow::io::JoinPath(path, kDoneFileName))
+      .ok();
+}
+
+absl::Status ParseChunkRecord(absl::string_view record, ChunkData* data) {
+  if (!data->ParseFromArray(record.data(), record.size())) {
+    return absl::DataLossError(absl::StrCat(
+        "Could not parse TFRecord as ChunkData: '", record, "'"));
+  }
+  if (data->deprecated_data_size()) {
+    if (!data->data().tensors().empty()) {
+      return absl::InternalError(
+          absl::StrCat("Checkpoint ChunkData of chunk ", data->chunk_key(),
+                       " has both data and deprecated_data."));
+    }
+    data->mutable_data()->mutable_tensors()->Swap(
+        data->mutable_deprecated_data());
+  }
+  return absl::OkStatus();
+}
+
+absl::Status LoadChunks(
+    const std::string& filename, ChunkStore* chunk_store,
+    std::vector<std::shared_ptr<ChunkStore::Chunk>>* chunks,
+    ChunkFileStats* stats) {
+  ChunkFileStats file_stats;
+  ProgressLogger progress("Read", filename);
+  Stopwatch stopwatch;
+  RecordReaderUniquePtr chunk_reader;
+  REVERB_RETURN_IF_ERROR(OpenReader(filename, &chunk_reader));
+
+  ChunkData chunk_data;
+  absl::Status chunk_status;
+  tensorflow::uint64 chunk_offset = 0;
+  tensorflow::tstring chunk_record;
+  do {
+    const tensorflow::uint64 record_offset = chunk_offset;
+    chunk_status = FromTensorflowStatus(
+        chunk_reader->ReadRecord(&chunk_offset, &chunk_record));
+    file_stats.io += stopwatch.Lap();
+    if (!chunk_status.ok()) break;
+    auto status = ParseChunkRecord(chunk_record, &chunk_data);
+    if (!status.ok()) {
+      return absl::Status(status.code(),
+                          absl::StrCat(status.message(), " (at offset ",
+                                       record_offset, " of ", filename, ")"));
+    }
+    file_stats.serialization += stopwatch.Lap();
+    chunks->push_back(chunk_store->Insert(chunk_data));
+    file_stats.insertion += stopwatch.Lap();
+
+    file_stats.num_records++;
+    file_stats.num_bytes += chunk_record.size();
+    progress.Update(file_stats);
+  } while (chunk_status.ok());
+  if (!absl::IsOutOfRange(chunk_status)) {
+    return chunk_status;
+  }
+  if (stats != nullptr) {
+    stats->Add(file_stats);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SaveChunks(
+    const std::string& filename,
+    const std::vector<std::shared_ptr<ChunkStore::Chunk>>& chunks,
+    std::vector<uint64_t>* offsets, ChunkFileStats* stats,
+    TaskExecutor* executor) {
+  return WriteRecords(
+      filename, chunks.size(),
+      [&chunks](int64_t index, std::string* record) {
+        *record = chunks[index]->data().SerializeAsString();
+        return absl::OkStatus();
+      },
+      executor, offsets, stats);
+}
+
+absl::Status WriteRecords(const std::string& filename, int64_t num_records,
+                          const RecordProducer& produce,
+                          TaskExecutor* executor,
+                          std::vector<uint64_t>* offsets,
+                          ChunkFileStats* stats) {
+  struct Record {
+    bool produced = false;
+    absl::Status status;
+    std::string data;
+    absl::Duration production;
+  };
+
+  ChunkFileStats file_stats;
+  ProgressLogger progress("Wrote", filename);
+  Stopwatch stopwatch;
+  RecordWriterUniquePtr writer;
+  REVERB_RETURN_IF_ERROR(OpenWriter(filename, &writer));
+  file_stats.io += stopwatch.Lap();
+
+  absl::Mutex mu;
+  std::vector<Record> records(num_records);
+  int64_t num_running = 0;
+  auto produce_record = [&](int64_t index) {
+    Stopwatch production;
+    std::string data;
+    absl::Status status = produce(index, &data);
+    const absl::Duration elapsed = production.Lap();
+
+    absl::MutexLock lock(&mu);
+    records[index] = {true, std::move(status), std::move(data), elapsed};
+  };
+  auto schedule = [&](int64_t index) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu) {
+    num_running++;
+    executor->Schedule(
+        [&, index] {
+          produce_record(index);
+          absl::MutexLock lock(&mu);
+          num_running--;
+        },
+        TaskExecutor::Lane::kBulk);
+  };
+
+  const int64_t max_ahead =
+      executor != nullptr ? kRecordsAheadPerThread * executor->num_threads()
+                          : 0;
+  {
+    absl::MutexLock lock(&mu);
+    for (int64_t i = 0; i < std::min(num_records, max_ahead); i++) {
+      schedule(i);
+    }
+  }
+
+  absl::Status status;
+  uint64_t offset = 0;
+  for (int64_t i = 0; i < num_records && status.ok(); i++) {
+    if (executor == nullptr) {
+      produce_record(i);
+    }
+    std::string data;
+    {
+      absl::MutexLock lock(&mu);
+      mu.Await(absl::Condition(&records[i].produced));
+      status = std::move(records[i].status);
+      data = std::move(records[i].data);
+      file_stats.serialization += records[i].production;
+      records[i] = Record();
+      if (status.ok() && i + max_ahead < num_records && executor != nullptr) {
+        schedule(i + max_ahead);
+      }
+    }
+    if (!status.ok()) break;
+
+    // The time spent producing or waiting for the record is already accounted
+    // for (or not attributed to any phase).
+    stopwatch.Lap();
+    status = FromTensorflowStatus(writer->WriteRecord(data));
+    file_stats.io += stopwatch.Lap();
+    file_stats.num_records++;
+    file_stats.num_bytes += data.size();
+    progress.Update(file_stats);
+    if (offsets != nullptr) {
+      offsets->push_back(offset);
+      offset += FramedRecordSize(data);
+    }
+  }
+
+  // The tasks reference the records so they must all have returned.
+  {
+    absl::MutexLock lock(&mu);
+    mu.Await(absl::Condition(
+        +[](int64_t* num_running) { return *num_running == 0; },
+        &num_running));
+  }
+  REVERB_RETURN_IF_ERROR(status);
+
+  REVERB_RETURN_IF_ERROR(FromTensorflowStatus(writer->Close()));
+  file_stats.io += stopwatch.Lap();
+  if (stats != nullptr) {
+    stats->Add(file_stats);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status RunInParallel(int n, absl::string_view name,
+                           const std::function<absl::Status(int)>& fn) {
+  if (n == 1) {
+    return fn(0);
+  }
+  std::vector<absl::Status> statuses(n);
+  {
+    std::vector<std::unique_ptr<internal::Thread>> threads;
+    threads.reserve(n);
+    for (int i = 0; i < n; i++) {
+      threads.push_back(internal::StartThread(
+          name, [&statuses, &fn, i] { statuses[i] = fn(i); }));
+    }
+  }  // Joins the threads.
+  for (const auto& status : statuses) {
+    REVERB_RETURN_IF_ERROR(status);
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,139 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef REVERB_CC_PLATFORM_TFRECORD_UTIL_H_
+#define REVERB_CC_PLATFORM_TFRECORD_UTIL_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/support/task_executor.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/lib/io/record_writer.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Helpers shared by the TFRecord based checkpointer and dataset exporter.
+
+using RecordWriterUniquePtr =
+    std::unique_ptr<tensorflow::io::RecordWriter,
+                    std::function<void(tensorflow::io::RecordWriter*)>>;
+using RecordReaderUniquePtr =
+    std::unique_ptr<tensorflow::io::RecordReader,
+                    std::function<void(tensorflow::io::RecordReader*)>>;
+
+// Opens a new TFRecord file `path` for writing. The file is closed when
+// `writer` is destroyed.
+absl::Status OpenWriter(const std::string& path, RecordWriterUniquePtr* writer);
+
+// Opens the TFRecord file `path` for reading. The file is closed when `reader`
+// is destroyed.
+absl::Status OpenReader(const std::string& path, RecordReaderUniquePtr* reader);
+
+// Creates the empty DONE file which marks the directory `path` as complete.
+absl::Status WriteDone(const std::string& path);
+
+// Returns true if the directory `path` holds a DONE file.
+bool HasDone(const std::string& path);
+
+// Splits the time spent into consecutive phases.
+class Stopwatch {
+ public:
+  // Returns the time since the previous call (or the construction).
+  absl::Duration Lap();
+
+ private:
+  absl::Time last_ = absl::Now();
+};
+
+// Counters of the chunk records read by `LoadChunks` or written by
+// `SaveChunks`. Each call adds to the counters, so the durations of calls
+// running in parallel add up to more than the wall time.
+struct ChunkFileStats {
+  int64_t num_records = 0;
+  // Bytes of the serialized records.
+  int64_t num_bytes = 0;
+
+  // Time spent serializing (`SaveChunks`) or parsing (`LoadChunks`) records.
+  absl::Duration serialization;
+  // Time spent opening, writing or reading and closing the file.
+  absl::Duration io;
+  // Time spent inserting the chunks into the chunk store (`LoadChunks` only).
+  absl::Duration insertion;
+
+  void Add(const ChunkFileStats& other);
+};
+
+// Parses a record of a chunk file written by `SaveChunks` into `data`.
+absl::Status ParseChunkRecord(absl::string_view record, ChunkData* data);
+
+// Inserts all the chunks stored in the file `filename` into `chunk_store` and
+// appends them to `chunks` so they are kept alive. If `stats` is set then the
+// records read are added to it. Progress is logged periodically while large
+// files are read.
+absl::Status LoadChunks(
+    const std::string& filename, ChunkStore* chunk_store,
+    std::vector<std::shared_ptr<ChunkStore::Chunk>>* chunks,
+    ChunkFileStats* stats = nullptr);
+
+// Writes `chunks` to a new file `filename`. If `offsets` is set then the
+// offset of the record of each chunk is appended to it. If `stats` is set then
+// the records written are added to it. Progress is logged periodically while
+// large files are written. If `executor` is set then the records are
+// serialized on it (see `WriteRecords`) rather than by the calling thread.
+absl::Status SaveChunks(
+    const std::string& filename,
+    const std::vector<std::shared_ptr<ChunkStore::Chunk>>& chunks,
+    std::vector<uint64_t>* offsets = nullptr,
+    ChunkFileStats* stats = nullptr, TaskExecutor* executor = nullptr);
+
+// Produces record `index` of a file in `record`.
+using RecordProducer =
+    std::function<absl::Status(int64_t index, std::string* record)>;
+
+// Writes the `num_records` records produced by `produce` to a new TFRecord
+// file `filename`, in order. If `executor` is set then the records are
+// produced (e.g serialized and compressed) in parallel on it, at most a few
+// per thread ahead of the record being written, while the calling thread
+// appends them to the file. Otherwise the calling thread produces each record
+// before writing it. Returns the first error of `produce` or of the file. If
+// `offsets` is set then the offset of every record is appended to it. If
+// `stats` is set then the records are added to it, with the time spent
+// producing them (summed over the threads) as `serialization`. Progress is
+// logged periodically while large files are written.
+absl::Status WriteRecords(const std::string& filename, int64_t num_records,
+                          const RecordProducer& produce,
+                          TaskExecutor* executor = nullptr,
+                          std::vector<uint64_t>* offsets = nullptr,
+                          ChunkFileStats* stats = nullptr);
+
+// Calls `fn(0)`, ..., `fn(n - 1)` on separate threads and blocks until all
+// calls have returned. Returns the first error encountered (if any).
+absl::Status RunInParallel(int n, absl::string_view name,
+                           const std::function<absl::Status(int)>& fn);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_TFRECORD_UTIL_H_
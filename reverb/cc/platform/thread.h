@@ -21,7 +21,9 @@
 #include <functional>
 #include <memory>
 
+#include "absl/status/status.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 
 namespace deepmind {
 namespace reverb {
@@ -38,6 +40,11 @@ class Thread {
   // returned.
   virtual ~Thread() = default;
 
+  // Restricts the thread to only run on the CPUs with the given (zero based)
+  // indices. Returns an error if the affinity could not be set, e.g because the
+  // CPUs do not exist or the platform does not support it.
+  virtual absl::Status SetCpuAffinity(absl::Span<const int> cpus) = 0;
+
   // A Thread is not copyable.
   Thread(const Thread&) = delete;
   Thread& operator=(const Thread&) = delete;
@@ -47,10 +54,26 @@ class Thread {
 };
 
 // Starts a new thread that executes (a copy of) fn. The `name_prefix` may be
-// used by the implementation to label the new thread.
+// used by the implementation to label the new thread (see
+// `CurrentThreadName`).
 std::unique_ptr<Thread> StartThread(absl::string_view name_prefix,
                                     std::function<void()> fn);
 
+// Like `StartThread` but the new thread is restricted to `cpu_affinity` (see
+// `Thread::SetCpuAffinity`) before it starts executing `fn`. No restriction is
+// applied if `cpu_affinity` is empty. Failing to set the affinity is logged
+// but otherwise ignored.
+std::unique_ptr<Thread> StartThread(absl::string_view name_prefix,
+                                    std::function<void()> fn,
+                                    absl::Span<const int> cpu_affinity);
+
+// Returns the `name_prefix` the calling thread was started with by
+// `StartThread` (possibly truncated), or an empty string for threads which
+// were started by other means. The returned string is owned by the thread and
+// is valid until it terminates. Async-signal-safe, so profilers may use it to
+// attribute samples to threads.
+const char* CurrentThreadName();
+
 }  // namespace internal
 }  // namespace reverb
 }  // namespace deepmind
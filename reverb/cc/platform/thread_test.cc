@@ -14,9 +14,14 @@
 
 #include "reverb/cc/platform/thread.h"
 
+#include <sched.h>
+
+#include <string>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/synchronization/notification.h"
+#include "reverb/cc/platform/status_matchers.h"
 
 namespace deepmind {
 namespace reverb {
@@ -34,6 +39,66 @@ TEST(ThreadStdTest, ThreadRuns) {
   EXPECT_EQ(x, 7);
 }
 
+TEST(ThreadStdTest, CurrentThreadName) {
+  std::string name;
+  auto t = StartThread("NamedThread", [&name] { name = CurrentThreadName(); });
+  t = nullptr;
+  EXPECT_EQ(name, "NamedThread");
+
+  // Threads which were not named (or not started by `StartThread`) have an
+  // empty name.
+  t = StartThread("", [&name] { name = CurrentThreadName(); });
+  t = nullptr;
+  EXPECT_EQ(name, "");
+  EXPECT_STREQ(CurrentThreadName(), "");
+}
+
+// Returns the number of CPUs the calling thread may run on.
+int NumAllowedCpus() {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  sched_getaffinity(0, sizeof(cpu_set), &cpu_set);
+  return CPU_COUNT(&cpu_set);
+}
+
+TEST(ThreadStdTest, StartThreadWithCpuAffinity) {
+  int num_cpus = 0;
+  int cpu = -1;
+  auto t = StartThread(
+      "",
+      [&] {
+        num_cpus = NumAllowedCpus();
+        cpu = sched_getcpu();
+      },
+      {0});
+  t = nullptr;
+  EXPECT_EQ(num_cpus, 1);
+  EXPECT_EQ(cpu, 0);
+}
+
+TEST(ThreadStdTest, SetCpuAffinity) {
+  absl::Notification pinned;
+  absl::Notification done;
+  int num_cpus = 0;
+  auto t = StartThread("", [&] {
+    pinned.WaitForNotification();
+    num_cpus = NumAllowedCpus();
+    done.Notify();
+  });
+  REVERB_EXPECT_OK(t->SetCpuAffinity({0}));
+  pinned.Notify();
+  done.WaitForNotification();
+  EXPECT_EQ(num_cpus, 1);
+}
+
+TEST(ThreadStdTest, SetCpuAffinityRejectsInvalidCpus) {
+  absl::Notification n;
+  auto t = StartThread("", [&n] { n.WaitForNotification(); });
+  EXPECT_EQ(t->SetCpuAffinity({-1}).code(),
+            absl::StatusCode::kInvalidArgument);
+  n.Notify();
+}
+
 }  // namespace
 }  // namespace internal
 }  // namespace reverb
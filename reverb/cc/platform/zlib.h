@@ -0,0 +1,44 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_PLATFORM_ZLIB_H_
+#define REVERB_CC_PLATFORM_ZLIB_H_
+
+#include <cstddef>
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Compresses `input` with deflate at `level` ([1, 9], or -1 for the default
+// level) and stores the result in `output`. Returns false on failure.
+bool ZlibCompressFromString(absl::string_view input, int level,
+                            std::string* output);
+
+// Uncompresses `input` into `output`, which must have room for exactly
+// `output_size` bytes. Returns false if `input` is not valid deflate data or if
+// the uncompressed size does not match `output_size`.
+bool ZlibUncompressToBuffer(absl::string_view input, size_t output_size,
+                            char* output);
+
+// Uncompresses `input` into `output` when the uncompressed size is not known
+// up front. Returns false if `input` is not valid deflate data.
+bool ZlibUncompressToString(absl::string_view input, std::string* output);
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PLATFORM_ZLIB_H_
@@ -0,0 +1,172 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/priority_update_buffer.h"
+
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/status_macros.h"
+
+namespace deepmind {
+namespace reverb {
+
+absl::Status PriorityUpdateBuffer::Options::Validate() const {
+  if (max_buffered_keys <= 0) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "max_buffered_keys must be > 0 but got ", max_buffered_keys, "."));
+  }
+  if (flush_interval <= absl::ZeroDuration()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("flush_interval must be > 0 but got ",
+                     absl::FormatDuration(flush_interval), "."));
+  }
+  return absl::OkStatus();
+}
+
+PriorityUpdateBuffer::PriorityUpdateBuffer(Options options, MutateFn mutate)
+    : options_(std::move(options)), mutate_(std::move(mutate)) {
+  REVERB_CHECK_OK(options_.Validate());
+  worker_ = internal::StartThread("PriorityUpdateBuffer",
+                                  [this] { RunFlushWorker(); });
+}
+
+PriorityUpdateBuffer::~PriorityUpdateBuffer() {
+  absl::Status status = Close();
+  REVERB_LOG_IF(REVERB_ERROR, !status.ok())
+      << "Failed to flush priority updates: " << status;
+}
+
+absl::Status PriorityUpdateBuffer::Mutate(
+    absl::string_view table, const std::vector<KeyWithPriority>& updates,
+    const std::vector<uint64_t>& deletes) {
+  absl::MutexLock lock(&mu_);
+  if (closed_) {
+    return absl::FailedPreconditionError("PriorityUpdateBuffer is closed.");
+  }
+  REVERB_RETURN_IF_ERROR(TakeError());
+  if (updates.empty() && deletes.empty()) return absl::OkStatus();
+
+  if (num_buffered_keys_ == 0) {
+    oldest_buffered_at_ = absl::Now();
+  }
+  TableMutations& mutations = buffered_[table];
+  for (const KeyWithPriority& update : updates) {
+    auto [it, inserted] =
+        mutations.try_emplace(update.key(), update.priority());
+    if (inserted) {
+      num_buffered_keys_++;
+    } else if (it->second.has_value()) {
+      it->second = update.priority();
+    }
+  }
+  for (uint64_t key : deletes) {
+    auto [it, inserted] = mutations.insert_or_assign(key, absl::nullopt);
+    if (inserted) num_buffered_keys_++;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status PriorityUpdateBuffer::Flush() {
+  absl::MutexLock lock(&mu_);
+  // The buffer has already been flushed by `Close`.
+  if (closed_) return TakeError();
+  const int64_t request = ++flushes_requested_;
+  auto done = [this, request]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return flushes_completed_ >= request;
+  };
+  mu_.Await(absl::Condition(&done));
+  return TakeError();
+}
+
+absl::Status PriorityUpdateBuffer::Close() {
+  {
+    absl::MutexLock lock(&mu_);
+    if (closed_) return TakeError();
+    closed_ = true;
+  }
+  worker_ = nullptr;  // Joins the thread once it has flushed the buffer.
+  absl::MutexLock lock(&mu_);
+  return TakeError();
+}
+
+int PriorityUpdateBuffer::num_buffered_keys() const {
+  absl::MutexLock lock(&mu_);
+  return num_buffered_keys_;
+}
+
+void PriorityUpdateBuffer::RunFlushWorker() {
+  absl::MutexLock lock(&mu_);
+  auto must_flush = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return closed_ || num_buffered_keys_ >= options_.max_buffered_keys ||
+           flushes_requested_ > flushes_completed_;
+  };
+  auto has_work = [&]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return num_buffered_keys_ > 0 || must_flush();
+  };
+  while (true) {
+    mu_.Await(absl::Condition(&has_work));
+    if (!must_flush()) {
+      mu_.AwaitWithTimeout(
+          absl::Condition(&must_flush),
+          oldest_buffered_at_ + options_.flush_interval - absl::Now());
+    }
+    if (closed_ && num_buffered_keys_ == 0 &&
+        flushes_requested_ == flushes_completed_) {
+      return;
+    }
+    FlushBuffered();
+  }
+}
+
+void PriorityUpdateBuffer::FlushBuffered() {
+  internal::flat_hash_map<std::string, TableMutations> buffered;
+  std::swap(buffered, buffered_);
+  num_buffered_keys_ = 0;
+  const int64_t requested = flushes_requested_;
+
+  absl::Status status;
+  mu_.Unlock();
+  for (const auto& [table, mutations] : buffered) {
+    std::vector<KeyWithPriority> updates;
+    std::vector<uint64_t> deletes;
+    for (const auto& [key, priority] : mutations) {
+      if (priority.has_value()) {
+        updates.emplace_back();
+        updates.back().set_key(key);
+        updates.back().set_priority(*priority);
+      } else {
+        deletes.push_back(key);
+      }
+    }
+    status.Update(mutate_(table, updates, deletes));
+  }
+  mu_.Lock();
+
+  flushes_completed_ = requested;
+  error_.Update(status);
+}
+
+absl::Status PriorityUpdateBuffer::TakeError() {
+  absl::Status error = std::move(error_);
+  error_ = absl::OkStatus();
+  return error;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
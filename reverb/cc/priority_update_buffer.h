@@ -0,0 +1,140 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_PRIORITY_UPDATE_BUFFER_H_
+#define REVERB_CC_PRIORITY_UPDATE_BUFFER_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Accumulates priority updates and deletions of items and sends them in
+// batches, e.g. for learners which update the priorities of the items they
+// have just trained on after every step. Updates of the same key are merged
+// while buffered so that only the last priority is sent, and a deletion
+// overrides any update of the key (before or after the deletion). The
+// buffered mutations are flushed by a background thread once
+// `max_buffered_keys` keys are buffered or `flush_interval` has passed since
+// the oldest buffered mutation, whichever comes first.
+//
+// Mutations of different keys are not ordered with respect to each other,
+// and a flushed batch may interleave with mutations sent by other means. The
+// mutations of a failed flush are dropped rather than retried and the error is
+// returned (once) by the next call to `Mutate`, `Flush` or `Close`.
+//
+// All public methods are thread safe.
+class PriorityUpdateBuffer {
+ public:
+  struct Options {
+    // Buffered keys (over all tables) which trigger a flush.
+    int max_buffered_keys = 10000;
+
+    // Longest time a mutation is buffered before it is flushed.
+    absl::Duration flush_interval = absl::Milliseconds(100);
+
+    // Returns an error if the options are invalid.
+    absl::Status Validate() const;
+  };
+
+  // Sends the mutations of `table`. Called from the background thread (or
+  // `Flush`) with at most one call in flight at a time.
+  using MutateFn = std::function<absl::Status(
+      absl::string_view table, const std::vector<KeyWithPriority>& updates,
+      const std::vector<uint64_t>& deletes)>;
+
+  // `options` must be valid.
+  PriorityUpdateBuffer(Options options, MutateFn mutate);
+
+  // Flushes the buffered mutations and stops the background thread.
+  ~PriorityUpdateBuffer();
+
+  // Adds `updates` and `deletes` of items of `table` to the buffer. Never
+  // blocks on sending mutations. Returns the error of a failed flush, if any,
+  // in which case the mutations are not buffered. Returns
+  // `FailedPreconditionError` if the buffer has been closed.
+  absl::Status Mutate(absl::string_view table,
+                      const std::vector<KeyWithPriority>& updates,
+                      const std::vector<uint64_t>& deletes)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Sends all buffered mutations and blocks until they have been sent. Returns
+  // the error of a failed flush, if any. Must not be called from `MutateFn`.
+  absl::Status Flush() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Flushes the buffered mutations and stops the background thread. Mutations
+  // added after the buffer has been closed are rejected. Returns the error of a
+  // failed flush, if any.
+  absl::Status Close() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Number of distinct keys currently buffered.
+  int num_buffered_keys() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  // Buffered mutation of each key. `absl::nullopt` if the key is deleted.
+  using TableMutations = internal::flat_hash_map<uint64_t,
+                                                 absl::optional<double>>;
+
+  // Flushes the buffer whenever it is full, `flush_interval` has passed or a
+  // flush has been requested, until the buffer is closed.
+  void RunFlushWorker() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Takes the buffered mutations and sends them (without holding `mu_`).
+  void FlushBuffered() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Returns and clears `error_`.
+  absl::Status TakeError() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const Options options_;
+  const MutateFn mutate_;
+
+  mutable absl::Mutex mu_;
+  internal::flat_hash_map<std::string, TableMutations> buffered_
+      ABSL_GUARDED_BY(mu_);
+  int num_buffered_keys_ ABSL_GUARDED_BY(mu_) = 0;
+
+  // Time at which the oldest buffered mutation was added.
+  absl::Time oldest_buffered_at_ ABSL_GUARDED_BY(mu_);
+
+  // Number of calls to `Flush` and the number of them whose mutations have
+  // been sent.
+  int64_t flushes_requested_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t flushes_completed_ ABSL_GUARDED_BY(mu_) = 0;
+
+  // Error of the first failed flush which has not been returned yet.
+  absl::Status error_ ABSL_GUARDED_BY(mu_);
+
+  bool closed_ ABSL_GUARDED_BY(mu_) = false;
+
+  std::unique_ptr<internal::Thread> worker_;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_PRIORITY_UPDATE_BUFFER_H_
@@ -0,0 +1,207 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/priority_update_buffer.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/testing/proto_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::UnorderedElementsAre;
+
+struct Call {
+  std::string table;
+  std::vector<std::pair<uint64_t, double>> updates;
+  std::vector<uint64_t> deletes;
+};
+
+// Records the calls of the `MutateFn` of a buffer.
+class Recorder {
+ public:
+  PriorityUpdateBuffer::MutateFn MutateFn() {
+    return [this](absl::string_view table,
+                  const std::vector<KeyWithPriority>& updates,
+                  const std::vector<uint64_t>& deletes) {
+      Call call{std::string(table), {}, deletes};
+      for (const auto& update : updates) {
+        call.updates.emplace_back(update.key(), update.priority());
+      }
+      absl::MutexLock lock(&mu_);
+      calls_.push_back(std::move(call));
+      return status_;
+    };
+  }
+
+  std::vector<Call> calls() const {
+    absl::MutexLock lock(&mu_);
+    return calls_;
+  }
+
+  void set_status(absl::Status status) {
+    absl::MutexLock lock(&mu_);
+    status_ = std::move(status);
+  }
+
+ private:
+  mutable absl::Mutex mu_;
+  std::vector<Call> calls_ ABSL_GUARDED_BY(mu_);
+  absl::Status status_ ABSL_GUARDED_BY(mu_);
+};
+
+PriorityUpdateBuffer::Options LongInterval() {
+  PriorityUpdateBuffer::Options options;
+  options.flush_interval = absl::Hours(1);
+  return options;
+}
+
+TEST(PriorityUpdateBufferTest, ValidatesOptions) {
+  PriorityUpdateBuffer::Options options;
+  REVERB_EXPECT_OK(options.Validate());
+  options.max_buffered_keys = 0;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+  options = PriorityUpdateBuffer::Options();
+  options.flush_interval = absl::ZeroDuration();
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST(PriorityUpdateBufferTest, LastUpdateOfKeyWins) {
+  Recorder recorder;
+  PriorityUpdateBuffer buffer(LongInterval(), recorder.MutateFn());
+  REVERB_ASSERT_OK(buffer.Mutate("table",
+                                 {testing::MakeKeyWithPriority(1, 1),
+                                  testing::MakeKeyWithPriority(2, 2)},
+                                 {}));
+  REVERB_ASSERT_OK(
+      buffer.Mutate("table", {testing::MakeKeyWithPriority(1, 3)}, {}));
+  EXPECT_EQ(buffer.num_buffered_keys(), 2);
+  EXPECT_THAT(recorder.calls(), IsEmpty());
+
+  REVERB_ASSERT_OK(buffer.Flush());
+  EXPECT_EQ(buffer.num_buffered_keys(), 0);
+  auto calls = recorder.calls();
+  ASSERT_EQ(calls.size(), 1);
+  EXPECT_EQ(calls[0].table, "table");
+  EXPECT_THAT(calls[0].updates,
+              UnorderedElementsAre(std::make_pair(1, 3), std::make_pair(2, 2)));
+  EXPECT_THAT(calls[0].deletes, IsEmpty());
+}
+
+TEST(PriorityUpdateBufferTest, DeleteOverridesUpdates) {
+  Recorder recorder;
+  PriorityUpdateBuffer buffer(LongInterval(), recorder.MutateFn());
+  REVERB_ASSERT_OK(
+      buffer.Mutate("table", {testing::MakeKeyWithPriority(1, 1)}, {}));
+  REVERB_ASSERT_OK(buffer.Mutate("table", {}, {1, 2}));
+  REVERB_ASSERT_OK(
+      buffer.Mutate("table", {testing::MakeKeyWithPriority(2, 2)}, {}));
+  REVERB_ASSERT_OK(buffer.Flush());
+
+  auto calls = recorder.calls();
+  ASSERT_EQ(calls.size(), 1);
+  EXPECT_THAT(calls[0].updates, IsEmpty());
+  EXPECT_THAT(calls[0].deletes, UnorderedElementsAre(1, 2));
+}
+
+TEST(PriorityUpdateBufferTest, KeepsTablesApart) {
+  Recorder recorder;
+  PriorityUpdateBuffer buffer(LongInterval(), recorder.MutateFn());
+  REVERB_ASSERT_OK(
+      buffer.Mutate("a", {testing::MakeKeyWithPriority(1, 1)}, {}));
+  REVERB_ASSERT_OK(buffer.Mutate("b", {}, {1}));
+  REVERB_ASSERT_OK(buffer.Flush());
+
+  auto calls = recorder.calls();
+  ASSERT_EQ(calls.size(), 2);
+  for (const Call& call : calls) {
+    if (call.table == "a") {
+      EXPECT_THAT(call.updates, ElementsAre(std::make_pair(1, 1)));
+      EXPECT_THAT(call.deletes, IsEmpty());
+    } else {
+      EXPECT_EQ(call.table, "b");
+      EXPECT_THAT(call.updates, IsEmpty());
+      EXPECT_THAT(call.deletes, ElementsAre(1));
+    }
+  }
+}
+
+TEST(PriorityUpdateBufferTest, FlushesWhenFull) {
+  Recorder recorder;
+  PriorityUpdateBuffer::Options options = LongInterval();
+  options.max_buffered_keys = 3;
+  PriorityUpdateBuffer buffer(options, recorder.MutateFn());
+  REVERB_ASSERT_OK(buffer.Mutate("table", {}, {1, 2}));
+  absl::SleepFor(absl::Milliseconds(10));
+  EXPECT_THAT(recorder.calls(), IsEmpty());
+
+  REVERB_ASSERT_OK(buffer.Mutate("table", {}, {3}));
+  while (recorder.calls().empty()) absl::SleepFor(absl::Milliseconds(1));
+  EXPECT_THAT(recorder.calls()[0].deletes, UnorderedElementsAre(1, 2, 3));
+}
+
+TEST(PriorityUpdateBufferTest, FlushesAfterInterval) {
+  Recorder recorder;
+  PriorityUpdateBuffer::Options options;
+  options.flush_interval = absl::Milliseconds(10);
+  PriorityUpdateBuffer buffer(options, recorder.MutateFn());
+  REVERB_ASSERT_OK(buffer.Mutate("table", {}, {1}));
+  while (recorder.calls().empty()) absl::SleepFor(absl::Milliseconds(1));
+  EXPECT_THAT(recorder.calls()[0].deletes, ElementsAre(1));
+}
+
+TEST(PriorityUpdateBufferTest, ReturnsErrorOfFailedFlushOnce) {
+  Recorder recorder;
+  recorder.set_status(absl::UnavailableError("server is down"));
+  PriorityUpdateBuffer buffer(LongInterval(), recorder.MutateFn());
+  REVERB_ASSERT_OK(buffer.Mutate("table", {}, {1}));
+  EXPECT_EQ(buffer.Flush().code(), absl::StatusCode::kUnavailable);
+
+  recorder.set_status(absl::OkStatus());
+  REVERB_EXPECT_OK(buffer.Mutate("table", {}, {2}));
+  REVERB_EXPECT_OK(buffer.Flush());
+}
+
+TEST(PriorityUpdateBufferTest, CloseFlushesAndRejectsMutations) {
+  Recorder recorder;
+  PriorityUpdateBuffer buffer(LongInterval(), recorder.MutateFn());
+  REVERB_ASSERT_OK(buffer.Mutate("table", {}, {1}));
+  REVERB_ASSERT_OK(buffer.Close());
+  ASSERT_EQ(recorder.calls().size(), 1);
+  EXPECT_THAT(recorder.calls()[0].deletes, ElementsAre(1));
+
+  EXPECT_EQ(buffer.Mutate("table", {}, {2}).code(),
+            absl::StatusCode::kFailedPrecondition);
+  REVERB_EXPECT_OK(buffer.Flush());
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -15,6 +15,8 @@
 #include "reverb/cc/rate_limiter.h"
 
 #include <algorithm>
+#include <atomic>
+#include <memory>
 #include <string>
 #include <utility>
 
@@ -45,6 +47,27 @@ inline void EncodeAsDurationProto(const absl::Duration& d,
       absl::ToInt64Nanoseconds(d - absl::Seconds(proto->seconds())));
 }
 
+// Returns the largest `n` in [0, max_n] for which `allowed(n)` is true.
+// `allowed` must be monotonic, i.e if `allowed(n)` then `allowed(m)` for all
+// 0 < m < n. Only O(log max_n) evaluations are made.
+template <typename Fn>
+int LargestAllowed(int max_n, const Fn& allowed) {
+  if (max_n == 0 || !allowed(1)) return 0;
+  if (allowed(max_n)) return max_n;
+  // Invariant: `allowed(lo)` and `!allowed(hi)`.
+  int lo = 1;
+  int hi = max_n;
+  while (hi - lo > 1) {
+    const int mid = lo + (hi - lo) / 2;
+    if (allowed(mid)) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
 }  // namespace
 
 RateLimiter::RateLimiter(double samples_per_insert, int64_t min_size_to_sample,
@@ -56,6 +79,7 @@ RateLimiter::RateLimiter(double samples_per_insert, int64_t min_size_to_sample,
       inserts_(0),
       samples_(0),
       deletes_(0),
+      version_(0),
       insert_stats_(),
       sample_stats_() {
   REVERB_CHECK_GT(min_size_to_sample, 0);
@@ -67,9 +91,9 @@ RateLimiter::RateLimiter(const RateLimiterCheckpoint& checkpoint)
                   checkpoint.min_size_to_sample(),
                   /*min_diff=*/checkpoint.min_diff(),
                   /*max_diff=*/checkpoint.max_diff()) {
-  inserts_ = checkpoint.insert_count();
-  samples_ = checkpoint.sample_count();
-  deletes_ = checkpoint.delete_count();
+  inserts_.store(checkpoint.insert_count(), std::memory_order_relaxed);
+  samples_.store(checkpoint.sample_count(), std::memory_order_relaxed);
+  deletes_.store(checkpoint.delete_count(), std::memory_order_relaxed);
 }
 
 absl::Status RateLimiter::RegisterTable(Table* table) {
@@ -93,25 +117,37 @@ void RateLimiter::UnregisterTable(absl::Mutex* mu, Table* table) {
 }
 
 void RateLimiter::Insert(absl::Mutex* mu) {
-  inserts_++;
+  Counters counters = LoadCounters(mu);
+  counters.inserts++;
+  StoreCounters(mu, counters);
 }
 
 void RateLimiter::Delete(absl::Mutex* mu) {
-  deletes_++;
+  Counters counters = LoadCounters(mu);
+  counters.deletes++;
+  StoreCounters(mu, counters);
 }
 
 void RateLimiter::Reset(absl::Mutex* mu) {
-  inserts_ = 0;
-  samples_ = 0;
-  deletes_ = 0;
+  StoreCounters(mu, Counters());
+}
+
+bool RateLimiter::CanSample(absl::Mutex* mu, int num_samples) const {
+  return CanSampleGiven(LoadCounters(mu), num_samples);
+}
+
+bool RateLimiter::CanSampleWithoutLock(int num_samples) const {
+  return CanSampleGiven(counters(), num_samples);
 }
 
-bool RateLimiter::CanSample(absl::Mutex*, int num_samples) const {
+bool RateLimiter::CanSampleGiven(const Counters& counters,
+                                 int num_samples) const {
   REVERB_CHECK_GT(num_samples, 0);
-  if (inserts_ - deletes_ < min_size_to_sample_) {
+  if (counters.inserts - counters.deletes < min_size_to_sample_) {
     return false;
   }
-  double diff = inserts_ * samples_per_insert_ - samples_ - num_samples;
+  double diff =
+      counters.inserts * samples_per_insert_ - counters.samples - num_samples;
   return diff >= min_diff_;
 }
 
@@ -122,34 +158,119 @@ bool RateLimiter::MaybeCommitSample(absl::Mutex* mu) {
   // Create and complete the event to register that the sample was completed
   // without any rate limiting.
   sample_stats_.CreateEvent(mu);
-  samples_++;
+  Counters counters = LoadCounters(mu);
+  counters.samples++;
+  StoreCounters(mu, counters);
   return true;
 }
 
-bool RateLimiter::CanInsert(absl::Mutex*, int num_inserts) const {
+int RateLimiter::MaybeCommitSamples(absl::Mutex* mu, int max_samples) {
+  REVERB_CHECK_GE(max_samples, 0);
+  Counters counters = LoadCounters(mu);
+  const int num_samples = LargestAllowed(
+      max_samples, [&](int n) { return CanSampleGiven(counters, n); });
+  if (num_samples > 0) {
+    sample_stats_.CreateEvents(mu, num_samples);
+    counters.samples += num_samples;
+    StoreCounters(mu, counters);
+  }
+  return num_samples;
+}
+
+void RateLimiter::CommitSamples(absl::Mutex* mu, int num_samples) {
+  REVERB_CHECK_GE(num_samples, 0);
+  if (num_samples == 0) return;
+  sample_stats_.CreateEvents(mu, num_samples);
+  Counters counters = LoadCounters(mu);
+  counters.samples += num_samples;
+  StoreCounters(mu, counters);
+}
+
+bool RateLimiter::CanInsert(absl::Mutex* mu, int num_inserts) const {
+  return CanInsertGiven(LoadCounters(mu), num_inserts);
+}
+
+bool RateLimiter::CanInsertWithoutLock(int num_inserts) const {
+  return CanInsertGiven(counters(), num_inserts);
+}
+
+int RateLimiter::InsertHeadroomWithoutLock(int max_inserts) const {
+  REVERB_CHECK_GE(max_inserts, 0);
+  const Counters snapshot = counters();
+  return LargestAllowed(
+      max_inserts, [&](int n) { return CanInsertGiven(snapshot, n); });
+}
+
+bool RateLimiter::CanInsertGiven(const Counters& counters,
+                                 int num_inserts) const {
   REVERB_CHECK_GT(num_inserts, 0);
   // Until the min size is reached inserts are free to progress.
-  if (inserts_ + num_inserts - deletes_ <= min_size_to_sample_) {
+  if (counters.inserts + num_inserts - counters.deletes <=
+      min_size_to_sample_) {
     return true;
   }
 
-  double diff = (num_inserts + inserts_) * samples_per_insert_ - samples_;
+  double diff =
+      (num_inserts + counters.inserts) * samples_per_insert_ - counters.samples;
   return diff <= max_diff_;
 }
 
+RateLimiter::Counters RateLimiter::counters() const {
+  Counters counters;
+  uint64_t version;
+  do {
+    version = version_.load(std::memory_order_acquire);
+    counters.inserts = inserts_.load(std::memory_order_relaxed);
+    counters.samples = samples_.load(std::memory_order_relaxed);
+    counters.deletes = deletes_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((version & 1) != 0 ||
+           version != version_.load(std::memory_order_relaxed));
+  return counters;
+}
+
+RateLimiter::Counters RateLimiter::LoadCounters(absl::Mutex*) const {
+  // Writers are serialized by the mutex so no retries are needed.
+  Counters counters;
+  counters.inserts = inserts_.load(std::memory_order_relaxed);
+  counters.samples = samples_.load(std::memory_order_relaxed);
+  counters.deletes = deletes_.load(std::memory_order_relaxed);
+  return counters;
+}
+
+void RateLimiter::StoreCounters(absl::Mutex*, const Counters& counters) {
+  const uint64_t version = version_.load(std::memory_order_relaxed);
+  version_.store(version + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  inserts_.store(counters.inserts, std::memory_order_relaxed);
+  samples_.store(counters.samples, std::memory_order_relaxed);
+  deletes_.store(counters.deletes, std::memory_order_relaxed);
+  version_.store(version + 2, std::memory_order_release);
+}
+
 void RateLimiter::CreateInstantInsertEvent(absl::Mutex* mu) {
   insert_stats_.CreateEvent(mu);
 }
 
-RateLimiterCheckpoint RateLimiter::CheckpointReader(absl::Mutex*) const {
+int RateLimiter::CommitInserts(absl::Mutex* mu, int max_inserts) {
+  REVERB_CHECK_GE(max_inserts, 0);
+  const Counters counters = LoadCounters(mu);
+  const int num_inserts = LargestAllowed(
+      max_inserts, [&](int n) { return CanInsertGiven(counters, n); });
+  insert_stats_.CreateEvents(mu, num_inserts);
+  return num_inserts;
+}
+
+RateLimiterCheckpoint RateLimiter::CheckpointReader(absl::Mutex* mu) const {
+  const Counters counters = LoadCounters(mu);
   RateLimiterCheckpoint checkpoint;
   checkpoint.set_samples_per_insert(samples_per_insert_);
   checkpoint.set_min_diff(min_diff_);
   checkpoint.set_max_diff(max_diff_);
   checkpoint.set_min_size_to_sample(min_size_to_sample_);
-  checkpoint.set_sample_count(samples_);
-  checkpoint.set_insert_count(inserts_);
-  checkpoint.set_delete_count(deletes_);
+  checkpoint.set_sample_count(counters.samples);
+  checkpoint.set_insert_count(counters.inserts);
+  checkpoint.set_delete_count(counters.deletes);
 
   return checkpoint;
 }
@@ -170,6 +291,15 @@ RateLimiterInfo RateLimiter::InfoWithoutCallStats() const {
   return info_proto;
 }
 
+std::shared_ptr<RateLimiter> RateLimiter::ShareForShards(int num_shards) const {
+  REVERB_CHECK_GE(num_shards, 1);
+  const int64_t min_size_to_sample =
+      (min_size_to_sample_ + num_shards - 1) / num_shards;
+  return std::make_shared<RateLimiter>(samples_per_insert_, min_size_to_sample,
+                                       min_diff_ / num_shards,
+                                       max_diff_ / num_shards);
+}
+
 std::string RateLimiter::DebugString() const {
   return absl::StrCat("RateLimiter(samples_per_insert=", samples_per_insert_,
                       ", min_diff_=", min_diff_, ", max_diff=", max_diff_,
@@ -184,6 +314,11 @@ void RateLimiter::StatsManager::CreateEvent(absl::Mutex* mu)
   completed_++;
 }
 
+void RateLimiter::StatsManager::CreateEvents(absl::Mutex* mu, int num_events)
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu) {
+  completed_ += num_events;
+}
+
 void RateLimiter::StatsManager::ToProto(absl::Mutex* mu,
                                         RateLimiterCallStats* proto) const
     ABSL_SHARED_LOCKS_REQUIRED(mu) {
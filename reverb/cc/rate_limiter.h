@@ -15,6 +15,8 @@
 #ifndef REVERB_CC_RATE_LIMITER_H_
 #define REVERB_CC_RATE_LIMITER_H_
 
+#include <atomic>
+#include <memory>
 #include <string>
 
 #include <cstdint>
@@ -49,6 +51,16 @@ struct RateLimiterEvent {
 // the ratio specified by `samples_per_insert`.
 class RateLimiter {
  public:
+  // Snapshot of the operation counters of the limiter.
+  struct Counters {
+    // Total number of items inserted into table.
+    int64_t inserts = 0;
+    // Total number of times any item has been sampled from the table.
+    int64_t samples = 0;
+    // Total number of items that has been deleted from the table.
+    int64_t deletes = 0;
+  };
+
   RateLimiter(double samples_per_insert, int64_t min_size_to_sample,
               double min_diff, double max_diff);
 
@@ -76,6 +88,22 @@ class RateLimiter {
   // is supposed to perform a single item sampling.
   bool MaybeCommitSample(absl::Mutex* mu) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
 
+  // Batched version of `MaybeCommitSample`. Commits and returns the largest
+  // number of samples, up to `max_samples`, which the current state allows.
+  // The caller is supposed to sample exactly that many items without
+  // releasing the lock in between. Equivalent to calling `MaybeCommitSample`
+  // until it returns false (or `max_samples` is reached) as long as no items
+  // are deleted by the sampling. Dies if `max_samples` is < 0.
+  int MaybeCommitSamples(absl::Mutex* mu, int max_samples)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+
+  // Registers `num_samples` samples which have already been handed out
+  // without consulting the rate limiter under the lock (see
+  // `Table::SetSnapshotSampling`). The samples are committed even if the
+  // current state would not allow for them. Dies if `num_samples` is < 0.
+  void CommitSamples(absl::Mutex* mu, int num_samples)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+
   // Returns true iff the current state would allow for `num_inserts` to be
   // inserted. Dies if `num_inserts` is < 1.
   bool CanInsert(absl::Mutex* mu, int num_inserts) const
@@ -85,6 +113,32 @@ class RateLimiter {
   void CreateInstantInsertEvent(absl::Mutex* mu)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
 
+  // Returns the largest number of inserts, up to `max_inserts`, which the
+  // current state allows and creates an insert stats event for each of them.
+  // Replaces calling `CanInsert(mu, 1)` and `CreateInstantInsertEvent` once
+  // per item. The inserts themselves must still be registered by calling
+  // `Insert` for every new item. Dies if `max_inserts` is < 0.
+  int CommitInserts(absl::Mutex* mu, int max_inserts)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+
+  // Returns a consistent snapshot of the counters without acquiring the table
+  // mutex. The counters are only modified while the table mutex is held, so
+  // readers may spin briefly while a modification is in progress but never
+  // block the table.
+  Counters counters() const;
+
+  // Same as `CanSample` and `CanInsert` but evaluated against `counters()`, so
+  // the table mutex does not have to be held. The result may be out of date by
+  // the time it is used and must therefore only be used by observers and as an
+  // admission hint, never to commit an operation.
+  bool CanSampleWithoutLock(int num_samples) const;
+  bool CanInsertWithoutLock(int num_inserts) const;
+
+  // Largest number of inserts, up to `max_inserts`, which `counters()` would
+  // allow for. Like `CanInsertWithoutLock` it must only be used as a hint.
+  // Dies if `max_inserts` is < 0.
+  int InsertHeadroomWithoutLock(int max_inserts) const;
+
   // Creates a checkpoint of the current state for the rate limiter.
   RateLimiterCheckpoint CheckpointReader(absl::Mutex* mu) const
       ABSL_SHARED_LOCKS_REQUIRED(mu);
@@ -96,6 +150,14 @@ class RateLimiter {
   // table.
   RateLimiterInfo InfoWithoutCallStats() const;
 
+  // Returns a new limiter for one of `num_shards` tables which together form a
+  // single logical table (see `ShardedClient`). Items are expected to be spread
+  // evenly across the shards, so each shard enforces a `1 / num_shards` share
+  // of `min_size_to_sample` (rounded up) and of the error buffer
+  // (`min_diff`/`max_diff`) while `samples_per_insert` is unchanged. Dies if
+  // `num_shards` is < 1.
+  std::shared_ptr<RateLimiter> ShareForShards(int num_shards) const;
+
   // Returns a summary string description.
   std::string DebugString() const;
 
@@ -105,6 +167,18 @@ class RateLimiter {
   absl::Status RegisterTable(Table* table);
   void UnregisterTable(absl::Mutex* mu, Table* table) ABSL_LOCKS_EXCLUDED(mu);
 
+  // Predicates behind `CanSample` and `CanInsert` evaluated on `counters`.
+  bool CanSampleGiven(const Counters& counters, int num_samples) const;
+  bool CanInsertGiven(const Counters& counters, int num_inserts) const;
+
+  // Reads the counters. Must only be called by the writer, i.e while holding
+  // the table mutex.
+  Counters LoadCounters(absl::Mutex* mu) const ABSL_SHARED_LOCKS_REQUIRED(mu);
+
+  // Replaces the counters and publishes the change to `counters()`.
+  void StoreCounters(absl::Mutex* mu, const Counters& counters)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+
   // Pointer to the table. We expect this to be available (if set), since it's
   // set by a Table calling RegisterTable(this) after it stores a shared_ptr to
   // this RateLimiter;.
@@ -126,14 +200,14 @@ class RateLimiter {
   // to be allowed.
   const int64_t min_size_to_sample_;
 
-  // Total number of items inserted into table.
-  int64_t inserts_;
-
-  // Total number of times any item has been sampled from the table.
-  int64_t samples_;
-
-  // Total number of items that has been deleted from the table.
-  int64_t deletes_;
+  // The counters (see `Counters`). They are only written while holding the
+  // table mutex. The writes are wrapped in a sequence lock (`version_` is odd
+  // while a write is in progress) so that `counters()` can read a consistent
+  // snapshot without the mutex.
+  std::atomic<int64_t> inserts_;
+  std::atomic<int64_t> samples_;
+  std::atomic<int64_t> deletes_;
+  std::atomic<uint64_t> version_;
 
   // The StatsManager maintains a circular buffer of `RateLimiterEvent` and a
   // set of all time stats for calls of a single type (sample/insert).
@@ -144,6 +218,10 @@ class RateLimiter {
     // Creates an event using the current time as `start`.
     void CreateEvent(absl::Mutex* mu) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
 
+    // Same as calling `CreateEvent` `num_events` times.
+    void CreateEvents(absl::Mutex* mu, int num_events)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+
     // Encode the current state as a `RateLimiterCallStats`-proto.
     void ToProto(absl::Mutex* mu, RateLimiterCallStats* proto) const
         ABSL_SHARED_LOCKS_REQUIRED(mu);
@@ -206,6 +206,173 @@ TEST(RateLimiterTest, CanInsert) {
   EXPECT_FALSE(limiter->CanInsert(&mu, 2));  // diff = 5.5.
 }
 
+TEST(RateLimiterTest, MaybeCommitSamples) {
+  auto limiter =
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1, /*min_diff=*/-1.0,
+                                    /*max_diff=*/10.0);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+  absl::WriterMutexLock lock(&mu);
+
+  // Min size should not have been reached so no samples should be allowed.
+  EXPECT_EQ(limiter->MaybeCommitSamples(&mu, 5), 0);
+
+  for (int i = 0; i < 3; i++) {
+    limiter->Insert(&mu);
+  }
+
+  // Four samples are allowed in total (diff = -1.0).
+  EXPECT_EQ(limiter->MaybeCommitSamples(&mu, 0), 0);
+  EXPECT_EQ(limiter->MaybeCommitSamples(&mu, 1), 1);
+  EXPECT_EQ(limiter->MaybeCommitSamples(&mu, 10), 3);
+  EXPECT_EQ(limiter->MaybeCommitSamples(&mu, 10), 0);
+  EXPECT_FALSE(limiter->MaybeCommitSample(&mu));
+  EXPECT_EQ(limiter->Info(&mu).sample_stats().completed(), 4);
+}
+
+TEST(RateLimiterTest, CommitSamplesIgnoresLimits) {
+  auto limiter =
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1, /*min_diff=*/0.0,
+                                    /*max_diff=*/10.0);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+  absl::WriterMutexLock lock(&mu);
+
+  limiter->Insert(&mu);
+  limiter->CommitSamples(&mu, 3);
+  EXPECT_EQ(limiter->Info(&mu).sample_stats().completed(), 3);
+  EXPECT_EQ(limiter->counters().samples, 3);
+
+  // The samples exceeding the limit must be made up for by inserts.
+  limiter->Insert(&mu);
+  limiter->Insert(&mu);
+  EXPECT_FALSE(limiter->CanSample(&mu, 1));
+  limiter->Insert(&mu);
+  EXPECT_TRUE(limiter->CanSample(&mu, 1));
+}
+
+TEST(RateLimiterTest, CommitInserts) {
+  auto limiter =
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.5,
+                                    /*min_size_to_sample=*/2, /*min_diff=*/0.0,
+                                    /*max_diff=*/5.0);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+  absl::WriterMutexLock lock(&mu);
+
+  // The min size allows for the first two inserts and the error buffer allows
+  // for one additional insert.
+  EXPECT_EQ(limiter->CommitInserts(&mu, 0), 0);
+  EXPECT_EQ(limiter->CommitInserts(&mu, 2), 2);
+  EXPECT_EQ(limiter->CommitInserts(&mu, 10), 3);
+  EXPECT_EQ(limiter->Info(&mu).insert_stats().completed(), 5);
+
+  // Committing does not register the inserts themselves.
+  for (int i = 0; i < 3; i++) {
+    limiter->Insert(&mu);
+  }
+  EXPECT_EQ(limiter->CommitInserts(&mu, 10), 0);  // diff = 6.0
+
+  // Move the cursor by sampling two items.
+  EXPECT_EQ(limiter->MaybeCommitSamples(&mu, 2), 2);  // diff = 2.5
+
+  // One more insert should now be allowed.
+  EXPECT_EQ(limiter->CommitInserts(&mu, 10), 1);  // diff = 4.0.
+}
+
+TEST(RateLimiterTest, CountersCanBeReadWithoutLock) {
+  auto limiter =
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1, /*min_diff=*/-1.0,
+                                    /*max_diff=*/1.0);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+  EXPECT_FALSE(limiter->CanSampleWithoutLock(1));
+  EXPECT_TRUE(limiter->CanInsertWithoutLock(2));
+  EXPECT_FALSE(limiter->CanInsertWithoutLock(3));
+
+  {
+    absl::WriterMutexLock lock(&mu);
+    limiter->Insert(&mu);
+    limiter->Insert(&mu);
+    limiter->Delete(&mu);
+    EXPECT_TRUE(limiter->MaybeCommitSample(&mu));
+  }
+
+  auto counters = limiter->counters();
+  EXPECT_EQ(counters.inserts, 2);
+  EXPECT_EQ(counters.samples, 1);
+  EXPECT_EQ(counters.deletes, 1);
+  EXPECT_TRUE(limiter->CanSampleWithoutLock(2));   // diff = -1.0.
+  EXPECT_FALSE(limiter->CanSampleWithoutLock(3));  // diff = -2.0.
+  EXPECT_FALSE(limiter->CanInsertWithoutLock(1));  // diff = 2.0.
+
+  {
+    absl::WriterMutexLock lock(&mu);
+    limiter->Reset(&mu);
+  }
+  counters = limiter->counters();
+  EXPECT_EQ(counters.inserts, 0);
+  EXPECT_EQ(counters.samples, 0);
+  EXPECT_EQ(counters.deletes, 0);
+}
+
+TEST(RateLimiterTest, InsertHeadroomWithoutLock) {
+  auto limiter =
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/2.0,
+                                    /*min_size_to_sample=*/3, /*min_diff=*/-1.0,
+                                    /*max_diff=*/4.0);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+
+  // Until the min size is reached the diff doesn't apply.
+  EXPECT_EQ(limiter->InsertHeadroomWithoutLock(10), 3);
+  EXPECT_EQ(limiter->InsertHeadroomWithoutLock(2), 2);
+  EXPECT_EQ(limiter->InsertHeadroomWithoutLock(0), 0);
+
+  {
+    absl::WriterMutexLock lock(&mu);
+    for (int i = 0; i < 3; i++) limiter->Insert(&mu);
+  }
+  EXPECT_EQ(limiter->InsertHeadroomWithoutLock(10), 0);  // diff = 6.0.
+
+  {
+    absl::WriterMutexLock lock(&mu);
+    EXPECT_EQ(limiter->MaybeCommitSamples(&mu, 5), 5);  // diff = 1.0.
+  }
+  EXPECT_EQ(limiter->InsertHeadroomWithoutLock(10), 1);  // diff = 3.0.
+}
+
+TEST(RateLimiterTest, CountersSnapshotIsConsistent) {
+  auto limiter =
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1,
+                                    /*min_diff=*/-1e9, /*max_diff=*/1e9);
+  auto table = MakeTable("table", limiter);
+  absl::Mutex mu;
+  absl::Notification done;
+  // Every insert is followed by a sample and a delete while holding the lock
+  // so a consistent snapshot always satisfies the checks below. A snapshot
+  // where each counter is read at a different time might not.
+  auto writer = internal::StartThread("writer", [&] {
+    for (int i = 0; i < 100000; i++) {
+      absl::WriterMutexLock lock(&mu);
+      limiter->Insert(&mu);
+      ASSERT_TRUE(limiter->MaybeCommitSample(&mu));
+      limiter->Delete(&mu);
+    }
+    done.Notify();
+  });
+  while (!done.HasBeenNotified()) {
+    auto counters = limiter->counters();
+    ASSERT_LE(counters.deletes, counters.samples);
+    ASSERT_LE(counters.samples, counters.inserts);
+    ASSERT_LE(counters.inserts - counters.deletes, 1);
+  }
+}
+
 TEST(RateLimiterTest, CheckpointSetsBasicOptions) {
   auto limiter =
       std::make_shared<RateLimiter>(/*samples_per_insert=*/1.5,
@@ -372,6 +539,27 @@ TEST(RateLimiterTest, Info) {
                           "}"));
 }
 
+TEST(RateLimiterTest, ShareForShards) {
+  EXPECT_THAT(
+      RateLimiter(2, 10, -30, 60).ShareForShards(4)->InfoWithoutCallStats(),
+      EqualsProto("samples_per_insert: 2 "
+                  "min_size_to_sample: 3 "
+                  "min_diff: -7.5 "
+                  "max_diff: 15"));
+  // Every shard must receive at least one item before it can be sampled.
+  EXPECT_EQ(RateLimiter(1, 1, 0, 5)
+                .ShareForShards(3)
+                ->InfoWithoutCallStats()
+                .min_size_to_sample(),
+            1);
+  EXPECT_THAT(
+      RateLimiter(1, 4, -1, 1).ShareForShards(1)->InfoWithoutCallStats(),
+      EqualsProto("samples_per_insert: 1 "
+                  "min_size_to_sample: 4 "
+                  "min_diff: -1 "
+                  "max_diff: 1"));
+}
+
 TEST(RateLimiterDeathTest, DiesIfMinSizeToSampleNonPositive) {
   ASSERT_DEATH(RateLimiter(1, 0, 0, 5), "");
   ASSERT_DEATH(RateLimiter(1, -1, 0, 5), "");
@@ -15,8 +15,11 @@
 #ifndef REVERB_CC_REVERB_SERVER_REACTOR_H_
 #define REVERB_CC_REVERB_SERVER_REACTOR_H_
 
-#include <queue>
+#include <cstdint>
+#include <deque>
+#include <memory>
 #include <type_traits>
+#include <vector>
 
 #include "grpcpp/grpcpp.h"
 #include "absl/base/thread_annotations.h"
@@ -24,7 +27,10 @@
 #include "absl/synchronization/mutex.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/support/grpc_transport_options.h"
 #include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/support/memory_budget.h"
+#include "reverb/cc/support/thread_pool_usage.h"
 #include "reverb/cc/task_worker.h"
 
 namespace deepmind {
@@ -35,12 +41,28 @@ namespace reverb {
     return;                                       \
   }
 
+// Attributes the calling thread, which must be one of the threads gRPC runs
+// handlers and reactions on, to the `GrpcCallback` pool of the thread pool
+// usage reports. Only the first call of each thread has any cost.
+inline void AddCurrentThreadToGrpcCallbackPool() {
+  static auto* const usage =
+      internal::ThreadPoolUsageTracker::Get("GrpcCallback");
+  usage->AddCurrentThread();
+}
+
 // Reactor implementing a bidirectional stream that enqueues work onto
 // appropriate tables.
 // * Request and Response are the ones defined by the GRPC service.
 //
-// Note that writes to the stream have compression disabled. This reactor is
-// supposed to send already compressed data (or very small messages).
+// Note that writes to the stream have compression disabled unless the subclass
+// sets `compress_responses_`. This reactor is supposed to send already
+// compressed data (or very small messages).
+//
+// Raw streams (`Response` is `grpc::ByteBuffer`) can opt into write coalescing
+// by setting `max_coalesced_response_bytes_`. Responses queued behind the
+// front are then sent together with it as a single message, which for
+// messages made up of repeated fields is equivalent to sending them one by
+// one, so the per-write overhead is paid once rather than per response.
 template <class Request, class Response, class ResponseCtx>
 class ReverbServerReactor
     : public grpc::ServerBidiReactor<Request, Response> {
@@ -86,22 +108,43 @@ class ReverbServerReactor
   // * There are no pending tasks.
   bool ShouldFinish() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
-  // Starts sending another queued response to the client (if available).
+  // Starts sending another queued response to the client (if available). If
+  // coalescing is enabled then the following queued responses are sent along
+  // with it (see `max_coalesced_response_bytes_`).
   void MaybeSendNextResponse() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
+  // Returns the message to write for `response`, a queued response about to
+  // be sent, which must not be modified until the write is done. Called once
+  // per response. Defaults to `response->payload`. Reactors whose `Response`
+  // is not the type of the payload (e.g raw `grpc::ByteBuffer` streams) must
+  // override this to serialize the payload.
+  virtual const Response* PrepareResponse(ResponseCtx* response)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Returns true if the last queued response has not been prepared for a
+  // write yet and may thus still be extended by the subclass.
+  bool CanExtendLastResponse() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return responses_to_send_.size() >
+           num_responses_in_flight_ + (next_prepared_response_ != nullptr);
+  }
+
  protected:
   // Incoming messages are handled one at a time. That is StartRead is not
   // called until `request_` has been completely salvaged. Fields accessed
   // only by OnRead are thus thread safe and require no additional mutex to
   // control access.
 
-  // Message where new requests are unpacked to.
-  Request request_;
+  // Message where new requests are unpacked to. Points to `default_request_`
+  // unless redirected by the subclass (e.g. to a message allocated on an
+  // arena). It must not be changed while a read is in flight.
+  Request* request_ = &default_request_;
 
   absl::Mutex mu_;
 
-  // Queued responses to be sent to the client.
-  std::queue<ResponseCtx> responses_to_send_ ABSL_GUARDED_BY(mu_);
+  // Queued responses to be sent to the client. The first
+  // `num_responses_in_flight_` of them are being written.
+  std::deque<ResponseCtx> responses_to_send_ ABSL_GUARDED_BY(mu_);
+  size_t num_responses_in_flight_ ABSL_GUARDED_BY(mu_) = 0;
 
   // When false, it means that the client has notified that it is not writing
   // anymore, or that the stream has been finished/cancelled.
@@ -113,6 +156,35 @@ class ReverbServerReactor
 
   // Is there a GRPC read in flight.
   bool read_in_flight_ ABSL_GUARDED_BY(mu_) = false;
+
+  // Whether responses are compressed with the default algorithm of the server
+  // (see `GrpcTransportOptions::compress_streams`). Set by the subclass before
+  // the first response is sent.
+  bool compress_responses_ ABSL_GUARDED_BY(mu_) = false;
+
+  // Maximum size of a message made up of several queued responses. The first
+  // response of a write is always sent in full, whatever its size. Zero
+  // (default) disables coalescing, which is only supported by raw streams.
+  int64_t max_coalesced_response_bytes_ ABSL_GUARDED_BY(mu_) = 0;
+
+  // If set then the message of the write in flight is charged to the budget
+  // until the write is done. Set by the subclass before the first response is
+  // sent.
+  std::shared_ptr<internal::MemoryBudget> memory_budget_ ABSL_GUARDED_BY(mu_);
+
+ private:
+  Request default_request_;
+
+  // Concatenation of the responses of the write in flight when it consists of
+  // more than one of them.
+  Response coalesced_response_ ABSL_GUARDED_BY(mu_);
+
+  // Message of the response following the write in flight if it has already
+  // been prepared (but did not fit into the coalesced write).
+  const Response* next_prepared_response_ ABSL_GUARDED_BY(mu_) = nullptr;
+
+  // Charge of the message of the write in flight to `memory_budget_`.
+  internal::MemoryBudget::Charge write_charge_ ABSL_GUARDED_BY(mu_);
 };
 
 /*****************************************************************************
@@ -124,15 +196,74 @@ void ReverbServerReactor<Request, Response,
   if (responses_to_send_.empty() || is_finished_) {
     return;
   }
-  grpc::WriteOptions options;
-  options.set_no_compression();
-  grpc::ServerBidiReactor<Request, Response>::StartWrite(
-      &responses_to_send_.front().payload, options);
+  REVERB_CHECK(num_responses_in_flight_ == 0);
+  const Response* message = next_prepared_response_ != nullptr
+                                ? next_prepared_response_
+                                : PrepareResponse(&responses_to_send_.front());
+  next_prepared_response_ = nullptr;
+  num_responses_in_flight_ = 1;
+
+  if constexpr (std::is_same<Response, grpc::ByteBuffer>::value) {
+    if (max_coalesced_response_bytes_ > 0 && responses_to_send_.size() > 1) {
+      std::vector<grpc::Slice> slices;
+      REVERB_CHECK(message->Dump(&slices).ok());
+      int64_t size = message->Length();
+      while (num_responses_in_flight_ < responses_to_send_.size()) {
+        const Response* next =
+            PrepareResponse(&responses_to_send_[num_responses_in_flight_]);
+        const int64_t next_size = next->Length();
+        if (size + next_size > max_coalesced_response_bytes_) {
+          next_prepared_response_ = next;
+          break;
+        }
+        std::vector<grpc::Slice> next_slices;
+        REVERB_CHECK(next->Dump(&next_slices).ok());
+        slices.insert(slices.end(), next_slices.begin(), next_slices.end());
+        size += next_size;
+        num_responses_in_flight_++;
+      }
+      if (num_responses_in_flight_ > 1) {
+        coalesced_response_ = grpc::ByteBuffer(slices.data(), slices.size());
+        message = &coalesced_response_;
+      }
+    }
+  }
+
+  if (memory_budget_ != nullptr) {
+    if constexpr (std::is_same<Response, grpc::ByteBuffer>::value) {
+      write_charge_ = memory_budget_->Acquire(message->Length());
+    } else {
+      write_charge_ = memory_budget_->Acquire(message->ByteSizeLong());
+    }
+  }
+
+  grpc::WriteOptions options = StreamWriteOptions(compress_responses_);
+  if (responses_to_send_.size() > num_responses_in_flight_) {
+    // Another write is issued as soon as this one is done so the message
+    // doesn't have to be flushed to the wire on its own.
+    options.set_buffer_hint();
+  }
+  grpc::ServerBidiReactor<Request, Response>::StartWrite(message, options);
+}
+
+template <class Request, class Response, class ResponseCtx>
+const Response* ReverbServerReactor<Request, Response,
+                                    ResponseCtx>::PrepareResponse(
+    ResponseCtx* response) {
+  if constexpr (std::is_same<decltype(response->payload), Response>::value) {
+    return &response->payload;
+  } else {
+    REVERB_LOG(REVERB_FATAL)
+        << "PrepareResponse must be overridden when the payload is not a "
+           "Response.";
+    return nullptr;
+  }
 }
 
 template <class Request, class Response, class ResponseCtx>
 void ReverbServerReactor<Request, Response, ResponseCtx>::OnReadDone(
     bool ok) {
+  AddCurrentThreadToGrpcCallbackPool();
   // Read until the client sends a HalfClose or the stream is cancelled.
   absl::MutexLock lock(&mu_);
   read_in_flight_ = false;
@@ -153,13 +284,14 @@ void ReverbServerReactor<Request, Response, ResponseCtx>::OnReadDone(
     return;
   }
 
-  GRPC_CALL_AND_RETURN_IF_ERROR(ProcessIncomingRequest(&request_),
+  GRPC_CALL_AND_RETURN_IF_ERROR(ProcessIncomingRequest(request_),
                                 SetReactorAsFinished);
 }
 
 template <class Request, class Response, class ResponseCtx>
 void ReverbServerReactor<Request, Response, ResponseCtx>::OnWriteDone(
     bool ok) {
+  AddCurrentThreadToGrpcCallbackPool();
   absl::MutexLock lock(&mu_);
   if (is_finished_) {
     // Reactor has been finished by the OnCancel callback. No point in
@@ -175,7 +307,11 @@ void ReverbServerReactor<Request, Response, ResponseCtx>::OnWriteDone(
     return;
   }
   // Message was successfully sent.
-  responses_to_send_.pop();
+  responses_to_send_.erase(
+      responses_to_send_.begin(),
+      responses_to_send_.begin() + num_responses_in_flight_);
+  num_responses_in_flight_ = 0;
+  write_charge_ = internal::MemoryBudget::Charge();
 
   // There are no pending writes so if we are no longer reading from the
   // stream and there are no pending tasks then we are done.
@@ -212,7 +348,7 @@ void ReverbServerReactor<Request, Response, ResponseCtx>::MaybeStartRead()
     ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
   if (!read_in_flight_ && still_reading_ && !is_finished_) {
     read_in_flight_ = true;
-    grpc::ServerBidiReactor<Request, Response>::StartRead(&request_);
+    grpc::ServerBidiReactor<Request, Response>::StartRead(request_);
   }
 }
 
@@ -227,7 +363,10 @@ void ReverbServerReactor<
   REVERB_CHECK(responses_to_send_.empty() || !status.ok());
 
   // Once the reactor is finished, we won't send any more responses.
-  std::queue<ResponseCtx>().swap(responses_to_send_);
+  responses_to_send_.clear();
+  num_responses_in_flight_ = 0;
+  next_prepared_response_ = nullptr;
+  write_charge_ = internal::MemoryBudget::Charge();
   is_finished_ = true;
   grpc::ServerBidiReactor<Request, Response>::Finish(status);
 }
@@ -15,41 +15,124 @@
 #include "reverb/cc/reverb_service_impl.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <iterator>
 #include <limits>
 #include <list>
 #include <memory>
+#include <numeric>
 #include <queue>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "absl/base/thread_annotations.h"
 #include "absl/flags/flag.h"
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
+#include "absl/strings/cord.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "grpcpp/alarm.h"
 #include "reverb/cc/checkpointing/interface.h"
 #include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/grpc_utils.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/hash_set.h"
 #include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/numa.h"
 #include "reverb/cc/platform/status_macros.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/reverb_server_reactor.h"
 #include "reverb/cc/reverb_service.grpc.pb.h"
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/sampler.h"
+#include "reverb/cc/support/chunk_key_window.h"
 #include "reverb/cc/support/cleanup.h"
+#include "reverb/cc/support/cord_util.h"
+#include "reverb/cc/support/flight_recorder.h"
 #include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/support/lock_profiler.h"
+#include "reverb/cc/support/metrics.h"
+#include "reverb/cc/support/packed_trajectory.h"
+#include "reverb/cc/support/thread_pool_usage.h"
 #include "reverb/cc/support/trajectory_util.h"
 #include "reverb/cc/support/uint128.h"
 #include "reverb/cc/support/unbounded_queue.h"
+#include "reverb/cc/table_extensions/replication.h"
+#include "reverb/cc/tensor_compression.h"
 
 ABSL_FLAG(size_t, reverb_callback_executor_num_threads, 32,
           "Number of threads in the callback executor thread pool.");
+ABSL_FLAG(int, reverb_callback_executor_sample_weight, 4,
+          "Number of sample callbacks the callback executor runs for every "
+          "insert callback when both are pending.");
+ABSL_FLAG(bool, reverb_fair_insert_admission, false,
+          "Admit rate limited inserts round-robin across insert streams "
+          "rather than in arrival order.");
+ABSL_FLAG(absl::Duration, reverb_table_worker_spin_budget,
+          absl::ZeroDuration(),
+          "How long the table workers may spin while waiting for new requests "
+          "before they go to sleep. Lowers the latency of requests which "
+          "arrive shortly after a worker ran out of work. Zero disables "
+          "spinning.");
+ABSL_FLAG(std::string, reverb_chunk_spill_directory, "",
+          "Local directory to which the data of chunks which have not been "
+          "accessed for `reverb_chunk_spill_cold_after` is spilled. Chunks "
+          "are kept in memory if empty.");
+ABSL_FLAG(absl::Duration, reverb_chunk_spill_cold_after, absl::Minutes(5),
+          "Time after the last access before a chunk is spilled to "
+          "`reverb_chunk_spill_directory`.");
+ABSL_FLAG(int64_t, reverb_chunk_episode_slab_bytes, 0,
+          "If positive, the chunks received by insert streams are copied into "
+          "slabs of this many bytes shared by the chunks of the same episode, "
+          "so consecutive chunks are stored contiguously and released in one "
+          "go once all of them have been destroyed. Zero disables slabs.");
+ABSL_FLAG(std::string, reverb_table_numa_nodes, "",
+          "Comma separated list of `table=node` pairs. The worker threads of "
+          "each listed table are restricted to the CPUs of the NUMA node so "
+          "the memory they allocate for the table stays local to that node.");
+ABSL_FLAG(std::string, reverb_table_executors, "",
+          "Semicolon separated list of `table|table...=num_threads[@cpus]` "
+          "entries. The callbacks of each group of tables are run on an "
+          "executor of their own with `num_threads` threads, restricted to "
+          "`cpus` (e.g. `0-3,8`) if given, rather than on the shared callback "
+          "executor. Isolates latency critical tables from noisy ones.");
+ABSL_FLAG(int64_t, reverb_presize_tables_max_items, 0,
+          "If positive, every table preallocates its item store and selectors "
+          "for min(max_size, this many) items when the server starts, rather "
+          "than growing them while it fills up, and advises them to be backed "
+          "by transparent huge pages.");
+ABSL_FLAG(bool, reverb_lazy_checkpoint_restore, false,
+          "Serve requests as soon as the tables of the latest checkpoint have "
+          "been restored and read the data of its chunks in the background. "
+          "Only supported by checkpointers which store a chunk index.");
+ABSL_FLAG(std::string, reverb_primary_address, "",
+          "Address of the server which replicates its tables to this one. "
+          "Priority mutations and resets sent by clients are forwarded to it "
+          "instead of being applied locally. Empty if the server is not a "
+          "replica.");
+ABSL_FLAG(int64_t, reverb_memory_soft_limit_bytes, 0,
+          "Soft limit of the memory held by chunks, queued inserts and sample "
+          "responses. Insert streams stop reading requests while the limit is "
+          "exceeded and resume once the usage has dropped below it. Zero "
+          "disables the limit.");
+ABSL_FLAG(size_t, reverb_decompression_executor_num_threads, 0,
+          "Number of threads which decompress the chunks of sample streams "
+          "that request `decompress_chunks`. If 0 then the chunks are "
+          "decompressed on the callback executor.");
 
 namespace deepmind {
 namespace reverb {
@@ -60,10 +143,200 @@ namespace {
 // remaining chunks are sent with other messages.
 static constexpr int64_t kMaxSampleResponseSizeBytes = 1 * 1024 * 1024;  // 1MB.
 
+// Maximum size of the messages which queued `InsertStreamResponse` are
+// coalesced into (see `ReverbServerReactor`).
+constexpr int64_t kMaxInsertResponseSizeBytes = 64 * 1024;  // 64KB.
+
+// Largest insert headroom pushed to insert streams (see
+// `InsertStreamOptions.push_insert_headroom`).
+constexpr int kMaxPushedInsertHeadroom = 1 << 20;
+
+// How often insert streams poll tables whose pushed headroom was exhausted.
+constexpr absl::Duration kInsertHeadroomPollInterval = absl::Milliseconds(1);
+
+// How often insert streams which paused reading check whether the memory usage
+// has dropped below `--reverb_memory_soft_limit_bytes`.
+constexpr absl::Duration kMemoryBudgetPollInterval = absl::Milliseconds(5);
+
 // How often to check whether callback execution finished before deleting
 // reactor.
 constexpr absl::Duration kCallbackWaitTime = absl::Milliseconds(1);
 
+// Source of the client ids which identify insert streams to the tables.
+std::atomic<uint64_t> next_insert_client_id{1};
+
+// Restricts the worker threads of the tables to the NUMA nodes listed in
+// `table_numa_nodes` (see `--reverb_table_numa_nodes`).
+absl::Status PinTablesToNumaNodes(
+    absl::string_view table_numa_nodes,
+    const internal::flat_hash_map<std::string, std::shared_ptr<Table>>&
+        tables) {
+  for (absl::string_view entry :
+       absl::StrSplit(table_numa_nodes, ',', absl::SkipWhitespace())) {
+    std::pair<absl::string_view, absl::string_view> parts =
+        absl::StrSplit(entry, absl::MaxSplits('=', 1));
+    int node;
+    if (!absl::SimpleAtoi(parts.second, &node)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid table NUMA node '", entry,
+                       "'. Expected format is `table=node`."));
+    }
+    auto it = tables.find(std::string(parts.first));
+    if (it == tables.end()) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "NUMA node configured for unknown table '", parts.first, "'."));
+    }
+    std::vector<int> cpus;
+    REVERB_RETURN_IF_ERROR(internal::GetNumaNodeCpus(node, &cpus));
+    REVERB_RETURN_IF_ERROR(it->second->SetCpuAffinity(cpus));
+    REVERB_LOG(REVERB_INFO) << "Pinned table " << parts.first
+                            << " to NUMA node " << node << ".";
+  }
+  return absl::OkStatus();
+}
+
+// Creates the executors of the table groups listed in `table_executors` (see
+// `--reverb_table_executors`) and assigns them to their tables. The executors
+// are appended to `executors` keyed by the name prefix of their threads.
+absl::Status CreateTableExecutors(
+    absl::string_view table_executors, int latency_sensitive_weight,
+    const internal::flat_hash_map<std::string, std::shared_ptr<Table>>&
+        tables,
+    std::vector<std::pair<std::string, std::shared_ptr<TaskExecutor>>>*
+        executors) {
+  internal::flat_hash_set<std::string> assigned;
+  for (absl::string_view entry :
+       absl::StrSplit(table_executors, ';', absl::SkipWhitespace())) {
+    std::pair<absl::string_view, absl::string_view> parts =
+        absl::StrSplit(entry, absl::MaxSplits('=', 1));
+    std::pair<absl::string_view, absl::string_view> config =
+        absl::StrSplit(parts.second, absl::MaxSplits('@', 1));
+    int num_threads;
+    if (!absl::SimpleAtoi(config.first, &num_threads) || num_threads <= 0) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Invalid table executor '", entry,
+          "'. Expected format is `table|table...=num_threads[@cpus]`."));
+    }
+    std::vector<int> cpus;
+    if (!config.second.empty()) {
+      REVERB_RETURN_IF_ERROR(internal::ParseCpuList(config.second, &cpus));
+    }
+
+    std::vector<std::string> names;
+    std::vector<std::shared_ptr<Table>> group;
+    for (absl::string_view name :
+         absl::StrSplit(parts.first, '|', absl::SkipWhitespace())) {
+      auto it = tables.find(std::string(name));
+      if (it == tables.end()) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Executor configured for unknown table '", name, "'."));
+      }
+      if (!assigned.insert(it->first).second) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Table '", name, "' is assigned to more than one executor."));
+      }
+      names.push_back(it->first);
+      group.push_back(it->second);
+    }
+    if (group.empty()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Table executor '", entry, "' lists no tables."));
+    }
+
+    std::string name =
+        absl::StrCat("TableCallbackExecutor_", absl::StrJoin(names, "_"));
+    auto executor = std::make_shared<TaskExecutor>(
+        num_threads, name, latency_sensitive_weight, cpus);
+    for (auto& table : group) table->SetCallbackExecutor(executor);
+    REVERB_LOG(REVERB_INFO) << "Running the callbacks of " << parts.first
+                            << " on " << num_threads << " dedicated threads.";
+    executors->emplace_back(std::move(name), std::move(executor));
+  }
+  return absl::OkStatus();
+}
+
+// Counter of the calls of `method` in the default metrics registry.
+internal::Counter* RpcCounter(absl::string_view method) {
+  return internal::MetricsRegistry::Default()->GetCounter(
+      "reverb_server_rpcs_total", "Number of RPCs received by the server.",
+      {{"method", std::string(method)}});
+}
+
+// Exports the state of `table` which is cheaper to poll than to keep up to
+// date.
+void CollectTableMetrics(Table& table, internal::MetricsWriter* writer) {
+  const TableInfo info = table.info();
+  const internal::MetricLabels labels = {{"table", info.name()}};
+  writer->AddGauge("reverb_table_size", "Number of items in the table.",
+                   labels, info.current_size());
+  writer->AddGauge("reverb_table_max_size",
+                   "Maximum number of items in the table.", labels,
+                   info.max_size());
+  writer->AddGauge("reverb_table_bytes",
+                   "Bytes of chunk data referenced by the table.", labels,
+                   info.num_bytes());
+  writer->AddGauge("reverb_table_episodes",
+                   "Number of episodes referenced by the table.", labels,
+                   info.num_episodes());
+  writer->AddGauge("reverb_table_queued_inserts",
+                   "Insert requests waiting to be inserted.", labels,
+                   table.num_queued_inserts());
+  writer->AddGauge("reverb_table_pending_sample_requests",
+                   "Sample requests not yet picked up by the sample lane.",
+                   labels, table.num_pending_async_sample_requests());
+  writer->AddCounter("reverb_table_inserts_total",
+                     "Inserts admitted by the rate limiter.", labels,
+                     info.rate_limiter_info().insert_stats().completed());
+  writer->AddCounter("reverb_table_samples_total",
+                     "Samples admitted by the rate limiter.", labels,
+                     info.rate_limiter_info().sample_stats().completed());
+  writer->AddCounter("reverb_table_unique_samples_total",
+                     "Number of unique items sampled from the table.", labels,
+                     info.num_unique_samples());
+
+  auto add_lane_time = [&](absl::string_view lane,
+                           const TableWorkerLaneTime& time) {
+    for (const auto& [state, ms] :
+         {std::make_pair("running", time.running_ms()),
+          std::make_pair("active", time.active_ms()),
+          std::make_pair("sleeping", time.sleeping_ms()),
+          std::make_pair("blocked", time.blocked_ms())}) {
+      writer->AddCounter(
+          "reverb_table_worker_seconds_total",
+          "Time spent by the table worker lanes in each state.",
+          {{"table", info.name()}, {"lane", std::string(lane)},
+           {"state", state}},
+          ms * 1e-3);
+    }
+  };
+  add_lane_time("insert", info.table_worker_time().insert_lane());
+  add_lane_time("sample", info.table_worker_time().sample_lane());
+
+  const TableLatencyStats& latency = info.latency_stats();
+  for (const auto& [operation, stage, distribution] :
+       {std::make_tuple("insert", "queue_wait", &latency.insert_queue_wait()),
+        std::make_tuple("insert", "rate_limiter_block",
+                        &latency.insert_rate_limiter_block()),
+        std::make_tuple("insert", "lock_hold", &latency.insert_lock_hold()),
+        std::make_tuple("insert", "end_to_end", &latency.insert_end_to_end()),
+        std::make_tuple("sample", "queue_wait", &latency.sample_queue_wait()),
+        std::make_tuple("sample", "rate_limiter_block",
+                        &latency.sample_rate_limiter_block()),
+        std::make_tuple("sample", "lock_hold", &latency.sample_lock_hold()),
+        std::make_tuple("sample", "end_to_end", &latency.sample_end_to_end()),
+        std::make_tuple("mutate", "lock_wait", &latency.mutate_lock_wait()),
+        std::make_tuple("mutate", "lock_hold", &latency.mutate_lock_hold()),
+        std::make_tuple("mutate", "end_to_end",
+                        &latency.mutate_end_to_end())}) {
+    writer->AddHistogram(
+        "reverb_table_latency_seconds",
+        "Latency of the stages of the table operations (see "
+        "TableLatencyStats).",
+        {{"table", info.name()}, {"operation", operation}, {"stage", stage}},
+        *distribution);
+  }
+}
+
 inline grpc::Status TableNotFound(absl::string_view name) {
   return grpc::Status(grpc::StatusCode::NOT_FOUND,
                       absl::StrCat("Priority table ", name, " was not found"));
@@ -73,11 +346,202 @@ inline grpc::Status Internal(const std::string& message) {
   return grpc::Status(grpc::StatusCode::INTERNAL, message);
 }
 
+// Reorders `samples` so that items which (directly or through other items)
+// share chunks are adjacent. The groups are ordered by their first sample and
+// the samples within each group keep their relative order.
+void GroupSamplesByChunk(std::vector<Table::SampledItem>* samples) {
+  if (samples->size() <= 2) return;
+
+  // Union find over the samples, where the root of a group is its first
+  // sample.
+  std::vector<int> parent(samples->size());
+  std::iota(parent.begin(), parent.end(), 0);
+  auto find = [&](int i) {
+    while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+    return i;
+  };
+  internal::flat_hash_map<uint64_t, int> first_sample_of_chunk;
+  for (int i = 0; i < samples->size(); i++) {
+    for (const auto& chunk : (*samples)[i].ref->chunks) {
+      auto [it, inserted] = first_sample_of_chunk.try_emplace(chunk->key(), i);
+      if (inserted) continue;
+      const int a = find(i);
+      const int b = find(it->second);
+      if (a != b) parent[std::max(a, b)] = std::min(a, b);
+    }
+  }
+
+  std::vector<int> order(samples->size());
+  std::iota(order.begin(), order.end(), 0);
+  std::vector<int> group(samples->size());
+  for (int i = 0; i < samples->size(); i++) group[i] = find(i);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](int a, int b) { return group[a] < group[b]; });
+
+  std::vector<Table::SampledItem> grouped;
+  grouped.reserve(samples->size());
+  for (int i : order) grouped.push_back(std::move((*samples)[i]));
+  *samples = std::move(grouped);
+}
+
+// Size of the key and length prefix of length delimited field `field_number`
+// holding `length` bytes.
+size_t FieldHeaderSize(int field_number, size_t length) {
+  return google::protobuf::io::CodedOutputStream::VarintSize32(
+             static_cast<uint32_t>(field_number) << 3) +
+         google::protobuf::io::CodedOutputStream::VarintSize64(length);
+}
+
+// Appends the key and length prefix of length delimited field `field_number`
+// holding `length` bytes to `out`.
+void AppendFieldHeader(int field_number, size_t length, std::string* out) {
+  // The key (wire type 2) takes at most 5 bytes and the length at most 10.
+  uint8_t header[15];
+  uint8_t* end = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(
+      (static_cast<uint32_t>(field_number) << 3) | 2, header);
+  end = google::protobuf::io::CodedOutputStream::WriteVarint64ToArray(length,
+                                                                     end);
+  out->append(reinterpret_cast<const char*>(header), end - header);
+}
+
+// Response of `SampleStream` and `GetItems` together with the resources
+// which keep the parts of the payload it doesn't own alive.
+struct SampleStreamResponseCtx {
+  SampleStreamResponseCtx() {}
+  SampleStreamResponseCtx(const SampleStreamResponseCtx&) = delete;
+  SampleStreamResponseCtx& operator=(const SampleStreamResponseCtx&) = delete;
+  SampleStreamResponseCtx(SampleStreamResponseCtx&& response) = default;
+  SampleStreamResponseCtx& operator=(SampleStreamResponseCtx&& response) =
+      default;
+
+  ~SampleStreamResponseCtx() {
+    // SampleStreamResponseCtx does not own immutable parts of the payload.
+    // We need to make sure not to destroy them while destructing the payload.
+    for (auto& entry : *payload.mutable_entries()) {
+      if (entry.info().has_item()) {
+        auto* item = entry.mutable_info()->mutable_item();
+        item->/*unsafe_arena_*/release_inserted_at();
+        item->/*unsafe_arena_*/release_flat_trajectory();
+      }
+      while (entry.data_size() != 0) {
+        entry.mutable_data()->UnsafeArenaReleaseLast();
+      }
+    }
+  }
+
+  void AddTableItem(std::shared_ptr<TableItem> item) {
+    table_items.push_back(std::move(item));
+  }
+
+  // Sets the trajectory of `item` to the one of `table_item`. The trajectory
+  // is lent to the payload unless `table_item` is packed, in which case an
+  // unpacked copy is owned by the response.
+  void SetTrajectory(TableItem* table_item, PrioritizedItem* item) {
+    if (!table_item->packed_trajectory.has_value()) {
+      item->/*unsafe_arena_*/set_allocated_flat_trajectory(
+          table_item->item.mutable_flat_trajectory());
+      return;
+    }
+    auto trajectory = absl::make_unique<FlatTrajectory>();
+    internal::UnpackTrajectory(*table_item->packed_trajectory,
+                               trajectory.get());
+    item->/*unsafe_arena_*/set_allocated_flat_trajectory(trajectory.get());
+    owned_trajectories.push_back(std::move(trajectory));
+  }
+
+  // Serializes `payload` into `serialized`. The chunks with an entry in
+  // `serialized_chunks` are spliced in from their wire encoding instead of
+  // being serialized again. The chunks are released from `payload`.
+  void Serialize() {
+    using SampleEntry = SampleStreamResponse::SampleEntry;
+    std::vector<grpc::Slice> slices;
+    // Bytes which are not shared with the chunks, copied into a slice once a
+    // shared chunk is reached.
+    std::string buffer;
+    auto flush = [&] {
+      if (buffer.empty()) return;
+      internal::AppendCordSlices(absl::Cord(std::move(buffer)), &slices);
+      buffer.clear();
+    };
+
+    for (auto& entry : *payload.mutable_entries()) {
+      std::vector<ChunkData*> chunks(entry.data_size());
+      for (int i = chunks.size() - 1; i >= 0; i--) {
+        chunks[i] = entry.mutable_data()->UnsafeArenaReleaseLast();
+      }
+      // Fields may appear in any order on the wire so the chunks are appended
+      // after the remaining fields of the entry.
+      const std::string head = entry.SerializeAsString();
+      std::vector<const absl::Cord*> shared(chunks.size());
+      std::vector<size_t> sizes(chunks.size());
+      size_t entry_size = head.size();
+      for (int i = 0; i < chunks.size(); i++) {
+        if (auto it = serialized_chunks.find(chunks[i]);
+            it != serialized_chunks.end()) {
+          shared[i] = &it->second;
+          sizes[i] = shared[i]->size();
+        } else {
+          sizes[i] = chunks[i]->ByteSizeLong();
+        }
+        entry_size +=
+            FieldHeaderSize(SampleEntry::kDataFieldNumber, sizes[i]) + sizes[i];
+      }
+
+      AppendFieldHeader(SampleStreamResponse::kEntriesFieldNumber, entry_size,
+                        &buffer);
+      buffer.append(head);
+      for (int i = 0; i < chunks.size(); i++) {
+        AppendFieldHeader(SampleEntry::kDataFieldNumber, sizes[i], &buffer);
+        if (shared[i] != nullptr) {
+          flush();
+          internal::AppendCordSlices(*shared[i], &slices);
+        } else {
+          chunks[i]->AppendToString(&buffer);
+        }
+      }
+    }
+    flush();
+    serialized = grpc::ByteBuffer(slices.data(), slices.size());
+  }
+
+  SampleStreamResponse payload;
+  // Wire encoding of `payload`, set by `Serialize`.
+  grpc::ByteBuffer serialized;
+  // Wire encoding of the chunks in `payload` which are shared with the chunk
+  // store, by address of the chunk in `payload`.
+  internal::flat_hash_map<const ChunkData*, absl::Cord> serialized_chunks;
+  // Empty stand-ins in `payload` for the chunks in `serialized_chunks` which
+  // are sent without ever being parsed.
+  std::deque<ChunkData> placeholder_chunks;
+  std::vector<std::shared_ptr<TableItem>> table_items;
+  // Keeps the data of the chunks in `payload` in memory. Destroyed before
+  // `table_items`, which keep the chunks themselves alive.
+  std::vector<ChunkStore::Chunk::DataPin> chunk_pins;
+  // Decompressed or trimmed copies of the chunks in `payload` when the
+  // request set `decompress_chunks` or `trim_chunks`.
+  std::vector<std::shared_ptr<const ChunkData>> owned_chunks;
+  // Trajectories in `payload` which were rewritten to reference trimmed
+  // chunks or unpacked from packed items.
+  std::vector<std::unique_ptr<FlatTrajectory>> owned_trajectories;
+  // Keys of the chunks whose data is included in `payload`.
+  internal::flat_hash_set<uint64_t> chunk_keys;
+};
+
 }  // namespace
 
 ReverbServiceImpl::ReverbServiceImpl(std::shared_ptr<Checkpointer> checkpointer)
     : checkpointer_(std::move(checkpointer)) {}
 
+ReverbServiceImpl::~ReverbServiceImpl() {
+  if (metrics_collector_id_ >= 0) {
+    internal::MetricsRegistry::Default()->RemoveCollector(
+        metrics_collector_id_);
+  }
+}
+
 absl::Status ReverbServiceImpl::Create(
     std::vector<std::shared_ptr<Table>> tables,
     std::shared_ptr<Checkpointer> checkpointer,
@@ -98,12 +562,38 @@ absl::Status ReverbServiceImpl::Create(
 
 absl::Status ReverbServiceImpl::Initialize(
     std::vector<std::shared_ptr<Table>> tables) {
+  if (const int64_t memory_soft_limit_bytes =
+          absl::GetFlag(FLAGS_reverb_memory_soft_limit_bytes);
+      memory_soft_limit_bytes > 0) {
+    // Set before the checkpoint is loaded so restored chunks are charged.
+    memory_budget_ =
+        std::make_shared<internal::MemoryBudget>(memory_soft_limit_bytes);
+    chunk_store_->SetMemoryBudget(memory_budget_);
+  }
+  const std::string spill_directory =
+      absl::GetFlag(FLAGS_reverb_chunk_spill_directory);
+  if (!spill_directory.empty()) {
+    // Enabled before the checkpoint is loaded so restored chunks are tiered.
+    ChunkStore::TieredStorageOptions options;
+    options.directory = spill_directory;
+    options.cold_after = absl::GetFlag(FLAGS_reverb_chunk_spill_cold_after);
+    REVERB_RETURN_IF_ERROR(chunk_store_->EnableTieredStorage(options));
+  }
+  const int64_t episode_slab_bytes =
+      absl::GetFlag(FLAGS_reverb_chunk_episode_slab_bytes);
+  if (episode_slab_bytes > 0) {
+    chunk_store_->EnableEpisodeSlabs(episode_slab_bytes);
+  }
+
   if (checkpointer_ != nullptr) {
     // We start by attempting to load the latest checkpoint from the root
     // directory.
     // In general we expect this to be nonempty (and thus succeed)
     // if this is a restart of a previously running job (e.g preemption).
-    auto status = checkpointer_->LoadLatest(&chunk_store_, &tables);
+    auto status =
+        absl::GetFlag(FLAGS_reverb_lazy_checkpoint_restore)
+            ? checkpointer_->LoadLatestLazily(chunk_store_.get(), &tables)
+            : checkpointer_->LoadLatest(chunk_store_.get(), &tables);
     if (absl::IsNotFound(status)) {
       // No checkpoint was found in the root directory. If a fallback
       // checkpoint (path) has been configured then we attempt to load that
@@ -113,7 +603,8 @@ absl::Status ReverbServiceImpl::Initialize(
       // empty we are effectively using the fallback checkpoint as a way to
       // initialise the service with a checkpoint generated by another
       // experiment.
-      status = checkpointer_->LoadFallbackCheckpoint(&chunk_store_, &tables);
+      status = checkpointer_->LoadFallbackCheckpoint(chunk_store_.get(),
+                                                     &tables);
     }
     // If no checkpoint was found in neither the root directory nor a fallback
     // checkpoint was provided then proceed to initialise an empty service.
@@ -128,22 +619,111 @@ absl::Status ReverbServiceImpl::Initialize(
     tables_[name] = std::move(table);
   }
 
-  auto executor = std::make_shared<TaskExecutor>(
+  REVERB_RETURN_IF_ERROR(PinTablesToNumaNodes(
+      absl::GetFlag(FLAGS_reverb_table_numa_nodes), tables_));
+  const int64_t presize = absl::GetFlag(FLAGS_reverb_presize_tables_max_items);
+  if (presize > 0) {
+    for (auto& [_, table] : tables_) table->Reserve(presize);
+  }
+
+  callback_executor_ = std::make_shared<TaskExecutor>(
       absl::GetFlag(FLAGS_reverb_callback_executor_num_threads),
-      "TableCallbackExecutor");
+      "TableCallbackExecutor",
+      absl::GetFlag(FLAGS_reverb_callback_executor_sample_weight));
+  const size_t num_decompression_threads =
+      absl::GetFlag(FLAGS_reverb_decompression_executor_num_threads);
+  decompression_executor_ =
+      num_decompression_threads == 0
+          ? callback_executor_
+          : std::make_shared<TaskExecutor>(num_decompression_threads,
+                                           "ChunkDecompressionExecutor");
   for (auto& table : tables_) {
-    table.second->SetCallbackExecutor(executor);
+    table.second->SetCallbackExecutor(callback_executor_);
+    table.second->SetFairInsertAdmission(
+        absl::GetFlag(FLAGS_reverb_fair_insert_admission));
+    table.second->SetWorkerSpinBudget(
+        absl::GetFlag(FLAGS_reverb_table_worker_spin_budget));
+  }
+  REVERB_RETURN_IF_ERROR(CreateTableExecutors(
+      absl::GetFlag(FLAGS_reverb_table_executors),
+      absl::GetFlag(FLAGS_reverb_callback_executor_sample_weight), tables_,
+      &table_executors_));
+
+  const std::string primary_address =
+      absl::GetFlag(FLAGS_reverb_primary_address);
+  if (!primary_address.empty()) {
+    grpc::ChannelArguments arguments;
+    arguments.SetMaxReceiveMessageSize(-1);  // Unlimited.
+    arguments.SetMaxSendMessageSize(-1);     // Unlimited.
+    primary_ = /* grpc_gen:: */ReverbService::NewStub(CreateCustomGrpcChannel(
+        primary_address, MakeChannelCredentials(), arguments));
   }
 
   tables_state_id_ = absl::MakeUint128(absl::Uniform<uint64_t>(rnd_),
                                        absl::Uniform<uint64_t>(rnd_));
+  for (const auto& [name, table] : tables_) {
+    static_table_info_[name] = table->static_info();
+  }
+
+  metrics_collector_id_ = internal::MetricsRegistry::Default()->AddCollector(
+      [this](internal::MetricsWriter* writer) { CollectMetrics(writer); });
 
   return absl::OkStatus();
 }
 
+void ReverbServiceImpl::CollectMetrics(internal::MetricsWriter* writer) const {
+  for (const auto& table : tables_) {
+    CollectTableMetrics(*table.second, writer);
+  }
+  writer->AddGauge("reverb_chunk_store_chunks",
+                   "Number of chunks in the chunk store.", {},
+                   chunk_store_->num_chunks());
+  if (const auto* slabs = chunk_store_->episode_slabs(); slabs != nullptr) {
+    writer->AddGauge("reverb_chunk_episode_slabs",
+                     "Number of episode slabs holding the data of chunks.", {},
+                     slabs->num_slabs());
+    writer->AddGauge("reverb_chunk_episode_slab_bytes",
+                     "Bytes allocated for episode slabs.", {},
+                     slabs->allocated_bytes());
+  }
+  if (memory_budget_ != nullptr) {
+    writer->AddGauge("reverb_memory_budget_used_bytes",
+                     "Memory charged against --reverb_memory_soft_limit_bytes.",
+                     {}, memory_budget_->used_bytes());
+  }
+  writer->AddGauge("reverb_callback_executor_pending_tasks",
+                   "Callbacks of table operations waiting to be run.", {},
+                   callback_executor_->num_pending_tasks());
+  for (auto [lane, name] :
+       {std::make_pair(TaskExecutor::Lane::kLatencySensitive, "sample"),
+        std::make_pair(TaskExecutor::Lane::kBulk, "insert")}) {
+    writer->AddGauge("reverb_callback_executor_lane_pending_tasks",
+                     "Callbacks waiting to be run per lane of the callback "
+                     "executor.",
+                     {{"lane", name}},
+                     callback_executor_->num_pending_tasks(lane));
+  }
+  writer->AddGauge("reverb_callback_executor_threads",
+                   "Threads running the callbacks of table operations.", {},
+                   callback_executor_->num_threads());
+  for (const auto& [name, executor] : table_executors_) {
+    const internal::MetricLabels labels = {{"executor", name}};
+    writer->AddGauge("reverb_table_executor_pending_tasks",
+                     "Callbacks waiting to be run on the executors of "
+                     "--reverb_table_executors.",
+                     labels, executor->num_pending_tasks());
+    writer->AddGauge("reverb_table_executor_threads",
+                     "Threads of the executors of --reverb_table_executors.",
+                     labels, executor->num_threads());
+  }
+}
+
 grpc::ServerUnaryReactor* ReverbServiceImpl::Checkpoint(
     grpc::CallbackServerContext* context, const CheckpointRequest* request,
     CheckpointResponse* response) {
+  static internal::Counter* const rpcs = RpcCounter("Checkpoint");
+  rpcs->Increment();
+  AddCurrentThreadToGrpcCallbackPool();
   grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
   if (checkpointer_ == nullptr) {
     reactor->Finish(
@@ -152,118 +732,469 @@ grpc::ServerUnaryReactor* ReverbServiceImpl::Checkpoint(
     return reactor;
   }
 
+  if (request->async()) {
+    absl::MutexLock lock(&checkpoints_mu_);
+    const uint64_t checkpoint_id = next_checkpoint_id_++;
+    checkpoints_[checkpoint_id].set_state(CheckpointStatusResponse::PENDING);
+    while (checkpoints_.size() > kMaxTrackedCheckpoints &&
+           (checkpoints_.begin()->second.state() ==
+                CheckpointStatusResponse::DONE ||
+            checkpoints_.begin()->second.state() ==
+                CheckpointStatusResponse::FAILED)) {
+      checkpoints_.erase(checkpoints_.begin());
+    }
+    if (checkpoint_executor_ == nullptr) {
+      checkpoint_executor_ = absl::make_unique<TaskExecutor>(1, "Checkpoint");
+    }
+    checkpoint_executor_->Schedule(
+        [this, checkpoint_id] { RunAsyncCheckpoint(checkpoint_id); });
+    response->set_checkpoint_id(checkpoint_id);
+    reactor->Finish(grpc::Status::OK);
+    return reactor;
+  }
+
+  auto status = SaveCheckpoint(response->mutable_checkpoint_path());
+  reactor->Finish(ToGrpcStatus(status));
+  return reactor;
+}
+
+grpc::ServerUnaryReactor* ReverbServiceImpl::CheckpointStatus(
+    grpc::CallbackServerContext* context,
+    const CheckpointStatusRequest* request,
+    CheckpointStatusResponse* response) {
+  static internal::Counter* const rpcs = RpcCounter("CheckpointStatus");
+  rpcs->Increment();
+  AddCurrentThreadToGrpcCallbackPool();
+  grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+  absl::MutexLock lock(&checkpoints_mu_);
+  auto it = checkpoints_.find(request->checkpoint_id());
+  if (it == checkpoints_.end()) {
+    reactor->Finish(grpc::Status(
+        grpc::StatusCode::NOT_FOUND,
+        absl::StrCat("Unknown checkpoint ", request->checkpoint_id(), ".")));
+    return reactor;
+  }
+  *response = it->second;
+  reactor->Finish(grpc::Status::OK);
+  return reactor;
+}
+
+absl::Status ReverbServiceImpl::SaveCheckpoint(std::string* path) {
   std::vector<Table*> tables;
   for (auto& table : tables_) {
     tables.push_back(table.second.get());
   }
 
-  auto status = checkpointer_->Save(std::move(tables), 1,
-                                    response->mutable_checkpoint_path());
-  reactor->Finish(ToGrpcStatus(status));
-  REVERB_LOG_IF(REVERB_INFO, status.ok())
-      << "Stored checkpoint to " << response->checkpoint_path();
-  return reactor;
+  auto status = checkpointer_->Save(std::move(tables), 1, path);
+  REVERB_LOG_IF(REVERB_INFO, status.ok()) << "Stored checkpoint to " << *path;
+  return status;
 }
 
-grpc::ServerBidiReactor<InsertStreamRequest, InsertStreamResponse>*
+void ReverbServiceImpl::RunAsyncCheckpoint(uint64_t checkpoint_id) {
+  {
+    absl::MutexLock lock(&checkpoints_mu_);
+    checkpoints_[checkpoint_id].set_state(CheckpointStatusResponse::RUNNING);
+  }
+  std::string path;
+  absl::Status status = SaveCheckpoint(&path);
+
+  absl::MutexLock lock(&checkpoints_mu_);
+  CheckpointStatusResponse& checkpoint = checkpoints_[checkpoint_id];
+  if (status.ok()) {
+    checkpoint.set_state(CheckpointStatusResponse::DONE);
+    checkpoint.set_checkpoint_path(std::move(path));
+  } else {
+    REVERB_LOG(REVERB_ERROR) << "Checkpoint " << checkpoint_id
+                             << " failed: " << status;
+    checkpoint.set_state(CheckpointStatusResponse::FAILED);
+    checkpoint.set_error_message(std::string(status.message()));
+  }
+}
+
+grpc::ServerBidiReactor<grpc::ByteBuffer, grpc::ByteBuffer>*
 ReverbServiceImpl::InsertStream(grpc::CallbackServerContext* context) {
+  static internal::Counter* const rpcs = RpcCounter("InsertStream");
+  rpcs->Increment();
+  AddCurrentThreadToGrpcCallbackPool();
   struct InsertStreamResponseCtx {
     InsertStreamResponse payload;
+    // Wire encoding of `payload`, set once the response is about to be sent.
+    grpc::ByteBuffer serialized;
   };
 
   class WorkerlessInsertReactor
-      : public ReverbServerReactor<InsertStreamRequest, InsertStreamResponse,
+      : public ReverbServerReactor<grpc::ByteBuffer, grpc::ByteBuffer,
                                    InsertStreamResponseCtx> {
    public:
     WorkerlessInsertReactor(ReverbServiceImpl* server)
         : ReverbServerReactor(),
           server_(server),
+          client_id_(next_insert_client_id.fetch_add(1)),
           insert_completed_(
               std::make_shared<Table::InsertCallback>([&](uint64_t key) {
                 absl::MutexLock lock(&mu_);
-                MaybeStartRead();
+                queued_item_charges_.erase(key);
+                MaybeStartReadWithinBudget();
                 if (!is_finished_) {
-                  // The first element is the one in flight, modify not yet
-                  // in flight response if possible.
-                  if (responses_to_send_.size() < 2) {
-                    responses_to_send_.emplace();
-                  }
-                  responses_to_send_.back().payload.add_keys(key);
-                  if (responses_to_send_.size() == 1) {
-                    MaybeSendNextResponse();
-                  }
+                  held_acks_.push_back(key);
+                  MaybeSendAcks();
                 }
-              })) {
+              })),
+          send_held_acks_(std::make_shared<std::function<void()>>([&] {
+            absl::MutexLock lock(&mu_);
+            ack_alarm_set_ = false;
+            if (!is_finished_) {
+              SendHeldAcks();
+            }
+          })),
+          poll_insert_headroom_(std::make_shared<std::function<void()>>([&] {
+            absl::MutexLock lock(&mu_);
+            headroom_alarm_set_ = false;
+            if (!is_finished_) {
+              PollInsertHeadroom();
+            }
+          })),
+          resume_reading_(std::make_shared<std::function<void()>>([&] {
+            absl::MutexLock lock(&mu_);
+            budget_alarm_set_ = false;
+            if (!is_finished_) {
+              MaybeStartReadWithinBudget();
+            }
+          })) {
       absl::MutexLock lock(&mu_);
-      MaybeStartRead();
+      max_coalesced_response_bytes_ = kMaxInsertResponseSizeBytes;
+      MaybeStartReadWithinBudget();
     }
 
     ~WorkerlessInsertReactor() {
-      // As callback references Reactor's memory make sure it can't be executed
-      // anymore.
+      // As callbacks reference Reactor's memory make sure they can't be
+      // executed anymore.
       std::weak_ptr<Table::InsertCallback> weak_ptr = insert_completed_;
       insert_completed_.reset();
-      while (weak_ptr.lock()) {
+      std::weak_ptr<std::function<void()>> weak_send = send_held_acks_;
+      send_held_acks_.reset();
+      std::weak_ptr<std::function<void()>> weak_poll = poll_insert_headroom_;
+      poll_insert_headroom_.reset();
+      std::weak_ptr<std::function<void()>> weak_resume = resume_reading_;
+      resume_reading_.reset();
+      ack_alarm_.Cancel();
+      headroom_alarm_.Cancel();
+      budget_alarm_.Cancel();
+      while (weak_ptr.lock() || weak_send.lock() || weak_poll.lock() ||
+             weak_resume.lock()) {
         absl::SleepFor(kCallbackWaitTime);
       }
     }
 
-    grpc::Status ProcessIncomingRequest(InsertStreamRequest* request) override
+    grpc::Status ProcessIncomingRequest(grpc::ByteBuffer* buffer) override
         ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
-      if (request->chunks_size() == 0 && request->items_size() == 0) {
+      // The chunks share the slices of `buffer` rather than being parsed. The
+      // remaining fields of the request are small and parsed as usual.
+      absl::Cord serialized;
+      if (auto status = internal::AppendByteBuffer(*buffer, &serialized);
+          !status.ok()) {
+        return ToGrpcStatus(status);
+      }
+      buffer->Clear();
+      std::vector<absl::Cord> chunks;
+      absl::Cord rest;
+      if (auto status = internal::SplitField(
+              serialized, InsertStreamRequest::kChunksFieldNumber, &chunks,
+              &rest);
+          !status.ok()) {
+        return ToGrpcStatus(status);
+      }
+      InsertStreamRequest request;
+      if (!internal::ParseFromCord(rest, &request)) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                            "ProcessIncomingRequest: Failed to parse request.");
+      }
+      return ProcessInsertRequest(std::move(chunks), &request);
+    }
+
+    const grpc::ByteBuffer* PrepareResponse(InsertStreamResponseCtx* response)
+        override ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      // The headroom is added as late as possible so that it is up to date.
+      AddInsertHeadroom(&response->payload);
+      bool own_buffer;
+      grpc::Status status =
+          grpc::SerializationTraits<InsertStreamResponse>::Serialize(
+              response->payload, &response->serialized, &own_buffer);
+      REVERB_CHECK(status.ok()) << "Failed to serialize InsertStreamResponse: "
+                                << status.error_message();
+      return &response->serialized;
+    }
+
+   private:
+    // Handles a request whose serialized chunks were split off into `chunks`.
+    grpc::Status ProcessInsertRequest(std::vector<absl::Cord> chunks,
+                                      InsertStreamRequest* request)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      if (chunks.empty() && request->items_size() == 0) {
         return grpc::Status(
             grpc::StatusCode::INVALID_ARGUMENT,
             absl::StrCat("ProcessIncomingRequest: Request lacks both chunks "
                          "and item.  Request: ",
                          request->ShortDebugString()));
       }
-      if (auto status = SaveChunks(request); !status.ok()) {
+      if (request->has_options()) {
+        if (auto status = SetOptions(request->options()); !status.ok()) {
+          return status;
+        }
+      }
+      if (auto status = SaveChunks(std::move(chunks)); !status.ok()) {
         return status;
       }
       if (request->items_size() == 0) {
         // No item to add to the table - continue reading next requests.
-        MaybeStartRead();
+        MaybeStartReadWithinBudget();
         return grpc::Status::OK;
       }
-      bool can_insert = true;
+      // Group the items by their target table (in order of first appearance)
+      // so that each table is handed a single batch.
+      std::vector<std::pair<std::shared_ptr<Table>, std::vector<Table::Item>>>
+          batches;
       for (auto& request_item : *request->mutable_items()) {
         Table::Item item;
         if (auto status = GetItemWithChunks(&item, &request_item);
             !status.ok()) {
           return status;
         }
+        if (server_->memory_budget_ != nullptr) {
+          // The chunks are charged by the chunk store.
+          queued_item_charges_.try_emplace(
+              item.item.key(),
+              server_->memory_budget_->Acquire(item.item.ByteSizeLong()));
+        }
         const auto& table_name = item.item.table();
         // Check that table name is valid.
         auto table = server_->TableByName(table_name);
         if (table == nullptr) {
           return TableNotFound(table_name);
         }
-        if (auto status = table->InsertOrAssignAsync(
-                std::move(item), &can_insert, insert_completed_);
+        auto batch = std::find_if(
+            batches.begin(), batches.end(),
+            [&table](const auto& entry) { return entry.first == table; });
+        if (batch == batches.end()) {
+          if (push_insert_headroom_) {
+            TrackInsertHeadroom(table);
+          }
+          batches.emplace_back(std::move(table), std::vector<Table::Item>());
+          batch = std::prev(batches.end());
+        }
+        batch->second.push_back(std::move(item));
+      }
+      bool can_insert = true;
+      for (auto& batch : batches) {
+        bool can_insert_into_table;
+        if (auto status = batch.first->InsertOrAssignBatchAsync(
+                std::move(batch.second), &can_insert_into_table,
+                insert_completed_, client_id_);
             !status.ok()) {
           return ToGrpcStatus(status);
         }
+        can_insert &= can_insert_into_table;
       }
-      if (auto status = ReleaseOutOfRangeChunks(request->keep_chunk_keys());
+      MaybePushExhaustedHeadroom();
+      if (auto status =
+              release_chunks_incrementally_
+                  ? ReleaseChunks(request->release_chunk_keys())
+                  : ReleaseOutOfRangeChunks(request->keep_chunk_keys());
           !status.ok()) {
         return status;
       }
       if (can_insert) {
         // Insert didn't exceed table's buffer, we can continue reading next
         // requests.
-        MaybeStartRead();
+        MaybeStartReadWithinBudget();
       }
       return grpc::Status::OK;
     }
 
-   private:
-    grpc::Status SaveChunks(InsertStreamRequest* request) {
-      for (auto& chunk : *request->mutable_chunks()) {
-        ChunkStore::Key key = chunk.chunk_key();
-        if (!chunks_.contains(key)) {
-          chunks_[key] = std::make_shared<ChunkStore::Chunk>(std::move(chunk));
+    grpc::Status SetOptions(const InsertStreamOptions& options)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      if (options.max_ack_delay_ms() < 0 ||
+          options.max_acks_per_response() < 0) {
+        return grpc::Status(
+            grpc::StatusCode::INVALID_ARGUMENT,
+            absl::StrCat("InsertStreamOptions must not be negative: ",
+                         options.ShortDebugString()));
+      }
+      max_ack_delay_ = absl::Milliseconds(options.max_ack_delay_ms());
+      max_acks_per_response_ = options.max_acks_per_response();
+      release_chunks_incrementally_ = options.release_chunks_incrementally();
+      push_insert_headroom_ = options.push_insert_headroom();
+      // The new options apply to the acknowledgements already held back too.
+      MaybeSendAcks();
+      return grpc::Status::OK;
+    }
+
+    // Sends the held back acknowledgements if the stream options don't allow
+    // them to be held any longer, otherwise makes sure that they are sent once
+    // `max_ack_delay_` has passed.
+    void MaybeSendAcks() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      if (held_acks_.empty()) {
+        return;
+      }
+      if (max_ack_delay_ == absl::ZeroDuration() ||
+          (max_acks_per_response_ > 0 &&
+           held_acks_.size() >= max_acks_per_response_)) {
+        SendHeldAcks();
+        return;
+      }
+      if (!ack_alarm_set_) {
+        ack_alarm_set_ = true;
+        std::weak_ptr<std::function<void()>> send = send_held_acks_;
+        ack_alarm_.Set(absl::ToChronoTime(absl::Now() + max_ack_delay_),
+                       [send](bool) {
+                         if (auto to_call = send.lock()) {
+                           (*to_call)();
+                         }
+                       });
+      }
+    }
+
+    // Moves all held back acknowledgements to the responses.
+    void SendHeldAcks() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      if (held_acks_.empty()) {
+        return;
+      }
+      // Modify the last response if it isn't in flight yet.
+      const bool already_writing = !responses_to_send_.empty();
+      if (!CanExtendLastResponse()) {
+        responses_to_send_.emplace_back();
+      }
+      for (uint64_t key : held_acks_) {
+        responses_to_send_.back().payload.add_keys(key);
+      }
+      held_acks_.clear();
+      if (!already_writing) {
+        MaybeSendNextResponse();
+      }
+    }
+
+    // Starts including the headroom of `table` in the responses.
+    void TrackInsertHeadroom(const std::shared_ptr<Table>& table)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      for (const TrackedHeadroom& tracked : tracked_headroom_) {
+        if (tracked.table == table) return;
+      }
+      tracked_headroom_.push_back({table, /*exhausted=*/false});
+    }
+
+    // Adds the current headroom of the tracked tables to `response` and polls
+    // the tables whose headroom is exhausted until it has recovered.
+    void AddInsertHeadroom(InsertStreamResponse* response)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      bool any_exhausted = false;
+      for (TrackedHeadroom& tracked : tracked_headroom_) {
+        const int headroom =
+            tracked.table->InsertHeadroom(kMaxPushedInsertHeadroom);
+        auto* entry = response->add_insert_headroom();
+        entry->set_table(tracked.table->name());
+        entry->set_inserts(headroom);
+        tracked.exhausted = headroom == 0;
+        any_exhausted |= tracked.exhausted;
+      }
+      if (any_exhausted && !headroom_alarm_set_) {
+        SetHeadroomAlarm();
+      }
+    }
+
+    // Pushes a response with the new headroom if the headroom of any table
+    // which was exhausted has recovered, otherwise polls again later.
+    void PollInsertHeadroom() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      const bool recovered = std::any_of(
+          tracked_headroom_.begin(), tracked_headroom_.end(),
+          [](const TrackedHeadroom& tracked) {
+            return tracked.exhausted && tracked.table->InsertHeadroom(1) > 0;
+          });
+      if (recovered) {
+        PushInsertHeadroom();
+      } else {
+        SetHeadroomAlarm();
+      }
+    }
+
+    // Tells the client straight away when the headroom of a table has been
+    // exhausted, rather than waiting for the next acknowledgement, which may
+    // not come until the headroom has recovered.
+    void MaybePushExhaustedHeadroom() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      for (const TrackedHeadroom& tracked : tracked_headroom_) {
+        if (!tracked.exhausted && tracked.table->InsertHeadroom(1) == 0) {
+          PushInsertHeadroom();
+          return;
         }
       }
+    }
+
+    // Queues a response which carries nothing but the headroom.
+    void PushInsertHeadroom() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      // A queued response which hasn't been prepared yet will carry the new
+      // headroom anyway.
+      if (CanExtendLastResponse()) {
+        return;
+      }
+      const bool already_writing = !responses_to_send_.empty();
+      responses_to_send_.emplace_back();
+      if (!already_writing) {
+        MaybeSendNextResponse();
+      }
+    }
+
+    void SetHeadroomAlarm() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      headroom_alarm_set_ = true;
+      std::weak_ptr<std::function<void()>> poll = poll_insert_headroom_;
+      headroom_alarm_.Set(
+          absl::ToChronoTime(absl::Now() + kInsertHeadroomPollInterval),
+          [poll](bool) {
+            if (auto to_call = poll.lock()) {
+              (*to_call)();
+            }
+          });
+    }
+
+    // Starts the next read unless the server exceeds its memory budget, in
+    // which case reading is resumed once the usage has dropped below the
+    // limit.
+    void MaybeStartReadWithinBudget() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      if (server_->memory_budget_ == nullptr ||
+          !server_->memory_budget_->exceeded()) {
+        MaybeStartRead();
+        return;
+      }
+      if (budget_alarm_set_ || read_in_flight_ || !still_reading_ ||
+          is_finished_) {
+        return;
+      }
+      static internal::Counter* const pauses =
+          internal::MetricsRegistry::Default()->GetCounter(
+              "reverb_insert_stream_read_pauses_total",
+              "Number of times insert streams paused reading because "
+              "--reverb_memory_soft_limit_bytes was exceeded.",
+              {});
+      pauses->Increment();
+      budget_alarm_set_ = true;
+      std::weak_ptr<std::function<void()>> resume = resume_reading_;
+      budget_alarm_.Set(
+          absl::ToChronoTime(absl::Now() + kMemoryBudgetPollInterval),
+          [resume](bool) {
+            if (auto to_call = resume.lock()) {
+              (*to_call)();
+            }
+          });
+    }
+
+    grpc::Status SaveChunks(std::vector<absl::Cord> chunks) {
+      for (absl::Cord& serialized : chunks) {
+        std::shared_ptr<ChunkStore::Chunk> chunk;
+        if (auto status = server_->chunk_store_->MakeChunk(
+                std::move(serialized), &chunk);
+            !status.ok()) {
+          return ToGrpcStatus(status);
+        }
+        chunks_.try_emplace(chunk->key(), std::move(chunk));
+      }
 
       return grpc::Status::OK;
     }
@@ -306,6 +1237,18 @@ ReverbServiceImpl::InsertStream(grpc::CallbackServerContext* context) {
       return grpc::Status::OK;
     }
 
+    grpc::Status ReleaseChunks(absl::Span<const uint64_t> release_keys) {
+      for (uint64_t key : release_keys) {
+        if (chunks_.erase(key) == 0) {
+          return grpc::Status(
+              grpc::StatusCode::FAILED_PRECONDITION,
+              absl::StrCat("ReleaseChunks: Chunk ", key,
+                           " was released but is not held by the stream."));
+        }
+      }
+      return grpc::Status::OK;
+    }
+
     // Incoming messages are handled one at a time. That is StartRead is not
     // called until `request_` has been completely salvaged. Fields accessed
     // only by OnRead are thus thread safe and require no additional mutex to
@@ -324,8 +1267,64 @@ ReverbServiceImpl::InsertStream(grpc::CallbackServerContext* context) {
     // Used to lookup tables when inserting items.
     const ReverbServiceImpl* server_;
 
+    // Identifies the stream to the tables for fair insert admission.
+    const uint64_t client_id_;
+
     // Callback called by the table when insert operation is completed.
     std::shared_ptr<Table::InsertCallback> insert_completed_;
+
+    // Keys of inserted items which haven't been acknowledged yet. See
+    // `InsertStreamOptions`.
+    std::vector<uint64_t> held_acks_ ABSL_GUARDED_BY(mu_);
+
+    // Set by the client through `InsertStreamOptions`. If true then chunks are
+    // released through `release_chunk_keys` instead of `keep_chunk_keys`.
+    bool release_chunks_incrementally_ ABSL_GUARDED_BY(mu_) = false;
+
+    // Acknowledgement options set by the client.
+    absl::Duration max_ack_delay_ ABSL_GUARDED_BY(mu_) = absl::ZeroDuration();
+    int max_acks_per_response_ ABSL_GUARDED_BY(mu_) = 0;
+
+    // Sends `held_acks_` once `max_ack_delay_` has passed since the oldest of
+    // them was held back.
+    grpc::Alarm ack_alarm_;
+    bool ack_alarm_set_ ABSL_GUARDED_BY(mu_) = false;
+
+    // Callback called by `ack_alarm_`.
+    std::shared_ptr<std::function<void()>> send_held_acks_;
+
+    // Set by the client through `InsertStreamOptions`. If true then the
+    // responses carry the headroom of `tracked_headroom_`.
+    bool push_insert_headroom_ ABSL_GUARDED_BY(mu_) = false;
+
+    // Tables which the stream has inserted into since `push_insert_headroom_`
+    // was set and whether the headroom last pushed for them was exhausted.
+    struct TrackedHeadroom {
+      std::shared_ptr<Table> table;
+      bool exhausted;
+    };
+    std::vector<TrackedHeadroom> tracked_headroom_ ABSL_GUARDED_BY(mu_);
+
+    // Polls the tables whose headroom was exhausted every
+    // `kInsertHeadroomPollInterval`.
+    grpc::Alarm headroom_alarm_;
+    bool headroom_alarm_set_ ABSL_GUARDED_BY(mu_) = false;
+
+    // Callback called by `headroom_alarm_`.
+    std::shared_ptr<std::function<void()>> poll_insert_headroom_;
+
+    // Memory budget charges of the items which have been handed to the tables
+    // but not yet inserted, by key.
+    internal::flat_hash_map<uint64_t, internal::MemoryBudget::Charge>
+        queued_item_charges_ ABSL_GUARDED_BY(mu_);
+
+    // Checks every `kMemoryBudgetPollInterval` whether reading, which was
+    // paused because the memory budget was exceeded, can be resumed.
+    grpc::Alarm budget_alarm_;
+    bool budget_alarm_set_ ABSL_GUARDED_BY(mu_) = false;
+
+    // Callback called by `budget_alarm_`.
+    std::shared_ptr<std::function<void()>> resume_reading_;
   };
 
   return new WorkerlessInsertReactor(this);
@@ -334,6 +1333,9 @@ ReverbServiceImpl::InsertStream(grpc::CallbackServerContext* context) {
 grpc::ServerBidiReactor<InitializeConnectionRequest,
                         InitializeConnectionResponse>*
 ReverbServiceImpl::InitializeConnection(grpc::CallbackServerContext* context) {
+  static internal::Counter* const rpcs = RpcCounter("InitializeConnection");
+  rpcs->Increment();
+  AddCurrentThreadToGrpcCallbackPool();
   class Reactor : public grpc::ServerBidiReactor<InitializeConnectionRequest,
                                                  InitializeConnectionResponse> {
    public:
@@ -361,22 +1363,29 @@ ReverbServiceImpl::InitializeConnection(grpc::CallbackServerContext* context) {
         return;
       }
 
-      if (table_ptr_ == nullptr) {
-        auto table = server_->TableByName(request_.table_name());
-        if (table == nullptr) {
-          Finish(TableNotFound(request_.table_name()));
-          return;
+      if (!sent_addresses_) {
+        // Allocate new shared pointers on the heap and transmit their memory
+        // addresses.
+        // The client will dereference and assume ownership of the objects
+        // before sending its response. For simplicity, the client will copy
+        // the shared_ptrs so the server is always responsible for cleaning up
+        // the heap allocated objects.
+        if (!request_.table_name().empty() || !request_.include_chunk_store()) {
+          auto table = server_->TableByName(request_.table_name());
+          if (table == nullptr) {
+            Finish(TableNotFound(request_.table_name()));
+            return;
+          }
+          table_ptr_ = new std::shared_ptr<Table>(table);
+          response_.set_address(reinterpret_cast<int64_t>(table_ptr_));
         }
-
-        // Allocate a new shared pointer on the heap and transmit its memory
-        // address.
-        // The client will dereference and assume ownership of the object before
-        // sending its response. For simplicity, the client will copy the
-        // shared_ptr so the server is always responsible for cleaning up the
-        // heap allocated object.
-        table_ptr_ = new std::shared_ptr<Table>(table);
-
-        response_.set_address(reinterpret_cast<int64_t>(table_ptr_));
+        if (request_.include_chunk_store()) {
+          chunk_store_ptr_ =
+              new std::shared_ptr<ChunkStore>(server_->chunk_store_);
+          response_.set_chunk_store_address(
+              reinterpret_cast<int64_t>(chunk_store_ptr_));
+        }
+        sent_addresses_ = true;
         StartWrite(&response_);
         return;
       }
@@ -394,9 +1403,9 @@ ReverbServiceImpl::InitializeConnection(grpc::CallbackServerContext* context) {
         return;
       }
 
-      // If the address was not set then the client was not running in the same
+      // If no address was set then the client was not running in the same
       // process. No further actions are required so we close down the stream.
-      if (response_.address() == 0) {
+      if (response_.address() == 0 && response_.chunk_store_address() == 0) {
         Finish(grpc::Status::OK);
         return;
       }
@@ -411,6 +1420,9 @@ ReverbServiceImpl::InitializeConnection(grpc::CallbackServerContext* context) {
       if (table_ptr_ != nullptr) {
         delete table_ptr_;
       }
+      if (chunk_store_ptr_ != nullptr) {
+        delete chunk_store_ptr_;
+      }
       delete this;
     }
 
@@ -419,6 +1431,8 @@ ReverbServiceImpl::InitializeConnection(grpc::CallbackServerContext* context) {
     InitializeConnectionRequest request_;
     InitializeConnectionResponse response_;
     std::shared_ptr<Table>* table_ptr_ = nullptr;
+    std::shared_ptr<ChunkStore>* chunk_store_ptr_ = nullptr;
+    bool sent_addresses_ = false;
   };
 
   return new Reactor(context, this);
@@ -428,6 +1442,9 @@ grpc::ServerUnaryReactor* ReverbServiceImpl::MutatePriorities(
     grpc::CallbackServerContext* context,
     const MutatePrioritiesRequest* request,
     MutatePrioritiesResponse* response) {
+  static internal::Counter* const rpcs = RpcCounter("MutatePriorities");
+  rpcs->Increment();
+  AddCurrentThreadToGrpcCallbackPool();
   grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
   std::shared_ptr<Table> table = TableByName(request->table());
   if (table == nullptr) {
@@ -435,10 +1452,249 @@ grpc::ServerUnaryReactor* ReverbServiceImpl::MutatePriorities(
     return reactor;
   }
 
+  if (ShouldForwardToPrimary(context)) {
+    // The call blocks until the primary responds so it is made from the
+    // executor rather than from the thread handling the RPC.
+    callback_executor_->Schedule([this, reactor, request, response] {
+      grpc::ClientContext primary_context;
+      reactor->Finish(
+          primary_->MutatePriorities(&primary_context, *request, response));
+    });
+    return reactor;
+  }
+
   auto status = table->MutateItems(
       std::vector<KeyWithPriority>(request->updates().begin(),
                                    request->updates().end()),
-      request->delete_keys());
+      request->delete_keys(), request->delete_episode_ids());
+  reactor->Finish(ToGrpcStatus(status));
+  return reactor;
+}
+
+grpc::ServerBidiReactor<MutatePrioritiesRequest, MutatePrioritiesResponse>*
+ReverbServiceImpl::MutatePrioritiesStream(
+    grpc::CallbackServerContext* context) {
+  static internal::Counter* const rpcs = RpcCounter("MutatePrioritiesStream");
+  rpcs->Increment();
+  AddCurrentThreadToGrpcCallbackPool();
+  struct MutatePrioritiesResponseCtx {
+    MutatePrioritiesResponse payload;
+  };
+
+  class MutatePrioritiesReactor
+      : public ReverbServerReactor<MutatePrioritiesRequest,
+                                   MutatePrioritiesResponse,
+                                   MutatePrioritiesResponseCtx> {
+   public:
+    MutatePrioritiesReactor(ReverbServiceImpl* server,
+                            bool forward_to_primary)
+        : ReverbServerReactor(),
+          server_(server),
+          forward_to_primary_(forward_to_primary),
+          apply_pending_requests_(std::make_shared<std::function<void()>>(
+              [this] { ApplyPendingRequests(); })) {
+      absl::MutexLock lock(&mu_);
+      MaybeStartRead();
+    }
+
+    ~MutatePrioritiesReactor() {
+      // As the callback references Reactor's memory make sure it can't be
+      // executed anymore.
+      std::weak_ptr<std::function<void()>> weak_ptr = apply_pending_requests_;
+      apply_pending_requests_.reset();
+      while (weak_ptr.lock()) {
+        absl::SleepFor(kCallbackWaitTime);
+      }
+      // The stream may have been finished (e.g by the client closing it) before
+      // all requests were applied. They can no longer be acknowledged but
+      // should still take effect.
+      absl::MutexLock lock(&mu_);
+      if (!pending_requests_.empty()) {
+        ApplyMerged(pending_requests_);
+      }
+    }
+
+    grpc::Status ProcessIncomingRequest(MutatePrioritiesRequest* request)
+        override ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      pending_requests_.push_back(std::move(*request));
+      request->Clear();
+      if (!apply_scheduled_) {
+        apply_scheduled_ = true;
+        std::weak_ptr<std::function<void()>> apply = apply_pending_requests_;
+        server_->callback_executor_->Schedule([apply] {
+          if (auto to_call = apply.lock()) {
+            (*to_call)();
+          }
+        });
+      }
+      // Read the next request while this one is applied so that it can be
+      // merged with any requests arriving in the meantime.
+      MaybeStartRead();
+      return grpc::Status::OK;
+    }
+
+   private:
+    // Applies all pending requests (including the ones arriving while doing
+    // so) and acknowledges each of them.
+    void ApplyPendingRequests() ABSL_LOCKS_EXCLUDED(mu_) {
+      std::vector<MutatePrioritiesRequest> requests;
+      while (true) {
+        {
+          absl::MutexLock lock(&mu_);
+          if (pending_requests_.empty()) {
+            apply_scheduled_ = false;
+            return;
+          }
+          std::swap(requests, pending_requests_);
+        }
+        auto status = ApplyMerged(requests);
+        absl::MutexLock lock(&mu_);
+        if (is_finished_) {
+          // Keep applying the remaining requests without acknowledging them.
+          requests.clear();
+          continue;
+        }
+        if (!status.ok()) {
+          apply_scheduled_ = false;
+          pending_requests_.clear();
+          SetReactorAsFinished(status);
+          return;
+        }
+        for (int i = 0; i < requests.size(); i++) {
+          responses_to_send_.emplace_back();
+          if (responses_to_send_.size() == 1) {
+            MaybeSendNextResponse();
+          }
+        }
+        requests.clear();
+      }
+    }
+
+    // Merges the mutations of `requests` per table and applies them with one
+    // `MutateItems` call per table. Later updates of a key replace earlier
+    // ones and updates of keys which are deleted are dropped. This yields the
+    // same result as applying the requests one by one since `MutateItems`
+    // ignores keys which don't exist. For the same reason deleting episodes
+    // after applying all updates is equivalent.
+    grpc::Status ApplyMerged(
+        const std::vector<MutatePrioritiesRequest>& requests) {
+      struct TableMutations {
+        std::vector<KeyWithPriority> updates;
+        internal::flat_hash_map<uint64_t, size_t> update_index;
+        std::vector<uint64_t> deletes;
+        internal::flat_hash_set<uint64_t> deleted;
+        std::vector<uint64_t> delete_episodes;
+      };
+      internal::flat_hash_map<std::string, TableMutations> mutations;
+      for (const auto& request : requests) {
+        TableMutations& table_mutations = mutations[request.table()];
+        for (const auto& update : request.updates()) {
+          auto it = table_mutations.update_index.find(update.key());
+          if (it != table_mutations.update_index.end()) {
+            table_mutations.updates[it->second] = update;
+          } else {
+            table_mutations.update_index[update.key()] =
+                table_mutations.updates.size();
+            table_mutations.updates.push_back(update);
+          }
+        }
+        for (uint64_t key : request.delete_keys()) {
+          if (table_mutations.deleted.insert(key).second) {
+            table_mutations.deletes.push_back(key);
+          }
+        }
+        table_mutations.delete_episodes.insert(
+            table_mutations.delete_episodes.end(),
+            request.delete_episode_ids().begin(),
+            request.delete_episode_ids().end());
+      }
+      for (auto& entry : mutations) {
+        std::shared_ptr<Table> table = server_->TableByName(entry.first);
+        if (table == nullptr) {
+          return TableNotFound(entry.first);
+        }
+        TableMutations& table_mutations = entry.second;
+        std::vector<KeyWithPriority> updates;
+        updates.reserve(table_mutations.updates.size());
+        for (auto& update : table_mutations.updates) {
+          if (!table_mutations.deleted.contains(update.key())) {
+            updates.push_back(std::move(update));
+          }
+        }
+        if (forward_to_primary_) {
+          MutatePrioritiesRequest request;
+          request.set_table(entry.first);
+          for (auto& update : updates) {
+            *request.add_updates() = std::move(update);
+          }
+          for (uint64_t key : table_mutations.deletes) {
+            request.add_delete_keys(key);
+          }
+          for (uint64_t episode_id : table_mutations.delete_episodes) {
+            request.add_delete_episode_ids(episode_id);
+          }
+          grpc::ClientContext primary_context;
+          MutatePrioritiesResponse response;
+          if (auto status = server_->primary_->MutatePriorities(
+                  &primary_context, request, &response);
+              !status.ok()) {
+            return status;
+          }
+          continue;
+        }
+        if (auto status =
+                table->MutateItems(updates, table_mutations.deletes,
+                                   table_mutations.delete_episodes);
+            !status.ok()) {
+          return ToGrpcStatus(status);
+        }
+      }
+      return grpc::Status::OK;
+    }
+
+    // Used to lookup tables and to schedule applying the requests.
+    ReverbServiceImpl* server_;
+
+    // Whether the merged requests are sent to the primary instead of being
+    // applied to the local tables.
+    const bool forward_to_primary_;
+
+    // Requests which have been read but not yet applied.
+    std::vector<MutatePrioritiesRequest> pending_requests_
+        ABSL_GUARDED_BY(mu_);
+
+    // Whether `apply_pending_requests_` has been scheduled on the executor and
+    // hasn't returned yet.
+    bool apply_scheduled_ ABSL_GUARDED_BY(mu_) = false;
+
+    // Callback which is scheduled on the executor to apply pending requests.
+    std::shared_ptr<std::function<void()>> apply_pending_requests_;
+  };
+
+  return new MutatePrioritiesReactor(this, ShouldForwardToPrimary(context));
+}
+
+grpc::ServerUnaryReactor* ReverbServiceImpl::TransformPriorities(
+    grpc::CallbackServerContext* context,
+    const TransformPrioritiesRequest* request,
+    TransformPrioritiesResponse* response) {
+  static internal::Counter* const rpcs = RpcCounter("TransformPriorities");
+  rpcs->Increment();
+  AddCurrentThreadToGrpcCallbackPool();
+  grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+  std::shared_ptr<Table> table = TableByName(request->table());
+  if (table == nullptr) {
+    reactor->Finish(TableNotFound(request->table()));
+    return reactor;
+  }
+
+  absl::Status status = absl::OkStatus();
+  if (request->priority_scale() != 0) {
+    status = table->ScalePriorities(request->priority_scale());
+  }
+  if (status.ok() && request->has_priority_exponent()) {
+    status = table->SetPriorityExponent(request->priority_exponent().value());
+  }
   reactor->Finish(ToGrpcStatus(status));
   return reactor;
 }
@@ -446,49 +1702,32 @@ grpc::ServerUnaryReactor* ReverbServiceImpl::MutatePriorities(
 grpc::ServerUnaryReactor* ReverbServiceImpl::Reset(
     grpc::CallbackServerContext* context, const ResetRequest* request,
     ResetResponse* response) {
+  static internal::Counter* const rpcs = RpcCounter("Reset");
+  rpcs->Increment();
+  AddCurrentThreadToGrpcCallbackPool();
   grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
   std::shared_ptr<Table> table = TableByName(request->table());
   if (table == nullptr) {
     reactor->Finish(TableNotFound(request->table()));
     return reactor;
   }
+  if (ShouldForwardToPrimary(context)) {
+    callback_executor_->Schedule([this, reactor, request, response] {
+      grpc::ClientContext primary_context;
+      reactor->Finish(primary_->Reset(&primary_context, *request, response));
+    });
+    return reactor;
+  }
   auto status = table->Reset();
   reactor->Finish(ToGrpcStatus(status));
   return reactor;
 }
 
-grpc::ServerBidiReactor<SampleStreamRequest, SampleStreamResponse>*
+grpc::ServerBidiReactor<grpc::ByteBuffer, grpc::ByteBuffer>*
 ReverbServiceImpl::SampleStream(grpc::CallbackServerContext* context) {
-  struct SampleStreamResponseCtx {
-    SampleStreamResponseCtx() {}
-    SampleStreamResponseCtx(const SampleStreamResponseCtx&) = delete;
-    SampleStreamResponseCtx& operator=(const SampleStreamResponseCtx&) = delete;
-    SampleStreamResponseCtx(SampleStreamResponseCtx&& response) = default;
-    SampleStreamResponseCtx& operator=(SampleStreamResponseCtx&& response) =
-        default;
-
-    ~SampleStreamResponseCtx() {
-      // SampleStreamResponseCtx does not own immutable parts of the payload.
-      // We need to make sure not to destroy them while destructing the payload.
-      for (auto& entry : *payload.mutable_entries()) {
-        if (entry.info().has_item()) {
-          auto* item = entry.mutable_info()->mutable_item();
-          item->/*unsafe_arena_*/release_inserted_at();
-          item->/*unsafe_arena_*/release_flat_trajectory();
-        }
-        while (entry.data_size() != 0) {
-          entry.mutable_data()->UnsafeArenaReleaseLast();
-        }
-      }
-    }
-
-    void AddTableItem(std::shared_ptr<TableItem> item) {
-      table_items.push_back(std::move(item));
-    }
-
-    SampleStreamResponse payload;
-    std::vector<std::shared_ptr<TableItem>> table_items;
-  };
+  static internal::Counter* const rpcs = RpcCounter("SampleStream");
+  rpcs->Increment();
+  AddCurrentThreadToGrpcCallbackPool();
 
   // Maximal number of queued SampleStreamResponse-messages waiting to be send
   // to the client. When this limit is reached enqueuing of sampling requests on
@@ -497,7 +1736,7 @@ ReverbServiceImpl::SampleStream(grpc::CallbackServerContext* context) {
   static constexpr int kMaxQueuedResponses = 3;
 
   class WorkerlessSampleReactor
-      : public ReverbServerReactor<SampleStreamRequest, SampleStreamResponse,
+      : public ReverbServerReactor<grpc::ByteBuffer, grpc::ByteBuffer,
                                    SampleStreamResponseCtx> {
    public:
     using SamplingCallback = std::function<void(Table::SampleRequest*)>;
@@ -516,10 +1755,34 @@ ReverbServiceImpl::SampleStream(grpc::CallbackServerContext* context) {
                   return;
                 }
                 task_info_.fetched_samples += sample->samples.size();
+                if (!mixture_.empty()) {
+                  ChargeMixture(sample->samples.size());
+                }
                 bool already_writing = !responses_to_send_.empty();
+                if (group_by_chunk_) {
+                  GroupSamplesByChunk(&sample->samples);
+                }
+                if (decompress_chunks_) {
+                  absl::Status status = DecompressChunks(sample->samples);
+                  if (!status.ok()) {
+                    decompressed_chunks_.clear();
+                    if (!is_finished_) {
+                      SetReactorAsFinished(ToGrpcStatus(status));
+                    }
+                    return;
+                  }
+                }
                 for (Table::SampledItem& sample : sample->samples) {
-                  ProcessSample(&sample, already_writing);
+                  absl::Status status = ProcessSample(&sample);
+                  if (!status.ok()) {
+                    decompressed_chunks_.clear();
+                    if (!is_finished_) {
+                      SetReactorAsFinished(ToGrpcStatus(status));
+                    }
+                    return;
+                  }
                 }
+                decompressed_chunks_.clear();
                 if (!already_writing) {
                   MaybeSendNextResponse();
                 }
@@ -529,10 +1792,16 @@ ReverbServiceImpl::SampleStream(grpc::CallbackServerContext* context) {
                   return;
                 }
                 // Current request is finalized, ask for another one.
+                internal::FlightRecorder::Default()->Record(
+                    trace_id_, internal::TraceSide::kServer,
+                    "SampleStream reactor", trace_started_at_, absl::Now());
                 MaybeStartRead();
               })),
           waiting_for_enqueued_sample_(false) {
       absl::MutexLock lock(&mu_);
+      compress_responses_ = server->compress_streams_;
+      max_coalesced_response_bytes_ = kMaxSampleResponseSizeBytes;
+      memory_budget_ = server->memory_budget_;
       MaybeStartRead();
     }
 
@@ -552,8 +1821,33 @@ ReverbServiceImpl::SampleStream(grpc::CallbackServerContext* context) {
       MaybeStartSampling();
     }
 
-    grpc::Status ProcessIncomingRequest(SampleStreamRequest* request) override
+    grpc::Status ProcessIncomingRequest(grpc::ByteBuffer* buffer) override
         ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      SampleStreamRequest request;
+      grpc::Status status =
+          grpc::SerializationTraits<SampleStreamRequest>::Deserialize(buffer,
+                                                                      &request);
+      if (!status.ok()) return status;
+      return ProcessSampleRequest(&request);
+    }
+
+    const grpc::ByteBuffer* PrepareResponse(SampleStreamResponseCtx* response)
+        override ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      response->Serialize();
+      return &response->serialized;
+    }
+
+   private:
+    grpc::Status ProcessSampleRequest(SampleStreamRequest* request)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      if (request->credits() != 0) {
+        return GrantCredits(request);
+      }
+      if (credit_flow_control_) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                            "Streams with `credit_flow_control` only accept "
+                            "`credits` after the first request.");
+      }
       if (request->num_samples() <= 0) {
         return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
                             absl::StrCat("`num_samples` must be > 0 (got",
@@ -567,6 +1861,22 @@ ReverbServiceImpl::SampleStream(grpc::CallbackServerContext* context) {
                          Sampler::kAutoSelectValue, " (for auto tuning). Got",
                          request->flexible_batch_size(), "."));
       }
+      if (request->max_cached_chunks() < 0) {
+        return grpc::Status(
+            grpc::StatusCode::INVALID_ARGUMENT,
+            absl::StrCat("`max_cached_chunks` must be >= 0 (got ",
+                         request->max_cached_chunks(), ")."));
+      }
+      if (sent_chunks_ == nullptr) {
+        sent_chunks_ = absl::make_unique<internal::ChunkKeyWindow>(
+            request->max_cached_chunks());
+      } else if (sent_chunks_->capacity() != request->max_cached_chunks()) {
+        return grpc::Status(
+            grpc::StatusCode::INVALID_ARGUMENT,
+            absl::StrCat("`max_cached_chunks` must not change within a stream "
+                         "(got ", request->max_cached_chunks(), " but was ",
+                         sent_chunks_->capacity(), ")."));
+      }
       if (request->has_rate_limiter_timeout() &&
           request->rate_limiter_timeout().milliseconds() > 0) {
         task_info_.timeout =
@@ -575,21 +1885,93 @@ ReverbServiceImpl::SampleStream(grpc::CallbackServerContext* context) {
         task_info_.timeout = absl::InfiniteDuration();
       }
 
-      task_info_.table = server_->TableByName(request->table());
-      if (task_info_.table == nullptr) {
-        return TableNotFound(request->table());
+      if (request->mixture_size() > 0) {
+        grpc::Status status = SetMixture(*request);
+        if (!status.ok()) return status;
+      } else {
+        mixture_.clear();
+        task_info_.table = server_->TableByName(request->table());
+        if (task_info_.table == nullptr) {
+          return TableNotFound(request->table());
+        }
+      }
+      if (request->flexible_batch_size() != Sampler::kAutoSelectValue) {
+        task_info_.flexible_batch_size = request->flexible_batch_size();
+      } else if (mixture_.empty()) {
+        task_info_.flexible_batch_size =
+            task_info_.table->DefaultFlexibleBatchSize();
+      } else {
+        // Small batches keep the interleaving of the tables fine grained.
+        task_info_.flexible_batch_size = std::numeric_limits<int32_t>::max();
+        for (const MixtureComponent& component : mixture_) {
+          task_info_.flexible_batch_size =
+              std::min(task_info_.flexible_batch_size,
+                       component.table->DefaultFlexibleBatchSize());
+        }
       }
-      task_info_.flexible_batch_size =
-          request->flexible_batch_size() == Sampler::kAutoSelectValue
-              ? task_info_.table->DefaultFlexibleBatchSize()
-              : request->flexible_batch_size();
       task_info_.fetched_samples = 0;
       task_info_.requested_samples = request->num_samples();
+      if (request->trim_chunks() && request->max_cached_chunks() != 0) {
+        return grpc::Status(
+            grpc::StatusCode::INVALID_ARGUMENT,
+            absl::StrCat("`max_cached_chunks` must be 0 when `trim_chunks` is "
+                         "set (got ",
+                         request->max_cached_chunks(), ")."));
+      }
+      if (request->trim_chunks() && request->deduplicate_chunks()) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                            "`trim_chunks` and `deduplicate_chunks` can't both "
+                            "be set.");
+      }
+      if (request->group_by_chunk()) {
+        grpc::Status status = CheckGroupableByChunk();
+        if (!status.ok()) return status;
+      }
+      decompress_chunks_ = request->decompress_chunks();
+      trim_chunks_ = request->trim_chunks();
+      deduplicate_chunks_ = request->deduplicate_chunks();
+      group_by_chunk_ = request->group_by_chunk();
+      columns_.assign(request->columns().begin(), request->columns().end());
+      column_set_ = internal::flat_hash_set<int>(columns_.begin(),
+                                                 columns_.end());
+      trace_id_ = request->trace_id();
+      trace_started_at_ = absl::Now();
+      credit_flow_control_ = request->credit_flow_control();
+      MaybeStartSampling();
+      if (credit_flow_control_) {
+        // Keep reading so credits are received while the request is served.
+        MaybeStartRead();
+      }
+      return grpc::Status::OK;
+    }
+
+    // Extends the request being served by the credits granted in `request`
+    // (see `SampleStreamRequest.credit_flow_control`).
+    grpc::Status GrantCredits(SampleStreamRequest* request)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      const int64_t credits = request->credits();
+      request->clear_credits();
+      if (!credit_flow_control_) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                            "`credits` can only be granted on streams with "
+                            "`credit_flow_control`.");
+      }
+      if (credits < 0 || request->ByteSizeLong() != 0) {
+        return grpc::Status(
+            grpc::StatusCode::INVALID_ARGUMENT,
+            absl::StrCat("Requests which grant `credits` must grant a positive "
+                         "number of them and set no other field (got ",
+                         credits, " credits and ",
+                         request->ShortDebugString(), ")."));
+      }
+      // The counts are rebased so they stay small on long lived streams.
+      task_info_.requested_samples += credits - task_info_.fetched_samples;
+      task_info_.fetched_samples = 0;
       MaybeStartSampling();
+      MaybeStartRead();
       return grpc::Status::OK;
     }
 
-   private:
     void MaybeStartSampling() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
       const int next_batch_size = task_info_.NextSampleSize();
       if (next_batch_size == 0) {
@@ -605,26 +1987,283 @@ ReverbServiceImpl::SampleStream(grpc::CallbackServerContext* context) {
         return;
       }
       waiting_for_enqueued_sample_ = true;
+      if (!mixture_.empty()) {
+        task_info_.table = mixture_[NextMixtureComponent()].table;
+      }
       task_info_.table->EnqueSampleRequest(next_batch_size, sampling_done_,
-                                           task_info_.timeout);
+                                           task_info_.timeout, trace_id_);
     }
 
-    void ProcessSample(Table::SampledItem* sample, bool write_in_flight)
+    // Returns `INVALID_ARGUMENT` unless the samples of every table of the
+    // current request may be reordered (see
+    // `SampleStreamRequest.group_by_chunk`).
+    grpc::Status CheckGroupableByChunk() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      std::vector<Table*> tables;
+      if (mixture_.empty()) tables.push_back(task_info_.table.get());
+      for (const MixtureComponent& component : mixture_) {
+        tables.push_back(component.table.get());
+      }
+      for (Table* table : tables) {
+        if (table->static_info().sampler_options().is_deterministic()) {
+          return grpc::Status(
+              grpc::StatusCode::INVALID_ARGUMENT,
+              absl::StrCat("`group_by_chunk` can't be set when sampling from "
+                           "table ",
+                           table->name(),
+                           " since the order of its samples is determined by "
+                           "its sampler."));
+        }
+      }
+      return grpc::Status::OK;
+    }
+
+    // Resolves the tables of `request.mixture` into `mixture_`.
+    grpc::Status SetMixture(const SampleStreamRequest& request)
         ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
-      if (responses_to_send_.empty() ||
-          (responses_to_send_.size() == 1 && write_in_flight) ||
+      if (!request.table().empty()) {
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT,
+                            "`table` must be empty when `mixture` is set.");
+      }
+      mixture_.clear();
+      mixture_weight_ = 0;
+      for (const auto& component : request.mixture()) {
+        if (!(component.weight() > 0) || std::isinf(component.weight())) {
+          return grpc::Status(
+              grpc::StatusCode::INVALID_ARGUMENT,
+              absl::StrCat("The weight of table ", component.table(),
+                           " in `mixture` must be > 0 and finite (got ",
+                           component.weight(), ")."));
+        }
+        auto table = server_->TableByName(component.table());
+        if (table == nullptr) return TableNotFound(component.table());
+        mixture_.push_back({std::move(table), component.weight()});
+        mixture_weight_ += component.weight();
+      }
+      return grpc::Status::OK;
+    }
+
+    // Index of the component of `mixture_` to sample the next batch from. This
+    // is the smooth weighted round robin order: the component which is the
+    // furthest behind its share of the samples fetched so far.
+    int NextMixtureComponent() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      mixture_index_ = 0;
+      for (int i = 1; i < mixture_.size(); i++) {
+        if (mixture_[i].credit + mixture_[i].weight >
+            mixture_[mixture_index_].credit + mixture_[mixture_index_].weight) {
+          mixture_index_ = i;
+        }
+      }
+      return mixture_index_;
+    }
+
+    // Accounts for `num_samples` fetched from the component `mixture_index_`
+    // by crediting every component with its share of them.
+    void ChargeMixture(int64_t num_samples) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      for (MixtureComponent& component : mixture_) {
+        component.credit += component.weight * num_samples;
+      }
+      mixture_[mixture_index_].credit -= mixture_weight_ * num_samples;
+    }
+
+    // Decompresses the chunks of `samples` which have to be sent to the
+    // client into `decompressed_chunks_`. The chunks are decompressed in
+    // parallel on the decompression executor of the server.
+    absl::Status DecompressChunks(
+        const std::vector<Table::SampledItem>& samples)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      std::vector<const ChunkStore::Chunk*> chunks;
+      for (const Table::SampledItem& sample : samples) {
+        for (const auto& chunk : sample.ref->chunks) {
+          if (sent_chunks_->Contains(chunk->key()) ||
+              decompressed_chunks_.contains(chunk->key())) {
+            continue;
+          }
+          decompressed_chunks_[chunk->key()] = nullptr;
+          chunks.push_back(chunk.get());
+        }
+      }
+
+      std::vector<std::shared_ptr<ChunkData>> decompressed(chunks.size());
+      std::vector<absl::Status> statuses(chunks.size());
+      server_->decompression_executor_->ParallelFor(
+          chunks.size(), [&](int64_t i) {
+            decompressed[i] = std::make_shared<ChunkData>();
+            statuses[i] = chunks[i]->GetDecompressedData(decompressed[i].get());
+          });
+      for (int i = 0; i < chunks.size(); i++) {
+        REVERB_RETURN_IF_ERROR(statuses[i]);
+        decompressed_chunks_[chunks[i]->key()] = std::move(decompressed[i]);
+      }
+      return absl::OkStatus();
+    }
+
+    // Looks up the decompressed copy of `chunk` in `decompressed_chunks_`.
+    // Only chunks which were held by the client when the samples arrived but
+    // have been evicted since are missing, those are decompressed here.
+    absl::Status GetDecompressedChunk(const ChunkStore::Chunk& chunk,
+                                      std::shared_ptr<const ChunkData>* out)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      auto it = decompressed_chunks_.find(chunk.key());
+      if (it != decompressed_chunks_.end() && it->second != nullptr) {
+        *out = it->second;
+        return absl::OkStatus();
+      }
+      auto decompressed = std::make_shared<ChunkData>();
+      REVERB_RETURN_IF_ERROR(chunk.GetDecompressedData(decompressed.get()));
+      decompressed_chunks_[chunk.key()] = decompressed;
+      *out = std::move(decompressed);
+      return absl::OkStatus();
+    }
+
+    // Trims the chunks of `item` to the rows referenced by its trajectory
+    // and adds them to `trimmed`. Chunks which are referenced in full (or are
+    // sparse) are left out. If at least one chunk was trimmed then
+    // `trajectory` is set to a copy of the trajectory of the item with the
+    // slice offsets rewritten to index into the trimmed chunks.
+    absl::Status TrimChunks(
+        const TableItem& item,
+        internal::flat_hash_map<uint64_t, std::shared_ptr<const ChunkData>>*
+            trimmed,
+        std::unique_ptr<FlatTrajectory>* trajectory)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      // The rows [begin, end) referenced in each chunk.
+      FlatTrajectory scratch;
+      const FlatTrajectory& item_trajectory = item.flat_trajectory(&scratch);
+      internal::flat_hash_map<uint64_t, std::pair<int, int>> rows;
+      for (const auto& column : item_trajectory.columns()) {
+        for (const auto& slice : column.chunk_slices()) {
+          const int end = slice.offset() + slice.length();
+          auto [it, inserted] =
+              rows.try_emplace(slice.chunk_key(), slice.offset(), end);
+          if (!inserted) {
+            it->second.first = std::min(it->second.first, slice.offset());
+            it->second.second = std::max(it->second.second, end);
+          }
+        }
+      }
+
+      internal::flat_hash_map<uint64_t, int> offsets;
+      for (const auto& chunk : item.chunks) {
+        auto it = rows.find(chunk->key());
+        if (it == rows.end() || trimmed->contains(chunk->key())) continue;
+        const auto [begin, end] = it->second;
+
+        std::shared_ptr<const ChunkData> decompressed;
+        absl::optional<ChunkStore::Chunk::DataPin> pin;
+        const ChunkData* data;
+        if (decompress_chunks_) {
+          REVERB_RETURN_IF_ERROR(GetDecompressedChunk(*chunk, &decompressed));
+          data = decompressed.get();
+        } else {
+          pin.emplace(chunk->Pin());
+          data = &pin->data();
+        }
+        if (data->sequence_range().sparse() ||
+            data->data().tensors_size() == 0 ||
+            (begin == 0 && end == ChunkColumnNumRows(*data, /*column=*/0))) {
+          continue;
+        }
+
+        auto sliced = std::make_shared<ChunkData>();
+        int offset;
+        REVERB_RETURN_IF_ERROR(
+            internal::SliceChunkData(*data, begin, end, sliced.get(), &offset));
+        (*trimmed)[chunk->key()] = std::move(sliced);
+        offsets[chunk->key()] = offset;
+      }
+
+      if (offsets.empty()) return absl::OkStatus();
+      *trajectory = absl::make_unique<FlatTrajectory>(item_trajectory);
+      for (auto& column : *(*trajectory)->mutable_columns()) {
+        for (auto& slice : *column.mutable_chunk_slices()) {
+          auto it = offsets.find(slice.chunk_key());
+          if (it != offsets.end()) {
+            slice.set_offset(slice.offset() - it->second);
+          }
+        }
+      }
+      return absl::OkStatus();
+    }
+
+    // Replaces `trajectory` (or the trajectory of `item` if `trajectory` is
+    // null) with the columns requested by the client and sets
+    // `chunk_indices` to the indices of the chunks of `item` which are
+    // referenced by these columns. `strip_columns` is set if the chunks also
+    // hold the data of columns which were not requested.
+    absl::Status ProjectColumns(const TableItem& item,
+                                std::unique_ptr<FlatTrajectory>* trajectory,
+                                std::vector<int>* chunk_indices,
+                                bool* strip_columns)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      FlatTrajectory scratch;
+      const FlatTrajectory& source = *trajectory != nullptr
+                                         ? **trajectory
+                                         : item.flat_trajectory(&scratch);
+      auto projected = absl::make_unique<FlatTrajectory>();
+      REVERB_RETURN_IF_ERROR(
+          internal::ProjectTrajectory(source, columns_, projected.get()));
+      // Column `c` of a timestep trajectory is tensor `c` of its chunks, so
+      // the same tensors are stripped from a chunk whichever item it is sent
+      // for. This keeps chunks held by the client valid for later samples.
+      *strip_columns = internal::IsTimestepTrajectory(source) &&
+                       column_set_.size() < source.columns_size();
+
+      const auto keys = internal::GetChunkKeys(*projected);
+      const internal::flat_hash_set<uint64_t> key_set(keys.begin(),
+                                                      keys.end());
+      for (int i = 0; i < item.chunks.size(); i++) {
+        if (key_set.contains(item.chunks[i]->key())) {
+          chunk_indices->push_back(i);
+        }
+      }
+      *trajectory = std::move(projected);
+      return absl::OkStatus();
+    }
+
+    absl::Status ProcessSample(Table::SampledItem* sample)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      if (!CanExtendLastResponse() ||
           current_response_size_bytes_ > kMaxSampleResponseSizeBytes) {
         // We need a new response as there is no previous one / is already in
         // flight or too big.
-        responses_to_send_.emplace();
+        responses_to_send_.emplace_back();
         current_response_size_bytes_ = 0;
       }
       SampleStreamResponseCtx* response = &responses_to_send_.back();
+
+      internal::flat_hash_map<uint64_t, std::shared_ptr<const ChunkData>>
+          trimmed;
+      // Set if the trajectory of the item was rewritten for the client.
+      std::unique_ptr<FlatTrajectory> trajectory;
+      if (trim_chunks_) {
+        absl::Status status = TrimChunks(*sample->ref, &trimmed, &trajectory);
+        if (!status.ok()) {
+          response->AddTableItem(std::move(sample->ref));
+          return status;
+        }
+      }
+
+      // Indices of the chunks of the item which are sent to the client.
+      std::vector<int> chunk_indices;
+      bool strip_columns = false;
+      if (columns_.empty()) {
+        chunk_indices.resize(sample->ref->chunks.size());
+        std::iota(chunk_indices.begin(), chunk_indices.end(), 0);
+      } else {
+        absl::Status status = ProjectColumns(*sample->ref, &trajectory,
+                                             &chunk_indices, &strip_columns);
+        if (!status.ok()) {
+          response->AddTableItem(std::move(sample->ref));
+          return status;
+        }
+      }
+
       auto* entry = response->payload.add_entries();
-      for (int i = 0; i < sample->ref->chunks.size(); i++) {
-        entry->set_end_of_sequence(i + 1 == sample->ref->chunks.size());
+      for (int n = 0; n < chunk_indices.size(); n++) {
+        const int i = chunk_indices[n];
+        entry->set_end_of_sequence(n + 1 == chunk_indices.size());
         // Attach the info to the first message.
-        if (i == 0) {
+        if (n == 0) {
           auto* item = entry->mutable_info()->mutable_item();
           auto& sample_item = sample->ref->item;
           item->set_key(sample_item.key());
@@ -635,36 +2274,117 @@ ReverbServiceImpl::SampleStream(grpc::CallbackServerContext* context) {
           // upon destruction of the item.
           item->/*unsafe_arena_*/set_allocated_inserted_at(
               sample_item.mutable_inserted_at());
-          item->/*unsafe_arena_*/set_allocated_flat_trajectory(
-              sample_item.mutable_flat_trajectory());
+          if (trajectory != nullptr) {
+            item->/*unsafe_arena_*/set_allocated_flat_trajectory(
+                trajectory.get());
+            response->owned_trajectories.push_back(std::move(trajectory));
+          } else {
+            response->SetTrajectory(sample->ref.get(), item);
+          }
           entry->mutable_info()->set_probability(sample->probability);
           entry->mutable_info()->set_table_size(sample->table_size);
           entry->mutable_info()->set_rate_limited(sample->rate_limited);
         }
-        ChunkData* chunk =
-            const_cast<ChunkData*>(&sample->ref->chunks[i]->data());
-        current_response_size_bytes_ += chunk->ByteSizeLong();
+        const ChunkStore::Key key = sample->ref->chunks[i]->key();
+        if (sent_chunks_->Contains(key)) {
+          // The client still holds the chunk so there is no need to send it
+          // again.
+          entry->add_cached_chunk_keys(key);
+          continue;
+        }
+        if (deduplicate_chunks_ && response->chunk_keys.contains(key)) {
+          // An earlier entry of the same response already holds the chunk.
+          entry->add_response_chunk_keys(key);
+          continue;
+        }
+        uint64_t evicted;
+        sent_chunks_->Insert(key, &evicted);
+
+        ChunkData* chunk;
+        bool spliced = false;
+        if (auto it = trimmed.find(key); it != trimmed.end()) {
+          chunk = const_cast<ChunkData*>(it->second.get());
+          response->owned_chunks.push_back(std::move(it->second));
+        } else if (decompress_chunks_) {
+          std::shared_ptr<const ChunkData> decompressed;
+          absl::Status status =
+              GetDecompressedChunk(*sample->ref->chunks[i], &decompressed);
+          if (!status.ok()) {
+            // The response references the item so it must keep it alive.
+            response->AddTableItem(std::move(sample->ref));
+            return status;
+          }
+          chunk = const_cast<ChunkData*>(decompressed.get());
+          response->owned_chunks.push_back(std::move(decompressed));
+        } else if (!strip_columns) {
+          // The chunk is sent as stored so its wire encoding is spliced into
+          // the response without parsing it. Chunks which were inserted but
+          // never accessed are thereby never parsed on the server.
+          response->placeholder_chunks.emplace_back();
+          chunk = &response->placeholder_chunks.back();
+          absl::Cord& serialized = response->serialized_chunks[chunk];
+          serialized = sample->ref->chunks[i]->SerializedData();
+          current_response_size_bytes_ += serialized.size();
+          spliced = true;
+        } else {
+          // The data must stay in memory until the response has been sent.
+          response->chunk_pins.push_back(sample->ref->chunks[i]->Pin());
+          chunk = const_cast<ChunkData*>(&response->chunk_pins.back().data());
+        }
+        if (strip_columns) {
+          auto stripped = std::make_shared<ChunkData>();
+          internal::StripChunkColumns(*chunk, column_set_, stripped.get());
+          chunk = stripped.get();
+          response->owned_chunks.push_back(std::move(stripped));
+        }
+        if (!spliced) {
+          current_response_size_bytes_ += chunk->ByteSizeLong();
+        }
         entry->mutable_data()->UnsafeArenaAddAllocated(chunk);
-        if (i < sample->ref->chunks.size() - 1 &&
+        if (deduplicate_chunks_) {
+          response->chunk_keys.insert(key);
+        }
+        if (n + 1 < chunk_indices.size() &&
             current_response_size_bytes_ > kMaxSampleResponseSizeBytes) {
           // Current response is too big, start a new one.
-          responses_to_send_.emplace();
+          responses_to_send_.emplace_back();
           current_response_size_bytes_ = 0;
           response = &responses_to_send_.back();
           entry = response->payload.add_entries();
         }
       }
       // Reference sample only in the last response containing it, so it is
-      // released when fully sent to the client.
-      response->AddTableItem(sample->ref);
+      // released when fully sent to the client. The sample is not used after
+      // this point so the reference is moved rather than copied.
+      response->AddTableItem(std::move(sample->ref));
+      return absl::OkStatus();
     }
 
     // Used to lookup tables when inserting items.
     const ReverbServiceImpl* server_;
 
-    // Context of the current sample request.
+    // Context of the current sample request. With a mixture, `table` is the
+    // table of the latest batch.
     SampleTaskInfo task_info_ ABSL_GUARDED_BY(mu_);
 
+    // Tables of the current request if it sets `mixture`, otherwise empty.
+    struct MixtureComponent {
+      std::shared_ptr<Table> table;
+      double weight;
+      // Samples owed to the table, scaled by the total weight. Negative while
+      // the table is ahead of its share.
+      double credit = 0;
+    };
+    std::vector<MixtureComponent> mixture_ ABSL_GUARDED_BY(mu_);
+    double mixture_weight_ ABSL_GUARDED_BY(mu_) = 0;
+    // Component of `mixture_` which the batch in flight is sampled from.
+    int mixture_index_ ABSL_GUARDED_BY(mu_) = 0;
+
+    // Flight recorder trace of the current sample request (0 if it isn't
+    // traced) and when the request was received.
+    uint64_t trace_id_ ABSL_GUARDED_BY(mu_) = 0;
+    absl::Time trace_started_at_ ABSL_GUARDED_BY(mu_);
+
     // Callback called by the table worker when current sampling batch is done.
     std::shared_ptr<SamplingCallback> sampling_done_;
 
@@ -675,11 +2395,141 @@ ReverbServiceImpl::SampleStream(grpc::CallbackServerContext* context) {
     // True if the reactor is awaiting the result of a sampling request already
     // enqueued in the target table.
     bool waiting_for_enqueued_sample_ ABSL_GUARDED_BY(mu_);
+
+    // Keys of the chunks that the client holds on to, in the order they were
+    // sent. Created when the first request is received.
+    std::unique_ptr<internal::ChunkKeyWindow> sent_chunks_
+        ABSL_GUARDED_BY(mu_);
+
+    // True if the stream uses credit based flow control. Set by its first
+    // request.
+    bool credit_flow_control_ ABSL_GUARDED_BY(mu_) = false;
+
+    // True if the current request asked for the chunks to be decompressed.
+    bool decompress_chunks_ ABSL_GUARDED_BY(mu_) = false;
+
+    // True if the current request asked for the chunks to be trimmed to the
+    // rows referenced by the sampled items.
+    bool trim_chunks_ ABSL_GUARDED_BY(mu_) = false;
+
+    // True if the current request asked for every chunk to be sent at most
+    // once per response.
+    bool deduplicate_chunks_ ABSL_GUARDED_BY(mu_) = false;
+
+    // True if the current request asked for the samples of every batch to be
+    // grouped by the chunks they reference.
+    bool group_by_chunk_ ABSL_GUARDED_BY(mu_) = false;
+
+    // Columns of the trajectories requested by the current request, or empty
+    // if all columns are returned.
+    std::vector<int> columns_ ABSL_GUARDED_BY(mu_);
+    internal::flat_hash_set<int> column_set_ ABSL_GUARDED_BY(mu_);
+
+    // Decompressed chunks of the samples being processed, by chunk key.
+    // Cleared once the samples have been added to the responses.
+    internal::flat_hash_map<uint64_t, std::shared_ptr<const ChunkData>>
+        decompressed_chunks_ ABSL_GUARDED_BY(mu_);
   };
 
   return new WorkerlessSampleReactor(this);
 }
 
+grpc::ServerBidiReactor<GetItemsRequest, SampleStreamResponse>*
+ReverbServiceImpl::GetItems(grpc::CallbackServerContext* context) {
+  static internal::Counter* const rpcs = RpcCounter("GetItems");
+  rpcs->Increment();
+  AddCurrentThreadToGrpcCallbackPool();
+
+  // Maximal number of responses waiting to be sent to the client. No more
+  // requests are read until one of them has been sent.
+  static constexpr int kMaxQueuedResponses = 3;
+
+  class GetItemsReactor
+      : public ReverbServerReactor<GetItemsRequest, SampleStreamResponse,
+                                   SampleStreamResponseCtx> {
+   public:
+    explicit GetItemsReactor(ReverbServiceImpl* server)
+        : ReverbServerReactor(), server_(server) {
+      absl::MutexLock lock(&mu_);
+      compress_responses_ = server->compress_streams_;
+      memory_budget_ = server->memory_budget_;
+      MaybeStartRead();
+    }
+
+    void OnWriteDone(bool ok) override {
+      ReverbServerReactor::OnWriteDone(ok);
+      absl::MutexLock lock(&mu_);
+      MaybeStartRead();
+    }
+
+    grpc::Status ProcessIncomingRequest(GetItemsRequest* request) override
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      std::shared_ptr<Table> table = server_->TableByName(request->table());
+      if (table == nullptr) {
+        return TableNotFound(request->table());
+      }
+      std::vector<Table::SampledItem> items;
+      table->GetBatch(request->keys(), &items);
+
+      const bool already_writing = !responses_to_send_.empty();
+      SampleStreamResponseCtx* response = &responses_to_send_.emplace_back();
+      for (Table::SampledItem& item : items) {
+        AddItem(&item, request->deduplicate_chunks(), response);
+      }
+      if (!already_writing) {
+        MaybeSendNextResponse();
+      }
+      if (responses_to_send_.size() < kMaxQueuedResponses) {
+        MaybeStartRead();
+      }
+      return grpc::Status::OK;
+    }
+
+   private:
+    // Adds an entry holding `item` and its chunks to `response`. Follows the
+    // encoding of the samples of `SampleStream`: the data of the chunks is
+    // referenced rather than copied and, if `deduplicate_chunks` is set,
+    // chunks already sent by an earlier entry are only referenced by key.
+    static void AddItem(Table::SampledItem* item, bool deduplicate_chunks,
+                        SampleStreamResponseCtx* response) {
+      auto* entry = response->payload.add_entries();
+      entry->set_end_of_sequence(true);
+
+      auto* info = entry->mutable_info();
+      auto& table_item = item->ref->item;
+      info->mutable_item()->set_key(table_item.key());
+      info->mutable_item()->set_table(table_item.table());
+      info->mutable_item()->set_priority(item->priority);
+      info->mutable_item()->set_times_sampled(item->times_sampled);
+      // ~SampleStreamResponseCtx releases these fields from the proto upon
+      // destruction of the response.
+      info->mutable_item()->/*unsafe_arena_*/set_allocated_inserted_at(
+          table_item.mutable_inserted_at());
+      response->SetTrajectory(item->ref.get(), info->mutable_item());
+      info->set_probability(item->probability);
+      info->set_table_size(item->table_size);
+
+      for (const auto& chunk : item->ref->chunks) {
+        if (deduplicate_chunks && response->chunk_keys.contains(chunk->key())) {
+          entry->add_response_chunk_keys(chunk->key());
+          continue;
+        }
+        response->chunk_pins.push_back(chunk->Pin());
+        entry->mutable_data()->UnsafeArenaAddAllocated(
+            const_cast<ChunkData*>(&response->chunk_pins.back().data()));
+        if (deduplicate_chunks) {
+          response->chunk_keys.insert(chunk->key());
+        }
+      }
+      response->AddTableItem(std::move(item->ref));
+    }
+
+    const ReverbServiceImpl* server_;
+  };
+
+  return new GetItemsReactor(this);
+}
+
 std::shared_ptr<Table> ReverbServiceImpl::TableByName(
     absl::string_view name) const {
   auto it = tables_.find(name);
@@ -687,6 +2537,14 @@ std::shared_ptr<Table> ReverbServiceImpl::TableByName(
   return it->second;
 }
 
+bool ReverbServiceImpl::ShouldForwardToPrimary(
+    const grpc::CallbackServerContext* context) const {
+  if (primary_ == nullptr) return false;
+  // Operations replicated by the primary are applied locally.
+  return context->client_metadata().find(kReplicatedOperationMetadataKey) ==
+         context->client_metadata().end();
+}
+
 void ReverbServiceImpl::Close() {
   for (auto& table : tables_) {
     table.second->Close();
@@ -710,11 +2568,66 @@ std::string ReverbServiceImpl::DebugString() const {
 grpc::ServerUnaryReactor* ReverbServiceImpl::ServerInfo(
     grpc::CallbackServerContext* context, const ServerInfoRequest* request,
     ServerInfoResponse* response) {
+  static internal::Counter* const rpcs = RpcCounter("ServerInfo");
+  rpcs->Increment();
+  AddCurrentThreadToGrpcCallbackPool();
   grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
-  for (const auto& iter : tables_) {
-    *response->add_table_info() = iter.second->info();
+  // Clients which already know the static fields of the current tables only
+  // receive the dynamic ones, which notably leaves out the signatures.
+  const bool omit_static_fields =
+      request->has_known_tables_state_id() &&
+      MessageToUint128(request->known_tables_state_id()) == tables_state_id_;
+  for (const auto& [name, table] : tables_) {
+    TableInfo* info = response->add_table_info();
+    if (omit_static_fields) {
+      info->set_name(name);
+    } else {
+      *info = static_table_info_.at(name);
+    }
+    table->FillDynamicInfo(info);
   }
   *response->mutable_tables_state_id() = Uint128ToMessage(tables_state_id_);
+  response->set_static_fields_omitted(omit_static_fields);
+  internal::ThreadPoolUsageTracker::Report(response->mutable_thread_pools());
+  reactor->Finish(grpc::Status::OK);
+  return reactor;
+}
+
+grpc::ServerUnaryReactor* ReverbServiceImpl::DumpTrace(
+    grpc::CallbackServerContext* context, const DumpTraceRequest* request,
+    DumpTraceResponse* response) {
+  static internal::Counter* const rpcs = RpcCounter("DumpTrace");
+  rpcs->Increment();
+  AddCurrentThreadToGrpcCallbackPool();
+  grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+  internal::FlightRecorder* recorder = internal::FlightRecorder::Default();
+  response->set_chrome_trace_json(recorder->ToChromeTraceJson());
+  if (request->clear()) {
+    recorder->Clear();
+  }
+  reactor->Finish(grpc::Status::OK);
+  return reactor;
+}
+
+grpc::ServerUnaryReactor* ReverbServiceImpl::LockProfile(
+    grpc::CallbackServerContext* context, const LockProfileRequest* request,
+    LockProfileResponse* response) {
+  static internal::Counter* const rpcs = RpcCounter("LockProfile");
+  rpcs->Increment();
+  AddCurrentThreadToGrpcCallbackPool();
+  grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+  switch (request->mode()) {
+    case LockProfileRequest::ENABLE:
+      internal::LockProfiler::SetEnabled(true);
+      break;
+    case LockProfileRequest::DISABLE:
+      internal::LockProfiler::SetEnabled(false);
+      break;
+    default:
+      break;
+  }
+  internal::LockProfiler::Report(request->reset(),
+                                 response->mutable_profile());
   reactor->Finish(grpc::Status::OK);
   return reactor;
 }
@@ -15,13 +15,18 @@
 #ifndef REVERB_CC__REVERB_SERVICE_IMPL_H_
 #define REVERB_CC__REVERB_SERVICE_IMPL_H_
 
+#include <map>
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "grpcpp/grpcpp.h"
 #include "absl/numeric/int128.h"
 #include "absl/random/random.h"
 #include "absl/status/status.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
 #include "reverb/cc/checkpointing/interface.h"
 #include "reverb/cc/chunk_store.h"
@@ -30,7 +35,10 @@
 #include "reverb/cc/reverb_service.grpc.pb.h"
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/memory_budget.h"
+#include "reverb/cc/support/metrics.h"
 #include "reverb/cc/support/periodic_closure.h"
+#include "reverb/cc/support/task_executor.h"
 #include "reverb/cc/support/unbounded_queue.h"
 #include "reverb/cc/table.h"
 
@@ -39,7 +47,14 @@ namespace reverb {
 
 // Implements ReverbService asynchronously. See reverb_service.proto for
 // documentation.
-class ReverbServiceImpl : public /* grpc_gen:: */ReverbService::CallbackService {
+//
+// InsertStream and SampleStream are registered as raw methods so their
+// messages can be (de)serialized by the service itself, see `InsertStream`
+// and `SampleStream`.
+class ReverbServiceImpl
+    : public /* grpc_gen:: */ReverbService::WithRawCallbackMethod_InsertStream<
+          /* grpc_gen:: */ReverbService::WithRawCallbackMethod_SampleStream<
+              /* grpc_gen:: */ReverbService::CallbackService>> {
  public:
   static absl::Status Create(
       std::vector<std::shared_ptr<Table>> tables,
@@ -50,10 +65,21 @@ class ReverbServiceImpl : public /* grpc_gen:: */ReverbService::CallbackService
       std::vector<std::shared_ptr<Table>> tables,
       std::unique_ptr<ReverbServiceImpl>* service);
 
+  // Unregisters the service from the default metrics registry.
+  ~ReverbServiceImpl() override;
+
+  // Unless `request->async()` is set, the checkpoint is written before the
+  // response is sent. Async checkpoints are written one at a time by a
+  // background thread and tracked with `CheckpointStatus`.
   grpc::ServerUnaryReactor* Checkpoint(grpc::CallbackServerContext* context,
                                        const CheckpointRequest* request,
                                        CheckpointResponse* response) override;
 
+  grpc::ServerUnaryReactor* CheckpointStatus(
+      grpc::CallbackServerContext* context,
+      const CheckpointStatusRequest* request,
+      CheckpointStatusResponse* response) override;
+
   // The InsertStream call schedules items to be inserted and to send back
   // confirmation when requested.
   // 1. The Reactor starts waiting to read
@@ -82,14 +108,33 @@ class ReverbServiceImpl : public /* grpc_gen:: */ReverbService::CallbackService
   // 3. When the last scheduled insertion runs, we reactivate the reads even if
   // the number of items in the queue exceeds max_queue_size_to_read as it is
   // the last opportunity we have to resume reads.
-  grpc::ServerBidiReactor<InsertStreamRequest, InsertStreamResponse>*
-  InsertStream(grpc::CallbackServerContext* context) override;
+  //
+  // Requests and responses are exchanged as (serialized) `InsertStreamRequest`
+  // and `InsertStreamResponse`. The chunks of a request are not parsed but
+  // kept in the buffers they were received in (see `ChunkStore::MakeChunk`)
+  // until their data is accessed on the server, which for chunks that are
+  // only sampled is never.
+  grpc::ServerBidiReactor<grpc::ByteBuffer, grpc::ByteBuffer>* InsertStream(
+      grpc::CallbackServerContext* context) override;
 
   grpc::ServerUnaryReactor* MutatePriorities(
       grpc::CallbackServerContext* context,
       const MutatePrioritiesRequest* request,
       MutatePrioritiesResponse* response) override;
 
+  // The MutatePrioritiesStream call reads requests ahead while earlier requests
+  // are applied on the callback executor. All requests which arrived in the
+  // meantime are merged (per table) and applied with a single
+  // `Table::MutateItems` call. Each request is acknowledged with an empty
+  // response once it has been applied.
+  grpc::ServerBidiReactor<MutatePrioritiesRequest, MutatePrioritiesResponse>*
+  MutatePrioritiesStream(grpc::CallbackServerContext* context) override;
+
+  grpc::ServerUnaryReactor* TransformPriorities(
+      grpc::CallbackServerContext* context,
+      const TransformPrioritiesRequest* request,
+      TransformPrioritiesResponse* response) override;
+
   grpc::ServerUnaryReactor* Reset(grpc::CallbackServerContext* context,
                                   const ResetRequest* request,
                                   ResetResponse* response) override;
@@ -107,17 +152,48 @@ class ReverbServiceImpl : public /* grpc_gen:: */ReverbService::CallbackService
   //    first message of the batch.
   //    3.c. if there are still messages to be sent,
   //    writes one message.
-  grpc::ServerBidiReactor<SampleStreamRequest, SampleStreamResponse>*
-  SampleStream(grpc::CallbackServerContext* context) override;
+  //
+  // Requests and responses are exchanged as (serialized) `SampleStreamRequest`
+  // and `SampleStreamResponse`. The wire encoding of every stored chunk is
+  // cached by the chunk (see `ChunkStore::Chunk::SerializedData`) and spliced
+  // into the responses as is, so chunks which are sampled repeatedly are only
+  // serialized once rather than once per response.
+  grpc::ServerBidiReactor<grpc::ByteBuffer, grpc::ByteBuffer>* SampleStream(
+      grpc::CallbackServerContext* context) override;
+
+  // Answers every request with a single response holding the requested items.
+  // The items are looked up synchronously when the request is read since
+  // `Table::GetBatch` never blocks on the rate limiter.
+  grpc::ServerBidiReactor<GetItemsRequest, SampleStreamResponse>* GetItems(
+      grpc::CallbackServerContext* context) override;
 
   grpc::ServerUnaryReactor* ServerInfo(grpc::CallbackServerContext* context,
                                        const ServerInfoRequest* request,
                                        ServerInfoResponse* response) override;
 
+  // Toggles the process wide `internal::LockProfiler` so the profile covers all
+  // tables and chunk stores of the process, not only those of this service.
+  grpc::ServerUnaryReactor* LockProfile(grpc::CallbackServerContext* context,
+                                        const LockProfileRequest* request,
+                                        LockProfileResponse* response) override;
+
+  // Dumps the process wide `internal::FlightRecorder`, which also holds the
+  // spans recorded by clients running in the same process.
+  grpc::ServerUnaryReactor* DumpTrace(grpc::CallbackServerContext* context,
+                                      const DumpTraceRequest* request,
+                                      DumpTraceResponse* response) override;
+
   grpc::ServerBidiReactor<InitializeConnectionRequest,
                           InitializeConnectionResponse>*
   InitializeConnection(grpc::CallbackServerContext* context) override;
 
+  // Whether the responses of the sample streams are compressed (see
+  // `GrpcTransportOptions::compress_streams`). Must be set before the service
+  // is started.
+  void set_compress_streams(bool compress_streams) {
+    compress_streams_ = compress_streams;
+  }
+
   // Gets a copy of the table lookup.
   internal::flat_hash_map<std::string, std::shared_ptr<Table>> tables() const;
 
@@ -127,31 +203,100 @@ class ReverbServiceImpl : public /* grpc_gen:: */ReverbService::CallbackService
   // Returns a summary string description.
   std::string DebugString() const;
 
+  // Lookups the table for a given name. Returns nullptr if not found.
+  std::shared_ptr<Table> TableByName(absl::string_view name) const;
+
+  // Chunk store which holds the chunks referenced by the items of the tables.
+  ChunkStore* chunk_store() const { return chunk_store_.get(); }
+
  private:
   explicit ReverbServiceImpl(
       std::shared_ptr<Checkpointer> checkpointer = nullptr);
 
   absl::Status Initialize(std::vector<std::shared_ptr<Table>> tables);
 
-  // Lookups the table for a given name. Returns nullptr if not found.
-  std::shared_ptr<Table> TableByName(absl::string_view name) const;
+  // Exports the state of the tables, the chunk store and the callback executor
+  // to the default metrics registry (see `internal::MetricsRegistry`).
+  void CollectMetrics(internal::MetricsWriter* writer) const;
+
+  // Whether priority mutations and resets received through `context` must be
+  // forwarded to `primary_` rather than applied locally.
+  bool ShouldForwardToPrimary(const grpc::CallbackServerContext* context) const;
+
+  // Writes a checkpoint of all tables with `checkpointer_`.
+  absl::Status SaveCheckpoint(std::string* path);
+
+  // Runs the async checkpoint `checkpoint_id` and records its outcome.
+  void RunAsyncCheckpoint(uint64_t checkpoint_id)
+      ABSL_LOCKS_EXCLUDED(checkpoints_mu_);
+
+  // Maximum number of async checkpoints whose status is kept. The status of
+  // the oldest checkpoint is dropped once it has completed.
+  static constexpr int kMaxTrackedCheckpoints = 64;
 
   // Checkpointer used to restore state in the constructor and to save data
   // when `Checkpoint` is called. Note that if `checkpointer_` is nullptr then
   // `Checkpoint` will return an `InvalidArgumentError`.
   std::shared_ptr<Checkpointer> checkpointer_;
 
-  // Stores chunks and keeps references to them.
-  ChunkStore chunk_store_;
+  // Memory held by chunks, queued inserts and sample responses. Insert streams
+  // pause reading while it exceeds `--reverb_memory_soft_limit_bytes`. Not set
+  // if no limit is set.
+  std::shared_ptr<internal::MemoryBudget> memory_budget_;
+
+  // Stores chunks and keeps references to them. Shared with the writers in
+  // the same process (see `InitializeConnection`).
+  const std::shared_ptr<ChunkStore> chunk_store_ =
+      std::make_shared<ChunkStore>();
 
   // Priority tables. Must be destroyed after `chunk_store_`.
   internal::flat_hash_map<std::string, std::shared_ptr<Table>> tables_;
 
+  // Executor shared by the tables for running operation callbacks. Also used
+  // to apply the requests of `MutatePrioritiesStream`.
+  std::shared_ptr<TaskExecutor> callback_executor_;
+
+  // Executors of the table groups which run on threads of their own (see
+  // `--reverb_table_executors`), keyed by the name prefix of their threads.
+  std::vector<std::pair<std::string, std::shared_ptr<TaskExecutor>>>
+      table_executors_;
+
+  // Executor which decompresses the chunks of sample streams that request
+  // `decompress_chunks`. Same as `callback_executor_` unless
+  // `--reverb_decompression_executor_num_threads` is set.
+  std::shared_ptr<TaskExecutor> decompression_executor_;
+
+  // See `set_compress_streams`.
+  bool compress_streams_ = false;
+
+  // Server which owns the tables replicated to this one (see
+  // `ReplicationExtension`), or nullptr. Set from `--reverb_primary_address`.
+  std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> primary_;
+
   absl::BitGen rnd_;
 
   // A new id must be generated whenever a table is added, deleted, or has its
   // signature modified.
   absl::uint128 tables_state_id_;
+
+  // `Table::static_info` of each table in `tables_`. Computed once since it
+  // only changes along with `tables_state_id_`.
+  internal::flat_hash_map<std::string, TableInfo> static_table_info_;
+
+  // Id of the collector registered with the default metrics registry, or -1.
+  int64_t metrics_collector_id_ = -1;
+
+  // Status of the async checkpoints by id.
+  absl::Mutex checkpoints_mu_;
+  uint64_t next_checkpoint_id_ ABSL_GUARDED_BY(checkpoints_mu_) = 1;
+  std::map<uint64_t, CheckpointStatusResponse> checkpoints_
+      ABSL_GUARDED_BY(checkpoints_mu_);
+
+  // Single thread running the async checkpoints, created by the first one.
+  // Declared last so that pending checkpoints complete before the tables and
+  // chunk store are destroyed.
+  std::unique_ptr<TaskExecutor> checkpoint_executor_
+      ABSL_GUARDED_BY(checkpoints_mu_);
 };
 
 
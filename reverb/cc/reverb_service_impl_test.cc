@@ -14,11 +14,13 @@
 
 #include "reverb/cc/reverb_service_impl.h"
 
+#include <algorithm>
 #include <cfloat>
 #include <cstddef>
 #include <list>
 #include <memory>
 #include <queue>
+#include <string>
 #include <vector>
 
 #include "grpcpp/server_builder.h"
@@ -36,6 +38,7 @@
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "absl/types/optional.h"
+#include "reverb/cc/chunk_store.h"
 #include "reverb/cc/platform/checkpointing.h"
 #include "reverb/cc/platform/status_macros.h"
 #include "reverb/cc/platform/status_matchers.h"
@@ -45,11 +48,17 @@
 #include "reverb/cc/selectors/fifo.h"
 #include "reverb/cc/selectors/interface.h"
 #include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/flight_recorder.h"
+#include "reverb/cc/tensor_compression.h"
 #include "reverb/cc/testing/proto_test_util.h"
+#include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/protobuf/struct.pb.h"
 
+ABSL_DECLARE_FLAG(int64_t, reverb_memory_soft_limit_bytes);
+ABSL_DECLARE_FLAG(std::string, reverb_table_executors);
+
 namespace deepmind {
 namespace reverb {
 namespace {
@@ -406,102 +415,69 @@ TEST(ReverbServiceImplTest, InsertStreamRespondsWithItemKeys) {
   EXPECT_EQ(responses[1].keys(0), first_id + 1);
 }
 
-TEST(ReverbServiceImplTest, SampleBlocksUntilEnoughInserts) {
+TEST(ReverbServiceImplTest, InsertStreamCoalescesAcksUpToCountThreshold) {
   std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
   std::unique_ptr<grpc::Server> server(
       grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
   /* grpc_gen:: */ReverbService::Stub stub(
       server->InProcessChannel(grpc::ChannelArguments()));
-  absl::Notification notification;
-  auto thread = internal::StartThread("", [&] {
-    grpc::ClientContext context;
-    auto stream = stub.SampleStream(&context);
-    ASSERT_TRUE(stream->Write(SampleRequest("dist", 1)));
-    ASSERT_TRUE(stream->WritesDone());
-    SampleStreamResponse response;
-    ASSERT_TRUE(stream->Read(&response));
-    REVERB_EXPECT_OK(stream->Finish());
-    notification.Notify();
-  });
-
-  // Blocking because there are no data to sample.
-  EXPECT_FALSE(notification.HasBeenNotified());
 
-  // Insert an item.
   grpc::ClientContext context;
   auto stream = stub.InsertStream(&context);
-  ASSERT_TRUE(stream->Write(InsertChunkRequest(1)));
-  ASSERT_TRUE(stream->Write(InsertItemRequest("dist", {1})));
+  InsertStreamRequest chunk_request = InsertChunkRequest(1);
+  chunk_request.mutable_options()->set_max_ack_delay_ms(3600 * 1000);
+  chunk_request.mutable_options()->set_max_acks_per_response(2);
+  ASSERT_TRUE(stream->Write(chunk_request));
+  auto first_id = nextId;
+  ASSERT_TRUE(stream->Write(InsertItemRequest("dist", {1}, {1})));
+  ASSERT_TRUE(stream->Write(InsertItemRequest("dist", {1}, {})));
   InsertStreamResponse response;
   ASSERT_TRUE(stream->Read(&response));
+  EXPECT_THAT(response.keys(), ::testing::ElementsAre(first_id, first_id + 1));
   ASSERT_TRUE(stream->WritesDone());
+  ASSERT_FALSE(stream->Read(&response));
   REVERB_EXPECT_OK(stream->Finish());
-
-  // The sample should now complete because there is data to sample.
-  notification.WaitForNotification();
-
-  thread = nullptr;  // Joins the thread.
 }
 
-TEST(ReverbServiceImplTest, MutateDeletionWorks) {
+TEST(ReverbServiceImplTest, InsertStreamSendsHeldAcksAfterMaxDelay) {
   std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
   std::unique_ptr<grpc::Server> server(
       grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
   /* grpc_gen:: */ReverbService::Stub stub(
       server->InProcessChannel(grpc::ChannelArguments()));
+
   grpc::ClientContext context;
   auto stream = stub.InsertStream(&context);
-  ASSERT_TRUE(stream->Write(InsertChunkRequest(1)));
-  auto insert_request = InsertItemRequest("dist", {1});
-  PrioritizedItem item = insert_request.items(0);
-  ASSERT_TRUE(stream->Write(insert_request));
+  InsertStreamRequest chunk_request = InsertChunkRequest(1);
+  chunk_request.mutable_options()->set_max_ack_delay_ms(10);
+  ASSERT_TRUE(stream->Write(chunk_request));
+  auto first_id = nextId;
+  ASSERT_TRUE(stream->Write(InsertItemRequest("dist", {1}, {})));
   InsertStreamResponse response;
   ASSERT_TRUE(stream->Read(&response));
+  EXPECT_THAT(response.keys(), ::testing::ElementsAre(first_id));
   ASSERT_TRUE(stream->WritesDone());
+  ASSERT_FALSE(stream->Read(&response));
   REVERB_EXPECT_OK(stream->Finish());
-
-  WaitForTableSize(service->tables()["dist"].get(), 1);
-
-  MutatePrioritiesRequest mutate_request;
-  MutatePrioritiesResponse mutate_response;
-  mutate_request.set_table("dist");
-  mutate_request.add_delete_keys(item.key());
-  grpc::ClientContext mutate_context;
-  REVERB_EXPECT_OK(
-      stub.MutatePriorities(&mutate_context, mutate_request, &mutate_response));
-
-  EXPECT_EQ(service->tables()["dist"]->size(), 0);
 }
 
-TEST(ReverbServiceImplTest, AnyCallWithInvalidDistributionFails) {
+TEST(ReverbServiceImplTest, InsertStreamRejectsNegativeOptions) {
   std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
   std::unique_ptr<grpc::Server> server(
       grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
   /* grpc_gen:: */ReverbService::Stub stub(
       server->InProcessChannel(grpc::ChannelArguments()));
 
-  grpc::ClientContext sample_context;
-  auto sample_stream = stub.SampleStream(&sample_context);
-  ASSERT_TRUE(sample_stream->Write(SampleRequest("invalid", 1)));
-  EXPECT_EQ(sample_stream->Finish().error_code(), grpc::StatusCode::NOT_FOUND);
-
-  grpc::ClientContext mutate_context;
-  MutatePrioritiesRequest mutate_request;
-  MutatePrioritiesResponse mutate_response;
-  mutate_request.set_table("invalid");
-  EXPECT_EQ(
-      stub.MutatePriorities(&mutate_context, mutate_request, &mutate_response)
-          .error_code(),
-      grpc::StatusCode::NOT_FOUND);
-
-  grpc::ClientContext insert_context;
-  auto insert_stream = stub.InsertStream(&insert_context);
-  ASSERT_TRUE(insert_stream->Write(InsertChunkRequest(1)));
-  ASSERT_TRUE(insert_stream->Write(InsertItemRequest("invalid", {1})));
-  EXPECT_EQ(insert_stream->Finish().error_code(), grpc::StatusCode::NOT_FOUND);
+  grpc::ClientContext context;
+  auto stream = stub.InsertStream(&context);
+  InsertStreamRequest chunk_request = InsertChunkRequest(1);
+  chunk_request.mutable_options()->set_max_ack_delay_ms(-1);
+  ASSERT_TRUE(stream->Write(chunk_request));
+  EXPECT_EQ(stream->Finish().error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
 }
 
-TEST(ReverbServiceImplTest, ResetWorks) {
+TEST(ReverbServiceImplTest, InsertStreamReleasesChunksIncrementally) {
   std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
   std::unique_ptr<grpc::Server> server(
       grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
@@ -510,142 +486,1322 @@ TEST(ReverbServiceImplTest, ResetWorks) {
 
   grpc::ClientContext context;
   auto stream = stub.InsertStream(&context);
-  ASSERT_TRUE(stream->Write(InsertChunkRequest(1)));
-  ASSERT_TRUE(stream->Write(InsertItemRequest("dist", {1})));
+  InsertStreamRequest chunk_request = InsertChunkRequest(1);
+  chunk_request.mutable_options()->set_release_chunks_incrementally(true);
+  ASSERT_TRUE(stream->Write(chunk_request));
+  ASSERT_TRUE(stream->Write(InsertChunkRequest(2)));
+
+  // Without release keys all chunks are kept.
+  ASSERT_TRUE(stream->Write(InsertItemRequest("dist", {1, 2})));
   InsertStreamResponse response;
   ASSERT_TRUE(stream->Read(&response));
-  ASSERT_TRUE(stream->WritesDone());
-  REVERB_EXPECT_OK(stream->Finish());
 
-  WaitForTableSize(service->tables()["dist"].get(), 1);
+  InsertStreamRequest release_request = InsertItemRequest("dist", {1, 2});
+  release_request.add_release_chunk_keys(1);
+  ASSERT_TRUE(stream->Write(release_request));
+  ASSERT_TRUE(stream->Read(&response));
 
-  ResetRequest reset_request;
-  reset_request.set_table("dist");
-  ResetResponse reset_response;
-  grpc::ClientContext reset_context;
-  REVERB_ASSERT_OK(stub.Reset(&reset_context, reset_request, &reset_response));
+  // Chunk 2 is still held by the stream but chunk 1 has been released.
+  ASSERT_TRUE(stream->Write(InsertItemRequest("dist", {2})));
+  ASSERT_TRUE(stream->Read(&response));
+  ASSERT_TRUE(stream->Write(InsertItemRequest("dist", {1})));
+  EXPECT_EQ(stream->Finish().error_code(), grpc::StatusCode::INTERNAL);
+}
 
-  EXPECT_EQ(service->tables()["dist"]->size(), 0);
+TEST(ReverbServiceImplTest, InsertStreamRejectsReleaseOfUnknownChunk) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext context;
+  auto stream = stub.InsertStream(&context);
+  InsertStreamRequest chunk_request = InsertChunkRequest(1);
+  chunk_request.mutable_options()->set_release_chunks_incrementally(true);
+  ASSERT_TRUE(stream->Write(chunk_request));
+  InsertStreamRequest release_request = InsertItemRequest("dist", {1});
+  release_request.add_release_chunk_keys(2);
+  ASSERT_TRUE(stream->Write(release_request));
+  EXPECT_EQ(stream->Finish().error_code(),
+            grpc::StatusCode::FAILED_PRECONDITION);
 }
 
-TEST(ReverbServiceImplTest, ServerInfoWorks) {
-  auto service = MakeService(10);
-  grpc::CallbackServerContext context;
-  grpc::testing::DefaultReactorTestPeer peer(&context);
+TEST(ReverbServiceImplTest, InsertStreamPushesInsertHeadroom) {
+  // The limiter only allows a single item to be inserted ahead of samples.
+  auto table = std::make_shared<Table>(
+      /*name=*/"limited",
+      /*sampler=*/absl::make_unique<UniformSelector>(),
+      /*remover=*/absl::make_unique<FifoSelector>(),
+      /*max_size=*/10,
+      /*max_times_sampled=*/0,
+      /*rate_limiter=*/
+      std::make_shared<RateLimiter>(/*samples_per_insert=*/1.0,
+                                    /*min_size_to_sample=*/1,
+                                    /*min_diff=*/-DBL_MAX, /*max_diff=*/1.0));
+  std::unique_ptr<ReverbServiceImpl> service =
+      MakeService(10, nullptr, {table});
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
 
-  ServerInfoRequest server_info_request;
-  ServerInfoResponse server_info_response;
+  grpc::ClientContext context;
+  auto stream = stub.InsertStream(&context);
+  InsertStreamRequest chunk_request = InsertChunkRequest(1);
+  chunk_request.mutable_options()->set_push_insert_headroom(true);
+  ASSERT_TRUE(stream->Write(chunk_request));
+  auto id = nextId;
+  ASSERT_TRUE(stream->Write(InsertItemRequest("limited", {1}, {1})));
 
-  grpc::ServerUnaryReactor* reactor = service->ServerInfo(
-      &context, &server_info_request, &server_info_response);
+  // The exhausted headroom may be pushed ahead of the acknowledgement.
+  InsertStreamResponse response;
+  do {
+    ASSERT_TRUE(stream->Read(&response));
+    ASSERT_THAT(response.insert_headroom(), ::testing::SizeIs(1));
+    EXPECT_EQ(response.insert_headroom(0).table(), "limited");
+    EXPECT_EQ(response.insert_headroom(0).inserts(), 0);
+  } while (response.keys().empty());
+  EXPECT_THAT(response.keys(), ::testing::ElementsAre(id));
+
+  // Sampling the item makes room for another insert, which is pushed without
+  // anything to acknowledge.
+  Table::SampledItem sample;
+  REVERB_ASSERT_OK(table->Sample(&sample));
+  ASSERT_TRUE(stream->Read(&response));
+  EXPECT_THAT(response.keys(), ::testing::IsEmpty());
+  EXPECT_THAT(response.insert_headroom(),
+              ::testing::ElementsAre(testing::EqualsProto(
+                  "table: 'limited' inserts: 1")));
 
-  ASSERT_EQ(reactor, peer.reactor());
-  ASSERT_TRUE(peer.test_status_set());
-  REVERB_ASSERT_OK(peer.test_status());
+  ASSERT_TRUE(stream->WritesDone());
+  ASSERT_FALSE(stream->Read(&response));
+  REVERB_EXPECT_OK(stream->Finish());
+}
 
-  // The probability of these being 0 is 2^{-128}
-  EXPECT_NE(std::make_pair(server_info_response.tables_state_id().low(),
-                           server_info_response.tables_state_id().high()),
-            std::make_pair(uint64_t{0}, uint64_t{0}));
+TEST(ReverbServiceImplTest, InsertStreamPausesWhileMemoryBudgetIsExceeded) {
+  auto table = std::make_shared<Table>(
+      /*name=*/"table",
+      /*sampler=*/absl::make_unique<UniformSelector>(),
+      /*remover=*/absl::make_unique<FifoSelector>(),
+      /*max_size=*/10,
+      /*max_times_sampled=*/0,
+      /*rate_limiter=*/MakeLimiter());
+  // Any chunk exceeds the limit. The flag is only read on creation.
+  absl::SetFlag(&FLAGS_reverb_memory_soft_limit_bytes, 1);
+  std::unique_ptr<ReverbServiceImpl> service =
+      MakeService(10, nullptr, {table});
+  absl::SetFlag(&FLAGS_reverb_memory_soft_limit_bytes, 0);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
 
-  EXPECT_EQ(server_info_response.table_info_size(), 1);
-  auto table_info = server_info_response.table_info()[0];
+  grpc::ClientContext context;
+  auto stream = stub.InsertStream(&context);
+  auto first_id = nextId;
+  for (int key : {1, 2}) {
+    InsertStreamRequest request = InsertItemRequest("table", {key});
+    request.add_chunks()->set_chunk_key(key);
+    ASSERT_TRUE(stream->Write(request));
+  }
 
-  TableInfo expected_table_info;
-  expected_table_info.set_name("dist");
-  expected_table_info.mutable_sampler_options()->set_uniform(true);
-  expected_table_info.mutable_sampler_options()->set_is_deterministic(false);
-  expected_table_info.mutable_remover_options()->set_fifo(true);
-  expected_table_info.mutable_remover_options()->set_is_deterministic(true);
-  expected_table_info.set_max_size(10);
-  expected_table_info.set_current_size(0);
-  auto rate_limiter = expected_table_info.mutable_rate_limiter_info();
-  rate_limiter->set_samples_per_insert(kSamplesPerInsert);
-  rate_limiter->set_min_size_to_sample(kMinSizeToSample);
-  rate_limiter->set_min_diff(kMinDiff);
-  rate_limiter->set_max_diff(kMaxDiff);
-  rate_limiter->mutable_insert_stats();
-  rate_limiter->mutable_sample_stats();
-  table_info.clear_table_worker_time();
-  *expected_table_info.mutable_signature() = MakeSignature();
+  // The chunk of the first item is held by the table so the second request is
+  // not read.
+  InsertStreamResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+  EXPECT_THAT(response.keys(), ::testing::ElementsAre(first_id));
+  absl::SleepFor(absl::Milliseconds(50));
+  EXPECT_EQ(table->size(), 1);
 
-  EXPECT_THAT(table_info, testing::EqualsProto(expected_table_info));
-}
+  // Releasing the chunk resumes reading.
+  REVERB_ASSERT_OK(table->Reset());
+  ASSERT_TRUE(stream->Read(&response));
+  EXPECT_THAT(response.keys(), ::testing::ElementsAre(first_id + 1));
 
-TEST(ReverbServiceImplTest, CheckpointCalledWithoutCheckpointer) {
-  auto service = MakeService(10);
-  grpc::CallbackServerContext context;
-  grpc::testing::DefaultReactorTestPeer peer(&context);
-  CheckpointRequest request;
-  CheckpointResponse response;
+  // The half close is only read once the stream has resumed again.
+  REVERB_ASSERT_OK(table->Reset());
+  ASSERT_TRUE(stream->WritesDone());
+  ASSERT_FALSE(stream->Read(&response));
+  REVERB_EXPECT_OK(stream->Finish());
+}
 
-  grpc::ServerUnaryReactor* reactor =
-      service->Checkpoint(&context, &request, &response);
+TEST(ReverbServiceImplTest, TableExecutorsIsolateTableGroups) {
+  std::vector<std::shared_ptr<Table>> tables;
+  for (const char* name : {"critical", "eval", "bulk"}) {
+    tables.push_back(std::make_shared<Table>(
+        /*name=*/name,
+        /*sampler=*/absl::make_unique<UniformSelector>(),
+        /*remover=*/absl::make_unique<FifoSelector>(),
+        /*max_size=*/10,
+        /*max_times_sampled=*/0,
+        /*rate_limiter=*/MakeLimiter()));
+  }
+  // The flag is only read on creation.
+  absl::SetFlag(&FLAGS_reverb_table_executors, "critical|eval=2@0");
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10, nullptr, tables);
+  absl::SetFlag(&FLAGS_reverb_table_executors, "");
+
+  std::shared_ptr<TaskExecutor> isolated = tables[0]->callback_executor();
+  EXPECT_EQ(tables[1]->callback_executor(), isolated);
+  EXPECT_NE(tables[2]->callback_executor(), isolated);
+  ASSERT_EQ(isolated->num_threads(), 2);
+  EXPECT_EQ(isolated->GetThreadStats()[0].thread_name,
+            "TableCallbackExecutor_critical_eval_0");
+}
 
-  ASSERT_EQ(reactor, peer.reactor());
-  ASSERT_TRUE(peer.test_status_set());
-  EXPECT_EQ(peer.test_status().error_code(),
-            grpc::StatusCode::INVALID_ARGUMENT);
+TEST(ReverbServiceImplTest, TableExecutorsRejectInvalidConfigs) {
+  for (const char* config :
+       {"unknown=1", "dist=0", "dist", "dist=1;dist=2", "dist=1@a"}) {
+    absl::SetFlag(&FLAGS_reverb_table_executors, config);
+    std::unique_ptr<ReverbServiceImpl> service;
+    std::vector<std::shared_ptr<Table>> tables = {std::make_shared<Table>(
+        /*name=*/"dist",
+        /*sampler=*/absl::make_unique<UniformSelector>(),
+        /*remover=*/absl::make_unique<FifoSelector>(),
+        /*max_size=*/10,
+        /*max_times_sampled=*/0,
+        /*rate_limiter=*/MakeLimiter())};
+    EXPECT_EQ(
+        ReverbServiceImpl::Create(std::move(tables), nullptr, &service).code(),
+        absl::StatusCode::kInvalidArgument)
+        << config;
+  }
+  absl::SetFlag(&FLAGS_reverb_table_executors, "");
 }
 
-TEST(ReverbServiceImplTest, CheckpointAndLoadFromCheckpoint) {
-  std::string path = getenv("TEST_TMPDIR");
-  REVERB_CHECK(tensorflow::Env::Default()->CreateUniqueFileName(&path, "temp"));
-  auto service = MakeService(10, CreateDefaultCheckpointer(path));
+TEST(ReverbServiceImplTest, SampleBlocksUntilEnoughInserts) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
   std::unique_ptr<grpc::Server> server(
       grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
   /* grpc_gen:: */ReverbService::Stub stub(
       server->InProcessChannel(grpc::ChannelArguments()));
-
-  // Check that there are no items in the service to begin with.
-  EXPECT_EQ(service->tables()["dist"]->size(), 0);
-
-  // Insert an item.
-  {
+  absl::Notification notification;
+  auto thread = internal::StartThread("", [&] {
     grpc::ClientContext context;
-    auto stream = stub.InsertStream(&context);
-    ASSERT_TRUE(stream->Write(InsertChunkRequest(1)));
-    ASSERT_TRUE(stream->Write(InsertItemRequest("dist", {1})));
-    InsertStreamResponse response;
-    ASSERT_TRUE(stream->Read(&response));
+    auto stream = stub.SampleStream(&context);
+    ASSERT_TRUE(stream->Write(SampleRequest("dist", 1)));
     ASSERT_TRUE(stream->WritesDone());
+    SampleStreamResponse response;
+    ASSERT_TRUE(stream->Read(&response));
     REVERB_EXPECT_OK(stream->Finish());
-  }
+    notification.Notify();
+  });
 
-  WaitForTableSize(service->tables()["dist"].get(), 1);
+  // Blocking because there are no data to sample.
+  EXPECT_FALSE(notification.HasBeenNotified());
 
-  // Checkpoint the service.
-  {
-    CheckpointRequest request;
-    CheckpointResponse response;
-    grpc::ClientContext context;
-    REVERB_EXPECT_OK(stub.Checkpoint(&context, request, &response));
-  }
+  // Insert an item.
+  grpc::ClientContext context;
+  auto stream = stub.InsertStream(&context);
+  ASSERT_TRUE(stream->Write(InsertChunkRequest(1)));
+  ASSERT_TRUE(stream->Write(InsertItemRequest("dist", {1})));
+  InsertStreamResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+  ASSERT_TRUE(stream->WritesDone());
+  REVERB_EXPECT_OK(stream->Finish());
 
-  // Create a new service from the checkpoint and check that it has the
-  // correct number of items.
-  auto loaded_service = MakeService(10, CreateDefaultCheckpointer(path));
-  EXPECT_EQ(loaded_service->tables()["dist"]->size(), 1);
+  // The sample should now complete because there is data to sample.
+  notification.WaitForNotification();
+
+  thread = nullptr;  // Joins the thread.
 }
 
-TEST(ReverbServiceImplTest, InitializeConnectionSuccess) {
+TEST(ReverbServiceImplTest, SampleStreamOnlySendsChunksOnce) {
   std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
   std::unique_ptr<grpc::Server> server(
       grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
   /* grpc_gen:: */ReverbService::Stub stub(
       server->InProcessChannel(grpc::ChannelArguments()));
 
-  grpc::ClientContext context;
-  auto stream = stub.InitializeConnection(&context);
+  grpc::ClientContext insert_context;
+  auto insert_stream = stub.InsertStream(&insert_context);
+  ASSERT_TRUE(insert_stream->Write(InsertChunkRequest(1)));
+  ASSERT_TRUE(insert_stream->Write(InsertItemRequest("dist", {1})));
+  InsertStreamResponse insert_response;
+  ASSERT_TRUE(insert_stream->Read(&insert_response));
+  ASSERT_TRUE(insert_stream->WritesDone());
+  REVERB_EXPECT_OK(insert_stream->Finish());
+  WaitForTableSize(service->tables()["dist"].get(), 1);
 
-  InitializeConnectionRequest request;
-  request.set_pid(getpid());
-  request.set_table_name("dist");
+  grpc::ClientContext context;
+  auto stream = stub.SampleStream(&context);
+  SampleStreamRequest request = SampleRequest("dist", 3, 1);
+  request.set_max_cached_chunks(10);
   ASSERT_TRUE(stream->Write(request));
+  ASSERT_TRUE(stream->WritesDone());
 
-  InitializeConnectionResponse response;
-  ASSERT_TRUE(stream->Read(&response));
-  ASSERT_NE(response.address(), 0);
+  std::vector<SampleStreamResponse::SampleEntry> entries;
+  SampleStreamResponse response;
+  while (entries.size() < 3 && stream->Read(&response)) {
+    entries.insert(entries.end(), response.entries().begin(),
+                   response.entries().end());
+  }
+  REVERB_EXPECT_OK(stream->Finish());
+
+  ASSERT_THAT(entries, ::testing::SizeIs(3));
+  ASSERT_THAT(entries[0].data(), ::testing::SizeIs(1));
+  EXPECT_EQ(entries[0].data(0).chunk_key(), 1);
+  EXPECT_THAT(entries[0].cached_chunk_keys(), ::testing::IsEmpty());
+  for (int i = 1; i < 3; i++) {
+    EXPECT_THAT(entries[i].data(), ::testing::IsEmpty());
+    EXPECT_THAT(entries[i].cached_chunk_keys(), ::testing::ElementsAre(1));
+  }
+}
+
+TEST(ReverbServiceImplTest, SampleStreamServesCreditsGrantedOnTheStream) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext insert_context;
+  auto insert_stream = stub.InsertStream(&insert_context);
+  ASSERT_TRUE(insert_stream->Write(InsertChunkRequest(1)));
+  ASSERT_TRUE(insert_stream->Write(InsertItemRequest("dist", {1})));
+  InsertStreamResponse insert_response;
+  ASSERT_TRUE(insert_stream->Read(&insert_response));
+  ASSERT_TRUE(insert_stream->WritesDone());
+  REVERB_EXPECT_OK(insert_stream->Finish());
+  WaitForTableSize(service->tables()["dist"].get(), 1);
+
+  grpc::ClientContext context;
+  auto stream = stub.SampleStream(&context);
+  SampleStreamRequest request = SampleRequest("dist", 1, 1);
+  request.set_credit_flow_control(true);
+  ASSERT_TRUE(stream->Write(request));
+
+  int num_entries = 0;
+  SampleStreamResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+  num_entries += response.entries_size();
+  EXPECT_EQ(num_entries, 1);
+
+  // The request is extended without sending it again.
+  SampleStreamRequest credits;
+  credits.set_credits(2);
+  ASSERT_TRUE(stream->Write(credits));
+  while (num_entries < 3 && stream->Read(&response)) {
+    num_entries += response.entries_size();
+  }
+  EXPECT_EQ(num_entries, 3);
+
+  ASSERT_TRUE(stream->WritesDone());
+  REVERB_EXPECT_OK(stream->Finish());
+}
+
+TEST(ReverbServiceImplTest, SampleStreamRejectsCreditsWithoutFlowControl) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext context;
+  auto stream = stub.SampleStream(&context);
+  SampleStreamRequest credits;
+  credits.set_credits(1);
+  ASSERT_TRUE(stream->Write(credits));
+  ASSERT_TRUE(stream->WritesDone());
+  SampleStreamResponse response;
+  EXPECT_FALSE(stream->Read(&response));
+  EXPECT_EQ(stream->Finish().error_code(), grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+TEST(ReverbServiceImplTest, SampleStreamInterleavesMixtureOfTables) {
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(absl::make_unique<Table>(
+      /*name=*/"other",
+      /*sampler=*/absl::make_unique<UniformSelector>(),
+      /*remover=*/absl::make_unique<FifoSelector>(),
+      /*max_size=*/10,
+      /*max_times_sampled=*/0,
+      /*rate_limiter=*/MakeLimiter(),
+      /*extensions=*/std::vector<std::shared_ptr<TableExtension>>(),
+      /*signature=*/absl::make_optional(MakeSignature())));
+  std::unique_ptr<ReverbServiceImpl> service =
+      MakeService(10, nullptr, std::move(tables));
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext insert_context;
+  auto insert_stream = stub.InsertStream(&insert_context);
+  ASSERT_TRUE(insert_stream->Write(InsertChunkRequest(1)));
+  ASSERT_TRUE(insert_stream->Write(InsertItemRequest("dist", {1}, {1})));
+  ASSERT_TRUE(insert_stream->Write(InsertItemRequest("other", {1})));
+  ASSERT_TRUE(insert_stream->WritesDone());
+  InsertStreamResponse insert_response;
+  while (insert_stream->Read(&insert_response)) {
+  }
+  REVERB_EXPECT_OK(insert_stream->Finish());
+  WaitForTableSize(service->tables()["dist"].get(), 1);
+  WaitForTableSize(service->tables()["other"].get(), 1);
+
+  grpc::ClientContext context;
+  auto stream = stub.SampleStream(&context);
+  SampleStreamRequest request = SampleRequest("", 8, 1);
+  auto* dist = request.add_mixture();
+  dist->set_table("dist");
+  dist->set_weight(3);
+  auto* other = request.add_mixture();
+  other->set_table("other");
+  other->set_weight(1);
+  ASSERT_TRUE(stream->Write(request));
+  ASSERT_TRUE(stream->WritesDone());
+
+  std::vector<std::string> sampled_tables;
+  SampleStreamResponse response;
+  while (sampled_tables.size() < 8 && stream->Read(&response)) {
+    for (const auto& entry : response.entries()) {
+      sampled_tables.push_back(entry.info().item().table());
+    }
+  }
+  REVERB_EXPECT_OK(stream->Finish());
+
+  // Every four samples hold three samples of "dist" and one of "other".
+  EXPECT_THAT(sampled_tables,
+              ::testing::ElementsAre("dist", "dist", "other", "dist", "dist",
+                                     "dist", "other", "dist"));
+}
+
+TEST(ReverbServiceImplTest, SampleStreamRejectsInvalidMixtures) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  SampleStreamRequest with_table = SampleRequest("dist", 1, 1);
+  auto* component = with_table.add_mixture();
+  component->set_table("dist");
+  component->set_weight(1);
+  SampleStreamRequest zero_weight = SampleRequest("", 1, 1);
+  component = zero_weight.add_mixture();
+  component->set_table("dist");
+  component->set_weight(0);
+  SampleStreamRequest unknown_table = SampleRequest("", 1, 1);
+  component = unknown_table.add_mixture();
+  component->set_table("unknown");
+  component->set_weight(1);
+
+  for (const auto& [request, code] :
+       {std::make_pair(with_table, grpc::StatusCode::INVALID_ARGUMENT),
+        std::make_pair(zero_weight, grpc::StatusCode::INVALID_ARGUMENT),
+        std::make_pair(unknown_table, grpc::StatusCode::NOT_FOUND)}) {
+    grpc::ClientContext context;
+    auto stream = stub.SampleStream(&context);
+    ASSERT_TRUE(stream->Write(request));
+    ASSERT_TRUE(stream->WritesDone());
+    SampleStreamResponse response;
+    EXPECT_FALSE(stream->Read(&response));
+    EXPECT_EQ(stream->Finish().error_code(), code);
+  }
+}
+
+TEST(ReverbServiceImplTest, SampleStreamDecompressesChunksIfRequested) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext insert_context;
+  auto insert_stream = stub.InsertStream(&insert_context);
+  InsertStreamRequest chunk_request;
+  *chunk_request.add_chunks() =
+      testing::MakeChunkData(1, testing::MakeSequenceRange(100, 0, 99), 2);
+  ASSERT_TRUE(insert_stream->Write(chunk_request));
+  ASSERT_TRUE(insert_stream->Write(InsertItemRequest("dist", {1})));
+  InsertStreamResponse insert_response;
+  ASSERT_TRUE(insert_stream->Read(&insert_response));
+  ASSERT_TRUE(insert_stream->WritesDone());
+  REVERB_EXPECT_OK(insert_stream->Finish());
+  WaitForTableSize(service->tables()["dist"].get(), 1);
+
+  grpc::ClientContext context;
+  auto stream = stub.SampleStream(&context);
+  SampleStreamRequest request = SampleRequest("dist", 2, 1);
+  request.set_max_cached_chunks(10);
+  request.set_decompress_chunks(true);
+  ASSERT_TRUE(stream->Write(request));
+  ASSERT_TRUE(stream->WritesDone());
+
+  std::vector<SampleStreamResponse::SampleEntry> entries;
+  SampleStreamResponse response;
+  while (entries.size() < 2 && stream->Read(&response)) {
+    entries.insert(entries.end(), response.entries().begin(),
+                   response.entries().end());
+  }
+  REVERB_EXPECT_OK(stream->Finish());
+
+  ASSERT_THAT(entries, ::testing::SizeIs(2));
+  ASSERT_THAT(entries[0].data(), ::testing::SizeIs(1));
+  const ChunkData& chunk = entries[0].data(0);
+  EXPECT_EQ(chunk.chunk_key(), 1);
+  EXPECT_FALSE(chunk.delta_encoded());
+  EXPECT_THAT(chunk.codecs(), ::testing::ElementsAre(COMPRESSION_CODEC_NONE,
+                                                     COMPRESSION_CODEC_NONE));
+  ASSERT_EQ(chunk.data().tensors_size(), 2);
+  for (const auto& proto : chunk.data().tensors()) {
+    tensorflow::Tensor tensor;
+    ASSERT_TRUE(tensor.FromProto(proto));
+    EXPECT_EQ(tensor.shape(), tensorflow::TensorShape({100, 10}));
+    EXPECT_EQ(tensor.flat<int32_t>()(0), 1);
+  }
+
+  // The decompressed chunk is still held by the client.
+  EXPECT_THAT(entries[1].data(), ::testing::IsEmpty());
+  EXPECT_THAT(entries[1].cached_chunk_keys(), ::testing::ElementsAre(1));
+}
+
+TEST(ReverbServiceImplTest, SampleStreamTrimsChunksIfRequested) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext insert_context;
+  auto insert_stream = stub.InsertStream(&insert_context);
+  InsertStreamRequest chunk_request;
+  *chunk_request.add_chunks() =
+      testing::MakeChunkData(1, testing::MakeSequenceRange(100, 0, 99), 2);
+  ASSERT_TRUE(insert_stream->Write(chunk_request));
+  // The item only references rows [40, 45) of the chunk.
+  InsertStreamRequest item_request = InsertItemRequest("dist", {1});
+  auto* slice = item_request.mutable_items(0)
+                    ->mutable_flat_trajectory()
+                    ->mutable_columns(0)
+                    ->mutable_chunk_slices(0);
+  slice->set_offset(40);
+  slice->set_length(5);
+  ASSERT_TRUE(insert_stream->Write(item_request));
+  InsertStreamResponse insert_response;
+  ASSERT_TRUE(insert_stream->Read(&insert_response));
+  ASSERT_TRUE(insert_stream->WritesDone());
+  REVERB_EXPECT_OK(insert_stream->Finish());
+  WaitForTableSize(service->tables()["dist"].get(), 1);
+
+  grpc::ClientContext context;
+  auto stream = stub.SampleStream(&context);
+  SampleStreamRequest request = SampleRequest("dist", 2, 1);
+  request.set_trim_chunks(true);
+  ASSERT_TRUE(stream->Write(request));
+  ASSERT_TRUE(stream->WritesDone());
+
+  std::vector<SampleStreamResponse::SampleEntry> entries;
+  SampleStreamResponse response;
+  while (entries.size() < 2 && stream->Read(&response)) {
+    entries.insert(entries.end(), response.entries().begin(),
+                   response.entries().end());
+  }
+  REVERB_EXPECT_OK(stream->Finish());
+
+  // Every sample receives the trimmed chunk and a trajectory which indexes
+  // into it.
+  ASSERT_THAT(entries, ::testing::SizeIs(2));
+  for (const auto& entry : entries) {
+    ASSERT_THAT(entry.data(), ::testing::SizeIs(1));
+    const ChunkData& chunk = entry.data(0);
+    EXPECT_EQ(chunk.chunk_key(), 1);
+    EXPECT_EQ(chunk.sequence_range().start(), 40);
+    EXPECT_EQ(chunk.sequence_range().end(), 44);
+    ASSERT_EQ(chunk.data().tensors_size(), 2);
+    EXPECT_EQ(ChunkColumnNumRows(chunk, 0), 5);
+    EXPECT_EQ(ChunkColumnNumRows(chunk, 1), 5);
+
+    const auto& trimmed_slice =
+        entry.info().item().flat_trajectory().columns(0).chunk_slices(0);
+    EXPECT_EQ(trimmed_slice.offset(), 0);
+    EXPECT_EQ(trimmed_slice.length(), 5);
+  }
+
+  // The item in the table still references the original rows.
+  std::vector<Table::Item> items = service->tables()["dist"]->Copy();
+  ASSERT_THAT(items, ::testing::SizeIs(1));
+  EXPECT_EQ(items[0].item.flat_trajectory().columns(0).chunk_slices(0).offset(),
+            40);
+}
+
+TEST(ReverbServiceImplTest, SampleStreamProjectsColumnsIfRequested) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext insert_context;
+  auto insert_stream = stub.InsertStream(&insert_context);
+  InsertStreamRequest chunk_request;
+  *chunk_request.add_chunks() =
+      testing::MakeChunkData(1, testing::MakeSequenceRange(100, 0, 99), 2);
+  ASSERT_TRUE(insert_stream->Write(chunk_request));
+  // A timestep trajectory where column `i` references tensor `i` of the chunk.
+  InsertStreamRequest item_request = InsertItemRequest("dist", {1});
+  auto* trajectory = item_request.mutable_items(0)->mutable_flat_trajectory();
+  *trajectory->add_columns() = trajectory->columns(0);
+  trajectory->mutable_columns(1)->mutable_chunk_slices(0)->set_index(1);
+  ASSERT_TRUE(insert_stream->Write(item_request));
+  InsertStreamResponse insert_response;
+  ASSERT_TRUE(insert_stream->Read(&insert_response));
+  ASSERT_TRUE(insert_stream->WritesDone());
+  REVERB_EXPECT_OK(insert_stream->Finish());
+  WaitForTableSize(service->tables()["dist"].get(), 1);
+
+  grpc::ClientContext context;
+  auto stream = stub.SampleStream(&context);
+  SampleStreamRequest request = SampleRequest("dist", 1, 1);
+  request.add_columns(1);
+  ASSERT_TRUE(stream->Write(request));
+  ASSERT_TRUE(stream->WritesDone());
+
+  SampleStreamResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+  REVERB_EXPECT_OK(stream->Finish());
+
+  // Only the selected column is returned and only its tensor holds data.
+  ASSERT_THAT(response.entries(), ::testing::SizeIs(1));
+  const auto& entry = response.entries(0);
+  const FlatTrajectory& projected = entry.info().item().flat_trajectory();
+  ASSERT_EQ(projected.columns_size(), 1);
+  EXPECT_EQ(projected.columns(0).chunk_slices(0).index(), 1);
+
+  ASSERT_THAT(entry.data(), ::testing::SizeIs(1));
+  const ChunkData& chunk = entry.data(0);
+  ASSERT_EQ(chunk.data().tensors_size(), 2);
+  EXPECT_TRUE(chunk.data().tensors(0).tensor_content().empty());
+  EXPECT_FALSE(chunk.data().tensors(1).tensor_content().empty());
+}
+
+TEST(ReverbServiceImplTest, SampleStreamRejectsColumnsOutOfRange) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext insert_context;
+  auto insert_stream = stub.InsertStream(&insert_context);
+  InsertStreamRequest chunk_request;
+  *chunk_request.add_chunks() =
+      testing::MakeChunkData(1, testing::MakeSequenceRange(100, 0, 99));
+  ASSERT_TRUE(insert_stream->Write(chunk_request));
+  ASSERT_TRUE(insert_stream->Write(InsertItemRequest("dist", {1})));
+  InsertStreamResponse insert_response;
+  ASSERT_TRUE(insert_stream->Read(&insert_response));
+  ASSERT_TRUE(insert_stream->WritesDone());
+  REVERB_EXPECT_OK(insert_stream->Finish());
+  WaitForTableSize(service->tables()["dist"].get(), 1);
+
+  grpc::ClientContext context;
+  auto stream = stub.SampleStream(&context);
+  SampleStreamRequest request = SampleRequest("dist", 1, 1);
+  request.add_columns(1);
+  ASSERT_TRUE(stream->Write(request));
+  ASSERT_TRUE(stream->WritesDone());
+  SampleStreamResponse response;
+  while (stream->Read(&response)) {
+  }
+  EXPECT_EQ(stream->Finish().error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+TEST(ReverbServiceImplTest, SampleStreamRejectsTrimmingWithCachedChunks) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext context;
+  auto stream = stub.SampleStream(&context);
+  SampleStreamRequest request = SampleRequest("dist", 1, 1);
+  request.set_max_cached_chunks(10);
+  request.set_trim_chunks(true);
+  ASSERT_TRUE(stream->Write(request));
+  EXPECT_EQ(stream->Finish().error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+TEST(ReverbServiceImplTest, SampleStreamDeduplicatesChunksIfRequested) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext insert_context;
+  auto insert_stream = stub.InsertStream(&insert_context);
+  InsertStreamRequest chunk_request;
+  *chunk_request.add_chunks() =
+      testing::MakeChunkData(1, testing::MakeSequenceRange(100, 0, 99));
+  ASSERT_TRUE(insert_stream->Write(chunk_request));
+  ASSERT_TRUE(insert_stream->Write(InsertItemRequest("dist", {1})));
+  InsertStreamResponse insert_response;
+  ASSERT_TRUE(insert_stream->Read(&insert_response));
+  ASSERT_TRUE(insert_stream->WritesDone());
+  REVERB_EXPECT_OK(insert_stream->Finish());
+  WaitForTableSize(service->tables()["dist"].get(), 1);
+
+  grpc::ClientContext context;
+  auto stream = stub.SampleStream(&context);
+  SampleStreamRequest request = SampleRequest("dist", 2, 2);
+  request.set_deduplicate_chunks(true);
+  ASSERT_TRUE(stream->Write(request));
+  ASSERT_TRUE(stream->WritesDone());
+
+  SampleStreamResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+  REVERB_EXPECT_OK(stream->Finish());
+
+  // Both samples are sent in the same response but only the first one holds
+  // the data of the chunk.
+  ASSERT_THAT(response.entries(), ::testing::SizeIs(2));
+  ASSERT_THAT(response.entries(0).data(), ::testing::SizeIs(1));
+  EXPECT_EQ(response.entries(0).data(0).chunk_key(), 1);
+  EXPECT_THAT(response.entries(1).data(), ::testing::IsEmpty());
+  EXPECT_THAT(response.entries(1).response_chunk_keys(),
+              ::testing::ElementsAre(1));
+}
+
+TEST(ReverbServiceImplTest, SampleStreamRejectsTrimmingWithDeduplication) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext context;
+  auto stream = stub.SampleStream(&context);
+  SampleStreamRequest request = SampleRequest("dist", 1, 1);
+  request.set_trim_chunks(true);
+  request.set_deduplicate_chunks(true);
+  ASSERT_TRUE(stream->Write(request));
+  EXPECT_EQ(stream->Finish().error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+TEST(ReverbServiceImplTest, SampleStreamGroupsSamplesByChunkIfRequested) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext insert_context;
+  auto insert_stream = stub.InsertStream(&insert_context);
+  ASSERT_TRUE(insert_stream->Write(InsertMultiChunkRequest({1, 2})));
+  for (int i = 0; i < 6; i++) {
+    ASSERT_TRUE(insert_stream->Write(
+        InsertItemRequest("dist", {1 + i % 2}, /*keep_chunks=*/{1, 2})));
+  }
+  ASSERT_TRUE(insert_stream->WritesDone());
+  InsertStreamResponse insert_response;
+  while (insert_stream->Read(&insert_response)) {
+  }
+  REVERB_EXPECT_OK(insert_stream->Finish());
+  WaitForTableSize(service->tables()["dist"].get(), 6);
+
+  grpc::ClientContext context;
+  auto stream = stub.SampleStream(&context);
+  SampleStreamRequest request = SampleRequest("dist", 20, 20);
+  request.set_group_by_chunk(true);
+  ASSERT_TRUE(stream->Write(request));
+  ASSERT_TRUE(stream->WritesDone());
+
+  std::vector<uint64_t> chunk_keys;
+  SampleStreamResponse response;
+  while (stream->Read(&response)) {
+    for (const auto& entry : response.entries()) {
+      chunk_keys.push_back(
+          entry.info().item().flat_trajectory().columns(0).chunk_slices(0)
+              .chunk_key());
+    }
+  }
+  REVERB_EXPECT_OK(stream->Finish());
+
+  // The samples of the batch which reference the same chunk are adjacent.
+  ASSERT_THAT(chunk_keys, ::testing::SizeIs(20));
+  int num_changes = 0;
+  for (int i = 1; i < chunk_keys.size(); i++) {
+    if (chunk_keys[i] != chunk_keys[i - 1]) num_changes++;
+  }
+  EXPECT_LE(num_changes, 1);
+}
+
+TEST(ReverbServiceImplTest, SampleStreamRejectsGroupingOfDeterministicTables) {
+  std::vector<std::shared_ptr<Table>> tables;
+  tables.push_back(std::make_shared<Table>(
+      /*name=*/"queue",
+      /*sampler=*/absl::make_unique<FifoSelector>(),
+      /*remover=*/absl::make_unique<FifoSelector>(),
+      /*max_size=*/10,
+      /*max_times_sampled=*/0,
+      /*rate_limiter=*/MakeLimiter()));
+  std::unique_ptr<ReverbServiceImpl> service =
+      MakeService(10, nullptr, std::move(tables));
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext context;
+  auto stream = stub.SampleStream(&context);
+  SampleStreamRequest request = SampleRequest("queue", 1, 1);
+  request.set_group_by_chunk(true);
+  ASSERT_TRUE(stream->Write(request));
+  EXPECT_EQ(stream->Finish().error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+TEST(ReverbServiceImplTest, GetItemsReturnsRequestedItems) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext insert_context;
+  auto insert_stream = stub.InsertStream(&insert_context);
+  InsertStreamRequest chunk_request;
+  *chunk_request.add_chunks() =
+      testing::MakeChunkData(1, testing::MakeSequenceRange(100, 0, 99));
+  ASSERT_TRUE(insert_stream->Write(chunk_request));
+  InsertStreamRequest first = InsertItemRequest("dist", {1}, {1});
+  InsertStreamRequest second = InsertItemRequest("dist", {1});
+  InsertStreamResponse insert_response;
+  ASSERT_TRUE(insert_stream->Write(first));
+  ASSERT_TRUE(insert_stream->Read(&insert_response));
+  ASSERT_TRUE(insert_stream->Write(second));
+  ASSERT_TRUE(insert_stream->Read(&insert_response));
+  ASSERT_TRUE(insert_stream->WritesDone());
+  REVERB_EXPECT_OK(insert_stream->Finish());
+  WaitForTableSize(service->tables()["dist"].get(), 2);
+
+  grpc::ClientContext context;
+  auto stream = stub.GetItems(&context);
+  GetItemsRequest request;
+  request.set_table("dist");
+  request.add_keys(second.items(0).key());
+  request.add_keys(12345);  // Not in the table.
+  request.add_keys(first.items(0).key());
+  request.set_deduplicate_chunks(true);
+  ASSERT_TRUE(stream->Write(request));
+  ASSERT_TRUE(stream->WritesDone());
+
+  SampleStreamResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+  EXPECT_FALSE(stream->Read(&response));
+  REVERB_EXPECT_OK(stream->Finish());
+
+  // The missing key is skipped and the chunk is only sent once.
+  ASSERT_THAT(response.entries(), ::testing::SizeIs(2));
+  EXPECT_EQ(response.entries(0).info().item().key(), second.items(0).key());
+  EXPECT_EQ(response.entries(1).info().item().key(), first.items(0).key());
+  EXPECT_EQ(response.entries(0).info().table_size(), 2);
+  EXPECT_TRUE(response.entries(0).end_of_sequence());
+  ASSERT_THAT(response.entries(0).data(), ::testing::SizeIs(1));
+  EXPECT_EQ(response.entries(0).data(0).chunk_key(), 1);
+  EXPECT_THAT(response.entries(1).data(), ::testing::IsEmpty());
+  EXPECT_THAT(response.entries(1).response_chunk_keys(),
+              ::testing::ElementsAre(1));
+
+  // Looking up the items does not count as sampling them.
+  TableItem item;
+  ASSERT_TRUE(service->tables()["dist"]->Get(first.items(0).key(), &item));
+  EXPECT_EQ(item.item.times_sampled(), 0);
+}
+
+TEST(ReverbServiceImplTest, GetItemsFailsForUnknownTable) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext context;
+  auto stream = stub.GetItems(&context);
+  GetItemsRequest request;
+  request.set_table("unknown");
+  request.add_keys(1);
+  ASSERT_TRUE(stream->Write(request));
+  EXPECT_EQ(stream->Finish().error_code(), grpc::StatusCode::NOT_FOUND);
+}
+
+TEST(ReverbServiceImplTest, MutateDeletionWorks) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+  grpc::ClientContext context;
+  auto stream = stub.InsertStream(&context);
+  ASSERT_TRUE(stream->Write(InsertChunkRequest(1)));
+  auto insert_request = InsertItemRequest("dist", {1});
+  insert_request.mutable_items(0)->set_priority(3);
+  PrioritizedItem item = insert_request.items(0);
+  ASSERT_TRUE(stream->Write(insert_request));
+  InsertStreamResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+  ASSERT_TRUE(stream->WritesDone());
+  REVERB_EXPECT_OK(stream->Finish());
+
+  WaitForTableSize(service->tables()["dist"].get(), 1);
+
+  MutatePrioritiesRequest mutate_request;
+  MutatePrioritiesResponse mutate_response;
+  mutate_request.set_table("dist");
+  mutate_request.add_delete_keys(item.key());
+  grpc::ClientContext mutate_context;
+  REVERB_EXPECT_OK(
+      stub.MutatePriorities(&mutate_context, mutate_request, &mutate_response));
+
+  EXPECT_EQ(service->tables()["dist"]->size(), 0);
+}
+
+TEST(ReverbServiceImplTest, TransformPrioritiesWorks) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+  grpc::ClientContext context;
+  auto stream = stub.InsertStream(&context);
+  ASSERT_TRUE(stream->Write(InsertChunkRequest(1)));
+  auto insert_request = InsertItemRequest("dist", {1});
+  PrioritizedItem item = insert_request.items(0);
+  ASSERT_TRUE(stream->Write(insert_request));
+  InsertStreamResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+  ASSERT_TRUE(stream->WritesDone());
+  REVERB_EXPECT_OK(stream->Finish());
+
+  WaitForTableSize(service->tables()["dist"].get(), 1);
+
+  TransformPrioritiesRequest transform_request;
+  TransformPrioritiesResponse transform_response;
+  transform_request.set_table("dist");
+  transform_request.set_priority_scale(0.5);
+  grpc::ClientContext transform_context;
+  REVERB_EXPECT_OK(stub.TransformPriorities(
+      &transform_context, transform_request, &transform_response));
+
+  Table::Item stored;
+  ASSERT_TRUE(service->tables()["dist"]->Get(item.key(), &stored));
+  EXPECT_EQ(stored.item.priority(), 1.5);
+
+  // The sampler of the table is uniform so it has no priority exponent.
+  transform_request.clear_priority_scale();
+  transform_request.mutable_priority_exponent()->set_value(2);
+  grpc::ClientContext exponent_context;
+  EXPECT_EQ(stub.TransformPriorities(&exponent_context, transform_request,
+                                     &transform_response)
+                .error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+TEST(ReverbServiceImplTest, MutatePrioritiesStreamAcknowledgesEachRequest) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+  grpc::ClientContext context;
+  auto stream = stub.InsertStream(&context);
+  ASSERT_TRUE(stream->Write(InsertChunkRequest(1)));
+  auto first_request = InsertItemRequest("dist", {1}, {1});
+  auto second_request = InsertItemRequest("dist", {1});
+  ASSERT_TRUE(stream->Write(first_request));
+  ASSERT_TRUE(stream->Write(second_request));
+  InsertStreamResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+  ASSERT_TRUE(stream->WritesDone());
+  REVERB_EXPECT_OK(stream->Finish());
+
+  WaitForTableSize(service->tables()["dist"].get(), 2);
+
+  grpc::ClientContext mutate_context;
+  auto mutate_stream = stub.MutatePrioritiesStream(&mutate_context);
+  MutatePrioritiesRequest update_request;
+  update_request.set_table("dist");
+  auto* update = update_request.add_updates();
+  update->set_key(first_request.items(0).key());
+  update->set_priority(7);
+  MutatePrioritiesRequest delete_request;
+  delete_request.set_table("dist");
+  delete_request.add_delete_keys(second_request.items(0).key());
+  ASSERT_TRUE(mutate_stream->Write(update_request));
+  ASSERT_TRUE(mutate_stream->Write(delete_request));
+  MutatePrioritiesResponse mutate_response;
+  ASSERT_TRUE(mutate_stream->Read(&mutate_response));
+  ASSERT_TRUE(mutate_stream->Read(&mutate_response));
+  ASSERT_TRUE(mutate_stream->WritesDone());
+  EXPECT_FALSE(mutate_stream->Read(&mutate_response));
+  REVERB_EXPECT_OK(mutate_stream->Finish());
+
+  auto items = service->tables()["dist"]->Copy();
+  ASSERT_THAT(items, ::testing::SizeIs(1));
+  EXPECT_EQ(items[0].item.key(), first_request.items(0).key());
+  EXPECT_EQ(items[0].item.priority(), 7);
+}
+
+TEST(ReverbServiceImplTest, MutatePrioritiesStreamWithInvalidTableFails) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+  grpc::ClientContext context;
+  auto stream = stub.MutatePrioritiesStream(&context);
+  MutatePrioritiesRequest request;
+  request.set_table("i_do_not_exist");
+  request.add_delete_keys(1);
+  ASSERT_TRUE(stream->Write(request));
+  MutatePrioritiesResponse response;
+  EXPECT_FALSE(stream->Read(&response));
+  EXPECT_EQ(stream->Finish().error_code(), grpc::StatusCode::NOT_FOUND);
+}
+
+TEST(ReverbServiceImplTest, AnyCallWithInvalidDistributionFails) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext sample_context;
+  auto sample_stream = stub.SampleStream(&sample_context);
+  ASSERT_TRUE(sample_stream->Write(SampleRequest("invalid", 1)));
+  EXPECT_EQ(sample_stream->Finish().error_code(), grpc::StatusCode::NOT_FOUND);
+
+  grpc::ClientContext mutate_context;
+  MutatePrioritiesRequest mutate_request;
+  MutatePrioritiesResponse mutate_response;
+  mutate_request.set_table("invalid");
+  EXPECT_EQ(
+      stub.MutatePriorities(&mutate_context, mutate_request, &mutate_response)
+          .error_code(),
+      grpc::StatusCode::NOT_FOUND);
+
+  grpc::ClientContext insert_context;
+  auto insert_stream = stub.InsertStream(&insert_context);
+  ASSERT_TRUE(insert_stream->Write(InsertChunkRequest(1)));
+  ASSERT_TRUE(insert_stream->Write(InsertItemRequest("invalid", {1})));
+  EXPECT_EQ(insert_stream->Finish().error_code(), grpc::StatusCode::NOT_FOUND);
+}
+
+TEST(ReverbServiceImplTest, ResetWorks) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext context;
+  auto stream = stub.InsertStream(&context);
+  ASSERT_TRUE(stream->Write(InsertChunkRequest(1)));
+  ASSERT_TRUE(stream->Write(InsertItemRequest("dist", {1})));
+  InsertStreamResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+  ASSERT_TRUE(stream->WritesDone());
+  REVERB_EXPECT_OK(stream->Finish());
+
+  WaitForTableSize(service->tables()["dist"].get(), 1);
+
+  ResetRequest reset_request;
+  reset_request.set_table("dist");
+  ResetResponse reset_response;
+  grpc::ClientContext reset_context;
+  REVERB_ASSERT_OK(stub.Reset(&reset_context, reset_request, &reset_response));
+
+  EXPECT_EQ(service->tables()["dist"]->size(), 0);
+}
+
+TEST(ReverbServiceImplTest, ServerInfoWorks) {
+  auto service = MakeService(10);
+  grpc::CallbackServerContext context;
+  grpc::testing::DefaultReactorTestPeer peer(&context);
+
+  ServerInfoRequest server_info_request;
+  ServerInfoResponse server_info_response;
+
+  grpc::ServerUnaryReactor* reactor = service->ServerInfo(
+      &context, &server_info_request, &server_info_response);
+
+  ASSERT_EQ(reactor, peer.reactor());
+  ASSERT_TRUE(peer.test_status_set());
+  REVERB_ASSERT_OK(peer.test_status());
+
+  // The probability of these being 0 is 2^{-128}
+  EXPECT_NE(std::make_pair(server_info_response.tables_state_id().low(),
+                           server_info_response.tables_state_id().high()),
+            std::make_pair(uint64_t{0}, uint64_t{0}));
+
+  EXPECT_EQ(server_info_response.table_info_size(), 1);
+  auto table_info = server_info_response.table_info()[0];
+
+  TableInfo expected_table_info;
+  expected_table_info.set_name("dist");
+  expected_table_info.mutable_sampler_options()->set_uniform(true);
+  expected_table_info.mutable_sampler_options()->set_is_deterministic(false);
+  expected_table_info.mutable_remover_options()->set_fifo(true);
+  expected_table_info.mutable_remover_options()->set_is_deterministic(true);
+  expected_table_info.set_max_size(10);
+  expected_table_info.set_current_size(0);
+  auto rate_limiter = expected_table_info.mutable_rate_limiter_info();
+  rate_limiter->set_samples_per_insert(kSamplesPerInsert);
+  rate_limiter->set_min_size_to_sample(kMinSizeToSample);
+  rate_limiter->set_min_diff(kMinDiff);
+  rate_limiter->set_max_diff(kMaxDiff);
+  rate_limiter->mutable_insert_stats();
+  rate_limiter->mutable_sample_stats();
+  table_info.clear_table_worker_time();
+  table_info.clear_latency_stats();
+  *expected_table_info.mutable_signature() = MakeSignature();
+
+  EXPECT_THAT(table_info, testing::EqualsProto(expected_table_info));
+}
+
+TEST(ReverbServiceImplTest, ServerInfoReportsThreadPools) {
+  auto service = MakeService(10);
+  grpc::CallbackServerContext context;
+  grpc::testing::DefaultReactorTestPeer peer(&context);
+  ServerInfoRequest request;
+  ServerInfoResponse response;
+  service->ServerInfo(&context, &request, &response);
+  REVERB_ASSERT_OK(peer.test_status());
+
+  std::vector<std::string> names;
+  for (const auto& pool : response.thread_pools()) {
+    names.push_back(pool.name());
+  }
+  EXPECT_THAT(names, ::testing::Contains("TableCallbackExecutor"));
+  EXPECT_TRUE(std::is_sorted(names.begin(), names.end()));
+}
+
+TEST(ReverbServiceImplTest, ServerInfoOmitsStaticFieldsIfStateIsKnown) {
+  auto service = MakeService(10);
+  auto call = [&](const ServerInfoRequest& request) {
+    grpc::CallbackServerContext context;
+    grpc::testing::DefaultReactorTestPeer peer(&context);
+    ServerInfoResponse response;
+    service->ServerInfo(&context, &request, &response);
+    EXPECT_TRUE(peer.test_status_set());
+    REVERB_EXPECT_OK(peer.test_status());
+    return response;
+  };
+
+  ServerInfoResponse full = call(ServerInfoRequest());
+  EXPECT_FALSE(full.static_fields_omitted());
+  ASSERT_EQ(full.table_info_size(), 1);
+  EXPECT_TRUE(full.table_info(0).has_signature());
+
+  ServerInfoRequest request;
+  *request.mutable_known_tables_state_id() = full.tables_state_id();
+  ServerInfoResponse partial = call(request);
+  EXPECT_TRUE(partial.static_fields_omitted());
+  EXPECT_THAT(partial.tables_state_id(),
+              testing::EqualsProto(full.tables_state_id()));
+  ASSERT_EQ(partial.table_info_size(), 1);
+  EXPECT_EQ(partial.table_info(0).name(), "dist");
+  EXPECT_FALSE(partial.table_info(0).has_signature());
+  EXPECT_FALSE(partial.table_info(0).has_sampler_options());
+  EXPECT_EQ(partial.table_info(0).max_size(), 0);
+  EXPECT_TRUE(partial.table_info(0).has_rate_limiter_info());
+
+  // An outdated id results in the full info being sent.
+  request.mutable_known_tables_state_id()->set_low(
+      full.tables_state_id().low() + 1);
+  ServerInfoResponse outdated = call(request);
+  EXPECT_FALSE(outdated.static_fields_omitted());
+  EXPECT_TRUE(outdated.table_info(0).has_signature());
+}
+
+TEST(ReverbServiceImplTest, LockProfileWorks) {
+  auto service = MakeService(10);
+  auto call = [&](LockProfileRequest::Mode mode, bool reset) {
+    grpc::CallbackServerContext context;
+    grpc::testing::DefaultReactorTestPeer peer(&context);
+    LockProfileRequest request;
+    request.set_mode(mode);
+    request.set_reset(reset);
+    LockProfileResponse response;
+    service->LockProfile(&context, &request, &response);
+    EXPECT_TRUE(peer.test_status_set());
+    REVERB_EXPECT_OK(peer.test_status());
+    return response.profile();
+  };
+
+  EXPECT_TRUE(call(LockProfileRequest::ENABLE, /*reset=*/false).enabled());
+  EXPECT_EQ(service->tables()["dist"]->size(), 0);
+  EXPECT_THAT(call(LockProfileRequest::KEEP, /*reset=*/true).sites(),
+              ::testing::Contains(::testing::Property(&LockSiteStats::mutex,
+                                                      "Table::mu_")));
+  EXPECT_FALSE(call(LockProfileRequest::DISABLE, /*reset=*/true).enabled());
+}
+
+TEST(ReverbServiceImplTest, DumpTraceWorks) {
+  auto service = MakeService(10);
+  internal::FlightRecorder::Default()->Record(
+      /*trace_id=*/1, internal::TraceSide::kServer, "stage", absl::Now(),
+      absl::Now());
+
+  grpc::CallbackServerContext context;
+  grpc::testing::DefaultReactorTestPeer peer(&context);
+  DumpTraceRequest request;
+  request.set_clear(true);
+  DumpTraceResponse response;
+  service->DumpTrace(&context, &request, &response);
+  ASSERT_TRUE(peer.test_status_set());
+  REVERB_ASSERT_OK(peer.test_status());
+
+  EXPECT_THAT(response.chrome_trace_json(),
+              ::testing::HasSubstr(R"("name":"stage")"));
+  EXPECT_THAT(internal::FlightRecorder::Default()->Spans(),
+              ::testing::IsEmpty());
+}
+
+TEST(ReverbServiceImplTest, CheckpointCalledWithoutCheckpointer) {
+  auto service = MakeService(10);
+  grpc::CallbackServerContext context;
+  grpc::testing::DefaultReactorTestPeer peer(&context);
+  CheckpointRequest request;
+  CheckpointResponse response;
+
+  grpc::ServerUnaryReactor* reactor =
+      service->Checkpoint(&context, &request, &response);
+
+  ASSERT_EQ(reactor, peer.reactor());
+  ASSERT_TRUE(peer.test_status_set());
+  EXPECT_EQ(peer.test_status().error_code(),
+            grpc::StatusCode::INVALID_ARGUMENT);
+}
+
+TEST(ReverbServiceImplTest, CheckpointAndLoadFromCheckpoint) {
+  std::string path = getenv("TEST_TMPDIR");
+  REVERB_CHECK(tensorflow::Env::Default()->CreateUniqueFileName(&path, "temp"));
+  auto service = MakeService(10, CreateDefaultCheckpointer(path));
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  // Check that there are no items in the service to begin with.
+  EXPECT_EQ(service->tables()["dist"]->size(), 0);
+
+  // Insert an item.
+  {
+    grpc::ClientContext context;
+    auto stream = stub.InsertStream(&context);
+    ASSERT_TRUE(stream->Write(InsertChunkRequest(1)));
+    ASSERT_TRUE(stream->Write(InsertItemRequest("dist", {1})));
+    InsertStreamResponse response;
+    ASSERT_TRUE(stream->Read(&response));
+    ASSERT_TRUE(stream->WritesDone());
+    REVERB_EXPECT_OK(stream->Finish());
+  }
+
+  WaitForTableSize(service->tables()["dist"].get(), 1);
+
+  // Checkpoint the service.
+  {
+    CheckpointRequest request;
+    CheckpointResponse response;
+    grpc::ClientContext context;
+    REVERB_EXPECT_OK(stub.Checkpoint(&context, request, &response));
+  }
+
+  // Create a new service from the checkpoint and check that it has the
+  // correct number of items.
+  auto loaded_service = MakeService(10, CreateDefaultCheckpointer(path));
+  EXPECT_EQ(loaded_service->tables()["dist"]->size(), 1);
+}
+
+TEST(ReverbServiceImplTest, AsyncCheckpointAndLoadFromCheckpoint) {
+  std::string path = getenv("TEST_TMPDIR");
+  REVERB_CHECK(tensorflow::Env::Default()->CreateUniqueFileName(&path, "temp"));
+  auto service = MakeService(10, CreateDefaultCheckpointer(path));
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  {
+    grpc::ClientContext context;
+    auto stream = stub.InsertStream(&context);
+    ASSERT_TRUE(stream->Write(InsertChunkRequest(1)));
+    ASSERT_TRUE(stream->Write(InsertItemRequest("dist", {1})));
+    InsertStreamResponse response;
+    ASSERT_TRUE(stream->Read(&response));
+    ASSERT_TRUE(stream->WritesDone());
+    REVERB_EXPECT_OK(stream->Finish());
+  }
+  WaitForTableSize(service->tables()["dist"].get(), 1);
+
+  CheckpointResponse checkpoint;
+  {
+    CheckpointRequest request;
+    request.set_async(true);
+    grpc::ClientContext context;
+    REVERB_ASSERT_OK(stub.Checkpoint(&context, request, &checkpoint));
+    EXPECT_NE(checkpoint.checkpoint_id(), 0);
+    EXPECT_EQ(checkpoint.checkpoint_path(), "");
+  }
+
+  // Poll until the checkpoint has been written.
+  CheckpointStatusResponse status;
+  for (int i = 0; i < 1000; i++) {
+    CheckpointStatusRequest request;
+    request.set_checkpoint_id(checkpoint.checkpoint_id());
+    grpc::ClientContext context;
+    REVERB_ASSERT_OK(stub.CheckpointStatus(&context, request, &status));
+    if (status.state() == CheckpointStatusResponse::DONE ||
+        status.state() == CheckpointStatusResponse::FAILED) {
+      break;
+    }
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+  ASSERT_EQ(status.state(), CheckpointStatusResponse::DONE)
+      << status.error_message();
+  EXPECT_NE(status.checkpoint_path(), "");
+
+  auto loaded_service = MakeService(10, CreateDefaultCheckpointer(path));
+  EXPECT_EQ(loaded_service->tables()["dist"]->size(), 1);
+}
+
+TEST(ReverbServiceImplTest, CheckpointStatusOfUnknownCheckpoint) {
+  auto service = MakeService(10);
+  grpc::CallbackServerContext context;
+  grpc::testing::DefaultReactorTestPeer peer(&context);
+  CheckpointStatusRequest request;
+  request.set_checkpoint_id(1);
+  CheckpointStatusResponse response;
+  service->CheckpointStatus(&context, &request, &response);
+  ASSERT_TRUE(peer.test_status_set());
+  EXPECT_EQ(peer.test_status().error_code(), grpc::StatusCode::NOT_FOUND);
+}
+
+TEST(ReverbServiceImplTest, InitializeConnectionSuccess) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext context;
+  auto stream = stub.InitializeConnection(&context);
+
+  InitializeConnectionRequest request;
+  request.set_pid(getpid());
+  request.set_table_name("dist");
+  ASSERT_TRUE(stream->Write(request));
+
+  InitializeConnectionResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+  ASSERT_NE(response.address(), 0);
 
   // Verify that we successfully copied the Table shared_ptr.
   auto server_table = service->tables().find("dist")->second;
@@ -660,6 +1816,39 @@ TEST(ReverbServiceImplTest, InitializeConnectionSuccess) {
   REVERB_EXPECT_OK(stream->Finish());
 }
 
+TEST(ReverbServiceImplTest, InitializeConnectionIncludesChunkStore) {
+  std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
+  std::unique_ptr<grpc::Server> server(
+      grpc::ServerBuilder().RegisterService(service.get()).BuildAndStart());
+  /* grpc_gen:: */ReverbService::Stub stub(
+      server->InProcessChannel(grpc::ChannelArguments()));
+
+  grpc::ClientContext context;
+  auto stream = stub.InitializeConnection(&context);
+
+  // No table is requested so only the chunk store is transferred.
+  InitializeConnectionRequest request;
+  request.set_pid(getpid());
+  request.set_include_chunk_store(true);
+  ASSERT_TRUE(stream->Write(request));
+
+  InitializeConnectionResponse response;
+  ASSERT_TRUE(stream->Read(&response));
+  EXPECT_EQ(response.address(), 0);
+  ASSERT_NE(response.chunk_store_address(), 0);
+
+  auto* client_chunk_store_ptr =
+      reinterpret_cast<std::shared_ptr<ChunkStore>*>(
+          response.chunk_store_address());
+  EXPECT_NE(*client_chunk_store_ptr, nullptr);
+
+  // Confirm the transfer and close the connection.
+  request.set_ownership_transferred(true);
+  ASSERT_TRUE(stream->Write(request));
+  ASSERT_TRUE(stream->WritesDone());
+  REVERB_EXPECT_OK(stream->Finish());
+}
+
 TEST(ReverbServiceImplTest, InitializeConnectionTableNotFound) {
   std::unique_ptr<ReverbServiceImpl> service = MakeService(10);
   std::unique_ptr<grpc::Server> server(
@@ -0,0 +1,77 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/sample_transform.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "reverb/cc/platform/logging.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/types.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+template <typename T>
+tensorflow::Tensor Clip(const tensorflow::Tensor& tensor, double min,
+                        double max) {
+  tensorflow::Tensor clipped(tensor.dtype(), tensor.shape());
+  auto src = tensor.flat<T>();
+  auto dst = clipped.flat<T>();
+  for (int64_t i = 0; i < src.size(); i++) {
+    dst(i) = std::min(std::max(src(i), static_cast<T>(min)),
+                      static_cast<T>(max));
+  }
+  return clipped;
+}
+
+}  // namespace
+
+ClipColumnTransform::ClipColumnTransform(int column, double min, double max)
+    : column_(column), min_(min), max_(max) {
+  REVERB_CHECK_GE(column_, 0);
+  REVERB_CHECK_LE(min_, max_);
+}
+
+absl::Status ClipColumnTransform::Apply(
+    std::vector<tensorflow::Tensor>* columns) const {
+  if (column_ >= columns->size()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Can't clip column ", column_, " of a trajectory with ",
+                     columns->size(), " columns."));
+  }
+  tensorflow::Tensor* tensor = &(*columns)[column_];
+  switch (tensor->dtype()) {
+    case tensorflow::DT_FLOAT:
+      *tensor = Clip<float>(*tensor, min_, max_);
+      return absl::OkStatus();
+    case tensorflow::DT_DOUBLE:
+      *tensor = Clip<double>(*tensor, min_, max_);
+      return absl::OkStatus();
+    default:
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Can only clip columns of dtype float or double but column ",
+          column_, " has dtype ", tensorflow::DataTypeString(tensor->dtype()),
+          "."));
+  }
+}
+
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,69 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SAMPLE_TRANSFORM_H_
+#define REVERB_CC_SAMPLE_TRANSFORM_H_
+
+#include <vector>
+
+#include "absl/status/status.h"
+#include "tensorflow/core/framework/tensor.h"
+
+namespace deepmind {
+namespace reverb {
+
+// A transform which is applied to every sampled trajectory by the workers of
+// a `Sampler` (see `Sampler::Options::transforms`) before the trajectory is
+// returned. Moving per sample work (e.g reward clipping or normalization)
+// from the consumer to the workers runs it in parallel with the training step
+// rather than on the thread which consumes the samples.
+class SampleTransform {
+ public:
+  virtual ~SampleTransform() = default;
+
+  // Transforms the data columns of a trajectory, i.e the last K tensors
+  // returned by `Sample::AsTrajectory` (without the key, probability, table
+  // size and priority). The transform may change the dtypes and shapes of the
+  // columns but not their number, and non squeezed columns must keep their
+  // leading time dimension.
+  //
+  // The tensors can share their buffers with other samples (e.g through the
+  // decoded chunk cache) so they must not be modified in place. Transformed
+  // columns have to be written to new tensors instead.
+  //
+  // Called concurrently by the workers of the sampler so implementations must
+  // be thread safe.
+  virtual absl::Status Apply(
+      std::vector<tensorflow::Tensor>* columns) const = 0;
+};
+
+// Clips the values of the floating point column `column` to [`min`, `max`],
+// e.g to clip the rewards of the sampled trajectories.
+class ClipColumnTransform : public SampleTransform {
+ public:
+  ClipColumnTransform(int column, double min, double max);
+
+  absl::Status Apply(std::vector<tensorflow::Tensor>* columns) const override;
+
+ private:
+  const int column_;
+  const double min_;
+  const double max_;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SAMPLE_TRANSFORM_H_
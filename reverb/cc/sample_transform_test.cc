@@ -0,0 +1,74 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/sample_transform.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/testing/tensor_testutil.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+template <typename T>
+tensorflow::Tensor MakeVector(const std::vector<T>& values) {
+  tensorflow::Tensor tensor(
+      tensorflow::DataTypeToEnum<T>::v(),
+      tensorflow::TensorShape({static_cast<int64_t>(values.size())}));
+  for (int i = 0; i < values.size(); i++) {
+    tensor.flat<T>()(i) = values[i];
+  }
+  return tensor;
+}
+
+TEST(ClipColumnTransformTest, ClipsColumn) {
+  tensorflow::Tensor observations = MakeVector<double>({-5, 5, 0.5});
+  std::vector<tensorflow::Tensor> columns = {
+      observations, MakeVector<float>({-2, -0.5, 0, 1, 3})};
+
+  REVERB_ASSERT_OK(ClipColumnTransform(1, -1, 1).Apply(&columns));
+  test::ExpectTensorEqual<double>(columns[0], observations);
+  test::ExpectTensorEqual<float>(columns[1],
+                                 MakeVector<float>({-1, -0.5, 0, 1, 1}));
+}
+
+TEST(ClipColumnTransformTest, DoesNotModifyInputBuffer) {
+  tensorflow::Tensor rewards = MakeVector<double>({-2, 2});
+  std::vector<tensorflow::Tensor> columns = {rewards};
+
+  REVERB_ASSERT_OK(ClipColumnTransform(0, 0, 1).Apply(&columns));
+  test::ExpectTensorEqual<double>(columns[0], MakeVector<double>({0, 1}));
+  test::ExpectTensorEqual<double>(rewards, MakeVector<double>({-2, 2}));
+}
+
+TEST(ClipColumnTransformTest, RejectsInvalidColumns) {
+  std::vector<tensorflow::Tensor> columns = {MakeVector<int32_t>({1, 2})};
+  EXPECT_EQ(ClipColumnTransform(0, 0, 1).Apply(&columns).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(ClipColumnTransform(1, 0, 1).Apply(&columns).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
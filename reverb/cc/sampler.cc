@@ -15,9 +15,14 @@
 #include "reverb/cc/sampler.h"
 
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <deque>
+#include <functional>
+#include <iterator>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "grpcpp/impl/codegen/client_context.h"
@@ -28,6 +33,7 @@
 #include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "absl/types/optional.h"
 #include "reverb/cc/chunk_store.h"
 #include "reverb/cc/errors.h"
 #include "reverb/cc/platform/hash_map.h"
@@ -37,9 +43,15 @@
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/sample_transform.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/chunk_key_window.h"
+#include "reverb/cc/support/decoded_chunk_cache.h"
+#include "reverb/cc/support/flight_recorder.h"
 #include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/support/task_executor.h"
 #include "reverb/cc/support/tf_util.h"
+#include "reverb/cc/support/trajectory_decode_plan.h"
 #include "reverb/cc/support/trajectory_util.h"
 #include "reverb/cc/table.h"
 #include "reverb/cc/tensor_compression.h"
@@ -50,6 +62,10 @@ namespace deepmind {
 namespace reverb {
 namespace {
 
+// Maximum size of the decoded chunk columns shared by the samples of a single
+// response when the sampler doesn't have a decoded chunk cache.
+constexpr int64_t kResponseDecodedChunkCacheBytes = 64 * 1024 * 1024;  // 64MB.
+
 template <typename T>
 tensorflow::Tensor InitializeTensor(T value, int64_t length) {
   tensorflow::Tensor tensor(tensorflow::DataTypeToEnum<T>::v(),
@@ -69,34 +85,260 @@ tensorflow::Tensor ScalarTensor(T value) {
   return tensor;
 }
 
+// Copies all the elements of `src` into `dst` starting at flat element
+// `offset`. `dst` must have the same dtype as `src` and room for all of them.
+void CopyElements(const tensorflow::Tensor& src, int64_t offset,
+                  tensorflow::Tensor* dst) {
+  REVERB_CHECK_EQ(src.dtype(), dst->dtype());
+  REVERB_CHECK_LE(offset + src.NumElements(), dst->NumElements());
+  if (tensorflow::DataTypeCanUseMemcpy(src.dtype())) {
+    auto src_data = src.tensor_data();
+    std::memcpy(static_cast<char*>(dst->data()) +
+                    offset * tensorflow::DataTypeSize(src.dtype()),
+                src_data.data(), src_data.size());
+  } else {
+    REVERB_CHECK_EQ(src.dtype(), tensorflow::DT_STRING);
+    auto src_t = src.flat<tensorflow::tstring>();
+    auto dst_t = dst->flat<tensorflow::tstring>();
+    for (int64_t i = 0; i < src_t.size(); i++) {
+      dst_t(offset + i) = src_t(i);
+    }
+  }
+}
+
+// Unpacks the column referenced by `slice` from `chunk_data`. The column is
+// decoded by `decoder` if set and supporting it. If `cache` is set then the
+// decompressed column is looked up in (or added to) the cache before being
+// sliced. Block structured chunks bypass the cache as only the blocks covered
+// by the slice have to be decompressed, unless they are decoded by `decoder`.
+absl::Status UnpackSlice(const ChunkData& chunk_data,
+                         const FlatTrajectory::ChunkSlice& slice,
+                         const ChunkDecoder* decoder,
+                         internal::DecodedChunkCache* cache,
+                         tensorflow::Tensor* out) {
+  const bool use_decoder =
+      decoder != nullptr && decoder->CanDecode(chunk_data, slice.index());
+  if (!use_decoder && (cache == nullptr || chunk_data.block_length() > 0)) {
+    return internal::UnpackChunkColumnAndSlice(chunk_data, slice, out);
+  }
+  auto decode = [&](tensorflow::Tensor* column) {
+    return use_decoder
+               ? decoder->Decode(chunk_data, slice.index(), column)
+               : internal::UnpackChunkColumn(chunk_data, slice.index(), column);
+  };
+  if (cache == nullptr) {
+    REVERB_RETURN_IF_ERROR(decode(out));
+  } else {
+    REVERB_RETURN_IF_ERROR(cache->GetOrDecode(chunk_data.chunk_key(),
+                                              slice.index(), decode, out));
+  }
+  return internal::SliceChunkColumn(slice.offset(), slice.length(), out);
+}
+
+// Runs `fn(i)` for every `i` in [0, `n`), in parallel on `executor` if set, and
+// returns the first error in index order.
+absl::Status ParallelForWithStatus(
+    TaskExecutor* executor, int64_t n,
+    const std::function<absl::Status(int64_t)>& fn) {
+  if (executor == nullptr) {
+    for (int64_t i = 0; i < n; i++) {
+      REVERB_RETURN_IF_ERROR(fn(i));
+    }
+    return absl::OkStatus();
+  }
+  std::vector<absl::Status> statuses(n);
+  executor->ParallelFor(n, [&](int64_t i) { statuses[i] = fn(i); });
+  for (auto& status : statuses) {
+    REVERB_RETURN_IF_ERROR(status);
+  }
+  return absl::OkStatus();
+}
+
+// Chunks received on a sample stream which the server may reference by key in
+// later responses (see `SampleStreamRequest.max_cached_chunks`). The keys are
+// tracked the same way as by the server so both ends agree on which chunks are
+// held. If `track_response_chunks` is set then the chunks are also held until
+// `ClearResponseChunks` is called so later entries of the same response can
+// reference them (see `SampleStreamRequest.deduplicate_chunks`).
+class StreamChunkCache {
+ public:
+  StreamChunkCache(int64_t capacity, bool track_response_chunks)
+      : window_(capacity), track_response_chunks_(track_response_chunks) {}
+
+  void Add(std::shared_ptr<const ChunkData> chunk) {
+    const uint64_t key = chunk->chunk_key();
+    if (track_response_chunks_) {
+      response_chunks_[key] = chunk;
+    }
+    // Servers which don't support caching resend chunks that are already held.
+    if (!window_.Contains(key)) {
+      uint64_t evicted;
+      if (window_.Insert(key, &evicted)) {
+        chunks_.erase(evicted);
+        if (evicted == key) return;
+      }
+    }
+    chunks_[key] = std::move(chunk);
+  }
+
+  std::shared_ptr<const ChunkData> Get(uint64_t key) const {
+    auto it = chunks_.find(key);
+    return it == chunks_.end() ? nullptr : it->second;
+  }
+
+  // Returns the chunk received since the last `ClearResponseChunks` call.
+  std::shared_ptr<const ChunkData> GetFromResponse(uint64_t key) const {
+    auto it = response_chunks_.find(key);
+    return it == response_chunks_.end() ? nullptr : it->second;
+  }
+
+  void ClearResponseChunks() { response_chunks_.clear(); }
+
+ private:
+  internal::ChunkKeyWindow window_;
+  internal::flat_hash_map<uint64_t, std::shared_ptr<const ChunkData>> chunks_;
+  const bool track_response_chunks_;
+  internal::flat_hash_map<uint64_t, std::shared_ptr<const ChunkData>>
+      response_chunks_;
+};
+
+// Collects the chunks of the entries received on a sample stream into
+// `chunks`. Chunks referenced through `cached_chunk_keys` or
+// `response_chunk_keys` are looked up in `stream_chunks` and all received
+// chunks are added to it.
+absl::Status CollectChunks(
+    std::vector<SampleStreamResponse::SampleEntry>* responses,
+    StreamChunkCache* stream_chunks,
+    internal::flat_hash_map<uint64_t, std::shared_ptr<const ChunkData>>*
+        chunks_out) {
+  const auto& info = responses->front().info();
+  auto& chunks = *chunks_out;
+  for (auto& response : *responses) {
+    // References must be resolved before the chunks of the same entry are
+    // added as these could evict the referenced chunks.
+    for (uint64_t key : response.cached_chunk_keys()) {
+      chunks[key] = stream_chunks->Get(key);
+      if (chunks[key] == nullptr) {
+        return absl::InternalError(absl::StrCat(
+            "Chunk ", key, " was referenced by item ", info.item().key(),
+            " but is not held by the sampler."));
+      }
+    }
+    for (uint64_t key : response.response_chunk_keys()) {
+      chunks[key] = stream_chunks->GetFromResponse(key);
+      if (chunks[key] == nullptr) {
+        return absl::InternalError(absl::StrCat(
+            "Chunk ", key, " was referenced by item ", info.item().key(),
+            " but was not sent earlier in the response."));
+      }
+    }
+    std::vector<ChunkData*> received(response.data_size());
+    response.mutable_data()->ExtractSubrange(0, received.size(),
+                                             received.data());
+    for (ChunkData* data : received) {
+      std::shared_ptr<const ChunkData> chunk(data);
+      stream_chunks->Add(chunk);
+      chunks[chunk->chunk_key()] = std::move(chunk);
+    }
+  }
+  return absl::OkStatus();
+}
+
+// Builds a sample from the entries received on a sample stream (see
+// `CollectChunks`). The slices are decoded by walking the plan of the
+// trajectory layout (see `TrajectoryDecodePlan`), taken from `plans`. The
+// chunk slices are decompressed in parallel if `executor` is set.
 absl::Status AsSample(std::vector<SampleStreamResponse::SampleEntry> responses,
+                      const ChunkDecoder* decoder,
+                      internal::DecodedChunkCache* cache,
+                      StreamChunkCache* stream_chunks,
+                      internal::TrajectoryDecodePlanCache* plans,
+                      TaskExecutor* executor,
                       std::unique_ptr<Sample>* sample) {
   const auto& info = responses.front().info();
-  internal::flat_hash_map<uint64_t, std::unique_ptr<ChunkData>> chunks;
-  for (auto& response : responses) {
-    while (response.data_size() != 0) {
-      auto* chunk = response.mutable_data()->ReleaseLast();
-      chunks[chunk->chunk_key()] = absl::WrapUnique<ChunkData>(chunk);
+  internal::flat_hash_map<uint64_t, std::shared_ptr<const ChunkData>> chunks;
+  REVERB_RETURN_IF_ERROR(CollectChunks(&responses, stream_chunks, &chunks));
+
+  const FlatTrajectory& trajectory = info.item().flat_trajectory();
+  std::vector<uint64_t> chunk_keys;
+  std::shared_ptr<const internal::TrajectoryDecodePlan> plan =
+      plans->Get(trajectory, &chunk_keys);
+
+  // Extract all chunks belonging to this sample, indexed by their ordinal.
+  std::vector<std::shared_ptr<const ChunkData>> sample_chunks(
+      plan->num_chunks);
+  for (int i = 0; i < plan->num_chunks; i++) {
+    auto it = chunks.find(chunk_keys[i]);
+    if (it == chunks.end()) {
+      return absl::InternalError(
+          absl::StrCat("Chunk ", chunk_keys[i],
+                       " could not be found when unpacking item ",
+                       info.item().key(), "."));
+    }
+    sample_chunks[i] = std::move(it->second);
+  }
+  chunks.clear();
+
+  // The slices of the trajectory and their outputs, in plan order.
+  std::vector<const FlatTrajectory::ChunkSlice*> slices;
+  std::vector<tensorflow::Tensor*> outs;
+  slices.reserve(plan->slices.size());
+  outs.reserve(plan->slices.size());
+  std::vector<std::vector<tensorflow::Tensor>> column_chunks(
+      plan->columns.size());
+  std::vector<bool> squeeze_columns(plan->columns.size());
+  for (int i = 0; i < plan->columns.size(); i++) {
+    squeeze_columns[i] = plan->columns[i].squeeze;
+    column_chunks[i].resize(plan->columns[i].num_slices);
+    for (int j = 0; j < plan->columns[i].num_slices; j++) {
+      slices.push_back(&trajectory.columns(i).chunk_slices(j));
+      outs.push_back(&column_chunks[i][j]);
     }
   }
+  auto unpack = [&](int64_t s) {
+    return UnpackSlice(*sample_chunks[plan->slices[s].chunk], *slices[s],
+                       decoder, cache, outs[s]);
+  };
 
-  // Count the number of times each chunk is referenced in the column slices.
-  // This allows us to check if the chunk is needed anymore after every use. If
-  // all the references have been handled then the memory of the chunk can be
-  // freed thus reducing total memory usage.
-  internal::flat_hash_map<uint64_t, int> chunk_ref_count;
-  for (const auto& column : info.item().flat_trajectory().columns()) {
-    for (const auto& slice : column.chunk_slices()) {
-      chunk_ref_count[slice.chunk_key()]++;
+  if (executor != nullptr) {
+    // All slices are unpacked at once so the chunks are held until the end.
+    REVERB_RETURN_IF_ERROR(
+        ParallelForWithStatus(executor, slices.size(), unpack));
+  } else {
+    for (int64_t s = 0; s < slices.size(); s++) {
+      REVERB_RETURN_IF_ERROR(unpack(s));
+      // If this was the last time the chunk is referenced then we can release
+      // its memory.
+      if (plan->slices[s].last_use) {
+        sample_chunks[plan->slices[s].chunk] = nullptr;
+      }
     }
   }
 
-  // Extract all chunks belonging to this sample.
-  const auto& columns = info.item().flat_trajectory().columns();
+  *sample = absl::make_unique<Sample>(
+      info.item().key(), info.probability(), info.table_size(),
+      info.item().priority(), info.rate_limited(), std::move(column_chunks),
+      std::move(squeeze_columns));
 
-  std::vector<std::vector<tensorflow::Tensor>> column_chunks(columns.size());
-  std::vector<bool> squeeze_columns(columns.size());
+  return absl::OkStatus();
+}
 
+// Like `AsSample` but the chunk slices are not decompressed (see
+// `Sampler::Options::lazy_decoding`).
+absl::Status AsEncodedSample(
+    std::vector<SampleStreamResponse::SampleEntry> responses,
+    StreamChunkCache* stream_chunks, std::unique_ptr<Sample>* sample) {
+  const auto& info = responses.front().info();
+  internal::flat_hash_map<uint64_t, std::shared_ptr<const ChunkData>> chunks;
+  REVERB_RETURN_IF_ERROR(CollectChunks(&responses, stream_chunks, &chunks));
+
+  // Every chunk is wrapped once, even if it's referenced by several columns.
+  internal::flat_hash_map<uint64_t, std::shared_ptr<const ChunkStore::Chunk>>
+      wrapped;
+  const auto& columns = info.item().flat_trajectory().columns();
+  std::vector<std::vector<Sample::EncodedSlice>> encoded_columns(
+      columns.size());
+  std::vector<bool> squeeze_columns(columns.size());
   for (int i = 0; i < columns.size(); i++) {
     squeeze_columns[i] = columns[i].squeeze();
     for (const auto& slice : columns[i].chunk_slices()) {
@@ -107,54 +349,71 @@ absl::Status AsSample(std::vector<SampleStreamResponse::SampleEntry> responses,
                          " could not be found when unpacking item ",
                          info.item().key(), "."));
       }
-
-      column_chunks[i].emplace_back();
-      REVERB_RETURN_IF_ERROR(internal::UnpackChunkColumnAndSlice(
-          *it->second, slice, &column_chunks[i].back()));
-
-      // If this was the last time the chunk is referenced the we can release
-      // its memory.
-      if (--chunk_ref_count[slice.chunk_key()] == 0) {
-        chunks.erase(it);
+      auto& chunk = wrapped[slice.chunk_key()];
+      if (chunk == nullptr) {
+        chunk = std::make_shared<ChunkStore::Chunk>(it->second);
       }
+      encoded_columns[i].push_back({chunk, slice});
     }
   }
 
   *sample = absl::make_unique<Sample>(
       info.item().key(), info.probability(), info.table_size(),
-      info.item().priority(), info.rate_limited(), std::move(column_chunks),
+      info.item().priority(), info.rate_limited(), std::move(encoded_columns),
       std::move(squeeze_columns));
-
   return absl::OkStatus();
 }
 
 absl::Status AsSample(const Table::SampledItem& sampled_item,
+                      absl::Span<const int> selected_columns,
+                      bool reuse_decoded_chunks,
+                      const ChunkDecoder* decoder,
+                      internal::DecodedChunkCache* cache,
+                      TaskExecutor* executor,
                       std::unique_ptr<Sample>* sample) {
-  internal::flat_hash_map<uint64_t, std::shared_ptr<ChunkStore::Chunk>> chunks(
+  // `sampled_item.ref` keeps the chunks alive so there is no need to take
+  // (atomically refcounted) ownership of each chunk while unpacking.
+  internal::flat_hash_map<uint64_t, const ChunkStore::Chunk*> chunks(
       sampled_item.ref->chunks.size());
-  for (auto& chunk : sampled_item.ref->chunks) {
-    chunks[chunk->key()] = chunk;
+  for (const auto& chunk : sampled_item.ref->chunks) {
+    chunks[chunk->key()] = chunk.get();
   }
 
-  std::vector<std::vector<tensorflow::Tensor>> column_chunks;
-  column_chunks.reserve(
-      sampled_item.ref->item.flat_trajectory().columns_size());
-
-  for (const auto& column :
-       sampled_item.ref->item.flat_trajectory().columns()) {
-    std::vector<tensorflow::Tensor> unpacked_chunks;
-
-    for (const auto& slice : column.chunk_slices()) {
-      unpacked_chunks.emplace_back();
-      REVERB_RETURN_IF_ERROR(internal::UnpackChunkColumnAndSlice(
-          chunks[slice.chunk_key()]->data(), slice, &unpacked_chunks.back()));
+  FlatTrajectory scratch;
+  const FlatTrajectory* trajectory =
+      &sampled_item.ref->flat_trajectory(&scratch);
+  FlatTrajectory projected;
+  if (!selected_columns.empty()) {
+    REVERB_RETURN_IF_ERROR(
+        internal::ProjectTrajectory(*trajectory, selected_columns, &projected));
+    trajectory = &projected;
+  }
+  const auto& columns = trajectory->columns();
+  std::vector<std::vector<tensorflow::Tensor>> column_chunks(columns.size());
+  std::vector<std::pair<int, int>> slices;
+  for (int i = 0; i < columns.size(); i++) {
+    column_chunks[i].resize(columns[i].chunk_slices_size());
+    for (int j = 0; j < columns[i].chunk_slices_size(); j++) {
+      slices.emplace_back(i, j);
     }
-
-    column_chunks.push_back(std::move(unpacked_chunks));
   }
 
+  REVERB_RETURN_IF_ERROR(ParallelForWithStatus(
+      executor, slices.size(), [&](int64_t index) -> absl::Status {
+        const auto [i, j] = slices[index];
+        const auto& slice = columns[i].chunk_slices(j);
+        tensorflow::Tensor* out = &column_chunks[i][j];
+        const ChunkStore::Chunk* chunk = chunks.at(slice.chunk_key());
+        if (reuse_decoded_chunks) {
+          REVERB_RETURN_IF_ERROR(chunk->GetDecodedColumn(slice.index(), out));
+          return internal::SliceChunkColumn(slice.offset(), slice.length(),
+                                            out);
+        }
+        return UnpackSlice(chunk->data(), slice, decoder, cache, out);
+      }));
+
   std::vector<bool> squeeze_columns;
-  for (const auto& col : sampled_item.ref->item.flat_trajectory().columns()) {
+  for (const auto& col : columns) {
     squeeze_columns.push_back(col.squeeze());
   }
   *sample = absl::make_unique<deepmind::reverb::Sample>(
@@ -165,17 +424,85 @@ absl::Status AsSample(const Table::SampledItem& sampled_item,
   return absl::OkStatus();
 }
 
+// Like `AsSample` but the chunk slices are not decompressed (see
+// `Sampler::Options::lazy_decoding`).
+absl::Status AsEncodedSample(const Table::SampledItem& sampled_item,
+                             absl::Span<const int> selected_columns,
+                             std::unique_ptr<Sample>* sample) {
+  internal::flat_hash_map<uint64_t, std::shared_ptr<const ChunkStore::Chunk>>
+      chunks(sampled_item.ref->chunks.size());
+  for (const auto& chunk : sampled_item.ref->chunks) {
+    chunks[chunk->key()] = chunk;
+  }
+
+  FlatTrajectory scratch;
+  const FlatTrajectory* trajectory =
+      &sampled_item.ref->flat_trajectory(&scratch);
+  FlatTrajectory projected;
+  if (!selected_columns.empty()) {
+    REVERB_RETURN_IF_ERROR(
+        internal::ProjectTrajectory(*trajectory, selected_columns, &projected));
+    trajectory = &projected;
+  }
+  const auto& columns = trajectory->columns();
+  std::vector<std::vector<Sample::EncodedSlice>> encoded_columns(
+      columns.size());
+  std::vector<bool> squeeze_columns(columns.size());
+  for (int i = 0; i < columns.size(); i++) {
+    squeeze_columns[i] = columns[i].squeeze();
+    for (const auto& slice : columns[i].chunk_slices()) {
+      encoded_columns[i].push_back({chunks.at(slice.chunk_key()), slice});
+    }
+  }
+
+  *sample = absl::make_unique<Sample>(
+      sampled_item.ref->item.key(), sampled_item.probability,
+      sampled_item.table_size, sampled_item.priority, sampled_item.rate_limited,
+      std::move(encoded_columns), std::move(squeeze_columns));
+  return absl::OkStatus();
+}
+
+// Records the time a traced sample spent in the queue of the sampler and the
+// time the `PopNextSample` call which returned it was blocked.
+void RecordPoppedSample(const Sample& sample, absl::Time pop_started_at) {
+  if (sample.trace_id() == 0) return;
+  const absl::Time now = absl::Now();
+  internal::FlightRecorder* recorder = internal::FlightRecorder::Default();
+  recorder->Record(sample.trace_id(), internal::TraceSide::kClient,
+                   "Sampler queue", sample.queued_at(), now);
+  recorder->Record(sample.trace_id(), internal::TraceSide::kClient,
+                   "PopNextSample", pop_started_at, now);
+}
+
 class GrpcSamplerWorker : public SamplerWorker {
  public:
   // Constructs a new worker without creating a stream to a server.
   GrpcSamplerWorker(
       std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
       std::string table_name, int64_t samples_per_request,
-      int flexible_batch_size)
+      int flexible_batch_size, int64_t max_cached_chunks,
+      bool decompress_on_server, bool trim_chunks_on_server,
+      bool deduplicate_chunks, bool group_by_chunk, std::vector<int> columns,
+      std::vector<std::pair<std::string, double>> mixture,
+      std::shared_ptr<internal::DecodedChunkCache> decoded_chunk_cache,
+      std::shared_ptr<internal::TraceSampler> trace_sampler)
       : stub_(std::move(stub)),
         table_name_(std::move(table_name)),
         samples_per_request_(samples_per_request),
-        flexible_batch_size_(flexible_batch_size) {}
+        flexible_batch_size_(flexible_batch_size),
+        max_cached_chunks_(max_cached_chunks),
+        decompress_on_server_(decompress_on_server),
+        trim_chunks_on_server_(trim_chunks_on_server),
+        deduplicate_chunks_(deduplicate_chunks),
+        group_by_chunk_(group_by_chunk),
+        columns_(std::move(columns)),
+        mixture_(std::move(mixture)),
+        // Trimmed chunks keep their key so their decoded columns must not be
+        // shared with other samples.
+        decoded_chunk_cache_(trim_chunks_on_server
+                                 ? nullptr
+                                 : std::move(decoded_chunk_cache)),
+        trace_sampler_(std::move(trace_sampler)) {}
 
   // Cancels the stream and marks the worker as closed. Active and future
   // calls to `OpenStreamAndFetch` will return status `CANCELLED`.
@@ -185,15 +512,16 @@ class GrpcSamplerWorker : public SamplerWorker {
     if (context_ != nullptr) context_->TryCancel();
   }
 
-  // Opens a new `SampleStream` to a server and requests `num_samples` samples
-  // in batches with maximum size `samples_per_request`, with a timeout to
-  // pass to the `Table::Sample` call. Once complete (either
-  // done, from a non transient error, or from timing out), the stream is
-  // closed and the number of samples pushed to `queue` is returned together
-  // with the status of the stream.  A timeout will cause the Status type
-  // DeadlineExceeded to be returned.
+  // Opens a new `SampleStream` to a server and requests up to `max_samples`
+  // samples with at most `samples_per_request` in flight at any time (further
+  // limited by the grants of `budget`), with a timeout to pass to the
+  // `Table::Sample` call. Once complete (either done, from a non transient
+  // error, or from timing out), the stream is closed and the number of samples
+  // pushed to `queue` is returned together with the status of the stream.  A
+  // timeout will cause the Status type DeadlineExceeded to be returned.
   std::pair<int64_t, absl::Status> FetchSamples(
-      internal::Queue<std::unique_ptr<Sample>>* queue, int64_t num_samples,
+      internal::LockFreeQueue<std::unique_ptr<Sample>>* queue,
+      int64_t max_samples, SampleBudget* budget,
       absl::Duration rate_limiter_timeout) override {
     std::unique_ptr<grpc::ClientReaderWriterInterface<SampleStreamRequest,
                                                       SampleStreamResponse>>
@@ -208,77 +536,176 @@ class GrpcSamplerWorker : public SamplerWorker {
       stream = stub_->SampleStream(context_.get());
     }
 
-    int64_t num_samples_returned = 0;
-    while (num_samples_returned < num_samples) {
-      // TODO(b/190237214): Ignore timeouts when data is not being requested.
-      SampleStreamRequest request;
+    // The server keeps track of the chunks held by the client separately for
+    // each stream.
+    StreamChunkCache stream_chunks(max_cached_chunks_,
+                                   /*track_response_chunks=*/
+                                   deduplicate_chunks_);
+
+    // Samples of the same response which share a chunk also share its decoded
+    // columns. Only used if the sampler has no decoded chunk cache of its own.
+    absl::optional<internal::DecodedChunkCache> response_decoded_chunks;
+    if (deduplicate_chunks_ && decoded_chunk_cache_ == nullptr) {
+      response_decoded_chunks.emplace(kResponseDecodedChunkCacheBytes);
+    }
+    internal::DecodedChunkCache* decoded_chunk_cache =
+        response_decoded_chunks.has_value() ? &response_decoded_chunks.value()
+                                            : decoded_chunk_cache_.get();
+
+    // The request is sent once and then extended by granting credits for the
+    // samples which have been received, so the stream never drains while
+    // there is budget left. Grants are batched to half of the window.
+    int64_t num_samples = budget->Acquire(
+        std::min(samples_per_request_, max_samples));
+    if (num_samples == 0) return {0, absl::OkStatus()};
+
+    // TODO(b/190237214): Ignore timeouts when data is not being requested.
+    SampleStreamRequest request;
+    if (mixture_.empty()) {
       request.set_table(table_name_);
-      request.set_num_samples(
-          std::min(samples_per_request_, num_samples - num_samples_returned));
-      request.mutable_rate_limiter_timeout()->set_milliseconds(
-          NonnegativeDurationToInt64Millis(rate_limiter_timeout));
-      request.set_flexible_batch_size(flexible_batch_size_);
+    }
+    for (const auto& [table, weight] : mixture_) {
+      auto* component = request.add_mixture();
+      component->set_table(table);
+      component->set_weight(weight);
+    }
+    request.set_num_samples(num_samples);
+    request.mutable_rate_limiter_timeout()->set_milliseconds(
+        NonnegativeDurationToInt64Millis(rate_limiter_timeout));
+    request.set_flexible_batch_size(flexible_batch_size_);
+    request.set_max_cached_chunks(max_cached_chunks_);
+    request.set_decompress_chunks(decompress_on_server_);
+    request.set_trim_chunks(trim_chunks_on_server_);
+    request.set_deduplicate_chunks(deduplicate_chunks_);
+    request.set_group_by_chunk(group_by_chunk_);
+    request.mutable_columns()->Add(columns_.begin(), columns_.end());
+    request.set_credit_flow_control(true);
+    const uint64_t trace_id = trace_sampler_->MaybeStartTrace();
+    request.set_trace_id(trace_id);
+    const absl::Time request_sent_at =
+        trace_id != 0 ? absl::Now() : absl::InfinitePast();
+
+    if (!stream->Write(request)) {
+      return {0, FromGrpcStatus(stream->Finish())};
+    }
 
-      if (!stream->Write(request)) {
-        return {num_samples_returned, FromGrpcStatus(stream->Finish())};
+    // Samples granted to the stream in total and those not yet received.
+    int64_t num_samples_granted = num_samples;
+    int64_t num_samples_in_flight = num_samples;
+    // Grants `credits` more samples to the stream. Returns false if the stream
+    // is broken.
+    auto grant = [&](int64_t credits) {
+      SampleStreamRequest credit;
+      credit.set_credits(credits);
+      num_samples_granted += credits;
+      num_samples_in_flight += credits;
+      return stream->Write(credit);
+    };
+
+    int64_t num_samples_returned = 0;
+    std::vector<SampleStreamResponse::SampleEntry> parts_of_next_sample;
+    while (num_samples_in_flight > 0) {
+      SampleStreamResponse response;
+      if (!stream->Read(&response)) {
+        auto status = FromGrpcStatus(stream->Finish());
+        if (errors::IsRateLimiterTimeout(status) &&
+            queue->num_waiting_to_pop() < 1) {
+          // The rate limiter timed out but no one is waiting for new data,
+          // so we can exit with an OkStatus and get restarted with a new
+          // stream.
+          return {num_samples_returned, absl::OkStatus()};
+        } else {
+          return {num_samples_returned, status};
+        }
+      }
+      // Entries only reference chunks sent earlier in the same response.
+      // Chunks of the previous response are kept as long as they could be
+      // needed by a partially received sample.
+      if (parts_of_next_sample.empty()) {
+        stream_chunks.ClearResponseChunks();
+        if (response_decoded_chunks.has_value()) {
+          response_decoded_chunks->Clear();
+        }
       }
+      for (auto& entry : response.entries()) {
+        parts_of_next_sample.push_back(std::move(entry));
+        // Continue grabbing entries until the current sample is complete.
+        if (!parts_of_next_sample.back().end_of_sequence()) {
+          continue;
+        }
+        if (num_samples_in_flight == 0) {
+          return {num_samples_returned,
+                  absl::InternalError(
+                      "Received more samples than were granted to the "
+                      "stream.")};
+        }
 
-      std::vector<SampleStreamResponse::SampleEntry> parts_of_next_sample;
-      for (int64_t sampled = 0; sampled < request.num_samples();) {
-        SampleStreamResponse response;
-        if (!stream->Read(&response)) {
-          auto status = FromGrpcStatus(stream->Finish());
-          if (errors::IsRateLimiterTimeout(status) &&
-              queue->num_waiting_to_pop() < 1) {
-            // The rate limiter timed out but no one is waiting for new data,
-            // so we can exit with an OkStatus and get restarted with a new
-            // stream.
-            return {num_samples_returned, absl::OkStatus()};
-          } else {
-            return {num_samples_returned, status};
-          }
+        // We have received everything we need to unpack the next sample so
+        // let's push it to the queue. We don't expect AsSample to ever fail
+        // but it will be closed if the Sampler has been closed.
+        std::unique_ptr<Sample> sample;
+        const absl::Time unpack_started_at =
+            trace_id != 0 ? absl::Now() : absl::InfinitePast();
+        auto status =
+            lazy_decoding_
+                ? AsEncodedSample(std::move(parts_of_next_sample),
+                                  &stream_chunks, &sample)
+                : AsSample(std::move(parts_of_next_sample),
+                           chunk_decoder_.get(), decoded_chunk_cache,
+                           &stream_chunks, &decode_plans_,
+                           decoding_executor_.get(), &sample);
+        parts_of_next_sample.clear();
+        if (status.ok()) {
+          status = ApplyTransforms(sample.get());
+        }
+        if (!status.ok()) {
+          return {num_samples_returned, status};
         }
-        for (auto& entry : response.entries()) {
-          parts_of_next_sample.push_back(std::move(entry));
-          // Continue grabbing entries until the current sample is complete.
-          if (!parts_of_next_sample.back().end_of_sequence()) {
-            continue;
-          }
-
-          // We have received everything we need to unpack the next sample so
-          // let's push it to the queue. We don't expect AsSample to ever fail
-          // but it will be closed if the Sampler has been closed.
-          std::unique_ptr<Sample> sample;
-          auto status = AsSample(std::move(parts_of_next_sample), &sample);
-          parts_of_next_sample.clear();
-          if (!status.ok()) {
-            return {num_samples_returned, status};
-          }
-          if (!queue->Push(std::move(sample))) {
-            return {num_samples_returned,
-                    absl::CancelledError("`Close` called on Sampler")};
-          }
-          // The sample was successfully received from the stream and pushed to
-          // the queue. There might still be more samples, or partial samples,
-          // in the same SampleStreamResponse so we'll continue reading the
-          // remaining entries into the next sample.
-          ++num_samples_returned;
-          ++sampled;
+        if (trace_id != 0) {
+          const absl::Time now = absl::Now();
+          internal::FlightRecorder::Default()->Record(
+              trace_id, internal::TraceSide::kClient, "Chunk decompression",
+              unpack_started_at, now);
+          sample->set_trace(trace_id, now);
         }
+        if (!queue->Push(std::move(sample))) {
+          return {num_samples_returned,
+                  absl::CancelledError("`Close` called on Sampler")};
+        }
+        // The sample was successfully received from the stream and pushed to
+        // the queue. There might still be more samples, or partial samples,
+        // in the same SampleStreamResponse so we'll continue reading the
+        // remaining entries into the next sample.
+        budget->OnSampleReceived();
+        ++num_samples_returned;
+        --num_samples_in_flight;
+      }
+
+      // Replace the received samples once half of the window has drained.
+      // The budget is only waited for when nothing is left in flight.
+      const int64_t max_credits =
+          std::min(samples_per_request_ - num_samples_in_flight,
+                   max_samples - num_samples_granted);
+      if (max_credits == 0 ||
+          num_samples_in_flight > samples_per_request_ / 2) {
+        continue;
       }
-      if (!parts_of_next_sample.empty()) {
-        return {num_samples_returned,
-                absl::InternalError(
-                    "Streamed responses included unattributed SampleEntry.")};
+      const int64_t credits = num_samples_in_flight == 0
+                                  ? budget->Acquire(max_credits)
+                                  : budget->TryAcquire(max_credits);
+      if (credits > 0 && !grant(credits)) {
+        return {num_samples_returned, FromGrpcStatus(stream->Finish())};
       }
     }
-
-    if (num_samples_returned != num_samples) {
+    if (!parts_of_next_sample.empty()) {
       return {num_samples_returned,
               absl::InternalError(
-                  absl::StrCat("num_samples_returned != num_samples (",
-                               num_samples_returned, " vs. ", num_samples))};
+                  "Streamed responses included unattributed SampleEntry.")};
     }
+    internal::FlightRecorder::Default()->Record(
+        trace_id, internal::TraceSide::kClient, "GrpcSamplerWorker RPC",
+        request_sent_at, absl::Now());
+
     return {num_samples_returned, absl::OkStatus()};
   }
 
@@ -297,6 +724,39 @@ class GrpcSamplerWorker : public SamplerWorker {
   // `Table::SampleFlexibleBatch` (lock not released between samples).
   const int flexible_batch_size_;
 
+  // Number of chunks received on a stream that are kept so the server can
+  // refer to them in later samples rather than sending them again.
+  const int64_t max_cached_chunks_;
+
+  // Whether the server is asked to send the chunks decompressed.
+  const bool decompress_on_server_;
+
+  // If true, the server only sends the rows of the chunks referenced by the
+  // sampled items.
+  const bool trim_chunks_on_server_;
+
+  // If true, the server sends every chunk at most once per response.
+  const bool deduplicate_chunks_;
+
+  // If true, the server groups the items of every batch by chunk.
+  const bool group_by_chunk_;
+
+  // Columns of the trajectories requested from the server, or empty for all.
+  const std::vector<int> columns_;
+
+  // Tables, and their weights, sampled instead of `table_name_` if not empty.
+  const std::vector<std::pair<std::string, double>> mixture_;
+
+  // Cache of decompressed chunk columns. May be null.
+  const std::shared_ptr<internal::DecodedChunkCache> decoded_chunk_cache_;
+
+  // Selects the requests which are traced. Shared by the workers of a sampler.
+  const std::shared_ptr<internal::TraceSampler> trace_sampler_;
+
+  // Decode plans of the trajectory layouts received by this worker. Only used
+  // by `FetchSamples`, which isn't called concurrently.
+  internal::TrajectoryDecodePlanCache decode_plans_;
+
   // Context of the active stream.
   std::unique_ptr<grpc::ClientContext> context_ ABSL_GUARDED_BY(mu_);
 
@@ -309,8 +769,15 @@ class GrpcSamplerWorker : public SamplerWorker {
 class LocalSamplerWorker : public SamplerWorker {
  public:
   // Constructs a new worker without creating a stream to a server.
-  LocalSamplerWorker(std::shared_ptr<Table> table, int flexible_batch_size)
-      : table_(table), flexible_batch_size_(flexible_batch_size) {
+  LocalSamplerWorker(
+      std::shared_ptr<Table> table, int flexible_batch_size,
+      bool reuse_decoded_chunks, std::vector<int> columns,
+      std::shared_ptr<internal::DecodedChunkCache> decoded_chunk_cache)
+      : table_(table),
+        flexible_batch_size_(flexible_batch_size),
+        reuse_decoded_chunks_(reuse_decoded_chunks),
+        columns_(std::move(columns)),
+        decoded_chunk_cache_(std::move(decoded_chunk_cache)) {
     REVERB_CHECK_GE(flexible_batch_size_, 1);
   }
 
@@ -320,13 +787,18 @@ class LocalSamplerWorker : public SamplerWorker {
   }
 
   std::pair<int64_t, absl::Status> FetchSamples(
-      internal::Queue<std::unique_ptr<Sample>>* queue, int64_t num_samples,
+      internal::LockFreeQueue<std::unique_ptr<Sample>>* queue,
+      int64_t max_samples, SampleBudget* budget,
       absl::Duration rate_limiter_timeout) override {
     static const auto kWakeupTimeout = absl::Seconds(3);
     auto final_deadline = absl::Now() + rate_limiter_timeout;
 
     int64_t num_samples_returned = 0;
-    while (num_samples_returned < num_samples) {
+
+    // Samples granted by `budget` which have not yet been sampled.
+    int64_t num_samples_granted = 0;
+
+    while (num_samples_returned < max_samples) {
       {
         absl::MutexLock lock(&mu_);
         if (closed_) {
@@ -334,6 +806,13 @@ class LocalSamplerWorker : public SamplerWorker {
         }
       }
 
+      if (num_samples_granted == 0) {
+        num_samples_granted = budget->Acquire(std::min<int64_t>(
+            flexible_batch_size_, max_samples - num_samples_returned));
+        if (num_samples_granted == 0) break;
+        final_deadline = absl::Now() + rate_limiter_timeout;
+      }
+
       // If the rate limiter deadline is long into the future then we set the
       // deadline `kWakeupTimeout` from now instead. Periodically waking up
       // allows us to check that the Sampler haven't been cancelled while we
@@ -342,9 +821,9 @@ class LocalSamplerWorker : public SamplerWorker {
           std::min(final_deadline, absl::Now() + kWakeupTimeout) - absl::Now();
 
       // Select the biggest batch size constrained by`flexible_batch_size_` and
-      // the number of samples remaining.
-      auto batch_size = std::min<int>(flexible_batch_size_,
-                                      num_samples - num_samples_returned);
+      // the number of samples granted.
+      auto batch_size =
+          std::min<int64_t>(flexible_batch_size_, num_samples_granted);
 
       std::vector<Table::SampledItem> items;
       auto status = table_->SampleFlexibleBatch(&items, batch_size, timeout);
@@ -373,29 +852,37 @@ class LocalSamplerWorker : public SamplerWorker {
       // Push sampled items to queue.
       for (const auto& item : items) {
         std::unique_ptr<Sample> sample;
-        if (status = AsSample(item, &sample); !status.ok()) {
+        if (status = lazy_decoding_
+                         ? AsEncodedSample(item, columns_, &sample)
+                         : AsSample(item, columns_, reuse_decoded_chunks_,
+                                    chunk_decoder_.get(),
+                                    decoded_chunk_cache_.get(),
+                                    decoding_executor_.get(), &sample);
+            !status.ok()) {
+          return {num_samples_returned, status};
+        }
+        if (status = ApplyTransforms(sample.get()); !status.ok()) {
           return {num_samples_returned, status};
         }
         if (!queue->Push(std::move(sample))) {
           return {num_samples_returned,
                   absl::CancelledError("`Close` called on Sampler")};
         }
+        budget->OnSampleReceived();
         ++num_samples_returned;
+        --num_samples_granted;
       }
     }
 
-    if (num_samples_returned != num_samples) {
-      return {num_samples_returned,
-              absl::InternalError(
-                  absl::StrCat("num_samples_returned != num_samples (",
-                               num_samples_returned, " vs. ", num_samples))};
-    }
     return {num_samples_returned, absl::OkStatus()};
   }
 
  private:
   std::shared_ptr<Table> table_;
   const int flexible_batch_size_;
+  const bool reuse_decoded_chunks_;
+  const std::vector<int> columns_;
+  const std::shared_ptr<internal::DecodedChunkCache> decoded_chunk_cache_;
   bool closed_ ABSL_GUARDED_BY(mu_) = false;
   absl::Mutex mu_;
 };
@@ -421,17 +908,49 @@ std::vector<std::unique_ptr<SamplerWorker>> MakeGrpcWorkers(
     const std::string& table_name, const Sampler::Options& options) {
   int64_t num_workers = GetNumWorkers(options);
   REVERB_CHECK_GE(num_workers, 1);
+  auto trace_sampler =
+      std::make_shared<internal::TraceSampler>(options.trace_sampling_period);
   std::vector<std::unique_ptr<SamplerWorker>> workers;
   workers.reserve(num_workers);
   for (int i = 0; i < num_workers; i++) {
     workers.push_back(absl::make_unique<GrpcSamplerWorker>(
         stub, table_name, options.max_in_flight_samples_per_worker,
-        options.flexible_batch_size));
+        options.flexible_batch_size, options.max_cached_chunks_per_stream,
+        options.decompress_on_server, options.trim_chunks_on_server,
+        options.deduplicate_chunks_in_responses,
+        options.group_samples_by_chunk, options.columns,
+        options.mixture, options.decoded_chunk_cache, trace_sampler));
   }
 
   return workers;
 }
 
+std::vector<std::unique_ptr<SamplerWorker>> MakeShardedGrpcWorkers(
+    const std::vector<
+        std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>& stubs,
+    const std::string& table_name, const Sampler::Options& options) {
+  REVERB_CHECK(!stubs.empty());
+  auto trace_sampler =
+      std::make_shared<internal::TraceSampler>(options.trace_sampling_period);
+  std::vector<std::unique_ptr<SamplerWorker>> workers;
+  workers.reserve(stubs.size());
+  for (const auto& stub : stubs) {
+    workers.push_back(absl::make_unique<GrpcSamplerWorker>(
+        stub, table_name, options.max_in_flight_samples_per_worker,
+        options.flexible_batch_size, options.max_cached_chunks_per_stream,
+        options.decompress_on_server, options.trim_chunks_on_server,
+        options.deduplicate_chunks_in_responses,
+        options.group_samples_by_chunk, options.columns,
+        options.mixture, options.decoded_chunk_cache, trace_sampler));
+  }
+  return workers;
+}
+
+Sampler::Options WithNumWorkers(Sampler::Options options, int num_workers) {
+  options.num_workers = num_workers;
+  return options;
+}
+
 std::vector<std::unique_ptr<SamplerWorker>> MakeLocalWorkers(
     std::shared_ptr<Table> table, const Sampler::Options& options) {
   int64_t num_workers = GetNumWorkers(options);
@@ -454,8 +973,9 @@ std::vector<std::unique_ptr<SamplerWorker>> MakeLocalWorkers(
   std::vector<std::unique_ptr<SamplerWorker>> workers;
   workers.reserve(num_workers);
   for (int i = 0; i < num_workers; ++i) {
-    workers.push_back(
-        absl::make_unique<LocalSamplerWorker>(table, flexible_batch_size));
+    workers.push_back(absl::make_unique<LocalSamplerWorker>(
+        table, flexible_batch_size, options.reuse_decoded_chunks,
+        options.columns, options.decoded_chunk_cache));
   }
   return workers;
 }
@@ -468,6 +988,19 @@ Sampler::Sampler(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> s
     : Sampler(MakeGrpcWorkers(std::move(stub), table_name, options), table_name,
               options, std::move(dtypes_and_shapes)) {}
 
+Sampler::Sampler(
+    const std::vector<
+        std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>& stubs,
+    const std::string& table_name, const Options& options,
+    internal::DtypesAndShapes dtypes_and_shapes)
+    : Sampler(MakeShardedGrpcWorkers(stubs, table_name, options), table_name,
+              WithNumWorkers(options, stubs.size()),
+              std::move(dtypes_and_shapes)) {}
+
+int64_t Sampler::NumGrpcWorkers(const Options& options) {
+  return GetNumWorkers(options);
+}
+
 Sampler::Sampler(std::vector<std::unique_ptr<SamplerWorker>> workers,
                  const std::string& table, const Options& options,
                  internal::DtypesAndShapes dtypes_and_shapes)
@@ -479,9 +1012,25 @@ Sampler::Sampler(std::vector<std::unique_ptr<SamplerWorker>> workers,
                                   ? kDefaultMaxSamplesPerStream
                                   : options.max_samples_per_stream),
       rate_limiter_timeout_(options.rate_limiter_timeout),
+      worker_stall_timeout_(options.worker_stall_timeout),
       workers_(std::move(workers)),
+      worker_states_(workers_.size()),
+      autotuner_(options.autotune
+                     ? absl::make_unique<internal::SamplerAutoTuner>(
+                           workers_.size(),
+                           options.max_in_flight_samples_per_worker,
+                           std::max<int>(options.num_workers, 1))
+                     : nullptr),
+      num_active_workers_limit_(workers_.size()),
       active_sample_(nullptr),
       samples_(std::max<int>(options.num_workers, 1)),
+      output_allocator_(options.output_allocator),
+      decoding_executor_(
+          options.num_decoding_threads > 0
+              ? std::make_shared<TaskExecutor>(options.num_decoding_threads,
+                                               "SamplerDecoder")
+              : nullptr),
+      tracing_(options.trace_sampling_period > 0),
       dtypes_and_shapes_(std::move(dtypes_and_shapes)) {
   REVERB_CHECK_GT(max_samples_, 0);
   REVERB_CHECK_GT(options.max_in_flight_samples_per_worker, 0);
@@ -490,10 +1039,15 @@ Sampler::Sampler(std::vector<std::unique_ptr<SamplerWorker>> workers,
   REVERB_CHECK(options.flexible_batch_size == kAutoSelectValue ||
                options.flexible_batch_size > 0);
 
+  for (auto& worker : workers_) {
+    worker->set_decoding_executor(decoding_executor_);
+    worker->set_transforms(options.transforms);
+    worker->set_lazy_decoding(options.lazy_decoding);
+    worker->set_chunk_decoder(options.chunk_decoder);
+  }
   for (int i = 0; i < workers_.size(); i++) {
     worker_threads_.push_back(internal::StartThread(
-        absl::StrCat("SamplerWorker_", i),
-        [this, worker = workers_[i].get()] { RunWorker(worker); }));
+        absl::StrCat("SamplerWorker_", i), [this, i] { RunWorker(i); }));
   }
 }
 
@@ -537,7 +1091,8 @@ absl::Status Sampler::GetNextSample(std::vector<tensorflow::Tensor>* data,
                                     bool* rate_limited) {
   std::unique_ptr<Sample> sample;
   REVERB_RETURN_IF_ERROR(PopNextSample(&sample));
-  REVERB_RETURN_IF_ERROR(sample->AsBatchedTimesteps(data));
+  REVERB_RETURN_IF_ERROR(
+      sample->AsBatchedTimesteps(data, decoding_executor_.get()));
   REVERB_RETURN_IF_ERROR(
       ValidateAgainstOutputSpec(*data, ValidationMode::kBatchedTimestep));
 
@@ -550,11 +1105,51 @@ absl::Status Sampler::GetNextSample(std::vector<tensorflow::Tensor>* data,
   return absl::OkStatus();
 }
 
+absl::Status Sampler::GetNextWindow(int64_t length, int64_t shift,
+                                    std::vector<tensorflow::Tensor>* data,
+                                    bool* rate_limited) {
+  if (length <= 0 || shift <= 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Window length (", length, ") and shift (", shift,
+                     ") must be positive."));
+  }
+
+  // Samples which are too short to make up a single window are dropped.
+  while (true) {
+    REVERB_RETURN_IF_ERROR(MaybeSampleNext());
+    if (!active_sample_->is_composed_of_timesteps()) {
+      return absl::InvalidArgumentError(
+          "Sampled trajectory cannot be decomposed into timesteps.");
+    }
+    if (active_sample_->num_remaining_timesteps() >= length) break;
+
+    active_sample_ = nullptr;
+    absl::WriterMutexLock lock(&mu_);
+    if (++returned_ == max_samples_) samples_.Close();
+  }
+
+  if (rate_limited != nullptr) {
+    *rate_limited = active_sample_->rate_limited();
+  }
+
+  REVERB_RETURN_IF_ERROR(active_sample_->GetNextWindow(length, shift, data));
+  REVERB_RETURN_IF_ERROR(
+      ValidateAgainstOutputSpec(*data, ValidationMode::kBatchedTimestep));
+
+  if (active_sample_->is_end_of_sample()) {
+    absl::WriterMutexLock lock(&mu_);
+    if (++returned_ == max_samples_) samples_.Close();
+  }
+
+  return absl::OkStatus();
+}
+
 absl::Status Sampler::GetNextTrajectory(std::vector<tensorflow::Tensor>* data,
                                         bool* rate_limited) {
   std::unique_ptr<Sample> sample;
   REVERB_RETURN_IF_ERROR(PopNextSample(&sample));
-  REVERB_RETURN_IF_ERROR(sample->AsTrajectory(data));
+  REVERB_RETURN_IF_ERROR(sample->AsTrajectory(data, output_allocator_,
+                                              decoding_executor_.get()));
   REVERB_RETURN_IF_ERROR(
       ValidateAgainstOutputSpec(*data, ValidationMode::kTrajectory));
 
@@ -567,12 +1162,88 @@ absl::Status Sampler::GetNextTrajectory(std::vector<tensorflow::Tensor>* data,
   return absl::OkStatus();
 }
 
+absl::Status Sampler::GetNextLazySample(std::unique_ptr<Sample>* sample,
+                                        bool* rate_limited) {
+  REVERB_RETURN_IF_ERROR(PopNextEncodedSample(sample));
+
+  if (rate_limited != nullptr) {
+    *rate_limited = (*sample)->rate_limited();
+  }
+
+  absl::WriterMutexLock lock(&mu_);
+  if (++returned_ == max_samples_) samples_.Close();
+  return absl::OkStatus();
+}
+
+absl::Status Sampler::GetNextBatch(int batch_size,
+                                   std::vector<tensorflow::Tensor>* data,
+                                   bool* rate_limited) {
+  if (batch_size <= 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("batch_size must be > 0 but got ", batch_size, "."));
+  }
+  {
+    // The workers stop once `max_samples_` have been requested so the batch
+    // cannot be completed if it is larger than the number of remaining
+    // samples.
+    absl::ReaderMutexLock lock(&mu_);
+    if (returned_ < max_samples_ && max_samples_ - returned_ < batch_size) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "batch_size (", batch_size, ") is larger than the number of samples ",
+          "remaining before `max_samples` is reached (",
+          max_samples_ - returned_, ")."));
+    }
+  }
+
+  std::vector<tensorflow::Tensor> batch;
+  bool any_rate_limited = false;
+  for (int i = 0; i < batch_size; i++) {
+    std::unique_ptr<Sample> sample;
+    REVERB_RETURN_IF_ERROR(PopNextSample(&sample));
+    if (i == 0) {
+      REVERB_RETURN_IF_ERROR(
+          sample->AllocateBatch(batch_size, &batch, output_allocator_));
+      REVERB_RETURN_IF_ERROR(
+          ValidateAgainstOutputSpec(batch, ValidationMode::kBatchedTrajectory));
+    }
+    REVERB_RETURN_IF_ERROR(sample->CopyToBatch(i, &batch));
+    any_rate_limited |= sample->rate_limited();
+  }
+
+  std::swap(batch, *data);
+  if (rate_limited != nullptr) {
+    *rate_limited = any_rate_limited;
+  }
+
+  absl::WriterMutexLock lock(&mu_);
+  returned_ += batch_size;
+  if (returned_ == max_samples_) samples_.Close();
+  return absl::OkStatus();
+}
+
 absl::Status Sampler::ValidateAgainstOutputSpec(
     const std::vector<tensorflow::Tensor>& data, Sampler::ValidationMode mode) {
   if (!dtypes_and_shapes_) {
     return absl::OkStatus();
   }
 
+  ValidatedLayout layout;
+  layout.push_back(static_cast<int64_t>(mode));
+  layout.push_back(data.size());
+  for (int i = 4; i < data.size(); ++i) {
+    layout.push_back(data[i].dtype());
+    layout.push_back(data[i].dims());
+    for (int d = 0; d < data[i].dims(); ++d) {
+      layout.push_back(data[i].dim_size(d));
+    }
+  }
+  {
+    absl::ReaderMutexLock lock(&validated_layouts_mu_);
+    if (validated_layouts_.contains(layout)) {
+      return absl::OkStatus();
+    }
+  }
+
   if (data.size() != dtypes_and_shapes_->size()) {
     return absl::InvalidArgumentError(absl::StrCat(
         "Inconsistent number of tensors received from table '", table_,
@@ -586,9 +1257,11 @@ absl::Status Sampler::ValidateAgainstOutputSpec(
 
   for (int i = 4; i < data.size(); ++i) {
     tensorflow::TensorShape elem_shape;
-    if (mode == ValidationMode::kBatchedTimestep) {
+    if (mode == ValidationMode::kBatchedTimestep ||
+        mode == ValidationMode::kBatchedTrajectory) {
       // Remove the outer dimension from data[i].shape() so we can properly
-      // compare against the spec (which doesn't have the sequence dimension).
+      // compare against the spec (which doesn't have the sequence or batch
+      // dimension).
       elem_shape = data[i].shape();
       if (elem_shape.dims() == 0) {
         return absl::InvalidArgumentError(
@@ -619,6 +1292,11 @@ absl::Status Sampler::ValidateAgainstOutputSpec(
           internal::DtypesShapesString(*dtypes_and_shapes_)));
     }
   }
+
+  absl::WriterMutexLock lock(&validated_layouts_mu_);
+  if (validated_layouts_.size() < kMaxValidatedLayouts) {
+    validated_layouts_.insert(std::move(layout));
+  }
   return absl::OkStatus();
 }
 
@@ -626,6 +1304,19 @@ bool Sampler::should_stop_workers() const {
   return closed_ || returned_ == max_samples_ || !worker_status_.ok();
 }
 
+bool Sampler::is_active_worker(int index) const {
+  return index < num_active_workers_limit_ &&
+         (autotuner_ == nullptr || index < autotuner_->num_active_workers());
+}
+
+void Sampler::SetWorkerLimits(int num_active_workers,
+                              int64_t max_samples_per_request) {
+  absl::MutexLock lock(&mu_);
+  num_active_workers_limit_ = std::max(1, num_active_workers);
+  max_samples_per_request_limit_ =
+      std::max<int64_t>(1, max_samples_per_request);
+}
+
 void Sampler::Close() {
   {
     absl::WriterMutexLock lock(&mu_);
@@ -650,7 +1341,25 @@ absl::Status Sampler::MaybeSampleNext() {
 }
 
 absl::Status Sampler::PopNextSample(std::unique_ptr<Sample>* sample) {
-  if (samples_.Pop(sample)) return absl::OkStatus();
+  REVERB_RETURN_IF_ERROR(PopNextEncodedSample(sample));
+  return (*sample)->DecodeColumns(decoding_executor_.get());
+}
+
+absl::Status Sampler::PopNextEncodedSample(std::unique_ptr<Sample>* sample) {
+  const absl::Time pop_started_at =
+      tracing_ ? absl::Now() : absl::InfinitePast();
+  if (autotuner_ != nullptr) {
+    int queue_depth = samples_.size();
+    if (samples_.Pop(sample)) {
+      absl::WriterMutexLock lock(&mu_);
+      autotuner_->OnSamplePopped(queue_depth);
+      RecordPoppedSample(**sample, pop_started_at);
+      return absl::OkStatus();
+    }
+  } else if (samples_.Pop(sample)) {
+    RecordPoppedSample(**sample, pop_started_at);
+    return absl::OkStatus();
+  }
 
   absl::ReaderMutexLock lock(&mu_);
   if (returned_ == max_samples_) {
@@ -662,34 +1371,37 @@ absl::Status Sampler::PopNextSample(std::unique_ptr<Sample>* sample) {
   return worker_status_;
 }
 
-void Sampler::RunWorker(SamplerWorker* worker) {
+void Sampler::RunWorker(int index) {
+  // When stalled workers can be taken over then the worker must be able to
+  // open a stream even when all the samples have already been requested.
+  // The stream then blocks in `AcquireSamples` until it has something to do.
   auto trigger = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
-    return should_stop_workers() || requested_ < max_samples_;
+    return should_stop_workers() || requested_ < max_samples_ ||
+           worker_stall_timeout_ != absl::InfiniteDuration();
   };
 
+  WorkerBudget budget(this, index);
   while (true) {
-    mu_.LockWhen(absl::Condition(&trigger));
-
-    if (should_stop_workers()) {
-      mu_.Unlock();
-      return;
+    {
+      absl::MutexLock lock(&mu_, absl::Condition(&trigger));
+      if (should_stop_workers()) {
+        return;
+      }
     }
 
-    int64_t samples_to_stream =
-        std::min<int64_t>(max_samples_per_stream_, max_samples_ - requested_);
-    requested_ += samples_to_stream;
-    mu_.Unlock();
+    // The samples of the stream are acquired from the budget one request at a
+    // time so the samples left once `max_samples_` is close to being reached
+    // are spread over the workers which are still making progress.
+    auto result = workers_[index]->FetchSamples(
+        &samples_, max_samples_per_stream_, &budget, rate_limiter_timeout_);
+
+    // If the stream was closed prematurely then the samples which are still in
+    // flight will never arrive.
+    ReleaseInFlightSamples(index);
 
-    auto result = worker->FetchSamples(&samples_, samples_to_stream,
-                                       rate_limiter_timeout_);
     {
       absl::WriterMutexLock lock(&mu_);
 
-      // If the stream was closed prematurely then we need to reduce the number
-      // of requested samples by the difference of the expected number and the
-      // actual.
-      requested_ -= samples_to_stream - result.first;
-
       // Overwrite the final status only if it wasn't already an error.
       if (worker_status_.ok() && !result.second.ok() &&
           !absl::IsUnavailable(result.second)) {
@@ -701,6 +1413,116 @@ void Sampler::RunWorker(SamplerWorker* worker) {
   }
 }
 
+int64_t Sampler::AcquireSamples(int index, int64_t max_samples, bool wait) {
+  REVERB_CHECK_GT(max_samples, 0);
+  auto can_acquire = [this, index]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return should_stop_workers() ||
+           (requested_ < max_samples_ && is_active_worker(index));
+  };
+
+  absl::MutexLock lock(&mu_);
+  while (true) {
+    if (should_stop_workers()) return 0;
+
+    // Workers deactivated by the autotuner stay idle until they are activated
+    // again (or the sampler is closed).
+    if (!is_active_worker(index)) {
+      if (!wait) return 0;
+      mu_.Await(absl::Condition(&can_acquire));
+      continue;
+    }
+
+    if (autotuner_ != nullptr) {
+      max_samples = std::min(max_samples, autotuner_->batch_size());
+    }
+    max_samples = std::min(max_samples, max_samples_per_request_limit_);
+
+    if (requested_ < max_samples_) {
+      int64_t num_samples =
+          std::min<int64_t>(max_samples, max_samples_ - requested_);
+      requested_ += num_samples;
+      auto& state = worker_states_[index];
+      if (state.in_flight == 0) state.last_progress = absl::Now();
+      state.in_flight += num_samples;
+      return num_samples;
+    }
+
+    if (worker_stall_timeout_ == absl::InfiniteDuration()) {
+      if (!wait) return 0;
+      mu_.Await(absl::Condition(&can_acquire));
+      continue;
+    }
+
+    if (int64_t stolen = StealFromStalledWorker(index, max_samples);
+        stolen > 0 || !wait) {
+      return stolen;
+    }
+    // Wake up periodically to check whether any of the workers have stalled.
+    mu_.AwaitWithTimeout(absl::Condition(&can_acquire),
+                         worker_stall_timeout_ / 2);
+  }
+}
+
+int64_t Sampler::StealFromStalledWorker(int thief, int64_t max_samples) {
+  const absl::Time now = absl::Now();
+  for (int i = 0; i < worker_states_.size(); i++) {
+    auto& victim = worker_states_[i];
+    if (i == thief || victim.in_flight == 0 ||
+        now - victim.last_progress < worker_stall_timeout_) {
+      continue;
+    }
+
+    int64_t num_samples = std::min(max_samples, victim.in_flight);
+    victim.in_flight -= num_samples;
+    victim.stolen += num_samples;
+
+    auto& state = worker_states_[thief];
+    if (state.in_flight == 0) state.last_progress = now;
+    state.in_flight += num_samples;
+    return num_samples;
+  }
+  return 0;
+}
+
+void Sampler::OnSampleReceived(int index) {
+  absl::MutexLock lock(&mu_);
+  auto& state = worker_states_[index];
+  state.last_progress = absl::Now();
+  state.received++;
+
+  // Samples which were taken over by other workers are surplus and thus do
+  // not count against the budget.
+  if (state.in_flight > 0) state.in_flight--;
+}
+
+void Sampler::ReleaseInFlightSamples(int index) {
+  absl::MutexLock lock(&mu_);
+  auto& state = worker_states_[index];
+  requested_ -= state.in_flight;
+  state.in_flight = 0;
+}
+
+absl::Status SamplerWorker::ApplyTransforms(Sample* sample) const {
+  if (transforms_.empty()) return absl::OkStatus();
+  return sample->ApplyTransforms(transforms_, decoding_executor_.get());
+}
+
+std::vector<Sampler::WorkerStats> Sampler::GetWorkerStats() const {
+  absl::ReaderMutexLock lock(&mu_);
+  const absl::Time now = absl::Now();
+  std::vector<WorkerStats> stats(worker_states_.size());
+  for (int i = 0; i < worker_states_.size(); i++) {
+    const auto& state = worker_states_[i];
+    stats[i].in_flight_samples = state.in_flight;
+    stats[i].stall_time = state.in_flight > 0 ? now - state.last_progress
+                                              : absl::ZeroDuration();
+    stats[i].received_samples = state.received;
+    stats[i].stolen_samples = state.stolen;
+    stats[i].active = is_active_worker(i);
+  }
+  return stats;
+}
+
 Sample::Sample(tensorflow::uint64 key, double probability,
                tensorflow::int64 table_size, double priority, bool rate_limited,
                std::vector<std::vector<tensorflow::Tensor>> column_chunks,
@@ -726,17 +1548,122 @@ Sample::Sample(tensorflow::uint64 key, double probability,
     columns_.push_back(std::move(slices));
   }
 
-  if (is_composed_of_timesteps()) {
-    num_timesteps_ = 0;
-    for (const auto& column_slice : columns_.front()) {
-      // Note that we can safely assume that the tensor is not a scalar since a
-      // batch dimension is always added when building a chunk. A scalar would
-      // thus be represented as a tensor of shape [1].
-      num_timesteps_ += column_slice.tensor.dim_size(0);
+  num_timesteps_ = CountTimesteps();
+}
+
+Sample::Sample(tensorflow::uint64 key, double probability,
+               tensorflow::int64 table_size, double priority, bool rate_limited,
+               std::vector<std::vector<EncodedSlice>> encoded_columns,
+               std::vector<bool> squeeze_columns)
+    : key_(key),
+      probability_(probability),
+      table_size_(table_size),
+      priority_(priority),
+      rate_limited_(rate_limited),
+      num_timesteps_(-1),
+      columns_(encoded_columns.size()),
+      encoded_columns_(std::move(encoded_columns)),
+      squeeze_columns_(std::move(squeeze_columns)),
+      next_timestep_called_(false) {
+  REVERB_CHECK(!encoded_columns_.empty()) << "Must provide at least one chunk.";
+  REVERB_CHECK(!encoded_columns_.front().empty())
+      << "Chunks must hold at least one tensor.";
+}
+
+int64_t Sample::CountTimesteps() const {
+  if (!is_composed_of_timesteps()) return -1;
+  int64_t num_timesteps = 0;
+  for (const auto& column_slice : columns_.front()) {
+    // Note that we can safely assume that the tensor is not a scalar since a
+    // batch dimension is always added when building a chunk. A scalar would
+    // thus be represented as a tensor of shape [1].
+    num_timesteps += column_slice.tensor.dim_size(0);
+  }
+  return num_timesteps;
+}
+
+absl::Status Sample::DecodeColumn(int i) {
+  if (encoded_columns_.empty() || encoded_columns_[i].empty()) {
+    return absl::OkStatus();
+  }
+  std::deque<ColumnChunk> column;
+  for (const auto& encoded : encoded_columns_[i]) {
+    // The data of chunks subject to tiered storage must be pinned while it is
+    // being decoded.
+    ChunkStore::Chunk::DataPin pin = encoded.chunk->Pin();
+    tensorflow::Tensor tensor;
+    REVERB_RETURN_IF_ERROR(internal::UnpackChunkColumnAndSlice(
+        pin.data(), encoded.slice, &tensor));
+    column.push_back({std::move(tensor), 0});
+  }
+  columns_[i] = std::move(column);
+  // Release the chunks as they are no longer needed by this column.
+  encoded_columns_[i].clear();
+  return absl::OkStatus();
+}
+
+absl::Status Sample::DecodeColumns(TaskExecutor* executor) {
+  if (encoded_columns_.empty()) return absl::OkStatus();
+  REVERB_RETURN_IF_ERROR(ParallelForWithStatus(
+      executor, columns_.size(),
+      [this](int64_t i) { return DecodeColumn(i); }));
+  encoded_columns_.clear();
+  num_timesteps_ = CountTimesteps();
+  return absl::OkStatus();
+}
+
+absl::Status Sample::GetColumn(int i, tensorflow::Tensor* column) {
+  if (next_timestep_called_) {
+    return absl::DataLossError(
+        "Sample::GetColumn: Some time steps have been lost.");
+  }
+  if (i < 0 || i >= columns_.size()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Column ", i, " is out of range for a sample with ",
+                     columns_.size(), " columns."));
+  }
+  REVERB_RETURN_IF_ERROR(DecodeColumn(i));
+
+  // The chunks are concatenated once so repeated calls don't copy the column.
+  auto& chunks = columns_[i];
+  if (chunks.size() > 1) {
+    std::vector<tensorflow::Tensor> tensors;
+    tensors.reserve(chunks.size());
+    for (const auto& chunk : chunks) {
+      tensors.push_back(chunk.tensor);
     }
+    tensorflow::Tensor concatenated;
+    REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
+        tensorflow::tensor::Concat(tensors, &concatenated)));
+    chunks.clear();
+    chunks.push_back({std::move(concatenated), 0});
   }
+
+  tensorflow::Tensor tensor = chunks.front().tensor;
+  if (squeeze_columns_[i]) {
+    if (int batch_dim = tensor.dim_size(0); batch_dim != 1) {
+      return absl::InternalError(absl::StrCat(
+          "Tried to squeeze column with batch size ", batch_dim, "."));
+    }
+    tensor = tensor.SubSlice(0);
+    if (!tensor.IsAligned()) {
+      tensor = tensorflow::tensor::DeepCopy(tensor);
+    }
+  }
+  *column = std::move(tensor);
+  return absl::OkStatus();
 }
 
+int Sample::num_columns() const { return columns_.size(); }
+
+tensorflow::uint64 Sample::key() const { return key_; }
+
+double Sample::probability() const { return probability_; }
+
+tensorflow::int64 Sample::table_size() const { return table_size_; }
+
+double Sample::priority() const { return priority_; }
+
 std::vector<tensorflow::Tensor> Sample::GetNextTimestep() {
   REVERB_CHECK(!is_end_of_sample());
   REVERB_CHECK(is_composed_of_timesteps());
@@ -778,8 +1705,10 @@ bool Sample::is_composed_of_timesteps() const {
     for (const auto& column_slice : col) {
       // Note that we can safely assume that the tensor is not a scalar since a
       // batch dimension is always added when building a chunk. A scalar would
-      // thus be represented as a tensor of shape [1].
-      column_length += column_slice.tensor.dim_size(0);
+      // thus be represented as a tensor of shape [1]. The timesteps which have
+      // already been returned are not counted as the chunk boundaries of the
+      // columns may differ.
+      column_length += column_slice.tensor.dim_size(0) - column_slice.offset;
     }
 
     if (prev_column_length != -1 && prev_column_length != column_length) {
@@ -792,7 +1721,17 @@ bool Sample::is_composed_of_timesteps() const {
 
 bool Sample::rate_limited() const { return rate_limited_; }
 
-absl::Status Sample::AsBatchedTimesteps(std::vector<tensorflow::Tensor>* data) {
+uint64_t Sample::trace_id() const { return trace_id_; }
+
+absl::Time Sample::queued_at() const { return queued_at_; }
+
+void Sample::set_trace(uint64_t trace_id, absl::Time queued_at) {
+  trace_id_ = trace_id;
+  queued_at_ = queued_at;
+}
+
+absl::Status Sample::AsBatchedTimesteps(std::vector<tensorflow::Tensor>* data,
+                                        TaskExecutor* executor) {
   if (next_timestep_called_) {
     return absl::DataLossError(
         "Sample::AsBatchedTimesteps: Some time steps have been lost.");
@@ -812,20 +1751,117 @@ absl::Status Sample::AsBatchedTimesteps(std::vector<tensorflow::Tensor>* data) {
   sequences[3] = InitializeTensor(priority_, num_timesteps_);
 
   // Unpack the data columns.
-  REVERB_RETURN_IF_ERROR(UnpackColumns(&sequences));
+  REVERB_RETURN_IF_ERROR(UnpackColumns(&sequences, executor));
 
   std::swap(sequences, *data);
 
   return absl::OkStatus();
 }
 
-absl::Status Sample::AsTrajectory(std::vector<tensorflow::Tensor>* data) {
+absl::Status Sample::GetNextWindow(int64_t length, int64_t shift,
+                                   std::vector<tensorflow::Tensor>* data) {
+  if (!is_composed_of_timesteps()) {
+    return absl::FailedPreconditionError(
+        "Sample::GetNextWindow when trajectory cannot be decomposed into "
+        "timesteps.");
+  }
+  if (const int64_t remaining = num_remaining_timesteps(); remaining < length) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("Sample::GetNextWindow: Window of length ", length,
+                     " requested but only ", remaining, " timesteps remain."));
+  }
+
+  next_timestep_called_ = true;
+
+  std::vector<tensorflow::Tensor> window(columns_.size() + 4);
+  window[0] = InitializeTensor(key_, length);
+  window[1] = InitializeTensor(probability_, length);
+  window[2] = InitializeTensor(table_size_, length);
+  window[3] = InitializeTensor(priority_, length);
+
+  for (int i = 0; i < columns_.size(); i++) {
+    const tensorflow::Tensor& first = columns_[i].front().tensor;
+    tensorflow::TensorShape shape = first.shape();
+    shape.set_dim(0, length);
+    tensorflow::Tensor column(first.dtype(), shape);
+    const int64_t row_size = shape.num_elements() / length;
+
+    // Copy the remaining rows of each chunk until the window is full.
+    int64_t copied = 0;
+    for (auto it = columns_[i].begin(); copied < length; ++it) {
+      const int64_t rows =
+          std::min(length - copied, it->tensor.dim_size(0) - it->offset);
+      CopyElements(it->tensor.Slice(it->offset, it->offset + rows),
+                   copied * row_size, &column);
+      copied += rows;
+    }
+    window[i + 4] = std::move(column);
+  }
+
+  SkipTimesteps(std::min(shift, num_remaining_timesteps()));
+  if (const int64_t remaining = num_remaining_timesteps(); remaining < length) {
+    SkipTimesteps(remaining);
+  }
+
+  std::swap(window, *data);
+  return absl::OkStatus();
+}
+
+int64_t Sample::num_remaining_timesteps() const {
+  if (columns_.empty()) return 0;
+  int64_t remaining = 0;
+  for (const auto& column_chunk : columns_.front()) {
+    remaining += column_chunk.tensor.dim_size(0) - column_chunk.offset;
+  }
+  return remaining;
+}
+
+void Sample::SkipTimesteps(int64_t num_timesteps) {
+  for (auto& column : columns_) {
+    int64_t skipped = 0;
+    while (skipped < num_timesteps) {
+      ColumnChunk& front = column.front();
+      const int64_t rows = std::min(num_timesteps - skipped,
+                                    front.tensor.dim_size(0) - front.offset);
+      front.offset += rows;
+      skipped += rows;
+      if (front.offset == front.tensor.dim_size(0)) {
+        column.pop_front();
+      }
+    }
+  }
+}
+
+absl::Status Sample::AsTrajectory(std::vector<tensorflow::Tensor>* data,
+                                  tensorflow::Allocator* allocator,
+                                  TaskExecutor* executor) {
   if (next_timestep_called_) {
     return absl::DataLossError(
         "Sample::AsBatchedTimesteps: Some time steps have been lost.");
   }
   std::vector<tensorflow::Tensor> sequences(columns_.size() + 4);
 
+  if (allocator != nullptr) {
+    sequences[0] = tensorflow::Tensor(allocator, tensorflow::DT_UINT64,
+                                      tensorflow::TensorShape());
+    sequences[0].scalar<tensorflow::uint64>()() = key_;
+    sequences[1] = tensorflow::Tensor(allocator, tensorflow::DT_DOUBLE,
+                                      tensorflow::TensorShape());
+    sequences[1].scalar<double>()() = probability_;
+    sequences[2] = tensorflow::Tensor(allocator, tensorflow::DT_INT64,
+                                      tensorflow::TensorShape());
+    sequences[2].scalar<tensorflow::int64>()() = table_size_;
+    sequences[3] = tensorflow::Tensor(allocator, tensorflow::DT_DOUBLE,
+                                      tensorflow::TensorShape());
+    sequences[3].scalar<double>()() = priority_;
+
+    // The squeezed shapes are allocated up front so there is nothing left to
+    // remove afterwards.
+    REVERB_RETURN_IF_ERROR(CopyColumns(allocator, executor, &sequences));
+    std::swap(sequences, *data);
+    return absl::OkStatus();
+  }
+
   // Initialize the first four items with the key, probability, table size and
   // priority.
   sequences[0] = ScalarTensor(key_);
@@ -834,7 +1870,7 @@ absl::Status Sample::AsTrajectory(std::vector<tensorflow::Tensor>* data) {
   sequences[3] = ScalarTensor(priority_);
 
   // Unpack the data columns.
-  REVERB_RETURN_IF_ERROR(UnpackColumns(&sequences));
+  REVERB_RETURN_IF_ERROR(UnpackColumns(&sequences, executor));
 
   // Remove batch dimension from squeezed columns.
   for (int i = 0; i < squeeze_columns_.size(); i++) {
@@ -855,30 +1891,190 @@ absl::Status Sample::AsTrajectory(std::vector<tensorflow::Tensor>* data) {
   return absl::OkStatus();
 }
 
-absl::Status Sample::UnpackColumns(std::vector<tensorflow::Tensor>* data) {
-  REVERB_CHECK_EQ(data->size(), columns_.size() + 4);
+absl::Status Sample::ColumnShape(int i, tensorflow::TensorShape* shape) const {
+  const auto& column = columns_[i];
+  REVERB_CHECK(!column.empty());
 
-  int64_t i = 4;
-  for (const auto& column : columns_) {
-    // If the column is made up of a single batched tensor then there will be no
-    // need for concatenation so we can save ourselves a copy by simply moving
-    // the one (unpacked) chunk into sequences.
-    if (column.size() == 1) {
-      data->at(i++) = std::move(column.front().tensor);
-    } else {
-      std::vector<tensorflow::Tensor> column_tensors;
-      column_tensors.reserve(column.size());
-      for (auto& slice : column) {
-        column_tensors.push_back(std::move(slice.tensor));
-      }
+  int64_t length = 0;
+  for (const auto& column_chunk : column) {
+    length += column_chunk.tensor.dim_size(0);
+  }
+  *shape = column.front().tensor.shape();
+  shape->set_dim(0, length);
 
-      REVERB_RETURN_IF_ERROR(FromTensorflowStatus(
-          tensorflow::tensor::Concat(column_tensors, &data->at(i++))));
+  if (squeeze_columns_[i]) {
+    if (length != 1) {
+      return absl::InternalError(absl::StrCat(
+          "Tried to squeeze column with batch size ", length, "."));
     }
+    shape->RemoveDim(0);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Sample::AllocateBatch(int64_t batch_size,
+                                   std::vector<tensorflow::Tensor>* batch,
+                                   tensorflow::Allocator* allocator) const {
+  if (allocator == nullptr) {
+    allocator = tensorflow::cpu_allocator();
+  }
+  batch->clear();
+  batch->reserve(columns_.size() + 4);
+  tensorflow::TensorShape info_shape({batch_size});
+  batch->emplace_back(allocator, tensorflow::DT_UINT64, info_shape);
+  batch->emplace_back(allocator, tensorflow::DT_DOUBLE, info_shape);
+  batch->emplace_back(allocator, tensorflow::DT_INT64, info_shape);
+  batch->emplace_back(allocator, tensorflow::DT_DOUBLE, info_shape);
+
+  for (int i = 0; i < columns_.size(); i++) {
+    tensorflow::TensorShape shape;
+    REVERB_RETURN_IF_ERROR(ColumnShape(i, &shape));
+    shape.InsertDim(0, batch_size);
+    batch->emplace_back(allocator, columns_[i].front().tensor.dtype(), shape);
   }
   return absl::OkStatus();
 }
 
+absl::Status Sample::CopyToBatch(int64_t index,
+                                 std::vector<tensorflow::Tensor>* batch) const {
+  if (next_timestep_called_) {
+    return absl::DataLossError(
+        "Sample::CopyToBatch: Some time steps have been lost.");
+  }
+  REVERB_CHECK_EQ(batch->size(), columns_.size() + 4);
+
+  (*batch)[0].flat<tensorflow::uint64>()(index) = key_;
+  (*batch)[1].flat<double>()(index) = probability_;
+  (*batch)[2].flat<tensorflow::int64>()(index) = table_size_;
+  (*batch)[3].flat<double>()(index) = priority_;
+
+  for (int i = 0; i < columns_.size(); i++) {
+    tensorflow::Tensor* dst = &(*batch)[i + 4];
+    tensorflow::TensorShape row_shape = dst->shape();
+    row_shape.RemoveDim(0);
+
+    tensorflow::TensorShape shape;
+    REVERB_RETURN_IF_ERROR(ColumnShape(i, &shape));
+    if (columns_[i].front().tensor.dtype() != dst->dtype() ||
+        shape != row_shape) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Column ", i, " of the sample has (dtype, shape): (",
+          tensorflow::DataTypeString(columns_[i].front().tensor.dtype()), ", ",
+          shape.DebugString(), ") but the batch expects (",
+          tensorflow::DataTypeString(dst->dtype()), ", ",
+          row_shape.DebugString(),
+          "). All samples in a batch must have the same dtypes and shapes."));
+    }
+
+    // The chunks of the column are laid out back to back in the row.
+    int64_t offset = index * row_shape.num_elements();
+    for (const auto& column_chunk : columns_[i]) {
+      CopyElements(column_chunk.tensor, offset, dst);
+      offset += column_chunk.tensor.NumElements();
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Sample::ApplyTransforms(
+    const std::vector<std::shared_ptr<const SampleTransform>>& transforms,
+    TaskExecutor* executor) {
+  if (next_timestep_called_) {
+    return absl::DataLossError(
+        "Sample::ApplyTransforms: Some time steps have been lost.");
+  }
+  REVERB_RETURN_IF_ERROR(DecodeColumns(executor));
+
+  std::vector<tensorflow::Tensor> trajectory;
+  REVERB_RETURN_IF_ERROR(AsTrajectory(&trajectory, nullptr, executor));
+  std::vector<tensorflow::Tensor> transformed(
+      std::make_move_iterator(trajectory.begin() + 4),
+      std::make_move_iterator(trajectory.end()));
+  for (const auto& transform : transforms) {
+    REVERB_RETURN_IF_ERROR(transform->Apply(&transformed));
+  }
+  if (transformed.size() != columns_.size()) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Sample transforms must not change the number of columns but the ",
+        columns_.size(), " columns of the trajectory were transformed into ",
+        transformed.size(), " columns."));
+  }
+
+  // Every column is now made up of a single chunk. Squeezed columns get back
+  // the batch dimension which `AsTrajectory` removes.
+  for (int i = 0; i < columns_.size(); i++) {
+    tensorflow::Tensor tensor = std::move(transformed[i]);
+    if (squeeze_columns_[i]) {
+      tensorflow::TensorShape shape = tensor.shape();
+      shape.InsertDim(0, 1);
+      tensorflow::Tensor batched;
+      if (!batched.CopyFrom(tensor, shape)) {
+        return absl::InternalError(
+            absl::StrCat("Failed to add batch dimension to column ", i, "."));
+      }
+      tensor = std::move(batched);
+    } else if (tensor.dims() == 0) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Sample transforms must not remove the time dimension of column ", i,
+          " as it isn't squeezed."));
+    }
+    columns_[i].clear();
+    columns_[i].push_back({std::move(tensor), 0});
+  }
+
+  num_timesteps_ = CountTimesteps();
+  return absl::OkStatus();
+}
+
+absl::Status Sample::UnpackColumns(std::vector<tensorflow::Tensor>* data,
+                                   TaskExecutor* executor) {
+  REVERB_CHECK_EQ(data->size(), columns_.size() + 4);
+
+  return ParallelForWithStatus(
+      executor, columns_.size(), [&](int64_t i) -> absl::Status {
+        auto& column = columns_[i];
+        tensorflow::Tensor* dst = &(*data)[i + 4];
+        // If the column is made up of a single batched tensor then there will
+        // be no need for concatenation so we can save ourselves a copy by
+        // simply moving the one (unpacked) chunk into sequences.
+        if (column.size() == 1) {
+          *dst = std::move(column.front().tensor);
+          return absl::OkStatus();
+        }
+
+        std::vector<tensorflow::Tensor> column_tensors;
+        column_tensors.reserve(column.size());
+        for (auto& slice : column) {
+          column_tensors.push_back(std::move(slice.tensor));
+        }
+        return FromTensorflowStatus(
+            tensorflow::tensor::Concat(column_tensors, dst));
+      });
+}
+
+absl::Status Sample::CopyColumns(tensorflow::Allocator* allocator,
+                                 TaskExecutor* executor,
+                                 std::vector<tensorflow::Tensor>* data) const {
+  REVERB_CHECK_EQ(data->size(), columns_.size() + 4);
+
+  return ParallelForWithStatus(
+      executor, columns_.size(), [&](int64_t i) -> absl::Status {
+        tensorflow::TensorShape shape;
+        REVERB_RETURN_IF_ERROR(ColumnShape(i, &shape));
+        tensorflow::Tensor* dst = &(*data)[i + 4];
+        *dst = tensorflow::Tensor(allocator, columns_[i].front().tensor.dtype(),
+                                  shape);
+
+        // The chunks of the column are laid out back to back.
+        int64_t offset = 0;
+        for (const auto& column_chunk : columns_[i]) {
+          CopyElements(column_chunk.tensor, offset, dst);
+          offset += column_chunk.tensor.NumElements();
+        }
+        return absl::OkStatus();
+      });
+}
+
 absl::Status Sampler::Options::Validate() const {
   if (max_samples < 1 && max_samples != kUnlimitedMaxSamples) {
     return absl::InvalidArgumentError(
@@ -890,6 +2086,11 @@ absl::Status Sampler::Options::Validate() const {
         absl::StrCat("max_in_flight_samples_per_worker (",
                      max_in_flight_samples_per_worker, ") has to be >= 1"));
   }
+  if (num_decoding_threads < 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("num_decoding_threads (", num_decoding_threads,
+                     ") must be >= 0"));
+  }
   if (num_workers < 1 && num_workers != kAutoSelectValue) {
     return absl::InvalidArgumentError(
         absl::StrCat("num_workers (", num_workers, ") must be ",
@@ -911,6 +2112,60 @@ absl::Status Sampler::Options::Validate() const {
         absl::StrCat("flexible_batch_size (", flexible_batch_size, ") must be ",
                      kAutoSelectValue, " or >= 1"));
   }
+  if (max_cached_chunks_per_stream < 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("max_cached_chunks_per_stream (",
+                     max_cached_chunks_per_stream, ") must be >= 0"));
+  }
+  if (trim_chunks_on_server && max_cached_chunks_per_stream != 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("max_cached_chunks_per_stream (",
+                     max_cached_chunks_per_stream,
+                     ") must be 0 when trim_chunks_on_server is set"));
+  }
+  if (trim_chunks_on_server && deduplicate_chunks_in_responses) {
+    return absl::InvalidArgumentError(
+        "trim_chunks_on_server and deduplicate_chunks_in_responses can't both "
+        "be set");
+  }
+  for (int column : columns) {
+    if (column < 0) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("columns must be >= 0 but got ", column));
+    }
+  }
+  if (trace_sampling_period < 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("trace_sampling_period (", trace_sampling_period,
+                     ") must be >= 0"));
+  }
+  if (worker_stall_timeout <= absl::ZeroDuration()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("worker_stall_timeout (",
+                     absl::FormatDuration(worker_stall_timeout),
+                     ") must be > 0"));
+  }
+  for (const auto& transform : transforms) {
+    if (transform == nullptr) {
+      return absl::InvalidArgumentError("transforms must not be null");
+    }
+  }
+  if (lazy_decoding && !transforms.empty()) {
+    return absl::InvalidArgumentError(
+        "transforms must be empty when lazy_decoding is set");
+  }
+  if (chunk_decoder != nullptr && (reuse_decoded_chunks || lazy_decoding)) {
+    return absl::InvalidArgumentError(
+        "reuse_decoded_chunks and lazy_decoding must be false when "
+        "chunk_decoder is set");
+  }
+  for (const auto& [table, weight] : mixture) {
+    if (!(weight > 0) || std::isinf(weight)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("The weight of table ", table,
+                       " in mixture must be > 0 and finite but got ", weight));
+    }
+  }
   return absl::OkStatus();
 }
 
@@ -20,17 +20,28 @@
 #include <deque>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "absl/base/attributes.h"
 #include <cstdint>
+#include "absl/container/inlined_vector.h"
+#include "absl/hash/hash.h"
 #include "absl/status/status.h"
 #include "absl/time/time.h"
+#include "reverb/cc/chunk_decoder.h"
+#include "reverb/cc/platform/hash_set.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/reverb_service.grpc.pb.h"
-#include "reverb/cc/support/queue.h"
+#include "reverb/cc/sample_transform.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/decoded_chunk_cache.h"
+#include "reverb/cc/support/lock_free_queue.h"
+#include "reverb/cc/support/sampler_autotuner.h"
+#include "reverb/cc/support/task_executor.h"
 #include "reverb/cc/support/signature.h"
 #include "reverb/cc/table.h"
+#include "tensorflow/core/framework/allocator.h"
 #include "tensorflow/core/framework/tensor.h"
 
 namespace deepmind {
@@ -53,11 +64,52 @@ inline absl::Duration Int64MillisToNonnegativeDuration(int64_t milliseconds) {
 // A sample from the replay buffer.
 class Sample {
  public:
+  // Slice of a chunk column which hasn't been decoded yet.
+  struct EncodedSlice {
+    std::shared_ptr<const ChunkStore::Chunk> chunk;
+    FlatTrajectory::ChunkSlice slice;
+  };
+
   Sample(tensorflow::uint64 key, double probability,
          tensorflow::int64 table_size, double priority, bool rate_limited,
          std::vector<std::vector<tensorflow::Tensor>> column_chunks,
          std::vector<bool> squeeze_columns);
 
+  // Constructs a sample whose columns are only decoded when they are needed
+  // (see `DecodeColumns` and `GetColumn`). `encoded_columns[i]` holds the
+  // slices which make up column `i`. The sample shares ownership of the
+  // chunks until the columns have been decoded.
+  Sample(tensorflow::uint64 key, double probability,
+         tensorflow::int64 table_size, double priority, bool rate_limited,
+         std::vector<std::vector<EncodedSlice>> encoded_columns,
+         std::vector<bool> squeeze_columns);
+
+  // Decodes the columns which haven't been decoded yet. The columns are
+  // decoded in parallel if `executor` is set. Except for `GetColumn`,
+  // `num_columns` and the getters of the info fields, the methods of a sample
+  // constructed from encoded columns must only be called once the columns have
+  // been decoded.
+  absl::Status DecodeColumns(TaskExecutor* executor = nullptr);
+
+  // Returns data column `i` of the trajectory, i.e the same tensor as
+  // `AsTrajectory` returns at index `i+4`, and decodes it first if needed.
+  // The other columns are left as they are.
+  //
+  // Fails with `DataLossError` if `GetNextTimestep()` has already been called
+  // on this sample.
+  // Fails with `InvalidArgumentError` if `i` is out of range.
+  absl::Status GetColumn(int i, tensorflow::Tensor* column);
+
+  // Number of data columns of the trajectory.
+  int num_columns() const;
+
+  // The info fields of the sample, i.e the first four tensors returned by
+  // `AsTrajectory`.
+  tensorflow::uint64 key() const;
+  double probability() const;
+  tensorflow::int64 table_size() const;
+  double priority() const;
+
   // Returns the next time step from this sample as a flat sequence of tensors.
   // CHECK-fails if the entire sample has already been returned.
   std::vector<tensorflow::Tensor> GetNextTimestep();
@@ -75,7 +127,27 @@ class Sample {
   //   the key, sample probability, table size and priority respectively. The
   //   last K tensors holds the actual timestep data batched into a tensor of
   //   shape [N, ...original_shape].
-  absl::Status AsBatchedTimesteps(std::vector<tensorflow::Tensor>* data);
+  //
+  // If `executor` is set then the columns are concatenated in parallel on it
+  // (see `TaskExecutor::ParallelFor`).
+  absl::Status AsBatchedTimesteps(std::vector<tensorflow::Tensor>* data,
+                                  TaskExecutor* executor = nullptr);
+
+  // Returns the next `length` timesteps of this sample as a flat sequence of
+  // batched tensors, i.e the same layout as `AsBatchedTimesteps` but for a
+  // window of `length` timesteps. The window is copied directly from the
+  // column chunks. The window is then advanced by `shift` timesteps and if
+  // fewer than `length` timesteps remain after that then they are dropped,
+  // so `is_end_of_sample` becomes true once no complete window remains.
+  //
+  // Fails with `FailedPreconditionError` if sample cannot be decomposed into
+  // timesteps or if fewer than `length` timesteps remain.
+  absl::Status GetNextWindow(int64_t length, int64_t shift,
+                             std::vector<tensorflow::Tensor>* data);
+
+  // Number of timesteps which haven't been returned yet by `GetNextTimestep`
+  // or `GetNextWindow`.
+  int64_t num_remaining_timesteps() const;
 
   // Returns the entire sample as a flat sequence of batched tensors.
   //
@@ -86,7 +158,48 @@ class Sample {
   //   K+4 tensors. The first four tensors are scalar tensors representing
   //   the key, sample probability, table size and priority respectively. The
   //   last K tensors holds the actual trajectory data.
-  absl::Status AsTrajectory(std::vector<tensorflow::Tensor>* data);
+  //
+  // If `allocator` is set then all returned tensors are allocated with it and
+  // the column chunks are copied into them, even when a column consists of a
+  // single chunk which could otherwise be returned without a copy.
+  //
+  // If `executor` is set then the columns are assembled in parallel on it (see
+  // `TaskExecutor::ParallelFor`).
+  absl::Status AsTrajectory(std::vector<tensorflow::Tensor>* data,
+                            tensorflow::Allocator* allocator = nullptr,
+                            TaskExecutor* executor = nullptr);
+
+  // Allocates the K+4 tensors of a batch of `batch_size` samples with the same
+  // dtypes and shapes as this sample. The shapes are the same as the ones
+  // returned by `AsTrajectory` with a leading batch dimension of size
+  // `batch_size`. The tensors are allocated with `allocator` if set and with
+  // the default CPU allocator otherwise.
+  absl::Status AllocateBatch(int64_t batch_size,
+                             std::vector<tensorflow::Tensor>* batch,
+                             tensorflow::Allocator* allocator = nullptr) const;
+
+  // Copies the sample into row `index` of `batch` (see `AllocateBatch`). The
+  // column chunks are copied straight into the row rather than being
+  // concatenated first.
+  //
+  // Fails with `DataLossError` if `GetNextTimestep()` has already been called
+  // on this sample.
+  // Fails with `InvalidArgumentError` if the shapes or dtypes of the columns
+  // differ from the ones of `batch`.
+  absl::Status CopyToBatch(int64_t index,
+                           std::vector<tensorflow::Tensor>* batch) const;
+
+  // Applies `transforms`, in order, to the data columns of the trajectory and
+  // replaces the columns of the sample with the result. The columns are
+  // assembled in parallel on `executor` if set.
+  //
+  // Fails with `DataLossError` if `GetNextTimestep()` has already been called
+  // on this sample.
+  // Fails with `InvalidArgumentError` if a transform changes the number of
+  // columns or removes the time dimension of a column which isn't squeezed.
+  absl::Status ApplyTransforms(
+      const std::vector<std::shared_ptr<const SampleTransform>>& transforms,
+      TaskExecutor* executor = nullptr);
 
   // Returns true if the end of the sample has been reached.
   ABSL_MUST_USE_RESULT bool is_end_of_sample() const;
@@ -97,10 +210,38 @@ class Sample {
   // Whether the sample was delayed due to rate limiting or not.
   bool rate_limited() const;
 
+  // Flight recorder trace (see `internal::FlightRecorder`) of the request which
+  // fetched the sample, or 0 if the request wasn't traced, and when the sample
+  // was pushed to the queue of the sampler.
+  uint64_t trace_id() const;
+  absl::Time queued_at() const;
+  void set_trace(uint64_t trace_id, absl::Time queued_at);
+
  private:
   // Concatenates content of column `i` into `data[i+4]`, i.e ofset by info
-  // columns.
-  absl::Status UnpackColumns(std::vector<tensorflow::Tensor>* data);
+  // columns. The columns are processed in parallel if `executor` is set.
+  absl::Status UnpackColumns(std::vector<tensorflow::Tensor>* data,
+                             TaskExecutor* executor);
+
+  // Copies the content of column `i` into `data[i+4]`, a new tensor allocated
+  // with `allocator` that has the shape returned by `ColumnShape`. The columns
+  // are processed in parallel if `executor` is set.
+  absl::Status CopyColumns(tensorflow::Allocator* allocator,
+                           TaskExecutor* executor,
+                           std::vector<tensorflow::Tensor>* data) const;
+
+  // Drops the next `num_timesteps` timesteps of every column.
+  void SkipTimesteps(int64_t num_timesteps);
+
+  // Shape of column `i` as returned by `AsTrajectory`.
+  absl::Status ColumnShape(int i, tensorflow::TensorShape* shape) const;
+
+  // Decodes the slices of column `i` if it hasn't been decoded yet.
+  absl::Status DecodeColumn(int i);
+
+  // Number of time steps of the decoded columns, or -1 if the sample can't be
+  // decomposed into timesteps.
+  int64_t CountTimesteps() const;
 
   // The key of the replay item this time step was sampled from.
   tensorflow::uint64 key_;
@@ -137,6 +278,11 @@ class Sample {
   // subsliced.
   std::vector<std::deque<ColumnChunk>> columns_;
 
+  // Slices of the columns which haven't been decoded yet, indexed like
+  // `columns_`. Empty if the sample was constructed from decoded columns or
+  // all columns have been decoded by `DecodeColumns`.
+  std::vector<std::vector<EncodedSlice>> encoded_columns_;
+
   // Columns where the batch dimension should be emitted. This is only respected
   // by `AsTrajectory`.
   std::vector<bool> squeeze_columns_;
@@ -146,6 +292,30 @@ class Sample {
 
   // True if GetNextTimestep() has been called on this sample.
   bool next_timestep_called_;
+
+  // See `trace_id()` and `queued_at()`.
+  uint64_t trace_id_ = 0;
+  absl::Time queued_at_;
+};
+
+// Hands out the number of samples a `SamplerWorker` may request. Rather than
+// claiming all the samples of a stream up front, workers acquire small grants
+// right before each request so the demand is spread dynamically across the
+// workers and a slow worker only holds on to the samples it has in flight.
+class SampleBudget {
+ public:
+  virtual ~SampleBudget() = default;
+
+  // Blocks until between 1 and `max_samples` samples can be requested and
+  // returns that number. Returns 0 if the worker should stop fetching samples.
+  virtual int64_t Acquire(int64_t max_samples) = 0;
+
+  // Like `Acquire` but returns 0 rather than blocking if no samples can be
+  // requested right away.
+  virtual int64_t TryAcquire(int64_t max_samples) = 0;
+
+  // Called every time a sample has been pushed to the queue.
+  virtual void OnSampleReceived() = 0;
 };
 
 // SamplerWorker implements strategy for fetching samples from table.
@@ -156,11 +326,56 @@ class SamplerWorker {
   // When called, future calls to FetchSampes must return CancelledError.
   virtual void Cancel() = 0;
 
-  // Attempt to sample up to `num_samples` and push results to `queue`. Returns
-  // when `num_samples` pushed to `queue` or error encountered.
+  // Attempt to sample up to `max_samples` and push results to `queue`. Every
+  // request is limited by the grants acquired from `budget`. Returns when
+  // `max_samples` pushed to `queue`, the budget is exhausted or error
+  // encountered. Grants which have not been received when this method returns
+  // are forfeited.
   virtual std::pair<int64_t, absl::Status> FetchSamples(
-      internal::Queue<std::unique_ptr<Sample>>* queue, int64_t num_samples,
+      internal::LockFreeQueue<std::unique_ptr<Sample>>* queue,
+      int64_t max_samples, SampleBudget* budget,
       absl::Duration rate_limiter_timeout) = 0;
+
+  // Sets the executor on which the chunk columns of the fetched samples are
+  // decompressed in parallel. Must be called before `FetchSamples`.
+  void set_decoding_executor(std::shared_ptr<TaskExecutor> executor) {
+    decoding_executor_ = std::move(executor);
+  }
+
+  // Sets the transforms which are applied to every fetched sample before it is
+  // pushed to the queue. Must be called before `FetchSamples`.
+  void set_transforms(
+      std::vector<std::shared_ptr<const SampleTransform>> transforms) {
+    transforms_ = std::move(transforms);
+  }
+
+  // Sets whether fetched samples are pushed to the queue without decoding
+  // their columns (see `Sampler::Options::lazy_decoding`). Must be called
+  // before `FetchSamples`.
+  void set_lazy_decoding(bool lazy_decoding) { lazy_decoding_ = lazy_decoding; }
+
+  // Sets the decoder used for the chunk columns it supports (see
+  // `Sampler::Options::chunk_decoder`). Must be called before `FetchSamples`.
+  void set_chunk_decoder(std::shared_ptr<const ChunkDecoder> chunk_decoder) {
+    chunk_decoder_ = std::move(chunk_decoder);
+  }
+
+ protected:
+  // Applies `transforms_` to `sample`. A no-op if there are no transforms.
+  absl::Status ApplyTransforms(Sample* sample) const;
+
+  // Executor for decompressing the columns of a sample in parallel, or nullptr
+  // if they are decompressed by the thread of the worker.
+  std::shared_ptr<TaskExecutor> decoding_executor_;
+
+  // See `Sampler::Options::transforms`.
+  std::vector<std::shared_ptr<const SampleTransform>> transforms_;
+
+  // See `Sampler::Options::lazy_decoding`.
+  bool lazy_decoding_ = false;
+
+  // See `Sampler::Options::chunk_decoder`.
+  std::shared_ptr<const ChunkDecoder> chunk_decoder_;
 };
 
 // The `Sampler` class should be used to retrieve samples from a
@@ -171,6 +386,8 @@ class SamplerWorker {
 //
 // Concurrent calls to `GetNextTimestep` is NOT supported! This includes calling
 // `GetNextSample` and `GetNextTimestep` concurrently.
+// `GetNextTrajectory` and `GetNextBatch` only pop complete samples from the
+// lock free queue and may be called concurrently (see sampler_pool.h).
 //
 // Terminology:
 //   Timestep:
@@ -230,9 +447,11 @@ class Sampler {
     // Must be a positive number or `kUnlimitedMaxSamples`.
     int64_t max_samples = kUnlimitedMaxSamples;
 
-    // `max_in_flight_samples_per_worker` is the number of samples requested by
-    // a worker in each batch. A new batch is requested once all the requested
-    // samples have been received.
+    // `max_in_flight_samples_per_worker` is the maximum number of samples
+    // requested but not yet received by a worker. Workers use credit based
+    // flow control (see `SampleStreamRequest.credit_flow_control`): once half
+    // of the samples in flight have been received, they are replaced by new
+    // grants so the stream never drains while there is budget left.
     int max_in_flight_samples_per_worker = 100;
 
     // `num_workers` is the number of worker threads started.
@@ -270,6 +489,198 @@ class Sampler {
     // When set to `kAutoSelectValue`, `kDefaultFlexibleBatchSize` is used.
     int flexible_batch_size = kAutoSelectValue;
 
+    // --- EXPERIMENTAL ---
+    //
+    // Only used by samplers constructed from a local `Table`. When true, the
+    // decompressed columns of every sampled chunk are kept alive (see
+    // `ChunkStore::Chunk::GetDecodedColumn`) so repeated samples of the same
+    // chunk become slices of the already decoded tensors rather than
+    // decompressing and copying the data again. This trades memory for CPU as
+    // the decoded tensors are held for as long as the chunk remains in the
+    // table.
+    bool reuse_decoded_chunks = false;
+
+    // --- EXPERIMENTAL ---
+    //
+    // If set, decompressed chunk columns are looked up in (and added to) this
+    // cache before being sliced into samples. The cache can be shared between
+    // the workers of one or more samplers to avoid decompressing the same
+    // chunks over and over again when they are sampled repeatedly (e.g with
+    // large `samples_per_insert` or prioritized sampling). Local samplers with
+    // `reuse_decoded_chunks` enabled do not use the cache.
+    std::shared_ptr<internal::DecodedChunkCache> decoded_chunk_cache;
+
+    // --- EXPERIMENTAL ---
+    //
+    // Only used by samplers constructed from a gRPC stub. The number of chunks
+    // received on each stream that every worker holds on to. The server does
+    // not resend chunks which are still held but only references them, which
+    // greatly reduces the bandwidth when consecutive samples overlap (e.g
+    // sequences sampled with a short period). The memory used by each worker
+    // grows with up to `max_cached_chunks_per_stream` (compressed) chunks.
+    //
+    // When 0, all chunks are sent with every sample.
+    int64_t max_cached_chunks_per_stream = 0;
+
+    // --- EXPERIMENTAL ---
+    //
+    // Only used by samplers constructed from a gRPC stub. If true, the server
+    // is asked to decompress the chunks before sending them (see
+    // `SampleStreamRequest.decompress_chunks`), so the sampler only copies the
+    // received tensors into place. Useful when the CPU of the client is the
+    // bottleneck rather than the bandwidth to the server.
+    bool decompress_on_server = false;
+
+    // --- EXPERIMENTAL ---
+    //
+    // Only used by samplers constructed from a gRPC stub. If true, the server
+    // is asked to only send the rows of the chunks which are referenced by the
+    // sampled items (see `SampleStreamRequest.trim_chunks`). Greatly reduces
+    // the bandwidth when items only reference a few rows of long chunks, in
+    // particular if the chunks are block structured (see
+    // `CompressionOptions.block_length`). Trimmed chunks are specific to the
+    // item so `max_cached_chunks_per_stream` must be 0 and
+    // `decoded_chunk_cache` is not used.
+    bool trim_chunks_on_server = false;
+
+    // --- EXPERIMENTAL ---
+    //
+    // Only used by samplers constructed from a gRPC stub. If true, the server
+    // sends every chunk at most once per response, even when it is referenced
+    // by several of the items sampled in one batch (see
+    // `SampleStreamRequest.deduplicate_chunks`). The samples of a response
+    // which share a chunk also share its decoded columns. Useful with
+    // `flexible_batch_size` > 1 when the sampled items overlap. Can't be
+    // combined with `trim_chunks_on_server`.
+    bool deduplicate_chunks_in_responses = false;
+
+    // --- EXPERIMENTAL ---
+    //
+    // Only used by samplers constructed from a gRPC stub. If true, the server
+    // reorders the items of every batch so that items which share chunks are
+    // adjacent (see `SampleStreamRequest.group_by_chunk`). This raises the hit
+    // rate of `deduplicate_chunks_in_responses` and `decoded_chunk_cache`.
+    // Samples are then no longer returned in the order they were selected, so
+    // the server rejects this for tables with a deterministic sampler.
+    bool group_samples_by_chunk = false;
+
+    // --- EXPERIMENTAL ---
+    //
+    // If not empty, only these columns of the sampled trajectories are
+    // returned, in the given order, and only these columns are decoded.
+    // Samplers constructed from a gRPC stub ask the server to leave out the
+    // chunk data of the other columns (see `SampleStreamRequest.columns`).
+    // Useful when the consumer only needs part of the trajectory (e.g. the
+    // observations to recompute priorities). The dtypes and shapes validated
+    // by the sampler describe the selected columns.
+    std::vector<int> columns;
+
+    // --- EXPERIMENTAL ---
+    //
+    // Only relevant when `max_samples` is set and `num_workers > 1`. If a
+    // worker does not receive any of its in flight samples for this long then
+    // idle workers take over the outstanding samples, i.e they request them
+    // from their own streams. If the slow worker eventually receives the
+    // samples then they are surplus. Surplus samples consume items from the
+    // table but are not returned once `max_samples` has been reached.
+    //
+    // The default is to never take over the samples of other workers.
+    absl::Duration worker_stall_timeout = absl::InfiniteDuration();
+
+    // --- EXPERIMENTAL ---
+    //
+    // When true, a feedback controller (see `internal::SamplerAutoTuner`)
+    // adjusts the number of active workers and the maximum number of samples
+    // fetched per request based on how full the sample queue is when samples
+    // are popped. `num_workers` and `max_in_flight_samples_per_worker` are
+    // used as upper bounds and as the initial values so the controller only
+    // ever reduces the load on the table when the consumer can't keep up.
+    bool autotune = false;
+
+    // --- EXPERIMENTAL ---
+    //
+    // If set, the tensors returned by `GetNextTrajectory` and `GetNextBatch`
+    // are allocated with this allocator rather than the default CPU allocator.
+    // Setting it to a host allocator which pins its memory for the
+    // accelerators (e.g. the GPU host allocator) allows the returned samples to
+    // be DMA'd to the device asynchronously without an intermediate staging
+    // copy. Note that `GetNextTrajectory` then always copies the decompressed
+    // chunks into the output tensors. The allocator must outlive the sampler.
+    tensorflow::Allocator* output_allocator = nullptr;
+
+    // --- EXPERIMENTAL ---
+    //
+    // Only used by samplers constructed from a gRPC stub. When > 0, one in
+    // every `trace_sampling_period` sample requests is traced: the time it
+    // spends in each stage (the RPC, the decompression of its samples, the
+    // queue of the sampler and `GetNext*` calls waiting for it, as well as the
+    // stages on the server) is recorded in the flight recorders of the client
+    // and the server (see `internal::FlightRecorder`). The client side is
+    // dumped with `internal::FlightRecorder::Default()->ToChromeTraceJson()`
+    // and the server side with `Client::DumpServerTrace`.
+    int64_t trace_sampling_period = 0;
+
+    // --- EXPERIMENTAL ---
+    //
+    // Number of threads used to decode samples. When > 0, the chunk slices of
+    // each sample are decompressed in parallel (rather than one by one on the
+    // thread of the worker which received the sample) and the columns returned
+    // by `GetNextTrajectory` and `GetNextSample` are assembled in parallel
+    // (rather than on the calling thread, usually the `tf.data` iterator
+    // thread). This reduces the latency of samples with many columns or large
+    // chunks (e.g images). The threads are shared by all workers and the
+    // calling threads also take part in the decoding.
+    //
+    // When 0, samples are decoded sequentially.
+    int num_decoding_threads = 0;
+
+    // --- EXPERIMENTAL ---
+    //
+    // Only used by samplers constructed from a gRPC stub. If not empty, every
+    // stream samples from all of these (table, weight) pairs rather than from
+    // the table of the sampler, interleaved by the server in proportion to the
+    // weights (see `SampleStreamRequest.mixture`). This replaces one sampler
+    // per table, and the streams of each, when the tables are mixed with
+    // fixed ratios. The rate limiter of each table is still respected. The
+    // table of the sampler is only used to look up the signature, so all
+    // tables of the mixture should share it. The table of each sample is given
+    // by `SampleInfo.item.table`.
+    std::vector<std::pair<std::string, double>> mixture;
+
+    // --- EXPERIMENTAL ---
+    //
+    // Transforms which the workers apply, in order, to every sampled
+    // trajectory before it is pushed to the queue (see `SampleTransform`).
+    // Per sample work such as reward clipping thus runs on the worker threads,
+    // in parallel with the consumer, rather than on the thread calling
+    // `GetNext*` (usually the `tf.data` iterator thread). `dtypes_and_shapes`
+    // must describe the transformed trajectories. The transforms are shared by
+    // all workers so they must be thread safe.
+    std::vector<std::shared_ptr<const SampleTransform>> transforms;
+
+    // --- EXPERIMENTAL ---
+    //
+    // When true, the workers push samples to the queue without decoding their
+    // columns. The columns are decoded by the `GetNext*` call which pops the
+    // sample, except for samples popped with `GetNextLazySample`, whose columns
+    // are only decoded when they are accessed. This saves the decompression of
+    // the columns which the consumer never reads (e.g the observations when
+    // only the rewards are logged). Chunks are neither decoded once per
+    // chunk (`reuse_decoded_chunks`) nor cached (`decoded_chunk_cache`) and
+    // `transforms` must be empty.
+    bool lazy_decoding = false;
+
+    // --- EXPERIMENTAL ---
+    //
+    // If set, the workers decode the chunk columns for which
+    // `ChunkDecoder::CanDecode` returns true with this decoder rather than on
+    // the CPU (e.g to decompress image-heavy columns with a GPU codec). The
+    // decoded columns are cached like any other (`decoded_chunk_cache`).
+    // Requires `reuse_decoded_chunks` and `lazy_decoding` to be false as these
+    // decode the chunks outside of the workers. The decoder is shared by all
+    // workers so it must be thread safe.
+    std::shared_ptr<const ChunkDecoder> chunk_decoder;
+
     // Checks that field values are valid and returns `InvalidArgument` if any
     // field value invalid.
     absl::Status Validate() const;
@@ -285,6 +696,22 @@ class Sampler {
           const std::string& table_name, const Options& options,
           internal::DtypesAndShapes dtypes_and_shapes = absl::nullopt);
 
+  // Constructs a new `Sampler` which merges the samples of multiple servers.
+  //
+  // One worker is created for every element of `stubs` and the worker opens
+  // all of its streams using that stub. The share of the workers (and thus of
+  // the requests) sent to a server is therefore controlled by how many times
+  // its stub occurs in `stubs`. `options.num_workers` is ignored.
+  Sampler(const std::vector<
+              std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>&
+              stubs,
+          const std::string& table_name, const Options& options,
+          internal::DtypesAndShapes dtypes_and_shapes = absl::nullopt);
+
+  // Number of workers started by a `Sampler` constructed from a single stub
+  // with `options`.
+  static int64_t NumGrpcWorkers(const Options& options);
+
   // Constructs a new `Sampler` which samples directly from local `table`.
   //
   // `table` is the table to sample from.
@@ -314,6 +741,19 @@ class Sampler {
   absl::Status GetNextSample(std::vector<tensorflow::Tensor>* data,
                              bool* rate_limited = nullptr);
 
+  // Blocks until a window of `length` consecutive timesteps has been retrieved
+  // or until a non transient error is encountered or `Close` has been called.
+  //
+  // The window is unpacked as "batched timesteps" (see `GetNextSample`) and
+  // copied directly from the chunk slices of the sample. Successive windows of
+  // the same sample start `shift` timesteps apart. Windows never span more
+  // than one sample: the timesteps at the end of a sample which don't make up
+  // a complete window, and samples with fewer than `length` timesteps, are
+  // dropped.
+  absl::Status GetNextWindow(int64_t length, int64_t shift,
+                             std::vector<tensorflow::Tensor>* data,
+                             bool* rate_limited = nullptr);
+
   // Blocks until a complete sample has been retrieved or until a non transient
   // error is encountered or `Close` has been called.
   //
@@ -327,11 +767,78 @@ class Sampler {
   absl::Status GetNextTrajectory(std::vector<tensorflow::Tensor>* data,
                                  bool* rate_limited = nullptr);
 
+  // Blocks until a complete sample has been retrieved or until a non transient
+  // error is encountered or `Close` has been called.
+  //
+  // Unlike `GetNextTrajectory`, the sample is returned as is. If
+  // `Options::lazy_decoding` is set then its columns are only decoded when
+  // they are accessed through `Sample::GetColumn` (or all at once by
+  // `Sample::DecodeColumns`). The columns are not validated against the
+  // signature of the sampler.
+  absl::Status GetNextLazySample(std::unique_ptr<Sample>* sample,
+                                 bool* rate_limited = nullptr);
+
+  struct WorkerStats {
+    // Number of samples requested by the worker which has not yet been
+    // received.
+    int64_t in_flight_samples = 0;
+
+    // Time since the worker last received a sample (or was granted samples)
+    // while it had samples in flight. Zero when nothing is in flight.
+    absl::Duration stall_time = absl::ZeroDuration();
+
+    // Total number of samples received by the worker.
+    int64_t received_samples = 0;
+
+    // Number of in flight samples of the worker which were taken over by other
+    // workers because the worker stalled (see `worker_stall_timeout`).
+    int64_t stolen_samples = 0;
+
+    // False if the worker has been deactivated by the autotuner (see
+    // `Options::autotune`).
+    bool active = true;
+  };
+
+  // Returns the stats of every worker.
+  std::vector<WorkerStats> GetWorkerStats() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Blocks until `batch_size` complete samples have been retrieved or until a
+  // non transient error is encountered or `Close` has been called.
+  //
+  // The samples are copied straight into 4+K tensors which are allocated once
+  // for the whole batch. The first 4 tensors have shape [batch_size] and hold
+  // the key, probability, table size and priority of each sample. The
+  // remaining K tensors hold the columns of the flattened trajectories, i.e the
+  // tensors returned by `GetNextTrajectory` stacked along a new leading
+  // dimension. All the samples of the batch must therefore have the same
+  // shapes.
+  //
+  // `rate_limited` is set if any of the samples was delayed due to rate
+  // limiting.
+  absl::Status GetNextBatch(int batch_size,
+                            std::vector<tensorflow::Tensor>* data,
+                            bool* rate_limited = nullptr);
+
   // Cancels all workers and joins their threads. Any blocking or future call
   // to `GetNextTimestep` or `GetNextSample` will return CancelledError without
   // blocking.
   void Close();
 
+  // Caps the number of workers which fetch samples and how many samples each
+  // of them requests at a time. Workers with an index >= `num_active_workers`
+  // stay idle until the cap is raised again. This lets an external controller
+  // (e.g tf.data's autotuning, see ../ops/trajectory_dataset.cc) trade the
+  // throughput of the sampler for the load it puts on the table. The caps can
+  // only lower the configured values and they apply on top of
+  // `Options::autotune`. Both values are raised to at least 1.
+  void SetWorkerLimits(int num_active_workers,
+                       int64_t max_samples_per_request)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Number of complete samples which have been fetched by the workers but not
+  // yet popped by the consumer.
+  int64_t num_buffered_samples() const { return samples_.size(); }
+
   // Sampler is neither copyable nor movable.
   Sampler(const Sampler&) = delete;
   Sampler& operator=(const Sampler&) = delete;
@@ -340,7 +847,9 @@ class Sampler {
   Sampler(std::vector<std::unique_ptr<SamplerWorker>>, const std::string& table,
           const Options& options, internal::DtypesAndShapes dtypes_and_shapes);
 
-  // Validates the `data` vector against `dtypes_and_shapes`.
+  // Validates the `data` vector against `dtypes_and_shapes`. The layouts (see
+  // `ValidatedLayout`) which have passed validation are cached so samples with
+  // an already seen layout are only checked for a cache hit.
   enum class ValidationMode {
     // `GetNextTimestep` is the caller. The signature represents a single
     // timestep and so do does the provided data.
@@ -353,11 +862,63 @@ class Sampler {
     // `GetNextTrajectory` is the caller. The signature represents a complete
     // trajectory and so does the data.
     kTrajectory,
+
+    // `GetNextBatch` is the caller. The signature represents a complete
+    // trajectory and the data is a batch of trajectories.
+    kBatchedTrajectory,
   };
   absl::Status ValidateAgainstOutputSpec(
-      const std::vector<tensorflow::Tensor>& data, ValidationMode mode);
+      const std::vector<tensorflow::Tensor>& data, ValidationMode mode)
+      ABSL_LOCKS_EXCLUDED(validated_layouts_mu_);
+
+  // The validation mode followed by the dtype, rank and dimensions of every
+  // data column of a sample. All samples of a table with a signature usually
+  // share the same layout.
+  using ValidatedLayout = absl::InlinedVector<int64_t, 32>;
+
+  // Upper bound on the number of entries in `validated_layouts_`. Tables with
+  // variable length trajectories produce many layouts so once the bound is
+  // reached new layouts are still validated but no longer cached.
+  static constexpr int kMaxValidatedLayouts = 1024;
+
+  void RunWorker(int index) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Budget of the worker with index `index`.
+  class WorkerBudget : public SampleBudget {
+   public:
+    WorkerBudget(Sampler* sampler, int index)
+        : sampler_(sampler), index_(index) {}
+
+    int64_t Acquire(int64_t max_samples) override {
+      return sampler_->AcquireSamples(index_, max_samples, /*wait=*/true);
+    }
+
+    int64_t TryAcquire(int64_t max_samples) override {
+      return sampler_->AcquireSamples(index_, max_samples, /*wait=*/false);
+    }
+
+    void OnSampleReceived() override { sampler_->OnSampleReceived(index_); }
 
-  void RunWorker(SamplerWorker* worker) ABSL_LOCKS_EXCLUDED(mu_);
+   private:
+    Sampler* sampler_;
+    const int index_;
+  };
+
+  // Implementations of `WorkerBudget`. `AcquireSamples` returns 0 rather than
+  // blocking if `wait` is false.
+  int64_t AcquireSamples(int index, int64_t max_samples, bool wait)
+      ABSL_LOCKS_EXCLUDED(mu_);
+  void OnSampleReceived(int index) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Called when `FetchSamples` returns. The samples still in flight will never
+  // be received so they are made available to the other workers.
+  void ReleaseInFlightSamples(int index) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Moves up to `max_samples` in flight samples from a worker which has stalled
+  // for at least `worker_stall_timeout_` to worker `thief`. Returns the number
+  // of samples moved.
+  int64_t StealFromStalledWorker(int thief, int64_t max_samples)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   // If `active_sample_` has been read, blocks until a sample has been retrieved
   // (popped from `samples_`) and populates `active_sample_`.
@@ -367,8 +928,13 @@ class Sampler {
   // error is encountered or `Close` has been called. Note that this method does
   // NOT increment `returned_`. This is left to `GetNextTimestep` and
   // `GetNextSample`. The returned pointer is only valid if the status is OK.
+  // The columns of the returned sample have been decoded.
   absl::Status PopNextSample(std::unique_ptr<Sample>* sample);
 
+  // Like `PopNextSample` but the columns of the sample are left as they were
+  // pushed by the worker (see `Options::lazy_decoding`).
+  absl::Status PopNextEncodedSample(std::unique_ptr<Sample>* sample);
+
   // True if the workers should be shut down. This is the case when either:
   //  - `Close` has been called.
   //  - The number of returned samples equal `max_samples_`.
@@ -376,6 +942,9 @@ class Sampler {
   //  status.
   bool should_stop_workers() const ABSL_SHARED_LOCKS_REQUIRED(mu_);
 
+  // True if the autotuner is disabled or has not deactivated the worker.
+  bool is_active_worker(int index) const ABSL_SHARED_LOCKS_REQUIRED(mu_);
+
   // Stub used by workers to open SampleStream-connections to the servers. Note
   // that the endpoints are load balanced using "roundrobin" which results in
   // uniform sampling when using multiple backends.
@@ -397,6 +966,9 @@ class Sampler {
   // The rate limiter timeout argument that all workers pass to SampleStream.
   const absl::Duration rate_limiter_timeout_;
 
+  // See `Options::worker_stall_timeout`.
+  const absl::Duration worker_stall_timeout_;
+
   // The number of complete samples that have been successfully requested.
   int64_t requested_ ABSL_GUARDED_BY(mu_) = 0;
 
@@ -408,6 +980,30 @@ class Sampler {
   std::vector<std::unique_ptr<SamplerWorker>> workers_;
   std::vector<std::unique_ptr<internal::Thread>> worker_threads_;
 
+  struct WorkerState {
+    // Samples granted to the worker which have not yet been received.
+    int64_t in_flight = 0;
+
+    // When the worker last received a sample or was granted new samples.
+    absl::Time last_progress = absl::InfinitePast();
+
+    int64_t received = 0;
+    int64_t stolen = 0;
+  };
+
+  // State of the worker with the same index.
+  std::vector<WorkerState> worker_states_ ABSL_GUARDED_BY(mu_);
+
+  // Set iff `Options::autotune` is true. Workers with an index >=
+  // `num_active_workers()` are idle and grants are capped by `batch_size()`.
+  // The pointer is never changed after construction but the autotuner itself
+  // must only be accessed while holding `mu_`.
+  const std::unique_ptr<internal::SamplerAutoTuner> autotuner_;
+
+  // See `SetWorkerLimits`.
+  int num_active_workers_limit_ ABSL_GUARDED_BY(mu_);
+  int64_t max_samples_per_request_limit_ ABSL_GUARDED_BY(mu_) = INT64_MAX;
+
   // OK or the first non transient error encountered by a worker.
   absl::Status worker_status_ ABSL_GUARDED_BY(mu_);
 
@@ -417,7 +1013,17 @@ class Sampler {
   std::unique_ptr<Sample> active_sample_;
 
   // Queue of complete samples (timesteps batched up by into sequence).
-  internal::Queue<std::unique_ptr<Sample>> samples_;
+  internal::LockFreeQueue<std::unique_ptr<Sample>> samples_;
+
+  // See `Options::output_allocator`.
+  tensorflow::Allocator* const output_allocator_;
+
+  // Executor shared by the workers and the `GetNext*` calls for decoding
+  // samples in parallel (see `Options::num_decoding_threads`), or nullptr.
+  const std::shared_ptr<TaskExecutor> decoding_executor_;
+
+  // True if `Options::trace_sampling_period` is set.
+  const bool tracing_;
 
   // The dtypes and shapes users expect from either `GetNextTimestep` or
   // `GetNextSample` (whichever they plan to call).  May be absl::nullopt,
@@ -429,6 +1035,14 @@ class Sampler {
   bool closed_ ABSL_GUARDED_BY(mu_) = false;
 
   mutable absl::Mutex mu_;
+
+  // Layouts which have passed `ValidateAgainstOutputSpec`. Guarded by a
+  // separate mutex as validation happens on the (possibly shared) consumer
+  // path.
+  internal::flat_hash_set<ValidatedLayout, absl::Hash<ValidatedLayout>>
+      validated_layouts_
+      ABSL_GUARDED_BY(validated_layouts_mu_);
+  mutable absl::Mutex validated_layouts_mu_;
 };
 
 }  // namespace reverb
@@ -0,0 +1,122 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/sampler_pool.h"
+
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/sampler.h"
+
+namespace deepmind {
+namespace reverb {
+
+SamplerPool* SamplerPool::Default() {
+  static auto* pool = new SamplerPool();
+  return pool;
+}
+
+std::string SamplerPool::MakeKey(absl::string_view server_address,
+                                 absl::string_view table,
+                                 const Sampler::Options& options) {
+  return absl::StrFormat(
+      "%s|%s|max_samples=%d|max_in_flight_samples_per_worker=%d|"
+      "num_workers=%d|max_samples_per_stream=%d|rate_limiter_timeout=%s|"
+      "flexible_batch_size=%d|reuse_decoded_chunks=%d|"
+      "decoded_chunk_cache=%p|max_cached_chunks_per_stream=%d|"
+      "worker_stall_timeout=%s|autotune=%d|output_allocator=%p|"
+      "num_decoding_threads=%d|decompress_on_server=%d|"
+      "trim_chunks_on_server=%d|deduplicate_chunks_in_responses=%d|"
+      "columns=%s|mixture=%s|transforms=%s|lazy_decoding=%d|"
+      "chunk_decoder=%p",
+      server_address, table, options.max_samples,
+      options.max_in_flight_samples_per_worker, options.num_workers,
+      options.max_samples_per_stream,
+      absl::FormatDuration(options.rate_limiter_timeout),
+      options.flexible_batch_size,
+      static_cast<int>(options.reuse_decoded_chunks),
+      options.decoded_chunk_cache.get(), options.max_cached_chunks_per_stream,
+      absl::FormatDuration(options.worker_stall_timeout),
+      static_cast<int>(options.autotune), options.output_allocator,
+      options.num_decoding_threads,
+      static_cast<int>(options.decompress_on_server),
+      static_cast<int>(options.trim_chunks_on_server),
+      static_cast<int>(options.deduplicate_chunks_in_responses),
+      absl::StrJoin(options.columns, ","),
+      absl::StrJoin(options.mixture, ",", absl::PairFormatter(":")),
+      absl::StrJoin(options.transforms, ",",
+                    [](std::string* out, const auto& transform) {
+                      absl::StrAppendFormat(out, "%p", transform.get());
+                    }),
+      static_cast<int>(options.lazy_decoding), options.chunk_decoder.get());
+}
+
+absl::Status SamplerPool::GetOrCreate(const std::string& key,
+                                      const Factory& factory,
+                                      std::shared_ptr<Sampler>* sampler) {
+  absl::MutexLock lock(&mu_);
+
+  // Drop the entries of samplers which have already been destroyed.
+  for (auto it = samplers_.begin(); it != samplers_.end();) {
+    if (it->second.expired()) {
+      samplers_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+
+  if (auto it = samplers_.find(key); it != samplers_.end()) {
+    if (auto existing = it->second.lock()) {
+      *sampler = std::move(existing);
+      return absl::OkStatus();
+    }
+  }
+
+  std::unique_ptr<Sampler> created;
+  REVERB_RETURN_IF_ERROR(factory(&created));
+  *sampler = std::shared_ptr<Sampler>(std::move(created));
+  samplers_[key] = *sampler;
+  return absl::OkStatus();
+}
+
+void SamplerPool::Evict(const std::string& key, const Sampler* sampler) {
+  absl::MutexLock lock(&mu_);
+  auto it = samplers_.find(key);
+  if (it == samplers_.end()) return;
+  auto existing = it->second.lock();
+  if (existing == nullptr || existing.get() == sampler) {
+    samplers_.erase(it);
+  }
+}
+
+int SamplerPool::size() const {
+  absl::MutexLock lock(&mu_);
+  int live = 0;
+  for (const auto& [key, sampler] : samplers_) {
+    if (!sampler.expired()) live++;
+  }
+  return live;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
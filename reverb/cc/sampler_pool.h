@@ -0,0 +1,82 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SAMPLER_POOL_H_
+#define REVERB_CC_SAMPLER_POOL_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/sampler.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Registry of `Sampler`s which lets multiple consumers in the same process
+// (e.g. the iterators of interleaved or replicated datasets) share the worker
+// streams of a single sampler rather than each opening their own.
+//
+// Samplers are keyed by a string which should identify everything that
+// affects the samples (see `MakeKey`). The pool only holds weak references so
+// a sampler is closed and destroyed once the last consumer releases it.
+//
+// Consumers of a shared sampler pop complete samples from its lock free queue
+// and must therefore only use `Sampler::GetNextTrajectory` and
+// `Sampler::GetNextBatch`, which support concurrent callers.
+class SamplerPool {
+ public:
+  using Factory = std::function<absl::Status(std::unique_ptr<Sampler>*)>;
+
+  // Returns the process wide pool.
+  static SamplerPool* Default();
+
+  // Builds a key from the server address, table name and all sampler options.
+  static std::string MakeKey(absl::string_view server_address,
+                             absl::string_view table,
+                             const Sampler::Options& options);
+
+  // Sets `sampler` to the live sampler registered under `key`. If there is no
+  // such sampler then a new one is created using `factory` and registered.
+  // The factory is called while holding the lock of the pool so concurrent
+  // calls with the same key never create more than one sampler.
+  absl::Status GetOrCreate(const std::string& key, const Factory& factory,
+                           std::shared_ptr<Sampler>* sampler)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Removes `sampler` from the pool so the next call to `GetOrCreate` with
+  // `key` creates a new sampler. Used when `sampler` has been closed. Does
+  // nothing if `key` is registered to a different sampler.
+  void Evict(const std::string& key, const Sampler* sampler)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Number of live samplers in the pool.
+  int size() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  mutable absl::Mutex mu_;
+  internal::flat_hash_map<std::string, std::weak_ptr<Sampler>> samplers_
+      ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SAMPLER_POOL_H_
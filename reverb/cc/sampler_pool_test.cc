@@ -0,0 +1,144 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/sampler_pool.h"
+
+#include <memory>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/sampler.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/table.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+std::shared_ptr<Table> MakeTable() {
+  return std::make_shared<Table>(
+      /*name=*/"queue",
+      /*sampler=*/std::make_shared<FifoSelector>(),
+      /*remover=*/std::make_shared<FifoSelector>(),
+      /*max_size=*/100,
+      /*max_times_sampled=*/1,
+      /*rate_limiter=*/std::make_shared<RateLimiter>(1, 1, 0, 100));
+}
+
+class SamplerPoolTest : public ::testing::Test {
+ protected:
+  SamplerPool::Factory MakeFactory() {
+    return [this](std::unique_ptr<Sampler>* sampler) {
+      num_created_++;
+      Sampler::Options options;
+      options.num_workers = 1;
+      *sampler = absl::make_unique<Sampler>(table_, options);
+      return absl::OkStatus();
+    };
+  }
+
+  std::shared_ptr<Table> table_ = MakeTable();
+  int num_created_ = 0;
+};
+
+TEST_F(SamplerPoolTest, SharesSamplerWithSameKey) {
+  SamplerPool pool;
+  std::shared_ptr<Sampler> a;
+  std::shared_ptr<Sampler> b;
+  REVERB_ASSERT_OK(pool.GetOrCreate("key", MakeFactory(), &a));
+  REVERB_ASSERT_OK(pool.GetOrCreate("key", MakeFactory(), &b));
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(num_created_, 1);
+  EXPECT_EQ(pool.size(), 1);
+}
+
+TEST_F(SamplerPoolTest, CreatesSeparateSamplersForDifferentKeys) {
+  SamplerPool pool;
+  std::shared_ptr<Sampler> a;
+  std::shared_ptr<Sampler> b;
+  REVERB_ASSERT_OK(pool.GetOrCreate("a", MakeFactory(), &a));
+  REVERB_ASSERT_OK(pool.GetOrCreate("b", MakeFactory(), &b));
+  EXPECT_NE(a, b);
+  EXPECT_EQ(num_created_, 2);
+  EXPECT_EQ(pool.size(), 2);
+}
+
+TEST_F(SamplerPoolTest, DestroysSamplerWhenReleased) {
+  SamplerPool pool;
+  std::shared_ptr<Sampler> sampler;
+  REVERB_ASSERT_OK(pool.GetOrCreate("key", MakeFactory(), &sampler));
+  sampler = nullptr;
+  EXPECT_EQ(pool.size(), 0);
+
+  REVERB_ASSERT_OK(pool.GetOrCreate("key", MakeFactory(), &sampler));
+  EXPECT_EQ(num_created_, 2);
+}
+
+TEST_F(SamplerPoolTest, EvictReplacesSampler) {
+  SamplerPool pool;
+  std::shared_ptr<Sampler> a;
+  std::shared_ptr<Sampler> b;
+  REVERB_ASSERT_OK(pool.GetOrCreate("key", MakeFactory(), &a));
+
+  // Evicting a different sampler has no effect.
+  pool.Evict("key", nullptr);
+  REVERB_ASSERT_OK(pool.GetOrCreate("key", MakeFactory(), &b));
+  EXPECT_EQ(a, b);
+
+  pool.Evict("key", a.get());
+  REVERB_ASSERT_OK(pool.GetOrCreate("key", MakeFactory(), &b));
+  EXPECT_NE(a, b);
+  EXPECT_EQ(num_created_, 2);
+}
+
+TEST_F(SamplerPoolTest, ReturnsFactoryError) {
+  SamplerPool pool;
+  std::shared_ptr<Sampler> sampler;
+  auto status = pool.GetOrCreate(
+      "key",
+      [](std::unique_ptr<Sampler>* sampler) {
+        return absl::UnavailableError("nope");
+      },
+      &sampler);
+  EXPECT_EQ(status.code(), absl::StatusCode::kUnavailable);
+  EXPECT_EQ(sampler, nullptr);
+  EXPECT_EQ(pool.size(), 0);
+}
+
+TEST(SamplerPoolMakeKeyTest, DependsOnAllInputs) {
+  Sampler::Options options;
+  const std::string key = SamplerPool::MakeKey("localhost:1234", "a", options);
+  EXPECT_EQ(key, SamplerPool::MakeKey("localhost:1234", "a", options));
+  EXPECT_NE(key, SamplerPool::MakeKey("localhost:1235", "a", options));
+  EXPECT_NE(key, SamplerPool::MakeKey("localhost:1234", "b", options));
+
+  Sampler::Options other = options;
+  other.num_workers = 7;
+  EXPECT_NE(key, SamplerPool::MakeKey("localhost:1234", "a", other));
+
+  other = options;
+  other.rate_limiter_timeout = absl::Seconds(1);
+  EXPECT_NE(key, SamplerPool::MakeKey("localhost:1234", "a", other));
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
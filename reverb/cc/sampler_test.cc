@@ -14,7 +14,9 @@
 
 #include "reverb/cc/sampler.h"
 
+#include <atomic>
 #include <list>
+#include <string>
 #include <vector>
 
 #include "grpcpp/client_context.h"
@@ -27,16 +29,23 @@
 #include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "reverb/cc/chunk_decoder.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/status_matchers.h"
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/reverb_service_mock.grpc.pb.h"
+#include "reverb/cc/sample_transform.h"
 #include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/support/decoded_chunk_cache.h"
+#include "reverb/cc/support/flight_recorder.h"
+#include "reverb/cc/support/signature.h"
 #include "reverb/cc/support/tf_util.h"
+#include "reverb/cc/support/trajectory_util.h"
 #include "reverb/cc/tensor_compression.h"
 #include "reverb/cc/testing/proto_test_util.h"
 #include "reverb/cc/testing/tensor_testutil.h"
 #include "reverb/cc/testing/time_testutil.h"
+#include "tensorflow/core/framework/allocator.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/tensor_util.h"
 #include "tensorflow/core/framework/types.pb.h"
@@ -157,6 +166,26 @@ tensorflow::Tensor MakeTensor(int length) {
   return tensor;
 }
 
+// Forwards to the CPU allocator and counts the allocations.
+class CountingAllocator : public tensorflow::Allocator {
+ public:
+  std::string Name() override { return "counting"; }
+
+  void* AllocateRaw(size_t alignment, size_t num_bytes) override {
+    num_allocations_++;
+    return tensorflow::cpu_allocator()->AllocateRaw(alignment, num_bytes);
+  }
+
+  void DeallocateRaw(void* ptr) override {
+    tensorflow::cpu_allocator()->DeallocateRaw(ptr);
+  }
+
+  int num_allocations() const { return num_allocations_; }
+
+ private:
+  std::atomic<int> num_allocations_{0};
+};
+
 template <tensorflow::DataType dtype>
 tensorflow::Tensor MakeConstantTensor(
     const tensorflow::TensorShape& shape,
@@ -206,6 +235,62 @@ SampleStreamResponse MakeResponse(int item_length, bool delta_encode = false,
   return response;
 }
 
+// Copy of the uint64 tensor `tensor` with `offset` added to all its values.
+tensorflow::Tensor AddOffset(const tensorflow::Tensor& tensor,
+                             tensorflow::uint64 offset) {
+  tensorflow::Tensor result(tensor.dtype(), tensor.shape());
+  for (int i = 0; i < tensor.NumElements(); i++) {
+    result.flat<tensorflow::uint64>()(i) =
+        tensor.flat<tensorflow::uint64>()(i) + offset;
+  }
+  return result;
+}
+
+class AddOffsetTransform : public SampleTransform {
+ public:
+  explicit AddOffsetTransform(tensorflow::uint64 offset) : offset_(offset) {}
+
+  absl::Status Apply(std::vector<tensorflow::Tensor>* columns) const override {
+    for (auto& column : *columns) {
+      column = AddOffset(column, offset_);
+    }
+    return absl::OkStatus();
+  }
+
+ private:
+  const tensorflow::uint64 offset_;
+};
+
+class DropColumnsTransform : public SampleTransform {
+ public:
+  absl::Status Apply(std::vector<tensorflow::Tensor>* columns) const override {
+    columns->clear();
+    return absl::OkStatus();
+  }
+};
+
+// Decodes columns like the sampler would and counts them.
+class CountingChunkDecoder : public ChunkDecoder {
+ public:
+  explicit CountingChunkDecoder(bool can_decode) : can_decode_(can_decode) {}
+
+  bool CanDecode(const ChunkData& chunk, int column) const override {
+    return can_decode_;
+  }
+
+  absl::Status Decode(const ChunkData& chunk, int column,
+                      tensorflow::Tensor* out) const override {
+    num_decoded_++;
+    return internal::UnpackChunkColumn(chunk, column, out);
+  }
+
+  int num_decoded() const { return num_decoded_; }
+
+ private:
+  const bool can_decode_;
+  mutable std::atomic<int> num_decoded_{0};
+};
+
 std::shared_ptr<Table> MakeTable(int max_size = 100) {
   return std::make_shared<Table>(
       /*name=*/"queue",
@@ -307,6 +392,45 @@ TEST(SampleTest, IsComposedOfTimesteps) {
   EXPECT_FALSE(non_timestep_sample.is_composed_of_timesteps());
 }
 
+TEST(SampleTest, GetNextWindowSpansChunks) {
+  Sample sample(
+      /*key=*/100,
+      /*probability=*/0.5,
+      /*table_size=*/2,
+      /*priority=*/1,
+      /*rate_limited=*/false,
+      /*column_chunks=*/{{MakeTensor(3), MakeTensor(4)}, {MakeTensor(7)}},
+      /*squeeze_columns=*/{false, false});
+
+  auto concat = [](std::vector<tensorflow::Tensor> parts) {
+    tensorflow::Tensor result;
+    REVERB_CHECK(tensorflow::tensor::Concat(parts, &result).ok());
+    return result;
+  };
+
+  std::vector<tensorflow::Tensor> first;
+  REVERB_ASSERT_OK(sample.GetNextWindow(/*length=*/4, /*shift=*/2, &first));
+  ASSERT_THAT(first, SizeIs(6));
+  ExpectTensorEqual<tensorflow::uint64>(
+      first[0], MakeConstantTensor<tensorflow::DT_UINT64>({4}, 100));
+  ExpectTensorEqual<tensorflow::uint64>(
+      first[4], concat({MakeTensor(3), MakeTensor(4).Slice(0, 1)}));
+  ExpectTensorEqual<tensorflow::uint64>(first[5], MakeTensor(7).Slice(0, 4));
+  EXPECT_FALSE(sample.is_end_of_sample());
+  EXPECT_EQ(sample.num_remaining_timesteps(), 5);
+
+  std::vector<tensorflow::Tensor> second;
+  REVERB_ASSERT_OK(sample.GetNextWindow(/*length=*/4, /*shift=*/2, &second));
+  ExpectTensorEqual<tensorflow::uint64>(
+      second[4],
+      concat({MakeTensor(3).Slice(2, 3), MakeTensor(4).Slice(0, 3)}));
+  ExpectTensorEqual<tensorflow::uint64>(second[5], MakeTensor(7).Slice(2, 6));
+
+  // The last 3 timesteps don't make up a complete window.
+  EXPECT_TRUE(sample.is_end_of_sample());
+  EXPECT_EQ(sample.num_remaining_timesteps(), 0);
+}
+
 TEST(SampleTest, RateLimited) {
   for (bool rate_limited : {true, false}) {
     Sample sample(
@@ -330,6 +454,96 @@ TEST(GrpcSamplerTest, SendsFirstRequest) {
   EXPECT_THAT(stub->requests(), SizeIs(1));
 }
 
+TEST(GrpcSamplerTest, TracesSampledRequests) {
+  auto stub = MakeGoodStub({MakeResponse(1)});
+  Sampler::Options options;
+  options.max_samples = 1;
+  options.max_in_flight_samples_per_worker = 1;
+  options.num_workers = 1;
+  options.trace_sampling_period = 1;
+  Sampler sampler(stub, "table", options);
+  std::vector<tensorflow::Tensor> sample;
+  bool end_of_sequence;
+  REVERB_EXPECT_OK(sampler.GetNextTimestep(&sample, &end_of_sequence));
+
+  ASSERT_THAT(stub->requests(), SizeIs(1));
+  const uint64_t trace_id = stub->requests()[0].trace_id();
+  EXPECT_NE(trace_id, 0);
+  std::vector<std::string> stages;
+  for (const auto& span : internal::FlightRecorder::Default()->Spans()) {
+    if (span.trace_id == trace_id) {
+      EXPECT_EQ(span.side, internal::TraceSide::kClient);
+      stages.push_back(span.stage);
+    }
+  }
+  EXPECT_THAT(stages, ::testing::IsSupersetOf(
+                          {"Chunk decompression", "Sampler queue",
+                           "PopNextSample"}));
+}
+
+TEST(GrpcSamplerTest, DoesNotTraceByDefault) {
+  auto stub = MakeGoodStub({MakeResponse(1)});
+  Sampler sampler(stub, "table", {1, 1, 1});
+  std::vector<tensorflow::Tensor> sample;
+  bool end_of_sequence;
+  REVERB_EXPECT_OK(sampler.GetNextTimestep(&sample, &end_of_sequence));
+  ASSERT_THAT(stub->requests(), SizeIs(1));
+  EXPECT_EQ(stub->requests()[0].trace_id(), 0);
+  EXPECT_FALSE(stub->requests()[0].decompress_chunks());
+}
+
+TEST(GrpcSamplerTest, RequestsDecompressionOnServerIfSet) {
+  auto stub = MakeGoodStub({MakeResponse(1)});
+  Sampler::Options options;
+  options.max_samples = 1;
+  options.max_in_flight_samples_per_worker = 1;
+  options.num_workers = 1;
+  options.decompress_on_server = true;
+  Sampler sampler(stub, "table", options);
+  std::vector<tensorflow::Tensor> sample;
+  bool end_of_sequence;
+  REVERB_EXPECT_OK(sampler.GetNextTimestep(&sample, &end_of_sequence));
+  ASSERT_THAT(stub->requests(), SizeIs(1));
+  EXPECT_TRUE(stub->requests()[0].decompress_chunks());
+}
+
+TEST(GrpcSamplerTest, RequestsTrimmingOnServerIfSet) {
+  auto stub = MakeGoodStub({MakeResponse(1)});
+  Sampler::Options options;
+  options.max_samples = 1;
+  options.max_in_flight_samples_per_worker = 1;
+  options.num_workers = 1;
+  options.trim_chunks_on_server = true;
+  Sampler sampler(stub, "table", options);
+  std::vector<tensorflow::Tensor> sample;
+  bool end_of_sequence;
+  REVERB_EXPECT_OK(sampler.GetNextTimestep(&sample, &end_of_sequence));
+  ASSERT_THAT(stub->requests(), SizeIs(1));
+  EXPECT_TRUE(stub->requests()[0].trim_chunks());
+  EXPECT_EQ(stub->requests()[0].max_cached_chunks(), 0);
+}
+
+TEST(GrpcSamplerTest, RequestsMixtureIfSet) {
+  auto stub = MakeGoodStub({MakeResponse(1)});
+  Sampler::Options options;
+  options.max_samples = 1;
+  options.max_in_flight_samples_per_worker = 1;
+  options.num_workers = 1;
+  options.mixture = {{"demos", 1}, {"online", 3}};
+  Sampler sampler(stub, "table", options);
+  std::vector<tensorflow::Tensor> sample;
+  bool end_of_sequence;
+  REVERB_EXPECT_OK(sampler.GetNextTimestep(&sample, &end_of_sequence));
+  ASSERT_THAT(stub->requests(), SizeIs(1));
+  const SampleStreamRequest& request = stub->requests()[0];
+  EXPECT_TRUE(request.table().empty());
+  ASSERT_THAT(request.mixture(), SizeIs(2));
+  EXPECT_EQ(request.mixture(0).table(), "demos");
+  EXPECT_EQ(request.mixture(0).weight(), 1);
+  EXPECT_EQ(request.mixture(1).table(), "online");
+  EXPECT_EQ(request.mixture(1).weight(), 3);
+}
+
 TEST(GrpcSamplerTest, SetsEndOfSequence) {
   auto stub = MakeGoodStub({MakeResponse(2), MakeResponse(1)});
   Sampler sampler(stub, "table", {2, 1});
@@ -464,6 +678,35 @@ TEST(LocalSamplerTest, GetNextSampleReturnsWholeSequence) {
   ExpectTensorEqual<tensorflow::uint64>(second[4], MakeTensor(3));
 }
 
+TEST(LocalSamplerTest, GetNextWindowDropsIncompleteWindows) {
+  auto table = MakeTable();
+  InsertItem(table.get(), 1, 1.0, {5});
+  InsertItem(table.get(), 2, 1.0, {2});
+  InsertItem(table.get(), 3, 1.0, {3});
+
+  Sampler sampler(table, {3});
+
+  // Windows of the first item start 2 timesteps apart, the second item is too
+  // short for a single window.
+  std::vector<std::pair<tensorflow::uint64, tensorflow::Tensor>> want = {
+      {1, MakeTensor(5).Slice(0, 3)},
+      {1, MakeTensor(5).Slice(2, 5)},
+      {3, MakeTensor(3)},
+  };
+  for (const auto& [key, data] : want) {
+    std::vector<tensorflow::Tensor> window;
+    REVERB_ASSERT_OK(sampler.GetNextWindow(/*length=*/3, /*shift=*/2, &window));
+    ASSERT_THAT(window, SizeIs(5));
+    ExpectTensorEqual<tensorflow::uint64>(
+        window[0], MakeConstantTensor<tensorflow::DT_UINT64>({3}, key));
+    ExpectTensorEqual<tensorflow::uint64>(window[4], data);
+  }
+
+  std::vector<tensorflow::Tensor> window;
+  EXPECT_EQ(sampler.GetNextWindow(/*length=*/0, /*shift=*/1, &window).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
 TEST(GrpcSamplerTest, GetNextSampleTrimsSequence) {
   auto stub = MakeGoodStub({
       MakeResponse(5, false, 1, 6),   // Trim offset at the start.
@@ -504,105 +747,691 @@ TEST(LocalSamplerTest, GetNextSampleTrimsSequence) {
 
   Sampler sampler(table, {3});
 
-  std::vector<tensorflow::Tensor> start_trimmed;
-  REVERB_EXPECT_OK(sampler.GetNextSample(&start_trimmed));
-  ASSERT_THAT(start_trimmed,
-              SizeIs(5));  // ID, probability, table size, priority, data.
-  ExpectTensorEqual<tensorflow::uint64>(
-      start_trimmed[4],
-      tensorflow::tensor::DeepCopy(MakeTensor(5).Slice(1, 5)));
+  std::vector<tensorflow::Tensor> start_trimmed;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&start_trimmed));
+  ASSERT_THAT(start_trimmed,
+              SizeIs(5));  // ID, probability, table size, priority, data.
+  ExpectTensorEqual<tensorflow::uint64>(
+      start_trimmed[4],
+      tensorflow::tensor::DeepCopy(MakeTensor(5).Slice(1, 5)));
+
+  std::vector<tensorflow::Tensor> end_trimmed;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&end_trimmed));
+  ASSERT_THAT(end_trimmed,
+              SizeIs(5));  // ID, probability, table size, priority, data.
+  ExpectTensorEqual<tensorflow::uint64>(end_trimmed[4],
+                                        MakeTensor(3).Slice(0, 2));
+
+  std::vector<tensorflow::Tensor> start_and_end_trimmed;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&start_and_end_trimmed));
+  ASSERT_THAT(start_and_end_trimmed,
+              SizeIs(5));  // ID, probability, table size, priority, data.
+
+  tensorflow::Tensor start_and_end_trimmer_want;
+  REVERB_EXPECT_OK(FromTensorflowStatus(tensorflow::tensor::Concat(
+      {
+          tensorflow::tensor::DeepCopy(MakeTensor(2).Slice(1, 2)),
+          tensorflow::tensor::DeepCopy(MakeTensor(3).Slice(0, 1)),
+      },
+      &start_and_end_trimmer_want)));
+
+  ExpectTensorEqual<tensorflow::uint64>(start_and_end_trimmed[4],
+                                        start_and_end_trimmer_want);
+}
+
+TEST(GrpcSamplerTest, GetNextSampleDecodesInParallel) {
+  auto stub = MakeGoodStub({
+      MakeResponse(5, false, 1, 6),
+      MakeResponse(3, false, 0, 4),
+      MakeResponse(2, false, 1, 10),
+  });
+  Sampler::Options options;
+  options.max_samples = 3;
+  options.max_in_flight_samples_per_worker = 1;
+  options.num_decoding_threads = 2;
+  Sampler sampler(stub, "table", options);
+
+  std::vector<tensorflow::Tensor> first;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&first));
+  ASSERT_THAT(first, SizeIs(5));
+  ExpectTensorEqual<tensorflow::uint64>(
+      first[4], tensorflow::tensor::DeepCopy(MakeTensor(6).Slice(1, 6)));
+
+  std::vector<tensorflow::Tensor> second;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&second));
+  ASSERT_THAT(second, SizeIs(5));
+  ExpectTensorEqual<tensorflow::uint64>(second[4], MakeTensor(4).Slice(0, 3));
+
+  std::vector<tensorflow::Tensor> third;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&third));
+  ASSERT_THAT(third, SizeIs(5));
+  ExpectTensorEqual<tensorflow::uint64>(
+      third[4], tensorflow::tensor::DeepCopy(MakeTensor(10).Slice(1, 3)));
+}
+
+TEST(LocalSamplerTest, GetNextTrajectoryDecodesInParallel) {
+  auto table = MakeTable();
+  InsertItem(table.get(), 1, 1.0, {2, 3}, 1, 2);
+
+  Sampler::Options options;
+  options.max_samples = 1;
+  options.num_decoding_threads = 4;
+  Sampler sampler(table, options);
+
+  std::vector<tensorflow::Tensor> trajectory;
+  REVERB_EXPECT_OK(sampler.GetNextTrajectory(&trajectory));
+  ASSERT_THAT(trajectory, SizeIs(5));
+
+  tensorflow::Tensor want;
+  REVERB_EXPECT_OK(FromTensorflowStatus(tensorflow::tensor::Concat(
+      {
+          tensorflow::tensor::DeepCopy(MakeTensor(2).Slice(1, 2)),
+          tensorflow::tensor::DeepCopy(MakeTensor(3).Slice(0, 1)),
+      },
+      &want)));
+  ExpectTensorEqual<tensorflow::uint64>(trajectory[4], want);
+}
+
+SampleStreamResponse MakeResponseWithChunkKey(uint64_t chunk_key,
+                                              int item_length, int offset,
+                                              int data_length) {
+  auto response = MakeResponse(item_length, /*delta_encode=*/false, offset,
+                               data_length);
+  auto* entry = response.mutable_entries(0);
+  entry->mutable_info()
+      ->mutable_item()
+      ->mutable_flat_trajectory()
+      ->mutable_columns(0)
+      ->mutable_chunk_slices(0)
+      ->set_chunk_key(chunk_key);
+  entry->mutable_data(0)->set_chunk_key(chunk_key);
+  return response;
+}
+
+TEST(GrpcSamplerTest, GetNextSampleUsesDecodedChunkCache) {
+  auto stub = MakeGoodStub({
+      MakeResponseWithChunkKey(7, /*item_length=*/2, /*offset=*/0, 5),
+      MakeResponseWithChunkKey(7, /*item_length=*/3, /*offset=*/2, 5),
+      MakeResponseWithChunkKey(8, /*item_length=*/1, /*offset=*/1, 4),
+  });
+  Sampler::Options options;
+  options.max_samples = 3;
+  options.max_in_flight_samples_per_worker = 1;
+  options.num_workers = 1;
+  options.decoded_chunk_cache =
+      std::make_shared<internal::DecodedChunkCache>(1 << 20);
+  Sampler sampler(stub, "table", options);
+
+  std::vector<tensorflow::Tensor> first;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&first));
+  ASSERT_THAT(first, SizeIs(5));  // ID, probability, table size, priority, data.
+  ExpectTensorEqual<tensorflow::uint64>(first[4], MakeTensor(5).Slice(0, 2));
+
+  std::vector<tensorflow::Tensor> second;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&second));
+  ASSERT_THAT(second, SizeIs(5));
+  ExpectTensorEqual<tensorflow::uint64>(
+      second[4], tensorflow::tensor::DeepCopy(MakeTensor(5).Slice(2, 5)));
+
+  std::vector<tensorflow::Tensor> third;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&third));
+  ASSERT_THAT(third, SizeIs(5));
+  ExpectTensorEqual<tensorflow::uint64>(
+      third[4], tensorflow::tensor::DeepCopy(MakeTensor(4).Slice(1, 2)));
+
+  auto stats = options.decoded_chunk_cache->stats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 2);
+  EXPECT_EQ(stats.num_entries, 2);
+}
+
+// Replaces the data of the response with a reference to its chunk.
+SampleStreamResponse ReferenceChunk(SampleStreamResponse response) {
+  auto* entry = response.mutable_entries(0);
+  entry->add_cached_chunk_keys(entry->data(0).chunk_key());
+  entry->clear_data();
+  return response;
+}
+
+TEST(GrpcSamplerTest, GetNextSampleResolvesCachedChunks) {
+  auto stub = MakeGoodStub({
+      MakeResponseWithChunkKey(7, /*item_length=*/2, /*offset=*/0, 5),
+      ReferenceChunk(
+          MakeResponseWithChunkKey(7, /*item_length=*/3, /*offset=*/2, 5)),
+  });
+  Sampler::Options options;
+  options.max_samples = 2;
+  options.max_in_flight_samples_per_worker = 2;
+  options.num_workers = 1;
+  options.max_cached_chunks_per_stream = 10;
+  Sampler sampler(stub, "table", options);
+
+  std::vector<tensorflow::Tensor> first;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&first));
+  ASSERT_THAT(first, SizeIs(5));
+  ExpectTensorEqual<tensorflow::uint64>(first[4], MakeTensor(5).Slice(0, 2));
+
+  std::vector<tensorflow::Tensor> second;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&second));
+  ASSERT_THAT(second, SizeIs(5));
+  ExpectTensorEqual<tensorflow::uint64>(
+      second[4], tensorflow::tensor::DeepCopy(MakeTensor(5).Slice(2, 5)));
+
+  ASSERT_FALSE(stub->requests().empty());
+  EXPECT_EQ(stub->requests()[0].max_cached_chunks(), 10);
+}
+
+TEST(GrpcSamplerTest, RequestsChunkDeduplicationIfSet) {
+  auto stub = MakeGoodStub({MakeResponse(1)});
+  Sampler::Options options;
+  options.max_samples = 1;
+  options.max_in_flight_samples_per_worker = 1;
+  options.num_workers = 1;
+  options.deduplicate_chunks_in_responses = true;
+  Sampler sampler(stub, "table", options);
+  std::vector<tensorflow::Tensor> sample;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&sample));
+  ASSERT_THAT(stub->requests(), SizeIs(1));
+  EXPECT_TRUE(stub->requests()[0].deduplicate_chunks());
+}
+
+TEST(GrpcSamplerTest, GetNextSampleResolvesChunksSentEarlierInResponse) {
+  auto response =
+      MakeResponseWithChunkKey(7, /*item_length=*/2, /*offset=*/0, 5);
+  auto second =
+      ReferenceChunk(
+          MakeResponseWithChunkKey(7, /*item_length=*/3, /*offset=*/2, 5))
+          .entries(0);
+  second.add_response_chunk_keys(second.cached_chunk_keys(0));
+  second.clear_cached_chunk_keys();
+  *response.add_entries() = std::move(second);
+
+  auto stub = MakeGoodStub({response});
+  Sampler::Options options;
+  options.max_samples = 2;
+  options.max_in_flight_samples_per_worker = 2;
+  options.num_workers = 1;
+  options.deduplicate_chunks_in_responses = true;
+  Sampler sampler(stub, "table", options);
+
+  std::vector<tensorflow::Tensor> first;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&first));
+  ASSERT_THAT(first, SizeIs(5));
+  ExpectTensorEqual<tensorflow::uint64>(first[4], MakeTensor(5).Slice(0, 2));
+
+  std::vector<tensorflow::Tensor> sample;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&sample));
+  ASSERT_THAT(sample, SizeIs(5));
+  ExpectTensorEqual<tensorflow::uint64>(
+      sample[4], tensorflow::tensor::DeepCopy(MakeTensor(5).Slice(2, 5)));
+}
+
+TEST(GrpcSamplerTest, GetNextSampleFailsIfResponseChunkIsMissing) {
+  auto response =
+      ReferenceChunk(
+          MakeResponseWithChunkKey(7, /*item_length=*/2, /*offset=*/0, 5));
+  auto* entry = response.mutable_entries(0);
+  entry->add_response_chunk_keys(entry->cached_chunk_keys(0));
+  entry->clear_cached_chunk_keys();
+  auto stub = MakeGoodStub({response});
+  Sampler::Options options;
+  options.max_samples = 1;
+  options.num_workers = 1;
+  options.deduplicate_chunks_in_responses = true;
+  Sampler sampler(stub, "table", options);
+
+  std::vector<tensorflow::Tensor> sample;
+  EXPECT_EQ(sampler.GetNextSample(&sample).code(),
+            absl::StatusCode::kInternal);
+}
+
+TEST(GrpcSamplerTest, GetNextSampleFailsIfCachedChunkIsMissing) {
+  auto stub = MakeGoodStub({ReferenceChunk(
+      MakeResponseWithChunkKey(7, /*item_length=*/2, /*offset=*/0, 5))});
+  Sampler::Options options;
+  options.max_samples = 1;
+  options.num_workers = 1;
+  Sampler sampler(stub, "table", options);
+
+  std::vector<tensorflow::Tensor> sample;
+  EXPECT_EQ(sampler.GetNextSample(&sample).code(),
+            absl::StatusCode::kInternal);
+}
+
+TEST(LocalSamplerTest, GetNextSampleReusesDecodedChunks) {
+  auto table = MakeTable();
+  InsertItem(table.get(), 1, 1.0, {5}, 1, 4);     // Trim offset at the start.
+  InsertItem(table.get(), 2, 1.0, {2, 3}, 1, 2);  // Trim offset and end.
+
+  Sampler::Options options;
+  options.max_samples = 2;
+  options.reuse_decoded_chunks = true;
+  Sampler sampler(table, options);
+
+  std::vector<tensorflow::Tensor> start_trimmed;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&start_trimmed));
+  ASSERT_THAT(start_trimmed,
+              SizeIs(5));  // ID, probability, table size, priority, data.
+  ExpectTensorEqual<tensorflow::uint64>(
+      start_trimmed[4],
+      tensorflow::tensor::DeepCopy(MakeTensor(5).Slice(1, 5)));
+
+  std::vector<tensorflow::Tensor> start_and_end_trimmed;
+  REVERB_EXPECT_OK(sampler.GetNextSample(&start_and_end_trimmed));
+  ASSERT_THAT(start_and_end_trimmed,
+              SizeIs(5));  // ID, probability, table size, priority, data.
+
+  tensorflow::Tensor start_and_end_trimmer_want;
+  REVERB_EXPECT_OK(FromTensorflowStatus(tensorflow::tensor::Concat(
+      {
+          tensorflow::tensor::DeepCopy(MakeTensor(2).Slice(1, 2)),
+          tensorflow::tensor::DeepCopy(MakeTensor(3).Slice(0, 1)),
+      },
+      &start_and_end_trimmer_want)));
+
+  ExpectTensorEqual<tensorflow::uint64>(start_and_end_trimmed[4],
+                                        start_and_end_trimmer_want);
+}
+
+TEST(GrpcSamplerTest, GetNextTrajectorySqueezesColumnsIfSet) {
+  auto stub = MakeGoodStub({
+      MakeResponse(
+          /*item_length=*/1,
+          /*delta_encode=*/false,
+          /*offset=*/1,
+          /*data_length=*/4,
+          /*squeeze=*/true),
+      MakeResponse(
+          /*item_length=*/1,
+          /*delta_encode=*/false,
+          /*offset=*/1,
+          /*data_length=*/4,
+          /*squeeze=*/false),
+  });
+  Sampler sampler(stub, "table", {3, 1});
+
+  std::vector<tensorflow::Tensor> squeezed;
+  REVERB_EXPECT_OK(sampler.GetNextTrajectory(&squeezed));
+  ASSERT_THAT(squeezed,
+              SizeIs(5));  // ID, probability, table size, priority, data.
+  ExpectTensorEqual<tensorflow::uint64>(
+      squeezed[4], tensorflow::tensor::DeepCopy(MakeTensor(4).SubSlice(1)));
+
+  std::vector<tensorflow::Tensor> not_squeezed;
+  REVERB_EXPECT_OK(sampler.GetNextTrajectory(&not_squeezed));
+  ASSERT_THAT(not_squeezed,
+              SizeIs(5));  // ID, probability, table size, priority, data.
+  ExpectTensorEqual<tensorflow::uint64>(
+      not_squeezed[4], tensorflow::tensor::DeepCopy(MakeTensor(4).Slice(1, 2)));
+}
+
+TEST(LocalSamplerTest, GetNextTrajectorySqueezesColumnsIfSet) {
+  auto table = MakeTable();
+  InsertItem(
+      /*table=*/table.get(),
+      /*key=*/1,
+      /*priority=*/1.0,
+      /*sequence_lengths=*/{5},
+      /*offset=*/2,
+      /*length=*/1,
+      /*squeeze=*/true);
+
+  InsertItem(
+      /*table=*/table.get(),
+      /*key=*/2,
+      /*priority=*/1.0,
+      /*sequence_lengths=*/{5},
+      /*offset=*/2,
+      /*length=*/1,
+      /*squeeze=*/false);
+
+  Sampler sampler(table, {2});
+
+  std::vector<tensorflow::Tensor> squeezed;
+  REVERB_EXPECT_OK(sampler.GetNextTrajectory(&squeezed));
+  ASSERT_THAT(squeezed,
+              SizeIs(5));  // ID, probability, table size, priority, data.
+  ExpectTensorEqual<tensorflow::uint64>(
+      squeezed[4], tensorflow::tensor::DeepCopy(MakeTensor(4).SubSlice(2)));
+
+  std::vector<tensorflow::Tensor> not_squeezed;
+  REVERB_EXPECT_OK(sampler.GetNextTrajectory(&not_squeezed));
+  ASSERT_THAT(not_squeezed,
+              SizeIs(5));  // ID, probability, table size, priority, data.
+  ExpectTensorEqual<tensorflow::uint64>(
+      not_squeezed[4], tensorflow::tensor::DeepCopy(MakeTensor(4).Slice(2, 3)));
+}
+
+TEST(SampleTest, CopyToBatchConcatenatesColumnChunks) {
+  Sample sample(
+      /*key=*/100,
+      /*probability=*/0.5,
+      /*table_size=*/2,
+      /*priority=*/1,
+      /*rate_limited=*/false,
+      /*column_chunks=*/{{MakeTensor(2), MakeTensor(3)}},
+      /*squeeze_columns=*/{false});
+
+  std::vector<tensorflow::Tensor> batch;
+  REVERB_ASSERT_OK(sample.AllocateBatch(2, &batch));
+  ASSERT_THAT(batch, SizeIs(5));
+  EXPECT_EQ(batch[4].shape(), tensorflow::TensorShape({2, 5, 2}));
+
+  REVERB_ASSERT_OK(sample.CopyToBatch(1, &batch));
+  EXPECT_EQ(batch[0].flat<tensorflow::uint64>()(1), 100);
+  EXPECT_EQ(batch[1].flat<double>()(1), 0.5);
+  EXPECT_EQ(batch[2].flat<tensorflow::int64>()(1), 2);
+  EXPECT_EQ(batch[3].flat<double>()(1), 1);
+
+  tensorflow::Tensor want;
+  REVERB_ASSERT_OK(FromTensorflowStatus(
+      tensorflow::tensor::Concat({MakeTensor(2), MakeTensor(3)}, &want)));
+  ExpectTensorEqual<tensorflow::uint64>(
+      tensorflow::tensor::DeepCopy(batch[4].SubSlice(1)), want);
+}
+
+TEST(SampleTest, ApplyTransformsReplacesColumns) {
+  Sample sample(
+      /*key=*/100,
+      /*probability=*/0.5,
+      /*table_size=*/2,
+      /*priority=*/1,
+      /*rate_limited=*/false,
+      /*column_chunks=*/{{MakeTensor(2), MakeTensor(3)}},
+      /*squeeze_columns=*/{false});
+  REVERB_ASSERT_OK(
+      sample.ApplyTransforms({std::make_shared<AddOffsetTransform>(10),
+                              std::make_shared<AddOffsetTransform>(1)}));
+
+  std::vector<tensorflow::Tensor> timesteps;
+  REVERB_ASSERT_OK(sample.AsBatchedTimesteps(&timesteps));
+  ASSERT_THAT(timesteps, SizeIs(5));
+  EXPECT_EQ(timesteps[0].NumElements(), 5);
+
+  tensorflow::Tensor want;
+  REVERB_ASSERT_OK(FromTensorflowStatus(
+      tensorflow::tensor::Concat({MakeTensor(2), MakeTensor(3)}, &want)));
+  ExpectTensorEqual<tensorflow::uint64>(timesteps[4], AddOffset(want, 11));
+}
+
+TEST(SampleTest, ApplyTransformsRejectsChangedNumberOfColumns) {
+  Sample sample(
+      /*key=*/100,
+      /*probability=*/0.5,
+      /*table_size=*/2,
+      /*priority=*/1,
+      /*rate_limited=*/false,
+      /*column_chunks=*/{{MakeTensor(2)}},
+      /*squeeze_columns=*/{false});
+  EXPECT_EQ(
+      sample.ApplyTransforms({std::make_shared<DropColumnsTransform>()})
+          .code(),
+      absl::StatusCode::kInvalidArgument);
+}
+
+TEST(LocalSamplerTest, GetNextTrajectoryAppliesTransforms) {
+  auto table = MakeTable();
+  InsertItem(
+      /*table=*/table.get(),
+      /*key=*/1,
+      /*priority=*/1.0,
+      /*sequence_lengths=*/{5},
+      /*offset=*/2,
+      /*length=*/1,
+      /*squeeze=*/true);
+
+  Sampler::Options options;
+  options.max_samples = 1;
+  options.transforms = {std::make_shared<AddOffsetTransform>(7)};
+  Sampler sampler(table, options);
+
+  std::vector<tensorflow::Tensor> trajectory;
+  REVERB_EXPECT_OK(sampler.GetNextTrajectory(&trajectory));
+  ASSERT_THAT(trajectory, SizeIs(5));
+  ExpectTensorEqual<tensorflow::uint64>(
+      trajectory[4],
+      AddOffset(tensorflow::tensor::DeepCopy(MakeTensor(4).SubSlice(2)), 7));
+}
+
+TEST(LocalSamplerTest, GetNextTrajectoryUsesChunkDecoder) {
+  for (bool can_decode : {true, false}) {
+    auto table = MakeTable();
+    InsertItem(
+        /*table=*/table.get(),
+        /*key=*/1,
+        /*priority=*/1.0,
+        /*sequence_lengths=*/{5},
+        /*offset=*/2,
+        /*length=*/1,
+        /*squeeze=*/true);
+
+    auto decoder = std::make_shared<CountingChunkDecoder>(can_decode);
+    Sampler::Options options;
+    options.max_samples = 1;
+    options.chunk_decoder = decoder;
+    Sampler sampler(table, options);
+
+    std::vector<tensorflow::Tensor> trajectory;
+    REVERB_EXPECT_OK(sampler.GetNextTrajectory(&trajectory));
+    ASSERT_THAT(trajectory, SizeIs(5));
+    ExpectTensorEqual<tensorflow::uint64>(
+        trajectory[4],
+        tensorflow::tensor::DeepCopy(MakeTensor(4).SubSlice(2)));
+    EXPECT_EQ(decoder->num_decoded(), can_decode ? 1 : 0);
+  }
+}
+
+Sample::EncodedSlice MakeEncodedSlice(ChunkData chunk_data, int offset,
+                                      int length) {
+  Sample::EncodedSlice encoded;
+  encoded.slice.set_chunk_key(chunk_data.chunk_key());
+  encoded.slice.set_offset(offset);
+  encoded.slice.set_length(length);
+  encoded.slice.set_index(0);
+  encoded.chunk = std::make_shared<ChunkStore::Chunk>(std::move(chunk_data));
+  return encoded;
+}
+
+TEST(SampleTest, GetColumnOnlyDecodesRequestedColumn) {
+  // The chunk of the second column doesn't hold the referenced column.
+  Sample::EncodedSlice missing =
+      MakeEncodedSlice(MakeChunkData(2, MakeSequenceRange(100, 0, 2)), 0, 3);
+  missing.slice.set_index(1);
+  Sample sample(
+      /*key=*/100,
+      /*probability=*/0.5,
+      /*table_size=*/2,
+      /*priority=*/1,
+      /*rate_limited=*/false,
+      /*encoded_columns=*/
+      {{MakeEncodedSlice(MakeChunkData(1, MakeSequenceRange(100, 0, 2)), 1, 2),
+        MakeEncodedSlice(MakeChunkData(3, MakeSequenceRange(100, 3, 4)), 0, 1)},
+       {std::move(missing)}},
+      /*squeeze_columns=*/{false, false});
+  EXPECT_EQ(sample.num_columns(), 2);
+  EXPECT_EQ(sample.key(), 100);
+
+  tensorflow::Tensor column;
+  REVERB_ASSERT_OK(sample.GetColumn(0, &column));
+  tensorflow::Tensor want;
+  REVERB_ASSERT_OK(FromTensorflowStatus(tensorflow::tensor::Concat(
+      {
+          tensorflow::tensor::DeepCopy(MakeTensor(3).Slice(1, 3)),
+          tensorflow::tensor::DeepCopy(MakeTensor(2).Slice(0, 1)),
+      },
+      &want)));
+  ExpectTensorEqual<tensorflow::uint64>(column, want);
+
+  // The second column is only decoded, and fails, when it is requested.
+  EXPECT_EQ(sample.GetColumn(1, &column).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(sample.GetColumn(2, &column).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(LocalSamplerTest, GetNextLazySampleDecodesColumnsOnAccess) {
+  auto table = MakeTable();
+  InsertItem(table.get(), 1, 1.0, {2, 3}, 1, 2);
+
+  Sampler::Options options;
+  options.max_samples = 1;
+  options.lazy_decoding = true;
+  Sampler sampler(table, options);
+
+  std::unique_ptr<Sample> sample;
+  REVERB_ASSERT_OK(sampler.GetNextLazySample(&sample));
+  EXPECT_EQ(sample->key(), 1);
+  ASSERT_EQ(sample->num_columns(), 1);
+
+  tensorflow::Tensor column;
+  REVERB_ASSERT_OK(sample->GetColumn(0, &column));
+  tensorflow::Tensor want;
+  REVERB_EXPECT_OK(FromTensorflowStatus(tensorflow::tensor::Concat(
+      {
+          tensorflow::tensor::DeepCopy(MakeTensor(2).Slice(1, 2)),
+          tensorflow::tensor::DeepCopy(MakeTensor(3).Slice(0, 1)),
+      },
+      &want)));
+  ExpectTensorEqual<tensorflow::uint64>(column, want);
+}
+
+TEST(LocalSamplerTest, GetNextTrajectoryDecodesLazySamples) {
+  auto table = MakeTable();
+  InsertItem(table.get(), 1, 1.0, {2, 3}, 1, 2);
+
+  Sampler::Options options;
+  options.max_samples = 1;
+  options.lazy_decoding = true;
+  Sampler sampler(table, options);
+
+  std::vector<tensorflow::Tensor> trajectory;
+  REVERB_EXPECT_OK(sampler.GetNextTrajectory(&trajectory));
+  ASSERT_THAT(trajectory, SizeIs(5));
+
+  tensorflow::Tensor want;
+  REVERB_EXPECT_OK(FromTensorflowStatus(tensorflow::tensor::Concat(
+      {
+          tensorflow::tensor::DeepCopy(MakeTensor(2).Slice(1, 2)),
+          tensorflow::tensor::DeepCopy(MakeTensor(3).Slice(0, 1)),
+      },
+      &want)));
+  ExpectTensorEqual<tensorflow::uint64>(trajectory[4], want);
+}
+
+TEST(SampleTest, AsTrajectoryAllocatesWithAllocator) {
+  CountingAllocator allocator;
+  Sample sample(
+      /*key=*/100,
+      /*probability=*/0.5,
+      /*table_size=*/2,
+      /*priority=*/1,
+      /*rate_limited=*/false,
+      /*column_chunks=*/{{MakeTensor(2), MakeTensor(3)}, {MakeTensor(1)}},
+      /*squeeze_columns=*/{false, true});
+
+  std::vector<tensorflow::Tensor> data;
+  REVERB_ASSERT_OK(sample.AsTrajectory(&data, &allocator));
+  ASSERT_THAT(data, SizeIs(6));
+
+  // The four info scalars and both columns, including the single chunk one.
+  EXPECT_EQ(allocator.num_allocations(), 6);
+  EXPECT_EQ(data[0].scalar<tensorflow::uint64>()(), 100);
+  EXPECT_EQ(data[3].scalar<double>()(), 1);
+
+  tensorflow::Tensor want;
+  REVERB_ASSERT_OK(FromTensorflowStatus(
+      tensorflow::tensor::Concat({MakeTensor(2), MakeTensor(3)}, &want)));
+  ExpectTensorEqual<tensorflow::uint64>(data[4], want);
+  ExpectTensorEqual<tensorflow::uint64>(
+      data[5], tensorflow::tensor::DeepCopy(MakeTensor(1).SubSlice(0)));
+}
+
+TEST(SampleTest, AllocateBatchAllocatesWithAllocator) {
+  CountingAllocator allocator;
+  Sample sample(
+      /*key=*/100,
+      /*probability=*/0.5,
+      /*table_size=*/2,
+      /*priority=*/1,
+      /*rate_limited=*/false,
+      /*column_chunks=*/{{MakeTensor(2)}},
+      /*squeeze_columns=*/{false});
+
+  std::vector<tensorflow::Tensor> batch;
+  REVERB_ASSERT_OK(sample.AllocateBatch(2, &batch, &allocator));
+  ASSERT_THAT(batch, SizeIs(5));
+  EXPECT_EQ(allocator.num_allocations(), 5);
+}
+
+TEST(SampleTest, CopyToBatchRejectsDifferentShape) {
+  Sample sample(
+      /*key=*/100,
+      /*probability=*/0.5,
+      /*table_size=*/2,
+      /*priority=*/1,
+      /*rate_limited=*/false,
+      /*column_chunks=*/{{MakeTensor(2)}},
+      /*squeeze_columns=*/{false});
+  Sample longer_sample(
+      /*key=*/101,
+      /*probability=*/0.5,
+      /*table_size=*/2,
+      /*priority=*/1,
+      /*rate_limited=*/false,
+      /*column_chunks=*/{{MakeTensor(3)}},
+      /*squeeze_columns=*/{false});
+
+  std::vector<tensorflow::Tensor> batch;
+  REVERB_ASSERT_OK(sample.AllocateBatch(2, &batch));
+  EXPECT_EQ(longer_sample.CopyToBatch(0, &batch).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(LocalSamplerTest, GetNextBatchStacksTrajectories) {
+  auto table = MakeTable();
+  InsertItem(table.get(), 1, 1.0, {2, 3}, 1, 3);
+  InsertItem(table.get(), 2, 1.0, {5}, 2, 3);
 
-  std::vector<tensorflow::Tensor> end_trimmed;
-  REVERB_EXPECT_OK(sampler.GetNextSample(&end_trimmed));
-  ASSERT_THAT(end_trimmed,
-              SizeIs(5));  // ID, probability, table size, priority, data.
-  ExpectTensorEqual<tensorflow::uint64>(end_trimmed[4],
-                                        MakeTensor(3).Slice(0, 2));
+  Sampler sampler(table, {2});
 
-  std::vector<tensorflow::Tensor> start_and_end_trimmed;
-  REVERB_EXPECT_OK(sampler.GetNextSample(&start_and_end_trimmed));
-  ASSERT_THAT(start_and_end_trimmed,
-              SizeIs(5));  // ID, probability, table size, priority, data.
+  std::vector<tensorflow::Tensor> batch;
+  REVERB_ASSERT_OK(sampler.GetNextBatch(2, &batch));
+  ASSERT_THAT(batch, SizeIs(5));  // ID, probability, table size, priority, data.
+  EXPECT_EQ(batch[0].shape(), tensorflow::TensorShape({2}));
+  EXPECT_EQ(batch[0].flat<tensorflow::uint64>()(0), 1);
+  EXPECT_EQ(batch[0].flat<tensorflow::uint64>()(1), 2);
+  EXPECT_EQ(batch[4].shape(), tensorflow::TensorShape({2, 3, 2}));
 
-  tensorflow::Tensor start_and_end_trimmer_want;
-  REVERB_EXPECT_OK(FromTensorflowStatus(tensorflow::tensor::Concat(
+  tensorflow::Tensor first_want;
+  REVERB_ASSERT_OK(FromTensorflowStatus(tensorflow::tensor::Concat(
       {
           tensorflow::tensor::DeepCopy(MakeTensor(2).Slice(1, 2)),
-          tensorflow::tensor::DeepCopy(MakeTensor(3).Slice(0, 1)),
+          tensorflow::tensor::DeepCopy(MakeTensor(3).Slice(0, 2)),
       },
-      &start_and_end_trimmer_want)));
-
-  ExpectTensorEqual<tensorflow::uint64>(start_and_end_trimmed[4],
-                                        start_and_end_trimmer_want);
-}
-
-TEST(GrpcSamplerTest, GetNextTrajectorySqueezesColumnsIfSet) {
-  auto stub = MakeGoodStub({
-      MakeResponse(
-          /*item_length=*/1,
-          /*delta_encode=*/false,
-          /*offset=*/1,
-          /*data_length=*/4,
-          /*squeeze=*/true),
-      MakeResponse(
-          /*item_length=*/1,
-          /*delta_encode=*/false,
-          /*offset=*/1,
-          /*data_length=*/4,
-          /*squeeze=*/false),
-  });
-  Sampler sampler(stub, "table", {3, 1});
-
-  std::vector<tensorflow::Tensor> squeezed;
-  REVERB_EXPECT_OK(sampler.GetNextTrajectory(&squeezed));
-  ASSERT_THAT(squeezed,
-              SizeIs(5));  // ID, probability, table size, priority, data.
+      &first_want)));
   ExpectTensorEqual<tensorflow::uint64>(
-      squeezed[4], tensorflow::tensor::DeepCopy(MakeTensor(4).SubSlice(1)));
-
-  std::vector<tensorflow::Tensor> not_squeezed;
-  REVERB_EXPECT_OK(sampler.GetNextTrajectory(&not_squeezed));
-  ASSERT_THAT(not_squeezed,
-              SizeIs(5));  // ID, probability, table size, priority, data.
+      tensorflow::tensor::DeepCopy(batch[4].SubSlice(0)), first_want);
   ExpectTensorEqual<tensorflow::uint64>(
-      not_squeezed[4], tensorflow::tensor::DeepCopy(MakeTensor(4).Slice(1, 2)));
+      tensorflow::tensor::DeepCopy(batch[4].SubSlice(1)),
+      tensorflow::tensor::DeepCopy(MakeTensor(5).Slice(2, 5)));
+
+  // All samples have been returned.
+  EXPECT_EQ(sampler.GetNextBatch(1, &batch).code(),
+            absl::StatusCode::kOutOfRange);
 }
 
-TEST(LocalSamplerTest, GetNextTrajectorySqueezesColumnsIfSet) {
+TEST(LocalSamplerTest, GetNextBatchRejectsBatchLargerThanMaxSamples) {
   auto table = MakeTable();
-  InsertItem(
-      /*table=*/table.get(),
-      /*key=*/1,
-      /*priority=*/1.0,
-      /*sequence_lengths=*/{5},
-      /*offset=*/2,
-      /*length=*/1,
-      /*squeeze=*/true);
-
-  InsertItem(
-      /*table=*/table.get(),
-      /*key=*/2,
-      /*priority=*/1.0,
-      /*sequence_lengths=*/{5},
-      /*offset=*/2,
-      /*length=*/1,
-      /*squeeze=*/false);
-
-  Sampler sampler(table, {2});
+  InsertItem(table.get(), 1, 1.0, {2});
 
-  std::vector<tensorflow::Tensor> squeezed;
-  REVERB_EXPECT_OK(sampler.GetNextTrajectory(&squeezed));
-  ASSERT_THAT(squeezed,
-              SizeIs(5));  // ID, probability, table size, priority, data.
-  ExpectTensorEqual<tensorflow::uint64>(
-      squeezed[4], tensorflow::tensor::DeepCopy(MakeTensor(4).SubSlice(2)));
+  Sampler sampler(table, {1});
 
-  std::vector<tensorflow::Tensor> not_squeezed;
-  REVERB_EXPECT_OK(sampler.GetNextTrajectory(&not_squeezed));
-  ASSERT_THAT(not_squeezed,
-              SizeIs(5));  // ID, probability, table size, priority, data.
-  ExpectTensorEqual<tensorflow::uint64>(
-      not_squeezed[4], tensorflow::tensor::DeepCopy(MakeTensor(4).Slice(2, 3)));
+  std::vector<tensorflow::Tensor> batch;
+  EXPECT_EQ(sampler.GetNextBatch(2, &batch).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(sampler.GetNextBatch(0, &batch).code(),
+            absl::StatusCode::kInvalidArgument);
+  REVERB_EXPECT_OK(sampler.GetNextBatch(1, &batch));
 }
 
 TEST(LocalSamplerTest, RespectsMaxInFlightItems) {
@@ -649,9 +1478,9 @@ TEST(LocalSamplerTest, Close) {
   EXPECT_EQ(sampler.GetNextSample(&third).code(), absl::StatusCode::kCancelled);
 }
 
-TEST(GrpcSamplerTest, RespectsBufferSizeAndMaxSamples) {
+TEST(GrpcSamplerTest, GrantsCreditsAsQueueDrainsAndRespectsMaxSamples) {
   const int kMaxSamples = 20;
-  const int kMaxInFlightSamplesPerWorker = 11;
+  const int kMaxInFlightSamplesPerWorker = 10;
   const int kNumWorkers = 1;
 
   std::vector<SampleStreamResponse> responses;
@@ -661,12 +1490,8 @@ TEST(GrpcSamplerTest, RespectsBufferSizeAndMaxSamples) {
   Sampler sampler(stub, "table",
                   {kMaxSamples, kMaxInFlightSamplesPerWorker, kNumWorkers});
 
-  test::WaitFor(
-      [&]() {
-        return !stub->requests().empty() && stub->requests()[0].num_samples() ==
-                                                kMaxInFlightSamplesPerWorker;
-      },
-      absl::Milliseconds(10), 100);
+  test::WaitFor([&]() { return !stub->requests().empty(); },
+                absl::Milliseconds(10), 100);
 
   std::vector<tensorflow::Tensor> sample;
   bool end_of_sequence;
@@ -674,45 +1499,47 @@ TEST(GrpcSamplerTest, RespectsBufferSizeAndMaxSamples) {
   // The first request should aim to fill up the buffer.
   ASSERT_THAT(stub->requests(), SizeIs(1));
   EXPECT_EQ(stub->requests()[0].num_samples(), kMaxInFlightSamplesPerWorker);
+  EXPECT_TRUE(stub->requests()[0].credit_flow_control());
 
   // The queue outside the workers has size `num_workers` (i.e 1 here) so in
   // addition to the samples actually returned to the user, an additional
   // sample is considered to been "consumed" from the perspective of the worker.
 
-  // The first 9 (9 + 1 = 10) pops should not result in a new request.
-  for (int i = 0; i < kMaxInFlightSamplesPerWorker - kNumWorkers - 1; i++) {
+  // The first 3 (3 + 1 = 4) pops leave more than half of the window in flight
+  // so no credits are granted.
+  for (int i = 0; i < 3; i++) {
     REVERB_EXPECT_OK(sampler.GetNextTimestep(&sample, &end_of_sequence));
   }
-
   test::WaitFor([&]() { return stub->requests().size() == 1; },
                 absl::Milliseconds(10), 100);
   EXPECT_THAT(stub->requests(), SizeIs(1));
 
-  // The 10th sample (+1 in the queue) mean that all the requested samples
-  // have been received and thus a new request is sent to retrieve more.
+  // Once half of the window has been received the received samples are
+  // replaced on the same stream.
   REVERB_EXPECT_OK(sampler.GetNextTimestep(&sample, &end_of_sequence));
-  test::WaitFor(
-      [&]() {
-        return stub->requests().size() == 2 &&
-               stub->requests()[1].num_samples() ==
-                   kMaxSamples - kMaxInFlightSamplesPerWorker;
-      },
-      absl::Milliseconds(10), 100);
-  EXPECT_THAT(stub->requests(), SizeIs(2));
+  test::WaitFor([&]() { return stub->requests().size() == 2; },
+                absl::Milliseconds(10), 100);
+  ASSERT_THAT(stub->requests(), SizeIs(2));
+  EXPECT_EQ(stub->requests()[1].credits(), 5);
+  EXPECT_EQ(stub->requests()[1].num_samples(), 0);
 
-  // The second request should respect the `max_samples` and thus only request
-  // 9 (9 + 11 = 20) more samples.
-  EXPECT_EQ(stub->requests()[1].num_samples(),
-            kMaxSamples - kMaxInFlightSamplesPerWorker);
+  // The last grant is limited by `max_samples` (10 + 5 + 5 = 20).
+  for (int i = 0; i < 5; i++) {
+    REVERB_EXPECT_OK(sampler.GetNextTimestep(&sample, &end_of_sequence));
+  }
+  test::WaitFor([&]() { return stub->requests().size() == 3; },
+                absl::Milliseconds(10), 100);
+  ASSERT_THAT(stub->requests(), SizeIs(3));
+  EXPECT_EQ(stub->requests()[2].credits(), 5);
 
-  // Consuming the remaining 10 samples should not trigger any more requests
-  // as this would violate `max_samples`.
-  for (int i = 0; i < 10; i++) {
+  // Consuming the remaining 11 samples should not grant any more credits as
+  // this would violate `max_samples`.
+  for (int i = 0; i < 11; i++) {
     REVERB_EXPECT_OK(sampler.GetNextTimestep(&sample, &end_of_sequence));
   }
-  test::WaitFor([&]() { return stub->requests().size() == 2; },
+  test::WaitFor([&]() { return stub->requests().size() == 3; },
                 absl::Milliseconds(10), 100);
-  EXPECT_THAT(stub->requests(), SizeIs(2));
+  EXPECT_THAT(stub->requests(), SizeIs(3));
 }
 
 TEST(GrpcSamplerTest, UnpacksDeltaEncodedTensors) {
@@ -976,6 +1803,191 @@ TEST(LocalSamplerTest, StressTestWithoutErrors) {
   sampler.Close();
 }
 
+TEST(LocalSamplerTest, GetWorkerStatsCountsReceivedSamples) {
+  const int kNumWorkers = 4;
+  const int kMaxSamples = 100;
+
+  auto table = MakeTable(kMaxSamples);
+  for (int i = 0; i < kMaxSamples; i++) {
+    InsertItem(table.get(), i, 1.0, {1});
+  }
+
+  Sampler::Options options;
+  options.num_workers = kNumWorkers;
+  options.max_samples = kMaxSamples;
+  options.flexible_batch_size = 3;
+  Sampler sampler(table, options);
+
+  for (int i = 0; i < kMaxSamples; i++) {
+    std::vector<tensorflow::Tensor> sample;
+    REVERB_ASSERT_OK(sampler.GetNextTrajectory(&sample));
+  }
+
+  // Closing the sampler joins the workers so the stats are final.
+  sampler.Close();
+
+  auto stats = sampler.GetWorkerStats();
+  ASSERT_THAT(stats, SizeIs(kNumWorkers));
+  int64_t received = 0;
+  for (const auto& worker : stats) {
+    EXPECT_EQ(worker.in_flight_samples, 0);
+    EXPECT_EQ(worker.stall_time, absl::ZeroDuration());
+    EXPECT_EQ(worker.stolen_samples, 0);
+    received += worker.received_samples;
+  }
+  EXPECT_EQ(received, kMaxSamples);
+}
+
+internal::DtypesAndShapes MakeTrajectorySpec(
+    tensorflow::PartialTensorShape data_shape) {
+  return std::vector<internal::TensorSpec>{
+      {"key", tensorflow::DT_UINT64, {}},
+      {"probability", tensorflow::DT_DOUBLE, {}},
+      {"table_size", tensorflow::DT_INT64, {}},
+      {"priority", tensorflow::DT_DOUBLE, {}},
+      {"data", tensorflow::DT_UINT64, std::move(data_shape)},
+  };
+}
+
+TEST(LocalSamplerTest, ValidatesEveryTrajectoryWithCachedLayouts) {
+  auto table = MakeTable();
+  for (int i = 0; i < 20; i++) {
+    InsertItem(table.get(), i, 1.0, {3 + i % 2});
+  }
+
+  Sampler::Options options;
+  options.max_samples = 20;
+  Sampler sampler(table, options, MakeTrajectorySpec({-1, 2}));
+
+  // Both layouts are accepted repeatedly, whether or not they are cached.
+  for (int i = 0; i < 20; i++) {
+    std::vector<tensorflow::Tensor> sample;
+    REVERB_ASSERT_OK(sampler.GetNextTrajectory(&sample));
+  }
+}
+
+TEST(LocalSamplerTest, IncompatibleTrajectoriesAreNeverCached) {
+  auto table = MakeTable();
+  InsertItem(table.get(), 1, 1.0, {3});
+  InsertItem(table.get(), 2, 1.0, {3});
+
+  Sampler::Options options;
+  options.max_samples = 2;
+  Sampler sampler(table, options, MakeTrajectorySpec({-1, 3}));
+
+  for (int i = 0; i < 2; i++) {
+    std::vector<tensorflow::Tensor> sample;
+    EXPECT_EQ(sampler.GetNextTrajectory(&sample).code(),
+              absl::StatusCode::kInvalidArgument);
+  }
+}
+
+TEST(LocalSamplerTest, StressTestWithWorkerStallTimeout) {
+  const int kNumWorkers = 32;
+  const int kMaxSamples = 2000;
+
+  auto table = MakeTable(kMaxSamples);
+  for (int i = 0; i < kMaxSamples; i++) {
+    InsertItem(table.get(), i, 1.0, {1});
+  }
+
+  // A timeout this short makes idle workers take over the in flight samples
+  // of workers which are merely descheduled, which must still produce exactly
+  // `max_samples` samples.
+  Sampler::Options options;
+  options.num_workers = kNumWorkers;
+  options.max_samples = kMaxSamples;
+  options.worker_stall_timeout = absl::Microseconds(100);
+  Sampler sampler(table, options);
+
+  for (int i = 0; i < kMaxSamples; i++) {
+    std::vector<tensorflow::Tensor> sample;
+    REVERB_ASSERT_OK(sampler.GetNextTrajectory(&sample));
+  }
+
+  std::vector<tensorflow::Tensor> sample;
+  EXPECT_EQ(sampler.GetNextTrajectory(&sample).code(),
+            absl::StatusCode::kOutOfRange);
+  sampler.Close();
+
+  int64_t received = 0;
+  for (const auto& worker : sampler.GetWorkerStats()) {
+    received += worker.received_samples;
+  }
+  EXPECT_GE(received, kMaxSamples);
+}
+
+TEST(LocalSamplerTest, AutotuneDeactivatesWorkersWhenConsumerIsSlow) {
+  const int kNumWorkers = 4;
+  const int kMaxSamples = 400;
+
+  auto table = MakeTable(kMaxSamples);
+  for (int i = 0; i < kMaxSamples; i++) {
+    InsertItem(table.get(), i, 1.0, {1});
+  }
+
+  Sampler::Options options;
+  options.num_workers = kNumWorkers;
+  options.max_samples = kMaxSamples;
+  options.max_in_flight_samples_per_worker = 8;
+  options.autotune = true;
+  Sampler sampler(table, options);
+
+  // Consuming slower than the workers produce keeps the queue full so the
+  // autotuner should shrink the batch size and then deactivate workers.
+  for (int i = 0; i < kMaxSamples; i++) {
+    std::vector<tensorflow::Tensor> sample;
+    REVERB_ASSERT_OK(sampler.GetNextTrajectory(&sample));
+    absl::SleepFor(absl::Microseconds(100));
+  }
+
+  std::vector<tensorflow::Tensor> sample;
+  EXPECT_EQ(sampler.GetNextTrajectory(&sample).code(),
+            absl::StatusCode::kOutOfRange);
+
+  auto stats = sampler.GetWorkerStats();
+  ASSERT_THAT(stats, SizeIs(kNumWorkers));
+  EXPECT_TRUE(stats[0].active);
+  EXPECT_FALSE(stats[kNumWorkers - 1].active);
+  sampler.Close();
+}
+
+TEST(LocalSamplerTest, SetWorkerLimitsDeactivatesWorkers) {
+  const int kNumWorkers = 4;
+  const int kMaxSamples = 100;
+
+  auto table = MakeTable(kMaxSamples);
+  for (int i = 0; i < kMaxSamples; i++) {
+    InsertItem(table.get(), i, 1.0, {1});
+  }
+
+  Sampler::Options options;
+  options.num_workers = kNumWorkers;
+  options.max_samples = kMaxSamples;
+  options.max_in_flight_samples_per_worker = 8;
+  Sampler sampler(table, options);
+  sampler.SetWorkerLimits(/*num_active_workers=*/1,
+                          /*max_samples_per_request=*/1);
+
+  auto stats = sampler.GetWorkerStats();
+  ASSERT_THAT(stats, SizeIs(kNumWorkers));
+  EXPECT_TRUE(stats[0].active);
+  for (int i = 1; i < kNumWorkers; i++) {
+    EXPECT_FALSE(stats[i].active);
+  }
+
+  // The active worker still fetches all the samples.
+  for (int i = 0; i < kMaxSamples; i++) {
+    std::vector<tensorflow::Tensor> sample;
+    REVERB_ASSERT_OK(sampler.GetNextTrajectory(&sample));
+  }
+  std::vector<tensorflow::Tensor> sample;
+  EXPECT_EQ(sampler.GetNextTrajectory(&sample).code(),
+            absl::StatusCode::kOutOfRange);
+  EXPECT_EQ(sampler.num_buffered_samples(), 0);
+  sampler.Close();
+}
+
 TEST(GrpcSamplerTest, StressTestWithTransientErrors) {
   const int kNumWorkers = 100;  // Should be larger than the number of CPUs.
   const int kMaxSamples = 10000;
@@ -1111,6 +2123,89 @@ TEST(SamplerOptionsTest, ValidateChecksFlexibleBatchSize) {
   EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
 }
 
+TEST(SamplerOptionsTest, ValidateChecksWorkerStallTimeout) {
+  Sampler::Options options;
+  options.worker_stall_timeout = absl::ZeroDuration();
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+  options.worker_stall_timeout = absl::Seconds(1);
+  REVERB_EXPECT_OK(options.Validate());
+}
+
+TEST(SamplerOptionsTest, ValidateChecksTraceSamplingPeriod) {
+  Sampler::Options options;
+  options.trace_sampling_period = -1;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+  options.trace_sampling_period = 100;
+  REVERB_EXPECT_OK(options.Validate());
+}
+
+TEST(SamplerOptionsTest, ValidateChecksMaxCachedChunksPerStream) {
+  Sampler::Options options;
+  options.max_cached_chunks_per_stream = -1;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+  options.max_cached_chunks_per_stream = 100;
+  REVERB_EXPECT_OK(options.Validate());
+}
+
+TEST(SamplerOptionsTest, ValidateChecksTrimChunksOnServer) {
+  Sampler::Options options;
+  options.trim_chunks_on_server = true;
+  REVERB_EXPECT_OK(options.Validate());
+  options.max_cached_chunks_per_stream = 10;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST(SamplerOptionsTest, ValidateChecksDeduplicateChunksInResponses) {
+  Sampler::Options options;
+  options.deduplicate_chunks_in_responses = true;
+  REVERB_EXPECT_OK(options.Validate());
+  options.trim_chunks_on_server = true;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST(SamplerOptionsTest, ValidateChecksMixtureWeights) {
+  Sampler::Options options;
+  options.mixture = {{"demos", 1}, {"online", 0}};
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+  options.mixture[1].second = 2;
+  REVERB_EXPECT_OK(options.Validate());
+}
+
+TEST(SamplerOptionsTest, ValidateChecksTransforms) {
+  Sampler::Options options;
+  options.transforms = {nullptr};
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+  options.transforms = {std::make_shared<AddOffsetTransform>(1)};
+  REVERB_EXPECT_OK(options.Validate());
+}
+
+TEST(SamplerOptionsTest, ValidateChecksLazyDecodingWithoutTransforms) {
+  Sampler::Options options;
+  options.lazy_decoding = true;
+  REVERB_EXPECT_OK(options.Validate());
+  options.transforms = {std::make_shared<AddOffsetTransform>(1)};
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST(SamplerOptionsTest, ValidateChecksChunkDecoder) {
+  Sampler::Options options;
+  options.chunk_decoder = std::make_shared<CountingChunkDecoder>(true);
+  REVERB_EXPECT_OK(options.Validate());
+  options.reuse_decoded_chunks = true;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+  options.reuse_decoded_chunks = false;
+  options.lazy_decoding = true;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST(SamplerOptionsTest, ValidateChecksNumDecodingThreads) {
+  Sampler::Options options;
+  options.num_decoding_threads = -1;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+  options.num_decoding_threads = 4;
+  REVERB_EXPECT_OK(options.Validate());
+}
+
 }  // namespace
 }  // namespace reverb
 }  // namespace deepmind
@@ -0,0 +1,200 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/selectors/dary_heap.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/platform/huge_pages.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/interface.h"
+
+namespace deepmind {
+namespace reverb {
+
+DaryHeapSelector::DaryHeapSelector(bool min_heap, int arity)
+    : sign_(min_heap ? 1 : -1), arity_(arity) {
+  REVERB_CHECK_GE(arity_, 2);
+  REVERB_CHECK_LE(arity_, 16);
+}
+
+absl::Status DaryHeapSelector::Delete(ItemSelector::Key key) {
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
+  }
+  size_t index = it->second;
+  index_.erase(it);
+
+  // Fast path for removing from the back of the heap.
+  if (index == heap_.size() - 1) {
+    heap_.pop_back();
+    return absl::OkStatus();
+  }
+
+  // Move the last entry to the hole and restore the heap invariant.
+  Entry last = heap_.back();
+  heap_.pop_back();
+  Place(index, last);
+  if (index > 0 && Less(last, heap_[(index - 1) / arity_])) {
+    SiftUp(index);
+  } else {
+    SiftDown(index);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status DaryHeapSelector::Insert(ItemSelector::Key key, double priority) {
+  if (!index_.emplace(key, heap_.size()).second) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Key ", key, " already inserted."));
+  }
+  heap_.push_back({priority * sign_, update_count_++, key});
+  SiftUp(heap_.size() - 1);
+  return absl::OkStatus();
+}
+
+absl::Status DaryHeapSelector::InsertBatch(
+    absl::Span<const KeyWithPriority> items) {
+  if (items.size() < heap_.size()) {
+    return ItemSelector::InsertBatch(items);
+  }
+
+  // Append all the entries and rebuild the heap bottom-up (Floyd's method).
+  index_.reserve(index_.size() + items.size());
+  heap_.reserve(heap_.size() + items.size());
+  absl::Status status = absl::OkStatus();
+  for (const auto& item : items) {
+    if (!index_.emplace(item.key(), heap_.size()).second) {
+      status = absl::InvalidArgumentError(
+          absl::StrCat("Key ", item.key(), " already inserted."));
+      break;
+    }
+    heap_.push_back({item.priority() * sign_, update_count_++, item.key()});
+  }
+  // Inserts preceding a failure are still applied.
+  Heapify();
+  return status;
+}
+
+absl::Status DaryHeapSelector::Update(ItemSelector::Key key, double priority) {
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
+  }
+  size_t index = it->second;
+  Entry& entry = heap_[index];
+  entry.priority = priority * sign_;
+  entry.update_number = update_count_++;
+
+  // The update number always grows so the entry can only move towards the
+  // root if its priority decreased.
+  if (index > 0 && Less(entry, heap_[(index - 1) / arity_])) {
+    SiftUp(index);
+  } else {
+    SiftDown(index);
+  }
+  return absl::OkStatus();
+}
+
+ItemSelector::KeyWithProbability DaryHeapSelector::Sample() {
+  REVERB_CHECK(!heap_.empty());
+  return {heap_.front().key, 1.};
+}
+
+void DaryHeapSelector::Clear() {
+  heap_.clear();
+  index_.clear();
+}
+
+void DaryHeapSelector::Reserve(size_t num_keys) {
+  heap_.reserve(num_keys);
+  internal::AdviseHugePages(heap_.data(), heap_.capacity() * sizeof(Entry));
+  index_.reserve(num_keys);
+}
+
+absl::Status DaryHeapSelector::ScalePriorities(double factor) {
+  for (Entry& entry : heap_) entry.priority *= factor;
+  Heapify();
+  return absl::OkStatus();
+}
+
+KeyDistributionOptions DaryHeapSelector::options() const {
+  KeyDistributionOptions options;
+  options.mutable_heap()->set_min_heap(sign_ == 1);
+  options.mutable_heap()->set_arity(arity_);
+  options.set_is_deterministic(true);
+  return options;
+}
+
+std::string DaryHeapSelector::DebugString() const {
+  return absl::StrCat("DaryHeapSelector(sign=", sign_, ", arity=", arity_,
+                      ")");
+}
+
+void DaryHeapSelector::Place(size_t index, const Entry& entry) {
+  heap_[index] = entry;
+  index_[entry.key] = index;
+}
+
+void DaryHeapSelector::SiftUp(size_t index) {
+  const Entry entry = heap_[index];
+  const size_t start = index;
+  while (index > 0) {
+    size_t parent = (index - 1) / arity_;
+    if (!Less(entry, heap_[parent])) break;
+    Place(index, heap_[parent]);
+    index = parent;
+  }
+  if (index != start) Place(index, entry);
+}
+
+void DaryHeapSelector::SiftDown(size_t index) {
+  const Entry entry = heap_[index];
+  const size_t start = index;
+  const size_t size = heap_.size();
+  while (true) {
+    size_t first_child = arity_ * index + 1;
+    if (first_child >= size) break;
+
+    // Find the smallest child. The children are contiguous so this scan only
+    // touches one or two cache lines.
+    size_t last_child = std::min(first_child + arity_, size);
+    size_t best = first_child;
+    for (size_t child = first_child + 1; child < last_child; child++) {
+      if (Less(heap_[child], heap_[best])) best = child;
+    }
+
+    if (!Less(heap_[best], entry)) break;
+    Place(index, heap_[best]);
+    index = best;
+  }
+  if (index != start) Place(index, entry);
+}
+
+void DaryHeapSelector::Heapify() {
+  if (heap_.size() < 2) return;
+  for (size_t i = (heap_.size() - 2) / arity_ + 1; i > 0; --i) {
+    SiftDown(i - 1);
+  }
+}
+
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,129 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SELECTORS_DARY_HEAP_H_
+#define REVERB_CC_SELECTORS_DARY_HEAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/types/span.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/selectors/interface.h"
+
+namespace deepmind {
+namespace reverb {
+
+// DaryHeapSelector samples keys in the same order as `HeapSelector` (lowest or
+// highest priority first, ties broken by the least recent insert or update)
+// but stores the heap in a cache friendly layout:
+//
+//   * The `(priority, update_number, key)` entries are stored inline in a
+//     single contiguous array rather than as pointers to individually
+//     allocated nodes.
+//   * Every node has `arity` children stored next to each other so the
+//     children compared in one sift down step share one or two cache lines
+//     and the heap is only log_arity(n) levels deep.
+//
+// The position of every key in the array is tracked in a separate map which
+// is updated whenever an entry is moved.
+class DaryHeapSelector : public ItemSelector {
+ public:
+  static constexpr int kDefaultArity = 4;
+
+  // `arity` must be in [2, 16].
+  explicit DaryHeapSelector(bool min_heap = true, int arity = kDefaultArity);
+
+  // O(arity log_arity n) time.
+  absl::Status Delete(Key key) override;
+
+  // O(log_arity n) time.
+  absl::Status Insert(Key key, double priority) override;
+
+  // O(arity log_arity n) time.
+  absl::Status Update(Key key, double priority) override;
+
+  // Keys are ordered by insertion just as if `Insert` had been called for
+  // each key. O(n) time when the batch is at least as large as the existing
+  // heap, O(k log_arity n) time otherwise.
+  absl::Status InsertBatch(absl::Span<const KeyWithPriority> items) override;
+
+  // O(1) time.
+  KeyWithProbability Sample() override;
+
+  // O(n) time.
+  void Clear() override;
+
+  void Reserve(size_t num_keys) override;
+
+  // Rebuilds the heap bottom-up since rounding may turn distinct priorities
+  // into ties. O(n) time.
+  absl::Status ScalePriorities(double factor) override;
+
+  KeyDistributionOptions options() const override;
+
+  std::string DebugString() const override;
+
+ private:
+  struct Entry {
+    // Priority multiplied by `sign_`.
+    double priority;
+    uint64_t update_number;
+    Key key;
+  };
+
+  // Lexicographic ordering by (priority, update_number).
+  static bool Less(const Entry& a, const Entry& b) {
+    return (a.priority < b.priority) ||
+           ((a.priority == b.priority) && (a.update_number < b.update_number));
+  }
+
+  // Writes `entry` to `heap_[index]` and updates its position in `index_`.
+  void Place(size_t index, const Entry& entry);
+
+  // Restores the heap invariant by moving the entry at `index` towards the
+  // root or the leaves respectively. The position of the entry in `index_`
+  // must already be up to date.
+  void SiftUp(size_t index);
+  void SiftDown(size_t index);
+
+  // Restores the heap invariant of the entire array bottom-up (Floyd's
+  // method) in O(n) time.
+  void Heapify();
+
+  // 1 if `min_heap` = true, else -1. See `HeapSelector`.
+  const double sign_;
+
+  const int arity_;
+
+  // Entries in heap order. The children of `heap_[i]` are
+  // `heap_[arity_ * i + 1, ..., arity_ * i + arity_]`.
+  std::vector<Entry> heap_;
+
+  // Position of every key in `heap_`.
+  internal::flat_hash_map<Key, size_t> index_;
+
+  // Keep track of the number of inserts/updates for most-recent tie-breaking.
+  uint64_t update_count_ = 0;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SELECTORS_DARY_HEAP_H_
@@ -0,0 +1,206 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/selectors/dary_heap.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/heap.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/testing/proto_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+class DaryHeapSelectorTest : public ::testing::TestWithParam<int> {};
+
+TEST_P(DaryHeapSelectorTest, ReturnValueSantiyChecks) {
+  DaryHeapSelector heap(true, GetParam());
+
+  // Non existent keys cannot be deleted or updated.
+  EXPECT_EQ(heap.Delete(123).code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(heap.Update(123, 4).code(), absl::StatusCode::kInvalidArgument);
+
+  // Keys cannot be inserted twice.
+  REVERB_EXPECT_OK(heap.Insert(123, 4));
+  EXPECT_EQ(heap.Insert(123, 4).code(), absl::StatusCode::kInvalidArgument);
+
+  // Existing keys can be updated and sampled.
+  REVERB_EXPECT_OK(heap.Update(123, 5));
+  EXPECT_EQ(heap.Sample().key, 123);
+
+  // Existing keys cannot be deleted twice.
+  REVERB_EXPECT_OK(heap.Delete(123));
+  EXPECT_EQ(heap.Delete(123).code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST_P(DaryHeapSelectorTest, ScalePrioritiesKeepsOrder) {
+  DaryHeapSelector heap(true, GetParam());
+  for (int i = 0; i < 100; i++) {
+    REVERB_EXPECT_OK(heap.Insert(i, (i * 37) % 100 + 1));
+  }
+  REVERB_EXPECT_OK(heap.ScalePriorities(0.01));
+
+  // The new key is ordered relative to the scaled priorities.
+  REVERB_EXPECT_OK(heap.Insert(100, 0.505));
+  double last = 0;
+  for (int i = 0; i < 101; i++) {
+    const auto key = heap.Sample().key;
+    const double priority = key == 100 ? 50.5 : (key * 37) % 100 + 1;
+    EXPECT_GE(priority, last);
+    last = priority;
+    REVERB_EXPECT_OK(heap.Delete(key));
+  }
+}
+
+TEST_P(DaryHeapSelectorTest, BreakTiesByInsertionOrder) {
+  DaryHeapSelector heap(true, GetParam());
+  REVERB_EXPECT_OK(heap.Insert(5, 300));
+  REVERB_EXPECT_OK(heap.Insert(0, 1));
+  REVERB_EXPECT_OK(heap.Insert(3, 20));
+  REVERB_EXPECT_OK(heap.Insert(1, 1));
+  REVERB_EXPECT_OK(heap.Insert(4, 20));
+  REVERB_EXPECT_OK(heap.Insert(2, 1));
+
+  for (auto i = 0; i < 6; i++) {
+    EXPECT_EQ(heap.Sample().key, i);
+    REVERB_EXPECT_OK(heap.Delete(i));
+  }
+}
+
+TEST_P(DaryHeapSelectorTest, BreakTiesByUpdateOrder) {
+  DaryHeapSelector heap(true, GetParam());
+  REVERB_EXPECT_OK(heap.Insert(2, 1));
+  REVERB_EXPECT_OK(heap.Insert(0, 1));
+  REVERB_EXPECT_OK(heap.Insert(1, 1));
+  REVERB_EXPECT_OK(heap.Update(2, 1));
+  for (auto i = 0; i < 3; i++) {
+    EXPECT_EQ(heap.Sample().key, i);
+    REVERB_EXPECT_OK(heap.Delete(i));
+  }
+}
+
+TEST_P(DaryHeapSelectorTest, InsertBatchAppliesInsertsBeforeError) {
+  DaryHeapSelector heap(true, GetParam());
+  REVERB_EXPECT_OK(heap.Insert(1, 10));
+  EXPECT_EQ(heap.InsertBatch({testing::MakeKeyWithPriority(2, 5),
+                              testing::MakeKeyWithPriority(1, 1),
+                              testing::MakeKeyWithPriority(3, 1)})
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+
+  EXPECT_EQ(heap.Sample().key, 2);
+  REVERB_EXPECT_OK(heap.Delete(2));
+  EXPECT_EQ(heap.Sample().key, 1);
+  EXPECT_EQ(heap.Delete(3).code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST_P(DaryHeapSelectorTest, SampleMaxPriorityWhenMinHeapFalse) {
+  DaryHeapSelector heap(false, GetParam());
+  REVERB_EXPECT_OK(heap.Insert(123, 2));
+  REVERB_EXPECT_OK(heap.Insert(124, 1));
+  REVERB_EXPECT_OK(heap.Insert(125, 3));
+  EXPECT_EQ(heap.Sample().key, 125);
+  REVERB_EXPECT_OK(heap.Delete(125));
+  EXPECT_EQ(heap.Sample().key, 123);
+}
+
+TEST_P(DaryHeapSelectorTest, MatchesHeapSelectorUnderRandomOperations) {
+  absl::BitGen gen;
+  DaryHeapSelector heap(true, GetParam());
+  HeapSelector expected;
+  std::vector<ItemSelector::Key> keys;
+  ItemSelector::Key next_key = 0;
+
+  for (int i = 0; i < 20000; i++) {
+    double op = absl::Uniform<double>(gen, 0, 1);
+    if (keys.empty() || op < 0.4) {
+      // A few distinct priorities so ties have to be broken.
+      double priority = absl::Uniform<int>(gen, 0, 10);
+      REVERB_ASSERT_OK(heap.Insert(next_key, priority));
+      REVERB_ASSERT_OK(expected.Insert(next_key, priority));
+      keys.push_back(next_key++);
+    } else if (op < 0.7) {
+      auto key = keys[absl::Uniform<size_t>(gen, 0, keys.size())];
+      double priority = absl::Uniform<int>(gen, 0, 10);
+      REVERB_ASSERT_OK(heap.Update(key, priority));
+      REVERB_ASSERT_OK(expected.Update(key, priority));
+    } else if (op < 0.9) {
+      size_t index = absl::Uniform<size_t>(gen, 0, keys.size());
+      REVERB_ASSERT_OK(heap.Delete(keys[index]));
+      REVERB_ASSERT_OK(expected.Delete(keys[index]));
+      keys[index] = keys.back();
+      keys.pop_back();
+    } else {
+      // Pop the top like a `max_times_sampled=1` table.
+      auto key = expected.Sample().key;
+      REVERB_ASSERT_OK(heap.Delete(key));
+      REVERB_ASSERT_OK(expected.Delete(key));
+      keys.erase(std::find(keys.begin(), keys.end(), key));
+    }
+
+    if (!keys.empty()) {
+      ASSERT_EQ(heap.Sample().key, expected.Sample().key);
+    }
+  }
+}
+
+TEST_P(DaryHeapSelectorTest, InsertBatchMatchesInsert) {
+  absl::BitGen gen;
+  DaryHeapSelector batched(true, GetParam());
+  DaryHeapSelector expected(true, GetParam());
+
+  std::vector<KeyWithPriority> items;
+  for (int i = 0; i < 1000; i++) {
+    items.push_back(
+        testing::MakeKeyWithPriority(i, absl::Uniform<int>(gen, 0, 100)));
+    REVERB_ASSERT_OK(expected.Insert(i, items.back().priority()));
+  }
+  REVERB_ASSERT_OK(batched.InsertBatch(items));
+
+  for (int i = 0; i < 1000; i++) {
+    auto key = expected.Sample().key;
+    ASSERT_EQ(batched.Sample().key, key);
+    REVERB_ASSERT_OK(batched.Delete(key));
+    REVERB_ASSERT_OK(expected.Delete(key));
+  }
+}
+
+TEST_P(DaryHeapSelectorTest, Options) {
+  DaryHeapSelector min_heap(true, GetParam());
+  DaryHeapSelector max_heap(false, GetParam());
+  KeyDistributionOptions expected;
+  expected.mutable_heap()->set_min_heap(true);
+  expected.mutable_heap()->set_arity(GetParam());
+  expected.set_is_deterministic(true);
+  EXPECT_THAT(min_heap.options(), testing::EqualsProto(expected));
+  expected.mutable_heap()->set_min_heap(false);
+  EXPECT_THAT(max_heap.options(), testing::EqualsProto(expected));
+}
+
+INSTANTIATE_TEST_SUITE_P(Arities, DaryHeapSelectorTest,
+                         ::testing::Values(2, 4, 8, 16));
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
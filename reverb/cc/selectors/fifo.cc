@@ -24,25 +24,15 @@ namespace deepmind {
 namespace reverb {
 
 absl::Status FifoSelector::Delete(ItemSelector::Key key) {
-  auto it = key_to_iterator_.find(key);
-  if (it == key_to_iterator_.end())
-    return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
-  keys_.erase(it->second);
-  key_to_iterator_.erase(it);
-  return absl::OkStatus();
+  return keys_.Erase(key);
 }
 
 absl::Status FifoSelector::Insert(ItemSelector::Key key, double priority) {
-  if (key_to_iterator_.find(key) != key_to_iterator_.end()) {
-    return absl::InvalidArgumentError(
-        absl::StrCat("Key ", key, " already inserted."));
-  }
-  key_to_iterator_.emplace(key, keys_.emplace(keys_.end(), key));
-  return absl::OkStatus();
+  return keys_.PushBack(key);
 }
 
 absl::Status FifoSelector::Update(ItemSelector::Key key, double priority) {
-  if (key_to_iterator_.find(key) == key_to_iterator_.end()) {
+  if (!keys_.Contains(key)) {
     return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
   }
   return absl::OkStatus();
@@ -53,9 +43,12 @@ ItemSelector::KeyWithProbability FifoSelector::Sample() {
   return {keys_.front(), 1.};
 }
 
-void FifoSelector::Clear() {
-  keys_.clear();
-  key_to_iterator_.clear();
+void FifoSelector::Clear() { keys_.Clear(); }
+
+void FifoSelector::Reserve(size_t num_keys) { keys_.Reserve(num_keys); }
+
+absl::Status FifoSelector::ScalePriorities(double factor) {
+  return absl::OkStatus();
 }
 
 KeyDistributionOptions FifoSelector::options() const {
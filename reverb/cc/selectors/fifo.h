@@ -15,11 +15,9 @@
 #ifndef REVERB_CC_SELECTORS_FIFO_H_
 #define REVERB_CC_SELECTORS_FIFO_H_
 
-#include <list>
-
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
-#include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/key_sequence.h"
 
 namespace deepmind {
 namespace reverb {
@@ -42,13 +40,17 @@ class FifoSelector : public ItemSelector {
 
   void Clear() override;
 
+  void Reserve(size_t num_keys) override;
+
+  // This is a no-op as priorities are ignored.
+  absl::Status ScalePriorities(double factor) override;
+
   KeyDistributionOptions options() const override;
 
   std::string DebugString() const override;
 
  private:
-  std::list<Key> keys_;
-  internal::flat_hash_map<Key, std::list<Key>::iterator> key_to_iterator_;
+  internal::KeySequence keys_;
 };
 
 }  // namespace reverb
@@ -14,6 +14,8 @@
 
 #include "reverb/cc/selectors/heap.h"
 
+#include <vector>
+
 #include "absl/strings/str_cat.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
 #include "reverb/cc/schema.pb.h"
@@ -46,6 +48,28 @@ absl::Status HeapSelector::Insert(ItemSelector::Key key, double priority) {
   return absl::OkStatus();
 }
 
+absl::Status HeapSelector::InsertBatch(
+    absl::Span<const KeyWithPriority> items) {
+  nodes_.reserve(nodes_.size() + items.size());
+  std::vector<HeapNode*> inserted;
+  inserted.reserve(items.size());
+  absl::Status status = absl::OkStatus();
+  for (const auto& item : items) {
+    auto& node = nodes_[item.key()];
+    if (node != nullptr) {
+      status = absl::InvalidArgumentError(
+          absl::StrCat("Key ", item.key(), " already inserted."));
+      break;
+    }
+    node = absl::make_unique<HeapNode>(item.key(), item.priority() * sign_,
+                                       update_count_++);
+    inserted.push_back(node.get());
+  }
+  // Inserts preceding a failure are still applied.
+  heap_.PushBatch(inserted);
+  return status;
+}
+
 absl::Status HeapSelector::Update(ItemSelector::Key key, double priority) {
   if (!nodes_.contains(key)) {
     return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
@@ -66,6 +90,18 @@ void HeapSelector::Clear() {
   heap_.Clear();
 }
 
+absl::Status HeapSelector::ScalePriorities(double factor) {
+  std::vector<HeapNode*> nodes;
+  nodes.reserve(nodes_.size());
+  for (auto& entry : nodes_) {
+    entry.second->priority *= factor;
+    nodes.push_back(entry.second.get());
+  }
+  heap_.Clear();
+  heap_.PushBatch(nodes);
+  return absl::OkStatus();
+}
+
 
 KeyDistributionOptions HeapSelector::options() const {
   KeyDistributionOptions options;
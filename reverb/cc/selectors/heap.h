@@ -39,12 +39,21 @@ class HeapSelector : public ItemSelector {
   // O(log n) time.
   absl::Status Update(Key key, double priority) override;
 
+  // Keys are ordered by insertion just as if `Insert` had been called for
+  // each key. O(n) time when the batch is at least as large as the existing
+  // heap, O(k log n) time otherwise.
+  absl::Status InsertBatch(absl::Span<const KeyWithPriority> items) override;
+
   // O(1) time.
   KeyWithProbability Sample() override;
 
   // O(n) time.
   void Clear() override;
 
+  // Rebuilds the heap bottom-up since rounding may turn distinct priorities
+  // into ties. O(n) time.
+  absl::Status ScalePriorities(double factor) override;
+
   KeyDistributionOptions options() const override;
 
   std::string DebugString() const override;
@@ -80,6 +80,51 @@ TEST(HeapSelectorTest, BreakTiesByInsertionOrder) {
   }
 }
 
+TEST(HeapSelectorTest, ScalePrioritiesKeepsOrder) {
+  HeapSelector heap;
+  REVERB_EXPECT_OK(heap.Insert(2, 30));
+  REVERB_EXPECT_OK(heap.Insert(0, 10));
+  REVERB_EXPECT_OK(heap.Insert(1, 20));
+  REVERB_EXPECT_OK(heap.ScalePriorities(0.1));
+
+  // The new key is ordered relative to the scaled priorities.
+  REVERB_EXPECT_OK(heap.Insert(3, 2.5));
+  for (int key : {0, 1, 3, 2}) {
+    EXPECT_EQ(heap.Sample().key, key);
+    REVERB_EXPECT_OK(heap.Delete(key));
+  }
+}
+
+TEST(HeapSelectorTest, InsertBatchBreaksTiesByInsertionOrder) {
+  HeapSelector heap;
+  REVERB_EXPECT_OK(heap.Insert(5, 300));
+  REVERB_EXPECT_OK(heap.InsertBatch({testing::MakeKeyWithPriority(0, 1),
+                                     testing::MakeKeyWithPriority(3, 20),
+                                     testing::MakeKeyWithPriority(1, 1),
+                                     testing::MakeKeyWithPriority(4, 20),
+                                     testing::MakeKeyWithPriority(2, 1)}));
+
+  for (auto i = 0; i < 6; i++) {
+    EXPECT_EQ(heap.Sample().key, i);
+    REVERB_EXPECT_OK(heap.Delete(i));
+  }
+}
+
+TEST(HeapSelectorTest, InsertBatchAppliesInsertsBeforeError) {
+  HeapSelector heap;
+  REVERB_EXPECT_OK(heap.Insert(1, 10));
+  EXPECT_EQ(heap.InsertBatch({testing::MakeKeyWithPriority(2, 5),
+                              testing::MakeKeyWithPriority(1, 1),
+                              testing::MakeKeyWithPriority(3, 1)})
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+
+  EXPECT_EQ(heap.Sample().key, 2);
+  REVERB_EXPECT_OK(heap.Delete(2));
+  EXPECT_EQ(heap.Sample().key, 1);
+  EXPECT_EQ(heap.Delete(3).code(), absl::StatusCode::kInvalidArgument);
+}
+
 TEST(HeapSelectorTest, BreakTiesByUpdateOrder) {
   HeapSelector heap;
 
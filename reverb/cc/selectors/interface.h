@@ -16,8 +16,15 @@
 #define REVERB_CC_SELECTORS_INTERFACE_H_
 
 #include <cstdint>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
 #include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/schema.pb.h"
 
 namespace deepmind {
 namespace reverb {
@@ -51,12 +58,90 @@ class ItemSelector {
   // not exist.
   virtual absl::Status Update(Key key, double priority) = 0;
 
+  // Returns the error `Insert` and `Update` would return for `priority`, if
+  // any, regardless of the keys. Used to validate a batch of changes before
+  // any of it is applied.
+  virtual absl::Status CheckPriority(double priority) const {
+    return absl::OkStatus();
+  }
+
+  // Inserts several keys in the order they are listed. Returns an error
+  // (without inserting the remaining keys) as soon as an insert fails. Used
+  // when a large number of keys are inserted at once (e.g when restoring a
+  // checkpoint) so implementations can override this to build the underlying
+  // data structure in a single pass rather than one key at a time.
+  virtual absl::Status InsertBatch(absl::Span<const KeyWithPriority> items) {
+    for (const auto& item : items) {
+      auto status = Insert(item.key(), item.priority());
+      if (!status.ok()) return status;
+    }
+    return absl::OkStatus();
+  }
+
   // Samples a key. Must contain keys when this is called.
   virtual KeyWithProbability Sample() = 0;
 
+  // Updates the priorities of several keys in the order they are listed.
+  // Returns an error (without applying the remaining updates) as soon as an
+  // update fails. Implementations can override this to amortize the cost of
+  // restructuring the underlying data structure across the entire batch.
+  virtual absl::Status UpdateBatch(absl::Span<const KeyWithPriority> updates) {
+    for (const auto& update : updates) {
+      auto status = Update(update.key(), update.priority());
+      if (!status.ok()) return status;
+    }
+    return absl::OkStatus();
+  }
+
+  // Samples `num_samples` keys (with replacement) from the current
+  // distribution. Must contain keys when this is called. The result is
+  // equivalent to calling `Sample` `num_samples` times without modifying the
+  // distribution in between.
+  virtual std::vector<KeyWithProbability> SampleBatch(int num_samples) {
+    std::vector<KeyWithProbability> samples;
+    samples.reserve(num_samples);
+    for (int i = 0; i < num_samples; i++) {
+      samples.push_back(Sample());
+    }
+    return samples;
+  }
+
   // Clear the distribution of all data.
   virtual void Clear() = 0;
 
+  // Preallocates room for `num_keys` keys so the selector does not have to
+  // grow (e.g rehash its index) while it fills up. Large arrays are advised to
+  // be backed by huge pages (see `internal::AdviseHugePages`). This is only a
+  // hint; the reservation may be dropped by `Clear`. The default does nothing.
+  virtual void Reserve(size_t num_keys) {}
+
+  // Multiplies the priority of every key by `factor`, which must be positive
+  // and finite. A common factor preserves the order and the proportions of the
+  // priorities so implementations only have to rescale the priorities they
+  // store, in a single pass, rather than updating one key at a time. Used to
+  // apply a table wide decay of the priorities.
+  virtual absl::Status ScalePriorities(double factor) {
+    return absl::UnimplementedError(absl::StrCat(
+        DebugString(), " does not support scaling all priorities."));
+  }
+
+  // Raises priorities to `priority_exponent` from now on. The weights of the
+  // keys already held are recomputed, in a single pass, from their current
+  // priority as returned by `priority`. Returns `InvalidArgumentError` if the
+  // selector does not raise priorities to an exponent.
+  virtual absl::Status SetPriorityExponent(
+      double priority_exponent, absl::FunctionRef<double(Key)> priority) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        DebugString(), " does not have a priority exponent."));
+  }
+
+  // Total (unnormalized) sampling weight of all keys in the distribution. Used
+  // when sampling proportionally across several tables (see
+  // `TableInfo.sampling_weight`). Selectors that treat all keys as equally
+  // likely return `absl::nullopt`, in which case callers should fall back to
+  // the number of keys.
+  virtual absl::optional<double> TotalWeight() const { return absl::nullopt; }
+
   // Options for dynamically constructing the distribution. Required when
   // reconstructing class from checkpoint.  Also used to query table metadata.
   virtual KeyDistributionOptions options() const = 0;
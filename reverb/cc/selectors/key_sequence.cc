@@ -0,0 +1,156 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/selectors/key_sequence.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "reverb/cc/platform/huge_pages.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+constexpr size_t kInitialCapacity = 16;
+
+}  // namespace
+
+uint64_t KeyRing::PushBack(Key key) {
+  if (slots_.empty()) {
+    slots_.resize(kInitialCapacity);
+    live_.resize(kInitialCapacity);
+  } else if (tail_ - head_ == slots_.size()) {
+    Grow();
+  }
+  slots_[Index(tail_)] = key;
+  live_[Index(tail_)] = true;
+  size_++;
+  return tail_++;
+}
+
+void KeyRing::Erase(uint64_t pos, OnMove on_move) {
+  REVERB_CHECK(pos >= head_ && pos < tail_ && live_[Index(pos)]);
+  live_[Index(pos)] = false;
+  size_--;
+
+  // Drop the tombstones at the ends right away so `front` and `back` always
+  // refer to live keys.
+  while (head_ < tail_ && !live_[Index(head_)]) head_++;
+  while (head_ < tail_ && !live_[Index(tail_ - 1)]) tail_--;
+
+  if (tail_ - head_ > 2 * size_ && tail_ - head_ > kInitialCapacity) {
+    Compact(on_move);
+  }
+}
+
+KeyRing::Key KeyRing::front() const {
+  REVERB_CHECK(!empty());
+  return slots_[Index(head_)];
+}
+
+KeyRing::Key KeyRing::back() const {
+  REVERB_CHECK(!empty());
+  return slots_[Index(tail_ - 1)];
+}
+
+void KeyRing::Clear() {
+  slots_.clear();
+  slots_.shrink_to_fit();
+  live_.clear();
+  live_.shrink_to_fit();
+  head_ = 0;
+  tail_ = 0;
+  size_ = 0;
+}
+
+void KeyRing::Reserve(size_t capacity) {
+  size_t new_capacity = std::max(slots_.size(), kInitialCapacity);
+  while (new_capacity < capacity) new_capacity *= 2;
+  if (new_capacity != slots_.size()) Resize(new_capacity);
+}
+
+void KeyRing::Grow() { Resize(slots_.size() * 2); }
+
+void KeyRing::Resize(size_t capacity) {
+  std::vector<Key> slots(capacity);
+  std::vector<bool> live(slots.size());
+  for (uint64_t pos = head_; pos < tail_; pos++) {
+    slots[pos & (slots.size() - 1)] = slots_[Index(pos)];
+    live[pos & (slots.size() - 1)] = live_[Index(pos)];
+  }
+  slots_ = std::move(slots);
+  live_ = std::move(live);
+  AdviseHugePages(slots_.data(), slots_.size() * sizeof(Key));
+}
+
+void KeyRing::Compact(OnMove on_move) {
+  uint64_t write = head_;
+  for (uint64_t read = head_; read < tail_; read++) {
+    if (!live_[Index(read)]) continue;
+    const Key key = slots_[Index(read)];
+    live_[Index(read)] = false;
+    slots_[Index(write)] = key;
+    live_[Index(write)] = true;
+    if (read != write) on_move(key, write);
+    write++;
+  }
+  tail_ = write;
+  REVERB_CHECK_EQ(tail_ - head_, size_);
+}
+
+absl::Status KeySequence::PushBack(Key key) {
+  auto it = positions_.try_emplace(key, 0);
+  if (!it.second) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Key ", key, " already inserted."));
+  }
+  it.first->second = ring_.PushBack(key);
+  return absl::OkStatus();
+}
+
+absl::Status KeySequence::Erase(Key key) {
+  auto it = positions_.find(key);
+  if (it == positions_.end()) {
+    return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
+  }
+  const uint64_t pos = it->second;
+  positions_.erase(it);
+  ring_.Erase(pos, [this](Key moved, uint64_t new_pos) {
+    positions_[moved] = new_pos;
+  });
+  return absl::OkStatus();
+}
+
+bool KeySequence::Contains(Key key) const { return positions_.contains(key); }
+
+void KeySequence::Clear() {
+  ring_.Clear();
+  positions_.clear();
+}
+
+void KeySequence::Reserve(size_t num_keys) {
+  ring_.Reserve(num_keys);
+  positions_.reserve(num_keys);
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
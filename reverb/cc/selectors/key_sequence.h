@@ -0,0 +1,146 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SELECTORS_KEY_SEQUENCE_H_
+#define REVERB_CC_SELECTORS_KEY_SEQUENCE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "reverb/cc/platform/hash_map.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Ring buffer of keys in insertion order which supports O(1) (amortized)
+// insertion at the back, deletion by position and access to the oldest and
+// newest key. Keys are not required to be unique; the ring does not look keys
+// up so owners must keep track of the position returned by `PushBack`
+// themselves, typically in an index they already maintain for other purposes.
+//
+// The ring grows by doubling. Deleting a key only marks its slot as a
+// tombstone. Tombstones at either end are dropped right away and the buffer is
+// compacted once the tombstones outnumber the live keys, which moves the live
+// keys to new positions.
+//
+// The class is NOT thread safe.
+class KeyRing {
+ public:
+  using Key = uint64_t;
+
+  // Called with the key and its new position for every key moved by a
+  // compaction.
+  using OnMove = absl::FunctionRef<void(Key key, uint64_t pos)>;
+
+  // Appends `key` to the back of the ring and returns its position.
+  uint64_t PushBack(Key key);
+
+  // Erases the key at `pos`, which must hold a key that has not been erased.
+  // If this triggers a compaction, `on_move` is called for each moved key.
+  void Erase(uint64_t pos, OnMove on_move);
+
+  // Oldest and newest key of the ring. Must not be called if empty.
+  Key front() const;
+  Key back() const;
+
+  // Number of keys in the ring (tombstones are not included).
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  void Clear();
+
+  // Grows the buffer to hold at least `capacity` keys without further growth.
+  // Positions are preserved.
+  void Reserve(size_t capacity);
+
+ private:
+  // Slot of position `pos` in `slots_`.
+  size_t Index(uint64_t pos) const { return pos & (slots_.size() - 1); }
+
+  // Doubles the capacity of the buffer.
+  void Grow();
+
+  // Moves the keys to a buffer with `capacity` (a power of two) slots.
+  void Resize(size_t capacity);
+
+  // Moves all keys to the front of the buffer, removing the tombstones.
+  void Compact(OnMove on_move);
+
+  // Ring buffer with a (power of two) capacity. Positions [head_, tail_) are
+  // occupied by keys or tombstones. Positions are never reused until the
+  // buffer is compacted.
+  std::vector<Key> slots_;
+
+  // Whether the slot with the same index in `slots_` holds a key which has not
+  // been erased.
+  std::vector<bool> live_;
+
+  uint64_t head_ = 0;
+  uint64_t tail_ = 0;
+  size_t size_ = 0;
+};
+
+// Insertion ordered sequence of unique keys which supports O(1) (amortized)
+// insertion at the back, deletion of arbitrary keys and access to the oldest
+// and newest key.
+//
+// The keys are stored in a `KeyRing` together with a map from each key to its
+// position. Each key thus costs an 8 byte slot (and a bit) in the ring and a 16
+// byte entry in the position map rather than a heap allocated `std::list` node
+// and a map entry holding an iterator (~64 bytes in total).
+//
+// The class is NOT thread safe.
+class KeySequence {
+ public:
+  using Key = uint64_t;
+
+  // Appends `key` to the back of the sequence. Returns `InvalidArgumentError`
+  // if the key is already part of the sequence.
+  absl::Status PushBack(Key key);
+
+  // Removes `key` from the sequence. Returns `InvalidArgumentError` if the key
+  // is not part of the sequence.
+  absl::Status Erase(Key key);
+
+  bool Contains(Key key) const;
+
+  // Oldest and newest key of the sequence. Must not be called if empty.
+  Key front() const { return ring_.front(); }
+  Key back() const { return ring_.back(); }
+
+  // Number of keys in the sequence.
+  size_t size() const { return positions_.size(); }
+  bool empty() const { return positions_.empty(); }
+
+  void Clear();
+
+  // Preallocates room for `num_keys` keys.
+  void Reserve(size_t num_keys);
+
+ private:
+  KeyRing ring_;
+
+  // Position of every key in `ring_`.
+  internal::flat_hash_map<Key, uint64_t> positions_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SELECTORS_KEY_SEQUENCE_H_
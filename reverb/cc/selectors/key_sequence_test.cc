@@ -0,0 +1,184 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/selectors/key_sequence.h"
+
+#include <cstdint>
+#include <list>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "reverb/cc/platform/status_matchers.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(KeySequenceTest, ReturnValueSanityChecks) {
+  KeySequence keys;
+  EXPECT_EQ(keys.Erase(1).code(), absl::StatusCode::kInvalidArgument);
+  REVERB_EXPECT_OK(keys.PushBack(1));
+  EXPECT_EQ(keys.PushBack(1).code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_TRUE(keys.Contains(1));
+  REVERB_EXPECT_OK(keys.Erase(1));
+  EXPECT_FALSE(keys.Contains(1));
+  EXPECT_EQ(keys.Erase(1).code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_TRUE(keys.empty());
+}
+
+TEST(KeySequenceTest, FrontAndBackSkipErasedKeys) {
+  KeySequence keys;
+  for (int i = 0; i < 5; i++) {
+    REVERB_ASSERT_OK(keys.PushBack(i));
+  }
+  REVERB_ASSERT_OK(keys.Erase(0));
+  REVERB_ASSERT_OK(keys.Erase(1));
+  REVERB_ASSERT_OK(keys.Erase(4));
+  EXPECT_EQ(keys.front(), 2);
+  EXPECT_EQ(keys.back(), 3);
+  EXPECT_EQ(keys.size(), 2);
+}
+
+TEST(KeySequenceTest, ReinsertedKeyIsMovedToBack) {
+  KeySequence keys;
+  REVERB_ASSERT_OK(keys.PushBack(1));
+  REVERB_ASSERT_OK(keys.PushBack(2));
+  REVERB_ASSERT_OK(keys.PushBack(3));
+  REVERB_ASSERT_OK(keys.Erase(2));
+  REVERB_ASSERT_OK(keys.PushBack(2));
+  REVERB_ASSERT_OK(keys.Erase(1));
+  REVERB_ASSERT_OK(keys.Erase(3));
+
+  // The tombstone of the first insertion of 2 must not be mistaken for the
+  // new one.
+  EXPECT_EQ(keys.front(), 2);
+  EXPECT_EQ(keys.back(), 2);
+}
+
+TEST(KeySequenceTest, MatchesListUnderRandomOperations) {
+  absl::BitGen gen;
+  KeySequence keys;
+  std::list<KeySequence::Key> expected;
+  KeySequence::Key next_key = 0;
+
+  for (int i = 0; i < 100000; i++) {
+    // Grow the sequence for a while and then shrink it so both growing and
+    // compaction are exercised.
+    bool insert = expected.empty() ||
+                  absl::Bernoulli(gen, (i / 10000) % 2 == 0 ? 0.7 : 0.3);
+    if (insert) {
+      // Occasionally insert a key which has previously been erased.
+      KeySequence::Key key = next_key > 0 && absl::Bernoulli(gen, 0.1)
+                                 ? absl::Uniform<KeySequence::Key>(gen, 0,
+                                                                   next_key)
+                                 : next_key++;
+      if (keys.Contains(key)) continue;
+      REVERB_ASSERT_OK(keys.PushBack(key));
+      expected.push_back(key);
+    } else {
+      // Mostly erase from the front like a FIFO table with some random
+      // deletes in between.
+      auto it = expected.begin();
+      if (absl::Bernoulli(gen, 0.3)) {
+        std::advance(it, absl::Uniform<size_t>(gen, 0, expected.size()));
+      }
+      REVERB_ASSERT_OK(keys.Erase(*it));
+      expected.erase(it);
+    }
+
+    ASSERT_EQ(keys.size(), expected.size());
+    if (!expected.empty()) {
+      ASSERT_EQ(keys.front(), expected.front());
+      ASSERT_EQ(keys.back(), expected.back());
+    }
+  }
+}
+
+TEST(KeySequenceTest, Clear) {
+  KeySequence keys;
+  REVERB_ASSERT_OK(keys.PushBack(1));
+  keys.Clear();
+  EXPECT_TRUE(keys.empty());
+  EXPECT_FALSE(keys.Contains(1));
+  REVERB_EXPECT_OK(keys.PushBack(1));
+  EXPECT_EQ(keys.front(), 1);
+}
+
+TEST(KeyRingTest, CompactionReportsMovedKeys) {
+  KeyRing ring;
+  std::vector<uint64_t> positions;
+  for (KeyRing::Key key = 0; key < 100; key++) {
+    positions.push_back(ring.PushBack(key));
+  }
+
+  // Erase every key but the first and the last few so the tombstones trigger a
+  // compaction. The positions reported for the moved keys must remain valid.
+  auto on_move = [&positions](KeyRing::Key key, uint64_t pos) {
+    positions[key] = pos;
+  };
+  for (KeyRing::Key key = 1; key < 95; key++) {
+    ring.Erase(positions[key], on_move);
+  }
+  EXPECT_EQ(ring.size(), 6);
+  EXPECT_EQ(ring.front(), 0);
+  EXPECT_EQ(ring.back(), 99);
+
+  for (KeyRing::Key key = 95; key < 100; key++) {
+    ring.Erase(positions[key], on_move);
+  }
+  EXPECT_EQ(ring.size(), 1);
+  EXPECT_EQ(ring.front(), 0);
+  EXPECT_EQ(ring.back(), 0);
+}
+
+TEST(KeyRingTest, ReservePreservesPositions) {
+  KeyRing ring;
+  std::vector<uint64_t> positions;
+  for (KeyRing::Key key = 0; key < 10; key++) {
+    positions.push_back(ring.PushBack(key));
+  }
+  ring.Erase(positions[0], [](KeyRing::Key, uint64_t) {});
+  ring.Reserve(1000);
+  for (KeyRing::Key key = 10; key < 1000; key++) {
+    positions.push_back(ring.PushBack(key));
+  }
+  EXPECT_EQ(ring.size(), 999);
+  EXPECT_EQ(ring.front(), 1);
+  EXPECT_EQ(ring.back(), 999);
+
+  // The positions returned before the reservation still refer to their keys.
+  ring.Erase(positions[1], [](KeyRing::Key, uint64_t) {});
+  EXPECT_EQ(ring.front(), 2);
+}
+
+TEST(KeyRingTest, AllowsDuplicateKeys) {
+  KeyRing ring;
+  uint64_t first = ring.PushBack(1);
+  ring.PushBack(2);
+  ring.PushBack(1);
+  ring.Erase(first, [](KeyRing::Key, uint64_t) {});
+  EXPECT_EQ(ring.size(), 2);
+  EXPECT_EQ(ring.front(), 2);
+  EXPECT_EQ(ring.back(), 1);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
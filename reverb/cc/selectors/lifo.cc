@@ -14,6 +14,7 @@
 
 #include "reverb/cc/selectors/lifo.h"
 
+#include "absl/strings/str_cat.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/schema.pb.h"
@@ -23,25 +24,15 @@ namespace deepmind {
 namespace reverb {
 
 absl::Status LifoSelector::Delete(ItemSelector::Key key) {
-  auto it = key_to_iterator_.find(key);
-  if (it == key_to_iterator_.end())
-    return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
-  keys_.erase(it->second);
-  key_to_iterator_.erase(it);
-  return absl::OkStatus();
+  return keys_.Erase(key);
 }
 
 absl::Status LifoSelector::Insert(ItemSelector::Key key, double priority) {
-  if (key_to_iterator_.find(key) != key_to_iterator_.end()) {
-    return absl::InvalidArgumentError(
-        absl::StrCat("Key ", key, " already inserted."));
-  }
-  key_to_iterator_.emplace(key, keys_.emplace(keys_.begin(), key));
-  return absl::OkStatus();
+  return keys_.PushBack(key);
 }
 
 absl::Status LifoSelector::Update(ItemSelector::Key key, double priority) {
-  if (key_to_iterator_.find(key) == key_to_iterator_.end()) {
+  if (!keys_.Contains(key)) {
     return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
   }
   return absl::OkStatus();
@@ -49,12 +40,15 @@ absl::Status LifoSelector::Update(ItemSelector::Key key, double priority) {
 
 ItemSelector::KeyWithProbability LifoSelector::Sample() {
   REVERB_CHECK(!keys_.empty());
-  return {keys_.front(), 1.};
+  return {keys_.back(), 1.};
 }
 
-void LifoSelector::Clear() {
-  keys_.clear();
-  key_to_iterator_.clear();
+void LifoSelector::Clear() { keys_.Clear(); }
+
+void LifoSelector::Reserve(size_t num_keys) { keys_.Reserve(num_keys); }
+
+absl::Status LifoSelector::ScalePriorities(double factor) {
+  return absl::OkStatus();
 }
 
 KeyDistributionOptions LifoSelector::options() const {
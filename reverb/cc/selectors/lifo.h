@@ -15,12 +15,10 @@
 #ifndef REVERB_CC_SELECTORS_LIFO_H_
 #define REVERB_CC_SELECTORS_LIFO_H_
 
-#include <list>
-
 #include "absl/status/status.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
-#include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/key_sequence.h"
 
 namespace deepmind {
 namespace reverb {
@@ -43,13 +41,17 @@ class LifoSelector : public ItemSelector {
 
   void Clear() override;
 
+  void Reserve(size_t num_keys) override;
+
+  // This is a no-op as priorities are ignored.
+  absl::Status ScalePriorities(double factor) override;
+
   KeyDistributionOptions options() const override;
 
   std::string DebugString() const override;
 
  private:
-  std::list<Key> keys_;
-  internal::flat_hash_map<Key, std::list<Key>::iterator> key_to_iterator_;
+  internal::KeySequence keys_;
 };
 
 }  // namespace reverb
@@ -14,221 +14,193 @@
 
 #include "reverb/cc/selectors/prioritized.h"
 
-#include <cmath>
 #include <cstddef>
+#include <utility>
+#include <vector>
 
-#include "absl/random/distributions.h"
 #include "absl/random/random.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/status_macros.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/sum_tree.h"
 
 namespace deepmind {
 namespace reverb {
-namespace {
 
-// If the approximation error at a node exceeds this threshold, the sum tree is
-// reinitialized.
-constexpr double kMaxApproximationError = 1e-4;
+using internal::CheckValidPriority;
+using internal::PriorityToWeight;
 
-// A priority of zero should correspond to zero probability, even if the
-// priority exponent is zero. So this modified version of std::pow is used to
-// turn priorities into weights. Expects base and exponent to be non-negative.
-inline double power(double base, double exponent) {
-  return base == 0. ? 0. : std::pow(base, exponent);
-}
-
-absl::Status CheckValidPriority(double priority) {
-  if (std::isnan(priority))
-    return absl::InvalidArgumentError("Priority must not be NaN.");
-  if (priority < 0)
-    return absl::InvalidArgumentError(
-        "Priority must not be negative.");
-  return absl::OkStatus();
-}
-
-}  // namespace
+PrioritizedSelector::PrioritizedSelector(double priority_exponent,
+                                         internal::PhiloxBitGen bit_gen)
+    : PrioritizedSelector(
+          priority_exponent,
+          KeyDistributionOptions::Prioritized::BATCH_SAMPLING_INDEPENDENT,
+          std::move(bit_gen)) {}
 
 PrioritizedSelector::PrioritizedSelector(double priority_exponent,
-                                         absl::BitGen bit_gen)
+                                         BatchSampling batch_sampling,
+                                         internal::PhiloxBitGen bit_gen)
     : priority_exponent_(priority_exponent),
-      capacity_(std::pow(2, 17)),
-      sum_tree_(capacity_),
+      batch_sampling_(batch_sampling),
       bit_gen_(std::move(bit_gen)) {
   REVERB_CHECK_GE(priority_exponent_, 0);
 }
 
 absl::Status PrioritizedSelector::Delete(Key key) {
-  const size_t last_index = key_to_index_.size() - 1;
   const auto it = key_to_index_.find(key);
   if (it == key_to_index_.end())
     return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
   const size_t index = it->second;
+  key_to_index_.erase(it);
 
-  if (index != last_index) {
-    // Replace the element that we want to remove with the last element.
-    SetNode(index, NodeValue(last_index));
-    const Key last_key = sum_tree_[last_index].key;
-    sum_tree_[index].key = last_key;
-    key_to_index_[last_key] = index;
+  sum_tree_.Remove(index);
+  if (index != sum_tree_.size()) {
+    // The last key has been moved into the position of the removed key.
+    key_to_index_[sum_tree_.key(index)] = index;
   }
-
-  SetNode(last_index, 0);
-  key_to_index_.erase(it);  // Note that this must occur after SetNode.
-
   return absl::OkStatus();
 }
 
 absl::Status PrioritizedSelector::Insert(Key key, double priority) {
   REVERB_RETURN_IF_ERROR(CheckValidPriority(priority));
-  const size_t index = key_to_index_.size();
-  if (index == capacity_) {
-    capacity_ *= 2;
-    sum_tree_.resize(capacity_);
-  }
-  if (!key_to_index_.try_emplace(key, index).second) {
+  if (!key_to_index_.try_emplace(key, sum_tree_.size()).second) {
     return absl::InvalidArgumentError(
         absl::StrCat("Key ", key, " already inserted."));
   }
-  sum_tree_[index].key = key;
-
-  SetNode(index, power(priority, priority_exponent_));
+  sum_tree_.Append(key, PriorityToWeight(priority, priority_exponent_));
   return absl::OkStatus();
 }
 
+absl::Status PrioritizedSelector::InsertBatch(
+    absl::Span<const KeyWithPriority> items) {
+  key_to_index_.reserve(key_to_index_.size() + items.size());
+
+  std::vector<std::pair<Key, double>> leaves;
+  leaves.reserve(items.size());
+  absl::Status status = absl::OkStatus();
+  for (const auto& item : items) {
+    status = CheckValidPriority(item.priority());
+    if (!status.ok()) break;
+    const size_t index = sum_tree_.size() + leaves.size();
+    if (!key_to_index_.try_emplace(item.key(), index).second) {
+      status = absl::InvalidArgumentError(
+          absl::StrCat("Key ", item.key(), " already inserted."));
+      break;
+    }
+    leaves.emplace_back(item.key(),
+                        PriorityToWeight(item.priority(), priority_exponent_));
+  }
+
+  // Inserts preceding a failure are still applied.
+  sum_tree_.AppendBatch(leaves);
+  return status;
+}
+
 absl::Status PrioritizedSelector::Update(Key key, double priority) {
   REVERB_RETURN_IF_ERROR(CheckValidPriority(priority));
   const auto it = key_to_index_.find(key);
   if (it == key_to_index_.end()) {
     return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
   }
-  SetNode(it->second, power(priority, priority_exponent_));
+  sum_tree_.Set(it->second, PriorityToWeight(priority, priority_exponent_));
   return absl::OkStatus();
 }
 
-ItemSelector::KeyWithProbability PrioritizedSelector::Sample() {
-  const size_t size = key_to_index_.size();
-  REVERB_CHECK_NE(size, 0);
+absl::Status PrioritizedSelector::CheckPriority(double priority) const {
+  return CheckValidPriority(priority);
+}
 
+ItemSelector::KeyWithProbability PrioritizedSelector::Sample() {
   // This should never be called concurrently from multiple threads.
-  const double target = absl::Uniform<double>(bit_gen_, 0, 1);
-  const double total_weight = sum_tree_[0].sum;
+  return sum_tree_.Sample(&bit_gen_);
+}
 
-  // All keys have zero priority so treat as if uniformly sampling.
-  if (total_weight == 0) {
-    const size_t pos = static_cast<size_t>(target * size);
-    return {sum_tree_[pos].key, 1. / size};
-  }
+std::vector<ItemSelector::KeyWithProbability> PrioritizedSelector::SampleBatch(
+    int num_samples) {
+  return sum_tree_.SampleBatch(num_samples, batch_sampling_, &bit_gen_);
+}
 
-  // We begin traversing the `sum_tree_` from the root to the children in order
-  // to find the `index` corresponding to the sampled `target_weight`.
-  size_t index = 0;
-  double target_weight = target * total_weight;
-  while (true) {
-    // Go to the left sub tree if it contains our sampled `target_weight`.
-    const size_t left_index = 2 * index + 1;
-    const double left_sum = NodeSum(left_index);
-    if (target_weight < left_sum) {
-      index = left_index;
-      continue;
-    }
-    target_weight -= left_sum;
-    // Go to the right sub tree if it contains our sampled `target_weight`.
-    const size_t right_index = 2 * index + 2;
-    const double right_sum = NodeSum(right_index);
-    if (target_weight < right_sum) {
-      index = right_index;
-      continue;
+absl::Status PrioritizedSelector::UpdateBatch(
+    absl::Span<const KeyWithPriority> updates) {
+  std::vector<std::pair<size_t, double>> weights;
+  weights.reserve(updates.size());
+  absl::Status status = absl::OkStatus();
+  for (const auto& update : updates) {
+    status = CheckValidPriority(update.priority());
+    if (!status.ok()) break;
+    const auto it = key_to_index_.find(update.key());
+    if (it == key_to_index_.end()) {
+      status = absl::InvalidArgumentError(
+          absl::StrCat("Key ", update.key(), " not found."));
+      break;
     }
-    target_weight -= right_sum;
-    // Otherwise it is the current index.
-    break;
+    weights.emplace_back(
+        it->second, PriorityToWeight(update.priority(), priority_exponent_));
   }
-  REVERB_CHECK_LT(index, size);
-  const double picked_weight = NodeValue(index);
-  REVERB_LOG_IF(REVERB_ERROR, target_weight >= picked_weight)
-      << "Target weight should be smaller than picked weight (target_weight: "
-      << target_weight << " >= picked_weight:" << picked_weight << ").";
-  return {sum_tree_[index].key, picked_weight / total_weight};
+  // Updates preceding a failure are still applied.
+  sum_tree_.SetBatch(weights);
+  return status;
 }
 
 void PrioritizedSelector::Clear() {
-  for (size_t i = 0; i < key_to_index_.size(); ++i) {
-    sum_tree_[i].sum = 0;
-    sum_tree_[i].value = 0;
-  }
+  sum_tree_.Clear();
   key_to_index_.clear();
 }
 
-KeyDistributionOptions PrioritizedSelector::options() const {
-  KeyDistributionOptions options;
-  options.mutable_prioritized()->set_priority_exponent(priority_exponent_);
-  options.set_is_deterministic(false);
-  return options;
+void PrioritizedSelector::Reserve(size_t num_keys) {
+  sum_tree_.Reserve(num_keys);
+  key_to_index_.reserve(num_keys);
 }
 
-std::string PrioritizedSelector::DebugString() const {
-  return absl::StrCat(
-      "PrioritizedSelector(priority_exponent=", priority_exponent_, ")");
+absl::Status PrioritizedSelector::ScalePriorities(double factor) {
+  sum_tree_.Scale(internal::PriorityToWeight(factor, priority_exponent_));
+  return absl::OkStatus();
 }
 
-double PrioritizedSelector::NodeValue(size_t index) const {
-  return sum_tree_[index].value;
+absl::Status PrioritizedSelector::SetPriorityExponent(
+    double priority_exponent, absl::FunctionRef<double(Key)> priority) {
+  if (!(priority_exponent >= 0)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Priority exponent must be non-negative but got ", priority_exponent,
+        "."));
+  }
+  priority_exponent_ = priority_exponent;
+  sum_tree_.Reweight([this, priority](Key key) {
+    return internal::PriorityToWeight(priority(key), priority_exponent_);
+  });
+  return absl::OkStatus();
 }
 
-double PrioritizedSelector::NodeSum(size_t index) const {
-  return index < key_to_index_.size() ? sum_tree_[index].sum : 0;
+absl::optional<double> PrioritizedSelector::TotalWeight() const {
+  return sum_tree_.total();
 }
 
-double PrioritizedSelector::NodeSumTestingOnly(size_t index) const {
-  return NodeSum(index);
+KeyDistributionOptions PrioritizedSelector::options() const {
+  KeyDistributionOptions options;
+  options.mutable_prioritized()->set_priority_exponent(priority_exponent_);
+  options.mutable_prioritized()->set_batch_sampling(batch_sampling_);
+  options.set_is_deterministic(false);
+  if (bit_gen_.deterministic()) options.set_seed(bit_gen_.seed());
+  return options;
 }
 
-// Updates the sum stored in a node and tracks if the tree needs to be
-// re-initialized.
-// Ensure the sum never becomes negative (it may happen because of rounding
-// errors).
-#define UPDATE_SUM(i)                                          \
-  sum_tree_[(i)].sum += difference;                            \
-  if (sum_tree_[(i)].sum < 0) sum_tree_[(i)].sum = 0.0;        \
-  error = std::abs(sum_tree_[(i)].sum - NodeSum(2 * (i) + 1) - \
-                   NodeSum(2 * (i) + 2) - sum_tree_[(i)].value);
-
-void PrioritizedSelector::SetNode(size_t index, double value) {
-  const double difference = value - NodeValue(index);
-
-  // The floating point approximation error of the last node update.
-  double error = 0.0;
-
-  // Update the subject node.
-  sum_tree_[index].value = value;
-  UPDATE_SUM(index);
-
-  // Update all parents until we find the root node.
-  while (index != 0 && error <= kMaxApproximationError) {
-    index = (index - 1) / 2;
-    UPDATE_SUM(index);
-  }
-
-  // If floating-point errors have built up, re-initialize the tree.
-  if (error > kMaxApproximationError) {
-    REVERB_LOG(REVERB_WARNING)
-        << "Tree needs to be initialized because node with index " << index
-        << " has approximation error " << error
-        << ", which exceeds the threshold of " << kMaxApproximationError;
-    ReinitializeSumTree();
+std::string PrioritizedSelector::DebugString() const {
+  if (batch_sampling_ ==
+      KeyDistributionOptions::Prioritized::BATCH_SAMPLING_INDEPENDENT) {
+    return absl::StrCat(
+        "PrioritizedSelector(priority_exponent=", priority_exponent_, ")");
   }
+  return absl::StrCat(
+      "PrioritizedSelector(priority_exponent=", priority_exponent_,
+      ", batch_sampling=",
+      KeyDistributionOptions::Prioritized::BatchSampling_Name(batch_sampling_),
+      ")");
 }
 
-#undef UPDATE_SUM
-
-void PrioritizedSelector::ReinitializeSumTree() {
-  // Re-initialize the sums from the leaves to the root node.
-  for (int64_t i = sum_tree_.size() - 1; i >= 0; --i) {
-    sum_tree_[i].sum = NodeValue(i) + NodeSum(2 * i + 1) + NodeSum(2 * i + 2);
-  }
+double PrioritizedSelector::NodeSumTestingOnly(size_t index) const {
+  return sum_tree_.NodeSum(index);
 }
 
 }  // namespace reverb
@@ -17,11 +17,13 @@
 
 #include <vector>
 
-#include "absl/random/random.h"
+#include "absl/functional/function_ref.h"
 #include "absl/status/status.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/sum_tree.h"
+#include "reverb/cc/support/philox_bit_gen.h"
 
 namespace deepmind {
 namespace reverb {
@@ -42,8 +44,17 @@ namespace reverb {
 //
 class PrioritizedSelector : public ItemSelector {
  public:
-  PrioritizedSelector(double priority_exponent,
-                      absl::BitGen bit_gen = absl::BitGen());
+  using BatchSampling = internal::SumTree::BatchSampling;
+
+  PrioritizedSelector(
+      double priority_exponent,
+      internal::PhiloxBitGen bit_gen = internal::PhiloxBitGen());
+
+  // `batch_sampling` controls how `SampleBatch` selects keys, see
+  // `KeyDistributionOptions::Prioritized::BatchSampling`.
+  PrioritizedSelector(
+      double priority_exponent, BatchSampling batch_sampling,
+      internal::PhiloxBitGen bit_gen = internal::PhiloxBitGen());
 
   // O(log n) time.
   absl::Status Delete(Key key) override;
@@ -54,12 +65,43 @@ class PrioritizedSelector : public ItemSelector {
   // The priority must be non-negative. O(log n) time.
   absl::Status Update(Key key, double priority) override;
 
+  absl::Status CheckPriority(double priority) const override;
+
+  // Grows the tree at most once and then sets the values of all new leaves
+  // before computing the sums. When the batch is at least as large as the
+  // existing tree, all sums are rebuilt bottom-up in O(n) time, otherwise only
+  // the ancestors of the new nodes are recomputed.
+  absl::Status InsertBatch(absl::Span<const KeyWithPriority> items) override;
+
   // O(log n) time.
   KeyWithProbability Sample() override;
 
+  // Sets the values of all updated leaves first and then recomputes the sum of
+  // every affected inner node exactly once, level by level. O(k log n) time in
+  // the worst case but each shared ancestor is only visited once.
+  absl::Status UpdateBatch(absl::Span<const KeyWithPriority> updates) override;
+
+  // Samples keys according to the `BatchSampling` of the selector. Descents
+  // share the cache lines of their common ancestors unless sampling without
+  // replacement. O(k log n) time.
+  std::vector<KeyWithProbability> SampleBatch(int num_samples) override;
+
   // O(n) time.
   void Clear() override;
 
+  void Reserve(size_t num_keys) override;
+
+  // Scales the weights by `factor` raised to the priority exponent. O(n) time.
+  absl::Status ScalePriorities(double factor) override;
+
+  // The exponent must be non-negative. O(n) time.
+  absl::Status SetPriorityExponent(
+      double priority_exponent,
+      absl::FunctionRef<double(Key)> priority) override;
+
+  // Sum of the exponentiated priorities of all keys. O(1) time.
+  absl::optional<double> TotalWeight() const override;
+
   KeyDistributionOptions options() const override;
 
   std::string DebugString() const override;
@@ -68,58 +110,24 @@ class PrioritizedSelector : public ItemSelector {
   double NodeSumTestingOnly(size_t index) const;
 
  private:
-  struct Node {
-    Key key;
-    // Sum of the exponentiated priority of this node and all its descendants.
-    // This includes the entire sub tree with inner and leaf nodes.
-    // `NodeValue()` can be used to get the exponentiated priority of a node
-    // without its children.
-    double sum = 0;
-    // The exponentiated priority of this node. This can be computed from `sum`,
-    // however, this calculation becomes less accurate over time as rounding
-    // errors accumulate.
-    double value = 0;
-  };
-
-  // Gets the individual value of a node in `sum_tree_` without the summed up
-  // value of all its descendants.
-  double NodeValue(size_t index) const;
-
-  // Sum of the exponentiated priority of this node and all its descendants.
-  // If the index is out of bounds, then 0 is returned.
-  double NodeSum(size_t index) const;
-
-  // Sets the individual value of a node in the `sum_tree_`. This does not
-  // include the value of the descendants. Usually, this operation's runtime is
-  // in O(log n). However, if floating point rounding errors have accumulated to
-  // a point where the intermediate sums deviate from their true values more
-  // than 1e-4, the tree is reinitialized, which takes O(n) time.
-  void SetNode(size_t index, double value);
-
-  // Computes the sum tree. This may be necessary if rounding errors have
-  // compounded due to repeated partial tree updates. For example, sums may
-  // become negative due to rounding errors (e.g. x - (x + epsilon) < 0 where
-  // epsilon is a small rounding error).
-  void ReinitializeSumTree();
-
   // Controls the degree of prioritization. Priorities are raised to this
   // exponent before adding them to the `SumTree` as weights. A non-negative
   // number where a value of zero corresponds each key having the same
   // probability (except for keys with zero priority).
-  const double priority_exponent_;
+  double priority_exponent_;
 
-  // Capacity of the summary tree. Starts at ~130000 and grows exponentially.
-  size_t capacity_;
+  // How keys are selected by `SampleBatch`.
+  const BatchSampling batch_sampling_;
 
-  // A tree stored as a flat vector were each node is the sum of its children
-  // plus its own exponentiated priority.
-  std::vector<Node> sum_tree_;
+  // Exponentiated priorities of all keys.
+  internal::SumTree sum_tree_;
 
   // Maps a key to the index where this key can be found in `sum_tree_`.
   internal::flat_hash_map<Key, size_t> key_to_index_;
 
-  // Used for sampling, not thread-safe.
-  absl::BitGen bit_gen_;
+  // Used for sampling, not thread-safe. Every sampled key draws from the
+  // stream of its own sample index (see `internal::PhiloxBitGen`).
+  internal::PhiloxBitGen bit_gen_;
 };
 
 }  // namespace reverb
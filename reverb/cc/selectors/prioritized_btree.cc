@@ -0,0 +1,382 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/selectors/prioritized_btree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// The tree is created with (at least) this many leaves.
+constexpr size_t kMinInitialCapacity = 1 << 16;
+
+// A priority of zero should correspond to zero probability, even if the
+// priority exponent is zero. Expects base and exponent to be non-negative.
+inline double power(double base, double exponent) {
+  return base == 0. ? 0. : std::pow(base, exponent);
+}
+
+absl::Status CheckValidPriority(double priority) {
+  if (std::isnan(priority))
+    return absl::InvalidArgumentError("Priority must not be NaN.");
+  if (priority < 0)
+    return absl::InvalidArgumentError("Priority must not be negative.");
+  return absl::OkStatus();
+}
+
+int Log2(int value) {
+  int shift = 0;
+  while ((1 << shift) < value) ++shift;
+  return shift;
+}
+
+// Returns the number of elements in the (non-decreasing) `prefix_sums` which
+// are smaller than or equal to `target`. This is the index of the child which
+// contains `target` or `num_children` if `target` is past the last child.
+inline int FindChild(const double* prefix_sums, int num_children,
+                     double target) {
+#ifdef __AVX2__
+  if (num_children >= 4) {
+    const __m256d target_vec = _mm256_set1_pd(target);
+    int count = 0;
+    for (int i = 0; i < num_children; i += 4) {
+      const __m256d sums = _mm256_loadu_pd(prefix_sums + i);
+      const int mask =
+          _mm256_movemask_pd(_mm256_cmp_pd(sums, target_vec, _CMP_LE_OQ));
+      count += __builtin_popcount(mask);
+    }
+    return count;
+  }
+#endif
+  // Branch free so that the compiler is able to vectorize the loop.
+  int count = 0;
+  for (int i = 0; i < num_children; ++i) {
+    count += prefix_sums[i] <= target;
+  }
+  return count;
+}
+
+}  // namespace
+
+BTreePrioritizedSelector::BTreePrioritizedSelector(
+    double priority_exponent, int branching_factor,
+    internal::PhiloxBitGen bit_gen)
+    : priority_exponent_(priority_exponent),
+      branching_factor_(branching_factor),
+      branching_shift_(Log2(branching_factor)),
+      bit_gen_(std::move(bit_gen)) {
+  REVERB_CHECK_GE(priority_exponent_, 0);
+  REVERB_CHECK_GE(branching_factor_, 2);
+  REVERB_CHECK_LE(branching_factor_, 64);
+  // The branching factor must be a power of two.
+  REVERB_CHECK_EQ(1 << branching_shift_, branching_factor_);
+
+  capacity_ = branching_factor_;
+  prefix_sums_.emplace_back(branching_factor_, 0);
+  totals_.emplace_back(1, 0);
+  while (capacity_ < kMinInitialCapacity) {
+    capacity_ <<= branching_shift_;
+    for (int level = 0; level < prefix_sums_.size(); ++level) {
+      prefix_sums_[level].resize(prefix_sums_[level].size()
+                                 << branching_shift_);
+      totals_[level].resize(totals_[level].size() << branching_shift_);
+    }
+    prefix_sums_.emplace_back(branching_factor_, 0);
+    totals_.emplace_back(1, 0);
+  }
+  keys_.resize(capacity_);
+  weights_.resize(capacity_);
+}
+
+absl::Status BTreePrioritizedSelector::Delete(Key key) {
+  const size_t last_index = key_to_index_.size() - 1;
+  const auto it = key_to_index_.find(key);
+  if (it == key_to_index_.end())
+    return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
+  const size_t index = it->second;
+
+  if (index != last_index) {
+    // Replace the element that we want to remove with the last element.
+    const Key last_key = keys_[last_index];
+    SetWeight(index, weights_[last_index]);
+    keys_[index] = last_key;
+    key_to_index_[last_key] = index;
+  }
+  SetWeight(last_index, 0);
+  key_to_index_.erase(key);
+
+  return absl::OkStatus();
+}
+
+absl::Status BTreePrioritizedSelector::Insert(Key key, double priority) {
+  REVERB_RETURN_IF_ERROR(CheckValidPriority(priority));
+  const size_t index = key_to_index_.size();
+  if (index == capacity_) {
+    Grow();
+  }
+  if (!key_to_index_.try_emplace(key, index).second) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Key ", key, " already inserted."));
+  }
+  keys_[index] = key;
+  SetWeight(index, power(priority, priority_exponent_));
+  return absl::OkStatus();
+}
+
+absl::Status BTreePrioritizedSelector::Update(Key key, double priority) {
+  REVERB_RETURN_IF_ERROR(CheckValidPriority(priority));
+  const auto it = key_to_index_.find(key);
+  if (it == key_to_index_.end()) {
+    return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
+  }
+  SetWeight(it->second, power(priority, priority_exponent_));
+  return absl::OkStatus();
+}
+
+absl::Status BTreePrioritizedSelector::CheckPriority(double priority) const {
+  return CheckValidPriority(priority);
+}
+
+ItemSelector::KeyWithProbability BTreePrioritizedSelector::Sample() {
+  const size_t size = key_to_index_.size();
+  REVERB_CHECK_NE(size, 0);
+
+  // This should never be called concurrently from multiple threads.
+  internal::PhiloxBitGen sample_gen =
+      bit_gen_.ForSample(bit_gen_.ReserveSamples(1));
+  const double target = absl::Uniform<double>(sample_gen, 0, 1);
+  const double total_weight = totals_.back()[0];
+
+  // All keys have zero priority so treat as if uniformly sampling.
+  if (total_weight == 0) {
+    const size_t pos = static_cast<size_t>(target * size);
+    return {keys_[pos], 1. / size};
+  }
+
+  const size_t index = FindIndex(target * total_weight);
+  return {keys_[index], weights_[index] / total_weight};
+}
+
+std::vector<ItemSelector::KeyWithProbability>
+BTreePrioritizedSelector::SampleBatch(int num_samples) {
+  const size_t size = key_to_index_.size();
+  REVERB_CHECK_NE(size, 0);
+
+  std::vector<KeyWithProbability> samples(num_samples);
+  const double total_weight = totals_.back()[0];
+
+  // Every target only depends on its sample index so the batch is the same as
+  // `num_samples` calls to `Sample`.
+  const uint64_t first_sample = bit_gen_.ReserveSamples(num_samples);
+  std::vector<std::pair<double, int>> targets(num_samples);
+  for (int i = 0; i < num_samples; i++) {
+    internal::PhiloxBitGen sample_gen = bit_gen_.ForSample(first_sample + i);
+    targets[i] = {absl::Uniform<double>(sample_gen, 0, 1), i};
+  }
+
+  // All keys have zero priority so treat as if uniformly sampling.
+  if (total_weight == 0) {
+    for (const auto& target : targets) {
+      const size_t pos = static_cast<size_t>(target.first * size);
+      samples[target.second] = {keys_[pos], 1. / size};
+    }
+    return samples;
+  }
+
+  // The original order is restored in the output so the batch is not ordered
+  // by tree position.
+  for (auto& target : targets) {
+    target.first *= total_weight;
+  }
+  std::sort(targets.begin(), targets.end());
+
+  for (const auto& target : targets) {
+    const size_t index = FindIndex(target.first);
+    samples[target.second] = {keys_[index], weights_[index] / total_weight};
+  }
+  return samples;
+}
+
+absl::Status BTreePrioritizedSelector::UpdateBatch(
+    absl::Span<const KeyWithPriority> updates) {
+  std::vector<size_t> nodes;
+  nodes.reserve(updates.size());
+  absl::Status status = absl::OkStatus();
+  for (const auto& update : updates) {
+    status = CheckValidPriority(update.priority());
+    if (!status.ok()) break;
+    const auto it = key_to_index_.find(update.key());
+    if (it == key_to_index_.end()) {
+      status = absl::InvalidArgumentError(
+          absl::StrCat("Key ", update.key(), " not found."));
+      break;
+    }
+    weights_[it->second] = power(update.priority(), priority_exponent_);
+    nodes.push_back(it->second >> branching_shift_);
+  }
+
+  // Updates preceding a failure are still applied.
+  for (int level = 0; level < prefix_sums_.size() && !nodes.empty(); ++level) {
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+    for (size_t& node : nodes) {
+      RecomputeNode(level, node);
+      node >>= branching_shift_;
+    }
+  }
+  return status;
+}
+
+void BTreePrioritizedSelector::Clear() {
+  std::fill(weights_.begin(), weights_.begin() + key_to_index_.size(), 0);
+  for (int level = 0; level < prefix_sums_.size(); ++level) {
+    std::fill(prefix_sums_[level].begin(), prefix_sums_[level].end(), 0);
+    std::fill(totals_[level].begin(), totals_[level].end(), 0);
+  }
+  key_to_index_.clear();
+}
+
+absl::Status BTreePrioritizedSelector::ScalePriorities(double factor) {
+  const double weight_factor = power(factor, priority_exponent_);
+  for (size_t i = 0; i < key_to_index_.size(); ++i) {
+    weights_[i] *= weight_factor;
+  }
+  RecomputeAll();
+  return absl::OkStatus();
+}
+
+absl::Status BTreePrioritizedSelector::SetPriorityExponent(
+    double priority_exponent, absl::FunctionRef<double(Key)> priority) {
+  if (!(priority_exponent >= 0)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Priority exponent must be non-negative but got ", priority_exponent,
+        "."));
+  }
+  priority_exponent_ = priority_exponent;
+  for (size_t i = 0; i < key_to_index_.size(); ++i) {
+    weights_[i] = power(priority(keys_[i]), priority_exponent_);
+  }
+  RecomputeAll();
+  return absl::OkStatus();
+}
+
+absl::optional<double> BTreePrioritizedSelector::TotalWeight() const {
+  return totals_.back()[0];
+}
+
+KeyDistributionOptions BTreePrioritizedSelector::options() const {
+  KeyDistributionOptions options;
+  options.mutable_prioritized_btree()->set_priority_exponent(
+      priority_exponent_);
+  options.mutable_prioritized_btree()->set_branching_factor(branching_factor_);
+  options.set_is_deterministic(false);
+  if (bit_gen_.deterministic()) options.set_seed(bit_gen_.seed());
+  return options;
+}
+
+std::string BTreePrioritizedSelector::DebugString() const {
+  return absl::StrCat("BTreePrioritizedSelector(priority_exponent=",
+                      priority_exponent_,
+                      ", branching_factor=", branching_factor_, ")");
+}
+
+void BTreePrioritizedSelector::RecomputeNode(int level, size_t index) {
+  const size_t first_child = index << branching_shift_;
+  const double* children = level == 0 ? weights_.data() + first_child
+                                      : totals_[level - 1].data() + first_child;
+  double* prefix_sums = prefix_sums_[level].data() + first_child;
+  double sum = 0;
+  for (int i = 0; i < branching_factor_; ++i) {
+    sum += children[i];
+    prefix_sums[i] = sum;
+  }
+  totals_[level][index] = sum;
+}
+
+void BTreePrioritizedSelector::RecomputeAll() {
+  size_t num_nodes = key_to_index_.size();
+  for (int level = 0; level < prefix_sums_.size(); ++level) {
+    num_nodes = (num_nodes + branching_factor_ - 1) >> branching_shift_;
+    for (size_t node = 0; node < num_nodes; ++node) {
+      RecomputeNode(level, node);
+    }
+  }
+}
+
+void BTreePrioritizedSelector::SetWeight(size_t index, double weight) {
+  weights_[index] = weight;
+  for (int level = 0; level < prefix_sums_.size(); ++level) {
+    index >>= branching_shift_;
+    RecomputeNode(level, index);
+  }
+}
+
+size_t BTreePrioritizedSelector::FindIndex(double target_weight) const {
+  size_t index = 0;
+  for (int level = prefix_sums_.size() - 1; level >= 0; --level) {
+    const double* prefix_sums =
+        prefix_sums_[level].data() + (index << branching_shift_);
+    int child = FindChild(prefix_sums, branching_factor_, target_weight);
+    if (child == branching_factor_) {
+      // Rounding errors have pushed the target past the end of the node so
+      // pick the last child with a non zero weight instead.
+      child = branching_factor_ - 1;
+      while (child > 0 && prefix_sums[child] == prefix_sums[child - 1]) {
+        --child;
+      }
+    }
+    if (child > 0) {
+      target_weight -= prefix_sums[child - 1];
+    }
+    index = (index << branching_shift_) + child;
+  }
+  REVERB_CHECK_LT(index, key_to_index_.size());
+  return index;
+}
+
+void BTreePrioritizedSelector::Grow() {
+  capacity_ <<= branching_shift_;
+  keys_.resize(capacity_);
+  weights_.resize(capacity_);
+  // Node `i` of every level keeps covering the same leaves so the existing
+  // nodes stay valid and only the new root has to be computed.
+  for (int level = 0; level < prefix_sums_.size(); ++level) {
+    prefix_sums_[level].resize(prefix_sums_[level].size() << branching_shift_);
+    totals_[level].resize(totals_[level].size() << branching_shift_);
+  }
+  prefix_sums_.emplace_back(branching_factor_, 0);
+  totals_.emplace_back(1, 0);
+  RecomputeNode(prefix_sums_.size() - 1, 0);
+}
+
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,156 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SELECTORS_PRIORITIZED_BTREE_H_
+#define REVERB_CC_SELECTORS_PRIORITIZED_BTREE_H_
+
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/types/span.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/support/philox_bit_gen.h"
+
+namespace deepmind {
+namespace reverb {
+
+// BTreePrioritizedSelector samples keys with the same distribution as
+// `PrioritizedSelector` (probability proportional to priority raised to a
+// configurable exponent) but stores the weights in a B-ary sum tree with a
+// cache friendly layout:
+//
+//   * The keys and the weights of the leaves are stored in separate dense
+//     arrays so the tree itself only contains doubles.
+//   * Every inner node stores the inclusive prefix sums of its B children in B
+//     contiguous doubles. Finding the child containing a target weight is
+//     therefore a single branch free comparison over one or two cache lines,
+//     which is done with AVX2 instructions when available.
+//
+// A sample descent touches log_B(n) cache lines instead of log_2(n) lines
+// scattered across the (much larger) array of `PrioritizedSelector`. Updates
+// recompute the prefix sums of every node on the path from their children so
+// rounding errors never accumulate and the tree never has to be reinitialized.
+class BTreePrioritizedSelector : public ItemSelector {
+ public:
+  static constexpr int kDefaultBranchingFactor = 16;
+
+  // `branching_factor` must be a power of two in [2, 64].
+  explicit BTreePrioritizedSelector(
+      double priority_exponent, int branching_factor = kDefaultBranchingFactor,
+      internal::PhiloxBitGen bit_gen = internal::PhiloxBitGen());
+
+  // O(B log_B n) time.
+  absl::Status Delete(Key key) override;
+
+  // The priority must be non-negative. O(B log_B n) amortized time.
+  absl::Status Insert(Key key, double priority) override;
+
+  // The priority must be non-negative. O(B log_B n) time.
+  absl::Status Update(Key key, double priority) override;
+
+  absl::Status CheckPriority(double priority) const override;
+
+  // O(B log_B n) time.
+  KeyWithProbability Sample() override;
+
+  // Sets the weights of all updated leaves first and then recomputes every
+  // affected inner node exactly once, level by level.
+  absl::Status UpdateBatch(absl::Span<const KeyWithPriority> updates) override;
+
+  // Descends the tree for all targets in ascending order so that consecutive
+  // descents share the cache lines of their common ancestors.
+  std::vector<KeyWithProbability> SampleBatch(int num_samples) override;
+
+  // O(capacity) time.
+  void Clear() override;
+
+  // Scales the weights by `factor` raised to the priority exponent and
+  // recomputes all inner nodes. O(n) time.
+  absl::Status ScalePriorities(double factor) override;
+
+  // The exponent must be non-negative. O(n) time.
+  absl::Status SetPriorityExponent(
+      double priority_exponent,
+      absl::FunctionRef<double(Key)> priority) override;
+
+  // Sum of the exponentiated priorities of all keys. O(1) time.
+  absl::optional<double> TotalWeight() const override;
+
+  KeyDistributionOptions options() const override;
+
+  std::string DebugString() const override;
+
+ private:
+  // Recomputes the prefix sums of node `index` at `level` from its children.
+  void RecomputeNode(int level, size_t index);
+
+  // Recomputes every inner node covering a leaf in use, level by level.
+  void RecomputeAll();
+
+  // Sets the weight of the leaf at `index` and recomputes all its ancestors.
+  void SetWeight(size_t index, double weight);
+
+  // Finds the index of the leaf containing `target_weight`, which must be in
+  // [0, TotalWeight()).
+  size_t FindIndex(double target_weight) const;
+
+  // Multiplies the capacity by the branching factor by adding a new root.
+  void Grow();
+
+  // Controls the degree of prioritization. See `PrioritizedSelector`.
+  double priority_exponent_;
+
+  // Number of children of every inner node.
+  const int branching_factor_;
+
+  // log2 of `branching_factor_`.
+  const int branching_shift_;
+
+  // Number of leaves the tree can hold. Always a power of
+  // `branching_factor_`.
+  size_t capacity_;
+
+  // Keys and exponentiated priorities of the leaves. Only the first
+  // `key_to_index_.size()` elements are in use, the weights of the remaining
+  // leaves are zero.
+  std::vector<Key> keys_;
+  std::vector<double> weights_;
+
+  // `prefix_sums_[l]` holds the inner nodes of level `l`, where level 0 is the
+  // parent level of the leaves and the last level is the root. Node `i` of
+  // level `l` occupies the B elements starting at `i * B` and element `j` is
+  // the sum of children `0..j`. Child `j` of the node is leaf (or node of level
+  // `l - 1`) `i * B + j`.
+  std::vector<std::vector<double>> prefix_sums_;
+
+  // `totals_[l][i]` is the sum of node `i` of level `l`. These are duplicated
+  // from `prefix_sums_` so that recomputing a parent reads its children's sums
+  // from contiguous memory.
+  std::vector<std::vector<double>> totals_;
+
+  // Maps a key to the index of its leaf.
+  internal::flat_hash_map<Key, size_t> key_to_index_;
+
+  // Used for sampling, not thread-safe. Every sampled key draws from the
+  // stream of its own sample index (see `internal::PhiloxBitGen`).
+  internal::PhiloxBitGen bit_gen_;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SELECTORS_PRIORITIZED_BTREE_H_
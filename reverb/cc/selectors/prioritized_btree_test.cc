@@ -0,0 +1,249 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/selectors/prioritized_btree.h"
+
+#include <cmath>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/prioritized.h"
+#include "reverb/cc/testing/proto_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+const double kInitialPriorityExponent = 1;
+
+class BTreePrioritizedSelectorTest : public ::testing::TestWithParam<int> {};
+
+TEST_P(BTreePrioritizedSelectorTest, ReturnValueSantiyChecks) {
+  BTreePrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+
+  // Non existent keys cannot be deleted or updated.
+  EXPECT_EQ(prioritized.Delete(123).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(prioritized.Update(123, 4).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // Keys cannot be inserted twice.
+  REVERB_EXPECT_OK(prioritized.Insert(123, 4));
+  EXPECT_EQ(prioritized.Insert(123, 4).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // Existing keys can be updated and sampled.
+  REVERB_EXPECT_OK(prioritized.Update(123, 5));
+  EXPECT_EQ(prioritized.Sample().key, 123);
+
+  // Negative and NAN priorities are not allowed.
+  EXPECT_EQ(prioritized.Update(123, -1).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(prioritized.Insert(456, -1).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(prioritized.Update(123, NAN).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(prioritized.Insert(456, NAN).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // Existing keys cannot be deleted twice.
+  REVERB_EXPECT_OK(prioritized.Delete(123));
+  EXPECT_EQ(prioritized.Delete(123).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST_P(BTreePrioritizedSelectorTest, AllZeroPrioritiesResultsInUniformSampling) {
+  const int kItems = 100;
+  const int kSamples = 100000;
+  const double expected_probability = 1. / kItems;
+
+  BTreePrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+  for (int i = 0; i < kItems; i++) {
+    REVERB_EXPECT_OK(prioritized.Insert(i, 0));
+  }
+  std::vector<int64_t> counts(kItems);
+  for (int i = 0; i < kSamples; i++) {
+    ItemSelector::KeyWithProbability sample = prioritized.Sample();
+    EXPECT_EQ(sample.probability, expected_probability);
+    counts[sample.key]++;
+  }
+  for (int64_t count : counts) {
+    EXPECT_NEAR(static_cast<double>(count) / kSamples, expected_probability,
+                0.05);
+  }
+}
+
+TEST_P(BTreePrioritizedSelectorTest, SampledDistributionMatchesProbabilities) {
+  const int kStart = 10;
+  const int kEnd = 100;
+  const int kSamples = 200000;
+
+  BTreePrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+  double sum = 0;
+  for (int i = 0; i < kEnd; i++) {
+    REVERB_EXPECT_OK(prioritized.Insert(i, 123));
+    REVERB_EXPECT_OK(prioritized.Update(i, i));
+    sum += i;
+  }
+  // Remove the first few items.
+  for (int i = 0; i < kStart; i++) {
+    REVERB_EXPECT_OK(prioritized.Delete(i));
+    sum -= i;
+  }
+
+  std::vector<int64_t> counts(kEnd);
+  for (int i = 0; i < kSamples; i++) {
+    ItemSelector::KeyWithProbability sample = prioritized.Sample();
+    EXPECT_NEAR(sample.probability, sample.key / sum, 1e-9);
+    counts[sample.key]++;
+  }
+  for (int k = 0; k < kStart; k++) EXPECT_EQ(counts[k], 0);
+  for (int k = kStart; k < kEnd; k++) {
+    EXPECT_NEAR(static_cast<double>(counts[k]) / kSamples, k / sum, 0.01);
+  }
+}
+
+TEST_P(BTreePrioritizedSelectorTest, MatchesPrioritizedSelector) {
+  BTreePrioritizedSelector btree(0.8, GetParam());
+  PrioritizedSelector binary(0.8);
+  absl::BitGen bit_gen;
+  for (int i = 0; i < 1000; i++) {
+    const double priority = absl::Uniform<double>(bit_gen, 0, 10);
+    REVERB_EXPECT_OK(btree.Insert(i, priority));
+    REVERB_EXPECT_OK(binary.Insert(i, priority));
+  }
+  for (int i = 0; i < 1000; i += 7) {
+    REVERB_EXPECT_OK(btree.Delete(i));
+    REVERB_EXPECT_OK(binary.Delete(i));
+  }
+  std::vector<KeyWithPriority> updates;
+  for (int i = 1; i < 1000; i += 7) {
+    updates.push_back(testing::MakeKeyWithPriority(i, i % 13));
+  }
+  REVERB_EXPECT_OK(btree.UpdateBatch(updates));
+  REVERB_EXPECT_OK(binary.UpdateBatch(updates));
+
+  EXPECT_NEAR(btree.TotalWeight().value(), binary.TotalWeight().value(), 1e-6);
+  for (const auto& sample : btree.SampleBatch(1000)) {
+    EXPECT_NE(sample.key % 7, 0);
+  }
+}
+
+TEST_P(BTreePrioritizedSelectorTest, MatchesPrioritizedSelectorAfterTransforms) {
+  BTreePrioritizedSelector btree(0.8, GetParam());
+  PrioritizedSelector binary(0.8);
+  internal::flat_hash_map<ItemSelector::Key, double> priorities;
+  absl::BitGen bit_gen;
+  for (int i = 0; i < 1000; i++) {
+    priorities[i] = absl::Uniform<double>(bit_gen, 0, 10);
+    REVERB_EXPECT_OK(btree.Insert(i, priorities[i]));
+    REVERB_EXPECT_OK(binary.Insert(i, priorities[i]));
+  }
+
+  REVERB_EXPECT_OK(btree.ScalePriorities(0.25));
+  REVERB_EXPECT_OK(binary.ScalePriorities(0.25));
+  EXPECT_NEAR(btree.TotalWeight().value(), binary.TotalWeight().value(), 1e-6);
+
+  for (auto& entry : priorities) entry.second *= 0.25;
+  auto priority = [&](ItemSelector::Key key) { return priorities[key]; };
+  REVERB_EXPECT_OK(btree.SetPriorityExponent(1.5, priority));
+  REVERB_EXPECT_OK(binary.SetPriorityExponent(1.5, priority));
+  EXPECT_NEAR(btree.TotalWeight().value(), binary.TotalWeight().value(), 1e-6);
+  EXPECT_EQ(btree.options().prioritized_btree().priority_exponent(), 1.5);
+
+  REVERB_EXPECT_OK(btree.Insert(1000, 1));
+  REVERB_EXPECT_OK(binary.Insert(1000, 1));
+  EXPECT_NEAR(btree.TotalWeight().value(), binary.TotalWeight().value(), 1e-6);
+}
+
+TEST_P(BTreePrioritizedSelectorTest, GrowsBeyondInitialCapacity) {
+  const int kItems = 300000;
+  BTreePrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+  for (int i = 0; i < kItems; i++) {
+    REVERB_EXPECT_OK(prioritized.Insert(i, i < kItems - 1 ? 0 : 1));
+  }
+  EXPECT_DOUBLE_EQ(prioritized.TotalWeight().value(), 1);
+  auto sample = prioritized.Sample();
+  EXPECT_EQ(sample.key, kItems - 1);
+  EXPECT_DOUBLE_EQ(sample.probability, 1);
+}
+
+TEST_P(BTreePrioritizedSelectorTest, NoRoundingErrorsAccumulate) {
+  BTreePrioritizedSelector prioritized(1.0, GetParam());
+
+  REVERB_EXPECT_OK(prioritized.Insert(0, 1e-15));
+  for (int i = 0; i < 10000; ++i) {
+    REVERB_EXPECT_OK(prioritized.Insert(i + 1, 0.3));
+  }
+  for (int i = 0; i < 10000; ++i) {
+    REVERB_EXPECT_OK(prioritized.Delete(i + 1));
+  }
+
+  // The sums are recomputed from the children so they are exact.
+  EXPECT_EQ(prioritized.TotalWeight().value(), 1e-15);
+  EXPECT_EQ(prioritized.Sample().key, 0);
+}
+
+TEST_P(BTreePrioritizedSelectorTest, UpdateBatchAppliesUpdatesBeforeError) {
+  BTreePrioritizedSelector prioritized(kInitialPriorityExponent, GetParam());
+  REVERB_EXPECT_OK(prioritized.Insert(1, 1));
+  REVERB_EXPECT_OK(prioritized.Insert(2, 1));
+
+  EXPECT_EQ(prioritized
+                .UpdateBatch({testing::MakeKeyWithPriority(1, 3),
+                              testing::MakeKeyWithPriority(3, 1),
+                              testing::MakeKeyWithPriority(2, 5)})
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_DOUBLE_EQ(prioritized.TotalWeight().value(), 4);
+}
+
+TEST_P(BTreePrioritizedSelectorTest, SetsOptions) {
+  BTreePrioritizedSelector prioritized(0.5, GetParam());
+  KeyDistributionOptions expected;
+  expected.mutable_prioritized_btree()->set_priority_exponent(0.5);
+  expected.mutable_prioritized_btree()->set_branching_factor(GetParam());
+  expected.set_is_deterministic(false);
+  EXPECT_THAT(prioritized.options(), testing::EqualsProto(expected));
+}
+
+INSTANTIATE_TEST_SUITE_P(BranchingFactors, BTreePrioritizedSelectorTest,
+                         ::testing::Values(2, 8, 16, 64));
+
+TEST(BTreePrioritizedDeathTest, ClearThenSample) {
+  BTreePrioritizedSelector prioritized(kInitialPriorityExponent);
+  for (int i = 0; i < 100; i++) {
+    REVERB_EXPECT_OK(prioritized.Insert(i, i));
+  }
+  prioritized.Sample();
+  prioritized.Clear();
+  EXPECT_EQ(prioritized.TotalWeight().value(), 0);
+  EXPECT_DEATH(prioritized.Sample(), "");
+}
+
+TEST(BTreePrioritizedDeathTest, BranchingFactorMustBePowerOfTwo) {
+  EXPECT_DEATH(BTreePrioritizedSelector(1, 12), "");
+  EXPECT_DEATH(BTreePrioritizedSelector(1, 1), "");
+  EXPECT_DEATH(BTreePrioritizedSelector(1, 128), "");
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
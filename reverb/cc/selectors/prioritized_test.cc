@@ -24,6 +24,7 @@
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/status_matchers.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/philox_bit_gen.h"
 #include "reverb/cc/testing/proto_test_util.h"
 
 namespace deepmind {
@@ -68,6 +69,16 @@ TEST(PrioritizedSelectorTest, ReturnValueSantiyChecks) {
             absl::StatusCode::kInvalidArgument);
 }
 
+TEST(PrioritizedSelectorTest, CheckPriorityMatchesInsertAndUpdate) {
+  PrioritizedSelector prioritized(1);
+  REVERB_EXPECT_OK(prioritized.CheckPriority(0));
+  REVERB_EXPECT_OK(prioritized.CheckPriority(1.5));
+  EXPECT_EQ(prioritized.CheckPriority(-1).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(prioritized.CheckPriority(NAN).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
 TEST(PrioritizedSelectorTest, AllZeroPrioritiesResultsInUniformSampling) {
   int64_t kItems = 100;
   int64_t kSamples = 1000000;
@@ -140,6 +151,55 @@ TEST(PrioritizedSelectorTest, SetsPriorityExponentInOptions) {
           "prioritized: { priority_exponent: 0.5 } is_deterministic: false"));
 }
 
+TEST(PrioritizedSelectorTest, SetsBatchSamplingInOptions) {
+  PrioritizedSelector prioritized(
+      0.5, KeyDistributionOptions::Prioritized::BATCH_SAMPLING_STRATIFIED);
+  EXPECT_THAT(prioritized.options(),
+              testing::EqualsProto(
+                  "prioritized: { priority_exponent: 0.5 batch_sampling: "
+                  "BATCH_SAMPLING_STRATIFIED } is_deterministic: false"));
+}
+
+TEST(PrioritizedSelectorTest, ScalePrioritiesAppliesToFutureInserts) {
+  PrioritizedSelector prioritized(2);
+  REVERB_EXPECT_OK(prioritized.Insert(1, 2));
+  REVERB_EXPECT_OK(prioritized.Insert(2, 4));
+  REVERB_EXPECT_OK(prioritized.ScalePriorities(0.5));
+  EXPECT_DOUBLE_EQ(prioritized.TotalWeight().value(), 5);
+
+  // The priority of the new key equals the scaled priority of key 2.
+  REVERB_EXPECT_OK(prioritized.Insert(3, 2));
+  for (const auto& sample : prioritized.SampleBatch(100)) {
+    EXPECT_DOUBLE_EQ(sample.probability, sample.key == 1 ? 1. / 9 : 4. / 9);
+  }
+}
+
+TEST(PrioritizedSelectorTest, SetPriorityExponentReweightsKeys) {
+  PrioritizedSelector prioritized(1);
+  internal::flat_hash_map<ItemSelector::Key, double> priorities = {
+      {1, 1}, {2, 0}, {3, 3}};
+  for (const auto& entry : priorities) {
+    REVERB_EXPECT_OK(prioritized.Insert(entry.first, entry.second));
+  }
+
+  EXPECT_EQ(prioritized
+                .SetPriorityExponent(
+                    -1, [&](ItemSelector::Key key) { return priorities[key]; })
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  REVERB_EXPECT_OK(prioritized.SetPriorityExponent(
+      2, [&](ItemSelector::Key key) { return priorities[key]; }));
+  EXPECT_DOUBLE_EQ(prioritized.TotalWeight().value(), 10);
+  EXPECT_THAT(
+      prioritized.options(),
+      testing::EqualsProto(
+          "prioritized: { priority_exponent: 2 } is_deterministic: false"));
+  for (const auto& sample : prioritized.SampleBatch(100)) {
+    ASSERT_NE(sample.key, 2);
+    EXPECT_DOUBLE_EQ(sample.probability, sample.key == 1 ? 0.1 : 0.9);
+  }
+}
+
 TEST(PrioritizedSelector, RoundingErrors) {
   PrioritizedSelector prioritized(1.0);
 
@@ -152,9 +212,215 @@ TEST(PrioritizedSelector, RoundingErrors) {
     REVERB_EXPECT_OK(prioritized.Delete(i + 1));
   }
 
-  // The root node should now have a value of 1e-15. However, due to rounding
-  // errors the value will be negative unless we re-initialize the tree.
+  // The root node should now have a value of 1e-15. Adjusting the sums by the
+  // differences of the weights would leave it negative due to rounding errors
+  // but the sums are recomputed from the children so it is exact.
   EXPECT_GE(prioritized.NodeSumTestingOnly(0), 0.0);
+  EXPECT_EQ(prioritized.NodeSumTestingOnly(0), 1e-15);
+}
+
+TEST(PrioritizedSelectorTest, UpdateBatchMatchesSequentialUpdates) {
+  PrioritizedSelector batched(kInitialPriorityExponent);
+  PrioritizedSelector sequential(kInitialPriorityExponent);
+  for (int i = 0; i < 1000; i++) {
+    REVERB_EXPECT_OK(batched.Insert(i, 1));
+    REVERB_EXPECT_OK(sequential.Insert(i, 1));
+  }
+
+  std::vector<KeyWithPriority> updates;
+  for (int i = 0; i < 1000; i += 3) {
+    updates.push_back(testing::MakeKeyWithPriority(i, i % 17));
+  }
+  // Later updates of the same key take precedence.
+  updates.push_back(testing::MakeKeyWithPriority(3, 100));
+
+  REVERB_EXPECT_OK(batched.UpdateBatch(updates));
+  for (const auto& update : updates) {
+    REVERB_EXPECT_OK(sequential.Update(update.key(), update.priority()));
+  }
+
+  for (int i = 0; i < 1000; i++) {
+    EXPECT_NEAR(batched.NodeSumTestingOnly(i),
+                sequential.NodeSumTestingOnly(i), 1e-9);
+  }
+}
+
+TEST(PrioritizedSelectorTest, UpdateBatchAppliesUpdatesBeforeError) {
+  PrioritizedSelector prioritized(kInitialPriorityExponent);
+  REVERB_EXPECT_OK(prioritized.Insert(1, 1));
+  REVERB_EXPECT_OK(prioritized.Insert(2, 1));
+
+  EXPECT_EQ(prioritized
+                .UpdateBatch({testing::MakeKeyWithPriority(1, 3),
+                              testing::MakeKeyWithPriority(3, 1),
+                              testing::MakeKeyWithPriority(2, 5)})
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_DOUBLE_EQ(prioritized.NodeSumTestingOnly(0), 4);
+  EXPECT_EQ(prioritized.UpdateBatch({testing::MakeKeyWithPriority(2, -1)})
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(PrioritizedSelectorTest, InsertBatchMatchesSequentialInserts) {
+  // The first batch is large enough for the tree to be rebuilt from scratch
+  // (and to grow beyond the initial capacity) while the second one only
+  // recomputes the ancestors of the new nodes.
+  const int kItems = 200000;
+  PrioritizedSelector batched(kInitialPriorityExponent);
+  PrioritizedSelector sequential(kInitialPriorityExponent);
+
+  std::vector<KeyWithPriority> first;
+  for (int i = 0; i < kItems; i++) {
+    first.push_back(testing::MakeKeyWithPriority(i, i % 13));
+  }
+  std::vector<KeyWithPriority> second;
+  for (int i = kItems; i < kItems + 100; i++) {
+    second.push_back(testing::MakeKeyWithPriority(i, i % 7));
+  }
+
+  for (const auto& items : {first, second}) {
+    REVERB_EXPECT_OK(batched.InsertBatch(items));
+    for (const auto& item : items) {
+      REVERB_EXPECT_OK(sequential.Insert(item.key(), item.priority()));
+    }
+    for (int i = 0; i < kItems + 100; i++) {
+      ASSERT_NEAR(batched.NodeSumTestingOnly(i),
+                  sequential.NodeSumTestingOnly(i), 1e-6);
+    }
+  }
+}
+
+TEST(PrioritizedSelectorTest, InsertBatchAppliesInsertsBeforeError) {
+  PrioritizedSelector prioritized(kInitialPriorityExponent);
+  REVERB_EXPECT_OK(prioritized.Insert(1, 1));
+
+  EXPECT_EQ(prioritized
+                .InsertBatch({testing::MakeKeyWithPriority(2, 3),
+                              testing::MakeKeyWithPriority(1, 1),
+                              testing::MakeKeyWithPriority(3, 5)})
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_DOUBLE_EQ(prioritized.TotalWeight().value(), 4);
+  EXPECT_EQ(prioritized.InsertBatch({testing::MakeKeyWithPriority(4, -1)})
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  REVERB_EXPECT_OK(prioritized.Delete(2));
+  EXPECT_EQ(prioritized.Delete(3).code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(prioritized.Delete(4).code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST(PrioritizedSelectorTest, SampleBatchMatchesProbabilities) {
+  const int kItems = 50;
+  const int kSamples = 200000;
+
+  PrioritizedSelector prioritized(kInitialPriorityExponent);
+  double sum = 0;
+  for (int i = 0; i < kItems; i++) {
+    REVERB_EXPECT_OK(prioritized.Insert(i, i));
+    sum += i;
+  }
+
+  std::vector<int64_t> counts(kItems);
+  for (int i = 0; i < kSamples / 100; i++) {
+    auto samples = prioritized.SampleBatch(100);
+    ASSERT_EQ(samples.size(), 100);
+    for (const auto& sample : samples) {
+      EXPECT_NEAR(sample.probability, sample.key / sum, 1e-9);
+      counts[sample.key]++;
+    }
+  }
+  EXPECT_EQ(counts[0], 0);
+  for (int k = 1; k < kItems; k++) {
+    EXPECT_NEAR(static_cast<double>(counts[k]) / kSamples, k / sum, 0.01);
+  }
+}
+
+TEST(PrioritizedSelectorTest, StratifiedSampleBatchMatchesProbabilities) {
+  const int kItems = 50;
+  const int kSamples = 200000;
+
+  PrioritizedSelector prioritized(
+      kInitialPriorityExponent,
+      KeyDistributionOptions::Prioritized::BATCH_SAMPLING_STRATIFIED);
+  double sum = 0;
+  for (int i = 0; i < kItems; i++) {
+    REVERB_EXPECT_OK(prioritized.Insert(i, i));
+    sum += i;
+  }
+
+  std::vector<int64_t> counts(kItems);
+  for (int i = 0; i < kSamples / 100; i++) {
+    auto samples = prioritized.SampleBatch(100);
+    ASSERT_EQ(samples.size(), 100);
+    for (const auto& sample : samples) {
+      EXPECT_NEAR(sample.probability, sample.key / sum, 1e-9);
+      counts[sample.key]++;
+    }
+  }
+  EXPECT_EQ(counts[0], 0);
+  for (int k = 1; k < kItems; k++) {
+    EXPECT_NEAR(static_cast<double>(counts[k]) / kSamples, k / sum, 0.01);
+  }
+}
+
+TEST(PrioritizedSelectorTest, WithoutReplacementSampleBatchHasNoDuplicates) {
+  PrioritizedSelector prioritized(
+      kInitialPriorityExponent,
+      KeyDistributionOptions::Prioritized::BATCH_SAMPLING_WITHOUT_REPLACEMENT);
+  for (int i = 0; i < 100; i++) {
+    REVERB_EXPECT_OK(prioritized.Insert(i, i + 1));
+  }
+  for (int i = 0; i < 100; i++) {
+    internal::flat_hash_map<ItemSelector::Key, int> counts;
+    for (const auto& sample : prioritized.SampleBatch(64)) {
+      EXPECT_EQ(++counts[sample.key], 1);
+    }
+  }
+  EXPECT_DOUBLE_EQ(prioritized.NodeSumTestingOnly(0), 100 * 101 / 2);
+}
+
+TEST(PrioritizedSelectorTest, SeededSelectorsSampleTheSameKeys) {
+  PrioritizedSelector a(kInitialPriorityExponent, internal::PhiloxBitGen(42));
+  PrioritizedSelector b(kInitialPriorityExponent, internal::PhiloxBitGen(42));
+  for (int i = 0; i < 100; i++) {
+    REVERB_EXPECT_OK(a.Insert(i, i + 1));
+    REVERB_EXPECT_OK(b.Insert(i, i + 1));
+  }
+  EXPECT_EQ(a.options().seed(), 42);
+
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(a.Sample().key, b.Sample().key);
+    auto batch_a = a.SampleBatch(16);
+    auto batch_b = b.SampleBatch(16);
+    ASSERT_EQ(batch_a.size(), batch_b.size());
+    for (size_t j = 0; j < batch_a.size(); j++) {
+      EXPECT_EQ(batch_a[j].key, batch_b[j].key);
+    }
+  }
+}
+
+TEST(PrioritizedSelectorTest, SampleBatchMatchesSequentialSamples) {
+  // Every sample is drawn from the stream of its index, so a batch selects the
+  // same keys as the same number of calls to `Sample` (in shuffled order).
+  PrioritizedSelector batched(kInitialPriorityExponent,
+                              internal::PhiloxBitGen(7));
+  PrioritizedSelector sequential(kInitialPriorityExponent,
+                                 internal::PhiloxBitGen(7));
+  for (int i = 0; i < 100; i++) {
+    REVERB_EXPECT_OK(batched.Insert(i, i + 1));
+    REVERB_EXPECT_OK(sequential.Insert(i, i + 1));
+  }
+  std::vector<ItemSelector::Key> batched_keys;
+  for (const auto& sample : batched.SampleBatch(32)) {
+    batched_keys.push_back(sample.key);
+  }
+  std::vector<ItemSelector::Key> sequential_keys;
+  for (int i = 0; i < 32; i++) {
+    sequential_keys.push_back(sequential.Sample().key);
+  }
+  EXPECT_THAT(batched_keys,
+              ::testing::UnorderedElementsAreArray(sequential_keys));
 }
 
 TEST(PrioritizedDeathTest, ClearThenSample) {
@@ -0,0 +1,304 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/selectors/recency_weighted.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/sum_tree.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using internal::CheckValidPriority;
+using internal::PriorityToWeight;
+
+// Buckets only hold the keys inserted during one decay interval so they start
+// out much smaller than the trees of `PrioritizedSelector`.
+constexpr size_t kInitialBucketCapacity = 1024;
+
+absl::Time DecodeTimestamp(const google::protobuf::Timestamp& timestamp) {
+  return absl::FromUnixSeconds(timestamp.seconds()) +
+         absl::Nanoseconds(timestamp.nanos());
+}
+
+}  // namespace
+
+RecencyWeightedSelector::Bucket::Bucket()
+    : sum_tree(kInitialBucketCapacity) {}
+
+RecencyWeightedSelector::RecencyWeightedSelector(
+    double priority_exponent, absl::Duration decay,
+    internal::PhiloxBitGen bit_gen, std::function<absl::Time()> clock)
+    : priority_exponent_(priority_exponent),
+      decay_(decay),
+      bit_gen_(std::move(bit_gen)),
+      clock_(std::move(clock)) {
+  REVERB_CHECK_GE(priority_exponent_, 0);
+  REVERB_CHECK(decay_ > absl::ZeroDuration());
+}
+
+void RecencyWeightedSelector::ToBucket(absl::Time time, int64_t* bucket,
+                                       double* offset) const {
+  absl::Duration remainder;
+  *bucket = absl::IDivDuration(time - absl::UnixEpoch(), decay_, &remainder);
+  // The division truncates towards zero, buckets are aligned to multiples of
+  // `decay_` instead.
+  if (remainder < absl::ZeroDuration()) {
+    --*bucket;
+    remainder += decay_;
+  }
+  *offset = absl::FDivDuration(remainder, decay_);
+}
+
+double RecencyWeightedSelector::Weight(double priority, double offset) const {
+  return PriorityToWeight(priority, priority_exponent_) * std::exp(offset);
+}
+
+absl::Status RecencyWeightedSelector::Delete(Key key) {
+  const auto it = key_to_location_.find(key);
+  if (it == key_to_location_.end())
+    return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
+  const Location location = it->second;
+  key_to_location_.erase(it);
+
+  auto bucket = buckets_.find(location.bucket);
+  internal::SumTree& sum_tree = bucket->second.sum_tree;
+  sum_tree.Remove(location.index);
+  if (location.index != sum_tree.size()) {
+    // The last key has been moved into the position of the removed key.
+    key_to_location_[sum_tree.key(location.index)].index = location.index;
+  }
+  if (sum_tree.size() == 0) buckets_.erase(bucket);
+  bucket_weights_dirty_ = true;
+  return absl::OkStatus();
+}
+
+absl::Status RecencyWeightedSelector::Insert(Key key, double priority) {
+  REVERB_RETURN_IF_ERROR(CheckValidPriority(priority));
+  Location location;
+  ToBucket(clock_(), &location.bucket, &location.offset);
+  auto [it, inserted] = key_to_location_.try_emplace(key, location);
+  if (!inserted) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Key ", key, " already inserted."));
+  }
+  it->second.index = buckets_[location.bucket].sum_tree.Append(
+      key, Weight(priority, location.offset));
+  bucket_weights_dirty_ = true;
+  return absl::OkStatus();
+}
+
+absl::Status RecencyWeightedSelector::InsertBatch(
+    absl::Span<const KeyWithPriority> items) {
+  key_to_location_.reserve(key_to_location_.size() + items.size());
+  const absl::Time now = clock_();
+
+  // Leaves of consecutive keys in the same bucket, appended at once.
+  internal::SumTree* sum_tree = nullptr;
+  int64_t current_bucket = 0;
+  std::vector<std::pair<Key, double>> leaves;
+  auto flush = [&] {
+    if (!leaves.empty()) sum_tree->AppendBatch(leaves);
+    leaves.clear();
+  };
+
+  absl::Status status = absl::OkStatus();
+  for (const auto& item : items) {
+    status = CheckValidPriority(item.priority());
+    if (!status.ok()) break;
+    Location location;
+    ToBucket(item.has_inserted_at() ? DecodeTimestamp(item.inserted_at()) : now,
+             &location.bucket, &location.offset);
+    if (sum_tree == nullptr || location.bucket != current_bucket) {
+      flush();
+      current_bucket = location.bucket;
+      sum_tree = &buckets_[current_bucket].sum_tree;
+    }
+    location.index = sum_tree->size() + leaves.size();
+    if (!key_to_location_.try_emplace(item.key(), location).second) {
+      status = absl::InvalidArgumentError(
+          absl::StrCat("Key ", item.key(), " already inserted."));
+      break;
+    }
+    leaves.emplace_back(item.key(), Weight(item.priority(), location.offset));
+  }
+
+  // Inserts preceding a failure are still applied.
+  flush();
+  if (sum_tree != nullptr && sum_tree->size() == 0) {
+    buckets_.erase(current_bucket);
+  }
+  bucket_weights_dirty_ = true;
+  return status;
+}
+
+absl::Status RecencyWeightedSelector::Update(Key key, double priority) {
+  REVERB_RETURN_IF_ERROR(CheckValidPriority(priority));
+  const auto it = key_to_location_.find(key);
+  if (it == key_to_location_.end()) {
+    return absl::InvalidArgumentError(absl::StrCat("Key ", key, " not found."));
+  }
+  const Location& location = it->second;
+  buckets_[location.bucket].sum_tree.Set(location.index,
+                                         Weight(priority, location.offset));
+  bucket_weights_dirty_ = true;
+  return absl::OkStatus();
+}
+
+absl::Status RecencyWeightedSelector::CheckPriority(double priority) const {
+  return CheckValidPriority(priority);
+}
+
+void RecencyWeightedSelector::UpdateBucketWeights() {
+  cumulative_weights_.clear();
+  cumulative_weights_.reserve(buckets_.size());
+
+  // The weight of bucket b is its sum times exp(b - now / decay). The time
+  // dependent factor is shared by all buckets so the weights are computed
+  // relative to the heaviest bucket instead, which avoids overflows and
+  // underflows of the exponential.
+  double reference = -std::numeric_limits<double>::infinity();
+  for (const auto& [index, bucket] : buckets_) {
+    const double total = bucket.sum_tree.total();
+    if (total > 0) {
+      reference = std::max(reference, std::log(total) + index);
+    }
+  }
+
+  double cumulative = 0;
+  for (auto& [index, bucket] : buckets_) {
+    if (std::isinf(reference)) {
+      // All weights are zero so keys are sampled uniformly.
+      cumulative += bucket.sum_tree.size();
+    } else {
+      const double total = bucket.sum_tree.total();
+      if (total > 0) {
+        cumulative += std::exp(std::log(total) + index - reference);
+      }
+    }
+    cumulative_weights_.emplace_back(cumulative, &bucket);
+  }
+  bucket_weights_dirty_ = false;
+}
+
+ItemSelector::KeyWithProbability RecencyWeightedSelector::Sample() {
+  REVERB_CHECK(!buckets_.empty());
+  if (bucket_weights_dirty_) UpdateBucketWeights();
+
+  const double total = cumulative_weights_.back().first;
+  internal::PhiloxBitGen sample_gen =
+      bit_gen_.ForSample(bit_gen_.ReserveSamples(1));
+  const double target = absl::Uniform<double>(sample_gen, 0, total);
+  auto it = std::upper_bound(
+      cumulative_weights_.begin(), cumulative_weights_.end(), target,
+      [](double target, const std::pair<double, Bucket*>& bucket) {
+        return target < bucket.first;
+      });
+  // Rounding errors may result in the target being at the very end, in which
+  // case the last bucket with a non-zero weight is selected.
+  if (it == cumulative_weights_.end()) --it;
+  while (it != cumulative_weights_.begin() && it->first == (it - 1)->first) {
+    --it;
+  }
+
+  const double bucket_weight =
+      it->first -
+      (it == cumulative_weights_.begin() ? 0.0 : (it - 1)->first);
+  KeyWithProbability sample = it->second->sum_tree.Sample(&bit_gen_);
+  sample.probability *= bucket_weight / total;
+  return sample;
+}
+
+void RecencyWeightedSelector::Clear() {
+  buckets_.clear();
+  key_to_location_.clear();
+  bucket_weights_dirty_ = true;
+}
+
+absl::Status RecencyWeightedSelector::ScalePriorities(double factor) {
+  const double weight_factor = PriorityToWeight(factor, priority_exponent_);
+  for (auto& [_, bucket] : buckets_) {
+    bucket.sum_tree.Scale(weight_factor);
+  }
+  bucket_weights_dirty_ = true;
+  return absl::OkStatus();
+}
+
+absl::Status RecencyWeightedSelector::SetPriorityExponent(
+    double priority_exponent, absl::FunctionRef<double(Key)> priority) {
+  if (!(priority_exponent >= 0)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Priority exponent must be non-negative but got ", priority_exponent,
+        "."));
+  }
+  priority_exponent_ = priority_exponent;
+  for (auto& [_, bucket] : buckets_) {
+    bucket.sum_tree.Reweight([this, priority](Key key) {
+      return Weight(priority(key), key_to_location_.at(key).offset);
+    });
+  }
+  bucket_weights_dirty_ = true;
+  return absl::OkStatus();
+}
+
+absl::optional<double> RecencyWeightedSelector::TotalWeight() const {
+  int64_t now_bucket;
+  double now_offset;
+  ToBucket(clock_(), &now_bucket, &now_offset);
+
+  double total = 0;
+  for (const auto& [index, bucket] : buckets_) {
+    total += bucket.sum_tree.total() *
+             std::exp(static_cast<double>(index - now_bucket) - now_offset);
+  }
+  return total;
+}
+
+KeyDistributionOptions RecencyWeightedSelector::options() const {
+  KeyDistributionOptions options;
+  options.mutable_recency_weighted()->set_priority_exponent(
+      priority_exponent_);
+  options.mutable_recency_weighted()->set_decay_seconds(
+      absl::ToDoubleSeconds(decay_));
+  options.set_is_deterministic(false);
+  if (bit_gen_.deterministic()) options.set_seed(bit_gen_.seed());
+  return options;
+}
+
+std::string RecencyWeightedSelector::DebugString() const {
+  return absl::StrCat(
+      "RecencyWeightedSelector(priority_exponent=", priority_exponent_,
+      ", decay_seconds=", absl::ToDoubleSeconds(decay_), ")");
+}
+
+}  // namespace reverb
+}  // namespace deepmind
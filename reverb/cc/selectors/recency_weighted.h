@@ -0,0 +1,169 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SELECTORS_RECENCY_WEIGHTED_H_
+#define REVERB_CC_SELECTORS_RECENCY_WEIGHTED_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/sum_tree.h"
+#include "reverb/cc/support/philox_bit_gen.h"
+
+namespace deepmind {
+namespace reverb {
+
+// RecencyWeightedSelector samples keys with a probability proportional to
+//
+//   priority^priority_exponent * exp(-age / decay)
+//
+// where `age` is the time since the key was inserted. Older keys thus become
+// less likely to be sampled without any priority updates from the learner.
+//
+// The decay is exponential, so the ratio between the weights of two keys does
+// not change as time passes and sampling never has to reweight the keys. The
+// weights are instead stored relative to the time at which the keys were
+// inserted: keys are grouped into buckets spanning `decay` of insertion time
+// and every bucket holds a `SumTree` of the priorities scaled by the offset of
+// the insertion time within the bucket (a factor in [1, e)). The weight of a
+// bucket relative to the newest bucket only depends on the distance between
+// them, so aging all keys is a O(buckets) pass over the sums of the buckets
+// rather than an update of every key. The bucket weights are only recomputed
+// when the content of a bucket changed since the last sample.
+//
+// Items restored from a checkpoint keep the age they had when the checkpoint
+// was taken (see `KeyWithPriority::inserted_at`), all other keys are stamped
+// with the time at which they are inserted into the selector.
+class RecencyWeightedSelector : public ItemSelector {
+ public:
+  // `priority_exponent` must be non-negative and `decay` positive. `clock`
+  // returns the current time and is only replaced in tests.
+  RecencyWeightedSelector(double priority_exponent, absl::Duration decay,
+                          internal::PhiloxBitGen bit_gen =
+                              internal::PhiloxBitGen(),
+                          std::function<absl::Time()> clock = absl::Now);
+
+  // O(log n) time.
+  absl::Status Delete(Key key) override;
+
+  // The priority must be non-negative. O(log n) time.
+  absl::Status Insert(Key key, double priority) override;
+
+  // Keys with an `inserted_at` are inserted with that age. Consecutive keys
+  // of the same bucket (e.g keys restored in order of insertion) are appended
+  // to the bucket at once.
+  absl::Status InsertBatch(absl::Span<const KeyWithPriority> items) override;
+
+  // The priority must be non-negative. O(log n) time.
+  absl::Status Update(Key key, double priority) override;
+
+  absl::Status CheckPriority(double priority) const override;
+
+  // O(buckets + log n) time if any bucket has changed since the last sample,
+  // O(log buckets + log n) otherwise.
+  KeyWithProbability Sample() override;
+
+  // O(n) time.
+  void Clear() override;
+
+  // Scales the weights by `factor` raised to the priority exponent. O(n) time.
+  absl::Status ScalePriorities(double factor) override;
+
+  // The exponent must be non-negative. O(n) time.
+  absl::Status SetPriorityExponent(
+      double priority_exponent,
+      absl::FunctionRef<double(Key)> priority) override;
+
+  // Sum of the decayed weights of all keys at the current time. O(buckets)
+  // time.
+  absl::optional<double> TotalWeight() const override;
+
+  KeyDistributionOptions options() const override;
+
+  std::string DebugString() const override;
+
+ private:
+  // Keys inserted during the same `decay_` long interval of time.
+  struct Bucket {
+    Bucket();
+
+    // Priorities raised to the exponent and scaled by `exp(offset)` where
+    // `offset` is the position of the insertion time within the bucket.
+    internal::SumTree sum_tree;
+  };
+
+  // Where a key is stored.
+  struct Location {
+    // Number of `decay_` intervals between the Unix epoch and the insertion.
+    int64_t bucket;
+    // Position of the key in the `SumTree` of the bucket.
+    size_t index;
+    // Remainder of the insertion time within the bucket, in units of `decay_`.
+    double offset;
+  };
+
+  // Splits `time` into the index of its bucket and the offset within.
+  void ToBucket(absl::Time time, int64_t* bucket, double* offset) const;
+
+  // Weight of a key within its bucket.
+  double Weight(double priority, double offset) const;
+
+  // Recomputes `cumulative_weights_` from the sums of the buckets.
+  void UpdateBucketWeights();
+
+  // Controls the degree of prioritization. See `PrioritizedSelector`.
+  double priority_exponent_;
+
+  // Time constant of the exponential decay.
+  const absl::Duration decay_;
+
+  // All non-empty buckets, ordered by insertion time.
+  std::map<int64_t, Bucket> buckets_;
+
+  // Maps a key to the bucket and position where it can be found.
+  internal::flat_hash_map<Key, Location> key_to_location_;
+
+  // Cumulative weights of the buckets, in the order of `buckets_`, relative to
+  // the heaviest bucket. If no key has a non-zero weight, then buckets are
+  // weighted by their size so that keys are sampled uniformly.
+  std::vector<std::pair<double, Bucket*>> cumulative_weights_;
+
+  // Whether `cumulative_weights_` has to be recomputed before sampling.
+  bool bucket_weights_dirty_ = true;
+
+  // Used for sampling, not thread-safe. Every sample draws the bucket from the
+  // stream of its own sample index (see `internal::PhiloxBitGen`).
+  internal::PhiloxBitGen bit_gen_;
+
+  // Returns the current time.
+  std::function<absl::Time()> clock_;
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SELECTORS_RECENCY_WEIGHTED_H_
@@ -0,0 +1,274 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/selectors/recency_weighted.h"
+
+#include <cmath>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/philox_bit_gen.h"
+#include "reverb/cc/testing/proto_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+const absl::Duration kDecay = absl::Seconds(10);
+
+// Selector with a clock which only moves when `now` is changed.
+class RecencyWeightedSelectorTest : public ::testing::Test {
+ protected:
+  RecencyWeightedSelectorTest()
+      : selector_(1, kDecay, internal::PhiloxBitGen(),
+                  [this] { return now_; }) {}
+
+  // Probability of each of `keys` according to `Sample`.
+  std::vector<double> SampledProbabilities(const std::vector<int>& keys) {
+    std::vector<double> probabilities(keys.size(), -1);
+    for (int i = 0; i < 100000; i++) {
+      auto sample = selector_.Sample();
+      for (int j = 0; j < keys.size(); j++) {
+        if (keys[j] == sample.key) probabilities[j] = sample.probability;
+      }
+    }
+    return probabilities;
+  }
+
+  absl::Time now_ = absl::FromUnixSeconds(1600000000);
+  RecencyWeightedSelector selector_;
+};
+
+TEST_F(RecencyWeightedSelectorTest, ReturnValueSantiyChecks) {
+  // Non existent keys cannot be deleted or updated.
+  EXPECT_EQ(selector_.Delete(123).code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(selector_.Update(123, 4).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // Keys cannot be inserted twice.
+  REVERB_EXPECT_OK(selector_.Insert(123, 4));
+  EXPECT_EQ(selector_.Insert(123, 4).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // Existing keys can be updated and sampled.
+  REVERB_EXPECT_OK(selector_.Update(123, 5));
+  EXPECT_EQ(selector_.Sample().key, 123);
+
+  // Negative and NAN priorities are not allowed.
+  EXPECT_EQ(selector_.Update(123, -1).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(selector_.Insert(456, NAN).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // Existing keys cannot be deleted twice.
+  REVERB_EXPECT_OK(selector_.Delete(123));
+  EXPECT_EQ(selector_.Delete(123).code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST_F(RecencyWeightedSelectorTest, ProbabilitiesDecayWithAge) {
+  // Weights relative to key 0: p * exp(age difference / decay).
+  REVERB_EXPECT_OK(selector_.Insert(0, 1));
+  now_ += kDecay / 2;
+  REVERB_EXPECT_OK(selector_.Insert(1, 1));
+  now_ += kDecay;
+  REVERB_EXPECT_OK(selector_.Insert(2, 2));
+  now_ += kDecay * 3;
+  REVERB_EXPECT_OK(selector_.Insert(3, 0.5));
+
+  const std::vector<double> weights = {1, std::exp(0.5), 2 * std::exp(1.5),
+                                       0.5 * std::exp(4.5)};
+  double sum = 0;
+  for (double weight : weights) sum += weight;
+
+  std::vector<double> probabilities = SampledProbabilities({0, 1, 2, 3});
+  for (int i = 0; i < weights.size(); i++) {
+    EXPECT_NEAR(probabilities[i], weights[i] / sum, 1e-9) << i;
+  }
+
+  // The ratios between the weights do not change as time passes but the total
+  // weight does.
+  const double total = selector_.TotalWeight().value();
+  now_ += kDecay;
+  EXPECT_NEAR(selector_.TotalWeight().value(), total * std::exp(-1), 1e-9);
+  EXPECT_THAT(SampledProbabilities({0, 1, 2, 3}),
+              ::testing::Pointwise(::testing::DoubleNear(1e-9), probabilities));
+}
+
+TEST_F(RecencyWeightedSelectorTest, TotalWeightIsDecayedPriority) {
+  REVERB_EXPECT_OK(selector_.Insert(0, 2));
+  REVERB_EXPECT_OK(selector_.Insert(1, 3));
+  EXPECT_NEAR(selector_.TotalWeight().value(), 5, 1e-9);
+
+  now_ += kDecay * 2;
+  EXPECT_NEAR(selector_.TotalWeight().value(), 5 * std::exp(-2), 1e-9);
+
+  REVERB_EXPECT_OK(selector_.Insert(2, 1));
+  EXPECT_NEAR(selector_.TotalWeight().value(), 5 * std::exp(-2) + 1, 1e-9);
+}
+
+TEST_F(RecencyWeightedSelectorTest, SampledDistributionMatchesProbabilities) {
+  const int kSamples = 1000000;
+  std::vector<double> weights;
+  for (int i = 0; i < 10; i++) {
+    REVERB_EXPECT_OK(selector_.Insert(i, i + 1));
+    weights.push_back((i + 1) * std::exp(0.3 * i));
+    now_ += kDecay * 0.3;
+  }
+  double sum = 0;
+  for (double weight : weights) sum += weight;
+
+  std::vector<int64_t> counts(weights.size());
+  for (int i = 0; i < kSamples; i++) {
+    counts[selector_.Sample().key]++;
+  }
+  for (int i = 0; i < weights.size(); i++) {
+    EXPECT_NEAR(static_cast<double>(counts[i]) / kSamples, weights[i] / sum,
+                0.01);
+  }
+}
+
+TEST_F(RecencyWeightedSelectorTest, AllZeroPrioritiesResultsInUniformSampling) {
+  for (int i = 0; i < 4; i++) {
+    REVERB_EXPECT_OK(selector_.Insert(i, 0));
+    now_ += kDecay * 2;
+  }
+  EXPECT_THAT(SampledProbabilities({0, 1, 2, 3}),
+              ::testing::Each(::testing::DoubleEq(0.25)));
+}
+
+TEST_F(RecencyWeightedSelectorTest, VeryOldKeysDoNotOverflow) {
+  REVERB_EXPECT_OK(selector_.Insert(0, 1));
+  now_ += kDecay * 2000;
+  REVERB_EXPECT_OK(selector_.Insert(1, 1));
+
+  auto sample = selector_.Sample();
+  EXPECT_EQ(sample.key, 1);
+  EXPECT_DOUBLE_EQ(sample.probability, 1);
+
+  // Once the recent key is gone the old key is the only one left.
+  REVERB_EXPECT_OK(selector_.Delete(1));
+  sample = selector_.Sample();
+  EXPECT_EQ(sample.key, 0);
+  EXPECT_DOUBLE_EQ(sample.probability, 1);
+}
+
+TEST_F(RecencyWeightedSelectorTest, DeleteUpdateAndClear) {
+  for (int i = 0; i < 6; i++) {
+    REVERB_EXPECT_OK(selector_.Insert(i, 1));
+    now_ += kDecay;
+  }
+  // Empty the buckets of keys 0 and 5 and move key 3 to the front.
+  REVERB_EXPECT_OK(selector_.Delete(0));
+  REVERB_EXPECT_OK(selector_.Delete(5));
+  REVERB_EXPECT_OK(selector_.Update(3, 0));
+  REVERB_EXPECT_OK(selector_.Update(1, std::exp(3)));
+
+  const double sum = 2 * std::exp(4) + std::exp(2);
+  EXPECT_THAT(SampledProbabilities({1, 2, 3, 4}),
+              ::testing::Pointwise(::testing::DoubleNear(1e-9),
+                                 std::vector<double>{std::exp(4) / sum,
+                                                     std::exp(2) / sum, -1,
+                                                     std::exp(4) / sum}));
+
+  selector_.Clear();
+  EXPECT_EQ(selector_.TotalWeight().value(), 0);
+  REVERB_EXPECT_OK(selector_.Insert(0, 1));
+  EXPECT_EQ(selector_.Sample().key, 0);
+}
+
+TEST_F(RecencyWeightedSelectorTest, InsertBatchUsesInsertedAt) {
+  RecencyWeightedSelector inserted_over_time(
+      1, kDecay, internal::PhiloxBitGen(), [this] { return now_; });
+  std::vector<KeyWithPriority> items;
+  for (int i = 0; i < 5; i++) {
+    REVERB_EXPECT_OK(inserted_over_time.Insert(i, i + 1));
+    items.emplace_back();
+    items.back().set_key(i);
+    items.back().set_priority(i + 1);
+    items.back().mutable_inserted_at()->set_seconds(absl::ToUnixSeconds(now_));
+    now_ += kDecay * 0.7;
+  }
+  // Keys without an insertion time are inserted now.
+  REVERB_EXPECT_OK(inserted_over_time.Insert(5, 1));
+  items.emplace_back();
+  items.back().set_key(5);
+  items.back().set_priority(1);
+
+  REVERB_EXPECT_OK(selector_.InsertBatch(items));
+  EXPECT_NEAR(selector_.TotalWeight().value(),
+              inserted_over_time.TotalWeight().value(), 1e-9);
+
+  std::vector<double> expected(6, -1);
+  for (int i = 0; i < 100000; i++) {
+    auto sample = inserted_over_time.Sample();
+    expected[sample.key] = sample.probability;
+  }
+  EXPECT_THAT(SampledProbabilities({0, 1, 2, 3, 4, 5}),
+              ::testing::Pointwise(::testing::DoubleNear(1e-9), expected));
+
+  // Keys already present are rejected but preceding keys are inserted.
+  items.resize(2);
+  items[0].set_key(6);
+  EXPECT_EQ(selector_.InsertBatch(items).code(),
+            absl::StatusCode::kInvalidArgument);
+  REVERB_EXPECT_OK(selector_.Delete(6));
+}
+
+TEST_F(RecencyWeightedSelectorTest, ScaleAndSetPriorityExponent) {
+  std::vector<double> priorities = {4, 1, 3};
+  for (int i = 0; i < priorities.size(); i++) {
+    REVERB_EXPECT_OK(selector_.Insert(i, priorities[i]));
+    now_ += kDecay;
+  }
+  // A common factor does not change the probabilities.
+  std::vector<double> probabilities = SampledProbabilities({0, 1, 2});
+  const double total = selector_.TotalWeight().value();
+  REVERB_EXPECT_OK(selector_.ScalePriorities(0.5));
+  EXPECT_NEAR(selector_.TotalWeight().value(), total * 0.5, 1e-9);
+  EXPECT_THAT(SampledProbabilities({0, 1, 2}),
+              ::testing::Pointwise(::testing::DoubleNear(1e-9), probabilities));
+
+  // Without prioritization only the age of the keys matters.
+  REVERB_EXPECT_OK(selector_.SetPriorityExponent(
+      0, [&priorities](ItemSelector::Key key) { return priorities[key]; }));
+  const double sum = 1 + std::exp(1) + std::exp(2);
+  EXPECT_THAT(SampledProbabilities({0, 1, 2}),
+              ::testing::Pointwise(::testing::DoubleNear(1e-9),
+                                 std::vector<double>{1 / sum, std::exp(1) / sum,
+                                                     std::exp(2) / sum}));
+  EXPECT_EQ(
+      selector_
+          .SetPriorityExponent(-1, [](ItemSelector::Key) { return 1.0; })
+          .code(),
+      absl::StatusCode::kInvalidArgument);
+}
+
+TEST(RecencyWeightedSelectorOptionsTest, Options) {
+  RecencyWeightedSelector selector(0.5, absl::Seconds(90));
+  EXPECT_THAT(selector.options(), testing::EqualsProto(R"pb(
+                recency_weighted: { priority_exponent: 0.5 decay_seconds: 90 }
+                is_deterministic: false
+              )pb"));
+  EXPECT_EQ(selector.DebugString(),
+            "RecencyWeightedSelector(priority_exponent=0.5, decay_seconds=90)");
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,662 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/selectors/selector_pair.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+#include "absl/memory/memory.h"
+#include "absl/random/distributions.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/platform/huge_pages.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/key_sequence.h"
+#include "reverb/cc/selectors/sum_tree.h"
+#include "reverb/cc/support/philox_bit_gen.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using Key = SelectorPair::Key;
+using KeyWithProbability = SelectorPair::KeyWithProbability;
+
+// Forwards every call to both selectors.
+class ForwardingSelectorPair final : public SelectorPair {
+ public:
+  ForwardingSelectorPair(std::shared_ptr<ItemSelector> sampler,
+                         std::shared_ptr<ItemSelector> remover)
+      : sampler_(std::move(sampler)), remover_(std::move(remover)) {}
+
+  absl::Status Insert(Key key, size_t slot, double priority) override {
+    REVERB_RETURN_IF_ERROR(sampler_->Insert(key, priority));
+    return remover_->Insert(key, priority);
+  }
+
+  absl::Status InsertBatch(absl::Span<const KeyWithPriority> items,
+                           absl::Span<const size_t> slots) override {
+    REVERB_RETURN_IF_ERROR(sampler_->InsertBatch(items));
+    return remover_->InsertBatch(items);
+  }
+
+  absl::Status Delete(Key key, size_t slot) override {
+    REVERB_RETURN_IF_ERROR(sampler_->Delete(key));
+    return remover_->Delete(key);
+  }
+
+  absl::Status Update(Key key, size_t slot, double priority) override {
+    REVERB_RETURN_IF_ERROR(sampler_->Update(key, priority));
+    return remover_->Update(key, priority);
+  }
+
+  absl::Status UpdateBatch(absl::Span<const KeyWithPriority> updates,
+                           absl::Span<const size_t> slots) override {
+    REVERB_RETURN_IF_ERROR(sampler_->UpdateBatch(updates));
+    return remover_->UpdateBatch(updates);
+  }
+
+  absl::Status CheckPriority(double priority) const override {
+    REVERB_RETURN_IF_ERROR(sampler_->CheckPriority(priority));
+    return remover_->CheckPriority(priority);
+  }
+
+  KeyWithProbability Sample() override { return sampler_->Sample(); }
+
+  std::vector<KeyWithProbability> SampleBatch(int num_samples) override {
+    return sampler_->SampleBatch(num_samples);
+  }
+
+  Key SelectForRemoval() override { return remover_->Sample().key; }
+
+  void Clear() override {
+    sampler_->Clear();
+    remover_->Clear();
+  }
+
+  void Reserve(size_t num_keys) override {
+    sampler_->Reserve(num_keys);
+    remover_->Reserve(num_keys);
+  }
+
+  absl::Status ScalePriorities(double factor) override {
+    REVERB_RETURN_IF_ERROR(sampler_->ScalePriorities(factor));
+    return remover_->ScalePriorities(factor);
+  }
+
+  absl::Status SetPriorityExponent(
+      double priority_exponent,
+      absl::FunctionRef<double(Key)> priority) override {
+    return sampler_->SetPriorityExponent(priority_exponent, priority);
+  }
+
+  absl::optional<double> TotalWeight() const override {
+    return sampler_->TotalWeight();
+  }
+
+  KeyDistributionOptions sampler_options() const override {
+    return sampler_->options();
+  }
+
+  KeyDistributionOptions remover_options() const override {
+    return remover_->options();
+  }
+
+  std::string DebugString() const override {
+    return absl::StrCat("sampler=", sampler_->DebugString(),
+                        ", remover=", remover_->DebugString());
+  }
+
+ private:
+  std::shared_ptr<ItemSelector> sampler_;
+  std::shared_ptr<ItemSelector> remover_;
+};
+
+// Sampling half of `FusedFifoSelectorPair` equivalent to `PrioritizedSelector`.
+// Stores slots rather than keys, addressed by their position in the sum tree,
+// which the owner keeps track of.
+class PrioritizedSampler {
+ public:
+  PrioritizedSampler(double priority_exponent,
+                     SumTree::BatchSampling batch_sampling,
+                     PhiloxBitGen bit_gen)
+      : priority_exponent_(priority_exponent),
+        batch_sampling_(batch_sampling),
+        bit_gen_(std::move(bit_gen)) {
+    REVERB_CHECK_GE(priority_exponent_, 0);
+  }
+
+  absl::Status CheckPriority(double priority) const {
+    return CheckValidPriority(priority);
+  }
+
+  size_t size() const { return sum_tree_.size(); }
+
+  Key key(size_t index) const { return sum_tree_.key(index); }
+
+  void Append(Key key, double priority) {
+    sum_tree_.Append(key, PriorityToWeight(priority, priority_exponent_));
+  }
+
+  void AppendBatch(std::vector<std::pair<Key, double>> items) {
+    for (auto& item : items) {
+      item.second = PriorityToWeight(item.second, priority_exponent_);
+    }
+    sum_tree_.AppendBatch(items);
+  }
+
+  void Remove(size_t index) { sum_tree_.Remove(index); }
+
+  void Set(size_t index, double priority) {
+    sum_tree_.Set(index, PriorityToWeight(priority, priority_exponent_));
+  }
+
+  void SetBatch(std::vector<std::pair<size_t, double>> updates) {
+    for (auto& update : updates) {
+      update.second = PriorityToWeight(update.second, priority_exponent_);
+    }
+    sum_tree_.SetBatch(updates);
+  }
+
+  KeyWithProbability Sample() { return sum_tree_.Sample(&bit_gen_); }
+
+  std::vector<KeyWithProbability> SampleBatch(int num_samples) {
+    return sum_tree_.SampleBatch(num_samples, batch_sampling_, &bit_gen_);
+  }
+
+  void Clear() { sum_tree_.Clear(); }
+
+  void Reserve(size_t size) { sum_tree_.Reserve(size); }
+
+  // Scales or recomputes the weights of all slots, see `PrioritizedSelector`.
+  void Scale(double factor) {
+    sum_tree_.Scale(PriorityToWeight(factor, priority_exponent_));
+  }
+
+  void SetPriorityExponent(double priority_exponent,
+                           absl::FunctionRef<double(Key)> priority) {
+    priority_exponent_ = priority_exponent;
+    sum_tree_.Reweight([this, priority](Key slot) {
+      return PriorityToWeight(priority(slot), priority_exponent_);
+    });
+  }
+
+  absl::optional<double> TotalWeight() const { return sum_tree_.total(); }
+
+ private:
+  double priority_exponent_;
+  const SumTree::BatchSampling batch_sampling_;
+  SumTree sum_tree_;
+  PhiloxBitGen bit_gen_;
+};
+
+// Sampling half of `FusedFifoSelectorPair` equivalent to `UniformSelector`.
+// Stores slots rather than keys, addressed by their position in a dense array,
+// which the owner keeps track of.
+class UniformSampler {
+ public:
+  explicit UniformSampler(PhiloxBitGen bit_gen)
+      : bit_gen_(std::move(bit_gen)) {}
+
+  absl::Status CheckPriority(double priority) const {
+    return absl::OkStatus();
+  }
+
+  size_t size() const { return keys_.size(); }
+
+  Key key(size_t index) const { return keys_[index]; }
+
+  void Append(Key key, double priority) { keys_.push_back(key); }
+
+  void AppendBatch(std::vector<std::pair<Key, double>> items) {
+    keys_.reserve(keys_.size() + items.size());
+    for (const auto& item : items) keys_.push_back(item.first);
+  }
+
+  void Remove(size_t index) {
+    keys_[index] = keys_.back();
+    keys_.pop_back();
+  }
+
+  void Set(size_t index, double priority) {}
+
+  void SetBatch(std::vector<std::pair<size_t, double>> updates) {}
+
+  KeyWithProbability Sample() {
+    REVERB_CHECK(!keys_.empty());
+    PhiloxBitGen sample_gen = bit_gen_.ForSample(bit_gen_.ReserveSamples(1));
+    const size_t index = absl::Uniform<size_t>(sample_gen, 0, keys_.size());
+    return {keys_[index], 1.0 / static_cast<double>(keys_.size())};
+  }
+
+  std::vector<KeyWithProbability> SampleBatch(int num_samples) {
+    std::vector<KeyWithProbability> samples;
+    samples.reserve(num_samples);
+    for (int i = 0; i < num_samples; i++) samples.push_back(Sample());
+    return samples;
+  }
+
+  void Clear() { keys_.clear(); }
+
+  void Reserve(size_t size) {
+    keys_.reserve(size);
+    AdviseHugePages(keys_.data(), keys_.capacity() * sizeof(Key));
+  }
+
+  void Scale(double factor) {}
+
+  void SetPriorityExponent(double priority_exponent,
+                           absl::FunctionRef<double(Key)> priority) {}
+
+  absl::optional<double> TotalWeight() const { return absl::nullopt; }
+
+ private:
+  std::vector<Key> keys_;
+  PhiloxBitGen bit_gen_;
+};
+
+// Equivalent to the pair (`Sampler`, `FifoSelector`). The position of each
+// key in the sampler and in the FIFO ring is stored in a vector indexed by the
+// slot of the key, so no operation needs to hash the key, and the sampler is
+// called directly rather than through `ItemSelector`. The sampler and FIFO ring
+// store slots, which are translated back into keys when selected.
+//
+// The replaced selectors are kept (empty) to describe the pair and to validate
+// table wide changes before they are applied to `sampler_`.
+template <typename Sampler>
+class FusedFifoSelectorPair final : public SelectorPair {
+ public:
+  FusedFifoSelectorPair(Sampler sampler,
+                        std::shared_ptr<ItemSelector> sampler_selector,
+                        std::shared_ptr<ItemSelector> remover_selector)
+      : sampler_(std::move(sampler)),
+        sampler_selector_(std::move(sampler_selector)),
+        remover_selector_(std::move(remover_selector)) {}
+
+  absl::Status Insert(Key key, size_t slot, double priority) override {
+    REVERB_RETURN_IF_ERROR(sampler_.CheckPriority(priority));
+    REVERB_RETURN_IF_ERROR(AddRecord(key, slot, sampler_.size()));
+    sampler_.Append(slot, priority);
+    return absl::OkStatus();
+  }
+
+  absl::Status InsertBatch(absl::Span<const KeyWithPriority> items,
+                           absl::Span<const size_t> slots) override {
+    REVERB_CHECK_EQ(items.size(), slots.size());
+    std::vector<std::pair<Key, double>> inserted;
+    inserted.reserve(items.size());
+    absl::Status status = absl::OkStatus();
+    for (size_t i = 0; i < items.size(); i++) {
+      status = sampler_.CheckPriority(items[i].priority());
+      if (!status.ok()) break;
+      status = AddRecord(items[i].key(), slots[i],
+                         sampler_.size() + inserted.size());
+      if (!status.ok()) break;
+      inserted.emplace_back(slots[i], items[i].priority());
+    }
+    // Inserts preceding a failure are still applied.
+    sampler_.AppendBatch(std::move(inserted));
+    return status;
+  }
+
+  absl::Status Delete(Key key, size_t slot) override {
+    REVERB_RETURN_IF_ERROR(CheckRecord(key, slot));
+    Record& record = records_[slot];
+    record.present = false;
+
+    sampler_.Remove(record.index);
+    if (record.index != sampler_.size()) {
+      // The last slot of the sampler has been moved into the freed position.
+      records_[sampler_.key(record.index)].index = record.index;
+    }
+    fifo_.Erase(record.fifo_pos, [this](Key moved, uint64_t pos) {
+      records_[moved].fifo_pos = pos;
+    });
+    return absl::OkStatus();
+  }
+
+  absl::Status Update(Key key, size_t slot, double priority) override {
+    REVERB_RETURN_IF_ERROR(sampler_.CheckPriority(priority));
+    REVERB_RETURN_IF_ERROR(CheckRecord(key, slot));
+    sampler_.Set(records_[slot].index, priority);
+    return absl::OkStatus();
+  }
+
+  absl::Status UpdateBatch(absl::Span<const KeyWithPriority> updates,
+                           absl::Span<const size_t> slots) override {
+    REVERB_CHECK_EQ(updates.size(), slots.size());
+    std::vector<std::pair<size_t, double>> found;
+    found.reserve(updates.size());
+    absl::Status status = absl::OkStatus();
+    for (size_t i = 0; i < updates.size(); i++) {
+      status = sampler_.CheckPriority(updates[i].priority());
+      if (!status.ok()) break;
+      status = CheckRecord(updates[i].key(), slots[i]);
+      if (!status.ok()) break;
+      found.emplace_back(records_[slots[i]].index, updates[i].priority());
+    }
+    // Updates preceding a failure are still applied.
+    sampler_.SetBatch(std::move(found));
+    return status;
+  }
+
+  absl::Status CheckPriority(double priority) const override {
+    return sampler_.CheckPriority(priority);
+  }
+
+  KeyWithProbability Sample() override {
+    KeyWithProbability sample = sampler_.Sample();
+    sample.key = records_[sample.key].key;
+    return sample;
+  }
+
+  std::vector<KeyWithProbability> SampleBatch(int num_samples) override {
+    std::vector<KeyWithProbability> samples = sampler_.SampleBatch(num_samples);
+    for (auto& sample : samples) sample.key = records_[sample.key].key;
+    return samples;
+  }
+
+  Key SelectForRemoval() override { return records_[fifo_.front()].key; }
+
+  void Clear() override {
+    sampler_.Clear();
+    fifo_.Clear();
+    records_.clear();
+  }
+
+  void Reserve(size_t num_keys) override {
+    sampler_.Reserve(num_keys);
+    fifo_.Reserve(num_keys);
+    records_.reserve(num_keys);
+    AdviseHugePages(records_.data(), records_.capacity() * sizeof(Record));
+  }
+
+  absl::Status ScalePriorities(double factor) override {
+    REVERB_RETURN_IF_ERROR(sampler_selector_->ScalePriorities(factor));
+    sampler_.Scale(factor);
+    return absl::OkStatus();
+  }
+
+  absl::Status SetPriorityExponent(
+      double priority_exponent,
+      absl::FunctionRef<double(Key)> priority) override {
+    REVERB_RETURN_IF_ERROR(sampler_selector_->SetPriorityExponent(
+        priority_exponent, [](Key key) { return 0.; }));
+    sampler_.SetPriorityExponent(priority_exponent, [&](Key slot) {
+      return priority(records_[slot].key);
+    });
+    return absl::OkStatus();
+  }
+
+  absl::optional<double> TotalWeight() const override {
+    return sampler_.TotalWeight();
+  }
+
+  KeyDistributionOptions sampler_options() const override {
+    return sampler_selector_->options();
+  }
+
+  KeyDistributionOptions remover_options() const override {
+    return remover_selector_->options();
+  }
+
+  std::string DebugString() const override {
+    return absl::StrCat("sampler=", sampler_selector_->DebugString(),
+                        ", remover=", remover_selector_->DebugString());
+  }
+
+ private:
+  struct Record {
+    Key key = 0;
+    // Position of the slot in `sampler_`.
+    size_t index = 0;
+    // Position of the slot in `fifo_`.
+    uint64_t fifo_pos = 0;
+    bool present = false;
+  };
+
+  // Records `key` in `slot` and appends the slot to `fifo_`. The slot must be
+  // appended to `sampler_` at `index` by the caller.
+  absl::Status AddRecord(Key key, size_t slot, size_t index) {
+    if (slot >= records_.size()) {
+      records_.resize(std::max(slot + 1, 2 * records_.size()));
+    }
+    Record& record = records_[slot];
+    if (record.present) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Key ", key, " already inserted."));
+    }
+    record = {key, index, fifo_.PushBack(slot), true};
+    return absl::OkStatus();
+  }
+
+  // Returns `InvalidArgumentError` unless `slot` holds `key`.
+  absl::Status CheckRecord(Key key, size_t slot) const {
+    if (slot >= records_.size() || !records_[slot].present ||
+        records_[slot].key != key) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Key ", key, " not found."));
+    }
+    return absl::OkStatus();
+  }
+
+  Sampler sampler_;
+  KeyRing fifo_;
+  std::vector<Record> records_;
+
+  // The (empty) selectors replaced by this pair.
+  const std::shared_ptr<ItemSelector> sampler_selector_;
+  const std::shared_ptr<ItemSelector> remover_selector_;
+};
+
+// Equivalent to the pair (`FifoSelector`, `FifoSelector`), i.e. a queue. Both
+// the sampler and the remover select the oldest key so a single FIFO ring of
+// slots serves both, and the position of each slot in the ring is stored in a
+// vector indexed by slot. Tables used as queues (which also delete every item
+// after it has been sampled once) therefore push and pop slots from a ring
+// without hashing keys or maintaining a second selector.
+//
+// The replaced selectors are kept (empty) to describe the pair.
+class FusedQueueSelectorPair final : public SelectorPair {
+ public:
+  FusedQueueSelectorPair(std::shared_ptr<ItemSelector> sampler_selector,
+                         std::shared_ptr<ItemSelector> remover_selector)
+      : sampler_selector_(std::move(sampler_selector)),
+        remover_selector_(std::move(remover_selector)) {}
+
+  absl::Status Insert(Key key, size_t slot, double priority) override {
+    return AddRecord(key, slot);
+  }
+
+  absl::Status InsertBatch(absl::Span<const KeyWithPriority> items,
+                           absl::Span<const size_t> slots) override {
+    REVERB_CHECK_EQ(items.size(), slots.size());
+    for (size_t i = 0; i < items.size(); i++) {
+      // Inserts preceding a failure are still applied.
+      REVERB_RETURN_IF_ERROR(AddRecord(items[i].key(), slots[i]));
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status Delete(Key key, size_t slot) override {
+    REVERB_RETURN_IF_ERROR(CheckRecord(key, slot));
+    Record& record = records_[slot];
+    record.present = false;
+    fifo_.Erase(record.fifo_pos, [this](Key moved, uint64_t pos) {
+      records_[moved].fifo_pos = pos;
+    });
+    return absl::OkStatus();
+  }
+
+  absl::Status Update(Key key, size_t slot, double priority) override {
+    return CheckRecord(key, slot);
+  }
+
+  absl::Status UpdateBatch(absl::Span<const KeyWithPriority> updates,
+                           absl::Span<const size_t> slots) override {
+    REVERB_CHECK_EQ(updates.size(), slots.size());
+    for (size_t i = 0; i < updates.size(); i++) {
+      REVERB_RETURN_IF_ERROR(CheckRecord(updates[i].key(), slots[i]));
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status CheckPriority(double priority) const override {
+    return absl::OkStatus();
+  }
+
+  KeyWithProbability Sample() override {
+    REVERB_CHECK(!fifo_.empty());
+    return {records_[fifo_.front()].key, 1.};
+  }
+
+  std::vector<KeyWithProbability> SampleBatch(int num_samples) override {
+    return std::vector<KeyWithProbability>(num_samples, Sample());
+  }
+
+  Key SelectForRemoval() override { return records_[fifo_.front()].key; }
+
+  void Clear() override {
+    fifo_.Clear();
+    records_.clear();
+  }
+
+  void Reserve(size_t num_keys) override {
+    fifo_.Reserve(num_keys);
+    records_.reserve(num_keys);
+    AdviseHugePages(records_.data(), records_.capacity() * sizeof(Record));
+  }
+
+  absl::Status ScalePriorities(double factor) override {
+    return absl::OkStatus();
+  }
+
+  absl::Status SetPriorityExponent(
+      double priority_exponent,
+      absl::FunctionRef<double(Key)> priority) override {
+    return sampler_selector_->SetPriorityExponent(priority_exponent,
+                                                  [](Key key) { return 0.; });
+  }
+
+  absl::optional<double> TotalWeight() const override {
+    return absl::nullopt;
+  }
+
+  KeyDistributionOptions sampler_options() const override {
+    return sampler_selector_->options();
+  }
+
+  KeyDistributionOptions remover_options() const override {
+    return remover_selector_->options();
+  }
+
+  std::string DebugString() const override {
+    return absl::StrCat("sampler=", sampler_selector_->DebugString(),
+                        ", remover=", remover_selector_->DebugString());
+  }
+
+ private:
+  struct Record {
+    Key key = 0;
+    // Position of the slot in `fifo_`.
+    uint64_t fifo_pos = 0;
+    bool present = false;
+  };
+
+  // Records `key` in `slot` and appends the slot to `fifo_`.
+  absl::Status AddRecord(Key key, size_t slot) {
+    if (slot >= records_.size()) {
+      records_.resize(std::max(slot + 1, 2 * records_.size()));
+    }
+    Record& record = records_[slot];
+    if (record.present) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Key ", key, " already inserted."));
+    }
+    record = {key, fifo_.PushBack(slot), true};
+    return absl::OkStatus();
+  }
+
+  // Returns `InvalidArgumentError` unless `slot` holds `key`.
+  absl::Status CheckRecord(Key key, size_t slot) const {
+    if (slot >= records_.size() || !records_[slot].present ||
+        records_[slot].key != key) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Key ", key, " not found."));
+    }
+    return absl::OkStatus();
+  }
+
+  KeyRing fifo_;
+  std::vector<Record> records_;
+
+  // The (empty) selectors replaced by this pair.
+  const std::shared_ptr<ItemSelector> sampler_selector_;
+  const std::shared_ptr<ItemSelector> remover_selector_;
+};
+
+// Generator of a fused sampler, seeded like the selector it replaces (see
+// `MakeBitGen` in checkpoint_util.cc).
+PhiloxBitGen MakeBitGen(const KeyDistributionOptions& options) {
+  return options.seed() != 0 ? PhiloxBitGen(options.seed()) : PhiloxBitGen();
+}
+
+}  // namespace
+
+std::unique_ptr<SelectorPair> MakeSelectorPair(
+    std::shared_ptr<ItemSelector> sampler,
+    std::shared_ptr<ItemSelector> remover) {
+  KeyDistributionOptions sampler_options = sampler->options();
+  KeyDistributionOptions remover_options = remover->options();
+  if (remover_options.fifo()) {
+    if (sampler_options.has_prioritized()) {
+      PrioritizedSampler fused(
+          sampler_options.prioritized().priority_exponent(),
+          sampler_options.prioritized().batch_sampling(),
+          MakeBitGen(sampler_options));
+      return absl::make_unique<FusedFifoSelectorPair<PrioritizedSampler>>(
+          std::move(fused), std::move(sampler), std::move(remover));
+    }
+    if (sampler_options.uniform()) {
+      return absl::make_unique<FusedFifoSelectorPair<UniformSampler>>(
+          UniformSampler(MakeBitGen(sampler_options)), std::move(sampler),
+          std::move(remover));
+    }
+    if (sampler_options.fifo()) {
+      return absl::make_unique<FusedQueueSelectorPair>(std::move(sampler),
+                                                       std::move(remover));
+    }
+  }
+  return absl::make_unique<ForwardingSelectorPair>(std::move(sampler),
+                                                   std::move(remover));
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,130 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SELECTORS_SELECTOR_PAIR_H_
+#define REVERB_CC_SELECTORS_SELECTOR_PAIR_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/interface.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// The sampler and remover of a table. Every item of a table is inserted into,
+// updated in and deleted from both selectors so they are driven through a
+// single interface. This allows the most common combinations to be replaced by
+// a fused implementation which calls the selectors without virtual dispatch
+// (see `MakeSelectorPair`).
+//
+// Every key is passed together with the slot in which the table stores the
+// item (see `SlotMap`). A slot identifies a single key until that key is
+// deleted, after which it may be reused. The fused implementations index all
+// their bookkeeping by slot and therefore never hash keys.
+//
+// Like `ItemSelector`, implementations are NOT thread safe.
+class SelectorPair {
+ public:
+  using Key = ItemSelector::Key;
+  using KeyWithProbability = ItemSelector::KeyWithProbability;
+
+  virtual ~SelectorPair() = default;
+
+  // Inserts the key into both selectors. Returns `InvalidArgumentError` if the
+  // key (or slot) already exists or the priority is rejected by either
+  // selector.
+  virtual absl::Status Insert(Key key, size_t slot, double priority) = 0;
+
+  // Inserts all items, where `slots[i]` is the slot of `items[i]`, into both
+  // selectors. Items preceding an error are still inserted.
+  virtual absl::Status InsertBatch(absl::Span<const KeyWithPriority> items,
+                                   absl::Span<const size_t> slots) = 0;
+
+  // Deletes the key from both selectors. Returns `InvalidArgumentError` if the
+  // key does not exist.
+  virtual absl::Status Delete(Key key, size_t slot) = 0;
+
+  // Updates the priority of the key in both selectors. Returns
+  // `InvalidArgumentError` if the key does not exist.
+  virtual absl::Status Update(Key key, size_t slot, double priority) = 0;
+
+  // Updates the priorities of all keys, where `slots[i]` is the slot of
+  // `updates[i]`, in both selectors. Updates preceding an error are still
+  // applied.
+  virtual absl::Status UpdateBatch(absl::Span<const KeyWithPriority> updates,
+                                   absl::Span<const size_t> slots) = 0;
+
+  // See `ItemSelector::CheckPriority`. Returns an error if either selector
+  // rejects `priority`.
+  virtual absl::Status CheckPriority(double priority) const = 0;
+
+  // Selects keys using the sampler. Must not be called if empty.
+  virtual KeyWithProbability Sample() = 0;
+  virtual std::vector<KeyWithProbability> SampleBatch(int num_samples) = 0;
+
+  // Selects the key which should be removed next using the remover. Must not
+  // be called if empty.
+  virtual Key SelectForRemoval() = 0;
+
+  // Removes all keys from both selectors.
+  virtual void Clear() = 0;
+
+  // See `ItemSelector::Reserve`. Applied to both selectors.
+  virtual void Reserve(size_t num_keys) = 0;
+
+  // See `ItemSelector::ScalePriorities`. Applied to both selectors.
+  virtual absl::Status ScalePriorities(double factor) = 0;
+
+  // See `ItemSelector::SetPriorityExponent`. Applied to the sampler only.
+  virtual absl::Status SetPriorityExponent(
+      double priority_exponent, absl::FunctionRef<double(Key)> priority) = 0;
+
+  // See `ItemSelector::TotalWeight`. Refers to the sampler.
+  virtual absl::optional<double> TotalWeight() const = 0;
+
+  // Options of the sampler and remover respectively.
+  virtual KeyDistributionOptions sampler_options() const = 0;
+  virtual KeyDistributionOptions remover_options() const = 0;
+
+  // Returns "sampler=<sampler>, remover=<remover>".
+  virtual std::string DebugString() const = 0;
+};
+
+// Combines `sampler` and `remover`, neither of which may contain any keys.
+//
+// A prioritized, uniform or FIFO sampler together with a FIFO remover is
+// replaced by a fused implementation equivalent to the two selectors. The
+// selectors are identified by their options, in the same way as they are
+// reconstructed from checkpoints. Any other combination forwards all calls to
+// the two selectors.
+std::unique_ptr<SelectorPair> MakeSelectorPair(
+    std::shared_ptr<ItemSelector> sampler,
+    std::shared_ptr<ItemSelector> remover);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SELECTORS_SELECTOR_PAIR_H_
@@ -0,0 +1,321 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/selectors/selector_pair.h"
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/lifo.h"
+#include "reverb/cc/selectors/prioritized.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/philox_bit_gen.h"
+#include "reverb/cc/support/slot_map.h"
+#include "reverb/cc/testing/proto_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::deepmind::reverb::testing::MakeKeyWithPriority;
+
+std::shared_ptr<ItemSelector> MakeSampler(bool prioritized) {
+  if (prioritized) return std::make_shared<PrioritizedSelector>(0.8);
+  return std::make_shared<UniformSelector>();
+}
+
+class SelectorPairTest : public ::testing::TestWithParam<bool> {};
+
+TEST_P(SelectorPairTest, ReturnValueSanityChecks) {
+  auto pair = MakeSelectorPair(MakeSampler(GetParam()),
+                               std::make_shared<FifoSelector>());
+
+  EXPECT_EQ(pair->Delete(123, 0).code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(pair->Update(123, 0, 4).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  REVERB_EXPECT_OK(pair->Insert(123, 0, 4));
+  EXPECT_EQ(pair->Insert(123, 0, 4).code(),
+            absl::StatusCode::kInvalidArgument);
+  REVERB_EXPECT_OK(pair->Update(123, 0, 5));
+  EXPECT_EQ(pair->Sample().key, 123);
+  EXPECT_EQ(pair->SelectForRemoval(), 123);
+
+  REVERB_EXPECT_OK(pair->Delete(123, 0));
+  EXPECT_EQ(pair->Delete(123, 0).code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST_P(SelectorPairTest, DescribesReplacedSelectors) {
+  auto sampler = MakeSampler(GetParam());
+  auto remover = std::make_shared<FifoSelector>();
+  auto pair = MakeSelectorPair(sampler, remover);
+
+  EXPECT_EQ(pair->DebugString(),
+            absl::StrCat("sampler=", sampler->DebugString(),
+                         ", remover=", remover->DebugString()));
+  EXPECT_EQ(pair->sampler_options().SerializeAsString(),
+            sampler->options().SerializeAsString());
+  EXPECT_EQ(pair->remover_options().SerializeAsString(),
+            remover->options().SerializeAsString());
+}
+
+TEST_P(SelectorPairTest, MatchesSelectorsUnderRandomOperations) {
+  const bool prioritized = GetParam();
+  auto pair = MakeSelectorPair(MakeSampler(prioritized),
+                               std::make_shared<FifoSelector>());
+  auto sampler = MakeSampler(prioritized);
+  FifoSelector remover;
+
+  absl::BitGen gen;
+  SlotMap<bool> slots;
+  ItemSelector::Key next_key = 0;
+  auto delete_key = [&](ItemSelector::Key key) {
+    const size_t slot = slots.Find(key);
+    REVERB_ASSERT_OK(pair->Delete(key, slot));
+    REVERB_ASSERT_OK(sampler->Delete(key));
+    REVERB_ASSERT_OK(remover.Delete(key));
+    slots.Erase(slot);
+  };
+  for (int i = 0; i < 20000; i++) {
+    // Grow the pair for a while and then shrink it so that the FIFO ring is
+    // both grown and compacted and slots are reused.
+    const bool grow = (i / 2000) % 2 == 0;
+    const double op = absl::Uniform<double>(gen, 0, 1);
+    if (slots.empty() || op < (grow ? 0.5 : 0.2)) {
+      const double priority = absl::Uniform<double>(gen, 0, 10);
+      const size_t slot = slots.Insert(next_key, true).first;
+      REVERB_ASSERT_OK(pair->Insert(next_key, slot, priority));
+      REVERB_ASSERT_OK(sampler->Insert(next_key, priority));
+      REVERB_ASSERT_OK(remover.Insert(next_key, priority));
+      next_key++;
+    } else if (op < 0.6) {
+      // Mostly remove the oldest key like a table at capacity would.
+      const ItemSelector::Key key = pair->SelectForRemoval();
+      ASSERT_EQ(key, remover.Sample().key);
+      delete_key(key);
+    } else if (op < 0.8) {
+      const ItemSelector::Key key = pair->Sample().key;
+      ASSERT_TRUE(slots.contains(key));
+      delete_key(key);
+    } else {
+      const ItemSelector::Key key = pair->Sample().key;
+      const double priority = absl::Uniform<double>(gen, 0, 10);
+      REVERB_ASSERT_OK(pair->Update(key, slots.Find(key), priority));
+      REVERB_ASSERT_OK(sampler->Update(key, priority));
+    }
+
+    if (!slots.empty()) {
+      ASSERT_EQ(pair->SelectForRemoval(), remover.Sample().key);
+      const auto sample = pair->Sample();
+      ASSERT_TRUE(slots.contains(sample.key));
+      if (!prioritized) {
+        ASSERT_DOUBLE_EQ(sample.probability, 1.0 / slots.size());
+      }
+    }
+    ASSERT_EQ(pair->TotalWeight().has_value(),
+              sampler->TotalWeight().has_value());
+    if (prioritized) {
+      ASSERT_NEAR(pair->TotalWeight().value(), sampler->TotalWeight().value(),
+                  1e-6);
+    }
+  }
+}
+
+TEST_P(SelectorPairTest, BatchesApplyItemsPrecedingError) {
+  auto pair = MakeSelectorPair(MakeSampler(GetParam()),
+                               std::make_shared<FifoSelector>());
+  REVERB_ASSERT_OK(pair->Insert(1, 1, 1));
+
+  // Slots and keys are the same to keep the test simple.
+  std::vector<KeyWithPriority> items = {
+      MakeKeyWithPriority(2, 1), MakeKeyWithPriority(1, 1),
+      MakeKeyWithPriority(3, 1)};
+  EXPECT_EQ(pair->InsertBatch(items, {2, 1, 3}).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(pair->Delete(3, 3).code(), absl::StatusCode::kInvalidArgument);
+
+  std::vector<KeyWithPriority> updates = {
+      MakeKeyWithPriority(2, 3), MakeKeyWithPriority(4, 1)};
+  EXPECT_EQ(pair->UpdateBatch(updates, {2, 4}).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // The FIFO order of the inserted keys is kept.
+  EXPECT_EQ(pair->SelectForRemoval(), 1);
+  REVERB_EXPECT_OK(pair->Delete(1, 1));
+  EXPECT_EQ(pair->SelectForRemoval(), 2);
+  EXPECT_EQ(pair->Sample().key, 2);
+  REVERB_EXPECT_OK(pair->Delete(2, 2));
+
+  pair->Clear();
+  REVERB_EXPECT_OK(pair->Insert(1, 1, 1));
+  EXPECT_EQ(pair->SelectForRemoval(), 1);
+}
+
+TEST_P(SelectorPairTest, RejectsKeyStoredInOtherSlot) {
+  auto pair = MakeSelectorPair(MakeSampler(GetParam()),
+                               std::make_shared<FifoSelector>());
+  REVERB_ASSERT_OK(pair->Insert(1, 0, 1));
+  REVERB_ASSERT_OK(pair->Insert(2, 1, 1));
+  EXPECT_EQ(pair->Update(1, 1, 2).code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(pair->Delete(2, 0).code(), absl::StatusCode::kInvalidArgument);
+  REVERB_EXPECT_OK(pair->Delete(1, 0));
+  REVERB_EXPECT_OK(pair->Delete(2, 1));
+}
+
+INSTANTIATE_TEST_SUITE_P(PrioritizedAndUniform, SelectorPairTest,
+                         ::testing::Bool());
+
+TEST(SelectorPairTest, FusedPrioritizedPairRejectsInvalidPriorities) {
+  auto pair = MakeSelectorPair(std::make_shared<PrioritizedSelector>(1),
+                               std::make_shared<FifoSelector>());
+  EXPECT_EQ(pair->Insert(1, 0, -1).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(pair->Insert(1, 0, NAN).code(),
+            absl::StatusCode::kInvalidArgument);
+  REVERB_ASSERT_OK(pair->Insert(1, 0, 1));
+  EXPECT_EQ(pair->Update(1, 0, -1).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST_P(SelectorPairTest, AppliesTableWideTransforms) {
+  auto pair = MakeSelectorPair(MakeSampler(GetParam()),
+                               std::make_shared<FifoSelector>());
+  // Keys and slots differ so that the translation between them is exercised.
+  for (int i = 0; i < 3; i++) REVERB_ASSERT_OK(pair->Insert(10 + i, i, i + 1));
+  REVERB_EXPECT_OK(pair->ScalePriorities(2));
+
+  auto priority = [](ItemSelector::Key key) { return 2. * (key - 9); };
+  if (!GetParam()) {
+    EXPECT_EQ(pair->SetPriorityExponent(2, priority).code(),
+              absl::StatusCode::kInvalidArgument);
+    EXPECT_EQ(pair->Sample().probability, 1. / 3);
+    return;
+  }
+  REVERB_EXPECT_OK(pair->SetPriorityExponent(2, priority));
+  EXPECT_EQ(pair->sampler_options().prioritized().priority_exponent(), 2);
+  EXPECT_THAT(pair->DebugString(),
+              ::testing::HasSubstr("priority_exponent=2"));
+  for (const auto& sample : pair->SampleBatch(100)) {
+    EXPECT_DOUBLE_EQ(sample.probability,
+                     std::pow(sample.key - 9, 2) / 14);
+  }
+  EXPECT_EQ(pair->SelectForRemoval(), 10);
+}
+
+TEST_P(SelectorPairTest, SeededFusedPairsSampleIdenticalSequences) {
+  auto make_pair = [](bool prioritized) {
+    std::shared_ptr<ItemSelector> sampler;
+    if (prioritized) {
+      sampler = std::make_shared<PrioritizedSelector>(0.8, PhiloxBitGen(42));
+    } else {
+      sampler = std::make_shared<UniformSelector>(PhiloxBitGen(42));
+    }
+    return MakeSelectorPair(std::move(sampler),
+                            std::make_shared<FifoSelector>());
+  };
+  auto first = make_pair(GetParam());
+  auto second = make_pair(GetParam());
+  EXPECT_EQ(first->sampler_options().seed(), 42);
+  for (int i = 0; i < 100; i++) {
+    REVERB_ASSERT_OK(first->Insert(i, i, i + 1));
+    REVERB_ASSERT_OK(second->Insert(i, i, i + 1));
+  }
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(first->Sample().key, second->Sample().key);
+  }
+  std::vector<ItemSelector::KeyWithProbability> first_batch =
+      first->SampleBatch(16);
+  std::vector<ItemSelector::KeyWithProbability> second_batch =
+      second->SampleBatch(16);
+  for (int i = 0; i < 16; i++) {
+    EXPECT_EQ(first_batch[i].key, second_batch[i].key);
+  }
+}
+
+TEST(SelectorPairTest, FusedQueuePairMatchesFifoSelector) {
+  auto sampler = std::make_shared<FifoSelector>();
+  auto remover = std::make_shared<FifoSelector>();
+  auto pair = MakeSelectorPair(sampler, remover);
+  EXPECT_EQ(pair->DebugString(),
+            "sampler=FifoSelector, remover=FifoSelector");
+  EXPECT_TRUE(pair->sampler_options().fifo());
+  EXPECT_FALSE(pair->TotalWeight().has_value());
+  EXPECT_EQ(pair->SetPriorityExponent(2, [](ItemSelector::Key) { return 1.; })
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+
+  absl::BitGen gen;
+  SlotMap<bool> slots;
+  FifoSelector expected;
+  ItemSelector::Key next_key = 0;
+  for (int i = 0; i < 20000; i++) {
+    // Grow and shrink the queue so that the ring is grown, compacted and
+    // slots are reused.
+    const bool grow = (i / 2000) % 2 == 0;
+    const double op = absl::Uniform<double>(gen, 0, 1);
+    if (slots.empty() || op < (grow ? 0.6 : 0.3)) {
+      const size_t slot = slots.Insert(next_key, true).first;
+      REVERB_ASSERT_OK(pair->Insert(next_key, slot, 1));
+      REVERB_ASSERT_OK(expected.Insert(next_key, 1));
+      next_key++;
+    } else {
+      // Mostly pop the front like a queue, sometimes delete another key.
+      ItemSelector::Key key = pair->Sample().key;
+      if (op > 0.9) key = pair->SelectForRemoval() + 1;
+      if (!slots.contains(key)) continue;
+      const size_t slot = slots.Find(key);
+      REVERB_ASSERT_OK(pair->Update(key, slot, 2));
+      REVERB_ASSERT_OK(pair->Delete(key, slot));
+      REVERB_ASSERT_OK(expected.Delete(key));
+      EXPECT_EQ(pair->Delete(key, slot).code(),
+                absl::StatusCode::kInvalidArgument);
+      slots.Erase(slot);
+    }
+    if (!slots.empty()) {
+      const auto sample = pair->Sample();
+      ASSERT_EQ(sample.key, expected.Sample().key);
+      ASSERT_EQ(sample.probability, 1.);
+      ASSERT_EQ(pair->SelectForRemoval(), sample.key);
+    }
+  }
+}
+
+TEST(SelectorPairTest, OtherCombinationsForwardToSelectors) {
+  auto sampler = std::make_shared<UniformSelector>();
+  auto remover = std::make_shared<LifoSelector>();
+  auto pair = MakeSelectorPair(sampler, remover);
+  for (int i = 0; i < 3; i++) REVERB_ASSERT_OK(pair->Insert(i, i, 1));
+  EXPECT_EQ(pair->SelectForRemoval(), 2);
+  EXPECT_EQ(remover->Sample().key, 2);
+  REVERB_ASSERT_OK(pair->Delete(2, 2));
+  EXPECT_EQ(remover->Sample().key, 1);
+  EXPECT_EQ(pair->DebugString(),
+            "sampler=UniformSelector, remover=LifoSelector");
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,424 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/selectors/sum_tree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/huge_pages.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+absl::Status CheckValidPriority(double priority) {
+  if (std::isnan(priority))
+    return absl::InvalidArgumentError("Priority must not be NaN.");
+  if (priority < 0)
+    return absl::InvalidArgumentError(
+        "Priority must not be negative.");
+  return absl::OkStatus();
+}
+
+double PriorityToWeight(double priority, double exponent) {
+  return priority == 0. ? 0. : std::pow(priority, exponent);
+}
+
+SumTree::SumTree() : SumTree(std::pow(2, 17)) {}
+
+namespace {
+
+// Smallest `shift` such that `1 << shift >= capacity`.
+int SegmentShift(size_t capacity) {
+  int shift = 0;
+  while ((size_t{1} << shift) < capacity) ++shift;
+  return shift;
+}
+
+}  // namespace
+
+SumTree::SumTree(size_t initial_capacity)
+    : segment_shift_(SegmentShift(initial_capacity)),
+      segment_mask_((size_t{1} << segment_shift_) - 1) {
+  Grow(1);
+}
+
+void SumTree::Grow(size_t size) {
+  while ((segments_.size() << segment_shift_) < size) {
+    segments_.push_back(absl::make_unique<Node[]>(segment_mask_ + 1));
+  }
+}
+
+void SumTree::Reserve(size_t size) {
+  const size_t num_segments = segments_.size();
+  Grow(size);
+  for (size_t i = num_segments; i < segments_.size(); i++) {
+    AdviseHugePages(segments_[i].get(), (segment_mask_ + 1) * sizeof(Node));
+  }
+}
+
+size_t SumTree::Append(Key key, double weight) {
+  const size_t index = size_;
+  Grow(index + 1);
+  node(index).key = key;
+  size_++;  // Note that this must occur before SetNode.
+  SetNode(index, weight);
+  return index;
+}
+
+void SumTree::AppendBatch(absl::Span<const std::pair<Key, double>> leaves) {
+  const size_t old_size = size_;
+  Grow(old_size + leaves.size());
+
+  for (const auto& leaf : leaves) {
+    node(size_).key = leaf.first;
+    node(size_).value = leaf.second;
+    size_++;
+  }
+
+  if (size_ - old_size >= old_size) {
+    // Children always have a higher index than their parent so iterating
+    // backwards computes every sum exactly once from final child sums.
+    for (int64_t i = size_ - 1; i >= 0; --i) {
+      node(i).sum = NodeValue(i) + NodeSum(2 * i + 1) + NodeSum(2 * i + 2);
+    }
+  } else {
+    std::vector<size_t> appended(size_ - old_size);
+    for (size_t i = 0; i < appended.size(); ++i) appended[i] = old_size + i;
+    RecomputeSums(std::move(appended));
+  }
+}
+
+void SumTree::Remove(size_t index) {
+  REVERB_CHECK_LT(index, size_);
+  const size_t last_index = size_ - 1;
+  if (index != last_index) {
+    // Replace the element that we want to remove with the last element.
+    SetNode(index, NodeValue(last_index));
+    node(index).key = node(last_index).key;
+  }
+  SetNode(last_index, 0);
+  size_--;  // Note that this must occur after SetNode.
+}
+
+void SumTree::Set(size_t index, double weight) {
+  REVERB_CHECK_LT(index, size_);
+  SetNode(index, weight);
+}
+
+void SumTree::SetBatch(absl::Span<const std::pair<size_t, double>> weights) {
+  std::vector<size_t> touched;
+  touched.reserve(weights.size());
+  for (const auto& weight : weights) {
+    REVERB_CHECK_LT(weight.first, size_);
+    node(weight.first).value = weight.second;
+    touched.push_back(weight.first);
+  }
+  RecomputeSums(std::move(touched));
+}
+
+ItemSelector::KeyWithProbability SumTree::Sample(PhiloxBitGen* bit_gen) const {
+  REVERB_CHECK_NE(size_, 0);
+
+  PhiloxBitGen sample_gen = bit_gen->ForSample(bit_gen->ReserveSamples(1));
+  const double target = absl::Uniform<double>(sample_gen, 0, 1);
+  const double total_weight = node(0).sum;
+
+  // All keys have zero priority so treat as if uniformly sampling.
+  if (total_weight == 0) {
+    const size_t pos = static_cast<size_t>(target * size_);
+    return {node(pos).key, 1. / size_};
+  }
+
+  double target_weight = target * total_weight;
+  const size_t index = FindIndex(&target_weight);
+  const double picked_weight = NodeValue(index);
+  REVERB_LOG_IF(REVERB_ERROR, target_weight >= picked_weight)
+      << "Target weight should be smaller than picked weight (target_weight: "
+      << target_weight << " >= picked_weight:" << picked_weight << ").";
+  return {node(index).key, picked_weight / total_weight};
+}
+
+std::vector<ItemSelector::KeyWithProbability> SumTree::SampleBatch(
+    int num_samples, BatchSampling batch_sampling, PhiloxBitGen* bit_gen) {
+  REVERB_CHECK_NE(size_, 0);
+  switch (batch_sampling) {
+    case KeyDistributionOptions::Prioritized::BATCH_SAMPLING_STRATIFIED:
+      return SampleStratified(num_samples, bit_gen);
+    case KeyDistributionOptions::Prioritized::
+        BATCH_SAMPLING_WITHOUT_REPLACEMENT:
+      return SampleWithoutReplacement(num_samples, bit_gen);
+    default:
+      return SampleIndependent(num_samples, bit_gen);
+  }
+}
+
+std::vector<ItemSelector::KeyWithProbability> SumTree::SampleIndependent(
+    int num_samples, PhiloxBitGen* bit_gen) const {
+  const double total_weight = node(0).sum;
+  const uint64_t first_sample = bit_gen->ReserveSamples(num_samples);
+
+  // The targets only depend on their sample index so they are computed in the
+  // same way as by `Sample`, except that the descents are sorted.
+  std::vector<double> targets(num_samples);
+  for (int i = 0; i < num_samples; i++) {
+    PhiloxBitGen sample_gen = bit_gen->ForSample(first_sample + i);
+    targets[i] = absl::Uniform<double>(sample_gen, 0, 1);
+  }
+
+  // All keys have zero priority so treat as if uniformly sampling.
+  if (total_weight == 0) {
+    std::vector<ItemSelector::KeyWithProbability> samples(num_samples);
+    for (int i = 0; i < num_samples; i++) {
+      const size_t pos = static_cast<size_t>(targets[i] * size_);
+      samples[i] = {node(pos).key, 1. / size_};
+    }
+    return samples;
+  }
+
+  for (double& target : targets) {
+    target *= total_weight;
+  }
+  std::sort(targets.begin(), targets.end());
+  return FindSorted(targets, bit_gen);
+}
+
+std::vector<ItemSelector::KeyWithProbability> SumTree::SampleStratified(
+    int num_samples, PhiloxBitGen* bit_gen) const {
+  const double total_weight = node(0).sum;
+  const uint64_t first_sample = bit_gen->ReserveSamples(num_samples);
+  auto offset = [&](int i) {
+    PhiloxBitGen sample_gen = bit_gen->ForSample(first_sample + i);
+    return absl::Uniform<double>(sample_gen, 0, 1);
+  };
+
+  // All keys have zero priority so the strata are positions rather than
+  // weights.
+  if (total_weight == 0) {
+    std::vector<ItemSelector::KeyWithProbability> samples(num_samples);
+    const double stratum = static_cast<double>(size_) / num_samples;
+    for (int i = 0; i < num_samples; i++) {
+      const size_t pos =
+          std::min<size_t>((i + offset(i)) * stratum, size_ - 1);
+      samples[i] = {node(pos).key, 1. / size_};
+    }
+    std::shuffle(samples.begin(), samples.end(), *bit_gen);
+    return samples;
+  }
+
+  // The targets are ascending by construction. Rounding may push the last
+  // target to the total weight so all targets are clamped below it.
+  const double stratum = total_weight / num_samples;
+  const double max_target = std::nextafter(total_weight, 0);
+  std::vector<double> targets(num_samples);
+  for (int i = 0; i < num_samples; i++) {
+    targets[i] = std::min((i + offset(i)) * stratum, max_target);
+  }
+  return FindSorted(targets, bit_gen);
+}
+
+std::vector<ItemSelector::KeyWithProbability>
+SumTree::SampleWithoutReplacement(int num_samples, PhiloxBitGen* bit_gen) {
+  const double total_weight = node(0).sum;
+  if (total_weight == 0) {
+    return SampleUniformWithoutReplacement(num_samples, bit_gen);
+  }
+
+  std::vector<ItemSelector::KeyWithProbability> samples;
+  samples.reserve(num_samples);
+  // Sampled positions and their weights, which are restored in the end.
+  std::vector<std::pair<size_t, double>> sampled;
+  // The descents depend on all previous samples so they are sequential, but
+  // every sample still draws from the stream of its own index.
+  const uint64_t first_sample = bit_gen->ReserveSamples(num_samples);
+  for (int i = 0; i < num_samples; i++) {
+    PhiloxBitGen sample_gen = bit_gen->ForSample(first_sample + i);
+    double target_weight = absl::Uniform<double>(sample_gen, 0, node(0).sum);
+    size_t index = FindIndex(&target_weight);
+    if (NodeValue(index) == 0) {
+      // Only rounding errors remain of the total weight so every key with a
+      // non-zero weight has been sampled and the remaining samples must be
+      // duplicates. Start over from the full tree.
+      SetBatch(sampled);
+      sampled.clear();
+      target_weight = absl::Uniform<double>(sample_gen, 0, node(0).sum);
+      index = FindIndex(&target_weight);
+    }
+    const double weight = NodeValue(index);
+    samples.push_back({node(index).key, weight / total_weight});
+    sampled.emplace_back(index, weight);
+    SetNode(index, 0);
+  }
+  SetBatch(sampled);
+  return samples;
+}
+
+std::vector<ItemSelector::KeyWithProbability>
+SumTree::SampleUniformWithoutReplacement(int num_samples,
+                                         PhiloxBitGen* bit_gen) const {
+  std::vector<ItemSelector::KeyWithProbability> samples;
+  samples.reserve(num_samples);
+
+  // Robert Floyd's algorithm samples k distinct positions in O(k) time.
+  const size_t k = std::min<size_t>(num_samples, size_);
+  internal::flat_hash_set<size_t> picked;
+  picked.reserve(k);
+  for (size_t j = size_ - k; j < size_; j++) {
+    size_t pos = absl::Uniform<size_t>(*bit_gen, 0, j + 1);
+    if (!picked.insert(pos).second) {
+      pos = j;
+      picked.insert(pos);
+    }
+    samples.push_back({node(pos).key, 1. / size_});
+  }
+  std::shuffle(samples.begin(), samples.end(), *bit_gen);
+
+  while (samples.size() < num_samples) {
+    const size_t pos = absl::Uniform<size_t>(*bit_gen, 0, size_);
+    samples.push_back({node(pos).key, 1. / size_});
+  }
+  return samples;
+}
+
+std::vector<ItemSelector::KeyWithProbability> SumTree::FindSorted(
+    const std::vector<double>& targets, PhiloxBitGen* bit_gen) const {
+  // The targets are sorted so that consecutive descents follow (mostly) the
+  // same path through the upper levels of the tree. The batch is shuffled
+  // afterwards so that it is not ordered by tree position.
+  const double total_weight = node(0).sum;
+  std::vector<ItemSelector::KeyWithProbability> samples;
+  samples.reserve(targets.size());
+  for (double target_weight : targets) {
+    const size_t index = FindIndex(&target_weight);
+    samples.push_back({node(index).key, NodeValue(index) / total_weight});
+  }
+  std::shuffle(samples.begin(), samples.end(), *bit_gen);
+  return samples;
+}
+
+void SumTree::Scale(double factor) {
+  for (size_t i = 0; i < size_; ++i) {
+    node(i).value *= factor;
+    node(i).sum *= factor;
+  }
+}
+
+void SumTree::Reweight(absl::FunctionRef<double(Key)> weight) {
+  for (size_t i = 0; i < size_; ++i) {
+    node(i).value = weight(node(i).key);
+  }
+  for (int64_t i = size_ - 1; i >= 0; --i) {
+    node(i).sum = NodeValue(i) + NodeSum(2 * i + 1) + NodeSum(2 * i + 2);
+  }
+}
+
+void SumTree::Clear() {
+  for (size_t i = 0; i < size_; ++i) {
+    node(i).sum = 0;
+    node(i).value = 0;
+  }
+  size_ = 0;
+}
+
+double SumTree::NodeSum(size_t index) const {
+  return index < size_ ? node(index).sum : 0;
+}
+
+size_t SumTree::FindIndex(double* target_weight) const {
+  // We begin traversing the nodes from the root to the children in order to
+  // find the `index` corresponding to the sampled `target_weight`.
+  size_t index = 0;
+  while (true) {
+    // Go to the left sub tree if it contains our sampled `target_weight`.
+    const size_t left_index = 2 * index + 1;
+    const double left_sum = NodeSum(left_index);
+    if (*target_weight < left_sum) {
+      index = left_index;
+      continue;
+    }
+    *target_weight -= left_sum;
+    // Go to the right sub tree if it contains our sampled `target_weight`.
+    const size_t right_index = 2 * index + 2;
+    const double right_sum = NodeSum(right_index);
+    if (*target_weight < right_sum) {
+      index = right_index;
+      continue;
+    }
+    *target_weight -= right_sum;
+    // Otherwise it is the current index.
+    break;
+  }
+  REVERB_CHECK_LT(index, size_);
+  return index;
+}
+
+void SumTree::RecomputeSums(std::vector<size_t> indices) {
+  if (indices.empty()) return;
+
+  // Parents always have a lower index than their children so processing the
+  // nodes one level at a time, starting with the deepest, ensures that the
+  // sums of the children are final before the parent is recomputed.
+  std::vector<std::vector<size_t>> levels;
+  for (size_t index : indices) {
+    int depth = 0;
+    for (size_t n = index + 1; n > 1; n >>= 1) ++depth;
+    if (levels.size() <= depth) levels.resize(depth + 1);
+    levels[depth].push_back(index);
+  }
+
+  for (int depth = levels.size() - 1; depth >= 0; --depth) {
+    auto& level = levels[depth];
+    std::sort(level.begin(), level.end());
+    level.erase(std::unique(level.begin(), level.end()), level.end());
+    for (size_t index : level) {
+      node(index).sum =
+          NodeValue(index) + NodeSum(2 * index + 1) + NodeSum(2 * index + 2);
+      if (index != 0) {
+        levels[depth - 1].push_back((index - 1) / 2);
+      }
+    }
+  }
+}
+
+void SumTree::SetNode(size_t index, double value) {
+  node(index).value = value;
+
+  // The sums on the path to the root are recomputed from the value and the
+  // children of each node rather than adjusted by the difference in value.
+  // Every sum is therefore exactly the sum of its parts (up to the rounding of
+  // a single addition) so rounding errors never accumulate and the tree never
+  // has to be rebuilt, which would stall the caller for O(n) time. The sums
+  // are non-negative since all weights are.
+  while (true) {
+    node(index).sum =
+        NodeValue(index) + NodeSum(2 * index + 1) + NodeSum(2 * index + 2);
+    if (index == 0) break;
+    index = (index - 1) / 2;
+  }
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,214 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SELECTORS_SUM_TREE_H_
+#define REVERB_CC_SELECTORS_SUM_TREE_H_
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/types/span.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/support/philox_bit_gen.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Returns `InvalidArgumentError` if `priority` is NaN or negative.
+absl::Status CheckValidPriority(double priority);
+
+// Raises `priority` to `exponent`. A priority of zero always results in a
+// weight of zero, even if the exponent is zero.
+double PriorityToWeight(double priority, double exponent);
+
+// Summary tree over a dense array of (key, weight) leaves, used to sample keys
+// with a probability proportional to their weight in O(log n) time.
+//
+// The tree is addressed by position rather than by key so that owners can keep
+// the position of each key in whichever index they already maintain. Positions
+// are dense: removing a leaf moves the last leaf into its place.
+//
+// The class is NOT thread safe.
+class SumTree {
+ public:
+  using Key = ItemSelector::Key;
+
+  SumTree();
+
+  // Preallocates `initial_capacity` (rounded up to a power of two) nodes rather
+  // than the default ~130000. The tree grows by segments of the same size.
+  // Useful when many small trees are kept alive at the same time.
+  explicit SumTree(size_t initial_capacity);
+
+  // Number of leaves.
+  size_t size() const { return size_; }
+
+  // Key stored at `index`, which must be smaller than `size()`.
+  Key key(size_t index) const { return node(index).key; }
+
+  // Sum of all weights. O(1) time.
+  double total() const { return NodeSum(0); }
+
+  // Appends a leaf and returns its position. O(log n) time.
+  size_t Append(Key key, double weight);
+
+  // Appends all `leaves`, growing the tree at most once, and then computes the
+  // sums. When the batch is at least as large as the existing tree, all sums
+  // are rebuilt bottom-up in O(n) time, otherwise only the ancestors of the new
+  // leaves are recomputed.
+  void AppendBatch(absl::Span<const std::pair<Key, double>> leaves);
+
+  // Removes the leaf at `index` by moving the last leaf into its place. Unless
+  // `index` was the last position, `key(index)` is the moved key afterwards.
+  // O(log n) time.
+  void Remove(size_t index);
+
+  // Sets the weight of the leaf at `index`. O(log n) time.
+  void Set(size_t index, double weight);
+
+  // Sets the weights of all (index, weight) pairs first and then recomputes
+  // the sum of every affected inner node exactly once, level by level.
+  void SetBatch(absl::Span<const std::pair<size_t, double>> weights);
+
+  // Samples a key with probability proportional to its weight, or uniformly
+  // if all weights are zero. The key is drawn from the stream of the next
+  // sample index reserved from `bit_gen` (see `PhiloxBitGen::ForSample`). Must
+  // not be called if empty. O(log n) time.
+  ItemSelector::KeyWithProbability Sample(PhiloxBitGen* bit_gen) const;
+
+  // How the keys of a batch are selected by `SampleBatch`.
+  using BatchSampling = KeyDistributionOptions::Prioritized::BatchSampling;
+
+  // Samples `num_samples` keys according to `batch_sampling`. For independent
+  // and stratified sampling the tree is descended for all targets in ascending
+  // order so that consecutive descents share the cache lines of their common
+  // ancestors, and the batch is returned in random order. When sampling
+  // without replacement the weights of the sampled keys are temporarily set to
+  // zero, which makes the descents sequential. In all cases the probability of
+  // a sample is its weight relative to the total weight before the batch was
+  // sampled. Must not be called if empty. O(k log n) time.
+  //
+  // The target of the i-th key is drawn from the stream of the i-th sample
+  // index reserved from `bit_gen` so the targets don't depend on each other
+  // and a batch sampled independently yields the same keys as `num_samples`
+  // calls to `Sample`, up to the order of the batch.
+  std::vector<ItemSelector::KeyWithProbability> SampleBatch(
+      int num_samples, BatchSampling batch_sampling, PhiloxBitGen* bit_gen);
+
+  // Multiplies every weight by `factor`. Sums are scaled along with the
+  // weights so the tree is not rebuilt. O(n) time.
+  void Scale(double factor);
+
+  // Sets the weight of every leaf to `weight(key)` and then rebuilds all sums
+  // bottom-up. O(n) time.
+  void Reweight(absl::FunctionRef<double(Key)> weight);
+
+  // Removes all leaves. O(n) time.
+  void Clear();
+
+  // Allocates the segments for `size` leaves up front and advises them to be
+  // backed by huge pages, which reduces the TLB misses of the descents.
+  void Reserve(size_t size);
+
+  // Sum of the weights of this node and all its descendants. If the index is
+  // out of bounds, then 0 is returned.
+  double NodeSum(size_t index) const;
+
+ private:
+  struct Node {
+    Key key;
+    // Sum of the weight of this node and all its descendants. This includes
+    // the entire sub tree with inner and leaf nodes. `NodeValue()` can be used
+    // to get the weight of a node without its children.
+    double sum = 0;
+    // The weight of this node. This can be computed from `sum`, however, this
+    // calculation becomes less accurate over time as rounding errors
+    // accumulate.
+    double value = 0;
+  };
+
+  // Gets the individual weight of a node without the summed up weight of all
+  // its descendants.
+  double NodeValue(size_t index) const { return node(index).value; }
+
+  // Node at `index`, which must be smaller than the capacity.
+  Node& node(size_t index) {
+    return segments_[index >> segment_shift_][index & segment_mask_];
+  }
+  const Node& node(size_t index) const {
+    return segments_[index >> segment_shift_][index & segment_mask_];
+  }
+
+  // Allocates segments until there is room for `size` nodes.
+  void Grow(size_t size);
+
+  // Sets the individual weight of a node. This does not include the weight of
+  // the descendants. The sums of the node and its ancestors are recomputed
+  // from their children so rounding errors don't accumulate. O(log n) time.
+  void SetNode(size_t index, double value);
+
+  // Recomputes the sums of the nodes in `indices` and all their ancestors from
+  // the values of the nodes. Each node is recomputed at most once.
+  void RecomputeSums(std::vector<size_t> indices);
+
+  // Finds the index of the node containing `target_weight`, which must be in
+  // [0, total()). `target_weight` is updated to be relative to the start of
+  // the returned node.
+  size_t FindIndex(double* target_weight) const;
+
+  // Implementations of `SampleBatch` for each kind of `BatchSampling`.
+  std::vector<ItemSelector::KeyWithProbability> SampleIndependent(
+      int num_samples, PhiloxBitGen* bit_gen) const;
+  std::vector<ItemSelector::KeyWithProbability> SampleStratified(
+      int num_samples, PhiloxBitGen* bit_gen) const;
+  std::vector<ItemSelector::KeyWithProbability> SampleWithoutReplacement(
+      int num_samples, PhiloxBitGen* bit_gen);
+
+  // Samples `num_samples` distinct positions uniformly, followed by positions
+  // sampled with replacement if `num_samples` exceeds `size()`.
+  std::vector<ItemSelector::KeyWithProbability> SampleUniformWithoutReplacement(
+      int num_samples, PhiloxBitGen* bit_gen) const;
+
+  // Descends the tree for the (sorted) `targets` and stores the samples in
+  // random order.
+  std::vector<ItemSelector::KeyWithProbability> FindSorted(
+      const std::vector<double>& targets, PhiloxBitGen* bit_gen) const;
+
+  // Number of nodes per segment is `1 << segment_shift_`. Starts at ~130000
+  // (unless specified).
+  int segment_shift_;
+  size_t segment_mask_;
+
+  // Number of leaves, stored at positions [0, size_) of the segments.
+  size_t size_ = 0;
+
+  // A tree stored as a flat array were each node is the sum of its children
+  // plus its own weight. The array is split into segments of equal size so
+  // that growing the tree only allocates new segments rather than copying all
+  // the nodes while the owner (e.g. the table) holds its lock.
+  std::vector<std::unique_ptr<Node[]>> segments_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SELECTORS_SUM_TREE_H_
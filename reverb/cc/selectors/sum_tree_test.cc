@@ -0,0 +1,249 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/selectors/sum_tree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/random.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/support/philox_bit_gen.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(SumTreeTest, RemoveMovesLastLeaf) {
+  SumTree tree;
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(tree.Append(i, i + 1), i);
+  }
+  EXPECT_DOUBLE_EQ(tree.total(), 10);
+
+  tree.Remove(1);
+  EXPECT_EQ(tree.size(), 3);
+  EXPECT_EQ(tree.key(1), 3);
+  EXPECT_DOUBLE_EQ(tree.total(), 8);
+
+  tree.Remove(2);
+  EXPECT_EQ(tree.size(), 2);
+  EXPECT_EQ(tree.key(0), 0);
+  EXPECT_EQ(tree.key(1), 3);
+  EXPECT_DOUBLE_EQ(tree.total(), 5);
+}
+
+TEST(SumTreeTest, BatchesMatchSingleOperations) {
+  SumTree single;
+  SumTree batched;
+  std::vector<std::pair<SumTree::Key, double>> leaves;
+  std::vector<std::pair<size_t, double>> weights;
+  for (int i = 0; i < 100; i++) {
+    single.Append(i, i);
+    leaves.emplace_back(i, i);
+    if (i % 3 == 0) weights.emplace_back(i, 2 * i);
+  }
+  batched.AppendBatch(leaves);
+  for (const auto& weight : weights) single.Set(weight.first, weight.second);
+  batched.SetBatch(weights);
+
+  for (size_t i = 0; i < single.size(); i++) {
+    EXPECT_EQ(single.key(i), batched.key(i));
+    EXPECT_DOUBLE_EQ(single.NodeSum(i), batched.NodeSum(i));
+  }
+}
+
+TEST(SumTreeTest, SampleReturnsProbability) {
+  PhiloxBitGen bit_gen;
+  SumTree tree;
+  tree.Append(1, 1);
+  tree.Append(2, 0);
+  tree.Append(3, 3);
+  for (int i = 0; i < 100; i++) {
+    const auto sample = tree.Sample(&bit_gen);
+    ASSERT_NE(sample.key, 2);
+    EXPECT_DOUBLE_EQ(sample.probability, sample.key == 1 ? 0.25 : 0.75);
+  }
+  for (auto batch_sampling :
+       {KeyDistributionOptions::Prioritized::BATCH_SAMPLING_INDEPENDENT,
+        KeyDistributionOptions::Prioritized::BATCH_SAMPLING_STRATIFIED,
+        KeyDistributionOptions::Prioritized::
+            BATCH_SAMPLING_WITHOUT_REPLACEMENT}) {
+    for (const auto& sample :
+         tree.SampleBatch(100, batch_sampling, &bit_gen)) {
+      ASSERT_NE(sample.key, 2);
+      EXPECT_DOUBLE_EQ(sample.probability, sample.key == 1 ? 0.25 : 0.75);
+    }
+  }
+}
+
+TEST(SumTreeTest, StratifiedSamplesOneKeyPerStratum) {
+  PhiloxBitGen bit_gen;
+  SumTree tree;
+  for (int i = 0; i < 10; i++) tree.Append(i, 1);
+
+  // With one stratum per key every key is sampled exactly once.
+  const auto samples = tree.SampleBatch(
+      10, KeyDistributionOptions::Prioritized::BATCH_SAMPLING_STRATIFIED,
+      &bit_gen);
+  std::vector<SumTree::Key> keys;
+  for (const auto& sample : samples) keys.push_back(sample.key);
+  EXPECT_THAT(keys,
+              testing::UnorderedElementsAre(0, 1, 2, 3, 4, 5, 6, 7, 8, 9));
+}
+
+TEST(SumTreeTest, WithoutReplacementSamplesDistinctKeys) {
+  PhiloxBitGen bit_gen;
+  SumTree tree;
+  for (int i = 0; i < 20; i++) tree.Append(i, i % 4 == 0 ? 0 : i);
+  std::vector<double> node_sums;
+  for (size_t i = 0; i < tree.size(); i++) node_sums.push_back(tree.NodeSum(i));
+
+  for (int i = 0; i < 100; i++) {
+    const auto samples = tree.SampleBatch(
+        15,
+        KeyDistributionOptions::Prioritized::BATCH_SAMPLING_WITHOUT_REPLACEMENT,
+        &bit_gen);
+    std::vector<SumTree::Key> keys;
+    for (const auto& sample : samples) {
+      EXPECT_NE(sample.key % 4, 0);
+      keys.push_back(sample.key);
+    }
+    std::sort(keys.begin(), keys.end());
+    EXPECT_TRUE(std::adjacent_find(keys.begin(), keys.end()) == keys.end());
+  }
+
+  // Every weight is restored once the batch has been sampled.
+  for (size_t i = 0; i < tree.size(); i++) {
+    EXPECT_DOUBLE_EQ(tree.NodeSum(i), node_sums[i]);
+  }
+}
+
+TEST(SumTreeTest, WithoutReplacementRepeatsKeysOnlyWhenExhausted) {
+  PhiloxBitGen bit_gen;
+  SumTree tree;
+  tree.Append(1, 1);
+  tree.Append(2, 0);
+  tree.Append(3, 3);
+
+  const auto samples = tree.SampleBatch(
+      4,
+      KeyDistributionOptions::Prioritized::BATCH_SAMPLING_WITHOUT_REPLACEMENT,
+      &bit_gen);
+  ASSERT_EQ(samples.size(), 4);
+  EXPECT_NE(samples[0].key, samples[1].key);
+  EXPECT_NE(samples[2].key, samples[3].key);
+  EXPECT_DOUBLE_EQ(tree.total(), 4);
+}
+
+TEST(SumTreeTest, ScaleAndReweightMatchRebuiltTree) {
+  SumTree tree;
+  SumTree expected;
+  for (int i = 0; i < 100; i++) {
+    tree.Append(i, i);
+    expected.Append(i, 3 * i);
+  }
+  tree.Scale(3);
+  for (size_t i = 0; i < tree.size(); i++) {
+    EXPECT_DOUBLE_EQ(tree.NodeSum(i), expected.NodeSum(i));
+  }
+
+  tree.Reweight([](SumTree::Key key) { return key % 2 ? 1. : 0.; });
+  EXPECT_DOUBLE_EQ(tree.total(), 50);
+  PhiloxBitGen bit_gen;
+  for (int i = 0; i < 100; i++) {
+    const auto sample = tree.Sample(&bit_gen);
+    EXPECT_EQ(sample.key % 2, 1);
+    EXPECT_DOUBLE_EQ(sample.probability, 0.02);
+  }
+}
+
+TEST(SumTreeTest, GrowsBeyondInitialCapacity) {
+  SumTree tree(/*initial_capacity=*/3);
+  SumTree batched(/*initial_capacity=*/3);
+  std::vector<std::pair<SumTree::Key, double>> leaves;
+  for (int i = 0; i < 100; i++) {
+    tree.Append(i, i);
+    leaves.emplace_back(i, i);
+  }
+  batched.AppendBatch(leaves);
+
+  ASSERT_EQ(tree.size(), 100);
+  ASSERT_EQ(batched.size(), 100);
+  EXPECT_DOUBLE_EQ(tree.total(), 99 * 100 / 2);
+  for (size_t i = 0; i < tree.size(); i++) {
+    EXPECT_EQ(tree.key(i), i);
+    EXPECT_EQ(batched.key(i), i);
+    EXPECT_DOUBLE_EQ(tree.NodeSum(i), batched.NodeSum(i));
+  }
+}
+
+TEST(SumTreeTest, ReserveKeepsExistingLeaves) {
+  SumTree tree(/*initial_capacity=*/4);
+  tree.Append(1, 1);
+  tree.Append(2, 3);
+  tree.Reserve(100);
+  for (int i = 3; i <= 100; i++) tree.Append(i, 1);
+
+  ASSERT_EQ(tree.size(), 100);
+  EXPECT_EQ(tree.key(0), 1);
+  EXPECT_EQ(tree.key(1), 2);
+  EXPECT_DOUBLE_EQ(tree.total(), 1 + 3 + 98);
+}
+
+TEST(SumTreeTest, UpdatesDoNotAccumulateRoundingErrors) {
+  SumTree tree;
+  std::vector<double> weights(1000);
+  absl::BitGen bit_gen;
+  for (size_t i = 0; i < weights.size(); i++) {
+    weights[i] = absl::Uniform<double>(bit_gen, 0, 1e6);
+    tree.Append(i, weights[i]);
+  }
+
+  // Weights of very different magnitudes would leave large errors in the sums
+  // if they were adjusted by the differences of the weights.
+  for (int i = 0; i < 100000; i++) {
+    const size_t index = absl::Uniform<size_t>(bit_gen, 0, weights.size());
+    weights[index] = absl::Uniform<double>(bit_gen, 0, 1) < 0.5
+                         ? absl::Uniform<double>(bit_gen, 0, 1e-6)
+                         : absl::Uniform<double>(bit_gen, 0, 1e6);
+    tree.Set(index, weights[index]);
+  }
+
+  for (size_t i = 0; i < weights.size(); i++) {
+    EXPECT_EQ(tree.NodeSum(i),
+              weights[i] + tree.NodeSum(2 * i + 1) + tree.NodeSum(2 * i + 2));
+  }
+}
+
+TEST(SumTreeTest, PriorityToWeight) {
+  EXPECT_EQ(PriorityToWeight(0, 0), 0);
+  EXPECT_EQ(PriorityToWeight(2, 0), 1);
+  EXPECT_DOUBLE_EQ(PriorityToWeight(2, 0.5), std::sqrt(2));
+  REVERB_EXPECT_OK(CheckValidPriority(0));
+  EXPECT_EQ(CheckValidPriority(-1).code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(CheckValidPriority(NAN).code(), absl::StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
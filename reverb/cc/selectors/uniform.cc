@@ -14,15 +14,22 @@
 
 #include "reverb/cc/selectors/uniform.h"
 
+#include <utility>
+
+#include "absl/random/random.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
+#include "reverb/cc/platform/huge_pages.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/schema.pb.h"
 
 namespace deepmind {
 namespace reverb {
 
+UniformSelector::UniformSelector(internal::PhiloxBitGen bit_gen)
+    : bit_gen_(std::move(bit_gen)) {}
+
 absl::Status UniformSelector::Delete(Key key) {
   const auto it = key_to_index_.find(key);
   if (it == key_to_index_.end())
@@ -61,7 +68,9 @@ ItemSelector::KeyWithProbability UniformSelector::Sample() {
 
   // This code is not thread-safe, because bit_gen_ is not protected by a mutex
   // and is not itself thread-safe.
-  const size_t index = absl::Uniform<size_t>(bit_gen_, 0, keys_.size());
+  internal::PhiloxBitGen sample_gen =
+      bit_gen_.ForSample(bit_gen_.ReserveSamples(1));
+  const size_t index = absl::Uniform<size_t>(sample_gen, 0, keys_.size());
   return {keys_[index], 1.0 / static_cast<double>(keys_.size())};
 }
 
@@ -70,10 +79,21 @@ void UniformSelector::Clear() {
   key_to_index_.clear();
 }
 
+void UniformSelector::Reserve(size_t num_keys) {
+  keys_.reserve(num_keys);
+  internal::AdviseHugePages(keys_.data(), keys_.capacity() * sizeof(Key));
+  key_to_index_.reserve(num_keys);
+}
+
+absl::Status UniformSelector::ScalePriorities(double factor) {
+  return absl::OkStatus();
+}
+
 KeyDistributionOptions UniformSelector::options() const {
   KeyDistributionOptions options;
   options.set_uniform(true);
   options.set_is_deterministic(false);
+  if (bit_gen_.deterministic()) options.set_seed(bit_gen_.seed());
   return options;
 }
 
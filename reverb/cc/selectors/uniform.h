@@ -17,11 +17,11 @@
 
 #include <vector>
 
-#include "absl/random/random.h"
 #include "absl/status/status.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/support/philox_bit_gen.h"
 
 namespace deepmind {
 namespace reverb {
@@ -31,6 +31,9 @@ namespace reverb {
 // public methods.
 class UniformSelector : public ItemSelector {
  public:
+  explicit UniformSelector(
+      internal::PhiloxBitGen bit_gen = internal::PhiloxBitGen());
+
   absl::Status Delete(Key key) override;
 
   absl::Status Insert(Key key, double priority) override;
@@ -41,6 +44,11 @@ class UniformSelector : public ItemSelector {
 
   void Clear() override;
 
+  void Reserve(size_t num_keys) override;
+
+  // This is a no-op as priorities are ignored.
+  absl::Status ScalePriorities(double factor) override;
+
   KeyDistributionOptions options() const override;
 
   std::string DebugString() const override;
@@ -52,8 +60,9 @@ class UniformSelector : public ItemSelector {
   // Maps a key to the index where this key can be found in `keys_.
   internal::flat_hash_map<Key, size_t> key_to_index_;
 
-  // Used for sampling, not thread-safe.
-  absl::BitGen bit_gen_;
+  // Used for sampling, not thread-safe. Every sampled key draws from the
+  // stream of its own sample index (see `internal::PhiloxBitGen`).
+  internal::PhiloxBitGen bit_gen_;
 };
 
 }  // namespace reverb
@@ -0,0 +1,259 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/sharded_client.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/signature.h"
+#include "tensorflow/core/platform/hash.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+// Returns the info of `table` or nullptr if the table does not exist.
+const TableInfo* FindTableInfo(const struct Client::ServerInfo& info,
+                               absl::string_view table) {
+  for (const auto& table_info : info.table_info) {
+    if (table_info.name() == table) return &table_info;
+  }
+  return nullptr;
+}
+
+std::vector<std::unique_ptr<Client>> MakeClients(
+    const std::vector<
+        std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>& stubs) {
+  std::vector<std::unique_ptr<Client>> clients;
+  clients.reserve(stubs.size());
+  for (const auto& stub : stubs) {
+    clients.push_back(absl::make_unique<Client>(stub));
+  }
+  return clients;
+}
+
+}  // namespace
+
+ShardedClient::ShardedClient(
+    std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+        stubs)
+    : stubs_(std::move(stubs)), shards_(MakeClients(stubs_)) {
+  REVERB_CHECK(!stubs_.empty());
+}
+
+ShardedClient::ShardedClient(const std::vector<std::string>& server_addresses)
+    : ShardedClient(MakeStubs(server_addresses)) {}
+
+std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+ShardedClient::MakeStubs(const std::vector<std::string>& server_addresses) {
+  std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      stubs;
+  stubs.reserve(server_addresses.size());
+  for (const auto& address : server_addresses) {
+    stubs.push_back(Client(address).stub_);
+  }
+  return stubs;
+}
+
+Client* ShardedClient::shard(int index) const {
+  REVERB_CHECK_GE(index, 0);
+  REVERB_CHECK_LT(index, shards_.size());
+  return shards_[index].get();
+}
+
+int ShardedClient::ShardForKey(absl::string_view key) const {
+  int best_shard = 0;
+  uint64_t best_score = 0;
+  for (int i = 0; i < shards_.size(); i++) {
+    uint64_t score = tensorflow::Hash64(key.data(), key.size(), i);
+    if (i == 0 || score > best_score) {
+      best_shard = i;
+      best_score = score;
+    }
+  }
+  return best_shard;
+}
+
+absl::Status ShardedClient::ServerInfo(
+    absl::Duration timeout, std::vector<struct Client::ServerInfo>* infos) {
+  infos->clear();
+  infos->resize(shards_.size());
+  for (int i = 0; i < shards_.size(); i++) {
+    auto status = shards_[i]->ServerInfo(timeout, &infos->at(i));
+    if (!status.ok()) {
+      return absl::Status(status.code(),
+                          absl::StrCat("Shard ", i, ": ", status.message()));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ShardedClient::LeastLoadedShard(const std::string& table,
+                                             absl::Duration timeout,
+                                             int* index) {
+  std::vector<struct Client::ServerInfo> infos;
+  REVERB_RETURN_IF_ERROR(ServerInfo(timeout, &infos));
+
+  *index = -1;
+  int64_t min_size = 0;
+  for (int i = 0; i < infos.size(); i++) {
+    const TableInfo* table_info = FindTableInfo(infos[i], table);
+    if (table_info == nullptr) continue;
+    if (*index == -1 || table_info->current_size() < min_size) {
+      *index = i;
+      min_size = table_info->current_size();
+    }
+  }
+
+  if (*index == -1) {
+    return absl::NotFoundError(
+        absl::StrCat("Table '", table, "' not found on any shard."));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ShardedClient::NewTrajectoryWriter(
+    absl::string_view key, const TrajectoryWriter::Options& options,
+    absl::Duration get_signature_timeout,
+    std::unique_ptr<TrajectoryWriter>* writer) {
+  return shards_[ShardForKey(key)]->NewTrajectoryWriter(
+      options, get_signature_timeout, writer);
+}
+
+absl::Status ShardedClient::NewTrajectoryWriterOnLeastLoadedShard(
+    const std::string& table, const TrajectoryWriter::Options& options,
+    absl::Duration timeout, std::unique_ptr<TrajectoryWriter>* writer) {
+  int index;
+  REVERB_RETURN_IF_ERROR(LeastLoadedShard(table, timeout, &index));
+  return shards_[index]->NewTrajectoryWriter(options, timeout, writer);
+}
+
+absl::Status ShardedClient::NewSampler(const std::string& table,
+                                       const Sampler::Options& options,
+                                       absl::Duration timeout,
+                                       std::unique_ptr<Sampler>* sampler) {
+  REVERB_RETURN_IF_ERROR(options.Validate());
+
+  std::vector<struct Client::ServerInfo> infos;
+  REVERB_RETURN_IF_ERROR(ServerInfo(timeout, &infos));
+
+  std::vector<double> weights = internal::ShardSamplingWeights(infos, table);
+  const int first_shard =
+      std::find_if(weights.begin(), weights.end(),
+                   [](double weight) { return weight > 0; }) -
+      weights.begin();
+  if (first_shard == weights.size()) {
+    return absl::NotFoundError(
+        absl::StrCat("Table '", table, "' not found on any shard."));
+  }
+
+  int num_workers = options.num_workers == Sampler::kAutoSelectValue
+                        ? shards_.size()
+                        : options.num_workers;
+  std::vector<int> workers_per_shard =
+      internal::DistributeWorkers(weights, num_workers);
+
+  std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      worker_stubs;
+  for (int i = 0; i < workers_per_shard.size(); i++) {
+    worker_stubs.insert(worker_stubs.end(), workers_per_shard[i], stubs_[i]);
+  }
+
+  internal::DtypesAndShapes dtypes_and_shapes;
+  REVERB_RETURN_IF_ERROR(shards_[first_shard]->GetDtypesAndShapesForSampler(
+      table, timeout, &dtypes_and_shapes));
+
+  *sampler = absl::make_unique<Sampler>(worker_stubs, table, options,
+                                        std::move(dtypes_and_shapes));
+  return absl::OkStatus();
+}
+
+namespace internal {
+
+std::vector<int> DistributeWorkers(const std::vector<double>& weights,
+                                   int num_workers) {
+  std::vector<int> workers(weights.size(), 0);
+  const double total_weight =
+      std::accumulate(weights.begin(), weights.end(), 0.0);
+
+  // Without any weights the workers are distributed evenly.
+  if (total_weight == 0) {
+    for (int i = 0; i < num_workers; i++) {
+      workers[i % workers.size()]++;
+    }
+    return workers;
+  }
+
+  std::vector<double> remainders(weights.size());
+  int assigned = 0;
+  for (int i = 0; i < weights.size(); i++) {
+    double quota = num_workers * (weights[i] / total_weight);
+    workers[i] = static_cast<int>(quota);
+    remainders[i] = quota - workers[i];
+    assigned += workers[i];
+  }
+
+  // Hand out the remaining workers to the shards with the largest remainders.
+  std::vector<int> order(weights.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return remainders[a] > remainders[b];
+  });
+  for (int i = 0; assigned < num_workers && i < order.size(); i++) {
+    if (weights[order[i]] > 0) {
+      workers[order[i]]++;
+      assigned++;
+    }
+  }
+
+  for (int i = 0; i < weights.size(); i++) {
+    if (weights[i] > 0 && workers[i] == 0) workers[i] = 1;
+  }
+  return workers;
+}
+
+std::vector<double> ShardSamplingWeights(
+    const std::vector<struct Client::ServerInfo>& infos,
+    absl::string_view table) {
+  std::vector<double> weights(infos.size(), 0);
+  for (int i = 0; i < infos.size(); i++) {
+    const TableInfo* table_info = FindTableInfo(infos[i], table);
+    if (table_info == nullptr) continue;
+    weights[i] = table_info->sampling_weight() > 0
+                     ? table_info->sampling_weight()
+                     : static_cast<double>(table_info->current_size());
+    // The table could be filled up after the sampler has been created.
+    if (weights[i] <= 0) weights[i] = std::numeric_limits<double>::min();
+  }
+  return weights;
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,138 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SHARDED_CLIENT_H_
+#define REVERB_CC_SHARDED_CLIENT_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "reverb/cc/client.h"
+#include "reverb/cc/reverb_service.grpc.pb.h"
+#include "reverb/cc/sampler.h"
+#include "reverb/cc/trajectory_writer.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Client of a set of Reverb servers ("shards") which all host the same tables.
+//
+// Every item references chunks stored on the server it is inserted into so a
+// `TrajectoryWriter` is always bound to a single shard. Writers are spread
+// across the shards either by consistent hashing of a caller provided key
+// (`NewTrajectoryWriter`) or by picking the shard where the table currently is
+// the smallest (`NewTrajectoryWriterOnLeastLoadedShard`).
+//
+// Samplers created through `NewSampler` have workers connected to all shards
+// which contain the table, with the number of workers per shard proportional
+// to the sampling weight (priority mass) of the table on that shard as
+// reported by `ServerInfo`. Each shard applies its own rate limiter, which
+// should be configured with `RateLimiter::ShareForShards`.
+class ShardedClient {
+ public:
+  explicit ShardedClient(
+      std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+          stubs);
+  explicit ShardedClient(const std::vector<std::string>& server_addresses);
+
+  // Number of shards which the client is connected to.
+  int num_shards() const { return shards_.size(); }
+
+  // Client connected to the shard with index `index`.
+  Client* shard(int index) const;
+
+  // Returns the index of the shard which `key` is mapped to. Keys are mapped
+  // using rendezvous hashing so adding a shard only moves the keys which are
+  // mapped to the new shard.
+  int ShardForKey(absl::string_view key) const;
+
+  // Requests the `ServerInfo` of every shard. `infos[i]` holds the info of
+  // shard `i`.
+  absl::Status ServerInfo(absl::Duration timeout,
+                          std::vector<struct Client::ServerInfo>* infos);
+
+  // Finds the shard where `table` currently holds the fewest items.
+  absl::Status LeastLoadedShard(const std::string& table,
+                                absl::Duration timeout, int* index);
+
+  // Creates a new `TrajectoryWriter` on the shard which `key` is mapped to
+  // (see `ShardForKey`).
+  absl::Status NewTrajectoryWriter(absl::string_view key,
+                                   const TrajectoryWriter::Options& options,
+                                   absl::Duration get_signature_timeout,
+                                   std::unique_ptr<TrajectoryWriter>* writer);
+
+  // Creates a new `TrajectoryWriter` on the shard returned by
+  // `LeastLoadedShard`.
+  absl::Status NewTrajectoryWriterOnLeastLoadedShard(
+      const std::string& table, const TrajectoryWriter::Options& options,
+      absl::Duration timeout, std::unique_ptr<TrajectoryWriter>* writer);
+
+  // Creates a new `Sampler` which samples `table` from all shards.
+  //
+  // `options.num_workers` is the total number of workers (`kAutoSelectValue`
+  // creates one worker per shard) and is distributed across the shards in
+  // proportion to the sampling weight of the table on each shard (see
+  // `internal::ShardSamplingWeights` and `internal::DistributeWorkers`).
+  // Shards where the table is missing are skipped. Returns `NotFoundError` if the table does not exist on any shard.
+  //
+  // The dtypes and shapes are validated against the signature reported by the
+  // first shard which has the table.
+  absl::Status NewSampler(const std::string& table,
+                          const Sampler::Options& options,
+                          absl::Duration timeout,
+                          std::unique_ptr<Sampler>* sampler);
+
+ private:
+  // Connects to every address using the same channel settings as `Client`.
+  static std::vector<
+      std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+  MakeStubs(const std::vector<std::string>& server_addresses);
+
+  std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      stubs_;
+  std::vector<std::unique_ptr<Client>> shards_;
+};
+
+namespace internal {
+
+// Distributes `num_workers` across shards with weights `weights` using the
+// largest remainder method. Every shard with a positive weight gets at least
+// one worker (even if this results in more than `num_workers` workers in
+// total) and shards with zero weight get none. If all weights are zero then
+// the workers are distributed evenly.
+std::vector<int> DistributeWorkers(const std::vector<double>& weights,
+                                   int num_workers);
+
+// Returns the weight with which `table` should be sampled from each shard,
+// that is the sampling weight reported in `infos[i]` (or the size of the table
+// for servers which don't report it). Shards where the table is empty get a
+// negligible but positive weight so they are still assigned a worker, and
+// shards where the table is missing get zero.
+std::vector<double> ShardSamplingWeights(
+    const std::vector<struct Client::ServerInfo>& infos,
+    absl::string_view table);
+
+}  // namespace internal
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SHARDED_CLIENT_H_
@@ -0,0 +1,193 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/sharded_client.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "grpcpp/impl/codegen/client_context.h"
+#include "grpcpp/impl/codegen/status.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/optional.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/reverb_service_mock.grpc.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::SizeIs;
+
+// Stub which reports a single table named "table" with `table_size` items. The
+// server has no tables if `table_size` is not set.
+class FakeStub : public /* grpc_gen:: */MockReverbServiceStub {
+ public:
+  explicit FakeStub(absl::optional<int64_t> table_size)
+      : table_size_(table_size) {}
+
+  grpc::Status ServerInfo(grpc::ClientContext* context,
+                          const ServerInfoRequest& request,
+                          ServerInfoResponse* response) override {
+    if (table_size_.has_value()) {
+      auto* table_info = response->add_table_info();
+      table_info->set_name("table");
+      table_info->set_current_size(*table_size_);
+    }
+    return grpc::Status::OK;
+  }
+
+ private:
+  absl::optional<int64_t> table_size_;
+};
+
+std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+MakeStubs(const std::vector<absl::optional<int64_t>>& table_sizes) {
+  std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      stubs;
+  for (const auto& size : table_sizes) {
+    stubs.push_back(std::make_shared<FakeStub>(size));
+  }
+  return stubs;
+}
+
+TEST(DistributeWorkersTest, IsProportionalToWeights) {
+  EXPECT_THAT(internal::DistributeWorkers({100, 300}, 4), ElementsAre(1, 3));
+  EXPECT_THAT(internal::DistributeWorkers({1, 1, 1}, 4), ElementsAre(2, 1, 1));
+  EXPECT_THAT(internal::DistributeWorkers({10, 20, 10}, 8),
+              ElementsAre(2, 4, 2));
+}
+
+TEST(DistributeWorkersTest, SkipsShardsWithoutWeight) {
+  EXPECT_THAT(internal::DistributeWorkers({0, 5, 5}, 4), ElementsAre(0, 2, 2));
+}
+
+TEST(DistributeWorkersTest, EveryWeightedShardGetsAWorker) {
+  EXPECT_THAT(internal::DistributeWorkers({1, 1000}, 2), ElementsAre(1, 2));
+}
+
+TEST(DistributeWorkersTest, DistributesEvenlyWithoutWeights) {
+  EXPECT_THAT(internal::DistributeWorkers({0, 0, 0}, 4), ElementsAre(2, 1, 1));
+}
+
+TEST(DistributeWorkersTest, AcceptsFractionalWeights) {
+  EXPECT_THAT(internal::DistributeWorkers({0.25, 0.75}, 4), ElementsAre(1, 3));
+}
+
+struct Client::ServerInfo MakeServerInfo(int64_t size, double sampling_weight) {
+  struct Client::ServerInfo info;
+  info.table_info.emplace_back();
+  info.table_info.back().set_name("table");
+  info.table_info.back().set_current_size(size);
+  info.table_info.back().set_sampling_weight(sampling_weight);
+  return info;
+}
+
+TEST(ShardSamplingWeightsTest, UsesPriorityMassOfEachShard) {
+  std::vector<struct Client::ServerInfo> infos = {
+      MakeServerInfo(10, 2.5), MakeServerInfo(10, 7.5),
+      struct Client::ServerInfo()};
+  EXPECT_THAT(internal::ShardSamplingWeights(infos, "table"),
+              ElementsAre(2.5, 7.5, 0));
+  EXPECT_THAT(internal::ShardSamplingWeights(infos, "missing"),
+              ElementsAre(0, 0, 0));
+}
+
+TEST(ShardSamplingWeightsTest, FallsBackToSizeAndKeepsEmptyShards) {
+  std::vector<struct Client::ServerInfo> infos = {MakeServerInfo(4, 0),
+                                                  MakeServerInfo(0, 0)};
+  auto weights = internal::ShardSamplingWeights(infos, "table");
+  ASSERT_THAT(weights, SizeIs(2));
+  EXPECT_EQ(weights[0], 4);
+  EXPECT_GT(weights[1], 0);
+  EXPECT_THAT(internal::DistributeWorkers(weights, 4), ElementsAre(4, 1));
+}
+
+TEST(ShardedClientTest, ShardForKeyIsDeterministicAndUsesAllShards) {
+  ShardedClient client(MakeStubs({0, 0, 0, 0}));
+  std::vector<int> keys_per_shard(client.num_shards(), 0);
+  for (int i = 0; i < 1000; i++) {
+    std::string key = absl::StrCat("key_", i);
+    int shard = client.ShardForKey(key);
+    ASSERT_GE(shard, 0);
+    ASSERT_LT(shard, client.num_shards());
+    EXPECT_EQ(client.ShardForKey(key), shard);
+    keys_per_shard[shard]++;
+  }
+  for (int count : keys_per_shard) {
+    EXPECT_GT(count, 0);
+  }
+}
+
+TEST(ShardedClientTest, AddingShardOnlyMovesKeysToNewShard) {
+  ShardedClient client(MakeStubs({0, 0, 0}));
+  ShardedClient larger_client(MakeStubs({0, 0, 0, 0}));
+  for (int i = 0; i < 1000; i++) {
+    std::string key = absl::StrCat("key_", i);
+    int new_shard = larger_client.ShardForKey(key);
+    if (new_shard != 3) {
+      EXPECT_EQ(new_shard, client.ShardForKey(key));
+    }
+  }
+}
+
+TEST(ShardedClientTest, LeastLoadedShardPicksSmallestTable) {
+  ShardedClient client(MakeStubs({10, absl::nullopt, 3, 7}));
+  int index;
+  REVERB_ASSERT_OK(
+      client.LeastLoadedShard("table", absl::InfiniteDuration(), &index));
+  EXPECT_EQ(index, 2);
+}
+
+TEST(ShardedClientTest, LeastLoadedShardFailsIfTableIsMissing) {
+  ShardedClient client(MakeStubs({absl::nullopt, absl::nullopt}));
+  int index;
+  EXPECT_EQ(client.LeastLoadedShard("table", absl::InfiniteDuration(), &index)
+                .code(),
+            absl::StatusCode::kNotFound);
+}
+
+TEST(ShardedClientTest, NewSamplerFailsIfTableIsMissing) {
+  ShardedClient client(MakeStubs({absl::nullopt, absl::nullopt}));
+  std::unique_ptr<Sampler> sampler;
+  EXPECT_EQ(client
+                .NewSampler("table", Sampler::Options(),
+                            absl::InfiniteDuration(), &sampler)
+                .code(),
+            absl::StatusCode::kNotFound);
+  EXPECT_EQ(sampler, nullptr);
+}
+
+TEST(ShardedClientTest, ServerInfoReturnsInfoOfEveryShard) {
+  ShardedClient client(MakeStubs({1, absl::nullopt, 2}));
+  std::vector<struct Client::ServerInfo> infos;
+  REVERB_ASSERT_OK(client.ServerInfo(absl::InfiniteDuration(), &infos));
+  ASSERT_EQ(infos.size(), 3);
+  ASSERT_EQ(infos[0].table_info.size(), 1);
+  EXPECT_EQ(infos[0].table_info[0].current_size(), 1);
+  EXPECT_TRUE(infos[1].table_info.empty());
+  ASSERT_EQ(infos[2].table_info.size(), 1);
+  EXPECT_EQ(infos[2].table_info[0].current_size(), 2);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
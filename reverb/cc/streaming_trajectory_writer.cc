@@ -36,6 +36,7 @@
 #include "reverb/cc/reverb_service.grpc.pb.h"
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/grpc_transport_options.h"
 #include "reverb/cc/support/grpc_util.h"
 #include "reverb/cc/support/key_generators.h"
 #include "reverb/cc/support/signature.h"
@@ -84,9 +85,23 @@ StreamingTrajectoryWriter::StreamingTrajectoryWriter(
   REVERB_CHECK(options_.chunker_options != nullptr);
   REVERB_CHECK_OK(options.Validate());
   SetContextAndCreateStream();
+  if (options_.max_in_flight_stream_requests > 0) {
+    write_worker_ =
+        internal::StartThread("StreamingTrajectoryWriter_WriteWorker",
+                              [this]() { RunWriteWorker(); });
+  }
 }
 
 StreamingTrajectoryWriter::~StreamingTrajectoryWriter() {
+  // Let the worker write the queued requests before the stream is closed.
+  if (write_worker_ != nullptr) {
+    {
+      absl::MutexLock lock(&mutex_);
+      closed_ = true;
+    }
+    write_worker_ = nullptr;  // Join thread.
+  }
+
   // Make sure to flush the stream on destruction.
   if (stream_) {
     stream_->WritesDone();
@@ -116,8 +131,7 @@ absl::Status StreamingTrajectoryWriter::AppendInternal(
     std::vector<absl::optional<std::weak_ptr<CellRef>>>* refs) {
   REVERB_CHECK(refs != nullptr);
   ClearVectorOnExit<decltype(refs)> clear(refs);
-  REVERB_RETURN_IF_ERROR(unrecoverable_error_);
-  REVERB_RETURN_IF_ERROR(recoverable_error_);
+  REVERB_RETURN_IF_ERROR(GetError());
 
   CellRef::EpisodeInfo episode_info{episode_id_, episode_step_};
 
@@ -171,8 +185,7 @@ absl::Status StreamingTrajectoryWriter::AppendInternal(
 absl::Status StreamingTrajectoryWriter::CreateItem(
     absl::string_view table, double priority,
     absl::Span<const TrajectoryColumn> trajectory) {
-  REVERB_RETURN_IF_ERROR(unrecoverable_error_);
-  REVERB_RETURN_IF_ERROR(recoverable_error_);
+  REVERB_RETURN_IF_ERROR(GetError());
 
   if (trajectory.empty() ||
       std::all_of(trajectory.begin(), trajectory.end(),
@@ -198,9 +211,10 @@ absl::Status StreamingTrajectoryWriter::CreateItem(
   // All chunks referenced by this item must have been streamed to the replay
   // buffer prior to inserting the item. Finalize chunks that aren't ready.
   for (std::shared_ptr<CellRef>& ref : item_and_refs.refs) {
-    if (!ref->IsReady()) {
+    if (!ref->IsFinalized()) {
       REVERB_RETURN_IF_ERROR(ref->chunker().lock()->Flush());
     }
+    ref->WaitUntilReady();
   }
   REVERB_RETURN_IF_ERROR(StreamChunks(item_and_refs.refs));
 
@@ -226,11 +240,16 @@ absl::Status StreamingTrajectoryWriter::CreateItem(
 
 absl::Status StreamingTrajectoryWriter::EndEpisode(bool clear_buffers,
                                                    absl::Duration timeout) {
-  REVERB_RETURN_IF_ERROR(unrecoverable_error_);
+  bool episode_corrupt;
+  {
+    absl::MutexLock lock(&mutex_);
+    REVERB_RETURN_IF_ERROR(unrecoverable_error_);
+    episode_corrupt = !recoverable_error_.ok();
+  }
 
   // Wait for all items belonging to this episode to be confirmed. This only
   // makes sense if the stream hasn't failed.
-  if (recoverable_error_.ok()) {
+  if (!episode_corrupt) {
     REVERB_RETURN_IF_ERROR(Flush(0, timeout));
   }
 
@@ -239,7 +258,10 @@ absl::Status StreamingTrajectoryWriter::EndEpisode(bool clear_buffers,
 
   if (clear_buffers) {
     streamed_chunk_keys_.clear();
-    recoverable_error_ = absl::OkStatus();
+    {
+      absl::MutexLock lock(&mutex_);
+      recoverable_error_ = absl::OkStatus();
+    }
     for (auto& [_, chunker] : chunkers_) {
       chunker->Reset();
     }
@@ -316,8 +338,8 @@ absl::Status StreamingTrajectoryWriter::StreamChunks(
   if (chunk_keys.empty()) return absl::OkStatus();
 
   // Send all requests.
-  for (const InsertStreamRequest& request : requests) {
-    REVERB_RETURN_IF_ERROR(WriteStream(request));
+  for (InsertStreamRequest& request : requests) {
+    REVERB_RETURN_IF_ERROR(SubmitRequest(std::move(request)));
   }
 
   streamed_chunk_keys_.insert(chunk_keys.begin(), chunk_keys.end());
@@ -337,23 +359,75 @@ absl::Status StreamingTrajectoryWriter::SendItem(PrioritizedItem item) {
     request.add_keep_chunk_keys(keep_key);
   }
 
-  return WriteStream(request);
+  return SubmitRequest(std::move(request));
 }
 
-absl::Status StreamingTrajectoryWriter::WriteStream(
-    const InsertStreamRequest& request) {
-  grpc::WriteOptions options;
-  options.set_no_compression();
+absl::Status StreamingTrajectoryWriter::SubmitRequest(
+    InsertStreamRequest request) {
+  if (write_worker_ == nullptr) {
+    // If this request contains items, mark them as "in-flight".
+    if (request.items_size() > 0) {
+      absl::MutexLock lock(&mutex_);
+      for (auto& item : request.items()) {
+        in_flight_items_.insert(item.key());
+      }
+    }
+    return WriteStream(request);
+  }
 
-  // If this request contains items, mark them as "in-flight".
-  if (request.items_size() > 0) {
-    absl::MutexLock lock(&mutex_);
-    for (auto& item : request.items()) {
-      in_flight_items_.insert(item.key());
+  absl::MutexLock lock(&mutex_);
+  auto has_room_or_error = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    int num_in_flight = write_queue_.size() + (write_in_progress_ ? 1 : 0);
+    return !unrecoverable_error_.ok() || !recoverable_error_.ok() ||
+           num_in_flight < options_.max_in_flight_stream_requests;
+  };
+  mutex_.Await(absl::Condition(&has_room_or_error));
+  REVERB_RETURN_IF_ERROR(unrecoverable_error_);
+  REVERB_RETURN_IF_ERROR(recoverable_error_);
+
+  for (auto& item : request.items()) {
+    in_flight_items_.insert(item.key());
+  }
+  write_queue_.push_back(std::move(request));
+  return absl::OkStatus();
+}
+
+void StreamingTrajectoryWriter::RunWriteWorker() {
+  while (true) {
+    InsertStreamRequest request;
+    {
+      absl::MutexLock lock(&mutex_);
+      auto has_request_or_closed = [this]()
+                                       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+        return closed_ || !write_queue_.empty();
+      };
+      mutex_.Await(absl::Condition(&has_request_or_closed));
+      if (write_queue_.empty()) return;
+
+      request = std::move(write_queue_.front());
+      write_queue_.pop_front();
+      write_in_progress_ = true;
     }
+
+    // Errors are stored by `WriteStream` and returned by the next call to
+    // `Append`, `CreateItem`, `Flush` or `EndEpisode`.
+    WriteStream(request).IgnoreError();
+
+    absl::MutexLock lock(&mutex_);
+    write_in_progress_ = false;
   }
+}
+
+absl::Status StreamingTrajectoryWriter::GetError() const {
+  absl::MutexLock lock(&mutex_);
+  REVERB_RETURN_IF_ERROR(unrecoverable_error_);
+  return recoverable_error_;
+}
 
-  if (!stream_->Write(request, options)) {
+absl::Status StreamingTrajectoryWriter::WriteStream(
+    const InsertStreamRequest& request) {
+  if (!stream_->Write(request,
+                      StreamWriteOptions(options_.compress_requests))) {
     // We won't get a confirmation these items.
     if (request.items_size() > 0) {
       absl::MutexLock lock(&mutex_);
@@ -371,6 +445,20 @@ absl::Status StreamingTrajectoryWriter::WriteStream(
 
     if (IsTransientError(streaming_status)) {
       SetContextAndCreateStream();
+    }
+
+    absl::MutexLock lock(&mutex_);
+
+    // Requests queued up behind the failed one belong to the same (corrupt)
+    // episode so there is no point in writing them.
+    for (const InsertStreamRequest& queued : write_queue_) {
+      for (auto& item : queued.items()) {
+        in_flight_items_.erase(item.key());
+      }
+    }
+    write_queue_.clear();
+
+    if (IsTransientError(streaming_status)) {
       recoverable_error_ = absl::DataLossError(absl::StrCat(
           "Stream interrupted with error: ", streaming_status.message()));
       return recoverable_error_;
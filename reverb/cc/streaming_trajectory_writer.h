@@ -17,6 +17,7 @@
 
 #include <stdint.h>
 
+#include <deque>
 #include <memory>
 #include <optional>
 #include <vector>
@@ -27,6 +28,7 @@
 #include "reverb/cc/chunker.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/thread.h"
 #include "reverb/cc/reverb_service.grpc.pb.h"
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/schema.pb.h"
@@ -62,6 +64,12 @@ namespace deepmind::reverb {
 // tensors or creating priority items will return an `absl::DataLossError`.
 // Callers should start a new episode when they observe the error.
 //
+// By default chunks and items are written to the stream by the thread calling
+// `Append` and `CreateItem`. If `Options::max_in_flight_stream_requests` is set
+// then the requests are instead queued up for a background thread and the
+// calls only block once the queue is full. Errors encountered by the background
+// thread are returned by the next call.
+//
 // This class is not thread-safe.
 //
 // TODO(b/143277674): Consolidate this implementation with TrajectoryWriter.
@@ -99,8 +107,8 @@ class StreamingTrajectoryWriter : public ColumnWriter {
       absl::Duration timeout = absl::InfiniteDuration()) override;
 
   // See `ColumnWriter::Flush` in trajectory_writer.h.
-  // Does not actually send any items since this writer operates synchronously
-  // with each `CreateItem` call. Waits until all but the past
+  // Does not actually send any items since every `CreateItem` call writes (or
+  // queues up) its item straight away. Waits until all but the past
   // `ignore_last_num_items` items are confirmed.
   absl::Status Flush(
       int ignore_last_num_items = 0,
@@ -129,6 +137,19 @@ class StreamingTrajectoryWriter : public ColumnWriter {
   // this method.
   absl::Status SendItem(PrioritizedItem item);
 
+  // Marks the items of `request` as in flight and then either writes it to the
+  // stream or, if `write_worker_` is running, blocks until there is room in
+  // `write_queue_` and appends it to the queue.
+  absl::Status SubmitRequest(InsertStreamRequest request);
+
+  // Writes the requests of `write_queue_` to the stream until the writer is
+  // destroyed. Drops the queued requests if writing fails.
+  void RunWriteWorker();
+
+  // Returns the first of `unrecoverable_error_` and `recoverable_error_` which
+  // isn't ok.
+  absl::Status GetError() const ABSL_LOCKS_EXCLUDED(mutex_);
+
   // Writes the requests provided in the argument to the stream. If writing
   // fails, the current episode is considered corrupt, which is a recoverable
   // error, which will be reset when a new episode is started.
@@ -144,7 +165,7 @@ class StreamingTrajectoryWriter : public ColumnWriter {
   TrajectoryWriter::Options options_;
 
   // Used to generates keys for episode and item IDs.
-  internal::UniformKeyGenerator key_generator_;
+  internal::ThreadLocalKeyGenerator key_generator_;
 
   // Mapping from column index to Chunker. Shared pointers are used as the
   // `CellRef`s created by the chunker will own a weak_ptr created using
@@ -158,7 +179,20 @@ class StreamingTrajectoryWriter : public ColumnWriter {
   // Set of item IDs that have been sent to the replay server but haven't been
   // confirmed yet.
   internal::flat_hash_set<uint64_t> in_flight_items_ ABSL_GUARDED_BY(mutex_);
-  absl::Mutex mutex_;
+  mutable absl::Mutex mutex_;
+
+  // Requests waiting to be written by `write_worker_`. Holds at most
+  // `options_.max_in_flight_stream_requests` requests, including the one being
+  // written (`write_in_progress_`).
+  std::deque<InsertStreamRequest> write_queue_ ABSL_GUARDED_BY(mutex_);
+  bool write_in_progress_ ABSL_GUARDED_BY(mutex_) = false;
+
+  // Set on destruction to stop `write_worker_` once the queue is empty.
+  bool closed_ ABSL_GUARDED_BY(mutex_) = false;
+
+  // Thread that writes the queued requests when
+  // `options_.max_in_flight_stream_requests` is set. Otherwise nullptr.
+  std::unique_ptr<internal::Thread> write_worker_;
 
   // Thread that receives item confirmations.
   std::unique_ptr<internal::Thread> item_confirmation_worker_;
@@ -172,13 +206,13 @@ class StreamingTrajectoryWriter : public ColumnWriter {
   // Set if a non transient error encountered by the stream worker or if `Close`
   // has been called. In the latter case `unrecoverable_status_` will be set to
   // `CancelledError`.
-  absl::Status unrecoverable_error_;
+  absl::Status unrecoverable_error_ ABSL_GUARDED_BY(mutex_);
 
   // Set if a a transient error occurs. Since this writer doesn't have a retry
   // mechanism, all data associated with the episode in which the transient
   // error occurred is considered corrupt. When a new episode starts, the error
   // is reset.
-  absl::Status recoverable_error_;
+  absl::Status recoverable_error_ ABSL_GUARDED_BY(mutex_);
 
   // Context used to create (and cancel) the gRPC stream used in
   // `stream_worker_`. The worker creates the context before invoking
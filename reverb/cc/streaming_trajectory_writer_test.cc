@@ -213,6 +213,21 @@ class FakeStream : public MockStream {
   internal::Queue<uint64_t> pending_confirmation_;
 };
 
+// Blocks all writes until `Unblock` is called.
+class BlockingFakeStream : public FakeStream {
+ public:
+  bool Write(const InsertStreamRequest& msg,
+             grpc::WriteOptions options) override {
+    unblock_.WaitForNotification();
+    return FakeStream::Write(msg, options);
+  }
+
+  void Unblock() { unblock_.Notify(); }
+
+ private:
+  absl::Notification unblock_;
+};
+
 inline TrajectoryWriter::Options MakeOptions(int max_chunk_length,
                                              int num_keep_alive_refs) {
   return TrajectoryWriter::Options{
@@ -502,6 +517,7 @@ TEST(StreamingTrajectoryWriter, ChunkersNotifiedWhenAllChunksDone) {
     int GetMaxChunkLength() const override { return 1; }
     int GetNumKeepAliveRefs() const override { return 1; }
     bool GetDeltaEncode() const override { return false; }
+    CompressionOptions GetCompression() const override { return {}; }
 
     absl::Status OnItemFinalized(
         const PrioritizedItem& item,
@@ -582,6 +598,71 @@ TEST(StreamingTrajectoryWriter, CorruptEpisodeOnTransientError) {
   EXPECT_THAT(success_stream->requests(), ElementsAre(IsChunk(), IsItem()));
 }
 
+TEST(StreamingTrajectoryWriter, AsyncAppendDoesNotWaitForWrites) {
+  auto* stream = new BlockingFakeStream();
+  auto stub = std::make_shared</* grpc_gen:: */MockReverbServiceStub>();
+  EXPECT_CALL(*stub, InsertStreamRaw(_)).WillOnce(Return(stream));
+
+  auto options =
+      MakeOptions(/*max_chunk_length=*/1, /*num_keep_alive_refs=*/1);
+  options.max_in_flight_stream_requests = 3;
+  StreamingTrajectoryWriter writer(stub, options);
+
+  // Every step completes a chunk but none of them can be written yet.
+  StepRef refs;
+  for (int i = 0; i < 3; ++i) {
+    refs.clear();
+    REVERB_ASSERT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &refs));
+  }
+  EXPECT_THAT(stream->requests(), ::testing::IsEmpty());
+
+  stream->Unblock();
+  REVERB_ASSERT_OK(
+      writer.CreateItem("table", 1.0, MakeTrajectory({{refs[0]}})));
+  REVERB_EXPECT_OK(writer.Flush());
+
+  EXPECT_THAT(stream->requests(),
+              ElementsAre(IsChunk(), IsChunk(), IsChunk(), IsItem()));
+}
+
+TEST(StreamingTrajectoryWriter, AsyncWriteErrorsAreReturnedByLaterCalls) {
+  auto* fail_stream = new MockStream();
+  EXPECT_CALL(*fail_stream, Write(IsChunk(), _)).WillOnce(Return(false));
+  EXPECT_CALL(*fail_stream, Finish())
+      .WillOnce(Return(grpc::Status(grpc::StatusCode::UNAVAILABLE, "")));
+
+  auto* success_stream = new FakeStream();
+
+  auto stub = std::make_shared</* grpc_gen:: */MockReverbServiceStub>();
+  EXPECT_CALL(*stub, InsertStreamRaw(_))
+      .WillOnce(Return(fail_stream))
+      .WillOnce(Return(success_stream));
+
+  auto options =
+      MakeOptions(/*max_chunk_length=*/1, /*num_keep_alive_refs=*/1);
+  options.max_in_flight_stream_requests = 1;
+  StreamingTrajectoryWriter writer(stub, options);
+
+  // The first chunk is queued up and the failure is only observed by the
+  // second call, which has to wait for the first write to complete.
+  StepRef first;
+  REVERB_EXPECT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &first));
+  StepRef second;
+  EXPECT_THAT(writer.Append(Step({MakeTensor(kIntSpec)}), &second),
+              StatusIs(absl::StatusCode::kDataLoss, ""));
+
+  // Start a new episode.
+  REVERB_EXPECT_OK(writer.EndEpisode(true));
+
+  StepRef third;
+  REVERB_EXPECT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &third));
+  REVERB_ASSERT_OK(
+      writer.CreateItem("table", 1.0, MakeTrajectory({{third[0]}})));
+  REVERB_EXPECT_OK(writer.Flush());
+
+  EXPECT_THAT(success_stream->requests(), ElementsAre(IsChunk(), IsItem()));
+}
+
 TEST(StreamingTrajectoryWriter, StopsOnNonTransientError) {
   auto* fail_stream = new MockStream();
   EXPECT_CALL(*fail_stream, Write(IsChunk(), _)).WillOnce(Return(false));
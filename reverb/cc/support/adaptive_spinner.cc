@@ -0,0 +1,86 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/adaptive_spinner.h"
+
+#include <algorithm>
+#include <thread>  // NOLINT(build/c++11)
+
+#include "absl/functional/function_ref.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Number of pauses after which the backoff yields the CPU between polls.
+constexpr int kMaxPausesPerPoll = 64;
+
+// Hints to the CPU that the thread is busy waiting.
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+}  // namespace
+
+void AdaptiveSpinner::set_max_budget(absl::Duration max_budget) {
+  const int64_t max_budget_ns =
+      std::max<int64_t>(0, absl::ToInt64Nanoseconds(max_budget));
+  max_budget_ns_.store(max_budget_ns, std::memory_order_relaxed);
+  budget_ns_.store(max_budget_ns, std::memory_order_relaxed);
+}
+
+absl::Duration AdaptiveSpinner::max_budget() const {
+  return absl::Nanoseconds(max_budget_ns_.load(std::memory_order_relaxed));
+}
+
+absl::Duration AdaptiveSpinner::budget() const {
+  return absl::Nanoseconds(budget_ns_.load(std::memory_order_relaxed));
+}
+
+bool AdaptiveSpinner::Spin(absl::FunctionRef<bool()> is_ready) {
+  const int64_t max_budget_ns = max_budget_ns_.load(std::memory_order_relaxed);
+  if (max_budget_ns <= 0) return false;
+  const int64_t budget_ns = std::min(
+      budget_ns_.load(std::memory_order_relaxed), max_budget_ns);
+
+  const absl::Time deadline = absl::Now() + absl::Nanoseconds(budget_ns);
+  int num_pauses = 1;
+  bool ready;
+  while (!(ready = is_ready()) && absl::Now() < deadline) {
+    if (num_pauses < kMaxPausesPerPoll) {
+      for (int i = 0; i < num_pauses; i++) CpuRelax();
+      num_pauses *= 2;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  budget_ns_.store(
+      ready ? std::min(max_budget_ns, budget_ns * 2)
+            : std::max(std::max<int64_t>(1, max_budget_ns / kMinBudgetDivisor),
+                       budget_ns / 2),
+      std::memory_order_relaxed);
+  return ready;
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
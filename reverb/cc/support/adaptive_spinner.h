@@ -0,0 +1,70 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_ADAPTIVE_SPINNER_H_
+#define REVERB_CC_SUPPORT_ADAPTIVE_SPINNER_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "absl/functional/function_ref.h"
+#include "absl/time/time.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Busy waits for a condition before a thread resorts to parking itself (e.g on
+// a condition variable), which saves the wakeup latency when the condition
+// becomes true shortly after the thread ran out of work.
+//
+// The condition is polled with exponentially increasing pauses between the
+// polls. The time spent spinning adapts to how often it pays off: every
+// successful spin doubles the budget (up to `max_budget`) and every
+// unsuccessful one halves it, down to 1/64 of `max_budget`. An idle thread
+// therefore only burns a small fraction of a core before it parks.
+//
+// `Spin` must only be called by a single thread at a time but `set_max_budget`
+// may be called concurrently.
+class AdaptiveSpinner {
+ public:
+  // The budget never shrinks below `max_budget` / `kMinBudgetDivisor`.
+  static constexpr int kMinBudgetDivisor = 64;
+
+  // Spinning is disabled until `set_max_budget` is called.
+  AdaptiveSpinner() = default;
+
+  // Sets the longest time a call to `Spin` may take. Zero (or negative)
+  // disables spinning.
+  void set_max_budget(absl::Duration max_budget);
+  absl::Duration max_budget() const;
+
+  // Current budget of `Spin`.
+  absl::Duration budget() const;
+
+  // Polls `is_ready` until it returns true (or the budget has been used up)
+  // and returns the last value it returned. Returns false without calling
+  // `is_ready` when spinning is disabled.
+  bool Spin(absl::FunctionRef<bool()> is_ready);
+
+ private:
+  std::atomic<int64_t> max_budget_ns_{0};
+  std::atomic<int64_t> budget_ns_{0};
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_ADAPTIVE_SPINNER_H_
@@ -0,0 +1,85 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/adaptive_spinner.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(AdaptiveSpinnerTest, DisabledByDefault) {
+  AdaptiveSpinner spinner;
+  int num_polls = 0;
+  EXPECT_FALSE(spinner.Spin([&] { return ++num_polls > 0; }));
+  EXPECT_EQ(num_polls, 0);
+  EXPECT_EQ(spinner.budget(), absl::ZeroDuration());
+}
+
+TEST(AdaptiveSpinnerTest, ReturnsTrueOnceReady) {
+  AdaptiveSpinner spinner;
+  spinner.set_max_budget(absl::Seconds(10));
+  int num_polls = 0;
+  EXPECT_TRUE(spinner.Spin([&] { return ++num_polls == 3; }));
+  EXPECT_EQ(num_polls, 3);
+  EXPECT_EQ(spinner.budget(), absl::Seconds(10));
+}
+
+TEST(AdaptiveSpinnerTest, GivesUpOnceBudgetIsUsed) {
+  AdaptiveSpinner spinner;
+  spinner.set_max_budget(absl::Milliseconds(1));
+  const absl::Time start = absl::Now();
+  EXPECT_FALSE(spinner.Spin([] { return false; }));
+  EXPECT_GE(absl::Now() - start, absl::Milliseconds(1));
+  EXPECT_LT(absl::Now() - start, absl::Seconds(5));
+}
+
+TEST(AdaptiveSpinnerTest, BudgetAdaptsToOutcome) {
+  AdaptiveSpinner spinner;
+  spinner.set_max_budget(absl::Milliseconds(64));
+
+  EXPECT_FALSE(spinner.Spin([] { return false; }));
+  EXPECT_EQ(spinner.budget(), absl::Milliseconds(32));
+
+  // The budget never shrinks below a fraction of the maximum.
+  for (int i = 0; i < 10; i++) {
+    EXPECT_FALSE(spinner.Spin([] { return false; }));
+  }
+  EXPECT_EQ(spinner.budget(), absl::Milliseconds(1));
+
+  // Successful spins double the budget up to the maximum.
+  EXPECT_TRUE(spinner.Spin([] { return true; }));
+  EXPECT_EQ(spinner.budget(), absl::Milliseconds(2));
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(spinner.Spin([] { return true; }));
+  }
+  EXPECT_EQ(spinner.budget(), absl::Milliseconds(64));
+}
+
+TEST(AdaptiveSpinnerTest, ZeroMaxBudgetDisablesSpinning) {
+  AdaptiveSpinner spinner;
+  spinner.set_max_budget(absl::Milliseconds(1));
+  spinner.set_max_budget(absl::ZeroDuration());
+  EXPECT_FALSE(spinner.Spin([] { return true; }));
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,81 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_CHUNK_KEY_WINDOW_H_
+#define REVERB_CC_SUPPORT_CHUNK_KEY_WINDOW_H_
+
+#include <cstdint>
+#include <deque>
+
+#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Bounded FIFO set of chunk keys. Used by both ends of a sample stream to keep
+// track of which chunks the client still holds: the server only sends chunks
+// which aren't in its window and the client resolves references to chunks in
+// its window. As long as both ends insert the keys of transmitted chunks in
+// the same order they evict the same keys, so the windows stay identical
+// without any additional round trips.
+//
+// Lookups do not affect the eviction order (unlike LRU) so the state of the
+// window only depends on the sequence of inserted keys, which is the order in
+// which chunks appear on the stream.
+class ChunkKeyWindow {
+ public:
+  // `capacity` is the maximum number of keys held. A window with capacity 0
+  // never contains any keys.
+  explicit ChunkKeyWindow(int64_t capacity) : capacity_(capacity) {
+    REVERB_CHECK_GE(capacity_, 0);
+  }
+
+  bool Contains(uint64_t key) const { return keys_.contains(key); }
+
+  // Inserts `key`, which must not already be in the window. Returns true and
+  // sets `evicted` if the oldest key had to be evicted to make room for it. If
+  // the capacity is 0 then `key` itself is evicted right away.
+  bool Insert(uint64_t key, uint64_t* evicted) {
+    if (capacity_ == 0) {
+      *evicted = key;
+      return true;
+    }
+    REVERB_CHECK(keys_.insert(key).second);
+    order_.push_back(key);
+    if (order_.size() <= capacity_) {
+      return false;
+    }
+    *evicted = order_.front();
+    order_.pop_front();
+    keys_.erase(*evicted);
+    return true;
+  }
+
+  int64_t size() const { return order_.size(); }
+
+  int64_t capacity() const { return capacity_; }
+
+ private:
+  const int64_t capacity_;
+  internal::flat_hash_set<uint64_t> keys_;
+  std::deque<uint64_t> order_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_CHUNK_KEY_WINDOW_H_
@@ -0,0 +1,70 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/chunk_key_window.h"
+
+#include <cstdint>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(ChunkKeyWindowTest, EvictsOldestKey) {
+  ChunkKeyWindow window(2);
+  uint64_t evicted;
+  EXPECT_FALSE(window.Insert(1, &evicted));
+  EXPECT_FALSE(window.Insert(2, &evicted));
+  EXPECT_TRUE(window.Contains(1));
+  EXPECT_TRUE(window.Contains(2));
+
+  EXPECT_TRUE(window.Insert(3, &evicted));
+  EXPECT_EQ(evicted, 1);
+  EXPECT_FALSE(window.Contains(1));
+  EXPECT_EQ(window.size(), 2);
+}
+
+TEST(ChunkKeyWindowTest, LookupsDoNotAffectOrder) {
+  ChunkKeyWindow window(2);
+  uint64_t evicted;
+  window.Insert(1, &evicted);
+  window.Insert(2, &evicted);
+  EXPECT_TRUE(window.Contains(1));
+  EXPECT_TRUE(window.Insert(3, &evicted));
+  EXPECT_EQ(evicted, 1);
+}
+
+TEST(ChunkKeyWindowTest, ZeroCapacityEvictsImmediately) {
+  ChunkKeyWindow window(0);
+  uint64_t evicted;
+  EXPECT_TRUE(window.Insert(1, &evicted));
+  EXPECT_EQ(evicted, 1);
+  EXPECT_FALSE(window.Contains(1));
+  EXPECT_EQ(window.size(), 0);
+}
+
+TEST(ChunkKeyWindowDeathTest, InsertingExistingKeyDies) {
+  ChunkKeyWindow window(2);
+  uint64_t evicted;
+  window.Insert(1, &evicted);
+  EXPECT_DEATH(window.Insert(1, &evicted), "");
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
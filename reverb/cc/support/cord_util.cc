@@ -0,0 +1,168 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/cord_util.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "grpcpp/grpcpp.h"
+#include "absl/status/status.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/message_lite.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+CordInputStream::CordInputStream(const absl::Cord* cord) {
+  for (absl::string_view chunk : cord->Chunks()) {
+    chunks_.push_back(chunk);
+  }
+}
+
+bool CordInputStream::Next(const void** data, int* size) {
+  while (index_ < chunks_.size() && offset_ == chunks_[index_].size()) {
+    index_++;
+    offset_ = 0;
+  }
+  if (index_ == chunks_.size()) return false;
+
+  *data = chunks_[index_].data() + offset_;
+  *size = chunks_[index_].size() - offset_;
+  offset_ = chunks_[index_].size();
+  byte_count_ += *size;
+  return true;
+}
+
+void CordInputStream::BackUp(int count) {
+  offset_ -= count;
+  byte_count_ -= count;
+}
+
+bool CordInputStream::Skip(int count) {
+  while (count > 0) {
+    if (index_ == chunks_.size()) return false;
+    const size_t skipped =
+        std::min<size_t>(count, chunks_[index_].size() - offset_);
+    offset_ += skipped;
+    byte_count_ += skipped;
+    count -= skipped;
+    if (offset_ == chunks_[index_].size()) {
+      index_++;
+      offset_ = 0;
+    }
+  }
+  return true;
+}
+
+int64_t CordInputStream::ByteCount() const { return byte_count_; }
+
+bool ParseFromCord(const absl::Cord& cord,
+                   google::protobuf::MessageLite* message) {
+  CordInputStream stream(&cord);
+  return message->ParseFromZeroCopyStream(&stream);
+}
+
+absl::Status SplitField(const absl::Cord& message, int field_number,
+                        std::vector<absl::Cord>* fields, absl::Cord* rest) {
+  CordInputStream stream(&message);
+  google::protobuf::io::CodedInputStream input(&stream);
+  auto error = [&] {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Failed to split field ", field_number, " from message of ",
+        message.size(), " bytes at byte ", input.CurrentPosition(), "."));
+  };
+
+  // The other fields are appended to `rest` in runs of consecutive fields.
+  int64_t run_start = 0;
+  while (true) {
+    const int64_t start = input.CurrentPosition();
+    const uint32_t tag = input.ReadTag();
+    if (tag == 0) break;
+
+    switch (tag & 7) {
+      case 0: {  // Varint.
+        uint64_t value;
+        if (!input.ReadVarint64(&value)) return error();
+        break;
+      }
+      case 1:  // Fixed 64.
+        if (!input.Skip(8)) return error();
+        break;
+      case 2: {  // Length delimited.
+        uint32_t length;
+        if (!input.ReadVarint32(&length)) return error();
+        const int64_t begin = input.CurrentPosition();
+        if (!input.Skip(length)) return error();
+        if ((tag >> 3) == field_number) {
+          rest->Append(message.Subcord(run_start, start - run_start));
+          fields->push_back(message.Subcord(begin, length));
+          run_start = input.CurrentPosition();
+        }
+        break;
+      }
+      case 5:  // Fixed 32.
+        if (!input.Skip(4)) return error();
+        break;
+      default:  // Groups are not supported.
+        return error();
+    }
+  }
+  if (input.CurrentPosition() != message.size()) return error();
+
+  rest->Append(message.Subcord(run_start, message.size() - run_start));
+  return absl::OkStatus();
+}
+
+absl::Status AppendByteBuffer(const grpc::ByteBuffer& buffer,
+                              absl::Cord* cord) {
+  std::vector<grpc::Slice> slices;
+  if (grpc::Status status = buffer.Dump(&slices); !status.ok()) {
+    return absl::InternalError(absl::StrCat("Failed to read byte buffer: ",
+                                            status.error_message()));
+  }
+  for (grpc::Slice& slice : slices) {
+    absl::string_view data(reinterpret_cast<const char*>(slice.begin()),
+                           slice.size());
+    cord->Append(
+        absl::MakeCordFromExternal(data, [slice = std::move(slice)] {}));
+  }
+  return absl::OkStatus();
+}
+
+void AppendCordSlices(const absl::Cord& cord,
+                      std::vector<grpc::Slice>* slices) {
+  // Every slice holds a reference to the same copy of the cord, which shares
+  // the chunks with `cord`.
+  auto owner = std::make_shared<const absl::Cord>(cord);
+  for (absl::string_view chunk : owner->Chunks()) {
+    slices->emplace_back(
+        const_cast<char*>(chunk.data()), chunk.size(),
+        [](void* owner) {
+          delete static_cast<std::shared_ptr<const absl::Cord>*>(owner);
+        },
+        new std::shared_ptr<const absl::Cord>(owner));
+  }
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
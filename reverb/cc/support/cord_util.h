@@ -0,0 +1,79 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_CORD_UTIL_H_
+#define REVERB_CC_SUPPORT_CORD_UTIL_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "grpcpp/grpcpp.h"
+#include "absl/status/status.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/io/zero_copy_stream.h"
+#include "google/protobuf/message_lite.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Reads the chunks of a cord without copying them. The cord must outlive the
+// stream.
+class CordInputStream : public google::protobuf::io::ZeroCopyInputStream {
+ public:
+  explicit CordInputStream(const absl::Cord* cord);
+
+  bool Next(const void** data, int* size) override;
+  void BackUp(int count) override;
+  bool Skip(int count) override;
+  int64_t ByteCount() const override;
+
+ private:
+  std::vector<absl::string_view> chunks_;
+
+  // Index of the current chunk and number of bytes of it which have been read.
+  int index_ = 0;
+  size_t offset_ = 0;
+
+  int64_t byte_count_ = 0;
+};
+
+// Parses `message` from the serialized `cord`. Returns false if the cord is
+// not a valid encoding of the message.
+bool ParseFromCord(const absl::Cord& cord,
+                   google::protobuf::MessageLite* message);
+
+// Splits the serialized `message` into the (length delimited) occurrences of
+// field `field_number`, appended to `fields` without their key and length
+// prefix, and the encoding of all other fields, appended to `rest`. Neither
+// is copied, they share the memory of `message`. Returns an error if
+// `message` is not a valid encoding.
+absl::Status SplitField(const absl::Cord& message, int field_number,
+                        std::vector<absl::Cord>* fields, absl::Cord* rest);
+
+// Appends the data of `buffer` to `cord` without copying it. The cord shares
+// ownership of the slices of the buffer.
+absl::Status AppendByteBuffer(const grpc::ByteBuffer& buffer,
+                              absl::Cord* cord);
+
+// Appends slices to `slices` which share ownership of the chunks of `cord`
+// rather than copying them.
+void AppendCordSlices(const absl::Cord& cord, std::vector<grpc::Slice>* slices);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_CORD_UTIL_H_
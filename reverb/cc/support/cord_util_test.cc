@@ -0,0 +1,122 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/cord_util.h"
+
+#include <string>
+#include <vector>
+
+#include "grpcpp/grpcpp.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/cord_test_helpers.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/testing/proto_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Cord holding `serialized` split over chunks of `chunk_size` bytes.
+absl::Cord FragmentedCord(const std::string& serialized, int chunk_size) {
+  std::vector<std::string> chunks;
+  for (int i = 0; i < serialized.size(); i += chunk_size) {
+    chunks.push_back(serialized.substr(i, chunk_size));
+  }
+  return absl::MakeFragmentedCord(chunks);
+}
+
+ChunkData MakeChunk() {
+  return testing::ParseTextProtoOrDie<ChunkData>(R"pb(
+    chunk_key: 3
+    sequence_range { episode_id: 1 start: 2 end: 5 }
+    data { tensors { dtype: DT_INT32 tensor_content: "0123456789abcdef" } }
+    delta_encoded: true
+    data_tensors_len: 1
+  )pb");
+}
+
+TEST(CordInputStreamTest, ParsesFragmentedCords) {
+  ChunkData chunk = MakeChunk();
+  for (int chunk_size : {1, 3, 1000}) {
+    ChunkData parsed;
+    ASSERT_TRUE(ParseFromCord(
+        FragmentedCord(chunk.SerializeAsString(), chunk_size), &parsed));
+    EXPECT_THAT(parsed, testing::EqualsProto(chunk));
+  }
+}
+
+TEST(CordInputStreamTest, SkipsAndBacksUp) {
+  absl::Cord cord = FragmentedCord("abcdefgh", 3);
+  CordInputStream stream(&cord);
+  const void* data;
+  int size;
+  ASSERT_TRUE(stream.Next(&data, &size));
+  EXPECT_EQ(absl::string_view(static_cast<const char*>(data), size), "abc");
+  stream.BackUp(1);
+  ASSERT_TRUE(stream.Skip(2));
+  EXPECT_EQ(stream.ByteCount(), 4);
+  ASSERT_TRUE(stream.Next(&data, &size));
+  EXPECT_EQ(absl::string_view(static_cast<const char*>(data), size), "ef");
+  EXPECT_FALSE(stream.Skip(5));
+}
+
+TEST(SplitFieldTest, SplitsFieldFromOtherFields) {
+  ChunkData chunk = MakeChunk();
+  std::vector<absl::Cord> fields;
+  absl::Cord rest;
+  REVERB_ASSERT_OK(SplitField(FragmentedCord(chunk.SerializeAsString(), 5),
+                              ChunkData::kDataFieldNumber, &fields, &rest));
+
+  ASSERT_THAT(fields, ::testing::SizeIs(1));
+  ChunkData::Data data;
+  ASSERT_TRUE(ParseFromCord(fields[0], &data));
+  EXPECT_THAT(data, testing::EqualsProto(chunk.data()));
+
+  ChunkData metadata;
+  ASSERT_TRUE(ParseFromCord(rest, &metadata));
+  chunk.clear_data();
+  EXPECT_THAT(metadata, testing::EqualsProto(chunk));
+}
+
+TEST(SplitFieldTest, RejectsTruncatedMessages) {
+  std::string serialized = MakeChunk().SerializeAsString();
+  serialized.resize(serialized.size() - 1);
+  std::vector<absl::Cord> fields;
+  absl::Cord rest;
+  EXPECT_EQ(SplitField(absl::Cord(serialized), ChunkData::kDataFieldNumber,
+                       &fields, &rest)
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(CordSlicesTest, RoundTripsThroughByteBuffer) {
+  absl::Cord cord = FragmentedCord("0123456789", 4);
+  std::vector<grpc::Slice> slices;
+  AppendCordSlices(cord, &slices);
+  EXPECT_THAT(slices, ::testing::SizeIs(3));
+
+  grpc::ByteBuffer buffer(slices.data(), slices.size());
+  absl::Cord read_back("prefix");
+  REVERB_ASSERT_OK(AppendByteBuffer(buffer, &read_back));
+  EXPECT_EQ(read_back, "prefix0123456789");
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,101 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/decoded_chunk_cache.h"
+
+#include <cstdint>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/status_macros.h"
+#include "tensorflow/core/framework/tensor.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+DecodedChunkCache::DecodedChunkCache(int64_t max_bytes)
+    : max_bytes_(max_bytes) {
+  REVERB_CHECK_GE(max_bytes_, 0);
+}
+
+absl::Status DecodedChunkCache::GetOrDecode(uint64_t chunk_key, int column,
+                                            const DecodeFn& decode,
+                                            tensorflow::Tensor* out) {
+  const Key key(chunk_key, column);
+  {
+    absl::MutexLock lock(&mu_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      // Move the entry to the front of the list as it is now the most recently
+      // used one.
+      lru_.splice(lru_.begin(), lru_, it->second);
+      *out = it->second->tensor;
+      stats_.hits++;
+      return absl::OkStatus();
+    }
+    stats_.misses++;
+  }
+
+  REVERB_RETURN_IF_ERROR(decode(out));
+
+  const int64_t num_bytes = out->TotalBytes();
+  if (num_bytes > max_bytes_) {
+    return absl::OkStatus();
+  }
+
+  absl::MutexLock lock(&mu_);
+  if (entries_.contains(key)) {
+    // Another thread decoded the same column while the lock was released.
+    return absl::OkStatus();
+  }
+  EvictUntilFits(num_bytes);
+  lru_.push_front(Entry{key, *out});
+  entries_[key] = lru_.begin();
+  stats_.num_entries++;
+  stats_.num_bytes += num_bytes;
+  return absl::OkStatus();
+}
+
+void DecodedChunkCache::EvictUntilFits(int64_t num_bytes) {
+  while (!lru_.empty() && stats_.num_bytes + num_bytes > max_bytes_) {
+    const Entry& entry = lru_.back();
+    stats_.num_bytes -= entry.tensor.TotalBytes();
+    stats_.num_entries--;
+    stats_.evictions++;
+    entries_.erase(entry.key);
+    lru_.pop_back();
+  }
+}
+
+void DecodedChunkCache::Clear() {
+  absl::MutexLock lock(&mu_);
+  lru_.clear();
+  entries_.clear();
+  stats_.num_entries = 0;
+  stats_.num_bytes = 0;
+}
+
+DecodedChunkCache::Stats DecodedChunkCache::stats() const {
+  absl::MutexLock lock(&mu_);
+  return stats_;
+}
+
+int64_t DecodedChunkCache::max_bytes() const { return max_bytes_; }
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
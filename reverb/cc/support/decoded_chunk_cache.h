@@ -0,0 +1,104 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_DECODED_CHUNK_CACHE_H_
+#define REVERB_CC_SUPPORT_DECODED_CHUNK_CACHE_H_
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "tensorflow/core/framework/tensor.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Thread-safe LRU cache of decompressed (and delta decoded) chunk columns keyed
+// by `(chunk_key, column)`. The size of the cache is bounded by the total
+// number of bytes of the cached tensors. When a new tensor does not fit, the
+// least recently used tensors are evicted until it does. Tensors larger than
+// the entire budget are never cached.
+//
+// The cached tensors are returned by reference (i.e the returned tensor shares
+// the buffer of the cached tensor) so callers must not modify them.
+//
+// Decoding is done without holding the lock so concurrent misses for the same
+// key may both decode the column, in which case the first inserted tensor is
+// kept.
+class DecodedChunkCache {
+ public:
+  struct Stats {
+    int64_t hits = 0;
+    int64_t misses = 0;
+    int64_t evictions = 0;
+    // Number of tensors and their total size in bytes currently in the cache.
+    int64_t num_entries = 0;
+    int64_t num_bytes = 0;
+  };
+
+  // Decodes a column into `out`.
+  using DecodeFn = std::function<absl::Status(tensorflow::Tensor* out)>;
+
+  // `max_bytes` is the maximum total size of the cached tensors. Must be >= 0.
+  explicit DecodedChunkCache(int64_t max_bytes);
+
+  // Looks up the decoded tensor of `column` in chunk `chunk_key`. If the tensor
+  // is not in the cache then `decode` is called and (if successful) the result
+  // is inserted into the cache. Errors from `decode` are returned as is.
+  absl::Status GetOrDecode(uint64_t chunk_key, int column,
+                           const DecodeFn& decode, tensorflow::Tensor* out)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Removes all tensors from the cache. The counters are not reset.
+  void Clear() ABSL_LOCKS_EXCLUDED(mu_);
+
+  Stats stats() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  int64_t max_bytes() const;
+
+ private:
+  using Key = std::pair<uint64_t, int>;
+
+  struct Entry {
+    Key key;
+    tensorflow::Tensor tensor;
+  };
+
+  // Evicts the least recently used entries until `num_bytes` more bytes fit.
+  void EvictUntilFits(int64_t num_bytes) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const int64_t max_bytes_;
+
+  mutable absl::Mutex mu_;
+
+  // Entries ordered from most to least recently used.
+  std::list<Entry> lru_ ABSL_GUARDED_BY(mu_);
+
+  internal::flat_hash_map<Key, std::list<Entry>::iterator> entries_
+      ABSL_GUARDED_BY(mu_);
+
+  Stats stats_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_DECODED_CHUNK_CACHE_H_
@@ -0,0 +1,141 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/decoded_chunk_cache.h"
+
+#include <cstdint>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Returns a decode function which creates a float tensor with `num_elements`
+// elements and counts the number of times it is called.
+DecodedChunkCache::DecodeFn MakeDecoder(int num_elements, int* num_calls) {
+  return [num_elements, num_calls](tensorflow::Tensor* out) {
+    (*num_calls)++;
+    *out = tensorflow::Tensor(tensorflow::DT_FLOAT,
+                              tensorflow::TensorShape({num_elements}));
+    out->flat<float>().setConstant(1);
+    return absl::OkStatus();
+  };
+}
+
+TEST(DecodedChunkCacheTest, HitReturnsCachedTensor) {
+  DecodedChunkCache cache(1000);
+  int num_calls = 0;
+
+  tensorflow::Tensor first;
+  REVERB_EXPECT_OK(cache.GetOrDecode(1, 0, MakeDecoder(10, &num_calls), &first));
+  tensorflow::Tensor second;
+  REVERB_EXPECT_OK(
+      cache.GetOrDecode(1, 0, MakeDecoder(10, &num_calls), &second));
+
+  EXPECT_EQ(num_calls, 1);
+  EXPECT_TRUE(first.SharesBufferWith(second));
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.evictions, 0);
+  EXPECT_EQ(stats.num_entries, 1);
+  EXPECT_EQ(stats.num_bytes, 40);
+}
+
+TEST(DecodedChunkCacheTest, ColumnsAreCachedSeparately) {
+  DecodedChunkCache cache(1000);
+  int num_calls = 0;
+
+  tensorflow::Tensor out;
+  REVERB_EXPECT_OK(cache.GetOrDecode(1, 0, MakeDecoder(10, &num_calls), &out));
+  REVERB_EXPECT_OK(cache.GetOrDecode(1, 1, MakeDecoder(10, &num_calls), &out));
+  REVERB_EXPECT_OK(cache.GetOrDecode(2, 0, MakeDecoder(10, &num_calls), &out));
+  EXPECT_EQ(num_calls, 3);
+  EXPECT_EQ(cache.stats().num_entries, 3);
+}
+
+TEST(DecodedChunkCacheTest, EvictsLeastRecentlyUsed) {
+  // Room for two tensors of 40 bytes.
+  DecodedChunkCache cache(100);
+  int num_calls = 0;
+
+  tensorflow::Tensor out;
+  REVERB_EXPECT_OK(cache.GetOrDecode(1, 0, MakeDecoder(10, &num_calls), &out));
+  REVERB_EXPECT_OK(cache.GetOrDecode(2, 0, MakeDecoder(10, &num_calls), &out));
+  // Touch chunk 1 so chunk 2 becomes the least recently used.
+  REVERB_EXPECT_OK(cache.GetOrDecode(1, 0, MakeDecoder(10, &num_calls), &out));
+  REVERB_EXPECT_OK(cache.GetOrDecode(3, 0, MakeDecoder(10, &num_calls), &out));
+  EXPECT_EQ(num_calls, 3);
+  EXPECT_EQ(cache.stats().evictions, 1);
+  EXPECT_EQ(cache.stats().num_bytes, 80);
+
+  // Chunk 1 is still cached but 2 has been evicted.
+  REVERB_EXPECT_OK(cache.GetOrDecode(1, 0, MakeDecoder(10, &num_calls), &out));
+  EXPECT_EQ(num_calls, 3);
+  REVERB_EXPECT_OK(cache.GetOrDecode(2, 0, MakeDecoder(10, &num_calls), &out));
+  EXPECT_EQ(num_calls, 4);
+}
+
+TEST(DecodedChunkCacheTest, TensorsLargerThanBudgetAreNotCached) {
+  DecodedChunkCache cache(100);
+  int num_calls = 0;
+
+  tensorflow::Tensor out;
+  REVERB_EXPECT_OK(cache.GetOrDecode(1, 0, MakeDecoder(10, &num_calls), &out));
+  REVERB_EXPECT_OK(
+      cache.GetOrDecode(2, 0, MakeDecoder(1000, &num_calls), &out));
+  EXPECT_EQ(out.NumElements(), 1000);
+  EXPECT_EQ(cache.stats().num_entries, 1);
+  EXPECT_EQ(cache.stats().evictions, 0);
+}
+
+TEST(DecodedChunkCacheTest, DecodeErrorsAreReturned) {
+  DecodedChunkCache cache(100);
+  tensorflow::Tensor out;
+  EXPECT_EQ(cache
+                .GetOrDecode(1, 0,
+                             [](tensorflow::Tensor*) {
+                               return absl::InternalError("decode failed");
+                             },
+                             &out)
+                .code(),
+            absl::StatusCode::kInternal);
+  EXPECT_EQ(cache.stats().num_entries, 0);
+}
+
+TEST(DecodedChunkCacheTest, ClearRemovesEntries) {
+  DecodedChunkCache cache(1000);
+  int num_calls = 0;
+
+  tensorflow::Tensor out;
+  REVERB_EXPECT_OK(cache.GetOrDecode(1, 0, MakeDecoder(10, &num_calls), &out));
+  cache.Clear();
+  EXPECT_EQ(cache.stats().num_entries, 0);
+  EXPECT_EQ(cache.stats().num_bytes, 0);
+  REVERB_EXPECT_OK(cache.GetOrDecode(1, 0, MakeDecoder(10, &num_calls), &out));
+  EXPECT_EQ(num_calls, 2);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
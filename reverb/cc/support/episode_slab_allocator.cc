@@ -0,0 +1,109 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/episode_slab_allocator.h"
+
+#include <cstring>
+#include <memory>
+#include <utility>
+
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+struct EpisodeSlabAllocator::Slab {
+  Slab(std::shared_ptr<Shard> shard, uint64_t episode_id, size_t size)
+      : shard(std::move(shard)),
+        episode_id(episode_id),
+        data(new char[size]),
+        size(size) {
+    this->shard->num_slabs++;
+  }
+
+  ~Slab() {
+    shard->num_slabs--;
+    absl::MutexLock lock(&shard->mu);
+    // The episode may have moved on to a new slab in the meantime.
+    auto it = shard->open.find(episode_id);
+    if (it != shard->open.end() && it->second.expired()) {
+      shard->open.erase(it);
+    }
+  }
+
+  const std::shared_ptr<Shard> shard;
+  const uint64_t episode_id;
+  const std::unique_ptr<char[]> data;
+  const size_t size;
+
+  // Number of bytes at the front of `data` which have been handed out. Guarded
+  // by `shard->mu`.
+  size_t used = 0;
+};
+
+EpisodeSlabAllocator::EpisodeSlabAllocator(size_t slab_size, int num_shards)
+    : slab_size_(slab_size) {
+  REVERB_CHECK_GT(slab_size, 0);
+  REVERB_CHECK_GT(num_shards, 0);
+  for (int i = 0; i < num_shards; i++) {
+    shards_.push_back(std::make_shared<Shard>());
+  }
+}
+
+absl::Cord EpisodeSlabAllocator::Copy(uint64_t episode_id,
+                                      const absl::Cord& data) {
+  if (data.empty() || data.size() > slab_size_) return data;
+
+  const std::shared_ptr<Shard>& shard = shards_[episode_id % shards_.size()];
+  std::shared_ptr<Slab> slab;
+  // Only released once the lock has been released as the destructor of the
+  // slab acquires it.
+  std::shared_ptr<Slab> full;
+  char* dest;
+  {
+    absl::MutexLock lock(&shard->mu);
+    std::weak_ptr<Slab>& open = shard->open[episode_id];
+    slab = open.lock();
+    if (slab == nullptr || slab->size - slab->used < data.size()) {
+      full = std::move(slab);
+      slab = std::make_shared<Slab>(shard, episode_id, slab_size_);
+      open = slab;
+    }
+    dest = slab->data.get() + slab->used;
+    slab->used += data.size();
+  }
+
+  // The range is exclusively owned by the caller so it is filled without
+  // holding the lock.
+  for (absl::string_view chunk : data.Chunks()) {
+    std::memcpy(dest, chunk.data(), chunk.size());
+    dest += chunk.size();
+  }
+  absl::string_view copy(dest - data.size(), data.size());
+  return absl::MakeCordFromExternal(copy, [slab = std::move(slab)] {});
+}
+
+int64_t EpisodeSlabAllocator::num_slabs() const {
+  int64_t num_slabs = 0;
+  for (const auto& shard : shards_) num_slabs += shard->num_slabs;
+  return num_slabs;
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,86 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_EPISODE_SLAB_ALLOCATOR_H_
+#define REVERB_CC_SUPPORT_EPISODE_SLAB_ALLOCATOR_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/cord.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/hash_map.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Copies the data of chunks into slabs of memory shared by the chunks of the
+// same episode. Consecutive chunks of an episode are thereby stored next to
+// each other rather than wherever the buffers they were received in happened
+// to be allocated, and a slab is released in one go once the data of all its
+// chunks has been destroyed.
+//
+// Every episode has at most one open slab, which data is appended to until it
+// is full. The allocator only holds weak references to the slabs: they are
+// owned by the cords returned by `Copy`. Thread safe.
+class EpisodeSlabAllocator {
+ public:
+  static constexpr int kDefaultNumShards = 16;
+
+  // `slab_size` is the number of bytes allocated for each slab. Data larger
+  // than `slab_size` is not copied. `num_shards` is the number of
+  // independently locked maps of open slabs.
+  explicit EpisodeSlabAllocator(size_t slab_size,
+                                int num_shards = kDefaultNumShards);
+
+  // Returns a copy of `data` stored in the open slab of `episode_id`, starting
+  // a new slab if there is none or if the data doesn't fit in it. Returns
+  // `data` as is if it is larger than `slab_size`.
+  absl::Cord Copy(uint64_t episode_id, const absl::Cord& data);
+
+  // Number of slabs which are still referenced.
+  int64_t num_slabs() const;
+
+  // Bytes allocated for the slabs which are still referenced.
+  int64_t allocated_bytes() const { return num_slabs() * slab_size_; }
+
+  size_t slab_size() const { return slab_size_; }
+
+ private:
+  struct Slab;
+
+  struct Shard {
+    absl::Mutex mu;
+    // Open slab of each episode. Entries of destroyed slabs are erased by the
+    // slabs themselves.
+    internal::flat_hash_map<uint64_t, std::weak_ptr<Slab>> open
+        ABSL_GUARDED_BY(mu);
+    std::atomic<int64_t> num_slabs{0};
+  };
+
+  const size_t slab_size_;
+
+  // Shared with the slabs as they may outlive the allocator.
+  std::vector<std::shared_ptr<Shard>> shards_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_EPISODE_SLAB_ALLOCATOR_H_
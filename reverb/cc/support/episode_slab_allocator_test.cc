@@ -0,0 +1,105 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/episode_slab_allocator.h"
+
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/cord_test_helpers.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+absl::string_view Flat(const absl::Cord& cord) {
+  absl::optional<absl::string_view> flat = cord.TryFlat();
+  EXPECT_TRUE(flat.has_value());
+  return flat.value_or("");
+}
+
+TEST(EpisodeSlabAllocatorTest, CopiesData) {
+  EpisodeSlabAllocator allocator(1024);
+  absl::Cord data = absl::MakeFragmentedCord({"0123", "4567", "89"});
+  absl::Cord copy = allocator.Copy(1, data);
+  EXPECT_EQ(copy, "0123456789");
+  EXPECT_EQ(allocator.num_slabs(), 1);
+  EXPECT_EQ(allocator.allocated_bytes(), 1024);
+}
+
+TEST(EpisodeSlabAllocatorTest, StoresChunksOfEpisodeContiguously) {
+  EpisodeSlabAllocator allocator(1024);
+  std::string data(100, 'a');
+  absl::Cord first = allocator.Copy(1, absl::Cord(data));
+  absl::Cord other_episode = allocator.Copy(2, absl::Cord(data));
+  absl::Cord second = allocator.Copy(1, absl::Cord(data));
+  EXPECT_EQ(Flat(first).data() + data.size(), Flat(second).data());
+  EXPECT_EQ(allocator.num_slabs(), 2);
+}
+
+TEST(EpisodeSlabAllocatorTest, StartsNewSlabWhenFull) {
+  EpisodeSlabAllocator allocator(256);
+  std::string data(100, 'a');
+  std::vector<absl::Cord> copies;
+  for (int i = 0; i < 5; i++) {
+    copies.push_back(allocator.Copy(1, absl::Cord(data)));
+  }
+  EXPECT_EQ(allocator.num_slabs(), 3);
+  for (const absl::Cord& copy : copies) {
+    EXPECT_EQ(copy, data);
+  }
+}
+
+TEST(EpisodeSlabAllocatorTest, ReleasesSlabOnceAllCopiesAreDestroyed) {
+  EpisodeSlabAllocator allocator(1024);
+  std::string data(100, 'a');
+  absl::Cord first = allocator.Copy(1, absl::Cord(data));
+  absl::Cord second = allocator.Copy(1, absl::Cord(data));
+  first.Clear();
+  EXPECT_EQ(allocator.num_slabs(), 1);
+  second.Clear();
+  EXPECT_EQ(allocator.num_slabs(), 0);
+
+  // The next chunk of the episode starts a new slab.
+  absl::Cord third = allocator.Copy(1, absl::Cord(data));
+  EXPECT_EQ(allocator.num_slabs(), 1);
+}
+
+TEST(EpisodeSlabAllocatorTest, DoesNotCopyDataLargerThanSlab) {
+  EpisodeSlabAllocator allocator(16);
+  absl::Cord data(std::string(100, 'a'));
+  absl::Cord copy = allocator.Copy(1, data);
+  EXPECT_EQ(Flat(copy).data(), Flat(data).data());
+  EXPECT_EQ(allocator.num_slabs(), 0);
+}
+
+TEST(EpisodeSlabAllocatorTest, SlabsOutliveAllocator) {
+  absl::Cord copy;
+  {
+    EpisodeSlabAllocator allocator(1024);
+    copy = allocator.Copy(1, absl::Cord(std::string(100, 'a')));
+  }
+  EXPECT_EQ(copy, std::string(100, 'a'));
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
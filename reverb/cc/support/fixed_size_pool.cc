@@ -0,0 +1,110 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/fixed_size_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Slabs are allocated with `new char[]` which only guarantees this alignment.
+constexpr size_t kMaxAlignment = alignof(std::max_align_t);
+
+size_t RoundUp(size_t size, size_t multiple) {
+  return (size + multiple - 1) / multiple * multiple;
+}
+
+}  // namespace
+
+FixedSizePool::FixedSizePool(int blocks_per_slab)
+    : blocks_per_slab_(blocks_per_slab) {
+  REVERB_CHECK_GT(blocks_per_slab_, 0);
+}
+
+FixedSizePool::~FixedSizePool() {
+  absl::MutexLock lock(&mu_);
+  REVERB_CHECK_EQ(num_allocated_, 0)
+      << "FixedSizePool destroyed while blocks are still in use.";
+}
+
+bool FixedSizePool::Serves(size_t size, size_t alignment) const {
+  return alignment <= kMaxAlignment &&
+         RoundUp(size, alignof(FreeBlock)) == block_size_;
+}
+
+void* FixedSizePool::Allocate(size_t size, size_t alignment) {
+  {
+    absl::MutexLock lock(&mu_);
+    if (block_size_ == 0 && alignment <= kMaxAlignment) {
+      block_size_ = RoundUp(size, alignof(FreeBlock));
+    }
+    if (Serves(size, alignment)) {
+      if (free_ == nullptr) {
+        // Blocks are a multiple of `FreeBlock`'s alignment so rounding them up
+        // to `kMaxAlignment` keeps every block of the slab aligned.
+        const size_t stride = RoundUp(block_size_, kMaxAlignment);
+        slabs_.push_back(
+            std::unique_ptr<char[]>(new char[stride * blocks_per_slab_]));
+        char* slab = slabs_.back().get();
+        for (int i = blocks_per_slab_ - 1; i >= 0; i--) {
+          auto* block = reinterpret_cast<FreeBlock*>(slab + i * stride);
+          block->next = free_;
+          free_ = block;
+        }
+      }
+      FreeBlock* block = free_;
+      free_ = block->next;
+      num_allocated_++;
+      return block;
+    }
+  }
+  return std::allocator<char>().allocate(size);
+}
+
+void FixedSizePool::Deallocate(void* ptr, size_t size, size_t alignment) {
+  {
+    absl::MutexLock lock(&mu_);
+    if (Serves(size, alignment)) {
+      auto* block = static_cast<FreeBlock*>(ptr);
+      block->next = free_;
+      free_ = block;
+      num_allocated_--;
+      return;
+    }
+  }
+  std::allocator<char>().deallocate(static_cast<char*>(ptr), size);
+}
+
+int64_t FixedSizePool::num_allocated() const {
+  absl::MutexLock lock(&mu_);
+  return num_allocated_;
+}
+
+int64_t FixedSizePool::num_slabs() const {
+  absl::MutexLock lock(&mu_);
+  return slabs_.size();
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
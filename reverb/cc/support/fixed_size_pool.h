@@ -0,0 +1,127 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_FIXED_SIZE_POOL_H_
+#define REVERB_CC_SUPPORT_FIXED_SIZE_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Thread-safe free list of equally sized memory blocks which are carved out of
+// larger slabs. Freed blocks are reused by later allocations and the slabs are
+// only returned to the global allocator when the pool is destroyed, so a pool
+// which has reached its peak size serves all allocations without touching the
+// global allocator.
+//
+// The block size is set by the first allocation. Allocations of any other size
+// (or alignment) are forwarded to the global allocator.
+class FixedSizePool {
+ public:
+  // `blocks_per_slab` must be > 0.
+  explicit FixedSizePool(int blocks_per_slab = 256);
+  ~FixedSizePool();
+
+  FixedSizePool(const FixedSizePool&) = delete;
+  FixedSizePool& operator=(const FixedSizePool&) = delete;
+
+  void* Allocate(size_t size, size_t alignment) ABSL_LOCKS_EXCLUDED(mu_);
+  void Deallocate(void* ptr, size_t size, size_t alignment)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Number of blocks currently handed out by the pool.
+  int64_t num_allocated() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Number of slabs allocated by the pool.
+  int64_t num_slabs() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  bool Serves(size_t size, size_t alignment) const
+      ABSL_SHARED_LOCKS_REQUIRED(mu_);
+
+  const int blocks_per_slab_;
+
+  mutable absl::Mutex mu_;
+  // Size of the blocks rounded up to a multiple of the alignment of
+  // `FreeBlock`. 0 until the first allocation.
+  size_t block_size_ ABSL_GUARDED_BY(mu_) = 0;
+  FreeBlock* free_ ABSL_GUARDED_BY(mu_) = nullptr;
+  std::vector<std::unique_ptr<char[]>> slabs_ ABSL_GUARDED_BY(mu_);
+  int64_t num_allocated_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+// Standard allocator which allocates single objects from a `FixedSizePool`.
+// Each copy keeps the pool alive so objects may outlive their original owner,
+// which makes it suitable for `std::allocate_shared`.
+template <typename T>
+class PoolAllocator {
+ public:
+  using value_type = T;
+
+  explicit PoolAllocator(std::shared_ptr<FixedSizePool> pool)
+      : pool_(std::move(pool)) {}
+
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>& other)  // NOLINT
+      : pool_(other.pool_) {}
+
+  T* allocate(size_t n) {
+    if (n != 1) {
+      return std::allocator<T>().allocate(n);
+    }
+    return static_cast<T*>(pool_->Allocate(sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* ptr, size_t n) {
+    if (n != 1) {
+      std::allocator<T>().deallocate(ptr, n);
+      return;
+    }
+    pool_->Deallocate(ptr, sizeof(T), alignof(T));
+  }
+
+  template <typename U>
+  bool operator==(const PoolAllocator<U>& other) const {
+    return pool_ == other.pool_;
+  }
+  template <typename U>
+  bool operator!=(const PoolAllocator<U>& other) const {
+    return pool_ != other.pool_;
+  }
+
+ private:
+  template <typename U>
+  friend class PoolAllocator;
+
+  std::shared_ptr<FixedSizePool> pool_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_FIXED_SIZE_POOL_H_
@@ -0,0 +1,118 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/fixed_size_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "reverb/cc/platform/thread.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(FixedSizePoolTest, ReusesFreedBlocks) {
+  FixedSizePool pool(/*blocks_per_slab=*/4);
+  void* first = pool.Allocate(16, 8);
+  EXPECT_EQ(pool.num_allocated(), 1);
+  pool.Deallocate(first, 16, 8);
+  EXPECT_EQ(pool.num_allocated(), 0);
+  void* second = pool.Allocate(16, 8);
+  EXPECT_EQ(first, second);
+  pool.Deallocate(second, 16, 8);
+  EXPECT_EQ(pool.num_slabs(), 1);
+}
+
+TEST(FixedSizePoolTest, AllocatesNewSlabWhenFull) {
+  FixedSizePool pool(/*blocks_per_slab=*/4);
+  std::vector<void*> blocks;
+  for (int i = 0; i < 5; i++) blocks.push_back(pool.Allocate(24, 8));
+  EXPECT_EQ(pool.num_slabs(), 2);
+  EXPECT_EQ(pool.num_allocated(), 5);
+  for (void* block : blocks) pool.Deallocate(block, 24, 8);
+
+  // All blocks are free again so no more slabs are needed.
+  for (void*& block : blocks) block = pool.Allocate(24, 8);
+  EXPECT_EQ(pool.num_slabs(), 2);
+  for (void* block : blocks) pool.Deallocate(block, 24, 8);
+}
+
+TEST(FixedSizePoolTest, BlocksAreDistinctAndAligned) {
+  FixedSizePool pool(/*blocks_per_slab=*/16);
+  std::vector<void*> blocks;
+  for (int i = 0; i < 40; i++) {
+    void* block = pool.Allocate(40, 8);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % alignof(std::max_align_t),
+              0);
+    memset(block, i, 40);
+    blocks.push_back(block);
+  }
+  for (int i = 0; i < 40; i++) {
+    EXPECT_EQ(static_cast<char*>(blocks[i])[39], static_cast<char>(i));
+    pool.Deallocate(blocks[i], 40, 8);
+  }
+}
+
+TEST(FixedSizePoolTest, OtherSizesUseGlobalAllocator) {
+  FixedSizePool pool;
+  void* block = pool.Allocate(16, 8);
+  void* other = pool.Allocate(64, 8);
+  EXPECT_EQ(pool.num_allocated(), 1);
+  pool.Deallocate(other, 64, 8);
+  pool.Deallocate(block, 16, 8);
+  EXPECT_EQ(pool.num_allocated(), 0);
+}
+
+TEST(PoolAllocatorTest, AllocateSharedUsesPool) {
+  auto pool = std::make_shared<FixedSizePool>();
+  std::weak_ptr<FixedSizePool> weak_pool = pool;
+  auto value = std::allocate_shared<int64_t>(PoolAllocator<int64_t>(pool), 7);
+  EXPECT_EQ(*value, 7);
+  EXPECT_EQ(pool->num_allocated(), 1);
+
+  // The allocator copy held by the shared_ptr keeps the pool alive.
+  pool = nullptr;
+  EXPECT_FALSE(weak_pool.expired());
+  value = nullptr;
+  EXPECT_TRUE(weak_pool.expired());
+}
+
+TEST(PoolAllocatorTest, ConcurrentAllocations) {
+  auto pool = std::make_shared<FixedSizePool>(/*blocks_per_slab=*/8);
+  std::vector<std::unique_ptr<Thread>> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.push_back(StartThread("", [pool] {
+      PoolAllocator<int64_t> allocator(pool);
+      std::vector<std::shared_ptr<int64_t>> values;
+      for (int i = 0; i < 1000; i++) {
+        values.push_back(std::allocate_shared<int64_t>(allocator, i));
+        if (values.size() > 10) values.erase(values.begin());
+      }
+    }));
+  }
+  threads.clear();  // Joins all threads.
+  EXPECT_EQ(pool->num_allocated(), 0);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
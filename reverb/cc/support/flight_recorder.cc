@@ -0,0 +1,126 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/flight_recorder.h"
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "absl/random/random.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Process ids under which the spans of each side are reported.
+int TraceProcessId(TraceSide side) {
+  return side == TraceSide::kClient ? 1 : 2;
+}
+
+}  // namespace
+
+FlightRecorder::FlightRecorder(int capacity) : capacity_(capacity) {
+  REVERB_CHECK_GT(capacity_, 0);
+}
+
+FlightRecorder* FlightRecorder::Default() {
+  static auto* const recorder = new FlightRecorder();
+  return recorder;
+}
+
+void FlightRecorder::Record(uint64_t trace_id, TraceSide side,
+                            const char* stage, absl::Time start,
+                            absl::Time end) {
+  if (trace_id == 0) return;
+  TraceSpan span{trace_id, side, stage, start, end};
+  absl::MutexLock lock(&mu_);
+  if (spans_.size() < capacity_) {
+    spans_.push_back(span);
+    return;
+  }
+  spans_[next_] = span;
+  next_ = (next_ + 1) % capacity_;
+}
+
+std::vector<TraceSpan> FlightRecorder::Spans() const {
+  absl::MutexLock lock(&mu_);
+  std::vector<TraceSpan> spans;
+  spans.reserve(spans_.size());
+  spans.insert(spans.end(), spans_.begin() + next_, spans_.end());
+  spans.insert(spans.end(), spans_.begin(), spans_.begin() + next_);
+  return spans;
+}
+
+std::string FlightRecorder::ToChromeTraceJson() const {
+  std::string json = R"({"displayTimeUnit":"ns","traceEvents":[)";
+  for (TraceSide side : {TraceSide::kClient, TraceSide::kServer}) {
+    absl::StrAppend(
+        &json, R"({"name":"process_name","ph":"M","pid":)",
+        TraceProcessId(side), R"(,"args":{"name":"reverb )",
+        side == TraceSide::kClient ? "client" : "server", R"("}},)");
+  }
+  bool first = true;
+  for (const TraceSpan& span : Spans()) {
+    absl::StrAppend(
+        &json, first ? "" : ",", R"({"name":")", span.stage,
+        R"(","cat":"reverb","ph":"X","ts":)",
+        absl::ToDoubleMicroseconds(span.start - absl::UnixEpoch()),
+        R"(,"dur":)", absl::ToDoubleMicroseconds(span.end - span.start),
+        R"(,"pid":)", TraceProcessId(span.side),
+        // Thread ids must fit in 32 bits.
+        R"(,"tid":)", span.trace_id & 0x7FFFFFFF, R"(,"args":{"trace_id":")",
+        absl::Hex(span.trace_id, absl::kZeroPad16), R"("}})");
+    first = false;
+  }
+  absl::StrAppend(&json, "]}");
+  return json;
+}
+
+void FlightRecorder::Clear() {
+  absl::MutexLock lock(&mu_);
+  spans_.clear();
+  next_ = 0;
+}
+
+TraceSampler::TraceSampler(int64_t period) : period_(period) {
+  REVERB_CHECK_GE(period_, 0);
+}
+
+uint64_t TraceSampler::MaybeStartTrace() {
+  if (period_ == 0) return 0;
+  if (num_requests_.fetch_add(1, std::memory_order_relaxed) % period_ != 0) {
+    return 0;
+  }
+  return NewTraceId();
+}
+
+uint64_t NewTraceId() {
+  static absl::Mutex mu(absl::kConstInit);
+  static auto* const bit_gen = new absl::BitGen;
+  absl::MutexLock lock(&mu);
+  return absl::Uniform<uint64_t>(*bit_gen, 1,
+                                 std::numeric_limits<uint64_t>::max());
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,111 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// In-memory flight recorder of the stages sampled requests go through on their
+// way from a table to the learner. Each traced request is assigned a random
+// id which is sent along with the request so that the spans recorded by the
+// client and by the server can be joined. Only one in every N requests is
+// traced (see `TraceSampler`) and the recorder keeps the most recent spans in
+// a ring buffer of fixed size, so tracing can be left enabled in production.
+//
+// The spans can be dumped in the Chrome trace event format, which can be
+// loaded in chrome://tracing or https://ui.perfetto.dev.
+
+#ifndef REVERB_CC_SUPPORT_FLIGHT_RECORDER_H_
+#define REVERB_CC_SUPPORT_FLIGHT_RECORDER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Which end of the connection recorded a span.
+enum class TraceSide { kClient, kServer };
+
+struct TraceSpan {
+  uint64_t trace_id;
+  TraceSide side;
+  // Name of the stage. Must have static storage duration.
+  const char* stage;
+  absl::Time start;
+  absl::Time end;
+};
+
+// Thread safe ring buffer of the most recently recorded spans.
+class FlightRecorder {
+ public:
+  static constexpr int kDefaultCapacity = 16384;
+
+  explicit FlightRecorder(int capacity = kDefaultCapacity);
+
+  // Recorder shared by all clients and servers of the process.
+  static FlightRecorder* Default();
+
+  // Records that the request identified by `trace_id` spent [`start`, `end`)
+  // in `stage`. Spans with `trace_id` 0 (i.e requests which aren't traced)
+  // are ignored. Once the buffer is full the oldest span is overwritten.
+  void Record(uint64_t trace_id, TraceSide side, const char* stage,
+              absl::Time start, absl::Time end);
+
+  // Recorded spans, oldest first.
+  std::vector<TraceSpan> Spans() const;
+
+  // Serializes the recorded spans as a Chrome trace (JSON object format). The
+  // spans of the client and the server are reported as separate processes and
+  // the spans of each request as a separate thread.
+  std::string ToChromeTraceJson() const;
+
+  void Clear();
+
+ private:
+  const int capacity_;
+
+  mutable absl::Mutex mu_;
+  std::vector<TraceSpan> spans_ ABSL_GUARDED_BY(mu_);
+  // Position in `spans_` which is written next once the buffer is full.
+  int next_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+// Selects one in every `period` requests for tracing.
+class TraceSampler {
+ public:
+  // A `period` of 0 disables tracing.
+  explicit TraceSampler(int64_t period);
+
+  // Returns a new (non zero) trace id if the next request should be traced
+  // and 0 otherwise.
+  uint64_t MaybeStartTrace();
+
+ private:
+  const int64_t period_;
+  std::atomic<int64_t> num_requests_{0};
+};
+
+// Returns a random, non zero, trace id.
+uint64_t NewTraceId();
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_FLIGHT_RECORDER_H_
@@ -0,0 +1,102 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/flight_recorder.h"
+
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Field;
+using ::testing::HasSubstr;
+using ::testing::IsEmpty;
+
+const absl::Time kStart = absl::FromUnixMicros(1000);
+
+TEST(FlightRecorderTest, IgnoresUntracedRequests) {
+  FlightRecorder recorder;
+  recorder.Record(0, TraceSide::kClient, "stage", kStart, kStart);
+  EXPECT_THAT(recorder.Spans(), IsEmpty());
+}
+
+TEST(FlightRecorderTest, OverwritesOldestSpans) {
+  FlightRecorder recorder(/*capacity=*/3);
+  for (uint64_t id = 1; id <= 5; id++) {
+    recorder.Record(id, TraceSide::kServer, "stage", kStart, kStart);
+  }
+  EXPECT_THAT(recorder.Spans(),
+              ElementsAre(Field(&TraceSpan::trace_id, 3),
+                          Field(&TraceSpan::trace_id, 4),
+                          Field(&TraceSpan::trace_id, 5)));
+
+  recorder.Clear();
+  EXPECT_THAT(recorder.Spans(), IsEmpty());
+}
+
+TEST(FlightRecorderTest, ToChromeTraceJson) {
+  FlightRecorder recorder;
+  recorder.Record(0x11, TraceSide::kClient, "PopNextSample", kStart,
+                  kStart + absl::Microseconds(5));
+  recorder.Record(0x11, TraceSide::kServer, "SampleStream", kStart,
+                  kStart + absl::Microseconds(2));
+
+  const std::string json = recorder.ToChromeTraceJson();
+  EXPECT_THAT(json, HasSubstr(R"("args":{"name":"reverb client"})"));
+  EXPECT_THAT(json, HasSubstr(R"("args":{"name":"reverb server"})"));
+  EXPECT_THAT(json,
+              HasSubstr(R"({"name":"PopNextSample","cat":"reverb","ph":"X",)"
+                        R"("ts":1000,"dur":5,"pid":1,"tid":17,)"
+                        R"("args":{"trace_id":"0000000000000011"}})"));
+  EXPECT_THAT(json, HasSubstr(R"({"name":"SampleStream","cat":"reverb",)"
+                              R"("ph":"X","ts":1000,"dur":2,"pid":2,)"));
+  EXPECT_EQ(json.back(), '}');
+}
+
+TEST(TraceSamplerTest, DisabledSamplerNeverTraces) {
+  TraceSampler sampler(/*period=*/0);
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(sampler.MaybeStartTrace(), 0);
+  }
+}
+
+TEST(TraceSamplerTest, TracesOneInEveryPeriodRequests) {
+  TraceSampler sampler(/*period=*/3);
+  std::vector<bool> traced;
+  for (int i = 0; i < 7; i++) {
+    traced.push_back(sampler.MaybeStartTrace() != 0);
+  }
+  EXPECT_THAT(traced, ElementsAre(true, false, false, true, false, false,
+                                  true));
+}
+
+TEST(TraceSamplerTest, NewTraceIdIsNeverZero) {
+  for (int i = 0; i < 100; i++) {
+    EXPECT_NE(NewTraceId(), 0);
+  }
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
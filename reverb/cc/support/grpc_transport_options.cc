@@ -0,0 +1,127 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/grpc_transport_options.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "grpcpp/grpcpp.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+constexpr int kMinHttp2FrameSize = 16 * 1024;
+constexpr int kMaxHttp2FrameSize = 16 * 1024 * 1024;
+
+}  // namespace
+
+absl::Status GrpcTransportOptions::Validate() const {
+  if (http2_stream_window_bytes < 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("http2_stream_window_bytes must be >= 0 but got ",
+                     http2_stream_window_bytes, "."));
+  }
+  if (http2_max_frame_size != 0 &&
+      (http2_max_frame_size < kMinHttp2FrameSize ||
+       http2_max_frame_size >= kMaxHttp2FrameSize)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "http2_max_frame_size must be 0 or in [", kMinHttp2FrameSize, ", ",
+        kMaxHttp2FrameSize, ") but got ", http2_max_frame_size, "."));
+  }
+  if (http2_write_buffer_size < 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("http2_write_buffer_size must be >= 0 but got ",
+                     http2_write_buffer_size, "."));
+  }
+  if (num_channels < 1) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "num_channels must be >= 1 but got ", num_channels, "."));
+  }
+  if (keepalive_time < absl::ZeroDuration()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("keepalive_time must be >= 0 but got ",
+                     absl::FormatDuration(keepalive_time), "."));
+  }
+  if (keepalive_timeout < absl::ZeroDuration()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("keepalive_timeout must be >= 0 but got ",
+                     absl::FormatDuration(keepalive_timeout), "."));
+  }
+  return absl::OkStatus();
+}
+
+std::vector<std::pair<std::string, int>> GrpcTransportOptions::ChannelArgs(
+    bool is_server) const {
+  std::vector<std::pair<std::string, int>> args;
+  if (http2_stream_window_bytes > 0) {
+    args.emplace_back(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES,
+                      http2_stream_window_bytes);
+  }
+  if (http2_bdp_probe.has_value()) {
+    args.emplace_back(GRPC_ARG_HTTP2_BDP_PROBE, *http2_bdp_probe ? 1 : 0);
+  }
+  if (http2_max_frame_size > 0) {
+    args.emplace_back(GRPC_ARG_HTTP2_MAX_FRAME_SIZE, http2_max_frame_size);
+  }
+  if (http2_write_buffer_size > 0) {
+    args.emplace_back(GRPC_ARG_HTTP2_WRITE_BUFFER_SIZE,
+                      http2_write_buffer_size);
+  }
+  if (keepalive_time > absl::ZeroDuration()) {
+    const int keepalive_time_ms = absl::ToInt64Milliseconds(keepalive_time);
+    args.emplace_back(GRPC_ARG_KEEPALIVE_TIME_MS, keepalive_time_ms);
+    if (is_server) {
+      args.emplace_back(GRPC_ARG_HTTP2_MIN_RECV_PING_INTERVAL_WITHOUT_DATA_MS,
+                        keepalive_time_ms);
+    }
+  }
+  if (keepalive_timeout > absl::ZeroDuration()) {
+    args.emplace_back(GRPC_ARG_KEEPALIVE_TIMEOUT_MS,
+                      absl::ToInt64Milliseconds(keepalive_timeout));
+  }
+  if (keepalive_permit_without_calls.has_value()) {
+    args.emplace_back(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS,
+                      *keepalive_permit_without_calls ? 1 : 0);
+    if (*keepalive_permit_without_calls) {
+      // Otherwise only a couple of pings are sent before data has to be sent.
+      args.emplace_back(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, 0);
+    }
+  }
+  if (compress_streams) {
+    args.emplace_back(GRPC_COMPRESSION_CHANNEL_DEFAULT_ALGORITHM,
+                      GRPC_COMPRESS_GZIP);
+  }
+  return args;
+}
+
+void GrpcTransportOptions::ApplyTo(grpc::ChannelArguments* arguments) const {
+  for (const auto& [name, value] : ChannelArgs(/*is_server=*/false)) {
+    arguments->SetInt(name, value);
+  }
+}
+
+void GrpcTransportOptions::ApplyTo(grpc::ServerBuilder* builder) const {
+  for (const auto& [name, value] : ChannelArgs(/*is_server=*/true)) {
+    builder->AddChannelArgument(name, value);
+  }
+}
+
+}  // namespace reverb
+}  // namespace deepmind
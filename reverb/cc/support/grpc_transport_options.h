@@ -0,0 +1,104 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_GRPC_TRANSPORT_OPTIONS_H_
+#define REVERB_CC_SUPPORT_GRPC_TRANSPORT_OPTIONS_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "grpcpp/grpcpp.h"
+#include "absl/status/status.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Tuning of the gRPC transport between clients and servers. The defaults
+// leave all settings to gRPC, which is tuned for connections with low latency.
+// Connections with a large bandwidth delay product (e.g across datacenters)
+// usually need larger flow control windows to be saturated. The same options
+// should be used on both ends of a connection.
+struct GrpcTransportOptions {
+  // Checks that field values are valid and returns `InvalidArgument` if any
+  // field value is invalid.
+  absl::Status Validate() const;
+
+  // Number of bytes that the peer may send on a stream before it has been
+  // read, i.e the initial HTTP/2 flow control window of every stream. 0
+  // leaves the window to gRPC.
+  int http2_stream_window_bytes = 0;
+
+  // Whether gRPC grows the flow control windows by probing the bandwidth delay
+  // product of the connection. Unset leaves the decision to gRPC (which probes
+  // by default).
+  absl::optional<bool> http2_bdp_probe = absl::nullopt;
+
+  // Maximum size of the HTTP/2 frames received, must be in [16KB, 16MB). 0
+  // leaves the size to gRPC.
+  int http2_max_frame_size = 0;
+
+  // Number of bytes gRPC buffers before writes to a stream block. 0 leaves the
+  // size to gRPC.
+  int http2_write_buffer_size = 0;
+
+  // How often a keepalive ping is sent on idle connections and how long to
+  // wait for it to be acknowledged before closing the connection. Zero leaves
+  // the value to gRPC. Servers accept pings as often as `keepalive_time` so
+  // clients and servers using the same options don't reject each other.
+  absl::Duration keepalive_time = absl::ZeroDuration();
+  absl::Duration keepalive_timeout = absl::ZeroDuration();
+
+  // Whether keepalive pings are sent (clients) or accepted (servers) when the
+  // connection has no calls in flight. Unset leaves the decision to gRPC.
+  absl::optional<bool> keepalive_permit_without_calls = absl::nullopt;
+
+  // Compresses the messages of the insert and sample streams with gzip. The
+  // streams are sent uncompressed by default since the chunks are already
+  // compressed, but compression can still help on slow links when chunks are
+  // stored without compression. Only the `TrajectoryWriter`s created by a
+  // client with this option compress their requests.
+  bool compress_streams = false;
+
+  // Number of channels (and thus TCP connections) a client opens to the
+  // server. The streams of samplers and writers are spread round-robin over
+  // the channels so that high bandwidth clients are not limited by a single
+  // connection. Unary calls always use the first channel. Ignored by servers.
+  int num_channels = 1;
+
+  // The channel arguments implementing the options.
+  std::vector<std::pair<std::string, int>> ChannelArgs(bool is_server) const;
+
+  // Adds the channel arguments to `arguments` (clients) and `builder`
+  // (servers).
+  void ApplyTo(grpc::ChannelArguments* arguments) const;
+  void ApplyTo(grpc::ServerBuilder* builder) const;
+};
+
+// Options of the messages written to streams. Streams are not compressed
+// unless `compress` is set (see `GrpcTransportOptions::compress_streams`).
+inline grpc::WriteOptions StreamWriteOptions(bool compress) {
+  grpc::WriteOptions options;
+  if (!compress) {
+    options.set_no_compression();
+  }
+  return options;
+}
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_GRPC_TRANSPORT_OPTIONS_H_
@@ -0,0 +1,104 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/grpc_transport_options.h"
+
+#include <string>
+#include <utility>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/status_matchers.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using ::testing::Contains;
+using ::testing::IsEmpty;
+using ::testing::Not;
+using ::testing::Pair;
+
+TEST(GrpcTransportOptionsTest, DefaultsLeaveEverythingToGrpc) {
+  GrpcTransportOptions options;
+  REVERB_EXPECT_OK(options.Validate());
+  EXPECT_THAT(options.ChannelArgs(/*is_server=*/false), IsEmpty());
+  EXPECT_THAT(options.ChannelArgs(/*is_server=*/true), IsEmpty());
+}
+
+TEST(GrpcTransportOptionsTest, SetsFlowControlArgs) {
+  GrpcTransportOptions options;
+  options.http2_stream_window_bytes = 8 << 20;
+  options.http2_bdp_probe = false;
+  options.http2_max_frame_size = 1 << 20;
+  auto args = options.ChannelArgs(/*is_server=*/false);
+  EXPECT_THAT(args,
+              Contains(Pair(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES, 8 << 20)));
+  EXPECT_THAT(args, Contains(Pair(GRPC_ARG_HTTP2_BDP_PROBE, 0)));
+  EXPECT_THAT(args, Contains(Pair(GRPC_ARG_HTTP2_MAX_FRAME_SIZE, 1 << 20)));
+}
+
+TEST(GrpcTransportOptionsTest, ServersAcceptPingsAsOftenAsTheyAreSent) {
+  GrpcTransportOptions options;
+  options.keepalive_time = absl::Seconds(10);
+  options.keepalive_timeout = absl::Seconds(5);
+
+  auto client_args = options.ChannelArgs(/*is_server=*/false);
+  EXPECT_THAT(client_args, Contains(Pair(GRPC_ARG_KEEPALIVE_TIME_MS, 10000)));
+  EXPECT_THAT(client_args,
+              Contains(Pair(GRPC_ARG_KEEPALIVE_TIMEOUT_MS, 5000)));
+  EXPECT_THAT(client_args,
+              Not(Contains(Pair(
+                  GRPC_ARG_HTTP2_MIN_RECV_PING_INTERVAL_WITHOUT_DATA_MS,
+                  ::testing::_))));
+
+  EXPECT_THAT(options.ChannelArgs(/*is_server=*/true),
+              Contains(Pair(
+                  GRPC_ARG_HTTP2_MIN_RECV_PING_INTERVAL_WITHOUT_DATA_MS,
+                  10000)));
+}
+
+TEST(GrpcTransportOptionsTest, CompressStreamsSetsDefaultAlgorithm) {
+  GrpcTransportOptions options;
+  options.compress_streams = true;
+  EXPECT_THAT(options.ChannelArgs(/*is_server=*/true),
+              Contains(Pair(GRPC_COMPRESSION_CHANNEL_DEFAULT_ALGORITHM,
+                            GRPC_COMPRESS_GZIP)));
+  EXPECT_FALSE(StreamWriteOptions(/*compress=*/true).get_no_compression());
+  EXPECT_TRUE(StreamWriteOptions(/*compress=*/false).get_no_compression());
+}
+
+TEST(GrpcTransportOptionsTest, ValidateRejectsInvalidValues) {
+  GrpcTransportOptions options;
+  options.http2_stream_window_bytes = -1;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+
+  options = GrpcTransportOptions();
+  options.http2_max_frame_size = 1024;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+
+  options = GrpcTransportOptions();
+  options.keepalive_time = -absl::Seconds(1);
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+
+  options = GrpcTransportOptions();
+  options.num_channels = 0;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
@@ -150,6 +150,25 @@ class IntrusiveHeap {
     FixHeapUp(t);
   }
 
+  // Insert all of 'ts' into the heap. If 'ts' is at least as large as the
+  // current heap then the heap is rebuilt bottom-up (Floyd's method), which
+  // takes O(n) time rather than the O(k log n) of pushing the elements one at a
+  // time.
+  void PushBatch(const std::vector<pointer>& ts) {
+    if (ts.size() < heap().size()) {
+      for (pointer t : ts) Push(t);
+      return;
+    }
+    heap().reserve(heap().size() + ts.size());
+    for (pointer t : ts) {
+      SetPositionOf(t, heap().size());
+      heap().push_back(t);
+    }
+    for (size_type h = heap().size() / 2; h > 0; --h) {
+      FixHeapDown(heap()[h - 1]);
+    }
+  }
+
   // Adjust the heap to accommodate changes in '*t'.
   void Adjust(pointer t) {
     REVERB_CHECK(Contains(t));
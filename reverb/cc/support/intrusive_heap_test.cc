@@ -108,6 +108,38 @@ TEST_F(IntrusiveHeapTest, PushPop) {
   VerifyHeap();
 }
 
+TEST_F(IntrusiveHeapTest, PushBatchIntoEmptyHeap) {
+  elems_.resize(kNumElems);
+  std::vector<Elem*> batch;
+  for (int i = 0; i < kNumElems; i++) {
+    elems_[i].val = absl::Uniform<uint32_t>(rnd_);
+    elems_[i].iota = i;
+    batch.push_back(&elems_[i]);
+    expected_.push_back(elems_[i]);
+  }
+  heap_.PushBatch(batch);
+  for (Elem& e : elems_) EXPECT_TRUE(heap_.Contains(&e));
+  VerifyHeap();
+}
+
+TEST_F(IntrusiveHeapTest, PushBatchIntoNonEmptyHeap) {
+  BuildHeap();
+  // Small batches are pushed one at a time and large batches rebuild the heap.
+  std::vector<Elem> small(kNumElems / 10);
+  std::vector<Elem> large(kNumElems * 2);
+  for (auto* elems : {&small, &large}) {
+    std::vector<Elem*> batch;
+    for (Elem& e : *elems) {
+      e.val = absl::Uniform<uint32_t>(rnd_);
+      e.iota = expected_.size();
+      batch.push_back(&e);
+      expected_.push_back(e);
+    }
+    heap_.PushBatch(batch);
+  }
+  VerifyHeap();
+}
+
 TEST_F(IntrusiveHeapTest, Clear) {
   Elem dummy;
   dummy.val = 8675309;
@@ -0,0 +1,69 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/key_generators.h"
+
+#include <cstdint>
+
+#include "absl/random/random.h"
+
+namespace deepmind::reverb::internal {
+namespace {
+
+inline uint64_t RotateLeft(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+// Expands a single seed into the state of `Xoshiro256`.
+inline uint64_t SplitMix64(uint64_t* state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+// xoshiro256** by David Blackman and Sebastiano Vigna, see
+// https://prng.di.unimi.it.
+class Xoshiro256 {
+ public:
+  Xoshiro256() {
+    absl::BitGen seed_gen;
+    uint64_t seed = absl::Uniform<uint64_t>(seed_gen);
+    for (uint64_t& s : state_) s = SplitMix64(&seed);
+  }
+
+  uint64_t Next() {
+    const uint64_t result = RotateLeft(state_[1] * 5, 7) * 9;
+    const uint64_t t = state_[1] << 17;
+    state_[2] ^= state_[0];
+    state_[3] ^= state_[1];
+    state_[1] ^= state_[2];
+    state_[0] ^= state_[3];
+    state_[2] ^= t;
+    state_[3] = RotateLeft(state_[3], 45);
+    return result;
+  }
+
+ private:
+  uint64_t state_[4];
+};
+
+}  // namespace
+
+uint64_t ThreadLocalKeyGenerator::Generate() {
+  static thread_local Xoshiro256 generator;
+  return generator.Next();
+}
+
+}  // namespace deepmind::reverb::internal
@@ -15,6 +15,7 @@
 #ifndef REVERB_CC_SUPPORT_KEY_GENERATORS_H_
 #define REVERB_CC_SUPPORT_KEY_GENERATORS_H_
 
+#include <cstdint>
 #include <limits>
 
 #include "absl/random/random.h"
@@ -25,6 +26,12 @@ class KeyGenerator {
  public:
   virtual ~KeyGenerator() = default;
   virtual uint64_t Generate() = 0;
+
+  // Reserves the `n` consecutive keys [first, first + n) (wrapping around at
+  // the maximum key) and returns `first`. A random range is as unlikely to
+  // collide with other keys as `n` independently generated keys but costs a
+  // single call.
+  virtual uint64_t ReserveRange(int n) { return Generate(); }
 };
 
 class UniformKeyGenerator : public KeyGenerator {
@@ -38,6 +45,39 @@ class UniformKeyGenerator : public KeyGenerator {
   absl::BitGen bit_gen_;
 };
 
+// Generates keys with a xoshiro256** generator owned by the calling thread,
+// which is seeded from `absl::BitGen` the first time the thread generates a
+// key. Much cheaper than `UniformKeyGenerator` and has no state of its own so
+// instances are free to create and can be shared between threads.
+class ThreadLocalKeyGenerator : public KeyGenerator {
+ public:
+  uint64_t Generate() override;
+};
+
+// Hands out keys from ranges reserved with `KeyGenerator::ReserveRange`. A
+// new range of `range_size` keys is reserved whenever the previous one has
+// been used up. Not thread safe.
+class KeyRangeAllocator {
+ public:
+  KeyRangeAllocator(KeyGenerator* generator, int range_size)
+      : generator_(generator), range_size_(range_size) {}
+
+  uint64_t Next() {
+    if (remaining_ == 0) {
+      next_ = generator_->ReserveRange(range_size_);
+      remaining_ = range_size_;
+    }
+    --remaining_;
+    return next_++;
+  }
+
+ private:
+  KeyGenerator* generator_;
+  const int range_size_;
+  uint64_t next_ = 0;
+  int remaining_ = 0;
+};
+
 }  // namespace deepmind::reverb::internal
 
 #endif  // REVERB_CC_SUPPORT_KEY_GENERATORS_H_
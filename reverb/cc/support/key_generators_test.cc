@@ -0,0 +1,89 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/key_generators.h"
+
+#include <cstdint>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/container/flat_hash_set.h"
+
+namespace deepmind::reverb::internal {
+namespace {
+
+class CountingKeyGenerator : public KeyGenerator {
+ public:
+  uint64_t Generate() override { return 1000 * ++num_calls_; }
+
+  int num_calls() const { return num_calls_; }
+
+ private:
+  int num_calls_ = 0;
+};
+
+TEST(ThreadLocalKeyGeneratorTest, GeneratesDistinctKeys) {
+  ThreadLocalKeyGenerator generator;
+  absl::flat_hash_set<uint64_t> keys;
+  for (int i = 0; i < 10000; i++) {
+    EXPECT_TRUE(keys.insert(generator.Generate()).second);
+  }
+}
+
+TEST(ThreadLocalKeyGeneratorTest, InstancesOnTheSameThreadShareState) {
+  ThreadLocalKeyGenerator a;
+  ThreadLocalKeyGenerator b;
+  absl::flat_hash_set<uint64_t> keys;
+  for (int i = 0; i < 1000; i++) {
+    EXPECT_TRUE(keys.insert(a.Generate()).second);
+    EXPECT_TRUE(keys.insert(b.Generate()).second);
+  }
+}
+
+TEST(ThreadLocalKeyGeneratorTest, ThreadsAreSeededIndependently) {
+  ThreadLocalKeyGenerator generator;
+  std::vector<std::vector<uint64_t>> keys(4);
+  std::vector<std::thread> threads;
+  for (auto& thread_keys : keys) {
+    threads.emplace_back([&generator, &thread_keys] {
+      for (int i = 0; i < 1000; i++) {
+        thread_keys.push_back(generator.Generate());
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  absl::flat_hash_set<uint64_t> unique_keys;
+  for (const auto& thread_keys : keys) {
+    unique_keys.insert(thread_keys.begin(), thread_keys.end());
+  }
+  EXPECT_EQ(unique_keys.size(), 4000);
+}
+
+TEST(KeyRangeAllocatorTest, ReservesRangesWhenUsedUp) {
+  CountingKeyGenerator generator;
+  KeyRangeAllocator allocator(&generator, 3);
+  std::vector<uint64_t> keys;
+  for (int i = 0; i < 7; i++) {
+    keys.push_back(allocator.Next());
+  }
+  EXPECT_THAT(keys,
+              ::testing::ElementsAre(1000, 1001, 1002, 2000, 2001, 2002, 3000));
+  EXPECT_EQ(generator.num_calls(), 3);
+}
+
+}  // namespace
+}  // namespace deepmind::reverb::internal
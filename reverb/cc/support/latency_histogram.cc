@@ -0,0 +1,101 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/latency_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "absl/numeric/bits.h"
+#include "absl/time/time.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+int BucketIndex(int64_t micros) {
+  if (micros <= 0) return 0;
+  // Durations in [2^(i-1), 2^i) have a bit width of `i`.
+  return std::min<int>(absl::bit_width(static_cast<uint64_t>(micros)),
+                       LatencyHistogram::kNumBuckets - 1);
+}
+
+}  // namespace
+
+int64_t LatencyHistogram::BucketLimitMicros(int i) {
+  if (i >= kNumBuckets - 1) return std::numeric_limits<int64_t>::max();
+  return int64_t{1} << i;
+}
+
+void LatencyHistogram::Record(absl::Duration duration) {
+  const int64_t micros =
+      std::max<int64_t>(absl::ToInt64Microseconds(duration), 0);
+  buckets_[BucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_us_.fetch_add(micros, std::memory_order_relaxed);
+  int64_t max = max_us_.load(std::memory_order_relaxed);
+  while (micros > max && !max_us_.compare_exchange_weak(
+                             max, micros, std::memory_order_relaxed)) {
+  }
+}
+
+int64_t LatencyHistogram::count() const {
+  return count_.load(std::memory_order_relaxed);
+}
+
+absl::Duration LatencyHistogram::Quantile(double q) const {
+  std::array<int64_t, kNumBuckets> counts;
+  int64_t total = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) return absl::ZeroDuration();
+
+  // Rank (1-based) of the requested quantile among the recorded durations.
+  const int64_t rank = std::max<int64_t>(
+      1, static_cast<int64_t>(std::ceil(std::clamp(q, 0.0, 1.0) * total)));
+  int64_t seen = 0;
+  for (int i = 0; i < kNumBuckets - 1; ++i) {
+    seen += counts[i];
+    if (seen >= rank) return absl::Microseconds(BucketLimitMicros(i));
+  }
+  return absl::InfiniteDuration();
+}
+
+void LatencyHistogram::ToProto(LatencyDistribution* proto) const {
+  proto->Clear();
+  int last_non_empty = -1;
+  std::array<int64_t, kNumBuckets> counts;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    if (counts[i] > 0) last_non_empty = i;
+  }
+  for (int i = 0; i <= last_non_empty; ++i) {
+    proto->add_bucket_limit_us(BucketLimitMicros(i));
+    proto->add_bucket_count(counts[i]);
+  }
+  proto->set_count(count_.load(std::memory_order_relaxed));
+  proto->set_sum_us(sum_us_.load(std::memory_order_relaxed));
+  proto->set_max_us(max_us_.load(std::memory_order_relaxed));
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,71 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SUPPORT_LATENCY_HISTOGRAM_H_
+#define REVERB_CC_SUPPORT_LATENCY_HISTOGRAM_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "absl/time/time.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Distribution of durations over exponentially growing buckets. Bucket 0
+// counts durations shorter than 1us and bucket `i > 0` those in
+// [2^(i-1)us, 2^i us). The last bucket has no upper limit.
+//
+// Thread safe. `Record` only performs relaxed atomic increments so it can be
+// called while holding hot locks.
+class LatencyHistogram {
+ public:
+  static constexpr int kNumBuckets = 34;
+
+  // Adds `duration` to the distribution. Negative durations are recorded as
+  // zero.
+  void Record(absl::Duration duration);
+
+  // Number of recorded durations.
+  int64_t count() const;
+
+  // Upper bound of the bucket containing the `q`-quantile (with `q` in
+  // [0, 1]) of the recorded durations. Returns `absl::ZeroDuration()` if
+  // nothing has been recorded and `absl::InfiniteDuration()` if the quantile
+  // falls in the last bucket.
+  absl::Duration Quantile(double q) const;
+
+  // Serializes the distribution. Buckets after the last non-empty one are
+  // omitted.
+  void ToProto(LatencyDistribution* proto) const;
+
+  // Upper bound (exclusive) of bucket `i`, in microseconds.
+  static int64_t BucketLimitMicros(int i);
+
+ private:
+  std::array<std::atomic<int64_t>, kNumBuckets> buckets_{};
+  std::atomic<int64_t> count_{0};
+  std::atomic<int64_t> sum_us_{0};
+  std::atomic<int64_t> max_us_{0};
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_LATENCY_HISTOGRAM_H_
@@ -0,0 +1,111 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/latency_histogram.h"
+
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::ElementsAre;
+
+TEST(LatencyHistogramTest, EmptyHistogram) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.count(), 0);
+  EXPECT_EQ(histogram.Quantile(0.5), absl::ZeroDuration());
+
+  LatencyDistribution proto;
+  histogram.ToProto(&proto);
+  EXPECT_EQ(proto.count(), 0);
+  EXPECT_EQ(proto.bucket_count_size(), 0);
+}
+
+TEST(LatencyHistogramTest, CountsDurationsInExponentialBuckets) {
+  LatencyHistogram histogram;
+  histogram.Record(absl::Nanoseconds(500));
+  histogram.Record(absl::Microseconds(1));
+  histogram.Record(absl::Microseconds(3));
+  histogram.Record(absl::Microseconds(3));
+  histogram.Record(absl::Microseconds(-5));
+
+  LatencyDistribution proto;
+  histogram.ToProto(&proto);
+  EXPECT_EQ(proto.count(), 5);
+  EXPECT_EQ(proto.sum_us(), 7);
+  EXPECT_EQ(proto.max_us(), 3);
+  EXPECT_THAT(proto.bucket_limit_us(), ElementsAre(1, 2, 4));
+  EXPECT_THAT(proto.bucket_count(), ElementsAre(2, 1, 2));
+}
+
+TEST(LatencyHistogramTest, LongDurationsGoToTheLastBucket) {
+  LatencyHistogram histogram;
+  histogram.Record(absl::Hours(100));
+
+  LatencyDistribution proto;
+  histogram.ToProto(&proto);
+  ASSERT_EQ(proto.bucket_count_size(), LatencyHistogram::kNumBuckets);
+  EXPECT_EQ(proto.bucket_count(LatencyHistogram::kNumBuckets - 1), 1);
+  EXPECT_EQ(proto.bucket_limit_us(LatencyHistogram::kNumBuckets - 1),
+            std::numeric_limits<int64_t>::max());
+  EXPECT_EQ(histogram.Quantile(1), absl::InfiniteDuration());
+}
+
+TEST(LatencyHistogramTest, Quantile) {
+  LatencyHistogram histogram;
+  for (int i = 0; i < 99; i++) {
+    histogram.Record(absl::Microseconds(10));
+  }
+  histogram.Record(absl::Milliseconds(10));
+
+  EXPECT_EQ(histogram.Quantile(0), absl::Microseconds(16));
+  EXPECT_EQ(histogram.Quantile(0.5), absl::Microseconds(16));
+  EXPECT_EQ(histogram.Quantile(0.99), absl::Microseconds(16));
+  EXPECT_EQ(histogram.Quantile(1), absl::Microseconds(16384));
+}
+
+TEST(LatencyHistogramTest, ConcurrentRecords) {
+  LatencyHistogram histogram;
+  std::vector<std::unique_ptr<Thread>> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.push_back(StartThread("", [&histogram, i] {
+      for (int j = 0; j < 1000; j++) {
+        histogram.Record(absl::Microseconds(i));
+      }
+    }));
+  }
+  threads.clear();  // Joins the threads.
+
+  LatencyDistribution proto;
+  histogram.ToProto(&proto);
+  EXPECT_EQ(proto.count(), 8000);
+  EXPECT_EQ(proto.sum_us(), 28000);
+  EXPECT_EQ(proto.max_us(), 7);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,353 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_LOCK_FREE_QUEUE_H_
+#define REVERB_CC_SUPPORT_LOCK_FREE_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Bounded multi-producer multi-consumer queue with the same interface and
+// semantics as `Queue` (see queue.h) but without a lock on the fast path.
+//
+// The buffer is a ring of cells which each hold a sequence number (Vyukov's
+// bounded MPMC queue). Producers and consumers claim a position by advancing
+// an atomic counter and the sequence number of the cell tells whether the cell
+// is ready to be written (or read) for that position. Threads only fall back to
+// blocking on a mutex and condition variable when the queue is full (`Push`)
+// or does not contain enough items (`Pop` and `PopBatch`). The mutex is only
+// acquired by the other side when there are blocked threads to wake up.
+//
+// Differences to `Queue`:
+//   * Calls to `Push` which race with `Close` or `SetLastItemPushed` may
+//     succeed even though the queue is closed immediately after.
+//   * `num_waiting_to_pop` and `num_waiting_to_push` only count threads which
+//     are blocked (or about to block) rather than every ongoing call.
+template <typename T>
+class LockFreeQueue {
+ public:
+  // `capacity` is the maximum number of elements which the queue can hold.
+  explicit LockFreeQueue(int capacity)
+      : capacity_(capacity), cells_(new Cell[capacity]) {
+    REVERB_CHECK_GT(capacity_, 0);
+    for (int64_t i = 0; i < capacity_; i++) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  LockFreeQueue(const LockFreeQueue&) = delete;
+  LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+
+  // Closes the queue. All pending and future calls to `Push()` and `Pop()` are
+  // unblocked and return false without performing the operation. Additional
+  // calls of Close after the first one have no effect.
+  void Close() ABSL_LOCKS_EXCLUDED(mu_) {
+    closed_.store(true);
+    WakeAll(/*consumers=*/true, /*producers=*/true);
+  }
+
+  // Pushes an item to the queue. Blocks if the queue has reached `capacity`. On
+  // success, `true` is returned. If the queue is closed, `false` is returned.
+  bool Push(T x) ABSL_LOCKS_EXCLUDED(mu_) {
+    while (true) {
+      if (closed_.load() || last_item_pushed_.load()) return false;
+      if (TryPush(&x)) {
+        WakeConsumers();
+        return true;
+      }
+
+      absl::MutexLock lock(&mu_);
+      ScopedIncrement ticket(&num_waiting_to_push_);
+      while (!closed_.load() && !last_item_pushed_.load() && Full()) {
+        cv_.Wait(&mu_);
+      }
+    }
+  }
+
+  // Blocks until queue contains at least `batch_size` items then pops and
+  // pushes `batch_size` from the queue to `out`.
+  //
+  // Returns:
+  //   OK: If `batch_size` items could be popped before `timeout`.
+  //   InvalidArgumentError: if `batch_size` > queue size.
+  //   DeadlineExceededError: if timeout exceeded.
+  //   ResourceExhaustedError: if SetLastItemPushed called before `batch_size`
+  //     items in the queue.
+  //   CancelledError: if queue has been closed or SetLastItemPushed called on
+  //     an already empty queue.
+  //
+  absl::Status PopBatch(int batch_size, absl::Duration timeout,
+                        std::vector<T>* out) ABSL_LOCKS_EXCLUDED(mu_) {
+    if (batch_size > capacity_) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Batch size (", batch_size,
+                       ") must be <= of queue size (", capacity_, ")."));
+    }
+
+    const absl::Time deadline = absl::Now() + timeout;
+    while (true) {
+      if (closed_.load()) {
+        return absl::CancelledError("Queue is closed.");
+      }
+      if (last_item_pushed_.load()) {
+        return absl::ResourceExhaustedError(absl::StrCat(
+            "The last item have been pushed to the queue and the current size "
+            "(",
+            size(), ") is less than the batch size (", batch_size, ")."));
+      }
+      if (TryPopBatch(batch_size, out)) {
+        OnPopped();
+        return absl::OkStatus();
+      }
+
+      absl::MutexLock lock(&mu_);
+      ScopedIncrement ticket(&num_waiting_to_pop_);
+      bool timed_out = false;
+      while (!closed_.load() && !last_item_pushed_.load() &&
+             !HasReadyItems(batch_size) && !timed_out) {
+        timed_out = cv_.WaitWithDeadline(&mu_, deadline);
+      }
+      if (timed_out && !closed_.load() && !last_item_pushed_.load() &&
+          !HasReadyItems(batch_size)) {
+        return absl::DeadlineExceededError(
+            absl::StrCat("Timeout exceeded before ", batch_size,
+                         " items observed in queue."));
+      }
+    }
+  }
+
+  absl::Status PopBatch(int batch_size, std::vector<T>* out) {
+    return PopBatch(batch_size, absl::InfiniteDuration(), out);
+  }
+
+  // Marks that no more items will be pushed to the queue.
+  void SetLastItemPushed() ABSL_LOCKS_EXCLUDED(mu_) {
+    last_item_pushed_.store(true);
+    if (Empty()) {
+      closed_.store(true);
+    }
+    WakeAll(/*consumers=*/true, /*producers=*/true);
+  }
+
+  // Removes an element from the queue and move-assigns it to *item. Blocks if
+  // the queue is empty. On success, `true` is returned. If the queue was
+  // closed, `false` is returned.
+  //
+  // If called after `SetLastItemPushed` and the final item of the queue is
+  // returned then queue is closed.
+  bool Pop(T* item) ABSL_LOCKS_EXCLUDED(mu_) {
+    while (true) {
+      if (closed_.load()) return false;
+      if (TryPopBatch(1, item)) {
+        OnPopped();
+        return true;
+      }
+
+      absl::MutexLock lock(&mu_);
+      ScopedIncrement ticket(&num_waiting_to_pop_);
+      while (!closed_.load() && !HasReadyItems(1)) {
+        cv_.Wait(&mu_);
+      }
+    }
+  }
+
+  // Current number of elements.
+  int size() const {
+    const int64_t size =
+        enqueue_pos_.load(std::memory_order_acquire) -
+        dequeue_pos_.load(std::memory_order_acquire);
+    return static_cast<int>(std::min<int64_t>(std::max<int64_t>(size, 0),
+                                              capacity_));
+  }
+
+  int num_waiting_to_pop() const { return num_waiting_to_pop_.load(); }
+
+  int num_waiting_to_push() const { return num_waiting_to_push_.load(); }
+
+  int num_pushes() const {
+    return static_cast<int>(enqueue_pos_.load(std::memory_order_acquire));
+  }
+
+ private:
+  struct Cell {
+    // Equal to the position `pos` when the cell is ready to be written by the
+    // producer of `pos` and `pos + 1` when it is ready to be read by the
+    // consumer of `pos`. After being read it is set to `pos + capacity_`.
+    std::atomic<int64_t> sequence;
+    T value;
+  };
+
+  // Increments a counter while in scope.
+  class ScopedIncrement {
+   public:
+    explicit ScopedIncrement(std::atomic<int>* value) : value_(value) {
+      value_->fetch_add(1);
+      // Pairs with the fence in `WakeConsumers`/`WakeProducers` to ensure that
+      // either the waiting thread observes the new state of the queue or the
+      // other side observes the waiting thread.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+    ~ScopedIncrement() { value_->fetch_sub(1); }
+
+   private:
+    std::atomic<int>* value_;
+  };
+
+  Cell& CellAt(int64_t pos) const { return cells_[pos % capacity_]; }
+
+  // Tries to push `*x` without blocking. Returns false if the queue is full.
+  bool TryPush(T* x) {
+    int64_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = CellAt(pos);
+      const int64_t diff =
+          cell.sequence.load(std::memory_order_acquire) - pos;
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          cell.value = std::move(*x);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        // The cell has not yet been consumed since the last lap.
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Tries to pop `batch_size` items without blocking. The items are only
+  // claimed if all of them are ready so either all or none are popped.
+  template <typename Out>
+  bool TryPopBatch(int batch_size, Out* out) {
+    int64_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      if (!ItemsReadyAt(pos, batch_size)) {
+        if (pos == dequeue_pos_.load(std::memory_order_relaxed)) return false;
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (dequeue_pos_.compare_exchange_weak(pos, pos + batch_size,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    }
+    for (int64_t i = pos; i < pos + batch_size; i++) {
+      Cell& cell = CellAt(i);
+      Take(&cell.value, out);
+      cell.sequence.store(i + capacity_, std::memory_order_release);
+    }
+    return true;
+  }
+
+  static void Take(T* value, T* out) { *out = std::move(*value); }
+  static void Take(T* value, std::vector<T>* out) {
+    out->push_back(std::move(*value));
+  }
+
+  // Returns true if the `batch_size` cells starting at `pos` have been
+  // published for reading at these positions.
+  bool ItemsReadyAt(int64_t pos, int batch_size) const {
+    for (int64_t i = pos; i < pos + batch_size; i++) {
+      if (CellAt(i).sequence.load(std::memory_order_acquire) != i + 1) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool HasReadyItems(int batch_size) const {
+    return ItemsReadyAt(dequeue_pos_.load(std::memory_order_acquire),
+                        batch_size);
+  }
+
+  bool Full() const {
+    const int64_t pos = enqueue_pos_.load(std::memory_order_acquire);
+    return CellAt(pos).sequence.load(std::memory_order_acquire) < pos;
+  }
+
+  bool Empty() const {
+    return dequeue_pos_.load(std::memory_order_acquire) >=
+           enqueue_pos_.load(std::memory_order_acquire);
+  }
+
+  // Closes the queue if the last item has been popped and wakes up blocked
+  // producers.
+  void OnPopped() {
+    if (last_item_pushed_.load() && Empty()) {
+      closed_.store(true);
+      WakeAll(/*consumers=*/true, /*producers=*/true);
+      return;
+    }
+    WakeAll(/*consumers=*/false, /*producers=*/true);
+  }
+
+  void WakeConsumers() { WakeAll(/*consumers=*/true, /*producers=*/false); }
+
+  void WakeAll(bool consumers, bool producers) ABSL_LOCKS_EXCLUDED(mu_) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if ((consumers && num_waiting_to_pop_.load() > 0) ||
+        (producers && num_waiting_to_push_.load() > 0)) {
+      absl::MutexLock lock(&mu_);
+      cv_.SignalAll();
+    }
+  }
+
+  const int64_t capacity_;
+  const std::unique_ptr<Cell[]> cells_;
+
+  // Position of the next push and pop. Kept on separate cache lines to avoid
+  // false sharing between producers and consumers.
+  alignas(ABSL_CACHELINE_SIZE) std::atomic<int64_t> enqueue_pos_{0};
+  alignas(ABSL_CACHELINE_SIZE) std::atomic<int64_t> dequeue_pos_{0};
+
+  alignas(ABSL_CACHELINE_SIZE) std::atomic<bool> closed_{false};
+
+  // Whether `SetLastItemPushed()` has been called. When set then push calls are
+  // treated the same as if `Closed()` had been called. If set and the queue is
+  // empty after a pop call then `closed_` is set.
+  std::atomic<bool> last_item_pushed_{false};
+
+  // The number of threads which are currently blocked on the queue.
+  std::atomic<int> num_waiting_to_pop_{0};
+  std::atomic<int> num_waiting_to_push_{0};
+
+  // Only used to block and wake up threads when the queue is full or empty.
+  absl::Mutex mu_;
+  absl::CondVar cv_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_LOCK_FREE_QUEUE_H_
@@ -0,0 +1,203 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/lock_profiler.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "absl/time/clock.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+struct Registry {
+  absl::Mutex mu;
+  std::vector<LockSite*> sites ABSL_GUARDED_BY(mu);
+  absl::Time window_start ABSL_GUARDED_BY(mu) = absl::Now();
+};
+
+Registry* GetRegistry() {
+  static auto* const registry = new Registry;
+  return registry;
+}
+
+void UpdateMax(std::atomic<int64_t>* max, int64_t value) {
+  int64_t current = max->load(std::memory_order_relaxed);
+  while (current < value &&
+         !max->compare_exchange_weak(current, value,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+}  // namespace
+
+std::atomic<bool> LockProfiler::enabled_{false};
+
+LockSite::LockSite(const char* mutex, const char* file, int line)
+    : mutex_(mutex), file_(file), line_(line) {
+  LockProfiler::Register(this);
+}
+
+void LockSite::RecordWait(absl::Duration wait) {
+  const int64_t ns = absl::ToInt64Nanoseconds(wait);
+  contended_acquisitions_.fetch_add(1, std::memory_order_relaxed);
+  total_wait_ns_.fetch_add(ns, std::memory_order_relaxed);
+  UpdateMax(&max_wait_ns_, ns);
+}
+
+void LockSite::RecordHold(absl::Duration hold) {
+  const int64_t ns = absl::ToInt64Nanoseconds(hold);
+  acquisitions_.fetch_add(1, std::memory_order_relaxed);
+  total_hold_ns_.fetch_add(ns, std::memory_order_relaxed);
+  UpdateMax(&max_hold_ns_, ns);
+}
+
+int64_t LockSite::acquisitions() const {
+  return acquisitions_.load(std::memory_order_relaxed);
+}
+
+bool LockSite::ToProto(LockSiteStats* proto) const {
+  if (acquisitions() == 0) return false;
+  proto->set_mutex(mutex_);
+  proto->set_file(file_);
+  proto->set_line(line_);
+  proto->set_acquisitions(acquisitions());
+  proto->set_contended_acquisitions(
+      contended_acquisitions_.load(std::memory_order_relaxed));
+  proto->set_total_wait_ns(total_wait_ns_.load(std::memory_order_relaxed));
+  proto->set_max_wait_ns(max_wait_ns_.load(std::memory_order_relaxed));
+  proto->set_total_hold_ns(total_hold_ns_.load(std::memory_order_relaxed));
+  proto->set_max_hold_ns(max_hold_ns_.load(std::memory_order_relaxed));
+  return true;
+}
+
+void LockSite::Reset() {
+  for (auto* value : {&acquisitions_, &contended_acquisitions_,
+                      &total_wait_ns_, &max_wait_ns_, &total_hold_ns_,
+                      &max_hold_ns_}) {
+    value->store(0, std::memory_order_relaxed);
+  }
+}
+
+void LockProfiler::SetEnabled(bool enabled) {
+  if (enabled && !enabled_.load(std::memory_order_relaxed)) Reset();
+  enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void LockProfiler::Report(bool reset, LockContentionProfile* profile) {
+  Registry* registry = GetRegistry();
+  absl::MutexLock lock(&registry->mu);
+  const absl::Time now = absl::Now();
+  profile->set_enabled(enabled());
+  profile->set_window_ns(
+      absl::ToInt64Nanoseconds(now - registry->window_start));
+  profile->clear_sites();
+  for (const LockSite* site : registry->sites) {
+    LockSiteStats stats;
+    if (site->ToProto(&stats)) *profile->add_sites() = std::move(stats);
+  }
+  std::sort(profile->mutable_sites()->begin(), profile->mutable_sites()->end(),
+            [](const LockSiteStats& a, const LockSiteStats& b) {
+              return a.total_wait_ns() > b.total_wait_ns();
+            });
+  if (reset) {
+    for (LockSite* site : registry->sites) site->Reset();
+    registry->window_start = now;
+  }
+}
+
+void LockProfiler::Reset() {
+  Registry* registry = GetRegistry();
+  absl::MutexLock lock(&registry->mu);
+  for (LockSite* site : registry->sites) site->Reset();
+  registry->window_start = absl::Now();
+}
+
+void LockProfiler::Register(LockSite* site) {
+  Registry* registry = GetRegistry();
+  absl::MutexLock lock(&registry->mu);
+  registry->sites.push_back(site);
+}
+
+void ProfiledLockBase::LockAndRecordWait() {
+  // Only acquisitions which can't be made right away are timed.
+  if (shared_ ? mu_->ReaderTryLock() : mu_->TryLock()) {
+    acquired_at_ = absl::Now();
+    return;
+  }
+  const absl::Time wait_start = absl::Now();
+  if (shared_) {
+    mu_->ReaderLock();
+  } else {
+    mu_->Lock();
+  }
+  acquired_at_ = absl::Now();
+  site_->RecordWait(acquired_at_ - wait_start);
+}
+
+void ProfiledLockBase::RecordHold() {
+  site_->RecordHold(held_for_ + (absl::Now() - acquired_at_));
+}
+
+void ProfiledLockBase::Wait(absl::CondVar* cv) {
+  PauseHold();
+  cv->Wait(mu_);
+  ResumeHold();
+}
+
+bool ProfiledLockBase::WaitWithDeadline(absl::CondVar* cv,
+                                        absl::Time deadline) {
+  PauseHold();
+  const bool timed_out = cv->WaitWithDeadline(mu_, deadline);
+  ResumeHold();
+  return timed_out;
+}
+
+void ProfiledLockBase::Await(const absl::Condition& condition) {
+  PauseHold();
+  mu_->Await(condition);
+  ResumeHold();
+}
+
+void ProfiledLockBase::Unlocked(absl::FunctionRef<void()> fn) {
+  PauseHold();
+  if (shared_) {
+    mu_->ReaderUnlock();
+  } else {
+    mu_->Unlock();
+  }
+  fn();
+  if (shared_) {
+    mu_->ReaderLock();
+  } else {
+    mu_->Lock();
+  }
+  ResumeHold();
+}
+
+void ProfiledLockBase::PauseHold() {
+  if (site_ != nullptr) held_for_ += absl::Now() - acquired_at_;
+}
+
+void ProfiledLockBase::ResumeHold() {
+  if (site_ != nullptr) acquired_at_ = absl::Now();
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,192 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Opt-in profiling of the time threads spend waiting for, and holding, the
+// mutexes of the server. Each call site which locks a profiled mutex declares
+// a `LockSite` (see `REVERB_LOCK_SITE`) and uses one of the scoped locks below
+// instead of `absl::MutexLock`:
+//
+//   internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE("Table::mu_"));
+//
+// While profiling is disabled (the default) the scoped locks only add a relaxed
+// atomic load (and the initialization check of the site) to the lock and
+// unlock of the mutex.
+
+#ifndef REVERB_CC_SUPPORT_LOCK_PROFILER_H_
+#define REVERB_CC_SUPPORT_LOCK_PROFILER_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/functional/function_ref.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "reverb/cc/schema.pb.h"
+
+// Returns a pointer to a `LockSite` which is unique to the line it is expanded
+// on. `mutex_name` must be a string literal (or another string with static
+// storage duration).
+#define REVERB_LOCK_SITE(mutex_name)                       \
+  ([]() -> ::deepmind::reverb::internal::LockSite* {       \
+    static auto* const site =                              \
+        new ::deepmind::reverb::internal::LockSite(        \
+            mutex_name, __FILE__, __LINE__);               \
+    return site;                                           \
+  }())
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Contention statistics of a single call site. Sites register themselves with
+// the `LockProfiler` on construction and must never be destroyed.
+class LockSite {
+ public:
+  LockSite(const char* mutex, const char* file, int line);
+
+  LockSite(const LockSite&) = delete;
+  LockSite& operator=(const LockSite&) = delete;
+
+  void RecordWait(absl::Duration wait);
+  void RecordHold(absl::Duration hold);
+
+  // Number of times the mutex was released since the last `Reset`.
+  int64_t acquisitions() const;
+
+  // Returns false if the mutex hasn't been acquired since the last `Reset`.
+  bool ToProto(LockSiteStats* proto) const;
+
+  void Reset();
+
+ private:
+  const char* const mutex_;
+  const char* const file_;
+  const int line_;
+
+  std::atomic<int64_t> acquisitions_{0};
+  std::atomic<int64_t> contended_acquisitions_{0};
+  std::atomic<int64_t> total_wait_ns_{0};
+  std::atomic<int64_t> max_wait_ns_{0};
+  std::atomic<int64_t> total_hold_ns_{0};
+  std::atomic<int64_t> max_hold_ns_{0};
+};
+
+// Process wide switch and registry of all `LockSite`s.
+class LockProfiler {
+ public:
+  // Enables or disables profiling. Enabling profiling while it is disabled
+  // resets the statistics of all sites. Locks which are held while profiling is
+  // toggled are not recorded.
+  static void SetEnabled(bool enabled);
+
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  // Writes the statistics collected since profiling was enabled or last reset.
+  // If `reset` is true then the statistics are cleared, which starts a new
+  // window.
+  static void Report(bool reset, LockContentionProfile* profile);
+
+  // Clears the statistics of all sites.
+  static void Reset();
+
+ private:
+  friend class LockSite;
+
+  static void Register(LockSite* site);
+
+  static std::atomic<bool> enabled_;
+};
+
+// Implementation shared by the scoped locks.
+class ProfiledLockBase {
+ public:
+  ProfiledLockBase(const ProfiledLockBase&) = delete;
+  ProfiledLockBase& operator=(const ProfiledLockBase&) = delete;
+
+  // Waits on `cv` (or until `deadline`) or for `condition` to become true. The
+  // time spent waiting is not counted as time the mutex was held. Returns the
+  // same as the corresponding `absl::CondVar` and `absl::Mutex` methods.
+  // Waits which are made on the mutex directly (e.g `cv->Wait(mu)`) are
+  // counted as hold time.
+  void Wait(absl::CondVar* cv);
+  bool WaitWithDeadline(absl::CondVar* cv, absl::Time deadline);
+  void Await(const absl::Condition& condition);
+
+  // Runs `fn` with the mutex released and then reacquires it. The time spent
+  // in `fn` is not counted as time the mutex was held.
+  void Unlocked(absl::FunctionRef<void()> fn);
+
+ protected:
+  ProfiledLockBase(absl::Mutex* mu, LockSite* site, bool shared)
+      : mu_(mu),
+        site_(LockProfiler::enabled() ? site : nullptr),
+        shared_(shared) {
+    if (site_ != nullptr) {
+      LockAndRecordWait();
+    } else if (shared_) {
+      mu_->ReaderLock();
+    } else {
+      mu_->Lock();
+    }
+  }
+
+  ~ProfiledLockBase() {
+    if (site_ != nullptr) RecordHold();
+    if (shared_) {
+      mu_->ReaderUnlock();
+    } else {
+      mu_->Unlock();
+    }
+  }
+
+ private:
+  void LockAndRecordWait();
+  void RecordHold();
+  void PauseHold();
+  void ResumeHold();
+
+  absl::Mutex* const mu_;
+  // Null when profiling was disabled when the lock was acquired.
+  LockSite* const site_;
+  const bool shared_;
+  absl::Time acquired_at_;
+  absl::Duration held_for_;
+};
+
+// Equivalent of `absl::MutexLock` (and `absl::WriterMutexLock`).
+class ABSL_SCOPED_LOCKABLE ProfiledMutexLock : public ProfiledLockBase {
+ public:
+  ProfiledMutexLock(absl::Mutex* mu, LockSite* site)
+      ABSL_EXCLUSIVE_LOCK_FUNCTION(mu)
+      : ProfiledLockBase(mu, site, /*shared=*/false) {}
+
+  ~ProfiledMutexLock() ABSL_UNLOCK_FUNCTION() {}
+};
+
+// Equivalent of `absl::ReaderMutexLock`.
+class ABSL_SCOPED_LOCKABLE ProfiledReaderMutexLock : public ProfiledLockBase {
+ public:
+  ProfiledReaderMutexLock(absl::Mutex* mu, LockSite* site)
+      ABSL_SHARED_LOCK_FUNCTION(mu)
+      : ProfiledLockBase(mu, site, /*shared=*/true) {}
+
+  ~ProfiledReaderMutexLock() ABSL_UNLOCK_FUNCTION() {}
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_LOCK_PROFILER_H_
@@ -0,0 +1,161 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/lock_profiler.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Returns the stats of the sites of `mutex` in the current profile.
+std::vector<LockSiteStats> SitesOf(const std::string& mutex) {
+  LockContentionProfile profile;
+  LockProfiler::Report(/*reset=*/false, &profile);
+  std::vector<LockSiteStats> sites;
+  for (const auto& site : profile.sites()) {
+    if (site.mutex() == mutex) sites.push_back(site);
+  }
+  return sites;
+}
+
+class LockProfilerTest : public ::testing::Test {
+ protected:
+  LockProfilerTest() { LockProfiler::SetEnabled(true); }
+  ~LockProfilerTest() override { LockProfiler::SetEnabled(false); }
+};
+
+TEST_F(LockProfilerTest, DisabledProfilerRecordsNothing) {
+  LockProfiler::SetEnabled(false);
+  absl::Mutex mu;
+  { ProfiledMutexLock lock(&mu, REVERB_LOCK_SITE("disabled")); }
+  EXPECT_THAT(SitesOf("disabled"), ::testing::IsEmpty());
+
+  LockContentionProfile profile;
+  LockProfiler::Report(/*reset=*/false, &profile);
+  EXPECT_FALSE(profile.enabled());
+}
+
+TEST_F(LockProfilerTest, RecordsAcquisitionsPerSite) {
+  absl::Mutex mu;
+  for (int i = 0; i < 3; i++) {
+    ProfiledMutexLock lock(&mu, REVERB_LOCK_SITE("per_site"));
+  }
+  { ProfiledReaderMutexLock lock(&mu, REVERB_LOCK_SITE("per_site")); }
+
+  auto sites = SitesOf("per_site");
+  ASSERT_EQ(sites.size(), 2);
+  std::sort(sites.begin(), sites.end(),
+            [](const LockSiteStats& a, const LockSiteStats& b) {
+              return a.line() < b.line();
+            });
+  EXPECT_EQ(sites[0].acquisitions(), 3);
+  EXPECT_EQ(sites[1].acquisitions(), 1);
+  EXPECT_LT(sites[0].line(), sites[1].line());
+  EXPECT_THAT(sites[0].file(), ::testing::HasSubstr("lock_profiler_test.cc"));
+  EXPECT_EQ(sites[0].contended_acquisitions(), 0);
+}
+
+TEST_F(LockProfilerTest, RecordsWaitAndHoldTime) {
+  absl::Mutex mu;
+  absl::Notification locked;
+  auto thread = StartThread("holder", [&] {
+    ProfiledMutexLock lock(&mu, REVERB_LOCK_SITE("contended_holder"));
+    locked.Notify();
+    absl::SleepFor(absl::Milliseconds(50));
+  });
+  locked.WaitForNotification();
+  { ProfiledMutexLock lock(&mu, REVERB_LOCK_SITE("contended_waiter")); }
+  thread = nullptr;
+
+  auto holder = SitesOf("contended_holder");
+  ASSERT_EQ(holder.size(), 1);
+  EXPECT_GE(holder[0].total_hold_ns(), absl::ToInt64Nanoseconds(
+                                           absl::Milliseconds(50)));
+  EXPECT_EQ(holder[0].max_hold_ns(), holder[0].total_hold_ns());
+
+  auto waiter = SitesOf("contended_waiter");
+  ASSERT_EQ(waiter.size(), 1);
+  EXPECT_EQ(waiter[0].contended_acquisitions(), 1);
+  EXPECT_GT(waiter[0].total_wait_ns(), 0);
+  EXPECT_LT(waiter[0].total_hold_ns(), holder[0].total_hold_ns());
+}
+
+TEST_F(LockProfilerTest, WaitIsNotCountedAsHoldTime) {
+  absl::Mutex mu;
+  absl::CondVar cv;
+  {
+    ProfiledMutexLock lock(&mu, REVERB_LOCK_SITE("cond_var"));
+    lock.WaitWithDeadline(&cv, absl::Now() + absl::Milliseconds(50));
+  }
+  auto sites = SitesOf("cond_var");
+  ASSERT_EQ(sites.size(), 1);
+  EXPECT_LT(sites[0].total_hold_ns(),
+            absl::ToInt64Nanoseconds(absl::Milliseconds(50)));
+}
+
+TEST_F(LockProfilerTest, UnlockedReleasesMutex) {
+  absl::Mutex mu;
+  {
+    ProfiledMutexLock lock(&mu, REVERB_LOCK_SITE("unlocked"));
+    lock.Unlocked([&] {
+      // Another thread can acquire the mutex while `fn` runs.
+      auto thread = StartThread("other", [&] { absl::MutexLock other(&mu); });
+      absl::SleepFor(absl::Milliseconds(50));
+    });
+    mu.AssertHeld();
+  }
+  auto sites = SitesOf("unlocked");
+  ASSERT_EQ(sites.size(), 1);
+  EXPECT_LT(sites[0].total_hold_ns(),
+            absl::ToInt64Nanoseconds(absl::Milliseconds(50)));
+}
+
+TEST_F(LockProfilerTest, ReportWithResetStartsNewWindow) {
+  absl::Mutex mu;
+  { ProfiledMutexLock lock(&mu, REVERB_LOCK_SITE("reset")); }
+
+  LockContentionProfile profile;
+  LockProfiler::Report(/*reset=*/true, &profile);
+  EXPECT_TRUE(profile.enabled());
+  EXPECT_GT(profile.window_ns(), 0);
+  EXPECT_THAT(SitesOf("reset"), ::testing::IsEmpty());
+}
+
+TEST_F(LockProfilerTest, SitesAreOrderedByWaitTime) {
+  LockContentionProfile profile;
+  LockProfiler::Report(/*reset=*/false, &profile);
+  for (int i = 1; i < profile.sites_size(); i++) {
+    EXPECT_GE(profile.sites(i - 1).total_wait_ns(),
+              profile.sites(i).total_wait_ns());
+  }
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,74 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/memory_budget.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+MemoryBudget::Charge::Charge(std::shared_ptr<MemoryBudget> budget,
+                             int64_t bytes)
+    : budget_(std::move(budget)), bytes_(bytes) {
+  budget_->used_bytes_.fetch_add(bytes_, std::memory_order_relaxed);
+}
+
+MemoryBudget::Charge::Charge(Charge&& other)
+    : budget_(std::move(other.budget_)), bytes_(other.bytes_) {
+  other.bytes_ = 0;
+}
+
+MemoryBudget::Charge& MemoryBudget::Charge::operator=(Charge&& other) {
+  if (this != &other) {
+    Release();
+    budget_ = std::move(other.budget_);
+    bytes_ = other.bytes_;
+    other.bytes_ = 0;
+  }
+  return *this;
+}
+
+MemoryBudget::Charge::~Charge() { Release(); }
+
+void MemoryBudget::Charge::Release() {
+  if (budget_ != nullptr) {
+    budget_->used_bytes_.fetch_sub(bytes_, std::memory_order_relaxed);
+    budget_ = nullptr;
+  }
+  bytes_ = 0;
+}
+
+MemoryBudget::MemoryBudget(int64_t soft_limit_bytes)
+    : soft_limit_bytes_(soft_limit_bytes) {}
+
+MemoryBudget::Charge MemoryBudget::Acquire(int64_t bytes) {
+  return Charge(shared_from_this(), bytes);
+}
+
+bool MemoryBudget::exceeded() const {
+  return soft_limit_bytes_ > 0 && used_bytes() > soft_limit_bytes_;
+}
+
+int64_t MemoryBudget::used_bytes() const {
+  return used_bytes_.load(std::memory_order_relaxed);
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,83 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SUPPORT_MEMORY_BUDGET_H_
+#define REVERB_CC_SUPPORT_MEMORY_BUDGET_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Tracks the memory held by a server (e.g chunks, queued inserts and queued
+// responses) against a soft limit. Crossing the limit doesn't fail anything,
+// it is up to the holders of the charges to stop taking on more work (e.g.
+// insert streams pause reading) until the usage has dropped below the limit
+// again. Must be created with `std::make_shared`. Thread safe.
+class MemoryBudget : public std::enable_shared_from_this<MemoryBudget> {
+ public:
+  // RAII handle of charged bytes, which are released on destruction. Charges
+  // keep the budget alive.
+  class Charge {
+   public:
+    Charge() = default;
+    Charge(Charge&& other);
+    Charge& operator=(Charge&& other);
+    ~Charge();
+
+    // Number of charged bytes.
+    int64_t bytes() const { return bytes_; }
+
+   private:
+    friend class MemoryBudget;
+
+    Charge(std::shared_ptr<MemoryBudget> budget, int64_t bytes);
+
+    // Releases the charged bytes (if any).
+    void Release();
+
+    std::shared_ptr<MemoryBudget> budget_;
+    int64_t bytes_ = 0;
+  };
+
+  // A `soft_limit_bytes` <= 0 means that the limit is never exceeded.
+  explicit MemoryBudget(int64_t soft_limit_bytes);
+
+  // Charges `bytes` to the budget for as long as the returned handle exists.
+  // Never blocks or fails, even if the limit is exceeded as a result.
+  Charge Acquire(int64_t bytes);
+
+  // True if the charged bytes are above the soft limit.
+  bool exceeded() const;
+
+  // Total number of currently charged bytes.
+  int64_t used_bytes() const;
+
+  int64_t soft_limit_bytes() const { return soft_limit_bytes_; }
+
+ private:
+  const int64_t soft_limit_bytes_;
+
+  std::atomic<int64_t> used_bytes_{0};
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_MEMORY_BUDGET_H_
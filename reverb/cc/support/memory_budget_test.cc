@@ -0,0 +1,80 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/memory_budget.h"
+
+#include <memory>
+#include <utility>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(MemoryBudgetTest, ChargesAreReleasedOnDestruction) {
+  auto budget = std::make_shared<MemoryBudget>(/*soft_limit_bytes=*/100);
+  {
+    MemoryBudget::Charge first = budget->Acquire(60);
+    EXPECT_EQ(first.bytes(), 60);
+    EXPECT_EQ(budget->used_bytes(), 60);
+    EXPECT_FALSE(budget->exceeded());
+
+    MemoryBudget::Charge second = budget->Acquire(50);
+    EXPECT_EQ(budget->used_bytes(), 110);
+    EXPECT_TRUE(budget->exceeded());
+  }
+  EXPECT_EQ(budget->used_bytes(), 0);
+  EXPECT_FALSE(budget->exceeded());
+}
+
+TEST(MemoryBudgetTest, MovedChargesAreOnlyReleasedOnce) {
+  auto budget = std::make_shared<MemoryBudget>(/*soft_limit_bytes=*/100);
+  MemoryBudget::Charge charge = budget->Acquire(10);
+  MemoryBudget::Charge moved(std::move(charge));
+  EXPECT_EQ(budget->used_bytes(), 10);
+
+  // Assigning releases the previous charge of the target.
+  MemoryBudget::Charge other = budget->Acquire(20);
+  other = std::move(moved);
+  EXPECT_EQ(budget->used_bytes(), 10);
+  EXPECT_EQ(other.bytes(), 10);
+
+  other = MemoryBudget::Charge();
+  EXPECT_EQ(budget->used_bytes(), 0);
+}
+
+TEST(MemoryBudgetTest, NonPositiveLimitIsNeverExceeded) {
+  auto budget = std::make_shared<MemoryBudget>(/*soft_limit_bytes=*/0);
+  MemoryBudget::Charge charge = budget->Acquire(1 << 30);
+  EXPECT_FALSE(budget->exceeded());
+}
+
+TEST(MemoryBudgetTest, ChargesKeepTheBudgetAlive) {
+  auto budget = std::make_shared<MemoryBudget>(/*soft_limit_bytes=*/100);
+  std::weak_ptr<MemoryBudget> weak_budget = budget;
+  MemoryBudget::Charge charge = budget->Acquire(10);
+  budget.reset();
+  EXPECT_FALSE(weak_budget.expired());
+  charge = MemoryBudget::Charge();
+  EXPECT_TRUE(weak_budget.expired());
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
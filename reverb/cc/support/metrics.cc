@@ -0,0 +1,254 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+std::string EscapeLabelValue(absl::string_view value) {
+  std::string escaped;
+  escaped.reserve(value.size());
+  for (char c : value) {
+    switch (c) {
+      case '\\':
+        escaped.append("\\\\");
+        break;
+      case '"':
+        escaped.append("\\\"");
+        break;
+      case '\n':
+        escaped.append("\\n");
+        break;
+      default:
+        escaped.push_back(c);
+    }
+  }
+  return escaped;
+}
+
+std::string FormatLabels(const MetricLabels& labels) {
+  if (labels.empty()) return "";
+  return absl::StrCat(
+      "{",
+      absl::StrJoin(labels, ",",
+                    [](std::string* out,
+                       const std::pair<std::string, std::string>& label) {
+                      absl::StrAppend(out, label.first, "=\"",
+                                      EscapeLabelValue(label.second), "\"");
+                    }),
+      "}");
+}
+
+std::string FormatValue(double value) {
+  if (std::isinf(value)) return value > 0 ? "+Inf" : "-Inf";
+  if (std::isnan(value)) return "NaN";
+  return absl::StrCat(value);
+}
+
+std::string MetricKey(absl::string_view name, const MetricLabels& labels) {
+  return absl::StrCat(name, FormatLabels(labels));
+}
+
+}  // namespace
+
+void Gauge::Add(double delta) {
+  double value = value_.load(std::memory_order_relaxed);
+  while (!value_.compare_exchange_weak(value, value + delta,
+                                       std::memory_order_relaxed)) {
+  }
+}
+
+MetricsWriter::Family* MetricsWriter::GetFamily(absl::string_view name,
+                                                absl::string_view type,
+                                                absl::string_view help) {
+  auto [it, inserted] = families_.try_emplace(std::string(name));
+  if (inserted) {
+    names_.push_back(std::string(name));
+    it->second.type = std::string(type);
+    it->second.help = std::string(help);
+  }
+  return &it->second;
+}
+
+void MetricsWriter::AddCounter(absl::string_view name, absl::string_view help,
+                               const MetricLabels& labels, double value) {
+  GetFamily(name, "counter", help)
+      ->samples.push_back(
+          absl::StrCat(name, FormatLabels(labels), " ", FormatValue(value)));
+}
+
+void MetricsWriter::AddGauge(absl::string_view name, absl::string_view help,
+                             const MetricLabels& labels, double value) {
+  GetFamily(name, "gauge", help)
+      ->samples.push_back(
+          absl::StrCat(name, FormatLabels(labels), " ", FormatValue(value)));
+}
+
+void MetricsWriter::AddHistogram(absl::string_view name,
+                                 absl::string_view help,
+                                 const MetricLabels& labels,
+                                 const LatencyDistribution& distribution) {
+  Family* family = GetFamily(name, "histogram", help);
+  MetricLabels bucket_labels = labels;
+  bucket_labels.emplace_back("le", "");
+  int64_t cumulative = 0;
+  for (int i = 0; i < distribution.bucket_count_size(); ++i) {
+    cumulative += distribution.bucket_count(i);
+    // The last possible bucket has no upper limit and is covered by `+Inf`.
+    if (distribution.bucket_limit_us(i) ==
+        std::numeric_limits<int64_t>::max()) {
+      break;
+    }
+    bucket_labels.back().second =
+        FormatValue(distribution.bucket_limit_us(i) * 1e-6);
+    family->samples.push_back(absl::StrCat(name, "_bucket",
+                                           FormatLabels(bucket_labels), " ",
+                                           cumulative));
+  }
+  bucket_labels.back().second = "+Inf";
+  family->samples.push_back(absl::StrCat(name, "_bucket",
+                                         FormatLabels(bucket_labels), " ",
+                                         distribution.count()));
+  family->samples.push_back(
+      absl::StrCat(name, "_sum", FormatLabels(labels), " ",
+                   FormatValue(distribution.sum_us() * 1e-6)));
+  family->samples.push_back(absl::StrCat(name, "_count", FormatLabels(labels),
+                                         " ", distribution.count()));
+}
+
+std::string MetricsWriter::ToString() const {
+  std::string out;
+  for (const auto& name : names_) {
+    const Family& family = families_.at(name);
+    absl::StrAppend(&out, "# HELP ", name, " ", family.help, "\n");
+    absl::StrAppend(&out, "# TYPE ", name, " ", family.type, "\n");
+    for (const auto& sample : family.samples) {
+      absl::StrAppend(&out, sample, "\n");
+    }
+  }
+  return out;
+}
+
+MetricsRegistry* MetricsRegistry::Default() {
+  static auto* registry = new MetricsRegistry();
+  return registry;
+}
+
+template <typename T>
+T* MetricsRegistry::GetOrCreate(
+    internal::flat_hash_map<std::string, Metric<T>>* metrics,
+    absl::string_view name, absl::string_view help,
+    const MetricLabels& labels) {
+  absl::MutexLock lock(&mu_);
+  auto& metric = (*metrics)[MetricKey(name, labels)];
+  if (metric.value == nullptr) {
+    metric.name = std::string(name);
+    metric.help = std::string(help);
+    metric.labels = labels;
+    metric.value = std::make_unique<T>();
+  }
+  return metric.value.get();
+}
+
+Counter* MetricsRegistry::GetCounter(absl::string_view name,
+                                     absl::string_view help,
+                                     const MetricLabels& labels) {
+  return GetOrCreate(&counters_, name, help, labels);
+}
+
+Gauge* MetricsRegistry::GetGauge(absl::string_view name,
+                                 absl::string_view help,
+                                 const MetricLabels& labels) {
+  return GetOrCreate(&gauges_, name, help, labels);
+}
+
+LatencyHistogram* MetricsRegistry::GetHistogram(absl::string_view name,
+                                                absl::string_view help,
+                                                const MetricLabels& labels) {
+  return GetOrCreate(&histograms_, name, help, labels);
+}
+
+int64_t MetricsRegistry::AddCollector(Collector collector) {
+  absl::MutexLock lock(&mu_);
+  const int64_t id = next_collector_id_++;
+  collectors_.emplace_back(id, std::move(collector));
+  return id;
+}
+
+void MetricsRegistry::RemoveCollector(int64_t id) {
+  absl::MutexLock lock(&mu_);
+  collectors_.erase(
+      std::remove_if(collectors_.begin(), collectors_.end(),
+                     [id](const auto& entry) { return entry.first == id; }),
+      collectors_.end());
+}
+
+std::string MetricsRegistry::ExportText() const {
+  MetricsWriter writer;
+  absl::ReaderMutexLock lock(&mu_);
+  // Metrics are exported in a deterministic order.
+  auto sorted = [](const auto& metrics) {
+    std::vector<const typename std::decay_t<decltype(metrics)>::mapped_type*>
+        sorted;
+    std::vector<const std::string*> keys;
+    for (const auto& entry : metrics) keys.push_back(&entry.first);
+    std::sort(keys.begin(), keys.end(),
+              [](const std::string* a, const std::string* b) {
+                return *a < *b;
+              });
+    for (const std::string* key : keys) sorted.push_back(&metrics.at(*key));
+    return sorted;
+  };
+  for (const auto* metric : sorted(counters_)) {
+    writer.AddCounter(metric->name, metric->help, metric->labels,
+                      metric->value->value());
+  }
+  for (const auto* metric : sorted(gauges_)) {
+    writer.AddGauge(metric->name, metric->help, metric->labels,
+                    metric->value->value());
+  }
+  for (const auto* metric : sorted(histograms_)) {
+    LatencyDistribution distribution;
+    metric->value->ToProto(&distribution);
+    writer.AddHistogram(metric->name, metric->help, metric->labels,
+                        distribution);
+  }
+  for (const auto& entry : collectors_) {
+    entry.second(&writer);
+  }
+  return writer.ToString();
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
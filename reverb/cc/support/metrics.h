@@ -0,0 +1,163 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SUPPORT_METRICS_H_
+#define REVERB_CC_SUPPORT_METRICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/latency_histogram.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Labels of a metric sample, e.g `{{"table", "queue"}}`.
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+// Monotonically increasing value. Thread safe and lock free.
+class Counter {
+ public:
+  void Increment(int64_t n = 1) {
+    value_.fetch_add(n, std::memory_order_relaxed);
+  }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+// Value which can go up and down. Thread safe and lock free.
+class Gauge {
+ public:
+  void Set(double value) { value_.store(value, std::memory_order_relaxed); }
+  void Add(double delta);
+  double value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<double> value_{0};
+};
+
+// Accumulates metric samples and renders them in the Prometheus text
+// exposition format (which OpenMetrics scrapers also accept). Samples of the
+// same metric are grouped under a single HELP and TYPE header regardless of
+// the order in which they are added. Not thread safe.
+class MetricsWriter {
+ public:
+  void AddCounter(absl::string_view name, absl::string_view help,
+                  const MetricLabels& labels, double value);
+  void AddGauge(absl::string_view name, absl::string_view help,
+                const MetricLabels& labels, double value);
+
+  // Adds `distribution` as a histogram with buckets in seconds.
+  void AddHistogram(absl::string_view name, absl::string_view help,
+                    const MetricLabels& labels,
+                    const LatencyDistribution& distribution);
+
+  std::string ToString() const;
+
+ private:
+  struct Family {
+    std::string type;
+    std::string help;
+    std::vector<std::string> samples;
+  };
+
+  Family* GetFamily(absl::string_view name, absl::string_view type,
+                    absl::string_view help);
+
+  // Families in the order they were first added.
+  std::vector<std::string> names_;
+  internal::flat_hash_map<std::string, Family> families_;
+};
+
+// Registry of the metrics of the process. Counters, gauges and histograms are
+// created on first use and live as long as the registry so the returned
+// pointers can be cached by the caller and updated without any locking.
+// State which is cheaper to read when the metrics are exported than to keep
+// up to date (e.g the size of a table) is reported by collectors instead.
+//
+// Metric names must be unique across the types of metrics.
+class MetricsRegistry {
+ public:
+  // Called with the writer when the metrics are exported.
+  using Collector = std::function<void(MetricsWriter* writer)>;
+
+  // Registry used by the server.
+  static MetricsRegistry* Default();
+
+  Counter* GetCounter(absl::string_view name, absl::string_view help,
+                      const MetricLabels& labels = {})
+      ABSL_LOCKS_EXCLUDED(mu_);
+  Gauge* GetGauge(absl::string_view name, absl::string_view help,
+                  const MetricLabels& labels = {}) ABSL_LOCKS_EXCLUDED(mu_);
+  LatencyHistogram* GetHistogram(absl::string_view name,
+                                 absl::string_view help,
+                                 const MetricLabels& labels = {})
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Registers `collector` and returns an id which can be passed to
+  // `RemoveCollector`. Collectors must not call back into the registry.
+  int64_t AddCollector(Collector collector) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Unregisters a collector. Blocks until any ongoing call to the collector
+  // has returned so what it captures can be destroyed right after.
+  void RemoveCollector(int64_t id) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Renders all metrics in the Prometheus text exposition format.
+  std::string ExportText() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  template <typename T>
+  struct Metric {
+    std::string name;
+    std::string help;
+    MetricLabels labels;
+    std::unique_ptr<T> value;
+  };
+
+  template <typename T>
+  T* GetOrCreate(
+      internal::flat_hash_map<std::string, Metric<T>>* metrics,
+      absl::string_view name, absl::string_view help,
+      const MetricLabels& labels) ABSL_LOCKS_EXCLUDED(mu_);
+
+  mutable absl::Mutex mu_;
+  internal::flat_hash_map<std::string, Metric<Counter>> counters_
+      ABSL_GUARDED_BY(mu_);
+  internal::flat_hash_map<std::string, Metric<Gauge>> gauges_
+      ABSL_GUARDED_BY(mu_);
+  internal::flat_hash_map<std::string, Metric<LatencyHistogram>> histograms_
+      ABSL_GUARDED_BY(mu_);
+  std::vector<std::pair<int64_t, Collector>> collectors_ ABSL_GUARDED_BY(mu_);
+  int64_t next_collector_id_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_METRICS_H_
@@ -0,0 +1,126 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/metrics.h"
+
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+TEST(GaugeTest, SetAndAdd) {
+  Gauge gauge;
+  gauge.Set(2.5);
+  gauge.Add(-1);
+  EXPECT_EQ(gauge.value(), 1.5);
+}
+
+TEST(MetricsWriterTest, GroupsSamplesOfTheSameMetric) {
+  MetricsWriter writer;
+  writer.AddGauge("size", "Size.", {{"table", "a"}}, 1);
+  writer.AddCounter("calls_total", "Calls.", {}, 3);
+  writer.AddGauge("size", "Size.", {{"table", "b"}}, 2);
+  EXPECT_EQ(writer.ToString(),
+            "# HELP size Size.\n"
+            "# TYPE size gauge\n"
+            "size{table=\"a\"} 1\n"
+            "size{table=\"b\"} 2\n"
+            "# HELP calls_total Calls.\n"
+            "# TYPE calls_total counter\n"
+            "calls_total 3\n");
+}
+
+TEST(MetricsWriterTest, EscapesLabelValues) {
+  MetricsWriter writer;
+  writer.AddGauge("size", "Size.", {{"table", "a\"b\\c\nd"}}, 1);
+  EXPECT_THAT(writer.ToString(), HasSubstr("size{table=\"a\\\"b\\\\c\\nd\"} 1"));
+}
+
+TEST(MetricsWriterTest, HistogramBucketsAreCumulativeInSeconds) {
+  LatencyHistogram histogram;
+  histogram.Record(absl::Microseconds(1));
+  histogram.Record(absl::Microseconds(3));
+  histogram.Record(absl::Microseconds(3));
+  LatencyDistribution distribution;
+  histogram.ToProto(&distribution);
+
+  MetricsWriter writer;
+  writer.AddHistogram("latency_seconds", "Latency.", {{"op", "insert"}},
+                      distribution);
+  EXPECT_EQ(writer.ToString(),
+            "# HELP latency_seconds Latency.\n"
+            "# TYPE latency_seconds histogram\n"
+            "latency_seconds_bucket{op=\"insert\",le=\"1e-06\"} 0\n"
+            "latency_seconds_bucket{op=\"insert\",le=\"2e-06\"} 1\n"
+            "latency_seconds_bucket{op=\"insert\",le=\"4e-06\"} 3\n"
+            "latency_seconds_bucket{op=\"insert\",le=\"+Inf\"} 3\n"
+            "latency_seconds_sum{op=\"insert\"} 7e-06\n"
+            "latency_seconds_count{op=\"insert\"} 3\n");
+}
+
+TEST(MetricsRegistryTest, ReturnsTheSameMetricForTheSameLabels) {
+  MetricsRegistry registry;
+  Counter* a = registry.GetCounter("calls_total", "Calls.", {{"m", "a"}});
+  EXPECT_EQ(registry.GetCounter("calls_total", "Calls.", {{"m", "a"}}), a);
+  EXPECT_NE(registry.GetCounter("calls_total", "Calls.", {{"m", "b"}}), a);
+}
+
+TEST(MetricsRegistryTest, ExportText) {
+  MetricsRegistry registry;
+  registry.GetCounter("calls_total", "Calls.", {{"m", "b"}})->Increment(2);
+  registry.GetCounter("calls_total", "Calls.", {{"m", "a"}})->Increment();
+  registry.GetGauge("depth", "Depth.")->Set(4);
+  registry.GetHistogram("latency_seconds", "Latency.")
+      ->Record(absl::Microseconds(1));
+  const std::string text = registry.ExportText();
+  EXPECT_THAT(text, HasSubstr("# TYPE calls_total counter\n"
+                              "calls_total{m=\"a\"} 1\n"
+                              "calls_total{m=\"b\"} 2\n"));
+  EXPECT_THAT(text, HasSubstr("# TYPE depth gauge\ndepth 4\n"));
+  EXPECT_THAT(text, HasSubstr("latency_seconds_count 1\n"));
+}
+
+TEST(MetricsRegistryTest, Collectors) {
+  MetricsRegistry registry;
+  int calls = 0;
+  const int64_t id = registry.AddCollector([&calls](MetricsWriter* writer) {
+    writer->AddGauge("collected", "Collected.", {}, ++calls);
+  });
+  EXPECT_THAT(registry.ExportText(), HasSubstr("collected 1\n"));
+  EXPECT_THAT(registry.ExportText(), HasSubstr("collected 2\n"));
+
+  registry.RemoveCollector(id);
+  EXPECT_THAT(registry.ExportText(), Not(HasSubstr("collected")));
+  EXPECT_EQ(calls, 2);
+}
+
+TEST(MetricsRegistryTest, DefaultIsASingleton) {
+  EXPECT_EQ(MetricsRegistry::Default(), MetricsRegistry::Default());
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
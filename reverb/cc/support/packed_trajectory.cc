@@ -0,0 +1,93 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/packed_trajectory.h"
+
+#include <memory>
+#include <utility>
+
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+size_t PackedTrajectory::ByteSizeLong() const {
+  return sizeof(PackedTrajectory) + slices.capacity() * sizeof(Slice);
+}
+
+std::shared_ptr<const TrajectoryLayout> TrajectoryLayoutInterner::Intern(
+    TrajectoryLayout layout) {
+  absl::MutexLock lock(&mu_);
+  auto it = layouts_.find(layout);
+  if (it != layouts_.end()) {
+    return it->second;
+  }
+  auto shared = std::make_shared<const TrajectoryLayout>(layout);
+  layouts_.emplace(std::move(layout), shared);
+  return shared;
+}
+
+size_t TrajectoryLayoutInterner::size() const {
+  absl::MutexLock lock(&mu_);
+  return layouts_.size();
+}
+
+PackedTrajectory PackTrajectory(const FlatTrajectory& trajectory,
+                                TrajectoryLayoutInterner* interner) {
+  TrajectoryLayout layout;
+  layout.columns.reserve(trajectory.columns_size());
+  size_t num_slices = 0;
+  for (const auto& column : trajectory.columns()) {
+    layout.columns.push_back({column.chunk_slices_size(), column.squeeze()});
+    num_slices += column.chunk_slices_size();
+  }
+
+  PackedTrajectory packed;
+  packed.layout = interner->Intern(std::move(layout));
+  packed.slices.reserve(num_slices);
+  for (const auto& column : trajectory.columns()) {
+    for (const auto& chunk_slice : column.chunk_slices()) {
+      packed.slices.push_back({chunk_slice.chunk_key(), chunk_slice.offset(),
+                               chunk_slice.length(), chunk_slice.index()});
+    }
+  }
+  return packed;
+}
+
+void UnpackTrajectory(const PackedTrajectory& packed,
+                      FlatTrajectory* trajectory) {
+  trajectory->Clear();
+  if (packed.layout == nullptr) return;
+
+  trajectory->mutable_columns()->Reserve(packed.layout->columns.size());
+  auto slice = packed.slices.begin();
+  for (const auto& layout : packed.layout->columns) {
+    auto* column = trajectory->add_columns();
+    column->set_squeeze(layout.squeeze);
+    column->mutable_chunk_slices()->Reserve(layout.num_slices);
+    for (int i = 0; i < layout.num_slices; ++i, ++slice) {
+      auto* chunk_slice = column->add_chunk_slices();
+      chunk_slice->set_chunk_key(slice->chunk_key);
+      chunk_slice->set_offset(slice->offset);
+      chunk_slice->set_length(slice->length);
+      chunk_slice->set_index(slice->index);
+    }
+  }
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
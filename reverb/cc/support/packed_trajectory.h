@@ -0,0 +1,112 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_PACKED_TRAJECTORY_H_
+#define REVERB_CC_SUPPORT_PACKED_TRAJECTORY_H_
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// The part of a `FlatTrajectory` which doesn't depend on the chunks it
+// references: the number of slices and the squeeze flag of every column. Items
+// written by the same writer usually share a handful of layouts so they are
+// interned by `TrajectoryLayoutInterner` rather than stored with every item.
+struct TrajectoryLayout {
+  struct Column {
+    int32_t num_slices;
+    bool squeeze;
+
+    bool operator==(const Column& other) const {
+      return num_slices == other.num_slices && squeeze == other.squeeze;
+    }
+  };
+
+  std::vector<Column> columns;
+
+  bool operator==(const TrajectoryLayout& other) const {
+    return columns == other.columns;
+  }
+
+  template <typename H>
+  friend H AbslHashValue(H h, const TrajectoryLayout& layout) {
+    for (const Column& column : layout.columns) {
+      h = H::combine(std::move(h), column.num_slices, column.squeeze);
+    }
+    return H::combine(std::move(h), layout.columns.size());
+  }
+};
+
+// Compact copy of a `FlatTrajectory`. The slices of all columns are stored in
+// a single array, in column order, and the layout is shared with the other
+// items of the same shape. A packed trajectory takes a single allocation of
+// `sizeof(Slice)` bytes per slice whereas the proto allocates every column and
+// every slice separately.
+struct PackedTrajectory {
+  struct Slice {
+    uint64_t chunk_key;
+    int32_t offset;
+    int32_t length;
+    int32_t index;
+  };
+
+  std::shared_ptr<const TrajectoryLayout> layout;
+  std::vector<Slice> slices;
+
+  // Approximate number of heap bytes used, excluding the shared layout.
+  size_t ByteSizeLong() const;
+};
+
+// Deduplicates the layouts of the trajectories packed by a table. Layouts are
+// never removed since there are only as many as there are distinct item shapes.
+// Thread safe.
+class TrajectoryLayoutInterner {
+ public:
+  // Returns the shared layout equal to `layout`, adding it if it is new.
+  std::shared_ptr<const TrajectoryLayout> Intern(TrajectoryLayout layout)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Number of distinct layouts.
+  size_t size() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  mutable absl::Mutex mu_;
+  absl::flat_hash_map<TrajectoryLayout, std::shared_ptr<const TrajectoryLayout>>
+      layouts_ ABSL_GUARDED_BY(mu_);
+};
+
+// Packs `trajectory` using (and adding to) the layouts of `interner`.
+PackedTrajectory PackTrajectory(const FlatTrajectory& trajectory,
+                                TrajectoryLayoutInterner* interner);
+
+// Overwrites `trajectory` with the unpacked copy of `packed`.
+void UnpackTrajectory(const PackedTrajectory& packed,
+                      FlatTrajectory* trajectory);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_PACKED_TRAJECTORY_H_
@@ -0,0 +1,95 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/packed_trajectory.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/testing/proto_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+FlatTrajectory MakeTrajectory() {
+  return testing::ParseTextProtoOrDie<FlatTrajectory>(R"pb(
+    columns {
+      chunk_slices { chunk_key: 1 offset: 2 length: 3 index: 0 }
+      chunk_slices { chunk_key: 2 offset: 0 length: 1 index: 0 }
+    }
+    columns {
+      chunk_slices { chunk_key: 3 offset: 4 length: 1 index: 1 }
+      squeeze: true
+    }
+  )pb");
+}
+
+TEST(PackedTrajectoryTest, RoundTrips) {
+  TrajectoryLayoutInterner interner;
+  FlatTrajectory trajectory = MakeTrajectory();
+  PackedTrajectory packed = PackTrajectory(trajectory, &interner);
+  EXPECT_EQ(packed.slices.size(), 3);
+
+  FlatTrajectory unpacked;
+  UnpackTrajectory(packed, &unpacked);
+  EXPECT_THAT(unpacked, testing::EqualsProto(trajectory));
+}
+
+TEST(PackedTrajectoryTest, RoundTripsEmptyTrajectory) {
+  TrajectoryLayoutInterner interner;
+  PackedTrajectory packed = PackTrajectory(FlatTrajectory(), &interner);
+  EXPECT_TRUE(packed.slices.empty());
+
+  FlatTrajectory unpacked = MakeTrajectory();
+  UnpackTrajectory(packed, &unpacked);
+  EXPECT_THAT(unpacked, testing::EqualsProto(FlatTrajectory()));
+}
+
+TEST(PackedTrajectoryTest, SharesLayoutOfSameShape) {
+  TrajectoryLayoutInterner interner;
+  FlatTrajectory first = MakeTrajectory();
+  FlatTrajectory second = MakeTrajectory();
+  second.mutable_columns(0)->mutable_chunk_slices(0)->set_chunk_key(10);
+
+  PackedTrajectory first_packed = PackTrajectory(first, &interner);
+  PackedTrajectory second_packed = PackTrajectory(second, &interner);
+  EXPECT_EQ(first_packed.layout, second_packed.layout);
+  EXPECT_EQ(interner.size(), 1);
+
+  FlatTrajectory unpacked;
+  UnpackTrajectory(second_packed, &unpacked);
+  EXPECT_THAT(unpacked, testing::EqualsProto(second));
+}
+
+TEST(PackedTrajectoryTest, DistinguishesLayouts) {
+  TrajectoryLayoutInterner interner;
+  FlatTrajectory squeezed = MakeTrajectory();
+  FlatTrajectory not_squeezed = MakeTrajectory();
+  not_squeezed.mutable_columns(1)->set_squeeze(false);
+  FlatTrajectory single_column = MakeTrajectory();
+  single_column.mutable_columns()->RemoveLast();
+
+  EXPECT_NE(PackTrajectory(squeezed, &interner).layout,
+            PackTrajectory(not_squeezed, &interner).layout);
+  EXPECT_NE(PackTrajectory(squeezed, &interner).layout,
+            PackTrajectory(single_column, &interner).layout);
+  EXPECT_EQ(interner.size(), 3);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -21,6 +21,7 @@
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "reverb/cc/platform/logging.h"
+#include "reverb/cc/support/thread_pool_usage.h"
 
 namespace deepmind {
 namespace reverb {
@@ -49,15 +50,22 @@ absl::Status PeriodicClosure::Start() {
         "PeriodicClosure: Start called when closure already running");
   }
   worker_ = StartThread(name_prefix_, [this] {
+    ThreadPoolUsageTracker* usage = nullptr;
+    if (!name_prefix_.empty()) {
+      usage = ThreadPoolUsageTracker::Get(name_prefix_);
+      usage->AddCurrentThread();
+    }
     for (auto next_run = absl::Now() + period_; true;) {
       if (mu_.LockWhenWithDeadline(absl::Condition(&stopped_), next_run)) {
         mu_.Unlock();
         return;
       }
       mu_.Unlock();
-      next_run = absl::Now() + period_;
+      const absl::Time start = absl::Now();
+      next_run = start + period_;
 
       fn_();
+      if (usage != nullptr) usage->RecordRunTime(absl::Now() - start);
     }
   });
   return absl::OkStatus();
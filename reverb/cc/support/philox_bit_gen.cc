@@ -0,0 +1,89 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/philox_bit_gen.h"
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+#include "absl/random/random.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+constexpr uint32_t kMultiplier0 = 0xD2511F53;
+constexpr uint32_t kMultiplier1 = 0xCD9E8D57;
+constexpr uint32_t kKeyIncrement0 = 0x9E3779B9;
+constexpr uint32_t kKeyIncrement1 = 0xBB67AE85;
+
+uint64_t RandomSeed() {
+  absl::BitGen bit_gen;
+  return absl::Uniform<uint64_t>(absl::IntervalClosedClosed, bit_gen, 0,
+                                 std::numeric_limits<uint64_t>::max());
+}
+
+}  // namespace
+
+std::array<uint32_t, 4> Philox4x32(std::array<uint32_t, 4> counter,
+                                   std::array<uint32_t, 2> key) {
+  for (int round = 0; round < 10; round++) {
+    if (round > 0) {
+      key[0] += kKeyIncrement0;
+      key[1] += kKeyIncrement1;
+    }
+    const uint64_t product0 = static_cast<uint64_t>(kMultiplier0) * counter[0];
+    const uint64_t product1 = static_cast<uint64_t>(kMultiplier1) * counter[2];
+    counter = {
+        static_cast<uint32_t>(product1 >> 32) ^ counter[1] ^ key[0],
+        static_cast<uint32_t>(product1),
+        static_cast<uint32_t>(product0 >> 32) ^ counter[3] ^ key[1],
+        static_cast<uint32_t>(product0),
+    };
+  }
+  return counter;
+}
+
+PhiloxBitGen::PhiloxBitGen()
+    : PhiloxBitGen(RandomSeed(), 0, /*deterministic=*/false) {}
+
+PhiloxBitGen::PhiloxBitGen(uint64_t seed)
+    : PhiloxBitGen(seed, 0, /*deterministic=*/true) {}
+
+PhiloxBitGen::PhiloxBitGen(uint64_t seed, uint64_t stream, bool deterministic)
+    : seed_(seed), stream_(stream), deterministic_(deterministic) {}
+
+PhiloxBitGen::result_type PhiloxBitGen::operator()() {
+  if (available_ == 0) Refill();
+  return block_[2 - available_--];
+}
+
+void PhiloxBitGen::Refill() {
+  // The low half of the counter is the position within the stream and the
+  // high half the stream itself.
+  const std::array<uint32_t, 4> words = Philox4x32(
+      {static_cast<uint32_t>(position_), static_cast<uint32_t>(position_ >> 32),
+       static_cast<uint32_t>(stream_), static_cast<uint32_t>(stream_ >> 32)},
+      {static_cast<uint32_t>(seed_), static_cast<uint32_t>(seed_ >> 32)});
+  position_++;
+  block_ = {(static_cast<uint64_t>(words[1]) << 32) | words[0],
+            (static_cast<uint64_t>(words[3]) << 32) | words[2]};
+  available_ = 2;
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,108 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_PHILOX_BIT_GEN_H_
+#define REVERB_CC_SUPPORT_PHILOX_BIT_GEN_H_
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Counter-based bit generator (Philox4x32-10, see Salmon et al. "Parallel
+// random numbers: as easy as 1, 2, 3", SC 2011) which satisfies the
+// UniformRandomBitGenerator requirements so it can be used with
+// `absl::Uniform` and `std::shuffle`.
+//
+// Every output is a pure function of (seed, stream, position) so the draws of
+// a stream can be computed without touching the state of any other stream.
+// Samplers use this to give the i-th sampled key its own stream, see
+// `ReserveSamples` and `ForSample`: the keys of a batch can then be computed
+// independently (and in any order) while the result only depends on the seed
+// and the number of keys sampled before.
+//
+// The class is NOT thread safe but `ForSample` may be called concurrently.
+class PhiloxBitGen {
+ public:
+  using result_type = uint64_t;
+
+  // Seeds the generator from `absl::BitGen`, i.e non-deterministically.
+  PhiloxBitGen();
+
+  // Deterministic generator. Two generators with the same seed produce the
+  // same sequence.
+  explicit PhiloxBitGen(uint64_t seed);
+
+  static constexpr result_type min() {
+    return std::numeric_limits<result_type>::min();
+  }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  result_type operator()();
+
+  uint64_t seed() const { return seed_; }
+
+  // True if the generator (or the generator it was derived from by
+  // `ForSample`) was constructed from an explicit seed.
+  bool deterministic() const { return deterministic_; }
+
+  // Reserves the sample indices [first, first + n) and returns `first`.
+  uint64_t ReserveSamples(uint64_t n) {
+    const uint64_t first = num_samples_;
+    num_samples_ += n;
+    return first;
+  }
+
+  // Generator of the stream which belongs to sample `index`. The stream is
+  // disjoint from the one of this generator and from those of all other
+  // samples.
+  PhiloxBitGen ForSample(uint64_t index) const {
+    return PhiloxBitGen(seed_, index + 1, deterministic_);
+  }
+
+ private:
+  PhiloxBitGen(uint64_t seed, uint64_t stream, bool deterministic);
+
+  // Computes the block at `position_` into `block_`.
+  void Refill();
+
+  uint64_t seed_;
+  uint64_t stream_;
+  bool deterministic_;
+
+  // Index of the next block to compute and number of unread words of the
+  // current block.
+  uint64_t position_ = 0;
+  std::array<uint64_t, 2> block_;
+  int available_ = 0;
+
+  // Number of samples reserved by `ReserveSamples`.
+  uint64_t num_samples_ = 0;
+};
+
+// Computes one Philox4x32-10 block. Exposed for testing against the reference
+// vectors of the algorithm.
+std::array<uint32_t, 4> Philox4x32(std::array<uint32_t, 4> counter,
+                                   std::array<uint32_t, 2> key);
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_PHILOX_BIT_GEN_H_
@@ -0,0 +1,94 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/philox_bit_gen.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/random.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::ElementsAre;
+
+TEST(Philox4x32Test, MatchesReferenceVectors) {
+  EXPECT_THAT(Philox4x32({0, 0, 0, 0}, {0, 0}),
+              ElementsAre(0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8));
+  EXPECT_THAT(Philox4x32({0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+                         {0xffffffff, 0xffffffff}),
+              ElementsAre(0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd));
+  EXPECT_THAT(Philox4x32({0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344},
+                         {0xa4093822, 0x299f31d0}),
+              ElementsAre(0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1));
+}
+
+std::vector<uint64_t> Draw(PhiloxBitGen bit_gen, int n) {
+  std::vector<uint64_t> values(n);
+  for (auto& value : values) value = bit_gen();
+  return values;
+}
+
+TEST(PhiloxBitGenTest, IsDeterministicForSeed) {
+  EXPECT_EQ(Draw(PhiloxBitGen(1), 5), Draw(PhiloxBitGen(1), 5));
+  EXPECT_NE(Draw(PhiloxBitGen(1), 5), Draw(PhiloxBitGen(2), 5));
+
+  EXPECT_TRUE(PhiloxBitGen(1).deterministic());
+  EXPECT_TRUE(PhiloxBitGen(1).ForSample(0).deterministic());
+  EXPECT_FALSE(PhiloxBitGen().deterministic());
+}
+
+TEST(PhiloxBitGenTest, SampleStreamsAreIndependentOfOrder) {
+  PhiloxBitGen bit_gen(7);
+  EXPECT_EQ(bit_gen.ReserveSamples(3), 0);
+  EXPECT_EQ(bit_gen.ReserveSamples(2), 3);
+
+  // Draws from the generator itself don't affect the sample streams.
+  const std::vector<uint64_t> first = Draw(bit_gen.ForSample(4), 3);
+  Draw(bit_gen, 10);
+  EXPECT_EQ(Draw(bit_gen.ForSample(4), 3), first);
+  EXPECT_EQ(Draw(PhiloxBitGen(7).ForSample(4), 3), first);
+
+  EXPECT_NE(Draw(bit_gen.ForSample(3), 3), first);
+  EXPECT_NE(Draw(bit_gen, 3), first);
+}
+
+TEST(PhiloxBitGenTest, WorksWithAbslDistributions) {
+  PhiloxBitGen bit_gen(3);
+  std::vector<int> counts(4);
+  for (int i = 0; i < 4000; i++) {
+    counts[absl::Uniform<int>(bit_gen, 0, 4)]++;
+  }
+  for (int count : counts) {
+    EXPECT_GT(count, 800);
+    EXPECT_LT(count, 1200);
+  }
+
+  std::vector<int> values = {1, 2, 3, 4, 5};
+  std::shuffle(values.begin(), values.end(), bit_gen);
+  std::sort(values.begin(), values.end());
+  EXPECT_THAT(values, ElementsAre(1, 2, 3, 4, 5));
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,93 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the throughput of `Queue` and `LockFreeQueue` with 1, 4 and 16
+// producers and consumers, e.g.:
+//
+//   bazel test -c opt //reverb/cc/support:queue_benchmark --test_output=all
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/support/lock_free_queue.h"
+#include "reverb/cc/support/queue.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+constexpr int kNumItems = 4000000;
+constexpr int kCapacity = 1024;
+
+// Pushes `kNumItems` items through a queue with `num_threads` producers and
+// `num_threads` consumers and logs the average time per item in ns.
+template <typename Q>
+void RunBenchmark(const std::string& name, int num_threads) {
+  Q queue(kCapacity);
+  const int items_per_producer = kNumItems / num_threads;
+
+  const absl::Time start = absl::Now();
+  std::vector<std::unique_ptr<Thread>> consumers;
+  for (int i = 0; i < num_threads; i++) {
+    consumers.push_back(StartThread("", [&queue] {
+      int64_t value;
+      while (queue.Pop(&value)) {
+      }
+    }));
+  }
+  std::vector<std::unique_ptr<Thread>> producers;
+  for (int i = 0; i < num_threads; i++) {
+    producers.push_back(StartThread("", [&queue, items_per_producer] {
+      for (int64_t j = 0; j < items_per_producer; j++) {
+        REVERB_CHECK(queue.Push(j));
+      }
+    }));
+  }
+  producers.clear();  // Joins the threads.
+  queue.SetLastItemPushed();
+  consumers.clear();
+  const absl::Duration elapsed = absl::Now() - start;
+
+  REVERB_LOG(REVERB_INFO) << name << "/" << num_threads << "x" << num_threads
+                          << ": "
+                          << absl::ToDoubleNanoseconds(elapsed) /
+                                 (items_per_producer * num_threads)
+                          << " ns/item";
+}
+
+TEST(QueueBenchmark, Queue) {
+  for (int num_threads : {1, 4, 16}) {
+    RunBenchmark<Queue<int64_t>>("Queue", num_threads);
+  }
+}
+
+TEST(QueueBenchmark, LockFreeQueue) {
+  for (int num_threads : {1, 4, 16}) {
+    RunBenchmark<LockFreeQueue<int64_t>>("LockFreeQueue", num_threads);
+  }
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -25,14 +25,23 @@
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/status_matchers.h"
 #include "reverb/cc/platform/thread.h"
+#include "reverb/cc/support/lock_free_queue.h"
 
 namespace deepmind {
 namespace reverb {
 namespace internal {
 namespace {
 
-TEST(QueueTest, PushAndPopAreConsistent) {
-  Queue<int> q(10);
+// `Queue` and `LockFreeQueue` implement the same interface and semantics so
+// all tests are run on both.
+template <typename Q>
+class QueueTest : public ::testing::Test {};
+
+using QueueTypes = ::testing::Types<Queue<int>, LockFreeQueue<int>>;
+TYPED_TEST_SUITE(QueueTest, QueueTypes);
+
+TYPED_TEST(QueueTest, PushAndPopAreConsistent) {
+  TypeParam q(10);
   int output;
   for (int i = 0; i < 100; i++) {
     q.Push(i);
@@ -41,8 +50,8 @@ TEST(QueueTest, PushAndPopAreConsistent) {
   }
 }
 
-TEST(QueueTest, PushBlocksWhenFull) {
-  Queue<int> q(2);
+TYPED_TEST(QueueTest, PushBlocksWhenFull) {
+  TypeParam q(2);
   ASSERT_TRUE(q.Push(1));
   ASSERT_TRUE(q.Push(2));
   absl::Notification n;
@@ -57,8 +66,8 @@ TEST(QueueTest, PushBlocksWhenFull) {
   EXPECT_EQ(output, 1);
 }
 
-TEST(QueueTest, PopBlocksWhenEmpty) {
-  Queue<int> q(2);
+TYPED_TEST(QueueTest, PopBlocksWhenEmpty) {
+  TypeParam q(2);
   absl::Notification n;
   int output;
   auto t = StartThread("", [&q, &n, &output] {
@@ -71,15 +80,15 @@ TEST(QueueTest, PopBlocksWhenEmpty) {
   EXPECT_EQ(output, 1);
 }
 
-TEST(QueueTest, AfterClosePushAndPopReturnFalse) {
-  Queue<int> q(2);
+TYPED_TEST(QueueTest, AfterClosePushAndPopReturnFalse) {
+  TypeParam q(2);
   q.Close();
   EXPECT_FALSE(q.Push(1));
   EXPECT_FALSE(q.Pop(nullptr));
 }
 
-TEST(QueueTest, CloseUnblocksPush) {
-  Queue<int> q(2);
+TYPED_TEST(QueueTest, CloseUnblocksPush) {
+  TypeParam q(2);
   ASSERT_TRUE(q.Push(1));
   ASSERT_TRUE(q.Push(2));
   absl::Notification n;
@@ -94,8 +103,8 @@ TEST(QueueTest, CloseUnblocksPush) {
   EXPECT_FALSE(ok);
 }
 
-TEST(QueueTest, CloseUnblocksPop) {
-  Queue<int> q(2);
+TYPED_TEST(QueueTest, CloseUnblocksPop) {
+  TypeParam q(2);
   absl::Notification n;
   bool ok;
   auto t = StartThread("", [&q, &n, &ok] {
@@ -109,8 +118,8 @@ TEST(QueueTest, CloseUnblocksPop) {
   EXPECT_FALSE(ok);
 }
 
-TEST(QueueTest, SizeReturnsNumberOfElements) {
-  Queue<int> q(3);
+TYPED_TEST(QueueTest, SizeReturnsNumberOfElements) {
+  TypeParam q(3);
   EXPECT_EQ(q.size(), 0);
 
   q.Push(20);
@@ -122,14 +131,14 @@ TEST(QueueTest, SizeReturnsNumberOfElements) {
   EXPECT_EQ(q.size(), 1);
 }
 
-TEST(QueueTest, PushFailsAfterSetLastItemPushed) {
-  Queue<int> q(3);
+TYPED_TEST(QueueTest, PushFailsAfterSetLastItemPushed) {
+  TypeParam q(3);
   q.SetLastItemPushed();
   EXPECT_FALSE(q.Push(1));
 }
 
-TEST(QueueTest, ExistingItemsCanBePoppedAfterSetLastItemPushed) {
-  Queue<int> q(3);
+TYPED_TEST(QueueTest, ExistingItemsCanBePoppedAfterSetLastItemPushed) {
+  TypeParam q(3);
 
   q.Push(1);
   q.Push(2);
@@ -146,8 +155,8 @@ TEST(QueueTest, ExistingItemsCanBePoppedAfterSetLastItemPushed) {
   EXPECT_FALSE(q.Pop(&v));
 }
 
-TEST(QueueTest, BlockingPopReturnsIfSetLastItemPushedCalled) {
-  Queue<int> q(2);
+TYPED_TEST(QueueTest, BlockingPopReturnsIfSetLastItemPushedCalled) {
+  TypeParam q(2);
   absl::Notification n;
   bool ok;
   auto t = StartThread("", [&q, &n, &ok] {
@@ -161,8 +170,8 @@ TEST(QueueTest, BlockingPopReturnsIfSetLastItemPushedCalled) {
   EXPECT_FALSE(ok);
 }
 
-TEST(QueueTest, PopBatchBlocksUntilBatchFull) {
-  Queue<int> q(10);
+TYPED_TEST(QueueTest, PopBatchBlocksUntilBatchFull) {
+  TypeParam q(10);
 
   std::vector<int> v;
   for (int i = 0; i < 5; i++) {
@@ -174,8 +183,8 @@ TEST(QueueTest, PopBatchBlocksUntilBatchFull) {
   REVERB_EXPECT_OK(q.PopBatch(5, &v));
 }
 
-TEST(QueueTest, PopBatchEmitsItemsInOrder) {
-  Queue<int> q(10);
+TYPED_TEST(QueueTest, PopBatchEmitsItemsInOrder) {
+  TypeParam q(10);
 
   for (int i = 0; i < 5; i++) {
     EXPECT_TRUE(q.Push(i));
@@ -186,8 +195,8 @@ TEST(QueueTest, PopBatchEmitsItemsInOrder) {
   EXPECT_THAT(v, testing::ElementsAre(0, 1, 2, 3, 4));
 }
 
-TEST(QueueTest, PopBatchReturnsIfSetLastItemPushed) {
-  Queue<int> q(3);
+TYPED_TEST(QueueTest, PopBatchReturnsIfSetLastItemPushed) {
+  TypeParam q(3);
   absl::Notification n;
   absl::Status status;
 
@@ -208,14 +217,14 @@ TEST(QueueTest, PopBatchReturnsIfSetLastItemPushed) {
   EXPECT_EQ(status.code(), absl::StatusCode::kResourceExhausted);
 }
 
-TEST(QueueTest, PopBatchReturnsInvalidArgumentIfBatchSizeTooBig) {
-  Queue<int> q(3);
+TYPED_TEST(QueueTest, PopBatchReturnsInvalidArgumentIfBatchSizeTooBig) {
+  TypeParam q(3);
   std::vector<int> v;
   EXPECT_EQ(q.PopBatch(4, &v).code(), absl::StatusCode::kInvalidArgument);
 }
 
-TEST(QueueTest, PopBatchReturnsCancelledIfClosedCalled) {
-  Queue<int> q(3);
+TYPED_TEST(QueueTest, PopBatchReturnsCancelledIfClosedCalled) {
+  TypeParam q(3);
   absl::Notification n;
   absl::Status status;
 
@@ -235,6 +244,48 @@ TEST(QueueTest, PopBatchReturnsCancelledIfClosedCalled) {
   EXPECT_EQ(status.code(), absl::StatusCode::kCancelled);
 }
 
+TYPED_TEST(QueueTest, ConcurrentProducersAndConsumers) {
+  constexpr int kNumThreads = 4;
+  constexpr int kItemsPerProducer = 10000;
+
+  TypeParam q(16);
+  std::vector<std::unique_ptr<Thread>> producers;
+  for (int i = 0; i < kNumThreads; i++) {
+    producers.push_back(StartThread("", [&q, i] {
+      for (int j = 0; j < kItemsPerProducer; j++) {
+        REVERB_CHECK(q.Push(i * kItemsPerProducer + j));
+      }
+    }));
+  }
+
+  std::vector<std::vector<int>> popped(kNumThreads);
+  std::vector<std::unique_ptr<Thread>> consumers;
+  for (int i = 0; i < kNumThreads; i++) {
+    consumers.push_back(StartThread("", [&q, &popped, i] {
+      int value;
+      while (q.Pop(&value)) {
+        popped[i].push_back(value);
+      }
+    }));
+  }
+
+  producers.clear();  // Joins the threads.
+  q.SetLastItemPushed();
+  consumers.clear();
+
+  std::vector<int> seen(kNumThreads * kItemsPerProducer, 0);
+  for (const auto& values : popped) {
+    // Items pushed by the same producer are popped in order.
+    std::vector<int> last(kNumThreads, -1);
+    for (int value : values) {
+      seen[value]++;
+      EXPECT_GT(value, last[value / kItemsPerProducer]);
+      last[value / kItemsPerProducer] = value;
+    }
+  }
+  EXPECT_THAT(seen, testing::Each(1));
+}
+
 }  // namespace
 }  // namespace internal
 }  // namespace reverb
@@ -0,0 +1,167 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_RCU_ARRAY_H_
+#define REVERB_CC_SUPPORT_RCU_ARRAY_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Array which is modified by a single writer while any number of readers
+// work on immutable versions of it (read-copy-update). The values are stored
+// in blocks of `kBlockSize` which are shared between versions: a modification
+// only copies the block it touches, once per version, and `Publish` makes the
+// modifications visible to readers by copying the block pointers. Readers
+// never block the writer, or each other, and keep the version they loaded
+// (and therefore its values) alive for as long as they hold it.
+//
+// The writer methods (everything except `Load`) are NOT thread safe and must
+// be externally synchronized. `Load` may be called concurrently with them.
+template <typename T, size_t kBlockSize = 1024>
+class RcuArray {
+ private:
+  using Block = std::array<T, kBlockSize>;
+
+ public:
+  // Immutable content of the array at the time of a `Publish`.
+  class Version {
+   public:
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    const T& operator[](size_t i) const {
+      return (*blocks_[i / kBlockSize])[i % kBlockSize];
+    }
+
+   private:
+    friend class RcuArray;
+
+    std::vector<std::shared_ptr<const Block>> blocks_;
+    size_t size_ = 0;
+  };
+
+  RcuArray() : published_(std::make_shared<const Version>()) {}
+
+  // Number of values of the array as seen by the writer, i.e including the
+  // modifications which haven't been published yet.
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const T& operator[](size_t i) const {
+    return (*blocks_[i / kBlockSize])[i % kBlockSize];
+  }
+
+  void PushBack(T value) {
+    if (size_ % kBlockSize == 0) {
+      blocks_.push_back(std::make_shared<Block>());
+      published_blocks_.push_back(false);
+    }
+    MutableBlock(size_ / kBlockSize)[size_ % kBlockSize] = std::move(value);
+    size_++;
+    num_unpublished_++;
+  }
+
+  void Set(size_t i, T value) {
+    REVERB_CHECK_LT(i, size_);
+    MutableBlock(i / kBlockSize)[i % kBlockSize] = std::move(value);
+    num_unpublished_++;
+  }
+
+  // Removes the last value. The value is reset to `T()` so that the writer no
+  // longer references it.
+  void PopBack() {
+    REVERB_CHECK_GT(size_, 0);
+    size_--;
+    if (size_ % kBlockSize == 0) {
+      blocks_.pop_back();
+      published_blocks_.pop_back();
+    } else {
+      MutableBlock(size_ / kBlockSize)[size_ % kBlockSize] = T();
+    }
+    num_unpublished_++;
+  }
+
+  void Clear() {
+    blocks_.clear();
+    published_blocks_.clear();
+    size_ = 0;
+    num_unpublished_++;
+  }
+
+  // Number of modifications since the last `Publish`.
+  int64_t num_unpublished() const { return num_unpublished_; }
+
+  // Number of blocks, i.e the number of pointers copied by `Publish`.
+  size_t num_blocks() const { return blocks_.size(); }
+
+  // Makes the current content visible to `Load`. Takes O(size / kBlockSize)
+  // time. Returns the previously published version, which the caller may
+  // want to release outside of its critical section since it could hold the
+  // last reference to removed values, or null if there was nothing to
+  // publish.
+  std::shared_ptr<const Version> Publish() {
+    if (num_unpublished_ == 0) return nullptr;
+    auto version = std::make_shared<Version>();
+    version->blocks_.assign(blocks_.begin(), blocks_.end());
+    version->size_ = size_;
+    std::fill(published_blocks_.begin(), published_blocks_.end(), true);
+    num_unpublished_ = 0;
+    return std::atomic_exchange(
+        &published_, std::shared_ptr<const Version>(std::move(version)));
+  }
+
+  // Most recently published version. Thread safe.
+  std::shared_ptr<const Version> Load() const {
+    return std::atomic_load(&published_);
+  }
+
+ private:
+  // Block `b` of the writer, copied first if it is shared with a published
+  // version.
+  Block& MutableBlock(size_t b) {
+    if (published_blocks_[b]) {
+      blocks_[b] = std::make_shared<Block>(*blocks_[b]);
+      published_blocks_[b] = false;
+    }
+    return *blocks_[b];
+  }
+
+  // Blocks of the writer and whether each of them is (also) referenced by the
+  // published version.
+  std::vector<std::shared_ptr<Block>> blocks_;
+  std::vector<bool> published_blocks_;
+  size_t size_ = 0;
+  int64_t num_unpublished_ = 0;
+
+  // Only accessed through `std::atomic_load` and `std::atomic_exchange`.
+  std::shared_ptr<const Version> published_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_RCU_ARRAY_H_
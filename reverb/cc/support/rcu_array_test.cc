@@ -0,0 +1,123 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/rcu_array.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+template <typename T, size_t kBlockSize>
+std::vector<T> Values(const typename RcuArray<T, kBlockSize>::Version& v) {
+  std::vector<T> values;
+  for (size_t i = 0; i < v.size(); i++) values.push_back(v[i]);
+  return values;
+}
+
+TEST(RcuArrayTest, ModificationsAreInvisibleUntilPublished) {
+  RcuArray<int, 2> array;
+  EXPECT_TRUE(array.Load()->empty());
+  for (int i = 0; i < 5; i++) array.PushBack(i);
+  EXPECT_EQ(array.size(), 5);
+  EXPECT_EQ(array[4], 4);
+  EXPECT_TRUE(array.Load()->empty());
+
+  EXPECT_NE(array.Publish(), nullptr);
+  EXPECT_THAT((Values<int, 2>(*array.Load())),
+              ::testing::ElementsAre(0, 1, 2, 3, 4));
+  EXPECT_EQ(array.Publish(), nullptr);
+}
+
+TEST(RcuArrayTest, LoadedVersionsDoNotChange) {
+  RcuArray<int, 2> array;
+  for (int i = 0; i < 5; i++) array.PushBack(i);
+  array.Publish();
+  auto before = array.Load();
+
+  array.Set(1, 10);
+  array.PopBack();
+  array.PopBack();
+  array.PushBack(20);
+  array.Publish();
+
+  EXPECT_THAT((Values<int, 2>(*before)), ::testing::ElementsAre(0, 1, 2, 3, 4));
+  EXPECT_THAT((Values<int, 2>(*array.Load())),
+              ::testing::ElementsAre(0, 10, 2, 20));
+}
+
+TEST(RcuArrayTest, RemovedValuesAreReleasedWithTheirVersion) {
+  RcuArray<std::shared_ptr<int>, 4> array;
+  auto value = std::make_shared<int>(1);
+  array.PushBack(value);
+  array.Publish();
+  auto version = array.Load();
+
+  array.PopBack();
+  auto previous = array.Publish();
+  EXPECT_EQ(previous, version);
+  EXPECT_EQ(value.use_count(), 2);
+  previous = nullptr;
+  EXPECT_EQ(value.use_count(), 2);
+  version = nullptr;
+  EXPECT_EQ(value.use_count(), 1);
+}
+
+TEST(RcuArrayTest, ClearRemovesAllValues) {
+  RcuArray<int, 2> array;
+  for (int i = 0; i < 3; i++) array.PushBack(i);
+  array.Publish();
+  array.Clear();
+  EXPECT_TRUE(array.empty());
+  array.PushBack(7);
+  array.Publish();
+  EXPECT_THAT((Values<int, 2>(*array.Load())), ::testing::ElementsAre(7));
+}
+
+TEST(RcuArrayTest, ReadersSeeConsistentVersions) {
+  // Every published version holds `size` copies of its size.
+  RcuArray<int, 4> array;
+  std::atomic<bool> done{false};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&] {
+      while (!done) {
+        auto version = array.Load();
+        for (size_t i = 0; i < version->size(); i++) {
+          ASSERT_EQ((*version)[i], version->size());
+        }
+      }
+    });
+  }
+  for (int size = 1; size < 100; size++) {
+    for (int i = 0; i < size - 1; i++) array.Set(i, size);
+    array.PushBack(size);
+    array.Publish();
+  }
+  done = true;
+  for (auto& reader : readers) reader.join();
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,101 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/reclamation_queue.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/support/thread_pool_usage.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+ReclamationQueue::ReclamationQueue()
+    : worker_(StartThread("ReclamationQueue", [this] { RunWorker(); })) {}
+
+ReclamationQueue::~ReclamationQueue() {
+  {
+    absl::MutexLock lock(&mu_);
+    stop_ = true;
+  }
+  // Joins the worker which releases everything pending before returning.
+  worker_ = nullptr;
+}
+
+void ReclamationQueue::Defer(std::shared_ptr<void> object) {
+  if (object == nullptr) return;
+  absl::MutexLock lock(&mu_);
+  pending_.push_back(std::move(object));
+}
+
+void ReclamationQueue::Defer(std::vector<std::shared_ptr<void>> objects) {
+  if (objects.empty()) return;
+  absl::MutexLock lock(&mu_);
+  if (pending_.empty()) {
+    pending_ = std::move(objects);
+  } else {
+    pending_.insert(pending_.end(), std::make_move_iterator(objects.begin()),
+                    std::make_move_iterator(objects.end()));
+  }
+}
+
+void ReclamationQueue::WaitUntilEmpty() {
+  absl::MutexLock lock(&mu_);
+  mu_.Await(absl::Condition(
+      +[](ReclamationQueue* queue) ABSL_EXCLUSIVE_LOCKS_REQUIRED(queue->mu_) {
+        return queue->pending_.empty() && !queue->releasing_;
+      },
+      this));
+}
+
+ReclamationQueue* ReclamationQueue::Default() {
+  static auto* queue = new ReclamationQueue();
+  return queue;
+}
+
+void ReclamationQueue::RunWorker() {
+  auto* usage = ThreadPoolUsageTracker::Get("ReclamationQueue");
+  usage->AddCurrentThread();
+  std::vector<std::shared_ptr<void>> batch;
+  while (true) {
+    {
+      absl::MutexLock lock(&mu_);
+      releasing_ = false;
+      mu_.Await(absl::Condition(
+          +[](ReclamationQueue* queue)
+              ABSL_EXCLUSIVE_LOCKS_REQUIRED(queue->mu_) {
+                return !queue->pending_.empty() || queue->stop_;
+              },
+          this));
+      if (pending_.empty()) return;
+      std::swap(batch, pending_);
+      releasing_ = true;
+    }
+    // Keeps the capacity of `batch` so it can be swapped back into `pending_`.
+    const absl::Time start = absl::Now();
+    batch.clear();
+    usage->RecordRunTime(absl::Now() - start);
+  }
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
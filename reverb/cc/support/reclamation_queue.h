@@ -0,0 +1,73 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_RECLAMATION_QUEUE_H_
+#define REVERB_CC_SUPPORT_RECLAMATION_QUEUE_H_
+
+#include <memory>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "reverb/cc/platform/thread.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Releases references to objects on a background thread.
+//
+// Destroying the last reference to an item can be expensive as it may in turn
+// release the last reference to its chunks, each of which owns potentially
+// large tensor buffers. When this happens while holding a lock (e.g the table
+// mutex) all other threads waiting for the lock are stalled until the memory
+// has been returned. Objects passed to `Defer` are instead destroyed by the
+// background thread of the queue, without holding any lock of the caller.
+//
+// The order in which deferred objects are released is unspecified.
+class ReclamationQueue {
+ public:
+  ReclamationQueue();
+
+  // Releases all remaining objects and joins the background thread.
+  ~ReclamationQueue();
+
+  // Takes ownership of the reference(s). Null references are ignored. Objects
+  // are destroyed without holding `mu_` so their destructors may defer other
+  // objects.
+  void Defer(std::shared_ptr<void> object);
+  void Defer(std::vector<std::shared_ptr<void>> objects);
+
+  // Blocks until every object deferred before the call has been released.
+  void WaitUntilEmpty();
+
+  // Queue shared by all tables of the process. Never destroyed.
+  static ReclamationQueue* Default();
+
+ private:
+  void RunWorker();
+
+  absl::Mutex mu_;
+  std::vector<std::shared_ptr<void>> pending_ ABSL_GUARDED_BY(mu_);
+  // True while the worker is releasing a batch it has taken from `pending_`.
+  bool releasing_ ABSL_GUARDED_BY(mu_) = false;
+  bool stop_ ABSL_GUARDED_BY(mu_) = false;
+  std::unique_ptr<Thread> worker_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_RECLAMATION_QUEUE_H_
@@ -0,0 +1,121 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/reclamation_queue.h"
+
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/synchronization/notification.h"
+#include "reverb/cc/platform/thread.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+TEST(ReclamationQueueTest, ReleasesDeferredObject) {
+  ReclamationQueue queue;
+  auto object = std::make_shared<int>(1);
+  std::weak_ptr<int> weak = object;
+  queue.Defer(std::move(object));
+  queue.WaitUntilEmpty();
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST(ReclamationQueueTest, ReleasesDeferredBatch) {
+  ReclamationQueue queue;
+  std::vector<std::shared_ptr<void>> objects;
+  std::vector<std::weak_ptr<int>> weak;
+  for (int i = 0; i < 10; i++) {
+    auto object = std::make_shared<int>(i);
+    weak.push_back(object);
+    objects.push_back(std::move(object));
+  }
+  queue.Defer(std::move(objects));
+  queue.WaitUntilEmpty();
+  for (const auto& w : weak) EXPECT_TRUE(w.expired());
+}
+
+TEST(ReclamationQueueTest, IgnoresNullObjects) {
+  ReclamationQueue queue;
+  queue.Defer(std::shared_ptr<void>());
+  queue.Defer(std::vector<std::shared_ptr<void>>{});
+  queue.WaitUntilEmpty();
+}
+
+TEST(ReclamationQueueTest, DoesNotReleaseObjectsWithOtherReferences) {
+  ReclamationQueue queue;
+  auto object = std::make_shared<int>(1);
+  queue.Defer(object);
+  queue.WaitUntilEmpty();
+  EXPECT_EQ(object.use_count(), 1);
+}
+
+TEST(ReclamationQueueTest, DeferDoesNotWaitForDestruction) {
+  struct Blocker {
+    explicit Blocker(absl::Notification* unblock) : unblock(unblock) {}
+    ~Blocker() { unblock->WaitForNotification(); }
+    absl::Notification* unblock;
+  };
+
+  ReclamationQueue queue;
+  absl::Notification unblock;
+  // The worker is stuck destroying the first object so the calls below would
+  // deadlock if they released the objects themselves.
+  queue.Defer(std::make_shared<Blocker>(&unblock));
+  auto object = std::make_shared<int>(1);
+  std::weak_ptr<int> weak = object;
+  queue.Defer(std::move(object));
+  EXPECT_FALSE(weak.expired());
+
+  unblock.Notify();
+  queue.WaitUntilEmpty();
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST(ReclamationQueueTest, DestructorReleasesPendingObjects) {
+  auto object = std::make_shared<int>(1);
+  std::weak_ptr<int> weak = object;
+  {
+    ReclamationQueue queue;
+    queue.Defer(std::move(object));
+  }
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST(ReclamationQueueTest, ConcurrentDefers) {
+  ReclamationQueue queue;
+  std::vector<std::weak_ptr<int>> weak(1000);
+  std::vector<std::unique_ptr<Thread>> threads;
+  for (int t = 0; t < 10; t++) {
+    threads.push_back(StartThread("", [&queue, &weak, t] {
+      for (int i = 0; i < 100; i++) {
+        auto object = std::make_shared<int>(i);
+        weak[t * 100 + i] = object;
+        queue.Defer(std::move(object));
+      }
+    }));
+  }
+  threads.clear();  // Joins all threads.
+  queue.WaitUntilEmpty();
+  for (const auto& w : weak) EXPECT_TRUE(w.expired());
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,100 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_SUPPORT_ROUND_ROBIN_QUEUE_H_
+#define REVERB_CC_SUPPORT_ROUND_ROBIN_QUEUE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Queue of values pushed by several clients. Values of the same client are
+// popped in the order they were pushed while the clients take turns, i.e the
+// values are popped round-robin across the clients which currently have values
+// in the queue. A client which pushes a large number of values therefore only
+// delays the values of other clients by at most one value each.
+//
+// Not thread-safe.
+template <typename T>
+class RoundRobinQueue {
+ public:
+  // Appends `value` to the values of `client_id`. If the client has no other
+  // values in the queue then it gets its turn after all other clients. O(1).
+  void Push(uint64_t client_id, T value) {
+    auto& values = queues_[client_id];
+    if (values.empty()) {
+      turns_.push_back(client_id);
+    }
+    values.push_back(std::move(value));
+    size_++;
+  }
+
+  // Removes and returns the oldest value of the client whose turn it is. Must
+  // not be called when the queue is empty. O(1).
+  T Pop() {
+    REVERB_CHECK(!empty());
+    const uint64_t client_id = turns_.front();
+    turns_.pop_front();
+    auto it = queues_.find(client_id);
+    T value = std::move(it->second.front());
+    it->second.pop_front();
+    if (it->second.empty()) {
+      queues_.erase(it);
+    } else {
+      turns_.push_back(client_id);
+    }
+    size_--;
+    return value;
+  }
+
+  // Removes all values in the order they would have been popped.
+  std::deque<T> PopAll() {
+    std::deque<T> values;
+    while (!empty()) {
+      values.push_back(Pop());
+    }
+    return values;
+  }
+
+  // Total number of values in the queue.
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  // Number of clients which have at least one value in the queue.
+  size_t num_clients() const { return turns_.size(); }
+
+ private:
+  // Values of each client with at least one value in the queue.
+  internal::flat_hash_map<uint64_t, std::deque<T>> queues_;
+
+  // Clients with values in the queue in the order they will be served.
+  std::deque<uint64_t> turns_;
+
+  size_t size_ = 0;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_ROUND_ROBIN_QUEUE_H_
@@ -0,0 +1,87 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/round_robin_queue.h"
+
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::ElementsAre;
+
+std::vector<int> PopAll(RoundRobinQueue<int>* queue) {
+  std::vector<int> values;
+  for (int value : queue->PopAll()) values.push_back(value);
+  return values;
+}
+
+TEST(RoundRobinQueueTest, SingleClientIsFifo) {
+  RoundRobinQueue<int> queue;
+  EXPECT_TRUE(queue.empty());
+  for (int i = 0; i < 5; i++) queue.Push(7, i);
+  EXPECT_EQ(queue.size(), 5);
+  EXPECT_EQ(queue.num_clients(), 1);
+  EXPECT_THAT(PopAll(&queue), ElementsAre(0, 1, 2, 3, 4));
+  EXPECT_TRUE(queue.empty());
+  EXPECT_EQ(queue.num_clients(), 0);
+}
+
+TEST(RoundRobinQueueTest, ClientsTakeTurns) {
+  RoundRobinQueue<int> queue;
+  // Client 1 pushes a burst of values before the other clients.
+  for (int i = 0; i < 4; i++) queue.Push(1, 10 + i);
+  queue.Push(2, 20);
+  queue.Push(3, 30);
+  queue.Push(2, 21);
+  EXPECT_EQ(queue.num_clients(), 3);
+  EXPECT_THAT(PopAll(&queue), ElementsAre(10, 20, 30, 11, 21, 12, 13));
+}
+
+TEST(RoundRobinQueueTest, ReturningClientIsServedLast) {
+  RoundRobinQueue<int> queue;
+  queue.Push(1, 10);
+  queue.Push(2, 20);
+  queue.Push(1, 11);
+  EXPECT_EQ(queue.Pop(), 10);
+  EXPECT_EQ(queue.Pop(), 20);
+  // Client 2 has no values left so it is put after client 1 when it returns.
+  queue.Push(2, 21);
+  queue.Push(3, 30);
+  EXPECT_THAT(PopAll(&queue), ElementsAre(11, 21, 30));
+}
+
+TEST(RoundRobinQueueTest, SupportsMoveOnlyValues) {
+  RoundRobinQueue<std::unique_ptr<int>> queue;
+  queue.Push(1, std::make_unique<int>(1));
+  queue.Push(2, std::make_unique<int>(2));
+  EXPECT_EQ(*queue.Pop(), 1);
+  EXPECT_EQ(*queue.Pop(), 2);
+}
+
+TEST(RoundRobinQueueDeathTest, PopFromEmptyQueue) {
+  RoundRobinQueue<int> queue;
+  EXPECT_DEATH(queue.Pop(), "");
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,77 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/sampler_autotuner.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+SamplerAutoTuner::SamplerAutoTuner(int max_workers, int64_t max_batch_size,
+                                   int queue_capacity)
+    : max_workers_(max_workers),
+      max_batch_size_(max_batch_size),
+      queue_capacity_(queue_capacity),
+      num_active_workers_(max_workers),
+      batch_size_(max_batch_size) {
+  REVERB_CHECK_GE(max_workers_, 1);
+  REVERB_CHECK_GE(max_batch_size_, 1);
+  REVERB_CHECK_GE(queue_capacity_, 1);
+}
+
+bool SamplerAutoTuner::OnSamplePopped(int queue_depth) {
+  total_queue_depth_ += queue_depth;
+  if (++num_observations_ < kNumObservationsToScore) {
+    return false;
+  }
+
+  double average_depth =
+      static_cast<double>(total_queue_depth_) / num_observations_;
+  total_queue_depth_ = 0;
+  num_observations_ = 0;
+
+  if (average_depth < kStarvedQueueFraction * queue_capacity_) {
+    if (num_active_workers_ < max_workers_) {
+      num_active_workers_++;
+      return true;
+    }
+    if (batch_size_ < max_batch_size_) {
+      batch_size_ = std::min(batch_size_ * 2, max_batch_size_);
+      return true;
+    }
+    return false;
+  }
+
+  if (average_depth > kSaturatedQueueFraction * queue_capacity_) {
+    if (batch_size_ > 1) {
+      batch_size_ /= 2;
+      return true;
+    }
+    if (num_active_workers_ > 1) {
+      num_active_workers_--;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,86 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SUPPORT_SAMPLER_AUTOTUNER_H_
+#define REVERB_CC_SUPPORT_SAMPLER_AUTOTUNER_H_
+
+#include <cstdint>
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Feedback controller which adjusts the number of active workers and the
+// maximum number of samples fetched per request of a `Sampler`. The controller
+// observes the depth of the sample queue every time the consumer pops a
+// sample and aims to keep the queue partially filled:
+//
+//   * If the consumer keeps finding the queue (almost) empty then the workers
+//     aren't keeping up. More workers are activated first and once all workers
+//     are active the batch size is doubled.
+//
+//   * If the consumer keeps finding the queue (almost) full then the workers
+//     are fetching samples faster than they are consumed and only add
+//     contention on the table. The batch size is halved first, which shortens
+//     how long the table lock is held by each call, and once the batch size
+//     reaches 1 workers are deactivated.
+//
+// Both values start at (and never exceed) the configured maximums so enabling
+// the controller can only reduce the load the sampler puts on the table.
+//
+// The class is NOT thread safe.
+class SamplerAutoTuner {
+ public:
+  // Number of observations which are averaged before (potentially) updating
+  // the recommendations.
+  static const int kNumObservationsToScore = 20;
+
+  // The queue is considered starved (saturated) if the average observed depth
+  // is below (above) this fraction of `queue_capacity`.
+  static constexpr double kStarvedQueueFraction = 0.25;
+  static constexpr double kSaturatedQueueFraction = 0.75;
+
+  SamplerAutoTuner(int max_workers, int64_t max_batch_size,
+                   int queue_capacity);
+
+  // Records the number of samples in the queue right before the consumer
+  // popped a sample from it. Returns true if the recommendations changed.
+  bool OnSamplePopped(int queue_depth);
+
+  // Number of workers which should be fetching samples. Workers with an index
+  // higher than or equal to this value should stay idle.
+  int num_active_workers() const { return num_active_workers_; }
+
+  // Maximum number of samples which should be fetched in a single request.
+  int64_t batch_size() const { return batch_size_; }
+
+ private:
+  const int max_workers_;
+  const int64_t max_batch_size_;
+  const int queue_capacity_;
+
+  int num_active_workers_;
+  int64_t batch_size_;
+
+  // Sum of the depths observed since the last time the score was calculated.
+  int64_t total_queue_depth_ = 0;
+  int num_observations_ = 0;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_SAMPLER_AUTOTUNER_H_
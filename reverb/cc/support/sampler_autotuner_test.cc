@@ -0,0 +1,104 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/sampler_autotuner.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+// Feeds a full window of observations with depth `queue_depth`. Returns the
+// result of the last call.
+bool ObserveWindow(SamplerAutoTuner* tuner, int queue_depth) {
+  bool changed = false;
+  for (int i = 0; i < SamplerAutoTuner::kNumObservationsToScore; i++) {
+    changed = tuner->OnSamplePopped(queue_depth);
+  }
+  return changed;
+}
+
+TEST(SamplerAutoTunerTest, StartsAtMaximum) {
+  SamplerAutoTuner tuner(4, 16, 8);
+  EXPECT_EQ(tuner.num_active_workers(), 4);
+  EXPECT_EQ(tuner.batch_size(), 16);
+}
+
+TEST(SamplerAutoTunerTest, OnlyUpdatesWhenWindowIsFull) {
+  SamplerAutoTuner tuner(4, 16, 8);
+  for (int i = 0; i < SamplerAutoTuner::kNumObservationsToScore - 1; i++) {
+    EXPECT_FALSE(tuner.OnSamplePopped(8));
+  }
+  EXPECT_TRUE(tuner.OnSamplePopped(8));
+  EXPECT_EQ(tuner.batch_size(), 8);
+}
+
+TEST(SamplerAutoTunerTest, SaturatedQueueShrinksBatchSizeBeforeWorkers) {
+  SamplerAutoTuner tuner(3, 4, 8);
+
+  EXPECT_TRUE(ObserveWindow(&tuner, 8));
+  EXPECT_EQ(tuner.batch_size(), 2);
+  EXPECT_EQ(tuner.num_active_workers(), 3);
+
+  EXPECT_TRUE(ObserveWindow(&tuner, 8));
+  EXPECT_EQ(tuner.batch_size(), 1);
+  EXPECT_EQ(tuner.num_active_workers(), 3);
+
+  EXPECT_TRUE(ObserveWindow(&tuner, 8));
+  EXPECT_TRUE(ObserveWindow(&tuner, 8));
+  EXPECT_EQ(tuner.batch_size(), 1);
+  EXPECT_EQ(tuner.num_active_workers(), 1);
+
+  // There is always at least one active worker fetching single samples.
+  EXPECT_FALSE(ObserveWindow(&tuner, 8));
+  EXPECT_EQ(tuner.num_active_workers(), 1);
+}
+
+TEST(SamplerAutoTunerTest, StarvedQueueGrowsWorkersBeforeBatchSize) {
+  SamplerAutoTuner tuner(2, 4, 8);
+  while (ObserveWindow(&tuner, 8)) {
+  }
+  ASSERT_EQ(tuner.num_active_workers(), 1);
+  ASSERT_EQ(tuner.batch_size(), 1);
+
+  EXPECT_TRUE(ObserveWindow(&tuner, 0));
+  EXPECT_EQ(tuner.num_active_workers(), 2);
+  EXPECT_EQ(tuner.batch_size(), 1);
+
+  EXPECT_TRUE(ObserveWindow(&tuner, 0));
+  EXPECT_EQ(tuner.batch_size(), 2);
+  EXPECT_TRUE(ObserveWindow(&tuner, 0));
+  EXPECT_EQ(tuner.batch_size(), 4);
+
+  // The configured maximums are never exceeded.
+  EXPECT_FALSE(ObserveWindow(&tuner, 0));
+  EXPECT_EQ(tuner.num_active_workers(), 2);
+  EXPECT_EQ(tuner.batch_size(), 4);
+}
+
+TEST(SamplerAutoTunerTest, KeepsRecommendationsWhenDepthIsOnTarget) {
+  SamplerAutoTuner tuner(4, 16, 8);
+  EXPECT_FALSE(ObserveWindow(&tuner, 4));
+  EXPECT_EQ(tuner.num_active_workers(), 4);
+  EXPECT_EQ(tuner.batch_size(), 16);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
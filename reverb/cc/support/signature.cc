@@ -24,6 +24,7 @@
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/support/trajectory_util.h"
 #include "reverb/cc/table.h"
+#include "reverb/cc/tensor_compression.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor.pb.h"
 #include "tensorflow/core/framework/types.h"
@@ -158,7 +159,7 @@ tensorflow::StructuredValue StructuredValueFromChunkData(
     shape.RemoveDim(0);
     auto* spec =
         value.mutable_list_value()->add_values()->mutable_tensor_spec_value();
-    spec->set_dtype(chunk.dtype());
+    spec->set_dtype(ChunkColumnDtype(chunk_data, i));
     shape.AsProto(spec->mutable_shape());
   }
 
@@ -223,24 +224,26 @@ absl::Status AddBatchDim(tensorflow::StructuredValue* value, int batch_size) {
 tensorflow::StructuredValue StructuredValueFromItem(const TableItem& item) {
   tensorflow::StructuredValue value;
 
-  auto get_tensor = [&](const FlatTrajectory::ChunkSlice& slice) {
+  auto get_chunk = [&](const FlatTrajectory::ChunkSlice& slice) {
     for (const auto& chunk : item.chunks) {
       if (chunk->key() == slice.chunk_key()) {
-        return &chunk->data().data().tensors(slice.index());
+        return &chunk->data();
       }
     }
     REVERB_CHECK(false) << "Invalid item.";
   };
 
-  for (int col_idx = 0; col_idx < item.item.flat_trajectory().columns_size();
-       col_idx++) {
-    const auto& col = item.item.flat_trajectory().columns(col_idx);
-    const auto* tensor_proto = get_tensor(col.chunk_slices(0));
+  FlatTrajectory scratch;
+  const FlatTrajectory& trajectory = item.flat_trajectory(&scratch);
+  for (int col_idx = 0; col_idx < trajectory.columns_size(); col_idx++) {
+    const auto& col = trajectory.columns(col_idx);
+    const int index = col.chunk_slices(0).index();
+    const ChunkData* chunk = get_chunk(col.chunk_slices(0));
 
     auto* spec =
         value.mutable_list_value()->add_values()->mutable_tensor_spec_value();
-    spec->set_dtype(tensor_proto->dtype());
-    *spec->mutable_shape() = tensor_proto->tensor_shape();
+    spec->set_dtype(ChunkColumnDtype(*chunk, index));
+    *spec->mutable_shape() = chunk->data().tensors(index).tensor_shape();
 
     if (col.squeeze()) {
       spec->mutable_shape()->mutable_dim()->DeleteSubrange(0, 1);
@@ -0,0 +1,154 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SUPPORT_SLOT_MAP_H_
+#define REVERB_CC_SUPPORT_SLOT_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/platform/huge_pages.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Map from unique keys to values where every entry is assigned a dense integer
+// slot. Values are stored in a vector indexed by slot so that, once the slot of
+// a key has been looked up, related data kept by other owners (e.g. selectors)
+// can be stored in vectors indexed by the same slot rather than in maps of
+// their own. Iterating over all entries walks the vector in slot order.
+//
+// Slots are reused after an entry has been erased, most recently freed first,
+// so that slots remain densely packed.
+//
+// The class is NOT thread safe.
+template <typename T>
+class SlotMap {
+ public:
+  using Key = uint64_t;
+
+  // Returned by `Find` if the key is not present.
+  static constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+  // Number of entries.
+  size_t size() const { return slots_.size(); }
+  bool empty() const { return slots_.empty(); }
+
+  // Upper bound (exclusive) of all slots currently in use.
+  size_t slot_count() const { return entries_.size(); }
+
+  // Slot of `key` or `kNotFound`.
+  size_t Find(Key key) const {
+    auto it = slots_.find(key);
+    return it == slots_.end() ? kNotFound : it->second;
+  }
+
+  bool contains(Key key) const { return slots_.contains(key); }
+
+  // Inserts `value` for `key` unless the key is already present. Returns the
+  // slot of the key and whether the value was inserted.
+  std::pair<size_t, bool> Insert(Key key, T value) {
+    auto it = slots_.try_emplace(key, 0);
+    if (!it.second) return {it.first->second, false};
+
+    size_t slot;
+    if (free_slots_.empty()) {
+      slot = entries_.size();
+      entries_.emplace_back();
+    } else {
+      slot = free_slots_.back();
+      free_slots_.pop_back();
+    }
+    it.first->second = slot;
+    entries_[slot] = {key, std::move(value), true};
+    return {slot, true};
+  }
+
+  // Removes the entry in `slot`, which must be occupied, and returns its value.
+  T Erase(size_t slot) {
+    REVERB_CHECK(occupied(slot));
+    Entry& entry = entries_[slot];
+    slots_.erase(entry.key);
+    entry.occupied = false;
+    free_slots_.push_back(slot);
+    return std::move(entry.value);
+  }
+
+  // Whether `slot` currently holds an entry.
+  bool occupied(size_t slot) const {
+    return slot < entries_.size() && entries_[slot].occupied;
+  }
+
+  // Key and value of the occupied `slot`.
+  Key key(size_t slot) const { return entries_[slot].key; }
+  T& operator[](size_t slot) { return entries_[slot].value; }
+  const T& operator[](size_t slot) const { return entries_[slot].value; }
+
+  // Value of `key`, which must be present.
+  T& at(Key key) { return entries_[slots_.at(key)].value; }
+  const T& at(Key key) const { return entries_[slots_.at(key)].value; }
+
+  // Calls `fn(slot, value)` for every entry in slot order.
+  template <typename F>
+  void ForEach(F fn) const {
+    for (size_t slot = 0; slot < entries_.size(); ++slot) {
+      if (entries_[slot].occupied) fn(slot, entries_[slot].value);
+    }
+  }
+
+  // Preallocates room for `n` entries. The entries are advised to be backed by
+  // huge pages since they are accessed in random order.
+  void Reserve(size_t n) {
+    slots_.reserve(n);
+    entries_.reserve(n);
+    AdviseHugePages(entries_.data(), entries_.capacity() * sizeof(Entry));
+  }
+
+  void Clear() {
+    slots_.clear();
+    entries_.clear();
+    free_slots_.clear();
+  }
+
+ private:
+  struct Entry {
+    Key key = 0;
+    T value{};
+    bool occupied = false;
+  };
+
+  // Slot of every key.
+  internal::flat_hash_map<Key, size_t> slots_;
+
+  // Entries indexed by slot. Erased entries remain until their slot is reused.
+  std::vector<Entry> entries_;
+
+  // Slots in `entries_` which are not occupied.
+  std::vector<size_t> free_slots_;
+};
+
+template <typename T>
+constexpr size_t SlotMap<T>::kNotFound;
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_SLOT_MAP_H_
@@ -0,0 +1,118 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/slot_map.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/random/random.h"
+#include "reverb/cc/platform/hash_map.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+TEST(SlotMapTest, InsertFindErase) {
+  SlotMap<std::string> map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(map.Find(1), SlotMap<std::string>::kNotFound);
+
+  auto inserted = map.Insert(1, "a");
+  EXPECT_TRUE(inserted.second);
+  EXPECT_EQ(map.Find(1), inserted.first);
+  EXPECT_EQ(map.key(inserted.first), 1);
+  EXPECT_EQ(map[inserted.first], "a");
+  EXPECT_EQ(map.at(1), "a");
+
+  // Existing keys are not overwritten.
+  auto existing = map.Insert(1, "b");
+  EXPECT_FALSE(existing.second);
+  EXPECT_EQ(existing.first, inserted.first);
+  EXPECT_EQ(map.at(1), "a");
+
+  EXPECT_EQ(map.Erase(inserted.first), "a");
+  EXPECT_FALSE(map.contains(1));
+  EXPECT_FALSE(map.occupied(inserted.first));
+  EXPECT_TRUE(map.empty());
+}
+
+TEST(SlotMapTest, ReusesFreedSlots) {
+  SlotMap<int> map;
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(map.Insert(i, i).first, i);
+  }
+  map.Erase(map.Find(1));
+  map.Erase(map.Find(2));
+  EXPECT_EQ(map.Insert(10, 10).first, 2);
+  EXPECT_EQ(map.Insert(11, 11).first, 1);
+  EXPECT_EQ(map.Insert(12, 12).first, 4);
+  EXPECT_EQ(map.slot_count(), 5);
+}
+
+TEST(SlotMapTest, ForEachVisitsEntriesInSlotOrder) {
+  SlotMap<int> map;
+  for (int i = 0; i < 4; i++) map.Insert(10 + i, i);
+  map.Erase(map.Find(11));
+
+  std::vector<std::pair<size_t, int>> visited;
+  map.ForEach(
+      [&](size_t slot, int value) { visited.emplace_back(slot, value); });
+  EXPECT_THAT(visited, ElementsAre(Pair(0, 0), Pair(2, 2), Pair(3, 3)));
+}
+
+TEST(SlotMapTest, ErasedValuesAreReleased) {
+  SlotMap<std::shared_ptr<int>> map;
+  auto value = std::make_shared<int>(1);
+  const size_t slot = map.Insert(1, value).first;
+  EXPECT_EQ(value.use_count(), 2);
+  map.Erase(slot);
+  EXPECT_EQ(value.use_count(), 1);
+}
+
+TEST(SlotMapTest, MatchesHashMapUnderRandomOperations) {
+  absl::BitGen gen;
+  SlotMap<int> map;
+  internal::flat_hash_map<uint64_t, int> expected;
+  for (int i = 0; i < 10000; i++) {
+    const uint64_t key = absl::Uniform<uint64_t>(gen, 0, 100);
+    if (absl::Bernoulli(gen, 0.5)) {
+      EXPECT_EQ(map.Insert(key, i).second, expected.emplace(key, i).second);
+    } else if (expected.erase(key)) {
+      map.Erase(map.Find(key));
+    } else {
+      EXPECT_EQ(map.Find(key), SlotMap<int>::kNotFound);
+    }
+    ASSERT_EQ(map.size(), expected.size());
+  }
+  for (const auto& entry : expected) {
+    EXPECT_EQ(map.at(entry.first), entry.second);
+  }
+  map.Clear();
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(map.slot_count(), 0);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,137 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/spill_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "reverb/cc/platform/logging.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+absl::Status ErrnoToStatus(absl::string_view op, absl::string_view path) {
+  return absl::InternalError(absl::StrCat(op, " failed for spill file ", path,
+                                          ": ", std::strerror(errno)));
+}
+
+size_t PageSize() {
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+
+uint64_t RoundUpToPage(uint64_t size) {
+  return (size + PageSize() - 1) / PageSize() * PageSize();
+}
+
+}  // namespace
+
+SpillFile::Mapping::Mapping(void* address, size_t mapped_size, size_t size)
+    : address_(address), mapped_size_(mapped_size), size_(size) {}
+
+SpillFile::Mapping::~Mapping() {
+  if (mapped_size_ != 0) munmap(address_, mapped_size_);
+}
+
+absl::Status SpillFile::Create(absl::string_view directory,
+                               std::unique_ptr<SpillFile>* file) {
+  std::string path = absl::StrCat(directory, "/reverb_spill_XXXXXX");
+  std::vector<char> path_buffer(path.begin(), path.end());
+  path_buffer.push_back('\0');
+  int fd = mkstemp(path_buffer.data());
+  if (fd < 0) return ErrnoToStatus("mkstemp", path);
+  path = path_buffer.data();
+  if (unlink(path.c_str()) != 0) {
+    auto status = ErrnoToStatus("unlink", path);
+    close(fd);
+    return status;
+  }
+  file->reset(new SpillFile(std::move(path), fd));
+  return absl::OkStatus();
+}
+
+SpillFile::SpillFile(std::string path, int fd)
+    : path_(std::move(path)), fd_(fd), end_(0), num_bytes_(0) {}
+
+SpillFile::~SpillFile() { close(fd_); }
+
+absl::Status SpillFile::Write(absl::string_view blob, Region* region) {
+  region->size = blob.size();
+  region->offset = end_.fetch_add(RoundUpToPage(blob.size()));
+
+  size_t written = 0;
+  while (written < blob.size()) {
+    ssize_t n = pwrite(fd_, blob.data() + written, blob.size() - written,
+                       region->offset + written);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      // The region is left as a (sparse) hole in the file.
+      return ErrnoToStatus("pwrite", path_);
+    }
+    written += n;
+  }
+  num_bytes_.fetch_add(blob.size());
+  return absl::OkStatus();
+}
+
+absl::Status SpillFile::Map(const Region& region,
+                            std::unique_ptr<Mapping>* mapping) const {
+  if (region.size == 0) {
+    *mapping = absl::make_unique<Mapping>(nullptr, 0, 0);
+    return absl::OkStatus();
+  }
+  // Map the whole pages so the kernel can read ahead the entire blob.
+  const size_t mapped_size = RoundUpToPage(region.size);
+  void* address = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd_,
+                       static_cast<off_t>(region.offset));
+  if (address == MAP_FAILED) return ErrnoToStatus("mmap", path_);
+  madvise(address, mapped_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+  *mapping = absl::make_unique<Mapping>(address, mapped_size, region.size);
+  return absl::OkStatus();
+}
+
+void SpillFile::Release(const Region& region) {
+  if (region.size == 0) return;
+  if (fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                static_cast<off_t>(region.offset),
+                static_cast<off_t>(RoundUpToPage(region.size))) != 0) {
+    REVERB_LOG(REVERB_WARNING)
+        << ErrnoToStatus("fallocate", path_).message();
+  }
+  num_bytes_.fetch_sub(region.size);
+}
+
+int64_t SpillFile::num_bytes() const { return num_bytes_.load(); }
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
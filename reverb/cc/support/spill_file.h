@@ -0,0 +1,109 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SUPPORT_SPILL_FILE_H_
+#define REVERB_CC_SUPPORT_SPILL_FILE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Append-only file on local disk which holds blobs (e.g serialized chunks)
+// that have been evicted from memory. The file is unlinked as soon as it has
+// been created so it never outlives the process, even if the process crashes.
+//
+// Every blob is written to a page aligned region of the file so it can be
+// mapped back into memory directly and so the space of released blobs can be
+// returned to the file system by punching holes. Regions are never reused.
+//
+// All methods are thread safe.
+class SpillFile {
+ public:
+  // Location of a blob in the file.
+  struct Region {
+    uint64_t offset = 0;
+    size_t size = 0;
+  };
+
+  // Read-only mapping of a region. The region is unmapped on destruction.
+  class Mapping {
+   public:
+    Mapping(void* address, size_t mapped_size, size_t size);
+    ~Mapping();
+
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+
+    const char* data() const { return static_cast<const char*>(address_); }
+    size_t size() const { return size_; }
+
+   private:
+    void* const address_;
+    const size_t mapped_size_;
+    const size_t size_;
+  };
+
+  // Creates a new (already unlinked) file in `directory`.
+  static absl::Status Create(absl::string_view directory,
+                             std::unique_ptr<SpillFile>* file);
+
+  ~SpillFile();
+
+  SpillFile(const SpillFile&) = delete;
+  SpillFile& operator=(const SpillFile&) = delete;
+
+  // Appends `blob` to the file and returns its location in `region`.
+  absl::Status Write(absl::string_view blob, Region* region);
+
+  // Maps the blob at `region` into memory.
+  absl::Status Map(const Region& region,
+                   std::unique_ptr<Mapping>* mapping) const;
+
+  // Returns the disk space of `region` to the file system. The region must not
+  // be mapped or written again. Failures are logged and otherwise ignored as
+  // they only waste disk space.
+  void Release(const Region& region);
+
+  // Total number of bytes of the blobs which have been written but not yet
+  // released.
+  int64_t num_bytes() const;
+
+ private:
+  SpillFile(std::string path, int fd);
+
+  // Path the file had before it was unlinked. Only used in error messages.
+  const std::string path_;
+  const int fd_;
+
+  // Offset at which the next region starts. Always page aligned.
+  std::atomic<uint64_t> end_;
+
+  std::atomic<int64_t> num_bytes_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_SPILL_FILE_H_
@@ -0,0 +1,93 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/spill_file.h"
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/string_view.h"
+#include "reverb/cc/platform/status_matchers.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+std::string TempDir() {
+  const char* dir = std::getenv("TEST_TMPDIR");
+  return dir != nullptr ? dir : "/tmp";
+}
+
+TEST(SpillFileTest, MapReturnsWrittenBlobs) {
+  std::unique_ptr<SpillFile> file;
+  REVERB_ASSERT_OK(SpillFile::Create(TempDir(), &file));
+
+  const std::string first = "hello";
+  const std::string second(10000, 'x');
+  SpillFile::Region first_region, second_region;
+  REVERB_ASSERT_OK(file->Write(first, &first_region));
+  REVERB_ASSERT_OK(file->Write(second, &second_region));
+  EXPECT_NE(first_region.offset, second_region.offset);
+  EXPECT_EQ(file->num_bytes(), first.size() + second.size());
+
+  std::unique_ptr<SpillFile::Mapping> mapping;
+  REVERB_ASSERT_OK(file->Map(second_region, &mapping));
+  EXPECT_EQ(absl::string_view(mapping->data(), mapping->size()), second);
+  REVERB_ASSERT_OK(file->Map(first_region, &mapping));
+  EXPECT_EQ(absl::string_view(mapping->data(), mapping->size()), first);
+}
+
+TEST(SpillFileTest, ReleaseOnlyAffectsReleasedRegion) {
+  std::unique_ptr<SpillFile> file;
+  REVERB_ASSERT_OK(SpillFile::Create(TempDir(), &file));
+
+  SpillFile::Region released, kept;
+  REVERB_ASSERT_OK(file->Write(std::string(5000, 'a'), &released));
+  REVERB_ASSERT_OK(file->Write(std::string(5000, 'b'), &kept));
+
+  file->Release(released);
+  EXPECT_EQ(file->num_bytes(), 5000);
+
+  std::unique_ptr<SpillFile::Mapping> mapping;
+  REVERB_ASSERT_OK(file->Map(kept, &mapping));
+  EXPECT_EQ(absl::string_view(mapping->data(), mapping->size()),
+            std::string(5000, 'b'));
+}
+
+TEST(SpillFileTest, EmptyBlob) {
+  std::unique_ptr<SpillFile> file;
+  REVERB_ASSERT_OK(SpillFile::Create(TempDir(), &file));
+
+  SpillFile::Region region;
+  REVERB_ASSERT_OK(file->Write("", &region));
+  std::unique_ptr<SpillFile::Mapping> mapping;
+  REVERB_ASSERT_OK(file->Map(region, &mapping));
+  EXPECT_EQ(mapping->size(), 0);
+  file->Release(region);
+}
+
+TEST(SpillFileTest, CreateFailsForMissingDirectory) {
+  std::unique_ptr<SpillFile> file;
+  EXPECT_FALSE(SpillFile::Create("/does/not/exist", &file).ok());
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -14,16 +14,43 @@
 
 #include "reverb/cc/support/task_executor.h"
 
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "reverb/cc/platform/logging.h"
+
 namespace deepmind {
 namespace reverb {
+namespace {
+
+// The executor and deque index of the worker running on this thread, if any.
+thread_local const TaskExecutor* current_executor = nullptr;
+thread_local int current_index = -1;
+
+}  // namespace
+
+constexpr int TaskExecutor::kNumLanes;
 
 TaskExecutor::TaskExecutor(size_t num_threads,
-                           const std::string& thread_name_prefix)
-    : queue_() {
+                           const std::string& thread_name_prefix,
+                           int latency_sensitive_weight,
+                           absl::Span<const int> cpu_affinity)
+    : latency_sensitive_weight_(latency_sensitive_weight),
+      usage_(internal::ThreadPoolUsageTracker::Get(thread_name_prefix)) {
+  REVERB_CHECK_GT(num_threads, 0);
+  REVERB_CHECK_GE(latency_sensitive_weight, 1);
+  for (int i = 0; i < num_threads; i++) {
+    deques_.push_back(std::make_unique<Deque>());
+    absl::MutexLock lock(&deques_.back()->mu);
+    deques_.back()->stats.thread_name =
+        absl::StrCat(thread_name_prefix, "_", i);
+  }
   for (int thread_index = 0; thread_index < num_threads; thread_index++) {
     threads_.push_back(internal::StartThread(
         absl::StrCat(thread_name_prefix, "_", thread_index),
-        [this] { RunWorker(); }));
+        [this, thread_index] { RunWorker(thread_index); }, cpu_affinity));
   }
 }
 
@@ -31,25 +58,218 @@ TaskExecutor::~TaskExecutor() {
   Close();
 }
 
-void TaskExecutor::Schedule(const std::function<void()>& callback) {
-  queue_.Push(std::move(callback));
+TaskExecutor::Deque* TaskExecutor::ScheduleTarget() {
+  if (current_executor == this) {
+    return deques_[current_index].get();
+  }
+  return deques_[static_cast<unsigned>(next_deque_++) % deques_.size()].get();
+}
+
+void TaskExecutor::Schedule(std::function<void()> callback, Lane lane) {
+  if (closed_) return;
+  Deque* deque = ScheduleTarget();
+  {
+    absl::MutexLock lock(&deque->mu);
+    deque->lanes[static_cast<int>(lane)].push_back(
+        {std::move(callback), absl::Now()});
+  }
+  num_pending_per_lane_[static_cast<int>(lane)]++;
+  num_pending_++;
+  WakeIdleThreads(1);
+}
+
+void TaskExecutor::ScheduleBatch(std::vector<std::function<void()>> callbacks,
+                                 Lane lane) {
+  if (closed_ || callbacks.empty()) return;
+  Deque* deque = ScheduleTarget();
+  const absl::Time now = absl::Now();
+  {
+    absl::MutexLock lock(&deque->mu);
+    for (auto& callback : callbacks) {
+      deque->lanes[static_cast<int>(lane)].push_back(
+          {std::move(callback), now});
+    }
+  }
+  num_pending_per_lane_[static_cast<int>(lane)] += callbacks.size();
+  num_pending_ += callbacks.size();
+  WakeIdleThreads(callbacks.size());
+}
+
+void TaskExecutor::ParallelFor(int64_t n,
+                               const std::function<void(int64_t)>& fn,
+                               int max_parallelism, Lane lane) {
+  if (n <= 0) return;
+  if (n == 1) {
+    fn(0);
+    return;
+  }
+
+  // Helpers which are only picked up after all indices have been claimed
+  // return without touching `fn`, which is only guaranteed to be alive until
+  // `num_done` reaches `n`.
+  struct State {
+    State(int64_t n, const std::function<void(int64_t)>* fn) : n(n), fn(fn) {}
+    const int64_t n;
+    const std::function<void(int64_t)>* const fn;
+    std::atomic<int64_t> next{0};
+    absl::Mutex mu;
+    int64_t num_done ABSL_GUARDED_BY(mu) = 0;
+
+    bool Done() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu) {
+      return num_done == n;
+    }
+
+    void Run() {
+      int64_t num_run = 0;
+      for (int64_t i = next++; i < n; i = next++) {
+        (*fn)(i);
+        num_run++;
+      }
+      if (num_run > 0) {
+        absl::MutexLock lock(&mu);
+        num_done += num_run;
+      }
+    }
+  };
+  auto state = std::make_shared<State>(n, &fn);
+
+  int64_t num_helpers = std::min<int64_t>(n - 1, threads_.size());
+  if (max_parallelism > 0) {
+    num_helpers = std::min<int64_t>(num_helpers, max_parallelism - 1);
+  }
+  std::vector<std::function<void()>> helpers;
+  helpers.reserve(num_helpers);
+  for (int64_t i = 0; i < num_helpers; i++) {
+    helpers.push_back([state] { state->Run(); });
+  }
+  ScheduleBatch(std::move(helpers), lane);
+
+  state->Run();
+  absl::MutexLock lock(&state->mu);
+  state->mu.Await(absl::Condition(state.get(), &State::Done));
+}
+
+void TaskExecutor::WakeIdleThreads(int num_tasks) {
+  // `num_pending_` is incremented before `num_idle_` is read while idle threads
+  // increment `num_idle_` before reading `num_pending_`, so either the idle
+  // thread sees the new task or it is woken up here.
+  if (num_idle_ == 0) return;
+  absl::MutexLock lock(&idle_mu_);
+  if (num_tasks == 1) {
+    idle_cv_.Signal();
+  } else {
+    idle_cv_.SignalAll();
+  }
+}
+
+bool TaskExecutor::PopFrom(Deque* deque, bool steal, Task* task) {
+  absl::MutexLock lock(&deque->mu);
+  auto& latency_sensitive =
+      deque->lanes[static_cast<int>(Lane::kLatencySensitive)];
+  auto& bulk = deque->lanes[static_cast<int>(Lane::kBulk)];
+  if (latency_sensitive.empty() && bulk.empty()) {
+    return false;
+  }
+
+  Lane lane = Lane::kLatencySensitive;
+  if (latency_sensitive.empty() ||
+      (!bulk.empty() && deque->credits >= latency_sensitive_weight_)) {
+    lane = Lane::kBulk;
+  }
+  // Thieves don't affect the ratio between the lanes of the owning thread.
+  if (!steal) {
+    deque->credits = lane == Lane::kBulk ? 0 : deque->credits + 1;
+  }
+
+  auto& tasks = deque->lanes[static_cast<int>(lane)];
+  if (steal) {
+    *task = std::move(tasks.back());
+    tasks.pop_back();
+  } else {
+    *task = std::move(tasks.front());
+    tasks.pop_front();
+  }
+  num_pending_per_lane_[static_cast<int>(lane)]--;
+  num_pending_--;
+  return true;
+}
+
+bool TaskExecutor::TryPop(int index, Task* task) {
+  if (PopFrom(deques_[index].get(), /*steal=*/false, task)) {
+    return true;
+  }
+  for (int i = 1; i < deques_.size(); i++) {
+    if (PopFrom(deques_[(index + i) % deques_.size()].get(), /*steal=*/true,
+                task)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<ThreadStats> TaskExecutor::GetThreadStats() const {
+  std::vector<ThreadStats> stats(deques_.size());
+  for (int i = 0; i < deques_.size(); i++) {
+    absl::MutexLock lock(&deques_[i]->mu);
+    stats[i] = deques_[i]->stats;
+    stats[i].queue_depth_per_lane.clear();
+    for (const auto& lane : deques_[i]->lanes) {
+      stats[i].queue_depth_per_lane.push_back(lane.size());
+    }
+  }
+  return stats;
 }
 
 void TaskExecutor::Close() {
-  std::function<void()> callback;
-  // Before closing, we cancel all the pending tasks.
-  queue_.SetLastItemPushed();
-  while (queue_.Pop(&callback)) {
-    callback();
+  {
+    absl::MutexLock lock(&idle_mu_);
+    if (closed_) return;
+    closed_ = true;
+    idle_cv_.SignalAll();
+  }
+  // Before closing, we run all the pending tasks.
+  Task task;
+  while (TryPop(0, &task)) {
+    task.callback();
   }
   threads_.clear();  // Joins worker threads.
 }
 
-void TaskExecutor::RunWorker() {
-  std::function<void()> callback;
-  while (queue_.Pop(&callback)) {
-    callback();
+void TaskExecutor::RunWorker(int index) {
+  current_executor = this;
+  current_index = index;
+  usage_->AddCurrentThread();
+  Deque* own = deques_[index].get();
+  Task task;
+  while (true) {
+    if (TryPop(index, &task)) {
+      const absl::Time started_at = absl::Now();
+      usage_->RecordQueueWait(started_at - task.created_at);
+      {
+        absl::MutexLock lock(&own->mu);
+        own->stats.current_task_id++;
+        own->stats.current_task_created_at = task.created_at;
+        own->stats.current_task_started_at = started_at;
+      }
+      task.callback();
+      task.callback = nullptr;
+      usage_->RecordRunTime(absl::Now() - started_at);
+      {
+        absl::MutexLock lock(&own->mu);
+        own->stats.num_tasks_processed++;
+      }
+      continue;
+    }
+    absl::MutexLock lock(&idle_mu_);
+    num_idle_++;
+    while (num_pending_ == 0 && !closed_) {
+      idle_cv_.Wait(&idle_mu_);
+    }
+    num_idle_--;
+    if (num_pending_ == 0 && closed_) break;
   }
+  current_executor = nullptr;
+  current_index = -1;
 }
 
 }  // namespace reverb
@@ -15,37 +15,149 @@
 #ifndef REVERB_CC_TASK_EXECUTOR_H_
 #define REVERB_CC_TASK_EXECUTOR_H_
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "reverb/cc/platform/status_macros.h"
 #include "reverb/cc/platform/thread.h"
-#include "reverb/cc/support/unbounded_queue.h"
+#include "reverb/cc/support/thread_pool_usage.h"
+#include "reverb/cc/thread_stats.h"
 
 namespace deepmind {
 namespace reverb {
 
-// Class that implements a thread pool that executes tasks from a queue. It is
-// thread-safe.
+// Class that implements a work-stealing thread pool. It is thread-safe.
+//
+// Every thread owns a deque of tasks. Tasks scheduled from one of the threads
+// of the pool are pushed to the deque of that thread, tasks scheduled from any
+// other thread are distributed round-robin over the deques. A thread runs the
+// tasks of its own deque in the order they were scheduled and steals the most
+// recently scheduled task of another thread when its own deque is empty. This
+// avoids funnelling the callbacks of all tables through a single queue.
+//
+// Every deque is split into lanes so that latency sensitive tasks (e.g. the
+// delivery of samples) are not stuck behind bulk work (e.g. acknowledging
+// inserts). When both lanes hold tasks, `latency_sensitive_weight` tasks of
+// `Lane::kLatencySensitive` are run for every task of `Lane::kBulk`.
 class TaskExecutor {
  public:
+  enum class Lane { kLatencySensitive = 0, kBulk = 1 };
+  static constexpr int kNumLanes = 2;
+
   // Constructs a TaskExecutor.
   // num_threads: number of threads that will run tasks.
   // thread_name_prefix: is used as a prefix for the name of the threads.
-  TaskExecutor(size_t num_threads, const std::string& thread_name_prefix);
+  // latency_sensitive_weight: number of latency sensitive tasks which are run
+  //   for every bulk task when both lanes are non-empty. Must be >= 1.
+  // cpu_affinity: CPUs which the threads are restricted to (see
+  //   `internal::Thread::SetCpuAffinity`). Empty if any CPU may be used.
+  TaskExecutor(size_t num_threads, const std::string& thread_name_prefix,
+               int latency_sensitive_weight = 1,
+               absl::Span<const int> cpu_affinity = {});
 
   ~TaskExecutor();
 
   // Schedules `task_cb` to be called as soon as possible.
-  void Schedule(const std::function<void()>& callback);
+  void Schedule(std::function<void()> callback,
+                Lane lane = Lane::kLatencySensitive);
+
+  // Schedules all of `callbacks`. The callbacks are pushed to the same deque
+  // with a single lock acquisition and idle threads steal from it.
+  void ScheduleBatch(std::vector<std::function<void()>> callbacks,
+                     Lane lane = Lane::kLatencySensitive);
+
+  // Calls `fn(i)` for every `i` in [0, `n`) and returns once all calls have
+  // returned. The calls are spread over up to `max_parallelism` threads of the
+  // executor (all threads if <= 0) and the calling thread, which runs the
+  // calls that haven't been picked up by the executor so the method makes
+  // progress even when all threads are busy (or when called from one of them).
+  void ParallelFor(int64_t n, const std::function<void(int64_t)>& fn,
+                   int max_parallelism = 0,
+                   Lane lane = Lane::kLatencySensitive);
 
-  // Closes the thread pool and the queue. After calling this, no new tasks
-  // will be scheduled and pending tasks will run with a cancelled status.
+  // Number of scheduled tasks which have not yet been picked up by a thread.
+  int num_pending_tasks() const { return num_pending_; }
+
+  // Number of scheduled tasks in `lane` which have not yet been picked up by a
+  // thread.
+  int num_pending_tasks(Lane lane) const {
+    return num_pending_per_lane_[static_cast<int>(lane)];
+  }
+
+  // Number of threads running the tasks.
+  int num_threads() const { return threads_.size(); }
+
+  // Returns a snapshot of the statistics of the worker threads (each item
+  // of the vector corresponds to one worker thread). The depth of the lanes of
+  // the deque owned by each thread is reported in `queue_depth_per_lane` and
+  // the name it was started with in `thread_name`.
+  std::vector<ThreadStats> GetThreadStats() const;
+
+  // Closes the thread pool. After calling this, no new tasks will be scheduled
+  // and pending tasks are run before the threads are joined.
   void Close();
 
  private:
-  void RunWorker();
+  struct Task {
+    std::function<void()> callback;
+    absl::Time created_at;
+  };
+
+  struct Deque {
+    mutable absl::Mutex mu;
+    std::array<std::deque<Task>, kNumLanes> lanes ABSL_GUARDED_BY(mu);
+    // Latency sensitive tasks taken from the front since the last bulk task.
+    int credits ABSL_GUARDED_BY(mu) = 0;
+    // Statistics of the thread owning the deque.
+    ThreadStats stats ABSL_GUARDED_BY(mu);
+  };
+
+  void RunWorker(int index);
+
+  // Returns the deque which tasks scheduled from the calling thread are pushed
+  // to.
+  Deque* ScheduleTarget();
+
+  // Pops a task from the front of `deque` or, if `steal` is true, from the
+  // back. Returns false if `deque` is empty.
+  bool PopFrom(Deque* deque, bool steal, Task* task);
+
+  // Pops a task from the deque of thread `index` or, if it is empty, steals
+  // one from another deque. Returns false if all deques are empty.
+  bool TryPop(int index, Task* task);
+
+  // Wakes up to `num_tasks` idle threads.
+  void WakeIdleThreads(int num_tasks);
+
+  const int latency_sensitive_weight_;
+
+  // Usage of the pool shared by all executors with the same
+  // `thread_name_prefix`.
+  internal::ThreadPoolUsageTracker* const usage_;
+
+  std::vector<std::unique_ptr<Deque>> deques_;
+  std::atomic<int> num_pending_{0};
+  std::array<std::atomic<int>, kNumLanes> num_pending_per_lane_{};
+  std::atomic<int> next_deque_{0};
+
+  // Idle threads wait on `idle_cv_` until tasks are scheduled or the executor
+  // is closed. `num_idle_` allows `Schedule` to skip the mutex when all
+  // threads are busy.
+  absl::Mutex idle_mu_;
+  absl::CondVar idle_cv_;
+  std::atomic<int> num_idle_{0};
+  std::atomic<bool> closed_{false};
 
-  internal::UnboundedQueue<std::function<void()>> queue_;
   std::vector<std::unique_ptr<internal::Thread>> threads_;
 };
 
@@ -0,0 +1,249 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/support/task_executor.h"
+
+#include <sched.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/thread_pool_usage.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+TEST(TaskExecutorTest, RunsScheduledTasks) {
+  TaskExecutor executor(4, "test");
+  EXPECT_EQ(executor.num_threads(), 4);
+  absl::BlockingCounter counter(100);
+  for (int i = 0; i < 100; i++) {
+    executor.Schedule([&] { counter.DecrementCount(); });
+  }
+  counter.Wait();
+}
+
+TEST(TaskExecutorTest, RunsScheduledBatch) {
+  TaskExecutor executor(4, "test");
+  absl::BlockingCounter counter(100);
+  std::vector<std::function<void()>> callbacks(
+      100, [&] { counter.DecrementCount(); });
+  executor.ScheduleBatch(std::move(callbacks));
+  counter.Wait();
+}
+
+TEST(TaskExecutorTest, ParallelForCallsEveryIndexOnce) {
+  TaskExecutor executor(4, "test");
+  std::vector<std::atomic<int>> calls(1000);
+  executor.ParallelFor(calls.size(), [&](int64_t i) { calls[i]++; });
+  for (const auto& count : calls) {
+    EXPECT_EQ(count, 1);
+  }
+}
+
+TEST(TaskExecutorTest, ParallelForRespectsMaxParallelism) {
+  TaskExecutor executor(8, "test");
+  std::atomic<int> running(0);
+  std::atomic<int> max_running(0);
+  executor.ParallelFor(
+      64,
+      [&](int64_t) {
+        int now = ++running;
+        int prev = max_running;
+        while (now > prev && !max_running.compare_exchange_weak(prev, now)) {
+        }
+        absl::SleepFor(absl::Milliseconds(1));
+        running--;
+      },
+      /*max_parallelism=*/2);
+  EXPECT_LE(max_running, 2);
+}
+
+TEST(TaskExecutorTest, ParallelForMakesProgressWhenThreadsAreBusy) {
+  TaskExecutor executor(1, "test");
+  absl::Notification blocked;
+  absl::Notification release;
+  executor.Schedule([&] {
+    blocked.Notify();
+    release.WaitForNotification();
+  });
+  blocked.WaitForNotification();
+
+  // The only thread is blocked so the calls are run by the calling thread.
+  std::atomic<int> calls(0);
+  executor.ParallelFor(10, [&](int64_t) { calls++; });
+  EXPECT_EQ(calls, 10);
+  release.Notify();
+}
+
+TEST(TaskExecutorTest, ParallelForCanBeNestedInTasks) {
+  TaskExecutor executor(2, "test");
+  std::atomic<int> calls(0);
+  absl::BlockingCounter done(4);
+  for (int i = 0; i < 4; i++) {
+    executor.Schedule([&] {
+      executor.ParallelFor(8, [&](int64_t) { calls++; });
+      done.DecrementCount();
+    });
+  }
+  done.Wait();
+  EXPECT_EQ(calls, 32);
+}
+
+TEST(TaskExecutorTest, IdleThreadsStealTasks) {
+  TaskExecutor executor(4, "test");
+  absl::Notification release;
+  absl::BlockingCounter started(4);
+  // The batch is pushed to a single deque so all but one of the tasks can only
+  // start if they are stolen by the other threads.
+  std::vector<std::function<void()>> callbacks(4, [&] {
+    started.DecrementCount();
+    release.WaitForNotification();
+  });
+  executor.ScheduleBatch(std::move(callbacks));
+  started.Wait();
+  release.Notify();
+}
+
+TEST(TaskExecutorTest, TasksScheduledFromWorkerRunInOrder) {
+  TaskExecutor executor(1, "test");
+  std::vector<int> order;
+  absl::Notification done;
+  executor.Schedule([&] {
+    for (int i = 0; i < 10; i++) {
+      executor.Schedule([&order, i] { order.push_back(i); });
+    }
+    executor.Schedule([&] { done.Notify(); });
+  });
+  done.WaitForNotification();
+  EXPECT_THAT(order, ::testing::ElementsAre(0, 1, 2, 3, 4, 5, 6, 7, 8, 9));
+}
+
+TEST(TaskExecutorTest, CloseRunsPendingTasks) {
+  std::atomic<int> num_calls(0);
+  absl::Notification release;
+  TaskExecutor executor(1, "test");
+  executor.Schedule([&] { release.WaitForNotificationWithTimeout(
+                              absl::Milliseconds(100)); });
+  for (int i = 0; i < 10; i++) {
+    executor.Schedule([&] { num_calls++; });
+  }
+  executor.Close();
+  EXPECT_EQ(num_calls, 10);
+  EXPECT_EQ(executor.num_pending_tasks(), 0);
+
+  // Tasks scheduled after the executor was closed are ignored.
+  executor.Schedule([&] { num_calls++; });
+  EXPECT_EQ(num_calls, 10);
+}
+
+TEST(TaskExecutorTest, LatencySensitiveLaneIsWeighted) {
+  TaskExecutor executor(1, "test", /*latency_sensitive_weight=*/3);
+  absl::Notification release;
+  absl::Notification blocked;
+  // Block the thread with a bulk task so the ratio between the lanes starts
+  // afresh.
+  executor.Schedule(
+      [&] {
+        blocked.Notify();
+        release.WaitForNotification();
+      },
+      TaskExecutor::Lane::kBulk);
+  blocked.WaitForNotification();
+
+  std::vector<char> order;
+  absl::BlockingCounter counter(12);
+  auto record = [&](char lane) {
+    return [&, lane] {
+      order.push_back(lane);
+      counter.DecrementCount();
+    };
+  };
+  for (int i = 0; i < 4; i++) {
+    executor.Schedule(record('b'), TaskExecutor::Lane::kBulk);
+  }
+  for (int i = 0; i < 8; i++) {
+    executor.Schedule(record('s'));
+  }
+  EXPECT_EQ(executor.num_pending_tasks(), 12);
+  EXPECT_EQ(executor.num_pending_tasks(TaskExecutor::Lane::kBulk), 4);
+  EXPECT_EQ(
+      executor.num_pending_tasks(TaskExecutor::Lane::kLatencySensitive), 8);
+  auto stats = executor.GetThreadStats();
+  ASSERT_EQ(stats.size(), 1);
+  EXPECT_THAT(stats[0].queue_depth_per_lane, ::testing::ElementsAre(8, 4));
+
+  release.Notify();
+  counter.Wait();
+  EXPECT_EQ(std::string(order.begin(), order.end()), "sssbsssbssbb");
+}
+
+TEST(TaskExecutorTest, ThreadStatsIncludeThreadNames) {
+  TaskExecutor executor(2, "named");
+  auto stats = executor.GetThreadStats();
+  ASSERT_EQ(stats.size(), 2);
+  EXPECT_EQ(stats[0].thread_name, "named_0");
+  EXPECT_EQ(stats[1].thread_name, "named_1");
+}
+
+TEST(TaskExecutorTest, RestrictsThreadsToCpuAffinity) {
+  TaskExecutor executor(2, "test", /*latency_sensitive_weight=*/1, {0});
+  std::vector<std::atomic<int>> cpus(10);
+  absl::BlockingCounter counter(10);
+  for (int i = 0; i < 10; i++) {
+    executor.Schedule([&, i] {
+      cpus[i] = sched_getcpu();
+      counter.DecrementCount();
+    });
+  }
+  counter.Wait();
+  for (const auto& cpu : cpus) {
+    EXPECT_EQ(cpu, 0);
+  }
+}
+
+TEST(TaskExecutorTest, RecordsUsageOfThePool) {
+  auto executor = std::make_unique<TaskExecutor>(2, "usage_test");
+  absl::BlockingCounter counter(10);
+  for (int i = 0; i < 10; i++) {
+    executor->Schedule([&] {
+      absl::SleepFor(absl::Milliseconds(1));
+      counter.DecrementCount();
+    });
+  }
+  counter.Wait();
+  executor = nullptr;
+
+  ThreadPoolUsage usage;
+  internal::ThreadPoolUsageTracker::Get("usage_test")->ToProto(&usage);
+  EXPECT_EQ(usage.num_threads(), 0);
+  EXPECT_EQ(usage.num_exited_threads(), 2);
+  EXPECT_EQ(usage.queue_wait().count(), 10);
+  EXPECT_EQ(usage.run_time().count(), 10);
+  EXPECT_GE(usage.run_time().sum_us(), 10000);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
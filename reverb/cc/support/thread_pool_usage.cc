@@ -0,0 +1,144 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/thread_pool_usage.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "absl/time/clock.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+struct Registry {
+  absl::Mutex mu;
+  std::map<std::string, ThreadPoolUsageTracker*, std::less<>> trackers
+      ABSL_GUARDED_BY(mu);
+};
+
+Registry* GetRegistry() {
+  static auto* const registry = new Registry;
+  return registry;
+}
+
+absl::Duration ReadCpuClock(clockid_t clock) {
+  timespec ts;
+  if (clock_gettime(clock, &ts) != 0) return absl::ZeroDuration();
+  return absl::DurationFromTimespec(ts);
+}
+
+std::atomic<uint64_t> next_thread_id{0};
+
+}  // namespace
+
+// Removes the thread from its pool when it exits.
+struct PoolMembership {
+  ~PoolMembership() {
+    if (tracker != nullptr) tracker->RemoveCurrentThread(id);
+  }
+
+  ThreadPoolUsageTracker* tracker = nullptr;
+  uint64_t id = 0;
+};
+
+namespace {
+
+thread_local PoolMembership membership;
+
+}  // namespace
+
+ThreadPoolUsageTracker::ThreadPoolUsageTracker(std::string name)
+    : name_(std::move(name)) {}
+
+ThreadPoolUsageTracker* ThreadPoolUsageTracker::Get(absl::string_view name) {
+  Registry* registry = GetRegistry();
+  absl::MutexLock lock(&registry->mu);
+  auto it = registry->trackers.find(name);
+  if (it == registry->trackers.end()) {
+    it = registry->trackers
+             .emplace(std::string(name),
+                      new ThreadPoolUsageTracker(std::string(name)))
+             .first;
+  }
+  return it->second;
+}
+
+void ThreadPoolUsageTracker::Report(
+    google::protobuf::RepeatedPtrField<ThreadPoolUsage>* pools) {
+  Registry* registry = GetRegistry();
+  absl::MutexLock lock(&registry->mu);
+  for (const auto& [_, tracker] : registry->trackers) {
+    tracker->ToProto(pools->Add());
+  }
+}
+
+void ThreadPoolUsageTracker::AddCurrentThread() {
+  if (membership.tracker != nullptr) return;
+  LiveThread thread;
+  if (pthread_getcpuclockid(pthread_self(), &thread.clock) != 0) return;
+  thread.added_at = absl::Now();
+
+  membership.id = next_thread_id++;
+  membership.tracker = this;
+  absl::MutexLock lock(&mu_);
+  threads_.emplace(membership.id, thread);
+}
+
+void ThreadPoolUsageTracker::RemoveCurrentThread(uint64_t id) {
+  const absl::Duration cpu_time = ReadCpuClock(CLOCK_THREAD_CPUTIME_ID);
+  const absl::Time now = absl::Now();
+  absl::MutexLock lock(&mu_);
+  auto it = threads_.find(id);
+  if (it == threads_.end()) return;
+  num_exited_threads_++;
+  exited_cpu_time_ += cpu_time;
+  exited_wall_time_ += now - it->second.added_at;
+  threads_.erase(it);
+}
+
+void ThreadPoolUsageTracker::ToProto(ThreadPoolUsage* proto) const {
+  proto->set_name(name_);
+  {
+    // The threads can't exit (and invalidate their clocks) while the lock is
+    // held.
+    absl::MutexLock lock(&mu_);
+    absl::Duration cpu_time = exited_cpu_time_;
+    absl::Duration wall_time = exited_wall_time_;
+    const absl::Time now = absl::Now();
+    for (const auto& [_, thread] : threads_) {
+      cpu_time += ReadCpuClock(thread.clock);
+      wall_time += now - thread.added_at;
+    }
+    proto->set_num_threads(threads_.size());
+    proto->set_num_exited_threads(num_exited_threads_);
+    proto->set_cpu_time_us(absl::ToInt64Microseconds(cpu_time));
+    proto->set_wall_time_us(absl::ToInt64Microseconds(wall_time));
+  }
+  queue_wait_.ToProto(proto->mutable_queue_wait());
+  run_time_.ToProto(proto->mutable_run_time());
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,99 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SUPPORT_THREAD_POOL_USAGE_H_
+#define REVERB_CC_SUPPORT_THREAD_POOL_USAGE_H_
+
+#include <time.h>
+
+#include <cstdint>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "google/protobuf/repeated_field.h"
+#include "reverb/cc/platform/hash_map.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/support/latency_histogram.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// Always-on accounting of the CPU time used by the threads of a pool and of
+// the time its tasks spend queued and running. Trackers are shared by all
+// instances of a pool with the same name and are never destroyed.
+//
+// Threads add themselves with `AddCurrentThread`. Their CPU clocks are only
+// read when the usage is reported, and once more when they exit, so running
+// tasks costs nothing beyond the (relaxed atomic) histogram updates.
+//
+// Thread safe.
+class ThreadPoolUsageTracker {
+ public:
+  // Returns the tracker of the pool called `name`, creating it on first use.
+  static ThreadPoolUsageTracker* Get(absl::string_view name);
+
+  // Writes the usage of all pools, ordered by name.
+  static void Report(
+      google::protobuf::RepeatedPtrField<ThreadPoolUsage>* pools);
+
+  ThreadPoolUsageTracker(const ThreadPoolUsageTracker&) = delete;
+  ThreadPoolUsageTracker& operator=(const ThreadPoolUsageTracker&) = delete;
+
+  // Attributes the calling thread to the pool until it exits. A thread only
+  // belongs to the first pool it is added to, later calls are ignored.
+  void AddCurrentThread();
+
+  void RecordQueueWait(absl::Duration wait) { queue_wait_.Record(wait); }
+  void RecordRunTime(absl::Duration run_time) { run_time_.Record(run_time); }
+
+  void ToProto(ThreadPoolUsage* proto) const;
+
+ private:
+  friend struct PoolMembership;
+
+  struct LiveThread {
+    // CPU clock of the thread (see `pthread_getcpuclockid`).
+    clockid_t clock;
+    absl::Time added_at;
+  };
+
+  explicit ThreadPoolUsageTracker(std::string name);
+
+  // Called by the exiting thread `id`, so it can still read its own clock.
+  void RemoveCurrentThread(uint64_t id);
+
+  const std::string name_;
+
+  mutable absl::Mutex mu_;
+  // Threads which are still running, keyed by an id unique to the process.
+  internal::flat_hash_map<uint64_t, LiveThread> threads_ ABSL_GUARDED_BY(mu_);
+  // Usage of the threads which have exited.
+  int64_t num_exited_threads_ ABSL_GUARDED_BY(mu_) = 0;
+  absl::Duration exited_cpu_time_ ABSL_GUARDED_BY(mu_);
+  absl::Duration exited_wall_time_ ABSL_GUARDED_BY(mu_);
+
+  LatencyHistogram queue_wait_;
+  LatencyHistogram run_time_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_THREAD_POOL_USAGE_H_
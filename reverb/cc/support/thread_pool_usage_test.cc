@@ -0,0 +1,134 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/thread_pool_usage.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+ThreadPoolUsage Usage(const ThreadPoolUsageTracker& tracker) {
+  ThreadPoolUsage usage;
+  tracker.ToProto(&usage);
+  return usage;
+}
+
+// Keeps the CPU busy for `duration` of CPU time.
+void Spin(absl::Duration duration) {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  const absl::Duration end = absl::DurationFromTimespec(ts) + duration;
+  while (absl::DurationFromTimespec(ts) < end) {
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  }
+}
+
+TEST(ThreadPoolUsageTrackerTest, ReturnsTrackerOfName) {
+  ThreadPoolUsageTracker* tracker = ThreadPoolUsageTracker::Get("SameName");
+  EXPECT_EQ(ThreadPoolUsageTracker::Get("SameName"), tracker);
+  EXPECT_NE(ThreadPoolUsageTracker::Get("OtherName"), tracker);
+  EXPECT_EQ(Usage(*tracker).name(), "SameName");
+}
+
+TEST(ThreadPoolUsageTrackerTest, ReportsCpuTimeOfRunningThreads) {
+  ThreadPoolUsageTracker* tracker = ThreadPoolUsageTracker::Get("Running");
+  absl::Notification spun;
+  absl::Notification stop;
+  auto thread = StartThread("", [&] {
+    tracker->AddCurrentThread();
+    Spin(absl::Milliseconds(20));
+    spun.Notify();
+    stop.WaitForNotification();
+  });
+  spun.WaitForNotification();
+
+  ThreadPoolUsage usage = Usage(*tracker);
+  EXPECT_EQ(usage.num_threads(), 1);
+  EXPECT_EQ(usage.num_exited_threads(), 0);
+  EXPECT_GE(usage.cpu_time_us(), 20000);
+  EXPECT_GE(usage.wall_time_us(), usage.cpu_time_us());
+  stop.Notify();
+}
+
+TEST(ThreadPoolUsageTrackerTest, KeepsCpuTimeOfExitedThreads) {
+  ThreadPoolUsageTracker* tracker = ThreadPoolUsageTracker::Get("Exited");
+  for (int i = 0; i < 2; i++) {
+    StartThread("", [&] {
+      tracker->AddCurrentThread();
+      Spin(absl::Milliseconds(10));
+    });
+  }
+
+  ThreadPoolUsage usage = Usage(*tracker);
+  EXPECT_EQ(usage.num_threads(), 0);
+  EXPECT_EQ(usage.num_exited_threads(), 2);
+  EXPECT_GE(usage.cpu_time_us(), 20000);
+  EXPECT_GE(usage.wall_time_us(), usage.cpu_time_us());
+}
+
+TEST(ThreadPoolUsageTrackerTest, ThreadsOnlyBelongToTheirFirstPool) {
+  ThreadPoolUsageTracker* first = ThreadPoolUsageTracker::Get("First");
+  ThreadPoolUsageTracker* second = ThreadPoolUsageTracker::Get("Second");
+  StartThread("", [&] {
+    first->AddCurrentThread();
+    first->AddCurrentThread();
+    second->AddCurrentThread();
+  });
+  EXPECT_EQ(Usage(*first).num_exited_threads(), 1);
+  EXPECT_EQ(Usage(*second).num_exited_threads(), 0);
+}
+
+TEST(ThreadPoolUsageTrackerTest, RecordsQueueWaitAndRunTime) {
+  ThreadPoolUsageTracker* tracker = ThreadPoolUsageTracker::Get("Tasks");
+  tracker->RecordQueueWait(absl::Microseconds(3));
+  tracker->RecordRunTime(absl::Microseconds(5));
+  tracker->RecordRunTime(absl::Microseconds(7));
+
+  ThreadPoolUsage usage = Usage(*tracker);
+  EXPECT_EQ(usage.queue_wait().count(), 1);
+  EXPECT_EQ(usage.queue_wait().sum_us(), 3);
+  EXPECT_EQ(usage.run_time().count(), 2);
+  EXPECT_EQ(usage.run_time().sum_us(), 12);
+}
+
+TEST(ThreadPoolUsageTrackerTest, ReportsAllPoolsOrderedByName) {
+  ThreadPoolUsageTracker::Get("ReportB");
+  ThreadPoolUsageTracker::Get("ReportA");
+
+  google::protobuf::RepeatedPtrField<ThreadPoolUsage> pools;
+  ThreadPoolUsageTracker::Report(&pools);
+  std::vector<std::string> names;
+  for (const auto& pool : pools) names.push_back(pool.name());
+  EXPECT_THAT(names, ::testing::IsSupersetOf({"ReportA", "ReportB"}));
+  EXPECT_TRUE(std::is_sorted(names.begin(), names.end()));
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
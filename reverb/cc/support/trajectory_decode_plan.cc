@@ -0,0 +1,81 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/trajectory_decode_plan.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+TrajectoryDecodePlanCache::TrajectoryDecodePlanCache(size_t max_plans)
+    : max_plans_(max_plans) {}
+
+std::shared_ptr<const TrajectoryDecodePlan> TrajectoryDecodePlanCache::Get(
+    const FlatTrajectory& trajectory, std::vector<uint64_t>* chunk_keys) {
+  chunk_keys->clear();
+  ordinals_.clear();
+  LayoutKey key;
+  key.push_back(trajectory.columns_size());
+  for (const auto& column : trajectory.columns()) {
+    key.push_back(column.squeeze());
+    key.push_back(column.chunk_slices_size());
+    for (const auto& slice : column.chunk_slices()) {
+      auto [it, inserted] =
+          ordinals_.try_emplace(slice.chunk_key(), chunk_keys->size());
+      if (inserted) chunk_keys->push_back(slice.chunk_key());
+      key.push_back(it->second);
+      key.push_back(slice.index());
+      key.push_back(slice.length());
+    }
+  }
+
+  auto it = plans_.find(key);
+  if (it != plans_.end()) return it->second;
+
+  auto plan = std::make_shared<TrajectoryDecodePlan>();
+  plan->num_chunks = chunk_keys->size();
+  plan->columns.reserve(trajectory.columns_size());
+  std::vector<int32_t> last_slice(chunk_keys->size());
+  for (const auto& column : trajectory.columns()) {
+    TrajectoryDecodePlan::Column planned{
+        column.squeeze(), 0, static_cast<int32_t>(plan->slices.size()),
+        column.chunk_slices_size()};
+    for (const auto& slice : column.chunk_slices()) {
+      const int32_t chunk = ordinals_.at(slice.chunk_key());
+      last_slice[chunk] = plan->slices.size();
+      plan->slices.push_back({chunk, slice.index(), slice.length(),
+                              planned.num_rows, /*last_use=*/false});
+      planned.num_rows += slice.length();
+    }
+    plan->columns.push_back(planned);
+  }
+  for (int32_t slice : last_slice) {
+    plan->slices[slice].last_use = true;
+  }
+
+  if (plans_.size() >= max_plans_) return plan;
+  return plans_.emplace(std::move(key), std::move(plan)).first->second;
+}
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -0,0 +1,113 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef REVERB_CC_SUPPORT_TRAJECTORY_DECODE_PLAN_H_
+#define REVERB_CC_SUPPORT_TRAJECTORY_DECODE_PLAN_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/inlined_vector.h"
+#include "reverb/cc/schema.pb.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+
+// The steps of decoding a sampled trajectory which only depend on its
+// layout: which chunk, chunk column and number of rows every slice refers to
+// and where the rows end up in the output column. Trajectories of the same
+// table usually share a handful of layouts, so a plan is built once per
+// layout (see `TrajectoryDecodePlanCache`) and samples are then decoded by
+// walking the plan rather than inspecting the trajectory proto.
+//
+// Chunks are referred to by their ordinal in the trajectory, i.e the order in
+// which they are first referenced by a slice, so the same plan applies to
+// trajectories referencing different chunks.
+struct TrajectoryDecodePlan {
+  struct Slice {
+    // Ordinal of the chunk referenced by the slice.
+    int32_t chunk;
+    // Column of the chunk and number of rows of it included in the slice.
+    int32_t index;
+    int32_t length;
+    // Row of the output column at which the slice starts.
+    int64_t row_offset;
+    // Whether this is the last slice, in plan order, which references the
+    // chunk.
+    bool last_use;
+  };
+
+  struct Column {
+    bool squeeze;
+    // Total number of rows of the column.
+    int64_t num_rows;
+    // The slices of the column are `slices[first_slice, first_slice +
+    // num_slices)`.
+    int32_t first_slice;
+    int32_t num_slices;
+  };
+
+  std::vector<Column> columns;
+
+  // The slices of all columns, in column order.
+  std::vector<Slice> slices;
+
+  // Number of distinct chunks referenced by the trajectory.
+  int32_t num_chunks = 0;
+};
+
+// Builds and caches the plans of the trajectories decoded by a single sampler
+// worker. At most `max_plans` plans are cached; once the bound is reached,
+// plans of new layouts are still built but no longer cached. Tables with
+// variable length trajectories can produce many layouts.
+//
+// NOT thread safe.
+class TrajectoryDecodePlanCache {
+ public:
+  static constexpr size_t kDefaultMaxPlans = 1024;
+
+  explicit TrajectoryDecodePlanCache(size_t max_plans = kDefaultMaxPlans);
+
+  // Returns the plan of the layout of `trajectory` and sets `chunk_keys` to
+  // the keys of the chunks it references, indexed by ordinal.
+  std::shared_ptr<const TrajectoryDecodePlan> Get(
+      const FlatTrajectory& trajectory, std::vector<uint64_t>* chunk_keys);
+
+  // Number of cached plans.
+  size_t size() const { return plans_.size(); }
+
+ private:
+  // Number of columns followed by the squeeze flag and number of slices of
+  // every column and the chunk ordinal, chunk column and length of every
+  // slice.
+  using LayoutKey = absl::InlinedVector<int64_t, 32>;
+
+  const size_t max_plans_;
+  absl::flat_hash_map<LayoutKey, std::shared_ptr<const TrajectoryDecodePlan>>
+      plans_;
+
+  // Scratch space of `Get` which maps chunk keys to ordinals.
+  absl::flat_hash_map<uint64_t, int32_t> ordinals_;
+};
+
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_SUPPORT_TRAJECTORY_DECODE_PLAN_H_
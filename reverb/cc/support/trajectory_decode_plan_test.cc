@@ -0,0 +1,135 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "reverb/cc/support/trajectory_decode_plan.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "reverb/cc/schema.pb.h"
+#include "reverb/cc/testing/proto_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace internal {
+namespace {
+
+using ::testing::ElementsAre;
+
+FlatTrajectory MakeTrajectory(uint64_t first_chunk_key) {
+  FlatTrajectory trajectory = testing::ParseTextProtoOrDie<FlatTrajectory>(R"pb(
+    columns {
+      chunk_slices { chunk_key: 0 offset: 2 length: 3 index: 0 }
+      chunk_slices { chunk_key: 1 offset: 0 length: 2 index: 0 }
+    }
+    columns {
+      chunk_slices { chunk_key: 1 offset: 1 length: 1 index: 1 }
+      squeeze: true
+    }
+  )pb");
+  for (auto& column : *trajectory.mutable_columns()) {
+    for (auto& slice : *column.mutable_chunk_slices()) {
+      slice.set_chunk_key(first_chunk_key + slice.chunk_key());
+    }
+  }
+  return trajectory;
+}
+
+TEST(TrajectoryDecodePlanCacheTest, PlansSlicesOfEveryColumn) {
+  TrajectoryDecodePlanCache cache;
+  std::vector<uint64_t> chunk_keys;
+  auto plan = cache.Get(MakeTrajectory(10), &chunk_keys);
+  EXPECT_THAT(chunk_keys, ElementsAre(10, 11));
+  EXPECT_EQ(plan->num_chunks, 2);
+
+  ASSERT_EQ(plan->columns.size(), 2);
+  EXPECT_FALSE(plan->columns[0].squeeze);
+  EXPECT_EQ(plan->columns[0].num_rows, 5);
+  EXPECT_EQ(plan->columns[0].first_slice, 0);
+  EXPECT_EQ(plan->columns[0].num_slices, 2);
+  EXPECT_TRUE(plan->columns[1].squeeze);
+  EXPECT_EQ(plan->columns[1].num_rows, 1);
+  EXPECT_EQ(plan->columns[1].first_slice, 2);
+  EXPECT_EQ(plan->columns[1].num_slices, 1);
+
+  ASSERT_EQ(plan->slices.size(), 3);
+  const auto& first = plan->slices[0];
+  EXPECT_EQ(first.chunk, 0);
+  EXPECT_EQ(first.index, 0);
+  EXPECT_EQ(first.length, 3);
+  EXPECT_EQ(first.row_offset, 0);
+  EXPECT_TRUE(first.last_use);
+  EXPECT_EQ(plan->slices[1].chunk, 1);
+  EXPECT_EQ(plan->slices[1].row_offset, 3);
+  EXPECT_FALSE(plan->slices[1].last_use);
+  EXPECT_EQ(plan->slices[2].chunk, 1);
+  EXPECT_EQ(plan->slices[2].index, 1);
+  EXPECT_EQ(plan->slices[2].row_offset, 0);
+  EXPECT_TRUE(plan->slices[2].last_use);
+}
+
+TEST(TrajectoryDecodePlanCacheTest, SharesPlanOfSameLayout) {
+  TrajectoryDecodePlanCache cache;
+  std::vector<uint64_t> chunk_keys;
+  auto first = cache.Get(MakeTrajectory(10), &chunk_keys);
+
+  // Offsets are not part of the layout, only the chunks they refer to.
+  FlatTrajectory shifted = MakeTrajectory(20);
+  shifted.mutable_columns(0)->mutable_chunk_slices(0)->set_offset(0);
+  EXPECT_EQ(cache.Get(shifted, &chunk_keys), first);
+  EXPECT_THAT(chunk_keys, ElementsAre(20, 21));
+  EXPECT_EQ(cache.size(), 1);
+}
+
+TEST(TrajectoryDecodePlanCacheTest, DistinguishesLayouts) {
+  TrajectoryDecodePlanCache cache;
+  std::vector<uint64_t> chunk_keys;
+  auto plan = cache.Get(MakeTrajectory(10), &chunk_keys);
+
+  FlatTrajectory longer = MakeTrajectory(10);
+  longer.mutable_columns(0)->mutable_chunk_slices(1)->set_length(3);
+  EXPECT_EQ(cache.Get(longer, &chunk_keys)->columns[0].num_rows, 6);
+
+  FlatTrajectory same_chunk = MakeTrajectory(10);
+  same_chunk.mutable_columns(1)->mutable_chunk_slices(0)->set_chunk_key(10);
+  EXPECT_EQ(cache.Get(same_chunk, &chunk_keys)->slices[2].chunk, 0);
+
+  FlatTrajectory not_squeezed = MakeTrajectory(10);
+  not_squeezed.mutable_columns(1)->set_squeeze(false);
+  EXPECT_FALSE(cache.Get(not_squeezed, &chunk_keys)->columns[1].squeeze);
+  EXPECT_EQ(cache.size(), 4);
+  EXPECT_EQ(cache.Get(MakeTrajectory(10), &chunk_keys), plan);
+}
+
+TEST(TrajectoryDecodePlanCacheTest, StopsCachingAtMaxPlans) {
+  TrajectoryDecodePlanCache cache(/*max_plans=*/1);
+  std::vector<uint64_t> chunk_keys;
+  auto plan = cache.Get(MakeTrajectory(10), &chunk_keys);
+
+  FlatTrajectory longer = MakeTrajectory(10);
+  longer.mutable_columns(0)->mutable_chunk_slices(1)->set_length(3);
+  auto uncached = cache.Get(longer, &chunk_keys);
+  EXPECT_EQ(uncached->columns[0].num_rows, 6);
+  EXPECT_NE(cache.Get(longer, &chunk_keys), uncached);
+  EXPECT_EQ(cache.size(), 1);
+  EXPECT_EQ(cache.Get(MakeTrajectory(10), &chunk_keys), plan);
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace reverb
+}  // namespace deepmind
@@ -99,6 +99,59 @@ int ColumnLength(const FlatTrajectory& trajectory, int column) {
   return length;
 }
 
+absl::Status SliceTrajectory(const FlatTrajectory& trajectory, int offset,
+                             int length, FlatTrajectory* out) {
+  REVERB_CHECK_GE(offset, 0);
+  REVERB_CHECK_GT(length, 0);
+  out->Clear();
+  for (int i = 0; i < trajectory.columns_size(); i++) {
+    const auto& column = trajectory.columns(i);
+    auto* out_column = out->add_columns();
+    out_column->set_squeeze(column.squeeze());
+
+    // Steps of the column to skip and to include respectively.
+    int skip = offset;
+    int remaining = length;
+    for (const auto& slice : column.chunk_slices()) {
+      if (remaining == 0) break;
+      if (skip >= slice.length()) {
+        skip -= slice.length();
+        continue;
+      }
+      auto* out_slice = out_column->add_chunk_slices();
+      *out_slice = slice;
+      out_slice->set_offset(slice.offset() + skip);
+      out_slice->set_length(std::min(slice.length() - skip, remaining));
+      remaining -= out_slice->length();
+      skip = 0;
+    }
+
+    if (remaining != 0) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Column ", i, " has ", ColumnLength(trajectory, i),
+          " steps but steps [", offset, ", ", offset + length,
+          ") were requested."));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ProjectTrajectory(const FlatTrajectory& trajectory,
+                               absl::Span<const int> columns,
+                               FlatTrajectory* out) {
+  out->Clear();
+  out->mutable_columns()->Reserve(columns.size());
+  for (int column : columns) {
+    if (column < 0 || column >= trajectory.columns_size()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Column ", column, " is out of range for trajectory "
+                       "with ", trajectory.columns_size(), " columns."));
+    }
+    *out->add_columns() = trajectory.columns(column);
+  }
+  return absl::OkStatus();
+}
+
 int TimestepTrajectoryLength(const FlatTrajectory& trajectory) {
   REVERB_CHECK(!trajectory.columns().empty());
   return ColumnLength(trajectory, 0);
@@ -150,30 +203,37 @@ absl::Status UnpackChunkColumn(const ChunkData& chunk_data, int column,
         " which has ", chunk_data.data().tensors_size(), " columns."));
   }
 
-  *out = DecompressTensorFromProto(chunk_data.data().tensors(column));
-  if (chunk_data.delta_encoded()) {
-    *out = DeltaEncode(*out, /*encode=*/false);
-  }
-
+  *out = DecompressChunkColumn(chunk_data, column);
   return absl::OkStatus();
 }
 
 absl::Status UnpackChunkColumnAndSlice(const ChunkData& chunk_data, int column,
                                        int offset, int length,
                                        tensorflow::Tensor* out) {
-  REVERB_RETURN_IF_ERROR(UnpackChunkColumn(chunk_data, column, out));
+  if (chunk_data.block_length() <= 0 &&
+      !IsFrameStackColumn(chunk_data, column)) {
+    REVERB_RETURN_IF_ERROR(UnpackChunkColumn(chunk_data, column, out));
+    return SliceChunkColumn(offset, length, out);
+  }
 
-  if (offset < 0 || offset + length > out->shape().dim_size(0)) {
+  // Block structured chunks only decompress the blocks covering the slice and
+  // frame stack columns only stack the frames of the sliced rows.
+  if (column >= chunk_data.data().tensors_size() || column < 0) {
     return absl::InvalidArgumentError(absl::StrCat(
-        "Cannot slice (", offset, ", ", offset + length,
-        ") out of tensor with shape ", out->shape().DebugString(), "."));
+        "Cannot unpack column ", column, " in chunk ", chunk_data.chunk_key(),
+        " which has ", chunk_data.data().tensors_size(), " columns."));
   }
-
-  *out = out->Slice(offset, offset + length);
+  const int64_t num_rows = ChunkColumnNumRows(chunk_data, column);
+  if (offset < 0 || length < 0 || offset + length > num_rows) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Cannot slice (", offset, ", ", offset + length, ") out of column ",
+        column, " of chunk ", chunk_data.chunk_key(), " which has ", num_rows,
+        " rows."));
+  }
+  *out = DecompressChunkColumn(chunk_data, column, offset, length);
   if (!out->IsAligned()) {
     *out = tensorflow::tensor::DeepCopy(*out);
   }
-
   return absl::OkStatus();
 }
 
@@ -184,6 +244,117 @@ absl::Status UnpackChunkColumnAndSlice(const ChunkData& chunk_data,
                                    slice.length(), out);
 }
 
+absl::Status SliceChunkData(const ChunkData& chunk, int begin, int end,
+                            ChunkData* out, int* offset) {
+  if (chunk.sequence_range().sparse()) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Cannot slice chunk ", chunk.chunk_key(), " since it is sparse."));
+  }
+  const int num_columns = chunk.data().tensors_size();
+  const int num_rows =
+      num_columns == 0 ? 0 : ChunkColumnNumRows(chunk, /*column=*/0);
+  if (begin < 0 || begin >= end || end > num_rows) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Cannot slice rows (", begin, ", ", end, ") out of chunk ",
+                     chunk.chunk_key(), " which has ", num_rows, " rows."));
+  }
+
+  out->Clear();
+  out->set_chunk_key(chunk.chunk_key());
+  out->set_delta_encoded(chunk.delta_encoded());
+  out->set_delta_encoded_floats(chunk.delta_encoded_floats());
+
+  int out_rows;
+  if (chunk.block_length() > 0) {
+    const int block_length = chunk.block_length();
+    const int first_block = begin / block_length;
+    const int end_block = (end - 1) / block_length + 1;
+    *offset = first_block * block_length;
+    out_rows = std::min(num_rows, end_block * block_length) - *offset;
+
+    out->set_block_length(block_length);
+    *out->mutable_quantized_columns() = chunk.quantized_columns();
+    for (int column = 0; column < num_columns; column++) {
+      tensorflow::TensorProto* proto = out->mutable_data()->add_tensors();
+      proto->set_dtype(chunk.data().tensors(column).dtype());
+      *proto->mutable_tensor_shape() =
+          chunk.data().tensors(column).tensor_shape();
+      proto->mutable_tensor_shape()->mutable_dim(0)->set_size(out_rows);
+
+      const auto& blocks = chunk.data().blocks(column).tensors();
+      auto* out_blocks = out->mutable_data()->add_blocks();
+      for (int i = first_block; i < end_block; i++) {
+        *out_blocks->add_tensors() = blocks[i];
+      }
+      out->add_codecs(GetChunkColumnCodec(chunk, column));
+    }
+  } else {
+    *offset = begin;
+    out_rows = end - begin;
+    for (int column = 0; column < num_columns; column++) {
+      CopyChunkColumnRows(chunk, column, begin, out_rows, out);
+    }
+  }
+  out->set_data_tensors_len(num_columns);
+
+  SequenceRange* range = out->mutable_sequence_range();
+  *range = chunk.sequence_range();
+  range->set_start(chunk.sequence_range().start() + *offset);
+  range->set_end(range->start() + out_rows - 1);
+  return absl::OkStatus();
+}
+
+void StripChunkColumns(const ChunkData& chunk,
+                       const internal::flat_hash_set<int>& columns,
+                       ChunkData* out) {
+  out->Clear();
+  out->set_chunk_key(chunk.chunk_key());
+  *out->mutable_sequence_range() = chunk.sequence_range();
+  out->set_data_tensors_len(chunk.data_tensors_len());
+  out->set_delta_encoded(chunk.delta_encoded());
+  out->set_delta_encoded_floats(chunk.delta_encoded_floats());
+  *out->mutable_codecs() = chunk.codecs();
+  *out->mutable_quantized_columns() = chunk.quantized_columns();
+  out->set_block_length(chunk.block_length());
+
+  const ChunkData::Data& data = chunk.data();
+  ChunkData::Data* out_data = out->mutable_data();
+  for (int column = 0; column < data.tensors_size(); column++) {
+    const bool keep = columns.contains(column);
+    tensorflow::TensorProto* proto = out_data->add_tensors();
+    if (keep) {
+      *proto = data.tensors(column);
+    } else {
+      proto->set_dtype(data.tensors(column).dtype());
+      *proto->mutable_tensor_shape() = data.tensors(column).tensor_shape();
+    }
+    if (column < data.blocks_size()) {
+      auto* blocks = out_data->add_blocks();
+      if (keep) *blocks = data.blocks(column);
+    }
+    if (column < data.frame_stacks_size()) {
+      auto* frame_stack = out_data->add_frame_stacks();
+      if (keep) *frame_stack = data.frame_stacks(column);
+    }
+  }
+}
+
+absl::Status SliceChunkColumn(int offset, int length,
+                              tensorflow::Tensor* column) {
+  if (offset < 0 || offset + length > column->shape().dim_size(0)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Cannot slice (", offset, ", ", offset + length,
+        ") out of tensor with shape ", column->shape().DebugString(), "."));
+  }
+
+  *column = column->Slice(offset, offset + length);
+  if (!column->IsAligned()) {
+    *column = tensorflow::tensor::DeepCopy(*column);
+  }
+
+  return absl::OkStatus();
+}
+
 int TimestepTrajectoryOffset(const FlatTrajectory& trajectory) {
   return trajectory.columns(0).chunk_slices(0).offset();
 }
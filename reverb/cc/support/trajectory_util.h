@@ -62,12 +62,27 @@ int TimestepTrajectoryOffset(const FlatTrajectory& trajectory);
 // Number of steps referenced by column.
 int ColumnLength(const FlatTrajectory& trajectory, int column);
 
-// Decompresses the tensor at index `column` in `chunk_data` into `out`.
+// Sets `out` to the steps `[offset, offset + length)` of every column of
+// `trajectory`. Returns InvalidArgumentError if a column is shorter than
+// `offset + length` steps.
+absl::Status SliceTrajectory(const FlatTrajectory& trajectory, int offset,
+                             int length, FlatTrajectory* out);
+
+// Sets `out` to the columns `columns` of `trajectory`, in the given order.
+// Returns InvalidArgumentError if a column is out of range.
+absl::Status ProjectTrajectory(const FlatTrajectory& trajectory,
+                               absl::Span<const int> columns,
+                               FlatTrajectory* out);
+
+// Decompresses the tensor at index `column` in `chunk_data` into `out`. Frame
+// stack columns (see `ChunkData.FrameStack`) are restacked from their frames.
 absl::Status UnpackChunkColumn(const ChunkData& chunk_data, int column,
                                tensorflow::Tensor* out);
 
 // Unpacks content of column (see `UnpackChunkColumn`) and returns an aligned
-// tensor of the desired slice,
+// tensor of the desired slice. Only the blocks covering the slice are
+// decompressed if the chunk is block structured (see `ChunkData.block_length`)
+// and only the sliced rows are restacked for frame stack columns.
 absl::Status UnpackChunkColumnAndSlice(const ChunkData& chunk_data, int column,
                                        int offset, int length,
                                        tensorflow::Tensor* out);
@@ -78,6 +93,29 @@ absl::Status UnpackChunkColumnAndSlice(const ChunkData& chunk_data,
                                        const FlatTrajectory::ChunkSlice& slice,
                                        tensorflow::Tensor* out);
 
+// Copies the rows `[begin, end)` of all columns of `chunk` into `out` and sets
+// `offset` to the row of `chunk` that became the first row of `out`. Block
+// structured chunks (see `ChunkData.block_length`) are copied one block at a
+// time without being decompressed, so `out` may include rows before `begin`
+// and after `end`. The columns of other chunks are decompressed, sliced and
+// compressed again (see `CopyChunkColumnRows`). Sparse chunks can't be sliced.
+absl::Status SliceChunkData(const ChunkData& chunk, int begin, int end,
+                            ChunkData* out, int* offset);
+
+// Replaces the (already unpacked) `column` with the rows `[offset, offset +
+// length)`. The slice shares the buffer of `column` unless it would be
+// unaligned, in which case it is copied.
+absl::Status SliceChunkColumn(int offset, int length,
+                              tensorflow::Tensor* column);
+
+// Copies `chunk` into `out` but only keeps the data of the columns in
+// `columns`. The protos of the other columns only keep their dtype and shape
+// and their blocks and frames are left out, so the remaining columns keep their
+// index and `out` can be unpacked (but not sliced) like `chunk`.
+void StripChunkColumns(const ChunkData& chunk,
+                       const internal::flat_hash_set<int>& columns,
+                       ChunkData* out);
+
 }  // namespace internal
 }  // namespace reverb
 }  // namespace deepmind
@@ -25,6 +25,7 @@
 #include "reverb/cc/testing/proto_test_util.h"
 #include "reverb/cc/testing/tensor_testutil.h"
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_util.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 
 namespace deepmind {
@@ -241,6 +242,86 @@ TEST(TimestepTrajectoryLength, AccumulatesSlices) {
   EXPECT_EQ(TimestepTrajectoryLength(trajectory), 6);
 }
 
+TEST(SliceTrajectory, SlicesEveryColumn) {
+  auto trajectory = FlatTimestepTrajectory(
+      /*chunk_keys=*/{1, 2, 3}, /*chunk_lengths=*/{4, 4, 4},
+      /*num_columns=*/2, /*offset=*/1, /*length=*/10);
+
+  FlatTrajectory window;
+  REVERB_ASSERT_OK(SliceTrajectory(trajectory, /*offset=*/2, /*length=*/5,
+                                   &window));
+  EXPECT_THAT(window, testing::EqualsProto(FlatTimestepTrajectory(
+                          /*chunk_keys=*/{1, 2}, /*chunk_lengths=*/{4, 4},
+                          /*num_columns=*/2, /*offset=*/3, /*length=*/5)));
+
+  REVERB_ASSERT_OK(SliceTrajectory(trajectory, /*offset=*/5, /*length=*/5,
+                                   &window));
+  EXPECT_THAT(window, testing::EqualsProto(FlatTimestepTrajectory(
+                          /*chunk_keys=*/{2, 3}, /*chunk_lengths=*/{4, 4},
+                          /*num_columns=*/2, /*offset=*/2, /*length=*/5)));
+}
+
+TEST(SliceTrajectory, RejectsStepsOutOfRange) {
+  auto trajectory = FlatTimestepTrajectory(
+      /*chunk_keys=*/{1, 2}, /*chunk_lengths=*/{2, 2},
+      /*num_columns=*/1, /*offset=*/0, /*length=*/4);
+
+  FlatTrajectory window;
+  EXPECT_EQ(SliceTrajectory(trajectory, /*offset=*/2, /*length=*/3, &window)
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(ProjectTrajectory, SelectsColumnsInOrder) {
+  auto trajectory = FlatTimestepTrajectory(
+      /*chunk_keys=*/{1, 2}, /*chunk_lengths=*/{2, 2},
+      /*num_columns=*/3, /*offset=*/0, /*length=*/4);
+  trajectory.mutable_columns(2)->set_squeeze(true);
+
+  FlatTrajectory projected;
+  REVERB_ASSERT_OK(ProjectTrajectory(trajectory, {2, 0}, &projected));
+  ASSERT_EQ(projected.columns_size(), 2);
+  EXPECT_THAT(projected.columns(0),
+              testing::EqualsProto(trajectory.columns(2)));
+  EXPECT_THAT(projected.columns(1),
+              testing::EqualsProto(trajectory.columns(0)));
+}
+
+TEST(ProjectTrajectory, RejectsColumnsOutOfRange) {
+  auto trajectory = FlatTimestepTrajectory(
+      /*chunk_keys=*/{1}, /*chunk_lengths=*/{2},
+      /*num_columns=*/2, /*offset=*/0, /*length=*/2);
+
+  FlatTrajectory projected;
+  EXPECT_EQ(ProjectTrajectory(trajectory, {0, 2}, &projected).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(ProjectTrajectory(trajectory, {-1}, &projected).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(StripChunkColumns, OnlyKeepsDataOfSelectedColumns) {
+  tensorflow::Tensor first_col_tensor(static_cast<int32_t>(1337));
+  tensorflow::Tensor second_col_tensor(static_cast<int32_t>(9000));
+
+  ChunkData data;
+  data.set_chunk_key(3);
+  CompressTensorAsProto(first_col_tensor, data.mutable_data()->add_tensors());
+  CompressTensorAsProto(second_col_tensor, data.mutable_data()->add_tensors());
+  data.set_data_tensors_len(2);
+
+  ChunkData stripped;
+  StripChunkColumns(data, /*columns=*/{1}, &stripped);
+  EXPECT_EQ(stripped.chunk_key(), 3);
+  EXPECT_EQ(stripped.data_tensors_len(), 2);
+  ASSERT_EQ(stripped.data().tensors_size(), 2);
+  EXPECT_TRUE(stripped.data().tensors(0).tensor_content().empty());
+  EXPECT_EQ(stripped.data().tensors(0).dtype(), tensorflow::DT_INT32);
+
+  tensorflow::Tensor second_got;
+  REVERB_EXPECT_OK(UnpackChunkColumn(stripped, 1, &second_got));
+  test::ExpectTensorEqual<int32_t>(second_got, second_col_tensor);
+}
+
 TEST(UnpackChunkColumn, SelectsCorrectColumn) {
   tensorflow::Tensor first_col_tensor(static_cast<int32_t>(1337));
   tensorflow::Tensor second_col_tensor(static_cast<int32_t>(9000));
@@ -259,6 +340,138 @@ TEST(UnpackChunkColumn, SelectsCorrectColumn) {
   test::ExpectTensorEqual<int32_t>(second_got, second_col_tensor);
 }
 
+TEST(UnpackChunkColumnAndSlice, BlockStructuredChunk) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({7, 2}));
+  tensor.flat<int32_t>().setRandom();
+
+  CompressionOptions options;
+  options.set_block_length(3);
+  ChunkData data;
+  data.set_delta_encoded(true);
+  CompressChunkColumn(tensor, options, &data);
+  data.set_data_tensors_len(1);
+
+  tensorflow::Tensor got;
+  REVERB_ASSERT_OK(UnpackChunkColumnAndSlice(data, 0, 2, 3, &got));
+  EXPECT_TRUE(got.IsAligned());
+  test::ExpectTensorEqual<int32_t>(
+      got, tensorflow::tensor::DeepCopy(tensor.Slice(2, 5)));
+
+  tensorflow::Tensor column;
+  REVERB_ASSERT_OK(UnpackChunkColumn(data, 0, &column));
+  test::ExpectTensorEqual<int32_t>(column, tensor);
+
+  EXPECT_EQ(UnpackChunkColumnAndSlice(data, 0, 5, 3, &got).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(UnpackChunkColumnAndSlice(data, 1, 0, 1, &got).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+ChunkData MakeChunkForSlicing(const tensorflow::Tensor& tensor,
+                              int block_length) {
+  CompressionOptions options;
+  options.set_codec(COMPRESSION_CODEC_ZLIB);
+  options.set_block_length(block_length);
+  ChunkData chunk;
+  chunk.set_chunk_key(7);
+  chunk.set_delta_encoded(true);
+  chunk.mutable_sequence_range()->set_episode_id(3);
+  chunk.mutable_sequence_range()->set_start(10);
+  chunk.mutable_sequence_range()->set_end(10 + tensor.dim_size(0) - 1);
+  CompressChunkColumn(tensor, options, &chunk);
+  chunk.set_data_tensors_len(1);
+  return chunk;
+}
+
+TEST(SliceChunkData, CopiesRequestedRows) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({8, 2}));
+  tensor.flat<int32_t>().setRandom();
+  ChunkData chunk = MakeChunkForSlicing(tensor, /*block_length=*/0);
+
+  ChunkData sliced;
+  int offset;
+  REVERB_ASSERT_OK(SliceChunkData(chunk, 3, 6, &sliced, &offset));
+  EXPECT_EQ(offset, 3);
+  EXPECT_EQ(sliced.chunk_key(), 7);
+  EXPECT_TRUE(sliced.delta_encoded());
+  EXPECT_EQ(sliced.sequence_range().episode_id(), 3);
+  EXPECT_EQ(sliced.sequence_range().start(), 13);
+  EXPECT_EQ(sliced.sequence_range().end(), 15);
+  EXPECT_THAT(sliced.codecs(), ::testing::ElementsAre(COMPRESSION_CODEC_ZLIB));
+
+  tensorflow::Tensor column;
+  REVERB_ASSERT_OK(UnpackChunkColumn(sliced, 0, &column));
+  test::ExpectTensorEqual<int32_t>(
+      column, tensorflow::tensor::DeepCopy(tensor.Slice(3, 6)));
+}
+
+TEST(SliceChunkData, CopiesWholeBlocksOfBlockStructuredChunks) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({8, 2}));
+  tensor.flat<int32_t>().setRandom();
+  ChunkData chunk = MakeChunkForSlicing(tensor, /*block_length=*/3);
+
+  ChunkData sliced;
+  int offset;
+  REVERB_ASSERT_OK(SliceChunkData(chunk, 4, 7, &sliced, &offset));
+  EXPECT_EQ(offset, 3);
+  EXPECT_EQ(sliced.block_length(), 3);
+  ASSERT_EQ(sliced.data().blocks_size(), 1);
+  EXPECT_EQ(sliced.data().blocks(0).tensors_size(), 2);
+  EXPECT_EQ(sliced.sequence_range().start(), 13);
+  EXPECT_EQ(sliced.sequence_range().end(), 17);
+
+  tensorflow::Tensor column;
+  REVERB_ASSERT_OK(UnpackChunkColumn(sliced, 0, &column));
+  test::ExpectTensorEqual<int32_t>(
+      column, tensorflow::tensor::DeepCopy(tensor.Slice(3, 8)));
+}
+
+TEST(SliceChunkData, KeepsFrameStacks) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({8, 2}));
+  tensor.flat<int32_t>().setRandom();
+  CompressionOptions options;
+  options.mutable_frame_stack()->set_axis(0);
+  ChunkData chunk;
+  chunk.set_chunk_key(7);
+  chunk.mutable_sequence_range()->set_end(7);
+  CompressChunkColumn(tensor, options, &chunk);
+  chunk.set_data_tensors_len(1);
+
+  ChunkData sliced;
+  int offset;
+  REVERB_ASSERT_OK(SliceChunkData(chunk, 2, 5, &sliced, &offset));
+  EXPECT_EQ(offset, 2);
+  ASSERT_TRUE(IsFrameStackColumn(sliced, 0));
+  EXPECT_EQ(sliced.data().frame_stacks(0).frame_indices_size(), 3 * 2);
+
+  tensorflow::Tensor column;
+  REVERB_ASSERT_OK(UnpackChunkColumnAndSlice(sliced, 0, 1, 2, &column));
+  test::ExpectTensorEqual<int32_t>(
+      column, tensorflow::tensor::DeepCopy(tensor.Slice(3, 5)));
+}
+
+TEST(SliceChunkData, RejectsInvalidRows) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({4, 2}));
+  tensor.flat<int32_t>().setRandom();
+  ChunkData chunk = MakeChunkForSlicing(tensor, /*block_length=*/0);
+
+  ChunkData sliced;
+  int offset;
+  EXPECT_EQ(SliceChunkData(chunk, 2, 2, &sliced, &offset).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(SliceChunkData(chunk, 2, 5, &sliced, &offset).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  chunk.mutable_sequence_range()->set_sparse(true);
+  EXPECT_EQ(SliceChunkData(chunk, 0, 2, &sliced, &offset).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
 }  // namespace
 }  // namespace internal
 }  // namespace reverb
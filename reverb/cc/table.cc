@@ -15,8 +15,11 @@
 #include "reverb/cc/table.h"
 
 #include <algorithm>
+#include <cmath>
 #include <cstddef>
+#include <functional>
 #include <initializer_list>
+#include <limits>
 #include <memory>
 #include <string>
 #include <utility>
@@ -25,6 +28,8 @@
 #include "google/protobuf/timestamp.pb.h"
 #include <cstdint>
 #include "absl/memory/memory.h"
+#include "absl/random/distributions.h"
+#include "absl/random/random.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/synchronization/mutex.h"
@@ -42,6 +47,12 @@
 #include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/support/cleanup.h"
+#include "reverb/cc/support/flight_recorder.h"
+#include "reverb/cc/support/lock_profiler.h"
+#include "reverb/cc/support/reclamation_queue.h"
+#include "reverb/cc/support/round_robin_queue.h"
+#include "reverb/cc/support/thread_pool_usage.h"
 #include "reverb/cc/support/trajectory_util.h"
 #include "reverb/cc/table_extensions/interface.h"
 
@@ -90,8 +101,111 @@ inline absl::Status CheckItemValidity(const Table::Item& item) {
   return absl::OkStatus();
 }
 
+// Checks that `item` can be sampled as windows of `window_length` steps. Every
+// item is valid if `window_length` is 0.
+absl::Status CheckWindowValidity(const Table::Item& item, int window_length) {
+  if (window_length == 0) return absl::OkStatus();
+  const FlatTrajectory& trajectory = item.item.flat_trajectory();
+  const int length = internal::ColumnLength(trajectory, 0);
+  for (int i = 1; i < trajectory.columns_size(); i++) {
+    if (internal::ColumnLength(trajectory, i) != length) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "All columns of items sampled as windows must have the same length "
+          "but column 0 has ", length, " steps and column ", i, " has ",
+          internal::ColumnLength(trajectory, i), " steps."));
+    }
+  }
+  if (length < window_length) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Item has ", length, " steps which is less than the window length (",
+        window_length, ")."));
+  }
+  return absl::OkStatus();
+}
+
+// Sets `window` to the window of `window_length` steps of `item` at an offset
+// drawn uniformly from `bitgen` and `num_windows` to the number of windows of
+// `item`. Only the chunks referenced by the window are included.
+absl::Status SampleWindow(const Table::Item& item, int window_length,
+                          absl::BitGen* bitgen,
+                          std::shared_ptr<Table::Item>* window,
+                          int* num_windows) {
+  FlatTrajectory scratch;
+  const FlatTrajectory& trajectory = item.flat_trajectory(&scratch);
+  *num_windows = internal::ColumnLength(trajectory, 0) - window_length + 1;
+  if (*num_windows <= 0) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "Item ", item.item.key(), " is shorter than the window length (",
+        window_length, ")."));
+  }
+  const int offset = absl::Uniform(*bitgen, 0, *num_windows);
+
+  auto result = std::make_shared<Table::Item>();
+  result->item.set_key(item.item.key());
+  result->item.set_table(item.item.table());
+  result->item.set_priority(item.item.priority());
+  result->item.set_times_sampled(item.item.times_sampled());
+  *result->item.mutable_inserted_at() = item.item.inserted_at();
+  REVERB_RETURN_IF_ERROR(
+      internal::SliceTrajectory(trajectory, offset, window_length,
+                                result->item.mutable_flat_trajectory()));
+
+  const auto keys = internal::GetChunkKeys(result->item.flat_trajectory());
+  const internal::flat_hash_set<uint64_t> key_set(keys.begin(), keys.end());
+  result->chunks.reserve(keys.size());
+  for (const auto& chunk : item.chunks) {
+    if (key_set.contains(chunk->key())) result->chunks.push_back(chunk);
+  }
+  *window = std::move(result);
+  return absl::OkStatus();
+}
+
+// Replaces the trajectory of `item` with its packed representation.
+void PackItem(internal::TrajectoryLayoutInterner* layouts, Table::Item* item) {
+  item->packed_trajectory =
+      internal::PackTrajectory(item->item.flat_trajectory(), layouts);
+  item->item.clear_flat_trajectory();
+}
+
+// Copies `item` with its trajectory unpacked.
+Table::Item UnpackedCopy(const Table::Item& item) {
+  if (!item.packed_trajectory.has_value()) return item;
+  Table::Item copy{item.item, item.chunks, absl::nullopt};
+  internal::UnpackTrajectory(*item.packed_trajectory,
+                             copy.item.mutable_flat_trajectory());
+  return copy;
+}
+
+// Maximum number of inserts the insert lane performs before releasing `mu_`
+// so that the sample lane is not blocked for the entire insert batch.
+constexpr int kMaxInsertsPerCriticalSection = 64;
+
+// Maximum number of items the sample lane selects before releasing `mu_`. In
+// between, newly enqueued sample requests are merged into the lane's queue so
+// that large requests are served in slices, interleaved with more urgent ones.
+constexpr int kMaxSamplesPerCriticalSection = 1024;
+
+// Orders sample requests by deadline (earliest first).
+bool HasEarlierDeadline(const std::unique_ptr<Table::SampleRequest>& a,
+                        const std::unique_ptr<Table::SampleRequest>& b) {
+  return a->deadline < b->deadline;
+}
+
+// Names under which the mutexes of all tables are reported by the lock
+// profiler.
+constexpr char kTableMu[] = "Table::mu_";
+constexpr char kWorkerMu[] = "Table::worker_mu_";
+constexpr char kAsyncExtensionsMu[] = "Table::async_extensions_mu_";
+
 }  // namespace
 
+const FlatTrajectory& TableItem::flat_trajectory(
+    FlatTrajectory* scratch) const {
+  if (!packed_trajectory.has_value()) return item.flat_trajectory();
+  internal::UnpackTrajectory(*packed_trajectory, scratch);
+  return *scratch;
+}
+
 void Table::FinalizeSampleRequest(std::unique_ptr<Table::SampleRequest> request,
                                   absl::Status status) {
   Table::SampleRequest* r = request.release();
@@ -101,7 +215,17 @@ void Table::FinalizeSampleRequest(std::unique_ptr<Table::SampleRequest> request,
     return;
   }
   r->status = status;
-  callback_executor_->Schedule([r] {
+  if (status.ok()) {
+    latency_->sample_rate_limiter_block.Record(r->rate_limited_for);
+  }
+  std::atomic_load(&callback_executor_)->Schedule([r, latency = latency_] {
+    if (r->status.ok()) {
+      const absl::Time now = absl::Now();
+      latency->sample_end_to_end.Record(now - r->enqueued_at);
+      internal::FlightRecorder::Default()->Record(
+          r->trace_id, internal::TraceSide::kServer, "Table sample request",
+          r->enqueued_at, now);
+    }
     auto to_notify = r->on_batch_done.lock();
     // Callback might have been destroyed in the meantime.
     if (to_notify != nullptr) {
@@ -133,6 +257,13 @@ void GetExpiredRequests(
   }
 }
 
+// Returns true if `a` and `b` point to the same callback (or both have expired
+// after pointing to the same callback).
+bool IsSameCallback(const std::weak_ptr<Table::InsertCallback>& a,
+                    const std::weak_ptr<Table::InsertCallback>& b) {
+  return !a.owner_before(b) && !b.owner_before(a);
+}
+
 void NotifyPendingInserts(const std::vector<Table::InsertRequest>& requests) {
   for (auto& r : requests) {
     auto to_notify = r.insert_completed.lock();
@@ -148,8 +279,8 @@ Table::Table(std::string name, std::shared_ptr<ItemSelector> sampler,
              int32_t max_times_sampled, std::shared_ptr<RateLimiter> rate_limiter,
              Extensions extensions,
              absl::optional<tensorflow::StructuredValue> signature)
-    : sampler_(std::move(sampler)),
-      remover_(std::move(remover)),
+    : selectors_(internal::MakeSelectorPair(std::move(sampler),
+                                            std::move(remover))),
       num_deleted_episodes_(0),
       num_unique_samples_(0),
       max_size_(max_size),
@@ -176,13 +307,14 @@ Table::Table(std::string name, std::shared_ptr<ItemSelector> sampler,
 Table::~Table() {
   Close();
   {
-    absl::MutexLock lock(&mu_);
+    internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
     stop_extension_worker_ = true;
     extension_buffer_available_cv_.SignalAll();
     extension_work_available_cv_.SignalAll();
   }
-  // Join the worker thread
-  table_worker_ = nullptr;
+  // Join the worker threads.
+  insert_worker_ = nullptr;
+  sample_worker_ = nullptr;
   // Join the extension worker thread.
   extension_worker_ = nullptr;
   rate_limiter_->UnregisterTable(&mu_, this);
@@ -194,65 +326,206 @@ Table::~Table() {
   }
 }
 
-absl::Status Table::TableWorkerLoop() {
-  internal::StateStatistics<TableWorkerState> worker_stats;
-  // Collection of items waiting to the added to the table.
-  std::vector<InsertRequest> current_inserts;
-  // Index of the next item in the `pending_inserts` to be processed.
-  int insert_idx = 0;
-  // Collection of sample requests to be processed.
+absl::Status Table::InsertWorkerLoop() {
+  internal::StateStatistics<TableWorkerState> lane_stats;
+  // Requests picked up by the lane which haven't been inserted yet. When fair
+  // insert admission is disabled all requests share the same client id, which
+  // makes the queue FIFO.
+  internal::RoundRobinQueue<InsertRequest> queued_inserts;
+  // Value of `sample_lane_progress_` before the rate limiter was last
+  // consulted.
+  int64_t seen_sample_progress;
+  {
+    internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+    lane_stats.Enter(TableWorkerState::kRunning);
+    seen_sample_progress = sample_lane_progress_;
+  }
+  while (true) {
+    int num_inserted = 0;
+    {
+      internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+      const absl::Time lock_acquired_at = absl::Now();
+      lane_stats.Enter(TableWorkerState::kActivelyInserting);
+      // Samples drawn from the snapshot count towards the rate limiter.
+      REVERB_RETURN_IF_ERROR(ReconcileSnapshotSamples());
+      // The rate limiter is consulted once for as many of the queued inserts
+      // as fit in this critical section. Deleting items (when the table is
+      // full) can only allow more inserts so the number of committed inserts
+      // remains valid throughout the loop.
+      const int num_allowed = rate_limiter_->CommitInserts(
+          &mu_, std::min<int>(queued_inserts.size(),
+                              kMaxInsertsPerCriticalSection));
+      // Consecutive inserts sharing the same callback (e.g the items of a
+      // single insert stream request) are acknowledged by a single task.
+      struct Notification {
+        std::weak_ptr<InsertCallback> callback;
+        std::vector<uint64_t> ids;
+        std::vector<absl::Time> enqueued_at;
+      };
+      std::vector<Notification> notifications;
+      while (num_inserted < num_allowed) {
+        InsertRequest request = queued_inserts.Pop();
+        latency_->insert_rate_limiter_block.Record(lock_acquired_at -
+                                                   request.picked_up_at);
+        uint64_t id = request.item->item.key();
+        REVERB_RETURN_IF_ERROR(InsertOrAssignInternal(std::move(request.item)));
+        if (notifications.empty() ||
+            !IsSameCallback(notifications.back().callback,
+                            request.insert_completed)) {
+          notifications.push_back({std::move(request.insert_completed)});
+        }
+        notifications.back().ids.push_back(id);
+        notifications.back().enqueued_at.push_back(request.enqueued_at);
+        num_inserted++;
+      }
+      std::vector<std::function<void()>> callbacks;
+      callbacks.reserve(notifications.size());
+      for (auto& notification : notifications) {
+        callbacks.push_back([notification = std::move(notification),
+                             latency = latency_] {
+          const absl::Time now = absl::Now();
+          for (absl::Time enqueued_at : notification.enqueued_at) {
+            latency->insert_end_to_end.Record(now - enqueued_at);
+          }
+          auto to_notify = notification.callback.lock();
+          // Callback might have been destroyed in the meantime.
+          if (to_notify != nullptr) {
+            for (uint64_t id : notification.ids) {
+              (*to_notify)(id);
+            }
+          }
+        });
+      }
+      std::atomic_load(&callback_executor_)
+          ->ScheduleBatch(std::move(callbacks), TaskExecutor::Lane::kBulk);
+      PublishSnapshot();
+      if (num_inserted > 0) {
+        latency_->insert_lock_hold.Record(absl::Now() - lock_acquired_at);
+      }
+    }
+    lane_stats.Enter(TableWorkerState::kRunning);
+    internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+    if (num_inserted > 0) {
+      num_queued_inserts_ -= num_inserted;
+      // The inserts might have unblocked the sample lane.
+      insert_lane_progress_++;
+      SignalSampleLane();
+    }
+    if (stop_worker_) {
+      break;
+    }
+    // `insert_lane_time_distribution_` is protected by `worker_mu_`. We don't
+    // want to hold this mutex each time lane stats are updated, so it is
+    // updated periodically.
+    insert_lane_time_distribution_ = lane_stats;
+    if (!pending_inserts_.empty()) {
+      // Pick up the new requests. With fair admission they are queued behind
+      // the requests of their own client only.
+      const absl::Time now = absl::Now();
+      for (auto& request : pending_inserts_) {
+        latency_->insert_queue_wait.Record(now - request.enqueued_at);
+        request.picked_up_at = now;
+        const uint64_t client_id =
+            fair_insert_admission_ ? request.client_id : 0;
+        queued_inserts.Push(client_id, std::move(request));
+      }
+      pending_inserts_.clear();
+      continue;
+    }
+    if (num_inserted > 0 || seen_sample_progress != sample_lane_progress_) {
+      // Either the batch was cut short or the sample lane has changed the
+      // state of the rate limiter since it was last consulted.
+      seen_sample_progress = sample_lane_progress_;
+      continue;
+    }
+    lane_stats.Enter(!queued_inserts.empty()
+                         ? TableWorkerState::kWaitingForSamples
+                         : TableWorkerState::kSleeping);
+    insert_lane_time_distribution_ = lane_stats;
+    WaitForLaneSignal(&lock, &insert_lane_spinner_, insert_lane_signals_,
+                      &wakeup_insert_worker_, absl::InfiniteFuture());
+    lane_stats.Enter(TableWorkerState::kRunning);
+    seen_sample_progress = sample_lane_progress_;
+  }
+
+  // Collect all requests which haven't been inserted and notify them.
+  std::vector<InsertRequest> remaining_inserts;
+  for (auto& request : queued_inserts.PopAll()) {
+    remaining_inserts.push_back(std::move(request));
+  }
+  {
+    internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+    remaining_inserts.insert(
+      remaining_inserts.end(),
+      std::make_move_iterator(pending_inserts_.begin()),
+      std::make_move_iterator(pending_inserts_.end())
+    );
+    pending_inserts_.clear();
+  }
+  NotifyPendingInserts(remaining_inserts);
+  return absl::OkStatus();
+}
+
+absl::Status Table::SampleWorkerLoop() {
+  internal::StateStatistics<TableWorkerState> lane_stats;
+  // Collection of sample requests to be processed, ordered by deadline.
   std::vector<std::unique_ptr<SampleRequest>> current_sampling;
-  // Index of the next request from the `sampling_requests` to be processed.
+  // Index of the next request from the `current_sampling` to be processed.
   int sample_idx = 0;
   // Whether the next sample was rate limited.
   bool rate_limited = false;
-
-  // Progress of handling insert/sample requests. Used for detecting whether
-  // worker has something to do (making progress) or should go to sleep.
-  int64_t progress = 0;
-  int64_t last_progress = 0;
+  // Value of `insert_lane_progress_` before the rate limiter was last
+  // consulted.
+  int64_t seen_insert_progress;
   {
-    absl::MutexLock lock(&worker_mu_);
-    worker_stats.Enter(TableWorkerState::kRunning);
+    internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+    lane_stats.Enter(TableWorkerState::kRunning);
+    seen_insert_progress = insert_lane_progress_;
   }
   while (true) {
+    int64_t num_sampled = 0;
+    bool reclaim;
     {
-      absl::MutexLock lock(&mu_);
+      internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+      const absl::Time lock_acquired_at = absl::Now();
+      lane_stats.Enter(TableWorkerState::kActivelySampling);
       // Tracks whether while loop below makes progress.
-      int64_t prev_progress = progress - 1;
-      while (prev_progress < progress) {
-        prev_progress = progress;
-        // Try processing an insert request.
-        worker_stats.Enter(TableWorkerState::kActivelyInserting);
-        if (insert_idx < current_inserts.size() &&
-            rate_limiter_->CanInsert(&mu_, 1)) {
-          rate_limiter_->CreateInstantInsertEvent(&mu_);
-          uint64_t id = current_inserts[insert_idx].item->item.key();
-          REVERB_RETURN_IF_ERROR(InsertOrAssignInternal(
-              std::move(current_inserts[insert_idx].item)));
-          auto callback =
-              std::move(current_inserts[insert_idx].insert_completed);
-          callback_executor_->Schedule([callback, id] {
-            auto to_notify = callback.lock();
-            // Callback might have been destroyed in the meantime.
-            if (to_notify != nullptr) {
-              (*to_notify)(id);
-            }
-          });
-          insert_idx++;
-          progress++;
-        }
+      int64_t prev_num_sampled = num_sampled - 1;
+      while (prev_num_sampled < num_sampled &&
+             num_sampled < kMaxSamplesPerCriticalSection) {
+        prev_num_sampled = num_sampled;
         // Skip sampling requests which timed out already.
-        worker_stats.Enter(TableWorkerState::kActivelySampling);
         while (sample_idx < current_sampling.size() &&
                current_sampling[sample_idx] == nullptr) {
           sample_idx++;
         }
         // Try processing a sample request.
-        if (sample_idx < current_sampling.size()) {
+        if (sample_idx < current_sampling.size() && max_times_sampled_ < 1) {
+          // Items are never deleted as part of sampling so the entire batch
+          // allowed by the rate limiter can be selected in a single pass.
           auto& request = current_sampling[sample_idx];
-          while (rate_limiter_->MaybeCommitSample(&mu_)) {
-            progress++;
+          // Capacity of the samples collection indicates how many items
+          // should be sampled.
+          const int remaining = std::min<int64_t>(
+              request->samples.capacity() - request->samples.size(),
+              kMaxSamplesPerCriticalSection - num_sampled);
+          const int num_samples =
+              rate_limiter_->MaybeCommitSamples(&mu_, remaining);
+          if (num_samples > 0) {
+            num_sampled += num_samples;
+            REVERB_RETURN_IF_ERROR(SampleBatchInternal(
+                rate_limited, num_samples, &request->samples));
+            if (request->samples.capacity() == request->samples.size()) {
+              // Finalized request is moved out of sampling_requests.
+              FinalizeSampleRequest(std::move(request), absl::OkStatus());
+              sample_idx++;
+            }
+          }
+        } else if (sample_idx < current_sampling.size()) {
+          auto& request = current_sampling[sample_idx];
+          while (num_sampled < kMaxSamplesPerCriticalSection &&
+                 rate_limiter_->MaybeCommitSample(&mu_)) {
+            num_sampled++;
             request->samples.emplace_back();
             REVERB_RETURN_IF_ERROR(
                 SampleInternal(rate_limited, &request->samples.back()));
@@ -267,78 +540,148 @@ absl::Status Table::TableWorkerLoop() {
           }
         }
       }
+      // Items which reached `max_times_sampled_` have been unlinked.
+      PublishSnapshot();
+      if (num_sampled > 0) {
+        latency_->sample_lock_hold.Record(absl::Now() - lock_acquired_at);
+      }
+      // The references of the exhausted items are released once the requests
+      // have been served, or earlier if too many have piled up. The lane is
+      // about to become idle if it didn't make progress.
+      reclaim = !exhausted_items_.empty() &&
+                (num_sampled == 0 || sample_idx >= current_sampling.size() ||
+                 exhausted_items_.size() >= kMaxSamplesPerCriticalSection);
+    }
+    if (reclaim) {
+      internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+      REVERB_RETURN_IF_ERROR(ReclaimExhaustedItems());
     }
-    worker_stats.Enter(TableWorkerState::kRunning);
+    lane_stats.Enter(TableWorkerState::kRunning);
     // Sampling requests that exceeded deadline and should be terminated.
     std::vector<std::unique_ptr<Table::SampleRequest>> to_terminate;
     {
-      absl::MutexLock lock(&worker_mu_);
+      internal::ProfiledMutexLock lock(
+          &worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+      if (num_sampled > 0) {
+        // The samples might have unblocked the insert lane.
+        sample_lane_progress_++;
+        SignalInsertLane();
+      }
       if (stop_worker_) {
         break;
       }
-      // `worker_time_distribution_` is protected by `worker_mu_`. We don't want
-      // to hold this mutex each time worker stats are updated, so
-      // `worker_time_distribution_` is updated periodically.
-      worker_time_distribution_ = worker_stats;
-      if (insert_idx == current_inserts.size() &&
-          !pending_inserts_.empty()) {
-        // Get a new batch of insert requests as previous batch is done.
-        progress++;
-        insert_idx = 0;
-        current_inserts.clear();
-        std::swap(current_inserts, pending_inserts_);
-      }
-      if (sample_idx == current_sampling.size() &&
-          !pending_sampling_.empty()) {
-        // Get a new batch of sample requests as previous batch is done.
-        progress++;
+      // `sample_lane_time_distribution_` is protected by `worker_mu_`. We
+      // don't want to hold this mutex each time lane stats are updated, so it
+      // is updated periodically.
+      sample_lane_time_distribution_ = lane_stats;
+      if (!pending_sampling_.empty()) {
+        // Merge the new requests into the ones which are already being
+        // processed (earliest deadline first) so that requests with a short
+        // timeout don't have to wait for large requests which don't have one.
+        const SampleRequest* served = sample_idx < current_sampling.size()
+                                          ? current_sampling[sample_idx].get()
+                                          : nullptr;
+        current_sampling.erase(std::remove(current_sampling.begin(),
+                                           current_sampling.end(), nullptr),
+                               current_sampling.end());
         sample_idx = 0;
-        current_sampling.clear();
-        std::swap(current_sampling, pending_sampling_);
-
-        // We'll consider the new batch of requests to be unaffected by the
-        // rate limiter until the worker is put to sleep again.
-        rate_limited = false;
-      }
-      if (progress != last_progress) {
-        // There was progress executing insert/sample requests,
-        // so continue without handling timeouts.
-        last_progress = progress;
+        const absl::Time now = absl::Now();
+        for (const auto& request : pending_sampling_) {
+          latency_->sample_queue_wait.Record(now - request->enqueued_at);
+          internal::FlightRecorder::Default()->Record(
+              request->trace_id, internal::TraceSide::kServer,
+              "TableWorkerLoop queue wait", request->enqueued_at, now);
+        }
+        const int num_queued = current_sampling.size();
+        current_sampling.insert(
+            current_sampling.end(),
+            std::make_move_iterator(pending_sampling_.begin()),
+            std::make_move_iterator(pending_sampling_.end()));
+        pending_sampling_.clear();
+        std::stable_sort(current_sampling.begin() + num_queued,
+                         current_sampling.end(), HasEarlierDeadline);
+        std::inplace_merge(current_sampling.begin(),
+                           current_sampling.begin() + num_queued,
+                           current_sampling.end(), HasEarlierDeadline);
+
+        // We'll consider a new request to be unaffected by the rate limiter
+        // until the lane is put to sleep again.
+        if (current_sampling.front().get() != served) {
+          rate_limited = false;
+        }
         continue;
       }
       auto deadline = absl::Now();
+      if (num_sampled > 0) {
+        // There was progress executing sample requests, so continue without
+        // waiting. The requests are ordered by deadline so the ones queued
+        // behind the request being served which have already expired come
+        // straight after it. They are failed now rather than when the lane
+        // gets to them.
+        for (int i = sample_idx + 1; i < current_sampling.size(); ++i) {
+          auto& request = current_sampling[i];
+          if (request == nullptr) continue;
+          if (request->deadline > deadline) break;
+          to_terminate.push_back(std::move(request));
+        }
+        if (to_terminate.empty()) {
+          continue;
+        }
+      }
       auto wakeup = absl::InfiniteFuture();
-      GetExpiredRequests(deadline, &current_sampling, &to_terminate, &wakeup);
-      GetExpiredRequests(deadline, &pending_sampling_, &to_terminate, &wakeup);
       if (to_terminate.empty()) {
+        GetExpiredRequests(deadline, &current_sampling, &to_terminate, &wakeup);
+        GetExpiredRequests(deadline, &pending_sampling_, &to_terminate,
+                           &wakeup);
+      }
+      if (to_terminate.empty()) {
+        if (seen_insert_progress != insert_lane_progress_) {
+          // The insert lane has changed the state of the rate limiter since it
+          // was last consulted.
+          seen_insert_progress = insert_lane_progress_;
+          continue;
+        }
         if (sample_idx < current_sampling.size()) {
           if (!current_sampling[sample_idx]->samples.empty()) {
             // No more data to sample, so send out already sampled items for the
             // current sampling batch.
-            worker_stats.Enter(TableWorkerState::kActivelySampling);
+            lane_stats.Enter(TableWorkerState::kActivelySampling);
             {
-              absl::MutexLock table_lock(&mu_);
+              internal::ProfiledMutexLock table_lock(
+                  &mu_, REVERB_LOCK_SITE(kTableMu));
               FinalizeSampleRequest(std::move(current_sampling[sample_idx]),
                                     absl::OkStatus());
               sample_idx++;
             }
           }
-          worker_stats.Enter(TableWorkerState::kWaitingForInserts);
-        } else if (insert_idx < current_inserts.size()) {
-          worker_stats.Enter(TableWorkerState::kWaitingForSamples);
+          lane_stats.Enter(TableWorkerState::kWaitingForInserts);
         } else {
-          worker_stats.Enter(TableWorkerState::kSleeping);
+          lane_stats.Enter(TableWorkerState::kSleeping);
+        }
+        if (sample_idx == current_sampling.size()) {
+          // There are no sample requests to serve so use the idle time to
+          // select items for future requests.
+          internal::ProfiledMutexLock table_lock(
+              &mu_, REVERB_LOCK_SITE(kTableMu));
+          FillSampleAhead();
         }
-        worker_time_distribution_ = worker_stats;
+        sample_lane_time_distribution_ = lane_stats;
         rate_limited = !current_sampling.empty() &&
                        sample_idx != current_sampling.size();
-        wakeup_worker_.WaitWithDeadline(&worker_mu_, wakeup);
-        worker_stats.Enter(TableWorkerState::kRunning);
+        const absl::Time wait_start = absl::Now();
+        WaitForLaneSignal(&lock, &sample_lane_spinner_, sample_lane_signals_,
+                          &wakeup_sample_worker_, wakeup);
+        if (rate_limited && current_sampling[sample_idx] != nullptr) {
+          current_sampling[sample_idx]->rate_limited_for +=
+              absl::Now() - wait_start;
+        }
+        lane_stats.Enter(TableWorkerState::kRunning);
+        seen_insert_progress = insert_lane_progress_;
       }
     }
     if (!to_terminate.empty()) {
       // Notify sample requests which exceeded deadline.
-      absl::MutexLock lock(&mu_);
+      internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
       for (auto& sample : to_terminate) {
         FinalizeSampleRequest(std::move(sample), errors::RateLimiterTimeout());
       }
@@ -346,45 +689,84 @@ absl::Status Table::TableWorkerLoop() {
     }
   }
 
-  // Append all enqueued requests to the worker's local lists and terminate
-  // all pending requests.
+  // Append all enqueued requests to the lane's local list and terminate all
+  // pending requests.
   {
-    absl::MutexLock lock(&worker_mu_);
-    current_inserts.insert(
-      current_inserts.end(),
-      std::make_move_iterator(pending_inserts_.begin()),
-      std::make_move_iterator(pending_inserts_.end())
-    );
+    internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
     current_sampling.insert(
       current_sampling.end(),
       std::make_move_iterator(pending_sampling_.begin()),
       std::make_move_iterator(pending_sampling_.end())
     );
+    pending_sampling_.clear();
   }
   auto status = absl::CancelledError("RateLimiter has been cancelled");
   {
-    absl::MutexLock lock(&mu_);
+    internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
     for (auto& r : current_sampling) {
       FinalizeSampleRequest(std::move(r), status);
     }
   }
-  NotifyPendingInserts(current_inserts);
   return absl::OkStatus();
 }
 
+void Table::WakeupWorkers() {
+  insert_lane_progress_++;
+  sample_lane_progress_++;
+  SignalInsertLane();
+  SignalSampleLane();
+}
+
+void Table::SignalInsertLane() {
+  insert_lane_signals_.fetch_add(1, std::memory_order_release);
+  wakeup_insert_worker_.Signal();
+}
+
+void Table::SignalSampleLane() {
+  sample_lane_signals_.fetch_add(1, std::memory_order_release);
+  wakeup_sample_worker_.Signal();
+}
+
+void Table::WaitForLaneSignal(internal::ProfiledMutexLock* lock,
+                              internal::AdaptiveSpinner* spinner,
+                              const std::atomic<int64_t>& signals,
+                              absl::CondVar* cv, absl::Time deadline) {
+  const int64_t seen = signals.load(std::memory_order_relaxed);
+  if (spinner->max_budget() > absl::ZeroDuration()) {
+    lock->Unlocked([&] {
+      spinner->Spin([&] {
+        return signals.load(std::memory_order_acquire) != seen;
+      });
+    });
+  }
+  // The counter is only incremented while `worker_mu_` is held so a signal
+  // cannot be missed between the check and the wait.
+  if (signals.load(std::memory_order_relaxed) == seen) {
+    lock->WaitWithDeadline(cv, deadline);
+  }
+}
+
+void Table::SetWorkerSpinBudget(absl::Duration budget) {
+  insert_lane_spinner_.set_max_budget(budget);
+  sample_lane_spinner_.set_max_budget(budget);
+}
+
 absl::Status Table::ExtensionsWorkerLoop() {
   // Collection of extension requests being currently processed.
   std::vector<ExtensionRequest> extension_requests;
+  // Items of consecutive extension requests of the same type.
+  std::vector<ExtensionItem> batch_items;
   // Collection of deleted items for which memory is to be released by the
   // clients (to not perform expensive operations inside the worker loop).
   std::vector<std::shared_ptr<Item>> deleted_items;
   {
-    absl::MutexLock lock(&mu_);
+    internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
     extension_worker_sleeps_ = false;
   }
   while (true) {
     {
-      absl::MutexLock lock(&worker_mu_);
+      internal::ProfiledMutexLock lock(
+          &worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
       if (deleted_items_.empty() && !deleted_items.empty()) {
         // Deleted items are freed by the clients to spread the load.
         // Previous deletion batch has been processed, give clients a new batch.
@@ -392,7 +774,7 @@ absl::Status Table::ExtensionsWorkerLoop() {
       }
     }
     {
-      absl::MutexLock lock(&mu_);
+      internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
       if (!extension_requests.empty()) {
         return absl::InvalidArgumentError(absl::StrCat(
             "ExtensionsWorkerLoop: extension_requests expected to be empty but "
@@ -405,7 +787,7 @@ absl::Status Table::ExtensionsWorkerLoop() {
           return absl::OkStatus();
         }
         extension_worker_sleeps_ = true;
-        extension_work_available_cv_.Wait(&mu_);
+        lock.Wait(&extension_work_available_cv_);
         extension_worker_sleeps_ = false;
       }
       std::swap(extension_requests_, extension_requests);
@@ -417,34 +799,43 @@ absl::Status Table::ExtensionsWorkerLoop() {
       }
     }
     {
-      absl::MutexLock lock(&async_extensions_mu_);
-      for (auto& request : extension_requests) {
-        switch (request.call_type) {
-          case ExtensionRequest::CallType::kInsert:
-            for (auto& extension : async_extensions_) {
-              extension->OnInsert(&async_extensions_mu_, request.item);
-            }
-            break;
-          case ExtensionRequest::CallType::kSample:
-            for (auto& extension : async_extensions_) {
-              extension->OnSample(&async_extensions_mu_, request.item);
-            }
-            break;
-          case ExtensionRequest::CallType::kUpdate:
-            for (auto& extension : async_extensions_) {
-              extension->OnUpdate(&async_extensions_mu_, request.item);
-            }
-            break;
-          case ExtensionRequest::CallType::kDelete:
-            for (auto& extension : async_extensions_) {
-              extension->OnDelete(&async_extensions_mu_, request.item);
-            }
-            deleted_items.push_back(std::move(request.item.ref));
-            break;
-          case ExtensionRequest::CallType::kMemoryRelease:
-            deleted_items.push_back(std::move(request.item.ref));
-            break;
+      internal::ProfiledMutexLock lock(
+          &async_extensions_mu_, REVERB_LOCK_SITE(kAsyncExtensionsMu));
+      // Consecutive requests of the same type are delivered as one batch.
+      for (size_t begin = 0; begin < extension_requests.size();) {
+        const auto call_type = extension_requests[begin].call_type;
+        size_t end = begin;
+        while (end < extension_requests.size() &&
+               extension_requests[end].call_type == call_type) {
+          batch_items.push_back(std::move(extension_requests[end].item));
+          end++;
+        }
+        begin = end;
+        for (auto& extension : async_extensions_) {
+          switch (call_type) {
+            case ExtensionRequest::CallType::kInsert:
+              extension->OnInsertBatch(&async_extensions_mu_, batch_items);
+              break;
+            case ExtensionRequest::CallType::kSample:
+              extension->OnSampleBatch(&async_extensions_mu_, batch_items);
+              break;
+            case ExtensionRequest::CallType::kUpdate:
+              extension->OnUpdateBatch(&async_extensions_mu_, batch_items);
+              break;
+            case ExtensionRequest::CallType::kDelete:
+              extension->OnDeleteBatch(&async_extensions_mu_, batch_items);
+              break;
+            case ExtensionRequest::CallType::kMemoryRelease:
+              break;
+          }
+        }
+        if (call_type == ExtensionRequest::CallType::kDelete ||
+            call_type == ExtensionRequest::CallType::kMemoryRelease) {
+          for (auto& item : batch_items) {
+            deleted_items.push_back(std::move(item.ref));
+          }
         }
+        batch_items.clear();
       }
     }
     extension_requests.clear();
@@ -452,30 +843,50 @@ absl::Status Table::ExtensionsWorkerLoop() {
 }
 
 void Table::SetCallbackExecutor(std::shared_ptr<TaskExecutor> executor) {
-  absl::MutexLock lock(&mu_);
-  callback_executor_ = executor;
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  std::atomic_store(&callback_executor_, std::move(executor));
+}
+
+std::shared_ptr<TaskExecutor> Table::callback_executor() const {
+  return std::atomic_load(&callback_executor_);
 }
 
 void Table::EnableTableWorker(std::shared_ptr<TaskExecutor> executor) {
   {
-    absl::MutexLock lock(&mu_);
-    callback_executor_ = executor;
+    internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+    std::atomic_store(&callback_executor_, std::move(executor));
   }
+  // The workers of all tables share a pool each in the usage reports. Their
+  // queue wait is part of the latency stats of the table.
   extension_worker_ = internal::StartThread("ExtensionWorker_" + name_, [&]() {
+    internal::ThreadPoolUsageTracker::Get("ExtensionWorker")
+        ->AddCurrentThread();
     auto status = ExtensionsWorkerLoop();
     REVERB_LOG_IF(REVERB_ERROR, !status.ok())
         << "Extension worker encountered a fatal error: " << status;
   });
-  table_worker_ = internal::StartThread("TableWorker_" + name_, [&]() {
-    auto status = TableWorkerLoop();
-    REVERB_LOG_IF(REVERB_ERROR, !status.ok())
-        << "Table worker encountered a fatal error: " << status;
-  });
+  insert_worker_ =
+      internal::StartThread("TableInsertWorker_" + name_, [&]() {
+        internal::ThreadPoolUsageTracker::Get("TableInsertWorker")
+            ->AddCurrentThread();
+        auto status = InsertWorkerLoop();
+        REVERB_LOG_IF(REVERB_ERROR, !status.ok())
+            << "Table insert worker encountered a fatal error: " << status;
+      });
+  sample_worker_ =
+      internal::StartThread("TableSampleWorker_" + name_, [&]() {
+        internal::ThreadPoolUsageTracker::Get("TableSampleWorker")
+            ->AddCurrentThread();
+        auto status = SampleWorkerLoop();
+        REVERB_LOG_IF(REVERB_ERROR, !status.ok())
+            << "Table sample worker encountered a fatal error: " << status;
+      });
   {
     // Move asynchrouns extensions to async_extensions_ collection. When table
     // worker is disabled all extensions are added to sync_extensions_.
-    absl::MutexLock table_lock(&mu_);
-    absl::MutexLock extension_lock(&async_extensions_mu_);
+    internal::ProfiledMutexLock table_lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+    internal::ProfiledMutexLock extension_lock(
+        &async_extensions_mu_, REVERB_LOCK_SITE(kAsyncExtensionsMu));
     std::vector<std::shared_ptr<TableExtension>> extensions;
     std::swap(extensions, sync_extensions_);
     for (auto& extension : extensions) {
@@ -491,15 +902,55 @@ void Table::EnableTableWorker(std::shared_ptr<TaskExecutor> executor) {
 
 std::vector<Table::Item> Table::Copy(size_t count) const {
   std::vector<Item> items;
-  absl::MutexLock lock(&mu_);
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
   items.reserve(count == 0 ? data_.size() : count);
-  for (auto it = data_.cbegin();
-       it != data_.cend() && (count == 0 || items.size() < count); it++) {
-    items.push_back(*it->second);
+  for (size_t slot = 0;
+       slot < data_.slot_count() && (count == 0 || items.size() < count);
+       slot++) {
+    if (data_.occupied(slot)) items.push_back(UnpackedCopy(*data_[slot]));
   }
   return items;
 }
 
+std::vector<Table::Item> Table::CopyPage(CopyCursor* cursor,
+                                         size_t max_items) const {
+  REVERB_CHECK_GE(max_items, 1);
+  std::vector<Item> items;
+  if (cursor->done) return items;
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  // Items never move between slots so walking the slots in order visits every
+  // item which remains in the table exactly once.
+  const size_t end_slot = std::min(data_.slot_count(),
+                                   cursor->next_slot + kMaxSlotsPerCopyPage);
+  size_t slot = cursor->next_slot;
+  for (; slot < end_slot && items.size() < max_items; slot++) {
+    if (data_.occupied(slot)) items.push_back(UnpackedCopy(*data_[slot]));
+  }
+  cursor->next_slot = slot;
+  cursor->done = slot >= data_.slot_count();
+  return items;
+}
+
+std::vector<Table::Item> Table::CopyEpisode(uint64_t episode_id) const {
+  std::vector<Item> items;
+  {
+    internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+    auto it = episode_refs_.find(episode_id);
+    if (it == episode_refs_.end()) return items;
+    items.reserve(it->second.keys.size());
+    for (Key key : it->second.keys) {
+      // Exhausted items are still referenced until they are reclaimed.
+      const size_t slot = data_.Find(key);
+      if (slot == ItemStore::kNotFound) continue;
+      items.push_back(UnpackedCopy(*data_[slot]));
+    }
+  }
+  std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+    return IsInsertedBefore(a.item, b.item);
+  });
+  return items;
+}
+
 absl::Status Table::InsertOrAssign(Item item, absl::Duration timeout) {
   REVERB_RETURN_IF_ERROR(CheckItemValidity(item));
   // This code path is here mainly to allow running existing tests with the
@@ -517,31 +968,143 @@ absl::Status Table::InsertOrAssign(Item item, absl::Duration timeout) {
   return errors::RateLimiterTimeout();
 }
 
+absl::Status Table::InsertOrAssignBatch(std::vector<Item> items,
+                                        absl::Duration timeout) {
+  if (items.empty()) return absl::OkStatus();
+  // Shared with the callback, which may still be running when the wait times
+  // out.
+  struct Progress {
+    absl::Mutex mu;
+    size_t num_remaining ABSL_GUARDED_BY(mu);
+    absl::Notification all_inserted;
+  };
+  auto progress = std::make_shared<Progress>();
+  progress->num_remaining = items.size();
+  auto insert_done = std::make_shared<InsertCallback>([progress](uint64_t) {
+    absl::MutexLock lock(&progress->mu);
+    if (--progress->num_remaining == 0) progress->all_inserted.Notify();
+  });
+  bool can_insert;
+  REVERB_RETURN_IF_ERROR(
+      InsertOrAssignBatchAsync(std::move(items), &can_insert, insert_done));
+  if (progress->all_inserted.WaitForNotificationWithTimeout(timeout)) {
+    return absl::OkStatus();
+  }
+  return errors::RateLimiterTimeout();
+}
+
 absl::Status Table::InsertOrAssignAsync(
     Item item, bool* can_insert_more,
-    std::weak_ptr<InsertCallback> insert_completed) {
+    std::weak_ptr<InsertCallback> insert_completed, uint64_t client_id) {
   REVERB_RETURN_IF_ERROR(CheckItemValidity(item));
+  REVERB_RETURN_IF_ERROR(CheckWindowValidity(
+      item, window_length_.load(std::memory_order_relaxed)));
+  if (pack_items_.load(std::memory_order_relaxed)) {
+    PackItem(&trajectory_layouts_, &item);
+  }
   InsertRequest request{std::make_shared<Item>(std::move(item)),
-                        std::move(insert_completed)};
+                        std::move(insert_completed), client_id, absl::Now()};
   // Table worker doesn't release memory of removed items, clients do that
   // asynchrously.
   std::shared_ptr<Item> to_delete;
   {
-    absl::MutexLock lock(&worker_mu_);
+    internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
     if (stop_worker_) {
       return absl::CancelledError("RateLimiter has been cancelled");
     }
     pending_inserts_.push_back(std::move(request));
-    wakeup_worker_.Signal();
+    num_queued_inserts_++;
+    SignalInsertLane();
     if (!deleted_items_.empty()) {
       to_delete = std::move(deleted_items_.back());
       deleted_items_.pop_back();
     }
-    *can_insert_more = pending_inserts_.size() < max_enqueued_inserts_;
+    *can_insert_more = num_queued_inserts_ < max_enqueued_inserts_;
   }
   return absl::OkStatus();
 }
 
+absl::Status Table::InsertOrAssignBatchAsync(
+    std::vector<Item> items, bool* can_insert_more,
+    std::weak_ptr<InsertCallback> insert_completed, uint64_t client_id) {
+  const int window_length = window_length_.load(std::memory_order_relaxed);
+  for (const auto& item : items) {
+    REVERB_RETURN_IF_ERROR(CheckItemValidity(item));
+    REVERB_RETURN_IF_ERROR(CheckWindowValidity(item, window_length));
+  }
+  if (pack_items_.load(std::memory_order_relaxed)) {
+    for (auto& item : items) {
+      PackItem(&trajectory_layouts_, &item);
+    }
+  }
+  std::vector<InsertRequest> requests;
+  requests.reserve(items.size());
+  const absl::Time now = absl::Now();
+  for (auto& item : items) {
+    requests.push_back(InsertRequest{std::make_shared<Item>(std::move(item)),
+                                     insert_completed, client_id, now});
+  }
+  // Table worker doesn't release memory of removed items, clients do that
+  // asynchrously.
+  std::vector<std::shared_ptr<Item>> to_delete;
+  {
+    internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+    if (stop_worker_) {
+      return absl::CancelledError("RateLimiter has been cancelled");
+    }
+    pending_inserts_.insert(pending_inserts_.end(),
+                            std::make_move_iterator(requests.begin()),
+                            std::make_move_iterator(requests.end()));
+    num_queued_inserts_ += requests.size();
+    SignalInsertLane();
+    // Release (at most) as many deleted items as items were inserted to keep
+    // the memory usage in balance.
+    while (!deleted_items_.empty() && to_delete.size() < requests.size()) {
+      to_delete.push_back(std::move(deleted_items_.back()));
+      deleted_items_.pop_back();
+    }
+    *can_insert_more = num_queued_inserts_ < max_enqueued_inserts_;
+  }
+  return absl::OkStatus();
+}
+
+void Table::SetFairInsertAdmission(bool enabled) {
+  internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+  fair_insert_admission_ = enabled;
+}
+
+absl::Status Table::SetMaxBytes(int64_t max_bytes) {
+  {
+    internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+    max_bytes_ = max_bytes;
+    REVERB_RETURN_IF_ERROR(EvictToMaxBytes());
+    PublishSnapshot();
+  }
+  // Evictions may have unblocked inserts, so wake up the table worker.
+  internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+  WakeupWorkers();
+  return absl::OkStatus();
+}
+
+absl::Status Table::SetCpuAffinity(absl::Span<const int> cpus) {
+  for (auto* worker : {&extension_worker_, &insert_worker_, &sample_worker_}) {
+    if (*worker != nullptr) {
+      REVERB_RETURN_IF_ERROR((*worker)->SetCpuAffinity(cpus));
+    }
+  }
+  return absl::OkStatus();
+}
+
+void Table::Reserve(int64_t num_items) {
+  const int64_t reserved = std::min(num_items, max_size_);
+  if (reserved <= 0) return;
+  reserved_items_ = reserved;
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  data_.Reserve(reserved);
+  chunk_refs_.reserve(reserved);
+  selectors_->Reserve(reserved);
+}
+
 absl::Status Table::InsertOrAssignInternal(std::shared_ptr<Item> item) {
   const auto key = item->item.key();
   const auto priority = item->item.priority();
@@ -551,30 +1114,35 @@ absl::Status Table::InsertOrAssignInternal(std::shared_ptr<Item> item) {
     return absl::OkStatus();
   }
 
+  // Exhausted items are reclaimed first so that `EvictToMaxBytes` sees the
+  // actual size and extensions are notified of their deletion before the
+  // insert.
+  REVERB_RETURN_IF_ERROR(ReclaimExhaustedItems());
+
   // Set the insertion timestamp after the lock has been acquired as this
   // represents the order it was inserted into the sampler and remover.
   EncodeAsTimestampProto(absl::Now(), item->item.mutable_inserted_at());
-  data_[key] = std::move(item);
-
-  REVERB_RETURN_IF_ERROR(sampler_->Insert(key, priority));
-  REVERB_RETURN_IF_ERROR(remover_->Insert(key, priority));
+  const size_t slot = data_.Insert(key, std::move(item)).first;
+  sampled_ahead_.clear();
 
-  auto it = data_.find(key);
+  REVERB_RETURN_IF_ERROR(selectors_->Insert(key, slot, priority));
+  AddToSnapshot(slot);
 
-  // Increment references to the episode/s the item is referencing.
+  // Increment references to the episode/s and chunks the item is referencing.
   // We increment before a possible call to DeleteItem since the sampler can
   // return this key.
-  for (const auto& chunk : it->second->chunks) {
-    ++episode_refs_[chunk->episode_id()];
-  }
+  AddReferences(*data_[slot]);
 
-  ExtensionOperation(ExtensionRequest::CallType::kInsert, it->second);
+  ExtensionOperation(ExtensionRequest::CallType::kInsert, data_[slot]);
 
   // Remove an item if we exceeded `max_size_`.
   if (data_.size() > max_size_) {
-    REVERB_RETURN_IF_ERROR(DeleteItem(remover_->Sample().key));
+    REVERB_RETURN_IF_ERROR(DeleteItem(selectors_->SelectForRemoval()));
   }
 
+  // Remove items until we are back within `max_bytes_`.
+  REVERB_RETURN_IF_ERROR(EvictToMaxBytes());
+
   // Now that the new item has been inserted and an older item has
   // (potentially) been removed the insert can be finalized.
   rate_limiter_->Insert(&mu_);
@@ -582,21 +1150,84 @@ absl::Status Table::InsertOrAssignInternal(std::shared_ptr<Item> item) {
 }
 
 absl::Status Table::MutateItems(absl::Span<const KeyWithPriority> updates,
-                                absl::Span<const Key> deletes) {
+                                absl::Span<const Key> deletes,
+                                absl::Span<const uint64_t> delete_episodes) {
+  const absl::Time start = absl::Now();
   std::vector<std::shared_ptr<Item>> deleted_items(deletes.size());
   {
-    absl::MutexLock lock(&mu_);
+    internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+    const absl::Time lock_acquired_at = absl::Now();
+    latency_->mutate_lock_wait.Record(lock_acquired_at - start);
+    auto record_lock_hold = internal::MakeCleanup([&] {
+      latency_->mutate_lock_hold.Record(absl::Now() - lock_acquired_at);
+    });
+    // The episodes must only reference items which can still be deleted.
+    REVERB_RETURN_IF_ERROR(ReclaimExhaustedItems());
     for (int i = 0; i < deletes.size(); i++) {
       REVERB_RETURN_IF_ERROR(DeleteItem(deletes[i], &deleted_items[i]));
     }
-    for (const auto& item : updates) {
-      REVERB_RETURN_IF_ERROR(UpdateItem(item.key(), item.priority()));
+    for (uint64_t episode_id : delete_episodes) {
+      auto it = episode_refs_.find(episode_id);
+      if (it == episode_refs_.end()) continue;
+      // Deleting the items erases them from (and eventually erases) the
+      // references of the episode so the keys are copied first.
+      const std::vector<Key> keys(it->second.keys.begin(),
+                                  it->second.keys.end());
+      for (Key key : keys) {
+        deleted_items.emplace_back();
+        REVERB_RETURN_IF_ERROR(DeleteItem(key, &deleted_items.back()));
+      }
     }
+    REVERB_RETURN_IF_ERROR(UpdateItems(updates));
+    PublishSnapshot();
+  }
+  {
+    // Table worker doesn't listen on rate_limiter, so need to wake it up
+    // explicitly.
+    internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+    WakeupWorkers();
+  }
+  latency_->mutate_end_to_end.Record(absl::Now() - start);
+  return absl::OkStatus();
+}
+
+absl::Status Table::ScalePriorities(double factor) {
+  if (!(factor > 0) || std::isinf(factor)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Priorities must be scaled by a positive and finite factor but got ",
+        factor, "."));
+  }
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  REVERB_RETURN_IF_ERROR(selectors_->ScalePriorities(factor));
+  sampled_ahead_.clear();
+  std::vector<std::shared_ptr<Item>> updated;
+  updated.reserve(data_.size());
+  for (size_t slot = 0; slot < data_.slot_count(); ++slot) {
+    if (!data_.occupied(slot)) continue;
+    data_[slot]->item.set_priority(data_[slot]->item.priority() * factor);
+    RefreshInSnapshot(slot);
+    updated.push_back(data_[slot]);
+  }
+  PublishSnapshot();
+  // Waiting for space in the extension buffer releases `mu_` so the updates
+  // are only reported once every item has been scaled. Otherwise concurrent
+  // calls could observe (and e.g update) a partially scaled table. Items which
+  // were deleted while `mu_` was released are no longer reported.
+  for (const auto& item : updated) {
+    const size_t slot = data_.Find(item->item.key());
+    if (slot == ItemStore::kNotFound || data_[slot] != item) continue;
+    ExtensionOperation(ExtensionRequest::CallType::kUpdate, item);
   }
-  // Table worker doesn't listen on rate_limiter, so need to wake it up
-  // explicitly.
-  absl::MutexLock lock(&worker_mu_);
-  wakeup_worker_.Signal();
+  return absl::OkStatus();
+}
+
+absl::Status Table::SetPriorityExponent(double priority_exponent) {
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  REVERB_RETURN_IF_ERROR(selectors_->SetPriorityExponent(
+      priority_exponent, [this](Key key) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        return data_.at(key)->item.priority();
+      }));
+  sampled_ahead_.clear();
   return absl::OkStatus();
 }
 
@@ -607,20 +1238,65 @@ absl::Status Table::Sample(SampledItem* sampled_item, absl::Duration timeout) {
   return absl::OkStatus();
 }
 
+absl::Status Table::SampleEpisode(std::vector<SampledItem>* items,
+                                  absl::Duration timeout) {
+  SampledItem sampled_item;
+  REVERB_RETURN_IF_ERROR(Sample(&sampled_item, timeout));
+  items->clear();
+  if (!sampled_item.ref->chunks.empty()) {
+    const uint64_t episode_id = sampled_item.ref->chunks.front()->episode_id();
+    internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+    // The sampled item is no longer referenced by the episode if it was
+    // deleted for reaching `max_times_sampled_`. Exhausted items which haven't
+    // been reclaimed yet are still referenced but no longer in the table.
+    if (auto it = episode_refs_.find(episode_id); it != episode_refs_.end()) {
+      items->reserve(it->second.keys.size() + 1);
+      for (Key key : it->second.keys) {
+        if (key == sampled_item.ref->item.key()) continue;
+        const size_t slot = data_.Find(key);
+        if (slot == ItemStore::kNotFound) continue;
+        const std::shared_ptr<Item>& item = data_[slot];
+        items->push_back({
+            .ref = item,
+            .probability = sampled_item.probability,
+            .table_size = static_cast<int64_t>(data_.size()),
+            .priority = item->item.priority(),
+            .times_sampled = item->item.times_sampled(),
+            .rate_limited = false,
+        });
+      }
+    }
+  }
+  items->push_back(std::move(sampled_item));
+  std::sort(items->begin(), items->end(),
+            [](const SampledItem& a, const SampledItem& b) {
+              return IsInsertedBefore(a.ref->item, b.ref->item);
+            });
+  return absl::OkStatus();
+}
+
 void Table::EnqueSampleRequest(int num_samples,
                                std::weak_ptr<SamplingCallback> callback,
-                               absl::Duration timeout) {
+                               absl::Duration timeout, uint64_t trace_id) {
   auto request = std::make_unique<SampleRequest>();
   request->on_batch_done = std::move(callback);
-  request->deadline = absl::Now() + timeout;
+  request->enqueued_at = absl::Now();
+  request->trace_id = trace_id;
+  request->deadline = request->enqueued_at + timeout;
   // Reserved size is used to communicate sampling batch size (it eliminates the
   // need of alocating memory inside the table worker).
   request->samples.reserve(num_samples);
+  if (SampleFromSnapshot(num_samples, &request->samples)) {
+    // The caller might hold locks which the callback acquires so it is still
+    // run on the callback executor.
+    FinalizeSampleRequest(std::move(request), absl::OkStatus());
+    return;
+  }
   // Table worker doesn't release memory of removed items, clients do that
   // asynchrously.
   std::shared_ptr<Item> to_delete;
   {
-    absl::MutexLock lock(&worker_mu_);
+    internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
     if (stop_worker_) {
       request->status = absl::CancelledError(
           "EnqueSampleRequest: RateLimiter has been cancelled");
@@ -635,7 +1311,7 @@ void Table::EnqueSampleRequest(int num_samples,
       to_delete = std::move(deleted_items_.back());
       deleted_items_.pop_back();
     }
-    wakeup_worker_.Signal();
+    SignalSampleLane();
   }
 }
 
@@ -665,8 +1341,270 @@ absl::Status Table::SampleFlexibleBatch(std::vector<SampledItem>* items,
 }
 
 absl::Status Table::SampleInternal(bool rate_limited, SampledItem* result) {
-  auto sample = sampler_->Sample();
-  std::shared_ptr<Item>& item = data_[sample.key];
+  if (!sampled_ahead_.empty()) {
+    const auto sample = sampled_ahead_.front();
+    sampled_ahead_.pop_front();
+    return RecordSample(sample, rate_limited, result);
+  }
+  return RecordSample(selectors_->Sample(), rate_limited, result);
+}
+
+absl::Status Table::SampleBatchInternal(bool rate_limited, int num_samples,
+                                        std::vector<SampledItem>* results) {
+  // No items are deleted while the batch is recorded (see header) so the
+  // selections made ahead of time remain valid throughout the batch.
+  while (num_samples > 0 && !sampled_ahead_.empty()) {
+    // Synchronous extensions may update priorities (and thus clear the buffer)
+    // while the sample is recorded so the selection is removed first.
+    const auto sample = sampled_ahead_.front();
+    sampled_ahead_.pop_front();
+    results->emplace_back();
+    REVERB_RETURN_IF_ERROR(RecordSample(sample, rate_limited, &results->back()));
+    num_samples--;
+  }
+  if (num_samples == 0) {
+    return absl::OkStatus();
+  }
+  for (const auto& sample : selectors_->SampleBatch(num_samples)) {
+    results->emplace_back();
+    REVERB_RETURN_IF_ERROR(
+        RecordSample(sample, rate_limited, &results->back()));
+  }
+  return absl::OkStatus();
+}
+
+void Table::FillSampleAhead() {
+  const int num_missing =
+      sample_ahead_size_ - static_cast<int>(sampled_ahead_.size());
+  if (num_missing <= 0 || data_.empty() || !rate_limiter_->CanSample(&mu_, 1)) {
+    return;
+  }
+  for (const auto& sample : selectors_->SampleBatch(num_missing)) {
+    sampled_ahead_.push_back(sample);
+    // Give chunks which have been spilled to disk a head start on being read
+    // back into memory.
+    for (const auto& chunk : data_.at(sample.key)->chunks) {
+      chunk->Prefetch();
+    }
+  }
+}
+
+void Table::SetPackItems(bool enabled) {
+  pack_items_.store(enabled, std::memory_order_relaxed);
+}
+
+void Table::SetWindowLength(int window_length) {
+  REVERB_CHECK_GE(window_length, 0);
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  REVERB_CHECK(data_.empty())
+      << "SetWindowLength must be called before items are inserted.";
+  REVERB_CHECK(window_length == 0 || !snapshot_sampling_)
+      << "Windows cannot be sampled from the snapshot of the items.";
+  window_length_.store(window_length, std::memory_order_relaxed);
+}
+
+void Table::SetSampleAheadSize(int size) {
+  REVERB_CHECK_GE(size, 0);
+  {
+    internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+    sample_ahead_size_ = size;
+    while (static_cast<int>(sampled_ahead_.size()) > size) {
+      sampled_ahead_.pop_back();
+    }
+  }
+  // Wake up the worker so that it fills the buffer.
+  internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+  WakeupWorkers();
+}
+
+int Table::num_sampled_ahead() const {
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  return sampled_ahead_.size();
+}
+
+absl::Status Table::SetSnapshotSampling(bool enabled) {
+  {
+    internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+    if (enabled == snapshot_sampling_) return absl::OkStatus();
+    if (enabled) {
+      if (!selectors_->sampler_options().has_uniform()) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Snapshot sampling requires a uniform sampler but table ", name_,
+            " uses ", selectors_->sampler_options().ShortDebugString(), "."));
+      }
+      if (window_length_ > 0) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Snapshot sampling is not supported by table ", name_,
+            " since it samples windows of its items."));
+      }
+      snapshot_sampling_ = true;
+      for (size_t slot = 0; slot < data_.slot_count(); ++slot) {
+        if (data_.occupied(slot)) AddToSnapshot(slot);
+      }
+    } else {
+      // Bookkeep the samples which have already been handed out.
+      REVERB_RETURN_IF_ERROR(ReconcileSnapshotSamples());
+      snapshot_sampling_ = false;
+      snapshot_.Clear();
+      snapshot_positions_.clear();
+    }
+    PublishSnapshot();
+  }
+  // The state of the rate limiter might have changed.
+  internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+  WakeupWorkers();
+  return absl::OkStatus();
+}
+
+bool Table::snapshot_sampling() const {
+  return snapshot_sampling_.load(std::memory_order_acquire);
+}
+
+bool Table::SampleFromSnapshot(int num_samples,
+                               std::vector<SampledItem>* samples) {
+  if (!snapshot_sampling_.load(std::memory_order_acquire)) return false;
+
+  // The samples are counted before the rate limiter is consulted so that
+  // concurrent readers cannot all be admitted by the same state.
+  const int64_t num_unreconciled =
+      num_unreconciled_snapshot_samples_.fetch_add(num_samples) + num_samples;
+  const auto snapshot = snapshot_.Load();
+  if (snapshot->empty() ||
+      !rate_limiter_->CanSampleWithoutLock(num_unreconciled)) {
+    num_unreconciled_snapshot_samples_ -= num_samples;
+    return false;
+  }
+
+  static thread_local absl::InsecureBitGen bit_gen;
+  const size_t size = snapshot->size();
+  std::vector<Key> keys;
+  keys.reserve(num_samples);
+  for (int i = 0; i < num_samples; i++) {
+    const SnapshotEntry& entry =
+        (*snapshot)[absl::Uniform<size_t>(bit_gen, 0, size)];
+    keys.push_back(entry.item->item.key());
+    samples->push_back({
+        .ref = entry.item,
+        .probability = 1. / size,
+        .table_size = static_cast<int64_t>(size),
+        .priority = entry.priority,
+        .times_sampled = entry.times_sampled + 1,
+        .rate_limited = false,
+    });
+  }
+
+  bool reconcile;
+  {
+    absl::MutexLock lock(&snapshot_samples_mu_);
+    snapshot_samples_.insert(snapshot_samples_.end(), keys.begin(),
+                             keys.end());
+    reconcile = snapshot_samples_.size() >= kMaxSnapshotSamplesPerReconcile;
+  }
+  // Blocked inserts only make progress once the samples are committed to the
+  // rate limiter.
+  if (reconcile || !rate_limiter_->CanInsertWithoutLock(1)) {
+    {
+      internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+      absl::Status status = ReconcileSnapshotSamples();
+      REVERB_LOG_IF(REVERB_ERROR, !status.ok())
+          << "Failed to reconcile the samples of table " << name_ << ": "
+          << status;
+    }
+    internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+    WakeupWorkers();
+  }
+  return true;
+}
+
+absl::Status Table::ReconcileSnapshotSamples() {
+  if (num_unreconciled_snapshot_samples_ == 0) return absl::OkStatus();
+  std::vector<Key> keys;
+  {
+    absl::MutexLock lock(&snapshot_samples_mu_);
+    std::swap(keys, snapshot_samples_);
+  }
+  if (keys.empty()) return absl::OkStatus();
+
+  rate_limiter_->CommitSamples(&mu_, keys.size());
+  num_unreconciled_snapshot_samples_ -= keys.size();
+  for (Key key : keys) {
+    const size_t slot = data_.Find(key);
+    // The item might have been deleted since the snapshot was published.
+    if (slot == ItemStore::kNotFound) continue;
+    const std::shared_ptr<Item>& item = data_[slot];
+    if (item->item.times_sampled() == 0) {
+      ++num_unique_samples_;
+    }
+    item->item.set_times_sampled(item->item.times_sampled() + 1);
+    ExtensionOperation(ExtensionRequest::CallType::kSample, item);
+    if (max_times_sampled_ > 0 &&
+        item->item.times_sampled() >= max_times_sampled_) {
+      REVERB_RETURN_IF_ERROR(DeleteItem(key));
+    } else {
+      RefreshInSnapshot(slot);
+    }
+  }
+  PublishSnapshot();
+  return absl::OkStatus();
+}
+
+void Table::AddToSnapshot(size_t slot) {
+  if (!snapshot_sampling_) return;
+  const std::shared_ptr<Item>& item = data_[slot];
+  snapshot_positions_[item->item.key()] = snapshot_.size();
+  snapshot_.PushBack(
+      {item, item->item.priority(), item->item.times_sampled()});
+  MaybePublishSnapshot();
+}
+
+void Table::RemoveFromSnapshot(Key key) {
+  if (!snapshot_sampling_) return;
+  auto it = snapshot_positions_.find(key);
+  if (it == snapshot_positions_.end()) return;
+  // The last entry is moved into the position of the removed one.
+  const size_t position = it->second;
+  snapshot_positions_.erase(it);
+  if (position + 1 < snapshot_.size()) {
+    SnapshotEntry last = snapshot_[snapshot_.size() - 1];
+    snapshot_positions_[last.item->item.key()] = position;
+    snapshot_.Set(position, std::move(last));
+  }
+  snapshot_.PopBack();
+  MaybePublishSnapshot();
+}
+
+void Table::RefreshInSnapshot(size_t slot) {
+  if (!snapshot_sampling_) return;
+  const std::shared_ptr<Item>& item = data_[slot];
+  auto it = snapshot_positions_.find(item->item.key());
+  if (it == snapshot_positions_.end()) return;
+  snapshot_.Set(it->second,
+                {item, item->item.priority(), item->item.times_sampled()});
+  MaybePublishSnapshot();
+}
+
+void Table::MaybePublishSnapshot() {
+  // Publishing copies a pointer per block so it is postponed until at least as
+  // many modifications have accumulated. Every critical section which
+  // modifies the items ends with `PublishSnapshot`.
+  if (snapshot_.num_unpublished() >=
+      std::max<int64_t>(snapshot_.num_blocks(), 1)) {
+    PublishSnapshot();
+  }
+}
+
+void Table::PublishSnapshot() {
+  if (snapshot_.num_unpublished() == 0) return;
+  // The previous version could hold the last references to deleted items.
+  internal::ReclamationQueue::Default()->Defer(
+      std::const_pointer_cast<internal::RcuArray<SnapshotEntry>::Version>(
+          snapshot_.Publish()));
+}
+
+absl::Status Table::RecordSample(
+    const ItemSelector::KeyWithProbability& sample, bool rate_limited,
+    SampledItem* result) {
+  std::shared_ptr<Item>& item = data_.at(sample.key);
   // If this is the first time the item was sampled then update unique
   // sampled counter.
   if (item->item.times_sampled() == 0) {
@@ -674,11 +1612,23 @@ absl::Status Table::SampleInternal(bool rate_limited, SampledItem* result) {
   }
   // Increment the sample count.
   item->item.set_times_sampled(item->item.times_sampled() + 1);
+  RefreshInSnapshot(data_.Find(sample.key));
+
+  // Materialize the sampled window if items are sampled as windows.
+  std::shared_ptr<Item> ref = item;
+  double probability = sample.probability;
+  if (const int window_length = window_length_.load(std::memory_order_relaxed);
+      window_length > 0) {
+    int num_windows;
+    REVERB_RETURN_IF_ERROR(SampleWindow(*item, window_length, &window_bitgen_,
+                                        &ref, &num_windows));
+    probability /= num_windows;
+  }
 
   // Copy Details of the sampled item.
   *result = {
-      .ref = item,
-      .probability = sample.probability,
+      .ref = std::move(ref),
+      .probability = probability,
       .table_size = static_cast<int64_t>(data_.size()),
       .priority = item->item.priority(),
       .times_sampled = item->item.times_sampled(),
@@ -689,22 +1639,33 @@ absl::Status Table::SampleInternal(bool rate_limited, SampledItem* result) {
   ExtensionOperation(ExtensionRequest::CallType::kSample, item);
 
   // If there is an upper bound of the number of times an item can be
-  // sampled and it is now reached then delete the item before the lock is
-  // released.
+  // sampled and it is now reached then the item must not be selected again
+  // once the lock is released. The rest of the deletion is postponed until
+  // the worker reclaims the exhausted items.
   if (item->item.times_sampled() == max_times_sampled_) {
-    REVERB_RETURN_IF_ERROR(DeleteItem(item->item.key()));
+    REVERB_RETURN_IF_ERROR(ExhaustItem(item->item.key()));
   }
   return absl::OkStatus();
 }
 
 int64_t Table::size() const {
-  absl::MutexLock lock(&mu_);
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
   return data_.size();
 }
 
+double Table::SamplingWeightLocked() const {
+  return selectors_->TotalWeight().value_or(static_cast<double>(data_.size()));
+}
+
 const std::string& Table::name() const { return name_; }
 
-TableInfo Table::info() const {
+TableInfo Table::info() {
+  TableInfo info = static_info();
+  FillDynamicInfo(&info);
+  return info;
+}
+
+TableInfo Table::static_info() const {
   TableInfo info;
 
   info.set_name(name_);
@@ -715,78 +1676,190 @@ TableInfo Table::info() const {
     *info.mutable_signature() = *signature_;
   }
 
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  *info.mutable_sampler_options() = selectors_->sampler_options();
+  *info.mutable_remover_options() = selectors_->remover_options();
+  return info;
+}
+
+void Table::FillDynamicInfo(TableInfo* info) {
   {
-    absl::MutexLock lock(&mu_);
-    *info.mutable_rate_limiter_info() = rate_limiter_->Info(&mu_);
-    *info.mutable_sampler_options() = sampler_->options();
-    *info.mutable_remover_options() = remover_->options();
-    info.set_current_size(data_.size());
-    info.set_num_episodes(episode_refs_.size());
-    info.set_num_deleted_episodes(num_deleted_episodes_);
-    info.set_num_unique_samples(num_unique_samples_);
+    internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+    ReclaimExhaustedItemsOrLog();
+    *info->mutable_rate_limiter_info() = rate_limiter_->Info(&mu_);
+    info->set_current_size(data_.size());
+    info->set_num_episodes(episode_refs_.size());
+    info->set_num_deleted_episodes(num_deleted_episodes_);
+    info->set_num_unique_samples(num_unique_samples_);
+    info->set_num_bytes(num_bytes_);
+    info->set_max_bytes(max_bytes_);
+    info->set_sampling_weight(SamplingWeightLocked());
   }
   {
-    absl::MutexLock lock(&worker_mu_);
-    auto* worker_time = info.mutable_table_worker_time();
-    worker_time->set_running_ms(absl::ToInt64Milliseconds(
-        worker_time_distribution_.GetTotalTimeIn(TableWorkerState::kRunning)));
-    worker_time->set_sampling_ms(
-        absl::ToInt64Milliseconds(worker_time_distribution_.GetTotalTimeIn(
-            TableWorkerState::kActivelySampling)));
-    worker_time->set_inserting_ms(
-        absl::ToInt64Milliseconds(worker_time_distribution_.GetTotalTimeIn(
-            TableWorkerState::kActivelyInserting)));
-    worker_time->set_sleeping_ms(absl::ToInt64Milliseconds(
-        worker_time_distribution_.GetTotalTimeIn(TableWorkerState::kSleeping)));
-    worker_time->set_waiting_for_sampling_ms(
-        absl::ToInt64Milliseconds(worker_time_distribution_.GetTotalTimeIn(
-            TableWorkerState::kWaitingForSamples)));
-    worker_time->set_waiting_for_inserts_ms(
-        absl::ToInt64Milliseconds(worker_time_distribution_.GetTotalTimeIn(
-            TableWorkerState::kWaitingForInserts)));
+    internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+    auto* worker_time = info->mutable_table_worker_time();
+    const auto& inserts = insert_lane_time_distribution_;
+    const auto& samples = sample_lane_time_distribution_;
+    auto to_ms = [](absl::Duration d) { return absl::ToInt64Milliseconds(d); };
+
+    auto* insert_lane = worker_time->mutable_insert_lane();
+    insert_lane->set_running_ms(
+        to_ms(inserts.GetTotalTimeIn(TableWorkerState::kRunning)));
+    insert_lane->set_active_ms(
+        to_ms(inserts.GetTotalTimeIn(TableWorkerState::kActivelyInserting)));
+    insert_lane->set_sleeping_ms(
+        to_ms(inserts.GetTotalTimeIn(TableWorkerState::kSleeping)));
+    insert_lane->set_blocked_ms(
+        to_ms(inserts.GetTotalTimeIn(TableWorkerState::kWaitingForSamples)));
+
+    auto* sample_lane = worker_time->mutable_sample_lane();
+    sample_lane->set_running_ms(
+        to_ms(samples.GetTotalTimeIn(TableWorkerState::kRunning)));
+    sample_lane->set_active_ms(
+        to_ms(samples.GetTotalTimeIn(TableWorkerState::kActivelySampling)));
+    sample_lane->set_sleeping_ms(
+        to_ms(samples.GetTotalTimeIn(TableWorkerState::kSleeping)));
+    sample_lane->set_blocked_ms(
+        to_ms(samples.GetTotalTimeIn(TableWorkerState::kWaitingForInserts)));
+
+    worker_time->set_running_ms(insert_lane->running_ms() +
+                                sample_lane->running_ms());
+    worker_time->set_sampling_ms(sample_lane->active_ms());
+    worker_time->set_inserting_ms(insert_lane->active_ms());
+    worker_time->set_sleeping_ms(insert_lane->sleeping_ms() +
+                                 sample_lane->sleeping_ms());
+    worker_time->set_waiting_for_sampling_ms(insert_lane->blocked_ms());
+    worker_time->set_waiting_for_inserts_ms(sample_lane->blocked_ms());
   }
+  latency_->ToProto(info->mutable_latency_stats());
+}
 
-  return info;
+void Table::LatencyHistograms::ToProto(TableLatencyStats* proto) const {
+  insert_queue_wait.ToProto(proto->mutable_insert_queue_wait());
+  insert_rate_limiter_block.ToProto(proto->mutable_insert_rate_limiter_block());
+  insert_lock_hold.ToProto(proto->mutable_insert_lock_hold());
+  insert_end_to_end.ToProto(proto->mutable_insert_end_to_end());
+  sample_queue_wait.ToProto(proto->mutable_sample_queue_wait());
+  sample_rate_limiter_block.ToProto(proto->mutable_sample_rate_limiter_block());
+  sample_lock_hold.ToProto(proto->mutable_sample_lock_hold());
+  sample_end_to_end.ToProto(proto->mutable_sample_end_to_end());
+  mutate_lock_wait.ToProto(proto->mutable_mutate_lock_wait());
+  mutate_lock_hold.ToProto(proto->mutable_mutate_lock_hold());
+  mutate_end_to_end.ToProto(proto->mutable_mutate_end_to_end());
 }
 
 void Table::Close() {
   {
-    absl::MutexLock lock(&mu_);
+    internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
     closed_ = true;
+    // Requests must no longer be served from the snapshot.
+    snapshot_sampling_ = false;
   }
   {
-    absl::MutexLock lock(&worker_mu_);
+    internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
     stop_worker_ = true;
-    wakeup_worker_.Signal();
+    WakeupWorkers();
   }
 }
 
 absl::Status Table::DeleteItem(Table::Key key,
                                std::shared_ptr<Item>* deleted_item) {
-  auto it = data_.find(key);
-  if (it == data_.end()) return absl::OkStatus();
+  const size_t slot = data_.Find(key);
+  if (slot == ItemStore::kNotFound) return absl::OkStatus();
+
+  std::shared_ptr<Item> item;
+  REVERB_RETURN_IF_ERROR(UnlinkItem(slot, &item));
+  REVERB_RETURN_IF_ERROR(ReleaseReferences(item));
+  if (deleted_item) {
+    *deleted_item = std::move(item);
+  } else {
+    // The item could hold the last reference to its chunks so destroying it
+    // here would free their data while holding `mu_`.
+    internal::ReclamationQueue::Default()->Defer(std::move(item));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Table::UnlinkItem(size_t slot, std::shared_ptr<Item>* item) {
+  const Key key = data_[slot]->item.key();
+  *item = data_.Erase(slot);
+  sampled_ahead_.clear();
+  RemoveFromSnapshot(key);
+  rate_limiter_->Delete(&mu_);
+  return selectors_->Delete(key, slot);
+}
 
+absl::Status Table::ReleaseReferences(const std::shared_ptr<Item>& item) {
+  const Key key = item->item.key();
   // Decrement counts to the episodes the item is referencing.
-  for (const auto& chunk : it->second->chunks) {
+  for (const auto& chunk : item->chunks) {
     auto ep_it = episode_refs_.find(chunk->episode_id());
     if (ep_it == episode_refs_.end()) {
       return absl::FailedPreconditionError(
           absl::StrCat("Unable to find chunk episode_id ", chunk->episode_id(),
                        " in refs table."));
     }
-    if (--(ep_it->second) == 0) {
+    ep_it->second.keys.erase(key);
+    if (--(ep_it->second.num_chunk_refs) == 0) {
       episode_refs_.erase(ep_it);
       num_deleted_episodes_++;
     }
+
+    auto chunk_it = chunk_refs_.find(chunk->key());
+    if (chunk_it == chunk_refs_.end()) {
+      return absl::FailedPreconditionError(absl::StrCat(
+          "Unable to find chunk ", chunk->key(), " in refs table."));
+    }
+    if (--(chunk_it->second) == 0) {
+      chunk_refs_.erase(chunk_it);
+      num_bytes_ -= chunk->DataByteSizeLong();
+    }
   }
-  auto item = std::move(it->second);
-  data_.erase(it);
-  rate_limiter_->Delete(&mu_);
-  REVERB_RETURN_IF_ERROR(sampler_->Delete(key));
-  REVERB_RETURN_IF_ERROR(remover_->Delete(key));
   ExtensionOperation(ExtensionRequest::CallType::kDelete, item);
-  if (deleted_item) {
-    *deleted_item = std::move(item);
+  return absl::OkStatus();
+}
+
+absl::Status Table::ExhaustItem(Table::Key key) {
+  const size_t slot = data_.Find(key);
+  if (slot == ItemStore::kNotFound) return absl::OkStatus();
+  exhausted_items_.emplace_back();
+  return UnlinkItem(slot, &exhausted_items_.back());
+}
+
+absl::Status Table::ReclaimExhaustedItems() {
+  if (exhausted_items_.empty()) return absl::OkStatus();
+  for (const auto& item : exhausted_items_) {
+    REVERB_RETURN_IF_ERROR(ReleaseReferences(item));
+  }
+  internal::ReclamationQueue::Default()->Defer(
+      std::vector<std::shared_ptr<void>>(
+          std::make_move_iterator(exhausted_items_.begin()),
+          std::make_move_iterator(exhausted_items_.end())));
+  exhausted_items_.clear();
+  return absl::OkStatus();
+}
+
+void Table::ReclaimExhaustedItemsOrLog() {
+  if (auto status = ReclaimExhaustedItems(); !status.ok()) {
+    REVERB_LOG(REVERB_ERROR) << "Failed to reclaim exhausted items of table "
+                             << name_ << ": " << status;
+  }
+}
+
+void Table::AddReferences(const Item& item) {
+  for (const auto& chunk : item.chunks) {
+    EpisodeRefs& episode = episode_refs_[chunk->episode_id()];
+    ++episode.num_chunk_refs;
+    episode.keys.insert(item.item.key());
+    if (++chunk_refs_[chunk->key()] == 1) {
+      num_bytes_ += chunk->DataByteSizeLong();
+    }
+  }
+}
+
+absl::Status Table::EvictToMaxBytes() {
+  while (max_bytes_ > 0 && num_bytes_ > max_bytes_ && data_.size() > 1) {
+    REVERB_RETURN_IF_ERROR(DeleteItem(selectors_->SelectForRemoval()));
   }
   return absl::OkStatus();
 }
@@ -825,10 +1898,11 @@ void Table::ExtensionOperation(ExtensionRequest::CallType type,
     // All extensions are synchronous without extension worker.
     return;
   }
-  if (!has_async_extensions_ && type != ExtensionRequest::CallType::kDelete &&
+  if (!has_async_extensions_ &&
       type != ExtensionRequest::CallType::kMemoryRelease) {
-    // Memory releasing requests depend on extension worker,
-    // otherwise no need to enqueue the operation.
+    // Memory releasing requests depend on extension worker, otherwise no need
+    // to enqueue the operation. Deleted items are released by `DeleteItem`
+    // (or its caller) outside of `mu_`, so they don't need the worker either.
     return;
   }
   while (extension_requests_.size() >= max_enqueued_extension_ops_) {
@@ -844,30 +1918,77 @@ void Table::ExtensionOperation(ExtensionRequest::CallType type,
 }
 
 absl::Status Table::UpdateItem(Key key, double priority) {
-  auto it = data_.find(key);
-  if (it == data_.end()) {
+  const size_t slot = data_.Find(key);
+  if (slot == ItemStore::kNotFound) {
     return absl::OkStatus();
   }
-  it->second->item.set_priority(priority);
-  REVERB_RETURN_IF_ERROR(sampler_->Update(key, priority));
-  REVERB_RETURN_IF_ERROR(remover_->Update(key, priority));
-  ExtensionOperation(ExtensionRequest::CallType::kUpdate, it->second);
+  data_[slot]->item.set_priority(priority);
+  RefreshInSnapshot(slot);
+  sampled_ahead_.clear();
+  REVERB_RETURN_IF_ERROR(selectors_->Update(key, slot, priority));
+  ExtensionOperation(ExtensionRequest::CallType::kUpdate, data_[slot]);
 
   return absl::OkStatus();
 }
 
+absl::Status Table::UpdateItems(absl::Span<const KeyWithPriority> updates) {
+  // The whole batch is validated up front so that an invalid priority cannot
+  // leave the selectors with only a prefix of the batch applied.
+  std::vector<KeyWithPriority> existing;
+  std::vector<size_t> slots;
+  existing.reserve(updates.size());
+  slots.reserve(updates.size());
+  for (const auto& update : updates) {
+    const size_t slot = data_.Find(update.key());
+    if (slot == ItemStore::kNotFound) continue;
+    REVERB_RETURN_IF_ERROR(selectors_->CheckPriority(update.priority()));
+    existing.push_back(update);
+    slots.push_back(slot);
+  }
+  if (existing.empty()) {
+    return absl::OkStatus();
+  }
+  sampled_ahead_.clear();
+  REVERB_RETURN_IF_ERROR(selectors_->UpdateBatch(existing, slots));
+  for (size_t i = 0; i < slots.size(); i++) {
+    data_[slots[i]]->item.set_priority(existing[i].priority());
+    RefreshInSnapshot(slots[i]);
+    ExtensionOperation(ExtensionRequest::CallType::kUpdate, data_[slots[i]]);
+  }
+  return absl::OkStatus();
+}
+
 absl::Status Table::Reset() {
+  // State of the table before the reset. It is swapped out under the lock and
+  // destroyed on the background thread once all locks are released.
+  struct Retired {
+    ItemStore data;
+    internal::flat_hash_map<uint64_t, EpisodeRefs> episode_refs;
+    internal::flat_hash_map<uint64_t, int64_t> chunk_refs;
+    std::deque<ItemSelector::KeyWithProbability> sampled_ahead;
+    std::vector<std::shared_ptr<Item>> deleted_items;
+    std::vector<std::shared_ptr<Item>> exhausted_items;
+    internal::flat_hash_map<Key, size_t> snapshot_positions;
+  };
+  auto retired = std::make_shared<Retired>();
+  // The containers swapped in are preallocated here rather than under the lock.
+  const int64_t reserved = reserved_items_;
+  if (reserved > 0) {
+    retired->data.Reserve(reserved);
+    retired->chunk_refs.reserve(reserved);
+  }
   {
-    absl::MutexLock table_lock(&mu_);
+    internal::ProfiledMutexLock table_lock(&mu_, REVERB_LOCK_SITE(kTableMu));
     if (extension_worker_) {
       // Make sure extension worker has no more work to do.
       auto extension_worker_done = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
         return extension_worker_sleeps_ && extension_requests_.empty();
       };
-      mu_.Await(absl::Condition(&extension_worker_done));
+      table_lock.Await(absl::Condition(&extension_worker_done));
     }
     {
-      absl::MutexLock extension_lock(&async_extensions_mu_);
+      internal::ProfiledMutexLock extension_lock(
+          &async_extensions_mu_, REVERB_LOCK_SITE(kAsyncExtensionsMu));
       for (auto& extension : sync_extensions_) {
         extension->OnReset(&mu_);
       }
@@ -875,30 +1996,54 @@ absl::Status Table::Reset() {
         extension->OnReset(&async_extensions_mu_);
       }
     }
-    sampler_->Clear();
-    remover_->Clear();
+    // The selectors only hold keys and priorities in flat arrays so clearing
+    // (and reserving) them is cheap compared to releasing the items.
+    selectors_->Clear();
+    if (reserved > 0) selectors_->Reserve(reserved);
+    std::swap(sampled_ahead_, retired->sampled_ahead);
 
     num_deleted_episodes_ = 0;
     num_unique_samples_ = 0;
-    episode_refs_.clear();
-
-    data_.clear();
+    std::swap(episode_refs_, retired->episode_refs);
+    std::swap(chunk_refs_, retired->chunk_refs);
+    num_bytes_ = 0;
+
+    std::swap(data_, retired->data);
+    std::swap(exhausted_items_, retired->exhausted_items);
+
+    // Samples drawn from the snapshot which haven't been reconciled yet are
+    // discarded together with the sampled items.
+    snapshot_.Clear();
+    std::swap(snapshot_positions_, retired->snapshot_positions);
+    PublishSnapshot();
+    {
+      absl::MutexLock samples_lock(&snapshot_samples_mu_);
+      num_unreconciled_snapshot_samples_ -= snapshot_samples_.size();
+      snapshot_samples_.clear();
+    }
 
     rate_limiter_->Reset(&mu_);
   }
   {
-    absl::MutexLock worker_lock(&worker_mu_);
+    internal::ProfiledMutexLock worker_lock(
+        &worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
     // Delete all items waiting for deletion.
-    deleted_items_.clear();
+    std::swap(deleted_items_, retired->deleted_items);
     // Wakeup worker in case it has pending inserts which couldn't make progress
     // before.
-    wakeup_worker_.Signal();
+    WakeupWorkers();
   }
+  internal::ReclamationQueue::Default()->Defer(std::move(retired));
   return absl::OkStatus();
 }
 
 Table::CheckpointAndChunks Table::Checkpoint() {
-  PriorityTableCheckpoint checkpoint;
+  return TakeSnapshot().ToCheckpoint();
+}
+
+Table::Snapshot Table::TakeSnapshot() {
+  Snapshot snapshot;
+  PriorityTableCheckpoint& checkpoint = snapshot.checkpoint_;
   checkpoint.set_table_name(name());
   checkpoint.set_max_size(max_size_);
   checkpoint.set_max_times_sampled(max_times_sampled_);
@@ -907,35 +2052,65 @@ Table::CheckpointAndChunks Table::Checkpoint() {
     *checkpoint.mutable_signature() = signature_.value();
   }
 
-  absl::MutexLock lock(&mu_);
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
 
+  // The episodes of the exhausted items must be counted as deleted.
+  ReclaimExhaustedItemsOrLog();
   checkpoint.set_num_deleted_episodes(num_deleted_episodes_);
   checkpoint.set_num_unique_samples(num_unique_samples_);
+  checkpoint.set_max_bytes(max_bytes_);
 
-  *checkpoint.mutable_sampler() = sampler_->options();
-  *checkpoint.mutable_remover() = remover_->options();
+  *checkpoint.mutable_sampler() = selectors_->sampler_options();
+  *checkpoint.mutable_remover() = selectors_->remover_options();
 
   // Note that is is important that the rate limiter checkpoint is
   // finalized before the items are added
   *checkpoint.mutable_rate_limiter() = rate_limiter_->CheckpointReader(&mu_);
 
-  absl::flat_hash_set<std::shared_ptr<ChunkStore::Chunk>> chunks;
-  for (const auto& entry : data_) {
-    *checkpoint.add_items() = entry.second->item;
-    chunks.insert(entry.second->chunks.begin(), entry.second->chunks.end());
+  snapshot.entries_.reserve(data_.size());
+  data_.ForEach([&](size_t slot, const std::shared_ptr<Item>& item) {
+    snapshot.entries_.push_back(
+        {item, item->item.priority(), item->item.times_sampled()});
+  });
+  return snapshot;
+}
+
+Table::CheckpointAndChunks Table::Snapshot::ToCheckpoint() const {
+  CheckpointAndChunks result;
+  result.checkpoint = checkpoint_;
+  auto* items = result.checkpoint.mutable_items();
+  items->Reserve(entries_.size());
+  FlatTrajectory scratch;
+  for (const Entry& entry : entries_) {
+    // The priority and times sampled of the item may be modified by the table
+    // at any time so only the fields which are immutable once the item has
+    // been inserted are read from it.
+    const PrioritizedItem& item = entry.item->item;
+    PrioritizedItem* copy = items->Add();
+    copy->set_key(item.key());
+    copy->set_table(item.table());
+    copy->set_priority(entry.priority);
+    copy->set_times_sampled(entry.times_sampled);
+    *copy->mutable_inserted_at() = item.inserted_at();
+    *copy->mutable_flat_trajectory() = entry.item->flat_trajectory(&scratch);
+    *copy->mutable_deprecated_chunk_keys() = item.deprecated_chunk_keys();
+    if (item.has_deprecated_sequence_range()) {
+      *copy->mutable_deprecated_sequence_range() =
+          item.deprecated_sequence_range();
+    }
+    result.chunks.insert(entry.item->chunks.begin(), entry.item->chunks.end());
   }
 
   // Sort the items in ascending order based on their insertion time. This makes
   // it possible to reconstruct ordered structures (Fifo) when the checkpoint is
   // loaded.
-  std::sort(checkpoint.mutable_items()->begin(),
-            checkpoint.mutable_items()->end(), IsInsertedBefore);
+  std::sort(items->begin(), items->end(), IsInsertedBefore);
 
-  return {std::move(checkpoint), std::move(chunks)};
+  return result;
 }
 
 absl::Status Table::InsertCheckpointItem(Table::Item item) {
-  absl::MutexLock lock(&mu_);
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
   if (data_.size() + 1 > max_size_) {
     return absl::FailedPreconditionError(absl::StrCat(
         "InsertCheckpointItem called on already full Table. table size: ",
@@ -947,44 +2122,112 @@ absl::Status Table::InsertCheckpointItem(Table::Item item) {
         item.item.key()));
   }
 
-  REVERB_RETURN_IF_ERROR(
-      sampler_->Insert(item.item.key(), item.item.priority()));
-  REVERB_RETURN_IF_ERROR(
-      remover_->Insert(item.item.key(), item.item.priority()));
-
   const auto key = item.item.key();
-  auto it = data_.emplace(key, std::make_shared<Item>(std::move(item))).first;
+  const double priority = item.item.priority();
+  const size_t slot =
+      data_.Insert(key, std::make_shared<Item>(std::move(item))).first;
+  absl::Status status = selectors_->Insert(key, slot, priority);
+  if (!status.ok()) {
+    data_.Erase(slot);
+    return status;
+  }
+
+  AddReferences(*data_[slot]);
+  AddToSnapshot(slot);
+  PublishSnapshot();
+  ExtensionOperation(ExtensionRequest::CallType::kInsert, data_[slot]);
 
-  for (const auto& chunk : it->second->chunks) {
-    ++episode_refs_[chunk->episode_id()];
+  return absl::OkStatus();
+}
+
+absl::Status Table::InsertCheckpointItems(std::vector<Table::Item> items) {
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  if (data_.size() + items.size() > max_size_) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "InsertCheckpointItems called with ", items.size(),
+        " items on Table which would exceed its maximum size. table size: ",
+        data_.size(), ", maximum size: ", max_size_));
+  }
+
+  std::vector<KeyWithPriority> keys;
+  keys.reserve(items.size());
+  for (const auto& item : items) {
+    if (data_.contains(item.item.key())) {
+      return absl::FailedPreconditionError(absl::StrCat(
+          "InsertCheckpointItems called for item with already present key: ",
+          item.item.key()));
+    }
+    keys.emplace_back();
+    keys.back().set_key(item.item.key());
+    keys.back().set_priority(item.item.priority());
+    *keys.back().mutable_inserted_at() = item.item.inserted_at();
+  }
+
+  data_.Reserve(data_.size() + items.size());
+  std::vector<size_t> slots;
+  slots.reserve(items.size());
+  for (auto& item : items) {
+    const auto key = item.item.key();
+    slots.push_back(
+        data_.Insert(key, std::make_shared<Item>(std::move(item))).first);
+  }
+  absl::Status status = selectors_->InsertBatch(keys, slots);
+  if (!status.ok()) {
+    for (size_t slot : slots) data_.Erase(slot);
+    return status;
   }
-  ExtensionOperation(ExtensionRequest::CallType::kInsert, it->second);
+
+  for (size_t slot : slots) {
+    AddReferences(*data_[slot]);
+    AddToSnapshot(slot);
+    ExtensionOperation(ExtensionRequest::CallType::kInsert, data_[slot]);
+  }
+  PublishSnapshot();
 
   return absl::OkStatus();
 }
 
 bool Table::Get(Table::Key key, Table::Item* item) {
-  absl::MutexLock lock(&mu_);
-  auto it = data_.find(key);
-  if (it != data_.end()) {
-    *item = *it->second;
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  const size_t slot = data_.Find(key);
+  if (slot != ItemStore::kNotFound) {
+    *item = UnpackedCopy(*data_[slot]);
     return true;
   }
   return false;
 }
 
-const internal::flat_hash_map<Table::Key, std::shared_ptr<Table::Item>>*
-Table::RawLookup() {
+void Table::GetBatch(absl::Span<const Key> keys,
+                     std::vector<SampledItem>* items) {
+  items->reserve(items->size() + keys.size());
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  for (Key key : keys) {
+    const size_t slot = data_.Find(key);
+    if (slot == ItemStore::kNotFound) continue;
+    const std::shared_ptr<Item>& item = data_[slot];
+    items->push_back({
+        .ref = item,
+        .probability = 0,
+        .table_size = static_cast<int64_t>(data_.size()),
+        .priority = item->item.priority(),
+        .times_sampled = item->item.times_sampled(),
+        .rate_limited = false,
+    });
+  }
+}
+
+const Table::ItemStore* Table::RawLookup() {
   mu_.AssertHeld();
   return &data_;
 }
 
 void Table::UnsafeAddExtension(std::shared_ptr<TableExtension> extension) {
   REVERB_CHECK_OK(extension->RegisterTable(&mu_, this));
-  absl::MutexLock lock(&mu_);
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
   REVERB_CHECK(data_.empty());
   if (extension->CanRunAsync() && extension_worker_) {
-    absl::MutexLock lock(&async_extensions_mu_);
+    internal::ProfiledMutexLock lock(
+        &async_extensions_mu_, REVERB_LOCK_SITE(kAsyncExtensionsMu));
     async_extensions_.push_back(std::move(extension));
     has_async_extensions_ = true;
   } else {
@@ -997,20 +2240,33 @@ const absl::optional<tensorflow::StructuredValue>& Table::signature() const {
 }
 
 bool Table::CanSample(int num_samples) const {
-  absl::MutexLock lock(&mu_);
-  return rate_limiter_->CanSample(&mu_, num_samples);
+  return rate_limiter_->CanSampleWithoutLock(num_samples);
 }
 
 bool Table::CanInsert(int num_inserts) const {
-  absl::MutexLock lock(&mu_);
-  return rate_limiter_->CanInsert(&mu_, num_inserts);
+  return rate_limiter_->CanInsertWithoutLock(num_inserts);
 }
 
-int64_t Table::num_episodes() const {
-  absl::MutexLock lock(&mu_);
+int Table::InsertHeadroom(int max_inserts) const {
+  // The queued inserts will consume headroom before any new ones.
+  const int64_t queued = num_queued_inserts();
+  const int headroom = rate_limiter_->InsertHeadroomWithoutLock(
+      std::min<int64_t>(max_inserts + queued, std::numeric_limits<int>::max()));
+  return std::max<int64_t>(headroom - queued, 0);
+}
+
+int64_t Table::num_episodes() {
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  ReclaimExhaustedItemsOrLog();
   return episode_refs_.size();
 }
 
+int64_t Table::num_bytes() {
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  ReclaimExhaustedItemsOrLog();
+  return num_bytes_;
+}
+
 absl::Status Table::UnsafeUpdateItem(Key key, double priority) {
   mu_.AssertHeld();
   return UpdateItem(key, priority);
@@ -1019,8 +2275,9 @@ absl::Status Table::UnsafeUpdateItem(Key key, double priority) {
 std::vector<std::shared_ptr<TableExtension>> Table::UnsafeClearExtensions() {
   std::vector<std::shared_ptr<TableExtension>> extensions;
   {
-    absl::MutexLock lock(&mu_);
-    absl::MutexLock extension_lock(&async_extensions_mu_);
+    internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+    internal::ProfiledMutexLock extension_lock(
+        &async_extensions_mu_, REVERB_LOCK_SITE(kAsyncExtensionsMu));
     REVERB_CHECK(data_.empty());
     extensions.swap(sync_extensions_);
     for (auto& extension : async_extensions_) {
@@ -1036,19 +2293,20 @@ std::vector<std::shared_ptr<TableExtension>> Table::UnsafeClearExtensions() {
   return extensions;
 }
 
-int64_t Table::num_deleted_episodes() const {
-  absl::MutexLock lock(&mu_);
+int64_t Table::num_deleted_episodes() {
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
+  ReclaimExhaustedItemsOrLog();
   return num_deleted_episodes_;
 }
 
 void Table::set_num_deleted_episodes_from_checkpoint(int64_t value) {
-  absl::MutexLock lock(&mu_);
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
   REVERB_CHECK(data_.empty() && num_deleted_episodes_ == 0);
   num_deleted_episodes_ = value;
 }
 
 void Table::set_num_unique_samples_from_checkpoint(int64_t value) {
-  absl::MutexLock lock(&mu_);
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
   REVERB_CHECK(data_.empty() && num_unique_samples_ == 0);
   num_unique_samples_ = value;
 }
@@ -1079,16 +2337,16 @@ int32_t Table::DefaultFlexibleBatchSize() const {
 }
 
 std::string Table::DebugString() const {
-  absl::MutexLock lock(&mu_);
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
   std::string str = absl::StrCat(
-      "Table(sampler=", sampler_->DebugString(),
-      ", remover=", remover_->DebugString(), ", max_size=", max_size_,
+      "Table(", selectors_->DebugString(), ", max_size=", max_size_,
       ", max_times_sampled=", max_times_sampled_, ", name=", name_,
       ", rate_limiter=", rate_limiter_->DebugString(), ", signature=",
       (signature_.has_value() ? signature_.value().DebugString() : "nullptr"));
 
   {
-    absl::MutexLock lock(&async_extensions_mu_);
+    internal::ProfiledMutexLock lock(
+        &async_extensions_mu_, REVERB_LOCK_SITE(kAsyncExtensionsMu));
 
     if (!sync_extensions_.empty() || !async_extensions_.empty()) {
       absl::StrAppend(&str, ", extensions=[");
@@ -1112,18 +2370,25 @@ std::string Table::DebugString() const {
 }
 
 bool Table::worker_is_sleeping() const {
-  absl::MutexLock lock(&worker_mu_);
-  return worker_time_distribution_.CurrentState() >=
-         TableWorkerState::kSleeping;
+  internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+  return insert_lane_time_distribution_.CurrentState() >=
+             TableWorkerState::kSleeping &&
+         sample_lane_time_distribution_.CurrentState() >=
+             TableWorkerState::kSleeping;
 }
 
 int Table::num_pending_async_sample_requests() const {
-  absl::MutexLock lock(&worker_mu_);
+  internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
   return pending_sampling_.size();
 }
 
+int64_t Table::num_queued_inserts() const {
+  internal::ProfiledMutexLock lock(&worker_mu_, REVERB_LOCK_SITE(kWorkerMu));
+  return num_queued_inserts_;
+}
+
 bool Table::all_extensions_are_up_to_date() const {
-  absl::MutexLock lock(&mu_);
+  internal::ProfiledMutexLock lock(&mu_, REVERB_LOCK_SITE(kTableMu));
   return extension_requests_.empty() && extension_worker_sleeps_;
 }
 
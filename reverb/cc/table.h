@@ -15,7 +15,9 @@
 #ifndef REVERB_CC_TABLE_H_
 #define REVERB_CC_TABLE_H_
 
+#include <atomic>
 #include <cstddef>
+#include <deque>
 #include <initializer_list>
 #include <memory>
 #include <string>
@@ -24,6 +26,7 @@
 
 #include <cstdint>
 #include "absl/base/thread_annotations.h"
+#include "absl/random/random.h"
 #include "absl/status/status.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
@@ -35,6 +38,13 @@
 #include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/selectors/interface.h"
+#include "reverb/cc/selectors/selector_pair.h"
+#include "reverb/cc/support/adaptive_spinner.h"
+#include "reverb/cc/support/latency_histogram.h"
+#include "reverb/cc/support/lock_profiler.h"
+#include "reverb/cc/support/packed_trajectory.h"
+#include "reverb/cc/support/rcu_array.h"
+#include "reverb/cc/support/slot_map.h"
 #include "reverb/cc/support/state_statistics.h"
 #include "reverb/cc/support/task_executor.h"
 #include "reverb/cc/table_extensions/interface.h"
@@ -48,6 +58,14 @@ namespace reverb {
 struct TableItem {
   PrioritizedItem item;
   std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks;
+
+  // Set instead of `item.flat_trajectory` when the item was inserted into a
+  // table which packs its items. See `Table::SetPackItems`.
+  absl::optional<internal::PackedTrajectory> packed_trajectory;
+
+  // Returns the trajectory of the item. A packed trajectory is unpacked into
+  // `scratch`, which must outlive the returned reference.
+  const FlatTrajectory& flat_trajectory(FlatTrajectory* scratch) const;
 };
 
 // Table item wrapper used by extensions. It holds shared pointer to the
@@ -109,6 +127,17 @@ class Table {
   struct SampleRequest;
   using Key = ItemSelector::Key;
   using Item = TableItem;
+  // Items of the table, each stored in a dense slot (see `internal::SlotMap`).
+  using ItemStore = internal::SlotMap<std::shared_ptr<Item>>;
+
+  // Maximum number of slots of the item store that `CopyPage` visits while
+  // holding the lock.
+  static constexpr size_t kMaxSlotsPerCopyPage = 64 * 1024;
+
+  // Maximum number of samples drawn from the snapshot (see
+  // `SetSnapshotSampling`) which are reconciled with the table at once.
+  static constexpr int kMaxSnapshotSamplesPerReconcile = 256;
+
   using SamplingCallback = std::function<void(SampleRequest*)>;
   using InsertCallback = std::function<void(uint64_t on_insert_completed)>;
 
@@ -134,12 +163,27 @@ class Table {
     absl::Time deadline;
     absl::Status status;
     std::weak_ptr<SamplingCallback> on_batch_done;
+    // When the request was enqueued and how long the sample lane has been
+    // blocked by the rate limiter while serving it. Used for the latency stats
+    // of the table.
+    absl::Time enqueued_at;
+    absl::Duration rate_limited_for;
+    // Flight recorder trace of the request (see `internal::FlightRecorder`), or
+    // 0 if the request isn't traced.
+    uint64_t trace_id = 0;
   };
 
   // Represents asynchronous insert request processed by the table worker.
   struct InsertRequest {
     std::shared_ptr<Item> item;
     std::weak_ptr<InsertCallback> insert_completed;
+    // Identifies the client which issued the request. Only used when fair
+    // insert admission is enabled (see `SetFairInsertAdmission`).
+    uint64_t client_id = 0;
+    // When the request was enqueued and when the insert lane picked it up.
+    // Used for the latency stats of the table.
+    absl::Time enqueued_at;
+    absl::Time picked_up_at;
   };
 
   // Used when checkpointing to ensure that none of the chunks referenced by the
@@ -150,11 +194,41 @@ class Table {
     absl::flat_hash_set<std::shared_ptr<ChunkStore::Chunk>> chunks;
   };
 
+  // Point-in-time copy of the state of the table, see `TakeSnapshot`. Only
+  // references to the items are held, together with the values of the fields
+  // which may still change once an item has been inserted (the priority and
+  // the number of times it has been sampled). Holding a snapshot keeps the
+  // items, and therefore their chunks, alive but never blocks the table.
+  class Snapshot {
+   public:
+    // Builds the checkpoint of the table at the time the snapshot was taken.
+    // Runs without the table lock so it can take as long as it needs to.
+    CheckpointAndChunks ToCheckpoint() const;
+
+    // Number of items in the snapshot.
+    size_t size() const { return entries_.size(); }
+
+   private:
+    friend class Table;
+
+    struct Entry {
+      std::shared_ptr<const Item> item;
+      double priority;
+      int32_t times_sampled;
+    };
+
+    // Checkpoint of the table without any items.
+    PriorityTableCheckpoint checkpoint_;
+    std::vector<Entry> entries_;
+  };
+
   // Constructor.
   // `name` is the name of the table. Must be unique within server.
   // `sampler` is used in Sample() calls, while `remover` is used in
   //   InsertOrAssign() when we need to remove an item to not exceed `max_size`
-  //   items in this container.
+  //   items in this container. Both must be empty and should not be used
+  //   after the table has been created as common combinations are replaced by
+  //   an equivalent fused implementation (see `internal::MakeSelectorPair`).
   // `max_times_sampled` is the maximum number of times we allow for an item to
   //   be sampled before it is deleted. No value lower than 1 will be used.
   // `rate_limiter` controls when sample and insert calls are allowed to
@@ -174,16 +248,45 @@ class Table {
   // Copies at most `count` items that are currently in the table.
   // If `count` is `0` (default) then all items are copied.
   // If `count` is less than `size` then a subset is selected with in an
-  // undefined manner.
+  // undefined manner. The table is locked for the entire copy, which blocks
+  // all other operations on large tables. Use `CopyPage` when an atomic
+  // snapshot is not required.
   std::vector<Item> Copy(size_t count = 0) const;
 
+  // Position of an iteration over the items by `CopyPage`.
+  struct CopyCursor {
+    // Slot of the item store at which the next page starts.
+    size_t next_slot = 0;
+
+    // Set once all items have been visited.
+    bool done = false;
+  };
+
+  // Copies up to `max_items` items, starting at `cursor`, and advances the
+  // cursor past them. The table is only locked while a single page is copied
+  // and at most `kMaxSlotsPerCopyPage` (empty or occupied) slots are visited
+  // per page, so a page may hold fewer items even if the cursor is not done
+  // yet. Calling this until `cursor->done` is set copies every item which is
+  // in the table throughout the iteration exactly once, with its state
+  // (e.g priority) at the time its page was copied. Items inserted or deleted
+  // in the meantime may or may not be copied, possibly twice if they are
+  // deleted and inserted again. Dies if `max_items` is < 1.
+  std::vector<Item> CopyPage(CopyCursor* cursor, size_t max_items) const
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Copies all items which reference at least one chunk of episode
+  // `episode_id`, ordered by the time they were inserted. Only visits the items
+  // of the episode rather than scanning the table.
+  std::vector<Item> CopyEpisode(uint64_t episode_id) const
+      ABSL_LOCKS_EXCLUDED(mu_);
+
   // Attempts to insert an item into the distribution. If the item
   // already exists, the existing item is updated. Also applies the necessary
   // updates to sampler and remover.
   //
   // This call also ensures that the container does not grow larger than
   // `max_size`. If an insertion causes the container to exceed `max_size_`, one
-  // item is removed with the strategy specified by the `remover_`. Please note
+  // item is removed with the strategy specified by the remover. Please note
   // that we insert the new item that exceeds the capacity BEFORE we run the
   // remover. This means that the newly inserted item could be deleted right
   // away.
@@ -194,15 +297,72 @@ class Table {
   absl::Status InsertOrAssign(
       Item item, absl::Duration timeout = absl::InfiniteDuration());
 
+  // Same as `InsertOrAssign` for all of `items`, which are enqueued under a
+  // single acquisition of the worker lock (see `InsertOrAssignBatchAsync`).
+  // The insert lane consults the rate limiter for as many of the items as it
+  // can insert at once and the call returns once all items have been
+  // inserted. Intended for seeding or backfilling a table from within the
+  // process. Returns an error without inserting any of the items if any of
+  // them is invalid. If `timeout` is exceeded then `DeadlineExceededError` is
+  // returned but the remaining items stay queued.
+  absl::Status InsertOrAssignBatch(
+      std::vector<Item> items,
+      absl::Duration timeout = absl::InfiniteDuration());
+
   // Similar to the InsertOrAssign, but insert operation is queued inside the
   // table instead of blocking the caller. insert_completed callback will be
   // called when insert operation has completed. can_insert_more is set to true
   // if further inserts can be performed right away. When can_insert_more is set
   // to false, further inserts can be executed only after insert_completed
-  // callback is called.
+  // callback is called. `client_id` identifies the caller when fair insert
+  // admission is enabled.
   absl::Status InsertOrAssignAsync(
       Item item, bool* can_insert_more,
-      std::weak_ptr<InsertCallback> insert_completed);
+      std::weak_ptr<InsertCallback> insert_completed, uint64_t client_id = 0);
+
+  // Same as `InsertOrAssignAsync` but enqueues all of `items` at once, taking
+  // the worker lock only once. `insert_completed` is called once for each item
+  // (in order) but the insert lane coalesces the callbacks of items inserted
+  // together into a single callback executor task. Returns an error without
+  // enqueuing any of the items if any of them is invalid.
+  absl::Status InsertOrAssignBatchAsync(
+      std::vector<Item> items, bool* can_insert_more,
+      std::weak_ptr<InsertCallback> insert_completed, uint64_t client_id = 0);
+
+  // Enables or disables fair insert admission. When enabled, queued inserts
+  // which are blocked by the rate limiter are admitted round-robin across
+  // clients (as identified by the `client_id` of `InsertOrAssignAsync`) rather
+  // than in arrival order, so a single fast writer cannot starve the others.
+  // Disabled by default.
+  void SetFairInsertAdmission(bool enabled) ABSL_LOCKS_EXCLUDED(worker_mu_);
+
+  // Sets how long the worker lanes may spin while waiting for new requests
+  // before they go to sleep. Spinning saves the wakeup latency of requests
+  // which arrive shortly after a lane ran out of work. The actual spin time
+  // adapts to how often spinning pays off (see `internal::AdaptiveSpinner`)
+  // so idle lanes only spin for a fraction of `budget`. Zero (the default)
+  // disables spinning.
+  void SetWorkerSpinBudget(absl::Duration budget);
+
+  // Limits the number of bytes referenced by the items of the table. Whenever
+  // an insert makes the table exceed the limit, items selected by the
+  // remover are deleted until the table is back within the limit (the most
+  // recently inserted item is never deleted just for exceeding the limit).
+  // Lowering the limit evicts items immediately. A value <= 0 (the default)
+  // means that there is no limit.
+  absl::Status SetMaxBytes(int64_t max_bytes) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Restricts the worker threads of the table (insert, sample and extension
+  // workers) to `cpus`. Used to keep the table on a single NUMA node so that
+  // the memory allocated by the workers is local to the CPUs accessing it.
+  absl::Status SetCpuAffinity(absl::Span<const int> cpus);
+
+  // Preallocates the item store, the chunk references and the selectors for
+  // `min(num_items, max_size)` items so that they do not grow, and rehash,
+  // while the table fills up. Their large arrays are advised to be backed by
+  // huge pages (see `internal::AdviseHugePages`). The reservation is restored
+  // by `Reset`.
+  void Reserve(int64_t num_items) ABSL_LOCKS_EXCLUDED(mu_);
 
   // Inserts an item without consulting or modifying the RateLimiter about the
   // operation.
@@ -210,13 +370,46 @@ class Table {
   // This should ONLY be used when restoring a `Table` from a checkpoint.
   absl::Status InsertCheckpointItem(Item item);
 
+  // Same as `InsertCheckpointItem` but inserts all items at once, which allows
+  // the sampler and remover to build their data structures in a single pass.
+  // The table might be left partially populated if an error is returned (e.g
+  // when a key is repeated) so it should be discarded in that case.
+  //
+  // This should ONLY be used when restoring a `Table` from a checkpoint.
+  absl::Status InsertCheckpointItems(std::vector<Item> items);
+
   // Updates the priority or deletes items in this table distribution. All
   // operations in the arguments are applied in the order that they are listed.
   // Different operations can be set at the same time. Ignores non existing keys
   // but returns any other errors. The operations might be applied partially
   // when an error occurs.
+  //
+  // `delete_episodes` deletes every item referencing a chunk of any of the
+  // listed episodes. Unknown episodes are ignored. Applied after `deletes`.
   absl::Status MutateItems(absl::Span<const KeyWithPriority> updates,
-                           absl::Span<const Key> deletes);
+                           absl::Span<const Key> deletes,
+                           absl::Span<const uint64_t> delete_episodes = {});
+
+  // Multiplies the priority of every item by `factor`, which must be positive
+  // and finite, e.g to decay all priorities at once. The sampler and remover
+  // are rescaled in a single pass rather than updated one item at a time.
+  // Returns `UnimplementedError` (without any change) if a selector does not
+  // support it.
+  //
+  // The pass holds the table lock throughout and every item is refreshed in
+  // the sampling snapshot and reported to the extensions as an update, so
+  // inserts and samples stall for O(size) on large tables.
+  absl::Status ScalePriorities(double factor) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Raises the priorities of all (current and future) items to
+  // `priority_exponent` in the sampler, which is rebuilt in a single pass.
+  // Returns `InvalidArgumentError` (without any change) if the sampler does
+  // not raise priorities to an exponent. The new exponent is part of the
+  // sampler options and is therefore also used when restoring checkpoints.
+  // Like `ScalePriorities`, inserts and samples stall for the O(size) rebuild
+  // of the sampler.
+  absl::Status SetPriorityExponent(double priority_exponent)
+      ABSL_LOCKS_EXCLUDED(mu_);
 
   // Attempts to sample an item from table with the sampling
   // strategy passed to the constructor. We only allow the sample operation if
@@ -227,14 +420,27 @@ class Table {
   absl::Status Sample(SampledItem* item,
                       absl::Duration timeout = kDefaultTimeout);
 
+  // Samples an item like `Sample` and then adds all other items of the same
+  // episode (that of the first chunk of the sampled item), ordered by the time
+  // they were inserted. Only the sampled item counts as a sample towards the
+  // rate limiter and `max_times_sampled_`. All items are returned with the
+  // probability of the sampled item, i.e the probability of the episode being
+  // selected through it.
+  absl::Status SampleEpisode(std::vector<SampledItem>* items,
+                             absl::Duration timeout = kDefaultTimeout);
+
   // Enques an asynchronous sampling performed by the table worker.
   // All queued sampling operations are a subject to the table's sampling
   // strategy defined by the `rate_limiter_`. Sampled element which has reached
   // `max_times_sampled_` are deleted from the table, so it cannot be
   // sampled again.
+  // If `trace_id` is not 0 then the time the request waits for the table
+  // worker and the time until it is done are recorded in the default
+  // `internal::FlightRecorder`.
   void EnqueSampleRequest(int num_samples,
                           std::weak_ptr<SamplingCallback> callback,
-                          absl::Duration timeout = kDefaultTimeout);
+                          absl::Duration timeout = kDefaultTimeout,
+                          uint64_t trace_id = 0);
 
   // Attempts to sample up to `batch_size` items (without releasing the lock).
   //
@@ -244,7 +450,7 @@ class Table {
   //      one sample operation to proceed. At this point an exclusive lock on
   //      the table is acquired.
   //   2. If `timeout` was exceeded, return `DeadlineExceededError`.
-  //   3. Select item using `sampler_`, push item to output vector `items`,
+  //   3. Select item using the sampler, push item to output vector `items`,
   //      call extensions and delete item from table if `max_times_sampled_`
   //      reached.
   //   4. (Without releasing the lock) IFF `rate_limiter_` allows for one more
@@ -260,7 +466,8 @@ class Table {
                                    absl::Duration timeout = kDefaultTimeout);
 
   // Returns true iff the current state would allow for `num_samples` to be
-  // sampled. Dies if `num_samples` is < 1.
+  // sampled. Dies if `num_samples` is < 1. Does not acquire the table mutex so
+  // the result can be out of date by the time it is returned.
   //
   // TODO(b/153258711): This currently ignores max_size and
   // max_times_sampled arguments to the table, and will return true if e.g.
@@ -268,12 +475,19 @@ class Table {
   bool CanSample(int num_samples) const;
 
   // Returns true iff the current state would allow for `num_inserts` to be
-  // inserted. Dies if `num_inserts` is < 1.
+  // inserted. Dies if `num_inserts` is < 1. Does not acquire the table mutex
+  // so the result can be out of date by the time it is returned.
   //
   // TODO(b/153258711): This currently ignores max_size and max_times_sampled
   // arguments to the table.
   bool CanInsert(int num_inserts) const;
 
+  // Number of further inserts, up to `max_inserts`, which the rate limiter
+  // would currently allow for once the queued (async) inserts have been
+  // applied. Like `CanInsert` it does not acquire the table mutex and the
+  // result must only be used as a hint (e.g. for throttling writers).
+  int InsertHeadroom(int max_inserts) const ABSL_LOCKS_EXCLUDED(worker_mu_);
+
   // Appends the extension to the internal list. Note that this must be called
   // before any other operation is called. If called when the number of items
   // is non zero, death is triggered.
@@ -293,25 +507,47 @@ class Table {
   // Lookup a single item. Returns true if found, else false.
   bool Get(Key key, Item* item) ABSL_LOCKS_EXCLUDED(mu_);
 
+  // Looks up the items of `keys` while holding the lock once for the whole
+  // batch. The found items are appended to `items` in the order of `keys` and
+  // keys which are not in the table are skipped. The items are referenced
+  // rather than copied, `priority` and `times_sampled` are copied under the
+  // lock and `probability` is left at 0 since the items were not sampled.
+  void GetBatch(absl::Span<const Key> keys, std::vector<SampledItem>* items)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
   // Get pointer to `data_`. Must only be called by extensions while lock held.
-  const internal::flat_hash_map<Key, std::shared_ptr<Item>>* RawLookup()
-      ABSL_ASSERT_EXCLUSIVE_LOCK(mu_);
+  const ItemStore* RawLookup() ABSL_ASSERT_EXCLUSIVE_LOCK(mu_);
 
-  // Removes all items and resets the RateLimiter to its initial state.
+  // Removes all items and resets the RateLimiter to its initial state. The
+  // item store and reference maps are swapped for empty ones under the lock
+  // and the old ones are destroyed on the background reclamation thread, so
+  // the lock is not held for a time proportional to the size of the table.
   absl::Status Reset();
 
-  // Generate a checkpoint from the table's current state.
+  // Generate a checkpoint from the table's current state. Same as
+  // `TakeSnapshot().ToCheckpoint()`.
   CheckpointAndChunks Checkpoint() ABSL_LOCKS_EXCLUDED(mu_);
 
+  // Takes a consistent snapshot of the table's current state. The table lock
+  // is only held while the item references are copied, which is much cheaper
+  // than building the checkpoint: inserts and samples are blocked for
+  // milliseconds rather than seconds for tables with millions of items.
+  Snapshot TakeSnapshot() ABSL_LOCKS_EXCLUDED(mu_);
+
   // Number of items in the table distribution.
   int64_t size() const ABSL_LOCKS_EXCLUDED(mu_);
 
   // Number of episodes in the table.
-  int64_t num_episodes() const ABSL_LOCKS_EXCLUDED(mu_);
+  int64_t num_episodes() ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Number of bytes of chunk data referenced by the items in the table (as
+  // reported by `ChunkStore::Chunk::DataByteSizeLong`). Chunks that are
+  // referenced by more than one item are only counted once.
+  int64_t num_bytes() ABSL_LOCKS_EXCLUDED(mu_);
 
   // Number of episodes that previously were in the table but has since been
   // deleted.
-  int64_t num_deleted_episodes() const ABSL_LOCKS_EXCLUDED(mu_);
+  int64_t num_deleted_episodes() ABSL_LOCKS_EXCLUDED(mu_);
 
   // "Manually" set the number of deleted episodes and unique samples. This is
   // only intended to be called when reconstructing a Table from a checkpoint
@@ -326,8 +562,17 @@ class Table {
 
   // Metadata about the table, including the current state of the rate limiter
   // and table worker execution time. Execution time is slightly out of sync, as
-  // it is updated periodically by the table worker thread.
-  TableInfo info() const;
+  // it is updated periodically by the table worker lanes.
+  TableInfo info();
+
+  // The fields of `info` which don't change throughout the lifetime of the
+  // table (see `ServerInfoResponse.static_fields_omitted`), including `name`.
+  TableInfo static_info() const;
+
+  // Sets the remaining fields of `info`, i.e those which change as the table
+  // is used. Items exhausted by sampling are reclaimed first so the counts
+  // never include them.
+  void FillDynamicInfo(TableInfo* info);
 
   // Signature (if any) of the table.
   const absl::optional<tensorflow::StructuredValue>& signature() const;
@@ -349,14 +594,82 @@ class Table {
   // Make table worker use provided executor for executing callbacks.
   void SetCallbackExecutor(std::shared_ptr<TaskExecutor> executor);
 
-  // Check whether the worker is currently sleeping (either no work to do or
-  // blocked). This method is only exposed for testing purposes.
+  // Executor which currently runs the callbacks of the table operations.
+  std::shared_ptr<TaskExecutor> callback_executor() const;
+
+  // Sets the maximum number of items which the table worker selects ahead of
+  // demand while it has no other work to do. Pending sample requests are then
+  // served from the buffer instead of consulting the sampler. The buffer is
+  // cleared whenever items are inserted, deleted or updated, so samples are
+  // always drawn from the current distribution. Only the selection is done
+  // ahead of time: the rate limiter is consulted when the sample is handed out
+  // so its accounting is unaffected. 0 (default) disables the buffer.
+  void SetSampleAheadSize(int size) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Sets whether items inserted from now on store their trajectory packed
+  // rather than as a `FlatTrajectory` proto. Packed trajectories take a single
+  // allocation per item and share the layout of the columns with the other
+  // items of the same shape, at the cost of unpacking them again whenever an
+  // item is sampled, copied or checkpointed. Disabled by default.
+  void SetPackItems(bool enabled);
+
+  // Makes every item stand for all windows of `window_length` consecutive steps
+  // of its trajectory. An actor can then insert each episode once instead of
+  // inserting one overlapping item per step. The selectors still index items
+  // but a sample is the window at an offset drawn uniformly from the sampled
+  // item: its trajectory and chunks are materialized at sample time, it keeps
+  // the key of the item and its probability is divided by the number of
+  // windows of the item. Priorities, sample counts and deletions apply to the
+  // item as a whole, so windows are sampled uniformly across the table only if
+  // the priority of every item is proportional to its number of windows.
+  //
+  // Inserted items must have columns of equal length of at least
+  // `window_length` steps. 0 (default) samples items as they are. Must be
+  // called before any items are inserted.
+  void SetWindowLength(int window_length) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Enables or disables sampling from a published snapshot of the items. When
+  // enabled, a copy-on-write array of the items (see `internal::RcuArray`) is
+  // maintained alongside the item store and republished after the inserts,
+  // deletes and updates of every critical section. Sample requests are then
+  // served by the calling thread from the published snapshot, without the
+  // table lock or the sample lane, as long as the rate limiter allows it.
+  // Requests which can't be served from the snapshot fall back to the sample
+  // lane.
+  //
+  // The bookkeeping of the snapshot samples (the rate limiter, the sample
+  // counts of the items, `max_times_sampled`, and the extensions) is
+  // reconciled in batches of up to `kMaxSnapshotSamplesPerReconcile` samples,
+  // or as soon as inserts are blocked. Until then a sample can still be drawn
+  // from a snapshot which includes an item that has since been deleted or
+  // that has reached `max_times_sampled`, so such items may be sampled a few
+  // times more than the limit. Samples are drawn uniformly, so only tables
+  // whose sampler is uniform and which don't sample windows (see
+  // `SetWindowLength`) support it.
+  //
+  // Returns `InvalidArgumentError` if the table doesn't support it. Disabled
+  // by default.
+  absl::Status SetSnapshotSampling(bool enabled) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Whether samples are drawn from the snapshot (see `SetSnapshotSampling`).
+  bool snapshot_sampling() const;
+
+  // Number of items currently selected ahead of demand. This method is only
+  // exposed for testing purposes.
+  int num_sampled_ahead() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Check whether both worker lanes are currently sleeping (either no work to
+  // do or blocked). This method is only exposed for testing purposes.
   bool worker_is_sleeping() const ABSL_LOCKS_EXCLUDED(worker_mu_);
 
   // Get the number of sample requests which hasn't been picked up by the worker
-  // yet. This method is only exposed for testing purposes.
+  // yet.
   int num_pending_async_sample_requests() const ABSL_LOCKS_EXCLUDED(worker_mu_);
 
+  // Number of asynchronous insert requests which have been enqueued but not yet
+  // inserted.
+  int64_t num_queued_inserts() const ABSL_LOCKS_EXCLUDED(worker_mu_);
+
   // Checks whether all extensions requests, async and sync, have been
   // processed. This is the case if there are no pending requests AND the
   // extension worker is sleeping.
@@ -367,7 +680,10 @@ class Table {
   int max_enqueued_inserts() const { return max_enqueued_inserts_; }
 
  private:
-  // State of the table worker.
+  // State of a table worker lane. The insert lane only uses `kRunning`,
+  // `kActivelyInserting`, `kSleeping` and `kWaitingForSamples` while the sample
+  // lane only uses `kRunning`, `kActivelySampling`, `kSleeping` and
+  // `kWaitingForInserts`.
   enum class TableWorkerState {
     // Worker is performing general work.
     kRunning,
@@ -388,40 +704,142 @@ class Table {
     kWaitingForInserts,
   };
 
+  // Latency distributions exported as `TableInfo.latency_stats`. Shared with
+  // the callbacks scheduled on `callback_executor_`, which might outlive the
+  // table.
+  struct LatencyHistograms {
+    internal::LatencyHistogram insert_queue_wait;
+    internal::LatencyHistogram insert_rate_limiter_block;
+    internal::LatencyHistogram insert_lock_hold;
+    internal::LatencyHistogram insert_end_to_end;
+    internal::LatencyHistogram sample_queue_wait;
+    internal::LatencyHistogram sample_rate_limiter_block;
+    internal::LatencyHistogram sample_lock_hold;
+    internal::LatencyHistogram sample_end_to_end;
+    internal::LatencyHistogram mutate_lock_wait;
+    internal::LatencyHistogram mutate_lock_hold;
+    internal::LatencyHistogram mutate_end_to_end;
+
+    void ToProto(TableLatencyStats* proto) const;
+  };
+
   struct ExtensionRequest {
     enum class CallType { kDelete, kInsert, kSample, kUpdate, kMemoryRelease };
     CallType call_type;
     ExtensionItem item;
   };
 
-  // Starts table worker thread which processes table operations queue. Worker
-  // will use provided executor for running operation callbacks.
+  // Starts the table worker threads which process the queued insert and sample
+  // requests. Workers will use provided executor for running operation
+  // callbacks.
   void EnableTableWorker(std::shared_ptr<TaskExecutor> executor);
 
-  // Table worker execution loop. It is executed by a dedicated thread
-  // and performs enqueued table operations (inserts, mutations, sampling...).
-  absl::Status TableWorkerLoop();
-
-  // Updates item priority in `data_`, `samper_`, `remover_` and calls
+  // Execution loop of the insert lane of the table worker. It is executed by a
+  // dedicated thread and drains `pending_inserts_` into a lane-local queue
+  // (see `SetFairInsertAdmission`), only holding `mu_` while items are
+  // inserted. When the rate limiter blocks the inserts it
+  // sleeps until the sample lane has made progress.
+  absl::Status InsertWorkerLoop();
+
+  // Execution loop of the sample lane of the table worker. It is executed by a
+  // dedicated thread and drains `pending_sampling_` in batches, only holding
+  // `mu_` while items are sampled. Requests are served earliest deadline first
+  // and `mu_` is released regularly so that new requests can overtake large
+  // ones which are only partially served. When the rate limiter blocks the
+  // sampling it sleeps until the insert lane has made progress or a request
+  // times out.
+  absl::Status SampleWorkerLoop();
+
+  // Wakes up both worker lanes after the table has been modified outside of
+  // the workers (e.g items have been deleted) in a way which could unblock
+  // them.
+  void WakeupWorkers() ABSL_EXCLUSIVE_LOCKS_REQUIRED(worker_mu_);
+
+  // Wakes up the insert and sample lane respectively.
+  void SignalInsertLane() ABSL_EXCLUSIVE_LOCKS_REQUIRED(worker_mu_);
+  void SignalSampleLane() ABSL_EXCLUSIVE_LOCKS_REQUIRED(worker_mu_);
+
+  // Waits on `cv` until the lane is signalled (`signals` changes) or until
+  // `deadline`. If spinning is enabled then `signals` is first spun on with
+  // `worker_mu_` released.
+  void WaitForLaneSignal(internal::ProfiledMutexLock* lock,
+                         internal::AdaptiveSpinner* spinner,
+                         const std::atomic<int64_t>& signals,
+                         absl::CondVar* cv, absl::Time deadline)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(worker_mu_);
+
+  // Updates item priority in `data_`, the sampler, the remover and calls
   // `OnUpdate` on all extensions.
   absl::Status UpdateItem(Key key, double priority)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
+  // Updates the priorities of several items with a single pass through each
+  // of the sampler and remover. Ignores keys which cannot be found. Nothing is
+  // updated if any of the priorities is rejected by the selectors.
+  absl::Status UpdateItems(absl::Span<const KeyWithPriority> updates)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Total sampling weight of the items in the table as reported by the
+  // sampler (e.g the priority mass, which may be 0). Falls back to the number
+  // of items when the sampler weights all items equally.
+  double SamplingWeightLocked() const ABSL_SHARED_LOCKS_REQUIRED(mu_);
+
   // Used by the table worker to perform sampling.
   absl::Status SampleInternal(bool rate_limited, SampledItem* result)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
-  // Finalize sampling request with a given status.
-  void FinalizeSampleRequest(std::unique_ptr<Table::SampleRequest> request,
-                             absl::Status status)
+  // Selects up to `sample_ahead_size_` items into `sampled_ahead_` if the rate
+  // limiter would currently allow sampling.
+  void FillSampleAhead() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Samples `num_samples` items with a single call to the sampler and appends
+  // them to `results`. Must only be used when `max_times_sampled_` < 1 as the
+  // sampled items are not deleted in between the selections.
+  absl::Status SampleBatchInternal(bool rate_limited, int num_samples,
+                                   std::vector<SampledItem>* results)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Draws `num_samples` items from the published snapshot into `samples`.
+  // Returns false, without sampling anything, if snapshot sampling is
+  // disabled, the snapshot is empty or the rate limiter (taking the samples
+  // which haven't been reconciled yet into account) doesn't allow for all of
+  // them.
+  bool SampleFromSnapshot(int num_samples, std::vector<SampledItem>* samples)
+      ABSL_LOCKS_EXCLUDED(mu_, worker_mu_);
+
+  // Applies the bookkeeping of the samples drawn from the snapshot since the
+  // previous call: commits them to the rate limiter, increments the sample
+  // counts of the items (deleting those which reached `max_times_sampled_`)
+  // and notifies the extensions.
+  absl::Status ReconcileSnapshotSamples() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Keep the snapshot of the items in sync with `data_`. No-ops unless
+  // snapshot sampling is enabled. The modifications are made visible by
+  // `PublishSnapshot`, or sooner if enough of them have accumulated for the
+  // cost of publishing to be amortized.
+  void AddToSnapshot(size_t slot) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void RemoveFromSnapshot(Key key) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void RefreshInSnapshot(size_t slot) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void MaybePublishSnapshot() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void PublishSnapshot() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Updates the table state after `sample` has been selected by the sampler
+  // and populates `result`.
+  absl::Status RecordSample(const ItemSelector::KeyWithProbability& sample,
+                            bool rate_limited, SampledItem* result)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
+  // Finalize sampling request with a given status. The callback of the
+  // request is run on `callback_executor_`.
+  void FinalizeSampleRequest(std::unique_ptr<Table::SampleRequest> request,
+                             absl::Status status);
+
   // Performs insertion of the `item` into the table.
   absl::Status InsertOrAssignInternal(std::shared_ptr<Item> item)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
-  // Deletes the item associated with the key from `data_`, `sampler_` and
-  // `remover_`. Ignores the key if it cannot be found.
+  // Deletes the item associated with the key from `data_` and
+  // `selectors_`. Ignores the key if it cannot be found.
   //
   // The deleted item is returned in order to allow the deallocation of the
   // underlying item to be postponed until the lock has been released.
@@ -431,6 +849,36 @@ class Table {
                           std::shared_ptr<Item>* deleted_item = nullptr)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
+  // Removes the item in `slot` from the table, the selectors, the rate limiter
+  // and the snapshot. It no longer counts towards the size of the table and
+  // can't be sampled but the references it holds are left untouched.
+  absl::Status UnlinkItem(size_t slot, std::shared_ptr<Item>* item)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Decrements the episode and chunk references of an unlinked item and
+  // notifies the extensions of its deletion.
+  absl::Status ReleaseReferences(const std::shared_ptr<Item>& item)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Unlinks an item which reached `max_times_sampled_` and queues it in
+  // `exhausted_items_` for `ReclaimExhaustedItems`.
+  absl::Status ExhaustItem(Key key) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Releases the references of all exhausted items and defers their
+  // destruction to the reclamation queue.
+  absl::Status ReclaimExhaustedItems() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Calls `ReclaimExhaustedItems` before the episode and byte counts are read
+  // and logs (rather than returns) any error.
+  void ReclaimExhaustedItemsOrLog() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Increments the episode and chunk references of a newly inserted item.
+  void AddReferences(const Item& item) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Deletes items selected by the remover until the table no longer exceeds
+  // `max_bytes_`. The last item of the table is never deleted.
+  absl::Status EvictToMaxBytes() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   // Executes a given extension operation for all extensions registered with the
   // table. If extension worker is enabled, operation is executed asynchronously
   // for all extensions that support asynchronous execution. For synchronous
@@ -449,19 +897,96 @@ class Table {
   // holding this mutex.
   mutable absl::Mutex mu_ ABSL_ACQUIRED_AFTER(worker_mu_);
 
-  // Distribution used for sampling.
-  std::shared_ptr<ItemSelector> sampler_ ABSL_GUARDED_BY(mu_);
-
-  // Distribution used for removing.
-  std::shared_ptr<ItemSelector> remover_ ABSL_GUARDED_BY(mu_);
+  // Distributions used for sampling and removing. Combined so that common
+  // pairs of selectors can share their bookkeeping (see `MakeSelectorPair`).
+  std::unique_ptr<internal::SelectorPair> selectors_ ABSL_GUARDED_BY(mu_);
 
   // Bijection of key to item. Used for storing the chunks and timestep range of
-  // each item.
-  internal::flat_hash_map<Key, std::shared_ptr<Item>> data_
+  // each item. The slot of each item is shared with `selectors_` so that they
+  // do not need to keep a key index of their own.
+  ItemStore data_ ABSL_GUARDED_BY(mu_);
+
+  // Selections made by the table worker ahead of demand. Cleared whenever the
+  // content of the sampler changes.
+  std::deque<ItemSelector::KeyWithProbability> sampled_ahead_
+      ABSL_GUARDED_BY(mu_);
+
+  // Maximum size of `sampled_ahead_`.
+  int sample_ahead_size_ ABSL_GUARDED_BY(mu_) = 0;
+
+  // Entry of the snapshot used by `SampleFromSnapshot`. The mutable fields of
+  // the item are copied since they are modified under the lock.
+  struct SnapshotEntry {
+    std::shared_ptr<Item> item;
+    double priority = 0;
+    int32_t times_sampled = 0;
+  };
+
+  // Whether samples are drawn from `snapshot_` (see `SetSnapshotSampling`).
+  // Only modified while holding `mu_` but read without it.
+  std::atomic<bool> snapshot_sampling_{false};
+
+  // Items of the table in arbitrary order. Modified while holding `mu_`, but
+  // published versions are loaded without it.
+  internal::RcuArray<SnapshotEntry> snapshot_;
+
+  // Position of every item in `snapshot_`.
+  internal::flat_hash_map<Key, size_t> snapshot_positions_
       ABSL_GUARDED_BY(mu_);
 
-  // Count of references from chunks referenced by items.
-  internal::flat_hash_map<uint64_t, int64_t> episode_refs_ ABSL_GUARDED_BY(mu_);
+  // Number of samples drawn from the snapshot which haven't been reconciled
+  // yet. Incremented before the samples are drawn so that concurrent readers
+  // take each other's samples into account when consulting the rate limiter.
+  std::atomic<int64_t> num_unreconciled_snapshot_samples_{0};
+
+  // Keys of the items sampled from the snapshot since the last
+  // `ReconcileSnapshotSamples`.
+  absl::Mutex snapshot_samples_mu_ ABSL_ACQUIRED_AFTER(mu_);
+  std::vector<Key> snapshot_samples_ ABSL_GUARDED_BY(snapshot_samples_mu_);
+
+  // Whether inserted items are packed. Read before the item is queued so that
+  // the packing is done outside of the table lock.
+  std::atomic<bool> pack_items_{false};
+
+  // Length of the windows sampled from items or 0 if items are sampled whole.
+  // Read before the item is queued in order to validate it.
+  std::atomic<int> window_length_{0};
+
+  // Draws the window offsets.
+  absl::BitGen window_bitgen_ ABSL_GUARDED_BY(mu_);
+
+  // Layouts shared by the packed trajectories of the items.
+  internal::TrajectoryLayoutInterner trajectory_layouts_;
+
+  // References from items to the chunks of an episode.
+  struct EpisodeRefs {
+    // Number of chunks of the episode referenced by items (counting a chunk
+    // once for every item referencing it).
+    int64_t num_chunk_refs = 0;
+    // Keys of the items referencing at least one chunk of the episode.
+    internal::flat_hash_set<Key> keys;
+  };
+
+  // References of each episode, keyed by episode id. Maintained on insert and
+  // delete so that the items of an episode can be found without a scan.
+  internal::flat_hash_map<uint64_t, EpisodeRefs> episode_refs_
+      ABSL_GUARDED_BY(mu_);
+
+  // Count of references from items to each chunk, keyed by chunk key.
+  internal::flat_hash_map<uint64_t, int64_t> chunk_refs_ ABSL_GUARDED_BY(mu_);
+
+  // Sum of `DataByteSizeLong` over all chunks in `chunk_refs_`.
+  int64_t num_bytes_ ABSL_GUARDED_BY(mu_) = 0;
+
+  // Items which reached `max_times_sampled_` and were unlinked while sampling
+  // but whose references haven't been released yet. The sample worker reclaims
+  // them after its sampling critical section, at the latest before it becomes
+  // idle, so the episode and byte counts can briefly include them.
+  std::vector<std::shared_ptr<Item>> exhausted_items_ ABSL_GUARDED_BY(mu_);
+
+  // Maximum value of `num_bytes_` before items are evicted. A value <= 0 means
+  // there is no limit.
+  int64_t max_bytes_ ABSL_GUARDED_BY(mu_) = 0;
 
   // The total number of episodes that were at some point referenced by items
   // in the table but have since been removed. Is set to 0 when `Reset()`
@@ -479,6 +1004,10 @@ class Table {
   // respects this limit when inserting a new item.
   const int64_t max_size_;
 
+  // Number of items reserved by `Reserve`. Read by `Reset` before the lock is
+  // acquired so that the replacement containers are allocated outside of it.
+  std::atomic<int64_t> reserved_items_{0};
+
   // Number of queued inserts that are allowed on the table without slowing down
   // further inserts.
   const int64_t max_enqueued_inserts_;
@@ -501,12 +1030,21 @@ class Table {
   // Optional signature for data in the table.
   const absl::optional<tensorflow::StructuredValue> signature_;
 
-  // Worker thread which processes asynchronous insert and sample requests.
-  std::unique_ptr<internal::Thread> table_worker_;
+  // Worker threads which process asynchronous insert and sample requests
+  // respectively.
+  std::unique_ptr<internal::Thread> insert_worker_;
+  std::unique_ptr<internal::Thread> sample_worker_;
 
   // Pending asynchronous insert requests to the table.
   std::vector<InsertRequest> pending_inserts_ ABSL_GUARDED_BY(worker_mu_);
 
+  // Number of asynchronous insert requests which have been enqueued but not
+  // yet inserted, including the ones already picked up by the insert lane.
+  int64_t num_queued_inserts_ ABSL_GUARDED_BY(worker_mu_) = 0;
+
+  // Whether the insert lane admits inserts round-robin across clients.
+  bool fair_insert_admission_ ABSL_GUARDED_BY(worker_mu_) = false;
+
   // Pending sample requests to the table (not yet picked up by the worker).
   std::vector<std::unique_ptr<SampleRequest>> pending_sampling_
       ABSL_GUARDED_BY(worker_mu_);
@@ -515,24 +1053,52 @@ class Table {
   // This way we avoid expensive memory dealocation inside the worker.
   std::vector<std::shared_ptr<Item>> deleted_items_ ABSL_GUARDED_BY(worker_mu_);
 
-  // Table worker execution time stats. It is updated periodically as table
-  // worker state changes frequently and we don't want to grab `worker_mu_` each
-  // time that happens.
-  internal::StateStatistics<TableWorkerState> worker_time_distribution_
+  // Execution time stats of the insert and sample lanes. They are updated
+  // periodically as the lane states change frequently and we don't want to
+  // grab `worker_mu_` each time that happens.
+  internal::StateStatistics<TableWorkerState> insert_lane_time_distribution_
       ABSL_GUARDED_BY(worker_mu_);
+  internal::StateStatistics<TableWorkerState> sample_lane_time_distribution_
+      ABSL_GUARDED_BY(worker_mu_);
+
+  // Incremented every time a lane has processed requests (or the table has
+  // been modified by `WakeupWorkers`). A lane which is blocked by the rate
+  // limiter only goes to sleep if the counter of the other lane is unchanged
+  // since it last checked the rate limiter.
+  int64_t insert_lane_progress_ ABSL_GUARDED_BY(worker_mu_) = 0;
+  int64_t sample_lane_progress_ ABSL_GUARDED_BY(worker_mu_) = 0;
 
   // Should worker terminate. Set to true upon table termination to stop the
   // worker.
   bool stop_worker_ ABSL_GUARDED_BY(worker_mu_) = false;
 
-  // Used for waking up a table worker when asleep.
-  absl::CondVar wakeup_worker_ ABSL_GUARDED_BY(worker_mu_);
+  // Used for waking up the insert and sample lanes when asleep.
+  absl::CondVar wakeup_insert_worker_ ABSL_GUARDED_BY(worker_mu_);
+  absl::CondVar wakeup_sample_worker_ ABSL_GUARDED_BY(worker_mu_);
+
+  // Number of times the insert and sample lanes have been signalled. Only
+  // incremented while holding `worker_mu_` but read without it by lanes which
+  // are spinning.
+  std::atomic<int64_t> insert_lane_signals_{0};
+  std::atomic<int64_t> sample_lane_signals_{0};
+
+  // Used by the insert and sample lanes to spin before they go to sleep. Only
+  // used by the lane itself.
+  internal::AdaptiveSpinner insert_lane_spinner_;
+  internal::AdaptiveSpinner sample_lane_spinner_;
 
   // Mutex to protect table worker's state.
   mutable absl::Mutex worker_mu_ ABSL_ACQUIRED_BEFORE(mu_);
 
-  // Executor used by the table worker to run operation callbacks.
-  std::shared_ptr<TaskExecutor> callback_executor_ ABSL_GUARDED_BY(mu_);
+  // Latency distributions of the table operations. Thread safe.
+  const std::shared_ptr<LatencyHistograms> latency_ =
+      std::make_shared<LatencyHistograms>();
+
+  // Executor used by the table worker to run operation callbacks. Only
+  // replaced while holding `mu_` but accessed through `std::atomic_load` and
+  // `std::atomic_store` so that samples drawn from the snapshot (see
+  // `SetSnapshotSampling`) can be finalized without the lock.
+  std::shared_ptr<TaskExecutor> callback_executor_;
 
   // Extension worker which asynchronously updates monitoring.
   std::unique_ptr<internal::Thread> extension_worker_;
@@ -60,6 +60,26 @@ void TableExtensionBase::OnSample(absl::Mutex* mu, const ExtensionItem& item) {
   ApplyOnSample(item);
 }
 
+void TableExtensionBase::OnDeleteBatch(absl::Mutex* mu,
+                                       absl::Span<const ExtensionItem> items) {
+  ApplyOnDeleteBatch(items);
+}
+
+void TableExtensionBase::OnInsertBatch(absl::Mutex* mu,
+                                       absl::Span<const ExtensionItem> items) {
+  ApplyOnInsertBatch(items);
+}
+
+void TableExtensionBase::OnUpdateBatch(absl::Mutex* mu,
+                                       absl::Span<const ExtensionItem> items) {
+  ApplyOnUpdateBatch(items);
+}
+
+void TableExtensionBase::OnSampleBatch(absl::Mutex* mu,
+                                       absl::Span<const ExtensionItem> items) {
+  ApplyOnSampleBatch(items);
+}
+
 void TableExtensionBase::ApplyOnDelete(const ExtensionItem& item) {}
 
 void TableExtensionBase::ApplyOnInsert(const ExtensionItem& item) {}
@@ -70,5 +90,25 @@ void TableExtensionBase::ApplyOnUpdate(const ExtensionItem& item) {}
 
 void TableExtensionBase::ApplyOnSample(const ExtensionItem& item) {}
 
+void TableExtensionBase::ApplyOnDeleteBatch(
+    absl::Span<const ExtensionItem> items) {
+  for (const auto& item : items) ApplyOnDelete(item);
+}
+
+void TableExtensionBase::ApplyOnInsertBatch(
+    absl::Span<const ExtensionItem> items) {
+  for (const auto& item : items) ApplyOnInsert(item);
+}
+
+void TableExtensionBase::ApplyOnUpdateBatch(
+    absl::Span<const ExtensionItem> items) {
+  for (const auto& item : items) ApplyOnUpdate(item);
+}
+
+void TableExtensionBase::ApplyOnSampleBatch(
+    absl::Span<const ExtensionItem> items) {
+  for (const auto& item : items) ApplyOnSample(item);
+}
+
 }  // namespace reverb
 }  // namespace deepmind
@@ -21,6 +21,7 @@
 #include "absl/base/thread_annotations.h"
 #include "absl/status/status.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "reverb/cc/schema.pb.h"
 
 namespace deepmind {
@@ -67,6 +68,25 @@ class TableExtension {
   virtual void OnSample(absl::Mutex* mu, const ExtensionItem& item)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu) = 0;
 
+  // Batched versions of the hooks above. Asynchronous extensions are called
+  // through these by the extension worker, which delivers consecutive
+  // operations of the same type in a single call (in the order they were
+  // applied to the table). This allows extensions to amortize their overhead
+  // over all items of the batch. Synchronous extensions are only called
+  // through the per item hooks.
+  virtual void OnInsertBatch(absl::Mutex* mu,
+                             absl::Span<const ExtensionItem> items)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu) = 0;
+  virtual void OnDeleteBatch(absl::Mutex* mu,
+                             absl::Span<const ExtensionItem> items)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu) = 0;
+  virtual void OnUpdateBatch(absl::Mutex* mu,
+                             absl::Span<const ExtensionItem> items)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu) = 0;
+  virtual void OnSampleBatch(absl::Mutex* mu,
+                             absl::Span<const ExtensionItem> items)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu) = 0;
+
   // Executed just before all items are deleted.
   virtual void OnReset(absl::Mutex* mu) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu) = 0;
 
@@ -0,0 +1,441 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/table_extensions/replication.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "grpcpp/impl/codegen/client_context.h"
+#include "grpcpp/impl/codegen/sync_stream.h"
+#include "grpcpp/support/channel_arguments.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/time/clock.h"
+#include "reverb/cc/platform/grpc_utils.h"
+#include "reverb/cc/platform/hash_set.h"
+#include "reverb/cc/platform/logging.h"
+#include "reverb/cc/platform/thread.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/support/grpc_util.h"
+#include "reverb/cc/support/unbounded_queue.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+grpc::ChannelArguments CreateChannelArguments() {
+  grpc::ChannelArguments arguments;
+  arguments.SetMaxReceiveMessageSize(-1);  // Unlimited.
+  arguments.SetMaxSendMessageSize(-1);     // Unlimited.
+  arguments.SetInt(GRPC_ARG_MAX_RECONNECT_BACKOFF_MS, 30 * 1000);
+  return arguments;
+}
+
+// Copies the immutable fields of `item`. The priority and the sample count may
+// be modified by the table while the extension runs and are taken from the
+// snapshot in `item` instead.
+PrioritizedItem CopyForReplica(const ExtensionItem& item) {
+  PrioritizedItem copy;
+  copy.set_key(item.ref->item.key());
+  copy.set_table(item.ref->item.table());
+  copy.set_priority(item.priority);
+  FlatTrajectory scratch;
+  *copy.mutable_flat_trajectory() = item.ref->flat_trajectory(&scratch);
+  *copy.mutable_inserted_at() = item.ref->item.inserted_at();
+  return copy;
+}
+
+}  // namespace
+
+struct ReplicationExtension::Operation {
+  enum class Type { kInsert, kMutate, kReset };
+  Type type;
+  std::string table;
+
+  // kInsert: the items and the chunks they reference.
+  std::vector<PrioritizedItem> items;
+  std::vector<std::vector<std::shared_ptr<ChunkStore::Chunk>>> chunks;
+
+  // kMutate.
+  std::vector<KeyWithPriority> updates;
+  std::vector<uint64_t> deletes;
+};
+
+// Applies the operations forwarded to one replica in order on a thread of its
+// own.
+class ReplicationExtension::Replica {
+ public:
+  Replica(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
+          const Options& options, int index)
+      : stub_(std::move(stub)), options_(options) {
+    thread_ = internal::StartThread(
+        absl::StrCat("ReplicationExtension_", index), [this] { Run(); });
+  }
+
+  ~Replica() {
+    queue_.Close();
+    {
+      absl::MutexLock lock(&mu_);
+      stopped_ = true;
+      if (active_context_ != nullptr) active_context_->TryCancel();
+    }
+    thread_ = nullptr;  // Joins the thread.
+    CloseStream();
+  }
+
+  void Enqueue(std::shared_ptr<const Operation> operation) {
+    {
+      absl::MutexLock lock(&mu_);
+      num_enqueued_++;
+    }
+    queue_.Push(std::move(operation));
+  }
+
+  void Flush() {
+    absl::MutexLock lock(&mu_);
+    const int64_t target = num_enqueued_;
+    auto done = [this, target]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      return stopped_ || num_done_ >= target;
+    };
+    mu_.Await(absl::Condition(&done));
+  }
+
+  int64_t num_dropped() const {
+    absl::MutexLock lock(&mu_);
+    return num_dropped_;
+  }
+
+ private:
+  void Run() {
+    std::shared_ptr<const Operation> operation;
+    while (queue_.Pop(&operation)) {
+      absl::Status status;
+      for (int attempt = 1; attempt <= options_.max_attempts; attempt++) {
+        status = Apply(*operation);
+        if (status.ok() || IsStopped()) break;
+        REVERB_LOG(REVERB_WARNING)
+            << "Attempt " << attempt << " of forwarding an operation on table "
+            << operation->table << " to a replica failed: " << status;
+        CloseStream();
+        absl::SleepFor(options_.retry_delay);
+      }
+      absl::MutexLock lock(&mu_);
+      if (!status.ok()) {
+        REVERB_LOG(REVERB_ERROR)
+            << "Dropping operation on table " << operation->table
+            << " which could not be forwarded to a replica: " << status;
+        num_dropped_++;
+      }
+      num_done_++;
+    }
+  }
+
+  bool IsStopped() const {
+    absl::MutexLock lock(&mu_);
+    return stopped_;
+  }
+
+  // Creates a context which is cancelled if the replica is destroyed.
+  std::unique_ptr<grpc::ClientContext> NewContext(bool with_deadline) {
+    auto context = absl::make_unique<grpc::ClientContext>();
+    context->set_wait_for_ready(true);
+    context->AddMetadata(kReplicatedOperationMetadataKey, "1");
+    if (with_deadline) {
+      context->set_deadline(
+          absl::ToChronoTime(absl::Now() + options_.rpc_timeout));
+    }
+    return context;
+  }
+
+  void SetActiveContext(grpc::ClientContext* context) {
+    absl::MutexLock lock(&mu_);
+    active_context_ = context;
+    if (stopped_ && context != nullptr) context->TryCancel();
+  }
+
+  absl::Status Apply(const Operation& operation) {
+    switch (operation.type) {
+      case Operation::Type::kInsert:
+        return SendInserts(operation);
+      case Operation::Type::kMutate: {
+        MutatePrioritiesRequest request;
+        request.set_table(operation.table);
+        for (const auto& update : operation.updates) {
+          *request.add_updates() = update;
+        }
+        for (uint64_t key : operation.deletes) {
+          request.add_delete_keys(key);
+        }
+        MutatePrioritiesResponse response;
+        auto context = NewContext(/*with_deadline=*/true);
+        SetActiveContext(context.get());
+        auto status = FromGrpcStatus(
+            stub_->MutatePriorities(context.get(), request, &response));
+        SetActiveContext(nullptr);
+        return status;
+      }
+      case Operation::Type::kReset: {
+        ResetRequest request;
+        request.set_table(operation.table);
+        ResetResponse response;
+        auto context = NewContext(/*with_deadline=*/true);
+        SetActiveContext(context.get());
+        auto status =
+            FromGrpcStatus(stub_->Reset(context.get(), request, &response));
+        SetActiveContext(nullptr);
+        return status;
+      }
+    }
+    return absl::InternalError("Unknown operation.");
+  }
+
+  // Sends the items of `operation` in requests of up to
+  // `max_items_per_request` items and waits for all of them to be
+  // acknowledged. Chunks are only sent if they weren't kept by the previous
+  // request on the stream.
+  absl::Status SendInserts(const Operation& operation) {
+    if (stream_ == nullptr) {
+      stream_context_ = NewContext(/*with_deadline=*/false);
+      SetActiveContext(stream_context_.get());
+      stream_ = stub_->InsertStream(stream_context_.get());
+      sent_chunks_.clear();
+    }
+
+    for (int begin = 0; begin < operation.items.size();
+         begin += options_.max_items_per_request) {
+      const int end =
+          std::min<int>(operation.items.size(),
+                        begin + options_.max_items_per_request);
+      InsertStreamRequest request;
+      internal::flat_hash_set<uint64_t> keep;
+      for (int i = begin; i < end; i++) {
+        for (const auto& chunk : operation.chunks[i]) {
+          if (keep.insert(chunk->key()).second &&
+              !sent_chunks_.contains(chunk->key())) {
+            *request.add_chunks() = chunk->data();
+          }
+        }
+        *request.add_items() = operation.items[i];
+      }
+      for (uint64_t key : keep) {
+        request.add_keep_chunk_keys(key);
+      }
+      sent_chunks_ = std::move(keep);
+
+      if (!stream_->Write(request)) {
+        return CloseStream();
+      }
+      internal::flat_hash_set<uint64_t> pending;
+      for (int i = begin; i < end; i++) {
+        pending.insert(operation.items[i].key());
+      }
+      InsertStreamResponse response;
+      while (!pending.empty()) {
+        if (!stream_->Read(&response)) {
+          return CloseStream();
+        }
+        for (uint64_t key : response.keys()) {
+          pending.erase(key);
+        }
+      }
+    }
+    return absl::OkStatus();
+  }
+
+  // Closes the insert stream (if open) and returns its status.
+  absl::Status CloseStream() {
+    if (stream_ == nullptr) return absl::OkStatus();
+    stream_context_->TryCancel();
+    auto status = FromGrpcStatus(stream_->Finish());
+    SetActiveContext(nullptr);
+    stream_ = nullptr;
+    stream_context_ = nullptr;
+    sent_chunks_.clear();
+    return status.ok() ? absl::UnavailableError("Insert stream closed.")
+                       : status;
+  }
+
+  const std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub_;
+  const Options options_;
+
+  internal::UnboundedQueue<std::shared_ptr<const Operation>> queue_;
+
+  // Only accessed by the thread of the replica (and by the destructor after it
+  // has been joined).
+  std::unique_ptr<grpc::ClientContext> stream_context_;
+  std::unique_ptr<grpc::ClientReaderWriterInterface<InsertStreamRequest,
+                                                    InsertStreamResponse>>
+      stream_;
+  internal::flat_hash_set<uint64_t> sent_chunks_;
+
+  mutable absl::Mutex mu_;
+  bool stopped_ ABSL_GUARDED_BY(mu_) = false;
+  grpc::ClientContext* active_context_ ABSL_GUARDED_BY(mu_) = nullptr;
+  int64_t num_enqueued_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t num_done_ ABSL_GUARDED_BY(mu_) = 0;
+  int64_t num_dropped_ ABSL_GUARDED_BY(mu_) = 0;
+
+  std::unique_ptr<internal::Thread> thread_;
+};
+
+absl::Status ReplicationExtension::Options::Validate() const {
+  if (max_items_per_request < 1) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "max_items_per_request (", max_items_per_request, ") must be >= 1."));
+  }
+  if (max_attempts < 1) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("max_attempts (", max_attempts, ") must be >= 1."));
+  }
+  if (retry_delay < absl::ZeroDuration()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("retry_delay (", absl::FormatDuration(retry_delay),
+                     ") must be >= 0."));
+  }
+  if (rpc_timeout <= absl::ZeroDuration()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("rpc_timeout (", absl::FormatDuration(rpc_timeout),
+                     ") must be > 0."));
+  }
+  return absl::OkStatus();
+}
+
+ReplicationExtension::ReplicationExtension(
+    std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+        replicas,
+    Options options)
+    : options_(std::move(options)) {
+  REVERB_CHECK_OK(options_.Validate());
+  for (int i = 0; i < replicas.size(); i++) {
+    replicas_.push_back(
+        absl::make_unique<Replica>(std::move(replicas[i]), options_, i));
+  }
+}
+
+ReplicationExtension::ReplicationExtension(
+    const std::vector<std::string>& replica_addresses, Options options)
+    : ReplicationExtension(
+          [&] {
+            std::vector<std::shared_ptr<
+                /* grpc_gen:: */ReverbService::StubInterface>>
+                stubs;
+            for (const auto& address : replica_addresses) {
+              stubs.push_back(/* grpc_gen:: */ReverbService::NewStub(
+                  CreateCustomGrpcChannel(address, MakeChannelCredentials(),
+                                          CreateChannelArguments())));
+            }
+            return stubs;
+          }(),
+          std::move(options)) {}
+
+ReplicationExtension::~ReplicationExtension() = default;
+
+std::string ReplicationExtension::DebugString() const {
+  return absl::StrCat("ReplicationExtension(num_replicas=", replicas_.size(),
+                      ")");
+}
+
+absl::Status ReplicationExtension::RegisterTable(absl::Mutex* mu,
+                                                 Table* table) {
+  REVERB_RETURN_IF_ERROR(TableExtensionBase::RegisterTable(mu, table));
+  absl::MutexLock lock(&name_mu_);
+  table_name_ = table->name();
+  return absl::OkStatus();
+}
+
+void ReplicationExtension::Flush() {
+  for (auto& replica : replicas_) {
+    replica->Flush();
+  }
+}
+
+int64_t ReplicationExtension::num_dropped_operations() const {
+  int64_t num_dropped = 0;
+  for (const auto& replica : replicas_) {
+    num_dropped += replica->num_dropped();
+  }
+  return num_dropped;
+}
+
+void ReplicationExtension::Forward(std::shared_ptr<const Operation> operation) {
+  for (auto& replica : replicas_) {
+    replica->Enqueue(operation);
+  }
+}
+
+void ReplicationExtension::ApplyOnInsert(const ExtensionItem& item) {
+  ApplyOnInsertBatch(absl::MakeConstSpan(&item, 1));
+}
+
+void ReplicationExtension::ApplyOnUpdate(const ExtensionItem& item) {
+  ApplyOnUpdateBatch(absl::MakeConstSpan(&item, 1));
+}
+
+void ReplicationExtension::ApplyOnDelete(const ExtensionItem& item) {
+  ApplyOnDeleteBatch(absl::MakeConstSpan(&item, 1));
+}
+
+void ReplicationExtension::ApplyOnInsertBatch(
+    absl::Span<const ExtensionItem> items) {
+  if (items.empty()) return;
+  auto operation = std::make_shared<Operation>();
+  operation->type = Operation::Type::kInsert;
+  operation->table = items.front().ref->item.table();
+  for (const auto& item : items) {
+    operation->items.push_back(CopyForReplica(item));
+    operation->chunks.push_back(item.ref->chunks);
+  }
+  Forward(std::move(operation));
+}
+
+void ReplicationExtension::ApplyOnUpdateBatch(
+    absl::Span<const ExtensionItem> items) {
+  if (items.empty()) return;
+  auto operation = std::make_shared<Operation>();
+  operation->type = Operation::Type::kMutate;
+  operation->table = items.front().ref->item.table();
+  for (const auto& item : items) {
+    KeyWithPriority update;
+    update.set_key(item.ref->item.key());
+    update.set_priority(item.priority);
+    operation->updates.push_back(std::move(update));
+  }
+  Forward(std::move(operation));
+}
+
+void ReplicationExtension::ApplyOnDeleteBatch(
+    absl::Span<const ExtensionItem> items) {
+  if (items.empty()) return;
+  auto operation = std::make_shared<Operation>();
+  operation->type = Operation::Type::kMutate;
+  operation->table = items.front().ref->item.table();
+  for (const auto& item : items) {
+    operation->deletes.push_back(item.ref->item.key());
+  }
+  Forward(std::move(operation));
+}
+
+void ReplicationExtension::ApplyOnReset() {
+  auto operation = std::make_shared<Operation>();
+  operation->type = Operation::Type::kReset;
+  {
+    absl::MutexLock lock(&name_mu_);
+    operation->table = table_name_;
+  }
+  Forward(std::move(operation));
+}
+
+}  // namespace reverb
+}  // namespace deepmind
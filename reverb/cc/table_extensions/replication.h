@@ -0,0 +1,130 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REVERB_CC_TABLE_EXTENSIONS_REPLICATION_H_
+#define REVERB_CC_TABLE_EXTENSIONS_REPLICATION_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "reverb/cc/reverb_service.grpc.pb.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/table_extensions/base.h"
+
+namespace deepmind {
+namespace reverb {
+
+// Client metadata attached to the calls made by `ReplicationExtension`. Servers
+// started with `--reverb_primary_address` apply calls carrying it locally
+// rather than forwarding them back to the primary.
+inline constexpr char kReplicatedOperationMetadataKey[] =
+    "reverb-replicated-operation";
+
+// Forwards the inserts, priority updates, deletes and resets applied to the
+// table it is attached to (the primary) to the table with the same name on a
+// set of replica servers. Learners which only sample can then be spread over
+// the replicas while a single logical buffer is maintained.
+//
+// Operations are forwarded asynchronously, in the order they were applied to
+// the primary, by one thread per replica. Inserts are sent (together with the
+// chunks they reference) over a long lived `InsertStream`, other operations
+// with unary calls. A failed operation is retried `Options::max_attempts`
+// times before it is dropped, so replicas may temporarily lag behind the
+// primary or, after a prolonged outage, miss operations.
+//
+// Replicas apply their own sampler, remover and rate limiter, and the samples
+// they serve are not reported back to the primary. Their tables should
+// therefore be configured identically to the primary's and `max_times_sampled`
+// is only enforced per server. Priority mutations must be applied to the
+// primary, servers started with `--reverb_primary_address` forward them.
+class ReplicationExtension : public TableExtensionBase {
+ public:
+  struct Options {
+    // Maximum number of items sent in a single `InsertStreamRequest`.
+    int max_items_per_request = 64;
+
+    // Number of times an operation is sent to a replica before it is dropped.
+    int max_attempts = 5;
+
+    // Time to wait before an operation is retried.
+    absl::Duration retry_delay = absl::Seconds(1);
+
+    // Deadline of the unary calls (priority mutations and resets).
+    absl::Duration rpc_timeout = absl::Seconds(30);
+
+    absl::Status Validate() const;
+  };
+
+  ReplicationExtension(
+      std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+          replicas,
+      Options options);
+
+  // Connects to the servers at `replica_addresses`.
+  ReplicationExtension(const std::vector<std::string>& replica_addresses,
+                       Options options);
+
+  ~ReplicationExtension() override;
+
+  bool CanRunAsync() const override { return true; }
+
+  std::string DebugString() const override;
+
+  // Blocks until every operation forwarded before the call has been applied
+  // to, or dropped by, all replicas.
+  void Flush();
+
+  // Number of operations which have been dropped after all attempts to apply
+  // them to a replica failed (summed over the replicas).
+  int64_t num_dropped_operations() const;
+
+  void ApplyOnInsert(const ExtensionItem& item) override;
+  void ApplyOnUpdate(const ExtensionItem& item) override;
+  void ApplyOnDelete(const ExtensionItem& item) override;
+  void ApplyOnReset() override;
+
+  void ApplyOnInsertBatch(absl::Span<const ExtensionItem> items) override;
+  void ApplyOnUpdateBatch(absl::Span<const ExtensionItem> items) override;
+  void ApplyOnDeleteBatch(absl::Span<const ExtensionItem> items) override;
+
+ protected:
+  // Records the name of the table so that resets can be forwarded.
+  absl::Status RegisterTable(absl::Mutex* mu, Table* table)
+      ABSL_LOCKS_EXCLUDED(mu) override;
+
+ private:
+  struct Operation;
+  class Replica;
+
+  // Enqueues `operation` on every replica.
+  void Forward(std::shared_ptr<const Operation> operation);
+
+  const Options options_;
+  std::vector<std::unique_ptr<Replica>> replicas_;
+
+  absl::Mutex name_mu_;
+  std::string table_name_ ABSL_GUARDED_BY(name_mu_);
+};
+
+}  // namespace reverb
+}  // namespace deepmind
+
+#endif  // REVERB_CC_TABLE_EXTENSIONS_REPLICATION_H_
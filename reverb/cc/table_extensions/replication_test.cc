@@ -0,0 +1,254 @@
+// Copyright 2019 DeepMind Technologies Limited.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reverb/cc/table_extensions/replication.h"
+
+#include <cfloat>
+#include <memory>
+#include <vector>
+
+#include "grpcpp/impl/codegen/status.h"
+#include "grpcpp/test/mock_stream.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "reverb/cc/chunk_store.h"
+#include "reverb/cc/platform/status_matchers.h"
+#include "reverb/cc/rate_limiter.h"
+#include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/reverb_service_mock.grpc.pb.h"
+#include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/table.h"
+#include "reverb/cc/testing/proto_test_util.h"
+
+namespace deepmind {
+namespace reverb {
+namespace {
+
+using ::deepmind::reverb::testing::EqualsProto;
+using ::grpc::testing::MockClientReaderWriter;
+using ::testing::_;
+using ::testing::DoAll;
+using ::testing::ElementsAre;
+using ::testing::Invoke;
+using ::testing::Return;
+using ::testing::SizeIs;
+
+using MockStream =
+    MockClientReaderWriter<InsertStreamRequest, InsertStreamResponse>;
+
+// Records the requests written to the stream and acknowledges all their items.
+class FakeStream : public MockStream {
+ public:
+  explicit FakeStream(std::vector<InsertStreamRequest>* requests)
+      : requests_(requests) {}
+
+  bool Write(const InsertStreamRequest& msg,
+             grpc::WriteOptions options) override {
+    requests_->push_back(msg);
+    for (const auto& item : msg.items()) {
+      response_.add_keys(item.key());
+    }
+    return true;
+  }
+
+  bool Read(InsertStreamResponse* response) override {
+    if (response_.keys_size() == 0) return false;
+    *response = std::move(response_);
+    response_.Clear();
+    return true;
+  }
+
+  grpc::Status Finish() override { return grpc::Status::OK; }
+
+ private:
+  std::vector<InsertStreamRequest>* requests_;
+  InsertStreamResponse response_;
+};
+
+ReplicationExtension::Options FastRetryOptions() {
+  ReplicationExtension::Options options;
+  options.max_attempts = 2;
+  options.retry_delay = absl::ZeroDuration();
+  return options;
+}
+
+std::shared_ptr<TableItem> MakeItem(
+    uint64_t key, double priority,
+    std::vector<std::shared_ptr<ChunkStore::Chunk>> chunks) {
+  auto item = std::make_shared<TableItem>();
+  std::vector<ChunkData> data;
+  for (const auto& chunk : chunks) {
+    data.push_back(chunk->data());
+  }
+  item->item = testing::MakePrioritizedItem(key, priority, data);
+  item->item.set_table("table");
+  item->chunks = std::move(chunks);
+  return item;
+}
+
+TEST(ReplicationExtensionOptionsTest, Validate) {
+  ReplicationExtension::Options options;
+  REVERB_EXPECT_OK(options.Validate());
+  options.max_items_per_request = 0;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+  options = ReplicationExtension::Options();
+  options.max_attempts = 0;
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+  options = ReplicationExtension::Options();
+  options.rpc_timeout = absl::ZeroDuration();
+  EXPECT_EQ(options.Validate().code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST(ReplicationExtensionTest, ForwardsInsertsWithChunksNotYetSent) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = std::make_shared</* grpc_gen:: */MockReverbServiceStub>();
+  EXPECT_CALL(*stub, InsertStreamRaw(_))
+      .WillOnce(Invoke([&](grpc::ClientContext*) {
+        return new FakeStream(&requests);
+      }));
+  ReplicationExtension extension({stub}, FastRetryOptions());
+
+  ChunkStore chunk_store;
+  auto first = chunk_store.Insert(testing::MakeChunkData(1));
+  auto second = chunk_store.Insert(testing::MakeChunkData(2));
+  std::vector<ExtensionItem> batch = {MakeItem(10, 1.5, {first})};
+  extension.ApplyOnInsertBatch(batch);
+  extension.Flush();
+  batch = {MakeItem(11, 2.5, {first, second})};
+  extension.ApplyOnInsertBatch(batch);
+  extension.Flush();
+
+  ASSERT_THAT(requests, SizeIs(2));
+  ASSERT_THAT(requests[0].chunks(), SizeIs(1));
+  EXPECT_EQ(requests[0].chunks(0).chunk_key(), 1);
+  ASSERT_THAT(requests[0].items(), SizeIs(1));
+  EXPECT_EQ(requests[0].items(0).key(), 10);
+  EXPECT_EQ(requests[0].items(0).priority(), 1.5);
+  EXPECT_THAT(requests[0].keep_chunk_keys(), ElementsAre(1));
+
+  // The first chunk was kept by the previous request and is not sent again.
+  ASSERT_THAT(requests[1].chunks(), SizeIs(1));
+  EXPECT_EQ(requests[1].chunks(0).chunk_key(), 2);
+  ASSERT_THAT(requests[1].items(), SizeIs(1));
+  EXPECT_EQ(requests[1].items(0).key(), 11);
+  EXPECT_EQ(extension.num_dropped_operations(), 0);
+}
+
+TEST(ReplicationExtensionTest, SplitsLargeInsertBatches) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = std::make_shared</* grpc_gen:: */MockReverbServiceStub>();
+  EXPECT_CALL(*stub, InsertStreamRaw(_))
+      .WillOnce(Invoke([&](grpc::ClientContext*) {
+        return new FakeStream(&requests);
+      }));
+  auto options = FastRetryOptions();
+  options.max_items_per_request = 2;
+  ReplicationExtension extension({stub}, options);
+
+  ChunkStore chunk_store;
+  auto chunk = chunk_store.Insert(testing::MakeChunkData(1));
+  std::vector<ExtensionItem> batch;
+  for (int i = 0; i < 5; i++) {
+    batch.push_back(MakeItem(i, 1, {chunk}));
+  }
+  extension.ApplyOnInsertBatch(batch);
+  extension.Flush();
+
+  ASSERT_THAT(requests, SizeIs(3));
+  EXPECT_THAT(requests[0].items(), SizeIs(2));
+  EXPECT_THAT(requests[1].items(), SizeIs(2));
+  EXPECT_THAT(requests[2].items(), SizeIs(1));
+  EXPECT_THAT(requests[0].chunks(), SizeIs(1));
+  EXPECT_THAT(requests[1].chunks(), SizeIs(0));
+  EXPECT_THAT(requests[2].chunks(), SizeIs(0));
+}
+
+TEST(ReplicationExtensionTest, ForwardsUpdatesDeletesAndResets) {
+  auto stub = std::make_shared</* grpc_gen:: */MockReverbServiceStub>();
+  ::testing::InSequence sequence;
+  EXPECT_CALL(*stub, MutatePriorities(_, _, _))
+      .WillOnce(Invoke([](grpc::ClientContext*,
+                          const MutatePrioritiesRequest& request,
+                          MutatePrioritiesResponse*) {
+        EXPECT_THAT(request, EqualsProto(
+                                 "table: 'table' "
+                                 "updates: { key: 1 priority: 0.5 }"));
+        return grpc::Status::OK;
+      }));
+  EXPECT_CALL(*stub, MutatePriorities(_, _, _))
+      .WillOnce(Invoke([](grpc::ClientContext*,
+                          const MutatePrioritiesRequest& request,
+                          MutatePrioritiesResponse*) {
+        EXPECT_THAT(request, EqualsProto("table: 'table' delete_keys: 2"));
+        return grpc::Status::OK;
+      }));
+  EXPECT_CALL(*stub, Reset(_, _, _))
+      .WillOnce(Invoke([](grpc::ClientContext*, const ResetRequest& request,
+                          ResetResponse*) {
+        EXPECT_EQ(request.table(), "table");
+        return grpc::Status::OK;
+      }));
+
+  auto extension = std::make_shared<ReplicationExtension>(
+      std::vector<std::shared_ptr<
+          /* grpc_gen:: */ReverbService::StubInterface>>{stub},
+      FastRetryOptions());
+  // Register the extension with a table so it knows the name to reset.
+  Table table("table", std::make_shared<UniformSelector>(),
+              std::make_shared<FifoSelector>(), 10, 0,
+              std::make_shared<RateLimiter>(1.0, 1, -DBL_MAX, DBL_MAX),
+              {extension});
+
+  ExtensionItem updated(MakeItem(1, 1.0, {}));
+  updated.priority = 0.5;
+  extension->ApplyOnUpdate(updated);
+  extension->ApplyOnDelete(ExtensionItem(MakeItem(2, 1.0, {})));
+  extension->ApplyOnReset();
+  extension->Flush();
+  EXPECT_EQ(extension->num_dropped_operations(), 0);
+}
+
+TEST(ReplicationExtensionTest, DropsOperationAfterMaxAttempts) {
+  auto stub = std::make_shared</* grpc_gen:: */MockReverbServiceStub>();
+  EXPECT_CALL(*stub, MutatePriorities(_, _, _))
+      .Times(2)
+      .WillRepeatedly(Return(grpc::Status(grpc::StatusCode::UNAVAILABLE, "")));
+  ReplicationExtension extension({stub}, FastRetryOptions());
+
+  extension.ApplyOnDelete(ExtensionItem(MakeItem(2, 1.0, {})));
+  extension.Flush();
+  EXPECT_EQ(extension.num_dropped_operations(), 1);
+}
+
+TEST(ReplicationExtensionTest, ForwardsToEveryReplica) {
+  std::vector<std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface>>
+      stubs;
+  for (int i = 0; i < 3; i++) {
+    auto stub = std::make_shared</* grpc_gen:: */MockReverbServiceStub>();
+    EXPECT_CALL(*stub, MutatePriorities(_, _, _))
+        .WillOnce(Return(grpc::Status::OK));
+    stubs.push_back(std::move(stub));
+  }
+  ReplicationExtension extension(std::move(stubs), FastRetryOptions());
+  extension.ApplyOnDelete(ExtensionItem(MakeItem(2, 1.0, {})));
+  extension.Flush();
+  EXPECT_EQ(extension.num_dropped_operations(), 0);
+}
+
+}  // namespace
+}  // namespace reverb
+}  // namespace deepmind
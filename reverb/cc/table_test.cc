@@ -14,8 +14,10 @@
 
 #include "reverb/cc/table.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cfloat>
+#include <limits>
 #include <memory>
 #include <string>
 #include <utility>
@@ -32,13 +34,19 @@
 #include "absl/time/time.h"
 #include "reverb/cc/checkpointing/checkpoint.pb.h"
 #include "reverb/cc/chunk_store.h"
+#include "reverb/cc/errors.h"
+#include "reverb/cc/platform/hash_set.h"
 #include "reverb/cc/platform/status_matchers.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/selectors/fifo.h"
+#include "reverb/cc/selectors/prioritized.h"
 #include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/support/reclamation_queue.h"
+#include "reverb/cc/support/trajectory_util.h"
 #include "reverb/cc/support/task_executor.h"
+#include "reverb/cc/table_extensions/base.h"
 #include "reverb/cc/table_extensions/interface.h"
 #include "reverb/cc/testing/proto_test_util.h"
 #include "tensorflow/core/framework/tensor_shape.h"
@@ -57,6 +65,7 @@ using ::deepmind::reverb::testing::Partially;
 using ::testing::ElementsAre;
 using ::testing::IsEmpty;
 using ::testing::SizeIs;
+using ::testing::UnorderedElementsAre;
 
 MATCHER_P(HasItemKey, key, "") { return arg.item.key() == key; }
 MATCHER_P(HasSampledItemKey, key, "") { return arg.ref->item.key() == key; }
@@ -107,6 +116,57 @@ void WaitForTableSize(Table* table, int size) {
   EXPECT_EQ(table->size(), size);
 }
 
+// Asynchronous extension which records the keys of the batches it receives.
+class BatchRecordingExtension : public TableExtensionBase {
+ public:
+  bool CanRunAsync() const override { return true; }
+
+  std::string DebugString() const override { return "BatchRecordingExtension"; }
+
+  void ApplyOnInsertBatch(absl::Span<const ExtensionItem> items) override {
+    absl::MutexLock lock(&mu_);
+    Record(items, &inserted_);
+  }
+
+  void ApplyOnDeleteBatch(absl::Span<const ExtensionItem> items) override {
+    absl::MutexLock lock(&mu_);
+    Record(items, &deleted_);
+  }
+
+  void ApplyOnUpdateBatch(absl::Span<const ExtensionItem> items) override {
+    absl::MutexLock lock(&mu_);
+    Record(items, &updated_);
+  }
+
+  std::vector<uint64_t> inserted() {
+    absl::MutexLock lock(&mu_);
+    return inserted_;
+  }
+
+  std::vector<uint64_t> deleted() {
+    absl::MutexLock lock(&mu_);
+    return deleted_;
+  }
+
+  std::vector<uint64_t> updated() {
+    absl::MutexLock lock(&mu_);
+    return updated_;
+  }
+
+ private:
+  static void Record(absl::Span<const ExtensionItem> items,
+                     std::vector<uint64_t>* keys) {
+    for (const auto& item : items) {
+      keys->push_back(item.ref->item.key());
+    }
+  }
+
+  absl::Mutex mu_;
+  std::vector<uint64_t> inserted_ ABSL_GUARDED_BY(mu_);
+  std::vector<uint64_t> deleted_ ABSL_GUARDED_BY(mu_);
+  std::vector<uint64_t> updated_ ABSL_GUARDED_BY(mu_);
+};
+
 TEST(TableTest, SetsName) {
   auto first = MakeUniformTable("first");
   auto second = MakeUniformTable("second");
@@ -134,6 +194,53 @@ TEST(TableTest, CopySubset) {
   EXPECT_THAT(table->Copy(2), SizeIs(2));
 }
 
+TEST(TableTest, CopyPageVisitsEveryItemOnce) {
+  auto table = MakeUniformTable("dist");
+  for (int key = 1; key <= 5; key++) {
+    REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(key, 123)));
+  }
+
+  Table::CopyCursor cursor;
+  std::vector<Table::Item> items;
+  while (!cursor.done) {
+    auto page = table->CopyPage(&cursor, 2);
+    EXPECT_THAT(page.size(), ::testing::Le(2));
+    items.insert(items.end(), page.begin(), page.end());
+  }
+  EXPECT_THAT(items, UnorderedElementsAre(HasItemKey(1), HasItemKey(2),
+                                          HasItemKey(3), HasItemKey(4),
+                                          HasItemKey(5)));
+  EXPECT_THAT(table->CopyPage(&cursor, 2), IsEmpty());
+}
+
+TEST(TableTest, CopyPageKeepsRemainingItemsAcrossDeletes) {
+  auto table = MakeUniformTable("dist");
+  for (int key = 1; key <= 6; key++) {
+    REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(key, 123)));
+  }
+
+  Table::CopyCursor cursor;
+  std::vector<Table::Item> items = table->CopyPage(&cursor, 2);
+  ASSERT_THAT(items, SizeIs(2));
+  EXPECT_FALSE(cursor.done);
+
+  // Delete one of the copied items and one which has not been copied yet. The
+  // other items must still be copied exactly once.
+  ASSERT_THAT(items, ::testing::Not(::testing::Contains(HasItemKey(6))));
+  REVERB_EXPECT_OK(table->MutateItems({}, {items[0].item.key(), 6}));
+
+  while (!cursor.done) {
+    auto page = table->CopyPage(&cursor, 2);
+    items.insert(items.end(), page.begin(), page.end());
+  }
+  std::vector<uint64_t> keys;
+  for (const auto& item : items) keys.push_back(item.item.key());
+  std::sort(keys.begin(), keys.end());
+  EXPECT_EQ(std::adjacent_find(keys.begin(), keys.end()), keys.end());
+  EXPECT_THAT(keys, SizeIs(5));
+  EXPECT_THAT(items, ::testing::Not(::testing::Contains(HasItemKey(6))));
+}
+
 TEST(TableTest, InsertOrAssignOverwrites) {
   auto table = MakeUniformTable("dist");
   REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 123)));
@@ -159,6 +266,166 @@ TEST(TableTest, UpdatesAreAppliedPartially) {
   EXPECT_EQ(items[0].item.priority(), 456);
 }
 
+TEST(TableTest, BatchedUpdatesApplyLastPriorityPerKey) {
+  auto table = MakeUniformTable("dist");
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 123)));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(4, 123)));
+  REVERB_EXPECT_OK(table->MutateItems(
+      {
+          testing::MakeKeyWithPriority(3, 1),
+          testing::MakeKeyWithPriority(4, 2),
+          testing::MakeKeyWithPriority(3, 3),
+      },
+      {}));
+
+  Table::Item item;
+  ASSERT_TRUE(table->Get(3, &item));
+  EXPECT_EQ(item.item.priority(), 3);
+  ASSERT_TRUE(table->Get(4, &item));
+  EXPECT_EQ(item.item.priority(), 2);
+}
+
+TEST(TableTest, BatchedUpdatesWithInvalidPriorityAreNotApplied) {
+  auto table =
+      MakeTable("dist", std::make_shared<PrioritizedSelector>(1),
+                std::make_shared<FifoSelector>(), 10, 0, MakeLimiter(1));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 1)));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(4, 1)));
+  EXPECT_EQ(table
+                ->MutateItems(
+                    {
+                        testing::MakeKeyWithPriority(3, 2),
+                        testing::MakeKeyWithPriority(4, -1),
+                        testing::MakeKeyWithPriority(3, 5),
+                    },
+                    {})
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // The priorities of the items still match the weights of the sampler.
+  Table::Item item;
+  ASSERT_TRUE(table->Get(3, &item));
+  EXPECT_EQ(item.item.priority(), 1);
+  ASSERT_TRUE(table->Get(4, &item));
+  EXPECT_EQ(item.item.priority(), 1);
+  EXPECT_DOUBLE_EQ(table->info().sampling_weight(), 2);
+}
+
+TEST(TableTest, ScalePrioritiesMultipliesAllPriorities) {
+  auto table = MakeUniformTable("dist");
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 2)));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(4, 8)));
+  REVERB_EXPECT_OK(table->ScalePriorities(0.25));
+
+  Table::Item item;
+  ASSERT_TRUE(table->Get(3, &item));
+  EXPECT_EQ(item.item.priority(), 0.5);
+  ASSERT_TRUE(table->Get(4, &item));
+  EXPECT_EQ(item.item.priority(), 2);
+}
+
+TEST(TableTest, ScalePrioritiesReportsEveryItemToExtensions) {
+  auto extension = std::make_shared<BatchRecordingExtension>();
+  auto table = MakeTable(
+      "dist", std::make_shared<UniformSelector>(),
+      std::make_shared<FifoSelector>(), 10, 0, MakeLimiter(1),
+      std::vector<std::shared_ptr<TableExtension>>{extension});
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 2)));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(4, 8)));
+  REVERB_EXPECT_OK(table->ScalePriorities(0.25));
+
+  while (!table->all_extensions_are_up_to_date()) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  EXPECT_THAT(extension->updated(), UnorderedElementsAre(3, 4));
+}
+
+TEST(TableTest, ScalePrioritiesRejectsInvalidFactors) {
+  auto table = MakeUniformTable("dist");
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 2)));
+  for (double factor : {0., -1., std::numeric_limits<double>::infinity(),
+                        std::numeric_limits<double>::quiet_NaN()}) {
+    EXPECT_EQ(table->ScalePriorities(factor).code(),
+              absl::StatusCode::kInvalidArgument);
+  }
+
+  Table::Item item;
+  ASSERT_TRUE(table->Get(3, &item));
+  EXPECT_EQ(item.item.priority(), 2);
+}
+
+TEST(TableTest, ScalePrioritiesPreservesSamplingProbabilities) {
+  auto table =
+      MakeTable("dist", std::make_shared<PrioritizedSelector>(1),
+                std::make_shared<FifoSelector>(), 10, 0, MakeLimiter(1));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 1)));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(4, 3)));
+  REVERB_EXPECT_OK(table->ScalePriorities(0.5));
+
+  // The new item has the same priority as the scaled (first) item.
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(5, 0.5)));
+  for (int i = 0; i < 10; i++) {
+    Table::SampledItem sample;
+    REVERB_ASSERT_OK(table->Sample(&sample));
+    const uint64_t key = sample.ref->item.key();
+    EXPECT_DOUBLE_EQ(sample.probability, key == 4 ? 0.6 : 0.2);
+  }
+}
+
+TEST(TableTest, InfoReportsSamplingWeight) {
+  auto prioritized =
+      MakeTable("dist", std::make_shared<PrioritizedSelector>(1),
+                std::make_shared<FifoSelector>(), 10, 0, MakeLimiter(1));
+  REVERB_EXPECT_OK(prioritized->InsertOrAssign(MakeItem(3, 1.5)));
+  REVERB_EXPECT_OK(prioritized->InsertOrAssign(MakeItem(4, 2)));
+  EXPECT_DOUBLE_EQ(prioritized->info().sampling_weight(), 3.5);
+
+  // Items with zero priority are never sampled so they carry no weight.
+  auto zero_priority =
+      MakeTable("zero", std::make_shared<PrioritizedSelector>(1),
+                std::make_shared<FifoSelector>(), 10, 0, MakeLimiter(1));
+  REVERB_EXPECT_OK(zero_priority->InsertOrAssign(MakeItem(3, 0)));
+  REVERB_EXPECT_OK(zero_priority->InsertOrAssign(MakeItem(4, 0)));
+  EXPECT_DOUBLE_EQ(zero_priority->info().sampling_weight(), 0);
+
+  // Uniform samplers weight every item equally.
+  auto uniform = MakeUniformTable("uniform");
+  REVERB_EXPECT_OK(uniform->InsertOrAssign(MakeItem(3, 1.5)));
+  REVERB_EXPECT_OK(uniform->InsertOrAssign(MakeItem(4, 2)));
+  EXPECT_DOUBLE_EQ(uniform->info().sampling_weight(), 2);
+}
+
+TEST(TableTest, SetPriorityExponentReweightsExistingItems) {
+  auto table =
+      MakeTable("dist", std::make_shared<PrioritizedSelector>(1),
+                std::make_shared<FifoSelector>(), 10, 0, MakeLimiter(1));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 1)));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(4, 3)));
+  REVERB_EXPECT_OK(table->SetPriorityExponent(2));
+
+  EXPECT_EQ(table->info().sampler_options().prioritized().priority_exponent(),
+            2);
+  for (int i = 0; i < 10; i++) {
+    Table::SampledItem sample;
+    REVERB_ASSERT_OK(table->Sample(&sample));
+    const uint64_t key = sample.ref->item.key();
+    EXPECT_DOUBLE_EQ(sample.probability, key == 4 ? 0.9 : 0.1);
+  }
+
+  // Items inserted afterwards also use the new exponent.
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(5, 1)));
+  Table::SampledItem sample;
+  REVERB_ASSERT_OK(table->Sample(&sample));
+  EXPECT_DOUBLE_EQ(sample.probability,
+                   sample.ref->item.key() == 4 ? 9. / 11 : 1. / 11);
+}
+
+TEST(TableTest, SetPriorityExponentRequiresPrioritizedSampler) {
+  auto table = MakeUniformTable("dist");
+  EXPECT_EQ(table->SetPriorityExponent(2).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
 TEST(TableTest, DeletesAreAppliedPartially) {
   auto table = MakeUniformTable("dist");
   REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 123)));
@@ -202,6 +469,33 @@ TEST(TableTest, SampleMatchesInsert) {
   EXPECT_EQ(sample.probability, 1);
 }
 
+TEST(TableTest, PackedItemsAreUnpackedWhenRead) {
+  auto table = MakeUniformTable("dist");
+  table->SetPackItems(true);
+
+  Table::Item item = MakeItem(3, 123);
+  REVERB_EXPECT_OK(table->InsertOrAssign(item));
+
+  Table::SampledItem sample;
+  REVERB_EXPECT_OK(table->Sample(&sample));
+  ASSERT_TRUE(sample.ref->packed_trajectory.has_value());
+  EXPECT_FALSE(sample.ref->item.has_flat_trajectory());
+  FlatTrajectory scratch;
+  EXPECT_THAT(sample.ref->flat_trajectory(&scratch),
+              testing::EqualsProto(item.item.flat_trajectory()));
+
+  auto items = table->Copy();
+  ASSERT_THAT(items, SizeIs(1));
+  EXPECT_FALSE(items[0].packed_trajectory.has_value());
+  EXPECT_THAT(items[0].item.flat_trajectory(),
+              testing::EqualsProto(item.item.flat_trajectory()));
+
+  auto checkpoint = table->Checkpoint();
+  ASSERT_THAT(checkpoint.checkpoint.items(), SizeIs(1));
+  EXPECT_THAT(checkpoint.checkpoint.items(0).flat_trajectory(),
+              testing::EqualsProto(item.item.flat_trajectory()));
+}
+
 TEST(TableTest, SampleIncrementsSampleTimes) {
   auto table = MakeUniformTable("dist");
 
@@ -228,6 +522,152 @@ TEST(TableTest, MaxTimesSampledIsRespected) {
   EXPECT_THAT(table->Copy(), IsEmpty());
 }
 
+void WaitForNumSampledAhead(Table* table, int num_sampled_ahead) {
+  for (int retry = 0;
+       retry < 1000 && table->num_sampled_ahead() != num_sampled_ahead;
+       retry++) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  EXPECT_EQ(table->num_sampled_ahead(), num_sampled_ahead);
+}
+
+TEST(TableTest, SampleAheadIsFilledWhenWorkerIsIdle) {
+  auto table = MakeUniformTable("dist");
+  for (int i = 0; i < 10; i++) {
+    REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+  }
+  table->SetSampleAheadSize(5);
+  WaitForNumSampledAhead(table.get(), 5);
+
+  // The rate limiter is only consulted when items are handed out.
+  EXPECT_EQ(table->info().rate_limiter_info().sample_stats().completed(), 0);
+
+  std::vector<Table::SampledItem> items;
+  REVERB_EXPECT_OK(table->SampleFlexibleBatch(&items, 3));
+  EXPECT_THAT(items, SizeIs(3));
+  EXPECT_EQ(table->info().rate_limiter_info().sample_stats().completed(), 3);
+
+  // The buffer is topped up again once the request has been served.
+  WaitForNumSampledAhead(table.get(), 5);
+}
+
+TEST(TableTest, SampleAheadIsNotFilledWhenRateLimited) {
+  // The rate limiter requires two items before sampling is allowed.
+  auto table = MakeTable("dist", std::make_shared<UniformSelector>(),
+                         std::make_shared<FifoSelector>(), 1000, 0,
+                         MakeLimiter(2));
+  table->SetSampleAheadSize(5);
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  absl::SleepFor(absl::Milliseconds(50));
+  EXPECT_EQ(table->num_sampled_ahead(), 0);
+
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(2, 1)));
+  WaitForNumSampledAhead(table.get(), 5);
+}
+
+TEST(TableTest, SampleAheadIsClearedByMutations) {
+  auto table = MakeUniformTable("dist");
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(2, 1)));
+  table->SetSampleAheadSize(100);
+  WaitForNumSampledAhead(table.get(), 100);
+
+  // Once item 1 has been deleted it must never be sampled again even if it
+  // was selected before the deletion.
+  REVERB_EXPECT_OK(table->MutateItems({}, {1}));
+  for (int i = 0; i < 100; i++) {
+    Table::SampledItem item;
+    REVERB_ASSERT_OK(table->Sample(&item));
+    EXPECT_EQ(item.ref->item.key(), 2);
+    EXPECT_EQ(item.probability, 1);
+  }
+}
+
+TEST(TableTest, SampleAheadRespectsMaxTimesSampled) {
+  auto table = MakeUniformTable("dist", /*max_size=*/10,
+                                /*max_times_sampled=*/1);
+  table->SetSampleAheadSize(10);
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(2, 1)));
+  WaitForNumSampledAhead(table.get(), 10);
+
+  Table::SampledItem first;
+  Table::SampledItem second;
+  REVERB_ASSERT_OK(table->Sample(&first));
+  REVERB_ASSERT_OK(table->Sample(&second));
+  EXPECT_NE(first.ref->item.key(), second.ref->item.key());
+  EXPECT_EQ(table->size(), 0);
+}
+
+TEST(TableTest, SnapshotSamplingRequiresUniformSampler) {
+  auto table = MakeTable("dist", std::make_shared<PrioritizedSelector>(1),
+                         std::make_shared<FifoSelector>(), 1000, 0,
+                         MakeLimiter(1));
+  EXPECT_EQ(table->SetSnapshotSampling(true).code(),
+            absl::StatusCode::kInvalidArgument);
+  REVERB_EXPECT_OK(table->SetSnapshotSampling(false));
+}
+
+TEST(TableTest, SnapshotSamplingSeesInsertsAndDeletes) {
+  auto table = MakeUniformTable("dist");
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  REVERB_EXPECT_OK(table->SetSnapshotSampling(true));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(2, 1)));
+
+  internal::flat_hash_set<uint64_t> keys;
+  for (int i = 0; i < 100; i++) {
+    Table::SampledItem item;
+    REVERB_ASSERT_OK(table->Sample(&item));
+    EXPECT_EQ(item.probability, 0.5);
+    keys.insert(item.ref->item.key());
+  }
+  EXPECT_THAT(keys, UnorderedElementsAre(1, 2));
+
+  REVERB_EXPECT_OK(table->MutateItems({}, {1}));
+  for (int i = 0; i < 100; i++) {
+    Table::SampledItem item;
+    REVERB_ASSERT_OK(table->Sample(&item));
+    EXPECT_EQ(item.ref->item.key(), 2);
+    EXPECT_EQ(item.probability, 1);
+  }
+}
+
+TEST(TableTest, SnapshotSamplesAreReconciled) {
+  auto table = MakeUniformTable("dist");
+  for (int i = 0; i < 10; i++) {
+    REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+  }
+  REVERB_EXPECT_OK(table->SetSnapshotSampling(true));
+  const int kSamples = Table::kMaxSnapshotSamplesPerReconcile + 10;
+  for (int i = 0; i < kSamples; i++) {
+    Table::SampledItem item;
+    REVERB_ASSERT_OK(table->Sample(&item));
+  }
+  EXPECT_GE(table->info().rate_limiter_info().sample_stats().completed(),
+            Table::kMaxSnapshotSamplesPerReconcile);
+
+  // Disabling the snapshot reconciles the remaining samples.
+  REVERB_EXPECT_OK(table->SetSnapshotSampling(false));
+  EXPECT_EQ(table->info().rate_limiter_info().sample_stats().completed(),
+            kSamples);
+  int times_sampled = 0;
+  for (const auto& item : table->Copy()) {
+    times_sampled += item.item.times_sampled();
+  }
+  EXPECT_EQ(times_sampled, kSamples);
+}
+
+TEST(TableTest, SnapshotSamplingDeletesItemsAtMaxTimesSampled) {
+  auto table = MakeUniformTable("dist", /*max_size=*/10,
+                                /*max_times_sampled=*/1);
+  REVERB_EXPECT_OK(table->SetSnapshotSampling(true));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  Table::SampledItem item;
+  REVERB_ASSERT_OK(table->Sample(&item));
+  REVERB_EXPECT_OK(table->SetSnapshotSampling(false));
+  EXPECT_EQ(table->size(), 0);
+}
+
 TEST(TableTest, SampleFlexibleBatchRequireEmptyOutputVector) {
   auto table = MakeUniformTable("dist", 10, 2);
 
@@ -294,6 +734,257 @@ TEST(TableTest, EnqueSampleRequestSetsRateLimitedIfBlocked) {
   EXPECT_FALSE(not_rate_limited_item.rate_limited);
 }
 
+TEST(TableTest, SpinningWorkerServesRequests) {
+  auto table = MakeUniformTable("table", /*max_size=*/1000,
+                                /*max_times_sampled=*/1);
+  table->SetWorkerSpinBudget(absl::Milliseconds(1));
+
+  // Every sample has to wait for the next insert so the lanes keep running out
+  // of work in between.
+  auto sampler = internal::StartThread("sampler", [&] {
+    for (int i = 0; i < 100; i++) {
+      Table::SampledItem sample;
+      REVERB_EXPECT_OK(table->Sample(&sample, absl::Seconds(10)));
+    }
+  });
+  for (int i = 0; i < 100; i++) {
+    REVERB_ASSERT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+    absl::SleepFor(absl::Microseconds(100));
+  }
+  sampler = nullptr;  // Join thread.
+  EXPECT_EQ(table->size(), 0);
+
+  // Disabling spinning at runtime doesn't affect the workers either.
+  table->SetWorkerSpinBudget(absl::ZeroDuration());
+  REVERB_ASSERT_OK(table->InsertOrAssign(MakeItem(100, 1)));
+  Table::SampledItem sample;
+  REVERB_ASSERT_OK(table->Sample(&sample, absl::Seconds(10)));
+  EXPECT_EQ(sample.ref->item.key(), 100);
+}
+
+TEST(TableTest, SampleRequestsAreServedEarliestDeadlineFirst) {
+  // Every item can only be sampled once so each insert serves one sample.
+  auto table = MakeUniformTable("table", /*max_size=*/1000,
+                                /*max_times_sampled=*/1);
+
+  absl::Notification large_done;
+  auto large_callback = std::make_shared<Table::SamplingCallback>(
+      [&](Table::SampleRequest* req) { large_done.Notify(); });
+  table->EnqueSampleRequest(100, large_callback, absl::InfiniteDuration());
+
+  // Wait until the worker has picked up the large request and gone to sleep.
+  while (table->num_pending_async_sample_requests() ||
+         !table->worker_is_sleeping()) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+
+  absl::Notification small_done;
+  absl::Status small_status;
+  std::vector<Table::SampledItem> small_samples;
+  auto small_callback =
+      std::make_shared<Table::SamplingCallback>([&](Table::SampleRequest* req) {
+        small_status = req->status;
+        small_samples = req->samples;
+        small_done.Notify();
+      });
+  table->EnqueSampleRequest(1, small_callback, absl::Seconds(10));
+
+  // The small request has the earlier deadline so it gets the only item even
+  // though the large request was enqueued first.
+  REVERB_ASSERT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  ASSERT_TRUE(small_done.WaitForNotificationWithTimeout(absl::Seconds(5)));
+  REVERB_EXPECT_OK(small_status);
+  EXPECT_THAT(small_samples, ElementsAre(HasSampledItemKey(1)));
+  EXPECT_FALSE(large_done.HasBeenNotified());
+}
+
+// Enqueues a burst of inserts from one client followed by a single insert from
+// another while the rate limiter blocks all inserts, then unblocks them one at
+// a time and returns the keys in the order they were inserted.
+std::vector<uint64_t> InsertOrderOfBlockedClients(bool fair_insert_admission) {
+  // Only a single insert is allowed for every sample.
+  auto table = MakeTable("dist", std::make_shared<UniformSelector>(),
+                         std::make_shared<FifoSelector>(), 1000, 0,
+                         std::make_shared<RateLimiter>(1.0, 1, -DBL_MAX, 1.5));
+  table->SetFairInsertAdmission(fair_insert_admission);
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+
+  absl::Mutex mu;
+  std::vector<uint64_t> inserted;
+  auto callback = std::make_shared<Table::InsertCallback>([&](uint64_t key) {
+    absl::MutexLock lock(&mu);
+    inserted.push_back(key);
+  });
+  bool can_insert_more;
+  for (uint64_t key : {10, 11, 12}) {
+    REVERB_EXPECT_OK(table->InsertOrAssignAsync(MakeItem(key, 1),
+                                                &can_insert_more, callback,
+                                                /*client_id=*/1));
+  }
+  REVERB_EXPECT_OK(table->InsertOrAssignAsync(MakeItem(20, 1), &can_insert_more,
+                                              callback, /*client_id=*/2));
+
+  for (int i = 0; i < 4; i++) {
+    Table::SampledItem item;
+    REVERB_EXPECT_OK(table->Sample(&item));
+  }
+  absl::MutexLock lock(&mu);
+  mu.AwaitWithTimeout(
+      absl::Condition(
+          +[](std::vector<uint64_t>* keys) { return keys->size() == 4; },
+          &inserted),
+      kLongTimeout);
+  return inserted;
+}
+
+TEST(TableTest, BlockedInsertsAreAdmittedInArrivalOrderByDefault) {
+  EXPECT_THAT(InsertOrderOfBlockedClients(/*fair_insert_admission=*/false),
+              ElementsAre(10, 11, 12, 20));
+}
+
+TEST(TableTest, FairInsertAdmissionAlternatesBetweenClients) {
+  EXPECT_THAT(InsertOrderOfBlockedClients(/*fair_insert_admission=*/true),
+              ElementsAre(10, 20, 11, 12));
+}
+
+TEST(TableTest, InsertOrAssignBatchAsyncCallsCallbackForEachItem) {
+  auto table = MakeUniformTable("dist");
+  absl::Mutex mu;
+  std::vector<uint64_t> inserted;
+  auto callback = std::make_shared<Table::InsertCallback>([&](uint64_t key) {
+    absl::MutexLock lock(&mu);
+    inserted.push_back(key);
+  });
+
+  std::vector<Table::Item> items;
+  for (uint64_t key : {3, 1, 2}) {
+    items.push_back(MakeItem(key, 1));
+  }
+  bool can_insert_more;
+  REVERB_EXPECT_OK(table->InsertOrAssignBatchAsync(
+      std::move(items), &can_insert_more, callback));
+  EXPECT_TRUE(can_insert_more);
+
+  absl::MutexLock lock(&mu);
+  mu.AwaitWithTimeout(
+      absl::Condition(
+          +[](std::vector<uint64_t>* keys) { return keys->size() == 3; },
+          &inserted),
+      kLongTimeout);
+  EXPECT_THAT(inserted, ElementsAre(3, 1, 2));
+  EXPECT_EQ(table->size(), 3);
+}
+
+TEST(TableTest, InsertOrAssignBatchReturnsOnceAllItemsAreInserted) {
+  auto table = MakeUniformTable("dist", /*max_size=*/5);
+  std::vector<Table::Item> items;
+  for (uint64_t key = 1; key <= 8; key++) {
+    items.push_back(MakeItem(key, 1));
+  }
+  REVERB_EXPECT_OK(table->InsertOrAssignBatch(std::move(items)));
+
+  // The oldest items are evicted as the batch is inserted in order.
+  EXPECT_THAT(table->Copy(),
+              UnorderedElementsAre(HasItemKey(4), HasItemKey(5), HasItemKey(6),
+                                   HasItemKey(7), HasItemKey(8)));
+  REVERB_EXPECT_OK(table->InsertOrAssignBatch({}));
+}
+
+TEST(TableTest, InsertOrAssignBatchTimesOutWhenRateLimited) {
+  // Only a single insert is allowed for every sample.
+  auto table = MakeTable("dist", std::make_shared<UniformSelector>(),
+                         std::make_shared<FifoSelector>(), 1000, 0,
+                         std::make_shared<RateLimiter>(1.0, 1, -DBL_MAX, 1.5));
+  std::vector<Table::Item> items;
+  for (uint64_t key = 1; key <= 3; key++) {
+    items.push_back(MakeItem(key, 1));
+  }
+  EXPECT_TRUE(errors::IsRateLimiterTimeout(
+      table->InsertOrAssignBatch(std::move(items), kTimeout)));
+
+  // The remaining items are inserted as soon as samples make room for them.
+  for (int i = 0; i < 2; i++) {
+    Table::SampledItem item;
+    REVERB_EXPECT_OK(table->Sample(&item));
+  }
+  for (int retry = 0; retry < 100 && table->size() != 3; retry++) {
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+  EXPECT_EQ(table->size(), 3);
+
+  // Invalid batches are rejected without inserting any of the items.
+  items.clear();
+  items.push_back(MakeItem(4, 1));
+  items.push_back(MakeItem(5, 1));
+  items.back().item.clear_flat_trajectory();
+  EXPECT_EQ(table->InsertOrAssignBatch(std::move(items)).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(table->size(), 3);
+}
+
+TEST(TableTest, InsertOrAssignBatchAsyncRejectsBatchWithInvalidItem) {
+  auto table = MakeUniformTable("dist");
+  std::vector<Table::Item> items;
+  items.push_back(MakeItem(1, 1));
+  items.push_back(MakeItem(2, 1));
+  items.back().item.clear_flat_trajectory();
+
+  bool can_insert_more;
+  auto status = table->InsertOrAssignBatchAsync(
+      std::move(items), &can_insert_more,
+      std::make_shared<Table::InsertCallback>([](uint64_t) {}));
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  absl::SleepFor(absl::Milliseconds(10));
+  EXPECT_EQ(table->size(), 0);
+}
+
+TEST(TableTest, AsyncExtensionsReceiveBatches) {
+  auto extension = std::make_shared<BatchRecordingExtension>();
+  auto table = MakeTable(
+      "dist", std::make_shared<UniformSelector>(),
+      std::make_shared<FifoSelector>(), 2, 0, MakeLimiter(1),
+      std::vector<std::shared_ptr<TableExtension>>{extension});
+
+  for (uint64_t key : {1, 2, 3}) {
+    REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(key, 1)));
+  }
+  while (!table->all_extensions_are_up_to_date()) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  EXPECT_THAT(extension->inserted(), ElementsAre(1, 2, 3));
+  EXPECT_THAT(extension->deleted(), ElementsAre(1));
+}
+
+TEST(TableTest, WorkerReclaimsExhaustedItems) {
+  auto extension = std::make_shared<BatchRecordingExtension>();
+  auto table = MakeTable(
+      "dist", std::make_shared<FifoSelector>(),
+      std::make_shared<FifoSelector>(), 10, 1, MakeLimiter(1),
+      std::vector<std::shared_ptr<TableExtension>>{extension});
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(2, 1)));
+
+  // The exhausted item can no longer be sampled as soon as the sample returns.
+  Table::SampledItem sample;
+  REVERB_EXPECT_OK(table->Sample(&sample));
+  EXPECT_EQ(sample.ref->item.key(), 1);
+  EXPECT_EQ(table->size(), 1);
+  EXPECT_THAT(table->CopyEpisode(100), IsEmpty());
+
+  // Its references are released by the worker before it goes to sleep.
+  while (!table->worker_is_sleeping() ||
+         !table->all_extensions_are_up_to_date()) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  EXPECT_THAT(extension->deleted(), ElementsAre(1));
+  EXPECT_EQ(table->num_episodes(), 1);
+  EXPECT_EQ(table->num_deleted_episodes(), 1);
+
+  REVERB_EXPECT_OK(table->Sample(&sample));
+  EXPECT_EQ(sample.ref->item.key(), 2);
+  EXPECT_EQ(table->size(), 0);
+}
+
 TEST(TableTest, InsertDeletesWhenOverflowing) {
   auto table = MakeUniformTable("dist", 10);
 
@@ -308,6 +999,32 @@ TEST(TableTest, InsertDeletesWhenOverflowing) {
   }
 }
 
+TEST(TableTest, EvictedChunksAreReleasedInTheBackground) {
+  auto table = MakeUniformTable("dist", 1);
+
+  auto first = MakeItem(1, 123);
+  std::weak_ptr<ChunkStore::Chunk> chunk = first.chunks[0];
+  REVERB_EXPECT_OK(table->InsertOrAssign(std::move(first)));
+  EXPECT_FALSE(chunk.expired());
+
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(2, 123)));
+  internal::ReclamationQueue::Default()->WaitUntilEmpty();
+  EXPECT_TRUE(chunk.expired());
+}
+
+TEST(TableTest, ResetReleasesChunksInTheBackground) {
+  auto table = MakeUniformTable("dist");
+
+  auto item = MakeItem(1, 123);
+  std::weak_ptr<ChunkStore::Chunk> chunk = item.chunks[0];
+  REVERB_EXPECT_OK(table->InsertOrAssign(std::move(item)));
+
+  REVERB_EXPECT_OK(table->Reset());
+  internal::ReclamationQueue::Default()->WaitUntilEmpty();
+  EXPECT_TRUE(chunk.expired());
+  EXPECT_EQ(table->size(), 0);
+}
+
 TEST(TableTest, ConcurrentCalls) {
   auto table = MakeUniformTable("dist", 1000);
 
@@ -500,6 +1217,37 @@ TEST(TableTest, ResetClearsAllData) {
   EXPECT_EQ(table->size(), 0);
 }
 
+TEST(TableTest, ResetTableCanBeRefilled) {
+  auto table = MakeUniformTable("dist");
+  REVERB_ASSERT_OK(table->InsertOrAssign(
+      MakeItem(1, 123, {testing::MakeSequenceRange(100, 0, 5)})));
+  REVERB_ASSERT_OK(table->InsertOrAssign(
+      MakeItem(2, 123, {testing::MakeSequenceRange(100, 6, 10)})));
+  REVERB_ASSERT_OK(table->Reset());
+  EXPECT_THAT(table->CopyEpisode(100), IsEmpty());
+
+  REVERB_ASSERT_OK(table->InsertOrAssign(
+      MakeItem(2, 456, {testing::MakeSequenceRange(100, 0, 5)})));
+  EXPECT_THAT(table->Copy(), ElementsAre(HasItemKey(2)));
+  EXPECT_THAT(table->CopyEpisode(100), ElementsAre(HasItemKey(2)));
+}
+
+TEST(TableTest, ReservedTableBehavesLikeUnreservedTable) {
+  auto table = MakeUniformTable("dist", /*max_size=*/10);
+  table->Reserve(1000);
+  for (int key = 1; key <= 12; key++) {
+    REVERB_ASSERT_OK(table->InsertOrAssign(MakeItem(key, 123)));
+  }
+  EXPECT_EQ(table->size(), 10);
+
+  REVERB_ASSERT_OK(table->Reset());
+  REVERB_ASSERT_OK(table->InsertOrAssign(MakeItem(3, 123)));
+  EXPECT_THAT(table->Copy(), ElementsAre(HasItemKey(3)));
+  Table::SampledItem item;
+  REVERB_ASSERT_OK(table->Sample(&item));
+  EXPECT_EQ(item.ref->item.key(), 3);
+}
+
 TEST(TableTest, ResetWhileConcurrentCalls) {
   auto table = MakeUniformTable("dist");
   std::vector<std::unique_ptr<internal::Thread>> bundle;
@@ -533,6 +1281,30 @@ TEST(TableTest, CheckpointOrderItems) {
                           Partially(testing::EqualsProto("key: 2"))));
 }
 
+TEST(TableTest, SnapshotIsNotAffectedByLaterChanges) {
+  auto table = MakeUniformTable("dist");
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 123)));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(2, 124)));
+
+  auto snapshot = table->TakeSnapshot();
+  EXPECT_EQ(snapshot.size(), 2);
+
+  Table::SampledItem sample;
+  REVERB_EXPECT_OK(table->Sample(&sample));
+  REVERB_EXPECT_OK(table->MutateItems({testing::MakeKeyWithPriority(1, 5)},
+                                      {2}));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 125)));
+
+  auto checkpoint = snapshot.ToCheckpoint();
+  EXPECT_THAT(checkpoint.checkpoint.items(),
+              ElementsAre(Partially(testing::EqualsProto(
+                              "key: 1 priority: 123 times_sampled: 0")),
+                          Partially(testing::EqualsProto(
+                              "key: 2 priority: 124 times_sampled: 0"))));
+  EXPECT_THAT(checkpoint.chunks, SizeIs(2));
+  EXPECT_THAT(table->Checkpoint().checkpoint.items(), SizeIs(2));
+}
+
 TEST(TableTest, CheckpointSanityCheck) {
   tensorflow::StructuredValue signature;
   auto* spec =
@@ -592,6 +1364,37 @@ TEST(TableTest, CheckpointSanityCheck) {
               )pb")));
 }
 
+TEST(TableTest, InsertCheckpointItems) {
+  auto table = MakeUniformTable("dist", /*max_size=*/3);
+  std::vector<Table::Item> items;
+  items.push_back(MakeItem(1, 123));
+  items.push_back(MakeItem(3, 125));
+  REVERB_EXPECT_OK(table->InsertCheckpointItems(std::move(items)));
+  EXPECT_EQ(table->size(), 2);
+
+  // The table would exceed its maximum size.
+  items.clear();
+  items.push_back(MakeItem(4, 1));
+  items.push_back(MakeItem(5, 1));
+  EXPECT_EQ(table->InsertCheckpointItems(std::move(items)).code(),
+            absl::StatusCode::kFailedPrecondition);
+
+  // The key is already present.
+  items.clear();
+  items.push_back(MakeItem(3, 1));
+  EXPECT_EQ(table->InsertCheckpointItems(std::move(items)).code(),
+            absl::StatusCode::kFailedPrecondition);
+  EXPECT_EQ(table->size(), 2);
+
+  // The remover (FIFO) evicts the items in the order they were inserted.
+  items.clear();
+  items.push_back(MakeItem(2, 124));
+  REVERB_EXPECT_OK(table->InsertCheckpointItems(std::move(items)));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(6, 1)));
+  EXPECT_THAT(table->Copy(), UnorderedElementsAre(HasItemKey(3), HasItemKey(2),
+                                                  HasItemKey(6)));
+}
+
 TEST(TableTest, BlocksSamplesWhenSizeToSmallDueToAutoDelete) {
   auto table = MakeTable(
       /*name=*/"dist",
@@ -701,6 +1504,19 @@ TEST(TableTest, GetMissingItem) {
   EXPECT_FALSE(table->Get(2, &item));
 }
 
+TEST(TableTest, GetBatchSkipsMissingItems) {
+  auto table = MakeUniformTable("dist");
+
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(3, 1)));
+
+  std::vector<Table::SampledItem> items;
+  table->GetBatch({3, 2, 1}, &items);
+  EXPECT_THAT(items, ElementsAre(HasSampledItemKey(3), HasSampledItemKey(1)));
+  EXPECT_EQ(items[0].table_size, 2);
+  EXPECT_EQ(items[0].times_sampled, 0);
+}
+
 TEST(TableTest, SampleSetsTableSize) {
   auto table = MakeUniformTable("dist");
 
@@ -755,6 +1571,201 @@ TEST(TableTest, NumEpisodes) {
   EXPECT_EQ(table->num_episodes(), 0);
 }
 
+TEST(TableTest, CopyEpisodeReturnsItemsInInsertionOrder) {
+  auto table = MakeUniformTable("dist");
+
+  REVERB_EXPECT_OK(table->InsertOrAssign(
+      MakeItem(3, 1, {testing::MakeSequenceRange(100, 0, 5)})));
+  REVERB_EXPECT_OK(table->InsertOrAssign(
+      MakeItem(1, 1, {testing::MakeSequenceRange(101, 0, 5)})));
+  // Items spanning two episodes belong to both.
+  REVERB_EXPECT_OK(table->InsertOrAssign(
+      MakeItem(2, 1, {testing::MakeSequenceRange(100, 6, 10),
+                      testing::MakeSequenceRange(101, 6, 10)})));
+
+  EXPECT_THAT(table->CopyEpisode(100),
+              ElementsAre(HasItemKey(3), HasItemKey(2)));
+  EXPECT_THAT(table->CopyEpisode(101),
+              ElementsAre(HasItemKey(1), HasItemKey(2)));
+  EXPECT_THAT(table->CopyEpisode(102), IsEmpty());
+
+  REVERB_EXPECT_OK(table->MutateItems({}, {2}));
+  EXPECT_THAT(table->CopyEpisode(100), ElementsAre(HasItemKey(3)));
+}
+
+TEST(TableTest, MutateItemsDeletesEpisodes) {
+  auto table = MakeUniformTable("dist");
+
+  REVERB_EXPECT_OK(table->InsertOrAssign(
+      MakeItem(1, 1, {testing::MakeSequenceRange(100, 0, 5)})));
+  REVERB_EXPECT_OK(table->InsertOrAssign(
+      MakeItem(2, 1, {testing::MakeSequenceRange(100, 6, 10),
+                      testing::MakeSequenceRange(101, 0, 5)})));
+  REVERB_EXPECT_OK(table->InsertOrAssign(
+      MakeItem(3, 1, {testing::MakeSequenceRange(101, 6, 10)})));
+  REVERB_EXPECT_OK(table->InsertOrAssign(
+      MakeItem(4, 1, {testing::MakeSequenceRange(102, 0, 5)})));
+
+  // Unknown episodes are ignored.
+  REVERB_EXPECT_OK(table->MutateItems({}, {}, {100, 200}));
+  EXPECT_THAT(table->Copy(),
+              UnorderedElementsAre(HasItemKey(3), HasItemKey(4)));
+  EXPECT_EQ(table->num_episodes(), 2);
+  EXPECT_EQ(table->num_deleted_episodes(), 1);
+
+  // Keys and episodes can be deleted at the same time.
+  REVERB_EXPECT_OK(table->MutateItems({}, {3}, {102}));
+  EXPECT_THAT(table->Copy(), IsEmpty());
+  EXPECT_EQ(table->num_episodes(), 0);
+}
+
+TEST(TableTest, SampleEpisodeReturnsAllItemsOfEpisode) {
+  auto table = MakeTable("dist", std::make_shared<PrioritizedSelector>(1),
+                         std::make_shared<FifoSelector>(), 1000, 1,
+                         MakeLimiter(1));
+
+  REVERB_EXPECT_OK(table->InsertOrAssign(
+      MakeItem(1, 0, {testing::MakeSequenceRange(100, 0, 5)})));
+  REVERB_EXPECT_OK(table->InsertOrAssign(
+      MakeItem(2, 1, {testing::MakeSequenceRange(100, 6, 10)})));
+  REVERB_EXPECT_OK(table->InsertOrAssign(
+      MakeItem(3, 0, {testing::MakeSequenceRange(100, 11, 15)})));
+  REVERB_EXPECT_OK(table->InsertOrAssign(
+      MakeItem(4, 0, {testing::MakeSequenceRange(101, 0, 5)})));
+
+  // Only the item with a non-zero priority can be sampled but the entire
+  // episode is returned.
+  std::vector<Table::SampledItem> items;
+  REVERB_EXPECT_OK(table->SampleEpisode(&items));
+  EXPECT_THAT(items, ElementsAre(HasSampledItemKey(1), HasSampledItemKey(2),
+                                 HasSampledItemKey(3)));
+  for (const auto& item : items) {
+    EXPECT_EQ(item.probability, 1);
+  }
+  // Only the sampled item counts as sampled, and has reached
+  // `max_times_sampled`.
+  EXPECT_EQ(items[0].times_sampled, 0);
+  EXPECT_EQ(items[1].times_sampled, 1);
+  EXPECT_THAT(table->Copy(), UnorderedElementsAre(HasItemKey(1), HasItemKey(3),
+                                                  HasItemKey(4)));
+}
+
+TEST(TableTest, SamplesWindowsOfItems) {
+  auto table = MakeUniformTable("dist");
+  table->SetWindowLength(2);
+
+  // Two chunks of 3 steps each, making up 5 windows of 2 steps.
+  REVERB_EXPECT_OK(table->InsertOrAssign(
+      MakeItem(1, 1,
+               {testing::MakeSequenceRange(100, 0, 2),
+                testing::MakeSequenceRange(100, 3, 5)})));
+
+  internal::flat_hash_set<std::pair<uint64_t, int>> first_slices;
+  for (int i = 0; i < 100; i++) {
+    Table::SampledItem sample;
+    REVERB_EXPECT_OK(table->Sample(&sample));
+    EXPECT_EQ(sample.ref->item.key(), 1);
+    EXPECT_DOUBLE_EQ(sample.probability, 1.0 / 5);
+
+    const FlatTrajectory& trajectory = sample.ref->item.flat_trajectory();
+    ASSERT_THAT(trajectory.columns(), SizeIs(1));
+    EXPECT_EQ(internal::ColumnLength(trajectory, 0), 2);
+    ASSERT_THAT(sample.ref->chunks,
+                SizeIs(trajectory.columns(0).chunk_slices_size()));
+    for (int j = 0; j < sample.ref->chunks.size(); j++) {
+      EXPECT_EQ(sample.ref->chunks[j]->key(),
+                trajectory.columns(0).chunk_slices(j).chunk_key());
+    }
+    const auto& first = trajectory.columns(0).chunk_slices(0);
+    first_slices.emplace(first.chunk_key(), first.offset());
+  }
+  // Every window is sampled.
+  EXPECT_THAT(first_slices, SizeIs(5));
+
+  // The table holds the inserted item only.
+  auto items = table->Copy();
+  ASSERT_THAT(items, SizeIs(1));
+  EXPECT_EQ(items[0].item.times_sampled(), 100);
+  EXPECT_EQ(internal::ColumnLength(items[0].item.flat_trajectory(), 0), 6);
+}
+
+TEST(TableTest, RejectsItemsShorterThanWindow) {
+  auto table = MakeUniformTable("dist");
+  table->SetWindowLength(4);
+  EXPECT_EQ(table
+                ->InsertOrAssign(
+                    MakeItem(1, 1, {testing::MakeSequenceRange(100, 0, 2)}))
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  REVERB_EXPECT_OK(table->InsertOrAssign(
+      MakeItem(2, 1, {testing::MakeSequenceRange(100, 0, 3)})));
+}
+
+TEST(TableTest, NumBytesCountsSharedChunksOnce) {
+  auto table = MakeUniformTable("dist");
+
+  TableItem first = MakeItem(1, 1);
+  TableItem second = MakeItem(2, 1);
+  const int64_t first_bytes = first.chunks[0]->DataByteSizeLong();
+  const int64_t second_bytes = second.chunks[0]->DataByteSizeLong();
+
+  // A third item which references the same chunk as the first item.
+  TableItem shared = MakeItem(3, 1);
+  shared.chunks = first.chunks;
+  shared.item.mutable_flat_trajectory()->CopyFrom(
+      first.item.flat_trajectory());
+
+  REVERB_EXPECT_OK(table->InsertOrAssign(first));
+  EXPECT_EQ(table->num_bytes(), first_bytes);
+
+  REVERB_EXPECT_OK(table->InsertOrAssign(second));
+  EXPECT_EQ(table->num_bytes(), first_bytes + second_bytes);
+
+  REVERB_EXPECT_OK(table->InsertOrAssign(shared));
+  EXPECT_EQ(table->num_bytes(), first_bytes + second_bytes);
+
+  // The chunk is still referenced by the third item.
+  REVERB_EXPECT_OK(table->MutateItems({}, {1}));
+  EXPECT_EQ(table->num_bytes(), first_bytes + second_bytes);
+
+  REVERB_EXPECT_OK(table->MutateItems({}, {3}));
+  EXPECT_EQ(table->num_bytes(), second_bytes);
+
+  REVERB_EXPECT_OK(table->Reset());
+  EXPECT_EQ(table->num_bytes(), 0);
+}
+
+TEST(TableTest, MaxBytesEvictsWithRemover) {
+  auto table = MakeUniformTable("dist");
+
+  const int64_t item_bytes = MakeItem(1, 1).chunks[0]->DataByteSizeLong();
+  REVERB_EXPECT_OK(table->SetMaxBytes(3 * item_bytes));
+
+  for (int i = 1; i <= 5; i++) {
+    REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(i, 1)));
+  }
+
+  // The FIFO remover should have evicted the two oldest items.
+  EXPECT_THAT(table->Copy(), UnorderedElementsAre(HasItemKey(3), HasItemKey(4),
+                                                  HasItemKey(5)));
+  EXPECT_EQ(table->num_bytes(), 3 * item_bytes);
+  EXPECT_EQ(table->info().max_bytes(), 3 * item_bytes);
+
+  // Lowering the limit evicts items right away but always keeps the last one.
+  REVERB_EXPECT_OK(table->SetMaxBytes(1));
+  EXPECT_THAT(table->Copy(), UnorderedElementsAre(HasItemKey(5)));
+}
+
+TEST(TableTest, SetCpuAffinity) {
+  auto table = MakeUniformTable("dist");
+  REVERB_EXPECT_OK(table->SetCpuAffinity({0}));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  EXPECT_EQ(table->size(), 1);
+
+  EXPECT_EQ(table->SetCpuAffinity({-1}).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
 TEST(TableTest, NumDeletedEpisodes) {
   auto table = MakeUniformTable("dist");
 
@@ -838,6 +1849,13 @@ TEST(TableTest, Info) {
   REVERB_EXPECT_OK(table->Sample(&sample));
   auto info = table->info();
   info.clear_table_worker_time();
+  info.clear_latency_stats();
+
+  // The byte size depends on the encoding of the chunks so it is checked
+  // against the accessor rather than a constant.
+  EXPECT_GT(info.num_bytes(), 0);
+  EXPECT_EQ(info.num_bytes(), table->num_bytes());
+  info.clear_num_bytes();
 
   EXPECT_THAT(info, testing::EqualsProto(R"pb(
                 name: 'dist'
@@ -981,6 +1999,68 @@ TEST(TableTest, CloseWithWorker) {
   notification.WaitForNotification();
 }
 
+TEST(TableTest, InfoReportsWorkerLaneTime) {
+  absl::Notification notification;
+  auto callback = std::make_shared<Table::SamplingCallback>(
+      [&](Table::SampleRequest* sample) { notification.Notify(); });
+  auto table = MakeUniformTable("table");
+  // The table is empty so the sample lane is blocked by the rate limiter while
+  // the insert lane has nothing to do.
+  table->EnqueSampleRequest(1, callback, kLongTimeout);
+  while (table->num_pending_async_sample_requests() ||
+         !table->worker_is_sleeping()) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  absl::SleepFor(absl::Milliseconds(50));
+
+  auto worker_time = table->info().table_worker_time();
+  EXPECT_GE(worker_time.sample_lane().blocked_ms(), 40);
+  EXPECT_GE(worker_time.insert_lane().sleeping_ms(), 40);
+  EXPECT_EQ(worker_time.insert_lane().blocked_ms(), 0);
+  EXPECT_EQ(worker_time.waiting_for_inserts_ms(),
+            worker_time.sample_lane().blocked_ms());
+
+  // Inserting an item unblocks the sample lane.
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  notification.WaitForNotification();
+}
+
+TEST(TableTest, InfoReportsLatencyStats) {
+  absl::Notification notification;
+  auto callback = std::make_shared<Table::SamplingCallback>(
+      [&](Table::SampleRequest* sample) { notification.Notify(); });
+  auto table = MakeUniformTable("table");
+  // The sample request is blocked by the rate limiter until the item is
+  // inserted.
+  table->EnqueSampleRequest(1, callback, kLongTimeout);
+  while (table->num_pending_async_sample_requests() ||
+         !table->worker_is_sleeping()) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
+  absl::SleepFor(absl::Milliseconds(50));
+  REVERB_EXPECT_OK(table->InsertOrAssign(MakeItem(1, 1)));
+  notification.WaitForNotification();
+  REVERB_EXPECT_OK(table->MutateItems({}, {1}));
+
+  auto stats = table->info().latency_stats();
+  EXPECT_EQ(stats.insert_queue_wait().count(), 1);
+  EXPECT_EQ(stats.insert_rate_limiter_block().count(), 1);
+  EXPECT_EQ(stats.insert_lock_hold().count(), 1);
+  EXPECT_EQ(stats.insert_end_to_end().count(), 1);
+
+  EXPECT_EQ(stats.sample_queue_wait().count(), 1);
+  EXPECT_EQ(stats.sample_rate_limiter_block().count(), 1);
+  EXPECT_GE(stats.sample_rate_limiter_block().max_us(), 40000);
+  EXPECT_GE(stats.sample_lock_hold().count(), 1);
+  EXPECT_EQ(stats.sample_end_to_end().count(), 1);
+  EXPECT_GE(stats.sample_end_to_end().max_us(),
+            stats.sample_rate_limiter_block().max_us());
+
+  EXPECT_EQ(stats.mutate_lock_wait().count(), 1);
+  EXPECT_EQ(stats.mutate_lock_hold().count(), 1);
+  EXPECT_EQ(stats.mutate_end_to_end().count(), 1);
+}
+
 }  // namespace
 }  // namespace reverb
 }  // namespace deepmind
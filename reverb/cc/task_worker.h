@@ -23,6 +23,7 @@
 #include "reverb/cc/platform/status_macros.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/support/periodic_closure.h"
+#include "reverb/cc/support/thread_pool_usage.h"
 #include "reverb/cc/support/unbounded_queue.h"
 #include "reverb/cc/table.h"
 #include "reverb/cc/thread_stats.h"
@@ -149,6 +150,8 @@ class TaskWorker {
   static constexpr auto kQueueTimeToWarn = absl::Seconds(10);
   std::vector<std::shared_ptr<ThreadStatsMutex>> thread_stats_;
   size_t max_queue_size_to_warn_;
+  // Shared by all workers with the same `thread_name_prefix`.
+  internal::ThreadPoolUsageTracker* const usage_;
 };
 
 typedef TaskWorker<InsertTaskInfo, InsertCallback> InsertWorker;
@@ -170,7 +173,8 @@ TaskWorker<TaskInfo, TaskCallback>::TaskWorker(
     : deadlock_checker_([this] { RunDeadlockChecker(); },
                         kDeadlockCheckerPeriod),
       queue_(),
-      max_queue_size_to_warn_(max_queue_size_to_warn) {
+      max_queue_size_to_warn_(max_queue_size_to_warn),
+      usage_(internal::ThreadPoolUsageTracker::Get(thread_name_prefix)) {
   for (int thread_index = 0; thread_index < num_threads; thread_index++) {
     auto stats = std::make_shared<ThreadStatsMutex>();
     thread_stats_.push_back(stats);
@@ -214,9 +218,12 @@ void TaskWorker<TaskInfo, TaskCallback>::Close() {
 template <class TaskInfo, class TaskCallback>
 void TaskWorker<TaskInfo, TaskCallback>::RunWorker(
     std::shared_ptr<ThreadStatsMutex> thread_stats) {
+  usage_->AddCurrentThread();
   Task task;
   while (queue_.Pop(&task)) {
-    if (auto time_in_queue = absl::Now() - task.created_at;
+    const absl::Time started_at = absl::Now();
+    usage_->RecordQueueWait(started_at - task.created_at);
+    if (auto time_in_queue = started_at - task.created_at;
         time_in_queue >= kQueueTimeToWarn) {
       REVERB_LOG(REVERB_WARNING)
           << " A task spent " << absl::FormatDuration(time_in_queue)
@@ -228,13 +235,14 @@ void TaskWorker<TaskInfo, TaskCallback>::RunWorker(
     {
       absl::MutexLock lock(thread_stats->mu.get());
       thread_stats->stats.current_task_id++;
-      thread_stats->stats.current_task_started_at = absl::Now();
+      thread_stats->stats.current_task_started_at = started_at;
       thread_stats->stats.current_task_created_at = task.created_at;
       thread_stats->stats.current_task_info = task.task_info.DebugString();
     }
     // The callback can be expensive, so we run it without holding the lock.
     task.callback(std::move(task.task_info), absl::OkStatus(),
                   QueueIsNotAlmostFull());
+    usage_->RecordRunTime(absl::Now() - started_at);
     {
       absl::MutexLock lock(thread_stats->mu.get());
       thread_stats->stats.num_tasks_processed++;
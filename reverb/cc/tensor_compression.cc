@@ -14,10 +14,24 @@
 
 #include "reverb/cc/tensor_compression.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/snappy.h"
+#include "reverb/cc/platform/zlib.h"
+#include "reverb/cc/schema.pb.h"
 #include "tensorflow/core/framework/register_types.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/types.h"
@@ -27,84 +41,808 @@ namespace deepmind {
 namespace reverb {
 namespace {
 
+// Vectorized kernels are compiled for x86-64 with GCC and Clang. SSE2 is part of
+// the x86-64 baseline so it can always be used while AVX2 is only used if the
+// CPU supports it (checked at runtime).
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define REVERB_HAVE_X86_DELTA_KERNELS 1
+#define REVERB_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#ifdef REVERB_HAVE_X86_DELTA_KERNELS
+
+// Lane-wise integer arithmetic for the unsigned type `T`.
 template <typename T>
+struct SimdOps;
+
+#define REVERB_DEFINE_SIMD_OPS(BITS)                                         \
+  template <>                                                                \
+  struct SimdOps<uint##BITS##_t> {                                           \
+    static __m128i Add(__m128i a, __m128i b) {                               \
+      return _mm_add_epi##BITS(a, b);                                        \
+    }                                                                        \
+    static __m128i Sub(__m128i a, __m128i b) {                               \
+      return _mm_sub_epi##BITS(a, b);                                        \
+    }                                                                        \
+    REVERB_TARGET_AVX2 static __m256i Add(__m256i a, __m256i b) {            \
+      return _mm256_add_epi##BITS(a, b);                                     \
+    }                                                                        \
+    REVERB_TARGET_AVX2 static __m256i Sub(__m256i a, __m256i b) {            \
+      return _mm256_sub_epi##BITS(a, b);                                     \
+    }                                                                        \
+  };
+
+REVERB_DEFINE_SIMD_OPS(8)
+REVERB_DEFINE_SIMD_OPS(16)
+REVERB_DEFINE_SIMD_OPS(32)
+REVERB_DEFINE_SIMD_OPS(64)
+
+#undef REVERB_DEFINE_SIMD_OPS
+
+#endif  // REVERB_HAVE_X86_DELTA_KERNELS
+
+// Element-wise operations used by the delta kernels. Integers are delta
+// encoded with `SubOp` and decoded with `AddOp`. Floating point values are
+// encoded and decoded with `XorOp` on their bit patterns as the integer
+// difference of two floats is not meaningful.
+template <typename T>
+struct AddOp {
+  static T Apply(T a, T b) { return static_cast<T>(a + b); }
+#ifdef REVERB_HAVE_X86_DELTA_KERNELS
+  static __m128i Apply(__m128i a, __m128i b) { return SimdOps<T>::Add(a, b); }
+  REVERB_TARGET_AVX2 static __m256i Apply(__m256i a, __m256i b) {
+    return SimdOps<T>::Add(a, b);
+  }
+#endif
+};
+
+template <typename T>
+struct SubOp {
+  static T Apply(T a, T b) { return static_cast<T>(a - b); }
+#ifdef REVERB_HAVE_X86_DELTA_KERNELS
+  static __m128i Apply(__m128i a, __m128i b) { return SimdOps<T>::Sub(a, b); }
+  REVERB_TARGET_AVX2 static __m256i Apply(__m256i a, __m256i b) {
+    return SimdOps<T>::Sub(a, b);
+  }
+#endif
+};
+
+template <typename T>
+struct XorOp {
+  static T Apply(T a, T b) { return static_cast<T>(a ^ b); }
+#ifdef REVERB_HAVE_X86_DELTA_KERNELS
+  static __m128i Apply(__m128i a, __m128i b) { return _mm_xor_si128(a, b); }
+  REVERB_TARGET_AVX2 static __m256i Apply(__m256i a, __m256i b) {
+    return _mm256_xor_si256(a, b);
+  }
+#endif
+};
+
+// Computes `out[i] = Op(a[i], b[i])` for `i` in [0, n). `out` may be equal to
+// `a` or `b` but must not partially overlap with them.
+template <typename T>
+using DeltaKernel = void (*)(const T* a, const T* b, T* out, int64_t n);
+
+template <typename T, template <typename> class Op>
+void ScalarDeltaKernel(const T* a, const T* b, T* out, int64_t n) {
+  for (int64_t i = 0; i < n; i++) {
+    out[i] = Op<T>::Apply(a[i], b[i]);
+  }
+}
+
+#ifdef REVERB_HAVE_X86_DELTA_KERNELS
+
+template <typename T, template <typename> class Op>
+void Sse2DeltaKernel(const T* a, const T* b, T* out, int64_t n) {
+  constexpr int64_t kLanes = sizeof(__m128i) / sizeof(T);
+  int64_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     Op<T>::Apply(va, vb));
+  }
+  ScalarDeltaKernel<T, Op>(a + i, b + i, out + i, n - i);
+}
+
+template <typename T, template <typename> class Op>
+REVERB_TARGET_AVX2 void Avx2DeltaKernel(const T* a, const T* b, T* out,
+                                        int64_t n) {
+  constexpr int64_t kLanes = sizeof(__m256i) / sizeof(T);
+  int64_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    const __m256i va =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    const __m256i vb =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                        Op<T>::Apply(va, vb));
+  }
+  ScalarDeltaKernel<T, Op>(a + i, b + i, out + i, n - i);
+}
+
+#endif  // REVERB_HAVE_X86_DELTA_KERNELS
+
+// Returns the fastest kernel supported by the CPU. The selection is made once
+// per kernel.
+template <typename T, template <typename> class Op>
+DeltaKernel<T> GetDeltaKernel() {
+  static const DeltaKernel<T> kernel = [] {
+#ifdef REVERB_HAVE_X86_DELTA_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return &Avx2DeltaKernel<T, Op>;
+    }
+    return &Sse2DeltaKernel<T, Op>;
+#else
+    return &ScalarDeltaKernel<T, Op>;
+#endif
+  }();
+  return kernel;
+}
+
+// Delta encodes (or decodes) `tensor` along its first dimension. `EncodeOp`
+// and `DecodeOp` must be each others inverse.
+template <typename T, template <typename> class EncodeOp,
+          template <typename> class DecodeOp>
 tensorflow::Tensor DeltaEncode(const tensorflow::Tensor& tensor, bool encode) {
   tensorflow::Tensor output(tensor.dtype(), tensor.shape());
+  if (tensor.NumElements() == 0) return output;
+
+  const int64_t num_rows = tensor.dim_size(0);
+  const int64_t row_size = tensor.NumElements() / num_rows;
+  const T* src = reinterpret_cast<const T*>(tensor.tensor_data().data());
+  T* dst = reinterpret_cast<T*>(const_cast<char*>(output.tensor_data().data()));
+
+  std::copy(src, src + row_size, dst);
+  if (encode) {
+    // Every row only depends on the input so all rows can be encoded in a
+    // single pass.
+    GetDeltaKernel<T, EncodeOp>()(src + row_size, src, dst + row_size,
+                                  (num_rows - 1) * row_size);
+  } else {
+    // Every row depends on the previously decoded row.
+    const DeltaKernel<T> kernel = GetDeltaKernel<T, DecodeOp>();
+    for (int64_t i = 1; i < num_rows; i++) {
+      kernel(src + i * row_size, dst + (i - 1) * row_size, dst + i * row_size,
+             row_size);
+    }
+  }
+  return output;
+}
+
+// Writes the elements `[begin, end)` of the delta encoding of `src` (see
+// `DeltaEncode`), which holds rows of `row_size` elements, to `dst`.
+template <typename T, template <typename> class EncodeOp>
+void DeltaEncodeElements(const T* src, int64_t row_size, int64_t begin,
+                         int64_t end, T* dst) {
+  if (begin < row_size) {
+    const int64_t n = std::min(end, row_size) - begin;
+    std::copy_n(src + begin, n, dst);
+    begin += n;
+    dst += n;
+  }
+  if (begin < end) {
+    GetDeltaKernel<T, EncodeOp>()(src + begin, src + begin - row_size, dst,
+                                  end - begin);
+  }
+}
+
+// Generator of the bytes of the delta encoding of a tensor. See
+// `DeltaEncodingGenerator`.
+using DeltaGenerator = std::function<void(size_t, size_t, char*)>;
 
-  tensorflow::Tensor tensor_reinterpret;
-  TF_CHECK_OK(tensor_reinterpret.BitcastFrom(
-      tensor, tensorflow::DataTypeToEnum<T>::v(), tensor.shape()));
+template <typename T, template <typename> class EncodeOp>
+DeltaGenerator MakeDeltaGenerator(const tensorflow::Tensor& tensor) {
+  const T* src = reinterpret_cast<const T*>(tensor.tensor_data().data());
+  const int64_t row_size = tensor.NumElements() / tensor.dim_size(0);
+  return [src, row_size](size_t offset, size_t size, char* buffer) {
+    DeltaEncodeElements<T, EncodeOp>(src, row_size, offset / sizeof(T),
+                                     (offset + size) / sizeof(T),
+                                     reinterpret_cast<T*>(buffer));
+  };
+}
 
-  tensorflow::Tensor output_reinterpret;
-  TF_CHECK_OK(output_reinterpret.BitcastFrom(
-      output, tensorflow::DataTypeToEnum<T>::v(), output.shape()));
+// Returns a function which writes bytes `[offset, offset + size)` of the delta
+// encoding of `tensor` to a buffer, so the encoding can be consumed without
+// being materialized. Offsets and sizes must be multiples of the element size.
+// Returns nullptr if `DeltaEncode` would return `tensor` unchanged. `tensor`
+// must outlive the function.
+DeltaGenerator DeltaEncodingGenerator(const tensorflow::Tensor& tensor,
+                                      bool include_floats) {
+  if (tensor.dims() < 2 || tensor.NumElements() == 0) return nullptr;
 
-  auto src = tensor_reinterpret.flat_outer_dims<T>();
-  auto dst = output_reinterpret.flat_outer_dims<T>();
-  for (int j = 0; j < src.dimension(1); j++) {
-    dst(0, j) = src(0, j);
+  switch (tensor.dtype()) {
+#define DELTA_GENERATOR(T)                   \
+  case tensorflow::DataTypeToEnum<T>::value: \
+    return MakeDeltaGenerator<UnsignedType<T>::Type, SubOp>(tensor);
+    TF_CALL_INTEGRAL_TYPES(DELTA_GENERATOR)
+#undef DELTA_GENERATOR
+    case tensorflow::DT_HALF:
+    case tensorflow::DT_BFLOAT16:
+      if (!include_floats) return nullptr;
+      return MakeDeltaGenerator<uint16_t, XorOp>(tensor);
+    case tensorflow::DT_FLOAT:
+      if (!include_floats) return nullptr;
+      return MakeDeltaGenerator<uint32_t, XorOp>(tensor);
+    case tensorflow::DT_DOUBLE:
+      if (!include_floats) return nullptr;
+      return MakeDeltaGenerator<uint64_t, XorOp>(tensor);
+    default:
+      return nullptr;
   }
-  for (int i = 1; i < src.dimension(0); i++) {
-    for (int j = 0; j < src.dimension(1); j++) {
-      dst(i, j) = src(i, j) + (encode ? -src(i - 1, j) : dst(i - 1, j));
+}
+
+template <typename T, template <typename> class DecodeOp>
+void DeltaDecodeInPlace(tensorflow::Tensor* tensor) {
+  const int64_t num_rows = tensor->dim_size(0);
+  const int64_t row_size = tensor->NumElements() / num_rows;
+  T* data =
+      reinterpret_cast<T*>(const_cast<char*>(tensor->tensor_data().data()));
+  const DeltaKernel<T> kernel = GetDeltaKernel<T, DecodeOp>();
+  for (int64_t i = 1; i < num_rows; i++) {
+    kernel(data + i * row_size, data + (i - 1) * row_size, data + i * row_size,
+           row_size);
+  }
+}
+
+// Delta decodes `tensor` (see `DeltaEncode`) without allocating a new buffer.
+// `tensor` must not share its buffer with other tensors.
+void DeltaDecodeInPlace(tensorflow::Tensor* tensor, bool include_floats) {
+  if (tensor->dims() < 2 || tensor->NumElements() == 0) return;
+
+  switch (tensor->dtype()) {
+#define DELTA_DECODE(T)                      \
+  case tensorflow::DataTypeToEnum<T>::value: \
+    return DeltaDecodeInPlace<UnsignedType<T>::Type, AddOp>(tensor);
+    TF_CALL_INTEGRAL_TYPES(DELTA_DECODE)
+#undef DELTA_DECODE
+    case tensorflow::DT_HALF:
+    case tensorflow::DT_BFLOAT16:
+      if (include_floats) DeltaDecodeInPlace<uint16_t, XorOp>(tensor);
+      return;
+    case tensorflow::DT_FLOAT:
+      if (include_floats) DeltaDecodeInPlace<uint32_t, XorOp>(tensor);
+      return;
+    case tensorflow::DT_DOUBLE:
+      if (include_floats) DeltaDecodeInPlace<uint64_t, XorOp>(tensor);
+      return;
+    default:
+      return;
+  }
+}
+
+// Byte layout of a column whose rows are stacks of frames along `axis` (of the
+// rows). Every row is viewed as `outer` runs of `stack_size` pieces of
+// `inner_bytes` bytes and frame `j` of the row is made up of piece `j` of
+// every run.
+struct FrameStackLayout {
+  FrameStackLayout(const tensorflow::TensorShape& column_shape, int axis,
+                   tensorflow::DataType dtype)
+      : stack_size(column_shape.dim_size(axis + 1)),
+        inner_bytes(tensorflow::DataTypeSize(dtype)) {
+    for (int i = 1; i < axis + 1; i++) outer *= column_shape.dim_size(i);
+    for (int i = axis + 2; i < column_shape.dims(); i++) {
+      inner_bytes *= column_shape.dim_size(i);
     }
   }
-  return output;
+
+  int64_t frame_bytes() const { return outer * inner_bytes; }
+  int64_t row_bytes() const { return frame_bytes() * stack_size; }
+
+  int64_t outer = 1;
+  int64_t stack_size;
+  int64_t inner_bytes;
+};
+
+// Returns the frame stack of `column` in `chunk` or nullptr if the column
+// isn't a frame stack.
+const ChunkData::FrameStack* GetFrameStack(const ChunkData& chunk,
+                                           int column) {
+  if (column < 0 || column >= chunk.data().frame_stacks_size() ||
+      !chunk.data().frame_stacks(column).has_frames()) {
+    return nullptr;
+  }
+  return &chunk.data().frame_stacks(column);
+}
+
+// Splits the rows of `tensor` into the frames stacked along `axis` and returns
+// the unique frames in order of first appearance. The index of every frame of
+// every row is added to `frame_stack`.
+tensorflow::Tensor ExtractUniqueFrames(const tensorflow::Tensor& tensor,
+                                       int axis,
+                                       ChunkData::FrameStack* frame_stack) {
+  const FrameStackLayout layout(tensor.shape(), axis, tensor.dtype());
+  const char* data = tensor.tensor_data().data();
+
+  internal::flat_hash_map<std::string, int32_t> frame_ids;
+  std::string unique_frames;
+  std::string frame(layout.frame_bytes(), '\0');
+  for (int64_t row = 0; row < tensor.dim_size(0); row++) {
+    for (int64_t j = 0; j < layout.stack_size; j++) {
+      for (int64_t o = 0; o < layout.outer; o++) {
+        std::copy_n(data + row * layout.row_bytes() +
+                        (o * layout.stack_size + j) * layout.inner_bytes,
+                    layout.inner_bytes, &frame[o * layout.inner_bytes]);
+      }
+      const int32_t next_id = frame_ids.size();
+      auto [it, inserted] = frame_ids.try_emplace(frame, next_id);
+      if (inserted) unique_frames.append(frame);
+      frame_stack->add_frame_indices(it->second);
+    }
+  }
+
+  tensorflow::TensorShape frames_shape = tensor.shape();
+  frames_shape.RemoveDim(axis + 1);
+  frames_shape.set_dim(0, frame_ids.size());
+  tensorflow::Tensor frames(tensor.dtype(), frames_shape);
+  std::copy(unique_frames.begin(), unique_frames.end(),
+            const_cast<char*>(frames.tensor_data().data()));
+  return frames;
+}
+
+// Reconstructs rows `[offset, offset + length)` of the frame stack column with
+// shape `column_shape` from its unique `frames`.
+tensorflow::Tensor StackFrames(const tensorflow::Tensor& frames,
+                               const ChunkData::FrameStack& frame_stack,
+                               tensorflow::TensorShape column_shape,
+                               int64_t offset, int64_t length) {
+  const FrameStackLayout layout(column_shape, frame_stack.axis(),
+                                frames.dtype());
+  column_shape.set_dim(0, length);
+  tensorflow::Tensor tensor(frames.dtype(), column_shape);
+  const char* src = frames.tensor_data().data();
+  char* dst = const_cast<char*>(tensor.tensor_data().data());
+  for (int64_t row = 0; row < length; row++) {
+    for (int64_t j = 0; j < layout.stack_size; j++) {
+      const int32_t frame = frame_stack.frame_indices(
+          (offset + row) * layout.stack_size + j);
+      REVERB_CHECK(frame >= 0 && frame < frames.dim_size(0))
+          << "Frame index " << frame << " out of range of "
+          << frames.dim_size(0) << " frames.";
+      for (int64_t o = 0; o < layout.outer; o++) {
+        std::copy_n(src + frame * layout.frame_bytes() + o * layout.inner_bytes,
+                    layout.inner_bytes,
+                    dst + row * layout.row_bytes() +
+                        (o * layout.stack_size + j) * layout.inner_bytes);
+      }
+    }
+  }
+  return tensor;
 }
 
 }  // namespace
 
-tensorflow::Tensor DeltaEncode(const tensorflow::Tensor& tensor, bool encode) {
+tensorflow::Tensor DeltaEncode(const tensorflow::Tensor& tensor, bool encode,
+                               bool include_floats) {
   if (tensor.dims() < 2) return tensor;
 
   switch (tensor.dtype()) {
 #define DELTA_ENCODE(T)                      \
   case tensorflow::DataTypeToEnum<T>::value: \
-    return DeltaEncode<UnsignedType<T>::Type>(tensor, encode);
+    return DeltaEncode<UnsignedType<T>::Type, SubOp, AddOp>(tensor, encode);
     TF_CALL_INTEGRAL_TYPES(DELTA_ENCODE)
 #undef DELTA_ENCODE
+    case tensorflow::DT_HALF:
+    case tensorflow::DT_BFLOAT16:
+      if (!include_floats) return tensor;
+      return DeltaEncode<uint16_t, XorOp, XorOp>(tensor, encode);
+    case tensorflow::DT_FLOAT:
+      if (!include_floats) return tensor;
+      return DeltaEncode<uint32_t, XorOp, XorOp>(tensor, encode);
+    case tensorflow::DT_DOUBLE:
+      if (!include_floats) return tensor;
+      return DeltaEncode<uint64_t, XorOp, XorOp>(tensor, encode);
     default:
       return tensor;
   }
 }
 
 std::vector<tensorflow::Tensor> DeltaEncodeList(
-    const std::vector<tensorflow::Tensor>& tensors, bool encode) {
+    const std::vector<tensorflow::Tensor>& tensors, bool encode,
+    bool include_floats) {
   std::vector<tensorflow::Tensor> outputs;
   outputs.reserve(tensors.size());
   for (const tensorflow::Tensor& tensor : tensors) {
-    outputs.push_back(DeltaEncode(tensor, encode));
+    outputs.push_back(DeltaEncode(tensor, encode, include_floats));
   }
   return outputs;
 }
 
 void CompressTensorAsProto(const tensorflow::Tensor& tensor,
                            tensorflow::TensorProto* proto) {
-  if (tensor.dtype() == tensorflow::DT_STRING) {
-    tensor.AsProtoTensorContent(proto);
-  } else {
-    proto->set_dtype(tensor.dtype());
-    tensor.shape().AsProto(proto->mutable_tensor_shape());
-    SnappyCompressFromString(tensor.tensor_data(),
-                             proto->mutable_tensor_content());
+  CompressionOptions options;
+  options.set_codec(COMPRESSION_CODEC_SNAPPY);
+  CompressTensorAsProto(tensor, options, proto);
+}
+
+void CompressTensorAsProto(const tensorflow::Tensor& tensor,
+                           const CompressionOptions& options,
+                           tensorflow::TensorProto* proto) {
+  switch (options.codec()) {
+    case COMPRESSION_CODEC_NONE:
+      tensor.AsProtoTensorContent(proto);
+      return;
+    case COMPRESSION_CODEC_ZLIB: {
+      // The content of string tensors is encoded by `AsProtoTensorContent` so
+      // it can be compressed the same way as any other dtype.
+      tensor.AsProtoTensorContent(proto);
+      std::string compressed;
+      REVERB_CHECK(ZlibCompressFromString(
+          proto->tensor_content(), options.level() == 0 ? -1 : options.level(),
+          &compressed));
+      *proto->mutable_tensor_content() = std::move(compressed);
+      return;
+    }
+    case COMPRESSION_CODEC_SNAPPY:
+      if (tensor.dtype() == tensorflow::DT_STRING) {
+        tensor.AsProtoTensorContent(proto);
+      } else {
+        proto->set_dtype(tensor.dtype());
+        tensor.shape().AsProto(proto->mutable_tensor_shape());
+        SnappyCompressFromString(tensor.tensor_data(),
+                                 proto->mutable_tensor_content());
+      }
+      return;
+    default:
+      REVERB_LOG(REVERB_FATAL)
+          << "Unsupported compression codec: "
+          << CompressionCodec_Name(options.codec());
   }
 }
 
 tensorflow::Tensor DecompressTensorFromProto(
     const tensorflow::TensorProto& proto) {
-  if (proto.dtype() == tensorflow::DT_STRING) {
+  return DecompressTensorFromProto(proto, COMPRESSION_CODEC_SNAPPY);
+}
+
+tensorflow::Tensor DecompressTensorFromProto(
+    const tensorflow::TensorProto& proto, CompressionCodec codec) {
+  if (codec == COMPRESSION_CODEC_NONE ||
+      (codec == COMPRESSION_CODEC_SNAPPY &&
+       proto.dtype() == tensorflow::DT_STRING)) {
     tensorflow::Tensor tensor;
     REVERB_CHECK(tensor.FromProto(proto));
     return tensor;
-  } else {
+  }
+
+  const auto& tensor_content = proto.tensor_content();
+  if (codec == COMPRESSION_CODEC_ZLIB) {
+    if (proto.dtype() == tensorflow::DT_STRING) {
+      tensorflow::TensorProto uncompressed;
+      uncompressed.set_dtype(proto.dtype());
+      *uncompressed.mutable_tensor_shape() = proto.tensor_shape();
+      REVERB_CHECK(ZlibUncompressToString(
+          tensor_content, uncompressed.mutable_tensor_content()));
+      tensorflow::Tensor tensor;
+      REVERB_CHECK(tensor.FromProto(uncompressed));
+      return tensor;
+    }
     tensorflow::Tensor tensor(proto.dtype(),
                               tensorflow::TensorShape(proto.tensor_shape()));
-    const auto& tensor_content = proto.tensor_content();
-    SnappyUncompressToString(tensor_content,
-                             tensor.tensor_data().size(),
-                             const_cast<char*>(tensor.tensor_data().data()));
+    REVERB_CHECK(ZlibUncompressToBuffer(
+        tensor_content, tensor.tensor_data().size(),
+        const_cast<char*>(tensor.tensor_data().data())));
     return tensor;
   }
+
+  REVERB_CHECK_EQ(codec, COMPRESSION_CODEC_SNAPPY);
+  tensorflow::Tensor tensor(proto.dtype(),
+                            tensorflow::TensorShape(proto.tensor_shape()));
+  SnappyUncompressToString(tensor_content, tensor.tensor_data().size(),
+                           const_cast<char*>(tensor.tensor_data().data()));
+  return tensor;
+}
+
+CompressionCodec GetChunkColumnCodec(const ChunkData& chunk, int column) {
+  return column < chunk.codecs_size() ? chunk.codecs(column)
+                                      : COMPRESSION_CODEC_SNAPPY;
+}
+
+namespace {
+
+// Returns the quantization of `column` in `chunk` or nullptr if the column
+// isn't quantized.
+const ChunkData::QuantizedColumn* GetQuantizedColumn(const ChunkData& chunk,
+                                                     int column) {
+  if (column < 0 || column >= chunk.quantized_columns_size() ||
+      chunk.quantized_columns(column).quantization() == QUANTIZATION_NONE) {
+    return nullptr;
+  }
+  return &chunk.quantized_columns(column);
+}
+
+// Quantizes the float32 `tensor` with the quantization of `column` and sets
+// the parameters needed to restore the values.
+tensorflow::Tensor Quantize(const tensorflow::Tensor& tensor,
+                            ChunkData::QuantizedColumn* column) {
+  REVERB_CHECK_EQ(tensor.dtype(), tensorflow::DT_FLOAT)
+      << "Only float32 columns can be quantized.";
+  const auto values = tensor.unaligned_flat<float>();
+  switch (column->quantization()) {
+    case QUANTIZATION_BFLOAT16: {
+      tensorflow::Tensor out(tensorflow::DT_BFLOAT16, tensor.shape());
+      out.flat<tensorflow::bfloat16>() = values.cast<tensorflow::bfloat16>();
+      return out;
+    }
+    case QUANTIZATION_FLOAT16: {
+      tensorflow::Tensor out(tensorflow::DT_HALF, tensor.shape());
+      out.flat<Eigen::half>() = values.cast<Eigen::half>();
+      return out;
+    }
+    case QUANTIZATION_AFFINE_UINT8: {
+      float min = std::numeric_limits<float>::infinity();
+      float max = -std::numeric_limits<float>::infinity();
+      for (int64_t i = 0; i < values.size(); i++) {
+        if (std::isfinite(values(i))) {
+          min = std::min(min, values(i));
+          max = std::max(max, values(i));
+        }
+      }
+      if (min > max) min = max = 0;  // No finite values.
+      const float scale = (max - min) / 255;
+      column->set_offset(min);
+      column->set_scale(scale);
+
+      tensorflow::Tensor out(tensorflow::DT_UINT8, tensor.shape());
+      auto levels = out.flat<uint8_t>();
+      for (int64_t i = 0; i < values.size(); i++) {
+        float level = scale > 0 ? std::round((values(i) - min) / scale) : 0;
+        // NaNs fail every comparison and are mapped to the lowest level.
+        if (!(level >= 0)) level = 0;
+        levels(i) = static_cast<uint8_t>(std::min(level, 255.0f));
+      }
+      return out;
+    }
+    default:
+      REVERB_CHECK(false) << "Unsupported quantization: "
+                          << column->quantization();
+  }
+}
+
+// Restores the float32 values of `tensor` which was quantized as `column`.
+tensorflow::Tensor Dequantize(const tensorflow::Tensor& tensor,
+                              const ChunkData::QuantizedColumn& column) {
+  tensorflow::Tensor out(tensorflow::DT_FLOAT, tensor.shape());
+  auto values = out.flat<float>();
+  switch (column.quantization()) {
+    case QUANTIZATION_BFLOAT16:
+      values = tensor.unaligned_flat<tensorflow::bfloat16>().cast<float>();
+      break;
+    case QUANTIZATION_FLOAT16:
+      values = tensor.unaligned_flat<Eigen::half>().cast<float>();
+      break;
+    case QUANTIZATION_AFFINE_UINT8: {
+      const auto levels = tensor.unaligned_flat<uint8_t>();
+      for (int64_t i = 0; i < levels.size(); i++) {
+        values(i) = column.offset() + column.scale() * levels(i);
+      }
+      break;
+    }
+    default:
+      REVERB_CHECK(false) << "Unsupported quantization: "
+                          << column.quantization();
+  }
+  return out;
+}
+
+// Delta encodes `rows` (if `delta_encode` is set) and compresses them into
+// `proto`. Snappy compresses the deltas while they are generated and
+// uncompressed rows are delta encoded straight into `proto`, so the delta
+// encoded rows are never materialized for these codecs.
+void DeltaEncodeAndCompress(const tensorflow::Tensor& rows, bool delta_encode,
+                            bool include_floats,
+                            const CompressionOptions& options,
+                            tensorflow::TensorProto* proto) {
+  const DeltaGenerator deltas =
+      delta_encode ? DeltaEncodingGenerator(rows, include_floats) : nullptr;
+  if (deltas == nullptr) {
+    CompressTensorAsProto(rows, options, proto);
+    return;
+  }
+  if (options.codec() != COMPRESSION_CODEC_SNAPPY &&
+      options.codec() != COMPRESSION_CODEC_NONE) {
+    CompressTensorAsProto(
+        DeltaEncode(rows, /*encode=*/true, include_floats), options, proto);
+    return;
+  }
+
+  proto->set_dtype(rows.dtype());
+  rows.shape().AsProto(proto->mutable_tensor_shape());
+  const size_t size = rows.tensor_data().size();
+  std::string* content = proto->mutable_tensor_content();
+  if (options.codec() == COMPRESSION_CODEC_SNAPPY) {
+    SnappyCompressFromGenerator(size, deltas, content);
+  } else {
+    content->resize(size);
+    deltas(0, size, &(*content)[0]);
+  }
+}
+
+// Decompresses `proto` and delta decodes it (if `delta_encoded` is set) in
+// the buffer it was decompressed into.
+tensorflow::Tensor DecompressAndDeltaDecode(
+    const tensorflow::TensorProto& proto, CompressionCodec codec,
+    bool delta_encoded, bool include_floats) {
+  tensorflow::Tensor tensor = DecompressTensorFromProto(proto, codec);
+  if (delta_encoded) DeltaDecodeInPlace(&tensor, include_floats);
+  return tensor;
+}
+
+// Compresses the (already quantized) `tensor` as a new column of `chunk`. See
+// `CompressChunkColumn`.
+void EncodeChunkColumn(const tensorflow::Tensor& tensor,
+                       const CompressionOptions& options, ChunkData* chunk) {
+  auto compress = [chunk, &options](const tensorflow::Tensor& rows,
+                                    tensorflow::TensorProto* proto) {
+    DeltaEncodeAndCompress(rows, chunk->delta_encoded(),
+                           chunk->delta_encoded_floats(), options, proto);
+  };
+
+  tensorflow::TensorProto* proto = chunk->mutable_data()->add_tensors();
+  chunk->add_codecs(options.codec());
+  if (options.has_frame_stack()) {
+    const int axis = options.frame_stack().axis();
+    REVERB_CHECK_EQ(options.block_length(), 0)
+        << "Frame stacks can't be compressed in blocks.";
+    REVERB_CHECK_EQ(chunk->block_length(), 0);
+    REVERB_CHECK_NE(tensor.dtype(), tensorflow::DT_STRING)
+        << "String columns can't be frame stacks.";
+    REVERB_CHECK(axis >= 0 && axis + 1 < tensor.dims())
+        << "Frame stack axis " << axis << " out of range of column with shape "
+        << tensor.shape().DebugString() << ".";
+
+    // The column proto only describes the column while the rows are rebuilt
+    // from the unique frames.
+    proto->set_dtype(tensor.dtype());
+    tensor.shape().AsProto(proto->mutable_tensor_shape());
+    const int column = chunk->data().tensors_size() - 1;
+    while (chunk->data().frame_stacks_size() < column) {
+      chunk->mutable_data()->add_frame_stacks();
+    }
+    auto* frame_stack = chunk->mutable_data()->add_frame_stacks();
+    frame_stack->set_axis(axis);
+    compress(ExtractUniqueFrames(tensor, axis, frame_stack),
+             frame_stack->mutable_frames());
+    return;
+  }
+  if (options.block_length() <= 0) {
+    REVERB_CHECK_EQ(chunk->block_length(), 0);
+    compress(tensor, proto);
+    return;
+  }
+
+  REVERB_CHECK(chunk->data().tensors_size() == 1 ||
+               chunk->block_length() == options.block_length())
+      << "All columns of a chunk must use the same block length.";
+  chunk->set_block_length(options.block_length());
+
+  // The column proto only describes the column while its rows are stored in
+  // blocks. Every block is delta encoded on its own so it can be decoded
+  // without the rows of the blocks before it.
+  proto->set_dtype(tensor.dtype());
+  tensor.shape().AsProto(proto->mutable_tensor_shape());
+  auto* blocks = chunk->mutable_data()->add_blocks();
+  const int64_t num_rows = tensor.dim_size(0);
+  for (int64_t start = 0; start < num_rows; start += options.block_length()) {
+    const int64_t end = std::min(num_rows, start + options.block_length());
+    compress(tensor.Slice(start, end), blocks->add_tensors());
+  }
+}
+
+// Decompresses the rows `[offset, offset + length)` of `column` without
+// restoring quantized values. See `DecompressChunkColumn`.
+tensorflow::Tensor DecodeChunkColumn(const ChunkData& chunk, int column,
+                                     int64_t offset, int64_t length) {
+  const int64_t num_rows = ChunkColumnNumRows(chunk, column);
+  if (length < 0) length = num_rows - offset;
+  REVERB_CHECK(offset >= 0 && offset + length <= num_rows)
+      << "Rows [" << offset << ", " << offset + length << ") out of range of "
+      << "column " << column << " with " << num_rows << " rows.";
+
+  const CompressionCodec codec = GetChunkColumnCodec(chunk, column);
+  auto decode = [&chunk, codec](const tensorflow::TensorProto& proto) {
+    return DecompressAndDeltaDecode(proto, codec, chunk.delta_encoded(),
+                                    chunk.delta_encoded_floats());
+  };
+
+  if (const auto* frame_stack = GetFrameStack(chunk, column)) {
+    return StackFrames(
+        decode(frame_stack->frames()), *frame_stack,
+        tensorflow::TensorShape(chunk.data().tensors(column).tensor_shape()),
+        offset, length);
+  }
+
+  if (chunk.block_length() <= 0) {
+    tensorflow::Tensor tensor = decode(chunk.data().tensors(column));
+    if (offset == 0 && length == num_rows) return tensor;
+    return tensor.Slice(offset, offset + length);
+  }
+
+  if (length == 0) {
+    tensorflow::TensorShape shape(chunk.data().tensors(column).tensor_shape());
+    shape.set_dim(0, 0);
+    return tensorflow::Tensor(chunk.data().tensors(column).dtype(), shape);
+  }
+
+  // Only the blocks which overlap the requested rows are decompressed.
+  const int64_t block_length = chunk.block_length();
+  const auto& blocks = chunk.data().blocks(column).tensors();
+  std::vector<tensorflow::Tensor> parts;
+  for (int64_t start = offset - offset % block_length;
+       start < offset + length; start += block_length) {
+    tensorflow::Tensor block = decode(blocks[start / block_length]);
+    const int64_t begin = std::max(offset, start) - start;
+    const int64_t end = std::min(offset + length, start + block_length) - start;
+    parts.push_back(begin == 0 && end == block.dim_size(0)
+                        ? std::move(block)
+                        : block.Slice(begin, end));
+  }
+  if (parts.size() == 1) return std::move(parts[0]);
+
+  tensorflow::Tensor tensor;
+  REVERB_CHECK(tensorflow::tensor::Concat(parts, &tensor).ok());
+  return tensor;
+}
+
+}  // namespace
+
+void CompressChunkColumn(const tensorflow::Tensor& tensor,
+                         const CompressionOptions& options, ChunkData* chunk) {
+  if (options.quantization() == QUANTIZATION_NONE) {
+    EncodeChunkColumn(tensor, options, chunk);
+    return;
+  }
+
+  const int column = chunk->data().tensors_size();
+  while (chunk->quantized_columns_size() < column) {
+    chunk->add_quantized_columns();
+  }
+  auto* quantized = chunk->add_quantized_columns();
+  quantized->set_quantization(options.quantization());
+  EncodeChunkColumn(Quantize(tensor, quantized), options, chunk);
+}
+
+tensorflow::Tensor DecompressChunkColumn(const ChunkData& chunk, int column,
+                                         int64_t offset, int64_t length) {
+  tensorflow::Tensor tensor = DecodeChunkColumn(chunk, column, offset, length);
+  if (const auto* quantized = GetQuantizedColumn(chunk, column)) {
+    return Dequantize(tensor, *quantized);
+  }
+  return tensor;
+}
+
+void CopyChunkColumnRows(const ChunkData& chunk, int column, int64_t offset,
+                         int64_t length, ChunkData* out) {
+  CompressionOptions options;
+  options.set_codec(GetChunkColumnCodec(chunk, column));
+  if (const auto* frame_stack = GetFrameStack(chunk, column)) {
+    options.mutable_frame_stack()->set_axis(frame_stack->axis());
+  }
+  // The quantized values are copied as is so they aren't rounded again.
+  if (const auto* quantized = GetQuantizedColumn(chunk, column)) {
+    while (out->quantized_columns_size() < out->data().tensors_size()) {
+      out->add_quantized_columns();
+    }
+    *out->add_quantized_columns() = *quantized;
+  }
+  EncodeChunkColumn(DecodeChunkColumn(chunk, column, offset, length), options,
+                    out);
+}
+
+tensorflow::DataType ChunkColumnDtype(const ChunkData& chunk, int column) {
+  return GetQuantizedColumn(chunk, column) != nullptr
+             ? tensorflow::DT_FLOAT
+             : chunk.data().tensors(column).dtype();
+}
+
+bool IsFrameStackColumn(const ChunkData& chunk, int column) {
+  return GetFrameStack(chunk, column) != nullptr;
+}
+
+int64_t ChunkColumnNumRows(const ChunkData& chunk, int column) {
+  const auto& shape = chunk.data().tensors(column).tensor_shape();
+  return shape.dim_size() == 0 ? 0 : shape.dim(0).size();
 }
 
 }  // namespace reverb
@@ -15,6 +15,7 @@
 #ifndef LEARNING_DEEPMIND_REPLAY_REVERB_TENSOR_COMPRESSION_H_
 #define LEARNING_DEEPMIND_REPLAY_REVERB_TENSOR_COMPRESSION_H_
 
+#include "reverb/cc/schema.pb.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor.pb.h"
 
@@ -25,21 +26,86 @@ namespace reverb {
 // The first dimension is assumed to be the time step and each timestep will be
 // encoded as follows: output[i] = input[i] - input[i-1]. For encoding
 // `encode=true` should be passed, for decoding `encode=false`.
-tensorflow::Tensor DeltaEncode(const tensorflow::Tensor& tensor, bool encode);
+//
+// If `include_floats` is true then HALF, BFLOAT16, FLOAT and DOUBLE tensors
+// are delta encoded as well by XORing the bit patterns of subsequent time
+// steps: bits(output[i]) = bits(input[i]) ^ bits(input[i-1]). The same value
+// of `include_floats` must be used for encoding and decoding.
+//
+// Vectorized (SSE2/AVX2) kernels are selected at runtime when available.
+tensorflow::Tensor DeltaEncode(const tensorflow::Tensor& tensor, bool encode,
+                               bool include_floats = false);
 
 // Applies `DeltaEncode` on a vector of tensors.
 std::vector<tensorflow::Tensor> DeltaEncodeList(
-    const std::vector<tensorflow::Tensor>& tensors, bool encode);
+    const std::vector<tensorflow::Tensor>& tensors, bool encode,
+    bool include_floats = false);
 
 // Compresses a Tensor with Zippy. The resulting `proto` must be read with
 // `DecompressTensorFromProto`. Note that string tensors are not compressed.
 void CompressTensorAsProto(const tensorflow::Tensor& tensor,
                            tensorflow::TensorProto* proto);
 
+// Compresses a Tensor with the codec (and level) selected in `options`. The
+// resulting `proto` must be read with `DecompressTensorFromProto` using the
+// same codec. String tensors are only compressed by `COMPRESSION_CODEC_ZLIB`.
+void CompressTensorAsProto(const tensorflow::Tensor& tensor,
+                           const CompressionOptions& options,
+                           tensorflow::TensorProto* proto);
+
 // Assumes that the TensorProto was built by calling `CompressTensorAsProto`.
 tensorflow::Tensor DecompressTensorFromProto(
     const tensorflow::TensorProto& proto);
 
+// Assumes that the TensorProto was built by calling `CompressTensorAsProto`
+// with `codec`.
+tensorflow::Tensor DecompressTensorFromProto(
+    const tensorflow::TensorProto& proto, CompressionCodec codec);
+
+// Returns the codec used to compress `column` of `chunk`. Chunks which do not
+// record their codecs were compressed with `COMPRESSION_CODEC_SNAPPY`.
+CompressionCodec GetChunkColumnCodec(const ChunkData& chunk, int column);
+
+// Compresses `tensor` and appends it as a new column of `chunk`. The tensor is
+// delta encoded first if `chunk.delta_encoded()` is set. If
+// `options.block_length()` is > 0 then the rows are compressed (and delta
+// encoded) in blocks which can be decompressed independently of each other.
+// All columns of a chunk must use the same block length. If
+// `options.frame_stack()` is set then only the unique frames of the rows are
+// compressed (see `ChunkData.FrameStack`). If `options.quantization()` is set
+// then the (float32) tensor is quantized before it is compressed and the
+// quantization is recorded in `chunk.quantized_columns`.
+void CompressChunkColumn(const tensorflow::Tensor& tensor,
+                         const CompressionOptions& options, ChunkData* chunk);
+
+// Decompresses (and delta decodes) rows `[offset, offset + length)` of
+// `column` in `chunk`. If `length` is negative then all rows starting at
+// `offset` are returned. Only the blocks overlapping the rows are decompressed
+// for chunks with a `block_length` and only the requested rows are stacked for
+// frame stack columns. The column and rows must exist. Note that the returned
+// tensor may be an unaligned slice.
+tensorflow::Tensor DecompressChunkColumn(const ChunkData& chunk, int column,
+                                         int64_t offset = 0,
+                                         int64_t length = -1);
+
+// Decompresses (and delta decodes) rows `[offset, offset + length)` of `column`
+// in `chunk` and appends them as a new column of `out`. The rows are compressed
+// with the same codec, as a frame stack if `column` is one, and keep their
+// quantized values so they aren't rounded twice. Blocks are not preserved.
+// `out` must use the same delta encoding as `chunk`.
+void CopyChunkColumnRows(const ChunkData& chunk, int column, int64_t offset,
+                         int64_t length, ChunkData* out);
+
+// Returns the dtype of `column` in `chunk` once decompressed. This differs from
+// the dtype of `chunk.data().tensors(column)` for quantized columns.
+tensorflow::DataType ChunkColumnDtype(const ChunkData& chunk, int column);
+
+// Returns true if `column` of `chunk` was compressed as a frame stack.
+bool IsFrameStackColumn(const ChunkData& chunk, int column);
+
+// Returns the number of rows in `column` of `chunk` without decompressing it.
+int64_t ChunkColumnNumRows(const ChunkData& chunk, int column);
+
 template <typename T>
 struct UnsignedType {
   static_assert(
@@ -14,14 +14,18 @@
 
 #include "reverb/cc/tensor_compression.h"
 
+#include <limits>
 #include <string>
+#include <utility>
 
 #include "gtest/gtest.h"
+#include "reverb/cc/schema.pb.h"
 #include "reverb/cc/testing/tensor_testutil.h"
 #include "tensorflow/core/framework/register_types.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor.pb.h"
 #include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/tensor_util.h"
 #include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/framework/types.pb.h"
 
@@ -48,6 +52,80 @@ TEST(TensorCompressionTest, EncodeMatchesDecode) {
   EncodeMatchesDecodeT<bool>();
 }
 
+// Reference implementation of the integer delta encoding.
+template <typename T>
+tensorflow::Tensor ScalarDeltaEncode(const tensorflow::Tensor& tensor) {
+  tensorflow::Tensor output(tensor.dtype(), tensor.shape());
+  auto src = tensor.flat_outer_dims<T>();
+  auto dst = output.flat_outer_dims<T>();
+  for (int i = 0; i < src.dimension(0); i++) {
+    for (int j = 0; j < src.dimension(1); j++) {
+      dst(i, j) =
+          i == 0 ? src(i, j) : static_cast<T>(src(i, j) - src(i - 1, j));
+    }
+  }
+  return output;
+}
+
+template <typename T>
+void EncodeMatchesReferenceT() {
+  // Row sizes which are not multiples of the vector width exercise the scalar
+  // tail of the vectorized kernels.
+  for (int row_size : {1, 7, 16, 33, 1000}) {
+    tensorflow::Tensor tensor(tensorflow::DataTypeToEnum<T>::v(),
+                              tensorflow::TensorShape({9, row_size}));
+    tensor.flat<T>().setRandom();
+    tensorflow::Tensor encoded = DeltaEncode(tensor, true);
+    test::ExpectTensorEqual<T>(encoded, ScalarDeltaEncode<T>(tensor));
+    test::ExpectTensorEqual<T>(DeltaEncode(encoded, false), tensor);
+  }
+}
+
+TEST(TensorCompressionTest, EncodeMatchesReference) {
+#define ENCODE_MATCHES_REFERENCE(T) EncodeMatchesReferenceT<T>();
+  TF_CALL_INTEGRAL_TYPES(ENCODE_MATCHES_REFERENCE)
+#undef ENCODE_MATCHES_REFERENCE
+}
+
+template <typename T>
+void FloatEncodeMatchesDecodeT() {
+  tensorflow::Tensor tensor(tensorflow::DataTypeToEnum<T>::v(),
+                            tensorflow::TensorShape({16, 37, 6}));
+  tensor.flat<T>().setRandom();
+
+  // Floats are left untouched unless explicitly included.
+  test::ExpectTensorEqual<T>(DeltaEncode(tensor, true), tensor);
+
+  tensorflow::Tensor encoded =
+      DeltaEncode(tensor, true, /*include_floats=*/true);
+  EXPECT_NE(encoded.tensor_data(), tensor.tensor_data());
+  tensorflow::Tensor decoded =
+      DeltaEncode(encoded, false, /*include_floats=*/true);
+  EXPECT_EQ(decoded.tensor_data(), tensor.tensor_data());
+}
+
+TEST(TensorCompressionTest, FloatEncodeMatchesDecode) {
+  FloatEncodeMatchesDecodeT<Eigen::half>();
+  FloatEncodeMatchesDecodeT<float>();
+  FloatEncodeMatchesDecodeT<double>();
+}
+
+TEST(TensorCompressionTest, FloatEncodeZeroesRepeatedSteps) {
+  tensorflow::Tensor tensor(tensorflow::DT_FLOAT,
+                            tensorflow::TensorShape({4, 3}));
+  tensor.flat<float>().setConstant(1.5);
+
+  tensorflow::Tensor encoded =
+      DeltaEncode(tensor, true, /*include_floats=*/true);
+  auto values = encoded.flat_outer_dims<float>();
+  for (int j = 0; j < 3; j++) {
+    EXPECT_EQ(values(0, j), 1.5);
+    for (int i = 1; i < 4; i++) {
+      EXPECT_EQ(values(i, j), 0);
+    }
+  }
+}
+
 TEST(TensorCompressionTest, EncodeListMatchesDecode) {
   tensorflow::Tensor tensor(tensorflow::DT_INT32,
                             tensorflow::TensorShape({16, 37, 6}));
@@ -98,6 +176,458 @@ TEST(TensorCompressionTest, NonStringTensorWithDeltaEncoding) {
   test::ExpectTensorEqual<int>(tensor, DeltaEncode(result, false));
 }
 
+CompressionOptions MakeCompressionOptions(CompressionCodec codec,
+                                          int level = 0) {
+  CompressionOptions options;
+  options.set_codec(codec);
+  options.set_level(level);
+  return options;
+}
+
+class TensorCompressionCodecTest
+    : public ::testing::TestWithParam<CompressionOptions> {};
+
+TEST_P(TensorCompressionCodecTest, StringTensor) {
+  tensorflow::Tensor tensor(tensorflow::DT_STRING,
+                            tensorflow::TensorShape({3}));
+  tensor.flat<tensorflow::tstring>()(0) = "hello";
+  tensor.flat<tensorflow::tstring>()(1) = "";
+  tensor.flat<tensorflow::tstring>()(2) = std::string(100000, 'x');
+
+  tensorflow::TensorProto proto;
+  CompressTensorAsProto(tensor, GetParam(), &proto);
+
+  tensorflow::Tensor result =
+      DecompressTensorFromProto(proto, GetParam().codec());
+  test::ExpectTensorEqual<tensorflow::tstring>(tensor, result);
+}
+
+TEST_P(TensorCompressionCodecTest, NonStringTensor) {
+  tensorflow::Tensor tensor(tensorflow::DT_FLOAT,
+                            tensorflow::TensorShape({16, 37, 6}));
+  tensor.flat<float>().setRandom();
+
+  tensorflow::TensorProto proto;
+  CompressTensorAsProto(tensor, GetParam(), &proto);
+
+  tensorflow::Tensor result =
+      DecompressTensorFromProto(proto, GetParam().codec());
+  test::ExpectTensorEqual<float>(tensor, result);
+}
+
+TEST_P(TensorCompressionCodecTest, EmptyTensor) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({0, 3}));
+
+  tensorflow::TensorProto proto;
+  CompressTensorAsProto(tensor, GetParam(), &proto);
+
+  tensorflow::Tensor result =
+      DecompressTensorFromProto(proto, GetParam().codec());
+  test::ExpectTensorEqual<int>(tensor, result);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Codecs, TensorCompressionCodecTest,
+    ::testing::Values(MakeCompressionOptions(COMPRESSION_CODEC_SNAPPY),
+                      MakeCompressionOptions(COMPRESSION_CODEC_NONE),
+                      MakeCompressionOptions(COMPRESSION_CODEC_ZLIB),
+                      MakeCompressionOptions(COMPRESSION_CODEC_ZLIB, 1),
+                      MakeCompressionOptions(COMPRESSION_CODEC_ZLIB, 9)));
+
+TEST(TensorCompressionTest, DefaultCodecIsSnappy) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({16, 37}));
+  tensor.flat<int>().setConstant(1);
+
+  tensorflow::TensorProto expected;
+  CompressTensorAsProto(
+      tensor, MakeCompressionOptions(COMPRESSION_CODEC_SNAPPY), &expected);
+  tensorflow::TensorProto proto;
+  CompressTensorAsProto(tensor, &proto);
+  EXPECT_EQ(proto.tensor_content(), expected.tensor_content());
+}
+
+TEST(TensorCompressionTest, ZlibCompressesStringTensors) {
+  tensorflow::Tensor tensor(tensorflow::DT_STRING,
+                            tensorflow::TensorShape({1}));
+  tensor.flat<tensorflow::tstring>()(0) = std::string(100000, 'x');
+
+  tensorflow::TensorProto snappy;
+  CompressTensorAsProto(
+      tensor, MakeCompressionOptions(COMPRESSION_CODEC_SNAPPY), &snappy);
+  tensorflow::TensorProto zlib;
+  CompressTensorAsProto(tensor, MakeCompressionOptions(COMPRESSION_CODEC_ZLIB),
+                        &zlib);
+  EXPECT_LT(zlib.ByteSizeLong(), snappy.ByteSizeLong() / 10);
+}
+
+TEST(TensorCompressionTest, GetChunkColumnCodec) {
+  ChunkData chunk;
+  chunk.mutable_data()->add_tensors();
+  chunk.mutable_data()->add_tensors();
+  EXPECT_EQ(GetChunkColumnCodec(chunk, 0), COMPRESSION_CODEC_SNAPPY);
+  EXPECT_EQ(GetChunkColumnCodec(chunk, 1), COMPRESSION_CODEC_SNAPPY);
+
+  chunk.add_codecs(COMPRESSION_CODEC_NONE);
+  chunk.add_codecs(COMPRESSION_CODEC_ZLIB);
+  EXPECT_EQ(GetChunkColumnCodec(chunk, 0), COMPRESSION_CODEC_NONE);
+  EXPECT_EQ(GetChunkColumnCodec(chunk, 1), COMPRESSION_CODEC_ZLIB);
+}
+
+// Slices of tensors may be unaligned and can't be compared directly.
+tensorflow::Tensor Aligned(const tensorflow::Tensor& tensor) {
+  return tensorflow::tensor::DeepCopy(tensor);
+}
+
+TEST(TensorCompressionTest, ChunkColumnWithoutBlocks) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({10, 3}));
+  tensor.flat<int>().setRandom();
+
+  ChunkData chunk;
+  chunk.set_delta_encoded(true);
+  CompressChunkColumn(
+      tensor, MakeCompressionOptions(COMPRESSION_CODEC_ZLIB), &chunk);
+  EXPECT_EQ(chunk.block_length(), 0);
+  EXPECT_EQ(chunk.data().blocks_size(), 0);
+  EXPECT_EQ(GetChunkColumnCodec(chunk, 0), COMPRESSION_CODEC_ZLIB);
+  EXPECT_EQ(ChunkColumnNumRows(chunk, 0), 10);
+
+  test::ExpectTensorEqual<int>(DecompressChunkColumn(chunk, 0), tensor);
+  test::ExpectTensorEqual<int>(Aligned(DecompressChunkColumn(chunk, 0, 3, 4)),
+                               Aligned(tensor.Slice(3, 7)));
+}
+
+TEST(TensorCompressionTest, ChunkColumnWithBlocks) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({10, 3}));
+  tensor.flat<int>().setRandom();
+
+  CompressionOptions options = MakeCompressionOptions(COMPRESSION_CODEC_SNAPPY);
+  options.set_block_length(4);
+
+  ChunkData chunk;
+  chunk.set_delta_encoded(true);
+  CompressChunkColumn(tensor, options, &chunk);
+  EXPECT_EQ(chunk.block_length(), 4);
+  ASSERT_EQ(chunk.data().blocks_size(), 1);
+  EXPECT_EQ(chunk.data().blocks(0).tensors_size(), 3);
+  EXPECT_TRUE(chunk.data().tensors(0).tensor_content().empty());
+  EXPECT_EQ(ChunkColumnNumRows(chunk, 0), 10);
+
+  test::ExpectTensorEqual<int>(DecompressChunkColumn(chunk, 0), tensor);
+  for (int offset = 0; offset < 10; offset++) {
+    for (int length = 0; offset + length <= 10; length++) {
+      test::ExpectTensorEqual<int>(
+          Aligned(DecompressChunkColumn(chunk, 0, offset, length)),
+          Aligned(tensor.Slice(offset, offset + length)));
+    }
+  }
+}
+
+TEST(TensorCompressionTest, ChunkColumnWithBlocksOnlyDecodesCoveredBlocks) {
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({8, 3}));
+  tensor.flat<int>().setRandom();
+
+  CompressionOptions options = MakeCompressionOptions(COMPRESSION_CODEC_NONE);
+  options.set_block_length(2);
+
+  ChunkData chunk;
+  CompressChunkColumn(tensor, options, &chunk);
+
+  // Blocks which are not covered by the rows are never decompressed so
+  // corrupting them does not affect the result.
+  chunk.mutable_data()->mutable_blocks(0)->mutable_tensors(0)->Clear();
+  chunk.mutable_data()->mutable_blocks(0)->mutable_tensors(3)->Clear();
+  test::ExpectTensorEqual<int>(Aligned(DecompressChunkColumn(chunk, 0, 2, 4)),
+                               Aligned(tensor.Slice(2, 6)));
+}
+
+TEST(TensorCompressionTest, ChunkColumnWithBlocksOfStrings) {
+  tensorflow::Tensor tensor(tensorflow::DT_STRING,
+                            tensorflow::TensorShape({5}));
+  for (int i = 0; i < 5; i++) {
+    tensor.flat<tensorflow::tstring>()(i) = std::string(i * 10, 'a' + i);
+  }
+
+  CompressionOptions options = MakeCompressionOptions(COMPRESSION_CODEC_ZLIB);
+  options.set_block_length(2);
+
+  ChunkData chunk;
+  CompressChunkColumn(tensor, options, &chunk);
+  test::ExpectTensorEqual<tensorflow::tstring>(
+      Aligned(DecompressChunkColumn(chunk, 0, 1, 3)),
+      Aligned(tensor.Slice(1, 4)));
+}
+
+// Returns `num_rows` rows of shape [2, `stack_size`, 3] where row `i` stacks
+// frames `[i, i + stack_size)` of a sequence of random frames along axis 1.
+tensorflow::Tensor MakeFrameStacks(int num_rows, int stack_size) {
+  tensorflow::Tensor frames(tensorflow::DT_UINT8,
+                            tensorflow::TensorShape({num_rows + stack_size - 1,
+                                                     2, 3}));
+  frames.flat<uint8_t>().setRandom();
+  tensorflow::Tensor tensor(tensorflow::DT_UINT8,
+                            tensorflow::TensorShape({num_rows, 2, stack_size,
+                                                     3}));
+  for (int i = 0; i < num_rows; i++) {
+    for (int j = 0; j < stack_size; j++) {
+      for (int o = 0; o < 2; o++) {
+        for (int k = 0; k < 3; k++) {
+          tensor.tensor<uint8_t, 4>()(i, o, j, k) =
+              frames.tensor<uint8_t, 3>()(i + j, o, k);
+        }
+      }
+    }
+  }
+  return tensor;
+}
+
+TEST(TensorCompressionTest, ChunkColumnAsFrameStack) {
+  tensorflow::Tensor tensor = MakeFrameStacks(/*num_rows=*/6,
+                                              /*stack_size=*/4);
+
+  CompressionOptions options = MakeCompressionOptions(COMPRESSION_CODEC_SNAPPY);
+  options.mutable_frame_stack()->set_axis(1);
+
+  ChunkData chunk;
+  chunk.set_delta_encoded(true);
+  CompressChunkColumn(tensor, options, &chunk);
+  ASSERT_TRUE(IsFrameStackColumn(chunk, 0));
+  EXPECT_TRUE(chunk.data().tensors(0).tensor_content().empty());
+  EXPECT_EQ(ChunkColumnNumRows(chunk, 0), 6);
+
+  // Every unique frame is only stored once.
+  const auto& frame_stack = chunk.data().frame_stacks(0);
+  EXPECT_EQ(frame_stack.axis(), 1);
+  EXPECT_EQ(tensorflow::TensorShape(frame_stack.frames().tensor_shape()),
+            tensorflow::TensorShape({9, 2, 3}));
+  EXPECT_EQ(frame_stack.frame_indices_size(), 6 * 4);
+
+  test::ExpectTensorEqual<uint8_t>(DecompressChunkColumn(chunk, 0), tensor);
+  for (int offset = 0; offset < 6; offset++) {
+    for (int length = 0; offset + length <= 6; length++) {
+      test::ExpectTensorEqual<uint8_t>(
+          DecompressChunkColumn(chunk, 0, offset, length),
+          Aligned(tensor.Slice(offset, offset + length)));
+    }
+  }
+}
+
+TEST(TensorCompressionTest, ChunkColumnAsFrameStackWithRepeatedRows) {
+  // Episodes often start with a stack of identical frames.
+  tensorflow::Tensor tensor(tensorflow::DT_FLOAT,
+                            tensorflow::TensorShape({3, 4, 2}));
+  tensor.flat<float>().setConstant(1.5);
+
+  CompressionOptions options = MakeCompressionOptions(COMPRESSION_CODEC_ZLIB);
+  options.mutable_frame_stack()->set_axis(1);
+
+  ChunkData chunk;
+  CompressChunkColumn(tensor, options, &chunk);
+  EXPECT_EQ(tensorflow::TensorShape(
+                chunk.data().frame_stacks(0).frames().tensor_shape()),
+            tensorflow::TensorShape({1, 4}));
+  test::ExpectTensorEqual<float>(DecompressChunkColumn(chunk, 0), tensor);
+}
+
+TEST(TensorCompressionTest, ChunkWithFrameStackAndRegularColumns) {
+  tensorflow::Tensor regular(tensorflow::DT_INT32,
+                             tensorflow::TensorShape({5, 3}));
+  regular.flat<int>().setRandom();
+  tensorflow::Tensor stacked = MakeFrameStacks(/*num_rows=*/5,
+                                               /*stack_size=*/2);
+
+  CompressionOptions stacked_options =
+      MakeCompressionOptions(COMPRESSION_CODEC_SNAPPY);
+  stacked_options.mutable_frame_stack()->set_axis(1);
+
+  ChunkData chunk;
+  CompressChunkColumn(regular, MakeCompressionOptions(COMPRESSION_CODEC_NONE),
+                      &chunk);
+  CompressChunkColumn(stacked, stacked_options, &chunk);
+  CompressChunkColumn(regular, MakeCompressionOptions(COMPRESSION_CODEC_NONE),
+                      &chunk);
+
+  EXPECT_FALSE(IsFrameStackColumn(chunk, 0));
+  EXPECT_TRUE(IsFrameStackColumn(chunk, 1));
+  EXPECT_FALSE(IsFrameStackColumn(chunk, 2));
+  EXPECT_EQ(chunk.data().frame_stacks_size(), 2);
+
+  test::ExpectTensorEqual<int>(DecompressChunkColumn(chunk, 0), regular);
+  test::ExpectTensorEqual<uint8_t>(DecompressChunkColumn(chunk, 1), stacked);
+  test::ExpectTensorEqual<int>(DecompressChunkColumn(chunk, 2), regular);
+}
+
+class DeltaEncodedChunkColumnTest
+    : public ::testing::TestWithParam<CompressionCodec> {};
+
+TEST_P(DeltaEncodedChunkColumnTest, MatchesSeparateDeltaEncoding) {
+  // Large enough to be delta encoded in several pieces which don't line up
+  // with the rows.
+  tensorflow::Tensor tensor(tensorflow::DT_INT32,
+                            tensorflow::TensorShape({300, 77}));
+  tensor.flat<int>().setRandom();
+  const CompressionOptions options = MakeCompressionOptions(GetParam());
+
+  ChunkData chunk;
+  chunk.set_delta_encoded(true);
+  CompressChunkColumn(tensor, options, &chunk);
+
+  tensorflow::TensorProto want;
+  CompressTensorAsProto(DeltaEncode(tensor, /*encode=*/true), options, &want);
+  EXPECT_EQ(chunk.data().tensors(0).tensor_content(), want.tensor_content());
+  test::ExpectTensorEqual<int>(DecompressChunkColumn(chunk, 0), tensor);
+}
+
+TEST_P(DeltaEncodedChunkColumnTest, FloatsMatchSeparateDeltaEncoding) {
+  tensorflow::Tensor tensor(tensorflow::DT_FLOAT,
+                            tensorflow::TensorShape({40, 1000}));
+  tensor.flat<float>().setRandom();
+  const CompressionOptions options = MakeCompressionOptions(GetParam());
+
+  ChunkData chunk;
+  chunk.set_delta_encoded(true);
+  chunk.set_delta_encoded_floats(true);
+  CompressChunkColumn(tensor, options, &chunk);
+
+  tensorflow::TensorProto want;
+  CompressTensorAsProto(
+      DeltaEncode(tensor, /*encode=*/true, /*include_floats=*/true), options,
+      &want);
+  EXPECT_EQ(chunk.data().tensors(0).tensor_content(), want.tensor_content());
+  test::ExpectTensorEqual<float>(DecompressChunkColumn(chunk, 0), tensor);
+}
+
+INSTANTIATE_TEST_SUITE_P(Codecs, DeltaEncodedChunkColumnTest,
+                         ::testing::Values(COMPRESSION_CODEC_SNAPPY,
+                                           COMPRESSION_CODEC_NONE,
+                                           COMPRESSION_CODEC_ZLIB));
+
+class QuantizedChunkColumnTest
+    : public ::testing::TestWithParam<std::pair<Quantization, float>> {};
+
+TEST_P(QuantizedChunkColumnTest, RestoresValuesWithinTolerance) {
+  const auto [quantization, tolerance] = GetParam();
+  tensorflow::Tensor tensor(tensorflow::DT_FLOAT,
+                            tensorflow::TensorShape({10, 3}));
+  tensor.flat<float>().setRandom();  // Uniform in [0, 1).
+
+  CompressionOptions options = MakeCompressionOptions(COMPRESSION_CODEC_ZLIB);
+  options.set_quantization(quantization);
+
+  ChunkData chunk;
+  chunk.set_delta_encoded(true);
+  chunk.set_delta_encoded_floats(true);
+  CompressChunkColumn(tensor, options, &chunk);
+  ASSERT_EQ(chunk.quantized_columns_size(), 1);
+  EXPECT_EQ(chunk.quantized_columns(0).quantization(), quantization);
+  EXPECT_NE(chunk.data().tensors(0).dtype(), tensorflow::DT_FLOAT);
+  EXPECT_EQ(ChunkColumnDtype(chunk, 0), tensorflow::DT_FLOAT);
+
+  tensorflow::Tensor got = DecompressChunkColumn(chunk, 0);
+  ASSERT_EQ(got.dtype(), tensorflow::DT_FLOAT);
+  ASSERT_EQ(got.shape(), tensor.shape());
+  for (int i = 0; i < tensor.NumElements(); i++) {
+    EXPECT_NEAR(got.flat<float>()(i), tensor.flat<float>()(i), tolerance);
+  }
+
+  tensorflow::Tensor slice = DecompressChunkColumn(chunk, 0, 4, 3);
+  test::ExpectTensorEqual<float>(Aligned(slice), Aligned(got.Slice(4, 7)));
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Quantizations, QuantizedChunkColumnTest,
+    ::testing::Values(std::make_pair(QUANTIZATION_BFLOAT16, 1.0f / 256),
+                      std::make_pair(QUANTIZATION_FLOAT16, 1.0f / 2048),
+                      std::make_pair(QUANTIZATION_AFFINE_UINT8, 1.0f / 500)));
+
+TEST(TensorCompressionTest, AffineQuantizationOfConstantColumn) {
+  tensorflow::Tensor tensor(tensorflow::DT_FLOAT,
+                            tensorflow::TensorShape({4, 2}));
+  tensor.flat<float>().setConstant(-3.25);
+
+  CompressionOptions options = MakeCompressionOptions(COMPRESSION_CODEC_NONE);
+  options.set_quantization(QUANTIZATION_AFFINE_UINT8);
+
+  ChunkData chunk;
+  CompressChunkColumn(tensor, options, &chunk);
+  EXPECT_EQ(chunk.quantized_columns(0).scale(), 0);
+  test::ExpectTensorEqual<float>(DecompressChunkColumn(chunk, 0), tensor);
+}
+
+TEST(TensorCompressionTest, AffineQuantizationIgnoresNonFiniteValues) {
+  tensorflow::Tensor tensor(tensorflow::DT_FLOAT, tensorflow::TensorShape({5}));
+  auto values = tensor.flat<float>();
+  values(0) = 1;
+  values(1) = 2;
+  values(2) = std::numeric_limits<float>::infinity();
+  values(3) = -std::numeric_limits<float>::infinity();
+  values(4) = std::numeric_limits<float>::quiet_NaN();
+
+  CompressionOptions options = MakeCompressionOptions(COMPRESSION_CODEC_NONE);
+  options.set_quantization(QUANTIZATION_AFFINE_UINT8);
+
+  ChunkData chunk;
+  CompressChunkColumn(tensor, options, &chunk);
+  EXPECT_EQ(chunk.quantized_columns(0).offset(), 1);
+  EXPECT_FLOAT_EQ(chunk.quantized_columns(0).scale(), 1.0f / 255);
+
+  auto got = DecompressChunkColumn(chunk, 0).flat<float>();
+  EXPECT_FLOAT_EQ(got(0), 1);
+  EXPECT_FLOAT_EQ(got(1), 2);
+  EXPECT_FLOAT_EQ(got(2), 2);
+  EXPECT_FLOAT_EQ(got(3), 1);
+  EXPECT_FLOAT_EQ(got(4), 1);
+}
+
+TEST(TensorCompressionTest, ChunkWithQuantizedAndRegularColumns) {
+  tensorflow::Tensor regular(tensorflow::DT_FLOAT,
+                             tensorflow::TensorShape({5, 3}));
+  regular.flat<float>().setRandom();
+
+  CompressionOptions quantized_options =
+      MakeCompressionOptions(COMPRESSION_CODEC_SNAPPY);
+  quantized_options.set_quantization(QUANTIZATION_BFLOAT16);
+
+  ChunkData chunk;
+  CompressChunkColumn(regular, MakeCompressionOptions(COMPRESSION_CODEC_NONE),
+                      &chunk);
+  CompressChunkColumn(regular, quantized_options, &chunk);
+  CompressChunkColumn(regular, MakeCompressionOptions(COMPRESSION_CODEC_NONE),
+                      &chunk);
+
+  ASSERT_EQ(chunk.quantized_columns_size(), 2);
+  EXPECT_EQ(chunk.quantized_columns(0).quantization(), QUANTIZATION_NONE);
+  EXPECT_EQ(chunk.quantized_columns(1).quantization(), QUANTIZATION_BFLOAT16);
+  test::ExpectTensorEqual<float>(DecompressChunkColumn(chunk, 0), regular);
+  test::ExpectTensorEqual<float>(DecompressChunkColumn(chunk, 2), regular);
+  EXPECT_EQ(DecompressChunkColumn(chunk, 1).dtype(), tensorflow::DT_FLOAT);
+}
+
+TEST(TensorCompressionTest, CopyChunkColumnRowsKeepsQuantizedValues) {
+  tensorflow::Tensor tensor(tensorflow::DT_FLOAT,
+                            tensorflow::TensorShape({8, 2}));
+  tensor.flat<float>().setRandom();
+
+  CompressionOptions options = MakeCompressionOptions(COMPRESSION_CODEC_ZLIB);
+  options.set_quantization(QUANTIZATION_AFFINE_UINT8);
+  ChunkData chunk;
+  CompressChunkColumn(tensor, options, &chunk);
+
+  ChunkData copy;
+  CopyChunkColumnRows(chunk, 0, 2, 5, &copy);
+  EXPECT_EQ(GetChunkColumnCodec(copy, 0), COMPRESSION_CODEC_ZLIB);
+  ASSERT_EQ(copy.quantized_columns_size(), 1);
+  EXPECT_EQ(copy.quantized_columns(0).scale(),
+            chunk.quantized_columns(0).scale());
+  test::ExpectTensorEqual<float>(
+      DecompressChunkColumn(copy, 0),
+      Aligned(DecompressChunkColumn(chunk, 0).Slice(2, 7)));
+}
+
 }  // namespace
 }  // namespace reverb
 }  // namespace deepmind
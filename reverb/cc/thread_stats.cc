@@ -15,6 +15,7 @@
 #include "reverb/cc/thread_stats.h"
 
 #include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 
@@ -49,11 +50,20 @@ int LastThreadId(const std::vector<ThreadStats>& stats) {
 std::string FormatThreadStats(const std::vector<ThreadStats>& stats) {
   std::string s = "";
   for (int i = 0; i < stats.size(); i++) {
-    absl::StrAppendFormat(&s, "\tThread[%d]:\n", i);
+    if (stats[i].thread_name.empty()) {
+      absl::StrAppendFormat(&s, "\tThread[%d]:\n", i);
+    } else {
+      absl::StrAppendFormat(&s, "\tThread[%d] (%s):\n", i,
+                            stats[i].thread_name);
+    }
     absl::StrAppendFormat(&s, "\t\tcurently processing task: %d (info: %s)\n",
                           stats[i].current_task_id, stats[i].current_task_info);
     absl::StrAppendFormat(&s, "\t\tTotal number of tasks processed: %d\n",
                           stats[i].num_tasks_processed);
+    if (!stats[i].queue_depth_per_lane.empty()) {
+      absl::StrAppendFormat(&s, "\t\tPending tasks per lane: %s\n",
+                            absl::StrJoin(stats[i].queue_depth_per_lane, ", "));
+    }
     absl::StrAppendFormat(
         &s,
         "\t\tTime the current task spent in the queue before "
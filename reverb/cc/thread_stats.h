@@ -15,6 +15,7 @@
 #ifndef REVERB_CC_THREAD_STATS_H_
 #define REVERB_CC_THREAD_STATS_H_
 
+#include <string>
 #include <vector>
 
 #include "absl/time/time.h"
@@ -41,6 +42,12 @@ struct ThreadStats {
   // Number of tasks that have been processed and completed. It doesn't include
   // the current task being processed.
   int num_tasks_processed = 0;
+  // Number of tasks waiting in each lane of the queue owned by this thread.
+  // Empty if the thread doesn't own a queue.
+  std::vector<int> queue_depth_per_lane;
+  // Name the thread was started with (e.g. the prefix of the executor owning
+  // it and its index). Empty if unknown.
+  std::string thread_name;
 };
 
 int LastThreadId(const std::vector<ThreadStats>& stats);
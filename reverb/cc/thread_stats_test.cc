@@ -65,6 +65,16 @@ TEST(ThreadStats, LastThreadIdReturnsCorrectId) {
   EXPECT_EQ(LastThreadId(stats), 2);
 }
 
+TEST(ThreadStats, FormatThreadStatsIncludesLaneDepths) {
+  std::vector<ThreadStats> stats;
+  stats.push_back(ActiveThread(absl::Now()));
+  EXPECT_THAT(FormatThreadStats(stats),
+              ::testing::Not(::testing::HasSubstr("Pending tasks per lane")));
+  stats[0].queue_depth_per_lane = {3, 7};
+  EXPECT_THAT(FormatThreadStats(stats),
+              ::testing::HasSubstr("Pending tasks per lane: 3, 7"));
+}
+
 }  // namespace
 
 }  // namespace reverb
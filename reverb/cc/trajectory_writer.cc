@@ -14,6 +14,7 @@
 
 #include "reverb/cc/trajectory_writer.h"
 
+#include <algorithm>
 #include <limits>
 #include <memory>
 #include <vector>
@@ -37,6 +38,7 @@
 #include "reverb/cc/reverb_service.pb.h"
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/support/cleanup.h"
+#include "reverb/cc/support/grpc_transport_options.h"
 #include "reverb/cc/support/grpc_util.h"
 #include "reverb/cc/support/key_generators.h"
 #include "reverb/cc/support/trajectory_util.h"
@@ -57,8 +59,32 @@ class ArenaOwnedRequest {
       r.mutable_items()->UnsafeArenaReleaseLast();
     }
     r.clear_keep_chunk_keys();
+    r.clear_release_chunk_keys();
+    num_bytes = 0;
   }
   InsertStreamRequest r;
+
+  // Sum of the sizes of the chunks and items added to `r`. Tracked separately
+  // as computing the size of the request is linear in its number of fields.
+  int64_t num_bytes = 0;
+};
+
+// Pair of requests which are used in turn so that the next request can be
+// populated while the previous one is still being written to the stream.
+class PipelinedRequests {
+ public:
+  // The request which is being populated.
+  ArenaOwnedRequest* next() { return &requests_[next_]; }
+
+  // The request which was most recently passed to `StartWrite` (if any).
+  ArenaOwnedRequest* in_flight() { return &requests_[1 - next_]; }
+
+  // Called once `next()` has been passed to `StartWrite`.
+  void Swap() { next_ = 1 - next_; }
+
+ private:
+  ArenaOwnedRequest requests_[2];
+  int next_ = 0;
 };
 
 namespace {
@@ -86,9 +112,19 @@ std::vector<FlatTrajectory::ChunkSlice> MergeAdjacent(
 }
 
 
-// Returns true if all references `refs` are ready.
-bool AllReady(absl::Span<const std::shared_ptr<CellRef>> refs) {
-  return absl::c_all_of(refs, [](const auto& ref) { return ref->IsReady(); });
+// Returns true if the chunks of all references `refs` have been finalized.
+bool AllFinalized(absl::Span<const std::shared_ptr<CellRef>> refs) {
+  return absl::c_all_of(refs,
+                        [](const auto& ref) { return ref->IsFinalized(); });
+}
+
+// Waits for the compression of the finalized chunks referenced by `refs`.
+void WaitForFinalizedChunks(absl::Span<const std::shared_ptr<CellRef>> refs) {
+  for (const auto& ref : refs) {
+    if (ref->IsFinalized()) {
+      ref->WaitUntilReady();
+    }
+  }
 }
 
 // Returns true if `set` contains all chunk keys references by `refs`.
@@ -128,47 +164,78 @@ std::vector<internal::TensorSpec> FlatSignatureFromTrajectory(
 
 bool TrajectoryWriter::WriteIfNotEmpty(
     const internal::flat_hash_set<uint64_t>& keep_keys,
-    ArenaOwnedRequest* request) {
+    internal::flat_hash_set<uint64_t>* released_chunk_keys,
+    PipelinedRequests* requests) {
+  ArenaOwnedRequest* request = requests->next();
   if (request->r.items_size() == 0 && request->r.chunks_size() == 0) {
     return true;
   }
-  for (uint64_t keep_key : keep_keys) {
-    request->r.add_keep_chunk_keys(keep_key);
-  }
-  {
-    absl::MutexLock lock(&mu_);
-    write_inflight_ = true;
+  if (!options_.release_chunks_incrementally) {
+    for (uint64_t keep_key : keep_keys) {
+      request->r.add_keep_chunk_keys(keep_key);
+    }
+  } else if (request->r.items_size() > 0) {
+    // The server only releases chunks after inserting the items of a request
+    // so the keys are held back until a request with items is written.
+    for (uint64_t released_key : *released_chunk_keys) {
+      request->r.add_release_chunk_keys(released_key);
+    }
+    released_chunk_keys->clear();
   }
-  grpc::WriteOptions options;
-  options.set_no_compression();
-  StartWrite(&request->r, options);
   {
+    // Only one write can be in flight at any given time so wait for the
+    // previous request to be written before starting the next one.
     absl::MutexLock lock(&mu_);
     auto trigger = [&]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
       return !write_inflight_ || closed_ || !stream_ok_;
     };
     mu_.Await(absl::Condition(&trigger));
-    request->Clear();
-    return !write_inflight_;
+    if (write_inflight_ || closed_ || !stream_ok_) {
+      return false;
+    }
+    requests->in_flight()->Clear();
+    write_inflight_ = true;
+
+    stats_.num_requests++;
+    stats_.num_items += request->r.items_size();
+    stats_.num_chunks += request->r.chunks_size();
+    stats_.num_bytes += request->num_bytes;
+    stats_.max_items_per_request =
+        std::max<int64_t>(stats_.max_items_per_request,
+                          request->r.items_size());
   }
+  StartWrite(&request->r, StreamWriteOptions(options_.compress_requests));
+
+  // The request is now owned by the stream until `OnWriteDone` is called. In
+  // the meantime the next request can be populated.
+  requests->Swap();
+  return true;
 }
 
 bool TrajectoryWriter::SendNotAlreadySentChunks(
     internal::flat_hash_set<uint64_t>* streamed_chunk_keys,
+    internal::flat_hash_set<uint64_t>* released_chunk_keys,
     absl::Span<const std::shared_ptr<CellRef>> refs,
-    ArenaOwnedRequest* request) {
+    PipelinedRequests* requests) {
   // Send referenced chunks which haven't already been sent.
   for (const std::shared_ptr<CellRef>& ref : refs) {
     if (!ref->IsReady() || streamed_chunk_keys->contains(ref->chunk_key())) {
       continue;
     }
+    ArenaOwnedRequest* request = requests->next();
+    const ChunkData* chunk = ref->GetChunk()->get();
     request->r.mutable_chunks()->UnsafeArenaAddAllocated(
-        const_cast<ChunkData*>(ref->GetChunk()->get()));
+        const_cast<ChunkData*>(chunk));
+    request->num_bytes += chunk->ByteSizeLong();
     streamed_chunk_keys->insert(ref->chunk_key());
+    // The chunk is sent again so it must not be released by the server when
+    // the current request has been processed.
+    released_chunk_keys->erase(ref->chunk_key());
 
     // If the message has grown beyond the cutoff point then we send it.
-    if (request->r.ByteSizeLong() >= TrajectoryWriter::kMaxRequestSizeBytes) {
-      if (!WriteIfNotEmpty(*streamed_chunk_keys, request)) {
+    if (request->num_bytes >= options_.max_request_size_bytes) {
+      if (!WriteIfNotEmpty(*streamed_chunk_keys, released_chunk_keys,
+                           requests)) {
         return false;
       }
 
@@ -184,6 +251,36 @@ absl::Status TrajectoryWriter::Options::Validate() const {
   if (chunker_options == nullptr) {
     return absl::InvalidArgumentError("chunker_options must be set.");
   }
+  if (max_items_per_request < 1 && max_items_per_request != kAutoSelectValue) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("max_items_per_request must be > 0 or ", kAutoSelectValue,
+                     " but got ", max_items_per_request, "."));
+  }
+  if (max_request_size_bytes <= 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("max_request_size_bytes must be > 0 but got ",
+                     max_request_size_bytes, "."));
+  }
+  if (max_linger_time < absl::ZeroDuration()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("max_linger_time must be >= 0 but got ",
+                     absl::FormatDuration(max_linger_time), "."));
+  }
+  if (max_ack_delay < absl::ZeroDuration()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("max_ack_delay must be >= 0 but got ",
+                     absl::FormatDuration(max_ack_delay), "."));
+  }
+  if (max_acks_per_response < 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("max_acks_per_response must be >= 0 but got ",
+                     max_acks_per_response, "."));
+  }
+  if (max_in_flight_stream_requests < 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("max_in_flight_stream_requests must be >= 0 but got ",
+                     max_in_flight_stream_requests, "."));
+  }
   return ValidateChunkerOptions(chunker_options.get());
 }
 
@@ -249,18 +346,36 @@ absl::Status TrajectoryWriter::ItemAndRefs::Validate(
 TrajectoryWriter::TrajectoryWriter(
     std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
     const Options& options)
+    : TrajectoryWriter(std::move(stub), absl::nullopt, options) {}
+
+TrajectoryWriter::TrajectoryWriter(LocalServer server, const Options& options)
+    : TrajectoryWriter(nullptr, std::move(server), options) {}
+
+TrajectoryWriter::TrajectoryWriter(
+    std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
+    absl::optional<LocalServer> local_server, const Options& options)
     : stub_(std::move(stub)),
+      local_server_(std::move(local_server)),
+      local_insert_completed_(
+          std::make_shared<Table::InsertCallback>([this](uint64_t key) {
+            absl::MutexLock lock(&mu_);
+            in_flight_items_.erase(key);
+            local_insert_blocked_ = false;
+          })),
       options_(options),
-      key_generator_(absl::make_unique<internal::UniformKeyGenerator>()),
+      key_generator_(absl::make_unique<internal::ThreadLocalKeyGenerator>()),
       episode_id_(key_generator_->Generate()),
       episode_step_(0),
       closed_(false),
+      num_pending_flushes_(0),
       stream_worker_(
           internal::StartThread("TrajectoryWriter_StreamWorker", [this] {
             absl::Duration retry_backoff = absl::Milliseconds(1);
             while (true) {
               absl::Time start_time = absl::Now();
-              absl::Status status = RunStreamWorker();
+              absl::Status status = local_server_.has_value()
+                                        ? RunLocalWorker()
+                                        : RunStreamWorker();
 
               absl::MutexLock lock(&mu_);
 
@@ -281,6 +396,7 @@ TrajectoryWriter::TrajectoryWriter(
               // of the queue is undefined and thus may differ from how they
               // were originally transmitted.
               for (auto& [_, item_and_refs] : in_flight_items_) {
+                UpdateQueuedChunkRefs(*item_and_refs, 1);
                 write_queue_.push_front(std::move(item_and_refs));
               }
               in_flight_items_.clear();
@@ -297,6 +413,7 @@ TrajectoryWriter::TrajectoryWriter(
             }
           })) {
   REVERB_CHECK_OK(options.Validate());
+  REVERB_CHECK((stub_ == nullptr) != (!local_server_.has_value()));
 }
 
 TrajectoryWriter::~TrajectoryWriter() {
@@ -334,10 +451,37 @@ absl::Status TrajectoryWriter::AppendInternal(
   CellRef::EpisodeInfo episode_info;
   {
     absl::MutexLock lock(&mu_);
-    REVERB_RETURN_IF_ERROR(unrecoverable_status_);
     episode_info = {episode_id_, episode_step_};
   }
 
+  REVERB_RETURN_IF_ERROR(
+      AppendToChunkers(std::move(data), {episode_info}, refs));
+
+  absl::MutexLock lock(&mu_);
+
+  // Sanity check that `Append`, `AppendPartial` or `EndEpisode` wasn't called
+  // concurrently.
+  REVERB_CHECK_EQ(episode_info.episode_id, episode_id_);
+  REVERB_CHECK_EQ(episode_info.step, episode_step_);
+
+  if (increment_episode_step) {
+    episode_step_++;
+  }
+
+  return absl::OkStatus();
+}
+
+absl::Status TrajectoryWriter::AppendToChunkers(
+    std::vector<absl::optional<tensorflow::Tensor>> data,
+    absl::Span<const CellRef::EpisodeInfo> episode_infos,
+    std::vector<absl::optional<std::weak_ptr<CellRef>>>* refs) {
+  REVERB_CHECK(episode_infos.size() == 1 ||
+               episode_infos.size() == data.size());
+  {
+    absl::MutexLock lock(&mu_);
+    REVERB_RETURN_IF_ERROR(unrecoverable_status_);
+  }
+
   // If this is the first time the column has been present in the data then
   // create a chunker using the spec of the item.
   for (int i = 0; i < data.size(); i++) {
@@ -352,7 +496,7 @@ absl::Status TrajectoryWriter::AppendInternal(
       chunkers_[i] = std::make_shared<Chunker>(
           internal::TensorSpec{std::to_string(i), tensor.dtype(),
                                tensor.shape()},
-          chunker_options->Clone());
+          chunker_options->Clone(), options_.compression_executor);
     }
   }
 
@@ -364,8 +508,9 @@ absl::Status TrajectoryWriter::AppendInternal(
     }
 
     std::weak_ptr<CellRef> ref;
-    absl::Status status =
-        chunkers_[i]->Append(data[i].value(), episode_info, &ref);
+    absl::Status status = chunkers_[i]->Append(
+        data[i].value(), episode_infos[episode_infos.size() == 1 ? 0 : i],
+        &ref);
     if (absl::IsFailedPrecondition(status)) {
       return absl::FailedPreconditionError(
           "Append/AppendPartial called with data containing column that was "
@@ -377,15 +522,6 @@ absl::Status TrajectoryWriter::AppendInternal(
 
   absl::MutexLock lock(&mu_);
 
-  // Sanity check that `Append`, `AppendPartial` or `EndEpisode` wasn't called
-  // concurrently.
-  REVERB_CHECK_EQ(episode_info.episode_id, episode_id_);
-  REVERB_CHECK_EQ(episode_info.step, episode_step_);
-
-  if (increment_episode_step) {
-    episode_step_++;
-  }
-
   // Wake up stream worker in case it was blocked on items referencing
   // incomplete chunks
   data_cv_.Signal();
@@ -435,6 +571,7 @@ absl::Status TrajectoryWriter::CreateItem(
 
   {
     absl::MutexLock lock(&mu_);
+    UpdateQueuedChunkRefs(*item_and_refs, 1);
     write_queue_.push_back(std::move(item_and_refs));
   }
 
@@ -463,6 +600,14 @@ void TrajectoryWriter::Close() {
 
   // Join the worker thread.
   stream_worker_ = nullptr;
+
+  // The callback references the writer so make sure that the tables can't
+  // execute it anymore.
+  std::weak_ptr<Table::InsertCallback> weak_callback = local_insert_completed_;
+  local_insert_completed_.reset();
+  while (weak_callback.lock()) {
+    absl::SleepFor(absl::Milliseconds(1));
+  }
 }
 
 void TrajectoryWriter::OnReadDone(bool ok) {
@@ -475,6 +620,9 @@ void TrajectoryWriter::OnReadDone(bool ok) {
   for (uint64_t key : response_.keys()) {
     in_flight_items_.erase(key);
   }
+  for (const TableInsertHeadroom& headroom : response_.insert_headroom()) {
+    insert_headroom_[headroom.table()] = headroom.inserts();
+  }
   StartRead(&response_);
 }
 
@@ -516,6 +664,7 @@ absl::Status TrajectoryWriter::SetContextAndCreateStream() {
   stub_->async()->InsertStream(context_.get(), this);
   stream_ok_ = true;
   stream_done_ = false;
+  insert_headroom_.clear();
   // Use a hold since some StartWrites are invoked indirectly rather than
   // directly from the reactor itself.
   AddHold();
@@ -532,11 +681,39 @@ bool TrajectoryWriter::WaitForPendingItems() {
   return !closed_ && stream_ok_;
 }
 
+bool TrajectoryWriter::WaitForInsertHeadroom(
+    const std::string& table,
+    const internal::flat_hash_set<uint64_t>& keep_keys,
+    internal::flat_hash_set<uint64_t>* released_chunk_keys,
+    PipelinedRequests* requests) {
+  auto has_headroom = [&]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    auto it = insert_headroom_.find(table);
+    return it == insert_headroom_.end() || it->second > 0;
+  };
+  {
+    absl::MutexLock lock(&mu_);
+    if (has_headroom()) return true;
+  }
+
+  // The items already added to the request don't have to wait.
+  if (!WriteIfNotEmpty(keep_keys, released_chunk_keys, requests)) {
+    return false;
+  }
+
+  absl::MutexLock lock(&mu_);
+  auto trigger = [&]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return has_headroom() || closed_ || !stream_ok_;
+  };
+  mu_.Await(absl::Condition(&trigger));
+  return !closed_ && stream_ok_;
+}
+
 void TrajectoryWriter::AddItemToRequest(
     const PrioritizedItem& item, ArenaOwnedRequest* request) {
   request->r.mutable_items()->UnsafeArenaAddAllocated(
       const_cast<PrioritizedItem*>(&item));
   request->r.clear_keep_chunk_keys();
+  request->num_bytes += item.ByteSizeLong();
 }
 
 internal::flat_hash_set<uint64_t> TrajectoryWriter::GetKeepKeys(
@@ -550,49 +727,120 @@ internal::flat_hash_set<uint64_t> TrajectoryWriter::GetKeepKeys(
     }
   }
 
-  for (auto it = write_queue_.begin(); it != write_queue_.end(); it++) {
-    // Ignore chunks only referenced by the front item since keep keys is sent
-    // together with this item and thus there is no need for the server to keep
-    // these chunks around after the item has been written.
-    if (it == write_queue_.begin()) continue;
-
-    for (const std::shared_ptr<CellRef>& ref : (*it)->refs) {
-      if (streamed_chunk_keys.contains(ref->chunk_key())) {
-        keys.insert(ref->chunk_key());
-      }
+  // Ignore chunks only referenced by the front item since keep keys is sent
+  // together with this item and thus there is no need for the server to keep
+  // these chunks around after the item has been written.
+  internal::flat_hash_map<uint64_t, int> front_refs;
+  if (!write_queue_.empty()) {
+    for (const std::shared_ptr<CellRef>& ref : write_queue_.front()->refs) {
+      front_refs[ref->chunk_key()]++;
+    }
+  }
+  for (const auto& [key, num_refs] : queued_chunk_refs_) {
+    if (!streamed_chunk_keys.contains(key)) continue;
+    auto it = front_refs.find(key);
+    if (it == front_refs.end() || it->second < num_refs) {
+      keys.insert(key);
     }
   }
 
   return keys;
 }
 
+void TrajectoryWriter::UpdateQueuedChunkRefs(const ItemAndRefs& item,
+                                             int delta) {
+  for (const std::shared_ptr<CellRef>& ref : item.refs) {
+    auto it = queued_chunk_refs_.emplace(ref->chunk_key(), 0).first;
+    if ((it->second += delta) == 0) {
+      queued_chunk_refs_.erase(it);
+    }
+  }
+}
+
 absl::Status TrajectoryWriter::RunStreamWorker() {
   REVERB_RETURN_IF_ERROR(SetContextAndCreateStream());
   internal::flat_hash_set<uint64_t> streamed_chunk_keys;
-  ArenaOwnedRequest request;
+  // Streamed chunks which are no longer needed and which the server has not
+  // yet been told to release. Only used if `release_chunks_incrementally`.
+  internal::flat_hash_set<uint64_t> released_chunk_keys;
+  PipelinedRequests requests;
+
+  // Maximum number of items to add to the current request. When a new request
+  // is started without an explicit limit this value is set to the number of
+  // currently pending items, so that all of them are written in one go, but
+  // items enqueued in the meantime are not.
+  int max_items_in_request = 0;
+
+  // When the request contains items but has room for more, it is sent once
+  // this deadline has passed without any new items becoming available.
+  absl::Time linger_deadline = absl::InfinitePast();
+
+  // The stream options are sent with the first request of the stream.
+  if (options_.max_ack_delay > absl::ZeroDuration()) {
+    auto* options = requests.next()->r.mutable_options();
+    options->set_max_ack_delay_ms(
+        absl::ToInt64Milliseconds(options_.max_ack_delay));
+    options->set_max_acks_per_response(options_.max_acks_per_response);
+  }
+  if (options_.release_chunks_incrementally) {
+    requests.next()->r.mutable_options()->set_release_chunks_incrementally(
+        true);
+  }
+  if (options_.throttle_on_insert_headroom) {
+    requests.next()->r.mutable_options()->set_push_insert_headroom(true);
+  }
 
-  // How many more items to add to the current request. When a new request is
-  // started this value is set to the number of currently pending items, so that
-  // all of them are written in one go, but items enqueued in the meantime are
-  // not.
-  int add_items_to_batch = 0;
   while (true) {
-    ItemAndRefs* item_and_refs;
+    ItemAndRefs* item_and_refs = nullptr;
     {
       absl::WriterMutexLock lock(&mu_);
-      if (!WaitForPendingItems()) {
-        break;
+      const bool request_has_items = requests.next()->r.items_size() > 0;
+      if (request_has_items && write_queue_.empty()) {
+        auto trigger = [&]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+          return !write_queue_.empty() || closed_ || !stream_ok_ ||
+                 num_pending_flushes_ > 0;
+        };
+        mu_.AwaitWithDeadline(absl::Condition(&trigger), linger_deadline);
       }
-      if (add_items_to_batch == 0) {
-        add_items_to_batch = write_queue_.size();
+      if (!request_has_items || !write_queue_.empty()) {
+        if (!WaitForPendingItems()) {
+          break;
+        }
+        if (!request_has_items) {
+          max_items_in_request =
+              options_.max_items_per_request == kAutoSelectValue
+                  ? write_queue_.size()
+                  : options_.max_items_per_request;
+        }
+        item_and_refs = write_queue_.front().get();
       }
-      item_and_refs = write_queue_.front().get();
+    }
+
+    if (item_and_refs == nullptr) {
+      // No more items arrived before the deadline so send what we have.
+      if (!WriteIfNotEmpty(streamed_chunk_keys, &released_chunk_keys,
+                           &requests)) {
+        return Finish();
+      }
+      continue;
+    }
+
+    // Chunks may still be compressed in the background so wait for them
+    // before sending the item.
+    WaitForFinalizedChunks(item_and_refs->refs);
+
+    // Don't send anything for the item while the server couldn't insert it.
+    if (options_.throttle_on_insert_headroom &&
+        !WaitForInsertHeadroom(item_and_refs->item.table(),
+                               streamed_chunk_keys, &released_chunk_keys,
+                               &requests)) {
+      return Finish();
     }
 
     // Send referenced chunks which haven't already been sent. This call also
     // inserts the new chunk keys into `streamed_chunk_keys`.
-    if (!SendNotAlreadySentChunks(&streamed_chunk_keys, item_and_refs->refs,
-                                  &request)) {
+    if (!SendNotAlreadySentChunks(&streamed_chunk_keys, &released_chunk_keys,
+                                  item_and_refs->refs, &requests)) {
       return Finish();
     }
 
@@ -601,15 +849,16 @@ absl::Status TrajectoryWriter::RunStreamWorker() {
     // worker will wait for the chunk state to change and then retry.
     if (!ContainsAll(streamed_chunk_keys, item_and_refs->refs)) {
       // Before going to sleep send ready items for better pipelining.
-      if (!WriteIfNotEmpty(streamed_chunk_keys, &request)) {
+      if (!WriteIfNotEmpty(streamed_chunk_keys, &released_chunk_keys,
+                           &requests)) {
         return Finish();
       }
       absl::WriterMutexLock lock(&mu_);
       // Do a final check that the chunks didn't change since the lock was
       // last held. If the item still references incomplete chunks then we
-      // sleep until the chunks changed. If all the chunks are now completed
+      // sleep until the chunks changed. If all the chunks are now finalized
       // then we move straight to the top of the loop.
-      if (!AllReady(item_and_refs->refs)) {
+      if (!AllFinalized(item_and_refs->refs)) {
         data_cv_.Wait(&mu_);
       }
       continue;
@@ -618,13 +867,25 @@ absl::Status TrajectoryWriter::RunStreamWorker() {
       absl::WriterMutexLock lock(&mu_);
       // Item is about to be written - move from write_queue_ to
       // in_flight_items_.
+      UpdateQueuedChunkRefs(*write_queue_.front(), -1);
       in_flight_items_[item_and_refs->item.key()] =
           std::move(write_queue_.front());
       write_queue_.pop_front();
+      if (auto it = insert_headroom_.find(item_and_refs->item.table());
+          it != insert_headroom_.end()) {
+        it->second--;
+      }
 
       // Remove keys of expired chunks from streamed_chunk_keys to avoid OOM
       // issues caused by the otherwise indefinitely growing hash set.
-      streamed_chunk_keys = GetKeepKeys(streamed_chunk_keys);
+      internal::flat_hash_set<uint64_t> keep_keys =
+          GetKeepKeys(streamed_chunk_keys);
+      if (options_.release_chunks_incrementally) {
+        for (uint64_t key : streamed_chunk_keys) {
+          if (!keep_keys.contains(key)) released_chunk_keys.insert(key);
+        }
+      }
+      streamed_chunk_keys = std::move(keep_keys);
     }
 
     for (auto& [_, chunker] : chunkers_) {
@@ -634,10 +895,16 @@ absl::Status TrajectoryWriter::RunStreamWorker() {
 
     // All chunks have been written to the stream so the item can now be
     // added to the request.
-    AddItemToRequest(item_and_refs->item, &request);
+    ArenaOwnedRequest* request = requests.next();
+    AddItemToRequest(item_and_refs->item, request);
+    if (request->r.items_size() == 1) {
+      linger_deadline = absl::Now() + options_.max_linger_time;
+    }
 
-    if (--add_items_to_batch == 0) {
-      if (!WriteIfNotEmpty(streamed_chunk_keys, &request)) {
+    if (request->r.items_size() >= max_items_in_request ||
+        request->num_bytes >= options_.max_request_size_bytes) {
+      if (!WriteIfNotEmpty(streamed_chunk_keys, &released_chunk_keys,
+                           &requests)) {
         return Finish();
       }
     }
@@ -645,6 +912,135 @@ absl::Status TrajectoryWriter::RunStreamWorker() {
   return Finish();
 }
 
+absl::Status TrajectoryWriter::GetLocalTable(absl::string_view name,
+                                             std::shared_ptr<Table>* table) {
+  auto it = local_tables_.find(name);
+  if (it == local_tables_.end()) {
+    std::shared_ptr<Table> found;
+    REVERB_RETURN_IF_ERROR(local_server_->get_table(name, &found));
+    it = local_tables_.emplace(std::string(name), std::move(found)).first;
+  }
+  *table = it->second;
+  return absl::OkStatus();
+}
+
+absl::Status TrajectoryWriter::RunLocalWorker() {
+  {
+    absl::MutexLock lock(&mu_);
+    REVERB_RETURN_IF_ERROR(unrecoverable_status_);
+    stream_ok_ = true;
+  }
+
+  // Chunks handed to the tables which may be referenced by later items. The
+  // store only holds weak references so these keep the chunks alive until an
+  // item has been inserted that references them.
+  internal::flat_hash_map<uint64_t, std::shared_ptr<ChunkStore::Chunk>> chunks;
+
+  // Identifies the writer to the tables for fair insert admission.
+  const uint64_t client_id = key_generator_->Generate();
+
+  while (true) {
+    ItemAndRefs* item_and_refs = nullptr;
+    {
+      absl::MutexLock lock(&mu_);
+      // Wait for the previous insert to complete if the table is busy.
+      auto trigger = [&]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        return !local_insert_blocked_ || closed_;
+      };
+      mu_.Await(absl::Condition(&trigger));
+      if (!WaitForPendingItems()) {
+        break;
+      }
+      item_and_refs = write_queue_.front().get();
+    }
+
+    // Chunks may still be compressed in the background so wait for them
+    // before inserting the item.
+    WaitForFinalizedChunks(item_and_refs->refs);
+
+    // If at least one chunk is incomplete then the worker waits for the chunk
+    // state to change and then retries.
+    if (!absl::c_all_of(item_and_refs->refs,
+                        [](const auto& ref) { return ref->IsReady(); })) {
+      absl::MutexLock lock(&mu_);
+      if (!closed_ && !AllFinalized(item_and_refs->refs)) {
+        data_cv_.Wait(&mu_);
+      }
+      continue;
+    }
+
+    std::shared_ptr<Table> table;
+    REVERB_RETURN_IF_ERROR(GetLocalTable(item_and_refs->item.table(), &table));
+
+    int num_new_chunks = 0;
+    for (const std::shared_ptr<CellRef>& ref : item_and_refs->refs) {
+      if (chunks.contains(ref->chunk_key())) continue;
+      // The chunk shares ownership of the data with the `CellRef`s.
+      std::shared_ptr<ChunkDataContainer> container = ref->GetChunk();
+      const ChunkData* data = container->get();
+      chunks[ref->chunk_key()] = local_server_->chunk_store->MakeChunk(
+          std::shared_ptr<const ChunkData>(std::move(container), data));
+      num_new_chunks++;
+    }
+
+    Table::Item item;
+    item.item = item_and_refs->item;
+    for (uint64_t key : internal::GetChunkKeys(item.item.flat_trajectory())) {
+      auto it = chunks.find(key);
+      if (it == chunks.end()) {
+        return absl::InternalError(
+            absl::StrCat("Could not find sequence chunk ", key, "."));
+      }
+      item.chunks.push_back(it->second);
+    }
+
+    std::shared_ptr<Table::InsertCallback> insert_completed;
+    {
+      absl::MutexLock lock(&mu_);
+      // Item is about to be inserted - move from write_queue_ to
+      // in_flight_items_.
+      UpdateQueuedChunkRefs(*write_queue_.front(), -1);
+      in_flight_items_[item_and_refs->item.key()] =
+          std::move(write_queue_.front());
+      write_queue_.pop_front();
+      local_insert_blocked_ = true;
+      insert_completed = local_insert_completed_;
+
+      // Release the chunks which can't be referenced by any future item.
+      internal::flat_hash_set<uint64_t> handed_over;
+      for (const auto& [key, _] : chunks) handed_over.insert(key);
+      internal::flat_hash_set<uint64_t> keep_keys = GetKeepKeys(handed_over);
+      for (auto it = chunks.begin(); it != chunks.end();) {
+        if (keep_keys.contains(it->first)) {
+          ++it;
+        } else {
+          chunks.erase(it++);
+        }
+      }
+
+      stats_.num_requests++;
+      stats_.num_items++;
+      stats_.num_chunks += num_new_chunks;
+      stats_.max_items_per_request =
+          std::max<int64_t>(stats_.max_items_per_request, 1);
+    }
+
+    for (auto& [_, chunker] : chunkers_) {
+      REVERB_RETURN_IF_ERROR(
+          chunker->OnItemFinalized(item_and_refs->item, item_and_refs->refs));
+    }
+
+    bool can_insert_more;
+    REVERB_RETURN_IF_ERROR(table->InsertOrAssignAsync(
+        std::move(item), &can_insert_more, insert_completed, client_id));
+    if (can_insert_more) {
+      absl::MutexLock lock(&mu_);
+      local_insert_blocked_ = false;
+    }
+  }
+  return absl::OkStatus();
+}
+
 absl::Status TrajectoryWriter::Flush(int ignore_last_num_items,
                                      absl::Duration timeout) {
   absl::MutexLock lock(&mu_);
@@ -653,6 +1049,11 @@ absl::Status TrajectoryWriter::Flush(int ignore_last_num_items,
 
 absl::Status TrajectoryWriter::FlushLocked(int ignore_last_num_items,
                                            absl::Duration timeout) {
+  // Stops the stream worker from lingering on partially filled requests.
+  num_pending_flushes_++;
+  auto decrement_pending_flushes = internal::MakeCleanup(
+      [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) { num_pending_flushes_--; });
+
   // If items are referencing any data which has not yet been finalized into a
   // `ChunkData` then force the chunk to be created prematurely. This will allow
   // the worker to write all items to the stream. Note that we don't need to
@@ -663,7 +1064,7 @@ absl::Status TrajectoryWriter::FlushLocked(int ignore_last_num_items,
     if (num_items_to_force_flush-- <= 0) break;
 
     for (const std::shared_ptr<CellRef>& ref : item->refs) {
-      if (!ref->IsReady()) {
+      if (!ref->IsFinalized()) {
         REVERB_RETURN_IF_ERROR(ref->chunker().lock()->Flush());
       }
     }
@@ -718,6 +1119,37 @@ absl::Status TrajectoryWriter::EndEpisode(bool clear_buffers,
   return absl::OkStatus();
 }
 
+absl::Status TrajectoryWriter::EndColumnEpisodes(absl::Span<const int> columns,
+                                                 bool clear_buffers) {
+  absl::MutexLock lock(&mu_);
+  REVERB_RETURN_IF_ERROR(unrecoverable_status_);
+
+  for (int column : columns) {
+    auto it = chunkers_.find(column);
+    if (it == chunkers_.end()) continue;
+
+    // Pending items may reference the active chunk so it is always finalized,
+    // even if the buffers are cleared. This call should NEVER fail but if it
+    // does then we will not be able to recover from it.
+    unrecoverable_status_ = it->second->Flush();
+    REVERB_RETURN_IF_ERROR(unrecoverable_status_);
+    if (clear_buffers) {
+      it->second->Reset();
+    }
+  }
+
+  // Wake up stream worker in case it was blocked on items referencing the
+  // chunks which were just finalized.
+  data_cv_.Signal();
+
+  return absl::OkStatus();
+}
+
+TrajectoryWriter::Stats TrajectoryWriter::stats() const {
+  absl::MutexLock lock(&mu_);
+  return stats_;
+}
+
 absl::Status TrajectoryWriter::ConfigureChunker(
     int column, const std::shared_ptr<ChunkerOptions>& options) {
   REVERB_RETURN_IF_ERROR(ValidateChunkerOptions(options.get()));
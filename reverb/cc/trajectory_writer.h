@@ -16,8 +16,10 @@
 #define REVERB_CC_TRAJECTORY_WRITER_H_
 
 #include <deque>
+#include <functional>
 #include <memory>
 #include <optional>
+#include <string>
 #include <string_view>
 #include <vector>
 
@@ -27,6 +29,7 @@
 #include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
 #include "absl/types/span.h"
+#include "reverb/cc/chunk_store.h"
 #include "reverb/cc/chunker.h"
 #include "reverb/cc/platform/hash_map.h"
 #include "reverb/cc/platform/hash_set.h"
@@ -35,13 +38,17 @@
 #include "reverb/cc/schema.pb.h"
 #include "reverb/cc/support/key_generators.h"
 #include "reverb/cc/support/signature.h"
+#include "reverb/cc/support/task_executor.h"
+#include "reverb/cc/table.h"
 #include "tensorflow/core/framework/tensor.h"
 
 namespace deepmind {
 namespace reverb {
 
-class TrajectoryColumn;   // Defined below.
-class ArenaOwnedRequest;  // Defined in trajectory_writer.cc.
+class TrajectoryColumn;          // Defined below.
+class ArenaOwnedRequest;         // Defined in trajectory_writer.cc.
+class BatchedTrajectoryWriter;   // Defined in batched_trajectory_writer.h.
+class PipelinedRequests;  // Defined in trajectory_writer.cc.
 
 // A `ColumnWriter` allows creating replay items based on sparse or partial
 // trajectories. The easiest way to explain a `ColumnWriter` is by comparing it
@@ -232,6 +239,8 @@ class TrajectoryWriter : public ColumnWriter,
   // remaining chunks are sent with other messages.
   static constexpr int64_t kMaxRequestSizeBytes = 40 * 1024 * 1024;  // 40MB.
 
+  static constexpr int kAutoSelectValue = -1;
+
   struct Options {
     // Checks that field values are valid and returns `InvalidArgument` if
     // any field value, or combination of field values, are invalid.
@@ -245,6 +254,82 @@ class TrajectoryWriter : public ColumnWriter,
     // knowledge whatsoever about the tables.
     absl::optional<internal::FlatSignatureMap> flat_signature_map =
         absl::nullopt;
+
+    // Maximum number of items packed into a single `InsertStreamRequest`
+    // (together with the chunks they reference). When set to
+    // `kAutoSelectValue`, all items pending when the request is started are
+    // packed together but items created in the meantime are not.
+    int max_items_per_request = kAutoSelectValue;
+
+    // Requests are sent once the total size of their chunks and items exceeds
+    // this value.
+    int64_t max_request_size_bytes = kMaxRequestSizeBytes;
+
+    // How long a request with room for more items is held back while waiting
+    // for more items to be created. Higher values result in fewer but larger
+    // requests at the cost of latency. `Flush` and `EndEpisode` send the
+    // request straight away.
+    absl::Duration max_linger_time = absl::ZeroDuration();
+
+    // How long the server may hold back the confirmation of an inserted item
+    // in order to send it together with the confirmations of other items.
+    // Higher values result in fewer responses at the cost of `Flush` (and
+    // `EndEpisode`) taking up to this much longer to complete.
+    absl::Duration max_ack_delay = absl::ZeroDuration();
+
+    // Held back confirmations are sent as soon as this many have accumulated.
+    // Zero means that only `max_ack_delay` applies.
+    int max_acks_per_response = 0;
+
+    // Threads on which the chunks of all columns are compressed. This keeps
+    // the compression of large columns out of `Append` and the stream worker
+    // only waits for a chunk when an item referencing it is sent. The same
+    // executor can be shared by several writers. If nullptr then chunks are
+    // compressed by the thread calling `Append`.
+    std::shared_ptr<TaskExecutor> compression_executor = nullptr;
+
+    // If true then each request only lists the chunks which the server can
+    // release (`release_chunk_keys`) rather than every chunk it has to keep
+    // (`keep_chunk_keys`). This keeps requests small when items reference many
+    // chunks but requires a server which supports
+    // `InsertStreamOptions.release_chunks_incrementally`. Only applies to
+    // writers connected to a server over gRPC.
+    bool release_chunks_incrementally = false;
+
+    // If true then the server is asked to push the insert headroom of the rate
+    // limiters of the tables written to (see
+    // `InsertStreamOptions.push_insert_headroom`) and items are held back
+    // locally, before their chunks are sent, while the headroom of their table
+    // is exhausted. This stops chunks and items from piling up in the server
+    // while inserts are blocked. Writers sharing a table each see the full
+    // headroom so the server may still briefly queue inserts. Only applies to
+    // writers connected to a server over gRPC.
+    bool throttle_on_insert_headroom = false;
+
+    // Maximum number of requests which `StreamingTrajectoryWriter` queues up
+    // for a background thread to write to the stream. `Append` and
+    // `CreateItem` only block once this many requests are waiting to be
+    // written and errors from the background thread are returned by the next
+    // call. If zero then requests are written by the calling thread. Ignored
+    // by `TrajectoryWriter`, which always writes from a background thread.
+    int max_in_flight_stream_requests = 0;
+
+    // If true then the requests are compressed with the default algorithm of
+    // the channel (see `GrpcTransportOptions::compress_streams`). Set by the
+    // `Client` creating the writer.
+    bool compress_requests = false;
+  };
+
+  // Counters of the requests written to the stream. Used to monitor how well
+  // items are coalesced into requests.
+  struct Stats {
+    int64_t num_requests = 0;
+    int64_t num_items = 0;
+    int64_t num_chunks = 0;
+    int64_t num_bytes = 0;
+
+    // The largest number of items written in a single request.
+    int64_t max_items_per_request = 0;
   };
 
   struct ItemAndRefs {
@@ -261,12 +346,30 @@ class TrajectoryWriter : public ColumnWriter,
     std::vector<std::shared_ptr<CellRef>> refs;
   };
 
+  // Server running in the same process as the writer. Rather than streaming
+  // them over gRPC, the chunks are handed to the chunk store of the server
+  // without being copied or serialized and the items are inserted straight
+  // into its tables.
+  struct LocalServer {
+    // Chunk store of the server.
+    std::shared_ptr<ChunkStore> chunk_store;
+
+    // Looks up a table of the server by name. Called once per table.
+    std::function<absl::Status(absl::string_view, std::shared_ptr<Table>*)>
+        get_table;
+  };
+
   // TODO(b/178084425): Allow chunking options to be specified for each column.
   // TODO(b/178085651): Support initiation using the table signature.
   explicit TrajectoryWriter(
       std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
       const Options& options);
 
+  // Constructs a writer which inserts into the tables of `server`. The
+  // `max_items_per_request`, `max_request_size_bytes`, `max_linger_time` and
+  // acknowledgement options have no effect as there are no requests.
+  TrajectoryWriter(LocalServer server, const Options& options);
+
   // Flushes pending items and then closes stream. If `Close` has already been
   // called then no action is taken.
   ~TrajectoryWriter() override;
@@ -308,19 +411,31 @@ class TrajectoryWriter : public ColumnWriter,
   absl::Status ConfigureChunker(int column,
                                 const std::shared_ptr<ChunkerOptions>& options);
 
+  // Returns the counters of the requests written so far.
+  Stats stats() const ABSL_LOCKS_EXCLUDED(mu_);
+
   // Async GRPC callback handlers.
   void OnReadDone(bool ok) override;
   void OnWriteDone(bool ok) override;
   void OnDone(const ::grpc::Status& s) override;
 
  private:
+  friend BatchedTrajectoryWriter;
+
   using InsertStream = grpc::ClientReaderWriterInterface<InsertStreamRequest,
                                                          InsertStreamResponse>;
 
+  // Constructor both public constructors delegate to. Exactly one of `stub`
+  // and `local_server` must be set.
+  TrajectoryWriter(
+      std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
+      absl::optional<LocalServer> local_server, const Options& options);
+
   bool SendNotAlreadySentChunks(
       internal::flat_hash_set<uint64_t>* streamed_chunk_keys,
+      internal::flat_hash_set<uint64_t>* released_chunk_keys,
       absl::Span<const std::shared_ptr<CellRef>> refs,
-      ArenaOwnedRequest* request);
+      PipelinedRequests* requests);
 
   // See `Append` and `AppendPartial`.
   absl::Status AppendInternal(
@@ -329,6 +444,22 @@ class TrajectoryWriter : public ColumnWriter,
       std::vector<absl::optional<std::weak_ptr<CellRef>>>* refs)
       ABSL_LOCKS_EXCLUDED(mu_);
 
+  // Appends `data` to the column chunkers without reading or updating the
+  // episode state of the writer. `episode_infos` either holds a single element
+  // which is used for all columns or one element per column of `data`. Used by
+  // `BatchedTrajectoryWriter` to track the episodes of each environment.
+  absl::Status AppendToChunkers(
+      std::vector<absl::optional<tensorflow::Tensor>> data,
+      absl::Span<const CellRef::EpisodeInfo> episode_infos,
+      std::vector<absl::optional<std::weak_ptr<CellRef>>>* refs)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Finalizes the active chunks of `columns` and, if `clear_buffers` is true,
+  // invalidates the `CellRef`s of the columns. Used by
+  // `BatchedTrajectoryWriter` to end the episode of a single environment.
+  absl::Status EndColumnEpisodes(absl::Span<const int> columns,
+                                 bool clear_buffers) ABSL_LOCKS_EXCLUDED(mu_);
+
   // Sends all but the last `ignore_last_num_items` pending items and awaits
   // confirmation. Incomplete chunks referenced by non ignored items are
   // finalized and transmitted.
@@ -345,6 +476,15 @@ class TrajectoryWriter : public ColumnWriter,
   // by `worker_thread_`.
   absl::Status RunStreamWorker();
 
+  // Like `RunStreamWorker` but hands the chunks and items of the pending items
+  // straight to `local_server_`. Runs until `closed_` is set or an error is
+  // encountered.
+  absl::Status RunLocalWorker();
+
+  // Looks up (and caches) a table of `local_server_`.
+  absl::Status GetLocalTable(absl::string_view name,
+                             std::shared_ptr<Table>* table);
+
   // Sets `context_` and opens a gRPC InsertStream to the server iff the writer
   // has not yet been closed.
   absl::Status SetContextAndCreateStream() ABSL_LOCKS_EXCLUDED(mu_);
@@ -354,16 +494,31 @@ class TrajectoryWriter : public ColumnWriter,
   // items.
   bool WaitForPendingItems() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
+  // Blocks while the last pushed headroom of `table` (minus the items written
+  // since) is exhausted. The pending request is written before blocking.
+  // False is returned when the writer should terminate without processing
+  // further items.
+  bool WaitForInsertHeadroom(
+      const std::string& table,
+      const internal::flat_hash_set<uint64_t>& keep_keys,
+      internal::flat_hash_set<uint64_t>* released_chunk_keys,
+      PipelinedRequests* requests) ABSL_LOCKS_EXCLUDED(mu_);
+
   // Add an item to the insertion request. All chunks
   // referenced by item must have been written to the stream before calling this
   // method.
   void AddItemToRequest(const PrioritizedItem& item,
                         ArenaOwnedRequest* request);
 
-  // Sends a given request to the server (if not empty). Tells server to keep
-  // specified chunks for processing further requests.
+  // Starts writing the next request of `requests` to the server (if not
+  // empty) once the previous write has completed. Tells server to keep
+  // specified chunks for processing further requests, or if
+  // `release_chunks_incrementally` is set, to release `released_chunk_keys`
+  // (which is then cleared). Returns without waiting for the write to complete
+  // so the caller can populate the next request in the meantime.
   bool WriteIfNotEmpty(const internal::flat_hash_set<uint64_t>& keep_keys,
-                       ArenaOwnedRequest* request) ABSL_LOCKS_EXCLUDED(mu_);
+                       internal::flat_hash_set<uint64_t>* released_chunk_keys,
+                       PipelinedRequests* requests) ABSL_LOCKS_EXCLUDED(mu_);
 
   // Terminates connection to the server.
   absl::Status Finish() ABSL_LOCKS_EXCLUDED(mu_);
@@ -377,9 +532,25 @@ class TrajectoryWriter : public ColumnWriter,
       const internal::flat_hash_set<uint64_t>& streamed_chunk_keys) const
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
+  // Adds `delta` to the counts in `queued_chunk_refs_` of the chunks referenced
+  // by `item`. Must be called whenever an item enters or leaves `write_queue_`.
+  void UpdateQueuedChunkRefs(const ItemAndRefs& item, int delta)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   // Stub used to create InsertStream gRPC streams.
   std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub_;
 
+  // Set instead of `stub_` when the server runs in the same process.
+  const absl::optional<LocalServer> local_server_;
+
+  // Tables of `local_server_` which have been looked up. Only accessed by
+  // `stream_worker_`.
+  internal::flat_hash_map<std::string, std::shared_ptr<Table>> local_tables_;
+
+  // Called by the tables of `local_server_` when an item has been inserted.
+  // Reset by `Close` (after which no callbacks are accepted).
+  std::shared_ptr<Table::InsertCallback> local_insert_completed_;
+
   // Configuration options.
   Options options_;
 
@@ -406,6 +577,13 @@ class TrajectoryWriter : public ColumnWriter,
   // True if `Close` has been called.
   bool closed_ ABSL_GUARDED_BY(mu_);
 
+  // Number of active `FlushLocked` calls. The stream worker doesn't hold back
+  // partially filled requests while this is > 0.
+  int num_pending_flushes_ ABSL_GUARDED_BY(mu_);
+
+  // Counters of the requests written to the stream.
+  Stats stats_ ABSL_GUARDED_BY(mu_);
+
   // Set if a non transient error encountered by the stream worker or if `Close`
   // has been called. In the latter case `unrecoverable_status_` will be set to
   // `CancelledError`.
@@ -414,6 +592,12 @@ class TrajectoryWriter : public ColumnWriter,
   // Items waiting for `stream_worker_` to write it to the steam.
   std::deque<std::unique_ptr<ItemAndRefs>> write_queue_ ABSL_GUARDED_BY(mu_);
 
+  // Number of refs of the items in `write_queue_` to each chunk. Lets
+  // `GetKeepKeys` find the chunks needed by pending items without scanning
+  // every ref of every pending item.
+  internal::flat_hash_map<uint64_t, int> queued_chunk_refs_
+      ABSL_GUARDED_BY(mu_);
+
   // Items which have been written to the stream but for which no confirmation
   // has yet been received from the server. Note that we have to keep the item
   // alive until the confirmation has been received so that we are able to
@@ -421,6 +605,12 @@ class TrajectoryWriter : public ColumnWriter,
   internal::flat_hash_map<uint64_t, std::unique_ptr<ItemAndRefs>> in_flight_items_
       ABSL_GUARDED_BY(mu_);
 
+  // Insert headroom last pushed by the server for each table, decremented for
+  // every item written since. Tables without an entry are not throttled. Only
+  // used if `throttle_on_insert_headroom` and reset with every new stream.
+  internal::flat_hash_map<std::string, int64_t> insert_headroom_
+      ABSL_GUARDED_BY(mu_);
+
   // We signal when a chunk is flushed in case the stream worker backed off due
   // to the front item of `write_queue_` referencing incomplete chunks.
   absl::CondVar data_cv_ ABSL_GUARDED_BY(mu_);
@@ -450,6 +640,10 @@ class TrajectoryWriter : public ColumnWriter,
 
   // In case `stream_done_` == false, tha status of the terminated connection.
   absl::Status stream_status_ ABSL_GUARDED_BY(mu_);
+
+  // True if a table of `local_server_` asked the writer to wait for the
+  // previous insert to complete before inserting more items.
+  bool local_insert_blocked_ ABSL_GUARDED_BY(mu_) = false;
 };
 
 class TrajectoryColumn {
@@ -14,6 +14,7 @@
 
 #include "reverb/cc/trajectory_writer.h"
 
+#include <cfloat>
 #include <limits>
 #include <memory>
 #include <string>
@@ -36,15 +37,20 @@
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "absl/types/optional.h"
+#include "reverb/cc/chunk_store.h"
 #include "reverb/cc/chunker.h"
 #include "reverb/cc/platform/logging.h"
 #include "reverb/cc/platform/status_matchers.h"
 #include "reverb/cc/platform/thread.h"
 #include "reverb/cc/reverb_service.grpc.pb.h"
 #include "reverb/cc/reverb_service.pb.h"
+#include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/reverb_service_mock.grpc.pb.h"
+#include "reverb/cc/selectors/fifo.h"
 #include "reverb/cc/support/queue.h"
 #include "reverb/cc/support/signature.h"
+#include "reverb/cc/support/task_executor.h"
+#include "reverb/cc/table.h"
 #include "reverb/cc/testing/proto_test_util.h"
 #include "reverb/cc/testing/tensor_testutil.h"
 #include "tensorflow/core/framework/tensor.h"
@@ -59,6 +65,7 @@ namespace reverb {
 namespace {
 
 using ::testing::ElementsAre;
+using ::testing::IsEmpty;
 using ::testing::Return;
 using ::testing::ReturnNew;
 using ::testing::UnorderedElementsAre;
@@ -195,6 +202,18 @@ class FakeStream : public ::grpc::ClientCallbackReaderWriter<
     status_ = status;
   }
 
+  // Headroom of "table" included in subsequent responses.
+  void SetInsertHeadroom(int64_t inserts) {
+    absl::MutexLock lock(&mu_);
+    insert_headroom_ = inserts;
+  }
+
+  // Sends a response with the headroom but without any confirmations.
+  void PushInsertHeadroom(int64_t inserts) {
+    SetInsertHeadroom(inserts);
+    ConfirmItems(0);
+  }
+
   void BlockUntilNumRequestsIs(int size) const {
     absl::MutexLock lock(&mu_);
     auto trigger = [size, this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
@@ -210,6 +229,11 @@ class FakeStream : public ::grpc::ClientCallbackReaderWriter<
         response_->add_keys(pending_confirmation_.front());
         pending_confirmation_.pop();
       }
+      if (insert_headroom_.has_value()) {
+        auto* headroom = response_->add_insert_headroom();
+        headroom->set_table("table");
+        headroom->set_inserts(*insert_headroom_);
+      }
       response_ = nullptr;
     }
     reactor_->OnReadDone(true);
@@ -248,6 +272,7 @@ class FakeStream : public ::grpc::ClientCallbackReaderWriter<
       nullptr;
   const bool generate_responses_;
   grpc::Status status_ = ::grpc::Status::OK;
+  absl::optional<int64_t> insert_headroom_ ABSL_GUARDED_BY(mu_);
 };
 
 class AsyncInterface : public ::deepmind::reverb::/* grpc_gen:: */ReverbService::
@@ -284,6 +309,24 @@ class AsyncInterface : public ::deepmind::reverb::/* grpc_gen:: */ReverbService:
                     const ::deepmind::reverb::MutatePrioritiesRequest* request,
                     ::deepmind::reverb::MutatePrioritiesResponse* response,
                     ::grpc::ClientUnaryReactor* reactor));
+  MOCK_METHOD(
+      void, MutatePrioritiesStream,
+      (::grpc::ClientContext*,
+       (::grpc::ClientBidiReactor<::deepmind::reverb::MutatePrioritiesRequest,
+                                  ::deepmind::reverb::MutatePrioritiesResponse>*
+            reactor)));
+  MOCK_METHOD(
+      void, TransformPriorities,
+      (::grpc::ClientContext*,
+       const ::deepmind::reverb::TransformPrioritiesRequest* request,
+       ::deepmind::reverb::TransformPrioritiesResponse* response,
+       std::function<void(::grpc::Status)>));
+  MOCK_METHOD(
+      void, TransformPriorities,
+      (::grpc::ClientContext*,
+       const ::deepmind::reverb::TransformPrioritiesRequest* request,
+       ::deepmind::reverb::TransformPrioritiesResponse* response,
+       ::grpc::ClientUnaryReactor* reactor));
   MOCK_METHOD(void, Reset, (::grpc::ClientContext*,
                            const ::deepmind::reverb::ResetRequest* request,
                            ::deepmind::reverb::ResetResponse* response,
@@ -292,11 +335,46 @@ class AsyncInterface : public ::deepmind::reverb::/* grpc_gen:: */ReverbService:
                            const ::deepmind::reverb::ResetRequest* request,
                            ::deepmind::reverb::ResetResponse* response,
                            ::grpc::ClientUnaryReactor* reactor));
+  MOCK_METHOD(void, LockProfile,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::LockProfileRequest* request,
+               ::deepmind::reverb::LockProfileResponse* response,
+               std::function<void(::grpc::Status)>));
+  MOCK_METHOD(void, LockProfile,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::LockProfileRequest* request,
+               ::deepmind::reverb::LockProfileResponse* response,
+               ::grpc::ClientUnaryReactor* reactor));
+  MOCK_METHOD(void, DumpTrace,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::DumpTraceRequest* request,
+               ::deepmind::reverb::DumpTraceResponse* response,
+               std::function<void(::grpc::Status)>));
+  MOCK_METHOD(void, DumpTrace,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::DumpTraceRequest* request,
+               ::deepmind::reverb::DumpTraceResponse* response,
+               ::grpc::ClientUnaryReactor* reactor));
+  MOCK_METHOD(void, CheckpointStatus,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::CheckpointStatusRequest* request,
+               ::deepmind::reverb::CheckpointStatusResponse* response,
+               std::function<void(::grpc::Status)>));
+  MOCK_METHOD(void, CheckpointStatus,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::CheckpointStatusRequest* request,
+               ::deepmind::reverb::CheckpointStatusResponse* response,
+               ::grpc::ClientUnaryReactor* reactor));
   MOCK_METHOD(
       void, SampleStream,
       ((::grpc::ClientContext*),
        (::grpc::ClientBidiReactor<::deepmind::reverb::SampleStreamRequest,
                                   ::deepmind::reverb::SampleStreamResponse>*)));
+  MOCK_METHOD(
+      void, GetItems,
+      ((::grpc::ClientContext*),
+       (::grpc::ClientBidiReactor<::deepmind::reverb::GetItemsRequest,
+                                  ::deepmind::reverb::SampleStreamResponse>*)));
   MOCK_METHOD(void, ServerInfo,
                (::grpc::ClientContext*,
                     const ::deepmind::reverb::ServerInfoRequest* request,
@@ -369,6 +447,36 @@ class MockReverbServiceAsyncStub
               (::grpc::ClientContext*,
                const ::deepmind::reverb::MutatePrioritiesRequest& request,
                ::grpc::CompletionQueue*));
+  MOCK_METHOD((::grpc::ClientReaderWriterInterface<
+                  ::deepmind::reverb::MutatePrioritiesRequest,
+                  ::deepmind::reverb::MutatePrioritiesResponse>*),
+              MutatePrioritiesStreamRaw, (::grpc::ClientContext*));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::MutatePrioritiesRequest,
+                  ::deepmind::reverb::MutatePrioritiesResponse>*),
+              AsyncMutatePrioritiesStreamRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*, void* tag));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::MutatePrioritiesRequest,
+                  ::deepmind::reverb::MutatePrioritiesResponse>*),
+              PrepareAsyncMutatePrioritiesStreamRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::Status, TransformPriorities,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::TransformPrioritiesRequest& request,
+               ::deepmind::reverb::TransformPrioritiesResponse* response));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::TransformPrioritiesResponse>*,
+              AsyncTransformPrioritiesRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::TransformPrioritiesRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::TransformPrioritiesResponse>*,
+              PrepareAsyncTransformPrioritiesRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::TransformPrioritiesRequest& request,
+               ::grpc::CompletionQueue*));
   MOCK_METHOD(::grpc::Status, Reset,
               (::grpc::ClientContext*,
                const ::deepmind::reverb::ResetRequest& request,
@@ -385,6 +493,54 @@ class MockReverbServiceAsyncStub
               (::grpc::ClientContext*,
                const ::deepmind::reverb::ResetRequest& request,
                ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::Status, LockProfile,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::LockProfileRequest& request,
+               ::deepmind::reverb::LockProfileResponse* response));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::LockProfileResponse>*,
+              AsyncLockProfileRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::LockProfileRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::LockProfileResponse>*,
+              PrepareAsyncLockProfileRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::LockProfileRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::Status, DumpTrace,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::DumpTraceRequest& request,
+               ::deepmind::reverb::DumpTraceResponse* response));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::DumpTraceResponse>*,
+              AsyncDumpTraceRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::DumpTraceRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::DumpTraceResponse>*,
+              PrepareAsyncDumpTraceRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::DumpTraceRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::Status, CheckpointStatus,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::CheckpointStatusRequest& request,
+               ::deepmind::reverb::CheckpointStatusResponse* response));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::CheckpointStatusResponse>*,
+              AsyncCheckpointStatusRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::CheckpointStatusRequest& request,
+               ::grpc::CompletionQueue*));
+  MOCK_METHOD(::grpc::ClientAsyncResponseReaderInterface<
+                  ::deepmind::reverb::CheckpointStatusResponse>*,
+              PrepareAsyncCheckpointStatusRaw,
+              (::grpc::ClientContext*,
+               const ::deepmind::reverb::CheckpointStatusRequest& request,
+               ::grpc::CompletionQueue*));
   MOCK_METHOD((::grpc::ClientReaderWriterInterface<
                   ::deepmind::reverb::SampleStreamRequest,
                   ::deepmind::reverb::SampleStreamResponse>*),
@@ -399,6 +555,20 @@ class MockReverbServiceAsyncStub
                   ::deepmind::reverb::SampleStreamResponse>*),
               PrepareAsyncSampleStreamRaw,
               (::grpc::ClientContext*, ::grpc::CompletionQueue*));
+  MOCK_METHOD((::grpc::ClientReaderWriterInterface<
+                  ::deepmind::reverb::GetItemsRequest,
+                  ::deepmind::reverb::SampleStreamResponse>*),
+              GetItemsRaw, (::grpc::ClientContext*));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::GetItemsRequest,
+                  ::deepmind::reverb::SampleStreamResponse>*),
+              AsyncGetItemsRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*, void* tag));
+  MOCK_METHOD((::grpc::ClientAsyncReaderWriterInterface<
+                  ::deepmind::reverb::GetItemsRequest,
+                  ::deepmind::reverb::SampleStreamResponse>*),
+              PrepareAsyncGetItemsRaw,
+              (::grpc::ClientContext*, ::grpc::CompletionQueue*));
   MOCK_METHOD(::grpc::Status, ServerInfo,
               (::grpc::ClientContext*,
                const ::deepmind::reverb::ServerInfoRequest&,
@@ -709,7 +879,7 @@ TEST(TrajectoryWriter, ItemSentStraightAwayIfChunksReady) {
   REVERB_ASSERT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &refs));
 
   // Nothing sent before the item created.
-  EXPECT_THAT(async.stream_.requests(), ::testing::IsEmpty());
+  EXPECT_THAT(async.stream_.requests(), IsEmpty());
 
   // The chunk is completed so inserting an item should result in both chunk
   // and item being sent.
@@ -749,7 +919,7 @@ TEST(TrajectoryWriter, ItemIsSentWhenAllChunksDone) {
                                      MakeTrajectory({{first[0]}, {first[1]}})));
 
   // No data is sent yet since the chunks are not completed.
-  EXPECT_THAT(async.stream_.requests(), ::testing::IsEmpty());
+  EXPECT_THAT(async.stream_.requests(), IsEmpty());
 
   // In the second step we only write to the first column. Only a single chunk
   // is being transmitted.
@@ -782,6 +952,38 @@ TEST(TrajectoryWriter, ItemIsSentWhenAllChunksDone) {
               ElementsAre(IsChunk(), HasNumChunksAndItems(1, 1)));
 }
 
+TEST(TrajectoryWriter, ItemIsSentOnceChunksCompressedByExecutor) {
+  AsyncInterface async;
+  auto stub = std::make_shared<MockReverbServiceAsyncStub>();
+  EXPECT_CALL(*stub, async()).WillOnce(Return(&async));
+
+  // Block the only thread of the executor so the chunks can't be compressed.
+  auto executor = std::make_shared<TaskExecutor>(1, "Compression");
+  absl::Notification unblock;
+  executor->Schedule([&] { unblock.WaitForNotification(); });
+
+  auto options =
+      MakeOptions(/*max_chunk_length=*/1, /*num_keep_alive_refs=*/1);
+  options.compression_executor = executor;
+  TrajectoryWriter writer(stub, options);
+
+  StepRef refs;
+  REVERB_ASSERT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &refs));
+  EXPECT_TRUE(refs[0]->lock()->IsFinalized());
+  EXPECT_FALSE(refs[0]->lock()->IsReady());
+
+  REVERB_ASSERT_OK(
+      writer.CreateItem("table", 1.0, MakeTrajectory({{refs[0]}})));
+
+  // Nothing can be sent until the chunk has been compressed.
+  absl::SleepFor(absl::Milliseconds(10));
+  EXPECT_THAT(async.stream_.requests(), IsEmpty());
+
+  unblock.Notify();
+  async.stream_.BlockUntilNumRequestsIs(1);
+  EXPECT_THAT(async.stream_.requests(), ElementsAre(IsChunkAndItem()));
+}
+
 TEST(TrajectoryWriter, ItemsAreBatched) {
   AsyncInterface async;
   auto stub = std::make_shared<MockReverbServiceAsyncStub>();
@@ -812,6 +1014,80 @@ TEST(TrajectoryWriter, ItemsAreBatched) {
   }
 }
 
+TEST(TrajectoryWriter, LingeringRequestIsSentWhenFull) {
+  AsyncInterface async;
+  auto stub = std::make_shared<MockReverbServiceAsyncStub>();
+  EXPECT_CALL(*stub, async()).WillOnce(Return(&async));
+
+  auto options =
+      MakeOptions(/*max_chunk_length=*/1, /*num_keep_alive_refs=*/1);
+  options.max_items_per_request = 3;
+  options.max_linger_time = absl::Hours(1);
+  TrajectoryWriter writer(stub, options);
+
+  StepRef refs;
+  REVERB_ASSERT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &refs));
+
+  // The request is held back until it contains three items.
+  for (int i = 0; i < 3; i++) {
+    EXPECT_THAT(async.stream_.requests(), IsEmpty());
+    REVERB_ASSERT_OK(
+        writer.CreateItem("table", 1.0, MakeTrajectory({{refs[0]}})));
+  }
+  async.stream_.BlockUntilNumRequestsIs(1);
+  EXPECT_THAT(async.stream_.requests()[0], HasNumChunksAndItems(1, 3));
+
+  auto stats = writer.stats();
+  EXPECT_EQ(stats.num_requests, 1);
+  EXPECT_EQ(stats.num_items, 3);
+  EXPECT_EQ(stats.num_chunks, 1);
+  EXPECT_GT(stats.num_bytes, 0);
+  EXPECT_EQ(stats.max_items_per_request, 3);
+}
+
+TEST(TrajectoryWriter, FlushSendsLingeringRequest) {
+  AsyncInterface async;
+  auto stub = std::make_shared<MockReverbServiceAsyncStub>();
+  EXPECT_CALL(*stub, async()).WillOnce(Return(&async));
+
+  auto options =
+      MakeOptions(/*max_chunk_length=*/1, /*num_keep_alive_refs=*/1);
+  options.max_items_per_request = 10;
+  options.max_linger_time = absl::Hours(1);
+  TrajectoryWriter writer(stub, options);
+
+  StepRef refs;
+  REVERB_ASSERT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &refs));
+  REVERB_ASSERT_OK(
+      writer.CreateItem("table", 1.0, MakeTrajectory({{refs[0]}})));
+  REVERB_ASSERT_OK(
+      writer.CreateItem("table", 1.0, MakeTrajectory({{refs[0]}})));
+
+  REVERB_ASSERT_OK(writer.Flush());
+  EXPECT_THAT(async.stream_.requests(),
+              ElementsAre(HasNumChunksAndItems(1, 2)));
+}
+
+TEST(TrajectoryWriter, RequestIsSentWhenLingerTimeExpires) {
+  AsyncInterface async;
+  auto stub = std::make_shared<MockReverbServiceAsyncStub>();
+  EXPECT_CALL(*stub, async()).WillOnce(Return(&async));
+
+  auto options =
+      MakeOptions(/*max_chunk_length=*/1, /*num_keep_alive_refs=*/1);
+  options.max_items_per_request = 10;
+  options.max_linger_time = absl::Milliseconds(50);
+  TrajectoryWriter writer(stub, options);
+
+  StepRef refs;
+  REVERB_ASSERT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &refs));
+  REVERB_ASSERT_OK(
+      writer.CreateItem("table", 1.0, MakeTrajectory({{refs[0]}})));
+
+  async.stream_.BlockUntilNumRequestsIs(1);
+  EXPECT_THAT(async.stream_.requests()[0], HasNumChunksAndItems(1, 1));
+}
+
 TEST(TrajectoryWriter, ChunkersNotifiedWhenAllChunksDone) {
   class FakeChunkerOptions : public ChunkerOptions {
    public:
@@ -820,6 +1096,7 @@ TEST(TrajectoryWriter, ChunkersNotifiedWhenAllChunksDone) {
     int GetMaxChunkLength() const override { return 1; }
     int GetNumKeepAliveRefs() const override { return 1; }
     bool GetDeltaEncode() const override { return false; }
+    CompressionOptions GetCompression() const override { return {}; }
 
     absl::Status OnItemFinalized(
         const PrioritizedItem& item,
@@ -877,7 +1154,7 @@ TEST(TrajectoryWriter, FlushSendsPendingItems) {
       writer.CreateItem("table", 1.0, MakeTrajectory({{first[1]}})));
 
   // No data is sent yet since the chunks are not completed.
-  EXPECT_THAT(async.stream_.requests(), ::testing::IsEmpty());
+  EXPECT_THAT(async.stream_.requests(), IsEmpty());
 
   // Calling flush should trigger the chunk creation of the second column only.
   // Since the first column isn't referenced by the pending item there is no
@@ -910,7 +1187,7 @@ TEST(TrajectoryWriter, DestructorFlushesPendingItems) {
         writer.CreateItem("table", 1.0, MakeTrajectory({{first[0]}})));
 
     // No data is sent yet since the chunks are not completed.
-    EXPECT_THAT(async.stream_.requests(), ::testing::IsEmpty());
+    EXPECT_THAT(async.stream_.requests(), IsEmpty());
   }
 
   EXPECT_THAT(*requests, ElementsAre(IsChunkAndItem()));
@@ -1271,6 +1548,82 @@ TEST(TrajectoryWriter, KeepKeysOnlyIncludesLiveChunks) {
                                    third[0].value().lock()->chunk_key()));
 }
 
+TEST(TrajectoryWriter, ReleaseKeysOnlyIncludeExpiredChunks) {
+  AsyncInterface success_stream;
+  auto stub = std::make_shared<MockReverbServiceAsyncStub>();
+  EXPECT_CALL(*stub, async())
+      .WillOnce(Return(&success_stream));
+
+  auto options =
+      MakeOptions(/*max_chunk_length=*/1, /*num_keep_alive_refs=*/2);
+  options.release_chunks_incrementally = true;
+  TrajectoryWriter writer(stub, options);
+
+  // Take three steps and insert a trajectory after each of them.
+  std::vector<uint64_t> chunk_keys;
+  for (int i = 0; i < 3; i++) {
+    StepRef step;
+    REVERB_ASSERT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &step));
+    chunk_keys.push_back(step[0].value().lock()->chunk_key());
+    REVERB_ASSERT_OK(
+        writer.CreateItem("table", 1.0, MakeTrajectory({{step[0]}})));
+    REVERB_ASSERT_OK(writer.Flush());
+
+    const auto& request = success_stream.stream_.requests().back();
+    EXPECT_THAT(request.keep_chunk_keys(), IsEmpty());
+    if (i < 2) {
+      // The chunks are still within `num_keep_alive_refs`.
+      EXPECT_THAT(request.release_chunk_keys(), IsEmpty());
+    } else {
+      // The chunk of the first step has now expired.
+      EXPECT_THAT(request.release_chunk_keys(),
+                  UnorderedElementsAre(chunk_keys[0]));
+    }
+  }
+
+  // The stream is told to expect release keys in the first request.
+  EXPECT_TRUE(success_stream.stream_.requests()[0]
+                  .options()
+                  .release_chunks_incrementally());
+}
+
+TEST(TrajectoryWriter, HoldsBackItemsWhileInsertHeadroomIsExhausted) {
+  AsyncInterface success_stream;
+  auto stub = std::make_shared<MockReverbServiceAsyncStub>();
+  EXPECT_CALL(*stub, async())
+      .WillOnce(Return(&success_stream));
+
+  auto options =
+      MakeOptions(/*max_chunk_length=*/1, /*num_keep_alive_refs=*/1);
+  options.throttle_on_insert_headroom = true;
+  TrajectoryWriter writer(stub, options);
+
+  // Nothing is known about the table yet so the first item is sent. The
+  // confirmation tells the writer that the table is full.
+  success_stream.stream_.SetInsertHeadroom(0);
+  StepRef step;
+  REVERB_ASSERT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &step));
+  REVERB_ASSERT_OK(
+      writer.CreateItem("table", 1.0, MakeTrajectory({{step[0]}})));
+  REVERB_ASSERT_OK(writer.Flush());
+  EXPECT_TRUE(
+      success_stream.stream_.requests()[0].options().push_insert_headroom());
+
+  // Neither the chunk nor the item of the second step is sent.
+  REVERB_ASSERT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &step));
+  REVERB_ASSERT_OK(
+      writer.CreateItem("table", 1.0, MakeTrajectory({{step[0]}})));
+  EXPECT_EQ(writer.Flush(0, absl::Milliseconds(100)).code(),
+            absl::StatusCode::kDeadlineExceeded);
+  EXPECT_EQ(success_stream.stream_.requests_size(), 1);
+
+  // Once the server pushes new headroom the item is sent.
+  success_stream.stream_.PushInsertHeadroom(1);
+  REVERB_ASSERT_OK(writer.Flush());
+  EXPECT_EQ(success_stream.stream_.requests_size(), 2);
+  EXPECT_EQ(success_stream.stream_.requests()[1].items_size(), 1);
+}
+
 TEST(TrajectoryWriter, CreateItemValidatesTrajectoryDtype) {
   AsyncInterface success_stream;
   auto stub = std::make_shared<MockReverbServiceAsyncStub>();
@@ -1700,6 +2053,111 @@ TEST_F(TrajectoryWriterOptionsTest, NumKeepAliveLtMaxChunkLength) {
       "num_keep_alive_refs (5) must be >= max_chunk_length (6).");
 }
 
+TEST_F(TrajectoryWriterOptionsTest, ZeroMaxItemsPerRequest) {
+  options_ = MakeOptions(/*max_chunk_length=*/2, /*num_keep_alive_refs=*/2);
+  options_.max_items_per_request = 0;
+  ExpectInvalidArgumentWithMessage(
+      "max_items_per_request must be > 0 or -1 but got 0.");
+}
+
+TEST_F(TrajectoryWriterOptionsTest, ZeroMaxRequestSizeBytes) {
+  options_ = MakeOptions(/*max_chunk_length=*/2, /*num_keep_alive_refs=*/2);
+  options_.max_request_size_bytes = 0;
+  ExpectInvalidArgumentWithMessage(
+      "max_request_size_bytes must be > 0 but got 0.");
+}
+
+TEST_F(TrajectoryWriterOptionsTest, NegativeMaxLingerTime) {
+  options_ = MakeOptions(/*max_chunk_length=*/2, /*num_keep_alive_refs=*/2);
+  options_.max_linger_time = -absl::Seconds(1);
+  ExpectInvalidArgumentWithMessage("max_linger_time must be >= 0 but got -1s.");
+}
+
+TEST_F(TrajectoryWriterOptionsTest, NegativeMaxAckDelay) {
+  options_ = MakeOptions(/*max_chunk_length=*/2, /*num_keep_alive_refs=*/2);
+  options_.max_ack_delay = -absl::Seconds(1);
+  ExpectInvalidArgumentWithMessage("max_ack_delay must be >= 0 but got -1s.");
+}
+
+TEST_F(TrajectoryWriterOptionsTest, NegativeMaxAcksPerResponse) {
+  options_ = MakeOptions(/*max_chunk_length=*/2, /*num_keep_alive_refs=*/2);
+  options_.max_acks_per_response = -1;
+  ExpectInvalidArgumentWithMessage(
+      "max_acks_per_response must be >= 0 but got -1.");
+}
+
+TrajectoryWriter::LocalServer MakeLocalServer(std::shared_ptr<Table> table) {
+  TrajectoryWriter::LocalServer server;
+  server.chunk_store = std::make_shared<ChunkStore>();
+  server.get_table = [table](absl::string_view name,
+                             std::shared_ptr<Table>* out) {
+    if (name != table->name()) {
+      return absl::NotFoundError(absl::StrCat("Unknown table ", name));
+    }
+    *out = table;
+    return absl::OkStatus();
+  };
+  return server;
+}
+
+std::shared_ptr<Table> MakeLocalTable() {
+  return std::make_shared<Table>(
+      /*name=*/"table",
+      /*sampler=*/std::make_shared<FifoSelector>(),
+      /*remover=*/std::make_shared<FifoSelector>(),
+      /*max_size=*/100,
+      /*max_times_sampled=*/0,
+      /*rate_limiter=*/std::make_shared<RateLimiter>(1, 1, -DBL_MAX, DBL_MAX));
+}
+
+TEST(TrajectoryWriter, LocalServerInsertsItemsIntoTable) {
+  auto table = MakeLocalTable();
+  TrajectoryWriter writer(
+      MakeLocalServer(table),
+      MakeOptions(/*max_chunk_length=*/2, /*num_keep_alive_refs=*/2));
+
+  StepRef first;
+  REVERB_ASSERT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &first));
+  StepRef second;
+  REVERB_ASSERT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &second));
+
+  REVERB_ASSERT_OK(
+      writer.CreateItem("table", 1.0, MakeTrajectory({{first[0]}})));
+  REVERB_ASSERT_OK(writer.CreateItem(
+      "table", 1.0, MakeTrajectory({{first[0], second[0]}})));
+  REVERB_ASSERT_OK(writer.Flush());
+
+  EXPECT_EQ(table->size(), 2);
+
+  // Both items reference the same chunk, which is only handed over once.
+  TrajectoryWriter::Stats stats = writer.stats();
+  EXPECT_EQ(stats.num_items, 2);
+  EXPECT_EQ(stats.num_chunks, 1);
+
+  // The table holds the data of the writer rather than a copy of it.
+  std::vector<Table::SampledItem> samples;
+  REVERB_ASSERT_OK(table->SampleFlexibleBatch(&samples, 1));
+  ASSERT_THAT(samples, ::testing::SizeIs(1));
+  ASSERT_THAT(samples[0].ref->chunks, ::testing::SizeIs(1));
+  EXPECT_EQ(&samples[0].ref->chunks[0]->data(),
+            first[0].value().lock()->GetChunk()->get());
+}
+
+TEST(TrajectoryWriter, LocalServerReturnsErrorForUnknownTable) {
+  auto table = MakeLocalTable();
+  TrajectoryWriter writer(
+      MakeLocalServer(table),
+      MakeOptions(/*max_chunk_length=*/1, /*num_keep_alive_refs=*/1));
+
+  StepRef refs;
+  REVERB_ASSERT_OK(writer.Append(Step({MakeTensor(kIntSpec)}), &refs));
+  REVERB_ASSERT_OK(
+      writer.CreateItem("unknown", 1.0, MakeTrajectory({{refs[0]}})));
+
+  EXPECT_EQ(writer.Flush().code(), absl::StatusCode::kNotFound);
+  EXPECT_EQ(table->size(), 0);
+}
+
 }  // namespace
 }  // namespace reverb
 }  // namespace deepmind
@@ -15,7 +15,9 @@
 #include "reverb/cc/writer.h"
 
 #include <algorithm>
+#include <functional>
 #include <iterator>
+#include <list>
 #include <string>
 #include <utility>
 #include <vector>
@@ -60,7 +62,7 @@ int PositiveModulo(int value, int divisor) {
 Writer::Writer(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
                int chunk_length, int max_timesteps, bool delta_encoded,
                std::shared_ptr<internal::FlatSignatureMap> signatures,
-               int max_in_flight_items)
+               int max_in_flight_items, bool asynchronous)
     : stub_(std::move(stub)),
       chunk_length_(chunk_length),
       max_timesteps_(max_timesteps),
@@ -72,8 +74,13 @@ Writer::Writer(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stu
       episode_id_(NewID()),
       index_within_episode_(0),
       closed_(false),
+      asynchronous_(asynchronous),
       inserted_dtypes_and_shapes_(max_timesteps) {
   CHECK_GT(max_in_flight_items_, 0);
+  if (asynchronous_) {
+    async_worker_ = internal::StartThread(
+        "WriterAsyncWorker", absl::bind_front(&Writer::AsyncWorker, this));
+  }
 }
 
 Writer::~Writer() {
@@ -158,7 +165,8 @@ absl::Status Writer::CreateItem(const std::string& table, int num_timesteps,
     return absl::FailedPreconditionError(
         "Calling method CreateItem after Close has been called");
   }
-  if (num_timesteps > chunks_.size() * chunk_length_ + buffer_.size()) {
+  if (num_timesteps >
+      chunk_metadata_.size() * chunk_length_ + buffer_.size()) {
     return absl::InvalidArgumentError(
         "Argument `num_timesteps` is larger than number of buffered "
         "timesteps.");
@@ -245,8 +253,8 @@ absl::Status Writer::CreateItem(const std::string& table, int num_timesteps,
   }
 
   // Traverse historic chunks backwards until trajectory complete.
-  for (auto rit = chunks_.rbegin(); remaining > 0 && rit != chunks_.rend();
-       ++rit) {
+  for (auto rit = chunk_metadata_.rbegin();
+       remaining > 0 && rit != chunk_metadata_.rend(); ++rit) {
     const auto& range = rit->sequence_range();
     chunk_lengths.push_back(range.end() - range.start() + 1);
     chunk_keys.push_back(rit->chunk_key());
@@ -259,15 +267,24 @@ absl::Status Writer::CreateItem(const std::string& table, int num_timesteps,
 
   *item.mutable_flat_trajectory() = internal::FlatTimestepTrajectory(
       chunk_keys, chunk_lengths,
-      /*num_columns=*/buffer_.empty() ? chunks_.front().data().tensors_size()
-                                      : buffer_[0].size(),
+      /*num_columns=*/buffer_.empty()
+          ? chunk_metadata_.front().data_tensors_len()
+          : buffer_[0].size(),
       /*offset=*/-remaining,
       /*length=*/num_timesteps);
 
+  if (buffer_.empty() && asynchronous_) {
+    return RunOrEnqueue(
+        [this, items = std::list<PrioritizedItem>{std::move(item)}]() mutable {
+          return WriteWithRetries(&items, /*retry_on_unavailable=*/true);
+        });
+  }
+
   pending_items_.push_back(item);
 
   if (buffer_.empty()) {
-    auto status = WriteWithRetries(/*retry_on_unavailable=*/true);
+    auto status =
+        WriteWithRetries(&pending_items_, /*retry_on_unavailable=*/true);
     if (!status.ok()) pending_items_.pop_back();
     return status;
   }
@@ -282,8 +299,10 @@ absl::Status Writer::Flush() {
   }
 
   if (!pending_items_.empty()) {
-    return Finish(/*retry_on_unavailable=*/true);
+    auto status = Finish(/*retry_on_unavailable=*/true);
+    if (!asynchronous_ || !status.ok()) return status;
   }
+  REVERB_RETURN_IF_ERROR(WaitForQueuedWrites());
   if (!ConfirmItems(0)) {
     return absl::InternalError(
         "Error when confirming that all items written to table.");
@@ -295,7 +314,8 @@ std::string Writer::DebugString() const {
   std::string str = absl::StrCat(
       "Writer(chunk_length=", chunk_length_, ", max_timesteps=", max_timesteps_,
       ", delta_encoded=", delta_encoded_, ", max_in_flight_items=",
-      max_in_flight_items_, ", episode_id=", episode_id_,
+      max_in_flight_items_, ", asynchronous=", asynchronous_,
+      ", episode_id=", episode_id_,
                   ", index_within_episode=", index_within_episode_,
                   ", closed=", closed_, ")");
   return str;
@@ -348,8 +368,9 @@ absl::Status Writer::Close(bool retry_on_unavailable) {
         "Calling method Close after Close has been called");
   }
   if (!pending_items_.empty()) {
+    // Asynchronous errors are returned once the worker has been stopped.
     auto status = Finish(retry_on_unavailable);
-    if (!status.ok()) {
+    if (!status.ok() && !asynchronous_) {
       if (!absl::IsUnavailable(status) || retry_on_unavailable) {
         return status;
       }
@@ -359,6 +380,29 @@ absl::Status Writer::Close(bool retry_on_unavailable) {
           << "The Writer will be closed although the server was Unavailable";
     }
   }
+  absl::Status async_status = absl::OkStatus();
+  if (async_worker_ != nullptr) {
+    async_status = WaitForQueuedWrites();
+    {
+      absl::MutexLock lock(&async_mu_);
+      async_stop_ = true;
+    }
+    // Joins the worker so the stream can be closed from this thread.
+    async_worker_ = nullptr;
+  }
+  CloseStream();
+  chunks_.clear();
+  chunk_metadata_.clear();
+  closed_ = true;
+  if (absl::IsUnavailable(async_status) && !retry_on_unavailable) {
+    REVERB_LOG(REVERB_INFO)
+        << "The Writer was closed although the server was Unavailable";
+    return absl::OkStatus();
+  }
+  return async_status;
+}
+
+void Writer::CloseStream() {
   if (stream_) {
     stream_->WritesDone();
     REVERB_LOG_IF(REVERB_ERROR, !ConfirmItems(0))
@@ -374,25 +418,68 @@ absl::Status Writer::Close(bool retry_on_unavailable) {
     }
     stream_ = nullptr;
   }
-  chunks_.clear();
-  closed_ = true;
-  return absl::OkStatus();
 }
 
 absl::Status Writer::Finish(bool retry_on_unavailable) {
-  std::vector<tensorflow::Tensor> batched_tensors;
   for (int i = 0; i < buffer_[0].size(); ++i) {
-    std::vector<tensorflow::Tensor> tensors(buffer_.size());
-    for (int j = 0; j < buffer_.size(); ++j) {
-      const tensorflow::Tensor& item = buffer_[j][i];
-      tensorflow::TensorShape shape = item.shape();
-      if (j > 0 && shape != buffer_[0][i].shape()) {
+    for (int j = 1; j < buffer_.size(); ++j) {
+      const tensorflow::TensorShape& shape = buffer_[j][i].shape();
+      if (shape != buffer_[0][i].shape()) {
         return absl::InvalidArgumentError(
             absl::StrCat("Unable to concatenate tensors at index ", i,
                          " due to mismatched shapes.  Tensor 0 has shape: ",
                          buffer_[0][i].shape().DebugString(), ", but tensor ",
                          j, " has shape: ", shape.DebugString()));
       }
+    }
+  }
+
+  ChunkData chunk;
+  chunk.set_chunk_key(next_chunk_key_);
+  chunk.mutable_sequence_range()->set_episode_id(episode_id_);
+  chunk.mutable_sequence_range()->set_start(index_within_episode_);
+  chunk.mutable_sequence_range()->set_end(index_within_episode_ +
+                                          buffer_.size() - 1);
+  chunk.set_delta_encoded(delta_encoded_);
+  chunk.set_data_tensors_len(buffer_[0].size());
+
+  absl::Status status;
+  if (asynchronous_) {
+    // The timesteps and items are copied so that the state can be restored if
+    // the write can't be queued. Copying the tensors only copies references.
+    status = RunOrEnqueue([this, steps = buffer_, chunk,
+                           items = pending_items_,
+                           retry_on_unavailable]() mutable {
+      return WriteChunkAndItems(steps, chunk, &items, retry_on_unavailable);
+    });
+    if (status.ok()) pending_items_.clear();
+  } else {
+    status = WriteChunkAndItems(buffer_, chunk, &pending_items_,
+                                retry_on_unavailable);
+  }
+
+  if (status.ok()) {
+    index_within_episode_ += buffer_.size();
+    buffer_.clear();
+    next_chunk_key_ = NewID();
+    chunk_metadata_.push_back(std::move(chunk));
+    while ((chunk_metadata_.size() - 1) * chunk_length_ >= max_timesteps_) {
+      chunk_metadata_.pop_front();
+    }
+  }
+  return status;
+}
+
+absl::Status Writer::WriteChunkAndItems(
+    const std::vector<std::vector<tensorflow::Tensor>>& steps,
+    const ChunkData& chunk, std::list<PrioritizedItem>* items,
+    bool retry_on_unavailable) {
+  std::vector<tensorflow::Tensor> batched_tensors;
+  for (int i = 0; i < steps[0].size(); ++i) {
+    std::vector<tensorflow::Tensor> tensors(steps.size());
+    for (int j = 0; j < steps.size(); ++j) {
+      const tensorflow::Tensor& item = steps[j][i];
+      tensorflow::TensorShape shape = item.shape();
       shape.InsertDim(0, 1);
       // This should never fail due to dtype or shape differences, because the
       // dtype of tensors[j] is UNKNOWN and `shape` has the same number of
@@ -404,30 +491,18 @@ absl::Status Writer::Finish(bool retry_on_unavailable) {
         tensorflow::tensor::Concat(tensors, &batched_tensors.back())));
   }
 
-  ChunkData chunk_data;
-  chunk_data.set_chunk_key(next_chunk_key_);
-  chunk_data.mutable_sequence_range()->set_episode_id(episode_id_);
-  chunk_data.mutable_sequence_range()->set_start(index_within_episode_);
-  chunk_data.mutable_sequence_range()->set_end(index_within_episode_ +
-                                               buffer_.size() - 1);
-
-  if (delta_encoded_) {
+  ChunkData chunk_data = chunk;
+  if (chunk_data.delta_encoded()) {
     batched_tensors = DeltaEncodeList(batched_tensors, true);
-    chunk_data.set_delta_encoded(true);
   }
-
-  chunk_data.set_data_tensors_len(batched_tensors.size());
   for (const auto& tensor : batched_tensors) {
     CompressTensorAsProto(tensor, chunk_data.mutable_data()->add_tensors());
   }
 
   chunks_.emplace_back(std::move(chunk_data));
 
-  auto status = WriteWithRetries(retry_on_unavailable);
+  auto status = WriteWithRetries(items, retry_on_unavailable);
   if (status.ok()) {
-    index_within_episode_ += buffer_.size();
-    buffer_.clear();
-    next_chunk_key_ = NewID();
     while ((chunks_.size() - 1) * chunk_length_ >= max_timesteps_) {
       streamed_chunk_keys_.erase(chunks_.front().chunk_key());
       chunks_.pop_front();
@@ -438,9 +513,10 @@ absl::Status Writer::Finish(bool retry_on_unavailable) {
   return status;
 }
 
-absl::Status Writer::WriteWithRetries(bool retry_on_unavailable) {
+absl::Status Writer::WriteWithRetries(std::list<PrioritizedItem>* items,
+                                      bool retry_on_unavailable) {
   while (true) {
-    if (WritePendingData()) return absl::OkStatus();
+    if (WritePendingData(items)) return absl::OkStatus();
     stream_->WritesDone();
     REVERB_RETURN_IF_ERROR(StopItemConfirmationWorker());
     auto status = FromGrpcStatus(stream_->Finish());
@@ -451,7 +527,7 @@ absl::Status Writer::WriteWithRetries(bool retry_on_unavailable) {
   }
 }
 
-bool Writer::WritePendingData() {
+bool Writer::WritePendingData(std::list<PrioritizedItem>* items) {
   class ArenaOwnedRequest {
    public:
     ~ArenaOwnedRequest() {
@@ -477,7 +553,7 @@ bool Writer::WritePendingData() {
   // to keep references only to the ones which the client still keeps
   // around.
   absl::flat_hash_set<uint64_t> item_chunk_keys;
-  for (const auto& item : pending_items_) {
+  for (const auto& item : *items) {
     for (auto key : internal::GetChunkKeys(item.flat_trajectory())) {
       item_chunk_keys.insert(key);
     }
@@ -507,11 +583,11 @@ bool Writer::WritePendingData() {
       keep_chunk_keys.push_back(chunk.chunk_key());
     }
   }
-  while (!pending_items_.empty()) {
+  while (!items->empty()) {
     if (!ConfirmItems(max_in_flight_items_ - 1)) {
       return false;
     }
-    *request.r.add_items() = pending_items_.front();
+    *request.r.add_items() = items->front();
     *request.r.mutable_keep_chunk_keys() = {
         keep_chunk_keys.begin(), keep_chunk_keys.end()};
     bool ok = stream_->Write(request.r, options);
@@ -520,7 +596,7 @@ bool Writer::WritePendingData() {
     for (const auto& chunk : request.r.chunks()) {
       streamed_chunk_keys_.insert(chunk.chunk_key());
     }
-    pending_items_.pop_front();
+    items->pop_front();
     absl::MutexLock lock(&mu_);
     ++num_items_in_flight_;
   }
@@ -528,6 +604,54 @@ bool Writer::WritePendingData() {
   return true;
 }
 
+absl::Status Writer::RunOrEnqueue(std::function<absl::Status()> write) {
+  if (!asynchronous_) return write();
+
+  absl::MutexLock lock(&async_mu_);
+  auto has_room = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(async_mu_) {
+    return async_queue_.size() < kMaxQueuedWrites || !async_status_.ok();
+  };
+  async_mu_.Await(absl::Condition(&has_room));
+  REVERB_RETURN_IF_ERROR(async_status_);
+  async_queue_.push_back(std::move(write));
+  return absl::OkStatus();
+}
+
+absl::Status Writer::WaitForQueuedWrites() {
+  absl::MutexLock lock(&async_mu_);
+  auto done = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(async_mu_) {
+    return (async_queue_.empty() && !async_write_running_) ||
+           !async_status_.ok();
+  };
+  async_mu_.Await(absl::Condition(&done));
+  return async_status_;
+}
+
+void Writer::AsyncWorker() {
+  while (true) {
+    std::function<absl::Status()> write;
+    {
+      absl::MutexLock lock(&async_mu_);
+      async_write_running_ = false;
+      auto ready = [this]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(async_mu_) {
+        return !async_queue_.empty() || async_stop_;
+      };
+      async_mu_.Await(absl::Condition(&ready));
+      if (async_queue_.empty()) return;
+      write = std::move(async_queue_.front());
+      async_queue_.pop_front();
+      async_write_running_ = true;
+    }
+    auto status = write();
+    if (!status.ok()) {
+      absl::MutexLock lock(&async_mu_);
+      async_status_ = status;
+      // The remaining writes build on the failed one so they are dropped.
+      async_queue_.clear();
+    }
+  }
+}
+
 uint64_t Writer::NewID() {
   return absl::Uniform<uint64_t>(bit_gen_, 0, UINT64_MAX);
 }
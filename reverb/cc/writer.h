@@ -15,6 +15,8 @@
 #ifndef LEARNING_DEEPMIND_REPLAY_REVERB_WRITER_H_
 #define LEARNING_DEEPMIND_REPLAY_REVERB_WRITER_H_
 
+#include <deque>
+#include <functional>
 #include <list>
 #include <memory>
 #include <vector>
@@ -49,11 +51,22 @@ class Writer {
   static constexpr int64_t kMaxRequestSizeBytes = 40 * 1024 * 1024;  // 40MB.
   static constexpr int kDefaultMaxInFlightItems = 25;
 
+  // Maximum number of chunks (and item batches) which can be waiting for the
+  // background worker of an asynchronous writer before calls block.
+  static constexpr int kMaxQueuedWrites = 4;
+
   // The client must not be deleted while any of its writer instances exist.
+  //
+  // If `asynchronous` is set then chunks are built, compressed and written to
+  // the stream by a background thread, so `Append` and `CreateItem` only block
+  // when the worker falls `kMaxQueuedWrites` writes behind. Errors encountered
+  // by the worker are returned by the next call instead and leave the writer
+  // unusable, the state is not reverted like when writing synchronously.
   Writer(std::shared_ptr</* grpc_gen:: */ReverbService::StubInterface> stub,
          int chunk_length, int max_timesteps, bool delta_encoded = false,
          std::shared_ptr<internal::FlatSignatureMap> signatures = nullptr,
-         int max_in_flight_items = kDefaultMaxInFlightItems);
+         int max_in_flight_items = kDefaultMaxInFlightItems,
+         bool asynchronous = false);
   ~Writer();
 
   // Appends a timestamp to internal `buffer_`. If the size of the buffer
@@ -108,15 +121,44 @@ class Writer {
   // number of items in `buffer_` and old items are removed from `chunks_` until
   // its size is <= `max_chunks_`. If the operation was unsuccessful then chunk
   // is popped from `chunks_`.
+  //
+  // If `asynchronous_` then the batch is handed to `async_worker_` and the
+  // caller state is updated as if the write succeeded.
   absl::Status Finish(bool retry_on_unavailable);
 
+  // Builds the chunk described by `chunk` (which has no data yet) from `steps`,
+  // inserts it into `chunks_` and streams it together with `items`. See
+  // `Finish`.
+  absl::Status WriteChunkAndItems(
+      const std::vector<std::vector<tensorflow::Tensor>>& steps,
+      const ChunkData& chunk, std::list<PrioritizedItem>* items,
+      bool retry_on_unavailable);
+
   // Retries `WritePendingData` until sucessful or, if retry_on_unavailable is
   // true, until non transient errors encountered
-  absl::Status WriteWithRetries(bool retry_on_unavailable);
+  absl::Status WriteWithRetries(std::list<PrioritizedItem>* items,
+                                bool retry_on_unavailable);
+
+  // Streams the chunks in `chunks_` referenced by `items` followed by the
+  // items. Items are popped from `items` once they have been written.
+  bool WritePendingData(std::list<PrioritizedItem>* items);
+
+  // Flushes and closes `stream_` and stops the confirmation worker.
+  void CloseStream();
+
+  // Runs `write` on the calling thread unless `asynchronous_` in which case it
+  // is queued for `async_worker_`. Returns the error of a previous
+  // asynchronous write if one has failed.
+  absl::Status RunOrEnqueue(std::function<absl::Status()> write)
+      ABSL_LOCKS_EXCLUDED(async_mu_);
+
+  // Blocks until all queued writes have completed and returns the status of
+  // the first one that failed (if any).
+  absl::Status WaitForQueuedWrites() ABSL_LOCKS_EXCLUDED(async_mu_);
 
-  // Streams the chunks in `chunks_` referenced by `pending_items_` followed by
-  // items in `pending_items_`
-  bool WritePendingData();
+  // Runs the writes queued by `RunOrEnqueue` in order until `async_stop_` is
+  // set and the queue is empty.
+  void AsyncWorker() ABSL_LOCKS_EXCLUDED(async_mu_);
 
   // Helper for generating a random ID.
   uint64_t NewID();
@@ -218,9 +260,14 @@ class Writer {
   // Timesteps not yet batched up and put into `chunks_`.
   std::vector<std::vector<tensorflow::Tensor>> buffer_;
 
-  // Batched timesteps that can be referenced by new items.
+  // Batched timesteps that can be referenced by new items. Owned by the
+  // thread writing to `stream_` (`async_worker_` if `asynchronous_`).
   std::list<ChunkData> chunks_;
 
+  // Chunks of `chunks_` without their data. Used by the caller thread to
+  // build trajectories without waiting for the chunks to be built.
+  std::list<ChunkData> chunk_metadata_;
+
   // Keys of the chunks which have been streamed to the server.
   absl::flat_hash_set<uint64_t> streamed_chunk_keys_;
 
@@ -236,6 +283,27 @@ class Writer {
   // Set if `Close` has been called.
   bool closed_;
 
+  // Whether chunks and items are written by `async_worker_`.
+  const bool asynchronous_;
+
+  absl::Mutex async_mu_;
+
+  // Writes waiting to be run by `async_worker_`.
+  std::deque<std::function<absl::Status()>> async_queue_
+      ABSL_GUARDED_BY(async_mu_);
+
+  // True while `async_worker_` is running a write popped from `async_queue_`.
+  bool async_write_running_ ABSL_GUARDED_BY(async_mu_) = false;
+
+  // Set by `Close` to stop `async_worker_` once the queue is empty.
+  bool async_stop_ ABSL_GUARDED_BY(async_mu_) = false;
+
+  // Status of the first asynchronous write that failed.
+  absl::Status async_status_ ABSL_GUARDED_BY(async_mu_);
+
+  // Thread running `AsyncWorker`. Only set if `asynchronous_`.
+  std::unique_ptr<internal::Thread> async_worker_;
+
   // Set of signatures passed to Append in a circular buffer.  Each
   // entry is the flat list of tensor dtypes and shapes in past Append
   // calls.  The vector itself is of length max_time_steps_ and Append
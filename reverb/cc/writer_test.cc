@@ -694,6 +694,52 @@ TEST(WriterTest, MultiChunkItemsAreCorrect) {
       SizeIs(1));
 }
 
+TEST(WriterTest, AsynchronousWriterSendsChunksAndItems) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeGoodStub(&requests);
+  Writer writer(stub, 2, 10, /*delta_encoded=*/false, /*signatures=*/nullptr,
+                Writer::kDefaultMaxInFlightItems, /*asynchronous=*/true);
+  for (int i = 0; i < 6; i++) {
+    REVERB_ASSERT_OK(writer.Append(MakeTimestep()));
+  }
+  REVERB_ASSERT_OK(writer.CreateItem("dist", 3, 1.0));
+  REVERB_ASSERT_OK(writer.Append(MakeTimestep()));
+  REVERB_ASSERT_OK(writer.CreateItem("dist", 2, 1.0));
+  REVERB_ASSERT_OK(writer.Flush());
+
+  // The first item is written as soon as it is created since `buffer_` is
+  // empty whereas the second one is written with the chunk built by `Flush`.
+  ASSERT_THAT(requests, SizeIs(2));
+  EXPECT_THAT(requests[0], IsChunk());
+  EXPECT_THAT(requests[0],
+              IsItemWithRangeAndPriorityAndTable(1, 3, 1.0, "dist"));
+  EXPECT_THAT(requests[1], IsChunk());
+  EXPECT_THAT(requests[1],
+              IsItemWithRangeAndPriorityAndTable(1, 2, 1.0, "dist"));
+  EXPECT_THAT(
+      internal::GetChunkKeys(requests[1].items(0).flat_trajectory()),
+      ElementsAre(requests[0].chunks(1).chunk_key(),
+                  requests[1].chunks(0).chunk_key()));
+  REVERB_EXPECT_OK(writer.Close());
+}
+
+TEST(WriterTest, AsynchronousWriterReturnsWriteErrorsFromLaterCalls) {
+  std::vector<InsertStreamRequest> requests;
+  auto stub = MakeFlakyStub(&requests, /*num_success=*/0, /*num_fail=*/1,
+                            ToGrpcStatus(absl::InternalError("A reason")));
+  Writer writer(stub, 2, 10, /*delta_encoded=*/false, /*signatures=*/nullptr,
+                Writer::kDefaultMaxInFlightItems, /*asynchronous=*/true);
+  REVERB_ASSERT_OK(writer.Append(MakeTimestep()));
+  REVERB_ASSERT_OK(writer.CreateItem("dist", 1, 1.0));
+
+  // The write is only attempted once the chunk is complete.
+  REVERB_ASSERT_OK(writer.Append(MakeTimestep()));
+  EXPECT_EQ(writer.Flush().code(), absl::StatusCode::kInternal);
+  EXPECT_EQ(writer.Append(MakeTimestep()).code(), absl::StatusCode::kOk);
+  EXPECT_EQ(writer.Append(MakeTimestep()).code(), absl::StatusCode::kInternal);
+  EXPECT_EQ(writer.Close().code(), absl::StatusCode::kInternal);
+}
+
 TEST(WriterTest, WriteTimeStepsMatchingSignature) {
   std::vector<InsertStreamRequest> requests;
   tensorflow::StructuredValue signature =
@@ -20,6 +20,7 @@ exposes direct methods for both inserting (i.e `insert`) and sampling (i.e
 `TrajectoryDataset` directly whenever possible.
 """
 
+from concurrent import futures
 from typing import Any, Dict, Generator, List, Optional, Union
 
 from absl import logging
@@ -32,6 +33,34 @@ from reverb import trajectory_writer as trajectory_writer_lib
 import tree
 
 
+def _future_callback(future: futures.Future,
+                     convert_result=lambda result: result,
+                     convert_error=lambda error: error):
+  """Returns a callback for the `Async*` methods of `pybind.Client`.
+
+  The callback is called from a C++ thread with an error (or None) and the
+  result of the call and completes `future` with them.
+
+  Args:
+    future: Future to complete.
+    convert_result: Applied to the result of successful calls.
+    convert_error: Applied to the error of failed calls.
+  """
+
+  def callback(error, result):
+    if not future.set_running_or_notify_cancel():
+      return
+    if error is not None:
+      future.set_exception(convert_error(error))
+      return
+    try:
+      future.set_result(convert_result(result))
+    except Exception as e:  # pylint: disable=broad-except
+      future.set_exception(e)
+
+  return callback
+
+
 class Writer:
   """Writer is used for streaming data of arbitrary length.
 
@@ -348,6 +377,7 @@ class Client:
       *,
       emit_timesteps: bool = True,
       unpack_as_table_signature: bool = False,
+      decode_lazily: bool = False,
   ) -> Generator[Union[List[replay_sample.ReplaySample],
                        replay_sample.ReplaySample], None, None]:
     """Samples `num_samples` items from table `table` of the Server.
@@ -385,6 +415,11 @@ class Client:
       unpack_as_table_signature: If True then the sampled data is unpacked
         according to the structure of the table signature. If the table does
         not have a signature then flat data is returned.
+      decode_lazily: If True then the data of each sample is a
+        `replay_sample.LazyColumns` which only decodes a column when it is
+        first accessed. Saves the decompression of columns which are never
+        read (e.g observations when only the rewards are logged). Requires
+        `emit_timesteps` and `unpack_as_table_signature` to be False.
 
     Yields:
       If `emit_timesteps` is `True`:
@@ -405,9 +440,16 @@ class Client:
     Raises:
       ValueError: If `emit_timestep` is True but the trajectory cannot be
         decomposed into timesteps.
+      ValueError: If `decode_lazily` is True and either `emit_timesteps` or
+        `unpack_as_table_signature` is True.
     """
     buffer_size = 1
 
+    if decode_lazily and (emit_timesteps or unpack_as_table_signature):
+      raise ValueError(
+          'decode_lazily requires emit_timesteps and '
+          'unpack_as_table_signature to be False.')
+
     if unpack_as_table_signature:
       signature = self._get_signature_for_table(table)
     else:
@@ -418,9 +460,21 @@ class Client:
     else:
       unflatten = lambda x: x
 
-    sampler = self._client.NewSampler(table, num_samples, buffer_size)
+    sampler = self._client.NewSampler(
+        table, num_samples, buffer_size, lazy_decoding=decode_lazily)
 
     for _ in range(num_samples):
+      if decode_lazily:
+        sample = sampler.GetNextLazySample()
+        info = replay_sample.SampleInfo(
+            key=int(sample.key),
+            probability=float(sample.probability),
+            table_size=int(sample.table_size),
+            priority=float(sample.priority))
+        yield replay_sample.ReplaySample(
+            info, replay_sample.LazyColumns(sample))
+        continue
+
       sample = sampler.GetNextTrajectory()
 
       info = replay_sample.SampleInfo(
@@ -446,6 +500,82 @@ class Client:
       else:
         yield replay_sample.ReplaySample(info, unflatten(sample[4:]))
 
+  def dlpack_batches(
+      self,
+      table: str,
+      batch_size: int,
+      num_batches: int = 1,
+      *,
+      num_workers: int = -1,
+      max_in_flight_samples_per_worker: int = 100,
+      num_batching_threads: int = 1,
+      num_prefetched_batches: int = 2,
+  ) -> Generator[replay_sample.ReplaySample, None, None]:
+    """Samples `num_batches` batches of `batch_size` items from `table`.
+
+    Unlike `sample`, the batches are assembled on C++ threads and exported as
+    DLPack capsules rather than numpy arrays, so learners which don't use
+    `tf.data` (e.g JAX learners) can take ownership of the sampled tensors
+    without a copy or a TensorFlow pipeline:
+
+    ```python
+
+    for batch in client.dlpack_batches('my_table', batch_size=32,
+                                       num_batches=1000):
+      data = [jax.dlpack.from_dlpack(column) for column in batch.data]
+      ...
+
+    ```
+
+    Each capsule can only be consumed once. The tensors live in host memory.
+
+    Args:
+      table: Name of the priority table to sample from.
+      batch_size: The number of items in each batch. All items of a batch must
+        have the same shapes.
+      num_batches: The number of batches to fetch. Use -1 to sample until the
+        generator is closed.
+      num_workers: Number of threads which stream samples from the server. -1
+        lets the sampler decide.
+      max_in_flight_samples_per_worker: Maximum number of samples requested by
+        a worker but not yet returned.
+      num_batching_threads: Number of threads which assemble batches. Must be 1
+        if `num_batches` is not -1.
+      num_prefetched_batches: Maximum number of complete batches waiting to be
+        yielded.
+
+    Yields:
+      Instances of `ReplaySample` whose info fields and flat data are DLPack
+      capsules of tensors with a leading dimension of size `batch_size`.
+
+    Raises:
+      ValueError: If `num_batching_threads` is greater than 1 and `num_batches`
+        is not -1.
+    """
+    if num_batches != -1 and num_batching_threads > 1:
+      raise ValueError(
+          'num_batching_threads must be 1 when num_batches is limited.')
+
+    max_samples = -1 if num_batches == -1 else num_batches * batch_size
+    iterator = self._client.NewBatchIterator(
+        table,
+        batch_size=batch_size,
+        max_samples=max_samples,
+        num_workers=num_workers,
+        max_in_flight_samples_per_worker=max_in_flight_samples_per_worker,
+        num_batching_threads=num_batching_threads,
+        num_prefetched_batches=num_prefetched_batches)
+
+    try:
+      i = 0
+      while num_batches == -1 or i < num_batches:
+        batch = iterator.GetNext()
+        yield replay_sample.ReplaySample(
+            replay_sample.SampleInfo(*batch[:4]), batch[4:])
+        i += 1
+    finally:
+      iterator.Close()
+
   def mutate_priorities(self,
                         table: str,
                         updates: Optional[Dict[int, float]] = None,
@@ -470,6 +600,39 @@ class Client:
       deletes = []
     self._client.MutatePriorities(table, list(updates.items()), deletes)
 
+  def delete_episodes(self, table: str, episode_ids: List[int]):
+    """Deletes all items of a table which reference any of the episodes.
+
+    The items of each episode are found through an index maintained by the
+    table, so this is much cheaper than finding the keys of the items and
+    deleting them with `mutate_priorities`.
+
+    Args:
+      table: Name of the table to delete the items from.
+      episode_ids: Ids of the episodes to delete. Episodes which cannot be found
+        are ignored.
+    """
+    self._client.DeleteEpisodes(table, episode_ids)
+
+  def transform_priorities(self,
+                           table: str,
+                           scale: float = 1.0,
+                           priority_exponent: Optional[float] = None):
+    """Changes the priorities of all items in a table at once.
+
+    The server applies the change in a single pass over the table, which is far
+    cheaper than updating every item with `mutate_priorities`.
+
+    Args:
+      table: Name of the priority table to transform.
+      scale: Positive factor that the priority of every item is multiplied by,
+        e.g to decay all priorities.
+      priority_exponent: If set, the new priority exponent of the sampler of the
+        table, which must be prioritized. Used for the items already in the
+        table as well as for all future items. Applied after `scale`.
+    """
+    self._client.TransformPriorities(table, scale, priority_exponent)
+
   def reset(self, table: str):
     """Clears all items of the table and resets its RateLimiter.
 
@@ -497,12 +660,78 @@ class Client:
     try:
       info_proto_strings = self._client.ServerInfo(timeout or 0)
     except RuntimeError as e:
-      if 'Deadline Exceeded' in str(e) and timeout is not None:
-        raise errors.DeadlineExceededError(
-            f'ServerInfo call did not complete within provided timeout of '
-            f'{timeout}s')
-      raise
+      raise self._server_info_error(e, timeout)
+    return self._parse_server_info(info_proto_strings)
+
+  def mutate_priorities_async(
+      self,
+      table: str,
+      updates: Optional[Dict[int, float]] = None,
+      deletes: Optional[List[int]] = None) -> futures.Future:
+    """Non-blocking version of `mutate_priorities`.
+
+    The request is sent without blocking the calling thread and the returned
+    future is completed from a thread of the client once the server has applied
+    it. Use `asyncio.wrap_future` to await the result from a coroutine.
 
+    Args:
+      table: Name of the priority table to update.
+      updates: Mapping from priority item key to new priority value. If a key
+        cannot be found then it is ignored.
+      deletes: List of keys for priority items to delete. If a key cannot be
+        found then it is ignored.
+
+    Returns:
+      A future which is resolved to None once the mutations have been applied
+      or to the error of the call.
+    """
+    future = futures.Future()
+    self._client.AsyncMutatePriorities(table, list((updates or {}).items()),
+                                       deletes or [],
+                                       _future_callback(future))
+    return future
+
+  def reset_async(self, table: str) -> futures.Future:
+    """Non-blocking version of `reset` (see `mutate_priorities_async`)."""
+    future = futures.Future()
+    self._client.AsyncReset(table, _future_callback(future))
+    return future
+
+  def server_info_async(self, timeout: Optional[int] = None) -> futures.Future:
+    """Non-blocking version of `server_info` (see `mutate_priorities_async`).
+
+    Args:
+      timeout: Timeout in seconds to wait for server response. By default no
+        deadline is set.
+
+    Returns:
+      A future which is resolved to the same dictionary `server_info` returns or
+      to the error of the call.
+    """
+    future = futures.Future()
+
+    def parse(info_proto_strings):
+      return self._parse_server_info(info_proto_strings)
+
+    def convert_error(error):
+      if isinstance(error, RuntimeError):
+        return self._server_info_error(error, timeout)
+      return error
+
+    self._client.AsyncServerInfo(
+        timeout or 0, _future_callback(future, parse, convert_error))
+    return future
+
+  def _server_info_error(self, error: RuntimeError,
+                         timeout: Optional[int]) -> Exception:
+    if 'Deadline Exceeded' in str(error) and timeout is not None:
+      return errors.DeadlineExceededError(
+          f'ServerInfo call did not complete within provided timeout of '
+          f'{timeout}s')
+    return error
+
+  def _parse_server_info(
+      self, info_proto_strings) -> Dict[str, reverb_types.TableInfo]:
     table_infos = {}
     for proto_string in info_proto_strings:
       table_info = reverb_types.TableInfo.from_serialized_proto(proto_string)
@@ -239,6 +239,79 @@ class ClientTest(absltest.TestCase):
     after = self._get_sample_frequency()
     self.assertLen(after, 3)
 
+  def test_mutate_priorities_async(self):
+    self.client.insert([0], {TABLE_NAME: 1.0})
+    self.client.insert([0], {TABLE_NAME: 1.0})
+    self.client.insert([0], {TABLE_NAME: 1.0})
+
+    keys = [sample[0].info.key for sample in self.client.sample(TABLE_NAME, 3)]
+    pending = [
+        self.client.mutate_priorities_async(TABLE_NAME, updates={key: 2.0})
+        for key in keys
+    ]
+    for future in pending:
+      self.assertIsNone(future.result(timeout=10))
+
+    priorities = set(sample[0].info.priority
+                     for sample in self.client.sample(TABLE_NAME, 10))
+    self.assertEqual(priorities, {2.0})
+
+  def test_mutate_priorities_async_returns_errors(self):
+    future = self.client.mutate_priorities_async('unknown', deletes=[1])
+    with self.assertRaises(RuntimeError):
+      future.result(timeout=10)
+
+  def test_reset_async(self):
+    self.client.insert([0], {TABLE_NAME: 1.0})
+    self.client.reset_async(TABLE_NAME).result(timeout=10)
+    self.assertEqual(self.tables[0].info.current_size, 0)
+
+  def test_server_info_async(self):
+    self.client.insert([0], {TABLE_NAME: 1.0})
+    server_info = self.client.server_info_async().result(timeout=10)
+    self.assertLen(server_info, 3)
+    self.assertEqual(server_info[TABLE_NAME].current_size, 1)
+    self.assertEqual(server_info[TABLE_NAME].signature,
+                     tf.TensorSpec(dtype=tf.int64, shape=[]))
+
+  def test_transform_priorities_scale(self):
+    self.client.insert([0], {TABLE_NAME: 1.0})
+    self.client.insert([0], {TABLE_NAME: 3.0})
+
+    self.client.transform_priorities(TABLE_NAME, scale=0.5)
+
+    priorities = set(sample[0].info.priority
+                     for sample in self.client.sample(TABLE_NAME, 100))
+    self.assertEqual(priorities, {0.5, 1.5})
+
+    # The relative priorities of new items are unaffected by the scaling.
+    self.client.insert([0], {TABLE_NAME: 0.5})
+    after = self._get_sample_frequency()
+    self.assertLen(after, 3)
+    self.assertAlmostEqual(after[0], 0.6, delta=0.05)
+    self.assertAlmostEqual(after[1], 0.2, delta=0.05)
+    self.assertAlmostEqual(after[2], 0.2, delta=0.05)
+
+  def test_transform_priorities_exponent(self):
+    self.addCleanup(
+        self.client.transform_priorities, TABLE_NAME, priority_exponent=1)
+    self.client.insert([0], {TABLE_NAME: 1.0})
+    self.client.insert([0], {TABLE_NAME: 3.0})
+
+    before = self._get_sample_frequency()
+    self.assertAlmostEqual(before[0], 0.75, delta=0.05)
+
+    self.client.transform_priorities(TABLE_NAME, priority_exponent=0)
+
+    after = self._get_sample_frequency()
+    self.assertLen(after, 2)
+    self.assertAlmostEqual(after[0], 0.5, delta=0.05)
+    self.assertAlmostEqual(after[1], 0.5, delta=0.05)
+
+  def test_transform_priorities_rejects_invalid_scale(self):
+    with self.assertRaises(ValueError):
+      self.client.transform_priorities(TABLE_NAME, scale=-1)
+
   def test_reset(self):
     self.client.insert([0], {TABLE_NAME: 1.0})
     self.client.insert([0], {TABLE_NAME: 1.0})
@@ -359,6 +432,29 @@ class ClientTest(absltest.TestCase):
     self.assertIsInstance(sample.info.table_size, int)
     self.assertIsInstance(sample.info.priority, float)
 
+  def test_sample_trajectory_data_is_read_only(self):
+    with self.client.trajectory_writer(3) as writer:
+      for i in range(3):
+        writer.append({'a': np.full([2, 2], i, np.float32)})
+
+      writer.create_item(
+          table=SIMPLE_QUEUE_NAME,
+          priority=1.0,
+          trajectory={'a': writer.history['a'][:]})
+
+    sample = next(self.client.sample(SIMPLE_QUEUE_NAME,
+                                     emit_timesteps=False,
+                                     unpack_as_table_signature=False))
+
+    # The sampled data aliases the buffers of the sampler and thus can't be
+    # modified in place. The buffers are kept alive by the arrays.
+    data = sample.data[0]
+    self.assertFalse(data.flags.writeable)
+    with self.assertRaises(ValueError):
+      data[0] = 0
+    np.testing.assert_array_equal(
+        data, np.stack([np.full([2, 2], i, np.float32) for i in range(3)]))
+
   def test_sample_trajectory_as_flat_data(self):
     with self.client.trajectory_writer(3) as writer:
       for _ in range(3):
@@ -389,6 +485,63 @@ class ClientTest(absltest.TestCase):
     self.assertIsInstance(sample.info.table_size, int)
     self.assertIsInstance(sample.info.priority, float)
 
+  def test_sample_trajectory_decoded_lazily(self):
+    with self.client.trajectory_writer(3) as writer:
+      for i in range(3):
+        writer.append({
+            'a': np.full([], i, np.int64),
+            'b': np.ones([2, 2], np.float32),
+        })
+
+      writer.create_item(
+          table=SIMPLE_QUEUE_NAME,
+          priority=1.0,
+          trajectory={
+              'a': writer.history['a'][:],
+              'b': writer.history['b'][:],
+          })
+
+    sample = next(self.client.sample(SIMPLE_QUEUE_NAME,
+                                     emit_timesteps=False,
+                                     decode_lazily=True))
+
+    self.assertLen(sample.data, 2)
+    np.testing.assert_array_equal(sample.data[-1], np.ones([3, 2, 2]))
+    np.testing.assert_array_equal(sample.data[0], np.arange(3))
+    self.assertIs(sample.data[0], sample.data[0])
+    with self.assertRaises(IndexError):
+      _ = sample.data[2]
+
+    self.assertIsInstance(sample.info.key, int)
+    self.assertIsInstance(sample.info.probability, float)
+    self.assertIsInstance(sample.info.table_size, int)
+    self.assertIsInstance(sample.info.priority, float)
+
+  def test_sample_decode_lazily_requires_flat_trajectories(self):
+    with self.assertRaises(ValueError):
+      next(self.client.sample(SIMPLE_QUEUE_NAME, decode_lazily=True))
+
+  def test_dlpack_batches(self):
+    for i in range(4):
+      self.client.insert(np.full([3], i, np.int32), {SIMPLE_QUEUE_NAME: 1.0})
+
+    batches = list(self.client.dlpack_batches(
+        SIMPLE_QUEUE_NAME, batch_size=2, num_batches=2))
+
+    self.assertLen(batches, 2)
+    for i, batch in enumerate(batches):
+      self.assertLen(batch.data, 1)
+      data = tf.experimental.dlpack.from_dlpack(batch.data[0]).numpy()
+      np.testing.assert_array_equal(
+          data, [np.full([1, 3], 2 * i + j, np.int32) for j in range(2)])
+      key = tf.experimental.dlpack.from_dlpack(batch.info.key).numpy()
+      self.assertEqual(key.shape, (2,))
+
+  def test_dlpack_batches_requires_one_thread_for_limited_batches(self):
+    with self.assertRaises(ValueError):
+      next(self.client.dlpack_batches(
+          SIMPLE_QUEUE_NAME, batch_size=2, num_batching_threads=2))
+
   def test_sample_trajectory_written_with_insert(self):
     self.client.insert(np.ones([3, 3], np.int32), {SIMPLE_QUEUE_NAME: 1.0})
 
@@ -66,8 +66,10 @@ class ReplayDataset(tf.data.Dataset):
       table: Probability table to sample from.
       dtypes: Dtypes of the data output. Can be nested.
       shapes: Shapes of the data output. Can be nested.
-      max_in_flight_samples_per_worker: The number of samples requested in each
-        batch of samples. Higher values give higher throughput but too big
+      max_in_flight_samples_per_worker: The maximum number of samples requested
+        but not yet received by a worker. Every received sample is replaced by
+        a new request (in batches of half this value) so the stream is kept
+        busy. Higher values give higher throughput but too big
         values can result in skewed sampling distributions as large number of
         samples are fetched from single snapshot of the replay (followed by a
         period of lower activity as the samples are consumed). A good rule of
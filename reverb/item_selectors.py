@@ -22,5 +22,9 @@ Fifo = pybind.FifoSelector
 Lifo = pybind.LifoSelector
 MaxHeap = functools.partial(pybind.HeapSelector, False)  # pylint: disable=invalid-name
 MinHeap = functools.partial(pybind.HeapSelector, True)  # pylint: disable=invalid-name
+MaxDaryHeap = functools.partial(pybind.DaryHeapSelector, False)  # pylint: disable=invalid-name
+MinDaryHeap = functools.partial(pybind.DaryHeapSelector, True)  # pylint: disable=invalid-name
 Prioritized = pybind.PrioritizedSelector
+PrioritizedBTree = pybind.BTreePrioritizedSelector
+RecencyWeighted = pybind.RecencyWeightedSelector
 Uniform = pybind.UniformSelector
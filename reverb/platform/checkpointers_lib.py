@@ -63,6 +63,61 @@ class DefaultCheckpointer(CheckpointerBase):
                                               self.fallback_checkpoint_path)
 
 
+class StreamingCheckpointer(CheckpointerBase):
+  """Streams checkpoints in parallel parts, e.g. to GCS or S3.
+
+  The chunks are split into files of roughly `part_size_bytes` which are
+  uploaded in parallel and the checkpoint is committed by writing a manifest
+  once all parts are complete.
+  """
+
+  def __init__(self,
+               path: str,
+               part_size_bytes: int = 64 << 20,
+               max_buffered_bytes: int = 256 << 20,
+               deduplicate_chunks: bool = False,
+               min_live_fraction: float = 0.5,
+               lazy_restore: bool = False,
+               fallback_checkpoint_path: Optional[str] = None):
+    """Constructor of StreamingCheckpointer.
+
+    Args:
+      path: Root directory to store checkpoints in.
+      part_size_bytes: Approximate size of each file of chunks.
+      max_buffered_bytes: Upper bound on the number of bytes being written at
+        any one time, which limits the number of parallel uploads.
+      deduplicate_chunks: If True then the chunks are written to a pool shared
+        by all checkpoints in `path` and only the chunks which were not
+        persisted by the previous checkpoint are written.
+      min_live_fraction: Only used when `deduplicate_chunks` is True. Shared
+        files of which less than this fraction of the chunks is still
+        referenced are rewritten so that they can be deleted.
+      lazy_restore: If True then the server starts serving as soon as the
+        tables of the latest checkpoint have been restored, and the data of the
+        chunks is read in the background (or when first sampled).
+      fallback_checkpoint_path: (Optional) path to the actual checkpoint to load
+        if `path` does not contain any checkpoints. See `DefaultCheckpointer`.
+    """
+    self.path = path
+    self.part_size_bytes = part_size_bytes
+    self.max_buffered_bytes = max_buffered_bytes
+    self.deduplicate_chunks = deduplicate_chunks
+    self.min_live_fraction = min_live_fraction
+    self.lazy_restore = lazy_restore
+    self.fallback_checkpoint_path = fallback_checkpoint_path
+
+  def internal_checkpointer(self) -> pybind.Checkpointer:
+    """Creates the actual Checkpointer-object used by the C++ layer."""
+    return pybind.create_streaming_checkpointer(
+        root_dir=self.path,
+        part_size_bytes=self.part_size_bytes,
+        max_buffered_bytes=self.max_buffered_bytes,
+        deduplicate_chunks=self.deduplicate_chunks,
+        min_live_fraction=self.min_live_fraction,
+        lazy_restore=self.lazy_restore,
+        fallback_checkpoint_path=self.fallback_checkpoint_path)
+
+
 class TempDirCheckpointer(DefaultCheckpointer):
   """Stores and loads checkpoints from a temporary directory."""
 
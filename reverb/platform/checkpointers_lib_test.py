@@ -28,5 +28,24 @@ class TempDirCheckpointer(absltest.TestCase):
                           pybind.Checkpointer)
 
 
+class StreamingCheckpointer(absltest.TestCase):
+
+  def test_constructs_internal_checkpointer(self):
+    checkpointer = checkpointers_lib.StreamingCheckpointer(
+        self.create_tempdir().full_path,
+        part_size_bytes=1 << 20,
+        deduplicate_chunks=True)
+    internal_checkpointer = checkpointer.internal_checkpointer()
+    self.assertIsInstance(internal_checkpointer, pybind.Checkpointer)
+    self.assertIn('StreamingCheckpointer', repr(internal_checkpointer))
+    self.assertIn('deduplicate_chunks=1', repr(internal_checkpointer))
+
+  def test_rejects_invalid_options(self):
+    checkpointer = checkpointers_lib.StreamingCheckpointer(
+        self.create_tempdir().full_path, part_size_bytes=0)
+    with self.assertRaises(ValueError):
+      checkpointer.internal_checkpointer()
+
+
 if __name__ == '__main__':
   absltest.main()
@@ -21,6 +21,7 @@ from reverb.platform import checkpointers_lib
 
 CheckpointerBase = checkpointers_lib.CheckpointerBase
 DefaultCheckpointer = checkpointers_lib.DefaultCheckpointer
+StreamingCheckpointer = checkpointers_lib.StreamingCheckpointer
 TempDirCheckpointer = checkpointers_lib.TempDirCheckpointer
 
 
@@ -17,31 +17,45 @@
 
 #include "numpy/arrayobject.h"
 #include "absl/container/inlined_vector.h"
+#include "absl/base/thread_annotations.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
 #include "absl/types/optional.h"
+#include "dlpack/dlpack.h"
 #include "pybind11/numpy.h"
 #include "pybind11/pybind11.h"
 #include "pybind11/stl.h"
+#include "reverb/cc/batch_iterator.h"
+#include "reverb/cc/batched_trajectory_writer.h"
 #include "reverb/cc/checkpointing/interface.h"
 #include "reverb/cc/chunker.h"
 #include "reverb/cc/client.h"
 #include "reverb/cc/platform/checkpointing.h"
 #include "reverb/cc/platform/server.h"
+#include "reverb/cc/platform/tfrecord_dataset.h"
+#include "reverb/cc/platform/streaming_checkpointer.h"
+#include "reverb/cc/platform/status_macros.h"
 #include "reverb/cc/rate_limiter.h"
 #include "reverb/cc/sampler.h"
+#include "reverb/cc/selectors/dary_heap.h"
 #include "reverb/cc/selectors/fifo.h"
 #include "reverb/cc/selectors/heap.h"
 #include "reverb/cc/selectors/interface.h"
 #include "reverb/cc/selectors/lifo.h"
 #include "reverb/cc/selectors/prioritized.h"
+#include "reverb/cc/selectors/prioritized_btree.h"
+#include "reverb/cc/selectors/recency_weighted.h"
 #include "reverb/cc/selectors/uniform.h"
+#include "reverb/cc/sharded_client.h"
 #include "reverb/cc/support/tf_util.h"
 #include "reverb/cc/table.h"
 #include "reverb/cc/table_extensions/interface.h"
+#include "reverb/cc/table_extensions/replication.h"
 #include "reverb/cc/trajectory_writer.h"
 #include "reverb/cc/writer.h"
+#include "tensorflow/core/framework/allocation_description.pb.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/types.h"
@@ -83,6 +97,45 @@ inline void MaybeRaiseFromStatus(const absl::Status &status) {
   throw pybind11::error_already_set();
 }
 
+// Python objects referenced by a callback which is called from a C++ thread.
+// `keep_alive` (usually the object making the call) is referenced until the
+// callback is destroyed, which releases the objects with the GIL held.
+struct PyCallback {
+  pybind11::object keep_alive;
+  pybind11::function callback;
+};
+
+std::shared_ptr<PyCallback> MakePyCallback(pybind11::object keep_alive,
+                                           pybind11::function callback) {
+  return std::shared_ptr<PyCallback>(
+      new PyCallback{std::move(keep_alive), std::move(callback)},
+      [](PyCallback *callback) {
+        pybind11::gil_scoped_acquire gil;
+        delete callback;
+      });
+}
+
+// Calls `callback(None, result)` if `status` is OK and otherwise
+// `callback(error, None)` where `error` is the exception which
+// `MaybeRaiseFromStatus` raises for `status`. Exceptions raised by the callback
+// are reported as unraisable since there is no Python frame to raise them in.
+// Must be called with the GIL held.
+void InvokePyCallback(const PyCallback &callback, const absl::Status &status,
+                      pybind11::object result) {
+  try {
+    try {
+      MaybeRaiseFromStatus(status);
+    } catch (pybind11::error_already_set &e) {
+      callback.callback(e.value(), pybind11::none());
+      return;
+    }
+    callback.callback(pybind11::none(), std::move(result));
+  } catch (pybind11::error_already_set &e) {
+    e.restore();
+    PyErr_WriteUnraisable(callback.callback.ptr());
+  }
+}
+
 char const *NumpyTypeName(int numpy_type) {
   switch (numpy_type) {
 #define TYPE_CASE(s) \
@@ -303,8 +356,74 @@ inline tensorflow::Status VerifyDtypeIsSupported(
   return tensorflow::Status::OK();
 }
 
+ABSL_CONST_INIT absl::Mutex delayed_decrefs_mu(absl::kConstInit);
+
+// References to ndarrays which were released by threads that did not hold the
+// GIL. They are dropped the next time an ndarray is converted to a tensor.
+std::vector<PyObject *> &DelayedDecrefs()
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(delayed_decrefs_mu) {
+  static auto *decrefs = new std::vector<PyObject *>();
+  return *decrefs;
+}
+
+// Drops the reference to `ndarray` straight away if the GIL is held by the
+// calling thread, otherwise the decref is delayed until `ClearDelayedDecrefs`
+// is called. Acquiring the GIL here could deadlock if the thread holding it is
+// waiting for the calling thread.
+void DecrefNdArray(PyObject *ndarray) {
+  if (PyGILState_Check()) {
+    Py_DECREF(ndarray);
+    return;
+  }
+  absl::MutexLock lock(&delayed_decrefs_mu);
+  DelayedDecrefs().push_back(ndarray);
+}
+
+// Drops the references queued by `DecrefNdArray`. The GIL must be held.
+void ClearDelayedDecrefs() {
+  std::vector<PyObject *> decrefs;
+  {
+    absl::MutexLock lock(&delayed_decrefs_mu);
+    decrefs.swap(DelayedDecrefs());
+  }
+  for (PyObject *ndarray : decrefs) {
+    Py_DECREF(ndarray);
+  }
+}
+
+// Tensor buffer which aliases the data of an ndarray. The ndarray is kept alive
+// until the last tensor referencing the buffer is destroyed.
+class NdArrayTensorBuffer : public tensorflow::TensorBuffer {
+ public:
+  NdArrayTensorBuffer(PyObject *ndarray, void *data, size_t size)
+      : tensorflow::TensorBuffer(data), ndarray_(ndarray), size_(size) {}
+
+  ~NdArrayTensorBuffer() override { DecrefNdArray(ndarray_); }
+
+  size_t size() const override { return size_; }
+
+  tensorflow::TensorBuffer *root_buffer() override { return this; }
+
+  void FillAllocationDescription(
+      tensorflow::AllocationDescription *proto) const override {
+    proto->set_requested_bytes(size_);
+    proto->set_allocator_name("NdArrayTensorBuffer");
+  }
+
+  bool OwnsMemory() const override { return false; }
+
+ private:
+  PyObject *ndarray_;
+  const size_t size_;
+};
+
+// If `alias_buffer` is true then tensors with dtypes that can be memcpy'd point
+// directly at the (C-contiguous and aligned) data of the ndarray rather than
+// owning a copy of it. The caller must ensure that the ndarray isn't modified
+// while the tensor is in use.
 tensorflow::Status NdArrayToTensor(PyObject *ndarray,
-                                   tensorflow::Tensor *out_tensor) {
+                                   tensorflow::Tensor *out_tensor,
+                                   bool alias_buffer = false) {
   DCHECK(out_tensor != nullptr);
   auto array_safe = make_safe(PyArray_FromAny(
       /*op=*/ndarray,
@@ -331,7 +450,18 @@ tensorflow::Status NdArrayToTensor(PyObject *ndarray,
     nelems *= dims[i];
   }
 
-  if (tensorflow::DataTypeCanUseMemcpy(dtype)) {
+  // Eigen requires aligned buffers so unaligned ndarrays are always copied.
+  bool is_aligned = reinterpret_cast<intptr_t>(PyArray_DATA(py_array)) %
+                        EIGEN_MAX_ALIGN_BYTES ==
+                    0;
+  if (tensorflow::DataTypeCanUseMemcpy(dtype) && alias_buffer && is_aligned) {
+    ClearDelayedDecrefs();
+    auto *buffer = new NdArrayTensorBuffer(
+        array_safe.release(), PyArray_DATA(py_array), PyArray_NBYTES(py_array));
+    *out_tensor =
+        tensorflow::Tensor(dtype, tensorflow::TensorShape(dims), buffer);
+    buffer->Unref();
+  } else if (tensorflow::DataTypeCanUseMemcpy(dtype)) {
     *out_tensor = tensorflow::Tensor(dtype, tensorflow::TensorShape(dims));
     size_t size = PyArray_NBYTES(py_array);
     memcpy(out_tensor->data(), PyArray_DATA(py_array), size);
@@ -351,8 +481,19 @@ tensorflow::Status NdArrayToTensor(PyObject *ndarray,
   return tensorflow::Status::OK();
 }
 
+void DeleteTensorCapsule(PyObject *capsule) {
+  delete static_cast<tensorflow::Tensor *>(
+      PyCapsule_GetPointer(capsule, nullptr));
+}
+
+// If `alias_buffer` is true then tensors with dtypes that can be memcpy'd are
+// returned as read-only ndarrays which point directly at the tensor buffer. A
+// capsule holding a reference to the buffer is set as the base of the ndarray.
+// The ndarrays are read-only as the buffer may be shared with other tensors
+// (e.g other timesteps of the same chunk or the decoded chunk cache).
 tensorflow::Status TensorToNdArray(const tensorflow::Tensor &tensor,
-                                   PyObject **out_ndarray) {
+                                   PyObject **out_ndarray,
+                                   bool alias_buffer = false) {
   TF_RETURN_IF_ERROR(VerifyDtypeIsSupported(tensor.dtype()));
 
   // Extract the numpy type and dimensions.
@@ -364,6 +505,31 @@ tensorflow::Status TensorToNdArray(const tensorflow::Tensor &tensor,
     dims[i] = tensor.dim_size(i);
   }
 
+  if (alias_buffer && tensorflow::DataTypeCanUseMemcpy(tensor.dtype()) &&
+      tensor.NumElements() > 0) {
+    // Steals the reference to `descr`.
+    auto safe_out_ndarray = make_safe(PyArray_NewFromDescr(
+        &PyArray_Type, descr, dims.size(), dims.data(), /*strides=*/nullptr,
+        const_cast<char *>(tensor.tensor_data().data()), NPY_ARRAY_CARRAY_RO,
+        /*obj=*/nullptr));
+    if (!safe_out_ndarray) {
+      return tensorflow::errors::Internal("Could not allocate ndarray");
+    }
+    PyObject *capsule = PyCapsule_New(new tensorflow::Tensor(tensor), nullptr,
+                                      &DeleteTensorCapsule);
+    if (capsule == nullptr) {
+      return tensorflow::errors::Internal("Could not allocate capsule");
+    }
+    // Steals the reference to `capsule`.
+    if (PyArray_SetBaseObject(
+            reinterpret_cast<PyArrayObject *>(safe_out_ndarray.get()),
+            capsule) != 0) {
+      return tensorflow::errors::Internal("Could not set base of ndarray");
+    }
+    *out_ndarray = safe_out_ndarray.release();
+    return tensorflow::Status::OK();
+  }
+
   // Allocate an empty array of the desired shape and type.
   auto safe_out_ndarray =
       make_safe(PyArray_Empty(dims.size(), dims.data(), descr, 0));
@@ -388,6 +554,67 @@ tensorflow::Status TensorToNdArray(const tensorflow::Tensor &tensor,
   return tensorflow::Status::OK();
 }
 
+// Tensor converted from or to an ndarray without copying its data when
+// possible. When converted from an ndarray it must only be used by methods
+// which copy the data before returning (e.g `TrajectoryWriter::Append`) as
+// changes made to the ndarray by the caller would otherwise be visible in the
+// tensor. When converted to an ndarray the result is read-only.
+struct AliasedTensor {
+  tensorflow::Tensor tensor;
+};
+
+std::vector<AliasedTensor> WrapAliasedTensors(
+    std::vector<tensorflow::Tensor> tensors) {
+  std::vector<AliasedTensor> aliased(tensors.size());
+  for (int i = 0; i < tensors.size(); i++) {
+    aliased[i].tensor = std::move(tensors[i]);
+  }
+  return aliased;
+}
+
+std::vector<absl::optional<tensorflow::Tensor>> UnwrapAliasedTensors(
+    std::vector<absl::optional<AliasedTensor>> aliased) {
+  std::vector<absl::optional<tensorflow::Tensor>> tensors(aliased.size());
+  for (int i = 0; i < aliased.size(); i++) {
+    if (aliased[i].has_value()) {
+      tensors[i] = std::move(aliased[i]->tensor);
+    }
+  }
+  return tensors;
+}
+
+// Converts `ndarray` and logs the error if the conversion fails.
+bool LoadTensor(PyObject *ndarray, tensorflow::Tensor *tensor,
+                bool alias_buffer) {
+  tensorflow::Status status = NdArrayToTensor(ndarray, tensor, alias_buffer);
+
+  if (!status.ok()) {
+    std::string message = status.ToString();
+    REVERB_LOG(REVERB_ERROR)
+        << "Tensor can't be extracted from the source represented as "
+           "ndarray: "
+        << message;
+    // When a conversion fails, PyErr is set. Returning from `load` with PyErr
+    // set results in crashes so we clear the error here to make the Python
+    // error slightly more readable.
+    PyErr_Clear();
+    return false;
+  }
+  return true;
+}
+
+// Converts `tensor` and sets a Python error if the conversion fails.
+PyObject *CastTensor(const tensorflow::Tensor &tensor, bool alias_buffer) {
+  PyObject *ret;
+  tensorflow::Status status = TensorToNdArray(tensor, &ret, alias_buffer);
+  if (!status.ok()) {
+    std::string message = status.ToString();
+    PyErr_SetString(PyExc_ValueError, message.data());
+    return nullptr;
+  }
+  return ret;
+}
+
 // This wrapper exists for the sole purpose of allowing the weak_ptr to be
 // handled in Python. Pybind supports shared_ptr and unique_ptr out of the box
 // and although it is possible to implement our own `SmartPointer, using a
@@ -411,6 +638,112 @@ class WeakCellRef {
   std::weak_ptr<::deepmind::reverb::CellRef> ref_;
 };
 
+// Sample returned by `Sampler.GetNextLazySample`. The columns are decoded when
+// they are first accessed, without holding the GIL, so the mutex serializes
+// concurrent accesses from different Python threads.
+class LazySample {
+ public:
+  explicit LazySample(std::unique_ptr<::deepmind::reverb::Sample> sample)
+      : sample_(std::move(sample)) {}
+
+  absl::Status GetColumn(int i, tensorflow::Tensor *column) {
+    absl::MutexLock lock(&mu_);
+    return sample_->GetColumn(i, column);
+  }
+
+  // The info fields and the number of columns never change so they can be
+  // read without holding the mutex.
+  const ::deepmind::reverb::Sample &sample() const { return *sample_; }
+
+ private:
+  absl::Mutex mu_;
+  const std::unique_ptr<::deepmind::reverb::Sample> sample_;
+};
+
+// Owns the tensor exported through a DLPack capsule. The buffer of the tensor
+// is shared, not copied, and released when the consumer calls the deleter.
+struct DLPackTensor {
+  tensorflow::Tensor tensor;
+  std::vector<int64_t> shape;
+  DLManagedTensor managed;
+};
+
+absl::Status ToDLDataType(tensorflow::DataType dtype, DLDataType *dl_dtype) {
+  dl_dtype->lanes = 1;
+  dl_dtype->bits = tensorflow::DataTypeSize(dtype) * 8;
+  switch (dtype) {
+    case tensorflow::DT_HALF:
+    case tensorflow::DT_FLOAT:
+    case tensorflow::DT_DOUBLE:
+      dl_dtype->code = kDLFloat;
+      return absl::OkStatus();
+    case tensorflow::DT_INT8:
+    case tensorflow::DT_INT16:
+    case tensorflow::DT_INT32:
+    case tensorflow::DT_INT64:
+      dl_dtype->code = kDLInt;
+      return absl::OkStatus();
+    case tensorflow::DT_UINT8:
+    case tensorflow::DT_UINT16:
+    case tensorflow::DT_UINT32:
+    case tensorflow::DT_UINT64:
+      dl_dtype->code = kDLUInt;
+      return absl::OkStatus();
+    case tensorflow::DT_BFLOAT16:
+      dl_dtype->code = kDLBfloat;
+      return absl::OkStatus();
+    case tensorflow::DT_BOOL:
+      dl_dtype->code = kDLBool;
+      return absl::OkStatus();
+    default:
+      return absl::InvalidArgumentError(
+          absl::StrCat("Tensors of type ",
+                       tensorflow::DataTypeString(dtype),
+                       " can't be exported through DLPack."));
+  }
+}
+
+// Wraps `tensor` in a DLPack capsule (see
+// https://dmlc.github.io/dlpack/latest/python_spec.html) without copying it.
+// The capsule can be consumed once, e.g. by `jax.dlpack.from_dlpack`. If it
+// never is, the tensor is released along with the capsule.
+absl::Status ToDLPackCapsule(tensorflow::Tensor tensor, PyObject **capsule) {
+  auto exported = std::make_unique<DLPackTensor>();
+  REVERB_RETURN_IF_ERROR(
+      ToDLDataType(tensor.dtype(), &exported->managed.dl_tensor.dtype));
+  for (int64_t dim : tensor.shape().dim_sizes()) {
+    exported->shape.push_back(dim);
+  }
+  exported->tensor = std::move(tensor);
+
+  DLTensor &dl_tensor = exported->managed.dl_tensor;
+  dl_tensor.data = const_cast<char *>(exported->tensor.tensor_data().data());
+  dl_tensor.device = {kDLCPU, 0};
+  dl_tensor.ndim = exported->shape.size();
+  dl_tensor.shape = exported->shape.data();
+  dl_tensor.strides = nullptr;  // Compact and row-major.
+  dl_tensor.byte_offset = 0;
+  exported->managed.manager_ctx = exported.get();
+  exported->managed.deleter = [](DLManagedTensor *managed) {
+    delete static_cast<DLPackTensor *>(managed->manager_ctx);
+  };
+
+  *capsule = PyCapsule_New(&exported->managed, "dltensor", [](PyObject *obj) {
+    // Consumers rename the capsule to "used_dltensor" once they have taken
+    // ownership of the tensor.
+    if (PyCapsule_IsValid(obj, "dltensor")) {
+      auto *managed = static_cast<DLManagedTensor *>(
+          PyCapsule_GetPointer(obj, "dltensor"));
+      managed->deleter(managed);
+    }
+  });
+  if (*capsule == nullptr) {
+    return absl::InternalError("Failed to create DLPack capsule.");
+  }
+  exported.release();
+  return absl::OkStatus();
+}
+
 }  // namespace
 
 namespace pybind11 {
@@ -440,33 +773,26 @@ struct type_caster<tensorflow::Tensor> {
   PYBIND11_TYPE_CASTER(tensorflow::Tensor, _("tensorflow::Tensor"));
 
   bool load(handle handle, bool) {
-    tensorflow::Status status = NdArrayToTensor(handle.ptr(), &value);
-
-    if (!status.ok()) {
-      std::string message = status.ToString();
-      REVERB_LOG(REVERB_ERROR)
-          << "Tensor can't be extracted from the source represented as "
-             "ndarray: "
-          << message;
-      // When a conversion fails, PyErr is set. Returning from `load` with PyErr
-      // set results in crashes so we clear the error here to make the Python
-      // error slightly more readable.
-      PyErr_Clear();
-      return false;
-    }
-    return true;
+    return LoadTensor(handle.ptr(), &value, /*alias_buffer=*/false);
   }
 
   static handle cast(const tensorflow::Tensor &src, return_value_policy,
                      handle) {
-    PyObject *ret;
-    tensorflow::Status status = TensorToNdArray(src, &ret);
-    if (!status.ok()) {
-      std::string message = status.ToString();
-      PyErr_SetString(PyExc_ValueError, message.data());
-      return nullptr;
-    }
-    return ret;
+    return CastTensor(src, /*alias_buffer=*/false);
+  }
+};
+
+template <>
+struct type_caster<AliasedTensor> {
+ public:
+  PYBIND11_TYPE_CASTER(AliasedTensor, _("tensorflow::Tensor"));
+
+  bool load(handle handle, bool) {
+    return LoadTensor(handle.ptr(), &value.tensor, /*alias_buffer=*/true);
+  }
+
+  static handle cast(const AliasedTensor &src, return_value_policy, handle) {
+    return CastTensor(src.tensor, /*alias_buffer=*/true);
   }
 };
 
@@ -501,7 +827,53 @@ PYBIND11_MODULE(libpybind, m) {
 
   py::class_<PrioritizedSelector, ItemSelector,
              std::shared_ptr<PrioritizedSelector>>(m, "PrioritizedSelector")
-      .def(py::init<double>(), py::arg("priority_exponent"));
+      .def(py::init([](double priority_exponent,
+                       const std::string &batch_sampling)
+                        -> PrioritizedSelector * {
+             PrioritizedSelector::BatchSampling mode;
+             if (batch_sampling == "independent") {
+               mode = KeyDistributionOptions::Prioritized::
+                   BATCH_SAMPLING_INDEPENDENT;
+             } else if (batch_sampling == "stratified") {
+               mode = KeyDistributionOptions::Prioritized::
+                   BATCH_SAMPLING_STRATIFIED;
+             } else if (batch_sampling == "without_replacement") {
+               mode = KeyDistributionOptions::Prioritized::
+                   BATCH_SAMPLING_WITHOUT_REPLACEMENT;
+             } else {
+               MaybeRaiseFromStatus(absl::InvalidArgumentError(absl::StrCat(
+                   "batch_sampling must be one of 'independent', "
+                   "'stratified' or 'without_replacement' but got '",
+                   batch_sampling, "'.")));
+               return nullptr;
+             }
+             return new PrioritizedSelector(priority_exponent, mode);
+           }),
+           py::arg("priority_exponent"),
+           py::arg("batch_sampling") = "independent");
+
+  py::class_<BTreePrioritizedSelector, ItemSelector,
+             std::shared_ptr<BTreePrioritizedSelector>>(
+      m, "BTreePrioritizedSelector")
+      .def(py::init<double, int>(), py::arg("priority_exponent"),
+           py::arg("branching_factor") =
+               BTreePrioritizedSelector::kDefaultBranchingFactor);
+
+  py::class_<RecencyWeightedSelector, ItemSelector,
+             std::shared_ptr<RecencyWeightedSelector>>(
+      m, "RecencyWeightedSelector")
+      .def(py::init([](double priority_exponent,
+                       double decay_seconds) -> RecencyWeightedSelector * {
+             if (!(decay_seconds > 0)) {
+               MaybeRaiseFromStatus(absl::InvalidArgumentError(absl::StrCat(
+                   "decay_seconds must be positive but got ", decay_seconds,
+                   ".")));
+               return nullptr;
+             }
+             return new RecencyWeightedSelector(priority_exponent,
+                                                absl::Seconds(decay_seconds));
+           }),
+           py::arg("priority_exponent"), py::arg("decay_seconds"));
 
   py::class_<FifoSelector, ItemSelector, std::shared_ptr<FifoSelector>>(
       m, "FifoSelector")
@@ -519,15 +891,42 @@ PYBIND11_MODULE(libpybind, m) {
       m, "HeapSelector")
       .def(py::init<bool>(), py::arg("min_heap"));
 
+  py::class_<DaryHeapSelector, ItemSelector,
+             std::shared_ptr<DaryHeapSelector>>(m, "DaryHeapSelector")
+      .def(py::init<bool, int>(), py::arg("min_heap"),
+           py::arg("arity") = DaryHeapSelector::kDefaultArity);
+
   py::class_<TableExtension, std::shared_ptr<TableExtension>>(m,
                                                               "TableExtension")
       .def("__repr__", &TableExtension::DebugString,
            py::call_guard<py::gil_scoped_release>());
 
+  py::class_<ReplicationExtension, TableExtension,
+             std::shared_ptr<ReplicationExtension>>(m, "ReplicationExtension")
+      .def(py::init([](const std::vector<std::string> &replica_addresses,
+                       int max_items_per_request, int max_attempts,
+                       double retry_delay_seconds)
+                        -> ReplicationExtension * {
+             ReplicationExtension::Options options;
+             options.max_items_per_request = max_items_per_request;
+             options.max_attempts = max_attempts;
+             options.retry_delay = absl::Seconds(retry_delay_seconds);
+             MaybeRaiseFromStatus(options.Validate());
+             return new ReplicationExtension(replica_addresses, options);
+           }),
+           py::arg("replica_addresses"), py::arg("max_items_per_request"),
+           py::arg("max_attempts"), py::arg("retry_delay_seconds"))
+      .def("flush", &ReplicationExtension::Flush,
+           py::call_guard<py::gil_scoped_release>())
+      .def_property_readonly("num_dropped_operations",
+                             &ReplicationExtension::num_dropped_operations);
+
   py::class_<RateLimiter, std::shared_ptr<RateLimiter>>(m, "RateLimiter")
       .def(py::init<double, int, double, double>(),
            py::arg("samples_per_insert"), py::arg("min_size_to_sample"),
            py::arg("min_diff"), py::arg("max_diff"))
+      .def("share_for_shards", &RateLimiter::ShareForShards,
+           py::arg("num_shards"))
       .def("__repr__", &RateLimiter::DebugString,
            py::call_guard<py::gil_scoped_release>());
 
@@ -567,6 +966,17 @@ PYBIND11_MODULE(libpybind, m) {
            py::call_guard<py::gil_scoped_release>())
       .def("can_insert", &Table::CanInsert,
            py::call_guard<py::gil_scoped_release>())
+      .def(
+          "set_snapshot_sampling",
+          [](Table *table, bool enabled) {
+            absl::Status status;
+            {
+              py::gil_scoped_release g;
+              status = table->SetSnapshotSampling(enabled);
+            }
+            MaybeRaiseFromStatus(status);
+          },
+          py::arg("enabled"))
       .def(
           "info",
           [](Table *table) -> py::bytes {
@@ -608,7 +1018,8 @@ PYBIND11_MODULE(libpybind, m) {
              }
 
              MaybeRaiseFromStatus(status);
-             return std::make_pair(std::move(sample), end_of_sequence);
+             return std::make_pair(WrapAliasedTensors(std::move(sample)),
+                                   end_of_sequence);
            })
       .def("GetNextTrajectory",
            [](Sampler *sampler) {
@@ -625,10 +1036,84 @@ PYBIND11_MODULE(libpybind, m) {
              }
 
              MaybeRaiseFromStatus(status);
-             return sample;
+             return WrapAliasedTensors(std::move(sample));
+           })
+      .def("GetNextLazySample",
+           [](Sampler *sampler) {
+             absl::Status status;
+             std::unique_ptr<Sample> sample;
+
+             // Release the GIL only when waiting for the call to complete. If
+             // the GIL is not held when `MaybeRaiseFromStatus` is called it can
+             // result in segfaults as the Python exception is populated with
+             // details from the status.
+             {
+               py::gil_scoped_release g;
+               status = sampler->GetNextLazySample(&sample);
+             }
+
+             MaybeRaiseFromStatus(status);
+             return std::make_shared<LazySample>(std::move(sample));
            })
       .def("Close", &Sampler::Close, py::call_guard<py::gil_scoped_release>());
 
+  py::class_<LazySample, std::shared_ptr<LazySample>>(m, "LazySample")
+      .def_property_readonly(
+          "key", [](LazySample *sample) { return sample->sample().key(); })
+      .def_property_readonly(
+          "probability",
+          [](LazySample *sample) { return sample->sample().probability(); })
+      .def_property_readonly(
+          "table_size",
+          [](LazySample *sample) { return sample->sample().table_size(); })
+      .def_property_readonly(
+          "priority",
+          [](LazySample *sample) { return sample->sample().priority(); })
+      .def_property_readonly(
+          "num_columns",
+          [](LazySample *sample) { return sample->sample().num_columns(); })
+      .def("GetColumn", [](LazySample *sample, int i) {
+        absl::Status status;
+        tensorflow::Tensor column;
+
+        // Release the GIL while the column is decoded. See `GetNextTrajectory`
+        // for why the status must be raised while holding the GIL.
+        {
+          py::gil_scoped_release g;
+          status = sample->GetColumn(i, &column);
+        }
+
+        MaybeRaiseFromStatus(status);
+        return AliasedTensor{std::move(column)};
+      });
+
+  py::class_<BatchIterator>(m, "BatchIterator")
+      .def("GetNext",
+           [](BatchIterator *iterator) {
+             absl::Status status;
+             std::vector<tensorflow::Tensor> batch;
+
+             // Release the GIL only when waiting for the batch. See
+             // `Sampler.GetNextTrajectory` for why the status must be raised
+             // while holding the GIL.
+             {
+               py::gil_scoped_release g;
+               status = iterator->GetNext(&batch);
+             }
+             MaybeRaiseFromStatus(status);
+
+             py::list capsules;
+             for (tensorflow::Tensor &tensor : batch) {
+               PyObject *capsule;
+               MaybeRaiseFromStatus(
+                   ToDLPackCapsule(std::move(tensor), &capsule));
+               capsules.append(py::reinterpret_steal<py::object>(capsule));
+             }
+             return capsules;
+           })
+      .def("Close", &BatchIterator::Close,
+           py::call_guard<py::gil_scoped_release>());
+
   py::class_<Client>(m, "Client")
       .def(py::init<std::string>(), py::arg("server_name"))
       .def(
@@ -647,16 +1132,55 @@ PYBIND11_MODULE(libpybind, m) {
       .def(
           "NewSampler",
           [](Client *client, const std::string &table, int64_t max_samples,
-             size_t buffer_size) {
+             size_t buffer_size, bool lazy_decoding) {
             std::unique_ptr<Sampler> sampler;
             Sampler::Options options;
             options.max_samples = max_samples;
             options.max_in_flight_samples_per_worker = buffer_size;
+            options.lazy_decoding = lazy_decoding;
             MaybeRaiseFromStatus(client->NewSamplerWithoutSignatureCheck(
                 table, options, &sampler));
             return sampler;
           },
-          py::call_guard<py::gil_scoped_release>())
+          py::call_guard<py::gil_scoped_release>(), py::arg("table"),
+          py::arg("max_samples"), py::arg("buffer_size"),
+          py::arg("lazy_decoding") = false)
+      .def(
+          "NewBatchIterator",
+          [](Client *client, const std::string &table, int batch_size,
+             int64_t max_samples, int num_workers,
+             int max_in_flight_samples_per_worker, int num_batching_threads,
+             int num_prefetched_batches) {
+            Sampler::Options sampler_options;
+            sampler_options.max_samples = max_samples;
+            sampler_options.num_workers = num_workers;
+            sampler_options.max_in_flight_samples_per_worker =
+                max_in_flight_samples_per_worker;
+
+            BatchIterator::Options options;
+            options.batch_size = batch_size;
+            options.num_batching_threads = num_batching_threads;
+            options.num_prefetched_batches = num_prefetched_batches;
+            MaybeRaiseFromStatus(options.Validate());
+
+            // Release the GIL only when creating the sampler. See
+            // `Sampler.GetNextTrajectory` for why the status must be raised
+            // while holding the GIL.
+            absl::Status status;
+            std::unique_ptr<Sampler> sampler;
+            {
+              py::gil_scoped_release g;
+              status = client->NewSamplerWithoutSignatureCheck(
+                  table, sampler_options, &sampler);
+            }
+            MaybeRaiseFromStatus(status);
+            return std::make_unique<BatchIterator>(std::move(sampler),
+                                                   options);
+          },
+          py::arg("table"),
+          py::arg("batch_size"), py::arg("max_samples"),
+          py::arg("num_workers"), py::arg("max_in_flight_samples_per_worker"),
+          py::arg("num_batching_threads"), py::arg("num_prefetched_batches"))
       .def("NewTrajectoryWriter",
            [](Client *client, std::shared_ptr<ChunkerOptions> chunker_options,
               absl::optional<int> get_signature_timeout_ms) {
@@ -682,6 +1206,18 @@ PYBIND11_MODULE(libpybind, m) {
              }
              MaybeRaiseFromStatus(status);
 
+             return writer.release();
+           })
+      .def("NewBatchedTrajectoryWriter",
+           [](Client *client, int num_envs,
+              std::shared_ptr<ChunkerOptions> chunker_options) {
+             std::unique_ptr<BatchedTrajectoryWriter> writer;
+
+             TrajectoryWriter::Options options;
+             options.chunker_options = std::move(chunker_options);
+             MaybeRaiseFromStatus(client->NewBatchedTrajectoryWriter(
+                 num_envs, options, &writer));
+
              return writer.release();
            })
       .def(
@@ -698,6 +1234,18 @@ PYBIND11_MODULE(libpybind, m) {
             return client->MutatePriorities(table, update_protos, deletes);
           },
           py::call_guard<py::gil_scoped_release>())
+      .def(
+          "DeleteEpisodes",
+          [](Client *client, const std::string &table,
+             const std::vector<uint64_t> &episode_ids) {
+            return client->DeleteEpisodes(table, episode_ids);
+          },
+          py::arg("table"), py::arg("episode_ids"),
+          py::call_guard<py::gil_scoped_release>())
+      .def("TransformPriorities", &Client::TransformPriorities,
+           py::arg("table"), py::arg("priority_scale"),
+           py::arg("priority_exponent"),
+           py::call_guard<py::gil_scoped_release>())
       .def("Reset", &Client::Reset, py::call_guard<py::gil_scoped_release>())
       .def("ServerInfo",
            [](Client *client, int timeout_sec) {
@@ -728,6 +1276,60 @@ PYBIND11_MODULE(libpybind, m) {
              }
              return serialized_table_info;
            })
+      .def("AsyncMutatePriorities",
+           [](py::object self, const std::string &table,
+              const std::vector<std::pair<uint64_t, double>> &updates,
+              const std::vector<uint64_t> &deletes, py::function callback) {
+             std::vector<KeyWithPriority> update_protos;
+             for (const auto &update : updates) {
+               update_protos.emplace_back();
+               update_protos.back().set_key(update.first);
+               update_protos.back().set_priority(update.second);
+             }
+             auto *client = self.cast<Client *>();
+             auto py_callback =
+                 MakePyCallback(std::move(self), std::move(callback));
+             py::gil_scoped_release g;
+             client->AsyncMutatePriorities(
+                 table, update_protos, deletes, absl::InfiniteDuration(),
+                 [py_callback](absl::Status status) {
+                   py::gil_scoped_acquire gil;
+                   InvokePyCallback(*py_callback, status, py::none());
+                 });
+           })
+      .def("AsyncReset",
+           [](py::object self, const std::string &table,
+              py::function callback) {
+             auto *client = self.cast<Client *>();
+             auto py_callback =
+                 MakePyCallback(std::move(self), std::move(callback));
+             py::gil_scoped_release g;
+             client->AsyncReset(table, [py_callback](absl::Status status) {
+               py::gil_scoped_acquire gil;
+               InvokePyCallback(*py_callback, status, py::none());
+             });
+           })
+      .def("AsyncServerInfo",
+           [](py::object self, int timeout_sec, py::function callback) {
+             auto timeout = timeout_sec > 0 ? absl::Seconds(timeout_sec)
+                                            : absl::InfiniteDuration();
+             auto *client = self.cast<Client *>();
+             auto py_callback =
+                 MakePyCallback(std::move(self), std::move(callback));
+             py::gil_scoped_release g;
+             client->AsyncServerInfo(
+                 timeout, [py_callback](absl::Status status,
+                                        struct Client::ServerInfo info) {
+                   py::gil_scoped_acquire gil;
+                   py::list serialized_table_info;
+                   for (const auto &table_info : info.table_info) {
+                     serialized_table_info.append(
+                         py::bytes(table_info.SerializeAsString()));
+                   }
+                   InvokePyCallback(*py_callback, status,
+                                    std::move(serialized_table_info));
+                 });
+           })
       .def("Checkpoint", [](Client *client) {
         std::string path;
         absl::Status status;
@@ -739,6 +1341,67 @@ PYBIND11_MODULE(libpybind, m) {
         return path;
       });
 
+  py::class_<ShardedClient>(m, "ShardedClient")
+      .def(py::init<std::vector<std::string>>(), py::arg("server_names"))
+      .def_property_readonly("num_shards", &ShardedClient::num_shards)
+      .def("ShardForKey", &ShardedClient::ShardForKey, py::arg("key"))
+      .def(
+          "NewSampler",
+          [](ShardedClient *client, const std::string &table,
+             int64_t max_samples, size_t buffer_size, int num_workers,
+             int timeout_sec) {
+            auto timeout = timeout_sec > 0 ? absl::Seconds(timeout_sec)
+                                           : absl::InfiniteDuration();
+            std::unique_ptr<Sampler> sampler;
+            Sampler::Options options;
+            options.max_samples = max_samples;
+            options.max_in_flight_samples_per_worker = buffer_size;
+            options.num_workers = num_workers;
+
+            absl::Status status;
+            {
+              py::gil_scoped_release g;
+              status = client->NewSampler(table, options, timeout, &sampler);
+            }
+            MaybeRaiseFromStatus(status);
+            return sampler;
+          },
+          py::arg("table"), py::arg("max_samples"), py::arg("buffer_size"),
+          py::arg("num_workers") = Sampler::kAutoSelectValue,
+          py::arg("timeout_sec") = -1)
+      .def(
+          "NewTrajectoryWriter",
+          [](ShardedClient *client,
+             std::shared_ptr<ChunkerOptions> chunker_options,
+             absl::optional<std::string> key,
+             absl::optional<std::string> least_loaded_table,
+             int timeout_sec) {
+            auto timeout = timeout_sec > 0 ? absl::Seconds(timeout_sec)
+                                           : absl::InfiniteDuration();
+            std::unique_ptr<TrajectoryWriter> writer;
+            TrajectoryWriter::Options options;
+            options.chunker_options = std::move(chunker_options);
+
+            absl::Status status;
+            if (key.has_value() == least_loaded_table.has_value()) {
+              status = absl::InvalidArgumentError(
+                  "Exactly one of `key` and `least_loaded_table` must be set.");
+            } else {
+              py::gil_scoped_release g;
+              status = key.has_value()
+                           ? client->NewTrajectoryWriter(*key, options, timeout,
+                                                         &writer)
+                           : client->NewTrajectoryWriterOnLeastLoadedShard(
+                                 *least_loaded_table, options, timeout,
+                                 &writer);
+            }
+            MaybeRaiseFromStatus(status);
+            return writer.release();
+          },
+          py::arg("chunker_options"), py::arg("key") = absl::nullopt,
+          py::arg("least_loaded_table") = absl::nullopt,
+          py::arg("timeout_sec") = -1);
+
   py::class_<Checkpointer, std::shared_ptr<Checkpointer>>(m, "Checkpointer")
       .def("__repr__", &Checkpointer::DebugString,
            py::call_guard<py::gil_scoped_release>());
@@ -753,6 +1416,28 @@ PYBIND11_MODULE(libpybind, m) {
       },
       py::call_guard<py::gil_scoped_release>());
 
+  m.def(
+      "create_streaming_checkpointer",
+      [](const std::string &root_dir, int64_t part_size_bytes,
+         int64_t max_buffered_bytes, bool deduplicate_chunks,
+         double min_live_fraction, bool lazy_restore,
+         absl::optional<std::string> fallback_checkpoint_path) {
+        StreamingCheckpointerOptions options;
+        options.part_size_bytes = part_size_bytes;
+        options.max_buffered_bytes = max_buffered_bytes;
+        options.deduplicate_chunks = deduplicate_chunks;
+        options.min_live_fraction = min_live_fraction;
+        options.lazy_restore = lazy_restore;
+        MaybeRaiseFromStatus(options.Validate());
+        return std::shared_ptr<Checkpointer>(
+            std::make_shared<StreamingCheckpointer>(
+                root_dir, options, std::move(fallback_checkpoint_path)));
+      },
+      py::arg("root_dir"), py::arg("part_size_bytes"),
+      py::arg("max_buffered_bytes"), py::arg("deduplicate_chunks"),
+      py::arg("min_live_fraction"), py::arg("lazy_restore"),
+      py::arg("fallback_checkpoint_path"));
+
   py::class_<Server, std::shared_ptr<Server>>(m, "Server")
       .def(
           py::init([](std::vector<std::shared_ptr<Table>> priority_tables,
@@ -767,6 +1452,31 @@ PYBIND11_MODULE(libpybind, m) {
           py::arg("checkpointer") = nullptr)
       .def("Stop", &Server::Stop, py::call_guard<py::gil_scoped_release>())
       .def("Wait", &Server::Wait, py::call_guard<py::gil_scoped_release>())
+      .def(
+          "ExportTable",
+          [](Server *server, const std::string &table_name,
+             const std::string &path, int num_shards) {
+            absl::Status status;
+            {
+              py::gil_scoped_release g;
+              status = server->ExportTable(table_name, path, num_shards);
+            }
+            MaybeRaiseFromStatus(status);
+          },
+          py::arg("table_name"), py::arg("path"), py::arg("num_shards") = 1)
+      .def(
+          "ImportTable",
+          [](Server *server, const std::string &path,
+             const std::string &table_name, int batch_size) {
+            absl::Status status;
+            {
+              py::gil_scoped_release g;
+              status = server->ImportTable(path, table_name, batch_size);
+            }
+            MaybeRaiseFromStatus(status);
+          },
+          py::arg("path"), py::arg("table_name"),
+          py::arg("batch_size") = kDefaultImportBatchSize)
       .def("__repr__", &Server::DebugString,
            py::call_guard<py::gil_scoped_release>());
 
@@ -867,8 +1577,15 @@ PYBIND11_MODULE(libpybind, m) {
   py::class_<AutoTunedChunkerOptions, ChunkerOptions,
              std::shared_ptr<AutoTunedChunkerOptions>>(
       m, "AutoTunedChunkerOptions")
-      .def(py::init<int, double>(), py::arg("num_keep_alive_refs"),
-           py::arg("throughput_weight"))
+      .def(py::init([](int num_keep_alive_refs, double throughput_weight,
+                       double cpu_weight, bool tune_delta_encode) {
+             return std::make_shared<AutoTunedChunkerOptions>(
+                 num_keep_alive_refs, throughput_weight,
+                 /*delta_encode=*/false, CompressionOptions(), cpu_weight,
+                 tune_delta_encode);
+           }),
+           py::arg("num_keep_alive_refs"), py::arg("throughput_weight"),
+           py::arg("cpu_weight") = 0.0, py::arg("tune_delta_encode") = false)
       .def("__eq__", [](AutoTunedChunkerOptions *self,
                         std::shared_ptr<AutoTunedChunkerOptions> other) {
         return self->GetNumKeepAliveRefs() == other->GetNumKeepAliveRefs();
@@ -879,9 +1596,10 @@ PYBIND11_MODULE(libpybind, m) {
       .def(
           "Append",
           [](TrajectoryWriter *writer,
-             std::vector<absl::optional<tensorflow::Tensor>> data) {
+             std::vector<absl::optional<AliasedTensor>> data) {
             std::vector<absl::optional<std::weak_ptr<CellRef>>> refs;
-            MaybeRaiseFromStatus(writer->Append(std::move(data), &refs));
+            MaybeRaiseFromStatus(
+                writer->Append(UnwrapAliasedTensors(std::move(data)), &refs));
 
             std::vector<absl::optional<std::shared_ptr<WeakCellRef>>> weak_refs(
                 refs.size());
@@ -899,9 +1617,10 @@ PYBIND11_MODULE(libpybind, m) {
       .def(
           "AppendPartial",
           [](TrajectoryWriter *writer,
-             std::vector<absl::optional<tensorflow::Tensor>> data) {
+             std::vector<absl::optional<AliasedTensor>> data) {
             std::vector<absl::optional<std::weak_ptr<CellRef>>> refs;
-            MaybeRaiseFromStatus(writer->AppendPartial(std::move(data), &refs));
+            MaybeRaiseFromStatus(writer->AppendPartial(
+                UnwrapAliasedTensors(std::move(data)), &refs));
 
             std::vector<absl::optional<std::shared_ptr<WeakCellRef>>> weak_refs(
                 refs.size());
@@ -973,6 +1692,99 @@ PYBIND11_MODULE(libpybind, m) {
            py::call_guard<py::gil_scoped_release>())
       .def("ConfigureChunker", &TrajectoryWriter::ConfigureChunker,
            py::call_guard<py::gil_scoped_release>());
+
+  py::class_<BatchedTrajectoryWriter, std::shared_ptr<BatchedTrajectoryWriter>>(
+      m, "BatchedTrajectoryWriter")
+      .def(
+          "Append",
+          [](BatchedTrajectoryWriter *writer,
+             std::vector<absl::optional<AliasedTensor>> py_data) {
+            auto data = UnwrapAliasedTensors(std::move(py_data));
+            // The GIL is released once for the whole batch rather than once
+            // per environment. `data` is copied (which only copies the tensor
+            // headers) so the ndarrays it aliases are released after the GIL
+            // has been reacquired.
+            std::vector<std::vector<absl::optional<std::weak_ptr<CellRef>>>>
+                refs;
+            absl::Status status;
+            {
+              py::gil_scoped_release g;
+              status = writer->Append(data, &refs);
+            }
+            MaybeRaiseFromStatus(status);
+
+            std::vector<
+                std::vector<absl::optional<std::shared_ptr<WeakCellRef>>>>
+                weak_refs(refs.size());
+            for (int env = 0; env < refs.size(); env++) {
+              weak_refs[env].reserve(refs[env].size());
+              for (auto &ref : refs[env]) {
+                if (ref.has_value()) {
+                  weak_refs[env].push_back(
+                      std::make_shared<WeakCellRef>(std::move(ref.value())));
+                } else {
+                  weak_refs[env].push_back(absl::nullopt);
+                }
+              }
+            }
+
+            return weak_refs;
+          })
+      .def(
+          "CreateItem",
+          [](BatchedTrajectoryWriter *writer, const std::string &table,
+             double priority,
+             std::vector<std::vector<std::shared_ptr<WeakCellRef>>>
+                 py_trajectory,
+             std::vector<bool> squeeze_column) {
+            if (py_trajectory.size() != squeeze_column.size()) {
+              MaybeRaiseFromStatus(absl::InternalError(
+                  "Length of py_trajectory and squeeze_column did not match."));
+              return;
+            }
+
+            std::vector<TrajectoryColumn> trajectory;
+            trajectory.reserve(py_trajectory.size());
+            for (int i = 0; i < py_trajectory.size(); i++) {
+              auto &py_column = py_trajectory[i];
+              std::vector<std::weak_ptr<CellRef>> column;
+              column.reserve(py_column.size());
+              for (auto &weak_ref : py_column) {
+                column.push_back(weak_ref->ref());
+              }
+              trajectory.push_back(
+                  TrajectoryColumn(std::move(column), squeeze_column[i]));
+            }
+            MaybeRaiseFromStatus(
+                writer->CreateItem(table, priority, trajectory));
+          })
+      .def("Flush",
+           [](BatchedTrajectoryWriter *writer, int ignore_last_num_items,
+              int timeout_ms) {
+             absl::Status status;
+             auto timeout = timeout_ms > 0 ? absl::Milliseconds(timeout_ms)
+                                           : absl::InfiniteDuration();
+             {
+               py::gil_scoped_release g;
+               status = writer->Flush(ignore_last_num_items, timeout);
+             }
+             MaybeRaiseFromStatus(status);
+           })
+      .def("EndEpisode",
+           [](BatchedTrajectoryWriter *writer, int env, bool clear_buffers) {
+             absl::Status status;
+             {
+               py::gil_scoped_release g;
+               status = writer->EndEpisode(env, clear_buffers);
+             }
+             MaybeRaiseFromStatus(status);
+           })
+      .def("Close", &BatchedTrajectoryWriter::Close,
+           py::call_guard<py::gil_scoped_release>())
+      .def("ConfigureChunker", &BatchedTrajectoryWriter::ConfigureChunker,
+           py::call_guard<py::gil_scoped_release>())
+      .def_property_readonly("num_envs", &BatchedTrajectoryWriter::num_envs)
+      .def("episode_step", &BatchedTrajectoryWriter::episode_step);
 }
 
 }  // namespace
@@ -1,5 +1,5 @@
 # LINT.IfChange
-from typing import List, Optional, Sequence, Any, Tuple
+from typing import Any, Callable, List, Optional, Sequence, Tuple
 
 import numpy as np
 
@@ -7,7 +7,12 @@ import numpy as np
 class ItemSelector: ...
 
 class PrioritizedSelector(ItemSelector):
-  def __init__(self, priority_exponent: float): ...
+  def __init__(self, priority_exponent: float,
+               batch_sampling: str = ...): ...
+
+
+class RecencyWeightedSelector(ItemSelector):
+  def __init__(self, priority_exponent: float, decay_seconds: float): ...
 
 
 class FifoSelector(ItemSelector):
@@ -26,12 +31,26 @@ class HeapSelector(ItemSelector):
   def __init__(self, min_heap: bool): ...
 
 
+class DaryHeapSelector(ItemSelector):
+  def __init__(self, min_heap: bool, arity: int = ...): ...
+
+
 class TableExtension: ...
 
 
+class ReplicationExtension(TableExtension):
+  def __init__(self, replica_addresses: Sequence[str],
+               max_items_per_request: int, max_attempts: int,
+               retry_delay_seconds: float): ...
+  def flush(self) -> None: ...
+  @property
+  def num_dropped_operations(self) -> int: ...
+
+
 class RateLimiter:
   def __init__(self, samples_per_insert: float, min_size_to_sample: int,
                min_diff: float, max_diff: float): ...
+  def share_for_shards(self, num_shards: int) -> 'RateLimiter': ...
 
 class Table:
   def __init__(self, name: str, sampler: ItemSelector, remover: ItemSelector,
@@ -41,6 +60,7 @@ class Table:
   def name(self) -> str: ...
   def can_sample(self, num_samples: int) -> bool: ...
   def can_insert(self, num_inserts: int) -> bool: ...
+  def set_snapshot_sampling(self, enabled: bool): ...
   def info(self) -> bytes: ...
 
 
@@ -66,13 +86,42 @@ class Client:
   def NewTrajectoryWriter(
       self, chunker_options,
       get_signature_timeout_ms: Optional[int]) -> TrajectoryWriter: ...
+  def NewBatchedTrajectoryWriter(
+      self, num_envs: int, chunker_options) -> BatchedTrajectoryWriter: ...
   def MutatePriorities(self, table: str, updates: Sequence[Tuple[int, float]],
                        deletes: Sequence[int]): ...
+  def DeleteEpisodes(self, table: str, episode_ids: Sequence[int]): ...
+  def TransformPriorities(self, table: str, priority_scale: float,
+                          priority_exponent: Optional[float]): ...
   def Reset(self, table: str): ...
   def ServerInfo(self, timeout_sec: int) -> Sequence[bytes]: ...
+  def AsyncMutatePriorities(
+      self, table: str, updates: Sequence[Tuple[int, float]],
+      deletes: Sequence[int],
+      callback: Callable[[Optional[Exception], None], None]): ...
+  def AsyncReset(
+      self, table: str,
+      callback: Callable[[Optional[Exception], None], None]): ...
+  def AsyncServerInfo(
+      self, timeout_sec: int,
+      callback: Callable[[Optional[Exception], Optional[Sequence[bytes]]],
+                         None]): ...
   def Checkpoint(self): ...
 
 
+class ShardedClient:
+  def __init__(self, server_names: Sequence[str]): ...
+  @property
+  def num_shards(self) -> int: ...
+  def ShardForKey(self, key: str) -> int: ...
+  def NewSampler(self, table: str, max_samples: int, buffer_size: int,
+                 num_workers: int = ..., timeout_sec: int = ...) -> Sampler: ...
+  def NewTrajectoryWriter(
+      self, chunker_options, key: Optional[str] = ...,
+      least_loaded_table: Optional[str] = ...,
+      timeout_sec: int = ...) -> TrajectoryWriter: ...
+
+
 class Checkpointer: ...
 
 
@@ -81,11 +130,19 @@ def create_default_checkpointer(
     fallback_checkpoint_path: Optional[str]) -> Checkpointer: ...
 
 
+def create_streaming_checkpointer(
+    root_dir: str, part_size_bytes: int, max_buffered_bytes: int,
+    deduplicate_chunks: bool, min_live_fraction: float, lazy_restore: bool,
+    fallback_checkpoint_path: Optional[str]) -> Checkpointer: ...
+
+
 class Server:
   def __init__(self, priority_tables: Sequence[Table], port: int,
                checkpointer: Optional[Checkpointer]): ...
   def Stop(self): ...
   def Wait(self): ...
+  def ExportTable(self, table_name: str, path: str, num_shards: int = ...): ...
+  def ImportTable(self, path: str, table_name: str, batch_size: int = ...): ...
 
 
 
@@ -107,7 +164,11 @@ class ConstantChunkerOptions(ChunkerOptions):
 
 
 class AutoTunedChunkerOptions:
-  def __init__(self, num_keep_alive_refs: int, throughput_weight: float): ...
+  def __init__(self,
+               num_keep_alive_refs: int,
+               throughput_weight: float,
+               cpu_weight: float = ...,
+               tune_delta_encode: bool = ...): ...
 
 
 class TrajectoryWriter:
@@ -123,4 +184,19 @@ class TrajectoryWriter:
   def EndEpisode(self, clear_buffers: bool, timeout_ms: Optional[int]): ...
   def Close(self): ...
   def ConfigureChunker(self, column: int, options: ChunkerOptions): ...
+
+
+class BatchedTrajectoryWriter:
+  num_envs: int
+  def Append(
+      self,
+      data: Sequence[Optional[Any]]) -> List[List[Optional[WeakCellRef]]]: ...
+  def CreateItem(self, table: str, priority: float,
+                 py_trajectory: Sequence[Sequence[WeakCellRef]],
+                 squeeze_column: Sequence[bool]): ...
+  def Flush(self, ignore_last_num_items: int, timeout_ms: int): ...
+  def EndEpisode(self, env: int, clear_buffers: bool): ...
+  def Close(self): ...
+  def ConfigureChunker(self, column: int, options: ChunkerOptions): ...
+  def episode_step(self, env: int) -> int: ...
 # LINT.ThenChange(pybind.cc)
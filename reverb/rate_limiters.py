@@ -32,6 +32,27 @@ class RateLimiter(metaclass=abc.ABCMeta):
   def __repr__(self):
     return repr(self.internal_limiter)
 
+  def share_for_shards(self, num_shards: int) -> 'RateLimiter':
+    """Returns the limiter to use on each shard of a sharded logical table.
+
+    Each of the `num_shards` servers hosting the table enforces a
+    `1 / num_shards` share of `min_size_to_sample` and of the error buffer, so
+    that together they approximate this limiter as long as items are spread
+    evenly across the shards.
+
+    Args:
+      num_shards: Number of servers the table is sharded across.
+
+    Returns:
+      A `RateLimiter` to pass to the `Table` of every shard.
+
+    Raises:
+      ValueError: If `num_shards` < 1.
+    """
+    if num_shards < 1:
+      raise ValueError(f'num_shards ({num_shards}) must be a positive integer')
+    return _ShardRateLimiter(self.internal_limiter.share_for_shards(num_shards))
+
 
 class MinSize(RateLimiter):
   """Block sample calls unless replay contains `min_size_to_sample`.
@@ -185,3 +206,7 @@ class Stack(RateLimiter):
             min_size_to_sample=1,
             min_diff=0.0,
             max_diff=size))
+
+
+class _ShardRateLimiter(RateLimiter):
+  """Share of a `RateLimiter` enforced by one shard of a sharded table."""
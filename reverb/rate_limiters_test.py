@@ -121,5 +121,21 @@ class TestMinSize(parameterized.TestCase):
       rate_limiters.MinSize(min_size_to_sample)
 
 
+class TestShareForShards(parameterized.TestCase):
+
+  def test_divides_min_size_and_error_buffer(self):
+    limiter = rate_limiters.SampleToInsertRatio(
+        samples_per_insert=2.0, min_size_to_sample=10, error_buffer=(-30, 50))
+    share = limiter.share_for_shards(4)
+    self.assertIsInstance(share, rate_limiters.RateLimiter)
+    self.assertIn('min_size_to_sample=3', repr(share))
+    self.assertIn('samples_per_insert=2', repr(share))
+
+  @parameterized.parameters(0, -1)
+  def test_raises_if_num_shards_lt_1(self, num_shards):
+    with self.assertRaises(ValueError):
+      rate_limiters.MinSize(1).share_for_shards(num_shards)
+
+
 if __name__ == '__main__':
   absltest.main()
@@ -15,6 +15,7 @@
 
 """Data structures for output of client samples."""
 
+import collections.abc
 from typing import Any, NamedTuple, Sequence, Union
 
 import numpy as np
@@ -56,3 +57,35 @@ class ReplaySample(NamedTuple):
   """
   info: SampleInfo
   data: Union[Sequence[np.ndarray], Any]
+
+
+class LazyColumns(collections.abc.Sequence):
+  """Flat data of a sample whose columns are decoded when first accessed.
+
+  Returned as the data of samples fetched with `Client.sample(...,
+  decode_lazily=True)`. Each column is decompressed (without holding the GIL)
+  the first time it is indexed and then kept, so columns which are never read
+  are never decoded.
+  """
+
+  def __init__(self, sample):
+    """Constructor of LazyColumns.
+
+    Args:
+      sample: `LazySample` returned by `Sampler.GetNextLazySample` of the
+        pybind module.
+    """
+    self._sample = sample
+    self._columns = [None] * sample.num_columns
+
+  def __len__(self) -> int:
+    return len(self._columns)
+
+  def __getitem__(self, index):
+    if isinstance(index, slice):
+      return [self[i] for i in range(*index.indices(len(self)))]
+    # Resolves negative indices and raises IndexError if out of range.
+    index = range(len(self))[index]
+    if self._columns[index] is None:
+      self._columns[index] = self._sample.GetColumn(index)
+    return self._columns[index]
@@ -73,6 +73,10 @@ class TableInfo:
   num_deleted_episodes: int
   num_unique_samples: int
   table_worker_time: schema_pb2.TableWorkerTime
+  num_bytes: int
+  max_bytes: int
+  latency_stats: schema_pb2.TableLatencyStats
+  sampling_weight: float
   # LINT.ThenChange(../../reverb/schema.proto)
 
   @classmethod
@@ -97,4 +101,8 @@ class TableInfo:
         num_deleted_episodes=proto.num_deleted_episodes,
         num_unique_samples=proto.num_unique_samples,
         table_worker_time=proto.table_worker_time,
+        num_bytes=proto.num_bytes,
+        max_bytes=proto.max_bytes,
+        latency_stats=proto.latency_stats,
+        sampling_weight=proto.sampling_weight,
         )
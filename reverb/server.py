@@ -52,6 +52,49 @@ class TableExtensionBase(metaclass=abc.ABCMeta):
     """Constructs the c++ PriorityTableExtensions."""
 
 
+class ReplicationExtension(TableExtensionBase):
+  """Replicates the table to the tables with the same name on other servers.
+
+  Inserts, priority updates, deletes and resets are forwarded asynchronously,
+  in order, to every replica. The replicas should be started with
+  `--reverb_primary_address` set to the address of this server so that the
+  priority mutations and resets they receive are applied here (and replicated
+  back) rather than diverging from the primary.
+  """
+
+  def __init__(self,
+               replica_addresses: Sequence[str],
+               max_items_per_request: int = 64,
+               max_attempts: int = 5,
+               retry_delay_seconds: float = 1.0):
+    """Constructor of the ReplicationExtension.
+
+    Args:
+      replica_addresses: Addresses of the servers to replicate the table to.
+      max_items_per_request: Maximum number of items sent to a replica in a
+        single request.
+      max_attempts: Number of times an operation is sent to a replica before it
+        is dropped.
+      retry_delay_seconds: Time to wait before retrying a failed operation.
+    """
+    self._replica_addresses = list(replica_addresses)
+    self._max_items_per_request = max_items_per_request
+    self._max_attempts = max_attempts
+    self._retry_delay_seconds = retry_delay_seconds
+
+  def build_internal_extensions(
+      self,
+      table_name: str,
+  ) -> Sequence[pybind.TableExtension]:
+    del table_name  # Replicas use the same table name.
+    return [
+        pybind.ReplicationExtension(self._replica_addresses,
+                                    self._max_items_per_request,
+                                    self._max_attempts,
+                                    self._retry_delay_seconds)
+    ]
+
+
 class Table:
   """Item collection with configurable strategies for insertion and sampling.
 
@@ -106,7 +149,8 @@ class Table:
                rate_limiter: rate_limiters.RateLimiter,
                max_times_sampled: int = 0,
                extensions: Sequence[TableExtensionBase] = (),
-               signature: Optional[reverb_types.SpecNest] = None):
+               signature: Optional[reverb_types.SpecNest] = None,
+               snapshot_sampling: bool = False):
     """Constructor of the Table.
 
     Args:
@@ -125,10 +169,16 @@ class Table:
         the table.
       signature: Optional nested structure containing `tf.TypeSpec` objects,
         describing the schema of items in this table.
+      snapshot_sampling: If True then samples are drawn from a snapshot of the
+        items without locking the table, and the rate limiter and
+        `max_times_sampled` are reconciled in batches. Items may therefore be
+        sampled a few times more than `max_times_sampled`. Only supported by
+        tables with a uniform sampler.
 
     Raises:
       ValueError: If name is empty.
       ValueError: If max_size <= 0.
+      ValueError: If snapshot_sampling is set but not supported by the sampler.
     """
     if not name:
       raise ValueError('name must be nonempty')
@@ -160,6 +210,8 @@ class Table:
         rate_limiter=rate_limiter.internal_limiter,
         extensions=internal_extensions,
         signature=signature_proto_str)
+    if snapshot_sampling:
+      self.internal_table.set_snapshot_sampling(True)
 
   @classmethod
   def queue(cls,
@@ -322,6 +374,46 @@ class Server:
     if self._server.Wait():
       raise KeyboardInterrupt
 
+  def export_table(self, table_name: str, path: str, num_shards: int = 1):
+    """Writes the items of a table, and the chunks they reference, to `path`.
+
+    The dataset is written to a new directory (as TFRecord files) and can be
+    loaded into a table of any server with `import_table`. The table remains
+    usable during the export, which is therefore not an atomic snapshot of it.
+
+    Args:
+      table_name: Name of the table to export.
+      path: Directory which the dataset is written to. Created if missing.
+      num_shards: Number of files which the chunks and the items are each split
+        into. The files are written in parallel.
+
+    Raises:
+      ValueError: If `num_shards` is not positive.
+      RuntimeError: If the server has no table named `table_name` or if the
+        dataset could not be written.
+    """
+    self._server.ExportTable(table_name, path, num_shards)
+
+  def import_table(self, path: str, table_name: str, batch_size: int = 1024):
+    """Inserts the items of a dataset written by `export_table` into a table.
+
+    Items keep their keys and priorities but start out unsampled. The rate
+    limiter of the table is respected so the call blocks until all items have
+    been inserted.
+
+    Args:
+      path: Directory of the dataset.
+      table_name: Name of the table which the items are inserted into.
+      batch_size: Number of items inserted into the table at a time.
+
+    Raises:
+      ValueError: If `batch_size` is not positive or if `path` does not hold a
+        complete dataset.
+      RuntimeError: If the server has no table named `table_name` or if the
+        dataset could not be read.
+    """
+    self._server.ImportTable(path, table_name, batch_size)
+
   def localhost_client(self):
     """Creates a client connect to the localhost channel."""
     return client.Client(f'localhost:{self._port}')
@@ -27,12 +27,13 @@ from reverb import item_selectors
 from reverb import pybind
 from reverb import rate_limiters
 from reverb import server
+from reverb.platform.default import checkpointers
 import tensorflow as tf
 
 TABLE_NAME = 'table'
 
 
-class ServerTest(absltest.TestCase):
+class ServerTest(parameterized.TestCase):
 
   def test_in_process_client(self):
     my_server = server.Server(
@@ -99,6 +100,114 @@ class ServerTest(absltest.TestCase):
     del my_client
     my_server.stop()
 
+  def test_snapshot_sampling(self):
+    table = server.Table(
+        name=TABLE_NAME,
+        sampler=item_selectors.Uniform(),
+        remover=item_selectors.Fifo(),
+        max_size=100,
+        rate_limiter=rate_limiters.MinSize(1),
+        snapshot_sampling=True)
+    my_server = server.Server(tables=[table], port=None)
+    my_client = my_server.localhost_client()
+    for i in range(3):
+      my_client.insert(i, {TABLE_NAME: 1.0})
+    samples = list(my_client.sample(TABLE_NAME, num_samples=10))
+    self.assertLen(samples, 10)
+    del my_client
+    my_server.stop()
+
+  def test_snapshot_sampling_requires_uniform_sampler(self):
+    with self.assertRaises(ValueError):
+      server.Table(
+          name=TABLE_NAME,
+          sampler=item_selectors.Prioritized(1),
+          remover=item_selectors.Fifo(),
+          max_size=100,
+          rate_limiter=rate_limiters.MinSize(1),
+          snapshot_sampling=True)
+
+  @parameterized.parameters(False, True)
+  def test_restores_tables_from_streaming_checkpointer(self, lazy_restore):
+    checkpointer = checkpointers.StreamingCheckpointer(
+        self.create_tempdir().full_path, lazy_restore=lazy_restore)
+
+    def make_server():
+      return server.Server(
+          tables=[
+              server.Table(
+                  name=TABLE_NAME,
+                  sampler=item_selectors.Uniform(),
+                  remover=item_selectors.Fifo(),
+                  max_size=100,
+                  rate_limiter=rate_limiters.MinSize(1)),
+          ],
+          port=None,
+          checkpointer=checkpointer)
+
+    my_server = make_server()
+    my_client = my_server.localhost_client()
+    for i in range(3):
+      my_client.insert(i, {TABLE_NAME: 1.0})
+    my_client.checkpoint()
+    del my_client
+    my_server.stop()
+
+    my_server = make_server()
+    my_client = my_server.localhost_client()
+    self.assertEqual(my_client.server_info()[TABLE_NAME].current_size, 3)
+    samples = list(my_client.sample(TABLE_NAME, num_samples=3))
+    self.assertLen(samples, 3)
+    del my_client
+    my_server.stop()
+
+  def test_export_and_import_table(self):
+    path = self.create_tempdir().full_path
+
+    def make_server():
+      return server.Server(
+          tables=[
+              server.Table(
+                  name=TABLE_NAME,
+                  sampler=item_selectors.Uniform(),
+                  remover=item_selectors.Fifo(),
+                  max_size=100,
+                  rate_limiter=rate_limiters.MinSize(1)),
+          ],
+          port=None)
+
+    my_server = make_server()
+    my_client = my_server.localhost_client()
+    for i in range(3):
+      my_client.insert(i, {TABLE_NAME: 1.0})
+    my_server.export_table(TABLE_NAME, path, num_shards=2)
+    del my_client
+    my_server.stop()
+
+    my_server = make_server()
+    my_server.import_table(path, TABLE_NAME)
+    my_client = my_server.localhost_client()
+    self.assertEqual(my_client.server_info()[TABLE_NAME].current_size, 3)
+    samples = list(my_client.sample(TABLE_NAME, num_samples=3))
+    self.assertLen(samples, 3)
+    del my_client
+    my_server.stop()
+
+  def test_export_table_raises_for_unknown_table(self):
+    my_server = server.Server(
+        tables=[
+            server.Table(
+                name=TABLE_NAME,
+                sampler=item_selectors.Uniform(),
+                remover=item_selectors.Fifo(),
+                max_size=100,
+                rate_limiter=rate_limiters.MinSize(1)),
+        ],
+        port=None)
+    with self.assertRaisesRegex(RuntimeError, 'was not found'):
+      my_server.export_table('missing', self.create_tempdir().full_path)
+    my_server.stop()
+
 
 class TableTest(parameterized.TestCase):
 
@@ -15,7 +15,7 @@
 
 """TFClient provides tf-ops for interacting with Reverb."""
 
-from typing import Any, Optional, Sequence
+from typing import Any, Optional, Sequence, Union
 
 from absl import logging
 from reverb import dataset
@@ -137,6 +137,40 @@ class TFClient:
       return gen_reverb_ops.reverb_client_update_priorities(
           self._handle, table, keys, priorities, name=scope)
 
+  def trajectory_writer(self,
+                        max_chunk_length: int,
+                        num_keep_alive_refs: int,
+                        delta_encode: bool = False,
+                        shared_name: Optional[str] = None,
+                        name: Optional[str] = None) -> 'TFTrajectoryWriter':
+    """Creates a writer which streams steps to the server from the graph.
+
+    Unlike `insert`, which creates a new writer and stream for every call, the
+    writer is kept open in a TF resource so consecutive steps share chunks and
+    uploads are pipelined, just like with `Client.trajectory_writer`.
+
+    Args:
+      max_chunk_length: Maximum number of steps in each chunk.
+      num_keep_alive_refs: Number of most recent steps of each column which
+        can be referenced by new items. Must be >= `max_chunk_length`.
+      delta_encode: If True then the chunks are delta encoded.
+      shared_name: (Optional) If non-empty, this writer will be shared under the
+        given name across multiple sessions.
+      name: Optional name for the writer operations.
+
+    Returns:
+      A `TFTrajectoryWriter`.
+    """
+    name = name or f'{self._name}_trajectory_writer'
+    return TFTrajectoryWriter(
+        gen_reverb_ops.reverb_trajectory_writer(
+            server_address=self._server_address,
+            max_chunk_length=max_chunk_length,
+            num_keep_alive_refs=num_keep_alive_refs,
+            delta_encode=delta_encode,
+            shared_name=shared_name,
+            name=name), name)
+
   def dataset(self,
               table: str,
               dtypes: Sequence[Any],
@@ -211,3 +245,95 @@ class TFClient:
         sequence_length=sequence_length,
         emit_timesteps=emit_timesteps,
         rate_limiter_timeout_ms=rate_limiter_timeout_ms)
+
+
+class TFTrajectoryWriter:
+  """Graph mode counterpart of `TrajectoryWriter` (see `TFClient`).
+
+  Steps are appended as (nested) structures of tensors which must keep the same
+  structure, dtypes and shapes throughout. Items reference the last steps of
+  the current episode (see `create_item`).
+  """
+
+  def __init__(self, handle: tf.Tensor, name: str):
+    self._handle = handle
+    self._name = name
+
+  def append(self, data: Any, name: Optional[str] = None):
+    """Creates op for appending a step to the writer.
+
+    Args:
+      data: (Nested structure of) tensors which make up the step.
+      name: Optional name for the operation.
+
+    Returns:
+      A tf-op for performing the append.
+    """
+    with tf.name_scope(name, f'{self._name}_append', ['append']) as scope:
+      return gen_reverb_ops.reverb_trajectory_writer_append(
+          self._handle, tree.flatten(data), name=scope)
+
+  def create_item(self,
+                  table: str,
+                  priority: Union[float, tf.Tensor],
+                  num_timesteps: Any,
+                  name: Optional[str] = None):
+    """Creates op for creating an item from the last steps of the episode.
+
+    Args:
+      table: Name of the table to insert the item into.
+      priority: Priority of the item.
+      num_timesteps: Number of most recent steps of the current episode which
+        the item covers. Either an int for all columns, or a structure matching
+        the appended steps with one int per column. Columns with 0 timesteps
+        are left out of the item.
+      name: Optional name for the operation.
+
+    Returns:
+      A tf-op for creating the item. The item is inserted asynchronously, use
+      `flush` to wait for it to be written.
+    """
+    if tree.is_nested(num_timesteps):
+      num_timesteps = tree.flatten(num_timesteps)
+
+    with tf.name_scope(name, f'{self._name}_create_item',
+                       ['create_item']) as scope:
+      return gen_reverb_ops.reverb_trajectory_writer_create_item(
+          self._handle,
+          table,
+          tf.cast(priority, tf.float64),
+          tf.cast(num_timesteps, tf.int32),
+          name=scope)
+
+  def flush(self, ignore_last_num_items: int = 0, name: Optional[str] = None):
+    """Creates op for waiting until the created items have been written.
+
+    Args:
+      ignore_last_num_items: Number of most recently created items which the op
+        does not wait for.
+      name: Optional name for the operation.
+
+    Returns:
+      A tf-op for performing the flush.
+    """
+    with tf.name_scope(name, f'{self._name}_flush', ['flush']) as scope:
+      return gen_reverb_ops.reverb_trajectory_writer_flush(
+          self._handle, ignore_last_num_items=ignore_last_num_items,
+          name=scope)
+
+  def end_episode(self, clear_buffers: bool = True,
+                  name: Optional[str] = None):
+    """Creates op for writing all pending items and starting a new episode.
+
+    Args:
+      clear_buffers: If True then the data of the steps which can no longer be
+        referenced is released.
+      name: Optional name for the operation.
+
+    Returns:
+      A tf-op for ending the episode.
+    """
+    with tf.name_scope(name, f'{self._name}_end_episode',
+                       ['end_episode']) as scope:
+      return gen_reverb_ops.reverb_trajectory_writer_end_episode(
+          self._handle, clear_buffers=clear_buffers, name=scope)
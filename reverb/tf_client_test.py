@@ -281,6 +281,56 @@ class InsertOpTest(tf.test.TestCase):
             np.array([1, 2, 3], dtype=np.int8), sample.data[0])
 
 
+
+class TrajectoryWriterOpTest(tf.test.TestCase):
+
+  @classmethod
+  def setUpClass(cls):
+    super().setUpClass()
+    cls._tables, cls._server = make_tables_and_server()
+    cls._client = reverb_client.Client(f'localhost:{cls._server.port}')
+
+  def tearDown(self):
+    super().tearDown()
+    self._client.reset('dist')
+
+  @classmethod
+  def tearDownClass(cls):
+    super().tearDownClass()
+    cls._server.stop()
+
+  def test_items_reference_last_steps_of_columns(self):
+    with self.session() as session:
+      client = tf_client.TFClient(self._client.server_address)
+      writer = client.trajectory_writer(
+          max_chunk_length=2, num_keep_alive_refs=3)
+      step = tf.placeholder(tf.int32, [2])
+      append_op = writer.append({'a': step, 'b': step * 10})
+      create_item_op = writer.create_item(
+          'dist', 1.0, num_timesteps={'a': 2, 'b': 1})
+      flush_op = writer.flush()
+
+      for i in range(3):
+        session.run(append_op, feed_dict={step: [i, i]})
+      session.run(create_item_op)
+      session.run(flush_op)
+
+    sample = next(self._client.sample('dist', emit_timesteps=False))
+    self.assertLen(sample.data, 2)
+    np.testing.assert_array_equal(sample.data[0], [[1, 1], [2, 2]])
+    np.testing.assert_array_equal(sample.data[1], [[20, 20]])
+
+  def test_items_only_reference_current_episode(self):
+    with self.session() as session:
+      client = tf_client.TFClient(self._client.server_address)
+      writer = client.trajectory_writer(
+          max_chunk_length=1, num_keep_alive_refs=2)
+      session.run(writer.append([tf.constant(1)]))
+      session.run(writer.end_episode())
+
+      with self.assertRaises(tf.errors.InvalidArgumentError):
+        session.run(writer.create_item('dist', 1.0, num_timesteps=1))
+
 if __name__ == '__main__':
   tf.disable_eager_execution()
   tf.test.main()
@@ -69,7 +69,10 @@ class TimestepDataset(tf.data.Dataset):
                num_workers_per_iterator: int = -1,
                max_samples_per_stream: int = -1,
                rate_limiter_timeout_ms: int = -1,
-               flexible_batch_size: int = -1):
+               flexible_batch_size: int = -1,
+               tf_data_autotune: bool = False,
+               window_length: Optional[int] = None,
+               window_shift: Optional[int] = None):
     """Constructs a new TimestepDataset.
 
     Args:
@@ -77,8 +80,10 @@ class TimestepDataset(tf.data.Dataset):
       table: Probability table to sample from.
       dtypes: Dtypes of the data output. Can be nested.
       shapes: Shapes of the data output. Can be nested.
-      max_in_flight_samples_per_worker: The number of samples requested in each
-        batch of samples. Higher values give higher throughput but too big
+      max_in_flight_samples_per_worker: The maximum number of samples requested
+        but not yet received by a worker. Every received sample is replaced by
+        a new request (in batches of half this value) so the stream is kept
+        busy. Higher values give higher throughput but too big
         values can result in skewed sampling distributions as large number of
         samples are fetched from single snapshot of the replay (followed by a
         period of lower activity as the samples are consumed). A good rule of
@@ -110,6 +115,21 @@ class TimestepDataset(tf.data.Dataset):
           a bias towards sampling over inserts. In highly overloaded systems
           this results in higher sample QPS and lower insert QPS compared to
           lower `flexible_batch_size` values.
+      tf_data_autotune: (Defaults to False) If True, tf.data's performance
+        model (see `tf.data.AUTOTUNE`) tunes how many of the
+        `num_workers_per_iterator` workers fetch samples and how many samples,
+        up to `max_in_flight_samples_per_worker`, each of them requests at a
+        time.
+      window_length: (Defaults to None: no windowing) If set, each element of
+        the dataset holds `window_length` consecutive timesteps of an item
+        stacked along a new leading dimension (including the fields of
+        `info`). The windows are assembled directly from the sampled chunks
+        which is cheaper than calling `.window()` or `.batch()` on the
+        dataset. Windows never span more than one item and the timesteps at
+        the end of an item which don't make up a complete window are dropped.
+      window_shift: (Defaults to None: `window_length`) The number of
+        timesteps between the starts of successive windows of the same item.
+        Requires `window_length` to be set.
 
     Raises:
       ValueError: If `dtypes` and `shapes` don't share the same structure.
@@ -119,6 +139,9 @@ class TimestepDataset(tf.data.Dataset):
       ValueError: If `max_samples_per_stream` is not a positive integer or -1.
       ValueError: If `rate_limiter_timeout_ms < -1`.
       ValueError: If `flexible_batch_size` is not a positive integer or -1.
+      ValueError: If `window_length` is not None or a positive integer.
+      ValueError: If `window_shift` is not None or a positive integer, or is
+        set without `window_length`.
     """
     tree.assert_same_structure(dtypes, shapes, False)
     if max_in_flight_samples_per_worker < 1:
@@ -140,6 +163,15 @@ class TimestepDataset(tf.data.Dataset):
       raise ValueError(
           'flexible_batch_size (%d) must be a positive integer or -1' %
           flexible_batch_size)
+    if window_length is not None and window_length < 1:
+      raise ValueError(
+          'window_length (%d) must be a positive integer or None' %
+          window_length)
+    if window_shift is not None and window_shift < 1:
+      raise ValueError(
+          'window_shift (%d) must be a positive integer or None' % window_shift)
+    if window_shift is not None and window_length is None:
+      raise ValueError('window_shift requires window_length to be set')
 
     # Add the info fields (all scalars).
     dtypes = replay_sample.ReplaySample(
@@ -166,6 +198,9 @@ class TimestepDataset(tf.data.Dataset):
     self._max_samples_per_stream = max_samples_per_stream
     self._rate_limiter_timeout_ms = rate_limiter_timeout_ms
     self._flexible_batch_size = flexible_batch_size
+    self._tf_data_autotune = tf_data_autotune
+    self._window_length = window_length
+    self._window_shift = window_shift
 
     if _is_tf1_runtime():
       # Disabling to avoid errors given the different tf.data.Dataset init args
@@ -186,7 +221,10 @@ class TimestepDataset(tf.data.Dataset):
                            max_samples_per_stream: int = -1,
                            rate_limiter_timeout_ms: int = -1,
                            get_signature_timeout_secs: Optional[int] = None,
-                           flexible_batch_size: int = -1):
+                           flexible_batch_size: int = -1,
+                           tf_data_autotune: bool = False,
+                           window_length: Optional[int] = None,
+                           window_shift: Optional[int] = None):
     """Constructs a TimestepDataset using the table's signature to infer specs.
 
     Note: The target `Table` must specify a signature that represents a single
@@ -204,6 +242,9 @@ class TimestepDataset(tf.data.Dataset):
         respond when fetching the table signature. By default no timeout is set
         and the call will block indefinitely if the server does not respond.
       flexible_batch_size: See __init__ for details.
+      tf_data_autotune: See __init__ for details.
+      window_length: See __init__ for details.
+      window_shift: See __init__ for details.
 
     Returns:
       TimestepDataset using the specs defined by the table signature to build
@@ -239,7 +280,10 @@ class TimestepDataset(tf.data.Dataset):
         num_workers_per_iterator=num_workers_per_iterator,
         max_samples_per_stream=max_samples_per_stream,
         rate_limiter_timeout_ms=rate_limiter_timeout_ms,
-        flexible_batch_size=flexible_batch_size)
+        flexible_batch_size=flexible_batch_size,
+        tf_data_autotune=tf_data_autotune,
+        window_length=window_length,
+        window_shift=window_shift)
 
   def _as_variant_tensor(self):
     return gen_reverb_ops.reverb_timestep_dataset(
@@ -251,14 +295,22 @@ class TimestepDataset(tf.data.Dataset):
         num_workers_per_iterator=self._num_workers_per_iterator,
         max_samples_per_stream=self._max_samples_per_stream,
         rate_limiter_timeout_ms=self._rate_limiter_timeout_ms,
-        flexible_batch_size=self._flexible_batch_size)
+        flexible_batch_size=self._flexible_batch_size,
+        tf_data_autotune=self._tf_data_autotune,
+        window_length=self._window_length or -1,
+        window_shift=self._window_shift or -1)
 
   def _inputs(self) -> List[Any]:
     return []
 
   @property
   def element_spec(self) -> Any:
-    return tree.map_structure(tf.TensorSpec, self._shapes, self._dtypes)
+    shapes = self._shapes
+    if self._window_length is not None:
+      shapes = tree.map_structure(
+          lambda s: tf.TensorShape([self._window_length]).concatenate(s),
+          shapes)
+    return tree.map_structure(tf.TensorSpec, shapes, self._dtypes)
 
 
 def _convert_lists_to_tuples(structure: Any) -> Any:
@@ -188,6 +188,27 @@ class TimestepDatasetTest(tf.test.TestCase, parameterized.TestCase):
           'flexible_batch_size': 0,
           'want_error': ValueError,
       },
+      {
+          'testcase_name': 'window_length_is_0',
+          'window_length': 0,
+          'want_error': ValueError,
+      },
+      {
+          'testcase_name': 'window_length_and_shift',
+          'window_length': 4,
+          'window_shift': 2,
+      },
+      {
+          'testcase_name': 'window_shift_is_0',
+          'window_length': 4,
+          'window_shift': 0,
+          'want_error': ValueError,
+      },
+      {
+          'testcase_name': 'window_shift_without_window_length',
+          'window_shift': 2,
+          'want_error': ValueError,
+      },
   )
   def test_sampler_parameter_validation(self, **kwargs):
     dtypes = (tf.float32,)
@@ -441,6 +462,32 @@ class TimestepDatasetTest(tf.test.TestCase, parameterized.TestCase):
       np.testing.assert_array_equal(sample.data[0],
                                     np.zeros((2, 3, 3), dtype=np.float32))
 
+  def test_iterate_windows(self):
+    with self._client.writer(10) as writer:
+      for i in range(10):
+        writer.append([np.full((3, 3), i, dtype=np.float32)])
+      writer.create_item(table='dist', num_timesteps=10, priority=1)
+
+    dataset = timestep_dataset.TimestepDataset(
+        self._client.server_address,
+        table='dist',
+        dtypes=(tf.float32,),
+        shapes=(tf.TensorShape([3, 3]),),
+        max_in_flight_samples_per_worker=1,
+        num_workers_per_iterator=1,
+        window_length=4,
+        window_shift=3)
+    self.assertEqual(dataset.element_spec.info.key.shape, [4])
+    self.assertEqual(dataset.element_spec.data[0].shape, [4, 3, 3])
+
+    # The last timestep of the item doesn't make up a complete window.
+    for sample in self._sample_from(dataset, 6):
+      self.assertEqual(sample.info.key.shape, (4,))
+      self.assertIn(sample.data[0][0, 0, 0], (0, 3, 6))
+      np.testing.assert_array_equal(
+          sample.data[0][:, 0, 0],
+          np.arange(4, dtype=np.float32) + sample.data[0][0, 0, 0])
+
   def test_iterate_nested_and_batched(self):
     with self._client.writer(100) as writer:
       for i in range(1000):
@@ -19,7 +19,7 @@ changes may occur without notice. Please talk to cassirer@ if you wish to alpha
 test these features.
 """
 
-from typing import Any, List, Optional, Union
+from typing import Any, List, Optional, Sequence, Union
 
 from reverb import client as reverb_client
 from reverb import replay_sample
@@ -48,7 +48,12 @@ class TrajectoryDataset(tf.data.Dataset):
                num_workers_per_iterator: int = -1,
                max_samples_per_stream: int = -1,
                rate_limiter_timeout_ms: int = -1,
-               flexible_batch_size: int = -1):
+               flexible_batch_size: int = -1,
+               batch_size: Optional[int] = None,
+               share_sampler: bool = False,
+               pin_output_memory: bool = False,
+               columns: Optional[Sequence[int]] = None,
+               tf_data_autotune: bool = False):
     """Constructs a new TrajectoryDataset.
 
     Args:
@@ -56,8 +61,10 @@ class TrajectoryDataset(tf.data.Dataset):
       table: Probability table to sample from.
       dtypes: Dtypes of the data output. Can be nested.
       shapes: Shapes of the data output. Can be nested.
-      max_in_flight_samples_per_worker: The number of samples requested in each
-        batch of samples. Higher values give higher throughput but too big
+      max_in_flight_samples_per_worker: The maximum number of samples requested
+        but not yet received by a worker. Every received sample is replaced by
+        a new request (in batches of half this value) so the stream is kept
+        busy. Higher values give higher throughput but too big
         values can result in skewed sampling distributions as large number of
         samples are fetched from single snapshot of the replay (followed by a
         period of lower activity as the samples are consumed). A good rule of
@@ -89,6 +96,31 @@ class TrajectoryDataset(tf.data.Dataset):
           a bias towards sampling over inserts. In highly overloaded systems
           this results in higher sample QPS and lower insert QPS compared to
           lower `flexible_batch_size` values.
+      batch_size: (Defaults to None: no batching) If set, each element of the
+        dataset holds `batch_size` trajectories stacked along a new leading
+        dimension (including the fields of `info`). The batch tensors are
+        allocated once and filled directly from the sampled chunks which is
+        cheaper than calling `.batch(batch_size)` on the unbatched dataset. All
+        trajectories of a batch must have the same shapes.
+      share_sampler: (Defaults to False) If True, all iterators in the process
+        which sample from the same server and table with the same arguments
+        share a single sampler instead of each opening
+        `num_workers_per_iterator` streams of their own. This keeps the number
+        of streams to the server constant when the dataset is interleaved or
+        replicated. Cancelling any of the iterators closes the shared sampler.
+      pin_output_memory: (Defaults to False) If True, the output tensors are
+        allocated in host memory which is pinned for the accelerators (when
+        available) so they can be copied to the device asynchronously without
+        an intermediate staging copy.
+      columns: [EXPERIMENTAL] (Defaults to None, i.e. all columns) Indices of
+        the flattened trajectory columns to sample, in output order. Only the
+        data of the selected columns is sent by the server. `dtypes` and
+        `shapes` must describe the selected columns only.
+      tf_data_autotune: (Defaults to False) If True, tf.data's performance
+        model (see `tf.data.AUTOTUNE`) tunes how many of the
+        `num_workers_per_iterator` workers fetch samples and how many samples,
+        up to `max_in_flight_samples_per_worker`, each of them requests at a
+        time. Cannot be combined with `share_sampler`.
 
     Raises:
       ValueError: If `dtypes` and `shapes` don't share the same structure.
@@ -98,6 +130,9 @@ class TrajectoryDataset(tf.data.Dataset):
       ValueError: If `max_samples_per_stream` is not a positive integer or -1.
       ValueError: If `rate_limiter_timeout_ms < -1`.
       ValueError: If `flexible_batch_size` is not a positive integer or -1.
+      ValueError: If `batch_size` is not None or a positive integer.
+      ValueError: If `columns` contains negative indices.
+      ValueError: If both `share_sampler` and `tf_data_autotune` are True.
     """
     tree.assert_same_structure(dtypes, shapes, False)
     if max_in_flight_samples_per_worker < 1:
@@ -119,6 +154,14 @@ class TrajectoryDataset(tf.data.Dataset):
       raise ValueError(
           'flexible_batch_size (%d) must be a positive integer or -1' %
           flexible_batch_size)
+    if batch_size is not None and batch_size < 1:
+      raise ValueError(
+          'batch_size (%d) must be a positive integer or None' % batch_size)
+    if columns is not None and any(column < 0 for column in columns):
+      raise ValueError('columns (%s) must be non-negative' % list(columns))
+    if share_sampler and tf_data_autotune:
+      raise ValueError(
+          'share_sampler and tf_data_autotune cannot both be True')
 
     # Add the info fields (all scalars).
     dtypes = replay_sample.ReplaySample(
@@ -145,6 +188,11 @@ class TrajectoryDataset(tf.data.Dataset):
     self._max_samples_per_stream = max_samples_per_stream
     self._rate_limiter_timeout_ms = rate_limiter_timeout_ms
     self._flexible_batch_size = flexible_batch_size
+    self._batch_size = batch_size
+    self._share_sampler = share_sampler
+    self._pin_output_memory = pin_output_memory
+    self._columns = list(columns) if columns else []
+    self._tf_data_autotune = tf_data_autotune
 
     if _is_tf1_runtime():
       # Disabling to avoid errors given the different tf.data.Dataset init args
@@ -165,7 +213,12 @@ class TrajectoryDataset(tf.data.Dataset):
                            max_samples_per_stream: int = -1,
                            rate_limiter_timeout_ms: int = -1,
                            get_signature_timeout_secs: Optional[int] = None,
-                           flexible_batch_size: int = -1):
+                           flexible_batch_size: int = -1,
+                           batch_size: Optional[int] = None,
+                           share_sampler: bool = False,
+                           pin_output_memory: bool = False,
+                           columns: Optional[Sequence[int]] = None,
+                           tf_data_autotune: bool = False):
     """Constructs a TrajectoryDataset using the table's signature to infer specs.
 
     Note: The target `Table` must specify a signature which represent the entire
@@ -183,6 +236,12 @@ class TrajectoryDataset(tf.data.Dataset):
         respond when fetching the table signature. By default no timeout is set
         and the call will block indefinitely if the server does not respond.
       flexible_batch_size: See __init__ for details.
+      batch_size: See __init__ for details.
+      share_sampler: See __init__ for details.
+      pin_output_memory: See __init__ for details.
+      columns: See __init__ for details. When set, the dataset outputs a tuple
+        with the selected leaves of the flattened signature.
+      tf_data_autotune: See __init__ for details.
 
     Returns:
       TrajectoryDataset using the specs defined by the table signature to build
@@ -208,6 +267,15 @@ class TrajectoryDataset(tf.data.Dataset):
 
     shapes = tree.map_structure(lambda x: x.shape, info[table].signature)
     dtypes = tree.map_structure(lambda x: x.dtype, info[table].signature)
+    if columns:
+      flat_shapes = tree.flatten(shapes)
+      flat_dtypes = tree.flatten(dtypes)
+      if any(column >= len(flat_shapes) for column in columns):
+        raise ValueError(
+            f'columns ({list(columns)}) must be smaller than the number of '
+            f'columns in the signature of table {table} ({len(flat_shapes)}).')
+      shapes = tuple(flat_shapes[column] for column in columns)
+      dtypes = tuple(flat_dtypes[column] for column in columns)
 
     return cls(
         server_address=server_address,
@@ -218,7 +286,12 @@ class TrajectoryDataset(tf.data.Dataset):
         num_workers_per_iterator=num_workers_per_iterator,
         max_samples_per_stream=max_samples_per_stream,
         rate_limiter_timeout_ms=rate_limiter_timeout_ms,
-        flexible_batch_size=flexible_batch_size)
+        flexible_batch_size=flexible_batch_size,
+        batch_size=batch_size,
+        share_sampler=share_sampler,
+        pin_output_memory=pin_output_memory,
+        columns=columns,
+        tf_data_autotune=tf_data_autotune)
 
   def _as_variant_tensor(self):
     return gen_reverb_ops.reverb_trajectory_dataset(
@@ -230,14 +303,23 @@ class TrajectoryDataset(tf.data.Dataset):
         num_workers_per_iterator=self._num_workers_per_iterator,
         max_samples_per_stream=self._max_samples_per_stream,
         rate_limiter_timeout_ms=self._rate_limiter_timeout_ms,
-        flexible_batch_size=self._flexible_batch_size)
+        flexible_batch_size=self._flexible_batch_size,
+        batch_size=self._batch_size or -1,
+        share_sampler=self._share_sampler,
+        pin_output_memory=self._pin_output_memory,
+        columns=self._columns,
+        tf_data_autotune=self._tf_data_autotune)
 
   def _inputs(self) -> List[Any]:
     return []
 
   @property
   def element_spec(self) -> Any:
-    return tree.map_structure(tf.TensorSpec, self._shapes, self._dtypes)
+    shapes = self._shapes
+    if self._batch_size is not None:
+      shapes = tree.map_structure(
+          lambda s: tf.TensorShape([self._batch_size]).concatenate(s), shapes)
+    return tree.map_structure(tf.TensorSpec, shapes, self._dtypes)
 
 
 def _convert_lists_to_tuples(structure: Any) -> Any:
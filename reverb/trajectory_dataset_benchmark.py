@@ -0,0 +1,146 @@
+# Copyright 2019 DeepMind Technologies Limited.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+"""Benchmarks of iterating over a `TrajectoryDataset`.
+
+Every benchmark samples from a uniform table of 1000 items, written to a server
+running in the same process, and sweeps one of the number of workers, the
+flexible batch size, the sequence length and the number of (float32[64])
+columns. The wall time of a batch of `BATCH_SIZE` samples is reported, along
+with `samples_per_second` and (decompressed) `bytes_per_second`. Run with:
+
+  bazel run -c opt //reverb:trajectory_dataset_benchmark -- --benchmarks=.
+
+The throughput of the `Sampler` on its own is measured by
+`//reverb/cc/benchmarks:sampler_benchmark`.
+"""
+
+import time
+
+import numpy as np
+from reverb import client
+from reverb import item_selectors
+from reverb import rate_limiters
+from reverb import server as reverb_server
+from reverb import trajectory_dataset
+import tensorflow.compat.v1 as tf
+
+TABLE = 'benchmark'
+NUM_ITEMS = 1000
+COLUMN_SIZE = 64
+BATCH_SIZE = 64
+NUM_WARMUP_BATCHES = 10
+NUM_BATCHES = 100
+
+DEFAULTS = {
+    'num_workers': 4,
+    'flexible_batch_size': 16,
+    'sequence_length': 10,
+    'num_columns': 4,
+}
+
+
+def make_server(sequence_length, num_columns):
+  """Starts a server with a table of `NUM_ITEMS` trajectories."""
+  signature = {
+      f'column_{i}': tf.TensorSpec([sequence_length, COLUMN_SIZE], tf.float32)
+      for i in range(num_columns)
+  }
+  server = reverb_server.Server(tables=[
+      reverb_server.Table(
+          name=TABLE,
+          sampler=item_selectors.Uniform(),
+          remover=item_selectors.Fifo(),
+          max_size=NUM_ITEMS,
+          rate_limiter=rate_limiters.MinSize(1),
+          signature=signature),
+  ])
+
+  reverb_client = client.Client(f'localhost:{server.port}')
+  # The columns change smoothly over time so that they compress somewhat.
+  times = np.arange(NUM_ITEMS + sequence_length, dtype=np.float32)
+  offsets = np.arange(COLUMN_SIZE, dtype=np.float32)
+  steps = np.sin(times[:, None] * 0.01 + offsets * 0.1)
+  with reverb_client.trajectory_writer(sequence_length) as writer:
+    for i, step in enumerate(steps):
+      writer.append({f'column_{c}': step + c for c in range(num_columns)})
+      if i + 1 >= sequence_length:
+        writer.create_item(TABLE, 1.0, {
+            f'column_{c}': writer.history[f'column_{c}'][-sequence_length:]
+            for c in range(num_columns)
+        })
+  return server
+
+
+class TrajectoryDatasetBenchmark(tf.test.Benchmark):
+
+  def _run(self, name, num_workers, flexible_batch_size, sequence_length,
+           num_columns):
+    server = make_server(sequence_length, num_columns)
+    try:
+      with tf.Graph().as_default():
+        dataset = trajectory_dataset.TrajectoryDataset.from_table_signature(
+            server_address=f'localhost:{server.port}',
+            table=TABLE,
+            max_in_flight_samples_per_worker=2 * BATCH_SIZE,
+            num_workers_per_iterator=num_workers,
+            flexible_batch_size=flexible_batch_size)
+        dataset = dataset.batch(BATCH_SIZE, drop_remainder=True)
+        batch = tf.data.make_one_shot_iterator(dataset).get_next().data
+        with tf.Session() as session:
+          for _ in range(NUM_WARMUP_BATCHES):
+            session.run(batch)
+          start = time.time()
+          for _ in range(NUM_BATCHES):
+            session.run(batch)
+          wall_time = time.time() - start
+    finally:
+      server.stop()
+
+    num_samples = NUM_BATCHES * BATCH_SIZE
+    sample_bytes = num_columns * sequence_length * COLUMN_SIZE * 4
+    self.report_benchmark(
+        iters=NUM_BATCHES,
+        wall_time=wall_time / NUM_BATCHES,
+        extras={
+            'samples_per_second': num_samples / wall_time,
+            'bytes_per_second': num_samples * sample_bytes / wall_time,
+        },
+        name=(f'{name}_workers_{num_workers}_batch_{flexible_batch_size}'
+              f'_length_{sequence_length}_columns_{num_columns}'))
+
+  def benchmark_num_workers(self):
+    for num_workers in (1, 4, 16):
+      self._run('num_workers', **dict(DEFAULTS, num_workers=num_workers))
+
+  def benchmark_flexible_batch_size(self):
+    for flexible_batch_size in (1, 16, 64):
+      self._run(
+          'flexible_batch_size',
+          **dict(DEFAULTS, flexible_batch_size=flexible_batch_size))
+
+  def benchmark_sequence_length(self):
+    for sequence_length in (1, 10, 100):
+      self._run('sequence_length',
+                **dict(DEFAULTS, sequence_length=sequence_length))
+
+  def benchmark_num_columns(self):
+    for num_columns in (1, 8, 32):
+      self._run('num_columns', **dict(DEFAULTS, num_columns=num_columns))
+
+
+if __name__ == '__main__':
+  tf.disable_eager_execution()
+  tf.test.main()
@@ -149,6 +149,34 @@ class TrajectoryDatasetTest(tf.test.TestCase, parameterized.TestCase):
           'flexible_batch_size': 0,
           'want_error': ValueError,
       },
+      {
+          'testcase_name': 'batch_size_is_0',
+          'batch_size': 0,
+          'want_error': ValueError,
+      },
+      {
+          'testcase_name': 'batch_size_is_2',
+          'batch_size': 2,
+      },
+      {
+          'testcase_name': 'pin_output_memory',
+          'pin_output_memory': True,
+      },
+      {
+          'testcase_name': 'columns_is_negative',
+          'columns': [-1],
+          'want_error': ValueError,
+      },
+      {
+          'testcase_name': 'tf_data_autotune',
+          'tf_data_autotune': True,
+      },
+      {
+          'testcase_name': 'tf_data_autotune_with_share_sampler',
+          'tf_data_autotune': True,
+          'share_sampler': True,
+          'want_error': ValueError,
+      },
   )
   def test_sampler_parameter_validation(self, **kwargs):
     if 'max_in_flight_samples_per_worker' not in kwargs:
@@ -193,6 +221,68 @@ class TrajectoryDatasetTest(tf.test.TestCase, parameterized.TestCase):
             ),
             data=SHAPES))
 
+  def test_sample_batched_fixed_length_trajectory(self):
+    self._populate_replay()
+
+    dataset = trajectory_dataset.TrajectoryDataset(
+        tf.constant(self._client.server_address),
+        table=tf.constant(TABLE),
+        dtypes=DTYPES,
+        shapes=SHAPES,
+        max_in_flight_samples_per_worker=4,
+        flexible_batch_size=1,
+        batch_size=4)
+
+    self.assertEqual(dataset.element_spec.info.key.shape, [4])
+    self.assertEqual(dataset.element_spec.data['observation'].shape,
+                     [4, 1, 3, 3])
+
+    sample = self._sample_from(dataset, 1)[0]
+    self.assertEqual(sample.info.key.shape, (4,))
+    self.assertEqual(sample.info.probability.shape, (4,))
+    self.assertEqual(sample.data['observation'].shape, (4, 1, 3, 3))
+    self.assertEqual(sample.data['reward'].shape, (4,))
+    np.testing.assert_array_equal(sample.data['observation'],
+                                  np.ones([4, 1, 3, 3], np.float32))
+    np.testing.assert_array_equal(sample.data['reward'], [3, 3, 3, 3])
+
+  def test_iterators_share_sampler(self):
+    self._populate_replay()
+
+    dataset = trajectory_dataset.TrajectoryDataset(
+        tf.constant(self._client.server_address),
+        table=tf.constant(TABLE),
+        dtypes=DTYPES,
+        shapes=SHAPES,
+        max_in_flight_samples_per_worker=1,
+        flexible_batch_size=1,
+        share_sampler=True)
+
+    # Both iterators pull from the same sampler and see the same structure.
+    first = self._sample_from(dataset, 2)
+    second = self._sample_from(dataset, 2)
+    for sample in first + second:
+      np.testing.assert_array_equal(sample.data['observation'],
+                                    np.ones([1, 3, 3], np.float32))
+      self.assertEqual(sample.data['reward'], 3)
+
+  def test_sample_with_tf_data_autotune(self):
+    self._populate_replay()
+
+    dataset = trajectory_dataset.TrajectoryDataset(
+        tf.constant(self._client.server_address),
+        table=tf.constant(TABLE),
+        dtypes=DTYPES,
+        shapes=SHAPES,
+        max_in_flight_samples_per_worker=4,
+        num_workers_per_iterator=2,
+        tf_data_autotune=True)
+
+    for sample in self._sample_from(dataset, 5):
+      np.testing.assert_array_equal(sample.data['observation'],
+                                    np.ones([1, 3, 3], np.float32))
+      self.assertEqual(sample.data['reward'], 3)
+
   def test_sample_variable_length_trajectory(self):
     with self._client.trajectory_writer(10) as writer:
       for i in range(10):
@@ -287,6 +377,24 @@ class FromTableSignatureTest(tf.test.TestCase):
         f'localhost:{server.port}', 'queue', 100)
     self.assertDictEqual(dataset.element_spec.data, signature)
 
+  def test_selects_columns_from_signature(self):
+    signature = {
+        'a': {
+            'b': tf.TensorSpec([3, 3], tf.float32),
+            'c': tf.TensorSpec([], tf.int64),
+        },
+        'x': tf.TensorSpec([None], tf.uint64),
+    }
+
+    server = reverb_server.Server(
+        [reverb_server.Table.queue('queue', 10, signature=signature)])
+
+    dataset = trajectory_dataset.TrajectoryDataset.from_table_signature(
+        f'localhost:{server.port}', 'queue', 100, columns=[2, 0])
+    self.assertEqual(dataset.element_spec.data,
+                     (tf.TensorSpec([None], tf.uint64),
+                      tf.TensorSpec([3, 3], tf.float32)))
+
   def test_sets_dtypes_from_bounded_spec_signature(self):
     bounded_spec_signature = {
         'a': {
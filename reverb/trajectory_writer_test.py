@@ -448,6 +448,20 @@ class TrajectoryColumnTest(parameterized.TestCase):
           writer.history['b'][:].numpy(),
           np.stack([np.ones([3, 3], np.float) * x for x in range(i + 1)]))
 
+  def test_numpy_modified_after_append(self):
+    writer = self.client.trajectory_writer(num_keep_alive_refs=10)
+
+    # The array is reused between steps so the data of every step must be
+    # copied by the writer before `append` returns.
+    data = np.zeros([64, 64], np.float32)
+    for i in range(3):
+      data[:] = i
+      writer.append({'a': data})
+
+    np.testing.assert_array_equal(
+        writer.history['a'][:].numpy(),
+        np.stack([np.full([64, 64], x, np.float32) for x in range(3)]))
+
   def test_numpy_squeeze(self):
     writer = self.client.trajectory_writer(num_keep_alive_refs=10)
 